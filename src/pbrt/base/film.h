@@ -11,11 +11,15 @@
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/taggedptr.h>
 
+#include <functional>
 #include <string>
 
 namespace pbrt {
 
 class VisibleSurface;
+enum class AOVFlags;
+struct AOVSample;
+struct PixelCostSample;
 class RGBFilm;
 class GBufferFilm;
 class PixelSensor;
@@ -41,7 +45,43 @@ class FilmHandle : public TaggedPointer<RGBFilm, GBufferFilm> {
     PBRT_CPU_GPU inline Bounds2i PixelBounds() const;
     PBRT_CPU_GPU inline Float Diagonal() const;
 
+    void FlushSplats();
+
+    // Samples that the calling thread adds inside _tileBounds_ between
+    // these calls may be accumulated locally and added to the film's
+    // pixels when the tile ends.
+    void BeginTile(const Bounds2i &tileBounds);
+    void EndTile();
+    // Streaming films write finished tiles to disk as they go; they don't
+    // support splats or access to the image before rendering finishes.
+    bool IsStreaming() const;
+
+    // Returns the AOVs the film writes; integrators that support them call
+    // AddAOVSample() after AddSample() for each camera sample.
+    AOVFlags RequestedAOVs() const;
+    void AddAOVSample(const Point2i &pFilm, const AOVSample &aov,
+                      const SampledWavelengths &lambda, Float weight);
+    // Records the work done for a camera sample if the cost AOV was
+    // requested.
+    PBRT_CPU_GPU
+    void AddCostSample(const Point2i &pFilm, const PixelCostSample &cost);
+
+    // Save and restore the film's accumulated values for render
+    // checkpoints; both must be called between waves of samples.
+    std::string SaveState() const;
+    void RestoreState(const std::string &state);
+    // Save the values of the pixels in _bounds_ and add saved values to
+    // the film's, for merging films rendered separately.
+    std::string SaveState(const Bounds2i &bounds) const;
+    void MergeState(const std::string &state, const Bounds2i &bounds);
+    void ResetPixels(const Bounds2i &bounds);
+
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
+    // Computes the film's final pixel values and returns a function that
+    // writes them as WriteImage() would. The function doesn't access the
+    // film, so it may run on another thread while rendering continues.
+    std::function<void()> PrepareImageWrite(ImageMetadata metadata,
+                                            Float splatScale = 1);
 
     PBRT_CPU_GPU inline RGB ToOutputRGB(const SampledSpectrum &L,
                                         const SampledWavelengths &lambda) const;
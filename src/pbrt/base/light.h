@@ -27,6 +27,7 @@ class DistantLight;
 class ProjectionLight;
 class GoniometricLight;
 class DiffuseAreaLight;
+class TriangleLight;
 class UniformInfiniteLight;
 class ImageInfiniteLight;
 class PortalImageInfiniteLight;
@@ -38,10 +39,14 @@ class CompactLightBounds;
 struct LightLiSample;
 struct LightLeSample;
 
+// Lights can be assigned to at most this many light groups, which
+// GBufferFilm can write as separate images.
+static constexpr int MaxLightGroups = 8;
+
 // LightHandle Definition
 class LightHandle : public TaggedPointer<  // Light Source Types
                         PointLight, DistantLight, ProjectionLight, GoniometricLight,
-                        SpotLight, DiffuseAreaLight, UniformInfiniteLight,
+                        SpotLight, DiffuseAreaLight, TriangleLight, UniformInfiniteLight,
                         ImageInfiniteLight, PortalImageInfiniteLight
 
                         > {
@@ -61,11 +66,24 @@ class LightHandle : public TaggedPointer<  // Light Source Types
                                   const MediumInterface &mediumInterface,
                                   const ShapeHandle shape, const FileLoc *loc,
                                   Allocator alloc);
+    // Returns area lights for all of _shapes_, which share a single light if
+    // they are the triangles of a mesh.
+    static pstd::vector<LightHandle> CreateAreaLights(
+        const std::string &name, const ParameterDictionary &parameters,
+        const Transform &renderFromLight, const MediumInterface &mediumInterface,
+        pstd::span<const ShapeHandle> shapes, const FileLoc *loc, Allocator alloc);
 
     SampledSpectrum Phi(const SampledWavelengths &lambda) const;
 
     PBRT_CPU_GPU inline LightType Type() const;
 
+    // Returns the index of the light's "lightgroup", or -1 if it has none.
+    PBRT_CPU_GPU inline int LightGroup() const;
+
+    // Returns the light's index, which light samplers use to store per-light
+    // values in arrays, or -1 if _AssignLightIndices()_ hasn't given it one.
+    PBRT_CPU_GPU inline int Index() const;
+
     PBRT_CPU_GPU inline pstd::optional<LightLiSample> SampleLi(
         LightSampleContext ctx, Point2f u, SampledWavelengths lambda,
         LightSamplingMode mode = LightSamplingMode::WithoutMIS) const;
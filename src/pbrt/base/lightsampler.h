@@ -24,10 +24,12 @@ class UniformLightSampler;
 class PowerLightSampler;
 class BVHLightSampler;
 class ExhaustiveLightSampler;
+class SpatialLightSampler;
 
 // LightSamplerHandle Definition
-class LightSamplerHandle : public TaggedPointer<UniformLightSampler, PowerLightSampler,
-                                                BVHLightSampler, ExhaustiveLightSampler> {
+class LightSamplerHandle
+    : public TaggedPointer<UniformLightSampler, PowerLightSampler, BVHLightSampler,
+                           ExhaustiveLightSampler, SpatialLightSampler> {
   public:
     // LightSampler Interface
     using TaggedPointer::TaggedPointer;
@@ -74,10 +74,16 @@ class MediumHandle : public TaggedPointer<HomogeneousMedium, UniformGridMedium,
 
     bool IsEmissive() const;
 
+    // If _maxSegments_ is positive, sampling stops at the start of the
+    // first majorant segment after that many ones with nonzero majorants
+    // and sets *_tResume_ to the ray parameter there; sampling may then be
+    // resumed with a ray starting at that point. Media with a single
+    // majorant ignore it.
     template <typename F>
     PBRT_CPU_GPU SampledSpectrum SampleTmaj(Ray ray, Float tMax, Float u, RNG &rng,
-                                            const SampledWavelengths &lambda,
-                                            F callback) const;
+                                            const SampledWavelengths &lambda, F callback,
+                                            int maxSegments = 0,
+                                            Float *tResume = nullptr) const;
 };
 
 // MediumInterface Definition
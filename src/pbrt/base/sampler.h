@@ -7,6 +7,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/pstd.h>
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/util/vecmath.h>
 
@@ -56,6 +57,9 @@ class SamplerHandle
 
     PBRT_CPU_GPU inline Float Get1D();
     PBRT_CPU_GPU inline Point2f Get2D();
+    // Returns the samples that successive calls to Get1D() would in _u_,
+    // which some samplers generate together more efficiently
+    PBRT_CPU_GPU inline void GetND(pstd::span<Float> u);
 
     PBRT_CPU_GPU inline Point2f GetPixel2D();
 
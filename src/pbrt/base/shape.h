@@ -7,6 +7,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/base/camera.h>
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/util/vecmath.h>
 
@@ -38,7 +39,8 @@ class ShapeHandle
                                             const Transform *objectFromRender,
                                             bool reverseOrientation,
                                             const ParameterDictionary &parameters,
-                                            const FileLoc *loc, Allocator alloc);
+                                            const FileLoc *loc, Allocator alloc,
+                                            CameraHandle camera = nullptr);
     std::string ToString() const;
 
     PBRT_CPU_GPU inline Bounds3f Bounds() const;
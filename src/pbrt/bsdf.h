@@ -49,6 +49,12 @@ class BSDF {
     bool HasReflection() const { return (bxdf.Flags() & BxDFFlags::Reflection); }
     PBRT_CPU_GPU
     bool HasTransmission() const { return (bxdf.Flags() & BxDFFlags::Transmission); }
+    // Returns false if PDF() is a stochastic estimate of Sample_f()'s density,
+    // as it is for the layered BxDFs.
+    PBRT_CPU_GPU
+    bool HasExactPDF() const {
+        return !bxdf.Is<CoatedDiffuseBxDF>() && !bxdf.Is<CoatedConductorBxDF>();
+    }
 
     PBRT_CPU_GPU
     SampledSpectrum f(Vector3f woRender, Vector3f wiRender,
@@ -793,3 +793,47 @@ TEST(Hair, SamplingConsistency) {
             EXPECT_LT(err, 0.05);
         }
 }
+
+TEST(Hair, Tabulated) {
+    RNG rng;
+    for (Float beta_m = .2; beta_m < 1; beta_m += .3)
+        for (Float beta_n = .4; beta_n < 1; beta_n += .3) {
+            HairBxDFTable table(beta_m, beta_n, Allocator());
+            const int count = 64 * 1024;
+            SampledSpectrum sigma_a(.25);
+            Vector3f wo =
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+            Float yTable = 0, yAnalytic = 0;
+            int pdfMismatches = 0;
+            for (int i = 0; i < count; ++i) {
+                SampledWavelengths lambda =
+                    SampledWavelengths::SampleXYZ(RadicalInverse(0, i));
+                Float h = Clamp(-1 + 2. * RadicalInverse(1, i), -.999999, .999999);
+                HairBxDF hair(h, 1.55, sigma_a, beta_m, beta_n, 2.f, &table);
+                HairBxDF analytic(h, 1.55, sigma_a, beta_m, beta_n, 2.f);
+
+                // Sampled directions' PDFs should match the tabulated BSDF's,
+                // other than when round-off moves them into an adjacent cell
+                Float uc = RadicalInverse(2, i);
+                Point2f u(RadicalInverse(3, i), RadicalInverse(4, i));
+                pstd::optional<BSDFSample> bs = hair.Sample_f(
+                    wo, uc, u, TransportMode::Radiance, BxDFReflTransFlags::All);
+                if (bs && bs->pdf > 0) {
+                    Float pdf = hair.PDF(wo, bs->wi, TransportMode::Radiance,
+                                         BxDFReflTransFlags::All);
+                    if (std::abs(pdf / bs->pdf - 1) > 1e-3)
+                        ++pdfMismatches;
+                    yTable += bs->f.y(lambda) * AbsCosTheta(bs->wi) / bs->pdf;
+                }
+
+                // Estimate the analytic BSDF's reflectance to compare against
+                Vector3f wi =
+                    SampleUniformSphere({RadicalInverse(5, i), RadicalInverse(6, i)});
+                yAnalytic += analytic.f(wo, wi, TransportMode::Radiance).y(lambda) *
+                             AbsCosTheta(wi) / UniformSpherePDF();
+            }
+            EXPECT_LT(pdfMismatches, count / 1000);
+            Float err = std::abs(yTable - yAnalytic) / yAnalytic;
+            EXPECT_LT(err, 0.05) << beta_m << " " << beta_n;
+        }
+}
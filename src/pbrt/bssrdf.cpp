@@ -5,14 +5,23 @@
 #include <pbrt/bssrdf.h>
 
 #include <pbrt/media.h>
+#include <pbrt/options.h>
 #include <pbrt/shapes.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/stats.h>
 
 #include <cmath>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <tuple>
 
 namespace pbrt {
 
@@ -96,7 +105,8 @@ Float BeamDiffusionSS(Float sigma_s, Float sigma_a, Float g, Float eta, Float r)
     return Ess / nSamples;
 }
 
-void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
+// Initializes the radius and albedo values of _t_'s profile discretization
+static void InitBSSRDFTableSamples(BSSRDFTable *t) {
     // Choose radius values of the diffusion profile discretization
     t->radiusSamples[0] = 0;
     t->radiusSamples[1] = 2.5e-3f;
@@ -107,7 +117,10 @@ void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
     for (int i = 0; i < t->rhoSamples.size(); ++i)
         t->rhoSamples[i] =
             (1 - FastExp(-8 * i / (Float)(t->rhoSamples.size() - 1))) / (1 - FastExp(-8));
+}
 
+void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
+    InitBSSRDFTableSamples(t);
     ParallelFor(0, t->rhoSamples.size(), [&](int i) {
         // Compute the diffusion profile for the _i_th albedo sample
         // Compute scattering profile for chosen albedo $\rho$
@@ -127,6 +140,182 @@ void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t) {
     });
 }
 
+void ComputeBurleyBSSRDF(Float g, Float eta, BSSRDFTable *t) {
+    InitBSSRDFTableSamples(t);
+    // Compute diffusion boundary term used to find the surface albedo
+    Float fm1 = FresnelMoment1(eta), fm2 = FresnelMoment2(eta);
+    Float A = (1 + 3 * fm2) / (1 - 2 * fm1);
+
+    size_t nSamples = t->radiusSamples.size();
+    for (int i = 0; i < t->rhoSamples.size(); ++i) {
+        // Compute surface albedo _a_ for the _i_th albedo sample
+        // The albedo is given for $\sigmat=1$; use the classical diffusion
+        // approximation of the total diffuse reflectance with the reduced albedo.
+        Float rho = t->rhoSamples[i];
+        Float rhop = rho * (1 - g) / (1 - rho * g);
+        Float sqrtTerm = SafeSqrt(3 * (1 - rhop));
+        Float a =
+            rhop / 2 * (1 + FastExp(-4.f / 3.f * A * sqrtTerm)) * FastExp(-sqrtTerm);
+
+        // Evaluate Christensen-Burley profile for unit mean free path
+        Float s = 1.85f - a + 7 * std::abs(a - 0.8f) * Sqr(a - 0.8f);
+        for (int j = 0; j < nSamples; ++j) {
+            Float r = t->radiusSamples[j];
+            // $2\pi r R(r)$, where $R(r) = a s (e^{-s r} + e^{-s r / 3}) / (8 \pi r)$
+            t->profile[i * nSamples + j] =
+                a * s * (FastExp(-s * r) + FastExp(-s * r / 3)) / 4;
+        }
+
+        // Compute effective albedo $\rho_{\roman{eff}}$ and CDF for importance sampling
+        t->rhoEff[i] = IntegrateCatmullRom(
+            t->radiusSamples,
+            pstd::span<const Float>(&t->profile[i * nSamples], nSamples),
+            pstd::span<Float>(&t->profileCDF[i * nSamples], nSamples));
+    }
+}
+
+std::string ToString(BSSRDFProfile profile) {
+    switch (profile) {
+    case BSSRDFProfile::BeamDiffusion:
+        return "BeamDiffusion";
+    case BSSRDFProfile::Burley:
+        return "Burley";
+    default:
+        LOG_FATAL("Unhandled BSSRDFProfile");
+        return "";
+    }
+}
+
+// BSSRDF Table Cache Definitions
+STAT_COUNTER("Scene/BSSRDF tables computed", bssrdfTablesComputed);
+STAT_COUNTER("Scene/BSSRDF tables loaded from cache", bssrdfTableCacheHits);
+
+// Increment _BSSRDFCacheVersion_ whenever the tables' discretization or
+// layout changes.
+static constexpr int32_t BSSRDFCacheVersion = 1;
+
+struct BSSRDFCacheHeader {
+    char magic[8];
+    int32_t version;
+    int32_t floatSize;
+    uint64_t key;
+    uint64_t nFloats;
+};
+
+static constexpr int nBSSRDFRhoSamples = 100, nBSSRDFRadiusSamples = 64;
+
+// Returns the arrays of _t_ in the order they're stored in cache files
+static std::vector<pstd::vector<Float> *> BSSRDFTableArrays(BSSRDFTable *t) {
+    return {&t->rhoSamples, &t->radiusSamples, &t->profile, &t->rhoEff,
+            &t->profileCDF};
+}
+
+// Initializes _t_ from a cache file written by _WriteBSSRDFCache()_ and
+// returns true if it's valid for _key_.
+static bool ReadBSSRDFCache(const std::string &filename, uint64_t key, BSSRDFTable *t) {
+    if (!FileExists(filename))
+        return false;
+    std::string error;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename, &error);
+    if (!file) {
+        Warning("%s", error);
+        return false;
+    }
+
+    // Validate cache file header
+    std::vector<pstd::vector<Float> *> arrays = BSSRDFTableArrays(t);
+    size_t nFloats = 0;
+    for (const pstd::vector<Float> *a : arrays)
+        nFloats += a->size();
+    BSSRDFCacheHeader header;
+    if (file->Size() != sizeof(header) + nFloats * sizeof(Float)) {
+        Warning("%s: ignoring stale or corrupt BSSRDF cache file.", filename);
+        return false;
+    }
+    std::memcpy(&header, file->Data(), sizeof(header));
+    if (std::memcmp(header.magic, "pbrtsss", 8) != 0 ||
+        header.version != BSSRDFCacheVersion || header.floatSize != sizeof(Float) ||
+        header.key != key || header.nFloats != nFloats) {
+        Warning("%s: ignoring stale or corrupt BSSRDF cache file.", filename);
+        return false;
+    }
+
+    // Copy cached values into the table's arrays
+    const uint8_t *data = file->Data() + sizeof(header);
+    for (pstd::vector<Float> *a : arrays) {
+        std::memcpy(a->data(), data, a->size() * sizeof(Float));
+        data += a->size() * sizeof(Float);
+    }
+    ++bssrdfTableCacheHits;
+    LOG_VERBOSE("Loaded BSSRDF table from cache file %s", filename);
+    return true;
+}
+
+static void WriteBSSRDFCache(const std::string &filename, uint64_t key,
+                             BSSRDFTable *t) {
+    // Initialize cache file contents
+    std::vector<pstd::vector<Float> *> arrays = BSSRDFTableArrays(t);
+    BSSRDFCacheHeader header;
+    std::memcpy(header.magic, "pbrtsss", 8);
+    header.version = BSSRDFCacheVersion;
+    header.floatSize = sizeof(Float);
+    header.key = key;
+    header.nFloats = 0;
+    for (const pstd::vector<Float> *a : arrays)
+        header.nFloats += a->size();
+    std::string contents(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const pstd::vector<Float> *a : arrays)
+        contents.append(reinterpret_cast<const char *>(a->data()),
+                        a->size() * sizeof(Float));
+
+    if (!WriteFileAtomic(filename, contents)) {
+        Warning("%s: unable to write BSSRDF cache file.", filename);
+        return;
+    }
+    LOG_VERBOSE("Wrote BSSRDF table to cache file %s", filename);
+}
+
+const BSSRDFTable *GetBSSRDFTable(BSSRDFProfile profile, Float g, Float eta,
+                                  Allocator alloc) {
+    // Return previously created table for _profile_, _g_, and _eta_, if available
+    static std::mutex mutex;
+    static std::map<std::tuple<BSSRDFProfile, Float, Float>, const BSSRDFTable *>
+        tables;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = tables.find(std::make_tuple(profile, g, eta));
+    if (iter != tables.end())
+        return iter->second;
+
+    BSSRDFTable *table =
+        alloc.new_object<BSSRDFTable>(nBSSRDFRhoSamples, nBSSRDFRadiusSamples, alloc);
+    if (profile == BSSRDFProfile::Burley) {
+        // The Burley profile is cheap enough that caching it on disk isn't
+        // worthwhile.
+        ComputeBurleyBSSRDF(g, eta, table);
+        ++bssrdfTablesComputed;
+    } else {
+        // Use cached beam diffusion table, if available
+        std::string cacheFilename;
+        uint64_t cacheKey = 0;
+        if (!Options->bssrdfCacheDirectory.empty()) {
+            cacheKey = Hash(g, eta, nBSSRDFRhoSamples, nBSSRDFRadiusSamples,
+                            BSSRDFCacheVersion);
+            cacheFilename =
+                StringPrintf("%s/bssrdf-%016llx.bin", Options->bssrdfCacheDirectory,
+                             (unsigned long long)cacheKey);
+        }
+        if (cacheFilename.empty() || !ReadBSSRDFCache(cacheFilename, cacheKey, table)) {
+            ComputeBeamDiffusionBSSRDF(g, eta, table);
+            ++bssrdfTablesComputed;
+            if (!cacheFilename.empty())
+                WriteBSSRDFCache(cacheFilename, cacheKey, table);
+        }
+    }
+
+    tables[std::make_tuple(profile, g, eta)] = table;
+    return table;
+}
+
 // BSSRDFTable Method Definitions
 BSSRDFTable::BSSRDFTable(int nRhoSamples, int nRadiusSamples, Allocator alloc)
     : rhoSamples(nRhoSamples, alloc),
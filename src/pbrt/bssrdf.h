@@ -70,6 +70,17 @@ Float BeamDiffusionSS(Float sigma_s, Float sigma_a, Float g, Float eta, Float r)
 Float BeamDiffusionMS(Float sigma_s, Float sigma_a, Float g, Float eta, Float r);
 
 void ComputeBeamDiffusionBSSRDF(Float g, Float eta, BSSRDFTable *t);
+void ComputeBurleyBSSRDF(Float g, Float eta, BSSRDFTable *t);
+
+// BSSRDFProfile Definition
+enum class BSSRDFProfile { BeamDiffusion, Burley };
+
+std::string ToString(BSSRDFProfile profile);
+
+// Returns a _BSSRDFTable_ for the given profile and parameters that is shared
+// with all other callers that request the same one.
+const BSSRDFTable *GetBSSRDFTable(BSSRDFProfile profile, Float g, Float eta,
+                                  Allocator alloc);
 
 // BSSRDFTable Definition
 struct BSSRDFTable {
@@ -17,10 +17,14 @@
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/stats.h>
 
+#include <map>
+#include <mutex>
 #include <unordered_map>
 
 namespace pbrt {
@@ -301,13 +305,15 @@ std::string ConductorBxDF::ToString() const {
 
 // HairBxDF Method Definitions
 HairBxDF::HairBxDF(Float h, Float eta, const SampledSpectrum &sigma_a, Float beta_m,
-                   Float beta_n, Float alpha)
+                   Float beta_n, Float alpha, const HairBxDFTable *table)
     : h(h),
       gamma_o(SafeASin(h)),
       eta(eta),
       sigma_a(sigma_a),
       beta_m(beta_m),
-      beta_n(beta_n) {
+      beta_n(beta_n),
+      table(table) {
+    DCHECK(!table || (table->BetaM() == beta_m && table->BetaN() == beta_n));
     CHECK(h >= -1 && h <= 1);
     CHECK(beta_m >= 0 && beta_m <= 1);
     CHECK(beta_n >= 0 && beta_n <= 1);
@@ -385,12 +391,12 @@ SampledSpectrum HairBxDF::f(Vector3f wo, Vector3f wi, TransportMode mode) const
         // Handle out-of-range $\cos \thetao$ from scale adjustment
         cosThetap_o = std::abs(cosThetap_o);
 
-        fsum += Mp(cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o, v[p]) * ap[p] *
-                Np(phi, p, s, gamma_o, gamma_t);
+        fsum += EvaluateMp(p, cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o) *
+                ap[p] * EvaluateNp(phi, p, gamma_t);
     }
     // Compute contribution of remaining terms after _pMax_
-    fsum += Mp(cosTheta_i, cosTheta_o, sinTheta_i, sinTheta_o, v[pMax]) * ap[pMax] /
-            (2.f * Pi);
+    fsum += EvaluateMp(pMax, cosTheta_i, cosTheta_o, sinTheta_i, sinTheta_o) *
+            ap[pMax] / (2.f * Pi);
 
     if (AbsCosTheta(wi) > 0)
         fsum /= AbsCosTheta(wi);
@@ -456,11 +462,16 @@ pstd::optional<BSDFSample> HairBxDF::Sample_f(Vector3f wo, Float uc, Point2f u,
     }
 
     // Sample $M_p$ to compute $\thetai$
-    Float cosTheta = 1 + v[p] * std::log(std::max<Float>(u[0], 1e-5) +
-                                         (1 - u[0]) * FastExp(-2 / v[p]));
-    Float sinTheta = SafeSqrt(1 - Sqr(cosTheta));
-    Float cosPhi = std::cos(2 * Pi * u[1]);
-    Float sinTheta_i = -cosTheta * sinThetap_o + sinTheta * cosPhi * cosThetap_o;
+    Float sinTheta_i;
+    if (table)
+        sinTheta_i = table->SampleMp(p, sinThetap_o, u[0]);
+    else {
+        Float cosTheta = 1 + v[p] * std::log(std::max<Float>(u[0], 1e-5) +
+                                             (1 - u[0]) * FastExp(-2 / v[p]));
+        Float sinTheta = SafeSqrt(1 - Sqr(cosTheta));
+        Float cosPhi = std::cos(2 * Pi * u[1]);
+        sinTheta_i = -cosTheta * sinThetap_o + sinTheta * cosPhi * cosThetap_o;
+    }
     Float cosTheta_i = SafeSqrt(1 - Sqr(sinTheta_i));
 
     // Sample $N_p$ to compute $\Delta\phi$
@@ -472,7 +483,8 @@ pstd::optional<BSDFSample> HairBxDF::Sample_f(Vector3f wo, Float uc, Point2f u,
 
     Float dphi;
     if (p < pMax)
-        dphi = Phi(p, gamma_o, gamma_t) + SampleTrimmedLogistic(uc, s, -Pi, Pi);
+        dphi = Phi(p, gamma_o, gamma_t) +
+               (table ? table->SampleNp(uc) : SampleTrimmedLogistic(uc, s, -Pi, Pi));
     else
         dphi = 2 * Pi * uc;
 
@@ -502,11 +514,11 @@ pstd::optional<BSDFSample> HairBxDF::Sample_f(Vector3f wo, Float uc, Point2f u,
         // Handle out-of-range $\cos \thetao$ from scale adjustment
         cosThetap_o = std::abs(cosThetap_o);
 
-        pdf += Mp(cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o, v[p]) * apPDF[p] *
-               Np(dphi, p, s, gamma_o, gamma_t);
+        pdf += EvaluateMp(p, cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o) *
+               apPDF[p] * EvaluateNp(dphi, p, gamma_t);
     }
-    pdf += Mp(cosTheta_i, cosTheta_o, sinTheta_i, sinTheta_o, v[pMax]) * apPDF[pMax] *
-           (1 / (2 * Pi));
+    pdf += EvaluateMp(pMax, cosTheta_i, cosTheta_o, sinTheta_i, sinTheta_o) *
+           apPDF[pMax] * (1 / (2 * Pi));
     // if (std::abs(wi->x) < .9999) CHECK_NEAR(*pdf, PDF(wo, *wi), .01);
 
     return BSDFSample(f(wo, wi, mode), wi, pdf, Flags());
@@ -559,11 +571,11 @@ Float HairBxDF::PDF(Vector3f wo, Vector3f wi, TransportMode mode,
 
         // Handle out-of-range $\cos \thetao$ from scale adjustment
         cosThetap_o = std::abs(cosThetap_o);
-        pdf += Mp(cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o, v[p]) * apPDF[p] *
-               Np(phi, p, s, gamma_o, gamma_t);
+        pdf += EvaluateMp(p, cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o) *
+               apPDF[p] * EvaluateNp(phi, p, gamma_t);
     }
-    pdf += Mp(cosTheta_i, cosTheta_o, sinTheta_i, sinTheta_o, v[pMax]) * apPDF[pMax] *
-           (1 / (2 * Pi));
+    pdf += EvaluateMp(pMax, cosTheta_i, cosTheta_o, sinTheta_i, sinTheta_o) *
+           apPDF[pMax] * (1 / (2 * Pi));
     return pdf;
 }
 
@@ -591,13 +603,179 @@ SampledSpectrum HairBxDF::SigmaAFromReflectance(const SampledSpectrum &c, Float
 
 std::string HairBxDF::ToString() const {
     return StringPrintf("[ HairBxDF h: %f gamma_o: %f eta: %f beta_m: %f beta_n: %f "
-                        "v[0]: %f s: %f sigma_a: %s ]",
-                        h, gamma_o, eta, beta_m, beta_n, v[0], s, sigma_a);
+                        "v[0]: %f s: %f sigma_a: %s tabulated: %s ]",
+                        h, gamma_o, eta, beta_m, beta_n, v[0], s, sigma_a,
+                        table != nullptr);
+}
+
+// HairBxDFTable Method Definitions
+HairBxDFTable::HairBxDFTable(Float beta_m, Float beta_n, Allocator alloc)
+    : beta_m(beta_m), beta_n(beta_n), mp(alloc), np(alloc) {
+    // Tabulate $M_p$ for each lobe, averaging it over each cell
+    HairBxDF hair(0, 1.55f, SampledSpectrum(0.f), beta_m, beta_n, 0);
+    constexpr int nLobes = HairBxDF::pMax + 1, nCellSamples = 4;
+    std::vector<Float> values(nLobes * SinThetaOResolution * SinThetaIResolution);
+    ParallelFor(0, nLobes * SinThetaOResolution, [&](int64_t row) {
+        int p = row / SinThetaOResolution, o = row % SinThetaOResolution;
+        for (int i = 0; i < SinThetaIResolution; ++i) {
+            Float sum = 0;
+            for (int so = 0; so < nCellSamples; ++so)
+                for (int si = 0; si < nCellSamples; ++si) {
+                    Float sinTheta_o =
+                        -1 + 2 * (o + (so + 0.5f) / nCellSamples) / SinThetaOResolution;
+                    Float sinTheta_i =
+                        -1 + 2 * (i + (si + 0.5f) / nCellSamples) / SinThetaIResolution;
+                    sum += HairBxDF::Mp(SafeSqrt(1 - Sqr(sinTheta_i)),
+                                        SafeSqrt(1 - Sqr(sinTheta_o)), sinTheta_i,
+                                        sinTheta_o, hair.v[p]);
+                }
+            values[row * SinThetaIResolution + i] = sum / Sqr(nCellSamples);
+        }
+    });
+
+    // Compute sampling distributions for each lobe and $\sin\theta_\roman{o}$
+    mp.reserve(nLobes * SinThetaOResolution);
+    for (int row = 0; row < nLobes * SinThetaOResolution; ++row)
+        mp.push_back(PiecewiseConstant1D(
+            pstd::span<const Float>(&values[row * SinThetaIResolution],
+                                    SinThetaIResolution),
+            -1, 1, alloc));
+
+    // Tabulate the trimmed logistic used for $N_p$
+    std::vector<Float> npValues(PhiResolution, 0.f);
+    for (int i = 0; i < PhiResolution; ++i) {
+        for (int j = 0; j < Sqr(nCellSamples); ++j) {
+            Float dphi =
+                -Pi + 2 * Pi * (i + (j + 0.5f) / Sqr(nCellSamples)) / PhiResolution;
+            npValues[i] += TrimmedLogistic(dphi, hair.s, -Pi, Pi);
+        }
+        npValues[i] /= Sqr(nCellSamples);
+    }
+    np = PiecewiseConstant1D(npValues, -Pi, Pi, alloc);
+}
+
+std::string HairBxDFTable::ToString() const {
+    return StringPrintf("[ HairBxDFTable beta_m: %f beta_n: %f ]", beta_m, beta_n);
 }
 
 std::string LayeredBxDFConfig::ToString() const {
-    return StringPrintf("[ LayeredBxDFConfig maxDepth: %d nSamples: %d twoSided: %d",
-                        maxDepth, nSamples, twoSided);
+    return StringPrintf(
+        "[ LayeredBxDFConfig maxDepth: %d nSamples: %d twoSided: %d tabulated: %s ]",
+        maxDepth, nSamples, twoSided, table != nullptr);
+}
+
+// LayeredBxDFTable Method Definitions
+LayeredBxDFTable::LayeredBxDFTable(
+    std::function<SampledSpectrum(Vector3f, Vector3f, const SampledWavelengths &)>
+        fLayers,
+    Allocator alloc)
+    : values(LambdaResolution * MuResolution * PhiResolution * MuResolution, alloc),
+      distribs(alloc),
+      albedo(MuResolution, alloc) {
+    // Average _fLayers_ over each table cell at the centers of the
+    // wavelength bins; each set of sampled wavelengths covers
+    // _NSpectrumSamples_ of them.
+    static_assert(LambdaResolution % NSpectrumSamples == 0);
+    constexpr int nLambdaSets = LambdaResolution / NSpectrumSamples;
+    constexpr int nCellSamples = 32;
+    ParallelFor(0, nLambdaSets * MuResolution, [&](int64_t task) {
+        int lambdaSet = task / MuResolution, muO = task % MuResolution;
+        SampledWavelengths lambda =
+            SampledWavelengths::SampleUniform((lambdaSet + 0.5f) / LambdaResolution);
+        RNG rng(Hash(lambdaSet, muO));
+        for (int phi = 0; phi < PhiResolution; ++phi)
+            for (int muI = 0; muI < MuResolution; ++muI) {
+                SampledSpectrum sum(0.f);
+                for (int s = 0; s < nCellSamples; ++s) {
+                    // Sample directions in the cell and evaluate _fLayers_
+                    Float cosTheta_o = (muO + rng.Uniform<Float>()) / MuResolution;
+                    Float cosTheta_i = (muI + rng.Uniform<Float>()) / MuResolution;
+                    Float dPhi = Pi * (phi + rng.Uniform<Float>()) / PhiResolution;
+                    Vector3f wo = SphericalDirection(SafeSqrt(1 - Sqr(cosTheta_o)),
+                                                     cosTheta_o, 0);
+                    Vector3f wi = SphericalDirection(SafeSqrt(1 - Sqr(cosTheta_i)),
+                                                     cosTheta_i, dPhi);
+                    if (wo.z > 0 && wi.z > 0)
+                        sum += fLayers(wo, wi, lambda);
+                }
+                for (int i = 0; i < NSpectrumSamples; ++i) {
+                    int l = lambdaSet + i * nLambdaSets;
+                    values[((l * MuResolution + muO) * PhiResolution + phi) *
+                               MuResolution +
+                           muI] = sum[i] / nCellSamples;
+                }
+            }
+    });
+
+    // Compute sampling distributions and albedos for each $\cos\theta_\roman{o}$
+    int cellsPerLambda = MuResolution * PhiResolution * MuResolution;
+    for (int muO = 0; muO < MuResolution; ++muO) {
+        std::vector<Float> func(PhiResolution * MuResolution, 0.f);
+        for (int phi = 0; phi < PhiResolution; ++phi)
+            for (int muI = 0; muI < MuResolution; ++muI) {
+                int offset = (muO * PhiResolution + phi) * MuResolution + muI;
+                Float f = 0;
+                for (int l = 0; l < LambdaResolution; ++l)
+                    f += values[l * cellsPerLambda + offset];
+                func[phi * MuResolution + muI] =
+                    f / LambdaResolution * (muI + 0.5f) / MuResolution;
+            }
+        distribs.push_back(PiecewiseConstant2D(func, MuResolution, PhiResolution, alloc));
+        albedo[muO] = 2 * Pi * distribs.back().Integral();
+    }
+}
+
+SampledSpectrum LayeredBxDFTable::f(Vector3f wo, Vector3f wi,
+                                    const SampledWavelengths &lambda) const {
+    if (wo.z <= 0 || wi.z <= 0)
+        return SampledSpectrum(0.f);
+    int phi = Clamp(int(DeltaPhi(wo, wi) * InvPi * PhiResolution), 0, PhiResolution - 1);
+    int offset = (MuIndex(wo.z) * PhiResolution + phi) * MuResolution + MuIndex(wi.z);
+    int cellsPerLambda = MuResolution * PhiResolution * MuResolution;
+    // Interpolate linearly between the centers of the wavelength bins
+    SampledSpectrum f;
+    for (int i = 0; i < NSpectrumSamples; ++i) {
+        Float x = LambdaResolution * (lambda[i] - Lambda_min) /
+                      (Lambda_max - Lambda_min) -
+                  0.5f;
+        int l0 = Clamp(int(std::floor(x)), 0, LambdaResolution - 2);
+        Float t = Clamp(x - l0, 0, 1);
+        f[i] = Lerp(t, values[l0 * cellsPerLambda + offset],
+                    values[(l0 + 1) * cellsPerLambda + offset]);
+    }
+    return f;
+}
+
+pstd::optional<Vector3f> LayeredBxDFTable::Sample(Vector3f wo, Point2f u,
+                                                  Float *pdf) const {
+    int muO = MuIndex(wo.z);
+    if (wo.z <= 0 || albedo[muO] == 0)
+        return {};
+    // Choose the sign of the azimuth difference using _u[0]_
+    Float sign = u[0] < 0.5f ? 1 : -1;
+    u[0] = std::min(u[0] < 0.5f ? 2 * u[0] : 2 * u[0] - 1, OneMinusEpsilon);
+
+    // Sample $\cos\theta_\roman{i}$ and azimuth difference and compute
+    // direction
+    Float distribPDF;
+    Point2f p = distribs[muO].Sample(u, &distribPDF);
+    if (distribPDF == 0)
+        return {};
+    Float cosTheta = p[0], dPhi = sign * Pi * p[1];
+    *pdf = distribPDF * Inv2Pi;
+    Float phi = std::atan2(wo.y, wo.x) + dPhi;
+    return SphericalDirection(SafeSqrt(1 - Sqr(cosTheta)), cosTheta, phi);
+}
+
+Float LayeredBxDFTable::PDF(Vector3f wo, Vector3f wi) const {
+    int muO = MuIndex(wo.z);
+    if (wo.z <= 0 || wi.z <= 0 || albedo[muO] == 0)
+        return 0;
+    return distribs[muO].PDF(Point2f(wi.z, DeltaPhi(wo, wi) * InvPi)) * Inv2Pi;
+}
+
+std::string LayeredBxDFTable::ToString() const {
+    return StringPrintf("[ LayeredBxDFTable albedo: %s ]", albedo);
 }
 
 // *****************************************************************************
@@ -892,8 +1070,10 @@ class MeasuredBRDF {
           sigma(alloc),
           vndf(alloc),
           luminance(alloc),
-          spectra(alloc),
-          wavelengths(alloc) {}
+          phiValues(alloc),
+          thetaValues(alloc),
+          wavelengths(alloc),
+          spectra(alloc) {}
 
     static MeasuredBRDF *Create(const std::string &filename, Allocator alloc);
 
@@ -901,19 +1081,90 @@ class MeasuredBRDF {
         return StringPrintf("[ MeasuredBRDF filename: %s ]", filename);
     }
 
+    // Returns the spectral BRDF data at the given point in the VNDF's
+    // sample space, for the given incident direction angles. The angles'
+    // interpolation weights are found once and shared by all wavelengths.
+    PBRT_CPU_GPU
+    SampledSpectrum Spectrum(Vector2f sample, Float phi_i, Float theta_i,
+                             const SampledWavelengths &lambda) const {
+        // Find interpolation weights and offsets for the 16 surrounding samples
+        // in the incident angle and sample dimensions
+        Float wPhi, wTheta;
+        int iPhi = Interval(phiValues, phi_i, &wPhi);
+        int iTheta = Interval(thetaValues, theta_i, &wTheta);
+        Vector2f pos(sample.x * (spectraRes.x - 1), sample.y * (spectraRes.y - 1));
+        Vector2i p0 = Min(Vector2i(pos), spectraRes - Vector2i(2, 2));
+        Vector2f wPos = pos - Vector2f(p0);
+        int nCorners = 0;
+        Float cornerWeight[16];
+        size_t cornerOffset[16];
+        for (int c = 0; c < 16; ++c) {
+            Float w = ((c & 8) ? wPhi : 1 - wPhi) * ((c & 4) ? wTheta : 1 - wTheta) *
+                      ((c & 2) ? wPos.y : 1 - wPos.y) * ((c & 1) ? wPos.x : 1 - wPos.x);
+            if (w == 0)
+                continue;
+            int ip = std::min<int>(iPhi + ((c >> 3) & 1), phiValues.size() - 1);
+            int it = std::min<int>(iTheta + ((c >> 2) & 1), thetaValues.size() - 1);
+            int x = p0.x + (c & 1), y = p0.y + ((c >> 1) & 1);
+            cornerWeight[nCorners] = w;
+            cornerOffset[nCorners++] =
+                (((size_t(ip) * thetaValues.size() + it) * spectraRes.y + y) *
+                     spectraRes.x +
+                 x) *
+                wavelengths.size();
+        }
+
+        // Interpolate the corners' spectra at each wavelength
+        SampledSpectrum s(0.f);
+        for (int i = 0; i < NSpectrumSamples; ++i) {
+            Float wl;
+            int il = Interval(wavelengths, lambda[i], &wl);
+            int il1 = std::min<int>(il + 1, wavelengths.size() - 1);
+            for (int c = 0; c < nCorners; ++c) {
+                const float *v = &spectra[cornerOffset[c]];
+                s[i] += cornerWeight[c] * Lerp(wl, v[il], v[il1]);
+            }
+        }
+        return s;
+    }
+
+    size_t BytesUsed() const {
+        return sizeof(MeasuredBRDF) +
+               4 * (phiValues.size() + thetaValues.size() + wavelengths.size() +
+                    spectra.size()) +
+               ndf.BytesUsed() + sigma.BytesUsed() + vndf.BytesUsed() +
+               luminance.BytesUsed();
+    }
+
     using Warp2D0 = PiecewiseLinear2D<0>;
     using Warp2D2 = PiecewiseLinear2D<2>;
-    using Warp2D3 = PiecewiseLinear2D<3>;
 
     Warp2D0 ndf;
     Warp2D0 sigma;
     Warp2D2 vndf;
     Warp2D2 luminance;
-    Warp2D3 spectra;
-    pstd::vector<float> wavelengths;
+    // Spectral BRDF values, stored with wavelength varying fastest, then
+    // sample x and y, then $\theta_\roman{i}$ and $\phi_\roman{i}$
+    pstd::vector<float> phiValues, thetaValues, wavelengths;
+    pstd::vector<float> spectra;
+    Vector2i spectraRes;
     bool isotropic;
     bool jacobian;
     std::string filename;
+
+  private:
+    // Returns the index of the interval of sorted _values_ that contains
+    // _x_ and the weight of its upper end point for linear interpolation
+    PBRT_CPU_GPU
+    static int Interval(const pstd::vector<float> &values, Float x, Float *w) {
+        if (values.size() == 1) {
+            *w = 0;
+            return 0;
+        }
+        int i = FindInterval(values.size(), [&](int idx) { return values[idx] <= x; });
+        *w = Clamp((x - values[i]) / (values[i + 1] - values[i]), 0, 1);
+        return i;
+    }
 };
 
 STAT_MEMORY_COUNTER("Memory/Measured BRDF data", measuredBRDFBytes);
@@ -998,34 +1249,45 @@ MeasuredBRDF *MeasuredBRDF::Create(const std::string &filename, Allocator alloc)
                 luminance.shape[2], {{(int)phi_i.shape[0], (int)theta_i.shape[0]}},
                 {{(const float *)phi_i.data.get(), (const float *)theta_i.data.get()}});
 
-    /* Copy wavelength information */
-    size_t size = wavelengths.shape[0];
-    brdf->wavelengths.resize(size);
-    for (size_t i = 0; i < size; ++i)
-        brdf->wavelengths[i] = ((const float *)wavelengths.data.get())[i];
-
-    /* Construct spectral interpolant */
-    brdf->spectra =
-        Warp2D3(alloc, (float *)spectra.data.get(), spectra.shape[4], spectra.shape[3],
-                {{(int)phi_i.shape[0], (int)theta_i.shape[0], (int)wavelengths.shape[0]}},
-                {{(const float *)phi_i.data.get(), (const float *)theta_i.data.get(),
-                  (const float *)wavelengths.data.get()}},
-                false, false);
-
-    measuredBRDFBytes += sizeof(MeasuredBRDF) + 4 * brdf->wavelengths.size() +
-                         brdf->ndf.BytesUsed() + brdf->sigma.BytesUsed() +
-                         brdf->vndf.BytesUsed() + brdf->luminance.BytesUsed() +
-                         brdf->spectra.BytesUsed();
+    /* Copy parameter values */
+    auto copy = [](const Tensor::Field &field, pstd::vector<float> *values) {
+        const float *data = (const float *)field.data.get();
+        values->resize(field.shape[0]);
+        std::copy(data, data + field.shape[0], values->begin());
+    };
+    copy(phi_i, &brdf->phiValues);
+    copy(theta_i, &brdf->thetaValues);
+    copy(wavelengths, &brdf->wavelengths);
+
+    /* Store spectral data with wavelength varying fastest */
+    size_t nPhi = phi_i.shape[0], nTheta = theta_i.shape[0];
+    size_t nLambda = wavelengths.shape[0];
+    brdf->spectraRes = Vector2i(spectra.shape[4], spectra.shape[3]);
+    size_t nPos = spectra.shape[3] * spectra.shape[4];
+    const float *spectraData = (const float *)spectra.data.get();
+    brdf->spectra.resize(nPhi * nTheta * nPos * nLambda);
+    for (size_t angle = 0; angle < nPhi * nTheta; ++angle)
+        for (size_t l = 0; l < nLambda; ++l)
+            for (size_t pos = 0; pos < nPos; ++pos)
+                brdf->spectra[(angle * nPos + pos) * nLambda + l] =
+                    spectraData[(angle * nLambda + l) * nPos + pos];
+
+    measuredBRDFBytes += brdf->BytesUsed();
 
     return brdf;
 }
 
 MeasuredBRDF *MeasuredBxDF::BRDFDataFromFile(const std::string &filename,
                                              Allocator alloc) {
+    // Share the data between all materials that use the same file
     static std::map<std::string, MeasuredBRDF *> loadedData;
-    if (loadedData.find(filename) == loadedData.end())
-        loadedData[filename] = MeasuredBRDF::Create(filename, alloc);
-    return loadedData[filename];
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (auto iter = loadedData.find(filename); iter != loadedData.end())
+        return iter->second;
+    MeasuredBRDF *brdf = MeasuredBRDF::Create(filename, alloc);
+    loadedData[filename] = brdf;
+    return brdf;
 }
 
 // MeasuredBxDF Method Definitions
@@ -1056,13 +1318,11 @@ SampledSpectrum MeasuredBxDF::f(Vector3f wo, Vector3f wi, TransportMode mode) co
     Vector2f sample = ui.p;
     Float vndfPDF = ui.pdf;
 
-    SampledSpectrum fr(0);
+    SampledSpectrum fr = brdf->Spectrum(sample, phi_i, theta_i, lambda);
     for (int i = 0; i < pbrt::NSpectrumSamples; ++i) {
-        Float params_fr[3] = {phi_i, theta_i, lambda[i]};
-        fr[i] = brdf->spectra.Evaluate(sample, params_fr);
         CHECK_RARE(1e-5f, fr[i] < 0);
-        fr[i] = std::max<Float>(0, fr[i]);
     }
+    fr = ClampZero(fr);
 
     return fr * brdf->ndf.Evaluate(u_wm, params) /
            (4 * brdf->sigma.Evaluate(u_wi, params) * AbsCosTheta(wi));
@@ -1104,13 +1364,11 @@ pstd::optional<BSDFSample> MeasuredBxDF::Sample_f(Vector3f wo, Float uc, Point2f
     if (wi.z <= 0)
         return {};
 
-    SampledSpectrum fr(0);
+    SampledSpectrum fr = brdf->Spectrum(sample, phi_i, theta_i, lambda);
     for (int i = 0; i < pbrt::NSpectrumSamples; ++i) {
-        Float params_fr[3] = {phi_i, theta_i, lambda[i]};
-        fr[i] = brdf->spectra.Evaluate(sample, params_fr);
         CHECK_RARE(1e-5f, fr[i] < 0);
-        fr[i] = std::max<Float>(0, fr[i]);
     }
+    fr = ClampZero(fr);
 
     Vector2f u_wo = Vector2f(theta2u(theta_i), phi2u(phi_i));
     fr *= brdf->ndf.Evaluate(u_wm, params) /
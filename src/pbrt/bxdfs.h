@@ -14,6 +14,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/sampling.h>
 #include <pbrt/util/scattering.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/taggedptr.h>
@@ -21,6 +22,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <limits>
 #include <string>
 
@@ -222,6 +224,9 @@ class DielectricInterfaceBxDF {
     PBRT_CPU_GPU
     static constexpr const char *Name() { return "DielectricInterfaceBxDF"; }
 
+    PBRT_CPU_GPU
+    Float Eta() const { return eta; }
+
     std::string ToString() const;
 
     PBRT_CPU_GPU
@@ -413,14 +418,69 @@ class ConductorBxDF {
     SampledSpectrum eta, k;
 };
 
+class LayeredBxDFTable;
+
 // LayeredBxDFConfig Definition
 struct LayeredBxDFConfig {
     uint8_t maxDepth = 10;
     uint8_t nSamples = 1;
     uint8_t twoSided = true;
+    // If non-null, the part of the BSDF due to light that enters the layers
+    // is found using this table rather than by random walks
+    const LayeredBxDFTable *table = nullptr;
     std::string ToString() const;
 };
 
+// LayeredBxDFTable Definition
+// Tabulates the part of a two-sided, isotropic, reflection-only layered
+// BSDF that is due to light that enters its layers, as a function of the
+// cosines of the two directions' polar angles, the difference of their
+// azimuths, and wavelength. The table is piecewise constant in direction so
+// that it can be sampled exactly.
+class LayeredBxDFTable {
+  public:
+    // LayeredBxDFTable Public Methods
+    // _fLayers_ gives the part of the BSDF to tabulate for directions in the
+    // upper hemisphere at the given wavelengths; it is called in parallel.
+    LayeredBxDFTable(std::function<SampledSpectrum(Vector3f, Vector3f,
+                                                   const SampledWavelengths &)>
+                         fLayers,
+                     Allocator alloc);
+
+    PBRT_CPU_GPU
+    SampledSpectrum f(Vector3f wo, Vector3f wi, const SampledWavelengths &lambda) const;
+    PBRT_CPU_GPU
+    pstd::optional<Vector3f> Sample(Vector3f wo, Point2f u, Float *pdf) const;
+    PBRT_CPU_GPU
+    Float PDF(Vector3f wo, Vector3f wi) const;
+    // Returns the directional albedo of the tabulated part of the BSDF,
+    // averaged over wavelength
+    PBRT_CPU_GPU
+    Float Albedo(Vector3f wo) const { return albedo[MuIndex(wo.z)]; }
+
+    std::string ToString() const;
+
+    static constexpr int MuResolution = 16, PhiResolution = 12, LambdaResolution = 16;
+
+  private:
+    // LayeredBxDFTable Private Methods
+    PBRT_CPU_GPU
+    static int MuIndex(Float cosTheta) {
+        return Clamp(int(cosTheta * MuResolution), 0, MuResolution - 1);
+    }
+    PBRT_CPU_GPU
+    static Float DeltaPhi(Vector3f wo, Vector3f wi) {
+        return SafeACos(CosDPhi(wo, wi));
+    }
+
+    // LayeredBxDFTable Private Members
+    // Values are indexed by wavelength, $\cos\theta_\roman{o}$, azimuth
+    // difference, and $\cos\theta_\roman{i}$, from slowest to fastest varying
+    pstd::vector<Float> values;
+    pstd::vector<PiecewiseConstant2D> distribs;
+    pstd::vector<Float> albedo;
+};
+
 // TopOrBottomBxDF Definition
 template <typename TopBxDF, typename BottomBxDF>
 class TopOrBottomBxDF {
@@ -482,13 +542,15 @@ class LayeredBxDF {
     LayeredBxDF() = default;
     PBRT_CPU_GPU
     LayeredBxDF(TopBxDF top, BottomBxDF bottom, Float thickness,
-                const SampledSpectrum &albedo, Float g, LayeredBxDFConfig config)
+                const SampledSpectrum &albedo, Float g, LayeredBxDFConfig config,
+                const SampledWavelengths &lambda)
         : top(top),
           bottom(bottom),
           thickness(std::max(thickness, std::numeric_limits<Float>::min())),
           g(g),
           albedo(albedo),
-          config(config) {}
+          config(config),
+          lambda(lambda) {}
 
     std::string ToString() const;
 
@@ -528,6 +590,8 @@ class LayeredBxDF {
             wo = -wo;
             wi = -wi;
         }
+        if (config.table && mode == TransportMode::Radiance)
+            return top.f(wo, wi, mode) + config.table->f(wo, wi, lambda);
 
         // Determine entrance interface for layered BSDF
         TopOrBottomBxDF<TopBxDF, BottomBxDF> enterInterface;
@@ -696,6 +760,14 @@ class LayeredBxDF {
         return f / config.nSamples;
     }
 
+    // Returns the part of f() that is due to light that enters the layers,
+    // for _wo_ and _wi_ in the upper hemisphere; this is what
+    // _LayeredBxDFTable_ tabulates.
+    PBRT_CPU_GPU
+    SampledSpectrum fLayers(Vector3f wo, Vector3f wi, TransportMode mode) const {
+        return ClampZero(f(wo, wi, mode) - top.f(wo, wi, mode));
+    }
+
     PBRT_CPU_GPU
     pstd::optional<BSDFSample> Sample_f(
         Vector3f wo, Float uc, const Point2f &u, TransportMode mode,
@@ -707,6 +779,41 @@ class LayeredBxDF {
             wo = -wo;
             flipWi = true;
         }
+        if (config.table && mode == TransportMode::Radiance) {
+            // Sample either the top interface's reflection or the table
+            if (wo.z == 0)
+                return {};
+            Float pTop = tableTopProbability(wo);
+            Vector3f wi;
+            if (uc < pTop) {
+                pstd::optional<BSDFSample> bs = top.Sample_f(
+                    wo, std::min(uc / pTop, OneMinusEpsilon), u, mode,
+                    BxDFReflTransFlags::Reflection);
+                if (!bs || !bs->f || bs->pdf == 0 || bs->wi.z <= 0)
+                    return {};
+                if (bs->IsSpecular()) {
+                    bs->pdf *= pTop;
+                    if (flipWi)
+                        bs->wi = -bs->wi;
+                    return bs;
+                }
+                wi = bs->wi;
+            } else {
+                Float tablePDF;
+                pstd::optional<Vector3f> tableWi = config.table->Sample(wo, u, &tablePDF);
+                if (!tableWi)
+                    return {};
+                wi = *tableWi;
+            }
+
+            // Return _BSDFSample_ for the sum of the two components
+            SampledSpectrum f = top.f(wo, wi, mode) + config.table->f(wo, wi, lambda);
+            Float pdf = pTop * top.PDF(wo, wi, mode, BxDFReflTransFlags::Reflection) +
+                        (1 - pTop) * config.table->PDF(wo, wi);
+            if (flipWi)
+                wi = -wi;
+            return BSDFSample(f, wi, pdf, BxDFFlags::GlossyReflection);
+        }
 
         // Sample BSDF at entrance interface to get initial direction _w_
         bool enteredTop = wo.z > 0;
@@ -820,6 +927,13 @@ class LayeredBxDF {
             wo = -wo;
             wi = -wi;
         }
+        if (config.table && mode == TransportMode::Radiance) {
+            if (wo.z <= 0 || wi.z <= 0)
+                return 0;
+            Float pTop = tableTopProbability(wo);
+            return pTop * top.PDF(wo, wi, mode, BxDFReflTransFlags::Reflection) +
+                   (1 - pTop) * config.table->PDF(wo, wi);
+        }
 
         // Declare _RNG_ for layered BSDF evaluation
         RNG rng(Hash(GetOptions().seed, wo), Hash(wi));
@@ -928,12 +1042,23 @@ class LayeredBxDF {
         return FastExp(-std::abs(dz / w.z));
     }
 
+    // Returns the probability of sampling reflection at the top interface
+    // rather than the tabulated part of the BSDF, in proportion to an
+    // estimate of each one's albedo
+    PBRT_CPU_GPU
+    Float tableTopProbability(Vector3f wo) const {
+        Float R = FrDielectric(CosTheta(wo), top.Eta());
+        Float tableAlbedo = config.table->Albedo(wo);
+        return (R + tableAlbedo > 0) ? R / (R + tableAlbedo) : 1;
+    }
+
     // LayeredBxDF Protected Members
     TopBxDF top;
     BottomBxDF bottom;
     Float thickness, g;
     SampledSpectrum albedo;
     LayeredBxDFConfig config;
+    SampledWavelengths lambda;
 };
 
 // CoatedDiffuseBxDF Definition
@@ -954,6 +1079,72 @@ class CoatedConductorBxDF : public LayeredBxDF<DielectricInterfaceBxDF, Conducto
     using LayeredBxDF::LayeredBxDF;
 };
 
+// HairBxDFTable Definition
+// Tabulates the longitudinal scattering functions $M_p$ and the trimmed
+// logistic azimuthal distribution of _HairBxDF_s with given $\beta_m$ and
+// $\beta_n$, so that they can be evaluated and sampled without Bessel
+// functions or logarithms. $M_p$ is piecewise constant in
+// $\sin\theta_\roman{i}$ for each range of $\sin\theta_\roman{o}$, and the
+// logistic is piecewise constant in $\Delta\phi$; both are normalized so
+// that sampling them is exact.
+class HairBxDFTable {
+  public:
+    // HairBxDFTable Public Methods
+    HairBxDFTable(Float beta_m, Float beta_n, Allocator alloc);
+
+    PBRT_CPU_GPU
+    Float BetaM() const { return beta_m; }
+    PBRT_CPU_GPU
+    Float BetaN() const { return beta_n; }
+
+    PBRT_CPU_GPU
+    Float Mp(int p, Float sinTheta_i, Float sinTheta_o) const {
+        const PiecewiseConstant1D &distrib = mp[MpOffset(p, sinTheta_o)];
+        if (distrib.funcInt == 0)
+            return 0;
+        int i = Clamp(int((sinTheta_i + 1) * (SinThetaIResolution / 2)), 0,
+                      SinThetaIResolution - 1);
+        return distrib.func[i] / distrib.funcInt;
+    }
+    // Returns $\sin\theta_\roman{i}$ sampled according to the tabulated $M_p$.
+    PBRT_CPU_GPU
+    Float SampleMp(int p, Float sinTheta_o, Float u) const {
+        return mp[MpOffset(p, sinTheta_o)].Sample(u);
+    }
+
+    // _dphi_ is the azimuthal offset from the lobe's center in $[-\pi,\pi]$.
+    PBRT_CPU_GPU
+    Float Np(Float dphi) const {
+        if (np.funcInt == 0)
+            return 0;
+        int i = Clamp(int((dphi + Pi) * (PhiResolution * Inv2Pi)), 0, PhiResolution - 1);
+        return np.func[i] / np.funcInt;
+    }
+    PBRT_CPU_GPU
+    Float SampleNp(Float u) const { return np.Sample(u); }
+
+    std::string ToString() const;
+
+    static constexpr int SinThetaOResolution = 128, SinThetaIResolution = 256,
+                         PhiResolution = 256;
+
+  private:
+    // HairBxDFTable Private Methods
+    PBRT_CPU_GPU
+    static int MpOffset(int p, Float sinTheta_o) {
+        int o = Clamp(int((sinTheta_o + 1) * (SinThetaOResolution / 2)), 0,
+                      SinThetaOResolution - 1);
+        return p * SinThetaOResolution + o;
+    }
+
+    // HairBxDFTable Private Members
+    Float beta_m, beta_n;
+    // Distributions of $\sin\theta_\roman{i}$ indexed by lobe and then
+    // $\sin\theta_\roman{o}$
+    pstd::vector<PiecewiseConstant1D> mp;
+    PiecewiseConstant1D np;
+};
+
 // HairBxDF Definition
 class HairBxDF {
   public:
@@ -961,7 +1152,7 @@ class HairBxDF {
     HairBxDF() = default;
     PBRT_CPU_GPU
     HairBxDF(Float h, Float eta, const SampledSpectrum &sigma_a, Float beta_m,
-             Float beta_n, Float alpha);
+             Float beta_n, Float alpha, const HairBxDFTable *table = nullptr);
     PBRT_CPU_GPU
     SampledSpectrum f(Vector3f wo, Vector3f wi, TransportMode mode) const;
     PBRT_CPU_GPU
@@ -1049,6 +1240,29 @@ class HairBxDF {
     PBRT_CPU_GPU
     pstd::array<Float, pMax + 1> ComputeApPDF(Float cosThetaO) const;
 
+    // Evaluate $M_p$ and $N_p$ for lobe _p_ using the table, if present
+    PBRT_CPU_GPU
+    Float EvaluateMp(int p, Float cosTheta_i, Float cosThetap_o, Float sinTheta_i,
+                     Float sinThetap_o) const {
+        if (table)
+            return table->Mp(p, sinTheta_i, sinThetap_o);
+        return Mp(cosTheta_i, cosThetap_o, sinTheta_i, sinThetap_o, v[p]);
+    }
+    PBRT_CPU_GPU
+    Float EvaluateNp(Float phi, int p, Float gamma_t) const {
+        if (!table)
+            return Np(phi, p, s, gamma_o, gamma_t);
+        Float dphi = phi - Phi(p, gamma_o, gamma_t);
+        // Remap _dphi_ to $[-\pi,\pi]$
+        while (dphi > Pi)
+            dphi -= 2 * Pi;
+        while (dphi < -Pi)
+            dphi += 2 * Pi;
+        return table->Np(dphi);
+    }
+
+    friend class HairBxDFTable;
+
     // HairBxDF Private Members
     Float h, gamma_o, eta;
     SampledSpectrum sigma_a;
@@ -1056,6 +1270,7 @@ class HairBxDF {
     Float v[pMax + 1];
     Float s;
     Float sin2kAlpha[3], cos2kAlpha[3];
+    const HairBxDFTable *table = nullptr;
 };
 
 // MeasuredBxDF Definition
@@ -12,6 +12,7 @@
 #include <pbrt/paramdict.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
@@ -20,6 +21,8 @@
 #include <pbrt/util/stats.h>
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 
 namespace pbrt {
 
@@ -712,6 +715,74 @@ std::string SphericalCamera::ToString() const {
                         mapping == EquiRectangular ? "EquiRectangular" : "EqualArea");
 }
 
+// Exit Pupil Cache Definitions
+STAT_COUNTER("Camera/Exit pupil bounds loaded from cache", lensCacheHits);
+
+// Increment _LensCacheVersion_ whenever the layout of cached bounds or the
+// way that they are computed changes.
+static constexpr int32_t LensCacheVersion = 1;
+
+struct LensCacheHeader {
+    char magic[8];
+    int32_t version;
+    int32_t floatSize;
+    uint64_t key;
+    uint64_t nBounds;
+};
+
+// Initializes _bounds_ from a cache file written by _WriteLensCache()_ and
+// returns true if it's valid for _key_.
+static bool ReadLensCache(const std::string &filename, uint64_t key,
+                          pstd::span<Bounds2f> bounds) {
+    if (!FileExists(filename))
+        return false;
+    std::string error;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename, &error);
+    if (!file) {
+        Warning("%s", error);
+        return false;
+    }
+
+    LensCacheHeader header;
+    if (file->Size() != sizeof(header) + bounds.size() * sizeof(Bounds2f)) {
+        Warning("%s: ignoring stale or corrupt lens cache file.", filename);
+        return false;
+    }
+    std::memcpy(&header, file->Data(), sizeof(header));
+    if (std::memcmp(header.magic, "pbrtlns", 8) != 0 ||
+        header.version != LensCacheVersion || header.floatSize != sizeof(Float) ||
+        header.key != key || header.nBounds != bounds.size()) {
+        Warning("%s: ignoring stale or corrupt lens cache file.", filename);
+        return false;
+    }
+    std::memcpy(bounds.data(), file->Data() + sizeof(header),
+                bounds.size() * sizeof(Bounds2f));
+
+    ++lensCacheHits;
+    LOG_VERBOSE("Loaded exit pupil bounds from cache file %s", filename);
+    return true;
+}
+
+static void WriteLensCache(const std::string &filename, uint64_t key,
+                           pstd::span<const Bounds2f> bounds) {
+    LensCacheHeader header;
+    std::memcpy(header.magic, "pbrtlns", 8);
+    header.version = LensCacheVersion;
+    header.floatSize = sizeof(Float);
+    header.key = key;
+    header.nBounds = bounds.size();
+    std::string contents(sizeof(header) + bounds.size() * sizeof(Bounds2f), '\0');
+    std::memcpy(&contents[0], &header, sizeof(header));
+    std::memcpy(&contents[sizeof(header)], bounds.data(),
+                bounds.size() * sizeof(Bounds2f));
+
+    if (!WriteFileAtomic(filename, contents)) {
+        Warning("%s: unable to write lens cache file.", filename);
+        return;
+    }
+    LOG_VERBOSE("Wrote exit pupil bounds to cache file %s", filename);
+}
+
 // RealisticCamera Method Definitions
 RealisticCamera::RealisticCamera(CameraBaseParameters baseParameters,
                                  std::vector<Float> &lensParameters, Float focusDistance,
@@ -757,11 +828,37 @@ RealisticCamera::RealisticCamera(CameraBaseParameters baseParameters,
     // Compute exit pupil bounds at sampled points on the film
     int nSamples = 64;
     exitPupilBounds.resize(nSamples);
-    ParallelFor(0, nSamples, [&](int i) {
-        Float r0 = (Float)i / nSamples * film.Diagonal() / 2;
-        Float r1 = (Float)(i + 1) / nSamples * film.Diagonal() / 2;
-        exitPupilBounds[i] = BoundExitPupil(r0, r1);
-    });
+    // The bounds only depend on the lens system, the aperture image and the
+    // film's size, so they can be reused from a cache file
+    std::string cacheFilename;
+    uint64_t cacheKey = 0;
+    if (!Options->lensCacheDirectory.empty()) {
+        uint64_t apertureHash = 0;
+        if (apertureImage) {
+            Point2i res = apertureImage.Resolution();
+            apertureHash = Hash(HashBuffer(apertureImage.RawPointer({0, 0}),
+                                           size_t(res.x) * res.y *
+                                               apertureImage.NChannels() *
+                                               TexelBytes(apertureImage.Format())),
+                                res, apertureImage.Format());
+        }
+        cacheKey = Hash(HashBuffer(elementInterfaces.data(),
+                                   elementInterfaces.size() *
+                                       sizeof(LensElementInterface)),
+                        apertureHash, film.Diagonal(), nSamples, LensCacheVersion);
+        cacheFilename = StringPrintf("%s/lens-%016llx.bin", Options->lensCacheDirectory,
+                                     (unsigned long long)cacheKey);
+    }
+    if (cacheFilename.empty() ||
+        !ReadLensCache(cacheFilename, cacheKey, pstd::MakeSpan(exitPupilBounds))) {
+        ParallelFor(0, nSamples, [&](int i) {
+            Float r0 = (Float)i / nSamples * film.Diagonal() / 2;
+            Float r1 = (Float)(i + 1) / nSamples * film.Diagonal() / 2;
+            exitPupilBounds[i] = BoundExitPupil(r0, r1);
+        });
+        if (!cacheFilename.empty())
+            WriteLensCache(cacheFilename, cacheKey, pstd::MakeConstSpan(exitPupilBounds));
+    }
 
     // Compute minimum differentials for _RealisticCamera_
     FindMinimumDifferentials(this);
@@ -882,29 +979,42 @@ Float RealisticCamera::FocusThickLens(Float focusDistance) {
 }
 
 Bounds2f RealisticCamera::BoundExitPupil(Float filmX0, Float filmX1) const {
-    Bounds2f pupilBounds;
     // Sample a collection of points on the rear lens to find exit pupil
     const int nSamples = 1024 * 1024;
-    int nExitingRays = 0;
     // Compute bounding box of projection of rear element on sampling plane
     Float rearRadius = RearElementRadius();
     Bounds2f projRearBounds(Point2f(-1.5f * rearRadius, -1.5f * rearRadius),
                             Point2f(1.5f * rearRadius, 1.5f * rearRadius));
 
-    for (int i = 0; i < nSamples; ++i) {
-        // Find location of sample points on $x$ segment and rear lens element
-        Point3f pFilm(Lerp((i + 0.5f) / nSamples, filmX0, filmX1), 0, 0);
-        Float u[2] = {RadicalInverse(0, i), RadicalInverse(1, i)};
-        Point3f pRear(Lerp(u[0], projRearBounds.pMin.x, projRearBounds.pMax.x),
-                      Lerp(u[1], projRearBounds.pMin.y, projRearBounds.pMax.y),
-                      LensRearZ());
-
-        // Expand pupil bounds if ray makes it through the lens system
-        if (Inside(Point2f(pRear.x, pRear.y), pupilBounds) ||
-            TraceLensesFromFilm(Ray(pFilm, pRear - pFilm), nullptr)) {
-            pupilBounds = Union(pupilBounds, Point2f(pRear.x, pRear.y));
-            ++nExitingRays;
+    // Bound the samples in parallel over chunks of them; the union of the
+    // chunks' bounds is the same as if they had all been processed in order
+    constexpr int nChunks = 16;
+    Bounds2f chunkBounds[nChunks];
+    int chunkExitingRays[nChunks] = {};
+    ParallelFor(0, nChunks, [&](int64_t chunk) {
+        Bounds2f &pupilBounds = chunkBounds[chunk];
+        for (int i = chunk * (nSamples / nChunks); i < (chunk + 1) * (nSamples / nChunks);
+             ++i) {
+            // Find location of sample points on $x$ segment and rear lens element
+            Point3f pFilm(Lerp((i + 0.5f) / nSamples, filmX0, filmX1), 0, 0);
+            Float u[2] = {RadicalInverse(0, i), RadicalInverse(1, i)};
+            Point3f pRear(Lerp(u[0], projRearBounds.pMin.x, projRearBounds.pMax.x),
+                          Lerp(u[1], projRearBounds.pMin.y, projRearBounds.pMax.y),
+                          LensRearZ());
+
+            // Expand pupil bounds if ray makes it through the lens system
+            if (Inside(Point2f(pRear.x, pRear.y), pupilBounds) ||
+                TraceLensesFromFilm(Ray(pFilm, pRear - pFilm), nullptr)) {
+                pupilBounds = Union(pupilBounds, Point2f(pRear.x, pRear.y));
+                ++chunkExitingRays[chunk];
+            }
         }
+    });
+    Bounds2f pupilBounds;
+    int nExitingRays = 0;
+    for (int chunk = 0; chunk < nChunks; ++chunk) {
+        pupilBounds = Union(pupilBounds, chunkBounds[chunk]);
+        nExitingRays += chunkExitingRays[chunk];
     }
 
     // Return entire element bounds if no rays made it through the lens system
@@ -28,6 +28,9 @@ class CameraTransform {
     // CameraTransform Public Methods
     CameraTransform() = default;
     explicit CameraTransform(const AnimatedTransform &worldFromCamera);
+    CameraTransform(const AnimatedTransform &renderFromCamera,
+                    const Transform &worldFromRender)
+        : renderFromCamera(renderFromCamera), worldFromRender(worldFromRender) {}
 
     PBRT_CPU_GPU
     Point3f RenderFromCamera(const Point3f &p, Float time) const {
@@ -401,12 +401,39 @@ bool CyHair::ToCubicBezierCurves(std::vector<float> *vertices,
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <cstdint>
+#include <string>
 #include <vector>
 
+// Writes _v_ as 4 little-endian bytes.
+static void write_le32(uint32_t v, FILE *f) {
+    unsigned char bytes[4] = {(unsigned char)v, (unsigned char)(v >> 8),
+                              (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+    fwrite(bytes, 1, 4, f);
+}
+
+static void write_le32(float v, FILE *f) {
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof(float));
+    write_le32(bits, f);
+}
+
 int main(int argc, char *argv[]) {
+    // With --binary, the curves are written to a binary curve set file
+    // alongside the pbrt file, which is much faster to load than text.
+    bool binary = argc > 1 && strcmp(argv[1], "--binary") == 0;
+    if (binary) {
+        --argc;
+        ++argv;
+    }
+
     if (argc <= 2 || strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
-        fprintf(stderr, "usage: cyhair2pbrt [CyHair filename] [pbrt output filename] "
-                        "(max strands) (thickness)\n");
+        fprintf(stderr, "usage: cyhair2pbrt (--binary) [CyHair filename] "
+                        "[pbrt output filename] (max strands) (thickness)\n");
+        return EXIT_FAILURE;
+    }
+    if (binary && strcmp(argv[2], "-") == 0) {
+        fprintf(stderr, "cyhair2pbrt: --binary requires an output filename\n");
         return EXIT_FAILURE;
     }
 
@@ -461,7 +488,43 @@ int main(int argc, char *argv[]) {
             bounds[0][1], bounds[0][2], bounds[1][0], bounds[1][1], bounds[1][2]);
 
     const size_t num_curves = radiuss.size() / 4;
-    for (size_t i = 0; i < num_curves; i++) {
+    if (binary) {
+        // See Curve::CreateSet() for the format of curve set files.
+        std::string curves_filename = argv[2];
+        size_t dot = curves_filename.rfind('.');
+        if (dot != std::string::npos &&
+            curves_filename.find('/', dot) == std::string::npos)
+            curves_filename.erase(dot);
+        curves_filename += ".curves";
+
+        FILE *cf = fopen(curves_filename.c_str(), "wb");
+        if (!cf) {
+            perror(curves_filename.c_str());
+            return EXIT_FAILURE;
+        }
+        fwrite("PBRTCRV1", 1, 8, cf);
+        write_le32(static_cast<uint32_t>(num_curves), cf);
+        write_le32(uint32_t(0), cf);
+        for (size_t i = 0; i < 12 * num_curves; i++)
+            write_le32(points[i], cf);
+        for (size_t i = 0; i < num_curves; i++) {
+            write_le32(radiuss[4 * i + 0], cf);
+            write_le32(radiuss[4 * i + 3], cf);
+        }
+        if (fclose(cf) != 0) {
+            perror(curves_filename.c_str());
+            return EXIT_FAILURE;
+        }
+
+        // The scene file refers to the curve set file relative to itself.
+        size_t slash = curves_filename.rfind('/');
+        if (slash != std::string::npos)
+            curves_filename.erase(0, slash + 1);
+        fprintf(f, "Shape \"curveset\" \"string type\" [ \"cylinder\" ] "
+                   "\"string filename\" [ \"%s\" ]\n",
+                curves_filename.c_str());
+    }
+    for (size_t i = 0; !binary && i < num_curves; i++) {
         fprintf(f, R"(Shape "curve" "string type" [ "cylinder" ] "point3 P" [ )");
         for (size_t j = 0; j < 12; j++) {
             fprintf(f, "%f ", static_cast<double>(points[12 * i + j]));
@@ -14,6 +14,7 @@
 #include <pbrt/util/image.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/mipmap.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/rng.h>
@@ -29,11 +30,14 @@ extern "C" {
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 
 #include <flip.h>
@@ -73,6 +77,12 @@ static std::map<std::string, CommandUsage> commandUsage = {
 )")}},
     {"average", {"average [options] <filename base>", std::string(R"(
     --outfile          Output image filename.
+)")}},
+    {"batch", {"batch [options] <job file>\nwhere each line of <job file> is an "
+               "average, convert, diff, error, or falsecolor command line",
+               std::string(R"(
+    --jobs <n>         Maximum number of jobs to run concurrently.
+                       Default: the number of threads.
 )")}},
     {"cat", {"cat [options] <filename>", std::string(R"(
     --csv              Output pixel values in CSV format.
@@ -90,15 +100,29 @@ static std::map<std::string, CommandUsage> commandUsage = {
                        added to the original image. Default: 0.3
     --width <w>        Width of Gaussian used to generate bloom images.
                        Default: 15
+)")}},
+    {"convergence",
+     {"convergence [options] <filenames...>\nwhere each file was written using "
+      "pbrt's --mse-reference-out option",
+      std::string(R"(
+    --error <v>        Error to report the time to reach for each run.
+                       Default: the largest of the runs' final errors.
+    --metric <name>    Error metric to compare. (Options: "MSE", "relMSE",
+                       "FLIP"). Default: MSE
 )")}},
     {"convert", {"convert [options] <filename>", std::string(R"(
     --aces-filmic      Apply the ACES filmic s-curve to map values to [0,1].
+    --blur <sigma>     Blur the image with a Gaussian of the given standard
+                       deviation, in pixels. Default: 0 (none).
     --bw               Convert to black and white (average channels)
     --channels <names> Process the provided comma-delineated set of channels.
                        Default: R,G,B.
     --crop <x0,x1,y0,y1> Crop image to the given dimensions. Default: no crop.
     --colorspace <n>   Convert image to given colorspace.
                        (Options: "ACES2065-1", "Rec2020", "sRGB")
+    --compression <n>  zlib compression level for PNG output, from 0 (none) to
+                       9 (smallest); 0 also writes uncompressed EXR.
+                       Default: 6.
     --despike <v>      For any pixels with a luminance value greater than <v>,
                        replace the pixel with the median of the 3x3 neighboring
                        pixels. Default: infinity (i.e., disabled).
@@ -128,6 +152,9 @@ static std::map<std::string, CommandUsage> commandUsage = {
 )")}},
     {"denoise", {"denoise [options] <filename>", std::string(R"( options:
     --outfile <name>   Filename to use for the denoised image.
+    --tilesize <n>     Size of the square tiles that are denoised in parallel;
+                       memory use for temporary images grows with it.
+                       Default: 256.
 )")}},
 #ifdef PBRT_BUILD_GPU_RENDERER
     {"denoise-optix", {"denoise-optix [options] <filename>", std::string(R"( options:
@@ -157,13 +184,26 @@ static std::map<std::string, CommandUsage> commandUsage = {
     {"makeemitters", {"makeemitters [options] <filename>", std::string(R"(
     --downsample <n>   Downsample the image by a factor of n in both dimensions
                        (using simple box filtering). Default: 1.
+)")}},
+    {"makemip", {"makemip [options] <filename>", std::string(R"(
+    --encoding <enc>   Color encoding of 8-bit images. Default: sRGB for PNG
+                       files, linear otherwise.
+    --outfile <name>   Filename for MIP pyramid. Default: input filename
+                       with a ".mip" extension.
+    --wrap <mode>      Wrap mode used to filter the pyramid ("repeat", "clamp",
+                       "black", or "octahedralsphere"). Default: repeat
 )")}},
     {"makesky", {"makesky [options] <filename>", std::string(R"(
     --albedo <a>       Albedo of ground-plane (range 0-1). Default: 0.5
     --elevation <e>    Elevation of the sun in degrees (range 0-90). Default: 10
+    --endelevation <e> Elevation of the sun in the last map of a sequence.
+                       Default: same as --elevation.
     --outfile <name>   Filename to store environment map in.
     --turbidity <t>    Atmospheric turbidity (range 1.7-10). Default: 3
     --resolution <r>   Resolution of generated environment map. Default: 2048
+    --sequence <n>     Generate n maps with the sun's elevation evenly spaced
+                       from --elevation to --endelevation, numbered
+                       <outfile>-0000, <outfile>-0001, ... Default: 1
 )")}},
     {"whitebalance", {"whitebalance [options] <filename>", std::string(R"(
     --illuminant <n>   Apply white balance for the given standard illuminant
@@ -229,8 +269,9 @@ int makesky(int argc, char *argv[]) {
     std::string outfile;
     Float albedo = 0.5;
     Float turbidity = 3.;
-    Float elevation = 10;
+    Float elevation = 10, endElevation = -1;
     int resolution = 2048;
+    int sequence = 1;
 
     while (*argv != nullptr) {
         auto onError = [](const std::string &err) {
@@ -241,7 +282,9 @@ int makesky(int argc, char *argv[]) {
             ParseArg(&argv, "albedo", &albedo, onError) ||
             ParseArg(&argv, "turbidity", &turbidity, onError) ||
             ParseArg(&argv, "elevation", &elevation, onError) ||
-            ParseArg(&argv, "resolution", &resolution, onError)) {
+            ParseArg(&argv, "endelevation", &endElevation, onError) ||
+            ParseArg(&argv, "resolution", &resolution, onError) ||
+            ParseArg(&argv, "sequence", &sequence, onError)) {
             // success
         } else
             onError(StringPrintf("argument %s invalid", *argv));
@@ -255,14 +298,15 @@ int makesky(int argc, char *argv[]) {
         usage("makesky", "--turbidity must be between 1.7 and 10.");
     if (elevation < 0. || elevation > 90.)
         usage("makesky", "--elevation must be between 0. and 90.");
-    elevation = Radians(elevation);
+    if (sequence < 1)
+        usage("makesky", "--sequence must be >= 1");
+    if (endElevation == -1)
+        endElevation = elevation;
+    else if (endElevation < 0. || endElevation > 90.)
+        usage("makesky", "--endelevation must be between 0. and 90.");
     if (resolution < 1)
         usage("makesky", "--resolution must be >= 1");
 
-    // Vector pointing at the sun. Note that elevation is measured from the
-    // horizon--not the zenith, as it is elsewhere in pbrt.
-    Vector3f sunDir(0., std::cos(elevation), std::sin(elevation));
-
     Image img(PixelFormat::Float, {resolution, resolution}, {"R", "G", "B"});
 
     // They assert wavelengths are in this range...
@@ -271,49 +315,109 @@ int makesky(int argc, char *argv[]) {
     for (int i = 0; i < nLambda; ++i)
         lambda[i] = Lerp(i / Float(nLambda - 1), 320, 720);
 
-    // Assume a uniform spectral albedo
-    ArHosekSkyModelState *skymodel_state =
-        arhosekskymodelstate_alloc_init(elevation, turbidity, albedo);
+    // The sky's spectrum is piecewise-linear over _lambda_, so its XYZ color
+    // is a linear function of the radiance values there. Find the color of
+    // each wavelength's basis function so that each pixel's color is just a
+    // weighted sum of them.
+    std::vector<XYZ> lambdaXYZ(nLambda);
+    for (int i = 0; i < nLambda; ++i) {
+        std::vector<Float> basis(nLambda, Float(0));
+        basis[i] = 1;
+        PiecewiseLinearSpectrum spec(pstd::MakeConstSpan(lambda),
+                                     pstd::MakeConstSpan(basis));
+        lambdaXYZ[i] = SpectrumToXYZ(&spec);
+    }
 
-    const RGBColorSpace *colorSpace = RGBColorSpace::ACES2065_1;
-    XYZ illumXYZ = SpectrumToXYZ(&colorSpace->illuminant);
-
-    ParallelFor(0, resolution, [&](int64_t start, int64_t end) {
-        std::vector<Float> skyv(lambda.size());
-        for (int64_t iy = start; iy < end; ++iy) {
-            Float y = (iy + 0.5f) / resolution;
-            for (int ix = 0; ix < resolution; ++ix) {
-                Float x = (ix + 0.5f) / resolution;
-                Vector3f v = EqualAreaSquareToSphere({x, y});
-                if (v.z <= 0)
-                    // downward hemisphere
-                    continue;
+    // Away from the sun, the model's radiance at each wavelength is
+    // interpolated between its 11 channels at 40nm spacing, as in
+    // arhosekskymodel_radiance(). Each channel is evaluated once per pixel
+    // and the interpolation is done here.
+    constexpr int nChannels = 11;
+    std::vector<int> lowChannel(nLambda);
+    std::vector<double> channelInterp(nLambda);
+    for (int i = 0; i < nLambda; ++i) {
+        lowChannel[i] = (lambda[i] - 320.0) / 40.0;
+        channelInterp[i] = std::fmod((lambda[i] - 320.0) / 40.0, 1.0);
+    }
 
-                Float theta = SphericalTheta(v);
+    const RGBColorSpace *colorSpace = RGBColorSpace::ACES2065_1;
+    ImageMetadata metadata;
+    metadata.colorSpace = colorSpace;
 
-                // Compute the angle between the pixel's direction and the sun
-                // direction.
-                Float gamma = SafeACos(Dot(v, sunDir));
-                DCHECK(gamma >= 0 && gamma <= Pi);
+    for (int frame = 0; frame < sequence; ++frame) {
+        // Vector pointing at the sun. Note that elevation is measured from
+        // the horizon--not the zenith, as it is elsewhere in pbrt.
+        Float sunElevation = Radians(
+            sequence == 1 ? elevation
+                          : Lerp(frame / Float(sequence - 1), elevation, endElevation));
+        Vector3f sunDir(0., std::cos(sunElevation), std::sin(sunElevation));
+
+        // Assume a uniform spectral albedo
+        ArHosekSkyModelState *skymodel_state =
+            arhosekskymodelstate_alloc_init(sunElevation, turbidity, albedo);
+        // Directions where the sun's disk may be visible are handled by the
+        // model's own per-wavelength evaluation.
+        double sunDiskSin = 1.0001 * std::sin(skymodel_state->solar_radius);
+
+        ParallelFor(0, resolution, [&](int64_t start, int64_t end) {
+            std::vector<Float> skyv(nLambda);
+            double channels[nChannels];
+            for (int64_t iy = start; iy < end; ++iy) {
+                Float y = (iy + 0.5f) / resolution;
+                for (int ix = 0; ix < resolution; ++ix) {
+                    Float x = (ix + 0.5f) / resolution;
+                    Vector3f v = EqualAreaSquareToSphere({x, y});
+                    if (v.z <= 0)
+                        // downward hemisphere
+                        continue;
 
-                for (int i = 0; i < lambda.size(); ++i)
-                    skyv[i] = arhosekskymodel_solar_radiance(skymodel_state, theta, gamma,
-                                                             lambda[i]);
+                    Float theta = SphericalTheta(v);
+
+                    // Compute the angle between the pixel's direction and the
+                    // sun direction.
+                    Float gamma = SafeACos(Dot(v, sunDir));
+                    DCHECK(gamma >= 0 && gamma <= Pi);
+
+                    if (std::sin(double(gamma)) <= sunDiskSin) {
+                        for (int i = 0; i < nLambda; ++i)
+                            skyv[i] = arhosekskymodel_solar_radiance(
+                                skymodel_state, theta, gamma, lambda[i]);
+                    } else {
+                        for (int c = 0; c < nChannels; ++c)
+                            channels[c] = arhosekskymodel_radiance(
+                                skymodel_state, theta, gamma, 320 + 40 * c);
+                        for (int i = 0; i < nLambda; ++i) {
+                            int c = lowChannel[i];
+                            double interp = channelInterp[i];
+                            if (interp < 1e-6)
+                                skyv[i] = channels[c];
+                            else
+                                skyv[i] = (1.0 - interp) * channels[c] +
+                                          (c + 1 < nChannels ? interp * channels[c + 1]
+                                                             : 0.0);
+                        }
+                    }
 
-                PiecewiseLinearSpectrum spec(pstd::MakeConstSpan(lambda),
-                                             pstd::MakeConstSpan(skyv));
-                XYZ xyz = SpectrumToXYZ(&spec);
-                RGB rgb = colorSpace->ToRGB(xyz);
+                    XYZ xyz;
+                    for (int i = 0; i < nLambda; ++i)
+                        xyz += skyv[i] * lambdaXYZ[i];
+                    RGB rgb = colorSpace->ToRGB(xyz);
 
-                for (int c = 0; c < 3; ++c)
-                    img.SetChannel({ix, int(iy)}, c, rgb[c]);
+                    for (int c = 0; c < 3; ++c)
+                        img.SetChannel({ix, int(iy)}, c, rgb[c]);
+                }
             }
-        }
-    });
+        });
+        arhosekskymodelstate_free(skymodel_state);
 
-    ImageMetadata metadata;
-    metadata.colorSpace = colorSpace;
-    CHECK(img.Write(outfile, metadata));
+        // Sequences are written to numbered files
+        std::string filename = outfile;
+        if (sequence > 1) {
+            std::string base = RemoveExtension(outfile);
+            filename = base + StringPrintf("-%04d", frame) + outfile.substr(base.size());
+        }
+        CHECK(img.Write(filename, metadata));
+    }
 
     return 0;
 }
@@ -570,6 +674,36 @@ static bool checkImageCompatibility(const std::string &fn1, const Image &im1,
     return true;
 }
 
+// Reference Image Cache
+// While a batch of jobs runs, each reference image is read once and then
+// copied for the jobs that use it, so that many diffs against the same
+// reference don't each decode it again.
+static bool cacheReferenceImages = false;
+
+struct CachedReferenceImage {
+    std::once_flag read;
+    ImageAndMetadata im;
+};
+
+static std::mutex referenceCacheMutex;
+static std::map<std::string, std::unique_ptr<CachedReferenceImage>> referenceCache;
+
+static ImageAndMetadata ReadReferenceImage(const std::string &filename) {
+    if (!cacheReferenceImages)
+        return Image::Read(filename);
+
+    CachedReferenceImage *cached;
+    {
+        std::lock_guard<std::mutex> lock(referenceCacheMutex);
+        std::unique_ptr<CachedReferenceImage> &entry = referenceCache[filename];
+        if (!entry)
+            entry = std::make_unique<CachedReferenceImage>();
+        cached = entry.get();
+    }
+    std::call_once(cached->read, [&]() { cached->im = Image::Read(filename); });
+    return cached->im;
+}
+
 int average(int argc, char *argv[]) {
     std::string avgFile, filenameBase;
 
@@ -692,7 +826,7 @@ int error(int argc, char *argv[]) {
 
     if (referenceFile.empty())
         usage("error", "must provide --reference file.");
-    ImageAndMetadata ref = Image::Read(referenceFile);
+    ImageAndMetadata ref = ReadReferenceImage(referenceFile);
     Image &referenceImage = ref.image;
 
     // If last 2 are negative, they're taken as deltas
@@ -834,7 +968,7 @@ int diff(int argc, char *argv[]) {
         usage("diff", "%s: --metric must be \"MAE\", \"MSE\", \"MRSE\", or \"FLIP\".",
               metric.c_str());
 
-    ImageAndMetadata refRead = Image::Read(referenceFile);
+    ImageAndMetadata refRead = ReadReferenceImage(referenceFile);
     Image &refImage = refRead.image;
     const ImageMetadata &refMetadata = refRead.metadata;
 
@@ -1269,6 +1403,114 @@ int falsecolor(int argc, char *argv[]) {
     return 0;
 }
 
+int convergence(int argc, char *argv[]) {
+    std::string metric = "MSE";
+    Float targetError = 0;
+    std::vector<std::string> filenames;
+
+    while (*argv != nullptr) {
+        auto onError = [](const std::string &err) {
+            usage("convergence", "%s", err.c_str());
+            exit(1);
+        };
+
+        if (ParseArg(&argv, "error", &targetError, onError) ||
+            ParseArg(&argv, "metric", &metric, onError)) {
+            // success
+        } else if (argv[0][0] != '-') {
+            filenames.push_back(*argv);
+            ++argv;
+        } else
+            usage("convergence", "%s: unknown argument", *argv);
+    }
+
+    if (filenames.empty())
+        usage("convergence", "must provide one or more filenames.");
+    int column = 2;
+    if (metric == "MSE")
+        column = 2;
+    else if (metric == "relMSE")
+        column = 3;
+    else if (metric == "FLIP")
+        column = 4;
+    else
+        usage("convergence", "%s: --metric must be \"MSE\", \"relMSE\", or \"FLIP\".",
+              metric.c_str());
+
+    // Read the (seconds, spp, error) values logged for each run
+    struct LogEntry {
+        double seconds;
+        int spp;
+        double error;
+    };
+    std::vector<std::vector<LogEntry>> runs;
+    for (const std::string &filename : filenames) {
+        std::vector<LogEntry> run;
+        std::vector<std::string> lines = SplitString(ReadFileContents(filename), '\n');
+        for (size_t i = 0; i < lines.size(); ++i) {
+            if (lines[i].empty() || lines[i][0] == '#')
+                continue;
+            std::vector<double> values = SplitStringToDoubles(lines[i], ',');
+            if (values.size() != 5) {
+                fprintf(stderr, "%s:%d: expected five comma-separated values.\n",
+                        filename.c_str(), int(i + 1));
+                return 1;
+            }
+            if (std::isnan(values[column])) {
+                fprintf(stderr, "%s:%d: %s wasn't computed for this run.\n",
+                        filename.c_str(), int(i + 1), metric.c_str());
+                return 1;
+            }
+            run.push_back({values[0], int(values[1]), values[column]});
+        }
+        if (run.empty()) {
+            fprintf(stderr, "%s: no errors were logged.\n", filename.c_str());
+            return 1;
+        }
+        runs.push_back(std::move(run));
+    }
+
+    // By default, report the time to reach an error that all runs reached
+    if (targetError <= 0)
+        for (const std::vector<LogEntry> &run : runs)
+            targetError = std::max<Float>(targetError, run.back().error);
+
+    // Returns the time at which the run's error first reaches _targetError_,
+    // interpolating between the logged errors in log-log space, or infinity
+    // if it doesn't.
+    auto timeToError = [&](const std::vector<LogEntry> &run) {
+        for (size_t i = 0; i < run.size(); ++i) {
+            if (run[i].error > targetError)
+                continue;
+            if (i == 0 || run[i - 1].seconds <= 0 || run[i].error <= 0 ||
+                run[i].error == run[i - 1].error)
+                return run[i].seconds;
+            double t = std::log(targetError / run[i - 1].error) /
+                       std::log(run[i].error / run[i - 1].error);
+            return run[i - 1].seconds *
+                   std::pow(run[i].seconds / run[i - 1].seconds, Clamp(t, 0, 1));
+        }
+        return double(Infinity);
+    };
+
+    // Efficiency is the inverse of the product of error and time, which,
+    // for unbiased Monte Carlo, is independent of the number of samples.
+    Printf("%-30s %8s %10s %12s %12s %12s %8s\n", "file", "spp", "seconds",
+           metric, "efficiency", "time to err", "speedup");
+    double baseTime = timeToError(runs[0]);
+    for (size_t i = 0; i < runs.size(); ++i) {
+        const LogEntry &last = runs[i].back();
+        double time = timeToError(runs[i]);
+        Printf("%-30s %8d %10.3f %12.6g %12.6g %12.4f %7.3fx\n", filenames[i],
+               last.spp, last.seconds, last.error, 1 / (last.error * last.seconds),
+               time, baseTime / time);
+    }
+    Printf("(time to err: seconds to reach %s = %g; speedup is relative to %s.)\n",
+           metric, targetError, filenames[0]);
+
+    return 0;
+}
+
 int info(int argc, char *argv[]) {
     int err = 0;
     for (int i = 0; i < argc; ++i) {
@@ -1320,25 +1562,28 @@ int bloom(int argc, char *argv[]) {
     std::vector<Image> blurred;
 
     // First, threshold the source image
-    int nSurvivors = 0;
     Point2i res = image.Resolution();
     int nc = image.NChannels();
     Image thresholdedImage(PixelFormat::Float, image.Resolution(), image.ChannelNames());
-    for (int y = 0; y < res.y; ++y) {
-        for (int x = 0; x < res.x; ++x) {
-            bool overThreshold = false;
-            for (int c = 0; c < nc; ++c)
-                if (image.GetChannel({x, y}, c) > level)
-                    overThreshold = true;
-            if (overThreshold) {
-                ++nSurvivors;
-                for (int c = 0; c < nc; ++c)
-                    thresholdedImage.SetChannel({x, y}, c, image.GetChannel({x, y}, c));
-            } else
+    std::atomic<int> nSurvivors{0};
+    ParallelFor(0, res.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                bool overThreshold = false;
                 for (int c = 0; c < nc; ++c)
-                    thresholdedImage.SetChannel({x, y}, c, 0.f);
+                    if (image.GetChannel({x, y}, c) > level)
+                        overThreshold = true;
+                if (overThreshold) {
+                    ++nSurvivors;
+                    for (int c = 0; c < nc; ++c)
+                        thresholdedImage.SetChannel({x, y}, c,
+                                                    image.GetChannel({x, y}, c));
+                } else
+                    for (int c = 0; c < nc; ++c)
+                        thresholdedImage.SetChannel({x, y}, c, 0.f);
+            }
         }
-    }
+    });
     if (nSurvivors == 0) {
         fprintf(stderr, "imgtool: no pixels were above bloom threshold %f\n", level);
         return 1;
@@ -1362,21 +1607,23 @@ int bloom(int argc, char *argv[]) {
     }
 
     // Finally, add all of the blurred images, scaled, to the original.
-    for (int y = 0; y < res.y; ++y) {
-        for (int x = 0; x < res.x; ++x) {
-            for (int c = 0; c < nc; ++c) {
-                Float blurredSum = 0.f;
-                // Skip the thresholded image, since it's already
-                // present in the original; just add pixels from the
-                // blurred ones.
-                for (size_t j = 1; j < blurred.size(); ++j)
-                    blurredSum += blurred[j].GetChannel({x, y}, c);
-                image.SetChannel(
-                    {x, y}, c,
-                    image.GetChannel({x, y}, c) + (scale / iterations) * blurredSum);
+    ParallelFor(0, res.y, [&](int64_t y0, int64_t y1) {
+        for (int y = y0; y < y1; ++y) {
+            for (int x = 0; x < res.x; ++x) {
+                for (int c = 0; c < nc; ++c) {
+                    Float blurredSum = 0.f;
+                    // Skip the thresholded image, since it's already
+                    // present in the original; just add pixels from the
+                    // blurred ones.
+                    for (size_t j = 1; j < blurred.size(); ++j)
+                        blurredSum += blurred[j].GetChannel({x, y}, c);
+                    image.SetChannel({x, y}, c,
+                                     image.GetChannel({x, y}, c) +
+                                         (scale / iterations) * blurredSum);
+                }
             }
         }
-    }
+    });
 
     image.Write(outFile);
 
@@ -1387,10 +1634,12 @@ int convert(int argc, char *argv[]) {
     bool acesFilmic = false;
     float scale = 1.f, gamma = 1.f;
     int repeat = 1;
+    int compressionLevel = 6;
     bool flipy = false;
     bool tonemap = false;
     Float maxY = 1.;
     Float despikeLimit = Infinity;
+    Float blurSigma = 0;
     bool preserveColors = false;
     bool bw = false;
     std::string inFile, outFile;
@@ -1405,9 +1654,11 @@ int convert(int argc, char *argv[]) {
         };
 
         if (ParseArg(&argv, "acesfilmic", &acesFilmic, onError) ||
+            ParseArg(&argv, "blur", &blurSigma, onError) ||
             ParseArg(&argv, "bw", &bw, onError) ||
             ParseArg(&argv, "channels", &channelNames, onError) ||
             ParseArg(&argv, "colorspace", &colorspace, onError) ||
+            ParseArg(&argv, "compression", &compressionLevel, onError) ||
             ParseArg(&argv, "crop", pstd::MakeSpan(cropWindow), onError) ||
             ParseArg(&argv, "despike", &despikeLimit, onError) ||
             ParseArg(&argv, "flipy", &flipy, onError) ||
@@ -1426,12 +1677,16 @@ int convert(int argc, char *argv[]) {
             usage("convert", "%s: unknown command flag", *argv);
     }
 
+    if (blurSigma < 0)
+        usage("convert", "--blur value must be non-negative");
     if (maxY <= 0)
         usage("convert", "--maxluminance value must be greater than zero");
     if (repeat <= 0)
         usage("convert", "--repeatpix value must be greater than zero");
     if (scale == 0)
         usage("convert", "--scale value must be non-zero");
+    if (compressionLevel < 0 || compressionLevel > 9)
+        usage("convert", "--compression level must be between 0 and 9");
     if (outFile.empty())
         usage("convert", "--outfile filename must be specified");
     if (inFile.empty())
@@ -1567,6 +1822,11 @@ int convert(int argc, char *argv[]) {
         fprintf(stderr, "%s: despiked %d pixels\n", inFile.c_str(), despikeCount);
     }
 
+    if (blurSigma > 0) {
+        int halfWidth = std::ceil(3 * blurSigma);
+        image = image.GaussianFilter(image.AllChannelsDesc(), halfWidth, blurSigma);
+    }
+
     if (scale != 1) {
         for (int y = 0; y < res.y; ++y)
             for (int x = 0; x < res.x; ++x)
@@ -1649,7 +1909,9 @@ int convert(int argc, char *argv[]) {
     if (flipy)
         image.FlipY();
 
-    if (!image.Write(outFile))
+    ImageMetadata outMetadata;
+    outMetadata.compressionLevel = compressionLevel;
+    if (!image.Write(outFile, outMetadata))
         return 1;
 
     return 0;
@@ -1806,6 +2068,46 @@ int makeemitters(int argc, char *argv[]) {
     return 0;
 }
 
+int makemip(int argc, char *argv[]) {
+    std::string inFilename, outFilename, encodingName, wrapName = "repeat";
+
+    auto onError = [](const std::string &err) {
+        usage("makemip", "%s", err.c_str());
+        exit(1);
+    };
+    while (*argv != nullptr) {
+        if (ParseArg(&argv, "encoding", &encodingName, onError) ||
+            ParseArg(&argv, "outfile", &outFilename, onError) ||
+            ParseArg(&argv, "wrap", &wrapName, onError)) {
+            // success
+        } else if (argv[0][0] == '-')
+            usage("makemip", "%s: unknown command flag", *argv);
+        else if (inFilename.empty()) {
+            inFilename = *argv;
+            ++argv;
+        } else
+            usage("makemip", "multiple input filenames provided.");
+    }
+    if (inFilename.empty())
+        usage("makemip", "input image filename must be provided.");
+    if (outFilename.empty())
+        outFilename = RemoveExtension(inFilename) + ".mip";
+    if (inFilename == outFilename)
+        usage("makemip", "%s: output filename must differ from input.",
+              outFilename.c_str());
+
+    pstd::optional<WrapMode> wrapMode = ParseWrapMode(wrapName.c_str());
+    if (!wrapMode)
+        usage("makemip", "%s: wrap mode unknown", wrapName.c_str());
+    if (encodingName.empty())
+        encodingName = HasExtension(inFilename, "png") ? "sRGB" : "linear";
+    ColorEncodingHandle encoding = ColorEncodingHandle::Get(encodingName, {});
+
+    MIPMap *mipmap = MIPMap::CreateFromFile(inFilename, MIPMapFilterOptions(),
+                                            *wrapMode, encoding, {});
+    return mipmap->Write(outFilename) ? 0 : 1;
+}
+
 int makeequiarea(int argc, char *argv[]) {
     std::string inFilename, outFilename;
     int resolution = 0;
@@ -1922,9 +2224,6 @@ Image denoiseImage(const Image &in, const ImageChannelDesc &Ldesc,
     for (int i = 0; i <= halfWidth; ++i)
         f[i] = FastExp(-Float(i) / halfWidth * 3.f);
 
-    static int call = -1;
-    ++call;
-
     Image currentImage = std::move(illum);
     for (int i = 0; i < nLevels; ++i) {
         int delta = 1 << i;  // A-Trous step between samples.
@@ -2065,13 +2364,15 @@ Image denoiseImage(const Image &in, const ImageChannelDesc &Ldesc,
 
 int denoise(int argc, char *argv[]) {
     std::string inFilename, outFilename;
+    int tileSize = 256;
 
     auto onError = [](const std::string &err) {
         usage("denoise", "%s", err.c_str());
         exit(1);
     };
     while (*argv != nullptr) {
-        if (ParseArg(&argv, "outfile", &outFilename, onError)) {
+        if (ParseArg(&argv, "outfile", &outFilename, onError) ||
+            ParseArg(&argv, "tilesize", &tileSize, onError)) {
             // success
         } else if (argv[0][0] == '-')
             usage("denoise", "%s: unknown command flag", *argv);
@@ -2085,6 +2386,8 @@ int denoise(int argc, char *argv[]) {
         usage("denoise", "input image filename must be provided.");
     if (outFilename.empty())
         usage("denoise", "output image filename must be provided.");
+    if (tileSize < 1)
+        usage("denoise", "--tilesize must be at least 1.");
 
     ImageAndMetadata im = Image::Read(inFilename);
     Image &in = im.image;
@@ -2108,27 +2411,59 @@ int denoise(int argc, char *argv[]) {
     checkForChannels(nsDesc, "Nsx,Nsy,Nsz");
     ImageChannelDesc albedoDesc = in.GetChannelDesc({"Albedo.R", "Albedo.G", "Albedo.B"});
     checkForChannels(albedoDesc, "Albedo.R,Albedo.G,Albedo.B");
+    // GBufferFilm stores per-channel variance; it is averaged over R, G, and B
+    // after filtering.
     ImageChannelDesc varianceDesc = in.GetChannelDesc({"rgbVariance"});
-    checkForChannels(varianceDesc, "rgbVariance");
+    if (!varianceDesc)
+        varianceDesc = in.GetChannelDesc({"Variance.R", "Variance.G", "Variance.B"});
+    checkForChannels(varianceDesc, "rgbVariance or Variance.R,Variance.G,Variance.B");
 
-    ImageChannelDesc jointDesc = in.GetChannelDesc({"Pz", "Nx", "Ny", "Nz"});
     ImageChannelValues jointSigmaIndir(4, 1);
     Float xySigmaIndir[2] = {2.f, 2.f};
-    Image filteredVariance = in.JointBilateralFilter(varianceDesc, 7, xySigmaIndir,
-                                                     jointDesc, jointSigmaIndir);
-
+    int varianceHalfWidth = 7;
     int halfWidth = 3;
     int nLevels = 3;
-    Image denoisedImage = denoiseImage(in, rgbDesc, filteredVariance, albedoDesc, zDesc,
-                                       deltaZDesc, nsDesc, halfWidth, nLevels);
 
-    Image result(PixelFormat::Float, in.Resolution(), {"R", "G", "B"});
-    for (int y = 0; y < in.Resolution().y; ++y)
-        for (int x = 0; x < in.Resolution().x; ++x) {
-            ImageChannelValues Ldenoised = denoisedImage.GetChannels({x, y});
+    // Denoise the image in tiles. Each one is expanded by the footprint of the
+    // variance filter and all of the a-trous levels so that its interior
+    // matches denoising the whole image, while only the tiles in flight need
+    // temporary images.
+    int border = varianceHalfWidth - 1 + halfWidth * ((1 << nLevels) - 1);
+    Point2i resolution = in.Resolution();
+    Point2i nTiles((resolution.x + tileSize - 1) / tileSize,
+                   (resolution.y + tileSize - 1) / tileSize);
+    Image result(PixelFormat::Float, resolution, {"R", "G", "B"});
+    ParallelFor(0, nTiles.x * nTiles.y, [&](int64_t tile) {
+        Point2i pMin(tile % nTiles.x * tileSize, tile / nTiles.x * tileSize);
+        Bounds2i tileBounds(pMin, Min(pMin + Vector2i(tileSize, tileSize), resolution));
+        Bounds2i expanded = Intersect(Expand(tileBounds, border),
+                                      Bounds2i(Point2i(0, 0), resolution));
+        Image tileIn = in.Crop(expanded);
+
+        ImageChannelDesc jointDesc = tileIn.GetChannelDesc({"Pz", "Nx", "Ny", "Nz"});
+        Image filteredVariance = tileIn.JointBilateralFilter(
+            varianceDesc, varianceHalfWidth, xySigmaIndir, jointDesc, jointSigmaIndir);
+        if (filteredVariance.NChannels() > 1) {
+            Image averageVariance(PixelFormat::Float, filteredVariance.Resolution(),
+                                  {"Variance"});
+            for (int y = 0; y < filteredVariance.Resolution().y; ++y)
+                for (int x = 0; x < filteredVariance.Resolution().x; ++x)
+                    averageVariance.SetChannel(
+                        {x, y}, 0, filteredVariance.GetChannels({x, y}).Average());
+            filteredVariance = std::move(averageVariance);
+        }
+
+        Image denoisedImage =
+            denoiseImage(tileIn, rgbDesc, filteredVariance, albedoDesc, zDesc,
+                         deltaZDesc, nsDesc, halfWidth, nLevels);
+
+        for (Point2i p : tileBounds) {
+            ImageChannelValues Ldenoised =
+                denoisedImage.GetChannels(Point2i(p - expanded.pMin));
             for (int c = 0; c < 3; ++c)
-                result.SetChannel({x, y}, c, Ldenoised[c]);
+                result.SetChannel(p, c, Ldenoised[c]);
         }
+    });
 
     if (!result.Write(outFilename)) {
         fprintf(stderr, "%s: couldn't write image.\n", outFilename.c_str());
@@ -2280,6 +2615,85 @@ int denoise_optix(int argc, char *argv[]) {
 }
 #endif  // PBRT_BUILD_GPU_RENDERER
 
+int batch(int argc, char *argv[]) {
+    std::string jobFile;
+    int maxJobs = RunningThreads();
+
+    while (*argv != nullptr) {
+        auto onError = [](const std::string &err) {
+            usage("batch", "%s", err.c_str());
+            exit(1);
+        };
+
+        if (ParseArg(&argv, "jobs", &maxJobs, onError)) {
+            // success
+        } else if (argv[0][0] == '-') {
+            usage("batch", "%s: unknown command flag", *argv);
+        } else if (!jobFile.empty()) {
+            usage("batch", "%s: excess argument", *argv);
+        } else {
+            jobFile = *argv;
+            ++argv;
+        }
+    }
+
+    if (jobFile.empty())
+        usage("batch", "must specify job file.");
+    if (maxJobs < 1)
+        usage("batch", "--jobs must be at least 1.");
+
+    using Command = int (*)(int, char *[]);
+    const std::map<std::string, Command> commands = {{"average", average},
+                                                     {"convert", convert},
+                                                     {"diff", diff},
+                                                     {"error", error},
+                                                     {"falsecolor", falsecolor}};
+
+    // Parse the job file; blank lines and lines starting with '#' are skipped.
+    std::vector<std::vector<std::string>> jobs;
+    std::vector<int> jobLines;
+    std::vector<std::string> lines = SplitString(ReadFileContents(jobFile), '\n');
+    for (size_t i = 0; i < lines.size(); ++i) {
+        std::vector<std::string> args = SplitStringsFromWhitespace(lines[i]);
+        if (args.empty() || args[0][0] == '#')
+            continue;
+        if (commands.find(args[0]) == commands.end())
+            usage("batch", "%s:%d: \"%s\": unsupported command.", jobFile.c_str(),
+                  int(i + 1), args[0].c_str());
+        jobs.push_back(std::move(args));
+        jobLines.push_back(i + 1);
+    }
+
+    // Run the jobs concurrently so that one job's decoding overlaps with
+    // others' computation and encoding; each job's own parallel loops share
+    // the same thread pool.
+    cacheReferenceImages = true;
+    std::atomic<int> nextJob{0}, nFailed{0};
+    ParallelFor(0, std::min<int>(maxJobs, jobs.size()), [&](int64_t) {
+        for (int j = nextJob++; j < jobs.size(); j = nextJob++) {
+            std::vector<char *> jobArgv;
+            for (size_t a = 1; a < jobs[j].size(); ++a)
+                jobArgv.push_back(const_cast<char *>(jobs[j][a].c_str()));
+            jobArgv.push_back(nullptr);
+
+            Command command = commands.find(jobs[j][0])->second;
+            if (command(int(jobArgv.size()) - 1, jobArgv.data()) != 0) {
+                fprintf(stderr, "%s:%d: job returned nonzero status.\n", jobFile.c_str(),
+                        jobLines[j]);
+                ++nFailed;
+            }
+        }
+    });
+    cacheReferenceImages = false;
+    referenceCache.clear();
+
+    if (nFailed > 0) {
+        fprintf(stderr, "%d of %d jobs failed.\n", int(nFailed), int(jobs.size()));
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     InitPBRT({});
 
@@ -2292,10 +2706,14 @@ int main(int argc, char *argv[]) {
         return average(argc - 2, argv + 2);
     else if (strcmp(argv[1], "assemble") == 0)
         return assemble(argc - 2, argv + 2);
+    else if (strcmp(argv[1], "batch") == 0)
+        return batch(argc - 2, argv + 2);
     else if (strcmp(argv[1], "bloom") == 0)
         return bloom(argc - 2, argv + 2);
     else if (strcmp(argv[1], "cat") == 0)
         return cat(argc - 2, argv + 2);
+    else if (strcmp(argv[1], "convergence") == 0)
+        return convergence(argc - 2, argv + 2);
     else if (strcmp(argv[1], "convert") == 0)
         return convert(argc - 2, argv + 2);
     else if (strcmp(argv[1], "diff") == 0)
@@ -2319,6 +2737,8 @@ int main(int argc, char *argv[]) {
         return makeequiarea(argc - 2, argv + 2);
     else if (strcmp(argv[1], "makeemitters") == 0)
         return makeemitters(argc - 2, argv + 2);
+    else if (strcmp(argv[1], "makemip") == 0)
+        return makemip(argc - 2, argv + 2);
     else if (strcmp(argv[1], "makesky") == 0)
         return makesky(argc - 2, argv + 2);
     else if (strcmp(argv[1], "whitebalance") == 0)
@@ -4,6 +4,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/cpu/integrators.h>
 #include <pbrt/cpu/render.h>
 #include <pbrt/options.h>
 #include <pbrt/parsedscene.h>
@@ -14,10 +15,19 @@
 #include <pbrt/util/log.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
+#include <pbrt/util/perfcounters.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
 
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #ifdef NVTX
 #ifdef PBRT_IS_WINDOWS
 #include <windows.h>
@@ -49,7 +59,38 @@ static void usage(const std::string &msg = {}) {
             R"(usage: pbrt [<options>] <filename.pbrt...>
 
 Rendering options:
+  --adaptive <error>           Stop sampling each pixel once the relative error of its
+                               value is below the given threshold, taking at most the
+                               scene's number of pixel samples. Default: 0 (disabled).
+  --adaptive-min-spp <n>       Number of samples to take in every pixel before
+                               adaptive sampling may stop. Default: 16.
+  --bench-rays                 Rather than rendering, trace rays through the scene's
+                               accelerator and report how many million rays it traces
+                               per second, and, on the CPU, the nodes visited and
+                               primitives tested per ray.
+  --bench-ray-count <n>        Number of rays of each type to trace with --bench-rays.
+                               Default: 1048576.
+  --bench-ray-types <types>    Comma-separated list of the rays to trace with
+                               --bench-rays: "camera" rays, "surface" rays leaving
+                               the camera rays' intersections in random directions,
+                               and "shadow" rays between pairs of those points.
+                               Default: "camera,surface,shadow".
+  --bssrdf-cache <directory>   Store subsurface scattering profile tables in the given
+                               directory and reuse them in later runs.
+  --bvh-cache <directory>      Store BVHs in the given directory and reuse them in later
+                               runs with the same geometry and BVH parameters. With
+                               --gpu, OptiX's compiled program cache is kept there too.
+  --checkpoint <seconds>       Save the film and rendering progress to
+                               "<image filename>.checkpoint" at most this often, so
+                               that an interrupted render can be resumed.
+  --coordinator <directory>    Coordinate a render distributed across processes that
+                               share the given directory, rendering part of the image
+                               and writing the merged result.
   --cropwindow <x0,x1,y0,y1>   Specify an image crop window w.r.t. [0,1]^2
+  --cull-distance <d>          Don't render shapes that are farther than d from
+                               everything the camera sees. Reflections and shadows
+                               of culled shapes are lost, so d should cover the
+                               reach of indirect light. Default: 0 (disabled).
   --debugstart <values>        Inform the Integrator where to start rendering for
                                faster debugging. (<values> are Integrator-specific
                                and come from error message text.)
@@ -57,30 +98,136 @@ Rendering options:
   --disable-wavelength-jitter  Always sample the same %d wavelengths of light.
   --display-server <addr:port> Connect to display server at given address and port
                                to display the image as it's being rendered.
-  --force-diffuse              Convert all materials to be diffuse.)"
+  --entity-stats <n>           Print the n scene entities (shapes, textures, materials,
+                               included files, ...) that took the longest to create
+                               and the n that allocated the most memory.
+  --entity-stats-file <filename>
+                               Write the creation time and memory of every scene
+                               entity to a JSON file.
+  --force-diffuse              Convert all materials to be diffuse.
+  --geometry-budget <MB>       Limit the memory used by loaded "deferred" meshes,
+                               evicting the least recently used ones as needed.)"
 #ifdef PBRT_BUILD_GPU_RENDERER
             R"(
   --gpu                        Use the GPU for rendering. (Default: disabled)
-  --gpu-device <index>         Use specified GPU for rendering.)"
+  --gpu-compact-textures       Store floating-point image textures on the GPU
+                               as 8-bit sRGB texels if their values are in
+                               [0,1] and as half floats otherwise.
+  --gpu-compress-textures      Store image textures on the GPU compressed with BC1
+                               (8-bit RGB) or BC4 (one channel) unless the
+                               compression error is too high.
+  --gpu-count <n>              Render with the first n GPUs, or all of them if
+                               n is zero. (Default: 1)
+  --gpu-device <index>         Use specified GPU for rendering.
+  --gpu-disable-graphs         Launch each GPU kernel individually rather than
+                               replaying each pass's kernels from a CUDA graph,
+                               so that kernels are profiled individually.
+  --gpu-disable-material-sort  Don't sort intersections by material and texture
+                               coordinates before evaluating materials.
+  --gpu-paths <n>              Number of paths to trace in parallel on the GPU.
+                               (Default: based on the GPU's free memory)
+  --gpu-queue-stats            Report how full the GPU's work queues were for
+                               each kernel that processed one.)"
 #endif
             R"(
   --help                       Print this help text.
+  --instance-identity-tolerance <eps>
+                               Treat object instance transformations whose matrix
+                               elements are all within eps of the identity as the
+                               identity. Default: 0 (disabled).
+  --lens-cache <directory>     Store "realistic" cameras' exit pupil bounds in the
+                               given directory and reuse them in later runs with the
+                               same lens systems.
+  --light-cache <directory>    Store environment map lights' sampling distributions
+                               in the given directory and reuse them in later runs
+                               with the same images.
+  --memory-budget <budgets>    Exit with an error if the memory used for any of the
+                               given categories exceeds its budget, where budgets
+                               is a list like "geometry=4096,textures=1024" with
+                               sizes in MB. The categories are "geometry", "bvh",
+                               "textures", "materials", "lights", "media", "film",
+                               and "integrator".
   --mse-reference-image        Filename for reference image to use for MSE computation.
-  --mse-reference-out          File to write MSE error vs spp results.
+  --mse-reference-out          File to write the rendering time, spp, MSE, relative
+                               MSE, and FLIP error of each wave of samples to.
+                               ("imgtool convergence" compares such files.)
   --nthreads <num>             Use specified number of threads for rendering.
+  --numa                       Pin threads to cores, alternating between NUMA nodes,
+                               and spread large buffers' memory across the nodes.
   --outfile <filename>         Write the final image to the given filename.
+  --perf-counters              Report the CPU cycles, instructions, last-level cache
+                               misses, and branch misses over the parsing, scene
+                               creation, BVH construction, rendering, and image
+                               writing phases, with the statistics and in the
+                               --trace file. (Linux only.)
   --pixel <x,y>                Render just the specified pixel.
   --pixelbounds <x0,x1,y0,y1>  Specify an image crop window w.r.t. pixel coordinates.
   --pixelstats                 Record per-pixel statistics and write additional images
                                with their values.
+  --progress-rates             Show the rates of samples and rays traced in progress
+                               bars.
+  --progress-stream <filename> Write a JSON object with each progress bar's state,
+                               rates, and estimated time remaining to the given file
+                               (e.g., a named pipe, or "-" for standard output,
+                               which disables the progress bars) at each update.
   --quick                      Automatically reduce a number of quality settings
                                to render more quickly.
+  --preview                    With --display-server, show 1/16 and 1/4 resolution
+                               passes before rendering at full resolution. With
+                               --session, a new line of input also cancels the
+                               render in progress.
   --quiet                      Suppress all text output other than error messages.
+  --raster-primary             Find the first intersections of camera rays from pinhole
+                               perspective and orthographic cameras by rasterizing
+                               the scene's triangles rather than by tracing them.
   --render-coord-sys <name>    Coordinate system to use for the scene when rendering,
                                where name is "camera", "cameraworld", or "world".
+                               Default: "cameraworld", or "world" with --session.
+  --resume                     Continue rendering from the last checkpoint saved
+                               with --checkpoint, if there is one.
   --seed <n>                   Set random number generator seed. Default: 0.
+  --session                    Read lines of scene description filenames from
+                               standard input and render each in turn, reusing the
+                               objects that are unchanged since the previous render.
+  --shared-cache <directory>   Use the given directory for the BVH, light, lens, and
+                               BSSRDF caches that aren't given their own. It should be
+                               on a shared-memory file system such as /dev/shm, so that
+                               the pbrt processes on a machine that render the same
+                               scene build its BVHs once and share their memory.
+  --split-samples <n>          With --coordinator, divide each distributed job's pixel
+                               samples into n ranges that may be rendered by different
+                               processes. The result may then differ from a
+                               single-process render by floating-point rounding.
+                               Default: 1.
   --spp <n>                    Override number of pixel samples specified in scene
                                description file.
+  --stats-categories <list>    Only report the statistics in the given comma-separated
+                               categories (e.g., "BVH,Integrator").
+  --stats-json <filename>      Write the statistics, the render configuration, and
+                               the times taken by startup phases, progress bars, and
+                               GPU kernels to a JSON file.
+  --stats-level <level>        Statistics to record, where <level> is "off", "cheap"
+                               (counters, ratios, and percentages), or "full" (also
+                               distributions and --pixelstats). Statistics beyond the
+                               PBRT_STATS_LEVEL that pbrt was built with aren't
+                               available. Default: "full".
+  --target-error <error>       Stop rendering after the first wave of samples that
+                               brings the mean relative error of the pixels' values
+                               below the given value, once at least --adaptive-min-spp
+                               samples have been taken. (CPU only.)
+  --texture-budget <MB>        Limit the memory used by image texture maps, which are
+                               then split into tiles that are read from a temporary
+                               file on demand, evicting the least recently used tiles
+                               as needed.
+  --time-limit <seconds>       Stop rendering after the last wave of samples that is
+                               expected to finish within the given number of seconds,
+                               not counting scene loading. The number of samples taken
+                               is recorded in the image's metadata.
+  --trace <filename>           Record when each thread runs parallel work, waits, and
+                               blocks, along with scene creation and rendering phases,
+                               and write the timeline as a Chrome trace JSON file.
+  --worker <directory>         Render parts of the image for the --coordinator process
+                               that uses the given directory.
   --write-partial-images       Periodically write the current image to disk, rather
                                than waiting for the end of rendering. Default: disabled.
 
@@ -91,6 +238,9 @@ Logging options:
 Reformatting options:
   --format                     Print a reformatted version of the input file(s) to
                                standard output. Does not render an image.
+  --tobinary <filename>        Write the parsed scene to a binary scene file that pbrt
+                               loads without re-parsing the text scene description.
+                               Does not render an image.
   --toply                      Print a reformatted version of the input file(s) to
                                standard output and convert all triangle meshes to
                                PLY files. Does not render an image.
@@ -114,8 +264,12 @@ int main(int argc, char *argv[]) {
     PBRTOptions options;
     std::vector<std::string> filenames;
     std::string logLevel = "error";
-    std::string renderCoordSys = "cameraworld";
-    bool format = false, toPly = false;
+    std::string statsLevel = "full";
+    std::string renderCoordSys;
+    bool format = false, toPly = false, session = false;
+    std::string binaryFilename;
+    std::string coordinatorDirectory, workerDirectory;
+    std::string sharedCacheDirectory;
 
     // Process command-line arguments
     ++argv;
@@ -164,28 +318,76 @@ int main(int argc, char *argv[]) {
         } else if (
 #ifdef PBRT_BUILD_GPU_RENDERER
             ParseArg(&argv, "gpu", &options.useGPU, onError) ||
+            ParseArg(&argv, "gpu-compact-textures", &options.gpuCompactTextures,
+                     onError) ||
+            ParseArg(&argv, "gpu-compress-textures", &options.gpuCompressTextures,
+                     onError) ||
+            ParseArg(&argv, "gpu-count", &options.gpuCount, onError) ||
             ParseArg(&argv, "gpu-device", &options.gpuDevice, onError) ||
+            ParseArg(&argv, "gpu-disable-graphs", &options.gpuDisableGraphs, onError) ||
+            ParseArg(&argv, "gpu-disable-material-sort", &options.gpuDisableMaterialSort,
+                     onError) ||
+            ParseArg(&argv, "gpu-paths", &options.gpuPaths, onError) ||
+            ParseArg(&argv, "gpu-queue-stats", &options.gpuQueueStats, onError) ||
 #endif
+            ParseArg(&argv, "adaptive", &options.adaptiveThreshold, onError) ||
+            ParseArg(&argv, "adaptive-min-spp", &options.adaptiveMinSamples, onError) ||
+            ParseArg(&argv, "bench-rays", &options.benchRays, onError) ||
+            ParseArg(&argv, "bench-ray-count", &options.benchRayCount, onError) ||
+            ParseArg(&argv, "bench-ray-types", &options.benchRayTypes, onError) ||
+            ParseArg(&argv, "bssrdf-cache", &options.bssrdfCacheDirectory, onError) ||
+            ParseArg(&argv, "bvh-cache", &options.bvhCacheDirectory, onError) ||
+            ParseArg(&argv, "checkpoint", &options.checkpointInterval, onError) ||
+            ParseArg(&argv, "coordinator", &coordinatorDirectory, onError) ||
+            ParseArg(&argv, "cull-distance", &options.cullDistance, onError) ||
             ParseArg(&argv, "debugstart", &options.debugStart, onError) ||
             ParseArg(&argv, "disable-pixel-jitter", &options.disablePixelJitter,
                      onError) ||
             ParseArg(&argv, "disable-wavelength-jitter", &options.disableWavelengthJitter,
                      onError) ||
             ParseArg(&argv, "display-server", &options.displayServer, onError) ||
+            ParseArg(&argv, "entity-stats", &options.entityStatsCount, onError) ||
+            ParseArg(&argv, "entity-stats-file", &options.entityStatsFile, onError) ||
             ParseArg(&argv, "force-diffuse", &options.forceDiffuse, onError) ||
             ParseArg(&argv, "format", &format, onError) ||
+            ParseArg(&argv, "geometry-budget", &options.geometryBudgetMB, onError) ||
+            ParseArg(&argv, "instance-identity-tolerance",
+                     &options.instanceIdentityTolerance, onError) ||
+            ParseArg(&argv, "lens-cache", &options.lensCacheDirectory, onError) ||
+            ParseArg(&argv, "light-cache", &options.lightCacheDirectory, onError) ||
             ParseArg(&argv, "log-level", &logLevel, onError) ||
+            ParseArg(&argv, "memory-budget", &options.memoryBudgets, onError) ||
             ParseArg(&argv, "mse-reference-image", &options.mseReferenceImage, onError) ||
             ParseArg(&argv, "mse-reference-out", &options.mseReferenceOutput, onError) ||
             ParseArg(&argv, "nthreads", &options.nThreads, onError) ||
+            ParseArg(&argv, "numa", &options.numa, onError) ||
             ParseArg(&argv, "outfile", &options.imageFile, onError) ||
+            ParseArg(&argv, "perf-counters", &options.perfCounters, onError) ||
             ParseArg(&argv, "pixelstats", &options.recordPixelStatistics, onError) ||
+            ParseArg(&argv, "preview", &options.preview, onError) ||
+            ParseArg(&argv, "progress-rates", &options.progressRates, onError) ||
+            ParseArg(&argv, "progress-stream", &options.progressStream, onError) ||
             ParseArg(&argv, "quick", &options.quickRender, onError) ||
             ParseArg(&argv, "quiet", &options.quiet, onError) ||
+            ParseArg(&argv, "raster-primary", &options.rasterPrimary, onError) ||
             ParseArg(&argv, "render-coord-sys", &renderCoordSys, onError) ||
+            ParseArg(&argv, "resume", &options.resume, onError) ||
             ParseArg(&argv, "seed", &options.seed, onError) ||
+            ParseArg(&argv, "session", &session, onError) ||
+            ParseArg(&argv, "shared-cache", &sharedCacheDirectory, onError) ||
+            ParseArg(&argv, "split-samples", &options.distributedSampleSplits,
+                     onError) ||
             ParseArg(&argv, "spp", &options.pixelSamples, onError) ||
+            ParseArg(&argv, "stats-categories", &options.statsCategories, onError) ||
+            ParseArg(&argv, "stats-json", &options.statsJSONFile, onError) ||
+            ParseArg(&argv, "stats-level", &statsLevel, onError) ||
+            ParseArg(&argv, "target-error", &options.targetError, onError) ||
+            ParseArg(&argv, "texture-budget", &options.textureBudgetMB, onError) ||
+            ParseArg(&argv, "time-limit", &options.timeLimit, onError) ||
+            ParseArg(&argv, "tobinary", &binaryFilename, onError) ||
             ParseArg(&argv, "toply", &toPly, onError) ||
+            ParseArg(&argv, "trace", &options.traceFile, onError) ||
+            ParseArg(&argv, "worker", &workerDirectory, onError) ||
             ParseArg(&argv, "write-partial-images", &options.writePartialImages,
                      onError) ||
             ParseArg(&argv, "upgrade", &options.upgrade, onError)) {
@@ -201,7 +403,8 @@ int main(int argc, char *argv[]) {
     }
 
     // Print welcome banner
-    if (!options.quiet && !format && !toPly && !options.upgrade) {
+    if (!options.quiet && !format && !toPly && !options.upgrade &&
+        binaryFilename.empty()) {
         printf("pbrt version 4 (built %s at %s)\n", __DATE__, __TIME__);
 #ifdef PBRT_DEBUG_BUILD
         LOG_VERBOSE("Running debug build");
@@ -215,6 +418,10 @@ int main(int argc, char *argv[]) {
     }
 
     // Check validity of provided arguments
+    if (renderCoordSys.empty())
+        // Rendering in world space lets a session reuse everything but the
+        // camera when only the camera moves.
+        renderCoordSys = session ? "world" : "cameraworld";
     if (renderCoordSys == "camera")
         options.renderingSpace = RenderingCoordinateSystem::Camera;
     else if (renderCoordSys == "cameraworld")
@@ -230,12 +437,73 @@ int main(int argc, char *argv[]) {
     if (!options.mseReferenceOutput.empty() && options.mseReferenceImage.empty())
         ErrorExit("Must provide MSE reference image via --mse-reference-image");
 
+    if (session && (options.useGPU || format || toPly || options.upgrade ||
+                    !binaryFilename.empty()))
+        ErrorExit("--session can only be used for rendering on the CPU.");
+    if (session && !filenames.empty())
+        ErrorExit("Scene files are read from standard input with --session.");
+    if (options.preview && options.useGPU)
+        ErrorExit("--preview is only supported for CPU rendering.");
+    if (options.rasterPrimary && options.useGPU)
+        ErrorExit("--raster-primary is only supported for CPU rendering.");
+    if (options.checkpointInterval < 0)
+        ErrorExit("--checkpoint interval must be positive.");
+    if ((options.checkpointInterval > 0 || options.resume) &&
+        (options.useGPU || session))
+        ErrorExit("--checkpoint and --resume are only supported for single CPU "
+                  "renders.");
+    if (options.adaptiveThreshold < 0)
+        ErrorExit("--adaptive error threshold must be positive.");
+    if (options.adaptiveMinSamples < 1)
+        ErrorExit("--adaptive-min-spp must be at least one.");
+    if (options.timeLimit < 0)
+        ErrorExit("--time-limit must be positive.");
+    if (options.targetError < 0)
+        ErrorExit("--target-error must be positive.");
+    if (options.targetError > 0 && options.useGPU)
+        ErrorExit("--target-error is only supported for CPU rendering.");
+    if (options.benchRayCount < 1)
+        ErrorExit("--bench-ray-count must be at least one.");
+    if (options.benchRays &&
+        (session || !coordinatorDirectory.empty() || !workerDirectory.empty()))
+        ErrorExit("--bench-rays can't be used with --session, --coordinator, or "
+                  "--worker.");
+    if (options.gpuCount < 0)
+        ErrorExit("--gpu-count must not be negative.");
+    if (options.gpuPaths < 0)
+        ErrorExit("--gpu-paths must not be negative.");
+    if (options.gpuCount != 1 && options.gpuDevice)
+        ErrorExit("Only one of --gpu-count and --gpu-device may be given.");
+    if (!coordinatorDirectory.empty() && !workerDirectory.empty())
+        ErrorExit("Only one of --coordinator and --worker may be given.");
+    options.distributedDirectory =
+        coordinatorDirectory.empty() ? workerDirectory : coordinatorDirectory;
+    options.distributedCoordinator = !coordinatorDirectory.empty();
+    if (options.distributedSampleSplits < 1)
+        ErrorExit("--split-samples must be at least one.");
+    if (!sharedCacheDirectory.empty()) {
+        for (std::string *dir :
+             {&options.bvhCacheDirectory, &options.lightCacheDirectory,
+              &options.lensCacheDirectory, &options.bssrdfCacheDirectory})
+            if (dir->empty())
+                *dir = sharedCacheDirectory;
+        options.sharedCache = true;
+    }
+    if (!options.distributedDirectory.empty() &&
+        (options.useGPU || session || options.checkpointInterval > 0 ||
+         options.resume || options.adaptiveThreshold > 0 || options.timeLimit > 0 ||
+         options.targetError > 0))
+        ErrorExit("--coordinator and --worker are only supported for single CPU "
+                  "renders without --checkpoint, --resume, --adaptive, --time-limit, "
+                  "or --target-error.");
+
     if (options.pixelMaterial && options.useGPU) {
         Warning("Disabling --use-gpu since --pixelmaterial was specified.");
         options.useGPU = false;
     }
 
     options.logLevel = LogLevelFromString(logLevel);
+    options.statsLevel = StatsLevelFromString(statsLevel);
 
     // Initialize pbrt
     InitPBRT(options);
@@ -243,20 +511,90 @@ int main(int argc, char *argv[]) {
     if (format || toPly || options.upgrade) {
         FormattingScene formattingScene(toPly, options.upgrade);
         ParseFiles(&formattingScene, filenames);
-    } else {
-        // Parse provided scene description files
+    } else if (session) {
+        // Render each line's scene, keeping the objects created for one
+        // render resident for the next
+        CPURenderSession renderSession;
+        auto renderLine = [&](const std::string &line) {
+            auto scene = std::make_shared<ParsedScene>();
+            ParseFiles(scene.get(), SplitStringsFromWhitespace(line));
+            renderSession.Render(std::move(scene));
+        };
+        if (!options.preview) {
+            std::string line;
+            while (std::getline(std::cin, line))
+                if (!SplitStringsFromWhitespace(line).empty())
+                    renderLine(line);
+        } else {
+            // For interactive previews, read lines on another thread so that
+            // a new line cancels the render in progress; only the most
+            // recent pending line is rendered.
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::string pendingLine;
+            bool havePendingLine = false, inputDone = false;
+            std::thread reader([&]() {
+                std::string line;
+                while (std::getline(std::cin, line)) {
+                    if (SplitStringsFromWhitespace(line).empty())
+                        continue;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    pendingLine = line;
+                    havePendingLine = true;
+                    CancelRender();
+                    cv.notify_one();
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                inputDone = true;
+                cv.notify_one();
+            });
+            while (true) {
+                std::string line;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [&]() { return havePendingLine || inputDone; });
+                    if (!havePendingLine)
+                        break;
+                    line = std::move(pendingLine);
+                    havePendingLine = false;
+                    ResetRenderCancellation();
+                }
+                renderLine(line);
+            }
+            reader.join();
+        }
+    } else if (!binaryFilename.empty()) {
+        // Convert the scene description to a binary scene file
         ParsedScene scene;
         ParseFiles(&scene, filenames);
+        scene.WriteBinary(binaryFilename);
+    } else {
+        // Parse provided scene description files
+        std::unique_ptr<ParsedScene> scene = std::make_unique<ParsedScene>();
+        {
+            PerfCounterPhase parsePhase("Parsing");
+            Timer parseTimer;
+            ParseFiles(scene.get(), filenames);
+            StatsAppendJSON("phases", StringPrintf("{\"name\": \"parsing\", "
+                                                   "\"seconds\": %.6f}",
+                                                   parseTimer.ElapsedSeconds()));
+        }
 
         // Render the scene
         if (options.useGPU)
-            GPURender(scene);
+            GPURender(*scene);
         else
-            CPURender(scene);
+            CPURender(*scene);
 
         LOG_VERBOSE("Memory used after post-render cleanup: %s", GetCurrentRSS());
         // Clean up after rendering the scene
         CleanupPBRT();
+#ifndef PBRT_DEBUG_BUILD
+        // Destroying the scene's many entities one by one would only slow
+        // down pbrt's exit, so the scene is released without being freed.
+        // Debug builds free it so that leak checkers don't report it.
+        (void)scene.release();
+#endif
     }
     return 0;
 }
@@ -0,0 +1,408 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+// pbrt_bench.cpp
+
+// Measures rendering throughput for a fixed set of scenes and integrators so
+// that performance regressions can be caught by comparing against a stored
+// baseline.
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/integrators.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/film.h>
+#include <pbrt/filters.h>
+#include <pbrt/lights.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
+#include <pbrt/samplers.h>
+#include <pbrt/shapes.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/args.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
+
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace pbrt;
+
+static void usage(const std::string &msg = {}) {
+    if (!msg.empty())
+        fprintf(stderr, "pbrt_bench: %s\n\n", msg.c_str());
+
+    fprintf(stderr, R"(usage: pbrt_bench [<options...>]
+
+Renders each of a fixed set of scenes with each of pbrt's main CPU integrators
+and reports rays/sec, samples/sec, time to first pixel, and peak memory use.
+
+Options:
+  --baseline <filename>   Compare results to those in the given JSON file,
+                          written by an earlier run with --outfile. Exits with
+                          a non-zero status if any benchmark's rays/sec or
+                          samples/sec is lower than the baseline's by more
+                          than the tolerance.
+  --filter <string>       Only run benchmarks whose names include <string>.
+  --nthreads <num>        Use specified number of threads for rendering.
+  --outfile <filename>    Write the results as JSON to the given file.
+                          (Default: write them to standard output.)
+  --resolution <n>        Image resolution. Default: 128
+  --spp <n>               Pixel samples for the timed render. Default: 16
+  --tolerance <t>         Allowed relative slowdown for --baseline. Default: 0.05
+)");
+    exit(msg.empty() ? 0 : 1);
+}
+
+// BenchScene Definition
+struct BenchScene {
+    std::string name;
+    PrimitiveHandle aggregate;
+    std::vector<LightHandle> lights;
+    double buildSeconds;
+};
+
+// BenchResult Definition
+struct BenchResult {
+    std::string name;
+    double raysPerSecond = 0, samplesPerSecond = 0;
+    double timeToFirstPixel = 0;
+    size_t peakMemoryBytes = 0;
+};
+
+// The scenes are all closed diffuse enclosures lit from inside, like the
+// ones in integrators_test.cpp, so that every camera path does a full
+// number of bounces regardless of the integrator.
+static MaterialHandle DiffuseMaterialKd(Float kd) {
+    Allocator alloc;
+    SpectrumHandle cs = alloc.new_object<ConstantSpectrum>(kd);
+    SpectrumTextureHandle Kd = alloc.new_object<SpectrumConstantTexture>(cs);
+    FloatTextureHandle sigma = alloc.new_object<FloatConstantTexture>(0.);
+    return alloc.new_object<DiffuseMaterial>(Kd, sigma, nullptr, nullptr);
+}
+
+static LightHandle CenterPointLight() {
+    static Transform identity;
+    // Normalize the point light as *Light::Create() would.
+    static ConstantSpectrum I(1);
+    Float scale = Pi / SpectrumToPhotometric(&I);
+    return new PointLight(identity, MediumInterface(), &I, scale, Allocator());
+}
+
+static std::vector<std::function<BenchScene()>> GetScenes() {
+    std::vector<std::function<BenchScene()>> scenes;
+    static Transform identity;
+
+    // A single analytic sphere: measures integrator overhead more than
+    // intersection performance.
+    scenes.push_back([]() {
+        Timer timer;
+        ShapeHandle sphere = new Sphere(&identity, &identity,
+                                        true /* reverse orientation */, 1, -1, 1, 360);
+        std::vector<PrimitiveHandle> prims;
+        prims.push_back(PrimitiveHandle(new GeometricPrimitive(
+            sphere, DiffuseMaterialKd(0.5), nullptr, MediumInterface())));
+        PrimitiveHandle bvh(new BVHAggregate(std::move(prims)));
+        return BenchScene{"sphere", bvh, {CenterPointLight()}, timer.ElapsedSeconds()};
+    });
+
+    // A finely tessellated sphere: dominated by BVH construction and
+    // traversal.
+    scenes.push_back([]() {
+        Timer timer;
+        int nTheta = 256, nPhi = 512;
+        std::vector<Point3f> p;
+        for (int t = 0; t <= nTheta; ++t) {
+            Float theta = Pi * t / nTheta;
+            for (int ph = 0; ph < nPhi; ++ph) {
+                Float phi = 2 * Pi * ph / nPhi;
+                p.push_back(Point3f(SphericalDirection(std::sin(theta), std::cos(theta),
+                                                       phi)));
+            }
+        }
+        std::vector<int> indices;
+        for (int t = 0; t < nTheta; ++t)
+            for (int ph = 0; ph < nPhi; ++ph) {
+                int v00 = t * nPhi + ph, v01 = t * nPhi + (ph + 1) % nPhi;
+                int v10 = v00 + nPhi, v11 = v01 + nPhi;
+                indices.insert(indices.end(), {v00, v10, v11, v00, v11, v01});
+            }
+        TriangleMesh *mesh =
+            new TriangleMesh(identity, true /* reverse orientation */, std::move(indices),
+                             std::move(p), {}, {}, {}, {});
+        MaterialHandle material = DiffuseMaterialKd(0.5);
+        std::vector<PrimitiveHandle> prims;
+        for (ShapeHandle tri : Triangle::CreateTriangles(mesh, Allocator()))
+            prims.push_back(PrimitiveHandle(
+                new GeometricPrimitive(tri, material, nullptr, MediumInterface())));
+        PrimitiveHandle bvh(new BVHAggregate(std::move(prims)));
+        return BenchScene{"mesh", bvh, {CenterPointLight()}, timer.ElapsedSeconds()};
+    });
+
+    // An emissive sphere inside the enclosure: exercises area light
+    // sampling and MIS.
+    scenes.push_back([]() {
+        Timer timer;
+        static Transform renderFromLight = Scale(0.25, 0.25, 0.25);
+        static Transform lightFromRender = Inverse(renderFromLight);
+        ShapeHandle emitter = new Sphere(&renderFromLight, &lightFromRender,
+                                         false /* reverse orientation */, 1, -1, 1, 360);
+        static ConstantSpectrum Le(1);
+        LightHandle areaLight =
+            new DiffuseAreaLight(renderFromLight, MediumInterface(), &Le, 1, emitter,
+                                 Image(), nullptr, false, Allocator());
+
+        ShapeHandle enclosure = new Sphere(&identity, &identity,
+                                           true /* reverse orientation */, 1, -1, 1, 360);
+        std::vector<PrimitiveHandle> prims;
+        prims.push_back(PrimitiveHandle(new GeometricPrimitive(
+            enclosure, DiffuseMaterialKd(0.5), nullptr, MediumInterface())));
+        prims.push_back(PrimitiveHandle(new GeometricPrimitive(
+            emitter, DiffuseMaterialKd(0.5), areaLight, MediumInterface())));
+        PrimitiveHandle bvh(new BVHAggregate(std::move(prims)));
+        return BenchScene{"arealight", bvh, {areaLight}, timer.ElapsedSeconds()};
+    });
+
+    return scenes;
+}
+
+// Each IntegratorFactory creates an integrator that renders the given scene.
+using IntegratorFactory = std::function<Integrator *(CameraHandle, SamplerHandle,
+                                                     const BenchScene &)>;
+
+static std::vector<std::pair<std::string, IntegratorFactory>> GetIntegrators() {
+    return {
+        {"path",
+         [](CameraHandle camera, SamplerHandle sampler, const BenchScene &scene) {
+             return new PathIntegrator(8, camera, sampler, scene.aggregate, scene.lights);
+         }},
+        {"volpath",
+         [](CameraHandle camera, SamplerHandle sampler, const BenchScene &scene) {
+             return new VolPathIntegrator(8, camera, sampler, scene.aggregate,
+                                          scene.lights);
+         }},
+        {"bdpt",
+         [](CameraHandle camera, SamplerHandle sampler, const BenchScene &scene) {
+             return new BDPTIntegrator(camera, sampler, scene.aggregate, scene.lights, 6,
+                                       false, false);
+         }}};
+}
+
+static const char *benchFilename = "pbrt_bench.exr";
+
+static Integrator *CreateIntegrator(const IntegratorFactory &factory,
+                                    const BenchScene &scene, int resolution, int spp) {
+    static Transform id;
+    AnimatedTransform identity(id, 0, id, 1);
+    Point2i res(resolution, resolution);
+    FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(res, Bounds2i(Point2i(0, 0), res), filter, 1.,
+                          PixelSensor::CreateDefault(), benchFilename);
+    RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+    CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+    PerspectiveCamera *camera =
+        new PerspectiveCamera(cbp, 45, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+    SamplerHandle sampler = new ZSobolSampler(spp, res);
+    return factory(camera, sampler, scene);
+}
+
+static int64_t RaysTraced() {
+    ForEachThread(ReportThreadStats);
+    return GetStatsCounter("Intersections/Regular ray intersection tests") +
+           GetStatsCounter("Intersections/Shadow ray intersection tests");
+}
+
+static BenchResult RunBenchmark(const std::string &name, const IntegratorFactory &factory,
+                                const BenchScene &scene, int resolution, int spp) {
+    BenchResult result;
+    result.name = name;
+
+    // Time to first pixel: building the scene plus a one sample per pixel
+    // render.
+    Integrator *integrator = CreateIntegrator(factory, scene, resolution, 1);
+    Timer firstPassTimer;
+    integrator->Render();
+    result.timeToFirstPixel = scene.buildSeconds + firstPassTimer.ElapsedSeconds();
+    delete integrator;
+
+    // Throughput, from the full render.
+    integrator = CreateIntegrator(factory, scene, resolution, spp);
+    int64_t raysBefore = RaysTraced();
+    Timer timer;
+    integrator->Render();
+    double seconds = timer.ElapsedSeconds();
+    int64_t rays = RaysTraced() - raysBefore;
+    delete integrator;
+
+    result.raysPerSecond = rays / seconds;
+    result.samplesPerSecond = double(resolution) * resolution * spp / seconds;
+    result.peakMemoryBytes = GetPeakRSS();
+
+    remove(benchFilename);
+    return result;
+}
+
+static std::string ToJSON(const std::vector<BenchResult> &results) {
+    // One benchmark per line, so that ReadBaseline() doesn't need a full
+    // JSON parser.
+    std::string json = "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        json += StringPrintf("  {\"name\": \"%s\", \"raysPerSecond\": %f, "
+                             "\"samplesPerSecond\": %f, \"timeToFirstPixel\": %f, "
+                             "\"peakMemoryBytes\": %d}%s\n",
+                             r.name, r.raysPerSecond, r.samplesPerSecond,
+                             r.timeToFirstPixel, r.peakMemoryBytes,
+                             i + 1 < results.size() ? "," : "");
+    }
+    json += "]\n";
+    return json;
+}
+
+// Returns the value of the given field in a line written by ToJSON(), or
+// an empty string if it isn't present.
+static std::string JSONField(const std::string &line, const std::string &field) {
+    std::string key = "\"" + field + "\": ";
+    size_t start = line.find(key);
+    if (start == std::string::npos)
+        return {};
+    start += key.size();
+    if (line[start] == '"') {
+        size_t end = line.find('"', start + 1);
+        if (end == std::string::npos)
+            return {};
+        return line.substr(start + 1, end - start - 1);
+    }
+    size_t end = line.find_first_of(",}", start);
+    return line.substr(start, end == std::string::npos ? end : end - start);
+}
+
+static std::map<std::string, BenchResult> ReadBaseline(const std::string &filename) {
+    std::map<std::string, BenchResult> baseline;
+    std::string contents = ReadFileContents(filename);
+    size_t pos = 0;
+    while (pos < contents.size()) {
+        size_t end = contents.find('\n', pos);
+        if (end == std::string::npos)
+            end = contents.size();
+        std::string line = contents.substr(pos, end - pos);
+        pos = end + 1;
+
+        BenchResult r;
+        r.name = JSONField(line, "name");
+        if (r.name.empty())
+            continue;
+        r.raysPerSecond = atof(JSONField(line, "raysPerSecond").c_str());
+        r.samplesPerSecond = atof(JSONField(line, "samplesPerSecond").c_str());
+        r.timeToFirstPixel = atof(JSONField(line, "timeToFirstPixel").c_str());
+        r.peakMemoryBytes = atoll(JSONField(line, "peakMemoryBytes").c_str());
+        baseline[r.name] = r;
+    }
+    return baseline;
+}
+
+// Prints a comparison of each result against the baseline and returns the
+// number of benchmarks that regressed.
+static int CompareToBaseline(const std::vector<BenchResult> &results,
+                             const std::map<std::string, BenchResult> &baseline,
+                             Float tolerance) {
+    int nRegressed = 0;
+    fprintf(stderr, "%-24s %14s %14s %14s\n", "benchmark", "rays/sec", "samples/sec",
+            "first pixel");
+    for (const BenchResult &r : results) {
+        auto iter = baseline.find(r.name);
+        if (iter == baseline.end()) {
+            fprintf(stderr, "%-24s (not in baseline)\n", r.name.c_str());
+            continue;
+        }
+        const BenchResult &b = iter->second;
+        auto ratio = [](double cur, double base) { return base > 0 ? cur / base : 1; };
+        double rays = ratio(r.raysPerSecond, b.raysPerSecond);
+        double samples = ratio(r.samplesPerSecond, b.samplesPerSecond);
+        // For time to first pixel, lower is better.
+        double firstPixel = ratio(b.timeToFirstPixel, r.timeToFirstPixel);
+        bool regressed = rays < 1 - tolerance || samples < 1 - tolerance;
+        nRegressed += regressed;
+        fprintf(stderr, "%-24s %13.3fx %13.3fx %13.3fx%s\n", r.name.c_str(), rays,
+                samples, firstPixel, regressed ? "  REGRESSED" : "");
+    }
+    return nRegressed;
+}
+
+int main(int argc, char *argv[]) {
+    PBRTOptions options;
+    options.quiet = true;
+    std::string outFilename, baselineFilename, filter;
+    int resolution = 128, spp = 16;
+    Float tolerance = 0.05f;
+
+    argv += 1;
+    while (*argv != nullptr) {
+        auto onError = [](const std::string &err) {
+            usage(err);
+            exit(1);
+        };
+
+        if (ParseArg(&argv, "baseline", &baselineFilename, onError) ||
+            ParseArg(&argv, "filter", &filter, onError) ||
+            ParseArg(&argv, "nthreads", &options.nThreads, onError) ||
+            ParseArg(&argv, "outfile", &outFilename, onError) ||
+            ParseArg(&argv, "resolution", &resolution, onError) ||
+            ParseArg(&argv, "spp", &spp, onError) ||
+            ParseArg(&argv, "tolerance", &tolerance, onError))
+            ;
+        else if ((strcmp(*argv, "--help") == 0) || (strcmp(*argv, "-h") == 0))
+            usage();
+        else
+            usage(StringPrintf("unknown argument \"%s\"", *argv));
+    }
+
+    InitPBRT(options);
+
+    std::vector<BenchResult> results;
+    for (const std::function<BenchScene()> &createScene : GetScenes()) {
+        BenchScene scene = createScene();
+        for (const auto &integrator : GetIntegrators()) {
+            std::string name = scene.name + "/" + integrator.first;
+            if (!filter.empty() && name.find(filter) == std::string::npos)
+                continue;
+            fprintf(stderr, "Running %s...\n", name.c_str());
+            results.push_back(
+                RunBenchmark(name, integrator.second, scene, resolution, spp));
+        }
+    }
+
+    std::string json = ToJSON(results);
+    if (outFilename.empty())
+        fputs(json.c_str(), stdout);
+    else if (!WriteFile(outFilename, json))
+        ErrorExit("%s: unable to write benchmark results.", outFilename);
+
+    int status = 0;
+    if (!baselineFilename.empty()) {
+        std::map<std::string, BenchResult> baseline = ReadBaseline(baselineFilename);
+        int nRegressed = CompareToBaseline(results, baseline, tolerance);
+        if (nRegressed > 0) {
+            fprintf(stderr, "%d benchmark(s) regressed by more than %.0f%%.\n",
+                    nRegressed, 100 * tolerance);
+            status = 1;
+        }
+    }
+
+    CleanupPBRT();
+    return status;
+}
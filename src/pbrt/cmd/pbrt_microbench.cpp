@@ -0,0 +1,212 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+// pbrt_microbench.cpp
+
+// Google Benchmark micro-benchmarks of pbrt's innermost kernels. Each runs
+// over a fixed set of inputs generated with a fixed seed so that the effects
+// of code changes and compiler flags (e.g. PBRT_BUILD_NATIVE_EXECUTABLE) can
+// be compared between builds.
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/bxdfs.h>
+#include <pbrt/interaction.h>
+#include <pbrt/options.h>
+#include <pbrt/ray.h>
+#include <pbrt/samplers.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/mipmap.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/scattering.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/transform.h>
+#include <pbrt/util/vecmath.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+using namespace pbrt;
+
+// Each benchmark cycles through this many inputs; it's a power of two so
+// that the next input's index is cheap to compute.
+static constexpr int nInputs = 1024;
+
+static Float Uniform(RNG &rng, Float min, Float max) {
+    return Lerp(rng.Uniform<Float>(), min, max);
+}
+
+// Rays from random points above the z=0 plane toward points in the square
+// around the unit triangle and box there, about half of which hit them.
+static std::vector<Ray> PlaneRays() {
+    RNG rng;
+    std::vector<Ray> rays;
+    for (int i = 0; i < nInputs; ++i) {
+        Point3f o(Uniform(rng, -2, 2), Uniform(rng, -2, 2), Uniform(rng, 0.5, 2));
+        Point3f p(Uniform(rng, -0.25, 1.25), Uniform(rng, -0.25, 1.25), 0);
+        rays.push_back(Ray(o, p - o));
+    }
+    return rays;
+}
+
+static void BM_TriangleIntersect(benchmark::State &state) {
+    TriangleMesh mesh(Transform(), false, {0, 1, 2},
+                      {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(0, 1, 0)}, {}, {},
+                      {}, {});
+    pstd::vector<ShapeHandle> tris = Triangle::CreateTriangles(&mesh, Allocator());
+    ShapeHandle tri = tris[0];
+    std::vector<Ray> rays = PlaneRays();
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tri.Intersect(rays[i]));
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK(BM_TriangleIntersect);
+
+static void BM_Bounds3fIntersectP(benchmark::State &state) {
+    Bounds3f bounds(Point3f(0, 0, -0.5), Point3f(1, 1, 0));
+    std::vector<Ray> rays = PlaneRays();
+    // As in BVH traversal, the reciprocal direction is computed once per ray
+    std::vector<Vector3f> invDir;
+    for (const Ray &ray : rays)
+        invDir.push_back(Vector3f(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z));
+    int i = 0;
+    for (auto _ : state) {
+        const Vector3f &id = invDir[i];
+        int dirIsNeg[3] = {int(id.x < 0), int(id.y < 0), int(id.z < 0)};
+        benchmark::DoNotOptimize(
+            bounds.IntersectP(rays[i].o, rays[i].d, Infinity, id, dirIsNeg));
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK(BM_Bounds3fIntersectP);
+
+static void BM_ZSobolSamplerGet2D(benchmark::State &state) {
+    ZSobolSampler sampler(16, Point2i(1920, 1080));
+    RNG rng;
+    std::vector<Point2i> pixels;
+    for (int i = 0; i < nInputs; ++i)
+        pixels.push_back(
+            Point2i(rng.Uniform<uint32_t>(1920), rng.Uniform<uint32_t>(1080)));
+    int i = 0;
+    for (auto _ : state) {
+        sampler.StartPixelSample(pixels[i], i & 15, 2 * (i & 7));
+        benchmark::DoNotOptimize(sampler.Get2D());
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK(BM_ZSobolSamplerGet2D);
+
+static void BM_DielectricSample_f(benchmark::State &state, Float roughness) {
+    SampledSpectrum tint(1.f);
+    Float alpha = TrowbridgeReitzDistribution::RoughnessToAlpha(roughness);
+    DielectricInterfaceBxDF bxdf(1.5f, tint, TrowbridgeReitzDistribution(alpha, alpha));
+    RNG rng;
+    std::vector<Vector3f> wo;
+    std::vector<Point3f> u;
+    for (int i = 0; i < nInputs; ++i) {
+        // Directions on both sides of the surface
+        wo.push_back(SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()}));
+        u.push_back({rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>()});
+    }
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(bxdf.Sample_f(wo[i], u[i].x, Point2f(u[i].y, u[i].z),
+                                               TransportMode::Radiance));
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK_CAPTURE(BM_DielectricSample_f, smooth, 0.f);
+BENCHMARK_CAPTURE(BM_DielectricSample_f, rough, 0.3f);
+
+static void BM_MIPMapEWA(benchmark::State &state) {
+    // A random RGB image, filtered over anisotropic footprints of a range
+    // of sizes
+    RNG rng;
+    Point2i res(512, 512);
+    std::vector<std::string> channels = {"R", "G", "B"};
+    Image image(PixelFormat::Float, res, channels);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < 3; ++c)
+                image.SetChannel({x, y}, c, rng.Uniform<Float>());
+    MIPMapFilterOptions options;
+    options.filter = FilterFunction::EWA;
+    MIPMap mipmap(std::move(image), RGBColorSpace::sRGB, WrapMode::Repeat, Allocator(),
+                  options);
+
+    std::vector<Point2f> st;
+    std::vector<Vector2f> dst0, dst1;
+    for (int i = 0; i < nInputs; ++i) {
+        st.push_back({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Float width = std::pow(2.f, Uniform(rng, -10, -3));
+        Float phi = Uniform(rng, 0, 2 * Pi);
+        dst0.push_back(width * Vector2f(std::cos(phi), std::sin(phi)));
+        dst1.push_back(width * Uniform(rng, 0.25, 1) *
+                       Vector2f(-std::sin(phi), std::cos(phi)));
+    }
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(mipmap.Filter<RGB>(st[i], dst0[i], dst1[i]));
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK(BM_MIPMapEWA);
+
+static void BM_RGBToSpectrumTable(benchmark::State &state) {
+    const RGBToSpectrumTable *table = RGBToSpectrumTable::sRGB;
+    RNG rng;
+    std::vector<RGB> rgb;
+    for (int i = 0; i < nInputs; ++i)
+        rgb.push_back(RGB(rng.Uniform<Float>(), rng.Uniform<Float>(),
+                          rng.Uniform<Float>()));
+    int i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize((*table)(rgb[i]));
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK(BM_RGBToSpectrumTable);
+
+static void BM_SampledSpectrumMath(benchmark::State &state) {
+    // The operations that path throughput and radiance updates use most
+    RNG rng;
+    std::vector<SampledSpectrum> s;
+    for (int i = 0; i < nInputs; ++i) {
+        SampledSpectrum v;
+        for (int j = 0; j < NSpectrumSamples; ++j)
+            v[j] = Uniform(rng, 0.01, 1);
+        s.push_back(v);
+    }
+    int i = 0;
+    for (auto _ : state) {
+        const SampledSpectrum &a = s[i], &b = s[(i + 1) & (nInputs - 1)];
+        SampledSpectrum c = SafeDiv(a * b + Exp(-a), b);
+        benchmark::DoNotOptimize(c.Average());
+        i = (i + 1) & (nInputs - 1);
+    }
+}
+BENCHMARK(BM_SampledSpectrumMath);
+
+int main(int argc, char **argv) {
+    PBRTOptions options;
+    options.quiet = true;
+    InitPBRT(options);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+
+    CleanupPBRT();
+    return 0;
+}
@@ -83,6 +83,8 @@ Where <sampler> is one of:
                      in each dimension.
 
 Options:
+  --cpu                Compute the power spectrum on the CPU, even if pbrt was
+                       built with GPU support.
   --npoints <n>        Number of sample points to generate in each set.
                        (Default: 1024).
   --nsets <n>          Number of independent sets of sample points.
@@ -97,8 +99,15 @@ Options:
 )");
 }
 
+// Point sets read from files or standard input must be read in order; the
+// others are generated independently, using the given seed.
+static bool IsStreamedSampler(const std::string &samplerName) {
+    return samplerName == "stdin.binary" || samplerName == "stdin.dat" ||
+           samplerName == "cwd.pts";
+}
+
 static pstd::optional<std::vector<Point2f>>
-GenerateSamples(std::string samplerName, int nPoints, int iter) {
+GenerateSamples(std::string samplerName, int nPoints, int iter, int seed) {
     std::vector<Point2f> points;
     points.reserve(nPoints);
 
@@ -169,7 +178,7 @@ GenerateSamples(std::string samplerName, int nPoints, int iter) {
                 points.push_back(
                     Point2f(Float(i) / sqrtSamples, Float(j) / sqrtSamples));
     } else if (samplerName == "lhs") {
-        RNG rng(Options->seed, iter);
+        RNG rng(seed, iter);
         // Sample points along the diagonal
         for (int i = 0; i < nPoints; ++i)
             points.push_back(Point2f((i + rng.Uniform<Float>()) / nPoints,
@@ -184,7 +193,7 @@ GenerateSamples(std::string samplerName, int nPoints, int iter) {
             points.push_back(
                 Point2f(RadicalInverse(0, i), RadicalInverse(1, i)));
     } else if (samplerName == "halton.permutedigits") {
-        RNG rng(Options->seed, iter);
+        RNG rng(seed, iter);
         DigitPermutation perm2(2, rng.Uniform<uint32_t>(), {});
         DigitPermutation perm3(3, rng.Uniform<uint32_t>(), {});
 
@@ -192,7 +201,7 @@ GenerateSamples(std::string samplerName, int nPoints, int iter) {
             points.push_back(Point2f(ScrambledRadicalInverse(0, i, perm2),
                                      ScrambledRadicalInverse(1, i, perm3)));
     } else if (samplerName == "halton.owen") {
-        RNG rng(Options->seed, iter);
+        RNG rng(seed, iter);
         uint32_t r[2] = {rng.Uniform<uint32_t>(), rng.Uniform<uint32_t>()};
 
         for (int i = 0; i < nPoints; ++i) {
@@ -206,14 +215,14 @@ GenerateSamples(std::string samplerName, int nPoints, int iter) {
     } else {
         SamplerHandle sampler = [&]() -> SamplerHandle {
             if (samplerName == "random")
-                return new RandomSampler(nPoints, Options->seed);
+                return new RandomSampler(nPoints, seed);
             else if (samplerName == "stratified") {
                 int sqrtSamples = std::sqrt(nPoints);
                 nPoints = Sqr(sqrtSamples);
                 return new StratifiedSampler(sqrtSamples, sqrtSamples, true,
-                                             Options->seed);
+                                             seed);
             } else if (samplerName == "pmj02bn") {
-                return new PMJ02BNSampler(nPoints, Options->seed);
+                return new PMJ02BNSampler(nPoints, seed);
             } else if (samplerName == "sobol") {
                 return new PaddedSobolSampler(nPoints, RandomizeStrategy::None);
             } else if (samplerName == "sobol.permutedigits") {
@@ -240,6 +249,69 @@ GenerateSamples(std::string samplerName, int nPoints, int iter) {
     return points;
 }
 
+// Adds the power spectra of the given point sets to _pspec_. The complex
+// exponential in each frequency's Fourier sum is separable, so along a row
+// of frequencies each point's term is found by rotating it by a per-point
+// step rather than by calling sin() and cos(). The terms' components are
+// stored in separate arrays and summed in independent lanes so that the
+// compiler can vectorize the loop over points.
+static void AccumulatePowerSpectrum(const std::vector<std::vector<Point2f>> &pointSets,
+                                    Image *pspec) {
+    int res = pspec->Resolution().x;
+    ParallelFor(0, res, [&](int64_t y) {
+        std::vector<double> rowPower(res, 0.);
+        std::vector<double> re, im, stepRe, stepIm;
+        for (const std::vector<Point2f> &points : pointSets) {
+            // Initialize the points' terms for the row's first frequency
+            size_t n = points.size();
+            re.resize(n);
+            im.resize(n);
+            stepRe.resize(n);
+            stepIm.resize(n);
+            double wx = -(res / 2), wy = y - res / 2;
+            for (size_t i = 0; i < n; ++i) {
+                double theta = -2 * Pi * (wx * points[i][0] + wy * points[i][1]);
+                re[i] = std::cos(theta);
+                im[i] = std::sin(theta);
+                double step = -2 * Pi * points[i][0];
+                stepRe[i] = std::cos(step);
+                stepIm[i] = std::sin(step);
+            }
+
+            for (int x = 0; x < res; ++x) {
+                // Sum the terms and rotate them to the next frequency
+                constexpr int nLanes = 8;
+                double sumRe[nLanes] = {}, sumIm[nLanes] = {};
+                auto update = [&](size_t i, int lane) {
+                    sumRe[lane] += re[i];
+                    sumIm[lane] += im[i];
+                    double r = re[i] * stepRe[i] - im[i] * stepIm[i];
+                    im[i] = re[i] * stepIm[i] + im[i] * stepRe[i];
+                    re[i] = r;
+                };
+                size_t i = 0;
+                for (; i + nLanes <= n; i += nLanes)
+                    for (int lane = 0; lane < nLanes; ++lane)
+                        update(i + lane, lane);
+                for (; i < n; ++i)
+                    update(i, 0);
+
+                double uRe = 0, uIm = 0;
+                for (int lane = 0; lane < nLanes; ++lane) {
+                    uRe += sumRe[lane];
+                    uIm += sumIm[lane];
+                }
+                rowPower[x] += Sqr(uRe) + Sqr(uIm);
+            }
+        }
+
+        // Update power spectrum
+        for (int x = 0; x < res; ++x)
+            pspec->SetChannel({x, int(y)}, 0,
+                              pspec->GetChannel({x, int(y)}, 0) + rowPower[x]);
+    });
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 2) {
         usage();
@@ -251,6 +323,7 @@ int main(int argc, char *argv[]) {
     int nSets = 0;
     int res = 1500;
     std::string baseOutFilename;
+    bool cpu = false;
 
     argv += 1;
     while (*argv != nullptr) {
@@ -259,7 +332,8 @@ int main(int argc, char *argv[]) {
             exit(1);
         };
 
-        if (ParseArg(&argv, "npoints", &nPoints, onError) ||
+        if (ParseArg(&argv, "cpu", &cpu, onError) ||
+            ParseArg(&argv, "npoints", &nPoints, onError) ||
             ParseArg(&argv, "resolution", &res, onError) ||
             ParseArg(&argv, "outbase", &baseOutFilename, onError) ||
             ParseArg(&argv, "nsets", &nSets, onError))
@@ -282,16 +356,20 @@ int main(int argc, char *argv[]) {
     }
 
     if (!(res & 1)) ++res;
+    // Only point sets that are read are limited by the amount of input
+    if (nSets == 0 && !IsStreamedSampler(samplerName))
+        nSets = 4;
 
     PBRTOptions options;
     options.quiet = true;
 #ifdef PBRT_BUILD_GPU_RENDERER
-    options.useGPU = true;
+    options.useGPU = !cpu;
 #endif
     InitPBRT(options);
 
 #ifdef PBRT_BUILD_GPU_RENDERER
-    CUDAMemoryResource *memoryResource = new CUDAMemoryResource;
+    pstd::pmr::memory_resource *memoryResource =
+        options.useGPU ? new CUDAMemoryResource : pstd::pmr::get_default_resource();
 #else
     pstd::pmr::memory_resource *memoryResource =
         pstd::pmr::get_default_resource();
@@ -304,50 +382,62 @@ int main(int argc, char *argv[]) {
     ProgressReporter progress(nSets, "Analyzing", nSets == 1, options.useGPU);
 
 #ifdef PBRT_BUILD_GPU_RENDERER
-    GPUInit();
-    UPSInit(nPoints);
+    if (options.useGPU) {
+        GPUInit();
+        UPSInit(nPoints);
+    }
 #endif
 
+    // Process point sets in batches; on the CPU, each batch's sets are
+    // generated in parallel and each row of the power spectrum is then
+    // computed for all of them at once.
     int actualNSets = 0;
-    while (true) {
-        Options->seed = MixBits(actualNSets);
-
+    while (nSets == 0 || actualNSets < nSets) {
         // Generate points
-        pstd::optional<std::vector<Point2f>> points = GenerateSamples(samplerName, nPoints, actualNSets);
-        if (!points)
+        int batchSize = options.useGPU ? 1 : 16;
+        if (nSets != 0)
+            batchSize = std::min(batchSize, nSets - actualNSets);
+        std::vector<std::vector<Point2f>> pointSets(batchSize);
+        if (IsStreamedSampler(samplerName)) {
+            int n = 0;
+            for (; n < batchSize; ++n) {
+                int iter = actualNSets + n;
+                pstd::optional<std::vector<Point2f>> points =
+                    GenerateSamples(samplerName, nPoints, iter, MixBits(iter));
+                if (!points)
+                    break;
+                pointSets[n] = std::move(*points);
+            }
+            pointSets.resize(n);
+        } else
+            ParallelFor(0, batchSize, [&](int64_t i) {
+                int iter = actualNSets + i;
+                pointSets[i] =
+                    *GenerateSamples(samplerName, nPoints, iter, MixBits(iter));
+            });
+        if (pointSets.empty())
             break;
-        ++actualNSets;
+        actualNSets += pointSets.size();
 
-#ifdef PBRT_BUILD_GPU_RENDERER
-        UpdatePowerSpectrum(*points, pspec);
-#else
         // Fourier transform
-        ParallelFor(0, res, [&](int y) {
-            for (int x = 0; x < res; ++x) {
-                Point2f uv(0, 0);
-                Float wx = x - res / 2, wy = y - res / 2;
-                for (Point2f u : *points) {
-                    Float exp = -2 * Pi * (wx * u[0] + wy * u[1]);
-                    uv[0] += std::cos(exp);
-                    uv[1] += std::sin(exp);
-                }
-
-                // Update power spectrum
-                pspec->SetChannel(
-                    {x, y}, 0,
-                    (pspec->GetChannel({x, y}, 0) + (Sqr(uv[0]) + Sqr(uv[1]))));
-            }
-        });
+#ifdef PBRT_BUILD_GPU_RENDERER
+        if (options.useGPU) {
+            for (const std::vector<Point2f> &points : pointSets)
+                UpdatePowerSpectrum(points, pspec);
+        } else
 #endif
+            AccumulatePowerSpectrum(pointSets, pspec);
 
-        progress.Update();
+        progress.Update(pointSets.size());
 
-        if (nSets != 0 && actualNSets == nSets)
+        // Stop if the input ran out partway through the batch
+        if (pointSets.size() < batchSize)
             break;
     }
 
 #ifdef PBRT_BUILD_GPU_RENDERER
-    GPUWait();
+    if (options.useGPU)
+        GPUWait();
 #endif  // PBRT_BUILD_GPU_RENDERER
 
     ParallelFor(0, res, [&](int y) {
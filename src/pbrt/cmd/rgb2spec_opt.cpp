@@ -823,62 +823,58 @@ int main(int argc, char **argv) {
     size_t bufsize = 3 * 3 * res * res * res;
     float *out = new float[bufsize];
 
-    for (int l = 0; l < 3; ++l) {
-        ParallelFor(0, res, [&](size_t j) {
-            const double y = j / double(res - 1);
-            fflush(stdout);
-            for (int i = 0; i < res; ++i) {
-                const double x = i / double(res - 1);
-                double coeffs[3], rgb[3];
-                memset(coeffs, 0, sizeof(double) * 3);
-
-                int start = res / 5;
-
-                for (int k = start; k < res; ++k) {
-                    double b = (double)scale[k];
-
-                    rgb[l] = b;
-                    rgb[(l + 1) % 3] = x * b;
-                    rgb[(l + 2) % 3] = y * b;
-
-                    double resid = gauss_newton(rgb, coeffs);
-                    (void)resid;
-
-                    double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
-                    double A = coeffs[0], B = coeffs[1], C = coeffs[2];
-
-                    int idx = ((l * res + k) * res + j) * res + i;
-
-                    out[3 * idx + 0] = float(A * (sqr(c1)));
-                    out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
-                    out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
-                    // out[3*idx + 2] = resid;
-                }
-
-                memset(coeffs, 0, sizeof(double) * 3);
-                for (int k = start; k >= 0; --k) {
-                    double b = (double)scale[k];
-
-                    rgb[l] = b;
-                    rgb[(l + 1) % 3] = x * b;
-                    rgb[(l + 2) % 3] = y * b;
-
-                    double resid = gauss_newton(rgb, coeffs);
-                    (void)resid;
-
-                    double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
-                    double A = coeffs[0], B = coeffs[1], C = coeffs[2];
-
-                    int idx = ((l * res + k) * res + j) * res + i;
+    // Optimizes the coefficients for the cell at (i, j, k) in slice _l_,
+    // starting from the given coefficients, and stores the polynomial for it.
+    auto optimizeCell = [&](int l, int i, int j, int k, double coeffs[3]) {
+        const double x = i / double(res - 1), y = j / double(res - 1);
+        double b = (double)scale[k], rgb[3];
+        rgb[l] = b;
+        rgb[(l + 1) % 3] = x * b;
+        rgb[(l + 2) % 3] = y * b;
+
+        double resid = gauss_newton(rgb, coeffs);
+        (void)resid;
+
+        double c0 = 360.0, c1 = 1.0 / (830.0 - 360.0);
+        double A = coeffs[0], B = coeffs[1], C = coeffs[2];
+
+        int idx = ((l * res + k) * res + j) * res + i;
+
+        out[3 * idx + 0] = float(A * (sqr(c1)));
+        out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
+        out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
+        // out[3*idx + 2] = resid;
+    };
 
-                    out[3 * idx + 0] = float(A * (sqr(c1)));
-                    out[3 * idx + 1] = float(B * c1 - 2 * A * c0 * (sqr(c1)));
-                    out[3 * idx + 2] = float(C - B * c0 * c1 + A * (sqr(c0 * c1)));
-                    // out[3*idx + 2] = resid;
-                }
-            }
-        });
-    }
+    // First solve for all cells at the starting scale. Each row of a slice
+    // is done in order so that every cell can start from the solution of its
+    // neighbor, which takes many fewer iterations than starting from zero.
+    int start = res / 5;
+    std::vector<double> startCoeffs(3 * 3 * res * res);
+    ParallelFor(0, 3 * res, [&](int64_t lj) {
+        int l = lj / res, j = lj % res;
+        double coeffs[3];
+        memset(coeffs, 0, sizeof(double) * 3);
+        for (int i = 0; i < res; ++i) {
+            optimizeCell(l, i, j, start, coeffs);
+            memcpy(&startCoeffs[3 * (lj * res + i)], coeffs, sizeof(double) * 3);
+        }
+    });
+
+    // Then sweep each (i, j) column of each slice up and down in scale
+    // from there; the columns are independent and can all run in parallel,
+    // while the order within each one keeps the output deterministic.
+    ParallelFor(0, 3 * res * res, [&](int64_t lji) {
+        int l = lji / (res * res), j = (lji / res) % res, i = lji % res;
+        double coeffs[3];
+        memcpy(coeffs, &startCoeffs[3 * lji], sizeof(double) * 3);
+        for (int k = start + 1; k < res; ++k)
+            optimizeCell(l, i, j, k, coeffs);
+
+        memcpy(coeffs, &startCoeffs[3 * lji], sizeof(double) * 3);
+        for (int k = start - 1; k >= 0; --k)
+            optimizeCell(l, i, j, k, coeffs);
+    });
 
     FILE *f = fopen(argv[2], "w");
     if (f == nullptr)
@@ -3,13 +3,39 @@
 // SPDX: Apache-2.0
 
 /*
-TODO:
-- how to do float4, fancy packing tricks?
-  flat int:32;
-  float float:32
-  struct Foo { int a, b; float c, d; };
-  would be nice to load as a big float4...
+Layouts:
+By default, each field of an soa type is stored in its own array, and
+fields of other soa types are recursively split the same way. A different
+layout can be given after the type's name:
+
+  soa Point3f layout(packed) { Float x, y, z; };
+  soa Ray layout(aosoa, 32) { ... };
+
+- packed: each element is stored as a whole in consecutive 16-byte words and
+  is read and written with float4 loads and stores.
+- aosoa: elements are stored in blocks of the given number of elements;
+  inside a block, each field, including the fields of any soa types it
+  has, which must be defined in the same file, is stored as an array.
+
+Types with these layouts only provide access to whole elements, not to
+their fields' arrays. The layouts in a file can be overridden with
+"--layout <type>=<layout>" arguments, where the layout is "soa", "packed",
+or "aosoa(<n>)", so that they can be compared without editing the file.
+
+Encodings:
+A member declaration can give a more compact type to store its values as:
 
+  SampledSpectrum T_hat, uniPathPDF encoding(HalfSampledSpectrum);
+
+The encodings are only used if soac is run with "--compact"; otherwise the
+member's own type is stored. The storage type must have a constructor that
+takes the member's type and a conversion operator back to it. Encodings are
+only supported with the soa layout.
+
+Each generated SOA class has a BytesPerItem member that gives the number of
+bytes it stores for each element.
+
+TODO:
 - mechanism to not store fields that are easily recomputed...
   maybe the answer is to just do that--recompute only when needed--in the
   original struct!
@@ -19,6 +45,7 @@ TODO:
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
 #include <fstream>
 #include <functional>
 #include <map>
@@ -86,20 +113,178 @@ struct Member {
 
     std::vector<std::string> names;
     std::vector<std::string> arraySizes;
+    // Type that the values are stored as with --compact, if any
+    std::string encoding;
+};
+
+enum class Layout { SOA, Packed, AoSoA };
+
+// Parses a layout given on the command line: "soa", "packed", or "aosoa(<n>)".
+static bool parseLayout(const std::string &str, Layout *layout, int *blockSize) {
+    if (str == "soa")
+        *layout = Layout::SOA;
+    else if (str == "packed")
+        *layout = Layout::Packed;
+    else {
+        char end;
+        if (sscanf(str.c_str(), "aosoa(%d%c", blockSize, &end) != 2 || end != ')' ||
+            str.back() != ')' || *blockSize < 1)
+            return false;
+        *layout = Layout::AoSoA;
+    }
+    return true;
+}
+
+// A field of an element stored with the aosoa layout, where the fields of
+// soa types are replaced with their own fields
+struct LeafMember {
+    std::string type;
+    // Expression for the field in the original type, e.g. "o.x"
+    std::string path;
+    // Name of the field's arrays in the blocks, e.g. "o_x"
+    std::string name;
+    std::string arraySize;
 };
 
 struct SOA {
     std::string type;
     std::string templateType;
     std::vector<Member> members;
+    Layout layout = Layout::SOA;
+    int blockSize = 0;
+    std::vector<LeafMember> leafMembers;
 };
 
+static void emitPacked(const SOA &soa) {
+    const char *type = soa.type.c_str();
+    printf("template <> struct SOA<%s> {\n", type);
+    printf("    SOA() = default;\n");
+    printf("    SOA(int n, Allocator alloc) : nAlloc(n) {\n");
+    printf("        words = alloc.allocate_object<Float4>(n * nWords);\n");
+    printf("    }\n\n");
+
+    printf("    struct GetSetIndirector {\n");
+    printf("        PBRT_CPU_GPU\n");
+    printf("        operator %s() const {\n", type);
+    printf("            return LoadPacked<%s>(soa->words + nWords * i);\n", type);
+    printf("        }\n");
+    printf("        PBRT_CPU_GPU\n");
+    printf("        void operator=(const %s &a) {\n", type);
+    printf("            StorePacked(soa->words + nWords * i, a);\n");
+    printf("        }\n\n");
+    printf("        SOA *soa;\n");
+    printf("        int i;\n");
+    printf("    };\n\n");
+
+    printf("    PBRT_CPU_GPU\n");
+    printf("    GetSetIndirector operator[](int i) {\n");
+    printf("        DCHECK_LT(i, nAlloc);\n");
+    printf("        return GetSetIndirector{this, i};\n");
+    printf("    }\n");
+    printf("    PBRT_CPU_GPU\n");
+    printf("    %s operator[](int i) const {\n", type);
+    printf("        DCHECK_LT(i, nAlloc);\n");
+    printf("        return LoadPacked<%s>(words + nWords * i);\n", type);
+    printf("    }\n\n");
+
+    printf("    static constexpr int nWords = (sizeof(%s) + 15) / 16;\n", type);
+    printf("    static constexpr size_t BytesPerItem = nWords * sizeof(Float4);\n");
+    printf("    int nAlloc;\n");
+    printf("    Float4 * __restrict__ words;\n");
+    printf("};\n\n");
+}
+
+static void emitAoSoA(const SOA &soa) {
+    const char *type = soa.type.c_str();
+    int n = soa.blockSize;
+    printf("template <> struct SOA<%s> {\n", type);
+    printf("    SOA() = default;\n");
+    printf("    SOA(int n, Allocator alloc) : nAlloc(n) {\n");
+    printf("        blocks = alloc.allocate_object<Block>((n + %d) / %d);\n", n - 1, n);
+    printf("    }\n\n");
+
+    printf("    struct Block {\n");
+    for (const LeafMember &leaf : soa.leafMembers) {
+        if (leaf.arraySize.empty())
+            printf("        %s %s[%d];\n", leaf.type.c_str(), leaf.name.c_str(), n);
+        else
+            printf("        %s %s[%s][%d];\n", leaf.type.c_str(), leaf.name.c_str(),
+                   leaf.arraySize.c_str(), n);
+    }
+    printf("    };\n\n");
+
+    printf("    struct GetSetIndirector {\n");
+    printf("        PBRT_CPU_GPU\n");
+    printf("        operator %s() const { return (*(const SOA *)soa)[i]; }\n", type);
+    printf("        PBRT_CPU_GPU\n");
+    printf("        void operator=(const %s &a) {\n", type);
+    printf("            Block &b = soa->blocks[i / %d];\n", n);
+    printf("            int j = i %% %d;\n", n);
+    for (const LeafMember &leaf : soa.leafMembers) {
+        if (leaf.arraySize.empty())
+            printf("            b.%s[j] = a.%s;\n", leaf.name.c_str(), leaf.path.c_str());
+        else {
+            printf("            for (int c = 0; c < %s; ++c)\n", leaf.arraySize.c_str());
+            printf("                b.%s[c][j] = a.%s[c];\n", leaf.name.c_str(),
+                   leaf.path.c_str());
+        }
+    }
+    printf("        }\n\n");
+    printf("        SOA *soa;\n");
+    printf("        int i;\n");
+    printf("    };\n\n");
+
+    printf("    PBRT_CPU_GPU\n");
+    printf("    GetSetIndirector operator[](int i) {\n");
+    printf("        DCHECK_LT(i, nAlloc);\n");
+    printf("        return GetSetIndirector{this, i};\n");
+    printf("    }\n");
+    printf("    PBRT_CPU_GPU\n");
+    printf("    %s operator[](int i) const {\n", type);
+    printf("        DCHECK_LT(i, nAlloc);\n");
+    printf("        const Block &b = blocks[i / %d];\n", n);
+    printf("        int j = i %% %d;\n", n);
+    printf("        %s r;\n", type);
+    for (const LeafMember &leaf : soa.leafMembers) {
+        if (leaf.arraySize.empty())
+            printf("        r.%s = b.%s[j];\n", leaf.path.c_str(), leaf.name.c_str());
+        else {
+            printf("        for (int c = 0; c < %s; ++c)\n", leaf.arraySize.c_str());
+            printf("            r.%s[c] = b.%s[c][j];\n", leaf.path.c_str(),
+                   leaf.name.c_str());
+        }
+    }
+    printf("        return r;\n");
+    printf("    }\n\n");
+
+    printf("    static constexpr size_t BytesPerItem = sizeof(Block) / %d;\n", n);
+    printf("    int nAlloc;\n");
+    printf("    Block * __restrict__ blocks;\n");
+    printf("};\n\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2)
-        error("usage: soac <soac filename>\n");
+    // Parse the command line
+    std::map<std::string, std::string> layoutOverrides;
+    std::vector<const char *> filenames;
+    bool compact = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--compact") == 0)
+            compact = true;
+        else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+            std::string override = argv[++i];
+            size_t eq = override.find('=');
+            if (eq == std::string::npos)
+                error("%s: expected <type>=<layout> after --layout.\n", override.c_str());
+            layoutOverrides[override.substr(0, eq)] = override.substr(eq + 1);
+        } else
+            filenames.push_back(argv[i]);
+    }
+    if (filenames.size() != 1)
+        error("usage: soac [--compact] [--layout <type>=<layout>...] <soac filename>\n");
+    filename = filenames[0];
 
     // Read the file
-    filename = argv[1];
     std::ifstream ifs(filename, std::ios::binary);
     if (!ifs) {
         error("%s: %s", filename, strerror(errno));
@@ -167,6 +352,17 @@ int main(int argc, char *argv[]) {
             } else
                 ungetc();
         }
+        if (isdigit(s[0])) {
+            while (!eof()) {
+                char c = getc();
+                if (!isdigit(c)) {
+                    ungetc();
+                    break;
+                }
+                s += c;
+            }
+            return OptionalString(s);
+        }
         if (!isalpha(s[0]) && s[0] != '_')
             return OptionalString(s);
 
@@ -198,6 +394,40 @@ int main(int argc, char *argv[]) {
         return externSOA.find(type) != externSOA.end();
     };
 
+    // Adds the fields of _soa_ to _leafMembers_, replacing the ones with soa
+    // types with their own fields, for the aosoa layout.
+    std::function<void(const SOA &, std::string, std::vector<LeafMember> *)>
+        flattenMembers;
+    flattenMembers = [&](const SOA &soa, std::string prefix,
+                         std::vector<LeafMember> *leafMembers) {
+        for (const auto &member : soa.members)
+            for (int i = 0; i < member.names.size(); ++i) {
+                std::string path = prefix + member.names[i];
+                if (isFlatType(member.type) || member.numPointers > 0) {
+                    std::string name = path;
+                    for (char &c : name)
+                        if (c == '.')
+                            c = '_';
+                    leafMembers->push_back(
+                        {member.GetType(), path, name, member.arraySizes[i]});
+                    continue;
+                }
+
+                // Find the definition of the member's soa type
+                auto iter = std::find_if(
+                    soaTypes.begin(), soaTypes.end(),
+                    [&](const SOA &s) { return s.type == member.type; });
+                if (iter == soaTypes.end())
+                    error("%s: the aosoa layout requires the definitions of member "
+                          "types; %s is defined elsewhere.\n",
+                          soa.type.c_str(), member.type.c_str());
+                if (!member.arraySizes[i].empty())
+                    error("%s: the aosoa layout doesn't support arrays of soa types.\n",
+                          soa.type.c_str());
+                flattenMembers(*iter, path + ".", leafMembers);
+            }
+    };
+
     auto expect = [&](const char *str) {
         OptionalString tok = getToken(true);
         if (!tok)
@@ -232,17 +462,31 @@ int main(int argc, char *argv[]) {
                 error("%s: type redefined.\n", soa.type.c_str());
 
             OptionalString tok = getToken(false);
+            if (tok == ";") {
+                externSOA.insert(soa.type);
+                continue;
+            }
             if (tok == "<") {
                 tok = getToken(false);
                 soa.templateType = (std::string)tok;
                 if (!isalpha(soa.templateType[0]))
                     error("%s: invalid type identifier.\n", soa.templateType.c_str());
                 expect(">");
-                expect("{");
-            } else if (tok == ";") {
-                externSOA.insert(soa.type);
-                continue;
-            } else if (tok != "{")
+                tok = getToken(false);
+            }
+            if (tok == "layout") {
+                expect("(");
+                std::string layout = getToken(false);
+                if (layout == "aosoa") {
+                    expect(",");
+                    layout += "(" + (std::string)getToken(false) + ")";
+                }
+                if (!parseLayout(layout, &soa.layout, &soa.blockSize))
+                    error("%s: invalid layout.\n", layout.c_str());
+                expect(")");
+                tok = getToken(false);
+            }
+            if (tok != "{")
                 error("Syntax error: expected \"{\".\n");
 
             while (true) {
@@ -288,6 +532,18 @@ int main(int argc, char *argv[]) {
                         tok = getToken(false);
                     }
 
+                    if (tok == "encoding") {
+                        expect("(");
+                        member.encoding = (std::string)getToken(false);
+                        if (!isFlatType(member.encoding) &&
+                            !soaTypeExists(member.encoding))
+                            error("%s: undefined type\n", member.encoding.c_str());
+                        expect(")");
+                        tok = getToken(false);
+                        if (tok != ";")
+                            error("Syntax error: expected \";\" after encoding.\n");
+                    }
+
                     if (tok == ";")
                         break;
                     else if (tok == ",")
@@ -300,16 +556,61 @@ int main(int argc, char *argv[]) {
             }
             expect(";");
 
+            // Apply any layout override given on the command line
+            auto iter = layoutOverrides.find(soa.type);
+            if (iter != layoutOverrides.end() &&
+                !parseLayout(iter->second, &soa.layout, &soa.blockSize))
+                error("%s: invalid layout for %s given with --layout.\n",
+                      iter->second.c_str(), soa.type.c_str());
+            if (soa.layout != Layout::SOA && !soa.templateType.empty())
+                error("%s: only the soa layout is supported for template types.\n",
+                      soa.type.c_str());
+            for (Member &member : soa.members) {
+                if (member.encoding.empty())
+                    continue;
+                if (soa.layout != Layout::SOA)
+                    error("%s: encodings are only supported with the soa layout.\n",
+                          soa.type.c_str());
+                if (member.numPointers > 0 ||
+                    std::any_of(member.arraySizes.begin(), member.arraySizes.end(),
+                                [](const std::string &s) { return !s.empty(); }))
+                    error("%s: encodings can't be used with pointers or arrays.\n",
+                          soa.type.c_str());
+                if (!compact)
+                    member.encoding.clear();
+            }
+            if (soa.layout == Layout::AoSoA)
+                flattenMembers(soa, "", &soa.leafMembers);
+
             soaTypes.push_back(soa);
         } else
             error("%s: invalid token", tok.c_str());
     }
 
+    // Returns the type that a member's values are stored as and whether it
+    // is stored in a flat array
+    auto storedType = [](const Member &member) {
+        return member.encoding.empty() ? member.GetType() : member.encoding;
+    };
+    auto storedFlat = [&](const Member &member) {
+        if (!member.encoding.empty())
+            return isFlatType(member.encoding);
+        return isFlatType(member.type) || member.numPointers > 0;
+    };
+
     // And now emit them...
     printf("// SOA definitions automatically generated by soac\n");
     printf("// DO NOT EDIT THIS FILE MANUALLY\n\n");
     printf("template <typename T> struct SOA;\n\n");
     for (const auto &soa : soaTypes) {
+        if (soa.layout == Layout::Packed) {
+            emitPacked(soa);
+            continue;
+        } else if (soa.layout == Layout::AoSoA) {
+            emitAoSoA(soa);
+            continue;
+        }
+
         if (!soa.templateType.empty())
             printf("template <typename %s> struct SOA<%s<%s>> {\n",
                    soa.templateType.c_str(), soa.type.c_str(), soa.templateType.c_str());
@@ -335,12 +636,12 @@ int main(int argc, char *argv[]) {
                                member.type.c_str());
                     }
                 } else {
-                    if (isFlatType(member.type) || member.numPointers > 0)
+                    if (storedFlat(member))
                         printf("        this->%s = alloc.allocate_object<%s>(n);\n",
-                               name.c_str(), member.GetType().c_str());
+                               name.c_str(), storedType(member).c_str());
                     else
                         printf("        this->%s = SOA<%s>(n, alloc);\n", name.c_str(),
-                               member.type.c_str());
+                               storedType(member).c_str());
                 }
             }
         }
@@ -366,7 +667,10 @@ int main(int argc, char *argv[]) {
                            member.arraySizes[i].c_str());
                     printf("                r.%s[c] = soa->%s[c][i];\n", name.c_str(),
                            name.c_str());
-                } else
+                } else if (!member.encoding.empty())
+                    printf("            r.%s = %s(%s(soa->%s[i]));\n", name.c_str(),
+                           member.type.c_str(), member.encoding.c_str(), name.c_str());
+                else
                     printf("            r.%s = soa->%s[i];\n", name.c_str(),
                            name.c_str());
             }
@@ -387,7 +691,10 @@ int main(int argc, char *argv[]) {
                            member.arraySizes[i].c_str());
                     printf("                soa->%s[c][i] = a.%s[c];\n", name.c_str(),
                            name.c_str());
-                } else
+                } else if (!member.encoding.empty())
+                    printf("            soa->%s[i] = %s(a.%s);\n", name.c_str(),
+                           member.encoding.c_str(), name.c_str());
+                else
                     printf("            soa->%s[i] = a.%s;\n", name.c_str(),
                            name.c_str());
             }
@@ -420,13 +727,32 @@ int main(int argc, char *argv[]) {
                            member.arraySizes[i].c_str());
                     printf("            r.%s[c] = this->%s[c][i];\n", name.c_str(),
                            name.c_str());
-                } else
+                } else if (!member.encoding.empty())
+                    printf("        r.%s = %s(%s(this->%s[i]));\n", name.c_str(),
+                           member.type.c_str(), member.encoding.c_str(), name.c_str());
+                else
                     printf("        r.%s = this->%s[i];\n", name.c_str(), name.c_str());
             }
         printf("        return r;\n");
         printf("    }\n");
         printf("\n");
 
+        // Number of bytes stored per element
+        std::string bytes;
+        for (const auto &member : soa.members)
+            for (int i = 0; i < member.names.size(); ++i) {
+                if (!bytes.empty())
+                    bytes += " + ";
+                if (!member.arraySizes[i].empty())
+                    bytes += member.arraySizes[i] + " * ";
+                if (storedFlat(member))
+                    bytes += "sizeof(" + storedType(member) + ")";
+                else
+                    bytes += "SOA<" + storedType(member) + ">::BytesPerItem";
+            }
+        printf("    static constexpr size_t BytesPerItem = %s;\n",
+               bytes.empty() ? "0" : bytes.c_str());
+
         // Member definitions
         printf("    int nAlloc;\n");
         for (const auto &member : soa.members) {
@@ -441,11 +767,12 @@ int main(int argc, char *argv[]) {
                         printf("    SOA<%s> %s[%s];\n", member.type.c_str(), name.c_str(),
                                member.arraySizes[i].c_str());
                 } else {
-                    if (isFlatType(member.type) || member.numPointers > 0)
-                        printf("    %s * __restrict__ %s;\n", member.GetType().c_str(),
+                    if (storedFlat(member))
+                        printf("    %s * __restrict__ %s;\n", storedType(member).c_str(),
                                name.c_str());
                     else
-                        printf("    SOA<%s> %s;\n", member.type.c_str(), name.c_str());
+                        printf("    SOA<%s> %s;\n", storedType(member).c_str(),
+                               name.c_str());
                 }
             }
         }
@@ -5,26 +5,72 @@
 #include <pbrt/cpu/aggregates.h>
 
 #include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/shapes.h>
 #include <pbrt/util/bits.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/transform.h>
 
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
 #include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifdef PBRT_HAVE_EMBREE
+#include <embree3/rtcore.h>
+#endif
+
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && (defined(__SSE__) || defined(_M_X64))
+#define PBRT_BVH_SSE
+#endif
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && defined(__AVX__)
+#define PBRT_BVH_AVX
+#endif
+#if defined(PBRT_BVH_SSE) || defined(PBRT_BVH_AVX)
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/BVH", treeBytes);
+STAT_MEMORY_COUNTER("Memory/BVH full-precision nodes", fullPrecisionNodeBytes);
+STAT_MEMORY_COUNTER("Memory/BVH quantized nodes", quantizedNodeBytes);
+STAT_MEMORY_COUNTER("Memory/BVH SoA primitives", soaPrimitiveBytes);
+STAT_COUNTER("BVH/BVHs loaded from cache", bvhCacheHits);
+STAT_COUNTER("BVH/SBVH spatial splits", sbvhSpatialSplits);
+STAT_COUNTER("BVH/Refits", bvhRefits);
+STAT_COUNTER("BVH/Rebuilds after refit", bvhRefitRebuilds);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
 STAT_PIXEL_COUNTER("BVH/Nodes visited", bvhNodesVisited);
+STAT_PIXEL_COUNTER("BVH/Primitives tested", bvhPrimitivesTested);
+STAT_PERCENT("BVH/Shadow rays occluded by cached occluder", shadowOccluderHits,
+             shadowOccluderTests);
 
 // MortonPrimitive Definition
 struct MortonPrimitive {
@@ -126,6 +172,134 @@ struct BVHBuildNode {
     int splitAxis, firstPrimOffset, nPrimitives;
 };
 
+// BVH Construction Helper Functions
+// Nodes with more than _parallelBuildThreshold_ primitives compute their
+// bounds, SAH buckets, and partitions using multiple threads; child subtrees
+// with more than _parallelSubtreeThreshold_ primitives are built in parallel.
+static constexpr int parallelBuildThreshold = 64 * 1024;
+static constexpr int parallelSubtreeThreshold = 16 * 1024;
+
+// Returns the starting index of each of the blocks of primitives in
+// _[start, end)_ that are processed in parallel, followed by _end_.
+static std::vector<int> BuildBlockStarts(int start, int end) {
+    int64_t n = end - start;
+    int nBlocks = Clamp(n / (parallelBuildThreshold / 4), 1, 8 * RunningThreads());
+    std::vector<int> blockStarts(nBlocks + 1);
+    for (int b = 0; b <= nBlocks; ++b)
+        blockStarts[b] = start + n * b / nBlocks;
+    return blockStarts;
+}
+
+static void ComputeBounds(const std::vector<BVHPrimitive> &bvhPrimitives, int start,
+                          int end, Bounds3f *bounds, Bounds3f *centroidBounds) {
+    if (end - start <= parallelBuildThreshold) {
+        for (int i = start; i < end; ++i) {
+            *bounds = Union(*bounds, bvhPrimitives[i].bounds);
+            *centroidBounds = Union(*centroidBounds, bvhPrimitives[i].centroid);
+        }
+        return;
+    }
+    // Compute bounds of blocks of primitives in parallel and merge them
+    std::vector<int> blockStarts = BuildBlockStarts(start, end);
+    int nBlocks = blockStarts.size() - 1;
+    std::vector<Bounds3f> blockBounds(nBlocks), blockCentroidBounds(nBlocks);
+    ParallelFor(0, nBlocks, [&](int64_t b) {
+        ComputeBounds(bvhPrimitives, blockStarts[b], blockStarts[b + 1], &blockBounds[b],
+                      &blockCentroidBounds[b]);
+    });
+    for (int b = 0; b < nBlocks; ++b) {
+        *bounds = Union(*bounds, blockBounds[b]);
+        *centroidBounds = Union(*centroidBounds, blockCentroidBounds[b]);
+    }
+}
+
+template <typename BucketIndex>
+static void ComputeSAHBuckets(const std::vector<BVHPrimitive> &bvhPrimitives, int start,
+                              int end, BucketIndex bucketIndex, BVHSplitBucket *buckets,
+                              int nBuckets) {
+    if (end - start <= parallelBuildThreshold) {
+        for (int i = start; i < end; ++i) {
+            int b = bucketIndex(bvhPrimitives[i]);
+            DCHECK_GE(b, 0);
+            DCHECK_LT(b, nBuckets);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds, bvhPrimitives[i].bounds);
+        }
+        return;
+    }
+    // Fill buckets for blocks of primitives in parallel and merge them
+    std::vector<int> blockStarts = BuildBlockStarts(start, end);
+    int nBlocks = blockStarts.size() - 1;
+    std::vector<BVHSplitBucket> blockBuckets(nBlocks * nBuckets);
+    ParallelFor(0, nBlocks, [&](int64_t b) {
+        ComputeSAHBuckets(bvhPrimitives, blockStarts[b], blockStarts[b + 1], bucketIndex,
+                          &blockBuckets[b * nBuckets], nBuckets);
+    });
+    for (int b = 0; b < nBlocks; ++b)
+        for (int i = 0; i < nBuckets; ++i) {
+            buckets[i].count += blockBuckets[b * nBuckets + i].count;
+            buckets[i].bounds =
+                Union(buckets[i].bounds, blockBuckets[b * nBuckets + i].bounds);
+        }
+}
+
+// Reorders the primitives in _[start, end)_ so that those for which _pred_
+// is true come first and returns the index of the first one for which it is
+// false, like _std::partition()_.
+template <typename Predicate>
+static int PartitionPrimitives(std::vector<BVHPrimitive> &bvhPrimitives, int start,
+                               int end, Predicate pred) {
+    if (end - start <= parallelBuildThreshold)
+        return std::partition(&bvhPrimitives[start], &bvhPrimitives[end - 1] + 1, pred) -
+               &bvhPrimitives[0];
+
+    // Partition blocks of primitives in parallel
+    std::vector<int> blockStarts = BuildBlockStarts(start, end);
+    int nBlocks = blockStarts.size() - 1;
+    std::vector<int> blockMids(nBlocks);
+    ParallelFor(0, nBlocks, [&](int64_t b) {
+        blockMids[b] = std::partition(&bvhPrimitives[blockStarts[b]],
+                                      &bvhPrimitives[blockStarts[b + 1] - 1] + 1, pred) -
+                       &bvhPrimitives[0];
+    });
+    int mid = start;
+    for (int b = 0; b < nBlocks; ++b)
+        mid += blockMids[b] - blockStarts[b];
+
+    // Find the ranges of primitives that are on the wrong side of _mid_; there
+    // are as many before _mid_ as after it
+    std::vector<std::pair<int, int>> misplacedBefore, misplacedAfter;
+    std::vector<int64_t> beforeOffsets(1, 0), afterOffsets(1, 0);
+    for (int b = 0; b < nBlocks; ++b) {
+        if (int e = std::min(blockStarts[b + 1], mid); blockMids[b] < e) {
+            misplacedBefore.push_back({blockMids[b], e});
+            beforeOffsets.push_back(beforeOffsets.back() + e - blockMids[b]);
+        }
+        if (int s = std::max(blockStarts[b], mid); s < blockMids[b]) {
+            misplacedAfter.push_back({s, blockMids[b]});
+            afterOffsets.push_back(afterOffsets.back() + blockMids[b] - s);
+        }
+    }
+    CHECK_EQ(beforeOffsets.back(), afterOffsets.back());
+
+    // Swap misplaced primitives in parallel
+    ParallelFor(0, beforeOffsets.back(), [&](int64_t k0, int64_t k1) {
+        size_t bi = std::upper_bound(beforeOffsets.begin(), beforeOffsets.end(), k0) -
+                    beforeOffsets.begin() - 1;
+        size_t ai = std::upper_bound(afterOffsets.begin(), afterOffsets.end(), k0) -
+                    afterOffsets.begin() - 1;
+        for (int64_t k = k0; k < k1; ++k) {
+            while (k >= beforeOffsets[bi + 1])
+                ++bi;
+            while (k >= afterOffsets[ai + 1])
+                ++ai;
+            std::swap(bvhPrimitives[misplacedBefore[bi].first + (k - beforeOffsets[bi])],
+                      bvhPrimitives[misplacedAfter[ai].first + (k - afterOffsets[ai])]);
+        }
+    });
+    return mid;
+}
+
 // LinearBVHNode Definition
 struct alignas(32) LinearBVHNode {
     Bounds3f bounds;
@@ -137,18 +311,618 @@ struct alignas(32) LinearBVHNode {
     uint8_t axis;          // interior node: xyz
 };
 
+// Returns a bitmask of the boxes given by _pMin_ and _pMax_ that the ray
+// intersects and stores the parametric distances at which it enters them in
+// _tMin_. Box coordinates are stored as structure-of-arrays for SIMD.
+template <int N>
+inline int IntersectBoundsN(const Float pMin[3][N], const Float pMax[3][N], Point3f o,
+                            Vector3f invDir, const int dirIsNeg[3], Float raytMax,
+                            Float tMin[N]) {
+#ifdef PBRT_BVH_AVX
+    if constexpr (N == 8) {
+        __m256 t0 = _mm256_setzero_ps(), t1 = _mm256_set1_ps(raytMax);
+        for (int a = 0; a < 3; ++a) {
+            __m256 org = _mm256_set1_ps(o[a]), inv = _mm256_set1_ps(invDir[a]);
+            __m256 pNear = _mm256_loadu_ps(dirIsNeg[a] ? pMax[a] : pMin[a]);
+            __m256 pFar = _mm256_loadu_ps(dirIsNeg[a] ? pMin[a] : pMax[a]);
+            __m256 tNear = _mm256_mul_ps(_mm256_sub_ps(pNear, org), inv);
+            __m256 tFar = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(pFar, org), inv),
+                                        _mm256_set1_ps(1 + 2 * gamma(3)));
+            // Ignore NaN slab distances from rays that lie in a slab's plane;
+            // min and max return their second operand if either is NaN
+            t0 = _mm256_max_ps(tNear, t0);
+            t1 = _mm256_min_ps(tFar, t1);
+        }
+        _mm256_storeu_ps(tMin, t0);
+        return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+    }
+#endif
+#ifdef PBRT_BVH_SSE
+    if constexpr (N == 4) {
+        __m128 t0 = _mm_setzero_ps(), t1 = _mm_set1_ps(raytMax);
+        for (int a = 0; a < 3; ++a) {
+            __m128 org = _mm_set1_ps(o[a]), inv = _mm_set1_ps(invDir[a]);
+            __m128 pNear = _mm_loadu_ps(dirIsNeg[a] ? pMax[a] : pMin[a]);
+            __m128 pFar = _mm_loadu_ps(dirIsNeg[a] ? pMin[a] : pMax[a]);
+            __m128 tNear = _mm_mul_ps(_mm_sub_ps(pNear, org), inv);
+            __m128 tFar = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(pFar, org), inv),
+                                     _mm_set1_ps(1 + 2 * gamma(3)));
+            t0 = _mm_max_ps(tNear, t0);
+            t1 = _mm_min_ps(tFar, t1);
+        }
+        _mm_storeu_ps(tMin, t0);
+        return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+    }
+#endif
+    // Intersect ray with all boxes using portable code
+    Float t0[N], t1[N];
+    for (int i = 0; i < N; ++i) {
+        t0[i] = 0;
+        t1[i] = raytMax;
+    }
+    for (int a = 0; a < 3; ++a) {
+        const Float *pNear = dirIsNeg[a] ? pMax[a] : pMin[a];
+        const Float *pFar = dirIsNeg[a] ? pMin[a] : pMax[a];
+        for (int i = 0; i < N; ++i) {
+            Float tNear = (pNear[i] - o[a]) * invDir[a];
+            Float tFar = (pFar[i] - o[a]) * invDir[a] * (1 + 2 * gamma(3));
+            t0[i] = tNear > t0[i] ? tNear : t0[i];
+            t1[i] = tFar < t1[i] ? tFar : t1[i];
+        }
+    }
+    int hitMask = 0;
+    for (int i = 0; i < N; ++i) {
+        tMin[i] = t0[i];
+        if (t0[i] <= t1[i])
+            hitMask |= 1 << i;
+    }
+    return hitMask;
+}
+
+// WideBVHNode Definition
+template <int N>
+struct alignas(64) WideBVHNode {
+    // WideBVHNode Public Methods
+    WideBVHNode() {
+        // Initialize all children to empty bounds that no ray intersects
+        for (int a = 0; a < 3; ++a)
+            for (int i = 0; i < N; ++i) {
+                pMin[a][i] = Infinity;
+                pMax[a][i] = -Infinity;
+            }
+        for (int i = 0; i < N; ++i) {
+            childOffset[i] = 0;
+            nPrimitives[i] = 0;
+        }
+    }
+
+    void SetChild(int i, const Bounds3f &b, int offset, int nPrims) {
+        for (int a = 0; a < 3; ++a) {
+            pMin[a][i] = b.pMin[a];
+            pMax[a][i] = b.pMax[a];
+        }
+        childOffset[i] = offset;
+        nPrimitives[i] = nPrims;
+    }
+
+    Bounds3f ChildBounds(int i) const {
+        return Bounds3f(Point3f(pMin[0][i], pMin[1][i], pMin[2][i]),
+                        Point3f(pMax[0][i], pMax[1][i], pMax[2][i]));
+    }
+
+    Bounds3f Bounds() const {
+        Bounds3f b;
+        for (int i = 0; i < nChildren; ++i)
+            b = Union(b, ChildBounds(i));
+        return b;
+    }
+
+    int Intersect(Point3f o, Vector3f invDir, const int dirIsNeg[3], Float raytMax,
+                  Float tMin[N]) const {
+        return IntersectBoundsN<N>(pMin, pMax, o, invDir, dirIsNeg, raytMax, tMin);
+    }
+
+    // WideBVHNode Public Members
+    static constexpr int Width = N;
+    // Child bounds are stored as structure-of-arrays for SIMD traversal
+    Float pMin[3][N], pMax[3][N];
+    int childOffset[N];       // interior child: node index; leaf: first primitive
+    uint16_t nPrimitives[N];  // 0 -> interior child
+    int nChildren = 0;
+};
+
+// QuantizedBVHNode Definition
+template <int N>
+struct alignas(16) QuantizedBVHNode {
+    // QuantizedBVHNode Public Methods
+    QuantizedBVHNode(const WideBVHNode<N> &node) : nChildren(node.nChildren) {
+        // Choose per-axis power-of-two scales that span the node's bounds
+        Bounds3f bounds = node.Bounds();
+        for (int a = 0; a < 3; ++a) {
+            origin[a] = bounds.pMin[a];
+            int exponent;
+            std::frexp(float(bounds.pMax[a] - bounds.pMin[a]) / 255, &exponent);
+            exponent = Clamp(exponent, -100, 127);
+            // Make sure that the largest quantized value reaches the upper bound
+            while (exponent < 127 && origin[a] + 255 * std::ldexp(1.f, exponent) <
+                                         float(bounds.pMax[a]))
+                ++exponent;
+            scaleExponent[a] = exponent;
+        }
+
+        // Quantize child bounds conservatively relative to _origin_
+        for (int i = 0; i < N; ++i) {
+            childOffset[i] = node.childOffset[i];
+            nPrimitives[i] = node.nPrimitives[i];
+            for (int a = 0; a < 3; ++a) {
+                if (i >= nChildren) {
+                    // Use inverted bounds for unused children so that no ray hits them
+                    qMin[a][i] = 255;
+                    qMax[a][i] = 0;
+                    continue;
+                }
+                float scale = std::ldexp(1.f, scaleExponent[a]);
+                int lo = Clamp(int(std::floor((node.pMin[a][i] - origin[a]) / scale)), 0,
+                               255);
+                while (lo > 0 && origin[a] + lo * scale > float(node.pMin[a][i]))
+                    --lo;
+                int hi = Clamp(int(std::ceil((node.pMax[a][i] - origin[a]) / scale)), 0,
+                               255);
+                while (hi < 255 && origin[a] + hi * scale < float(node.pMax[a][i]))
+                    ++hi;
+                qMin[a][i] = lo;
+                qMax[a][i] = hi;
+            }
+        }
+    }
+
+    Bounds3f ChildBounds(int i) const {
+        Point3f pMin, pMax;
+        for (int a = 0; a < 3; ++a) {
+            float scale = std::ldexp(1.f, scaleExponent[a]);
+            pMin[a] = origin[a] + qMin[a][i] * scale;
+            pMax[a] = origin[a] + qMax[a][i] * scale;
+        }
+        return Bounds3f(pMin, pMax);
+    }
+
+    Bounds3f Bounds() const {
+        Bounds3f b;
+        for (int i = 0; i < nChildren; ++i)
+            b = Union(b, ChildBounds(i));
+        return b;
+    }
+
+    int Intersect(Point3f o, Vector3f invDir, const int dirIsNeg[3], Float raytMax,
+                  Float tMin[N]) const {
+        // Decode child bounds and intersect ray with them
+        alignas(32) Float pMin[3][N], pMax[3][N];
+        for (int a = 0; a < 3; ++a) {
+            float scale = std::ldexp(1.f, scaleExponent[a]);
+            for (int i = 0; i < N; ++i) {
+                pMin[a][i] = origin[a] + qMin[a][i] * scale;
+                pMax[a][i] = origin[a] + qMax[a][i] * scale;
+            }
+        }
+        int hitMask = IntersectBoundsN<N>(pMin, pMax, o, invDir, dirIsNeg, raytMax, tMin);
+        // Unused children decode to inverted boxes; mask them out explicitly
+        // in case the ray lies in the plane of one of their faces
+        return hitMask & ((1 << nChildren) - 1);
+    }
+
+    // QuantizedBVHNode Public Members
+    static constexpr int Width = N;
+    float origin[3];
+    int8_t scaleExponent[3];
+    uint8_t nChildren;
+    uint8_t qMin[3][N], qMax[3][N];
+    int childOffset[N];       // interior child: node index; leaf: first primitive
+    uint16_t nPrimitives[N];  // 0 -> interior child
+};
+
+// WideBVHNodeToVisit Definition
+struct WideBVHNodeToVisit {
+    int offset, nPrimitives;
+    Float tMin;
+};
+
+// Flattens the binary BVH rooted at _node_ into _nodes_ in depth-first order
+static int FlattenBVHTree(BVHBuildNode *node, LinearBVHNode *nodes, int *offset) {
+    LinearBVHNode *linearNode = &nodes[*offset];
+    linearNode->bounds = node->bounds;
+    int nodeOffset = (*offset)++;
+    if (node->nPrimitives > 0) {
+        CHECK(!node->children[0] && !node->children[1]);
+        CHECK_LT(node->nPrimitives, 65536);
+        linearNode->primitivesOffset = node->firstPrimOffset;
+        linearNode->nPrimitives = node->nPrimitives;
+    } else {
+        // Create interior flattened BVH node
+        linearNode->axis = node->splitAxis;
+        linearNode->nPrimitives = 0;
+        FlattenBVHTree(node->children[0], nodes, offset);
+        linearNode->secondChildOffset = FlattenBVHTree(node->children[1], nodes, offset);
+    }
+    return nodeOffset;
+}
+
+// Collapses the binary BVH rooted at _node_ into _N_-wide nodes appended to
+// _wideNodes_ and returns the index of the wide node for _node_.
+template <int N>
+static int FlattenWideBVHTree(BVHBuildNode *node,
+                              std::vector<WideBVHNode<N>> *wideNodes) {
+    // Gather up to _N_ children, opening the interior child with the largest
+    // surface area each time
+    BVHBuildNode *children[N];
+    int nChildren = 0;
+    if (node->nPrimitives > 0) {
+        children[nChildren++] = node;
+    } else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+    }
+    while (nChildren < N) {
+        int open = -1;
+        Float maxArea = -1;
+        for (int i = 0; i < nChildren; ++i)
+            if (children[i]->nPrimitives == 0 &&
+                children[i]->bounds.SurfaceArea() > maxArea) {
+                open = i;
+                maxArea = children[i]->bounds.SurfaceArea();
+            }
+        if (open == -1)
+            break;
+        BVHBuildNode *interior = children[open];
+        children[open] = interior->children[0];
+        children[nChildren++] = interior->children[1];
+    }
+
+    // Initialize wide node and recursively flatten its interior children
+    int nodeOffset = wideNodes->size();
+    wideNodes->push_back(WideBVHNode<N>());
+    (*wideNodes)[nodeOffset].nChildren = nChildren;
+    for (int i = 0; i < nChildren; ++i) {
+        BVHBuildNode *child = children[i];
+        if (child->nPrimitives > 0) {
+            CHECK_LT(child->nPrimitives, 65536);
+            (*wideNodes)[nodeOffset].SetChild(i, child->bounds, child->firstPrimOffset,
+                                              child->nPrimitives);
+        } else {
+            int childOffset = FlattenWideBVHTree(child, wideNodes);
+            (*wideNodes)[nodeOffset].SetChild(i, child->bounds, childOffset, 0);
+        }
+    }
+    return nodeOffset;
+}
+
+// BVH Cache Definitions
+// Increment _BVHCacheVersion_ whenever the layout of cached nodes changes.
+static constexpr int32_t BVHCacheVersion = 2;
+static constexpr size_t BVHCacheAlignment = 64;
+
+// BVHCacheHeader Definition
+struct BVHCacheHeader {
+    char magic[8];
+    uint64_t key;
+    // SBVHs may reference primitives more than once, so _nReferences_ may
+    // be larger than _nPrimitives_
+    int64_t nPrimitives, nReferences, nodeBytes;
+    int32_t version, width, quantize, floatSize;
+};
+
+// Primitive order and nodes follow the header in cache files, each starting
+// at a multiple of _BVHCacheAlignment_ bytes
+static size_t BVHCacheOrderOffset() {
+    return (sizeof(BVHCacheHeader) + BVHCacheAlignment - 1) & ~(BVHCacheAlignment - 1);
+}
+
+static size_t BVHCacheNodesOffset(int64_t nReferences) {
+    size_t end = BVHCacheOrderOffset() + nReferences * sizeof(int32_t);
+    return (end + BVHCacheAlignment - 1) & ~(BVHCacheAlignment - 1);
+}
+
+// SBVH Construction Helper Functions
+// Spatial splits are only considered for nodes where the children of the
+// best object split overlap by more than this fraction of the root's area.
+static constexpr Float sbvhOverlapThreshold = 1e-5f;
+
+// SBVHSpatialBin Definition
+struct SBVHSpatialBin {
+    Bounds3f bounds;
+    int enter = 0, exit = 0;
+};
+
+static int SBVHBinIndex(const Bounds3f &bounds, int dim, int nBins, Float x) {
+    Float extent = bounds.pMax[dim] - bounds.pMin[dim];
+    return Clamp(int(nBins * (x - bounds.pMin[dim]) / extent), 0, nBins - 1);
+}
+
+static Float SBVHBinPosition(const Bounds3f &bounds, int dim, int nBins, int bin) {
+    return Lerp(Float(bin) / nBins, bounds.pMin[dim], bounds.pMax[dim]);
+}
+
+// Returns _b_ restricted to the slab _[min, max]_ along _dim_. Only the
+// bounds are clipped, so this is exact for axis-aligned geometry and
+// conservative otherwise.
+static Bounds3f ClipBounds(Bounds3f b, int dim, Float min, Float max) {
+    b.pMin[dim] = Clamp(b.pMin[dim], min, max);
+    b.pMax[dim] = Clamp(b.pMax[dim], min, max);
+    return b;
+}
+
+// A flattened BVH is fully determined by the bounds of its primitives, in
+// order, and the build parameters, so those are all that the key depends on.
+static uint64_t BVHCacheKey(const std::vector<BVHPrimitive> &bvhPrimitives,
+                            int maxPrimsInNode, BVHAggregate::SplitMethod splitMethod,
+                            int width, bool quantize, Float splitBudget) {
+    std::vector<Bounds3f> bounds(bvhPrimitives.size());
+    ParallelFor(0, bvhPrimitives.size(),
+                [&](int64_t i) { bounds[i] = bvhPrimitives[i].bounds; });
+    uint64_t boundsHash = HashBuffer(bounds.data(), bounds.size() * sizeof(Bounds3f));
+    // The split budget only affects SBVHs
+    if (splitMethod != BVHAggregate::SplitMethod::SBVH)
+        splitBudget = 0;
+    return Hash(boundsHash, bvhPrimitives.size(), maxPrimsInNode, int(splitMethod),
+                width, quantize, splitBudget, BVHCacheVersion);
+}
+
+static WideBVHNodesHandle MakeWideBVHNodesHandle(const void *ptr, int width,
+                                                 bool quantize) {
+    void *p = const_cast<void *>(ptr);
+    if (quantize) {
+        if (width == 2)
+            return static_cast<QuantizedBVHNode<2> *>(p);
+        else if (width == 4)
+            return static_cast<QuantizedBVHNode<4> *>(p);
+        return static_cast<QuantizedBVHNode<8> *>(p);
+    } else if (width == 4)
+        return static_cast<WideBVHNode<4> *>(p);
+    CHECK_EQ(width, 8);
+    return static_cast<WideBVHNode<8> *>(p);
+}
+
+// BVH SoA Primitive Definitions
+#ifdef PBRT_BVH_AVX
+static constexpr int SoALanes = 8;
+#else
+static constexpr int SoALanes = 4;
+#endif
+
+// Values of _BVHAggregate::primitiveSoAKind_
+enum SoAKind : uint8_t {
+    NonSoA,
+    DegenerateTriangle,
+    // SoA hits with opaque shapes are certain to occlude shadow rays
+    OpaqueTriangle,
+    // The primitive must confirm SoA hits, e.g. in case of alpha masking
+    TestedTriangle,
+    OpaquePatch,
+    TestedPatch
+};
+
+static bool IsOpaqueSoAKind(uint8_t kind) {
+    return kind == OpaqueTriangle || kind == OpaquePatch;
+}
+
+// SoAHits Definition
+// The hits found by the SoA tests for a group of lanes; each lane's entry is
+// only valid if the lane's bit is set in the hit mask
+struct SoAHits {
+    TriangleIntersection triangles[SoALanes];
+    BilinearIntersection patches[SoALanes];
+};
+
+// TriangleRay Definition
+// Ray values used by IntersectTriangle() that are the same for every triangle
+struct TriangleRay {
+    explicit TriangleRay(const Ray &ray) {
+        // Permute components of ray origin and direction
+        kz = MaxComponentIndex(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3)
+            kx = 0;
+        ky = kx + 1;
+        if (ky == 3)
+            ky = 0;
+        Vector3f d = Permute(ray.d, {kx, ky, kz});
+        o = Permute(ray.o, {kx, ky, kz});
+
+        // Compute shear transformation for ray direction
+        Sx = -d.x / d.z;
+        Sy = -d.y / d.z;
+        Sz = 1.f / d.z;
+    }
+
+    int kx, ky, kz;
+    Point3f o;
+    Float Sx, Sy, Sz;
+};
+
+// LazyTriangleRay Definition
+// Computes a ray's _TriangleRay_ the first time that a BVH traversal tests
+// the ray against triangles in SoA form, so that traversals that never
+// reach any don't pay for it.
+class LazyTriangleRay {
+  public:
+    explicit LazyTriangleRay(const Ray &ray) : ray(ray) {}
+
+    const TriangleRay &Get() {
+        if (!triRay)
+            triRay = TriangleRay(ray);
+        return *triRay;
+    }
+
+  private:
+    const Ray &ray;
+    pstd::optional<TriangleRay> triRay;
+};
+
+// Tests the ray against _SoALanes_ triangles starting at _start_ in the
+// SoA _vertices_ arrays and returns a bitmask of the ones that it hits,
+// storing each hit in _hits_. The computation is the same as
+// IntersectTriangle()'s, one lane at a time, so that the results match it
+// exactly.
+static int IntersectTriangles(const Float *vertices, size_t stride, size_t start,
+                              const TriangleRay &r, Float tMax,
+                              TriangleIntersection *hits) {
+    constexpr int N = SoALanes;
+    // Transform triangle vertices to ray coordinate space
+    Float px[3][N], py[3][N], pz[3][N];
+    for (int v = 0; v < 3; ++v) {
+        const Float *x = vertices + (3 * v + r.kx) * stride + start;
+        const Float *y = vertices + (3 * v + r.ky) * stride + start;
+        const Float *z = vertices + (3 * v + r.kz) * stride + start;
+        for (int i = 0; i < N; ++i) {
+            pz[v][i] = z[i] - r.o.z;
+            px[v][i] = (x[i] - r.o.x) + r.Sx * pz[v][i];
+            py[v][i] = (y[i] - r.o.y) + r.Sy * pz[v][i];
+        }
+    }
+
+    // Compute edge function coefficients _e0_, _e1_, and _e2_
+    Float e0[N], e1[N], e2[N];
+    for (int i = 0; i < N; ++i) {
+        e0[i] = DifferenceOfProducts(px[1][i], py[2][i], py[1][i], px[2][i]);
+        e1[i] = DifferenceOfProducts(px[2][i], py[0][i], py[2][i], px[0][i]);
+        e2[i] = DifferenceOfProducts(px[0][i], py[1][i], py[0][i], px[1][i]);
+    }
+
+    // Fall back to double precision test at triangle edges
+    if (sizeof(Float) == sizeof(float))
+        for (int i = 0; i < N; ++i) {
+            if (e0[i] != 0 && e1[i] != 0 && e2[i] != 0)
+                continue;
+            double p2txp1ty = (double)px[2][i] * (double)py[1][i];
+            double p2typ1tx = (double)py[2][i] * (double)px[1][i];
+            e0[i] = (float)(p2typ1tx - p2txp1ty);
+            double p0txp2ty = (double)px[0][i] * (double)py[2][i];
+            double p0typ2tx = (double)py[0][i] * (double)px[2][i];
+            e1[i] = (float)(p0typ2tx - p0txp2ty);
+            double p1txp0ty = (double)px[1][i] * (double)py[0][i];
+            double p1typ0tx = (double)py[1][i] * (double)px[0][i];
+            e2[i] = (float)(p1typ0tx - p1txp0ty);
+        }
+
+    int hitMask = 0;
+    for (int i = 0; i < N; ++i) {
+        // Perform triangle edge and determinant tests
+        bool edgesPass = !((e0[i] < 0 || e1[i] < 0 || e2[i] < 0) &&
+                           (e0[i] > 0 || e1[i] > 0 || e2[i] > 0));
+        Float det = e0[i] + e1[i] + e2[i];
+
+        // Compute scaled hit distance to triangle and test against ray $t$ range
+        Float z0 = pz[0][i] * r.Sz, z1 = pz[1][i] * r.Sz, z2 = pz[2][i] * r.Sz;
+        Float tScaled = e0[i] * z0 + e1[i] * z1 + e2[i] * z2;
+        // These tests also fail for the NaN vertices of padding lanes
+        bool inRange = (det < 0 && tScaled < 0 && tScaled >= tMax * det) ||
+                       (det > 0 && tScaled > 0 && tScaled <= tMax * det);
+        Float invDet = 1 / det;
+        Float t = tScaled * invDet;
+
+        // Ensure that computed triangle $t$ is conservatively greater than zero
+        Float maxZt = std::max(std::max(std::abs(z0), std::abs(z1)), std::abs(z2));
+        Float deltaZ = gamma(3) * maxZt;
+        Float maxXt = std::max(std::max(std::abs(px[0][i]), std::abs(px[1][i])),
+                               std::abs(px[2][i]));
+        Float maxYt = std::max(std::max(std::abs(py[0][i]), std::abs(py[1][i])),
+                               std::abs(py[2][i]));
+        Float deltaX = gamma(5) * (maxXt + maxZt);
+        Float deltaY = gamma(5) * (maxYt + maxZt);
+        Float deltaE = 2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+        Float maxE = std::max(std::max(std::abs(e0[i]), std::abs(e1[i])),
+                              std::abs(e2[i]));
+        Float deltaT = 3 *
+                       (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+                       std::abs(invDet);
+
+        hits[i] = TriangleIntersection{e0[i] * invDet, e1[i] * invDet, e2[i] * invDet, t};
+        hitMask |= int(edgesPass && inRange && t > deltaT) << i;
+    }
+    return hitMask;
+}
+
+// Tests the ray against the bilinear patches in _laneMask_'s lanes starting
+// at _start_ in the SoA _vertices_ arrays and returns a bitmask of the ones
+// that it hits, storing each hit in _hits_. The quadratic coefficients are
+// computed for all of the lanes together, with the same expressions as
+// IntersectBilinearPatch(); only patches for which the quadratic has
+// solutions go on to the scalar test, which makes the final decision for
+// each one.
+static int IntersectBilinearPatches(const Float *vertices, size_t stride,
+                                    size_t start, int laneMask, const Ray &ray,
+                                    Float tMax, BilinearIntersection *hits) {
+    constexpr int N = SoALanes;
+    auto vertex = [&](int v, int i) {
+        return Point3f(vertices[(3 * v) * stride + start + i],
+                       vertices[(3 * v + 1) * stride + start + i],
+                       vertices[(3 * v + 2) * stride + start + i]);
+    };
+    // Find quadratic coefficients for distance from ray to $u$ iso-lines
+    Float a[N], b[N], c[N];
+    for (int i = 0; i < N; ++i) {
+        Point3f p00 = vertex(0, i), p10 = vertex(1, i);
+        Point3f p01 = vertex(2, i), p11 = vertex(3, i);
+        a[i] = Dot(Cross(p10 - p00, p01 - p11), ray.d);
+        c[i] = Dot(Cross(p00 - ray.o, ray.d), p01 - p00);
+        b[i] = Dot(Cross(p10 - ray.o, ray.d), p11 - p10) - (a[i] + c[i]);
+    }
+
+    int hitMask = 0;
+    for (int i = 0; i < N; ++i) {
+        // Skip patches where _Quadratic()_ has no solutions; the NaN
+        // vertices of padding lanes are skipped here as well
+        Float discrim = DifferenceOfProducts(b[i], b[i], 4 * a[i], c[i]);
+        if (!(laneMask & (1 << i)) || (a[i] != 0 && !(discrim >= 0)))
+            continue;
+        pstd::optional<BilinearIntersection> isect = IntersectBilinearPatch(
+            ray, tMax, vertex(0, i), vertex(1, i), vertex(2, i), vertex(3, i));
+        if (isect) {
+            hits[i] = *isect;
+            hitMask |= 1 << i;
+        }
+    }
+    return hitMask;
+}
+
 // BVHAggregate Method Definitions
 BVHAggregate::BVHAggregate(std::vector<PrimitiveHandle> p, int maxPrimsInNode,
-                           SplitMethod splitMethod)
+                           SplitMethod splitMethod, int width, bool quantize,
+                           Float splitBudget, bool soaTriangles, bool soaPatches)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       primitives(std::move(p)),
-      splitMethod(splitMethod) {
+      splitMethod(splitMethod),
+      width(width),
+      quantize(quantize),
+      splitBudget(splitBudget),
+      soaTriangles(soaTriangles),
+      soaPatches(soaPatches) {
     CHECK(!primitives.empty());
+    CHECK(width == 2 || width == 4 || width == 8);
     // Build BVH from _primitives_
     // Initialize _bvhPrimitives_ array for primitives
     std::vector<BVHPrimitive> bvhPrimitives(primitives.size());
-    for (size_t i = 0; i < primitives.size(); ++i)
+    ParallelFor(0, primitives.size(), [&](int64_t i) {
         bvhPrimitives[i] = BVHPrimitive(i, primitives[i].Bounds());
+    });
+    onlyOpaqueSurfaces =
+        std::all_of(primitives.begin(), primitives.end(),
+                    [](PrimitiveHandle prim) { return prim.HasOnlyOpaqueSurfaces(); });
+
+    // Use cached BVH for these primitive bounds and build parameters, if available
+    std::string cacheFilename;
+    uint64_t cacheKey = 0;
+    if (!Options->bvhCacheDirectory.empty()) {
+        cacheKey = BVHCacheKey(bvhPrimitives, maxPrimsInNode, splitMethod, width,
+                               quantize, splitBudget);
+        cacheFilename = StringPrintf("%s/bvh-%016llx.bin", Options->bvhCacheDirectory,
+                                     (unsigned long long)cacheKey);
+        if (readCache(cacheFilename, cacheKey, width, quantize)) {
+            if (soaTriangles || soaPatches)
+                initSoAPrimitives();
+            accountMemory();
+            return;
+        }
+    }
 
     // Build BVH for primitives using _bvhPrimitives_
     // Declare _Allocator_s used for BVH construction
@@ -161,11 +935,24 @@ BVHAggregate::BVHAggregate(std::vector<PrimitiveHandle> p, int maxPrimsInNode,
         threadAllocators.push_back(Allocator(&threadResources[i]));
 
     std::atomic<int> totalNodes{0};
-    std::vector<PrimitiveHandle> orderedPrims(primitives.size());
+    std::vector<PrimitiveHandle> orderedPrims;
     BVHBuildNode *root;
     if (splitMethod == SplitMethod::HLBVH) {
+        orderedPrims.resize(primitives.size());
         root = buildHLBVH(alloc, bvhPrimitives, &totalNodes, orderedPrims);
+    } else if (splitMethod == SplitMethod::SBVH) {
+        // Build SBVH; primitives may be referenced by more than one leaf
+        Bounds3f rootBounds, rootCentroidBounds;
+        ComputeBounds(bvhPrimitives, 0, bvhPrimitives.size(), &rootBounds,
+                      &rootCentroidBounds);
+        std::atomic<int64_t> remainingBudget{int64_t(splitBudget * primitives.size())};
+        std::mutex orderedPrimsMutex;
+        orderedPrims.reserve(primitives.size());
+        root = buildSBVH(threadAllocators, std::move(bvhPrimitives),
+                         rootBounds.SurfaceArea(), &remainingBudget, &totalNodes,
+                         &orderedPrimsMutex, orderedPrims);
     } else {
+        orderedPrims.resize(primitives.size());
         std::atomic<int> orderedPrimsOffset{0};
         root = buildRecursive(threadAllocators, bvhPrimitives, 0, primitives.size(),
                               &totalNodes, &orderedPrimsOffset, orderedPrims);
@@ -173,17 +960,59 @@ BVHAggregate::BVHAggregate(std::vector<PrimitiveHandle> p, int maxPrimsInNode,
     }
     primitives.swap(orderedPrims);
     bvhPrimitives.resize(0);
-    LOG_VERBOSE("BVH created with %d nodes for %d primitives (%.2f MB)",
-                totalNodes.load(), (int)primitives.size(),
+    LOG_VERBOSE("BVH created with %d nodes for %d primitives (%d references, %.2f MB)",
+                totalNodes.load(), (int)orderedPrims.size(), (int)primitives.size(),
                 float(totalNodes.load() * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
 
-    // Flatten BVH into _nodes_ array
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
-    nodes = new LinearBVHNode[totalNodes];
-    int offset = 0;
-    flattenBVHTree(root, &offset);
-    CHECK_EQ(totalNodes.load(), offset);
+    treeBytes += sizeof(*this) + primitives.size() * sizeof(primitives[0]);
+    if (quantize) {
+        if (width == 2)
+            wideNodes = collapseBVHTree<QuantizedBVHNode<2>>(root);
+        else if (width == 4)
+            wideNodes = collapseBVHTree<QuantizedBVHNode<4>>(root);
+        else
+            wideNodes = collapseBVHTree<QuantizedBVHNode<8>>(root);
+    } else if (width == 4) {
+        wideNodes = collapseBVHTree<WideBVHNode<4>>(root);
+    } else if (width == 8) {
+        wideNodes = collapseBVHTree<WideBVHNode<8>>(root);
+    } else {
+        // Flatten BVH into _nodes_ array
+        nodeBytes = totalNodes * sizeof(LinearBVHNode);
+        treeBytes += nodeBytes;
+        fullPrecisionNodeBytes += nodeBytes;
+        nodes = Allocator().allocate_object<LinearBVHNode>(totalNodes);
+        ParallelFirstTouch(nodes, nodeBytes);
+        for (int i = 0; i < totalNodes; ++i)
+            new (&nodes[i]) LinearBVHNode;
+        int offset = 0;
+        FlattenBVHTree(root, nodes, &offset);
+        CHECK_EQ(totalNodes.load(), offset);
+    }
+    if (soaTriangles || soaPatches)
+        initSoAPrimitives();
+
+    if (!cacheFilename.empty()) {
+        // Write BVH to cache, recording primitive order by original index
+        // (_orderedPrims_ now holds the primitives in their original order.)
+        std::unordered_map<const void *, int> primIndex;
+        for (size_t i = 0; i < orderedPrims.size(); ++i)
+            primIndex[orderedPrims[i].ptr()] = i;
+        std::vector<int> order(primitives.size());
+        for (size_t i = 0; i < primitives.size(); ++i)
+            order[i] = primIndex[primitives[i].ptr()];
+        if (writeCache(cacheFilename, cacheKey, width, quantize, orderedPrims.size(),
+                       order) &&
+            Options->sharedCache)
+            adoptCache(cacheFilename);
+    }
+    accountMemory();
+}
+
+void BVHAggregate::accountMemory() {
+    size_t bytes = MemoryBytes();
+    AddCategoryMemory(MemoryCategory::BVH, int64_t(bytes) - int64_t(accountedBytes));
+    accountedBytes = bytes;
 }
 
 BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocators,
@@ -197,10 +1026,9 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
     BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
     // Initialize _BVHBuildNode_ for primitive range
     ++*totalNodes;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, bvhPrimitives[i].bounds);
+    // Compute bounds of all primitives and their centroids in BVH node
+    Bounds3f bounds, centroidBounds;
+    ComputeBounds(bvhPrimitives, start, end, &bounds, &centroidBounds);
 
     int nPrimitives = end - start;
     if (bounds.SurfaceArea() == 0 || nPrimitives == 1) {
@@ -214,10 +1042,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
         return node;
 
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, bvhPrimitives[i].centroid);
+        // Choose split dimension _dim_ using bound of primitive centroids
         int dim = centroidBounds.MaxDimension();
 
         // Partition primitives into two sets and build children
@@ -238,12 +1063,10 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
             case SplitMethod::Middle: {
                 // Partition primitives through node's midpoint
                 Float pmid = (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
-                BVHPrimitive *midPtr =
-                    std::partition(&bvhPrimitives[start], &bvhPrimitives[end - 1] + 1,
-                                   [dim, pmid](const BVHPrimitive &pi) {
-                                       return pi.centroid[dim] < pmid;
-                                   });
-                mid = midPtr - &bvhPrimitives[0];
+                mid = PartitionPrimitives(bvhPrimitives, start, end,
+                                          [dim, pmid](const BVHPrimitive &pi) {
+                                              return pi.centroid[dim] < pmid;
+                                          });
                 // For lots of prims with large overlapping bounding boxes, this
                 // may fail to partition; in that case don't break and fall through
                 // to EqualCounts.
@@ -277,19 +1100,14 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
                     // Allocate _BVHSplitBucket_ for SAH partition buckets
                     constexpr int nBuckets = 12;
                     BVHSplitBucket buckets[nBuckets];
+                    auto bucketIndex = [=](const BVHPrimitive &bp) {
+                        int b = nBuckets * centroidBounds.Offset(bp.centroid)[dim];
+                        return b == nBuckets ? nBuckets - 1 : b;
+                    };
 
                     // Initialize _BVHSplitBucket_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
-                        int b = nBuckets *
-                                centroidBounds.Offset(bvhPrimitives[i].centroid)[dim];
-                        if (b == nBuckets)
-                            b = nBuckets - 1;
-                        DCHECK_GE(b, 0);
-                        DCHECK_LT(b, nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, bvhPrimitives[i].bounds);
-                    }
+                    ComputeSAHBuckets(bvhPrimitives, start, end, bucketIndex, buckets,
+                                      nBuckets);
 
                     // Compute costs for splitting after each bucket
                     constexpr int nSplits = nBuckets - 1;
@@ -334,16 +1152,11 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
 
                     // Either create leaf or split primitives at selected SAH bucket
                     if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
-                        BVHPrimitive *pmid = std::partition(
-                            &bvhPrimitives[start], &bvhPrimitives[end - 1] + 1,
-                            [=](const BVHPrimitive &bp) {
-                                int b =
-                                    nBuckets * centroidBounds.Offset(bp.centroid)[dim];
-                                if (b == nBuckets)
-                                    b = nBuckets - 1;
-                                return b <= minCostSplitBucket;
-                            });
-                        mid = pmid - &bvhPrimitives[0];
+                        mid = PartitionPrimitives(bvhPrimitives, start, end,
+                                                  [=](const BVHPrimitive &bp) {
+                                                      return bucketIndex(bp) <=
+                                                             minCostSplitBucket;
+                                                  });
                     } else {
                         // Create leaf _BVHBuildNode_
                         int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
@@ -362,7 +1175,7 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
 
             BVHBuildNode *children[2];
             // Recursively build BVHs for _children_
-            if (end - start > 128 * 1024) {
+            if (end - start > parallelSubtreeThreshold) {
                 // Recursively build child BVHs in parallel
                 ParallelFor(0, 2, [&](int i) {
                     if (i == 0)
@@ -392,6 +1205,247 @@ BVHBuildNode *BVHAggregate::buildRecursive(std::vector<Allocator> &threadAllocat
     return node;
 }
 
+BVHBuildNode *BVHAggregate::buildSBVH(std::vector<Allocator> &threadAllocators,
+                                      std::vector<BVHPrimitive> refs,
+                                      Float rootSurfaceArea,
+                                      std::atomic<int64_t> *splitBudget,
+                                      std::atomic<int> *totalNodes,
+                                      std::mutex *orderedPrimsMutex,
+                                      std::vector<PrimitiveHandle> &orderedPrims) {
+    DCHECK(!refs.empty());
+    Allocator alloc = threadAllocators[ThreadIndex];
+    BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
+    ++*totalNodes;
+    int nRefs = refs.size();
+    Bounds3f bounds, centroidBounds;
+    ComputeBounds(refs, 0, nRefs, &bounds, &centroidBounds);
+
+    auto makeLeaf = [&]() {
+        // Create leaf _BVHBuildNode_ for references in _refs_
+        std::lock_guard<std::mutex> lock(*orderedPrimsMutex);
+        int firstPrimOffset = orderedPrims.size();
+        for (const BVHPrimitive &ref : refs)
+            orderedPrims.push_back(primitives[ref.primitiveIndex]);
+        node->InitLeaf(firstPrimOffset, nRefs, bounds);
+        return node;
+    };
+    if (bounds.SurfaceArea() == 0 || nRefs == 1)
+        return makeLeaf();
+
+    // Find the best object split along the centroid bounds' largest extent
+    int objectDim = centroidBounds.MaxDimension();
+    constexpr int nBuckets = 12;
+    int objectSplitBucket = -1;
+    Float objectCost = Infinity, objectOverlap = Infinity;
+    auto bucketIndex = [=](const BVHPrimitive &bp) {
+        int b = nBuckets * centroidBounds.Offset(bp.centroid)[objectDim];
+        return b == nBuckets ? nBuckets - 1 : b;
+    };
+    if (centroidBounds.pMax[objectDim] > centroidBounds.pMin[objectDim]) {
+        BVHSplitBucket buckets[nBuckets];
+        ComputeSAHBuckets(refs, 0, nRefs, bucketIndex, buckets, nBuckets);
+        Bounds3f boundsAbove[nBuckets];
+        int countAbove[nBuckets];
+        boundsAbove[nBuckets - 1] = buckets[nBuckets - 1].bounds;
+        countAbove[nBuckets - 1] = buckets[nBuckets - 1].count;
+        for (int i = nBuckets - 2; i >= 0; --i) {
+            boundsAbove[i] = Union(boundsAbove[i + 1], buckets[i].bounds);
+            countAbove[i] = countAbove[i + 1] + buckets[i].count;
+        }
+        Bounds3f boundsBelow;
+        int countBelow = 0;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            boundsBelow = Union(boundsBelow, buckets[i].bounds);
+            countBelow += buckets[i].count;
+            if (countBelow == 0 || countAbove[i + 1] == 0)
+                continue;
+            Float cost = countBelow * boundsBelow.SurfaceArea() +
+                         countAbove[i + 1] * boundsAbove[i + 1].SurfaceArea();
+            if (cost < objectCost) {
+                objectCost = cost;
+                objectSplitBucket = i;
+                Bounds3f overlap = pbrt::Intersect(boundsBelow, boundsAbove[i + 1]);
+                objectOverlap = overlap.IsDegenerate() ? 0 : overlap.SurfaceArea();
+            }
+        }
+    }
+
+    // Find the best spatial split if the object split's children overlap
+    constexpr int nBins = 16;
+    int spatialDim = -1, spatialSplitBin = -1;
+    Float spatialCost = Infinity;
+    Bounds3f spatialBounds[2];
+    int spatialCount[2];
+    if (objectOverlap > sbvhOverlapThreshold * rootSurfaceArea &&
+        splitBudget->load(std::memory_order_relaxed) > 0) {
+        // Evaluate spatial splits along each axis
+        struct AxisSplit {
+            int bin = -1;
+            Float cost = Infinity;
+            Bounds3f bounds[2];
+            int count[2];
+        };
+        AxisSplit axisSplits[3];
+        auto evaluateAxis = [&](int dim) {
+            if (bounds.pMax[dim] == bounds.pMin[dim])
+                return;
+            // Clip references to the bins that they overlap
+            SBVHSpatialBin bins[nBins];
+            for (const BVHPrimitive &ref : refs) {
+                int first = SBVHBinIndex(bounds, dim, nBins, ref.bounds.pMin[dim]);
+                int last = SBVHBinIndex(bounds, dim, nBins, ref.bounds.pMax[dim]);
+                ++bins[first].enter;
+                ++bins[last].exit;
+                for (int b = first; b <= last; ++b) {
+                    Float b0 = SBVHBinPosition(bounds, dim, nBins, b);
+                    Float b1 = SBVHBinPosition(bounds, dim, nBins, b + 1);
+                    bins[b].bounds =
+                        Union(bins[b].bounds, ClipBounds(ref.bounds, dim, b0, b1));
+                }
+            }
+
+            // Sweep over the split planes between bins
+            Bounds3f boundsAbove[nBins];
+            int countAbove[nBins];
+            boundsAbove[nBins - 1] = bins[nBins - 1].bounds;
+            countAbove[nBins - 1] = bins[nBins - 1].exit;
+            for (int b = nBins - 2; b >= 0; --b) {
+                boundsAbove[b] = Union(boundsAbove[b + 1], bins[b].bounds);
+                countAbove[b] = countAbove[b + 1] + bins[b].exit;
+            }
+            Bounds3f boundsBelow;
+            int countBelow = 0;
+            for (int b = 0; b < nBins - 1; ++b) {
+                boundsBelow = Union(boundsBelow, bins[b].bounds);
+                countBelow += bins[b].enter;
+                // Splits that don't reduce the number of references on both
+                // sides may not terminate
+                if (countBelow == 0 || countAbove[b + 1] == 0 || countBelow == nRefs ||
+                    countAbove[b + 1] == nRefs)
+                    continue;
+                Float cost = countBelow * boundsBelow.SurfaceArea() +
+                             countAbove[b + 1] * boundsAbove[b + 1].SurfaceArea();
+                if (cost < axisSplits[dim].cost) {
+                    axisSplits[dim].bin = b;
+                    axisSplits[dim].cost = cost;
+                    axisSplits[dim].bounds[0] = boundsBelow;
+                    axisSplits[dim].bounds[1] = boundsAbove[b + 1];
+                    axisSplits[dim].count[0] = countBelow;
+                    axisSplits[dim].count[1] = countAbove[b + 1];
+                }
+            }
+        };
+        if (nRefs > parallelBuildThreshold)
+            ParallelFor(0, 3, [&](int64_t dim) { evaluateAxis(dim); });
+        else
+            for (int dim = 0; dim < 3; ++dim)
+                evaluateAxis(dim);
+
+        for (int dim = 0; dim < 3; ++dim)
+            if (axisSplits[dim].cost < spatialCost) {
+                spatialDim = dim;
+                spatialSplitBin = axisSplits[dim].bin;
+                spatialCost = axisSplits[dim].cost;
+                spatialBounds[0] = axisSplits[dim].bounds[0];
+                spatialBounds[1] = axisSplits[dim].bounds[1];
+                spatialCount[0] = axisSplits[dim].count[0];
+                spatialCount[1] = axisSplits[dim].count[1];
+            }
+    }
+
+    // Reserve duplicate references for the spatial split if it is the better one
+    bool useSpatialSplit = false;
+    int64_t nReserved = 0;
+    if (spatialCost < objectCost) {
+        nReserved = spatialCount[0] + spatialCount[1] - nRefs;
+        int64_t remaining = splitBudget->load();
+        while (remaining >= nReserved &&
+               !splitBudget->compare_exchange_weak(remaining, remaining - nReserved))
+            ;
+        useSpatialSplit = remaining >= nReserved;
+    }
+
+    // Either create leaf or split references
+    Float leafCost = nRefs;
+    Float splitCost = 1.f / 2.f + (useSpatialSplit ? spatialCost : objectCost) /
+                                      bounds.SurfaceArea();
+    if ((!useSpatialSplit && objectSplitBucket == -1) ||
+        (nRefs <= maxPrimsInNode && splitCost >= leafCost)) {
+        splitBudget->fetch_add(useSpatialSplit ? nReserved : 0);
+        return makeLeaf();
+    }
+
+    std::vector<BVHPrimitive> childRefs[2];
+    int dim;
+    if (useSpatialSplit) {
+        // Partition references at spatial split, duplicating those that straddle it
+        dim = spatialDim;
+        Float splitPos = SBVHBinPosition(bounds, dim, nBins, spatialSplitBin + 1);
+        Bounds3f childBounds[2] = {spatialBounds[0], spatialBounds[1]};
+        int childCount[2] = {spatialCount[0], spatialCount[1]};
+        int64_t nDuplicated = 0;
+        for (const BVHPrimitive &ref : refs) {
+            int first = SBVHBinIndex(bounds, dim, nBins, ref.bounds.pMin[dim]);
+            int last = SBVHBinIndex(bounds, dim, nBins, ref.bounds.pMax[dim]);
+            if (last <= spatialSplitBin) {
+                childRefs[0].push_back(ref);
+                continue;
+            } else if (first > spatialSplitBin) {
+                childRefs[1].push_back(ref);
+                continue;
+            }
+            // Place straddling reference in one child if that is cheaper than
+            // splitting it
+            Float area[2] = {childBounds[0].SurfaceArea(), childBounds[1].SurfaceArea()};
+            Float duplicateCost = area[0] * childCount[0] + area[1] * childCount[1];
+            Float unsplitCost[2] = {
+                Union(childBounds[0], ref.bounds).SurfaceArea() * childCount[0] +
+                    area[1] * (childCount[1] - 1),
+                area[0] * (childCount[0] - 1) +
+                    Union(childBounds[1], ref.bounds).SurfaceArea() * childCount[1]};
+            int side = unsplitCost[0] <= unsplitCost[1] ? 0 : 1;
+            if (unsplitCost[side] < duplicateCost && childCount[1 - side] > 1) {
+                childRefs[side].push_back(ref);
+                childBounds[side] = Union(childBounds[side], ref.bounds);
+                --childCount[1 - side];
+            } else {
+                Bounds3f b[2] = {ClipBounds(ref.bounds, dim, -Infinity, splitPos),
+                                 ClipBounds(ref.bounds, dim, splitPos, Infinity)};
+                childRefs[0].push_back(BVHPrimitive(ref.primitiveIndex, b[0]));
+                childRefs[1].push_back(BVHPrimitive(ref.primitiveIndex, b[1]));
+                ++nDuplicated;
+            }
+        }
+        // Return unused duplicate references to the budget
+        splitBudget->fetch_add(nReserved - nDuplicated);
+        ++sbvhSpatialSplits;
+
+    } else {
+        // Partition references at object split
+        dim = objectDim;
+        for (const BVHPrimitive &ref : refs)
+            childRefs[bucketIndex(ref) <= objectSplitBucket ? 0 : 1].push_back(ref);
+    }
+    DCHECK(!childRefs[0].empty() && !childRefs[1].empty());
+    refs = std::vector<BVHPrimitive>();
+
+    // Recursively build SBVHs for children
+    BVHBuildNode *children[2];
+    auto buildChild = [&](int i) {
+        children[i] = buildSBVH(threadAllocators, std::move(childRefs[i]),
+                                rootSurfaceArea, splitBudget, totalNodes,
+                                orderedPrimsMutex, orderedPrims);
+    };
+    if (nRefs > parallelSubtreeThreshold)
+        ParallelFor(0, 2, [&](int64_t i) { buildChild(i); });
+    else {
+        buildChild(0);
+        buildChild(1);
+    }
+    node->InitInterior(dim, children[0], children[1]);
+    return node;
+}
+
 BVHBuildNode *BVHAggregate::buildHLBVH(Allocator alloc,
                                        const std::vector<BVHPrimitive> &bvhPrimitives,
                                        std::atomic<int> *totalNodes,
@@ -508,37 +1562,567 @@ BVHBuildNode *BVHAggregate::emitLBVH(BVHBuildNode *&buildNodes,
     }
 }
 
-int BVHAggregate::flattenBVHTree(BVHBuildNode *node, int *offset) {
-    LinearBVHNode *linearNode = &nodes[*offset];
-    linearNode->bounds = node->bounds;
-    int nodeOffset = (*offset)++;
-    if (node->nPrimitives > 0) {
-        CHECK(!node->children[0] && !node->children[1]);
-        CHECK_LT(node->nPrimitives, 65536);
-        linearNode->primitivesOffset = node->firstPrimOffset;
-        linearNode->nPrimitives = node->nPrimitives;
+template <typename Node>
+Node *BVHAggregate::collapseBVHTree(BVHBuildNode *root) {
+    // Collapse binary BVH into wide nodes
+    constexpr int N = Node::Width;
+    std::vector<WideBVHNode<N>> fullNodes;
+    FlattenWideBVHTree(root, &fullNodes);
+
+    // Convert nodes to final representation and update memory statistics
+    size_t bytes = fullNodes.size() * sizeof(Node);
+    nodeBytes = bytes;
+    constexpr bool quantized = std::is_same_v<Node, QuantizedBVHNode<N>>;
+    LOG_VERBOSE("BVH collapsed to %d %d-wide%s nodes (%.2f MB)", (int)fullNodes.size(),
+                N, quantized ? " quantized" : "", float(bytes) / (1024.f * 1024.f));
+    treeBytes += bytes;
+    if (quantized)
+        quantizedNodeBytes += bytes;
+    else
+        fullPrecisionNodeBytes += bytes;
+    Node *wn = Allocator().allocate_object<Node>(fullNodes.size());
+    for (size_t i = 0; i < fullNodes.size(); ++i)
+        new (&wn[i]) Node(fullNodes[i]);
+    return wn;
+}
+
+bool BVHAggregate::readCache(const std::string &filename, uint64_t key, int width,
+                             bool quantize) {
+    if (!FileExists(filename))
+        return false;
+    // Map cached BVH into memory, or read it if memory mapping is unavailable
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        Warning("%s: %s", filename, ErrorString());
+        return false;
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) == 0 && stat.st_size > 0) {
+        size = stat.st_size;
+        // Map pages copy-on-write so that _Refit()_ can update nodes in place
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED)
+            data = static_cast<const char *>(ptr);
+    }
+    close(fd);
+    if (!data) {
+        Warning("%s: unable to map BVH cache file: %s", filename, ErrorString());
+        return false;
+    }
+    auto release = [&]() { munmap(const_cast<char *>(data), size); };
+#else
+    std::string contents = ReadFileContents(filename);
+    size = contents.size();
+    char *buf = static_cast<char *>(
+        Allocator().allocate_bytes(std::max<size_t>(size, 1), BVHCacheAlignment));
+    std::memcpy(buf, contents.data(), size);
+    data = buf;
+    auto release = [&]() { Allocator().deallocate_bytes(buf, size, BVHCacheAlignment); };
+#endif
+
+    // Validate cache file header and contents
+    BVHCacheHeader header;
+    if (size < sizeof(header)) {
+        release();
+        return false;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    int64_t nPrimitives = primitives.size(), nReferences = header.nReferences;
+    if (std::memcmp(header.magic, "pbrtbvh", 8) != 0 ||
+        header.version != BVHCacheVersion || header.key != key ||
+        header.nPrimitives != nPrimitives || nReferences < nPrimitives ||
+        nReferences > int64_t(size / sizeof(int32_t)) || header.width != width ||
+        header.quantize != int32_t(quantize) || header.floatSize != sizeof(Float) ||
+        header.nodeBytes <= 0 ||
+        size < BVHCacheNodesOffset(nReferences) + header.nodeBytes) {
+        Warning("%s: ignoring stale or corrupt BVH cache file.", filename);
+        release();
+        return false;
+    }
+    const int32_t *order =
+        reinterpret_cast<const int32_t *>(data + BVHCacheOrderOffset());
+    for (int64_t i = 0; i < nReferences; ++i)
+        if (order[i] < 0 || order[i] >= nPrimitives) {
+            Warning("%s: ignoring corrupt BVH cache file.", filename);
+            release();
+            return false;
+        }
+
+    // Initialize BVH from cache; cached nodes are used in place
+    std::vector<PrimitiveHandle> orderedPrims(nReferences);
+    for (int64_t i = 0; i < nReferences; ++i)
+        orderedPrims[i] = primitives[order[i]];
+    primitives.swap(orderedPrims);
+    nodeBytes = header.nodeBytes;
+    const void *nodeData = data + BVHCacheNodesOffset(nReferences);
+    if (width == 2 && !quantize) {
+        nodes = static_cast<LinearBVHNode *>(const_cast<void *>(nodeData));
+        fullPrecisionNodeBytes += nodeBytes;
     } else {
-        // Create interior flattened BVH node
-        linearNode->axis = node->splitAxis;
-        linearNode->nPrimitives = 0;
-        flattenBVHTree(node->children[0], offset);
-        linearNode->secondChildOffset = flattenBVHTree(node->children[1], offset);
+        wideNodes = MakeWideBVHNodesHandle(nodeData, width, quantize);
+        if (quantize)
+            quantizedNodeBytes += nodeBytes;
+        else
+            fullPrecisionNodeBytes += nodeBytes;
     }
-    return nodeOffset;
+    treeBytes += sizeof(*this) + primitives.size() * sizeof(primitives[0]) + nodeBytes;
+    cacheData = const_cast<char *>(data);
+    cacheBytes = size;
+    ++bvhCacheHits;
+    LOG_VERBOSE("Loaded BVH for %d primitives from cache file %s", nPrimitives,
+                filename);
+    return true;
+}
+
+bool BVHAggregate::writeCache(const std::string &filename, uint64_t key, int width,
+                              bool quantize, int64_t nPrimitives,
+                              const std::vector<int> &order) const {
+    // Initialize cache file contents
+    int64_t nReferences = primitives.size();
+    size_t nodesOffset = BVHCacheNodesOffset(nReferences);
+    std::string contents(nodesOffset + nodeBytes, '\0');
+    BVHCacheHeader header;
+    std::memcpy(header.magic, "pbrtbvh", 8);
+    header.key = key;
+    header.nPrimitives = nPrimitives;
+    header.nReferences = nReferences;
+    header.nodeBytes = nodeBytes;
+    header.version = BVHCacheVersion;
+    header.width = width;
+    header.quantize = quantize;
+    header.floatSize = sizeof(Float);
+    std::memcpy(&contents[0], &header, sizeof(header));
+    for (int64_t i = 0; i < nReferences; ++i) {
+        int32_t index = order[i];
+        std::memcpy(&contents[BVHCacheOrderOffset() + i * sizeof(int32_t)], &index,
+                    sizeof(index));
+    }
+    const void *nodeData = nodes ? static_cast<const void *>(nodes) : wideNodes.ptr();
+    std::memcpy(&contents[nodesOffset], nodeData, nodeBytes);
+
+    if (!WriteFileAtomic(filename, contents)) {
+        Warning("%s: unable to write BVH cache file.", filename);
+        return false;
+    }
+    LOG_VERBOSE("Wrote BVH for %d primitives to cache file %s", nPrimitives, filename);
+    return true;
+}
+
+void BVHAggregate::adoptCache(const std::string &filename) {
+#ifdef PBRT_HAVE_MMAP
+    // Map the cache file as _readCache()_ does
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+    size_t nodesOffset = BVHCacheNodesOffset(primitives.size());
+    size_t size = nodesOffset + nodeBytes;
+    struct stat stat;
+    void *ptr = MAP_FAILED;
+    if (fstat(fd, &stat) == 0 && size_t(stat.st_size) == size)
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return;
+
+    // Use the file's nodes if they are the same as the BVH's; another
+    // process may have replaced the file in the meantime.
+    char *data = static_cast<char *>(ptr);
+    const void *nodeData = nodes ? static_cast<const void *>(nodes) : wideNodes.ptr();
+    if (std::memcmp(data + nodesOffset, nodeData, nodeBytes) != 0) {
+        munmap(ptr, size);
+        return;
+    }
+    size_t builtNodeBytes = nodeBytes;
+    releaseNodes();
+    nodeBytes = builtNodeBytes;
+    if (width == 2 && !quantize)
+        nodes = reinterpret_cast<LinearBVHNode *>(data + nodesOffset);
+    else
+        wideNodes = MakeWideBVHNodesHandle(data + nodesOffset, width, quantize);
+    cacheData = data;
+    cacheBytes = size;
+    LOG_VERBOSE("Using BVH nodes from cache file %s", filename);
+#endif
 }
 
 Bounds3f BVHAggregate::Bounds() const {
+    if (wideNodes)
+        return wideNodes.DispatchCPU([](auto ptr) { return ptr[0].Bounds(); });
     CHECK(nodes != nullptr);
     return nodes[0].bounds;
 }
 
+// Returns the nodes of a BVH stored in depth-first order grouped by their
+// depth in the tree; _forEachChild(i, f)_ must call _f_ with the index of each
+// interior child of node _i_.
+template <typename ForEachChild>
+static std::vector<std::vector<int>> BVHNodeLevels(int nNodes,
+                                                   ForEachChild forEachChild) {
+    std::vector<int> depth(nNodes, 0);
+    std::vector<std::vector<int>> levels;
+    // Children always follow their parents, so a single forward pass suffices
+    for (int i = 0; i < nNodes; ++i) {
+        if (depth[i] == levels.size())
+            levels.push_back({});
+        levels[depth[i]].push_back(i);
+        forEachChild(i, [&](int child) { depth[child] = depth[i] + 1; });
+    }
+    return levels;
+}
+
+// Calls _refitNode_ for all nodes, deepest first, so that each node's
+// children have been refit before it is; nodes at the same depth are
+// processed in parallel.
+template <typename RefitNode>
+static void RefitBVHLevels(const std::vector<std::vector<int>> &levels,
+                           RefitNode refitNode) {
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+        const std::vector<int> &nodeIndices = *level;
+        if (nodeIndices.size() < 1024)
+            for (int i : nodeIndices)
+                refitNode(i);
+        else
+            ParallelFor(0, nodeIndices.size(),
+                        [&](int64_t i) { refitNode(nodeIndices[i]); });
+    }
+}
+
+void BVHAggregate::ReleaseMemory() {
+    releaseNodes();
+
+    // Free primitive references and SoA primitive data
+    std::vector<PrimitiveHandle>().swap(primitives);
+    std::vector<Float>().swap(triangleVertices);
+    std::vector<Float>().swap(patchVertices);
+    std::vector<uint8_t>().swap(primitiveSoAKind);
+    AddCategoryMemory(MemoryCategory::BVH, -int64_t(accountedBytes));
+    accountedBytes = 0;
+}
+
+void BVHAggregate::releaseNodes() {
+    // Free BVH nodes, which may be in memory holding a cached BVH
+    if (cacheData) {
+#ifdef PBRT_HAVE_MMAP
+        munmap(cacheData, cacheBytes);
+#else
+        Allocator().deallocate_bytes(cacheData, std::max<size_t>(cacheBytes, 1),
+                                     BVHCacheAlignment);
+#endif
+    } else if (nodes)
+        Allocator().deallocate_object(nodes, nodeBytes / sizeof(LinearBVHNode));
+    else if (wideNodes)
+        wideNodes.DispatchCPU([&](auto ptr) {
+            using Node = std::remove_const_t<std::remove_pointer_t<decltype(ptr)>>;
+            Allocator().deallocate_object(const_cast<Node *>(ptr),
+                                          nodeBytes / sizeof(Node));
+        });
+    cacheData = nullptr;
+    cacheBytes = 0;
+    nodes = nullptr;
+    wideNodes = nullptr;
+    nodeBytes = 0;
+}
+
+size_t BVHAggregate::MemoryBytes() const {
+    return sizeof(*this) + nodeBytes + primitives.capacity() * sizeof(PrimitiveHandle) +
+           (triangleVertices.capacity() + patchVertices.capacity()) * sizeof(Float) +
+           primitiveSoAKind.capacity();
+}
+
+bool BVHAggregate::Refit(Float rebuildCostRatio) {
+    if (builtSAHCost == 0)
+        builtSAHCost = SAHCost();
+
+    // Update transformed primitives' copies of their inverse transformations
+    ParallelFor(0, primitives.size(), [&](int64_t i) {
+        if (TransformedPrimitive *prim =
+                primitives[i].CastOrNullptr<TransformedPrimitive>())
+            prim->TransformChanged();
+    });
+
+    // Update node bounds bottom-up
+    if (wideNodes)
+        wideNodes.DispatchCPU([&](auto ptr) { refitWide(ptr); });
+    else {
+        int nNodes = nodeBytes / sizeof(LinearBVHNode);
+        std::vector<std::vector<int>> levels =
+            BVHNodeLevels(nNodes, [&](int i, auto f) {
+                if (nodes[i].nPrimitives == 0) {
+                    f(i + 1);
+                    f(nodes[i].secondChildOffset);
+                }
+            });
+        RefitBVHLevels(levels, [&](int i) {
+            LinearBVHNode &node = nodes[i];
+            if (node.nPrimitives > 0) {
+                Bounds3f bounds;
+                for (int j = 0; j < node.nPrimitives; ++j) {
+                    PrimitiveHandle prim = primitives[node.primitivesOffset + j];
+                    bounds = Union(bounds, prim.Bounds());
+                }
+                node.bounds = bounds;
+            } else
+                node.bounds =
+                    Union(nodes[i + 1].bounds, nodes[node.secondChildOffset].bounds);
+        });
+    }
+    if (soaTriangles || soaPatches)
+        initSoAPrimitives();
+    ++bvhRefits;
+
+    // Rebuild BVH if refitting has degraded it too much
+    Float cost = SAHCost();
+    LOG_VERBOSE("BVH refit: SAH cost %f, %f when built", cost, builtSAHCost);
+    if (!(cost > rebuildCostRatio * builtSAHCost))
+        return false;
+    std::vector<PrimitiveHandle> prims;
+    if (splitMethod == SplitMethod::SBVH) {
+        // Remove duplicate references to primitives
+        std::unordered_set<const void *> seen;
+        for (PrimitiveHandle prim : primitives)
+            if (seen.insert(prim.ptr()).second)
+                prims.push_back(prim);
+    } else
+        prims = std::move(primitives);
+    ReleaseMemory();
+    *this = BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod, width, quantize,
+                         splitBudget, soaTriangles, soaPatches);
+    ++bvhRefitRebuilds;
+    return true;
+}
+
+template <typename Node>
+void BVHAggregate::refitWide(Node *wideNodes) {
+    constexpr int N = Node::Width;
+    int nNodes = nodeBytes / sizeof(Node);
+    std::vector<std::vector<int>> levels = BVHNodeLevels(nNodes, [&](int i, auto f) {
+        for (int c = 0; c < wideNodes[i].nChildren; ++c)
+            if (wideNodes[i].nPrimitives[c] == 0)
+                f(wideNodes[i].childOffset[c]);
+    });
+    RefitBVHLevels(levels, [&](int i) {
+        // Compute child bounds and reinitialize node with them
+        const Node &node = wideNodes[i];
+        WideBVHNode<N> refitNode;
+        refitNode.nChildren = node.nChildren;
+        for (int c = 0; c < node.nChildren; ++c) {
+            Bounds3f bounds;
+            if (node.nPrimitives[c] > 0) {
+                for (int j = 0; j < node.nPrimitives[c]; ++j)
+                    bounds = Union(bounds, primitives[node.childOffset[c] + j].Bounds());
+            } else
+                bounds = wideNodes[node.childOffset[c]].Bounds();
+            refitNode.SetChild(c, bounds, node.childOffset[c], node.nPrimitives[c]);
+        }
+        wideNodes[i] = Node(refitNode);
+    });
+}
+
+Float BVHAggregate::SAHCost() const {
+    if (wideNodes)
+        return wideNodes.DispatchCPU([&](auto ptr) { return wideSAHCost(ptr); });
+    // Sum traversal and intersection costs weighted by node surface areas,
+    // using the same costs as BVH construction
+    Float cost = 0;
+    int nNodes = nodeBytes / sizeof(LinearBVHNode);
+    for (int i = 0; i < nNodes; ++i) {
+        Float area = nodes[i].bounds.SurfaceArea();
+        cost += nodes[i].nPrimitives > 0 ? nodes[i].nPrimitives * area : area / 2;
+    }
+    return cost / nodes[0].bounds.SurfaceArea();
+}
+
+template <typename Node>
+Float BVHAggregate::wideSAHCost(const Node *wideNodes) const {
+    Float cost = 0;
+    int nNodes = nodeBytes / sizeof(Node);
+    for (int i = 0; i < nNodes; ++i) {
+        cost += wideNodes[i].Bounds().SurfaceArea() / 2;
+        for (int c = 0; c < wideNodes[i].nChildren; ++c)
+            cost +=
+                wideNodes[i].nPrimitives[c] * wideNodes[i].ChildBounds(c).SurfaceArea();
+    }
+    return cost / wideNodes[0].Bounds().SurfaceArea();
+}
+
+void BVHAggregate::initSoAPrimitives() {
+    // Store triangle and bilinear patch vertices for _primitives_ in SoA
+    // form; NaN-valued padding at the end allows the last leaf to be tested
+    // a full _SoALanes_ primitives at a time
+    size_t nPrimitives = primitives.size();
+    bool first = primitiveSoAKind.empty();
+    size_t stride = nPrimitives + SoALanes;
+    if (soaTriangles) {
+        triangleVerticesStride = stride;
+        triangleVertices.assign(9 * stride, std::numeric_limits<Float>::quiet_NaN());
+    }
+    if (soaPatches) {
+        patchVerticesStride = stride;
+        patchVertices.assign(12 * stride, std::numeric_limits<Float>::quiet_NaN());
+    }
+    primitiveSoAKind.assign(nPrimitives, NonSoA);
+    ParallelFor(0, nPrimitives, [&](int64_t i) {
+        ShapeHandle shape;
+        bool opaque = false;
+        if (const SimplePrimitive *prim =
+                primitives[i].CastOrNullptr<SimplePrimitive>()) {
+            shape = prim->GetShape();
+            MaterialHandle material = prim->GetMaterial();
+            opaque = !material || !material.IsTransparent();
+        } else if (const Triangle *tri = primitives[i].CastOrNullptr<Triangle>()) {
+            shape = tri;
+            MaterialHandle material = MeshMaterials::Get(tri->MeshIndex());
+            opaque = !material || !material.IsTransparent();
+        } else if (const GeometricPrimitive *prim =
+                       primitives[i].CastOrNullptr<GeometricPrimitive>())
+            shape = prim->GetShape();
+        if (!shape)
+            return;
+
+        if (soaTriangles && shape.Is<Triangle>()) {
+            pstd::array<Point3f, 3> p = shape.Cast<Triangle>()->Vertices();
+            if (LengthSquared(Cross(p[2] - p[0], p[1] - p[0])) == 0) {
+                // IntersectTriangle() never reports hits with degenerate triangles
+                primitiveSoAKind[i] = DegenerateTriangle;
+                return;
+            }
+            primitiveSoAKind[i] = opaque ? OpaqueTriangle : TestedTriangle;
+            for (int v = 0; v < 3; ++v)
+                for (int c = 0; c < 3; ++c)
+                    triangleVertices[(3 * v + c) * stride + i] = p[v][c];
+        } else if (soaPatches && shape.Is<BilinearPatch>()) {
+            pstd::array<Point3f, 4> p = shape.Cast<BilinearPatch>()->Vertices();
+            primitiveSoAKind[i] = opaque ? OpaquePatch : TestedPatch;
+            for (int v = 0; v < 4; ++v)
+                for (int c = 0; c < 3; ++c)
+                    patchVertices[(3 * v + c) * stride + i] = p[v][c];
+        }
+    });
+    if (first)
+        soaPrimitiveBytes +=
+            (triangleVertices.size() + patchVertices.size()) * sizeof(Float) +
+            nPrimitives;
+}
+
+// Returns the intersection for the SoA hit in _lane_ with _prim_, an opaque
+// triangle or bilinear patch, with the material that the primitive's
+// Intersect() method would set
+static ShapeIntersection SoAIntersection(PrimitiveHandle prim, uint8_t kind,
+                                         const SoAHits &hits, int lane, const Ray &ray) {
+    ShapeHandle shape;
+    MaterialHandle material;
+    if (const Triangle *tri = prim.CastOrNullptr<Triangle>()) {
+        shape = tri;
+        material = MeshMaterials::Get(tri->MeshIndex());
+    } else {
+        const SimplePrimitive *simplePrim = prim.Cast<SimplePrimitive>();
+        shape = simplePrim->GetShape();
+        material = simplePrim->GetMaterial();
+    }
+    ShapeIntersection si =
+        (kind == OpaqueTriangle)
+            ? shape.Cast<Triangle>()->IntersectionFromHit(hits.triangles[lane], ray)
+            : shape.Cast<BilinearPatch>()->IntersectionFromHit(hits.patches[lane], ray);
+    si.intr.SetIntersectionProperties(material, nullptr, nullptr, ray.medium);
+    return si;
+}
+
+int BVHAggregate::soaHitMask(const Ray &ray, LazyTriangleRay *triRay,
+                             int start, int end, Float tMax, SoAHits *hits) const {
+    // Only the lanes up to _end_ hold the leaf's primitives; the rest belong
+    // to the following nodes or are padding
+    int laneMask = (1 << std::min(end - start, SoALanes)) - 1;
+    // Each primitive's vertices are NaN in the arrays for the other kind of
+    // shape, so that it can only be hit by the test for its own
+    int hitMask = 0;
+    if (!triangleVertices.empty()) {
+        hitMask |= IntersectTriangles(triangleVertices.data(), triangleVerticesStride,
+                                      start, triRay->Get(), tMax, hits->triangles);
+    }
+    if (!patchVertices.empty())
+        hitMask |= IntersectBilinearPatches(patchVertices.data(), patchVerticesStride,
+                                            start, laneMask, ray, tMax, hits->patches);
+    return hitMask & laneMask;
+}
+
+pstd::optional<ShapeIntersection> BVHAggregate::intersectLeaf(
+    const Ray &ray, LazyTriangleRay *triRay, int offset, int nPrimitives,
+    Float *tMax) const {
+    pstd::optional<ShapeIntersection> si;
+    bvhPrimitivesTested += nPrimitives;
+    int end = offset + nPrimitives;
+    for (int start = offset; start < end; start += SoALanes) {
+        // Test triangles and bilinear patches in SoA form, if available,
+        // before their primitives
+        int hitMask = ~0;
+        SoAHits hits;
+        if (!primitiveSoAKind.empty())
+            hitMask = soaHitMask(ray, triRay, start, end, *tMax, &hits);
+        for (int i = start; i < std::min(end, start + SoALanes); ++i) {
+            // Only primitives that were hit are intersected to compute the
+            // full intersection, as are those that aren't stored in SoA form
+            uint8_t kind = primitiveSoAKind.empty() ? NonSoA : primitiveSoAKind[i];
+            if (kind != NonSoA && !(hitMask & (1 << (i - start))))
+                continue;
+            if (IsOpaqueSoAKind(kind)) {
+                // Use the SoA hit, unless a closer hit was found after it
+                int lane = i - start;
+                if ((kind == OpaqueTriangle && hits.triangles[lane].t > *tMax) ||
+                    (kind == OpaquePatch && hits.patches[lane].t >= *tMax))
+                    continue;
+                si = SoAIntersection(primitives[i], kind, hits, lane, ray);
+                *tMax = si->tHit;
+                continue;
+            }
+            pstd::optional<ShapeIntersection> primSi =
+                primitives[i].Intersect(ray, *tMax);
+            if (primSi) {
+                si = primSi;
+                *tMax = si->tHit;
+            }
+        }
+    }
+    return si;
+}
+
+bool BVHAggregate::intersectPLeaf(const Ray &ray, LazyTriangleRay *triRay,
+                                  int offset, int nPrimitives, Float tMax,
+                                  int *occluder) const {
+    bvhPrimitivesTested += nPrimitives;
+    int end = offset + nPrimitives;
+    for (int start = offset; start < end; start += SoALanes) {
+        int hitMask = ~0;
+        SoAHits hits;
+        if (!primitiveSoAKind.empty())
+            hitMask = soaHitMask(ray, triRay, start, end, tMax, &hits);
+        for (int i = start; i < std::min(end, start + SoALanes); ++i) {
+            uint8_t kind = primitiveSoAKind.empty() ? NonSoA : primitiveSoAKind[i];
+            if (kind != NonSoA && !(hitMask & (1 << (i - start))))
+                continue;
+            if (IsOpaqueSoAKind(kind) || primitives[i].IntersectP(ray, tMax)) {
+                if (occluder)
+                    *occluder = i;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
                                                           Float tMax) const {
+    if (wideNodes)
+        return wideNodes.DispatchCPU(
+            [&](auto ptr) { return intersectWide(ptr, ray, tMax); });
     if (nodes == nullptr)
         return {};
     pstd::optional<ShapeIntersection> si;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    LazyTriangleRay triRay(ray);
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
@@ -550,15 +2134,10 @@ pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
         if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    // Check for intersection with primitive in BVH node
-                    pstd::optional<ShapeIntersection> primSi =
-                        primitives[node->primitivesOffset + i].Intersect(ray, tMax);
-                    if (primSi) {
-                        si = primSi;
-                        tMax = si->tHit;
-                    }
-                }
+                pstd::optional<ShapeIntersection> primSi = intersectLeaf(
+                    ray, &triRay, node->primitivesOffset, node->nPrimitives, &tMax);
+                if (primSi)
+                    si = primSi;
                 if (toVisitOffset == 0)
                     break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
@@ -574,58 +2153,498 @@ pstd::optional<ShapeIntersection> BVHAggregate::Intersect(const Ray &ray,
                 }
             }
         } else {
-            if (toVisitOffset == 0)
-                break;
-            currentNodeIndex = nodesToVisit[--toVisitOffset];
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+
+    bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
+    return si;
+}
+
+bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    if (wideNodes)
+        return wideNodes.DispatchCPU(
+            [&](auto ptr) { return intersectPWide(ptr, ray, tMax); });
+    if (nodes == nullptr)
+        return false;
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
+                       static_cast<int>(invDir.z < 0)};
+    LazyTriangleRay triRay(ray);
+    int nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesVisited = 0;
+
+    while (true) {
+        ++nodesVisited;
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+            // Process BVH node _node_ for traversal
+            if (node->nPrimitives > 0) {
+                if (intersectPLeaf(ray, &triRay, node->primitivesOffset,
+                                   node->nPrimitives, tMax)) {
+                    bvhNodesVisited += nodesVisited;
+                    if (countTraversalSteps)
+                        threadWorkCounters.nodesVisited += nodesVisited;
+                    return true;
+                }
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis] != 0) {
+                    /// second child first
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
+    return false;
+}
+
+// ShadowOccluderCache Definition
+// Records the most recent occluder found by _BVHAggregate::IntersectShadowP()_
+struct ShadowOccluderCache {
+    const BVHAggregate *bvh = nullptr;
+    int primitive = 0;
+};
+
+static thread_local ShadowOccluderCache shadowOccluderCache;
+
+bool BVHAggregate::IntersectShadowP(const Ray &ray, Float tMax) const {
+    // Test the primitive that last occluded a shadow ray on this thread
+    ShadowOccluderCache &cache = shadowOccluderCache;
+    if (cache.bvh == this && cache.primitive < int(primitives.size())) {
+        ++shadowOccluderTests;
+        if (primitives[cache.primitive].IntersectP(ray, tMax)) {
+            ++shadowOccluderHits;
+            return true;
+        }
+    }
+
+    int occluder = -1;
+    bool occluded;
+    if (wideNodes)
+        occluded = wideNodes.DispatchCPU(
+            [&](auto ptr) { return intersectShadowPWide(ptr, ray, tMax, &occluder); });
+    else if (nodes == nullptr)
+        occluded = false;
+    else {
+        Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+        int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+        LazyTriangleRay triRay(ray);
+        int nodesToVisit[64];
+        int toVisitOffset = 0, currentNodeIndex = 0;
+        int nodesVisited = 0;
+        occluded = false;
+        while (true) {
+            ++nodesVisited;
+            const LinearBVHNode *node = &nodes[currentNodeIndex];
+            if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+                if (node->nPrimitives > 0) {
+                    if (intersectPLeaf(ray, &triRay, node->primitivesOffset,
+                                       node->nPrimitives, tMax, &occluder)) {
+                        occluded = true;
+                        break;
+                    }
+                    if (toVisitOffset == 0)
+                        break;
+                    currentNodeIndex = nodesToVisit[--toVisitOffset];
+                } else {
+                    // Visit the child with the larger surface area first
+                    int first = currentNodeIndex + 1, second = node->secondChildOffset;
+                    if (nodes[second].bounds.SurfaceArea() >
+                        nodes[first].bounds.SurfaceArea())
+                        pstd::swap(first, second);
+                    nodesToVisit[toVisitOffset++] = second;
+                    currentNodeIndex = first;
+                }
+            } else {
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            }
+        }
+        bvhNodesVisited += nodesVisited;
+        if (countTraversalSteps)
+            threadWorkCounters.nodesVisited += nodesVisited;
+    }
+
+    if (occluded)
+        cache = ShadowOccluderCache{this, occluder};
+    return occluded;
+}
+
+// BVHPacketNodeToVisit Definition
+struct BVHPacketNodeToVisit {
+    int nodeIndex;
+    uint32_t rayMask;
+};
+
+void BVHAggregate::IntersectPacket(const Ray *rays, const Float *tMax,
+                                   uint32_t activeMask,
+                                   pstd::optional<ShapeIntersection> *si) const {
+    DCHECK_EQ(activeMask >> PacketSize, 0u);
+    for (int i = 0; i < PacketSize; ++i)
+        if (activeMask & (1u << i))
+            si[i].reset();
+    if (activeMask == 0)
+        return;
+    if (nodes == nullptr) {
+        // Trace rays individually for wide BVHs
+        for (int i = 0; i < PacketSize; ++i)
+            if (activeMask & (1u << i))
+                si[i] = Intersect(rays[i], tMax[i]);
+        return;
+    }
+
+    // Initialize per-ray traversal state for packet
+    Float rayTMax[PacketSize];
+    Vector3f invDir[PacketSize];
+    int dirIsNeg[PacketSize][3];
+    int firstActive = -1;
+    for (int i = 0; i < PacketSize; ++i) {
+        if (!(activeMask & (1u << i)))
+            continue;
+        if (firstActive == -1)
+            firstActive = i;
+        rayTMax[i] = tMax[i];
+        invDir[i] = Vector3f(1 / rays[i].d.x, 1 / rays[i].d.y, 1 / rays[i].d.z);
+        for (int c = 0; c < 3; ++c)
+            dirIsNeg[i][c] = int(invDir[i][c] < 0);
+    }
+
+    // Follow packet through BVH nodes, tracking the rays that reach each node
+    BVHPacketNodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    uint32_t currentMask = activeMask;
+    int nodesVisited = 0;
+    while (true) {
+        ++nodesVisited;
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        // Find the rays in _currentMask_ that intersect the node's bounds
+        uint32_t hitMask = 0;
+        for (int i = 0; i < PacketSize; ++i)
+            if ((currentMask & (1u << i)) &&
+                node->bounds.IntersectP(rays[i].o, rays[i].d, rayTMax[i], invDir[i],
+                                        dirIsNeg[i]))
+                hitMask |= 1u << i;
+
+        if (hitMask != 0 && node->nPrimitives == 0) {
+            // Visit children in the order given by the first active ray's direction
+            if (dirIsNeg[firstActive][node->axis]) {
+                nodesToVisit[toVisitOffset++] = {currentNodeIndex + 1, hitMask};
+                currentNodeIndex = node->secondChildOffset;
+            } else {
+                nodesToVisit[toVisitOffset++] = {node->secondChildOffset, hitMask};
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+            currentMask = hitMask;
+            continue;
+        }
+
+        if (hitMask != 0) {
+            // Intersect rays that reached leaf with its primitives
+            for (int i = 0; i < PacketSize; ++i) {
+                if (!(hitMask & (1u << i)))
+                    continue;
+                bvhPrimitivesTested += node->nPrimitives;
+                for (int j = 0; j < node->nPrimitives; ++j) {
+                    pstd::optional<ShapeIntersection> primSi =
+                        primitives[node->primitivesOffset + j].Intersect(rays[i],
+                                                                         rayTMax[i]);
+                    if (primSi) {
+                        si[i] = primSi;
+                        rayTMax[i] = si[i]->tHit;
+                    }
+                }
+            }
+        }
+        if (toVisitOffset == 0)
+            break;
+        --toVisitOffset;
+        currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+        currentMask = nodesToVisit[toVisitOffset].rayMask;
+    }
+
+    bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
+}
+
+uint32_t BVHAggregate::IntersectPPacket(const Ray *rays, const Float *tMax,
+                                        uint32_t activeMask) const {
+    DCHECK_EQ(activeMask >> PacketSize, 0u);
+    if (activeMask == 0)
+        return 0;
+    uint32_t occludedMask = 0;
+    if (nodes == nullptr) {
+        // Trace rays individually for wide BVHs
+        for (int i = 0; i < PacketSize; ++i)
+            if ((activeMask & (1u << i)) && IntersectP(rays[i], tMax[i]))
+                occludedMask |= 1u << i;
+        return occludedMask;
+    }
+
+    // Initialize per-ray traversal state for packet
+    Vector3f invDir[PacketSize];
+    int dirIsNeg[PacketSize][3];
+    int firstActive = -1;
+    for (int i = 0; i < PacketSize; ++i) {
+        if (!(activeMask & (1u << i)))
+            continue;
+        if (firstActive == -1)
+            firstActive = i;
+        invDir[i] = Vector3f(1 / rays[i].d.x, 1 / rays[i].d.y, 1 / rays[i].d.z);
+        for (int c = 0; c < 3; ++c)
+            dirIsNeg[i][c] = int(invDir[i][c] < 0);
+    }
+
+    BVHPacketNodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    uint32_t currentMask = activeMask;
+    int nodesVisited = 0;
+    while (true) {
+        ++nodesVisited;
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        uint32_t hitMask = 0;
+        for (int i = 0; i < PacketSize; ++i)
+            if ((currentMask & (1u << i)) &&
+                node->bounds.IntersectP(rays[i].o, rays[i].d, tMax[i], invDir[i],
+                                        dirIsNeg[i]))
+                hitMask |= 1u << i;
+
+        if (hitMask != 0 && node->nPrimitives == 0) {
+            if (dirIsNeg[firstActive][node->axis]) {
+                nodesToVisit[toVisitOffset++] = {currentNodeIndex + 1, hitMask};
+                currentNodeIndex = node->secondChildOffset;
+            } else {
+                nodesToVisit[toVisitOffset++] = {node->secondChildOffset, hitMask};
+                currentNodeIndex = currentNodeIndex + 1;
+            }
+            currentMask = hitMask;
+            continue;
+        }
+
+        if (hitMask != 0) {
+            // Test rays that reached leaf for occlusion by its primitives
+            for (int i = 0; i < PacketSize; ++i) {
+                if (!(hitMask & (1u << i)))
+                    continue;
+                bvhPrimitivesTested += node->nPrimitives;
+                for (int j = 0; j < node->nPrimitives; ++j)
+                    if (primitives[node->primitivesOffset + j].IntersectP(rays[i],
+                                                                          tMax[i])) {
+                        occludedMask |= 1u << i;
+                        break;
+                    }
+            }
+            // Stop once all rays in packet are known to be occluded
+            if (occludedMask == activeMask)
+                break;
+        }
+
+        // Pop next node that still has unoccluded rays to visit
+        bool found = false;
+        while (toVisitOffset > 0 && !found) {
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+            currentMask = nodesToVisit[toVisitOffset].rayMask & ~occludedMask;
+            found = currentMask != 0;
+        }
+        if (!found)
+            break;
+    }
+
+    bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
+    return occludedMask;
+}
+
+void BVHAggregate::IntersectN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                              pstd::span<pstd::optional<ShapeIntersection>> si) const {
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), si.size());
+    for (size_t start = 0; start < rays.size(); start += PacketSize) {
+        int n = std::min<size_t>(PacketSize, rays.size() - start);
+        uint32_t activeMask = (1u << n) - 1;
+        IntersectPacket(&rays[start], &tMax[start], activeMask, &si[start]);
+    }
+}
+
+void BVHAggregate::IntersectPN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                               pstd::span<bool> occluded) const {
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), occluded.size());
+    for (size_t start = 0; start < rays.size(); start += PacketSize) {
+        int n = std::min<size_t>(PacketSize, rays.size() - start);
+        uint32_t activeMask = (1u << n) - 1;
+        uint32_t occludedMask = IntersectPPacket(&rays[start], &tMax[start], activeMask);
+        for (int i = 0; i < n; ++i)
+            occluded[start + i] = occludedMask & (1u << i);
+    }
+}
+
+template <typename Node>
+pstd::optional<ShapeIntersection> BVHAggregate::intersectWide(const Node *wideNodes,
+                                                              const Ray &ray,
+                                                              Float tMax) const {
+    constexpr int N = Node::Width;
+    pstd::optional<ShapeIntersection> si;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    LazyTriangleRay triRay(ray);
+    // Follow ray through wide BVH nodes to find primitive intersections
+    WideBVHNodeToVisit nodesToVisit[64 * N];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = WideBVHNodeToVisit{0, 0, 0};
+    int nodesVisited = 0;
+    while (toVisitOffset > 0) {
+        WideBVHNodeToVisit toVisit = nodesToVisit[--toVisitOffset];
+        // Skip nodes that are farther away than the closest intersection found
+        if (toVisit.tMin > tMax)
+            continue;
+
+        if (toVisit.nPrimitives > 0) {
+            // Intersect ray with primitives in leaf
+            pstd::optional<ShapeIntersection> primSi =
+                intersectLeaf(ray, &triRay, toVisit.offset, toVisit.nPrimitives, &tMax);
+            if (primSi)
+                si = primSi;
+        } else {
+            // Check ray against children of wide BVH node
+            ++nodesVisited;
+            const Node &node = wideNodes[toVisit.offset];
+            Float tMin[N];
+            int hitMask = node.Intersect(ray.o, invDir, dirIsNeg, tMax, tMin);
+
+            // Push intersected children in order of decreasing _tMin_ so that the
+            // nearest one is visited next
+            int firstPushed = toVisitOffset;
+            for (int i = 0; i < N; ++i) {
+                if (!(hitMask & (1 << i)))
+                    continue;
+                WideBVHNodeToVisit child{node.childOffset[i], node.nPrimitives[i],
+                                         tMin[i]};
+                int j = toVisitOffset++;
+                for (; j > firstPushed && nodesToVisit[j - 1].tMin < child.tMin; --j)
+                    nodesToVisit[j] = nodesToVisit[j - 1];
+                nodesToVisit[j] = child;
+            }
         }
     }
 
     bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
     return si;
 }
 
-bool BVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
-    if (nodes == nullptr)
-        return false;
+template <typename Node>
+bool BVHAggregate::intersectPWide(const Node *wideNodes, const Ray &ray,
+                                  Float tMax) const {
+    constexpr int N = Node::Width;
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {static_cast<int>(invDir.x < 0), static_cast<int>(invDir.y < 0),
                        static_cast<int>(invDir.z < 0)};
-    int nodesToVisit[64];
-    int toVisitOffset = 0, currentNodeIndex = 0;
+    LazyTriangleRay triRay(ray);
+    int nodesToVisit[64 * N];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
     int nodesVisited = 0;
 
-    while (true) {
+    while (toVisitOffset > 0) {
         ++nodesVisited;
-        const LinearBVHNode *node = &nodes[currentNodeIndex];
-        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
-            // Process BVH node _node_ for traversal
-            if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i].IntersectP(ray, tMax)) {
-                        bvhNodesVisited += nodesVisited;
-                        return true;
-                    }
-                }
-                if (toVisitOffset == 0)
-                    break;
-                currentNodeIndex = nodesToVisit[--toVisitOffset];
-            } else {
-                if (dirIsNeg[node->axis] != 0) {
-                    /// second child first
-                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
-                    currentNodeIndex = node->secondChildOffset;
-                } else {
-                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
-                    currentNodeIndex = currentNodeIndex + 1;
+        const Node &node = wideNodes[nodesToVisit[--toVisitOffset]];
+        Float tMin[N];
+        int hitMask = node.Intersect(ray.o, invDir, dirIsNeg, tMax, tMin);
+        // Test primitives in intersected leaves and enqueue interior children
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i)))
+                continue;
+            if (node.nPrimitives[i] == 0) {
+                nodesToVisit[toVisitOffset++] = node.childOffset[i];
+                continue;
+            }
+            if (intersectPLeaf(ray, &triRay, node.childOffset[i], node.nPrimitives[i],
+                               tMax)) {
+                bvhNodesVisited += nodesVisited;
+                if (countTraversalSteps)
+                    threadWorkCounters.nodesVisited += nodesVisited;
+                return true;
+            }
+        }
+    }
+    bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
+    return false;
+}
+
+template <typename Node>
+bool BVHAggregate::intersectShadowPWide(const Node *wideNodes, const Ray &ray,
+                                        Float tMax, int *occluder) const {
+    constexpr int N = Node::Width;
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    LazyTriangleRay triRay(ray);
+    int nodesToVisit[64 * N];
+    int toVisitOffset = 0;
+    nodesToVisit[toVisitOffset++] = 0;
+    int nodesVisited = 0;
+
+    while (toVisitOffset > 0) {
+        ++nodesVisited;
+        const Node &node = wideNodes[nodesToVisit[--toVisitOffset]];
+        Float tMin[N];
+        int hitMask = node.Intersect(ray.o, invDir, dirIsNeg, tMax, tMin);
+        // Test primitives in intersected leaves and enqueue interior children
+        // in order of increasing surface area so that the largest is visited
+        // next
+        int firstPushed = toVisitOffset;
+        Float pushedArea[N];
+        for (int i = 0; i < N; ++i) {
+            if (!(hitMask & (1 << i)))
+                continue;
+            if (node.nPrimitives[i] == 0) {
+                Float area = node.ChildBounds(i).SurfaceArea();
+                int j = toVisitOffset++;
+                for (; j > firstPushed && pushedArea[j - 1 - firstPushed] > area; --j) {
+                    nodesToVisit[j] = nodesToVisit[j - 1];
+                    pushedArea[j - firstPushed] = pushedArea[j - 1 - firstPushed];
                 }
+                nodesToVisit[j] = node.childOffset[i];
+                pushedArea[j - firstPushed] = area;
+                continue;
+            }
+            if (intersectPLeaf(ray, &triRay, node.childOffset[i], node.nPrimitives[i],
+                               tMax, occluder)) {
+                bvhNodesVisited += nodesVisited;
+                if (countTraversalSteps)
+                    threadWorkCounters.nodesVisited += nodesVisited;
+                return true;
             }
-        } else {
-            if (toVisitOffset == 0)
-                break;
-            currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
     bvhNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
     return false;
 }
 
@@ -740,13 +2759,298 @@ BVHAggregate *BVHAggregate::Create(std::vector<PrimitiveHandle> prims,
         splitMethod = BVHAggregate::SplitMethod::Middle;
     else if (splitMethodName == "equal")
         splitMethod = BVHAggregate::SplitMethod::EqualCounts;
+    else if (splitMethodName == "sbvh")
+        splitMethod = BVHAggregate::SplitMethod::SBVH;
     else {
         Warning(R"(BVH split method "%s" unknown.  Using "sah".)", splitMethodName);
         splitMethod = BVHAggregate::SplitMethod::SAH;
     }
 
     int maxPrimsInNode = parameters.GetOneInt("maxnodeprims", 4);
-    return new BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod);
+    int width = parameters.GetOneInt("width", 2);
+    if (width != 2 && width != 4 && width != 8) {
+        Warning("BVH width %d unsupported; must be 2, 4, or 8.  Using 2.", width);
+        width = 2;
+    }
+    bool quantize = parameters.GetOneBool("quantize", false);
+    Float splitBudget = parameters.GetOneFloat("splitbudget", 0.5f);
+    if (splitBudget < 0) {
+        Warning("BVH split budget %f must be non-negative.  Using 0.", splitBudget);
+        splitBudget = 0;
+    }
+    bool soaTriangles = parameters.GetOneBool("soatriangles", false);
+    bool soaPatches = parameters.GetOneBool("soabilinearpatches", false);
+    return new BVHAggregate(std::move(prims), maxPrimsInNode, splitMethod, width,
+                            quantize, splitBudget, soaTriangles, soaPatches);
+}
+
+// InstanceBVHAggregate Local Definitions
+STAT_MEMORY_COUNTER("Memory/Instance BVH", instanceBVHBytes);
+STAT_COUNTER("Geometry/Instances", nInstances);
+STAT_COUNTER("Geometry/Instance prototypes", nInstancePrototypes);
+
+// Builds a binary BVH over instance bounds. The SAH weights each instance by
+// the estimated cost of intersecting its prototype, so that instances of
+// complex prototypes are separated more aggressively than simple ones.
+static BVHBuildNode *BuildInstanceBVH(std::vector<Allocator> &threadAllocators,
+                                      std::vector<BVHPrimitive> &bvhInstances,
+                                      const std::vector<Float> &instanceCost, int start,
+                                      int end, std::atomic<int> *totalNodes) {
+    Allocator alloc = threadAllocators[ThreadIndex];
+    BVHBuildNode *node = alloc.new_object<BVHBuildNode>();
+    ++*totalNodes;
+    Bounds3f bounds, centroidBounds;
+    ComputeBounds(bvhInstances, start, end, &bounds, &centroidBounds);
+    int dim = centroidBounds.MaxDimension();
+    // Instances with coincident centroids are put in small leaves
+    constexpr int maxCoincidentInstances = 16;
+    bool coincident = centroidBounds.pMax[dim] == centroidBounds.pMin[dim];
+    if (end - start == 1 || (coincident && end - start <= maxCoincidentInstances)) {
+        node->InitLeaf(start, end - start, bounds);
+        return node;
+    }
+
+    int mid = (start + end) / 2;
+    if (!coincident) {
+        // Compute cost-weighted SAH buckets along _dim_
+        constexpr int nBuckets = 12;
+        BVHSplitBucket buckets[nBuckets];
+        Float bucketCost[nBuckets] = {};
+        auto bucketIndex = [=](const BVHPrimitive &bp) {
+            int b = nBuckets * centroidBounds.Offset(bp.centroid)[dim];
+            return b == nBuckets ? nBuckets - 1 : b;
+        };
+        for (int i = start; i < end; ++i) {
+            int b = bucketIndex(bvhInstances[i]);
+            buckets[b].bounds = Union(buckets[b].bounds, bvhInstances[i].bounds);
+            bucketCost[b] += instanceCost[bvhInstances[i].primitiveIndex];
+        }
+
+        // Find bucket to split at that minimizes weighted SAH metric
+        Bounds3f boundsAbove[nBuckets];
+        Float costAbove[nBuckets];
+        boundsAbove[nBuckets - 1] = buckets[nBuckets - 1].bounds;
+        costAbove[nBuckets - 1] = bucketCost[nBuckets - 1];
+        for (int i = nBuckets - 2; i >= 0; --i) {
+            boundsAbove[i] = Union(boundsAbove[i + 1], buckets[i].bounds);
+            costAbove[i] = costAbove[i + 1] + bucketCost[i];
+        }
+        int minCostSplitBucket = -1;
+        Float minCost = Infinity, costBelow = 0;
+        Bounds3f boundsBelow;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            boundsBelow = Union(boundsBelow, buckets[i].bounds);
+            costBelow += bucketCost[i];
+            if (costBelow == 0 || costAbove[i + 1] == 0)
+                continue;
+            Float cost = costBelow * boundsBelow.SurfaceArea() +
+                         costAbove[i + 1] * boundsAbove[i + 1].SurfaceArea();
+            if (cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+            }
+        }
+        // The first and last buckets are never empty, so there is always a split
+        CHECK_NE(minCostSplitBucket, -1);
+        mid = PartitionPrimitives(bvhInstances, start, end,
+                                  [=](const BVHPrimitive &bp) {
+                                      return bucketIndex(bp) <= minCostSplitBucket;
+                                  });
+    }
+
+    // Recursively build instance BVHs for children
+    BVHBuildNode *children[2];
+    auto buildChild = [&](int i) {
+        children[i] = BuildInstanceBVH(threadAllocators, bvhInstances, instanceCost,
+                                       i == 0 ? start : mid, i == 0 ? mid : end,
+                                       totalNodes);
+    };
+    if (end - start > parallelSubtreeThreshold)
+        ParallelFor(0, 2, [&](int64_t i) { buildChild(i); });
+    else {
+        buildChild(0);
+        buildChild(1);
+    }
+    node->InitInterior(dim, children[0], children[1]);
+    return node;
+}
+
+// InstanceBVHAggregate Method Definitions
+InstanceBVHAggregate::InstanceBVHAggregate(
+    std::vector<PrimitiveHandle> p, const std::vector<int> &instProtos,
+    const std::vector<const Transform *> &renderFromInst)
+    : prototypes(std::move(p)) {
+    CHECK_EQ(instProtos.size(), renderFromInst.size());
+    CHECK(!instProtos.empty());
+    // Estimate intersection cost of each prototype from its primitive count
+    std::vector<Float> prototypeCost(prototypes.size());
+    for (size_t i = 0; i < prototypes.size(); ++i) {
+        prototypeBounds.push_back(prototypes[i].Bounds());
+        size_t nPrimitives = 1;
+        if (prototypes[i].Is<BVHAggregate>())
+            nPrimitives = prototypes[i].Cast<BVHAggregate>()->NumPrimitives();
+        prototypeCost[i] = 1 + std::log2(Float(nPrimitives));
+    }
+
+    // Initialize _bvhInstances_ with render-space instance bounds
+    size_t n = instProtos.size();
+    std::vector<BVHPrimitive> bvhInstances(n);
+    std::vector<Float> instanceCost(n);
+    ParallelFor(0, n, [&](int64_t i) {
+        bvhInstances[i] =
+            BVHPrimitive(i, (*renderFromInst[i])(prototypeBounds[instProtos[i]]));
+        instanceCost[i] = prototypeCost[instProtos[i]];
+    });
+
+    // Build instance BVH
+    pstd::pmr::monotonic_buffer_resource resource;
+    std::vector<pstd::pmr::monotonic_buffer_resource> threadResources(MaxThreadIndex());
+    std::vector<Allocator> threadAllocators;
+    for (auto &threadResource : threadResources)
+        threadAllocators.push_back(Allocator(&threadResource));
+    std::atomic<int> totalNodes{0};
+    BVHBuildNode *root =
+        BuildInstanceBVH(threadAllocators, bvhInstances, instanceCost, 0, n, &totalNodes);
+    bounds = root->bounds;
+    nodes = Allocator().allocate_object<LinearBVHNode>(totalNodes);
+    for (int i = 0; i < totalNodes; ++i)
+        new (&nodes[i]) LinearBVHNode;
+    int offset = 0;
+    FlattenBVHTree(root, nodes, &offset);
+    CHECK_EQ(totalNodes.load(), offset);
+
+    // Store per-instance data in leaf order
+    instancePrototypes.resize(n);
+    renderFromInstance.resize(n);
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 4; ++c)
+            instanceFromRender[r][c].resize(n);
+    ParallelFor(0, n, [&](int64_t i) {
+        size_t index = bvhInstances[i].primitiveIndex;
+        instancePrototypes[i] = instProtos[index];
+        renderFromInstance[i] = renderFromInst[index];
+        const SquareMatrix<4> &m = renderFromInst[index]->GetInverseMatrix();
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 4; ++c)
+                instanceFromRender[r][c][i] = m[r][c];
+    });
+
+    // Prototypes' own memory is reported by their aggregates, once each
+    instanceBVHBytes += sizeof(*this) + totalNodes * sizeof(LinearBVHNode) +
+                        n * (sizeof(int) + sizeof(Transform *) + 12 * sizeof(Float)) +
+                        prototypes.size() * (sizeof(PrimitiveHandle) + sizeof(Bounds3f));
+    nInstances += n;
+    nInstancePrototypes += prototypes.size();
+}
+
+Ray InstanceBVHAggregate::instanceRay(int instance, const Ray &r, Float *tMax) const {
+    // Transform ray with instance's _instanceFromRender_ transformation
+    AffineTransform instanceFromRenderTransform;
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 4; ++j)
+            instanceFromRenderTransform.m[i][j] = instanceFromRender[i][j][instance];
+    return instanceFromRenderTransform(r, tMax);
+}
+
+pstd::optional<ShapeIntersection> InstanceBVHAggregate::Intersect(const Ray &ray,
+                                                                  Float tMax) const {
+    pstd::optional<ShapeIntersection> si;
+    int hitInstance = -1;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    // Follow ray through instance BVH nodes to find instance intersections
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    // Intersect instance-space ray with instance's prototype,
+                    // culling it if the ray misses the prototype's bounds
+                    int instance = node->primitivesOffset + i;
+                    int prototype = instancePrototypes[instance];
+                    Float instTMax = tMax;
+                    Ray instRay = instanceRay(instance, ray, &instTMax);
+                    if (!prototypeBounds[prototype].IntersectP(instRay.o, instRay.d,
+                                                               instTMax))
+                        continue;
+                    pstd::optional<ShapeIntersection> instSi =
+                        prototypes[prototype].Intersect(instRay, instTMax);
+                    if (instSi) {
+                        si = instSi;
+                        tMax = si->tHit;
+                        hitInstance = instance;
+                    }
+                }
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+
+            } else {
+                // Put far node on _nodesToVisit_ stack, advance to near node
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+
+    // Transform closest intersection to render space, only once
+    if (si) {
+        si->intr = (*renderFromInstance[hitInstance])(si->intr);
+        CHECK_GE(Dot(si->intr.n, si->intr.shading.n), 0);
+    }
+    return si;
+}
+
+bool InstanceBVHAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {int(invDir.x < 0), int(invDir.y < 0), int(invDir.z < 0)};
+    int nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        if (node->bounds.IntersectP(ray.o, ray.d, tMax, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                for (int i = 0; i < node->nPrimitives; ++i) {
+                    int instance = node->primitivesOffset + i;
+                    int prototype = instancePrototypes[instance];
+                    Float instTMax = tMax;
+                    Ray instRay = instanceRay(instance, ray, &instTMax);
+                    if (prototypeBounds[prototype].IntersectP(instRay.o, instRay.d,
+                                                              instTMax) &&
+                        prototypes[prototype].IntersectP(instRay, instTMax))
+                        return true;
+                }
+                if (toVisitOffset == 0)
+                    break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+
+            } else {
+                if (dirIsNeg[node->axis] != 0) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0)
+                break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
 }
 
 // KdNodeToVisit Definition
@@ -772,6 +3076,14 @@ struct alignas(8) KdTreeNode {
     bool IsLeaf() const { return (flags & 3) == 3; }
     int AboveChild() const { return aboveChild >> 2; }
 
+    // Offsets references of a subtree built separately for splicing
+    void Relocate(int nodeOffset, int primitiveIndexOffset) {
+        if (!IsLeaf())
+            aboveChild += nodeOffset << 2;
+        else if (nPrimitives() > 1)
+            primitiveIndicesOffset += primitiveIndexOffset;
+    }
+
     union {
         Float split;                 // Interior
         int onePrimitive;            // Leaf
@@ -803,7 +3115,37 @@ struct BoundEdge {
     EdgeType type;
 };
 
+// KdTreeBuildState Definition
+// Working state for building a kd-tree subtree: primitive edges sorted along
+// all three axes, the primitive index that each edge's _primNum_ refers to,
+// and scratch space for classifying primitives and initializing leaves.
+struct KdTreeBuildState {
+    std::vector<BoundEdge> edges[3];
+    std::vector<int> primNums;
+    std::vector<uint8_t> side;
+    std::vector<int> leafPrimNums;
+};
+
 STAT_PIXEL_COUNTER("Kd-Tree/Nodes visited", kdNodesVisited);
+STAT_PIXEL_COUNTER("Kd-Tree/Primitives tested", kdPrimitivesTested);
+STAT_MEMORY_COUNTER("Memory/Kd-tree", kdTreeBytes);
+STAT_COUNTER("Kd-Tree/Interior nodes", kdInteriorNodes);
+STAT_COUNTER("Kd-Tree/Leaf nodes", kdLeafNodes);
+STAT_RATIO("Kd-Tree/Primitives per leaf node", kdLeafPrimitives, kdLeafNodesRatio);
+
+// KdTreeAggregate Utility Functions
+static void AppendKdSubtree(std::vector<KdTreeNode> *nodes,
+                            std::vector<int> *primitiveIndices,
+                            const std::vector<KdTreeNode> &subtreeNodes,
+                            const std::vector<int> &subtreeIndices) {
+    int nodeOffset = nodes->size(), indexOffset = primitiveIndices->size();
+    for (KdTreeNode node : subtreeNodes) {
+        node.Relocate(nodeOffset, indexOffset);
+        nodes->push_back(node);
+    }
+    primitiveIndices->insert(primitiveIndices->end(), subtreeIndices.begin(),
+                             subtreeIndices.end());
+}
 
 // KdTreeAggregate Method Definitions
 KdTreeAggregate::KdTreeAggregate(std::vector<PrimitiveHandle> p, int isectCost,
@@ -815,35 +3157,48 @@ KdTreeAggregate::KdTreeAggregate(std::vector<PrimitiveHandle> p, int isectCost,
       emptyBonus(emptyBonus),
       primitives(std::move(p)) {
     // Build kd-tree for accelerator
-    nextFreeNode = nAllocedNodes = 0;
+    int nPrimitives = primitives.size();
     if (maxDepth <= 0)
-        maxDepth = std::round(8 + 1.3f * Log2Int(int64_t(primitives.size())));
+        maxDepth = std::round(8 + 1.3f * Log2Int(int64_t(nPrimitives)));
     // Compute bounds for kd-tree construction
     std::vector<Bounds3f> primBounds;
-    primBounds.reserve(primitives.size());
+    primBounds.reserve(nPrimitives);
     for (PrimitiveHandle &prim : primitives) {
         Bounds3f b = prim.Bounds();
         bounds = Union(bounds, b);
         primBounds.push_back(b);
     }
 
-    // Allocate working memory for kd-tree construction
-    std::unique_ptr<BoundEdge[]> edges[3];
-    for (int i = 0; i < 3; ++i)
-        edges[i] = std::make_unique<BoundEdge[]>(2 * primitives.size());
-
-    std::unique_ptr<int[]> prims0 = std::make_unique<int[]>(primitives.size());
-    std::unique_ptr<int[]> prims1 =
-        std::make_unique<int[]>((maxDepth + 1) * primitives.size());
-
-    // Initialize _primNums_ for kd-tree construction
-    std::unique_ptr<int[]> primNums = std::make_unique<int[]>(primitives.size());
-    for (size_t i = 0; i < primitives.size(); ++i)
-        primNums[i] = i;
+    // Sort primitive edges along all three axes once for the whole build
+    KdTreeBuildState state;
+    ParallelFor(0, 3, [&](int64_t axis) {
+        std::vector<BoundEdge> &edges = state.edges[axis];
+        edges.reserve(2 * nPrimitives);
+        for (int i = 0; i < nPrimitives; ++i) {
+            edges.push_back(BoundEdge(primBounds[i].pMin[axis], i, true));
+            edges.push_back(BoundEdge(primBounds[i].pMax[axis], i, false));
+        }
+        std::sort(edges.begin(), edges.end(),
+                  [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
+                      return std::tie(e0.t, e0.type) < std::tie(e1.t, e1.type);
+                  });
+    });
+    state.primNums.resize(nPrimitives);
+    std::iota(state.primNums.begin(), state.primNums.end(), 0);
+    state.side.resize(nPrimitives);
 
     // Start recursive construction of kd-tree
-    buildTree(0, bounds, primBounds, primNums.get(), primitives.size(), maxDepth, edges,
-              prims0.get(), prims1.get(), 0);
+    std::vector<KdTreeNode> buildNodes;
+    buildTree(&buildNodes, &primitiveIndices, bounds, &state, 0, nPrimitives,
+              2 * nPrimitives, maxDepth, 0);
+
+    nodes = new KdTreeNode[buildNodes.size()];
+    std::copy(buildNodes.begin(), buildNodes.end(), nodes);
+    kdTreeBytes += buildNodes.size() * sizeof(KdTreeNode) +
+                   primitiveIndices.size() * sizeof(int) +
+                   primitives.size() * sizeof(primitives[0]);
+    LOG_VERBOSE("Kd-tree created with %d nodes for %d primitives",
+                (int)buildNodes.size(), nPrimitives);
 }
 
 void KdTreeNode::InitLeaf(int *primNums, int np, std::vector<int> *primitiveIndices) {
@@ -861,28 +3216,31 @@ void KdTreeNode::InitLeaf(int *primNums, int np, std::vector<int> *primitiveIndi
     }
 }
 
-void KdTreeAggregate::buildTree(int nodeNum, const Bounds3f &nodeBounds,
-                                const std::vector<Bounds3f> &allPrimBounds, int *primNums,
-                                int nPrimitives, int depth,
-                                const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
-                                int *prims1, int badRefines) {
-    CHECK_EQ(nodeNum, nextFreeNode);
+void KdTreeAggregate::buildTree(std::vector<KdTreeNode> *nodes,
+                                std::vector<int> *primitiveIndices,
+                                const Bounds3f &nodeBounds, KdTreeBuildState *state,
+                                size_t edgeOffset, int nPrimitives, size_t freeOffset,
+                                int depth, int badRefines) const {
     // Get next free node from _nodes_ array
-    if (nextFreeNode == nAllocedNodes) {
-        int nNewAllocNodes = std::max(2 * nAllocedNodes, 512);
-        KdTreeNode *n = new KdTreeNode[nNewAllocNodes];
-        if (nAllocedNodes > 0) {
-            memcpy(n, nodes, nAllocedNodes * sizeof(KdTreeNode));
-            delete[] nodes;
-        }
-        nodes = n;
-        nAllocedNodes = nNewAllocNodes;
-    }
-    ++nextFreeNode;
+    int nodeNum = nodes->size();
+    nodes->push_back(KdTreeNode());
 
     // Initialize leaf node if termination criteria met
+    auto initLeaf = [&]() {
+        std::vector<int> &primNums = state->leafPrimNums;
+        primNums.clear();
+        for (int i = 0; i < 2 * nPrimitives; ++i) {
+            const BoundEdge &edge = state->edges[0][edgeOffset + i];
+            if (edge.type == EdgeType::Start)
+                primNums.push_back(state->primNums[edge.primNum]);
+        }
+        (*nodes)[nodeNum].InitLeaf(primNums.data(), nPrimitives, primitiveIndices);
+        ++kdLeafNodes;
+        ++kdLeafNodesRatio;
+        kdLeafPrimitives += nPrimitives;
+    };
     if (nPrimitives <= maxPrims || depth == 0) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
+        initLeaf();
         return;
     }
 
@@ -891,92 +3249,142 @@ void KdTreeAggregate::buildTree(int nodeNum, const Bounds3f &nodeBounds,
     int bestAxis = -1, bestOffset = -1;
     Float bestCost = Infinity, leafCost = isectCost * nPrimitives;
     Float invTotalSA = 1 / nodeBounds.SurfaceArea();
-    // Choose which axis to split along
-    int axis = nodeBounds.MaxDimension();
-
-    // Choose split along axis and attempt to partition primitives
-    int retries = 0;
-retrySplit:
-    // Initialize edges for _axis_
-    for (int i = 0; i < nPrimitives; ++i) {
-        int pn = primNums[i];
-        const Bounds3f &bounds = allPrimBounds[pn];
-        edges[axis][2 * i] = BoundEdge(bounds.pMin[axis], pn, true);
-        edges[axis][2 * i + 1] = BoundEdge(bounds.pMax[axis], pn, false);
-    }
-    // Sort _edges_ for _axis_
-    std::sort(&edges[axis][0], &edges[axis][2 * nPrimitives],
-              [](const BoundEdge &e0, const BoundEdge &e1) -> bool {
-                  return std::tie(e0.t, e0.type) < std::tie(e1.t, e1.type);
-              });
-
-    // Compute cost of all splits for _axis_ to find best
-    int nBelow = 0, nAbove = nPrimitives;
-    for (int i = 0; i < 2 * nPrimitives; ++i) {
-        if (edges[axis][i].type == EdgeType::End)
-            --nAbove;
-        Float edgeT = edges[axis][i].t;
-        if (edgeT > nodeBounds.pMin[axis] && edgeT < nodeBounds.pMax[axis]) {
-            // Compute child surface areas for split at _edgeT_
-            Vector3f d = nodeBounds.pMax - nodeBounds.pMin;
-            int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
-            Float belowSA =
-                2 * (d[otherAxis0] * d[otherAxis1] +
-                     (edgeT - nodeBounds.pMin[axis]) * (d[otherAxis0] + d[otherAxis1]));
-            Float aboveSA =
-                2 * (d[otherAxis0] * d[otherAxis1] +
-                     (nodeBounds.pMax[axis] - edgeT) * (d[otherAxis0] + d[otherAxis1]));
-
-            // Compute cost for split at _i_th edge
-            Float pBelow = belowSA * invTotalSA, pAbove = aboveSA * invTotalSA;
-            Float eb = (nAbove == 0 || nBelow == 0) ? emptyBonus : 0;
-            Float cost = traversalCost +
-                         isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
-            // Update best split if this is lowest cost so far
-            if (cost < bestCost) {
-                bestCost = cost;
-                bestAxis = axis;
-                bestOffset = i;
+    // Choose split along largest axis, falling back to the others if needed
+    for (int retries = 0, axis = nodeBounds.MaxDimension(); retries < 3 && bestAxis == -1;
+         ++retries, axis = (axis + 1) % 3) {
+        // Compute cost of all splits for _axis_ to find best
+        const BoundEdge *edges = &state->edges[axis][edgeOffset];
+        int nBelow = 0, nAbove = nPrimitives;
+        for (int i = 0; i < 2 * nPrimitives; ++i) {
+            if (edges[i].type == EdgeType::End)
+                --nAbove;
+            Float edgeT = edges[i].t;
+            if (edgeT > nodeBounds.pMin[axis] && edgeT < nodeBounds.pMax[axis]) {
+                // Compute child surface areas for split at _edgeT_
+                Vector3f d = nodeBounds.pMax - nodeBounds.pMin;
+                int otherAxis0 = (axis + 1) % 3, otherAxis1 = (axis + 2) % 3;
+                Float belowSA = 2 * (d[otherAxis0] * d[otherAxis1] +
+                                     (edgeT - nodeBounds.pMin[axis]) *
+                                         (d[otherAxis0] + d[otherAxis1]));
+                Float aboveSA = 2 * (d[otherAxis0] * d[otherAxis1] +
+                                     (nodeBounds.pMax[axis] - edgeT) *
+                                         (d[otherAxis0] + d[otherAxis1]));
+
+                // Compute cost for split at _i_th edge
+                Float pBelow = belowSA * invTotalSA, pAbove = aboveSA * invTotalSA;
+                Float eb = (nAbove == 0 || nBelow == 0) ? emptyBonus : 0;
+                Float cost = traversalCost +
+                             isectCost * (1 - eb) * (pBelow * nBelow + pAbove * nAbove);
+                // Update best split if this is lowest cost so far
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestOffset = i;
+                }
             }
+            if (edges[i].type == EdgeType::Start)
+                ++nBelow;
         }
-        if (edges[axis][i].type == EdgeType::Start)
-            ++nBelow;
+        CHECK(nBelow == nPrimitives && nAbove == 0);
     }
-    CHECK(nBelow == nPrimitives && nAbove == 0);
 
     // Create leaf if no good splits were found
-    if (bestAxis == -1 && retries < 2) {
-        ++retries;
-        axis = (axis + 1) % 3;
-        goto retrySplit;
-    }
     if (bestCost > leafCost)
         ++badRefines;
     if ((bestCost > 4 * leafCost && nPrimitives < 16) || bestAxis == -1 ||
         badRefines == 3) {
-        nodes[nodeNum].InitLeaf(primNums, nPrimitives, &primitiveIndices);
+        initLeaf();
         return;
     }
 
     // Classify primitives with respect to split
+    enum { Below = 1, Above = 2 };
+    const BoundEdge *splitEdges = &state->edges[bestAxis][edgeOffset];
+    uint8_t *side = state->side.data();
+    for (int i = 0; i < 2 * nPrimitives; ++i)
+        side[splitEdges[i].primNum] = 0;
     int n0 = 0, n1 = 0;
     for (int i = 0; i < bestOffset; ++i)
-        if (edges[bestAxis][i].type == EdgeType::Start)
-            prims0[n0++] = edges[bestAxis][i].primNum;
+        if (splitEdges[i].type == EdgeType::Start) {
+            side[splitEdges[i].primNum] |= Below;
+            ++n0;
+        }
     for (int i = bestOffset + 1; i < 2 * nPrimitives; ++i)
-        if (edges[bestAxis][i].type == EdgeType::End)
-            prims1[n1++] = edges[bestAxis][i].primNum;
+        if (splitEdges[i].type == EdgeType::End) {
+            side[splitEdges[i].primNum] |= Above;
+            ++n1;
+        }
+    Float tSplit = splitEdges[bestOffset].t;
+
+    // Partition sorted edges along all axes between the children
+    // Edges below the split are compacted in place, which preserves their
+    // order; those above are appended at _freeOffset_, past any edges still
+    // needed by ancestor nodes.
+    size_t aboveOffset = freeOffset;
+    for (int axis = 0; axis < 3; ++axis) {
+        std::vector<BoundEdge> &edges = state->edges[axis];
+        if (edges.size() < aboveOffset + 2 * n1)
+            edges.resize(std::max(aboveOffset + 2 * n1, 2 * edges.size()));
+        int nBelowEdges = 0, nAboveEdges = 0;
+        for (int i = 0; i < 2 * nPrimitives; ++i) {
+            BoundEdge edge = edges[edgeOffset + i];
+            if (side[edge.primNum] & Above)
+                edges[aboveOffset + nAboveEdges++] = edge;
+            if (side[edge.primNum] & Below)
+                edges[edgeOffset + nBelowEdges++] = edge;
+        }
+        DCHECK_EQ(nBelowEdges, 2 * n0);
+        DCHECK_EQ(nAboveEdges, 2 * n1);
+    }
 
     // Recursively initialize children nodes
-    Float tSplit = edges[bestAxis][bestOffset].t;
     Bounds3f bounds0 = nodeBounds, bounds1 = nodeBounds;
     bounds0.pMax[bestAxis] = bounds1.pMin[bestAxis] = tSplit;
-    buildTree(nodeNum + 1, bounds0, allPrimBounds, prims0, n0, depth - 1, edges, prims0,
-              prims1 + nPrimitives, badRefines);
-    int aboveChild = nextFreeNode;
-    nodes[nodeNum].InitInterior(bestAxis, aboveChild, tSplit);
-    buildTree(aboveChild, bounds1, allPrimBounds, prims1, n1, depth - 1, edges, prims0,
-              prims1 + nPrimitives, badRefines);
+    ++kdInteriorNodes;
+    if (nPrimitives > parallelSubtreeThreshold) {
+        // Build children in parallel, each with its own state
+        KdTreeBuildState childState[2];
+        std::vector<int> childPrimNum(state->primNums.size());
+        for (int c = 0; c < 2; ++c) {
+            // Renumber child's primitives densely and copy its edges
+            size_t offset = (c == 0) ? edgeOffset : aboveOffset;
+            int n = (c == 0) ? n0 : n1;
+            for (int i = 0; i < 2 * n; ++i) {
+                const BoundEdge &edge = state->edges[0][offset + i];
+                if (edge.type == EdgeType::Start) {
+                    childPrimNum[edge.primNum] = childState[c].primNums.size();
+                    childState[c].primNums.push_back(state->primNums[edge.primNum]);
+                }
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                childState[c].edges[axis].resize(2 * n);
+                for (int i = 0; i < 2 * n; ++i) {
+                    BoundEdge edge = state->edges[axis][offset + i];
+                    edge.primNum = childPrimNum[edge.primNum];
+                    childState[c].edges[axis][i] = edge;
+                }
+            }
+            childState[c].side.resize(n);
+        }
+
+        // Build child subtrees and splice them into _nodes_
+        std::vector<KdTreeNode> childNodes[2];
+        std::vector<int> childIndices[2];
+        ParallelFor(0, 2, [&](int64_t c) {
+            int n = (c == 0) ? n0 : n1;
+            buildTree(&childNodes[c], &childIndices[c], (c == 0) ? bounds0 : bounds1,
+                      &childState[c], 0, n, 2 * n, depth - 1, badRefines);
+        });
+        AppendKdSubtree(nodes, primitiveIndices, childNodes[0], childIndices[0]);
+        (*nodes)[nodeNum].InitInterior(bestAxis, nodes->size(), tSplit);
+        AppendKdSubtree(nodes, primitiveIndices, childNodes[1], childIndices[1]);
+    } else {
+        buildTree(nodes, primitiveIndices, bounds0, state, edgeOffset, n0,
+                  aboveOffset + 2 * n1, depth - 1, badRefines);
+        (*nodes)[nodeNum].InitInterior(bestAxis, nodes->size(), tSplit);
+        buildTree(nodes, primitiveIndices, bounds1, state, aboveOffset, n1,
+                  aboveOffset + 2 * n1, depth - 1, badRefines);
+    }
 }
 
 pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
@@ -1039,6 +3447,7 @@ pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
         } else {
             // Check for intersections inside leaf node
             int nPrimitives = node->nPrimitives();
+            kdPrimitivesTested += nPrimitives;
             if (nPrimitives == 1) {
                 const PrimitiveHandle &p = primitives[node->onePrimitive];
                 // Check one primitive inside leaf node
@@ -1072,6 +3481,8 @@ pstd::optional<ShapeIntersection> KdTreeAggregate::Intersect(const Ray &ray,
         }
     }
     kdNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
     return si;
 }
 
@@ -1093,10 +3504,13 @@ bool KdTreeAggregate::IntersectP(const Ray &ray, Float raytMax) const {
         if (node->IsLeaf()) {
             // Check for shadow ray intersections inside leaf node
             int nPrimitives = node->nPrimitives();
+            kdPrimitivesTested += nPrimitives;
             if (nPrimitives == 1) {
                 const PrimitiveHandle &p = primitives[node->onePrimitive];
                 if (p.IntersectP(ray, raytMax)) {
                     kdNodesVisited += nodesVisited;
+                    if (countTraversalSteps)
+                        threadWorkCounters.nodesVisited += nodesVisited;
                     return true;
                 }
             } else {
@@ -1106,6 +3520,8 @@ bool KdTreeAggregate::IntersectP(const Ray &ray, Float raytMax) const {
                     const PrimitiveHandle &prim = primitives[primitiveIndex];
                     if (prim.IntersectP(ray, raytMax)) {
                         kdNodesVisited += nodesVisited;
+                        if (countTraversalSteps)
+                            threadWorkCounters.nodesVisited += nodesVisited;
                         return true;
                     }
                 }
@@ -1155,6 +3571,8 @@ bool KdTreeAggregate::IntersectP(const Ray &ray, Float raytMax) const {
         }
     }
     kdNodesVisited += nodesVisited;
+    if (countTraversalSteps)
+        threadWorkCounters.nodesVisited += nodesVisited;
     return false;
 }
 
@@ -1169,6 +3587,321 @@ KdTreeAggregate *KdTreeAggregate::Create(std::vector<PrimitiveHandle> prims,
                                maxPrims, maxDepth);
 }
 
+// EmbreeAggregate Method Definitions
+#ifdef PBRT_HAVE_EMBREE
+// EmbreeAggregate Local Definitions
+// Extended intersection context that carries the pbrt ray and the closest
+// intersection found so far through Embree to the user geometry callbacks
+struct EmbreeIntersectContext {
+    RTCIntersectContext context;
+    const Ray *ray;
+    pstd::optional<ShapeIntersection> *si;
+};
+
+// Returns the triangle of _prim_ if Embree can intersect it as one of its own
+// triangles: an opaque mesh triangle without an alpha texture or area light.
+// Its material is returned in _material_.
+static const Triangle *EmbreeTriangle(PrimitiveHandle prim, MaterialHandle *material) {
+    const Triangle *tri = nullptr;
+    if ((tri = prim.CastOrNullptr<Triangle>()))
+        *material = MeshMaterials::Get(tri->MeshIndex());
+    else if (const SimplePrimitive *simplePrim = prim.CastOrNullptr<SimplePrimitive>()) {
+        tri = simplePrim->GetShape().CastOrNullptr<Triangle>();
+        *material = simplePrim->GetMaterial();
+    }
+    if (tri && *material && material->IsTransparent())
+        return nullptr;
+    return tri;
+}
+
+// Returns the ray that a user geometry callback should intersect; inside an
+// instance, Embree has already transformed it to the instance's space
+static Ray EmbreeCallbackRay(const RTCIntersectContext *context, const RTCRay &rtcRay,
+                             const Ray &ray) {
+    if (context->instID[0] == RTC_INVALID_GEOMETRY_ID)
+        return ray;
+    return Ray(Point3f(rtcRay.org_x, rtcRay.org_y, rtcRay.org_z),
+               Vector3f(rtcRay.dir_x, rtcRay.dir_y, rtcRay.dir_z), ray.time, ray.medium);
+}
+
+static void EmbreeBounds(const RTCBoundsFunctionArguments *args) {
+    const PrimitiveHandle *prims = (const PrimitiveHandle *)args->geometryUserPtr;
+    Bounds3f b = prims[args->primID].Bounds();
+    args->bounds_o->lower_x = b.pMin.x;
+    args->bounds_o->lower_y = b.pMin.y;
+    args->bounds_o->lower_z = b.pMin.z;
+    args->bounds_o->upper_x = b.pMax.x;
+    args->bounds_o->upper_y = b.pMax.y;
+    args->bounds_o->upper_z = b.pMax.z;
+}
+
+static void EmbreeIntersect(const RTCIntersectFunctionNArguments *args) {
+    // Only single-ray queries are issued, so _N_ is always one
+    DCHECK_EQ(1, args->N);
+    if (!args->valid[0])
+        return;
+    const PrimitiveHandle *prims = (const PrimitiveHandle *)args->geometryUserPtr;
+    EmbreeIntersectContext *ctx = (EmbreeIntersectContext *)args->context;
+    RTCRayHit *rayhit = (RTCRayHit *)args->rayhit;
+
+    Ray ray = EmbreeCallbackRay(args->context, rayhit->ray, *ctx->ray);
+    pstd::optional<ShapeIntersection> si =
+        prims[args->primID].Intersect(ray, rayhit->ray.tfar);
+    if (!si)
+        return;
+    rayhit->ray.tfar = si->tHit;
+    rayhit->hit.geomID = args->geomID;
+    rayhit->hit.primID = args->primID;
+    rayhit->hit.instID[0] = args->context->instID[0];
+    *ctx->si = si;
+}
+
+static void EmbreeOccluded(const RTCOccludedFunctionNArguments *args) {
+    DCHECK_EQ(1, args->N);
+    if (!args->valid[0])
+        return;
+    const PrimitiveHandle *prims = (const PrimitiveHandle *)args->geometryUserPtr;
+    EmbreeIntersectContext *ctx = (EmbreeIntersectContext *)args->context;
+    RTCRay *ray = (RTCRay *)args->ray;
+
+    if (prims[args->primID].IntersectP(EmbreeCallbackRay(args->context, *ray, *ctx->ray),
+                                       ray->tfar))
+        // Embree's convention for reporting an occluded ray
+        ray->tfar = -std::numeric_limits<float>::infinity();
+}
+
+static void InitEmbreeRay(const Ray &r, Float tMax, RTCRay *ray) {
+    ray->org_x = r.o.x;
+    ray->org_y = r.o.y;
+    ray->org_z = r.o.z;
+    ray->dir_x = r.d.x;
+    ray->dir_y = r.d.y;
+    ray->dir_z = r.d.z;
+    ray->tnear = 0;
+    ray->tfar = std::min<Float>(tMax, std::numeric_limits<float>::max());
+    ray->time = r.time;
+    ray->mask = ~0u;
+    ray->id = 0;
+    ray->flags = 0;
+}
+
+EmbreeAggregate::EmbreeAggregate(std::vector<PrimitiveHandle> prims)
+    : primitives(std::move(prims)) {
+    std::string config = StringPrintf("threads=%d", RunningThreads());
+    RTCDevice rtcDevice = rtcNewDevice(config.c_str());
+    if (!rtcDevice)
+        ErrorExit("Embree: unable to create device: error %d.",
+                  int(rtcGetDeviceError(nullptr)));
+    rtcSetDeviceErrorFunction(
+        rtcDevice,
+        [](void *, RTCError code, const char *str) {
+            ErrorExit("Embree: %s (error %d).", str, int(code));
+        },
+        nullptr);
+    device = rtcDevice;
+
+    addScene(primitives, true);
+    for (PrimitiveHandle prim : primitives)
+        bounds = Union(bounds, prim.Bounds());
+}
+
+EmbreeAggregate::~EmbreeAggregate() {
+    for (Scene &scene : scenes)
+        rtcReleaseScene((RTCScene)scene.scene);
+    rtcReleaseDevice((RTCDevice)device);
+}
+
+int EmbreeAggregate::addScene(const std::vector<PrimitiveHandle> &prims, bool topLevel) {
+    // Sort primitives into Embree geometries
+    // Mesh triangles are grouped by mesh, and the prototypes of the
+    // top-level scene's object instances get scenes of their own
+    std::vector<Geometry> geometries;
+    std::map<int, Geometry> meshTriangles;
+    Geometry userPrimitives;
+    for (PrimitiveHandle prim : prims) {
+        MaterialHandle material;
+        if (const Triangle *tri = EmbreeTriangle(prim, &material))
+            meshTriangles[tri->MeshIndex()].primitives.push_back(prim);
+        else if (topLevel && prim.Is<InstanceBVHAggregate>()) {
+            const InstanceBVHAggregate *instances = prim.Cast<InstanceBVHAggregate>();
+            std::vector<int> prototypeScenes;
+            for (PrimitiveHandle prototype : instances->Prototypes())
+                prototypeScenes.push_back(
+                    prototype.Is<BVHAggregate>()
+                        ? addScene(prototype.Cast<BVHAggregate>()->Primitives(), false)
+                        : addScene({prototype}, false));
+            for (size_t i = 0; i < instances->NumInstances(); ++i) {
+                Geometry instance;
+                instance.instanceScene = prototypeScenes[instances->InstancePrototype(i)];
+                instance.renderFromInstance = instances->RenderFromInstance(i);
+                geometries.push_back(std::move(instance));
+            }
+        } else
+            userPrimitives.primitives.push_back(prim);
+    }
+    for (auto &mesh : meshTriangles) {
+        mesh.second.triangles = true;
+        geometries.push_back(std::move(mesh.second));
+    }
+    if (!userPrimitives.primitives.empty())
+        geometries.push_back(std::move(userPrimitives));
+
+    // Create Embree scene for _geometries_
+    RTCDevice rtcDevice = (RTCDevice)device;
+    RTCScene rtcScene = rtcNewScene(rtcDevice);
+    rtcSetSceneFlags(rtcScene, RTC_SCENE_FLAG_ROBUST);
+    rtcSetSceneBuildQuality(rtcScene, RTC_BUILD_QUALITY_HIGH);
+    for (size_t geomID = 0; geomID < geometries.size(); ++geomID) {
+        const Geometry &g = geometries[geomID];
+        RTCGeometry geometry;
+        if (g.instanceScene != -1) {
+            // Create Embree instance of prototype scene
+            geometry = rtcNewGeometry(rtcDevice, RTC_GEOMETRY_TYPE_INSTANCE);
+            rtcSetGeometryInstancedScene(geometry,
+                                         (RTCScene)scenes[g.instanceScene].scene);
+            const SquareMatrix<4> &m = g.renderFromInstance.GetMatrix();
+            float xfm[12];
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 4; ++c)
+                    xfm[4 * r + c] = m[r][c];
+            rtcSetGeometryTransform(geometry, 0, RTC_FORMAT_FLOAT3X4_ROW_MAJOR, xfm);
+        } else if (g.triangles) {
+            // Create Embree triangle mesh with the mesh's vertices and the
+            // primitives' triangles
+            MaterialHandle material;
+            const Triangle *firstTri = EmbreeTriangle(g.primitives[0], &material);
+            const TriangleMesh *mesh = firstTri->GetMesh();
+            geometry = rtcNewGeometry(rtcDevice, RTC_GEOMETRY_TYPE_TRIANGLE);
+            float *p = (float *)rtcSetNewGeometryBuffer(
+                geometry, RTC_BUFFER_TYPE_VERTEX, 0, RTC_FORMAT_FLOAT3, 3 * sizeof(float),
+                mesh->nVertices);
+            for (int i = 0; i < mesh->nVertices; ++i)
+                for (int c = 0; c < 3; ++c)
+                    p[3 * i + c] = mesh->p[i][c];
+            unsigned int *indices = (unsigned int *)rtcSetNewGeometryBuffer(
+                geometry, RTC_BUFFER_TYPE_INDEX, 0, RTC_FORMAT_UINT3,
+                3 * sizeof(unsigned int), g.primitives.size());
+            for (size_t i = 0; i < g.primitives.size(); ++i) {
+                const Triangle *tri = EmbreeTriangle(g.primitives[i], &material);
+                const int *v = &mesh->vertexIndices[3 * tri->TriangleIndex()];
+                for (int j = 0; j < 3; ++j)
+                    indices[3 * i + j] = v[j];
+            }
+        } else {
+            // Create Embree user geometry for primitives that pbrt intersects
+            geometry = rtcNewGeometry(rtcDevice, RTC_GEOMETRY_TYPE_USER);
+            rtcSetGeometryUserPrimitiveCount(geometry, g.primitives.size());
+            rtcSetGeometryUserData(geometry, (void *)g.primitives.data());
+            rtcSetGeometryBoundsFunction(geometry, EmbreeBounds, nullptr);
+            rtcSetGeometryIntersectFunction(geometry, EmbreeIntersect);
+            rtcSetGeometryOccludedFunction(geometry, EmbreeOccluded);
+        }
+        rtcCommitGeometry(geometry);
+        rtcAttachGeometryByID(rtcScene, geometry, geomID);
+        rtcReleaseGeometry(geometry);
+    }
+    rtcCommitScene(rtcScene);
+
+    // The geometries' primitive arrays don't move when _geometries_ does
+    scenes.push_back(Scene{rtcScene, std::move(geometries)});
+    return scenes.size() - 1;
+}
+
+EmbreeAggregate *EmbreeAggregate::Create(std::vector<PrimitiveHandle> prims,
+                                         const ParameterDictionary &parameters) {
+    return new EmbreeAggregate(std::move(prims));
+}
+
+pstd::optional<ShapeIntersection> EmbreeAggregate::Intersect(const Ray &ray,
+                                                             Float tMax) const {
+    if (primitives.empty())
+        return {};
+    pstd::optional<ShapeIntersection> si;
+    EmbreeIntersectContext context;
+    rtcInitIntersectContext(&context.context);
+    context.ray = &ray;
+    context.si = &si;
+
+    RTCRayHit rayhit;
+    InitEmbreeRay(ray, tMax, &rayhit.ray);
+    rayhit.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+    rayhit.hit.primID = RTC_INVALID_GEOMETRY_ID;
+    rayhit.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+    rtcIntersect1((RTCScene)scenes[0].scene, &context.context, &rayhit);
+    if (rayhit.hit.geomID == RTC_INVALID_GEOMETRY_ID)
+        return {};
+
+    // Find hit's geometry and the ray in its space
+    const Geometry *geometry = &scenes[0].geometries[rayhit.hit.geomID];
+    const Transform *renderFromInstance = nullptr;
+    Ray r = ray;
+    if (rayhit.hit.instID[0] != RTC_INVALID_GEOMETRY_ID) {
+        const Geometry &instance = scenes[0].geometries[rayhit.hit.instID[0]];
+        geometry = &scenes[instance.instanceScene].geometries[rayhit.hit.geomID];
+        renderFromInstance = &instance.renderFromInstance;
+        r = renderFromInstance->ApplyInverse(ray);
+    }
+
+    if (geometry->triangles) {
+        // Compute intersection for Embree's triangle hit
+        PrimitiveHandle prim = geometry->primitives[rayhit.hit.primID];
+        MaterialHandle material;
+        const Triangle *tri = EmbreeTriangle(prim, &material);
+        Float u = rayhit.hit.u, v = rayhit.hit.v;
+        si = tri->IntersectionFromHit(
+            TriangleIntersection{1 - u - v, u, v, Float(rayhit.ray.tfar)}, r);
+        si->intr.SetIntersectionProperties(material, nullptr, nullptr, ray.medium);
+    }
+    // Otherwise, _EmbreeIntersect()_ has stored the intersection in _si_
+    CHECK(si.has_value());
+    if (renderFromInstance)
+        si->intr = (*renderFromInstance)(si->intr);
+    return si;
+}
+
+bool EmbreeAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    if (primitives.empty())
+        return false;
+    EmbreeIntersectContext context;
+    rtcInitIntersectContext(&context.context);
+    context.ray = &ray;
+    context.si = nullptr;
+
+    RTCRay rtcRay;
+    InitEmbreeRay(ray, tMax, &rtcRay);
+    rtcOccluded1((RTCScene)scenes[0].scene, &context.context, &rtcRay);
+    return rtcRay.tfar < 0;
+}
+
+#else
+EmbreeAggregate::EmbreeAggregate(std::vector<PrimitiveHandle> prims) {
+    LOG_FATAL("pbrt was not built with Embree support.");
+}
+
+EmbreeAggregate::~EmbreeAggregate() {}
+
+int EmbreeAggregate::addScene(const std::vector<PrimitiveHandle> &prims, bool topLevel) {
+    LOG_FATAL("pbrt was not built with Embree support.");
+    return -1;
+}
+
+EmbreeAggregate *EmbreeAggregate::Create(std::vector<PrimitiveHandle> prims,
+                                         const ParameterDictionary &parameters) {
+    return nullptr;
+}
+
+pstd::optional<ShapeIntersection> EmbreeAggregate::Intersect(const Ray &ray,
+                                                             Float tMax) const {
+    LOG_FATAL("pbrt was not built with Embree support.");
+    return {};
+}
+
+bool EmbreeAggregate::IntersectP(const Ray &ray, Float tMax) const {
+    LOG_FATAL("pbrt was not built with Embree support.");
+    return false;
+}
+#endif  // PBRT_HAVE_EMBREE
+
 PrimitiveHandle CreateAccelerator(const std::string &name,
                                   std::vector<PrimitiveHandle> prims,
                                   const ParameterDictionary &parameters) {
@@ -1177,7 +3910,14 @@ PrimitiveHandle CreateAccelerator(const std::string &name,
         accel = BVHAggregate::Create(std::move(prims), parameters);
     else if (name == "kdtree")
         accel = KdTreeAggregate::Create(std::move(prims), parameters);
-    else
+    else if (name == "embree") {
+#ifdef PBRT_HAVE_EMBREE
+        accel = EmbreeAggregate::Create(std::move(prims), parameters);
+#else
+        Warning("pbrt was not built with Embree support; using \"bvh\" accelerator.");
+        accel = BVHAggregate::Create(std::move(prims), parameters);
+#endif
+    } else
         ErrorExit("%s: accelerator type unknown.", name);
 
     if (!accel)
@@ -8,9 +8,11 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/cpu/primitive.h>
+#include <pbrt/util/taggedptr.h>
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 namespace pbrt {
@@ -23,23 +25,72 @@ struct BVHBuildNode;
 struct BVHPrimitive;
 struct LinearBVHNode;
 struct MortonPrimitive;
+struct SoAHits;
+class LazyTriangleRay;
+template <int N>
+struct WideBVHNode;
+template <int N>
+struct QuantizedBVHNode;
+
+// WideBVHNodesHandle Definition
+using WideBVHNodesHandle =
+    TaggedPointer<WideBVHNode<4>, WideBVHNode<8>, QuantizedBVHNode<2>,
+                  QuantizedBVHNode<4>, QuantizedBVHNode<8>>;
 
 // BVHAggregate Definition
 class BVHAggregate {
   public:
     // BVHAggregate Public Types
-    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts };
+    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH };
 
     // BVHAggregate Public Methods
     BVHAggregate(std::vector<PrimitiveHandle> p, int maxPrimsInNode = 1,
-                 SplitMethod splitMethod = SplitMethod::SAH);
+                 SplitMethod splitMethod = SplitMethod::SAH, int width = 2,
+                 bool quantize = false, Float splitBudget = 0.5f,
+                 bool soaTriangles = false, bool soaPatches = false);
 
     static BVHAggregate *Create(std::vector<PrimitiveHandle> prims,
                                 const ParameterDictionary &parameters);
 
     Bounds3f Bounds() const;
+    size_t NumPrimitives() const { return primitives.size(); }
+    const std::vector<PrimitiveHandle> &Primitives() const { return primitives; }
+
+    // Updates node bounds for the primitives' current bounds, keeping the
+    // BVH's topology. The transformations of _TransformedPrimitive_s may
+    // have been modified in place. If the refit BVH's SAH cost is more than
+    // _rebuildCostRatio_ times its cost when it was built, the BVH is rebuilt
+    // instead. Returns true if it was rebuilt.
+    bool Refit(Float rebuildCostRatio = 2);
+    // Frees the BVH's nodes and primitive references, leaving it empty; the
+    // primitives themselves are not freed
+    void ReleaseMemory();
+    // Returns the number of bytes used by the BVH, not counting its primitives
+    size_t MemoryBytes() const;
+    // Returns the BVH's SAH cost, relative to intersecting its bounds
+    Float SAHCost() const;
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
     bool IntersectP(const Ray &ray, Float tMax) const;
+    // Shadow rays traced with _IntersectShadowP()_ are first tested against
+    // the primitive that most recently occluded one on the same thread;
+    // traversal then visits larger children first, as they are more likely
+    // to hold an occluder
+    bool IntersectShadowP(const Ray &ray, Float tMax) const;
+    bool HasOnlyOpaqueSurfaces() const { return onlyOpaqueSurfaces; }
+
+    // Packets of up to _PacketSize_ rays share BVH traversal; only rays with
+    // their bit set in _activeMask_ are traced
+    static constexpr int PacketSize = 16;
+    void IntersectPacket(const Ray *rays, const Float *tMax, uint32_t activeMask,
+                         pstd::optional<ShapeIntersection> *si) const;
+    uint32_t IntersectPPacket(const Ray *rays, const Float *tMax,
+                              uint32_t activeMask) const;
+
+    // Ray streams are traced as a sequence of ray packets
+    void IntersectN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                    pstd::span<pstd::optional<ShapeIntersection>> si) const;
+    void IntersectPN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                     pstd::span<bool> occluded) const;
 
   private:
     // BVHAggregate Private Methods
@@ -48,6 +99,13 @@ class BVHAggregate {
                                  int end, std::atomic<int> *totalNodes,
                                  std::atomic<int> *orderedPrimsOffset,
                                  std::vector<PrimitiveHandle> &orderedPrims);
+    // SBVH spatial splits may add up to _splitBudget_ times the number of
+    // primitives in duplicate references
+    BVHBuildNode *buildSBVH(std::vector<Allocator> &threadAllocators,
+                            std::vector<BVHPrimitive> refs, Float rootSurfaceArea,
+                            std::atomic<int64_t> *splitBudget,
+                            std::atomic<int> *totalNodes, std::mutex *orderedPrimsMutex,
+                            std::vector<PrimitiveHandle> &orderedPrims);
     BVHBuildNode *buildHLBVH(Allocator alloc,
                              const std::vector<BVHPrimitive> &primitiveInfo,
                              std::atomic<int> *totalNodes,
@@ -60,17 +118,113 @@ class BVHAggregate {
     BVHBuildNode *buildUpperSAH(Allocator alloc,
                                 std::vector<BVHBuildNode *> &treeletRoots, int start,
                                 int end, std::atomic<int> *totalNodes) const;
-    int flattenBVHTree(BVHBuildNode *node, int *offset);
+    template <typename Node>
+    Node *collapseBVHTree(BVHBuildNode *root);
+    bool readCache(const std::string &filename, uint64_t key, int width, bool quantize);
+    bool writeCache(const std::string &filename, uint64_t key, int width, bool quantize,
+                    int64_t nPrimitives, const std::vector<int> &order) const;
+    // Switches the BVH's nodes to the ones in the cache file that was just
+    // written for it, if they can be mapped into memory.
+    void adoptCache(const std::string &filename);
+    void releaseNodes();
+
+    template <typename Node>
+    pstd::optional<ShapeIntersection> intersectWide(const Node *wideNodes,
+                                                    const Ray &ray, Float tMax) const;
+    template <typename Node>
+    bool intersectPWide(const Node *wideNodes, const Ray &ray, Float tMax) const;
+    template <typename Node>
+    bool intersectShadowPWide(const Node *wideNodes, const Ray &ray, Float tMax,
+                              int *occluder) const;
+    template <typename Node>
+    void refitWide(Node *wideNodes);
+    template <typename Node>
+    Float wideSAHCost(const Node *wideNodes) const;
+    void initSoAPrimitives();
+    void accountMemory();
+    int soaHitMask(const Ray &ray, LazyTriangleRay *triRay, int start,
+                   int end, Float tMax, SoAHits *hits) const;
+    pstd::optional<ShapeIntersection> intersectLeaf(const Ray &ray,
+                                                    LazyTriangleRay *triRay,
+                                                    int offset, int nPrimitives,
+                                                    Float *tMax) const;
+    bool intersectPLeaf(const Ray &ray, LazyTriangleRay *triRay, int offset,
+                        int nPrimitives, Float tMax, int *occluder = nullptr) const;
 
     // BVHAggregate Private Members
     int maxPrimsInNode;
     std::vector<PrimitiveHandle> primitives;
     SplitMethod splitMethod;
     LinearBVHNode *nodes = nullptr;
+    // Only one of _nodes_ and _wideNodes_ is non-null, depending on the BVH
+    // width and whether its node bounds are quantized
+    WideBVHNodesHandle wideNodes;
+    size_t nodeBytes = 0;
+    // Build parameters are kept so that _Refit()_ can rebuild the BVH
+    int width;
+    bool quantize;
+    Float splitBudget;
+    // Computed at the first refit, before node bounds are updated
+    Float builtSAHCost = 0;
+    // With _soaTriangles_, the vertices of triangles in _primitives_ are
+    // also stored as nine arrays of coordinates (x, y, and z of each vertex)
+    // so that leaves' triangles can be tested together without accessing
+    // their meshes; _soaPatches_ does the same for bilinear patches, with
+    // twelve arrays
+    bool soaTriangles, soaPatches;
+    std::vector<Float> triangleVertices, patchVertices;
+    size_t triangleVerticesStride = 0, patchVerticesStride = 0;
+    std::vector<uint8_t> primitiveSoAKind;
+    // Memory holding a BVH read from the cache, which _nodes_ or _wideNodes_
+    // then point into
+    char *cacheData = nullptr;
+    size_t cacheBytes = 0;
+    bool onlyOpaqueSurfaces = false;
+    // Bytes accounted to the BVH memory category
+    size_t accountedBytes = 0;
+};
+
+// InstanceBVHAggregate Definition
+class InstanceBVHAggregate {
+  public:
+    // InstanceBVHAggregate Public Methods
+    // Instance _i_ is of _prototypes[instancePrototypes[i]]_, placed with
+    // _renderFromInstance[i]_
+    InstanceBVHAggregate(std::vector<PrimitiveHandle> prototypes,
+                         const std::vector<int> &instancePrototypes,
+                         const std::vector<const Transform *> &renderFromInstance);
+
+    Bounds3f Bounds() const { return bounds; }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+    const std::vector<PrimitiveHandle> &Prototypes() const { return prototypes; }
+    size_t NumInstances() const { return instancePrototypes.size(); }
+    int InstancePrototype(int instance) const { return instancePrototypes[instance]; }
+    const Transform &RenderFromInstance(int instance) const {
+        return *renderFromInstance[instance];
+    }
+
+  private:
+    // InstanceBVHAggregate Private Methods
+    Ray instanceRay(int instance, const Ray &r, Float *tMax) const;
+
+    // InstanceBVHAggregate Private Members
+    std::vector<PrimitiveHandle> prototypes;
+    std::vector<Bounds3f> prototypeBounds;
+    // Per-instance data, in the order of the instances in the BVH's leaves;
+    // the top three rows of each instance's _instanceFromRender_ matrix are
+    // stored in structure-of-arrays form for transforming rays, and hits are
+    // transformed back with the instance's _renderFromInstance_ transform
+    std::vector<int> instancePrototypes;
+    std::vector<const Transform *> renderFromInstance;
+    std::vector<Float> instanceFromRender[3][4];
+    LinearBVHNode *nodes = nullptr;
+    Bounds3f bounds;
 };
 
 struct KdTreeNode;
-struct BoundEdge;
+struct KdTreeBuildState;
 
 // KdTreeAggregate Definition
 class KdTreeAggregate {
@@ -89,19 +243,61 @@ class KdTreeAggregate {
 
   private:
     // KdTreeAggregate Private Methods
-    void buildTree(int nodeNum, const Bounds3f &bounds,
-                   const std::vector<Bounds3f> &primBounds, int *primNums, int nprims,
-                   int depth, const std::unique_ptr<BoundEdge[]> edges[3], int *prims0,
-                   int *prims1, int badRefines);
+    void buildTree(std::vector<KdTreeNode> *nodes, std::vector<int> *primitiveIndices,
+                   const Bounds3f &bounds, KdTreeBuildState *state, size_t edgeOffset,
+                   int nPrimitives, size_t freeOffset, int depth, int badRefines) const;
 
     // KdTreeAggregate Private Members
     int isectCost, traversalCost, maxPrims;
     Float emptyBonus;
     std::vector<PrimitiveHandle> primitives;
     std::vector<int> primitiveIndices;
-    KdTreeNode *nodes;
-    int nAllocedNodes, nextFreeNode;
+    KdTreeNode *nodes = nullptr;
+    Bounds3f bounds;
+};
+
+// EmbreeAggregate Definition
+class EmbreeAggregate {
+  public:
+    // EmbreeAggregate Public Methods
+    EmbreeAggregate(std::vector<PrimitiveHandle> prims);
+    ~EmbreeAggregate();
+    EmbreeAggregate(const EmbreeAggregate &) = delete;
+    EmbreeAggregate &operator=(const EmbreeAggregate &) = delete;
+    // Returns nullptr if pbrt was built without Embree
+    static EmbreeAggregate *Create(std::vector<PrimitiveHandle> prims,
+                                   const ParameterDictionary &parameters);
+
+    Bounds3f Bounds() const { return bounds; }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &ray, Float tMax) const;
+    bool IntersectP(const Ray &ray, Float tMax) const;
+
+  private:
+    // EmbreeAggregate Private Methods
+    int addScene(const std::vector<PrimitiveHandle> &prims, bool topLevel);
+
+    // EmbreeAggregate Private Members
+    // An Embree geometry: either mesh triangles that Embree intersects
+    // itself, primitives that it intersects through pbrt's callbacks, or an
+    // instance of the Embree scene _instanceScene_
+    struct Geometry {
+        std::vector<PrimitiveHandle> primitives;
+        bool triangles = false;
+        int instanceScene = -1;
+        Transform renderFromInstance;
+    };
+    struct Scene {
+        // Embree's _RTCScene_
+        void *scene = nullptr;
+        // Indexed by Embree geometry ID
+        std::vector<Geometry> geometries;
+    };
+    std::vector<PrimitiveHandle> primitives;
     Bounds3f bounds;
+    // Embree's _RTCDevice_
+    void *device = nullptr;
+    // The top-level scene is first, followed by the instances' prototypes
+    std::vector<Scene> scenes;
 };
 
 }  // namespace pbrt
@@ -0,0 +1,612 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/aggregates.h>
+#include <pbrt/cpu/primitive.h>
+#include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
+#include <pbrt/shapes.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/transform.h>
+
+#include <memory>
+#include <vector>
+
+using namespace pbrt;
+
+static std::string inTestDir(const std::string &path) {
+    return path;
+}
+
+static std::vector<PrimitiveHandle> RandomTriangles(int nTriangles, Float size = .1f) {
+    RNG rng;
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < nTriangles; ++i) {
+        // Make a triangle at a random position in $[-1,1]^3$
+        Point3f c(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                  Lerp(rng.Uniform<Float>(), -1, 1));
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(c + Vector3f(Lerp(rng.Uniform<Float>(), -size, size),
+                                     Lerp(rng.Uniform<Float>(), -size, size),
+                                     Lerp(rng.Uniform<Float>(), -size, size)));
+        }
+    }
+
+    static Transform identity;
+    // Leaks...
+    TriangleMesh *mesh = new TriangleMesh(identity, false, indices, p, {}, {}, {}, {});
+    pstd::vector<ShapeHandle> tris = Triangle::CreateTriangles(mesh, Allocator());
+    std::vector<PrimitiveHandle> prims;
+    for (ShapeHandle tri : tris)
+        prims.push_back(new SimplePrimitive(tri, nullptr));
+    return prims;
+}
+
+TEST(BVHAggregate, WideAndQuantizedMatchBinary) {
+    std::vector<PrimitiveHandle> prims = RandomTriangles(10000);
+    BVHAggregate bvh2(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+    BVHAggregate bvh4(prims, 4, BVHAggregate::SplitMethod::SAH, 4);
+    BVHAggregate bvh8(prims, 4, BVHAggregate::SplitMethod::SAH, 8);
+    BVHAggregate bvh2q(prims, 4, BVHAggregate::SplitMethod::SAH, 2, true);
+    BVHAggregate bvh4q(prims, 4, BVHAggregate::SplitMethod::SAH, 4, true);
+    BVHAggregate bvh8q(prims, 4, BVHAggregate::SplitMethod::SAH, 8, true);
+
+    EXPECT_EQ(bvh2.Bounds(), bvh4.Bounds());
+    EXPECT_EQ(bvh2.Bounds(), bvh8.Bounds());
+    // Quantized bounds are conservative
+    for (const BVHAggregate *bvh : {&bvh2q, &bvh4q, &bvh8q})
+        EXPECT_EQ(bvh->Bounds(), Union(bvh->Bounds(), bvh2.Bounds()));
+
+    RNG rng(1234);
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        // Exercise axis-aligned directions as well
+        if (i % 8 == 0)
+            d.x = d.y = 0;
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>();
+
+        pstd::optional<ShapeIntersection> si2 = bvh2.Intersect(ray, tMax);
+        for (const BVHAggregate *bvh : {&bvh4, &bvh8, &bvh2q, &bvh4q, &bvh8q}) {
+            pstd::optional<ShapeIntersection> si = bvh->Intersect(ray, tMax);
+            ASSERT_EQ(si2.has_value(), si.has_value());
+            if (si2) {
+                EXPECT_EQ(si2->tHit, si->tHit);
+            }
+            EXPECT_EQ(bvh2.IntersectP(ray, tMax), bvh->IntersectP(ray, tMax));
+        }
+    }
+}
+
+TEST(BVHAggregate, SBVHMatchesSAH) {
+    // Large, overlapping triangles give spatial splits something to do
+    std::vector<PrimitiveHandle> prims = RandomTriangles(5000, .75f);
+    BVHAggregate sah(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+    BVHAggregate sbvh(prims, 4, BVHAggregate::SplitMethod::SBVH, 2);
+    BVHAggregate sbvh8(prims, 4, BVHAggregate::SplitMethod::SBVH, 8);
+    BVHAggregate sbvhNoBudget(prims, 4, BVHAggregate::SplitMethod::SBVH, 2, false, 0);
+    EXPECT_EQ(sah.Bounds(), sbvh.Bounds());
+
+    RNG rng(91);
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>();
+
+        pstd::optional<ShapeIntersection> si = sah.Intersect(ray, tMax);
+        for (const BVHAggregate *bvh : {&sbvh, &sbvh8, &sbvhNoBudget}) {
+            pstd::optional<ShapeIntersection> siSBVH = bvh->Intersect(ray, tMax);
+            ASSERT_EQ(si.has_value(), siSBVH.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siSBVH->tHit);
+            }
+            EXPECT_EQ(sah.IntersectP(ray, tMax), bvh->IntersectP(ray, tMax));
+        }
+    }
+}
+
+TEST(KdTreeAggregate, MatchesBVH) {
+    // Enough primitives that subtrees are built in parallel and spliced
+    std::vector<PrimitiveHandle> prims = RandomTriangles(40000, .05f);
+    BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+    KdTreeAggregate kdtree(prims);
+    KdTreeAggregate kdtreeShallow(prims, 5, 1, 0.5f, 4, 6);
+    EXPECT_EQ(bvh.Bounds(), kdtree.Bounds());
+
+    RNG rng(17);
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>();
+
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+        for (const KdTreeAggregate *kd : {&kdtree, &kdtreeShallow}) {
+            pstd::optional<ShapeIntersection> siKd = kd->Intersect(ray, tMax);
+            ASSERT_EQ(si.has_value(), siKd.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siKd->tHit);
+            }
+            EXPECT_EQ(bvh.IntersectP(ray, tMax), kd->IntersectP(ray, tMax));
+        }
+    }
+}
+
+TEST(BVHAggregate, SoATrianglesMatch) {
+    // Mix triangles held by different primitives with ones that aren't
+    // directly intersected as triangles
+    static Transform identity;
+    std::vector<PrimitiveHandle> prims;
+    for (PrimitiveHandle tri : RandomTriangles(3000, .25f)) {
+        ShapeHandle shape = tri.Cast<SimplePrimitive>()->GetShape();
+        if (prims.size() % 3 == 0)
+            prims.push_back(tri);
+        else if (prims.size() % 3 == 1)
+            prims.push_back(
+                new GeometricPrimitive(shape, nullptr, nullptr, MediumInterface()));
+        else
+            prims.push_back(new TransformedPrimitive(tri, &identity));
+    }
+
+    BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+    // Leaves with more primitives than SoA lanes are tested in multiple steps
+    BVHAggregate soa(prims, 13, BVHAggregate::SplitMethod::SAH, 2, false, .5f, true);
+    BVHAggregate soa8(prims, 4, BVHAggregate::SplitMethod::SAH, 8, false, .5f, true);
+    RNG rng(57);
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>();
+
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+        for (const BVHAggregate *b : {&soa, &soa8}) {
+            pstd::optional<ShapeIntersection> siSoA = b->Intersect(ray, tMax);
+            ASSERT_EQ(si.has_value(), siSoA.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siSoA->tHit);
+                EXPECT_EQ(si->intr.p(), siSoA->intr.p());
+            }
+            EXPECT_EQ(bvh.IntersectP(ray, tMax), b->IntersectP(ray, tMax));
+        }
+    }
+}
+
+TEST(BVHAggregate, MeshTrianglePrimitivesMatch) {
+    // Triangles used directly as primitives should give the same results
+    // as the same triangles held by SimplePrimitives.
+    std::vector<PrimitiveHandle> prims = RandomTriangles(3000, .25f);
+    std::vector<PrimitiveHandle> meshPrims;
+    for (PrimitiveHandle prim : prims) {
+        ShapeHandle shape = prim.Cast<SimplePrimitive>()->GetShape();
+        meshPrims.push_back(CreateShapePrimitive(shape, nullptr, nullptr,
+                                                 MediumInterface(), nullptr, {}));
+        EXPECT_TRUE(meshPrims.back().Is<Triangle>());
+    }
+    // The mesh's material can't then be changed.
+    int meshIndex = meshPrims[0].Cast<Triangle>()->MeshIndex();
+    EXPECT_TRUE(MeshMaterials::Set(meshIndex, nullptr));
+    DiffuseMaterial diffuse(nullptr, nullptr, nullptr, nullptr);
+    EXPECT_FALSE(MeshMaterials::Set(meshIndex, &diffuse));
+
+    for (bool soa : {false, true}) {
+        BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, 4, false, .5f, soa);
+        BVHAggregate meshBVH(meshPrims, 4, BVHAggregate::SplitMethod::SAH, 4, false, .5f,
+                             soa);
+        EXPECT_EQ(bvh.HasOnlyOpaqueSurfaces(), meshBVH.HasOnlyOpaqueSurfaces());
+        RNG rng(91);
+        for (int i = 0; i < 10000; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2));
+            Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1));
+            Ray ray(o, d);
+            Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>();
+
+            pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+            pstd::optional<ShapeIntersection> siMesh = meshBVH.Intersect(ray, tMax);
+            ASSERT_EQ(si.has_value(), siMesh.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siMesh->tHit);
+                EXPECT_EQ(si->intr.p(), siMesh->intr.p());
+                EXPECT_EQ(si->intr.material, siMesh->intr.material);
+            }
+            EXPECT_EQ(bvh.IntersectP(ray, tMax), meshBVH.IntersectP(ray, tMax));
+        }
+    }
+}
+
+TEST(BVHAggregate, SoABilinearPatchesMatch) {
+    // Make non-planar bilinear patches and mix them with triangles
+    RNG rng(3);
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < 2000; ++i) {
+        Point3f c(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                  Lerp(rng.Uniform<Float>(), -1, 1));
+        for (int j = 0; j < 4; ++j) {
+            indices.push_back(p.size());
+            p.push_back(c + Vector3f(Lerp(rng.Uniform<Float>(), -.25f, .25f),
+                                     Lerp(rng.Uniform<Float>(), -.25f, .25f),
+                                     Lerp(rng.Uniform<Float>(), -.25f, .25f)));
+        }
+    }
+    static Transform identity;
+    // Leaks...
+    BilinearPatchMesh *mesh =
+        new BilinearPatchMesh(identity, false, indices, p, {}, {}, {}, nullptr);
+    std::vector<PrimitiveHandle> prims = RandomTriangles(1000, .25f);
+    for (ShapeHandle blp : BilinearPatch::CreatePatches(mesh, Allocator())) {
+        if (prims.size() % 2 == 0)
+            prims.push_back(new SimplePrimitive(blp, nullptr));
+        else
+            prims.push_back(
+                new GeometricPrimitive(blp, nullptr, nullptr, MediumInterface()));
+    }
+
+    BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+    BVHAggregate soa(prims, 13, BVHAggregate::SplitMethod::SAH, 2, false, .5f, false,
+                     true);
+    BVHAggregate soaBoth(prims, 4, BVHAggregate::SplitMethod::SAH, 8, false, .5f, true,
+                         true);
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        Ray ray(o, d);
+        Float tMax = (i & 1) ? Infinity : rng.Uniform<Float>();
+
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, tMax);
+        for (const BVHAggregate *b : {&soa, &soaBoth}) {
+            pstd::optional<ShapeIntersection> siSoA = b->Intersect(ray, tMax);
+            ASSERT_EQ(si.has_value(), siSoA.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siSoA->tHit);
+                EXPECT_EQ(si->intr.p(), siSoA->intr.p());
+            }
+            EXPECT_EQ(bvh.IntersectP(ray, tMax), b->IntersectP(ray, tMax));
+        }
+    }
+}
+
+TEST(BVHAggregate, IntersectShadowP) {
+    std::vector<PrimitiveHandle> prims = RandomTriangles(5000, .25f);
+    RNG rng(91);
+    for (int width : {2, 4, 8})
+        for (bool quantize : {false, true}) {
+            BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, width, quantize);
+            // Trace groups of nearby rays so that the cached occluder is
+            // often, but not always, the occluder of the next ray
+            for (int i = 0; i < 1000; ++i) {
+                Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                          Lerp(rng.Uniform<Float>(), -2, 2),
+                          Lerp(rng.Uniform<Float>(), -2, 2));
+                Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1),
+                           Lerp(rng.Uniform<Float>(), -1, 1),
+                           Lerp(rng.Uniform<Float>(), -1, 1));
+                for (int j = 0; j < 8; ++j) {
+                    Ray ray(o, d + Vector3f(Lerp(rng.Uniform<Float>(), -.05f, .05f),
+                                            Lerp(rng.Uniform<Float>(), -.05f, .05f),
+                                            Lerp(rng.Uniform<Float>(), -.05f, .05f)));
+                    Float tMax = (j & 1) ? Infinity : rng.Uniform<Float>();
+                    EXPECT_EQ(bvh.IntersectP(ray, tMax), bvh.IntersectShadowP(ray, tMax));
+                }
+            }
+        }
+
+    // Triangles without materials aren't known to be opaque
+    EXPECT_FALSE(BVHAggregate(prims).HasOnlyOpaqueSurfaces());
+}
+
+TEST(DeferredPrimitive, LoadsWhenBoundsAreHit) {
+    std::vector<PrimitiveHandle> prims = RandomTriangles(1000);
+    BVHAggregate bvh(prims, 4);
+    int nLoads = 0;
+    DeferredPrimitive deferred(bvh.Bounds(), false, [&](Allocator alloc) -> PrimitiveHandle {
+        ++nLoads;
+        return alloc.new_object<BVHAggregate>(prims, 4);
+    });
+    EXPECT_EQ(bvh.Bounds(), deferred.Bounds());
+
+    // Rays that miss the bounds don't cause loading
+    Ray miss(Point3f(0, 0, 5), Vector3f(0, 1, 0));
+    EXPECT_FALSE(deferred.Intersect(miss, Infinity).has_value());
+    EXPECT_FALSE(deferred.IntersectP(miss, Infinity));
+    EXPECT_FALSE(deferred.IsLoaded());
+
+    RNG rng;
+    for (int i = 0; i < 1000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Ray ray(o, Point3f(0, 0, 0) - o);
+        pstd::optional<ShapeIntersection> si = bvh.Intersect(ray, Infinity);
+        pstd::optional<ShapeIntersection> siDeferred = deferred.Intersect(ray, Infinity);
+        ASSERT_EQ(si.has_value(), siDeferred.has_value());
+        if (si) {
+            EXPECT_EQ(si->tHit, siDeferred->tHit);
+        }
+        EXPECT_EQ(bvh.IntersectP(ray, Infinity), deferred.IntersectP(ray, Infinity));
+    }
+    EXPECT_TRUE(deferred.IsLoaded());
+    EXPECT_EQ(1, nLoads);
+}
+
+TEST(DeferredPrimitive, EvictsUnderBudget) {
+    int origBudget = Options->geometryBudgetMB;
+    Options->geometryBudgetMB = 1;
+
+    // Each loaded primitive uses a bit more than the 1MB budget. Like
+    // deferred shapes, each load creates a new mesh; the loaders record
+    // their meshes' indices.
+    int nLoads[2] = {0, 0};
+    std::vector<int> meshIndices[2];
+    auto makeLoader = [&](int index) {
+        return [&, index](Allocator alloc) -> PrimitiveHandle {
+            ++nLoads[index];
+            alloc.allocate_bytes(1 << 20);
+            std::vector<PrimitiveHandle> prims = RandomTriangles(100);
+            ShapeHandle tri = prims[0].Cast<SimplePrimitive>()->GetShape();
+            meshIndices[index].push_back(tri.Cast<Triangle>()->MeshIndex());
+            return alloc.new_object<BVHAggregate>(prims, 4);
+        };
+    };
+    Bounds3f bounds = BVHAggregate(RandomTriangles(100), 4).Bounds();
+    DeferredPrimitive a(bounds, false, makeLoader(0)), b(bounds, false, makeLoader(1));
+
+    Ray ray(Point3f(0, 0, -5), Vector3f(0, 0, 1));
+    pstd::optional<ShapeIntersection> si = a.Intersect(ray, Infinity);
+    EXPECT_TRUE(a.IsLoaded());
+
+    // Loading _b_ evicts _a_, which is loaded again when it's next needed
+    pstd::optional<ShapeIntersection> siB = b.Intersect(ray, Infinity);
+    EXPECT_TRUE(b.IsLoaded());
+    EXPECT_FALSE(a.IsLoaded());
+    pstd::optional<ShapeIntersection> siA = a.Intersect(ray, Infinity);
+    EXPECT_TRUE(a.IsLoaded());
+    EXPECT_FALSE(b.IsLoaded());
+    EXPECT_EQ(2, nLoads[0]);
+    EXPECT_EQ(1, nLoads[1]);
+    // The evicted mesh's index is reused when _a_ is loaded again
+    EXPECT_EQ(meshIndices[0][0], meshIndices[0][1]);
+    EXPECT_NE(meshIndices[0][0], meshIndices[1][0]);
+
+    ASSERT_EQ(si.has_value(), siA.has_value());
+    ASSERT_EQ(si.has_value(), siB.has_value());
+    if (si) {
+        EXPECT_EQ(si->tHit, siA->tHit);
+        EXPECT_EQ(si->tHit, siB->tHit);
+    }
+
+    Options->geometryBudgetMB = origBudget;
+}
+
+TEST(BVHAggregate, Refit) {
+    // Place each triangle with its own transform so that it can be moved
+    std::vector<PrimitiveHandle> triangles = RandomTriangles(5000);
+    std::vector<Transform *> transforms;
+    std::vector<PrimitiveHandle> prims;
+    for (PrimitiveHandle tri : triangles) {
+        // Leaks...
+        transforms.push_back(new Transform);
+        prims.push_back(new TransformedPrimitive(tri, transforms.back()));
+    }
+
+    RNG rng(23);
+    auto checkMatchesRebuilt = [&](const BVHAggregate &bvh) {
+        BVHAggregate rebuilt(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+        for (int i = 0; i < 1000; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2));
+            Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1));
+            Ray ray(o, d);
+            pstd::optional<ShapeIntersection> si = rebuilt.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> siRefit = bvh.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), siRefit.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siRefit->tHit);
+            }
+            EXPECT_EQ(rebuilt.IntersectP(ray, 1), bvh.IntersectP(ray, 1));
+        }
+    };
+
+    for (int width : {2, 4, 8})
+        for (bool quantize : {false, true}) {
+            for (Transform *t : transforms)
+                *t = Transform();
+            BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, width, quantize);
+
+            // Small motions are handled by refitting
+            for (Transform *t : transforms)
+                *t = Translate(Vector3f(Lerp(rng.Uniform<Float>(), -.05f, .05f),
+                                        Lerp(rng.Uniform<Float>(), -.05f, .05f), 0));
+            EXPECT_FALSE(bvh.Refit(Infinity));
+            checkMatchesRebuilt(bvh);
+
+            // Scrambling the triangles degrades the BVH enough to rebuild it
+            for (Transform *t : transforms)
+                *t = Translate(Vector3f(Lerp(rng.Uniform<Float>(), -1, 1),
+                                        Lerp(rng.Uniform<Float>(), -1, 1),
+                                        Lerp(rng.Uniform<Float>(), -1, 1)));
+            EXPECT_TRUE(bvh.Refit(2));
+            checkMatchesRebuilt(bvh);
+        }
+}
+
+TEST(InstanceBVHAggregate, MatchesTransformedPrimitives) {
+    std::vector<PrimitiveHandle> prototypes = {new BVHAggregate(RandomTriangles(200)),
+                                               new BVHAggregate(RandomTriangles(50))};
+    RNG rng(17);
+    std::vector<int> instancePrototypes;
+    std::vector<const Transform *> renderFromInstance;
+    std::vector<PrimitiveHandle> transformedPrims;
+    for (int i = 0; i < 1000; ++i) {
+        Vector3f delta(Lerp(rng.Uniform<Float>(), -10, 10),
+                       Lerp(rng.Uniform<Float>(), -10, 10),
+                       Lerp(rng.Uniform<Float>(), -10, 10));
+        Vector3f axis(rng.Uniform<Float>(), rng.Uniform<Float>(), 1);
+        // Leaks...
+        Transform *t = new Transform(Translate(delta) *
+                                     Rotate(360 * rng.Uniform<Float>(), Normalize(axis)) *
+                                     Scale(1 + rng.Uniform<Float>(), 1, 1));
+        instancePrototypes.push_back(i % 2);
+        renderFromInstance.push_back(t);
+        transformedPrims.push_back(new TransformedPrimitive(prototypes[i % 2], t));
+    }
+    InstanceBVHAggregate instances(prototypes, instancePrototypes, renderFromInstance);
+    BVHAggregate reference(transformedPrims);
+    EXPECT_EQ(reference.Bounds(), instances.Bounds());
+
+    for (int i = 0; i < 10000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -12, 12),
+                  Lerp(rng.Uniform<Float>(), -12, 12),
+                  Lerp(rng.Uniform<Float>(), -12, 12));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        Ray ray(o, d);
+        pstd::optional<ShapeIntersection> si = reference.Intersect(ray, Infinity);
+        pstd::optional<ShapeIntersection> siInstance = instances.Intersect(ray, Infinity);
+        ASSERT_EQ(si.has_value(), siInstance.has_value());
+        if (si) {
+            EXPECT_NEAR(si->tHit, siInstance->tHit, 1e-4f * si->tHit);
+            EXPECT_GT(Dot(Normalize(si->intr.n), Normalize(siInstance->intr.n)), .999f);
+        }
+        EXPECT_EQ(reference.IntersectP(ray, 10), instances.IntersectP(ray, 10));
+    }
+}
+
+TEST(BVHAggregate, RayStreams) {
+    std::vector<PrimitiveHandle> prims = RandomTriangles(10000);
+    BVHAggregate bvh(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+
+    // Trace a stream of coherent rays from a common origin, with the last
+    // packet partially filled
+    RNG rng(5678);
+    int nRays = 20 * BVHAggregate::PacketSize + 3;
+    std::vector<Ray> rays;
+    std::vector<Float> tMax;
+    for (int i = 0; i < nRays; ++i) {
+        Vector3f d(1, Lerp(rng.Uniform<Float>(), -.5f, .5f),
+                   Lerp(rng.Uniform<Float>(), -.5f, .5f));
+        rays.push_back(Ray(Point3f(-2, 0, 0), d));
+        tMax.push_back((i % 3) ? Infinity : Float(2));
+    }
+
+    std::vector<pstd::optional<ShapeIntersection>> si(nRays);
+    bvh.IntersectN(rays, tMax, pstd::MakeSpan(si));
+    std::unique_ptr<bool[]> occluded(new bool[nRays]);
+    bvh.IntersectPN(rays, tMax, pstd::span<bool>(occluded.get(), nRays));
+
+    for (int i = 0; i < nRays; ++i) {
+        pstd::optional<ShapeIntersection> ref = bvh.Intersect(rays[i], tMax[i]);
+        ASSERT_EQ(ref.has_value(), si[i].has_value());
+        if (ref) {
+            EXPECT_EQ(ref->tHit, si[i]->tHit);
+        }
+        EXPECT_EQ(bvh.IntersectP(rays[i], tMax[i]), occluded[i]);
+    }
+}
+
+#ifndef PBRT_IS_WINDOWS
+TEST(BVHAggregate, Cache) {
+    for (const std::string &fn : MatchingFilenames(inTestDir("bvh-")))
+        remove(fn.c_str());
+    std::string origCacheDirectory = Options->bvhCacheDirectory;
+    Options->bvhCacheDirectory = inTestDir(".");
+
+    // The first BVH is built and written to the cache; the second is read from it
+    std::vector<PrimitiveHandle> prims = RandomTriangles(2000);
+    BVHAggregate built(prims, 4, BVHAggregate::SplitMethod::SAH, 4);
+    EXPECT_EQ(1, MatchingFilenames(inTestDir("bvh-")).size());
+    BVHAggregate cached(prims, 4, BVHAggregate::SplitMethod::SAH, 4);
+    EXPECT_EQ(built.Bounds(), cached.Bounds());
+
+    RNG rng(42);
+    for (int i = 0; i < 1000; ++i) {
+        Point3f o(Lerp(rng.Uniform<Float>(), -2, 2), Lerp(rng.Uniform<Float>(), -2, 2),
+                  Lerp(rng.Uniform<Float>(), -2, 2));
+        Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                   Lerp(rng.Uniform<Float>(), -1, 1));
+        Ray ray(o, d);
+        pstd::optional<ShapeIntersection> si = built.Intersect(ray, Infinity);
+        pstd::optional<ShapeIntersection> siCached = cached.Intersect(ray, Infinity);
+        ASSERT_EQ(si.has_value(), siCached.has_value());
+        if (si) {
+            EXPECT_EQ(si->tHit, siCached->tHit);
+        }
+    }
+
+    // Different build parameters don't use the cached BVH
+    BVHAggregate binary(prims, 4, BVHAggregate::SplitMethod::SAH, 2);
+    EXPECT_EQ(2, MatchingFilenames(inTestDir("bvh-")).size());
+
+    Options->bvhCacheDirectory = origCacheDirectory;
+    for (const std::string &fn : MatchingFilenames(inTestDir("bvh-")))
+        EXPECT_EQ(0, remove(fn.c_str()));
+}
+
+TEST(BVHAggregate, SharedCache) {
+    for (const std::string &fn : MatchingFilenames(inTestDir("bvh-")))
+        remove(fn.c_str());
+    std::vector<PrimitiveHandle> prims = RandomTriangles(2000);
+    for (int width : {2, 4}) {
+        BVHAggregate uncached(prims, 4, BVHAggregate::SplitMethod::SAH, width);
+
+        // The BVH that writes the cache then uses the nodes in the file
+        std::string origCacheDirectory = Options->bvhCacheDirectory;
+        Options->bvhCacheDirectory = inTestDir(".");
+        Options->sharedCache = true;
+        BVHAggregate shared(prims, 4, BVHAggregate::SplitMethod::SAH, width);
+        Options->bvhCacheDirectory = origCacheDirectory;
+        Options->sharedCache = false;
+        EXPECT_EQ(uncached.Bounds(), shared.Bounds());
+
+        RNG rng(width);
+        for (int i = 0; i < 1000; ++i) {
+            Point3f o(Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2),
+                      Lerp(rng.Uniform<Float>(), -2, 2));
+            Vector3f d(Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1),
+                       Lerp(rng.Uniform<Float>(), -1, 1));
+            Ray ray(o, d);
+            pstd::optional<ShapeIntersection> si = uncached.Intersect(ray, Infinity);
+            pstd::optional<ShapeIntersection> siShared = shared.Intersect(ray, Infinity);
+            ASSERT_EQ(si.has_value(), siShared.has_value());
+            if (si) {
+                EXPECT_EQ(si->tHit, siShared->tHit);
+            }
+            EXPECT_EQ(uncached.IntersectP(ray, Infinity),
+                      shared.IntersectP(ray, Infinity));
+        }
+    }
+
+    for (const std::string &fn : MatchingFilenames(inTestDir("bvh-")))
+        EXPECT_EQ(0, remove(fn.c_str()));
+}
+#endif  // !PBRT_IS_WINDOWS
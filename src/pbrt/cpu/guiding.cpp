@@ -0,0 +1,270 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/cpu/guiding.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/print.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace pbrt {
+
+// Path Guiding Constants
+// A directional quadrant is subdivided if it has more than this fraction of
+// its tree's energy.
+static constexpr Float QuadtreeSubdivisionThreshold = 0.01f;
+static constexpr int MaxQuadtreeDepth = 20;
+// A spatial leaf is split if it received more than this factor times the
+// square root of the wave's samples per pixel.
+static constexpr Float SpatialSplitFactor = 12000;
+static constexpr int MaxSpatialLeaves = 1 << 16;
+// The radiance cache's grid has this many cells along the scene's largest
+// dimension, which are hashed into a fixed number of cells.
+static constexpr int RadianceCacheResolution = 64;
+static constexpr int RadianceCacheCells = 256 * 1024;
+
+// Returns the quadrant of a node that _p_ is in and remaps _p_ to the
+// quadrant's $[0,1]^2$.
+static int FindQuadrant(Point2f *p) {
+    int q = int(p->x >= 0.5f) | (int(p->y >= 0.5f) << 1);
+    *p = Point2f(std::min(2 * p->x - (q & 1), OneMinusEpsilon),
+                 std::min(2 * p->y - (q >> 1), OneMinusEpsilon));
+    return q;
+}
+
+// DirectionalQuadtree Method Definitions
+void DirectionalQuadtree::Record(Vector3f w, Float value) {
+    Point2f p = EqualAreaSphereToSquare(w);
+    int node = 0;
+    while (true) {
+        // Add _value_ to the quadrant that _w_ is in and descend into it
+        int q = FindQuadrant(&p);
+        nodes[node].sum[q].Add(value);
+        if (!nodes[node].child[q])
+            return;
+        node = nodes[node].child[q];
+    }
+}
+
+Vector3f DirectionalQuadtree::Sample(Point2f u) const {
+    Point2f pMin(0, 0);
+    Float size = 1;
+    int node = 0;
+    while (true) {
+        // Choose a column of quadrants and then one of its quadrants
+        const Node &n = nodes[node];
+        Float sum[4] = {n.sum[0], n.sum[1], n.sum[2], n.sum[3]};
+        Float total = sum[0] + sum[1] + sum[2] + sum[3];
+        DCHECK_GT(total, 0);
+        Float left = sum[0] + sum[2];
+        int qx = 1;
+        if (u[0] * total < left || left == total) {
+            qx = 0;
+            u[0] = u[0] * total / left;
+        } else
+            u[0] = (u[0] * total - left) / (total - left);
+        Float bottom = sum[qx], column = sum[qx] + sum[qx + 2];
+        int qy = 1;
+        if (u[1] * column < bottom || bottom == column) {
+            qy = 0;
+            u[1] = u[1] * column / bottom;
+        } else
+            u[1] = (u[1] * column - bottom) / (column - bottom);
+        u = Point2f(std::min(u[0], OneMinusEpsilon), std::min(u[1], OneMinusEpsilon));
+
+        // Descend into the quadrant or sample it uniformly if it's a leaf
+        size /= 2;
+        pMin += Vector2f(qx * size, qy * size);
+        int child = n.child[qx + 2 * qy];
+        if (!child)
+            return EqualAreaSquareToSphere(pMin + size * Vector2f(u));
+        node = child;
+    }
+}
+
+Float DirectionalQuadtree::PDF(Vector3f w) const {
+    // The equal-area mapping takes the unit square to $4\pi$ steradians
+    Float pdf = Inv4Pi;
+    Point2f p = EqualAreaSphereToSquare(w);
+    int node = 0;
+    while (true) {
+        const Node &n = nodes[node];
+        Float total = n.Total();
+        if (total == 0)
+            return 0;
+        int q = FindQuadrant(&p);
+        pdf *= 4 * n.sum[q] / total;
+        if (!n.child[q])
+            return pdf;
+        node = n.child[q];
+    }
+}
+
+DirectionalQuadtree DirectionalQuadtree::Refined(Float threshold, int maxDepth) const {
+    DirectionalQuadtree tree;
+    Float total = Total();
+    // Each entry gives a node of the refined tree, the corresponding node of
+    // this one or -1 if there is none, and the energy of its quadrants, which
+    // is divided evenly among the quadrants of new nodes.
+    struct Entry {
+        int node, source, depth;
+        Float sum[4];
+    };
+    Entry root{0, 0, 1, {nodes[0].sum[0], nodes[0].sum[1], nodes[0].sum[2],
+                         nodes[0].sum[3]}};
+    std::vector<Entry> stack(1, root);
+    while (!stack.empty()) {
+        Entry e = stack.back();
+        stack.pop_back();
+        for (int q = 0; q < 4; ++q) {
+            if (e.depth == maxDepth || !(e.sum[q] > threshold * total))
+                continue;
+            // Subdivide quadrant _q_ of the refined node
+            int child = tree.nodes.size();
+            tree.nodes.emplace_back();
+            tree.nodes[e.node].child[q] = child;
+            Entry c{child, -1, e.depth + 1, {}};
+            if (e.source >= 0 && nodes[e.source].child[q]) {
+                c.source = nodes[e.source].child[q];
+                for (int i = 0; i < 4; ++i)
+                    c.sum[i] = nodes[c.source].sum[i];
+            } else
+                for (int i = 0; i < 4; ++i)
+                    c.sum[i] = e.sum[q] / 4;
+            stack.push_back(c);
+        }
+    }
+    return tree;
+}
+
+// SDTree Method Definitions
+SDTree::SDTree(const Bounds3f &sceneBounds) {
+    // Make the tree's bounds a cube so that its leaves stay roughly cubical
+    Point3f center(0, 0, 0);
+    Float extent = 1e-3f;
+    if (!sceneBounds.IsDegenerate()) {
+        center = (sceneBounds.pMin + sceneBounds.pMax) / 2;
+        extent = std::max(extent, MaxComponentValue(sceneBounds.Diagonal()));
+    }
+    bounds = Bounds3f(center - Vector3f(extent, extent, extent) / 2,
+                      center + Vector3f(extent, extent, extent) / 2);
+
+    nodes.push_back(Node{0, {0, 0}, 0});
+    leaves.emplace_back();
+}
+
+SDTree::Leaf *SDTree::Lookup(Point3f p) {
+    Vector3f o = bounds.Offset(p);
+    Point3f q(Clamp(o.x, 0, 1), Clamp(o.y, 0, 1), Clamp(o.z, 0, 1));
+    int node = 0;
+    while (nodes[node].leaf < 0) {
+        // Descend into the half of the node that _q_ is in
+        const Node &n = nodes[node];
+        if (q[n.axis] < 0.5f) {
+            q[n.axis] *= 2;
+            node = n.children[0];
+        } else {
+            q[n.axis] = 2 * q[n.axis] - 1;
+            node = n.children[1];
+        }
+    }
+    return &leaves[nodes[node].leaf];
+}
+
+void SDTree::Record(Leaf *leaf, Vector3f wi, Float Li, Float pdf) {
+    if (pdf == 0 || IsInf(Li) || IsNaN(Li))
+        return;
+    ++leaf->nSamples;
+    if (Li > 0)
+        leaf->building.Record(wi, Li / pdf);
+}
+
+void SDTree::Update(int waveSamples) {
+    // Split leaves that received many samples, along each axis in turn
+    Float splitThreshold = SpatialSplitFactor * std::sqrt(Float(waveSamples));
+    for (size_t i = 0; i < nodes.size() && leaves.size() < MaxSpatialLeaves; ++i) {
+        if (nodes[i].leaf < 0 || leaves[nodes[i].leaf].nSamples <= splitThreshold)
+            continue;
+        // Give both children a copy of the leaf's distributions and half of its
+        // samples; they are checked again when the loop reaches them.
+        Leaf &leaf = leaves[nodes[i].leaf];
+        Leaf &split = leaves.emplace_back();
+        split.sampling = leaf.sampling;
+        split.building = leaf.building;
+        leaf.nSamples = leaf.nSamples / 2;
+        split.nSamples = int(leaf.nSamples);
+
+        int axis = nodes[i].axis, childAxis = (axis + 1) % 3;
+        int firstChild = nodes.size();
+        nodes.push_back(Node{childAxis, {0, 0}, nodes[i].leaf});
+        nodes.push_back(Node{childAxis, {0, 0}, int(leaves.size()) - 1});
+        nodes[i] = Node{axis, {firstChild, firstChild + 1}, -1};
+    }
+
+    // Sample from the recorded distributions and refine their successors
+    ParallelFor(0, leaves.size(), [&](int64_t i) {
+        Leaf &leaf = leaves[i];
+        // Leaves that recorded nothing keep their previous distribution
+        if (leaf.building.Total() > 0)
+            leaf.sampling = leaf.building;
+        leaf.building =
+            leaf.sampling.Refined(QuadtreeSubdivisionThreshold, MaxQuadtreeDepth);
+        leaf.nSamples = 0;
+    });
+}
+
+std::string SDTree::ToString() const {
+    return StringPrintf("[ SDTree bounds: %s nodes: %d leaves: %d ]", bounds,
+                        nodes.size(), leaves.size());
+}
+
+// RadianceCache Method Definitions
+RadianceCache::RadianceCache(const Bounds3f &sceneBounds)
+    : cells(new Cell[RadianceCacheCells]) {
+    gridOrigin = sceneBounds.IsDegenerate() ? Point3f(0, 0, 0) : sceneBounds.pMin;
+    Float extent =
+        sceneBounds.IsDegenerate() ? 0 : MaxComponentValue(sceneBounds.Diagonal());
+    invCellSize = RadianceCacheResolution / std::max<Float>(extent, 1e-3f);
+}
+
+RadianceCache::Cell &RadianceCache::LookupCell(Point3f p) const {
+    Vector3f v = (p - gridOrigin) * invCellSize;
+    uint64_t h = Hash(int(std::floor(v.x)), int(std::floor(v.y)), int(std::floor(v.z)));
+    return cells[h % RadianceCacheCells];
+}
+
+void RadianceCache::Record(Point3f p, Float L) {
+    if (IsNaN(L) || IsInf(L))
+        return;
+    Cell &cell = LookupCell(p);
+    cell.sum.Add(L);
+    ++cell.count;
+}
+
+pstd::optional<Float> RadianceCache::Lookup(Point3f p) const {
+    Float estimate = LookupCell(p).estimate;
+    if (estimate < 0)
+        return {};
+    return estimate;
+}
+
+void RadianceCache::Update() {
+    // Average all the samples recorded in each cell so far
+    ParallelFor(0, RadianceCacheCells, [&](int64_t i) {
+        Cell &cell = cells[i];
+        if (int count = cell.count; count > 0)
+            cell.estimate = cell.sum / count;
+    });
+}
+
+std::string RadianceCache::ToString() const {
+    return StringPrintf("[ RadianceCache gridOrigin: %s invCellSize: %f ]", gridOrigin,
+                        invCellSize);
+}
+
+}  // namespace pbrt
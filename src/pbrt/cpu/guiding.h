@@ -0,0 +1,153 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_CPU_GUIDING_H
+#define PBRT_CPU_GUIDING_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/vecmath.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pbrt {
+
+// DirectionalQuadtree Definition
+// Piecewise-constant distribution over the sphere of directions, stored as a
+// quadtree over their equal-area square parameterization. Each node stores
+// the energy of its four quadrants. _Record()_ may be called concurrently
+// with itself and with the const methods, but not with anything else.
+class DirectionalQuadtree {
+  public:
+    // DirectionalQuadtree Public Methods
+    DirectionalQuadtree() : nodes(1) {}
+
+    void Record(Vector3f w, Float value);
+
+    Float Total() const { return nodes[0].Total(); }
+    // The tree must have nonzero energy for _Sample()_ to be called.
+    Vector3f Sample(Point2f u) const;
+    Float PDF(Vector3f w) const;
+
+    // Returns a tree without energy whose quadrants are subdivided until
+    // each has at most _threshold_ of this tree's energy or is _maxDepth_
+    // levels deep.
+    DirectionalQuadtree Refined(Float threshold, int maxDepth) const;
+
+    size_t NumNodes() const { return nodes.size(); }
+
+  private:
+    // DirectionalQuadtree::Node Definition
+    // Quadrant _i_ is the upper half of the node's area in $x$ if _i_ & 1 is
+    // set and in $y$ if _i_ & 2 is; a zero _child_ marks a leaf quadrant.
+    struct Node {
+        Node() = default;
+        Node(const Node &n) { *this = n; }
+        Node &operator=(const Node &n) {
+            for (int i = 0; i < 4; ++i) {
+                sum[i] = Float(n.sum[i]);
+                child[i] = n.child[i];
+            }
+            return *this;
+        }
+        Float Total() const { return sum[0] + sum[1] + sum[2] + sum[3]; }
+
+        AtomicFloat sum[4];
+        int child[4] = {0, 0, 0, 0};
+    };
+
+    // DirectionalQuadtree Private Members
+    std::vector<Node> nodes;
+};
+
+// SDTree Definition
+// Path guiding distribution that adapts to the radiance that paths find, from
+// Müller et al.'s "Practical Path Guiding for Efficient Light-Transport
+// Simulation." A binary tree over the scene's bounds has a pair of
+// _DirectionalQuadtree_s at each leaf: one that is sampled from and one that
+// records the current wave's samples, which replaces it at the end of the
+// wave.
+class SDTree {
+  public:
+    // SDTree::Leaf Definition
+    struct Leaf {
+        DirectionalQuadtree sampling, building;
+        std::atomic<int> nSamples{0};
+    };
+
+    // SDTree Public Methods
+    SDTree(const Bounds3f &sceneBounds);
+
+    Leaf *Lookup(Point3f p);
+    // Records incident radiance _Li_ along _wi_ at a leaf, where _wi_ was
+    // sampled with density _pdf_. May be called concurrently.
+    static void Record(Leaf *leaf, Vector3f wi, Float Li, Float pdf);
+
+    // Starts sampling the distributions recorded since the last call and
+    // refines the tree, given the number of samples per pixel that were
+    // taken since then.
+    void Update(int waveSamples);
+
+    std::string ToString() const;
+
+  private:
+    // SDTree::Node Definition
+    struct Node {
+        int axis;
+        int children[2];
+        // Index into _leaves_, or -1 for interior nodes
+        int leaf;
+    };
+
+    // SDTree Private Members
+    Bounds3f bounds;
+    std::vector<Node> nodes;
+    // A deque keeps pointers to leaves valid as the tree grows.
+    std::deque<Leaf> leaves;
+};
+
+// RadianceCache Definition
+// Coarse estimate of the radiance leaving surfaces, averaged over directions
+// in the cells of a spatial hash grid over the scene. _Record()_ may be called
+// concurrently with itself and with _Lookup()_, which only returns what was
+// recorded before the last call to _Update()_.
+class RadianceCache {
+  public:
+    // RadianceCache Public Methods
+    RadianceCache(const Bounds3f &sceneBounds);
+
+    void Record(Point3f p, Float L);
+    pstd::optional<Float> Lookup(Point3f p) const;
+    void Update();
+
+    std::string ToString() const;
+
+  private:
+    // RadianceCache::Cell Definition
+    struct Cell {
+        AtomicFloat sum;
+        std::atomic<int> count{0};
+        // Average of the samples recorded before the last update, or -1 if
+        // there were none
+        Float estimate = -1;
+    };
+
+    // RadianceCache Private Methods
+    Cell &LookupCell(Point3f p) const;
+
+    // RadianceCache Private Members
+    Point3f gridOrigin;
+    Float invCellSize;
+    std::unique_ptr<Cell[]> cells;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CPU_GUIDING_H
@@ -0,0 +1,101 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/cpu/guiding.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+
+using namespace pbrt;
+
+// Returns a quadtree that has recorded samples clustered around +z, after
+// one round of refinement
+static DirectionalQuadtree ClusteredQuadtree() {
+    RNG rng;
+    DirectionalQuadtree tree;
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1)
+            tree = tree.Refined(0.01f, 20);
+        for (int i = 0; i < 10000; ++i) {
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Vector3f w = SampleUniformCone(u, 0.9f);
+            tree.Record(w, 1);
+        }
+    }
+    return tree;
+}
+
+TEST(DirectionalQuadtree, PDFIsNormalized) {
+    DirectionalQuadtree tree = ClusteredQuadtree();
+    EXPECT_GT(tree.NumNodes(), 1);
+
+    RNG rng;
+    double sum = 0;
+    int n = 100000;
+    for (int i = 0; i < n; ++i) {
+        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+        sum += tree.PDF(SampleUniformSphere(u)) / UniformSpherePDF();
+    }
+    EXPECT_NEAR(1, sum / n, 0.02);
+}
+
+TEST(DirectionalQuadtree, SamplesFollowEnergy) {
+    DirectionalQuadtree tree = ClusteredQuadtree();
+
+    RNG rng;
+    int nInCone = 0, n = 10000;
+    for (int i = 0; i < n; ++i) {
+        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+        Vector3f w = tree.Sample(u);
+        EXPECT_GT(tree.PDF(w), 0);
+        if (w.z > 0.85f)
+            ++nInCone;
+    }
+    // The quadtree's leaves only approximate the cone, but most samples
+    // should be close to it.
+    EXPECT_GT(nInCone, 0.8f * n);
+}
+
+TEST(SDTree, SplitsWhereSamplesAre) {
+    SDTree tree(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)));
+    RNG rng;
+    // Record samples in the $x<0.5$ half of the bounds for two waves, so
+    // that the second refines the directional distributions
+    for (int wave = 0; wave < 2; ++wave) {
+        for (int i = 0; i < 100000; ++i) {
+            Point3f p(0.5f * rng.Uniform<Float>(), rng.Uniform<Float>(),
+                      rng.Uniform<Float>());
+            SDTree::Record(tree.Lookup(p), Vector3f(0, 0, 1), 1, 1);
+        }
+        tree.Update(1);
+    }
+
+    // The half with the samples should have been split and the leaves there
+    // should sample the recorded direction.
+    SDTree::Leaf *a = tree.Lookup(Point3f(0.1f, 0.1f, 0.1f));
+    SDTree::Leaf *b = tree.Lookup(Point3f(0.4f, 0.9f, 0.9f));
+    EXPECT_NE(a, b);
+    for (SDTree::Leaf *leaf : {a, b}) {
+        ASSERT_GT(leaf->sampling.Total(), 0);
+        EXPECT_GT(leaf->sampling.Sample(Point2f(0.5f, 0.5f)).z, 0.9f);
+        EXPECT_EQ(0, leaf->building.Total());
+    }
+}
+
+TEST(RadianceCache, AveragesRecordedRadiance) {
+    RadianceCache cache(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1)));
+    Point3f p(0.25f, 0.5f, 0.5f), q(0.75f, 0.5f, 0.5f);
+    cache.Record(p, 1);
+    cache.Record(p, 3);
+    // Nothing is available until the cache is updated
+    EXPECT_FALSE(cache.Lookup(p).has_value());
+
+    cache.Update();
+    ASSERT_TRUE(cache.Lookup(p).has_value());
+    EXPECT_FLOAT_EQ(2, *cache.Lookup(p));
+    EXPECT_FALSE(cache.Lookup(q).has_value());
+}
@@ -7,6 +7,7 @@
 #include <pbrt/bsdf.h>
 #include <pbrt/bssrdf.h>
 #include <pbrt/cameras.h>
+#include <pbrt/cpu/aggregates.h>
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
 #include <pbrt/interaction.h>
@@ -16,6 +17,7 @@
 #include <pbrt/paramdict.h>
 #include <pbrt/samplers.h>
 #include <pbrt/shapes.h>
+#include <pbrt/util/bits.h>
 #include <pbrt/util/bluenoise.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/color.h>
@@ -30,6 +32,7 @@
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
+#include <pbrt/util/perfcounters.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/progressreporter.h>
 #include <pbrt/util/pstd.h>
@@ -38,6 +41,16 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 namespace pbrt {
 
@@ -59,8 +72,291 @@ std::string RandomWalkIntegrator::ToString() const {
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
+static CancellationToken renderCancellation;
+
+void CancelRender() {
+    renderCancellation.Cancel();
+}
+
+void ResetRenderCancellation() {
+    renderCancellation.Reset();
+}
+
+// TileScheduler Definition
+// TileScheduler distributes the image tiles for each wave of pixel samples
+// to the threads. It records how long each tile took in the previous wave
+// so that the most expensive tiles can be started first and tiles that
+// would otherwise dominate the end of a wave can be subdivided. Tiles of
+// similar cost are handed out in Morton order for coherence. Only the order
+// in which pixels are rendered changes, so results are unaffected.
+class TileScheduler {
+  public:
+    // TileScheduler Public Methods
+    TileScheduler(const Bounds2i &pixelBounds);
+
+    // Work that hasn't started when _cancel_ is cancelled is skipped.
+    void RenderWave(int nSamples, std::function<void(Bounds2i)> func,
+                    const CancellationToken *cancel = nullptr);
+
+  private:
+    // TileScheduler Private Members
+    std::vector<Bounds2i> tiles;
+    // Seconds per pixel sample measured for each tile in the last wave
+    std::vector<double> tileSampleCost;
+};
+
+// TileScheduler Method Definitions
+TileScheduler::TileScheduler(const Bounds2i &pixelBounds) {
+    // Use the same tile size heuristic as _ParallelFor2D()_
+    int tileSize = Clamp(int(std::sqrt(pixelBounds.Diagonal().x *
+                                       pixelBounds.Diagonal().y /
+                                       (8 * RunningThreads()))),
+                         1, 32);
+
+    // Create tiles and sort them in Morton order
+    std::vector<std::pair<uint64_t, Bounds2i>> mortonTiles;
+    for (int y = pixelBounds.pMin.y; y < pixelBounds.pMax.y; y += tileSize)
+        for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; x += tileSize) {
+            Bounds2i b = Intersect(
+                Bounds2i(Point2i(x, y), Point2i(x + tileSize, y + tileSize)),
+                pixelBounds);
+            uint32_t tx = (x - pixelBounds.pMin.x) / tileSize;
+            uint32_t ty = (y - pixelBounds.pMin.y) / tileSize;
+            mortonTiles.push_back({EncodeMorton2(tx, ty), b});
+        }
+    std::sort(mortonTiles.begin(), mortonTiles.end(),
+              [](const auto &a, const auto &b) { return a.first < b.first; });
+    for (const auto &mt : mortonTiles)
+        tiles.push_back(mt.second);
+
+    tileSampleCost.resize(tiles.size(), 0.);
+}
+
+void TileScheduler::RenderWave(int nSamples, std::function<void(Bounds2i)> func,
+                               const CancellationToken *cancel) {
+    // Estimate the cost of each tile for this wave
+    bool haveCosts = std::any_of(tileSampleCost.begin(), tileSampleCost.end(),
+                                 [](double c) { return c > 0; });
+    std::vector<double> tileCost(tiles.size());
+    double totalCost = 0;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        // Assume uniform per-sample cost before the first wave has been timed
+        double sampleCost = haveCosts ? tileSampleCost[i] : 1.;
+        tileCost[i] = sampleCost * tiles[i].Area() * nSamples;
+        totalCost += tileCost[i];
+    }
+
+    // Split tiles whose cost is a large fraction of a thread's share
+    struct TileWork {
+        Bounds2i bounds;
+        int tileIndex;
+        double cost;
+    };
+    std::vector<TileWork> work;
+    double maxWorkCost = totalCost / (8 * RunningThreads());
+    std::function<void(Bounds2i, int, double)> addWork = [&](Bounds2i b, int tileIndex,
+                                                              double cost) {
+        if (cost <= maxWorkCost || b.Area() <= 4) {
+            work.push_back({b, tileIndex, cost});
+            return;
+        }
+        Point2i pMid = (b.pMin + b.pMax) / 2;
+        for (int y = 0; y < 2; ++y)
+            for (int x = 0; x < 2; ++x) {
+                Bounds2i sub(Point2i(x == 0 ? b.pMin.x : pMid.x,
+                                     y == 0 ? b.pMin.y : pMid.y),
+                             Point2i(x == 0 ? pMid.x : b.pMax.x,
+                                     y == 0 ? pMid.y : b.pMax.y));
+                if (!sub.IsEmpty())
+                    addWork(sub, tileIndex, cost * sub.Area() / b.Area());
+            }
+    };
+    for (size_t i = 0; i < tiles.size(); ++i)
+        addWork(tiles[i], i, tileCost[i]);
+
+    // Order work from most to least expensive, grouping by powers of two so
+    // that Morton order is maintained among tiles with similar costs
+    if (haveCosts) {
+        auto costBucket = [](double cost) {
+            return int(std::floor(std::log2(std::max(cost, 1e-12))));
+        };
+        std::stable_sort(work.begin(), work.end(),
+                         [&](const TileWork &a, const TileWork &b) {
+                             return costBucket(a.cost) > costBucket(b.cost);
+                         });
+    }
+
+    // Have each thread repeatedly take the next unstarted piece of work
+    std::vector<std::atomic<int64_t>> tileNanoseconds(tiles.size());
+    for (auto &ns : tileNanoseconds)
+        ns = 0;
+    std::atomic<size_t> nextWork{0};
+    ParallelFor(0, RunningThreads(), [&](int64_t) {
+        size_t index;
+        while ((index = nextWork++) < work.size()) {
+            if (cancel && cancel->IsCancelled())
+                break;
+            auto start = std::chrono::steady_clock::now();
+            func(work[index].bounds);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            tileNanoseconds[work[index].tileIndex] +=
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        }
+    });
+
+    // Record per-sample costs of tiles for the next wave
+    for (size_t i = 0; i < tiles.size(); ++i)
+        tileSampleCost[i] =
+            std::max<double>(1e-12, 1e-9 * tileNanoseconds[i] /
+                                        (double(tiles[i].Area()) * nSamples));
+}
+
+// RenderCheckpointHeader Definition
+// Render checkpoints store this header followed by the film's state. Since
+// samplers generate the same samples for a given pixel sample index, the
+// film and wave state are all that is needed to continue a render.
+struct RenderCheckpointHeader {
+    char magic[8];
+    int32_t version;
+    int32_t pixelBounds[4];
+    int32_t spp, seed;
+    int32_t waveStart, waveEnd, nextWaveSize;
+};
+
+static constexpr int32_t RenderCheckpointVersion = 1;
+
+static RenderCheckpointHeader makeCheckpointHeader(Bounds2i pixelBounds, int spp) {
+    RenderCheckpointHeader header = {};
+    std::memcpy(header.magic, "pbrtckp", 8);
+    header.version = RenderCheckpointVersion;
+    header.pixelBounds[0] = pixelBounds.pMin.x;
+    header.pixelBounds[1] = pixelBounds.pMin.y;
+    header.pixelBounds[2] = pixelBounds.pMax.x;
+    header.pixelBounds[3] = pixelBounds.pMax.y;
+    header.spp = spp;
+    header.seed = Options->seed;
+    return header;
+}
+
+// Restores _film_ from the checkpoint in _filename_ and returns its header
+// in _header_; returns false if the checkpoint doesn't match the render.
+static bool readCheckpoint(const std::string &filename, FilmHandle film, int spp,
+                           RenderCheckpointHeader *header) {
+    std::string contents = ReadFileContents(filename);
+    RenderCheckpointHeader expected = makeCheckpointHeader(film.PixelBounds(), spp);
+    if (contents.size() < sizeof(*header)) {
+        Warning("%s: ignoring truncated render checkpoint.", filename);
+        return false;
+    }
+    std::memcpy(header, contents.data(), sizeof(*header));
+    if (std::memcmp(header->magic, expected.magic, 8) != 0 ||
+        header->version != expected.version) {
+        Warning("%s: ignoring corrupt render checkpoint.", filename);
+        return false;
+    }
+    if (std::memcmp(header->pixelBounds, expected.pixelBounds,
+                    sizeof(expected.pixelBounds)) != 0 ||
+        header->spp != expected.spp || header->seed != expected.seed ||
+        header->waveStart < 0 || header->waveEnd <= header->waveStart ||
+        header->waveEnd > spp || header->nextWaveSize < 1) {
+        Warning("%s: ignoring render checkpoint with different pixel bounds, "
+                "sample count, or seed.",
+                filename);
+        return false;
+    }
+
+    film.RestoreState(contents.substr(sizeof(*header)));
+    return true;
+}
+
+static void writeCheckpoint(const std::string &filename, const std::string &contents) {
+    if (!WriteFileAtomic(filename, contents)) {
+        Warning("%s: unable to write render checkpoint.", filename);
+        return;
+    }
+    LOG_VERBOSE("Wrote render checkpoint %s", filename);
+}
+
+// DistributedRenderHeader Definition
+// In a distributed render, the image is divided into jobs, each a square
+// region of pixels and a range of their samples. The coordinator writes this
+// header to the shared directory's "manifest" file; every process then
+// claims jobs by exclusively creating "job<n>.claim" files and writes the
+// film state of each job that it renders to "job<n>.film". The coordinator
+// merges the jobs' film states in job order, so the result doesn't depend on
+// which process rendered each job.
+struct DistributedRenderHeader {
+    char magic[8];
+    int32_t version;
+    int32_t pixelBounds[4];
+    int32_t spp, seed;
+    int32_t jobSize, sampleSplits;
+};
+
+static constexpr int32_t DistributedRenderVersion = 1;
+static constexpr int DistributedJobSize = 128;
+
+static DistributedRenderHeader makeDistributedHeader(Bounds2i pixelBounds, int spp,
+                                                     int sampleSplits) {
+    DistributedRenderHeader header = {};
+    std::memcpy(header.magic, "pbrtdst", 8);
+    header.version = DistributedRenderVersion;
+    header.pixelBounds[0] = pixelBounds.pMin.x;
+    header.pixelBounds[1] = pixelBounds.pMin.y;
+    header.pixelBounds[2] = pixelBounds.pMax.x;
+    header.pixelBounds[3] = pixelBounds.pMax.y;
+    header.spp = spp;
+    header.seed = Options->seed;
+    header.jobSize = DistributedJobSize;
+    header.sampleSplits = sampleSplits;
+    return header;
+}
+
+// Returns the pixel bounds and sample range of job _jobIndex_; jobs are
+// ordered by region, and then by sample range within each region.
+static void getDistributedJob(const Bounds2i &pixelBounds, int spp, int sampleSplits,
+                              int jobIndex, Bounds2i *bounds, int *sampleStart,
+                              int *sampleEnd) {
+    int nRegionsX = (pixelBounds.Diagonal().x + DistributedJobSize - 1) /
+                    DistributedJobSize;
+    int region = jobIndex / sampleSplits, split = jobIndex % sampleSplits;
+    Point2i pMin(pixelBounds.pMin.x + (region % nRegionsX) * DistributedJobSize,
+                 pixelBounds.pMin.y + (region / nRegionsX) * DistributedJobSize);
+    *bounds = Intersect(Bounds2i(pMin, pMin + Vector2i(DistributedJobSize,
+                                                       DistributedJobSize)),
+                        pixelBounds);
+    *sampleStart = int64_t(spp) * split / sampleSplits;
+    *sampleEnd = int64_t(spp) * (split + 1) / sampleSplits;
+}
+
+static int numDistributedJobs(const Bounds2i &pixelBounds, int sampleSplits) {
+    Vector2i d = pixelBounds.Diagonal();
+    return ((d.x + DistributedJobSize - 1) / DistributedJobSize) *
+           ((d.y + DistributedJobSize - 1) / DistributedJobSize) * sampleSplits;
+}
+
+static std::string distributedJobFilename(int jobIndex, const char *extension) {
+    return StringPrintf("%s/job%d.%s", Options->distributedDirectory, jobIndex,
+                        extension);
+}
+
+// Returns true if this process created _filename_ and thus claimed its job.
+static bool claimDistributedJob(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "wx");
+    if (!f)
+        return false;
+    fclose(f);
+    return true;
+}
+
 // ImageTileIntegrator Method Definitions
+// Pixel sample currently being evaluated by each thread, for error messages
+static thread_local Point2i threadPixel;
+static thread_local int threadSampleIndex;
+
 void ImageTileIntegrator::Render() {
+    BeginRender();
+
     // Handle debugStart, if set
     if (!Options->debugStart.empty()) {
         std::vector<int> c = SplitStringToInts(Options->debugStart, ',');
@@ -75,7 +371,7 @@ void ImageTileIntegrator::Render() {
         int sampleIndex = c[2];
 
         ScratchBuffer scratchBuffer(65536);
-        SamplerHandle tileSampler = samplerPrototype.Clone(1, Allocator())[0];
+        SamplerHandle tileSampler = samplerPrototype.Clone(1, IntegratorAllocator())[0];
         tileSampler.StartPixelSample(pPixel, sampleIndex);
 
         EvaluatePixelSample(pPixel, sampleIndex, tileSampler, scratchBuffer);
@@ -83,8 +379,6 @@ void ImageTileIntegrator::Render() {
         return;
     }
 
-    thread_local Point2i threadPixel;
-    thread_local int threadSampleIndex;
     CheckCallbackScope _([&]() {
         return StringPrintf("Rendering failed at pixel (%d, %d) sample %d. Debug with "
                             "\"--debugstart %d,%d,%d\"\n",
@@ -93,184 +387,782 @@ void ImageTileIntegrator::Render() {
     });
 
     // Declare common variables for rendering image in tiles
-    std::vector<ScratchBuffer> scratchBuffers;
-    for (int i = 0; i < MaxThreadIndex(); ++i)
-        scratchBuffers.push_back(ScratchBuffer(65536));
+    ThreadLocal<ScratchBuffer> scratchBuffers([]() { return ScratchBuffer(65536); });
 
-    std::vector<SamplerHandle> samplers = samplerPrototype.Clone(MaxThreadIndex());
+    ThreadLocal<SamplerHandle> samplers(
+        [this]() { return samplerPrototype.Clone(1, IntegratorAllocator())[0]; });
 
     Bounds2i pixelBounds = camera.GetFilm().PixelBounds();
     int spp = samplerPrototype.SamplesPerPixel();
     ProgressReporter progress(int64_t(spp) * pixelBounds.Area(), "Rendering",
                               Options->quiet);
+    progress.SetSamplesPerWorkUnit(1);
+    // Only count the work that is reported, in the "cost" AOV or as the
+    // progress reporter's ray rates
+    bool recordCost = camera.GetFilm().RequestedAOVs() & AOVFlags::Cost;
+    countRays = recordCost || !progress.Quiet();
+    countTraversalSteps = recordCost;
 
     int waveStart = 0, waveEnd = 1, nextWaveSize = 1;
+    // Streaming films write each tile when it finishes, so render all of
+    // the samples in a single wave
+    bool streamingFilm = camera.GetFilm().IsStreaming();
+    if (streamingFilm)
+        waveEnd = spp;
+
+    // Render jobs of a distributed render, if requested
+    if (!Options->distributedDirectory.empty()) {
+        if (streamingFilm)
+            ErrorExit("Distributed rendering isn't supported with streaming films.");
+        RenderDistributed(scratchBuffers, samplers, progress);
+        return;
+    }
+
+    // Resume rendering from a checkpoint, if requested
+    std::string checkpointFilename = camera.GetFilm().GetFilename() + ".checkpoint";
+    bool checkpointing = Options->checkpointInterval > 0 || Options->resume;
+    if (checkpointing && streamingFilm)
+        ErrorExit("--checkpoint and --resume aren't supported with streaming films.");
+
+    // Allocate per-pixel statistics for adaptive sampling; pixels keep
+    // receiving their samples in order until they converge, so each pixel's
+    // samples are a prefix of the sampler's sample indices.
+    bool adaptive = Options->adaptiveThreshold > 0;
+    if (adaptive && (streamingFilm || checkpointing))
+        ErrorExit("--adaptive isn't supported with streaming films, --checkpoint, "
+                  "or --resume.");
+    // Time and error budgets are checked between waves, so they need
+    // more than one of them; --target-error also needs the pixel statistics.
+    bool targetError = Options->targetError > 0;
+    if (streamingFilm && (Options->timeLimit > 0 || targetError))
+        ErrorExit("--time-limit and --target-error aren't supported with streaming "
+                  "films.");
+    if (targetError && checkpointing)
+        ErrorExit("--target-error isn't supported with --checkpoint or --resume.");
+    if (adaptive || targetError)
+        pixelVariance = Array2D<VarianceEstimator<Float>>(pixelBounds);
+    if (Options->resume) {
+        RenderCheckpointHeader header;
+        if (!FileExists(checkpointFilename))
+            Warning("%s: no render checkpoint found; starting from the beginning.",
+                    checkpointFilename);
+        else if (readCheckpoint(checkpointFilename, camera.GetFilm(), spp, &header)) {
+            waveStart = header.waveStart;
+            waveEnd = header.waveEnd;
+            nextWaveSize = header.nextWaveSize;
+            progress.Update(int64_t(waveStart) * pixelBounds.Area());
+            LOG_VERBOSE("Resuming render from checkpoint at spp = %d", waveStart);
+        }
+    }
+    Timer checkpointTimer;
+    Future<void> checkpointWrite;
+    // Partial image being written in the background, if any
+    Future<void> imageWrite;
 
     if (Options->recordPixelStatistics)
         StatsEnablePixelStats(pixelBounds,
                               RemoveExtension(camera.GetFilm().GetFilename()));
     // Handle MSE reference image, if provided
-    pstd::optional<Image> referenceImage;
-    FILE *mseOutFile = nullptr;
-    if (!Options->mseReferenceImage.empty()) {
-        auto mse = Image::Read(Options->mseReferenceImage);
-        referenceImage = mse.image;
-
-        Bounds2i msePixelBounds =
-            mse.metadata.pixelBounds
-                ? *mse.metadata.pixelBounds
-                : Bounds2i(Point2i(0, 0), referenceImage->Resolution());
-        if (!Inside(pixelBounds, msePixelBounds))
-            ErrorExit("Output image pixel bounds %s aren't inside the MSE "
-                      "image's pixel bounds %s.",
-                      pixelBounds, msePixelBounds);
-
-        // Transform the pixelBounds of the image we're rendering to the
-        // coordinate system with msePixelBounds.pMin at the origin, which
-        // in turn gives us the section of the MSE image to crop. (This is
-        // complicated by the fact that Image doesn't support pixel
-        // bounds...)
-        Bounds2i cropBounds(Point2i(pixelBounds.pMin - msePixelBounds.pMin),
-                            Point2i(pixelBounds.pMax - msePixelBounds.pMin));
-        *referenceImage = referenceImage->Crop(cropBounds);
-        CHECK_EQ(referenceImage->Resolution(), Point2i(pixelBounds.Diagonal()));
-
-        mseOutFile = fopen(Options->mseReferenceOutput.c_str(), "w");
-        if (!mseOutFile)
-            ErrorExit("%s: %s", Options->mseReferenceOutput, ErrorString());
-    }
+    if (!Options->mseReferenceImage.empty() && streamingFilm)
+        ErrorExit("--mse-reference-image isn't supported with streaming films.");
+    std::unique_ptr<ReferenceErrorLog> errorLog =
+        ReferenceErrorLog::Create(pixelBounds);
+
+    // With --preview, the display server first shows reduced-resolution
+    // passes where each block of _previewFactor_ x _previewFactor_ pixels
+    // shows the value of a single sample, stored in _previewRGB_.
+    std::mutex previewMutex;
+    int previewFactor = 0, previewBlocksX = 0;
+    std::vector<RGB> previewRGB;
+    Vector2i diag = pixelBounds.Diagonal();
+    auto previewPixel = [&](Point2i pBlock, int factor) {
+        // Returns the pixel sampled for the block, in film coordinates
+        Point2i p(pBlock.x * factor + factor / 2, pBlock.y * factor + factor / 2);
+        return pixelBounds.pMin +
+               Vector2i(std::min(p.x, diag.x - 1), std::min(p.y, diag.y - 1));
+    };
 
     // Connect to display server if needed
-    if (!Options->displayServer.empty()) {
+    if (!Options->displayServer.empty() && streamingFilm)
+        Warning("Streaming films can't be shown on the display server.");
+    else if (!Options->displayServer.empty()) {
         FilmHandle film = camera.GetFilm();
-        DisplayDynamic(film.GetFilename(), Point2i(pixelBounds.Diagonal()),
-                       {"R", "G", "B"},
-                       [&](Bounds2i b, pstd::span<pstd::span<Float>> displayValue) {
-                           int index = 0;
-                           for (Point2i p : b) {
-                               RGB rgb = film.GetPixelRGB(pixelBounds.pMin + p,
-                                                          2.f / (waveStart + waveEnd));
-                               for (int c = 0; c < 3; ++c)
-                                   displayValue[c][index] = rgb[c];
-                               ++index;
-                           }
-                       });
+        DisplayDynamic(
+            film.GetFilename(), Point2i(pixelBounds.Diagonal()), {"R", "G", "B"},
+            [&](Bounds2i b, pstd::span<pstd::span<Float>> displayValue) {
+                std::lock_guard<std::mutex> lock(previewMutex);
+                int index = 0;
+                for (Point2i p : b) {
+                    RGB rgb;
+                    if (previewFactor > 0)
+                        rgb = previewRGB[(p.y / previewFactor) * previewBlocksX +
+                                         p.x / previewFactor];
+                    else
+                        rgb = film.GetPixelRGB(pixelBounds.pMin + p,
+                                               2.f / (waveStart + waveEnd));
+                    for (int c = 0; c < 3; ++c)
+                        displayValue[c][index] = rgb[c];
+                    ++index;
+                }
+            },
+            true /* trackDirtyTiles */);
+    }
+
+    // Render preview passes for the display server, if requested. The
+    // passes' samples go through the film, which is then reset. Integrators
+    // that splat aren't previewed, since a block's single sample doesn't
+    // represent their splats' contributions, nor are renders whose pixel
+    // statistics or checkpoints the preview samples would affect.
+    if (Options->preview && !Options->displayServer.empty() && !streamingFilm &&
+        !SplatsToFilm() && !adaptive && !targetError && !checkpointing) {
+        FilmHandle film = camera.GetFilm();
+        for (int factor : {16, 4}) {
+            if (renderCancellation.IsCancelled())
+                break;
+            Timer previewTimer;
+            int nx = (diag.x + factor - 1) / factor, ny = (diag.y + factor - 1) / factor;
+            BeginWave(pixelBounds, 0, 1);
+            ParallelFor(0, ny, [&](int64_t by) {
+                ScratchBuffer &scratchBuffer = scratchBuffers.Get();
+                SamplerHandle &sampler = samplers.Get();
+                for (int bx = 0; bx < nx; ++bx) {
+                    Point2i p = previewPixel(Point2i(bx, by), factor);
+                    Bounds2i pixel(p, p + Vector2i(1, 1));
+                    film.BeginTile(pixel);
+                    EvaluateTileSamples(pixel, 0, 1, sampler, scratchBuffer);
+                    film.EndTile();
+                }
+            });
+            EndWave(1);
+
+            // Copy the pass's values for display and reset the film
+            std::vector<RGB> rgb(nx * ny);
+            for (int by = 0; by < ny; ++by)
+                for (int bx = 0; bx < nx; ++bx)
+                    rgb[by * nx + bx] =
+                        film.GetPixelRGB(previewPixel(Point2i(bx, by), factor), 1.f);
+            film.ResetPixels(pixelBounds);
+            {
+                std::lock_guard<std::mutex> lock(previewMutex);
+                previewRGB = std::move(rgb);
+                previewFactor = factor;
+                previewBlocksX = nx;
+            }
+            MarkDisplayDynamicDirty(film.GetFilename(),
+                                    Bounds2i(Point2i(0, 0), Point2i(diag)));
+            LOG_VERBOSE("Preview pass at 1/%d resolution took %.3fs", factor,
+                        previewTimer.ElapsedSeconds());
+        }
     }
 
     // Render image in waves
+    TileScheduler tileScheduler(pixelBounds);
+    bool cancelled = false;
     while (waveStart < spp) {
         // Render current wave's image tiles in parallel
-        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
+        TraceScope trace("Render wave", "Render", waveStart);
+        PerfCounterPhase wavePhase("Render wave");
+        Timer waveTimer;
+        BeginWave(pixelBounds, waveStart, waveEnd);
+        tileScheduler.RenderWave(waveEnd - waveStart, [&](Bounds2i tileBounds) {
             // Render image tile given by _tileBounds_
-            ScratchBuffer &scratchBuffer = scratchBuffers[ThreadIndex];
-            SamplerHandle &sampler = samplers[ThreadIndex];
+            ScratchBuffer &scratchBuffer = scratchBuffers.Get();
+            SamplerHandle &sampler = samplers.Get();
             PBRT_DBG("Starting image tile (%d,%d)-(%d,%d) waveStart %d, waveEnd %d\n",
                      tileBounds.pMin.x, tileBounds.pMin.y, tileBounds.pMax.x,
                      tileBounds.pMax.y, waveStart, waveEnd);
-            for (Point2i pPixel : tileBounds) {
-                StatsReportPixelStart(pPixel);
-                threadPixel = pPixel;
-                // Render samples in pixel _pPixel_
-                for (int sampleIndex = waveStart; sampleIndex < waveEnd; ++sampleIndex) {
-                    threadSampleIndex = sampleIndex;
-                    sampler.StartPixelSample(pPixel, sampleIndex);
-                    EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
-                    scratchBuffer.Reset();
-                }
-
-                StatsReportPixelEnd(pPixel);
-            }
+            FilmHandle film = camera.GetFilm();
+            film.BeginTile(tileBounds);
+            int64_t startRays = threadWorkCounters.rays + threadWorkCounters.shadowRays;
+            EvaluateTileSamples(tileBounds, waveStart, waveEnd, sampler, scratchBuffer);
+            int64_t tileRays =
+                threadWorkCounters.rays + threadWorkCounters.shadowRays - startRays;
+            film.EndTile();
+            if (!Options->displayServer.empty() && !streamingFilm)
+                MarkDisplayDynamicDirty(
+                    film.GetFilename(),
+                    Bounds2i(Point2i(tileBounds.pMin - pixelBounds.pMin),
+                             Point2i(tileBounds.pMax - pixelBounds.pMin)));
             PBRT_DBG("Finished image tile (%d,%d)-(%d,%d)\n", tileBounds.pMin.x,
                      tileBounds.pMin.y, tileBounds.pMax.x, tileBounds.pMax.y);
-            progress.Update((waveEnd - waveStart) * tileBounds.Area());
-        });
+            progress.Update((waveEnd - waveStart) * tileBounds.Area(), tileRays);
+        }, &renderCancellation);
+        // Merge splats from per-thread film buffers at the end of the wave
+        camera.GetFilm().FlushSplats();
+        EndWave(waveEnd - waveStart);
+        wavePhase.End();
+        if (renderCancellation.IsCancelled()) {
+            LOG_VERBOSE("Render cancelled at spp = %d", waveStart);
+            cancelled = true;
+            break;
+        }
+        // Show the full-resolution image once its first wave is done
+        if (previewFactor > 0) {
+            {
+                std::lock_guard<std::mutex> lock(previewMutex);
+                previewFactor = 0;
+            }
+            MarkDisplayDynamicDirty(camera.GetFilm().GetFilename(),
+                                    Bounds2i(Point2i(0, 0), Point2i(diag)));
+        }
+        if (adaptive && waveEnd < spp) {
+            std::atomic<int64_t> nConverged{0};
+            ParallelFor(pixelBounds.pMin.y, pixelBounds.pMax.y, [&](int64_t y) {
+                int n = 0;
+                for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; ++x)
+                    n += PixelConverged(Point2i(x, y));
+                nConverged += n;
+            });
+            LOG_VERBOSE("Adaptive sampling: %d of %d pixels converged at spp = %d",
+                        int64_t(nConverged), pixelBounds.Area(), waveEnd);
+        }
+
+        double waveSecondsPerSample = waveTimer.ElapsedSeconds() / (waveEnd - waveStart);
 
         // Update start and end wave
         waveStart = waveEnd;
         waveEnd = std::min(spp, waveEnd + nextWaveSize);
-        if (!referenceImage)
+        if (!errorLog)
             nextWaveSize = std::min(2 * nextWaveSize, 64);
+
+        // Stop early if the next wave won't fit in the time limit or if the
+        // image has reached the target error; the image is then finished with
+        // the samples taken so far.
+        if (waveStart < spp && Options->timeLimit > 0 &&
+            progress.ElapsedSeconds() + waveSecondsPerSample * (waveEnd - waveStart) >
+                Options->timeLimit) {
+            LOG_VERBOSE("Stopping at spp = %d to stay within the time limit", waveStart);
+            spp = waveStart;
+        }
+        if (waveStart < spp && targetError &&
+            waveStart >= Options->adaptiveMinSamples) {
+            AtomicDouble errorSum(0);
+            ParallelFor(pixelBounds.pMin.y, pixelBounds.pMax.y, [&](int64_t y) {
+                double sum = 0;
+                for (int x = pixelBounds.pMin.x; x < pixelBounds.pMax.x; ++x)
+                    sum += PixelRelativeError(Point2i(x, y));
+                errorSum.Add(sum);
+            });
+            Float error = double(errorSum) / pixelBounds.Area();
+            LOG_VERBOSE("Mean relative error %f at spp = %d", error, waveStart);
+            if (error <= Options->targetError)
+                spp = waveStart;
+        }
         if (waveStart == spp)
             progress.Done();
 
+        // Periodically save a render checkpoint
+        if (Options->checkpointInterval > 0 && waveStart < spp &&
+            checkpointTimer.ElapsedSeconds() >= Options->checkpointInterval) {
+            if (checkpointWrite.Valid())
+                checkpointWrite.Wait();
+            // Copy the film state now so that rendering can continue while
+            // the checkpoint is written
+            RenderCheckpointHeader header = makeCheckpointHeader(pixelBounds, spp);
+            header.waveStart = waveStart;
+            header.waveEnd = waveEnd;
+            header.nextWaveSize = nextWaveSize;
+            std::string contents(reinterpret_cast<const char *>(&header),
+                                 sizeof(header));
+            contents += camera.GetFilm().SaveState();
+            checkpointWrite = RunAsync(writeCheckpoint, checkpointFilename,
+                                       std::move(contents));
+            checkpointTimer = Timer();
+        }
+
         // Optionally write current image to disk
-        if (waveStart == spp || Options->writePartialImages || referenceImage) {
+        if (waveStart == spp || Options->writePartialImages || errorLog) {
             LOG_VERBOSE("Writing image with spp = %d", waveStart);
             ImageMetadata metadata;
             metadata.renderTimeSeconds = progress.ElapsedSeconds();
             metadata.samplesPerPixel = waveStart;
-            if (referenceImage) {
+            if (errorLog) {
                 ImageMetadata filmMetadata;
                 Image filmImage =
                     camera.GetFilm().GetImage(&filmMetadata, 1.f / waveStart);
-                ImageChannelValues mse =
-                    filmImage.MSE(filmImage.AllChannelsDesc(), *referenceImage);
-                fprintf(mseOutFile, "%d, %.9g\n", waveStart, mse.Average());
-                metadata.MSE = mse.Average();
-                fflush(mseOutFile);
+                metadata.MSE =
+                    errorLog->Add(filmImage, waveStart, progress.ElapsedSeconds());
             }
-            if (waveStart == spp || Options->writePartialImages) {
+            if (waveStart == spp) {
+                // Finish the last partial image before writing the final one
+                if (imageWrite.Valid())
+                    imageWrite.Wait();
                 camera.InitMetadata(&metadata);
+                PerfCounterPhase writePhase("Image write");
                 camera.GetFilm().WriteImage(metadata, 1.0f / waveStart);
+            } else if (Options->writePartialImages) {
+                // Encode and write partial images in the background; if the
+                // previous one is still being written, skip this one rather
+                // than holding up the next wave.
+                if (imageWrite.Valid() && !imageWrite.IsReady())
+                    LOG_VERBOSE("Skipping partial image at spp = %d; the previous "
+                                "one is still being written",
+                                waveStart);
+                else {
+                    camera.InitMetadata(&metadata);
+                    // Favor speed over size for partial images
+                    metadata.compressionLevel = 1;
+                    imageWrite = RunAsync(
+                        camera.GetFilm().PrepareImageWrite(metadata, 1.0f / waveStart));
+                }
             }
         }
     }
 
-    if (mseOutFile)
-        fclose(mseOutFile);
+    // Remove the checkpoint now that the final image has been written
+    if (checkpointWrite.Valid())
+        checkpointWrite.Wait();
+    if (imageWrite.Valid())
+        imageWrite.Wait();
+    if (cancelled)
+        progress.Done();
+    else if (checkpointing && FileExists(checkpointFilename))
+        std::remove(checkpointFilename.c_str());
+
     DisconnectFromDisplayServer();
     LOG_VERBOSE("Rendering finished");
 }
 
+void ImageTileIntegrator::RenderDistributed(ThreadLocal<ScratchBuffer> &scratchBuffers,
+                                            ThreadLocal<SamplerHandle> &samplers,
+                                            ProgressReporter &progress) {
+    FilmHandle film = camera.GetFilm();
+    Bounds2i pixelBounds = film.PixelBounds();
+    int spp = samplerPrototype.SamplesPerPixel();
+    std::string manifestFilename = Options->distributedDirectory + "/manifest";
+    bool coordinator = Options->distributedCoordinator;
+
+    // Write the render's manifest or wait for the coordinator to write it
+    DistributedRenderHeader header;
+    if (coordinator) {
+        if (FileExists(manifestFilename))
+            ErrorExit("%s: a distributed render is already using this directory.",
+                      Options->distributedDirectory);
+        header =
+            makeDistributedHeader(pixelBounds, spp, Options->distributedSampleSplits);
+        // Remove the files of jobs from an interrupted render
+        for (int i = 0; i < numDistributedJobs(pixelBounds, header.sampleSplits); ++i) {
+            std::remove(distributedJobFilename(i, "claim").c_str());
+            std::remove(distributedJobFilename(i, "film").c_str());
+        }
+        if (!WriteFileAtomic(manifestFilename,
+                                 std::string(reinterpret_cast<const char *>(&header),
+                                             sizeof(header))))
+            ErrorExit("%s: %s", manifestFilename, ErrorString());
+    } else {
+        LOG_VERBOSE("Waiting for distributed render manifest %s", manifestFilename);
+        while (!FileExists(manifestFilename))
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        std::string contents = ReadFileContents(manifestFilename);
+        if (contents.size() != sizeof(header))
+            ErrorExit("%s: corrupt distributed render manifest.", manifestFilename);
+        std::memcpy(&header, contents.data(), sizeof(header));
+        DistributedRenderHeader expected =
+            makeDistributedHeader(pixelBounds, spp, header.sampleSplits);
+        if (std::memcmp(&header, &expected, sizeof(header)) != 0)
+            ErrorExit("%s: the coordinator's pixel bounds, sample count, or seed "
+                      "don't match this process's.",
+                      manifestFilename);
+    }
+    int sampleSplits = header.sampleSplits;
+    int nJobs = numDistributedJobs(pixelBounds, sampleSplits);
+
+    // Render unclaimed jobs and write their film states
+    std::vector<bool> jobDone(nJobs, false);
+    for (int jobIndex = 0; jobIndex < nJobs; ++jobIndex) {
+        if (!claimDistributedJob(distributedJobFilename(jobIndex, "claim")))
+            continue;
+        Bounds2i jobBounds;
+        int sampleStart, sampleEnd;
+        getDistributedJob(pixelBounds, spp, sampleSplits, jobIndex, &jobBounds,
+                          &sampleStart, &sampleEnd);
+        TraceScope trace("Render job", "Render", jobIndex);
+        LOG_VERBOSE("Rendering distributed job %d: %s samples %d-%d", jobIndex,
+                    jobBounds, sampleStart, sampleEnd);
+        film.ResetPixels(jobBounds);
+
+        // Render the job's samples in the same waves as a single-process
+        // render, so that pixels' sums are computed identically
+        TileScheduler tileScheduler(jobBounds);
+        int waveStart = 0, waveEnd = 1, nextWaveSize = 1;
+        while (waveStart < sampleEnd) {
+            int start = std::max(waveStart, sampleStart);
+            int end = std::min(waveEnd, sampleEnd);
+            if (start < end) {
+                BeginWave(jobBounds, start, end);
+                tileScheduler.RenderWave(end - start, [&](Bounds2i tileBounds) {
+                    ScratchBuffer &scratchBuffer = scratchBuffers.Get();
+                    SamplerHandle &sampler = samplers.Get();
+                    film.BeginTile(tileBounds);
+                    EvaluateTileSamples(tileBounds, start, end, sampler, scratchBuffer);
+                    film.EndTile();
+                });
+                film.FlushSplats();
+                EndWave(end - start);
+            }
+            waveStart = waveEnd;
+            waveEnd = std::min(spp, waveEnd + nextWaveSize);
+            nextWaveSize = std::min(2 * nextWaveSize, 64);
+        }
+
+        std::string resultFilename = distributedJobFilename(jobIndex, "film");
+        if (!WriteFileAtomic(resultFilename, film.SaveState(jobBounds)))
+            ErrorExit("%s: %s", resultFilename, ErrorString());
+        progress.Update(int64_t(sampleEnd - sampleStart) * jobBounds.Area());
+        jobDone[jobIndex] = true;
+    }
+    if (!coordinator) {
+        progress.Done();
+        LOG_VERBOSE("Finished distributed render jobs");
+        return;
+    }
+
+    // Wait for the other processes' jobs to finish
+    int nWaiting;
+    do {
+        nWaiting = 0;
+        for (int jobIndex = 0; jobIndex < nJobs; ++jobIndex) {
+            if (jobDone[jobIndex])
+                continue;
+            if (FileExists(distributedJobFilename(jobIndex, "film"))) {
+                Bounds2i jobBounds;
+                int sampleStart, sampleEnd;
+                getDistributedJob(pixelBounds, spp, sampleSplits, jobIndex, &jobBounds,
+                                  &sampleStart, &sampleEnd);
+                progress.Update(int64_t(sampleEnd - sampleStart) * jobBounds.Area());
+                jobDone[jobIndex] = true;
+            } else
+                ++nWaiting;
+        }
+        if (nWaiting > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    } while (nWaiting > 0);
+    progress.Done();
+
+    // Merge all of the jobs' film states in order and write the image
+    film.ResetPixels(pixelBounds);
+    for (int jobIndex = 0; jobIndex < nJobs; ++jobIndex) {
+        Bounds2i jobBounds;
+        int sampleStart, sampleEnd;
+        getDistributedJob(pixelBounds, spp, sampleSplits, jobIndex, &jobBounds,
+                          &sampleStart, &sampleEnd);
+        std::string resultFilename = distributedJobFilename(jobIndex, "film");
+        film.MergeState(ReadFileContents(resultFilename), jobBounds);
+    }
+    ImageMetadata metadata;
+    metadata.renderTimeSeconds = progress.ElapsedSeconds();
+    metadata.samplesPerPixel = spp;
+    camera.InitMetadata(&metadata);
+    {
+        PerfCounterPhase writePhase("Image write");
+        film.WriteImage(metadata, 1.0f / spp);
+    }
+
+    // Clean up the shared directory so that it can be used for another render
+    for (int jobIndex = 0; jobIndex < nJobs; ++jobIndex) {
+        std::remove(distributedJobFilename(jobIndex, "claim").c_str());
+        std::remove(distributedJobFilename(jobIndex, "film").c_str());
+    }
+    std::remove(manifestFilename.c_str());
+    LOG_VERBOSE("Finished distributed render");
+}
+
+void ImageTileIntegrator::EvaluateTileSamples(Bounds2i tileBounds, int sampleStart,
+                                              int sampleEnd, SamplerHandle sampler,
+                                              ScratchBuffer &scratchBuffer) {
+    FilmHandle film = camera.GetFilm();
+    bool recordCost = film.RequestedAOVs() & AOVFlags::Cost;
+    for (Point2i pPixel : tileBounds) {
+        if (PixelConverged(pPixel))
+            continue;
+        StatsReportPixelStart(pPixel);
+        threadPixel = pPixel;
+        // Render samples in pixel _pPixel_
+        for (int sampleIndex = sampleStart; sampleIndex < sampleEnd; ++sampleIndex) {
+            threadSampleIndex = sampleIndex;
+            WorkCounters startWork;
+            std::chrono::steady_clock::time_point startTime;
+            if (recordCost) {
+                startWork = threadWorkCounters;
+                startTime = std::chrono::steady_clock::now();
+            }
+            sampler.StartPixelSample(pPixel, sampleIndex);
+            EvaluatePixelSample(pPixel, sampleIndex, sampler, scratchBuffer);
+            scratchBuffer.Reset();
+            if (recordCost) {
+                // Record the time taken and work done for the sample
+                std::chrono::duration<float, std::micro> elapsed =
+                    std::chrono::steady_clock::now() - startTime;
+                const WorkCounters &work = threadWorkCounters;
+                PixelCostSample cost;
+                cost.microseconds = elapsed.count();
+                cost.rays = work.rays - startWork.rays;
+                cost.nodesVisited = work.nodesVisited - startWork.nodesVisited;
+                cost.shadowRays = work.shadowRays - startWork.shadowRays;
+                cost.mediumSteps = work.mediumSteps - startWork.mediumSteps;
+                film.AddCostSample(pPixel, cost);
+            }
+        }
+
+        StatsReportPixelEnd(pPixel);
+    }
+}
+
+bool ImageTileIntegrator::PixelConverged(Point2i pPixel) const {
+    if (Options->adaptiveThreshold == 0 || pixelVariance.size() == 0)
+        return false;
+    if (pixelVariance[pPixel].Count() < Options->adaptiveMinSamples)
+        return false;
+    return PixelRelativeError(pPixel) <= Options->adaptiveThreshold;
+}
+
+Float ImageTileIntegrator::PixelRelativeError(Point2i pPixel) const {
+    const VarianceEstimator<Float> &ve = pixelVariance[pPixel];
+    if (ve.Count() == 0)
+        return Infinity;
+    // The standard error of the pixel's mean luminance is taken relative to
+    // the mean, which is clamped so that noise in nearly black pixels doesn't
+    // need to be driven to zero.
+    Float stdError = std::sqrt(ve.Variance() / ve.Count());
+    return stdError / std::max<Float>(ve.Mean(), 1e-2f);
+}
+
+// PrimaryVisibility Method Definitions
+STAT_COUNTER("Integrator/Camera rays rasterized", nRasterizedCameraRays);
+STAT_MEMORY_COUNTER("Memory/Primary visibility tiles", primaryVisibilityBytes);
+
+std::unique_ptr<PrimaryVisibility> PrimaryVisibility::Create(CameraHandle camera,
+                                                             PrimitiveHandle aggregate) {
+    // Make sure that the camera is a pinhole camera that doesn't move
+    const ProjectiveCamera *projCamera = camera.CastOrNullptr<OrthographicCamera>();
+    const PerspectiveCamera *perspective = camera.CastOrNullptr<PerspectiveCamera>();
+    if (perspective)
+        projCamera = perspective;
+    const CameraTransform &cameraTransform = camera.GetCameraTransform();
+    if (!projCamera || projCamera->lensRadius > 0 ||
+        cameraTransform.RenderFromCamera().IsAnimated()) {
+        Warning("--raster-primary: only perspective and orthographic cameras without "
+                "depth of field or motion are supported. Tracing camera rays instead.");
+        return nullptr;
+    }
+    Transform cameraFromRender = cameraTransform.CameraFromRender(0.f);
+
+    const BVHAggregate *bvh =
+        aggregate ? aggregate.CastOrNullptr<BVHAggregate>() : nullptr;
+    if (!bvh) {
+        Warning("--raster-primary: the scene's primitives aren't in a BVH. Tracing "
+                "camera rays instead.");
+        return nullptr;
+    }
+    const std::vector<PrimitiveHandle> &primitives = bvh->Primitives();
+
+    // Compute raster-space bounds of the scene's triangles
+    std::unique_ptr<PrimaryVisibility> visibility =
+        std::make_unique<PrimaryVisibility>();
+    std::vector<RasterTriangle> &triangles = visibility->triangles;
+    triangles.resize(primitives.size());
+    std::atomic<bool> allTriangles{true};
+    ParallelFor(0, primitives.size(), [&](int64_t i) {
+        // Find the triangle that _primitives[i]_ holds, if it's opaque
+        PrimitiveHandle prim = primitives[i];
+        ShapeHandle shape;
+        if (const GeometricPrimitive *gp = prim.CastOrNullptr<GeometricPrimitive>())
+            shape = gp->GetShape();
+        else if (const SimplePrimitive *sp = prim.CastOrNullptr<SimplePrimitive>())
+            shape = sp->GetShape();
+        const Triangle *tri = shape ? shape.CastOrNullptr<Triangle>()
+                                    : prim.CastOrNullptr<Triangle>();
+        if (!tri || !prim.HasOnlyOpaqueSurfaces()) {
+            allTriangles = false;
+            return;
+        }
+
+        RasterTriangle &rt = triangles[i];
+        rt.primitive = prim;
+        pstd::array<Point3f, 3> p = tri->Vertices();
+        int nBehind = 0;
+        for (int j = 0; j < 3; ++j) {
+            rt.p[j] = p[j];
+            Point3f pCamera = cameraFromRender(p[j]);
+            // Camera rays start at $z=0$ in camera space and head toward $+z$;
+            // vertices behind it can't be projected by a perspective camera
+            if (pCamera.z <= 0)
+                ++nBehind;
+            if (!perspective || pCamera.z > 0) {
+                Point3f pRaster = projCamera->cameraFromRaster.ApplyInverse(pCamera);
+                rt.rasterBounds = Union(rt.rasterBounds, Point2f(pRaster.x, pRaster.y));
+            }
+        }
+        if (nBehind == 3)
+            // Leave _rasterBounds_ empty; camera rays can't hit the triangle
+            rt.rasterBounds = Bounds2f();
+        else if (nBehind > 0 && perspective)
+            rt.rasterBounds = Bounds2f(Point2f(-Infinity, -Infinity),
+                                       Point2f(Infinity, Infinity));
+        else {
+            // Pad the bounds to account for round-off error in projecting
+            // the vertices and in computing camera rays
+            Bounds2f &b = rt.rasterBounds;
+            Float maxCoord = std::max({std::abs(b.pMin.x), std::abs(b.pMin.y),
+                                       std::abs(b.pMax.x), std::abs(b.pMax.y)});
+            b = Expand(b, 1e-2f + 1e-4f * maxCoord);
+        }
+    });
+    if (!allTriangles) {
+        Warning("--raster-primary: only scenes that are entirely made of opaque "
+                "triangles are supported. Tracing camera rays instead.");
+        return nullptr;
+    }
+
+    // Bin triangles into the tiles that their raster-space bounds overlap
+    // Find the film area that camera samples' film positions may be in
+    FilmHandle film = camera.GetFilm();
+    Bounds2i pixelBounds = film.PixelBounds();
+    Vector2f radius = film.GetFilter().Radius();
+    visibility->tileBounds = Bounds2f(Point2f(pixelBounds.pMin) - radius,
+                                      Point2f(pixelBounds.pMax) + radius);
+    Vector2f diag = visibility->tileBounds.Diagonal();
+    Point2i nTiles(int(std::ceil(diag.x / TileSize)), int(std::ceil(diag.y / TileSize)));
+    visibility->nTiles = nTiles;
+
+    // Returns false if triangle _i_ isn't binned; otherwise returns the range
+    // of tiles that it overlaps in _tiles_
+    auto tileRange = [&](int i, Bounds2i *tiles) {
+        const Bounds2f &b = triangles[i].rasterBounds;
+        if (b.pMin.x == -Infinity || b.IsEmpty() ||
+            !Overlaps(b, visibility->tileBounds))
+            return false;
+        Bounds2f tb = pbrt::Intersect(b, visibility->tileBounds);
+        Point2f pMin = Point2f((tb.pMin - visibility->tileBounds.pMin) / TileSize);
+        Point2f pMax = Point2f((tb.pMax - visibility->tileBounds.pMin) / TileSize);
+        *tiles = Bounds2i(Point2i(pMin.x, pMin.y),
+                          Point2i(std::min<int>(pMax.x, nTiles.x - 1) + 1,
+                                  std::min<int>(pMax.y, nTiles.y - 1) + 1));
+        return true;
+    };
+    std::vector<int> &tileOffsets = visibility->tileOffsets;
+    tileOffsets.assign(nTiles.x * nTiles.y + 1, 0);
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        Bounds2i tiles;
+        if (triangles[i].rasterBounds.pMin.x == -Infinity)
+            visibility->unboundedTriangles.push_back(i);
+        else if (tileRange(i, &tiles))
+            for (Point2i t : tiles)
+                ++tileOffsets[t.y * nTiles.x + t.x + 1];
+    }
+    for (size_t i = 1; i < tileOffsets.size(); ++i)
+        tileOffsets[i] += tileOffsets[i - 1];
+    std::vector<int> &tileTriangles = visibility->tileTriangles;
+    tileTriangles.resize(tileOffsets.back());
+    std::vector<int> tileCounts(nTiles.x * nTiles.y, 0);
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        Bounds2i tiles;
+        if (tileRange(i, &tiles))
+            for (Point2i t : tiles) {
+                int tile = t.y * nTiles.x + t.x;
+                tileTriangles[tileOffsets[tile] + tileCounts[tile]++] = i;
+            }
+    }
+
+    primaryVisibilityBytes += triangles.size() * sizeof(RasterTriangle) +
+                              (tileOffsets.size() + tileTriangles.size() +
+                               visibility->unboundedTriangles.size()) *
+                                  sizeof(int);
+    LOG_VERBOSE("Binned %d triangles into %d tiles for primary visibility; %d aren't "
+                "bounded in raster space",
+                tileTriangles.size(), nTiles.x * nTiles.y,
+                visibility->unboundedTriangles.size());
+    return visibility;
+}
+
+bool PrimaryVisibility::Intersect(const Ray &ray, Point2f pFilm,
+                                  pstd::optional<ShapeIntersection> *si) const {
+    if (!Inside(pFilm, tileBounds))
+        return false;
+    // Find the closest intersection with the triangles that may cover _pFilm_
+    Float tMax = Infinity;
+    int closest = -1;
+    auto intersect = [&](int i) {
+        const RasterTriangle &tri = triangles[i];
+        if (!Inside(pFilm, tri.rasterBounds))
+            return;
+        pstd::optional<TriangleIntersection> triIsect =
+            IntersectTriangle(ray, tMax, tri.p[0], tri.p[1], tri.p[2]);
+        if (triIsect) {
+            tMax = triIsect->t;
+            closest = i;
+        }
+    };
+    for (int i : unboundedTriangles)
+        intersect(i);
+    Point2f pTile = Point2f((pFilm - tileBounds.pMin) / TileSize);
+    int tile = std::min<int>(pTile.y, nTiles.y - 1) * nTiles.x +
+               std::min<int>(pTile.x, nTiles.x - 1);
+    for (int j = tileOffsets[tile]; j < tileOffsets[tile + 1]; ++j)
+        intersect(tileTriangles[j]);
+
+    if (closest == -1) {
+        si->reset();
+        return true;
+    }
+    // Compute the full intersection with the closest triangle's primitive
+    *si = triangles[closest].primitive.Intersect(ray, Infinity);
+    return si->has_value();
+}
+
 // RayIntegrator Method Definitions
+// A camera ray whose first intersection was found by rasterization; the next
+// call to Integrator::Intersect() for the ray on the same thread returns it.
+struct RasterizedCameraRay {
+    Ray ray;
+    pstd::optional<ShapeIntersection> si;
+};
+static thread_local const RasterizedCameraRay *threadRasterizedRay;
+
+void RayIntegrator::BeginRender() {
+    if (Options->rasterPrimary && !primaryVisibility)
+        primaryVisibility = PrimaryVisibility::Create(camera, aggregate);
+}
+
 void RayIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex,
                                         SamplerHandle sampler,
                                         ScratchBuffer &scratchBuffer) {
-    // Sample wavelengths for the ray
-    Float lu = sampler.Get1D();
-    if (Options->disableWavelengthJitter)
-        lu = 0.5;
-    SampledWavelengths lambda = camera.GetFilm().SampleWavelengths(lu);
-
-    // Initialize _CameraSample_ for current sample
-    FilterHandle filter = camera.GetFilm().GetFilter();
-    CameraSample cameraSample = GetCameraSample(sampler, pPixel, filter);
-
     // Generate camera ray for current sample
+    SampledWavelengths lambda;
+    CameraSample cameraSample;
     pstd::optional<CameraRayDifferential> cameraRay =
-        camera.GenerateRayDifferential(cameraSample, lambda);
+        GenerateCameraRay(pPixel, sampler, &lambda, &cameraSample);
 
     // Trace _cameraRay_ if valid
     SampledSpectrum L(0.);
     VisibleSurface visibleSurface;
+    pstd::optional<AOVSample> aov;
     if (cameraRay) {
-        // Double check that the ray's direction is normalized.
-        DCHECK_GT(Length(cameraRay->ray.d), .999f);
-        DCHECK_LT(Length(cameraRay->ray.d), 1.001f);
-        // Scale camera ray differentials based on sampling rate
-        Float rayDiffScale =
-            std::max<Float>(.125f, 1 / std::sqrt((Float)sampler.SamplesPerPixel()));
-        if (!Options->disablePixelJitter)
-            cameraRay->ray.ScaleDifferentials(rayDiffScale);
+        // Find camera ray's first intersection by rasterization, if possible
+        RasterizedCameraRay rasterized{cameraRay->ray, {}};
+        if (primaryVisibility &&
+            primaryVisibility->Intersect(cameraRay->ray, cameraSample.pFilm,
+                                         &rasterized.si)) {
+            threadRasterizedRay = &rasterized;
+            ++nRasterizedCameraRays;
+        }
 
-        ++nCameraRays;
         // Evaluate radiance along camera ray
-        bool initializeVisibleSurface = camera.GetFilm().UsesVisibleSurface();
-        L = cameraRay->weight * Li(cameraRay->ray, lambda, sampler, scratchBuffer,
-                                   initializeVisibleSurface ? &visibleSurface : nullptr);
-
-        // Issue warning if unexpected radiance value is returned
-        if (L.HasNaNs()) {
-            LOG_ERROR("Not-a-number radiance value returned for pixel (%d, "
-                      "%d), sample %d. Setting to black.",
-                      pPixel.x, pPixel.y, sampleIndex);
-            L = SampledSpectrum(0.f);
-        } else if (IsInf(L.y(lambda))) {
-            LOG_ERROR("Infinite radiance value returned for pixel (%d, %d), "
-                      "sample %d. Setting to black.",
-                      pPixel.x, pPixel.y, sampleIndex);
-            L = SampledSpectrum(0.f);
+        FilmHandle film = camera.GetFilm();
+        bool initializeVisibleSurface = film.UsesVisibleSurface();
+        AOVFlags aovs = IntegratorAOVs(film.RequestedAOVs());
+        if (aovs == AOVFlags::None)
+            L = cameraRay->weight *
+                Li(cameraRay->ray, lambda, sampler, scratchBuffer,
+                   initializeVisibleSurface ? &visibleSurface : nullptr);
+        else {
+            aov = AOVSample(aovs);
+            L = cameraRay->weight *
+                LiWithAOVs(cameraRay->ray, lambda, sampler, scratchBuffer,
+                           initializeVisibleSurface ? &visibleSurface : nullptr, &*aov);
+            aov->ScaleRadiance(cameraRay->weight);
         }
+        threadRasterizedRay = nullptr;
 
         if (cameraRay)
             PBRT_DBG(
@@ -286,7 +1178,65 @@ void RayIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex,
     }
 
     // Add camera ray's contribution to image
-    camera.GetFilm().AddSample(pPixel, L, lambda, &visibleSurface, cameraSample.weight);
+    AddCameraSample(pPixel, sampleIndex, L, lambda, &visibleSurface, cameraSample.weight,
+                    aov ? &*aov : nullptr);
+}
+
+pstd::optional<CameraRayDifferential> RayIntegrator::GenerateCameraRay(
+    Point2i pPixel, SamplerHandle sampler, SampledWavelengths *lambda,
+    CameraSample *cameraSample) const {
+    // Sample wavelengths for the ray
+    Float lu = sampler.Get1D();
+    if (Options->disableWavelengthJitter)
+        lu = 0.5;
+    *lambda = camera.GetFilm().SampleWavelengths(lu);
+
+    // Initialize _CameraSample_ for current sample
+    FilterHandle filter = camera.GetFilm().GetFilter();
+    *cameraSample = GetCameraSample(sampler, pPixel, filter);
+
+    // Generate camera ray for current sample
+    pstd::optional<CameraRayDifferential> cameraRay =
+        camera.GenerateRayDifferential(*cameraSample, *lambda);
+    if (cameraRay) {
+        // Double check that the ray's direction is normalized.
+        DCHECK_GT(Length(cameraRay->ray.d), .999f);
+        DCHECK_LT(Length(cameraRay->ray.d), 1.001f);
+        // Scale camera ray differentials based on sampling rate
+        Float rayDiffScale =
+            std::max<Float>(.125f, 1 / std::sqrt((Float)sampler.SamplesPerPixel()));
+        if (!Options->disablePixelJitter)
+            cameraRay->ray.ScaleDifferentials(rayDiffScale);
+        ++nCameraRays;
+    }
+    return cameraRay;
+}
+
+void RayIntegrator::AddCameraSample(Point2i pPixel, int sampleIndex, SampledSpectrum L,
+                                    const SampledWavelengths &lambda,
+                                    const VisibleSurface *visibleSurface, Float weight,
+                                    const AOVSample *aov) {
+    // Issue warning if unexpected radiance value is returned; the sample's
+    // AOVs are discarded along with it.
+    if (L.HasNaNs()) {
+        LOG_ERROR("Not-a-number radiance value returned for pixel (%d, "
+                  "%d), sample %d. Setting to black.",
+                  pPixel.x, pPixel.y, sampleIndex);
+        L = SampledSpectrum(0.f);
+        aov = nullptr;
+    } else if (IsInf(L.y(lambda))) {
+        LOG_ERROR("Infinite radiance value returned for pixel (%d, %d), "
+                  "sample %d. Setting to black.",
+                  pPixel.x, pPixel.y, sampleIndex);
+        L = SampledSpectrum(0.f);
+        aov = nullptr;
+    }
+
+    RecordPixelSample(pPixel, L.y(lambda));
+    FilmHandle film = camera.GetFilm();
+    film.AddSample(pPixel, L, lambda, visibleSurface, weight);
+    if (aov)
+        film.AddAOVSample(pPixel, *aov, lambda, weight);
 }
 
 // Integrator Utility Functions
@@ -297,7 +1247,15 @@ STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
 pstd::optional<ShapeIntersection> Integrator::Intersect(const Ray &ray,
                                                         Float tMax) const {
     ++nIntersectionTests;
+    if (countRays)
+        ++threadWorkCounters.rays;
     DCHECK_NE(ray.d, Vector3f(0, 0, 0));
+    if (const RasterizedCameraRay *rasterized = threadRasterizedRay;
+        rasterized && tMax == Infinity && ray.o == rasterized->ray.o &&
+        ray.d == rasterized->ray.d && ray.time == rasterized->ray.time) {
+        threadRasterizedRay = nullptr;
+        return rasterized->si;
+    }
     if (aggregate)
         return aggregate.Intersect(ray, tMax);
     else
@@ -306,6 +1264,8 @@ pstd::optional<ShapeIntersection> Integrator::Intersect(const Ray &ray,
 
 bool Integrator::IntersectP(const Ray &ray, Float tMax) const {
     ++nShadowTests;
+    if (countRays)
+        ++threadWorkCounters.shadowRays;
     DCHECK_NE(ray.d, Vector3f(0, 0, 0));
     if (aggregate)
         return aggregate.IntersectP(ray, tMax);
@@ -313,6 +1273,41 @@ bool Integrator::IntersectP(const Ray &ray, Float tMax) const {
         return false;
 }
 
+bool Integrator::IntersectShadowP(const Ray &ray, Float tMax) const {
+    ++nShadowTests;
+    if (countRays)
+        ++threadWorkCounters.shadowRays;
+    DCHECK_NE(ray.d, Vector3f(0, 0, 0));
+    if (aggregate)
+        return aggregate.IntersectShadowP(ray, tMax);
+    else
+        return false;
+}
+
+void Integrator::IntersectN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                            pstd::span<pstd::optional<ShapeIntersection>> si) const {
+    nIntersectionTests += rays.size();
+    if (countRays)
+        threadWorkCounters.rays += rays.size();
+    if (aggregate)
+        aggregate.IntersectN(rays, tMax, si);
+    else
+        for (pstd::optional<ShapeIntersection> &s : si)
+            s.reset();
+}
+
+void Integrator::IntersectPN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                             pstd::span<bool> occluded) const {
+    nShadowTests += rays.size();
+    if (countRays)
+        threadWorkCounters.shadowRays += rays.size();
+    if (aggregate)
+        aggregate.IntersectPN(rays, tMax, occluded);
+    else
+        for (bool &o : occluded)
+            o = false;
+}
+
 SampledSpectrum Integrator::Tr(const Interaction &p0, const Interaction &p1,
                                const SampledWavelengths &lambda, RNG &rng) const {
     auto rescale = [](SampledSpectrum &Tr, SampledSpectrum &pdf) {
@@ -340,23 +1335,29 @@ SampledSpectrum Integrator::Tr(const Interaction &p0, const Interaction &p1,
             Point3f pExit = ray(si ? si->tHit : (1 - ShadowEpsilon));
             ray.d = pExit - ray.o;
 
-            ray.medium.SampleTmaj(ray, 1.f, rng.Uniform<Float>(), rng, lambda,
-                                  [&](const MediumSample &ms) -> bool {
-                                      const SampledSpectrum &Tmaj = ms.Tmaj;
+            if (const HomogeneousMedium *homogeneous =
+                    ray.medium.CastOrNullptr<HomogeneousMedium>()) {
+                // Transmittance through homogeneous media is known in closed form
+                Tr *= homogeneous->Tr(ray, 1.f, lambda);
+            } else {
+                ray.medium.SampleTmaj(ray, 1.f, rng.Uniform<Float>(), rng, lambda,
+                                      [&](const MediumSample &ms) -> bool {
+                                          const SampledSpectrum &Tmaj = ms.Tmaj;
 
-                                      const MediumInteraction &intr = ms.intr;
-                                      SampledSpectrum sigma_n = intr.sigma_n();
+                                          const MediumInteraction &intr = ms.intr;
+                                          SampledSpectrum sigma_n = intr.sigma_n();
 
-                                      // ratio-tracking: only evaluate null scattering
-                                      Tr *= Tmaj * sigma_n;
-                                      pdf *= Tmaj * intr.sigma_maj;
+                                          // ratio-tracking: only evaluate null scattering
+                                          Tr *= Tmaj * sigma_n;
+                                          pdf *= Tmaj * intr.sigma_maj;
 
-                                      if (!Tr)
-                                          return false;
+                                          if (!Tr)
+                                              return false;
 
-                                      rescale(Tr, pdf);
-                                      return true;
-                                  });
+                                          rescale(Tr, pdf);
+                                          return true;
+                                      });
+            }
         }
 
         // Generate next ray segment or return final transmittance
@@ -389,7 +1390,7 @@ SimplePathIntegrator::SimplePathIntegrator(int maxDepth, bool sampleLights,
       maxDepth(maxDepth),
       sampleLights(sampleLights),
       sampleBSDF(sampleBSDF),
-      lightSampler(lights, Allocator()) {}
+      lightSampler(lights, IntegratorAllocator()) {}
 
 SampledSpectrum SimplePathIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                          SamplerHandle sampler,
@@ -493,27 +1494,117 @@ std::string SimplePathIntegrator::ToString() const {
                         maxDepth, sampleLights, sampleBSDF);
 }
 
-std::unique_ptr<SimplePathIntegrator> SimplePathIntegrator::Create(
-    const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
-    PrimitiveHandle aggregate, std::vector<LightHandle> lights, const FileLoc *loc) {
-    int maxDepth = parameters.GetOneInt("maxdepth", 5);
-    bool sampleLights = parameters.GetOneBool("samplelights", true);
-    bool sampleBSDF = parameters.GetOneBool("samplebsdf", true);
-    return std::make_unique<SimplePathIntegrator>(maxDepth, sampleLights, sampleBSDF,
-                                                  camera, sampler, aggregate, lights);
-}
+std::unique_ptr<SimplePathIntegrator> SimplePathIntegrator::Create(
+    const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
+    PrimitiveHandle aggregate, std::vector<LightHandle> lights, const FileLoc *loc) {
+    int maxDepth = parameters.GetOneInt("maxdepth", 5);
+    bool sampleLights = parameters.GetOneBool("samplelights", true);
+    bool sampleBSDF = parameters.GetOneBool("samplebsdf", true);
+    return std::make_unique<SimplePathIntegrator>(maxDepth, sampleLights, sampleBSDF,
+                                                  camera, sampler, aggregate, lights);
+}
+
+// LightPathIntegrator Method Definitions
+// Each thread's camera splats are traced once this many have accumulated,
+// which is typically every few light paths.
+static constexpr size_t MaxCameraSplatBatchSize = 64;
+// Visible splats are added to the film in tiles of this many pixels on a side.
+static constexpr int CameraSplatTileSize = 16;
+// Each thread buffers at most this many visible splats before it adds them
+// to the film itself.
+static constexpr size_t MaxVisibleCameraSplats = 16384;
+
+LightPathIntegrator::LightPathIntegrator(int maxDepth, CameraHandle camera,
+                                         SamplerHandle sampler, PrimitiveHandle aggregate,
+                                         std::vector<LightHandle> lights)
+    : ImageTileIntegrator(camera, sampler, aggregate, lights), maxDepth(maxDepth) {
+    lightSampler = std::make_unique<PowerLightSampler>(lights, IntegratorAllocator());
+}
+
+void LightPathIntegrator::EvaluateTileSamples(Bounds2i tileBounds, int sampleStart,
+                                              int sampleEnd, SamplerHandle sampler,
+                                              ScratchBuffer &scratchBuffer) {
+    ImageTileIntegrator::EvaluateTileSamples(tileBounds, sampleStart, sampleEnd, sampler,
+                                             scratchBuffer);
+    FlushSplats(threadSplats.Get());
+}
+
+void LightPathIntegrator::FlushSplats(ShadowRayBatch<CameraSplat> &splats) {
+    std::vector<CameraSplat> &visibleSplats = threadVisibleSplats.Get();
+    splats.Flush(*this, [&](const CameraSplat &splat, bool occluded) {
+        if (!occluded)
+            visibleSplats.push_back(splat);
+    });
+
+    // Add the thread's visible splats to the film if its buffer is full,
+    // in tile order so that nearby splats are added together
+    if (visibleSplats.size() >= MaxVisibleCameraSplats) {
+        std::sort(visibleSplats.begin(), visibleSplats.end(),
+                  [&](const CameraSplat &a, const CameraSplat &b) {
+                      return SplatTile(a) < SplatTile(b);
+                  });
+        FilmHandle film = camera.GetFilm();
+        for (const CameraSplat &splat : visibleSplats)
+            film.AddSplat(splat.pRaster, splat.L, splat.lambda);
+        visibleSplats.clear();
+    }
+}
+
+int LightPathIntegrator::SplatTile(const CameraSplat &splat) const {
+    Bounds2i pixelBounds = camera.GetFilm().PixelBounds();
+    Vector2i diag = pixelBounds.Diagonal();
+    int nTilesX = (diag.x + CameraSplatTileSize - 1) / CameraSplatTileSize;
+    Point2i p(Floor(splat.pRaster));
+    int x = Clamp(p.x - pixelBounds.pMin.x, 0, diag.x - 1) / CameraSplatTileSize;
+    int y = Clamp(p.y - pixelBounds.pMin.y, 0, diag.y - 1) / CameraSplatTileSize;
+    return y * nTilesX + x;
+}
+
+void LightPathIntegrator::EndWave(int waveSamples) {
+    // Find the image tile that each of the threads' remaining visible splats
+    // lands in
+    FilmHandle film = camera.GetFilm();
+    Vector2i diag = film.PixelBounds().Diagonal();
+    int nTilesX = (diag.x + CameraSplatTileSize - 1) / CameraSplatTileSize;
+    int nTilesY = (diag.y + CameraSplatTileSize - 1) / CameraSplatTileSize;
+    auto splatTile = [&](const CameraSplat &splat) { return SplatTile(splat); };
+
+    // Sort splats by tile with a counting sort over all threads' buffers
+    std::vector<int> tileStart(nTilesX * nTilesY + 1, 0);
+    threadVisibleSplats.ForAll([&](const std::vector<CameraSplat> &splats) {
+        for (const CameraSplat &splat : splats)
+            ++tileStart[splatTile(splat) + 1];
+    });
+    for (size_t i = 1; i < tileStart.size(); ++i)
+        tileStart[i] += tileStart[i - 1];
+    if (tileStart.back() == 0)
+        return;
+    std::vector<const CameraSplat *> sortedSplats(tileStart.back());
+    std::vector<int> tileOffset(tileStart.begin(), tileStart.end() - 1);
+    threadVisibleSplats.ForAll([&](const std::vector<CameraSplat> &splats) {
+        for (const CameraSplat &splat : splats)
+            sortedSplats[tileOffset[splatTile(splat)]++] = &splat;
+    });
 
-// LightPathIntegrator Method Definitions
-LightPathIntegrator::LightPathIntegrator(int maxDepth, CameraHandle camera,
-                                         SamplerHandle sampler, PrimitiveHandle aggregate,
-                                         std::vector<LightHandle> lights)
-    : ImageTileIntegrator(camera, sampler, aggregate, lights), maxDepth(maxDepth) {
-    lightSampler = std::make_unique<PowerLightSampler>(lights, Allocator());
+    // Add each tile's splats to the film in parallel
+    ParallelFor(0, nTilesX * nTilesY, [&](int64_t tile) {
+        for (int i = tileStart[tile]; i < tileStart[tile + 1]; ++i)
+            film.AddSplat(sortedSplats[i]->pRaster, sortedSplats[i]->L,
+                          sortedSplats[i]->lambda);
+    });
+    threadVisibleSplats.ForAll([](std::vector<CameraSplat> &splats) { splats.clear(); });
+    // Merge in case the film is itself buffering splats per thread
+    film.FlushSplats();
 }
 
 void LightPathIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex,
                                               SamplerHandle sampler,
                                               ScratchBuffer &scratchBuffer) {
+    // Flush the thread's splats if enough of them have accumulated
+    ShadowRayBatch<CameraSplat> &splats = threadSplats.Get();
+    if (splats.Size() >= MaxCameraSplatBatchSize)
+        FlushSplats(splats);
+
     // Sample wavelengths for the ray
     Float lu = sampler.Get1D();
     if (Options->disableWavelengthJitter)
@@ -544,12 +1635,13 @@ void LightPathIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex,
                 // Add light's emitted radiance if non-zero and light is visible
                 SampledSpectrum Le =
                     light.L(les->intr->p(), les->intr->n, les->intr->uv, cs->wi, lambda);
-                if (Le && Unoccluded(cs->pRef, cs->pLens)) {
-                    // Compute visible light's path contribution and add to film
+                if (Le) {
+                    // Compute light's path contribution and add it to film if visible
                     SampledSpectrum L = Le * les->AbsCosTheta(cs->wi) * cs->Wi /
                                         (lightPDF * pdf * cs->pdf);
                     L = SafeDiv(L, lambda.PDF());
-                    camera.GetFilm().AddSplat(cs->pRaster, L, lambda);
+                    splats.Add(cs->pRef.SpawnRayTo(cs->pLens), 1 - ShadowEpsilon,
+                               {cs->pRaster, L, lambda});
                 }
             }
         }
@@ -588,8 +1680,9 @@ void LightPathIntegrator::EvaluatePixelSample(Point2i pPixel, int sampleIndex,
             SampledSpectrum L = beta * bsdf.f(wo, cs->wi, TransportMode::Importance) *
                                 AbsDot(cs->wi, isect.shading.n) * cs->Wi / cs->pdf;
             L = SafeDiv(L, lambda.PDF());
-            if (L && Unoccluded(cs->pRef, cs->pLens))
-                camera.GetFilm().AddSplat(cs->pRaster, L, lambda);
+            if (L)
+                splats.Add(cs->pRef.SpawnRayTo(cs->pLens), 1 - ShadowEpsilon,
+                           {cs->pRaster, L, lambda});
         }
 
         // Sample BSDF and update light path state
@@ -620,150 +1713,339 @@ STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_PERCENT("Integrator/Regularized BSDFs", regularizedBSDFs, totalBSDFs);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
 
+// Path Guiding Local Definitions
+// Guided vertices sample this fraction of their directions from the guiding
+// distribution and the rest from the BSDF.
+static constexpr Float GuidingFraction = 0.5f;
+
+// Adjoint-Driven Russian Roulette and Splitting Local Definitions
+// Paths are terminated or split so that their expected contribution relative
+// to that of their first vertex stays within this window.
+static constexpr Float RRWindowMin = 1.f / 3, RRWindowMax = 5.f / 3;
+static constexpr Float RRMinSurvivalProbability = 0.05f;
+static constexpr int MaxSplitFactor = 8;
+
+// Returns the density of directions sampled from the combination of _bsdf_
+// and _guide_, or just from _bsdf_ if _guide_ is null
+static Float GuidedScatteringPDF(const BSDF &bsdf, const DirectionalQuadtree *guide,
+                                 Vector3f wo, Vector3f wi) {
+    Float pdf = bsdf.PDF(wo, wi);
+    if (!guide)
+        return pdf;
+    return GuidingFraction * guide->PDF(wi) + (1 - GuidingFraction) * pdf;
+}
+
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth, CameraHandle camera, SamplerHandle sampler,
                                PrimitiveHandle aggregate, std::vector<LightHandle> lights,
-                               const std::string &lightSampleStrategy, bool regularize)
+                               const std::string &lightSampleStrategy, bool regularize,
+                               bool wavefront, int nLightCandidates,
+                               const std::string &guiding,
+                               const std::string &russianRoulette)
     : RayIntegrator(camera, sampler, aggregate, lights),
       maxDepth(maxDepth),
-      lightSampler(LightSamplerHandle::Create(lightSampleStrategy, lights, Allocator())),
-      regularize(regularize) {}
+      lightSampler(
+          LightSamplerHandle::Create(lightSampleStrategy, lights, IntegratorAllocator())),
+      regularize(regularize),
+      wavefront(wavefront),
+      nLightCandidates(nLightCandidates),
+      sceneBounds(aggregate ? aggregate.Bounds() : Bounds3f()),
+      spatialLightSampler(lightSampler.CastOrNullptr<SpatialLightSampler>()) {
+    if (guiding == "sdtree")
+        guidingTree = std::make_unique<SDTree>(sceneBounds);
+    if (russianRoulette == "adjoint")
+        radianceCache = std::make_unique<RadianceCache>(sceneBounds);
+}
 
 SampledSpectrum PathIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                    SamplerHandle sampler, ScratchBuffer &scratchBuffer,
                                    VisibleSurface *visibleSurf) const {
-    // Declare local variables for _PathIntegrator::Li()_
-    SampledSpectrum L(0.f), beta(1.f);
-    int depth = 0;
+    PathState path(ray);
+    return TracePath<false>(path, lambda, sampler, scratchBuffer, visibleSurf);
+}
 
-    Float bsdfPDF, etaScale = 1;
-    bool specularBounce = false, anyNonSpecularBounces = false;
-    LightSampleContext prevIntrCtx;
+SampledSpectrum PathIntegrator::LiWithAOVs(RayDifferential ray,
+                                           SampledWavelengths &lambda,
+                                           SamplerHandle sampler,
+                                           ScratchBuffer &scratchBuffer,
+                                           VisibleSurface *visibleSurf,
+                                           AOVSample *aov) const {
+    PathState path(ray);
+    path.aov = aov;
+    return TracePath<true>(path, lambda, sampler, scratchBuffer, visibleSurf);
+}
 
+template <bool ComputeAOVs>
+SampledSpectrum PathIntegrator::TracePath(PathState &path, SampledWavelengths &lambda,
+                                          SamplerHandle sampler,
+                                          ScratchBuffer &scratchBuffer,
+                                          VisibleSurface *visibleSurf) const {
+    SampledSpectrum L(0.f);
+    path.splittable = true;
+    std::vector<PathState> splitPaths;
     while (true) {
         // Find next path vertex and accumulate contribution
-        pstd::optional<ShapeIntersection> si = Intersect(ray);
-        // Add emitted light at path vertex or from the environment
-        if (!si) {
-            // Incorporate emission from infinite lights for escaped ray
-            for (const auto &light : infiniteLights) {
-                SampledSpectrum Le = light.Le(ray, lambda);
-                if (depth == 0 || specularBounce)
-                    L += SafeDiv(beta * Le, lambda.PDF());
-                else {
-                    // Compute MIS weight for infinite light
-                    Float lightPDF =
-                        lightSampler.PDF(prevIntrCtx, light) *
-                        light.PDF_Li(prevIntrCtx, ray.d, LightSamplingMode::WithMIS);
-                    Float weight = PowerHeuristic(1, bsdfPDF, 1, lightPDF);
+        pstd::optional<ShapeIntersection> si = Intersect(path.ray);
+        bool extended = ExtendPath<ComputeAOVs>(path, si, lambda, sampler, scratchBuffer,
+                                                visibleSurf, nullptr, nullptr);
+        // Set aside the paths that _path_ was split into, to trace later
+        for (; path.nSplits > 0; --path.nSplits)
+            splitPaths.push_back(path.SplitOff());
+        if (extended)
+            continue;
 
-                    L += SafeDiv(beta * weight * Le, lambda.PDF());
-                }
-            }
+        // Finish _path_ and continue with a path that was split off, if any
+        RecordPathVertices(path);
+        ReportValue(pathLength, path.depth);
+        L += path.L;
+        if (splitPaths.empty())
+            return L;
+        path = splitPaths.back();
+        splitPaths.pop_back();
+    }
+}
 
-            break;
-        }
-        // Incorporate emission from emissive surface hit by ray
-        SampledSpectrum Le = si->intr.Le(-ray.d, lambda);
-        if (Le) {
+template <bool ComputeAOVs>
+bool PathIntegrator::ExtendPath(PathState &path, pstd::optional<ShapeIntersection> &si,
+                                SampledWavelengths &lambda, SamplerHandle sampler,
+                                ScratchBuffer &scratchBuffer, VisibleSurface *visibleSurf,
+                                Ray *shadowRay, SampledSpectrum *deferredLd) const {
+    RayDifferential &ray = path.ray;
+    SampledSpectrum &beta = path.beta;
+    int &depth = path.depth;
+    Float &bsdfPDF = path.bsdfPDF, &etaScale = path.etaScale;
+    bool &specularBounce = path.specularBounce;
+    bool &anyNonSpecularBounces = path.anyNonSpecularBounces;
+    LightSampleContext &prevIntrCtx = path.prevIntrCtx;
+
+    // Add emitted light at path vertex or from the environment
+    if (!si) {
+        // Incorporate emission from infinite lights for escaped ray
+        for (const auto &light : infiniteLights) {
+            SampledSpectrum Le = light.Le(ray, lambda);
             if (depth == 0 || specularBounce)
-                L += SafeDiv(beta * Le, lambda.PDF());
+                Le = SafeDiv(beta * Le, lambda.PDF());
             else {
-                // Compute MIS weight for area light
-                LightHandle areaLight(si->intr.areaLight);
+                // Compute MIS weight for infinite light
                 Float lightPDF =
-                    lightSampler.PDF(prevIntrCtx, areaLight) *
-                    areaLight.PDF_Li(prevIntrCtx, ray.d, LightSamplingMode::WithMIS);
+                    lightSampler.PDF(prevIntrCtx, light) *
+                    light.PDF_Li(prevIntrCtx, ray.d, LightSamplingMode::WithMIS);
                 Float weight = PowerHeuristic(1, bsdfPDF, 1, lightPDF);
 
-                L += SafeDiv(beta * weight * Le, lambda.PDF());
+                Le = SafeDiv(beta * weight * Le, lambda.PDF());
             }
+            path.AddRadiance(Le, path.nGuidingVertices);
+            if constexpr (ComputeAOVs)
+                path.aov->AddRadiance(Le, path.aovLobe, light);
         }
 
-        SurfaceInteraction &isect = si->intr;
-        // Get BSDF and skip over medium boundaries
-        BSDF bsdf = isect.GetBSDF(ray, lambda, camera, scratchBuffer, sampler);
-        if (!bsdf) {
-            isect.SkipIntersection(&ray, si->tHit);
-            continue;
+        return false;
+    }
+    // Incorporate emission from emissive surface hit by ray
+    SampledSpectrum Le = si->intr.Le(-ray.d, lambda);
+    if (Le) {
+        LightHandle areaLight(si->intr.areaLight);
+        if (depth == 0 || specularBounce)
+            Le = SafeDiv(beta * Le, lambda.PDF());
+        else {
+            // Compute MIS weight for area light
+            Float lightPDF =
+                lightSampler.PDF(prevIntrCtx, areaLight) *
+                areaLight.PDF_Li(prevIntrCtx, ray.d, LightSamplingMode::WithMIS);
+            Float weight = PowerHeuristic(1, bsdfPDF, 1, lightPDF);
+
+            Le = SafeDiv(beta * weight * Le, lambda.PDF());
         }
+        path.AddRadiance(Le, path.nGuidingVertices);
+        if constexpr (ComputeAOVs)
+            path.aov->AddRadiance(Le, path.aovLobe, areaLight);
+    }
 
-        // Initialize _visibleSurf_ at first intersection
-        if (depth == 0 && visibleSurf != nullptr) {
-            // Estimate BSDF's albedo
-            constexpr int nRhoSamples = 16;
-            SampledSpectrum rho(0.f);
-            for (int i = 0; i < nRhoSamples; ++i) {
-                // Generate sample for hemispherical-directional reflectance
-                Float uc = RadicalInverse(0, i + 1);
-                Point2f u(RadicalInverse(1, i + 1), RadicalInverse(2, i + 1));
+    SurfaceInteraction &isect = si->intr;
+    // Get BSDF and skip over medium boundaries
+    BSDF bsdf = isect.GetBSDF(ray, lambda, camera, scratchBuffer, sampler);
+    if (!bsdf) {
+        isect.SkipIntersection(&ray, si->tHit);
+        return true;
+    }
 
-                // Estimate one term of $\rho_\roman{hd}$
-                pstd::optional<BSDFSample> bs = bsdf.Sample_f(si->intr.wo, uc, u);
-                if (bs)
-                    rho += bs->f * AbsDot(bs->wi, si->intr.shading.n) / bs->pdf;
-            }
-            SampledSpectrum albedo = rho / nRhoSamples;
+    // Look up the vertex's cached radiance and start recording its radiance
+    pstd::optional<Float> Lcache;
+    if (radianceCache) {
+        Lcache = radianceCache->Lookup(isect.p());
+        if (depth == 0)
+            path.rrReference = Lcache.value_or(0);
+        if (depth < maxDepth && path.nCacheVertices < MaxCacheVertices)
+            path.cacheVertices[path.nCacheVertices++] = CacheVertex{isect.p(), beta, Le};
+    }
 
-            *visibleSurf =
-                VisibleSurface(si->intr, camera.GetCameraTransform(), albedo, lambda);
+    // Initialize _visibleSurf_ at first intersection
+    if (depth == 0 && visibleSurf != nullptr) {
+        // Estimate BSDF's albedo
+        constexpr int nRhoSamples = 16;
+        SampledSpectrum rho(0.f);
+        for (int i = 0; i < nRhoSamples; ++i) {
+            // Generate sample for hemispherical-directional reflectance
+            Float uc = RadicalInverse(0, i + 1);
+            Point2f u(RadicalInverse(1, i + 1), RadicalInverse(2, i + 1));
+
+            // Estimate one term of $\rho_\roman{hd}$
+            pstd::optional<BSDFSample> bs = bsdf.Sample_f(si->intr.wo, uc, u);
+            if (bs)
+                rho += bs->f * AbsDot(bs->wi, si->intr.shading.n) / bs->pdf;
         }
+        SampledSpectrum albedo = rho / nRhoSamples;
 
-        // End path if maximum depth reached
-        if (depth++ == maxDepth)
-            break;
+        *visibleSurf =
+            VisibleSurface(si->intr, camera.GetCameraTransform(), albedo, lambda);
+    }
+    if constexpr (ComputeAOVs)
+        if (depth == 0)
+            path.aov->material = isect.material;
 
-        // Possibly regularize the BSDF
-        if (regularize && anyNonSpecularBounces) {
-            ++regularizedBSDFs;
-            bsdf.Regularize();
+    // End path if maximum depth reached
+    if (depth++ == maxDepth)
+        return false;
+
+    // Possibly regularize the BSDF
+    if (regularize && anyNonSpecularBounces) {
+        ++regularizedBSDFs;
+        bsdf.Regularize();
+    }
+
+    ++totalBSDFs;
+    // Find the guiding distribution if the BSDF can be sampled with it
+    // Specular and transmissive BSDFs aren't guided, nor are ones whose PDF
+    // isn't exact, since the probability of sampling directions with the
+    // combination of the two distributions must be known.
+    SDTree::Leaf *guidingLeaf = nullptr;
+    if (guidingTree && bsdf.IsNonSpecular() && !bsdf.IsSpecular() &&
+        !bsdf.HasTransmission() && bsdf.HasExactPDF())
+        guidingLeaf = guidingTree->Lookup(isect.p());
+    const DirectionalQuadtree *guide = nullptr;
+    if (guidingLeaf && guidingLeaf->sampling.Total() > 0)
+        guide = &guidingLeaf->sampling;
+
+    // Sample direct illumination from the light sources
+    if (bsdf.IsNonSpecular()) {
+        ++totalPaths;
+        LightHandle light;
+        BxDFFlags flags = BxDFFlags::Unset;
+        SampledSpectrum Ld = ComputeAOVs ? SampleLd(isect, &bsdf, guide, lambda, sampler,
+                                                    shadowRay, &light, &flags)
+                                         : SampleLd(isect, &bsdf, guide, lambda, sampler,
+                                                    shadowRay);
+        if (!Ld)
+            ++zeroRadiancePaths;
+        Ld = SafeDiv(beta * Ld, lambda.PDF());
+        if (shadowRay) {
+            *deferredLd = Ld;
+            path.nDeferredGuidingVertices = path.nGuidingVertices;
+        } else
+            path.AddRadiance(Ld, path.nGuidingVertices);
+        if constexpr (ComputeAOVs) {
+            // Direct lighting at the first vertex is attributed to the lobe
+            // that scatters it; later vertices inherit the first one's lobe
+            AOVLobe lobe = depth == 1 ? GetAOVLobe(flags) : path.aovLobe;
+            if (shadowRay) {
+                path.deferredLight = light;
+                path.deferredLobe = lobe;
+            } else if (Ld)
+                path.aov->AddRadiance(Ld, lobe, light);
         }
+    }
 
-        ++totalBSDFs;
-        // Sample direct illumination from the light sources
-        if (bsdf.IsNonSpecular()) {
-            ++totalPaths;
-            SampledSpectrum Ld = SampleLd(isect, &bsdf, lambda, sampler);
-            if (!Ld)
-                ++zeroRadiancePaths;
-            L += SafeDiv(beta * Ld, lambda.PDF());
+    // Sample BSDF or guiding distribution to get new path direction
+    Vector3f wo = -ray.d;
+    Float u = sampler.Get1D();
+    Point2f u2 = sampler.Get2D();
+    pstd::optional<BSDFSample> bs;
+    if (guide && u < GuidingFraction) {
+        Vector3f wi = guide->Sample(u2);
+        if (SampledSpectrum f = bsdf.f(wo, wi); f)
+            bs = BSDFSample(f, wi, 0,
+                            bsdf.IsGlossy() ? BxDFFlags::GlossyReflection
+                                            : BxDFFlags::DiffuseReflection);
+    } else {
+        if (guide)
+            u = std::min((u - GuidingFraction) / (1 - GuidingFraction), OneMinusEpsilon);
+        bs = bsdf.Sample_f(wo, u, u2);
+    }
+    if (!bs)
+        return false;
+    if (guide)
+        bs->pdf = GuidedScatteringPDF(bsdf, guide, wo, bs->wi);
+    // Update path state variables for after surface scattering
+    beta *= bs->f * AbsDot(bs->wi, isect.shading.n) / bs->pdf;
+    bsdfPDF = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
+    DCHECK(!IsInf(beta.y(lambda)));
+    if (guidingLeaf && path.nGuidingVertices < MaxGuidingVertices)
+        path.guidingVertices[path.nGuidingVertices++] =
+            GuidingVertex{guidingLeaf, bs->wi, bsdfPDF, beta, SampledSpectrum(0.f)};
+    specularBounce = bs->IsSpecular();
+    anyNonSpecularBounces |= !bs->IsSpecular();
+    if constexpr (ComputeAOVs)
+        if (depth == 1)
+            path.aovLobe = GetAOVLobe(bs->flags);
+    if (bs->IsTransmission())
+        etaScale *= Sqr(bs->eta);
+    prevIntrCtx = si->intr;
+
+    ray = isect.SpawnRay(ray, bsdf, bs->wi, bs->flags, bs->eta);
+
+    // Possibly terminate or split the path according to its expected contribution
+    if (Lcache && path.rrReference > 0) {
+        // The radiance leaving the vertex approximates that arriving at it.
+        Float ratio = beta.Average() * *Lcache / path.rrReference;
+        if (ratio < RRWindowMin) {
+            Float survival = std::max(ratio / RRWindowMin, RRMinSurvivalProbability);
+            if (sampler.Get1D() >= survival)
+                return false;
+            beta /= survival;
+            DCHECK(!IsInf(beta.y(lambda)));
+        } else if (ratio > RRWindowMax && path.splittable) {
+            // Split the path into _n_ paths that share its throughput
+            int n = std::min<int>(std::ceil(ratio), MaxSplitFactor);
+            beta /= n;
+            for (int i = 0; i < path.nGuidingVertices; ++i)
+                path.guidingVertices[i].beta /= n;
+            for (int i = 0; i < path.nCacheVertices; ++i)
+                path.cacheVertices[i].beta /= n;
+            path.nSplits = n - 1;
         }
+        return true;
+    }
 
-        // Sample BSDF to get new path direction
-        Vector3f wo = -ray.d;
-        Float u = sampler.Get1D();
-        pstd::optional<BSDFSample> bs = bsdf.Sample_f(wo, u, sampler.Get2D());
-        if (!bs)
-            break;
-        // Update path state variables for after surface scattering
-        beta *= bs->f * AbsDot(bs->wi, isect.shading.n) / bs->pdf;
-        bsdfPDF = bs->pdfIsProportional ? bsdf.PDF(wo, bs->wi) : bs->pdf;
+    // Possibly terminate the path with Russian roulette
+    SampledSpectrum rrBeta = beta * etaScale;
+    if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+        Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
+        if (sampler.Get1D() < q)
+            return false;
+        beta /= 1 - q;
         DCHECK(!IsInf(beta.y(lambda)));
-        specularBounce = bs->IsSpecular();
-        anyNonSpecularBounces |= !bs->IsSpecular();
-        if (bs->IsTransmission())
-            etaScale *= Sqr(bs->eta);
-        prevIntrCtx = si->intr;
-
-        ray = isect.SpawnRay(ray, bsdf, bs->wi, bs->flags, bs->eta);
+    }
+    return true;
+}
 
-        // Possibly terminate the path with Russian roulette
-        SampledSpectrum rrBeta = beta * etaScale;
-        if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
-            Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
-            if (sampler.Get1D() < q)
-                break;
-            beta /= 1 - q;
-            DCHECK(!IsInf(beta.y(lambda)));
-        }
+void PathIntegrator::RecordPathVertices(const PathState &path) const {
+    for (int i = 0; i < path.nGuidingVertices; ++i) {
+        // Divide out the throughput up to the vertex to estimate incident radiance
+        const GuidingVertex &v = path.guidingVertices[i];
+        SDTree::Record(v.leaf, v.wi, SafeDiv(v.L, v.beta).Average(), v.pdf);
+    }
+    for (int i = 0; i < path.nCacheVertices; ++i) {
+        const CacheVertex &v = path.cacheVertices[i];
+        radianceCache->Record(v.p, SafeDiv(v.L, v.beta).Average());
     }
-    ReportValue(pathLength, depth);
-    return L;
 }
 
 SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const BSDF *bsdf,
+                                         const DirectionalQuadtree *guide,
                                          SampledWavelengths &lambda,
-                                         SamplerHandle sampler) const {
+                                         SamplerHandle sampler, Ray *shadowRay,
+                                         LightHandle *sampledLightOut,
+                                         BxDFFlags *flags) const {
     // Initialize _LightSampleContext_ for light sampling
     LightSampleContext ctx(intr);
     // Try to nudge the light sampling position to correct side of the surface
@@ -772,40 +2054,299 @@ SampledSpectrum PathIntegrator::SampleLd(const SurfaceInteraction &intr, const B
     else if (bsdf->HasTransmission() && !bsdf->HasReflection())
         ctx.pi = intr.OffsetRayOrigin(-intr.wo);
 
-    // Choose a light source for the direct lighting calculation
-    pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, sampler.Get1D());
+    // Draw candidate light samples and resample one of them
+    // The first candidate uses the sampler's values and the rest are drawn
+    // using an RNG seeded with them, so that the number of sampler dimensions
+    // consumed doesn't depend on _nLightCandidates_.
+    Float u = sampler.Get1D();
     Point2f uLight = sampler.Get2D();
-    if (!sampledLight)
-        return {};
+    uint64_t seed = Hash(u, uLight);
+    RNG rng(MixBits(seed));
+    struct LightCandidate {
+        LightHandle light;
+        LightLiSample ls;
+        // MIS-weighted unshadowed contribution
+        SampledSpectrum F;
+        // Unweighted contribution, which is reported to _spatialLightSampler_
+        Float contribution;
+    };
+    WeightedReservoirSampler<LightCandidate> wrs(seed);
+    Vector3f wo = intr.wo;
+    for (int i = 0; i < nLightCandidates; ++i) {
+        if (i > 0) {
+            u = rng.Uniform<Float>();
+            uLight = Point2f(rng.Uniform<Float>(), rng.Uniform<Float>());
+        }
+        // Choose a light source and sample a point on it
+        pstd::optional<SampledLight> sampledLight = lightSampler.Sample(ctx, u);
+        if (!sampledLight)
+            continue;
+        LightHandle light = sampledLight->light;
+        DCHECK(light != nullptr && sampledLight->pdf > 0);
+        pstd::optional<LightLiSample> ls =
+            light.SampleLi(ctx, uLight, lambda, LightSamplingMode::WithMIS);
+        if (!ls || !ls->L || ls->pdf == 0)
+            continue;
 
-    // Sample a point on the light source for direct lighting
-    LightHandle light = sampledLight->light;
-    DCHECK(light != nullptr && sampledLight->pdf > 0);
-    pstd::optional<LightLiSample> ls =
-        light.SampleLi(ctx, uLight, lambda, LightSamplingMode::WithMIS);
-    if (!ls || !ls->L || ls->pdf == 0)
+        // Evaluate BSDF for light sample and add candidate to reservoir
+        SampledSpectrum f = bsdf->f(wo, ls->wi) * AbsDot(ls->wi, intr.shading.n);
+        if (!f)
+            continue;
+        Float lightPDF = sampledLight->pdf * ls->pdf;
+        Float weight = 1;
+        if (!IsDeltaLight(light.Type()))
+            weight = PowerHeuristic(1, lightPDF, 1,
+                                    GuidedScatteringPDF(*bsdf, guide, wo, ls->wi));
+        SampledSpectrum F = f * ls->L * weight;
+        // The candidates' target function is the average of _F_
+        if (Float pHat = F.Average(); pHat > 0) {
+            Float contribution = (f * ls->L).Average() / ls->pdf;
+            wrs.Add(LightCandidate{light, *ls, F, contribution}, pHat / lightPDF);
+        }
+    }
+    if (!wrs.HasSample())
         return {};
 
-    // Evaluate BSDF for light sample and check light visibility
-    Vector3f wo = intr.wo, wi = ls->wi;
-    SampledSpectrum f = bsdf->f(wo, wi) * AbsDot(wi, intr.shading.n);
-    if (!f || !Unoccluded(intr, ls->pLight))
-        return {};
+    // Check visibility of the resampled light sample
+    const LightCandidate &c = wrs.GetSample();
+    Vector3f wi = c.ls.wi;
+    if (shadowRay)
+        // Leave visibility to be tested by the caller
+        *shadowRay = intr.SpawnRayTo(c.ls.pLight);
+    else {
+        bool occluded = IntersectShadowP(intr.SpawnRayTo(c.ls.pLight), 1 - ShadowEpsilon);
+        if (spatialLightSampler)
+            spatialLightSampler->Record(ctx.p(), c.light, occluded ? 0 : c.contribution);
+        if (occluded)
+            return {};
+    }
+
+    if (sampledLightOut)
+        *sampledLightOut = c.light;
+    if (flags) {
+        // Classify the scattering by the side of the surface that _wi_ is on
+        bool reflect = Dot(wo, intr.shading.n) * Dot(wi, intr.shading.n) > 0;
+        *flags = BxDFFlags((reflect ? BxDFFlags::Reflection : BxDFFlags::Transmission) |
+                           (bsdf->IsGlossy() ? BxDFFlags::Glossy : BxDFFlags::Diffuse));
+    }
 
     // Return light's contribution to reflected radiance
-    Float lightPDF = sampledLight->pdf * ls->pdf;
-    if (IsDeltaLight(light.Type()))
-        return f * ls->L / lightPDF;
-    else {
-        Float bsdfPDF = bsdf->PDF(wo, wi);
-        Float weight = PowerHeuristic(1, lightPDF, 1, bsdfPDF);
-        return f * ls->L * weight / lightPDF;
+    // With a single candidate, this is _F_ divided by the light sample's PDF.
+    return c.F * wrs.WeightSum() / (nLightCandidates * c.F.Average());
+}
+
+void PathIntegrator::EndWave(int waveSamples) {
+    if (spatialLightSampler)
+        spatialLightSampler->Update();
+    if (guidingTree)
+        guidingTree->Update(waveSamples);
+    if (radianceCache)
+        radianceCache->Update();
+}
+
+void PathIntegrator::EvaluateTileSamples(Bounds2i tileBounds, int sampleStart,
+                                         int sampleEnd, SamplerHandle sampler,
+                                         ScratchBuffer &scratchBuffer) {
+    if (wavefront)
+        EvaluateTileSamplesWavefront(tileBounds, sampleStart, sampleEnd, sampler,
+                                     scratchBuffer);
+    else
+        RayIntegrator::EvaluateTileSamples(tileBounds, sampleStart, sampleEnd, sampler,
+                                           scratchBuffer);
+}
+
+// Wavefront Path Tracing Local Definitions
+// Since path vertices are processed out of order, samplers are restarted at
+// each vertex at a dimension given by the number of dimensions used for the
+// camera ray and reserved for each preceding vertex.
+static constexpr int WavefrontCameraDimensions = 6;
+static constexpr int WavefrontVertexDimensions = 9;
+static constexpr int MaxWavefrontPaths = 16384;
+
+// Rays are sorted by direction octant and then by the Morton order of the
+// cell of a $1024^3$ grid over the scene bounds that their origin is in
+static uint64_t RaySortKey(const Ray &ray, const Bounds3f &sceneBounds) {
+    Vector3f o = sceneBounds.Offset(ray.o);
+    uint32_t cell = EncodeMorton3(1024 * Clamp(o.x, 0, 1), 1024 * Clamp(o.y, 0, 1),
+                                  1024 * Clamp(o.z, 0, 1));
+    int octant = int(ray.d.x < 0) | (int(ray.d.y < 0) << 1) | (int(ray.d.z < 0) << 2);
+    return (uint64_t(octant) << 30) | cell;
+}
+
+void PathIntegrator::EvaluateTileSamplesWavefront(Bounds2i tileBounds, int sampleStart,
+                                                  int sampleEnd, SamplerHandle sampler,
+                                                  ScratchBuffer &scratchBuffer) {
+    // WavefrontPath Definition
+    struct WavefrontPath {
+        WavefrontPath(const RayDifferential &ray) : path(ray) {}
+        PathState path;
+        Point2i pPixel;
+        int sampleIndex;
+        // Path vertices processed so far, including skipped intersections
+        int nVertices = 0;
+        SampledWavelengths lambda;
+        SampledSpectrum cameraWeight;
+        Float filterWeight;
+        VisibleSurface visibleSurface;
+    };
+
+    bool initializeVisibleSurface = camera.GetFilm().UsesVisibleSurface();
+    AOVFlags aovs = IntegratorAOVs(camera.GetFilm().RequestedAOVs());
+    int nSamples = sampleEnd - sampleStart;
+    int64_t nPixelSamples = int64_t(tileBounds.Area()) * nSamples;
+    std::vector<WavefrontPath> paths;
+    // Paths' AOVs are stored separately so that they take no space in
+    // _paths_ unless the film requests them.
+    std::vector<AOVSample> pathAOVs;
+    std::vector<int> active, nextActive, finished, materialOrder;
+    std::vector<std::pair<uint64_t, int>> sortedPaths;
+    std::vector<Ray> rays;
+    // Shadow rays carry the index of their path and its direct lighting
+    ShadowRayBatch<std::pair<int, SampledSpectrum>> shadowRays;
+    for (int64_t batchStart = 0; batchStart < nPixelSamples;
+         batchStart += MaxWavefrontPaths) {
+        // Generate camera rays for batch of pixel samples
+        int64_t batchEnd =
+            std::min<int64_t>(nPixelSamples, batchStart + MaxWavefrontPaths);
+        paths.clear();
+        paths.reserve(batchEnd - batchStart);
+        pathAOVs.clear();
+        if (aovs != AOVFlags::None)
+            pathAOVs.reserve(batchEnd - batchStart);
+        for (int64_t i = batchStart; i < batchEnd; ++i) {
+            int pixelOffset = i / nSamples;
+            Point2i pPixel(tileBounds.pMin.x + pixelOffset % tileBounds.Diagonal().x,
+                           tileBounds.pMin.y + pixelOffset / tileBounds.Diagonal().x);
+            int sampleIndex = sampleStart + i % nSamples;
+            if (PixelConverged(pPixel))
+                continue;
+            threadPixel = pPixel;
+            threadSampleIndex = sampleIndex;
+            sampler.StartPixelSample(pPixel, sampleIndex);
+            SampledWavelengths lambda;
+            CameraSample cameraSample;
+            pstd::optional<CameraRayDifferential> cameraRay =
+                GenerateCameraRay(pPixel, sampler, &lambda, &cameraSample);
+            if (!cameraRay) {
+                VisibleSurface visibleSurface;
+                AddCameraSample(pPixel, sampleIndex, SampledSpectrum(0.f), lambda,
+                                &visibleSurface, cameraSample.weight);
+                continue;
+            }
+
+            WavefrontPath &p = paths.emplace_back(cameraRay->ray);
+            p.pPixel = pPixel;
+            p.sampleIndex = sampleIndex;
+            p.lambda = lambda;
+            p.cameraWeight = cameraRay->weight;
+            p.filterWeight = cameraSample.weight;
+            if (aovs != AOVFlags::None)
+                p.path.aov = &pathAOVs.emplace_back(aovs);
+        }
+
+        // Trace batch's paths one vertex at a time
+        active.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i)
+            active[i] = i;
+        while (!active.empty()) {
+            // Sort active paths' rays and find their intersections
+            sortedPaths.clear();
+            for (int index : active)
+                sortedPaths.push_back(
+                    {RaySortKey(paths[index].path.ray, sceneBounds), index});
+            std::sort(sortedPaths.begin(), sortedPaths.end());
+            rays.clear();
+            for (const auto &sp : sortedPaths)
+                rays.push_back(paths[sp.second].path.ray);
+            std::vector<Float> tMax(rays.size(), Infinity);
+            std::vector<pstd::optional<ShapeIntersection>> si(rays.size());
+            IntersectN(rays, tMax, pstd::MakeSpan(si));
+
+            // Group intersections by material type with a counting sort that
+            // keeps the rays' order within each group, so that consecutive
+            // paths' BSDFs are evaluated by the same material's code
+            int tagStart[MaterialHandle::NumTags() + 1] = {};
+            auto materialTag = [&](size_t i) {
+                return si[i] ? si[i]->intr.material.Tag() : 0;
+            };
+            for (size_t i = 0; i < si.size(); ++i)
+                ++tagStart[materialTag(i) + 1];
+            for (size_t t = 1; t <= MaterialHandle::NumTags(); ++t)
+                tagStart[t] += tagStart[t - 1];
+            materialOrder.resize(si.size());
+            for (size_t i = 0; i < si.size(); ++i)
+                materialOrder[tagStart[materialTag(i)]++] = i;
+
+            // Extend paths in material order, gathering their shadow rays
+            nextActive.clear();
+            finished.clear();
+            for (int i : materialOrder) {
+                int index = sortedPaths[i].second;
+                WavefrontPath &p = paths[index];
+                StatsReportPixelStart(p.pPixel);
+                threadPixel = p.pPixel;
+                threadSampleIndex = p.sampleIndex;
+                sampler.StartPixelSample(p.pPixel, p.sampleIndex,
+                                         WavefrontCameraDimensions +
+                                             WavefrontVertexDimensions * p.nVertices++);
+                Ray shadowRay;
+                SampledSpectrum Ld(0.f);
+                VisibleSurface *visibleSurf =
+                    initializeVisibleSurface ? &p.visibleSurface : nullptr;
+                bool extended =
+                    p.path.aov ? ExtendPath<true>(p.path, si[i], p.lambda, sampler,
+                                                  scratchBuffer, visibleSurf, &shadowRay,
+                                                  &Ld)
+                               : ExtendPath<false>(p.path, si[i], p.lambda, sampler,
+                                                   scratchBuffer, visibleSurf,
+                                                   &shadowRay, &Ld);
+                if (extended)
+                    nextActive.push_back(index);
+                else
+                    finished.push_back(index);
+                scratchBuffer.Reset();
+                if (Ld)
+                    shadowRays.Add(shadowRay, 1 - ShadowEpsilon, {index, Ld});
+                StatsReportPixelEnd(p.pPixel);
+            }
+
+            // Trace shadow rays and add unoccluded direct lighting
+            shadowRays.Flush(*this, [&](const std::pair<int, SampledSpectrum> &sr,
+                                        bool occluded) {
+                if (occluded) {
+                    ++zeroRadiancePaths;
+                    return;
+                }
+                PathState &path = paths[sr.first].path;
+                path.AddRadiance(sr.second, path.nDeferredGuidingVertices);
+                if (path.aov)
+                    path.aov->AddRadiance(sr.second, path.deferredLobe,
+                                          path.deferredLight);
+            });
+
+            // Add radiance of finished paths to the film
+            for (int index : finished) {
+                const WavefrontPath &p = paths[index];
+                RecordPathVertices(p.path);
+                ReportValue(pathLength, p.path.depth);
+                if (p.path.aov)
+                    p.path.aov->ScaleRadiance(p.cameraWeight);
+                AddCameraSample(p.pPixel, p.sampleIndex, p.cameraWeight * p.path.L,
+                                p.lambda, &p.visibleSurface, p.filterWeight, p.path.aov);
+            }
+            active.swap(nextActive);
+        }
     }
 }
 
 std::string PathIntegrator::ToString() const {
-    return StringPrintf("[ PathIntegrator maxDepth: %d lightSampler: %s regularize: %s ]",
-                        maxDepth, lightSampler, regularize);
+    return StringPrintf("[ PathIntegrator maxDepth: %d lightSampler: %s regularize: %s "
+                        "wavefront: %s nLightCandidates: %d guidingTree: %s "
+                        "radianceCache: %s ]",
+                        maxDepth, lightSampler, regularize, wavefront, nLightCandidates,
+                        guidingTree ? guidingTree->ToString() : std::string("(nullptr)"),
+                        radianceCache ? radianceCache->ToString()
+                                      : std::string("(nullptr)"));
 }
 
 std::unique_ptr<PathIntegrator> PathIntegrator::Create(
@@ -814,8 +2355,20 @@ std::unique_ptr<PathIntegrator> PathIntegrator::Create(
     int maxDepth = parameters.GetOneInt("maxdepth", 5);
     std::string lightStrategy = parameters.GetOneString("lightsampler", "bvh");
     bool regularize = parameters.GetOneBool("regularize", false);
+    bool wavefront = parameters.GetOneBool("wavefront", false);
+    int nLightCandidates = parameters.GetOneInt("lightcandidates", 1);
+    if (nLightCandidates < 1)
+        ErrorExit(loc, "\"lightcandidates\" must be at least 1.");
+    std::string guiding = parameters.GetOneString("guiding", "none");
+    if (guiding != "none" && guiding != "sdtree")
+        ErrorExit(loc, "%s: unknown path guiding method.", guiding);
+    std::string russianRoulette =
+        parameters.GetOneString("russianroulette", "throughput");
+    if (russianRoulette != "throughput" && russianRoulette != "adjoint")
+        ErrorExit(loc, "%s: unknown Russian roulette strategy.", russianRoulette);
     return std::make_unique<PathIntegrator>(maxDepth, camera, sampler, aggregate, lights,
-                                            lightStrategy, regularize);
+                                            lightStrategy, regularize, wavefront,
+                                            nLightCandidates, guiding, russianRoulette);
 }
 
 // SimpleVolPathIntegrator Method Definitions
@@ -939,6 +2492,8 @@ std::unique_ptr<SimpleVolPathIntegrator> SimpleVolPathIntegrator::Create(
 }
 
 STAT_COUNTER("Integrator/Volume interactions", volumeInteractions);
+STAT_PERCENT("Integrator/Null-scattering volume interactions", nullCollisions,
+             nullCollisionTests);
 STAT_COUNTER("Integrator/Surface interactions", surfaceInteractions);
 
 // VolPathIntegrator Method Definitions
@@ -977,6 +2532,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
                         return false;
                     }
                     ++volumeInteractions;
+                    ++nullCollisionTests;
                     const MediumInteraction &intr = mediumSample.intr;
                     const SampledSpectrum &sigma_a = intr.sigma_a,
                                           &sigma_s = intr.sigma_s;
@@ -1045,6 +2601,7 @@ SampledSpectrum VolPathIntegrator::Li(RayDifferential ray, SampledWavelengths &l
 
                     } else {
                         // Handle null scattering along ray path
+                        ++nullCollisions;
                         SampledSpectrum sigma_n = intr.sigma_n();
                         T_hat *= Tmaj * sigma_n;
                         uniPathPDF *= Tmaj * sigma_n;
@@ -1321,13 +2878,27 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
 
     while (lightRay.d != Vector3f(0, 0, 0)) {
         // Trace ray through media to estimate transmittance
-        pstd::optional<ShapeIntersection> si = Intersect(lightRay, 1 - ShadowEpsilon);
+        pstd::optional<ShapeIntersection> si;
+        if (opaqueSurfaces) {
+            // Any surface intersected by the ray blocks it
+            if (IntersectShadowP(lightRay, 1 - ShadowEpsilon))
+                return SampledSpectrum(0.f);
+        } else
+            si = Intersect(lightRay, 1 - ShadowEpsilon);
         // Handle opaque surface along ray's path
         if (si && si->intr.material)
             return SampledSpectrum(0.f);
 
         // Update transmittance for current ray segment
-        if (lightRay.medium != nullptr) {
+        if (const HomogeneousMedium *homogeneous =
+                lightRay.medium.CastOrNullptr<HomogeneousMedium>()) {
+            // Use closed-form transmittance through homogeneous medium
+            // No sampling decisions are made along the segment, so the path PDFs
+            // are unchanged.
+            Float tMax = si ? si->tHit : (1 - ShadowEpsilon);
+            T_ray *= homogeneous->Tr(lightRay, tMax, lambda);
+
+        } else if (lightRay.medium != nullptr) {
             Float tMax = si ? si->tHit : (1 - ShadowEpsilon);
             SampledSpectrum Tmaj = lightRay.medium.SampleTmaj(
                 lightRay, tMax, rng.Uniform<Float>(), rng, lambda,
@@ -1380,9 +2951,9 @@ SampledSpectrum VolPathIntegrator::SampleLd(const Interaction &intr, const BSDF
 }
 
 std::string VolPathIntegrator::ToString() const {
-    return StringPrintf(
-        "[ VolPathIntegrator maxDepth: %d lightSampler: %s regularize: %s ]", maxDepth,
-        lightSampler, regularize);
+    return StringPrintf("[ VolPathIntegrator maxDepth: %d lightSampler: %s "
+                        "regularize: %s opaqueSurfaces: %s ]",
+                        maxDepth, lightSampler, regularize, opaqueSurfaces);
 }
 
 std::unique_ptr<VolPathIntegrator> VolPathIntegrator::Create(
@@ -1786,8 +3357,9 @@ struct Vertex {
         } else if (IsOnSurface()) {
             // Compute sampling density at emissive surface
             if (type == VertexType::Light)
-                CHECK(ei.light.Is<DiffuseAreaLight>());  // since that's all we've
-                                                         // got currently...
+                CHECK(ei.light.Is<DiffuseAreaLight>() ||
+                      ei.light.Is<TriangleLight>());  // since that's all we've
+                                                      // got currently...
             LightHandle light = (type == VertexType::Light) ? ei.light : si.areaLight;
             Float pdfPos, pdfDir;
             light.PDF_Le(ei, w, &pdfPos, &pdfDir);
@@ -2194,7 +3766,144 @@ Float InfiniteLightDensity(const std::vector<LightHandle> &infiniteLights,
     return pdf;
 }
 
+// LightVertexCache Definition
+// Light subpaths are traced with this many sets of wavelengths, one of which
+// is chosen for each camera subpath so that the two can be connected.
+static constexpr int LightVertexCacheWavelengths = 16;
+
+STAT_MEMORY_COUNTER("Memory/BDPT light vertex cache", lightVertexCacheBytes);
+STAT_COUNTER("Integrator/BDPT cached light vertices", cachedLightVertices);
+STAT_COUNTER("Integrator/BDPT cached light vertex connections", cachedVertexConnections);
+
+struct LightVertexCache {
+    // LightVertexCache Public Methods
+    LightVertexCache(int maxLightPaths, int nConnections)
+        : maxLightPaths(maxLightPaths), nConnections(nConnections) {}
+
+    // LightVertexCache::PathSet Definition
+    // Light subpaths traced with the same wavelengths; each one has
+    // _maxDepth_ + 1 entries in _vertices_, of which the first
+    // _CachedPath::nVertices_ are initialized.
+    struct CachedPath {
+        int nVertices;
+        bool secondaryTerminated;
+    };
+    struct PathSet {
+        SampledWavelengths lambda;
+        std::vector<CachedPath> paths;
+        std::vector<Vertex> vertices;
+        // Cached vertices that camera subpaths are connected to, given by the
+        // offset of their subpath in _vertices_ and the number of light
+        // subpath vertices $s$ up to and including them
+        std::vector<std::pair<int, int>> connectible;
+    };
+
+    // LightVertexCache Public Members
+    int maxLightPaths, nConnections;
+    int nPaths = 0;
+    PathSet pathSets[LightVertexCacheWavelengths];
+    // The cached vertices' BSDFs are allocated in these scratch buffers
+    ThreadLocal<ScratchBuffer> scratchBuffers{[]() { return ScratchBuffer(65536); }};
+};
+
 // BDPT Method Definitions
+BDPTIntegrator::BDPTIntegrator(CameraHandle camera, SamplerHandle sampler,
+                               PrimitiveHandle aggregate, std::vector<LightHandle> lights,
+                               int maxDepth, bool visualizeStrategies,
+                               bool visualizeWeights, bool regularize,
+                               int maxCachedLightPaths, int cacheConnections)
+    : RayIntegrator(camera, sampler, aggregate, lights),
+      maxDepth(maxDepth),
+      regularize(regularize),
+      lightSampler(new PowerLightSampler(lights, IntegratorAllocator())),
+      visualizeStrategies(visualizeStrategies),
+      visualizeWeights(visualizeWeights) {
+    if (maxCachedLightPaths > 0)
+        lightVertexCache = std::make_shared<LightVertexCache>(
+            std::max(maxCachedLightPaths, LightVertexCacheWavelengths), cacheConnections);
+}
+
+void BDPTIntegrator::BeginWave(Bounds2i pixelBounds, int sampleStart, int sampleEnd) {
+    if (!lightVertexCache)
+        return;
+    // Reset the light vertex cache and choose the wave's wavelengths
+    LightVertexCache &cache = *lightVertexCache;
+    cache.scratchBuffers.ForAll([](ScratchBuffer &buf) { buf.Reset(); });
+    int64_t nPixelSamples = int64_t(pixelBounds.Area()) * (sampleEnd - sampleStart);
+    cache.nPaths = std::min<int64_t>(cache.maxLightPaths,
+                                     std::max<int64_t>(nPixelSamples,
+                                                       LightVertexCacheWavelengths));
+    RNG rng(Hash(sampleStart, Options->seed));
+    Float lu = rng.Uniform<Float>();
+    for (int k = 0; k < LightVertexCacheWavelengths; ++k) {
+        LightVertexCache::PathSet &set = cache.pathSets[k];
+        Float u = Options->disableWavelengthJitter
+                      ? 0.5f
+                      : (k + lu) / LightVertexCacheWavelengths;
+        set.lambda = camera.GetFilm().SampleWavelengths(u);
+        int nSetPaths = (cache.nPaths - k + LightVertexCacheWavelengths - 1) /
+                        LightVertexCacheWavelengths;
+        set.paths.resize(nSetPaths);
+        set.vertices.resize(size_t(nSetPaths) * (maxDepth + 1));
+        set.connectible.clear();
+    }
+
+    // Trace light subpaths and splat their connections to the camera
+    // Splats are scaled so that they match one light subpath per pixel sample.
+    Float splatScale = Float(nPixelSamples) / cache.nPaths;
+    ParallelFor(0, cache.nPaths, [&](int64_t start, int64_t end) {
+        ScratchBuffer &scratchBuffer = cache.scratchBuffers.Get();
+        RandomSampler randomSampler(1, Options->seed);
+        SamplerHandle sampler = &randomSampler;
+        Vertex cameraVertex;
+        for (int64_t i = start; i < end; ++i) {
+            LightVertexCache::PathSet &set =
+                cache.pathSets[i % LightVertexCacheWavelengths];
+            int index = i / LightVertexCacheWavelengths;
+            sampler.StartPixelSample(Point2i(i % 65536, i / 65536), sampleStart);
+            SampledWavelengths lambda = set.lambda;
+            Vertex *path = &set.vertices[size_t(index) * (maxDepth + 1)];
+            Float time = camera.SampleTime(sampler.Get1D());
+            int nVertices =
+                GenerateLightSubpath(*this, lambda, sampler, camera, scratchBuffer,
+                                     maxDepth + 1, time, lightSampler, path, regularize);
+            set.paths[index] = {nVertices, lambda.SecondaryTerminated()};
+
+            for (int s = 2; s <= nVertices; ++s) {
+                pstd::optional<Point2f> pRaster;
+                SampledSpectrum L = ConnectBDPT(*this, lambda, path, &cameraVertex, s, 1,
+                                                lightSampler, camera, sampler, &pRaster);
+                if (L)
+                    camera.GetFilm().AddSplat(*pRaster, L * splatScale, lambda);
+            }
+        }
+    });
+
+    // Find the cached vertices that camera subpaths may be connected to
+    int64_t nConnectible = 0;
+    for (LightVertexCache::PathSet &set : cache.pathSets) {
+        for (size_t index = 0; index < set.paths.size(); ++index) {
+            int offset = index * (maxDepth + 1);
+            for (int s = 2; s <= set.paths[index].nVertices; ++s)
+                if (set.vertices[offset + s - 1].IsConnectible())
+                    set.connectible.push_back({offset, s});
+        }
+        nConnectible += set.connectible.size();
+    }
+    cachedLightVertices += nConnectible;
+
+    // Report the light vertex cache's memory use
+    int64_t bytes = 0;
+    for (const LightVertexCache::PathSet &set : cache.pathSets)
+        bytes += set.paths.capacity() * sizeof(LightVertexCache::CachedPath) +
+                 set.vertices.capacity() * sizeof(Vertex) +
+                 set.connectible.capacity() * sizeof(std::pair<int, int>);
+    lightVertexCacheBytes = std::max<int64_t>(lightVertexCacheBytes, bytes);
+    LOG_VERBOSE("Light vertex cache: %d light subpaths, %d connectible vertices, "
+                "%d MB",
+                cache.nPaths, nConnectible, bytes / (1024 * 1024));
+}
+
 void BDPTIntegrator::Render() {
     // Allocate buffers for debug visualization
     if (visualizeStrategies || visualizeWeights) {
@@ -2237,14 +3946,30 @@ void BDPTIntegrator::Render() {
 SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lambda,
                                    SamplerHandle sampler, ScratchBuffer &scratchBuffer,
                                    VisibleSurface *) const {
+    // Choose the wavelengths of a set of cached light subpaths, if available
+    const LightVertexCache::PathSet *cachedPaths = nullptr;
+    if (lightVertexCache && lightVertexCache->nPaths > 0) {
+        int k = std::min<int>(sampler.Get1D() * LightVertexCacheWavelengths,
+                              LightVertexCacheWavelengths - 1);
+        cachedPaths = &lightVertexCache->pathSets[k];
+        // The camera ray doesn't depend on the wavelengths that it was
+        // generated with, so they can be replaced here.
+        lambda = cachedPaths->lambda;
+    }
+
     // Trace the camera and light subpaths
     Vertex *cameraVertices = scratchBuffer.Alloc<Vertex[]>(maxDepth + 2);
     int nCamera = GenerateCameraSubpath(*this, ray, lambda, sampler, scratchBuffer,
                                         maxDepth + 2, camera, cameraVertices, regularize);
     Vertex *lightVertices = scratchBuffer.Alloc<Vertex[]>(maxDepth + 1);
-    int nLight = GenerateLightSubpath(*this, lambda, sampler, camera, scratchBuffer,
-                                      maxDepth + 1, cameraVertices[0].time(),
-                                      lightSampler, lightVertices, regularize);
+    // With the light vertex cache, only the $s=0$ and $s=1$ strategies are
+    // evaluated below; the others use the cached light subpaths.
+    int nLight = cachedPaths ? 1
+                             : GenerateLightSubpath(*this, lambda, sampler, camera,
+                                                    scratchBuffer, maxDepth + 1,
+                                                    cameraVertices[0].time(),
+                                                    lightSampler, lightVertices,
+                                                    regularize);
 
     SampledSpectrum L(0.f);
     // Execute all BDPT connection strategies
@@ -2281,6 +4006,43 @@ SampledSpectrum BDPTIntegrator::Li(RayDifferential ray, SampledWavelengths &lamb
         }
     }
 
+    if (cachedPaths && !cachedPaths->connectible.empty()) {
+        // Connect camera subpath vertices to randomly chosen cached light vertices
+        // Each connection is weighted so that their sum estimates the
+        // connections to all the vertices of a single light subpath.
+        const std::vector<std::pair<int, int>> &connectible = cachedPaths->connectible;
+        int nConnections = lightVertexCache->nConnections;
+        Float scale =
+            Float(connectible.size()) / (cachedPaths->paths.size() * nConnections);
+        RNG rng(Hash(sampler.Get1D(), sampler.Get1D()));
+        for (int t = 2; t <= nCamera; ++t) {
+            // Camera subpaths that escape end with a light vertex that has no
+            // light; like ConnectBDPT(), don't connect it to light subpaths
+            const Vertex &vertex = cameraVertices[t - 1];
+            if (vertex.type == VertexType::Light || !vertex.IsConnectible())
+                continue;
+            for (int i = 0; i < nConnections; ++i) {
+                int c = std::min<int>(rng.Uniform<Float>() * connectible.size(),
+                                      connectible.size() - 1);
+                int offset = connectible[c].first, s = connectible[c].second;
+                if (s + t - 2 > maxDepth)
+                    continue;
+                // Copy the light subpath, since ConnectBDPT() temporarily
+                // modifies its vertices
+                std::copy(&cachedPaths->vertices[offset],
+                          &cachedPaths->vertices[offset + s], lightVertices);
+                SampledWavelengths connectionLambda = lambda;
+                if (cachedPaths->paths[offset / (maxDepth + 1)].secondaryTerminated)
+                    connectionLambda.TerminateSecondary();
+                pstd::optional<Point2f> pFilmNew;
+                L += scale * ConnectBDPT(*this, connectionLambda, lightVertices,
+                                         cameraVertices, s, t, lightSampler, camera,
+                                         sampler, &pFilmNew);
+                ++cachedVertexConnections;
+            }
+        }
+    }
+
     return L;
 }
 
@@ -2407,9 +4169,12 @@ SampledSpectrum ConnectBDPT(const Integrator &integrator, SampledWavelengths &la
 
 std::string BDPTIntegrator::ToString() const {
     return StringPrintf("[ BDPTIntegrator maxDepth: %d visualizeStrategies: %s "
-                        "visualizeWeights: %s regularize: %s lightSampler: %s ]",
+                        "visualizeWeights: %s regularize: %s lightSampler: %s "
+                        "maxCachedLightPaths: %d cacheConnections: %d ]",
                         maxDepth, visualizeStrategies, visualizeWeights, regularize,
-                        lightSampler);
+                        lightSampler,
+                        lightVertexCache ? lightVertexCache->maxLightPaths : 0,
+                        lightVertexCache ? lightVertexCache->nConnections : 0);
 }
 
 std::unique_ptr<BDPTIntegrator> BDPTIntegrator::Create(
@@ -2426,13 +4191,29 @@ std::unique_ptr<BDPTIntegrator> BDPTIntegrator::Create(
     }
 
     bool regularize = parameters.GetOneBool("regularize", false);
+    int maxCachedLightPaths = 0;
+    int cacheConnections = parameters.GetOneInt("cacheconnections", 3);
+    if (parameters.GetOneBool("lightvertexcache", false)) {
+        if (visualizeStrategies || visualizeWeights)
+            ErrorExit(loc, "visualizestrategies/visualizeweights aren't supported with "
+                           "the light vertex cache.");
+        maxCachedLightPaths = parameters.GetOneInt("cachedlightpaths", 1 << 18);
+        if (maxCachedLightPaths <= 0 || cacheConnections <= 0)
+            ErrorExit(loc, "\"cachedlightpaths\" and \"cacheconnections\" must be "
+                           "positive.");
+    }
     return std::make_unique<BDPTIntegrator>(camera, sampler, aggregate, lights, maxDepth,
                                             visualizeStrategies, visualizeWeights,
-                                            regularize);
+                                            regularize, maxCachedLightPaths,
+                                            cacheConnections);
 }
 
 STAT_PERCENT("Integrator/Acceptance rate", acceptedMutations, totalMutations);
 
+// Markov chains are advanced this many mutations at a time before they are
+// returned to the queue of chains that are ready to run.
+static constexpr int64_t MLTMutationBatchSize = 4096;
+
 // MLTIntegrator Method Definitions
 SampledSpectrum MLTIntegrator::L(ScratchBuffer &scratchBuffer, MLTSampler &sampler,
                                  int depth, Point2f *pRaster,
@@ -2538,15 +4319,14 @@ void MLTIntegrator::Render() {
     std::vector<Float> bootstrapWeights(nBootstrapSamples, 0);
     if (!lights.empty()) {
         // Allocate scratch buffers for MLT samples
-        std::vector<ScratchBuffer> threadScratchBuffers;
-        for (int i = 0; i < MaxThreadIndex(); ++i)
-            threadScratchBuffers.push_back(ScratchBuffer(65536));
+        ThreadLocal<ScratchBuffer> threadScratchBuffers(
+            []() { return ScratchBuffer(65536); });
 
         // Generate bootstrap samples in parallel
         ProgressReporter progress(nBootstrap, "Generating bootstrap paths",
                                   Options->quiet);
         ParallelFor(0, nBootstrap, [&](int64_t start, int64_t end) {
-            ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
+            ScratchBuffer &scratchBuffer = threadScratchBuffers.Get();
             for (int64_t i = start; i < end; ++i) {
                 // Generate _i_th bootstrap sample
                 for (int depth = 0; depth <= maxDepth; ++depth) {
@@ -2574,7 +4354,7 @@ void MLTIntegrator::Render() {
               bootstrapWeights.size() * (maxDepth + 1);
 
     // Set up connection to display server, if enabled
-    std::atomic<int> finishedChains(0);
+    std::atomic<int64_t> finishedMutations(0);
     if (!Options->displayServer.empty()) {
         DisplayDynamic(
             camera.GetFilm().GetFilename(),
@@ -2585,8 +4365,8 @@ void MLTIntegrator::Render() {
                 int index = 0;
                 for (Point2i p : bounds) {
                     Float finishedPixelMutations =
-                        Float(finishedChains.load(std::memory_order_relaxed)) /
-                        Float(nChains) * mutationsPerPixel;
+                        Float(finishedMutations.load(std::memory_order_relaxed)) /
+                        Float(film.SampleBounds().Area());
                     Float scale = b / std::max<Float>(1, finishedPixelMutations);
                     RGB rgb = film.GetPixelRGB(pixelBounds.pMin + p, scale);
                     for (int c = 0; c < 3; ++c)
@@ -2602,79 +4382,127 @@ void MLTIntegrator::Render() {
         (int64_t)mutationsPerPixel * (int64_t)film.SampleBounds().Area();
     if (!lights.empty()) {
         // Allocate scratch buffers for MLT samples
-        std::vector<ScratchBuffer> threadScratchBuffers;
-        for (int i = 0; i < MaxThreadIndex(); ++i)
-            threadScratchBuffers.push_back(ScratchBuffer(65536));
-
-        ProgressReporter progress(nChains, "Rendering", Options->quiet);
-        // Run _nChains_ Markov chains in parallel
-        ParallelFor(0, nChains, [&](int i) {
-            ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
-            // Compute number of mutations to apply in current Markov chain
+        ThreadLocal<ScratchBuffer> threadScratchBuffers(
+            []() { return ScratchBuffer(65536); });
+
+        // Initialize state for the Markov chains
+        // Chains are advanced in batches of mutations, taken in round-robin
+        // order from _readyChains_, so that all of them finish at about the
+        // same time and no thread is left running a long chain at the end.
+        struct MarkovChain {
+            MarkovChain(int64_t nMutations) : nMutations(nMutations) {}
+            pstd::optional<MLTSampler> sampler;
+            RNG rng;
+            int depth;
+            Point2f pCurrent;
+            SampledWavelengths lambdaCurrent;
+            SampledSpectrum LCurrent;
+            int64_t nMutations;
+        };
+        std::vector<MarkovChain> chains;
+        std::deque<int> readyChains;
+        for (int i = 0; i < nChains; ++i) {
+            // Compute number of mutations to apply in _i_th Markov chain
             int64_t nChainMutations =
                 std::min((i + 1) * nTotalMutations / nChains, nTotalMutations) -
                 i * nTotalMutations / nChains;
+            chains.push_back(MarkovChain(nChainMutations));
+            readyChains.push_back(i);
+        }
+        std::mutex readyChainsMutex;
 
-            // Select initial state from the set of bootstrap samples
-            RNG rng(i);
-            int bootstrapIndex = bootstrapTable.Sample(rng.Uniform<Float>());
-            int depth = bootstrapIndex % (maxDepth + 1);
-            threadDepth = depth;
-
-            // Initialize local variables for selected state
-            MLTSampler sampler(mutationsPerPixel, bootstrapIndex, sigma,
-                               largeStepProbability, nSampleStreams);
-            threadSampler = &sampler;
-            Point2f pCurrent;
-            SampledWavelengths lambdaCurrent;
-            SampledSpectrum LCurrent =
-                L(scratchBuffer, sampler, depth, &pCurrent, &lambdaCurrent);
-
-            // Run the Markov chain for _nChainMutations_ steps
-            for (int64_t j = 0; j < nChainMutations; ++j) {
-                StatsReportPixelStart(Point2i(pCurrent));
-                sampler.StartIteration();
-                // Generate proposed sample and compute its radiance
-                Point2f pProposed;
-                SampledWavelengths lambdaProposed;
-                SampledSpectrum LProposed =
-                    L(scratchBuffer, sampler, depth, &pProposed, &lambdaProposed);
-
-                // Compute acceptance probability for proposed sample
-                Float accept = std::min<Float>(
-                    1, C(LProposed, lambdaProposed) / C(LCurrent, lambdaCurrent));
-
-                // Splat both current and proposed samples to _film_
-                if (accept > 0)
-                    film.AddSplat(pProposed,
-                                  LProposed * accept / C(LProposed, lambdaProposed),
-                                  lambdaProposed);
-                film.AddSplat(pCurrent,
-                              LCurrent * (1 - accept) / C(LCurrent, lambdaCurrent),
-                              lambdaCurrent);
-
-                // Accept or reject the proposal
-                if (rng.Uniform<Float>() < accept) {
-                    StatsReportPixelEnd(Point2i(pCurrent));
-                    StatsReportPixelStart(Point2i(pProposed));
-                    pCurrent = pProposed;
-                    LCurrent = LProposed;
-                    lambdaCurrent = lambdaProposed;
-                    sampler.Accept();
-                    ++acceptedMutations;
-                } else
-                    sampler.Reject();
-
-                ++totalMutations;
-                scratchBuffer.Reset();
-                StatsReportPixelEnd(Point2i(pCurrent));
+        ProgressReporter progress(nTotalMutations, "Rendering", Options->quiet);
+        ParallelFor(0, RunningThreads(), [&](int64_t) {
+            ScratchBuffer &scratchBuffer = threadScratchBuffers.Get();
+            while (true) {
+                // Take the next chain that isn't being advanced by another thread
+                int i;
+                {
+                    std::lock_guard<std::mutex> lock(readyChainsMutex);
+                    if (readyChains.empty())
+                        return;
+                    i = readyChains.front();
+                    readyChains.pop_front();
+                }
+                MarkovChain &chain = chains[i];
+                if (!chain.sampler) {
+                    // Select initial state from the set of bootstrap samples
+                    chain.rng.SetSequence(i);
+                    int bootstrapIndex =
+                        bootstrapTable.Sample(chain.rng.Uniform<Float>());
+                    chain.depth = bootstrapIndex % (maxDepth + 1);
+
+                    // Initialize local variables for selected state
+                    chain.sampler = MLTSampler(mutationsPerPixel, bootstrapIndex, sigma,
+                                               largeStepProbability, nSampleStreams);
+                    threadSampler = &*chain.sampler;
+                    threadDepth = chain.depth;
+                    chain.LCurrent = L(scratchBuffer, *chain.sampler, chain.depth,
+                                       &chain.pCurrent, &chain.lambdaCurrent);
+                    scratchBuffer.Reset();
+                }
+                MLTSampler *sampler = &*chain.sampler;
+                threadSampler = sampler;
+                threadDepth = chain.depth;
+
+                // Run the Markov chain for a batch of its remaining mutations
+                int64_t nBatchMutations =
+                    std::min<int64_t>(chain.nMutations, MLTMutationBatchSize);
+                for (int64_t j = 0; j < nBatchMutations; ++j) {
+                    StatsReportPixelStart(Point2i(chain.pCurrent));
+                    sampler->StartIteration();
+                    // Generate proposed sample and compute its radiance
+                    Point2f pProposed;
+                    SampledWavelengths lambdaProposed;
+                    SampledSpectrum LProposed = L(scratchBuffer, *sampler, chain.depth,
+                                                  &pProposed, &lambdaProposed);
+
+                    // Compute acceptance probability for proposed sample
+                    Float accept = std::min<Float>(
+                        1, C(LProposed, lambdaProposed) /
+                               C(chain.LCurrent, chain.lambdaCurrent));
+
+                    // Splat both current and proposed samples to _film_
+                    if (accept > 0)
+                        film.AddSplat(pProposed,
+                                      LProposed * accept / C(LProposed, lambdaProposed),
+                                      lambdaProposed);
+                    film.AddSplat(chain.pCurrent,
+                                  chain.LCurrent * (1 - accept) /
+                                      C(chain.LCurrent, chain.lambdaCurrent),
+                                  chain.lambdaCurrent);
+
+                    // Accept or reject the proposal
+                    if (chain.rng.Uniform<Float>() < accept) {
+                        StatsReportPixelEnd(Point2i(chain.pCurrent));
+                        StatsReportPixelStart(Point2i(pProposed));
+                        chain.pCurrent = pProposed;
+                        chain.LCurrent = LProposed;
+                        chain.lambdaCurrent = lambdaProposed;
+                        sampler->Accept();
+                        ++acceptedMutations;
+                    } else
+                        sampler->Reject();
+
+                    ++totalMutations;
+                    scratchBuffer.Reset();
+                    StatsReportPixelEnd(Point2i(chain.pCurrent));
+                }
+                chain.nMutations -= nBatchMutations;
+                finishedMutations += nBatchMutations;
+                progress.Update(nBatchMutations);
+
+                // Return the chain to the queue if it has mutations left
+                if (chain.nMutations > 0) {
+                    std::lock_guard<std::mutex> lock(readyChainsMutex);
+                    readyChains.push_back(i);
+                }
             }
-
-            ++finishedChains;
-            progress.Update(1);
         });
 
         progress.Done();
+        // Merge splats from per-thread film buffers
+        camera.GetFilm().FlushSplats();
     }
 
     // Store final image computed with MLT
@@ -2754,12 +4582,6 @@ struct SPPMPixel {
     Float n = 0;
 };
 
-// SPPMPixelListNode Definition
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
-};
-
 // SPPM Utility Functions
 static bool ToGrid(const Point3f &p, const Bounds3f &bounds, const int gridRes[3],
                    Point3i *pi) {
@@ -2789,24 +4611,23 @@ void SPPMIntegrator::Render() {
 
     // Initialize _pixels_ array for SPPM
     CHECK(!pixelBounds.IsEmpty());
-    Array2D<SPPMPixel> pixels(pixelBounds);
+    Array2D<SPPMPixel> pixels(pixelBounds, IntegratorAllocator());
     for (SPPMPixel &p : pixels)
         p.radius = initialSearchRadius;
     pixelMemoryBytes += pixels.size() * sizeof(SPPMPixel);
 
     // Create light samplers for SPPM rendering
-    BVHLightSampler lightSampler(lights, Allocator());
-    PowerLightSampler shootLightSampler(lights, Allocator());
+    BVHLightSampler lightSampler(lights, IntegratorAllocator());
+    PowerLightSampler shootLightSampler(lights, IntegratorAllocator());
 
     // Allocate per-thread _ScratchBuffer_s for SPPM rendering
-    std::vector<ScratchBuffer> threadScratchBuffers;
-    for (int i = 0; i < MaxThreadIndex(); ++i)
-        // TODO: size this
-        threadScratchBuffers.push_back(ScratchBuffer(nPixels * 1024));
+    // TODO: size this
+    ThreadLocal<ScratchBuffer> threadScratchBuffers(
+        [nPixels]() { return ScratchBuffer(nPixels * 1024); });
 
     // Allocate samplers for SPPM rendering
-    std::vector<SamplerHandle> threadSamplers =
-        samplerPrototype.Clone(MaxThreadIndex(), Allocator());
+    ThreadLocal<SamplerHandle> threadSamplers(
+        [this]() { return samplerPrototype.Clone(1, IntegratorAllocator())[0]; });
     pstd::vector<DigitPermutation> *digitPermutations(
         ComputeRadicalInversePermutations(digitPermutationsSeed));
 
@@ -2838,8 +4659,8 @@ void SPPMIntegrator::Render() {
 
         ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
             // Follow camera paths for _tileBounds_ in image for SPPM
-            ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
-            SamplerHandle sampler = threadSamplers[ThreadIndex];
+            ScratchBuffer &scratchBuffer = threadScratchBuffers.Get();
+            SamplerHandle sampler = threadSamplers.Get();
             for (Point2i pPixel : tileBounds) {
                 sampler.StartPixelSample(pPixel, iter);
                 // Generate camera ray for pixel for SPPM
@@ -2962,10 +4783,6 @@ void SPPMIntegrator::Render() {
         });
         progress.Update();
         // Create grid of all SPPM visible points
-        // Allocate grid for SPPM visible points
-        int hashSize = NextPrime(nPixels);
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
-
         // Compute grid bounds for SPPM visible points
         Bounds3f gridBounds;
         Float maxRadius = 0;
@@ -2985,52 +4802,73 @@ void SPPMIntegrator::Render() {
         for (int i = 0; i < 3; ++i)
             gridRes[i] = std::max<int>(baseGridRes * diag[i] / maxDiag, 1);
 
-        // Add visible points to SPPM grid
+        // Define _forVisiblePointCells_ to call a function for each hashed grid
+        // cell that a pixel's visible point overlaps
+        int hashSize = NextPrime(nPixels);
+        auto forVisiblePointCells = [&](const SPPMPixel &pixel, auto func) {
+            // Find grid cell bounds for pixel's visible point, _pMin_ and _pMax_
+            Float r = pixel.radius;
+            Point3i pMin, pMax;
+            ToGrid(pixel.vp.p - Vector3f(r, r, r), gridBounds, gridRes, &pMin);
+            ToGrid(pixel.vp.p + Vector3f(r, r, r), gridBounds, gridRes, &pMax);
+
+            for (int z = pMin.z; z <= pMax.z; ++z)
+                for (int y = pMin.y; y <= pMax.y; ++y)
+                    for (int x = pMin.x; x <= pMax.x; ++x) {
+                        int h = Hash(Point3i(x, y, z)) % hashSize;
+                        CHECK_GE(h, 0);
+                        func(h);
+                    }
+            return (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) * (1 + pMax.z - pMin.z);
+        };
+
+        // Sort visible points into SPPM grid cells
+        // The cell hashes are bounded by _hashSize_, so a single counting sort
+        // pass over them leaves each cell's visible points contiguous in
+        // _gridPixels_, starting at _cellStart[h]_.
+        std::vector<std::atomic<int>> cellCounts(hashSize);
+        ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
+            for (Point2i pPixel : tileBounds) {
+                const SPPMPixel &pixel = pixels[pPixel];
+                if (!pixel.vp.beta)
+                    continue;
+                int nCells = forVisiblePointCells(pixel, [&](int h) {
+                    cellCounts[h].fetch_add(1, std::memory_order_relaxed);
+                });
+                ReportValue(gridCellsPerVisiblePoint, nCells);
+            }
+        });
+
+        std::vector<int> cellStart(hashSize + 1);
+        for (int h = 0; h < hashSize; ++h) {
+            // Turn _cellCounts[h]_ into the cell's insertion offset
+            int count = cellCounts[h].load(std::memory_order_relaxed);
+            cellStart[h + 1] = cellStart[h] + count;
+            cellCounts[h].store(cellStart[h], std::memory_order_relaxed);
+        }
+
+        std::vector<SPPMPixel *> gridPixels(cellStart[hashSize]);
         ParallelFor2D(pixelBounds, [&](Bounds2i tileBounds) {
-            ScratchBuffer &scratchBuffer = threadScratchBuffers[ThreadIndex];
             for (Point2i pPixel : tileBounds) {
                 SPPMPixel &pixel = pixels[pPixel];
-                if (pixel.vp.beta) {
-                    // Add pixel's visible point to applicable grid cells
-                    // Find grid cell bounds for pixel's visible point, _pMin_ and _pMax_
-                    Float r = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(r, r, r), gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(r, r, r), gridBounds, gridRes, &pMax);
-
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = Hash(Point3i(x, y, z)) % hashSize;
-                                CHECK_GE(h, 0);
-                                SPPMPixelListNode *node =
-                                    scratchBuffer.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of _grid[h]_'s
-                                // linked list
-                                node->next = grid[h];
-                                while (!grid[h].compare_exchange_weak(node->next, node))
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint, (1 + pMax.x - pMin.x) *
-                                                              (1 + pMax.y - pMin.y) *
-                                                              (1 + pMax.z - pMin.z));
-                }
+                if (!pixel.vp.beta)
+                    continue;
+                forVisiblePointCells(pixel, [&](int h) {
+                    int offset = cellCounts[h].fetch_add(1, std::memory_order_relaxed);
+                    gridPixels[offset] = &pixel;
+                });
             }
         });
 
         // Trace photons and accumulate contributions
         // Create per-thread scratch buffers for photon shooting
-        std::vector<ScratchBuffer> photonShootScratchBuffers;
-        for (int i = 0; i < MaxThreadIndex(); ++i)
-            photonShootScratchBuffers.push_back(ScratchBuffer(65536));
+        ThreadLocal<ScratchBuffer> photonShootScratchBuffers(
+            []() { return ScratchBuffer(65536); });
 
         ParallelFor(0, photonsPerIteration, [&](int64_t start, int64_t end) {
             // Follow photon paths for photon index range _start_ - _end_
-            ScratchBuffer &scratchBuffer = photonShootScratchBuffers[ThreadIndex];
-            SamplerHandle sampler = threadSamplers[ThreadIndex];
+            ScratchBuffer &scratchBuffer = photonShootScratchBuffers.Get();
+            SamplerHandle sampler = threadSamplers.Get();
             for (int64_t photonIndex = start; photonIndex < end; ++photonIndex) {
                 // Follow photon path for _photonIndex_
                 // Define sampling lambda functions for photon shooting
@@ -3095,12 +4933,10 @@ void SPPMIntegrator::Render() {
                         if (ToGrid(isect.p(), gridBounds, gridRes, &photonGridIndex)) {
                             int h = Hash(photonGridIndex) % hashSize;
                             CHECK_GE(h, 0);
-                            // Add photon contribution to visible points in _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
+                            // Add photon contribution to visible points in cell _h_
+                            for (int i = cellStart[h]; i < cellStart[h + 1]; ++i) {
                                 ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
+                                SPPMPixel &pixel = *gridPixels[i];
                                 if (DistanceSquared(pixel.vp.p, isect.p()) >
                                     Sqr(pixel.radius))
                                     continue;
@@ -3153,8 +4989,7 @@ void SPPMIntegrator::Render() {
             }
         });
         // Reset _threadScratchBuffers_ after tracing photons
-        for (ScratchBuffer &scratchBuffer : threadScratchBuffers)
-            scratchBuffer.Reset();
+        threadScratchBuffers.ForAll([](ScratchBuffer &buf) { buf.Reset(); });
 
         progress.Update();
         photonPaths += photonsPerIteration;
@@ -3209,6 +5044,9 @@ void SPPMIntegrator::Render() {
             metadata.pixelBounds = pixelBounds;
             metadata.fullResolution = camera.GetFilm().FullResolution();
             metadata.colorSpace = colorSpace;
+            // Favor speed over size for images of intermediate iterations
+            if (iter + 1 < nIterations)
+                metadata.compressionLevel = 1;
             camera.InitMetadata(&metadata);
             rgbImage.Write(camera.GetFilm().GetFilename(), metadata);
 
@@ -3418,7 +5256,8 @@ void FunctionIntegrator::Render() {
         }
     }
 
-    std::vector<SamplerHandle> threadSamplers = baseSampler.Clone(MaxThreadIndex());
+    ThreadLocal<SamplerHandle> threadSamplers(
+        [this]() { return baseSampler.Clone(1, IntegratorAllocator())[0]; });
     for (int sampleIndex = 0; sampleIndex < nSamples; ++sampleIndex) {
         if (isStratified) {
             int spp = sampleIndex + 1;
@@ -3446,7 +5285,7 @@ void FunctionIntegrator::Render() {
             });
         } else {
             ParallelFor2D(pixelBounds, [&](Point2i pPixel) {
-                SamplerHandle &sampler = threadSamplers[ThreadIndex];
+                SamplerHandle &sampler = threadSamplers.Get();
                 sampler.StartPixelSample(pPixel, sampleIndex, 0);
 
                 Point2f u;
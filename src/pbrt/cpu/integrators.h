@@ -11,13 +11,18 @@
 #include <pbrt/base/sampler.h>
 #include <pbrt/bsdf.h>
 #include <pbrt/cameras.h>
+#include <pbrt/cpu/guiding.h>
 #include <pbrt/cpu/primitive.h>
 #include <pbrt/film.h>
 #include <pbrt/interaction.h>
 #include <pbrt/lights.h>
 #include <pbrt/lightsamplers.h>
+#include <pbrt/util/containers.h>
 #include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
@@ -30,6 +35,19 @@
 
 namespace pbrt {
 
+// Integrators allocate their state, such as light samplers and per-thread
+// samplers, with this allocator so that it is accounted to its memory
+// category.
+inline Allocator IntegratorAllocator() {
+    return CategoryAllocator(MemoryCategory::Integrator);
+}
+
+// After CancelRender() is called, an ImageTileIntegrator's render in
+// progress stops early without writing its image, as do any that start
+// before ResetRenderCancellation() is called.
+void CancelRender();
+void ResetRenderCancellation();
+
 // Integrator Definition
 class Integrator {
   public:
@@ -51,6 +69,11 @@ class Integrator {
     pstd::optional<ShapeIntersection> Intersect(const Ray &ray,
                                                 Float tMax = Infinity) const;
     bool IntersectP(const Ray &ray, Float tMax = Infinity) const;
+    bool IntersectShadowP(const Ray &ray, Float tMax = Infinity) const;
+    void IntersectN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                    pstd::span<pstd::optional<ShapeIntersection>> si) const;
+    void IntersectPN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                     pstd::span<bool> occluded) const;
 
     bool Unoccluded(const Interaction &p0, const Interaction &p1) const {
         return !IntersectP(p0.SpawnRayTo(p1), 1 - ShadowEpsilon);
@@ -79,6 +102,89 @@ class Integrator {
     }
 };
 
+// ShadowRayBatch Definition
+// Collects shadow rays along with the contributions that they carry when
+// unoccluded, so that their visibility can be tested together with
+// Integrator::IntersectPN(), similarly to the GPU integrator's
+// _ShadowRayQueue_. Batches are not thread-safe; each thread should use its
+// own.
+template <typename Payload>
+class ShadowRayBatch {
+  public:
+    // ShadowRayBatch Public Methods
+    void Add(const Ray &ray, Float tMax, const Payload &payload) {
+        rays.push_back(ray);
+        tMaxes.push_back(tMax);
+        payloads.push_back(payload);
+    }
+
+    size_t Size() const { return rays.size(); }
+    bool Empty() const { return rays.empty(); }
+
+    // Traces the batch's rays, calls _func_ with each one's payload and
+    // whether it was occluded, and then empties the batch.
+    template <typename F>
+    void Flush(const Integrator &integrator, F &&func) {
+        if (rays.empty())
+            return;
+        occluded.resize(rays.size());
+        integrator.IntersectPN(rays, tMaxes, pstd::MakeSpan(occluded));
+        for (size_t i = 0; i < payloads.size(); ++i)
+            func(payloads[i], occluded[i]);
+        rays.clear();
+        tMaxes.clear();
+        payloads.clear();
+    }
+
+  private:
+    // ShadowRayBatch Private Members
+    std::vector<Ray> rays;
+    std::vector<Float> tMaxes;
+    std::vector<Payload> payloads;
+    pstd::vector<bool> occluded;
+};
+
+// PrimaryVisibility Definition
+// Finds the first intersections of camera rays from a perspective or
+// orthographic camera without depth of field by rasterizing the scene's
+// triangles. Each triangle's raster-space bounds are binned into the image
+// tiles that they overlap once, before rendering; a camera ray is then only
+// tested against the triangles binned into the tile that its film position
+// is in, rather than traversing the scene's BVH.
+class PrimaryVisibility {
+  public:
+    // PrimaryVisibility Public Methods
+    // Returns nullptr, after issuing a warning, if the camera or the
+    // primitives can't be rasterized; the scene's BVH must directly hold
+    // opaque triangles and the camera mustn't move.
+    static std::unique_ptr<PrimaryVisibility> Create(CameraHandle camera,
+                                                     PrimitiveHandle aggregate);
+
+    // Returns false if the first intersection of _ray_, the camera ray for
+    // film position _pFilm_, must be found by tracing it; otherwise, it is
+    // returned in _si_.
+    bool Intersect(const Ray &ray, Point2f pFilm,
+                   pstd::optional<ShapeIntersection> *si) const;
+
+  private:
+    // PrimaryVisibility Private Members
+    struct RasterTriangle {
+        Bounds2f rasterBounds;
+        Point3f p[3];
+        PrimitiveHandle primitive;
+    };
+    static constexpr int TileSize = 16;
+    std::vector<RasterTriangle> triangles;
+    // Triangles that cross the plane of a perspective camera's center of
+    // projection, whose raster-space bounds are unbounded
+    std::vector<int> unboundedTriangles;
+    // The triangles binned into tile _i_ are _tileTriangles[tileOffsets[i]]_
+    // through _tileTriangles[tileOffsets[i + 1] - 1]_
+    Bounds2f tileBounds;
+    Point2i nTiles;
+    std::vector<int> tileOffsets, tileTriangles;
+};
+
 // ImageTileIntegrator Definition
 class ImageTileIntegrator : public Integrator {
   public:
@@ -93,10 +199,54 @@ class ImageTileIntegrator : public Integrator {
                                      SamplerHandle sampler,
                                      ScratchBuffer &scratchBuffer) = 0;
 
+    // Evaluates samples _sampleStart_ through _sampleEnd_ - 1 of the pixels in
+    // _tileBounds_; by default, each is evaluated with EvaluatePixelSample()
+    virtual void EvaluateTileSamples(Bounds2i tileBounds, int sampleStart, int sampleEnd,
+                                     SamplerHandle sampler, ScratchBuffer &scratchBuffer);
+
+    // Called once before rendering starts
+    virtual void BeginRender() {}
+
+    // Called before each wave of samples is rendered with the pixels and the
+    // range of sample indices that it covers
+    virtual void BeginWave(Bounds2i pixelBounds, int sampleStart, int sampleEnd) {}
+
+    // Called after each wave of samples has been rendered, before the next
+    // one starts, with the number of samples per pixel in the wave
+    virtual void EndWave(int waveSamples) {}
+
   protected:
+    // ImageTileIntegrator Protected Methods
+    // Returns true if the integrator adds splats to the film, in which case
+    // pixels' values depend on samples other than their own.
+    virtual bool SplatsToFilm() const { return false; }
+
+    // With adaptive sampling, returns true once the relative error of
+    // _pPixel_'s estimate is below the threshold, so that it needs no more
+    // samples; it then receives none for the rest of the render.
+    bool PixelConverged(Point2i pPixel) const;
+    // Returns the standard error of _pPixel_'s mean sample luminance
+    // relative to the mean; pixel statistics must have been allocated.
+    Float PixelRelativeError(Point2i pPixel) const;
+
+    // Renders this process's share of a distributed render and, for the
+    // coordinator, merges the other processes' results and writes the image
+    void RenderDistributed(ThreadLocal<ScratchBuffer> &scratchBuffers,
+                           ThreadLocal<SamplerHandle> &samplers,
+                           ProgressReporter &progress);
+
+    // Records the luminance of a sample of _pPixel_ for adaptive sampling
+    void RecordPixelSample(Point2i pPixel, Float y) {
+        if (pixelVariance.size() > 0)
+            pixelVariance[pPixel].Add(y);
+    }
+
     // ImageTileIntegrator Protected Members
     CameraHandle camera;
     SamplerHandle samplerPrototype;
+    // Per-pixel sample luminance statistics; only allocated for adaptive
+    // sampling and --target-error
+    Array2D<VarianceEstimator<Float>> pixelVariance;
 };
 
 // RayIntegrator Definition
@@ -107,12 +257,38 @@ class RayIntegrator : public ImageTileIntegrator {
                   std::vector<LightHandle> lights)
         : ImageTileIntegrator(camera, sampler, aggregate, lights) {}
 
+    void BeginRender();
+
     void EvaluatePixelSample(Point2i pPixel, int sampleIndex, SamplerHandle sampler,
                              ScratchBuffer &scratchBuffer) final;
 
     virtual SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda,
                                SamplerHandle sampler, ScratchBuffer &scratchBuffer,
                                VisibleSurface *visibleSurface) const = 0;
+
+    // Called instead of Li() when the film requests AOVs that integrators
+    // compute; integrators that support them override it to fill in _aov_.
+    virtual SampledSpectrum LiWithAOVs(RayDifferential ray, SampledWavelengths &lambda,
+                                       SamplerHandle sampler,
+                                       ScratchBuffer &scratchBuffer,
+                                       VisibleSurface *visibleSurface,
+                                       AOVSample *aov) const {
+        return Li(ray, lambda, sampler, scratchBuffer, visibleSurface);
+    }
+
+  protected:
+    // RayIntegrator Protected Methods
+    pstd::optional<CameraRayDifferential> GenerateCameraRay(
+        Point2i pPixel, SamplerHandle sampler, SampledWavelengths *lambda,
+        CameraSample *cameraSample) const;
+    void AddCameraSample(Point2i pPixel, int sampleIndex, SampledSpectrum L,
+                         const SampledWavelengths &lambda,
+                         const VisibleSurface *visibleSurface, Float weight,
+                         const AOVSample *aov = nullptr);
+
+    // RayIntegrator Protected Members
+    // Set with --raster-primary if the scene can be rasterized
+    std::unique_ptr<PrimaryVisibility> primaryVisibility;
 };
 
 // RandomWalkIntegrator Definition
@@ -216,11 +392,21 @@ class PathIntegrator : public RayIntegrator {
     PathIntegrator(int maxDepth, CameraHandle camera, SamplerHandle sampler,
                    PrimitiveHandle aggregate, std::vector<LightHandle> lights,
                    const std::string &lightSampleStrategy = "bvh",
-                   bool regularize = false);
+                   bool regularize = false, bool wavefront = false,
+                   int nLightCandidates = 1, const std::string &guiding = "none",
+                   const std::string &russianRoulette = "throughput");
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda,
                        SamplerHandle sampler, ScratchBuffer &scratchBuffer,
                        VisibleSurface *visibleSurface) const;
+    SampledSpectrum LiWithAOVs(RayDifferential ray, SampledWavelengths &lambda,
+                               SamplerHandle sampler, ScratchBuffer &scratchBuffer,
+                               VisibleSurface *visibleSurface, AOVSample *aov) const;
+
+    void EvaluateTileSamples(Bounds2i tileBounds, int sampleStart, int sampleEnd,
+                             SamplerHandle sampler, ScratchBuffer &scratchBuffer);
+
+    void EndWave(int waveSamples);
 
     static std::unique_ptr<PathIntegrator> Create(
         const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
@@ -229,14 +415,129 @@ class PathIntegrator : public RayIntegrator {
     std::string ToString() const;
 
   private:
+    // PathIntegrator Private Types
+    // Path vertex whose scattered direction was sampled with _guidingTree_'s
+    // distribution at _leaf_, or that records its radiance there
+    struct GuidingVertex {
+        SDTree::Leaf *leaf;
+        Vector3f wi;
+        Float pdf;
+        // Path throughput after scattering and the radiance found after it
+        SampledSpectrum beta, L;
+    };
+    static constexpr int MaxGuidingVertices = 8;
+    // Path vertex whose outgoing radiance is recorded in _radianceCache_
+    struct CacheVertex {
+        Point3f p;
+        // Path throughput before the vertex and the radiance found from it on
+        SampledSpectrum beta, L;
+    };
+    static constexpr int MaxCacheVertices = 8;
+
+    struct PathState {
+        PathState(const RayDifferential &ray) : ray(ray) {}
+
+        // Adds _Lp_ to the path's radiance and credits it to the first
+        // _nVertices_ guiding vertices and to all cache vertices
+        void AddRadiance(const SampledSpectrum &Lp, int nVertices) {
+            L += Lp;
+            for (int i = 0; i < nVertices; ++i)
+                guidingVertices[i].L += Lp;
+            for (int i = 0; i < nCacheVertices; ++i)
+                cacheVertices[i].L += Lp;
+        }
+
+        // Returns one of the additional paths that this one was split into,
+        // which continues from its current ray. Only this path keeps the
+        // radiance and the vertices found so far.
+        PathState SplitOff() const {
+            PathState path = *this;
+            path.L = SampledSpectrum(0.f);
+            path.nGuidingVertices = path.nCacheVertices = path.nSplits = 0;
+            return path;
+        }
+
+        RayDifferential ray;
+        SampledSpectrum L = SampledSpectrum(0.f), beta = SampledSpectrum(1.f);
+        int depth = 0;
+        Float bsdfPDF = 0, etaScale = 1;
+        bool specularBounce = false, anyNonSpecularBounces = false;
+        LightSampleContext prevIntrCtx;
+        // AOVs for the path's camera sample, which are only updated if
+        // _ExtendPath()_ is called with _ComputeAOVs_ true. Radiance is
+        // attributed to the lobe sampled at the first vertex.
+        AOVSample *aov = nullptr;
+        AOVLobe aovLobe = AOVLobe::Emission;
+        // Light and lobe of the deferred direct lighting contribution
+        LightHandle deferredLight;
+        AOVLobe deferredLobe = AOVLobe::Emission;
+        // Guiding vertices so far and the number of them that precede the
+        // vertex of the deferred direct lighting contribution
+        GuidingVertex guidingVertices[MaxGuidingVertices];
+        int nGuidingVertices = 0, nDeferredGuidingVertices = 0;
+        CacheVertex cacheVertices[MaxCacheVertices];
+        int nCacheVertices = 0;
+        // Cached radiance leaving the first vertex, which paths' expected
+        // contributions are compared to for adjoint-driven Russian roulette
+        Float rrReference = 0;
+        // If _splittable_ is true, _ExtendPath()_ may split the path, setting
+        // _nSplits_ to the number of additional paths from _SplitOff()_ that
+        // the caller must trace.
+        bool splittable = false;
+        int nSplits = 0;
+    };
+
     // PathIntegrator Private Methods
+    // Traces _path_ and any paths that it is split into and returns their
+    // radiance
+    template <bool ComputeAOVs>
+    SampledSpectrum TracePath(PathState &path, SampledWavelengths &lambda,
+                              SamplerHandle sampler, ScratchBuffer &scratchBuffer,
+                              VisibleSurface *visibleSurf) const;
+    // Updates _path_ for the intersection _si_ of its ray and returns false
+    // once the path is done. If _shadowRay_ is non-null, the direct lighting
+    // contribution is returned in _deferredLd_ and must be added to _path.L_ if
+    // _shadowRay_ is unoccluded.
+    template <bool ComputeAOVs>
+    bool ExtendPath(PathState &path, pstd::optional<ShapeIntersection> &si,
+                    SampledWavelengths &lambda, SamplerHandle sampler,
+                    ScratchBuffer &scratchBuffer, VisibleSurface *visibleSurf,
+                    Ray *shadowRay, SampledSpectrum *deferredLd) const;
+    // Traces all of a tile's paths together, one depth at a time, sorting
+    // rays for coherence
+    void EvaluateTileSamplesWavefront(Bounds2i tileBounds, int sampleStart,
+                                      int sampleEnd, SamplerHandle sampler,
+                                      ScratchBuffer &scratchBuffer);
+    // Records the incident radiance at _path_'s guiding vertices and the
+    // outgoing radiance at its cache vertices once the path is done
+    void RecordPathVertices(const PathState &path) const;
+    // Draws _nLightCandidates_ light samples and resamples one of them in
+    // proportion to its unshadowed contribution, which is the only one whose
+    // visibility is tested. If _light_ and _flags_ are non-null, they return
+    // the sampled light and the kind of scattering that its contribution is
+    // from. _guide_ is the guiding distribution that BSDF sampling at the
+    // vertex is combined with, if any.
     SampledSpectrum SampleLd(const SurfaceInteraction &intr, const BSDF *bsdf,
-                             SampledWavelengths &lambda, SamplerHandle sampler) const;
+                             const DirectionalQuadtree *guide,
+                             SampledWavelengths &lambda, SamplerHandle sampler,
+                             Ray *shadowRay = nullptr, LightHandle *light = nullptr,
+                             BxDFFlags *flags = nullptr) const;
 
     // PathIntegrator Private Members
     int maxDepth;
     LightSamplerHandle lightSampler;
     bool regularize;
+    bool wavefront;
+    int nLightCandidates;
+    Bounds3f sceneBounds;
+    // Non-null if _lightSampler_ learns from the light samples' contributions
+    SpatialLightSampler *spatialLightSampler;
+    // Learned distribution of incident radiance that non-specular reflection
+    // is partly sampled from, if guiding is enabled
+    std::unique_ptr<SDTree> guidingTree;
+    // Learned estimate of radiance leaving surfaces, if paths are terminated
+    // and split according to their expected contribution to the image
+    std::unique_ptr<RadianceCache> radianceCache;
 };
 
 // SimpleVolPathIntegrator Definition
@@ -271,9 +572,10 @@ class VolPathIntegrator : public RayIntegrator {
                       bool regularize = false)
         : RayIntegrator(camera, sampler, aggregate, lights),
           maxDepth(maxDepth),
-          lightSampler(
-              LightSamplerHandle::Create(lightSampleStrategy, lights, Allocator())),
-          regularize(regularize) {}
+          lightSampler(LightSamplerHandle::Create(lightSampleStrategy, lights,
+                                                  IntegratorAllocator())),
+          regularize(regularize),
+          opaqueSurfaces(aggregate && aggregate.HasOnlyOpaqueSurfaces()) {}
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda,
                        SamplerHandle sampler, ScratchBuffer &scratchBuffer,
@@ -316,6 +618,9 @@ class VolPathIntegrator : public RayIntegrator {
     int maxDepth;
     LightSamplerHandle lightSampler;
     bool regularize;
+    // If all surfaces are opaque, shadow rays can't pass through medium
+    // interfaces and their visibility can be found with shadow ray tests
+    bool opaqueSurfaces;
 };
 
 // AOIntegrator Definition
@@ -344,6 +649,13 @@ class AOIntegrator : public RayIntegrator {
     Float illumScale;
 };
 
+// CameraSplat Definition
+struct CameraSplat {
+    Point2f pRaster;
+    SampledSpectrum L;
+    SampledWavelengths lambda;
+};
+
 // LightPathIntegrator Definition
 class LightPathIntegrator : public ImageTileIntegrator {
   public:
@@ -353,6 +665,9 @@ class LightPathIntegrator : public ImageTileIntegrator {
 
     void EvaluatePixelSample(Point2i pPixel, int sampleIndex, SamplerHandle sampler,
                              ScratchBuffer &scratchBuffer);
+    void EvaluateTileSamples(Bounds2i tileBounds, int sampleStart, int sampleEnd,
+                             SamplerHandle sampler, ScratchBuffer &scratchBuffer);
+    void EndWave(int waveSamples);
 
     static std::unique_ptr<LightPathIntegrator> Create(
         const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
@@ -361,31 +676,45 @@ class LightPathIntegrator : public ImageTileIntegrator {
     std::string ToString() const;
 
   private:
+    // LightPathIntegrator Private Methods
+    bool SplatsToFilm() const { return true; }
+    void FlushSplats(ShadowRayBatch<CameraSplat> &splats);
+    // Returns the index of the image tile that _splat_ lands in
+    int SplatTile(const CameraSplat &splat) const;
+
     // LightPathIntegrator Private Members
     int maxDepth;
     std::unique_ptr<PowerLightSampler> lightSampler;
+    // Splats onto the film are deferred until their visibility is known
+    ThreadLocal<ShadowRayBatch<CameraSplat>> threadSplats;
+    // Visible splats are then buffered per thread, up to a fixed number, and
+    // added to the film in order of image tile so that threads rarely
+    // contend for the same pixels; the rest are added at the end of the
+    // wave, one image tile at a time
+    ThreadLocal<std::vector<CameraSplat>> threadVisibleSplats;
 };
 
 // BDPTIntegrator Definition
 struct Vertex;
+struct LightVertexCache;
 class BDPTIntegrator : public RayIntegrator {
   public:
     // BDPTIntegrator Public Methods
+    // If _maxCachedLightPaths_ is non-zero, light subpaths are traced once
+    // per wave into a light vertex cache, and each camera subpath vertex is
+    // connected to _cacheConnections_ randomly chosen cached light vertices.
     BDPTIntegrator(CameraHandle camera, SamplerHandle sampler, PrimitiveHandle aggregate,
                    std::vector<LightHandle> lights, int maxDepth,
                    bool visualizeStrategies, bool visualizeWeights,
-                   bool regularize = false)
-        : RayIntegrator(camera, sampler, aggregate, lights),
-          maxDepth(maxDepth),
-          regularize(regularize),
-          lightSampler(new PowerLightSampler(lights, Allocator())),
-          visualizeStrategies(visualizeStrategies),
-          visualizeWeights(visualizeWeights) {}
+                   bool regularize = false, int maxCachedLightPaths = 0,
+                   int cacheConnections = 0);
 
     SampledSpectrum Li(RayDifferential ray, SampledWavelengths &lambda,
                        SamplerHandle sampler, ScratchBuffer &scratchBuffer,
                        VisibleSurface *visibleSurface) const;
 
+    void BeginWave(Bounds2i pixelBounds, int sampleStart, int sampleEnd);
+
     static std::unique_ptr<BDPTIntegrator> Create(
         const ParameterDictionary &parameters, CameraHandle camera, SamplerHandle sampler,
         PrimitiveHandle aggregate, std::vector<LightHandle> lights, const FileLoc *loc);
@@ -395,12 +724,16 @@ class BDPTIntegrator : public RayIntegrator {
     void Render();
 
   private:
+    // BDPTIntegrator Private Methods
+    bool SplatsToFilm() const { return true; }
+
     // BDPTIntegrator Private Members
     int maxDepth;
     bool regularize;
     LightSamplerHandle lightSampler;
     bool visualizeStrategies, visualizeWeights;
     mutable std::vector<FilmHandle> weightFilms;
+    std::shared_ptr<LightVertexCache> lightVertexCache;
 };
 
 // MLTIntegrator Definition
@@ -414,7 +747,7 @@ class MLTIntegrator : public Integrator {
                   int nChains, int mutationsPerPixel, Float sigma,
                   Float largeStepProbability, bool regularize)
         : Integrator(aggregate, lights),
-          lightSampler(new PowerLightSampler(lights, Allocator())),
+          lightSampler(new PowerLightSampler(lights, IntegratorAllocator())),
           camera(camera),
           maxDepth(maxDepth),
           nBootstrap(nBootstrap),
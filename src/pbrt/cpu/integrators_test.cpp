@@ -7,10 +7,13 @@
 #include <pbrt/cameras.h>
 #include <pbrt/cpu/aggregates.h>
 #include <pbrt/cpu/integrators.h>
+#include <pbrt/cpu/render.h>
 #include <pbrt/filters.h>
 #include <pbrt/lights.h>
 #include <pbrt/materials.h>
 #include <pbrt/options.h>
+#include <pbrt/parsedscene.h>
+#include <pbrt/parser.h>
 #include <pbrt/pbrt.h>
 #include <pbrt/samplers.h>
 #include <pbrt/shapes.h>
@@ -18,6 +21,7 @@
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/image.h>
+#include <pbrt/util/rng.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
@@ -292,6 +296,30 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    scene});
         }
 
+        // Path tracing with tile buffers and with single-precision pixels
+        for (bool floatPixels : {false, true}) {
+            auto sampler = GetSamplers(resolution)[0];
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB, Infinity, true,
+                                        false /* thread splat buffers */,
+                                        !floatPixels /* tile buffers */,
+                                        0 /* stream tile size */, floatPixels);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+
+            const FilmHandle filmp = camera->GetFilm();
+            Integrator *integrator = new PathIntegrator(8, camera, sampler.first,
+                                                        scene.aggregate, scene.lights);
+            std::string storage = floatPixels ? "float pixels" : "tile buffers";
+            integrators.push_back({integrator, filmp,
+                                   "Path, depth 8, Perspective, " + storage + ", " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
         for (auto &sampler : GetSamplers(resolution)) {
             FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
             FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
@@ -310,6 +338,83 @@ std::vector<TestIntegrator> GetIntegrators() {
                  scene});
         }
 
+        for (auto &sampler : GetSamplers(resolution)) {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator =
+                new PathIntegrator(8, camera, sampler.first, scene.aggregate,
+                                   scene.lights, "bvh", false, true /* wavefront */);
+            integrators.push_back({integrator, filmp,
+                                   "Path wavefront, depth 8, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        for (auto &sampler : GetSamplers(resolution)) {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false,
+                false, 8 /* light candidates */);
+            integrators.push_back({integrator, filmp,
+                                   "Path resampled direct lighting, depth 8, "
+                                   "Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        for (auto &sampler : GetSamplers(resolution)) {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false,
+                false, 1, "sdtree");
+            integrators.push_back({integrator, filmp,
+                                   "Path guided, depth 8, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
+        for (auto &sampler : GetSamplers(resolution)) {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler.first, scene.aggregate, scene.lights, "bvh", false,
+                false, 1, "none", "adjoint");
+            integrators.push_back({integrator, filmp,
+                                   "Path adjoint RR, depth 8, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
         // Volume path tracing integrators
         for (auto &sampler : GetSamplers(resolution)) {
             FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
@@ -385,6 +490,27 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    scene});
         }
 
+        // BDPT with the light vertex cache
+        for (auto &sampler : GetSamplers(resolution)) {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator =
+                new BDPTIntegrator(camera, sampler.first, scene.aggregate, scene.lights,
+                                   6, false, false, false, 4096 /* cached light paths */,
+                                   3 /* cache connections */);
+            integrators.push_back({integrator, filmp,
+                                   "BDPT, light vertex cache, depth 6, Perspective, " +
+                                       sampler.second + ", " + scene.description,
+                                   scene});
+        }
+
         // MLT
         {
             FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
@@ -405,6 +531,29 @@ std::vector<TestIntegrator> GetIntegrators() {
                                    "MLT, depth 8, Perspective, " + scene.description,
                                    scene});
         }
+
+        // MLT with per-thread splat buffers
+        {
+            FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+            FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution),
+                                  filter, 1., PixelSensor::CreateDefault(), inTestDir("test.exr"));
+            RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB, Infinity, true,
+                                        true /* thread splat buffers */);
+            CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+            PerspectiveCamera *camera = new PerspectiveCamera(cbp, 45,
+                Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 10.);
+            const FilmHandle filmp = camera->GetFilm();
+
+            Integrator *integrator =
+                new MLTIntegrator(camera, scene.aggregate, scene.lights, 8 /* depth */,
+                                  100000 /* n bootstrap */, 1000 /* nchains */,
+                                  1024 /* mutations per pixel */, 0.01 /* sigma */,
+                                  0.3 /* large step prob */, false /* regularize */);
+            integrators.push_back({integrator, filmp,
+                                   "MLT, depth 8, Perspective, thread splat buffers, " +
+                                       scene.description,
+                                   scene});
+        }
     }
 
     return integrators;
@@ -427,3 +576,275 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+TEST(RGBFilm, CheckpointState) {
+    Point2i resolution(10, 10);
+    FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                          PixelSensor::CreateDefault(), inTestDir("test.exr"));
+    SampledWavelengths lambda = SampledWavelengths::SampleXYZ(0.5);
+    RNG rng;
+    auto addSamples = [&](RGBFilm &film, RNG rng) {
+        for (Point2i p : Bounds2i(Point2i(0, 0), resolution))
+            for (int i = 0; i < 4; ++i)
+                film.AddSample(p, SampledSpectrum(rng.Uniform<Float>()), lambda,
+                               nullptr, 0.5f + rng.Uniform<Float>());
+    };
+
+    for (bool floatPixels : {false, true}) {
+        RGBFilm film(fp, RGBColorSpace::sRGB, Infinity, true, false, false, 0,
+                     floatPixels);
+        addSamples(film, rng);
+        film.AddSplat(Point2f(2.5, 3.5), SampledSpectrum(2.f), lambda);
+
+        // Restoring the saved state in another film and continuing to add
+        // the same samples to both should give identical pixel values
+        RGBFilm resumed(fp, RGBColorSpace::sRGB, Infinity, true, false, false, 0,
+                        floatPixels);
+        resumed.RestoreState(film.SaveState());
+        rng.Advance(1000);
+        addSamples(film, rng);
+        addSamples(resumed, rng);
+        for (Point2i p : Bounds2i(Point2i(0, 0), resolution)) {
+            RGB rgb = film.GetPixelRGB(p), resumedRGB = resumed.GetPixelRGB(p);
+            for (int c = 0; c < 3; ++c)
+                EXPECT_EQ(rgb[c], resumedRGB[c]) << "float pixels " << floatPixels;
+        }
+        EXPECT_EQ(film.SaveState(), resumed.SaveState());
+    }
+}
+
+TEST(RGBFilm, MergeState) {
+    Point2i resolution(10, 10);
+    FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                          PixelSensor::CreateDefault(), inTestDir("test.exr"));
+    SampledWavelengths lambda = SampledWavelengths::SampleXYZ(0.5);
+    auto addSamples = [&](RGBFilm &film, Bounds2i b, RNG rng) {
+        for (Point2i p : b)
+            for (int i = 0; i < 4; ++i)
+                film.AddSample(p, SampledSpectrum(rng.Uniform<Float>()), lambda,
+                               nullptr, 0.5f + rng.Uniform<Float>());
+    };
+
+    for (bool floatPixels : {false, true}) {
+        // Render two regions in separate films and merge them into a third;
+        // the result should match a film with all of the samples.
+        Bounds2i left(Point2i(0, 0), Point2i(4, 10));
+        Bounds2i right(Point2i(4, 0), resolution);
+        RGBFilm film(fp, RGBColorSpace::sRGB, Infinity, true, false, false, 0,
+                     floatPixels);
+        RGBFilm leftFilm(fp, RGBColorSpace::sRGB, Infinity, true, false, false, 0,
+                         floatPixels);
+        RGBFilm rightFilm(fp, RGBColorSpace::sRGB, Infinity, true, false, false, 0,
+                          floatPixels);
+        RGBFilm merged(fp, RGBColorSpace::sRGB, Infinity, true, false, false, 0,
+                       floatPixels);
+        addSamples(film, left, RNG(1));
+        addSamples(film, right, RNG(2));
+        // Samples that are reset shouldn't affect the result
+        addSamples(leftFilm, left, RNG(3));
+        leftFilm.ResetPixels(left);
+        addSamples(leftFilm, left, RNG(1));
+        addSamples(rightFilm, right, RNG(2));
+        merged.MergeState(leftFilm.SaveState(left), left);
+        merged.MergeState(rightFilm.SaveState(right), right);
+        EXPECT_EQ(film.SaveState(), merged.SaveState()) << "float pixels " << floatPixels;
+    }
+}
+
+TEST(RGBFilm, ThreadSplatBuffers) {
+    // Splats spread over more tiles than a thread buffers at once
+    Point2i resolution(100, 80);
+    FilterHandle filter = new BoxFilter(Vector2f(1, 1));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                          PixelSensor::CreateDefault(), inTestDir("test.exr"));
+    SampledWavelengths lambda = SampledWavelengths::SampleXYZ(0.5);
+    for (bool floatPixels : {false, true}) {
+        RGBFilm film(fp, RGBColorSpace::sRGB, Infinity, false, false, false, 0,
+                     floatPixels);
+        RGBFilm buffered(fp, RGBColorSpace::sRGB, Infinity, false, true, false, 0,
+                         floatPixels);
+        RNG rng;
+        for (int i = 0; i < 20000; ++i) {
+            Point2f p(resolution.x * rng.Uniform<Float>(),
+                      resolution.y * rng.Uniform<Float>());
+            SampledSpectrum L(rng.Uniform<Float>());
+            film.AddSplat(p, L, lambda);
+            buffered.AddSplat(p, L, lambda);
+        }
+        buffered.FlushSplats();
+
+        ImageMetadata metadata;
+        Image image = film.GetImage(&metadata);
+        Image bufferedImage = buffered.GetImage(&metadata);
+        for (Point2i p : Bounds2i(Point2i(0, 0), resolution))
+            for (int c = 0; c < 3; ++c) {
+                Float v = image.GetChannel(p, c);
+                EXPECT_NEAR(v, bufferedImage.GetChannel(p, c), 1e-4f * std::abs(v))
+                    << "float pixels " << floatPixels << ", pixel " << p;
+            }
+    }
+}
+
+TEST(AOVSample, Lobes) {
+    EXPECT_EQ(AOVLobe::Diffuse, GetAOVLobe(BxDFFlags::DiffuseReflection));
+    EXPECT_EQ(AOVLobe::Glossy, GetAOVLobe(BxDFFlags::GlossyReflection));
+    EXPECT_EQ(AOVLobe::Specular, GetAOVLobe(BxDFFlags::SpecularReflection));
+    EXPECT_EQ(AOVLobe::Transmission, GetAOVLobe(BxDFFlags::SpecularTransmission));
+
+    // Only the requested AOVs are accumulated.
+    AOVSample aov(AOVFlags::Lobes);
+    aov.AddRadiance(SampledSpectrum(1.f), AOVLobe::Glossy, nullptr);
+    aov.AddRadiance(SampledSpectrum(2.f), AOVLobe::Glossy, nullptr);
+    aov.AddRadiance(SampledSpectrum(3.f), AOVLobe::Emission, nullptr);
+    aov.ScaleRadiance(SampledSpectrum(0.5f));
+    for (int i = 0; i < NSpectrumSamples; ++i) {
+        EXPECT_EQ(1.5f, aov.lobeL[int(AOVLobe::Glossy)][i]);
+        EXPECT_EQ(1.5f, aov.lobeL[int(AOVLobe::Emission)][i]);
+        EXPECT_EQ(0.f, aov.lobeL[int(AOVLobe::Diffuse)][i]);
+        for (int g = 0; g < MaxLightGroups; ++g)
+            EXPECT_EQ(0.f, aov.lightGroupL[g][i]);
+    }
+}
+
+TEST(GBufferFilm, CostAOV) {
+    Point2i resolution(4, 4);
+    FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                          PixelSensor::CreateDefault(), inTestDir("test.exr"));
+    GBufferFilm film(fp, RGBColorSpace::sRGB, Infinity, false, AOVFlags::Cost);
+
+    // The cost channels hold the average of the pixel's samples' costs
+    PixelCostSample cost;
+    cost.microseconds = 10;
+    cost.rays = 2;
+    cost.nodesVisited = 40;
+    cost.shadowRays = 1;
+    film.AddCostSample(Point2i(1, 2), cost);
+    cost.microseconds = 20;
+    cost.rays = 4;
+    cost.mediumSteps = 6;
+    film.AddCostSample(Point2i(1, 2), cost);
+
+    ImageMetadata metadata;
+    Image image = film.GetImage(&metadata);
+    ImageChannelDesc desc = image.GetChannelDesc(
+        {"Cost.Time", "Cost.Rays", "Cost.Nodes", "Cost.ShadowRays", "Cost.MediumSteps"});
+    ASSERT_TRUE(bool(desc));
+    ImageChannelValues values = image.GetChannels(Point2i(1, 2), desc);
+    EXPECT_EQ(15.f, values[0]);
+    EXPECT_EQ(3.f, values[1]);
+    EXPECT_EQ(40.f, values[2]);
+    EXPECT_EQ(1.f, values[3]);
+    EXPECT_EQ(3.f, values[4]);
+    values = image.GetChannels(Point2i(0, 0), desc);
+    for (int c = 0; c < 5; ++c)
+        EXPECT_EQ(0.f, values[c]);
+}
+
+TEST(PrimaryVisibility, MatchesBVH) {
+    // Make random triangles around the camera, some of which are behind it
+    // or cross the plane of its center of projection
+    RNG rng;
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    for (int i = 0; i < 2000; ++i) {
+        Point3f c(Lerp(rng.Uniform<Float>(), -1, 1), Lerp(rng.Uniform<Float>(), -1, 1),
+                  Lerp(rng.Uniform<Float>(), -0.5, 3));
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(c + Vector3f(Lerp(rng.Uniform<Float>(), -.2, .2),
+                                     Lerp(rng.Uniform<Float>(), -.2, .2),
+                                     Lerp(rng.Uniform<Float>(), -.2, .2)));
+        }
+    }
+    static Transform id;
+    TriangleMesh *mesh = new TriangleMesh(id, false, indices, p, {}, {}, {}, {});
+    // The triangles must be opaque for their visibility to be rasterized
+    MaterialHandle material = new DiffuseMaterial(nullptr, nullptr, nullptr, nullptr);
+    std::vector<PrimitiveHandle> prims;
+    for (ShapeHandle tri : Triangle::CreateTriangles(mesh, Allocator()))
+        prims.push_back(new SimplePrimitive(tri, material));
+    BVHAggregate *bvh = new BVHAggregate(prims);
+    PrimitiveHandle aggregate(bvh);
+
+    Point2i resolution(40, 30);
+    AnimatedTransform identity(id, 0, id, 1);
+    FilterHandle filter = new BoxFilter(Vector2f(0.5, 0.5));
+    FilmBaseParameters fp(resolution, Bounds2i(Point2i(0, 0), resolution), filter, 1.,
+                          PixelSensor::CreateDefault(), inTestDir("test.exr"));
+    RGBFilm *film = new RGBFilm(fp, RGBColorSpace::sRGB);
+    CameraBaseParameters cbp(CameraTransform(identity), film, nullptr, {}, nullptr);
+    Bounds2f screen(Point2f(-1, -1), Point2f(1, 1));
+    CameraHandle perspective = new PerspectiveCamera(cbp, 60, screen, 0, 1);
+    CameraHandle orthographic = new OrthographicCamera(cbp, screen, 0, 1);
+    for (CameraHandle camera : {perspective, orthographic}) {
+        std::unique_ptr<PrimaryVisibility> visibility =
+            PrimaryVisibility::Create(camera, aggregate);
+        ASSERT_TRUE(bool(visibility));
+
+        // Rasterization should find the same first intersections as the BVH
+        SampledWavelengths lambda = SampledWavelengths::SampleXYZ(0.5);
+        for (int i = 0; i < 10000; ++i) {
+            CameraSample sample;
+            sample.pFilm = Point2f(Lerp(rng.Uniform<Float>(), -.5, resolution.x + .5),
+                                   Lerp(rng.Uniform<Float>(), -.5, resolution.y + .5));
+            pstd::optional<CameraRay> cr = camera.GenerateRay(sample, lambda);
+            ASSERT_TRUE(cr.has_value());
+            pstd::optional<ShapeIntersection> si;
+            ASSERT_TRUE(visibility->Intersect(cr->ray, sample.pFilm, &si));
+            pstd::optional<ShapeIntersection> bvhSi = bvh->Intersect(cr->ray, Infinity);
+            ASSERT_EQ(bvhSi.has_value(), si.has_value());
+            if (si) {
+                EXPECT_EQ(bvhSi->tHit, si->tHit);
+            }
+        }
+    }
+}
+
+TEST(CPURenderSession, ReusesUnchangedObjects) {
+    auto parse = [](Float radius) {
+        auto scene = std::make_shared<ParsedScene>();
+        ParseString(scene.get(), R"(
+            Film "rgb" "integer xresolution" 8 "integer yresolution" 8
+                "string filename" ")" + inTestDir("session.pfm") + R"("
+            Sampler "random" "integer pixelsamples" 1
+            Integrator "ambientocclusion"
+            LookAt 0 0 5  0 0 0  0 1 0
+            Camera "perspective"
+            WorldBegin
+            LightSource "point" "point3 from" [0 0 5]
+            Material "diffuse"
+            Shape "sphere" "float radius" 1
+            Translate 2 0 0
+            Shape "sphere" "float radius" )" + std::to_string(radius));
+        return scene;
+    };
+
+    CPURenderSession session;
+    session.Render(parse(0.5));
+    EXPECT_EQ(0, session.Reused().shapes);
+    EXPECT_EQ(2, session.Created().shapes);
+    EXPECT_EQ(1, session.Created().geometry);
+
+    // Only the edited sphere, and the aggregate that holds it, are rebuilt.
+    session.Render(parse(0.75));
+    EXPECT_EQ(1, session.Reused().shapes);
+    EXPECT_EQ(1, session.Created().shapes);
+    EXPECT_EQ(1, session.Reused().lights);
+    EXPECT_EQ(0, session.Created().lights);
+    EXPECT_EQ(1, session.Reused().materials);
+    EXPECT_EQ(0, session.Created().materials);
+    EXPECT_EQ(0, session.Reused().geometry);
+    EXPECT_EQ(1, session.Created().geometry);
+
+    // Rendering the same scene again rebuilds nothing.
+    session.Render(parse(0.75));
+    EXPECT_EQ(2, session.Reused().shapes);
+    EXPECT_EQ(0, session.Created().shapes);
+    EXPECT_EQ(1, session.Reused().geometry);
+    EXPECT_EQ(0, session.Created().geometry);
+
+    EXPECT_EQ(0, remove(inTestDir("session.pfm").c_str()));
+}
@@ -7,15 +7,27 @@
 #include <pbrt/cpu/aggregates.h>
 #include <pbrt/interaction.h>
 #include <pbrt/materials.h>
+#include <pbrt/options.h>
 #include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/float.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
+#include <pbrt/util/memory.h>
 #include <pbrt/util/taggedptr.h>
+#include <pbrt/util/trace.h>
 #include <pbrt/util/vecmath.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
 namespace pbrt {
 
+STAT_COUNTER("Geometry/Triangles used directly as primitives", meshTrianglePrimitives);
+
 Bounds3f PrimitiveHandle::Bounds() const {
     auto bounds = [&](auto ptr) { return ptr->Bounds(); };
     return DispatchCPU(bounds);
@@ -23,25 +35,140 @@ Bounds3f PrimitiveHandle::Bounds() const {
 
 pstd::optional<ShapeIntersection> PrimitiveHandle::Intersect(const Ray &r,
                                                              Float tMax) const {
+    if (const Triangle *tri = CastOrNullptr<Triangle>()) {
+        // Intersect mesh triangle and set its mesh's material
+        pstd::optional<ShapeIntersection> si = tri->Intersect(r, tMax);
+        if (si)
+            si->intr.SetIntersectionProperties(MeshMaterials::Get(tri->MeshIndex()),
+                                               nullptr, nullptr, r.medium);
+        return si;
+    }
     auto isect = [&](auto ptr) { return ptr->Intersect(r, tMax); };
     return DispatchCPU(isect);
 }
 
 bool PrimitiveHandle::IntersectP(const Ray &r, Float tMax) const {
+    if (const Triangle *tri = CastOrNullptr<Triangle>()) {
+        MaterialHandle material = MeshMaterials::Get(tri->MeshIndex());
+        return !(material && material.IsTransparent()) && tri->IntersectP(r, tMax);
+    }
     auto isectp = [&](auto ptr) { return ptr->IntersectP(r, tMax); };
     return DispatchCPU(isectp);
 }
 
+bool PrimitiveHandle::IntersectShadowP(const Ray &r, Float tMax) const {
+    if (Is<BVHAggregate>())
+        return Cast<BVHAggregate>()->IntersectShadowP(r, tMax);
+    return IntersectP(r, tMax);
+}
+
+bool PrimitiveHandle::HasOnlyOpaqueSurfaces() const {
+    auto opaque = [](MaterialHandle material) {
+        return material && !material.IsTransparent();
+    };
+    if (const SimplePrimitive *prim = CastOrNullptr<SimplePrimitive>())
+        return opaque(prim->GetMaterial());
+    if (const Triangle *tri = CastOrNullptr<Triangle>())
+        return opaque(MeshMaterials::Get(tri->MeshIndex()));
+    if (const GeometricPrimitive *prim = CastOrNullptr<GeometricPrimitive>())
+        return opaque(prim->GetMaterial()) &&
+               !prim->GetMediumInterface().IsMediumTransition();
+    if (const TransformedPrimitive *prim = CastOrNullptr<TransformedPrimitive>())
+        return prim->GetPrimitive().HasOnlyOpaqueSurfaces();
+    if (const AnimatedPrimitive *prim = CastOrNullptr<AnimatedPrimitive>())
+        return prim->GetPrimitive().HasOnlyOpaqueSurfaces();
+    if (const DeferredPrimitive *prim = CastOrNullptr<DeferredPrimitive>())
+        return prim->HasOnlyOpaqueSurfaces();
+    if (const BVHAggregate *bvh = CastOrNullptr<BVHAggregate>())
+        return bvh->HasOnlyOpaqueSurfaces();
+    // Conservatively assume that other aggregates' surfaces may not be opaque
+    return false;
+}
+
+void PrimitiveHandle::IntersectN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                                 pstd::span<pstd::optional<ShapeIntersection>> si) const {
+    if (Is<BVHAggregate>())
+        return Cast<BVHAggregate>()->IntersectN(rays, tMax, si);
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), si.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+        si[i] = Intersect(rays[i], tMax[i]);
+}
+
+void PrimitiveHandle::IntersectPN(pstd::span<const Ray> rays,
+                                  pstd::span<const Float> tMax,
+                                  pstd::span<bool> occluded) const {
+    if (Is<BVHAggregate>())
+        return Cast<BVHAggregate>()->IntersectPN(rays, tMax, occluded);
+    CHECK_EQ(rays.size(), tMax.size());
+    CHECK_EQ(rays.size(), occluded.size());
+    for (size_t i = 0; i < rays.size(); ++i)
+        occluded[i] = IntersectP(rays[i], tMax[i]);
+}
+
+PrimitiveHandle CreateShapePrimitive(ShapeHandle shape, MaterialHandle material,
+                                     LightHandle areaLight,
+                                     const MediumInterface &mediumInterface,
+                                     FloatTextureHandle alpha, Allocator alloc,
+                                     const OpacityMicromap *alphaMicromap) {
+    if (areaLight || mediumInterface.IsMediumTransition() || alpha)
+        return alloc.new_object<GeometricPrimitive>(shape, material, areaLight,
+                                                    mediumInterface, alpha,
+                                                    alphaMicromap);
+    if (const Triangle *tri = shape.CastOrNullptr<Triangle>();
+        tri && MeshMaterials::Set(tri->MeshIndex(), material)) {
+        ++meshTrianglePrimitives;
+        return tri;
+    }
+    return alloc.new_object<SimplePrimitive>(shape, material);
+}
+
+// MeshMaterials Method Definitions
+std::atomic<MeshMaterials::Entry *>
+    MeshMaterials::chunks[(1u << 31) / MeshMaterials::ChunkSize];
+std::mutex MeshMaterials::mutex;
+
+bool MeshMaterials::Set(int meshIndex, MaterialHandle material) {
+    CHECK_GE(meshIndex, 0);
+    // Check for an existing entry without locking; meshes' triangles are
+    // usually set one after another
+    const Entry *chunk = chunks[meshIndex >> ChunkBits].load(std::memory_order_acquire);
+    if (chunk && chunk[meshIndex & (ChunkSize - 1)].set.load(std::memory_order_acquire))
+        return chunk[meshIndex & (ChunkSize - 1)].material == material;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::atomic<Entry *> &c = chunks[meshIndex >> ChunkBits];
+    if (!c.load(std::memory_order_relaxed))
+        c.store(new Entry[ChunkSize], std::memory_order_release);
+    Entry &entry = c.load(std::memory_order_relaxed)[meshIndex & (ChunkSize - 1)];
+    if (entry.set.load(std::memory_order_relaxed))
+        return entry.material == material;
+    entry.material = material;
+    entry.set.store(true, std::memory_order_release);
+    return true;
+}
+
+void MeshMaterials::Clear(int meshIndex) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (Entry *chunk = chunks[meshIndex >> ChunkBits].load(std::memory_order_relaxed))
+        chunk[meshIndex & (ChunkSize - 1)].set.store(false, std::memory_order_relaxed);
+}
+
+STAT_PERCENT("Intersections/Alpha tests resolved by opacity micromaps",
+             alphaMicromapTests, alphaTests);
+
 // GeometricPrimitive Method Definitions
 GeometricPrimitive::GeometricPrimitive(ShapeHandle shape, MaterialHandle material,
                                        LightHandle areaLight,
                                        const MediumInterface &mediumInterface,
-                                       FloatTextureHandle alpha)
+                                       FloatTextureHandle alpha,
+                                       const OpacityMicromap *alphaMicromap)
     : shape(shape),
       material(material),
       areaLight(areaLight),
       mediumInterface(mediumInterface),
-      alpha(alpha) {
+      alpha(alpha),
+      alphaMicromap(alpha && shape.Is<Triangle>() ? alphaMicromap : nullptr) {
     primitiveMemory += sizeof(*this);
 }
 
@@ -57,7 +184,22 @@ pstd::optional<ShapeIntersection> GeometricPrimitive::Intersect(const Ray &r,
     CHECK_LT(si->tHit, 1.001 * tMax);
     // Test intersection against alpha texture, if present
     if (alpha) {
-        if (Float a = alpha.Evaluate(si->intr); a < 1) {
+        // Use the opacity micromap's state for the hit point if it's known
+        OpacityMicromap::State state = OpacityMicromap::State::Unknown;
+        if (alphaMicromap) {
+            int triIndex = shape.Cast<Triangle>()->TriangleIndex();
+            state = alphaMicromap->Lookup(triIndex, si->intr.p());
+        }
+        ++alphaTests;
+        Float a;
+        if (state == OpacityMicromap::State::Unknown)
+            a = alpha.Evaluate(si->intr);
+        else {
+            ++alphaMicromapTests;
+            a = (state == OpacityMicromap::State::Opaque) ? 1 : 0;
+        }
+
+        if (a < 1) {
             // Potentially skip intersection, depending on stochastic alpha test
             Float u = (a <= 0) ? 1.f : (uint32_t(Hash(r.o, r.d)) * 0x1p-32f);
             if (u > a) {
@@ -121,7 +263,7 @@ pstd::optional<ShapeIntersection> SimplePrimitive::Intersect(const Ray &r,
 pstd::optional<ShapeIntersection> TransformedPrimitive::Intersect(const Ray &r,
                                                                   Float tMax) const {
     // Transform ray to primitive-space and intersect with primitive
-    Ray ray = renderFromPrimitive->ApplyInverse(r, &tMax);
+    Ray ray = primitiveRay(r, &tMax);
     pstd::optional<ShapeIntersection> si = primitive.Intersect(ray, tMax);
     if (!si)
         return {};
@@ -134,22 +276,56 @@ pstd::optional<ShapeIntersection> TransformedPrimitive::Intersect(const Ray &r,
 }
 
 bool TransformedPrimitive::IntersectP(const Ray &r, Float tMax) const {
-    Ray ray = renderFromPrimitive->ApplyInverse(r, &tMax);
+    Ray ray = primitiveRay(r, &tMax);
     return primitive.IntersectP(ray, tMax);
 }
 
+// AnimatedPrimitive Local Definitions
+STAT_PERCENT("Geometry/Interpolated transform cache hits", animatedTransformCacheHits,
+             animatedTransformCacheLookups);
+
+// Rays along a path and the shadow rays traced from it all have the same
+// time, so each thread keeps the transforms it most recently interpolated.
+struct ThreadInterpolatedTransforms {
+    static constexpr int Size = 16;
+    uint64_t ids[Size];
+    Float times[Size];
+    Transform transforms[Size];
+
+    ThreadInterpolatedTransforms() { std::fill(ids, ids + Size, ~uint64_t(0)); }
+};
+
+static thread_local ThreadInterpolatedTransforms threadInterpolatedTransforms;
+static std::atomic<uint64_t> nextAnimatedPrimitiveId{0};
+
 // AnimatedPrimitive Method Definitions
 AnimatedPrimitive::AnimatedPrimitive(PrimitiveHandle p,
                                      const AnimatedTransform &renderFromPrimitive)
     : primitive(p), renderFromPrimitive(renderFromPrimitive) {
     primitiveMemory += sizeof(*this);
     CHECK(renderFromPrimitive.IsAnimated());
+    id = nextAnimatedPrimitiveId++;
+}
+
+const Transform &AnimatedPrimitive::InterpolatedTransform(Float time) const {
+    ThreadInterpolatedTransforms &cache = threadInterpolatedTransforms;
+    int slot = MixBits(id ^ (uint64_t(FloatToBits(time)) << 20)) %
+               ThreadInterpolatedTransforms::Size;
+    ++animatedTransformCacheLookups;
+    if (cache.ids[slot] == id && cache.times[slot] == time) {
+        ++animatedTransformCacheHits;
+        return cache.transforms[slot];
+    }
+    cache.ids[slot] = id;
+    cache.times[slot] = time;
+    cache.transforms[slot] = renderFromPrimitive.Interpolate(time);
+    return cache.transforms[slot];
 }
 
 pstd::optional<ShapeIntersection> AnimatedPrimitive::Intersect(const Ray &r,
                                                                Float tMax) const {
     // Compute _ray_ after transformation by _renderFromPrimitive_
-    Transform interpRenderFromPrimitive = renderFromPrimitive.Interpolate(r.time);
+    Transform interpRenderFromPrimitive = InterpolatedTransform(r.time);
     Ray ray = interpRenderFromPrimitive.ApplyInverse(r, &tMax);
     pstd::optional<ShapeIntersection> si = primitive.Intersect(ray, tMax);
     if (!si)
@@ -162,8 +338,205 @@ pstd::optional<ShapeIntersection> AnimatedPrimitive::Intersect(const Ray &r,
 }
 
 bool AnimatedPrimitive::IntersectP(const Ray &r, Float tMax) const {
-    Ray ray = renderFromPrimitive.ApplyInverse(r, &tMax);
+    Ray ray = InterpolatedTransform(r.time).ApplyInverse(r, &tMax);
     return primitive.IntersectP(ray, tMax);
 }
 
+// DeferredPrimitive Local Definitions
+STAT_COUNTER("Geometry/Deferred primitives loaded", deferredPrimitivesLoaded);
+STAT_COUNTER("Geometry/Deferred primitives evicted", deferredPrimitivesEvicted);
+
+// Counts the bytes allocated for a _DeferredPrimitive_'s geometry
+class CountingMemoryResource : public pstd::pmr::memory_resource {
+  public:
+    size_t BytesAllocated() const { return bytesAllocated; }
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        bytesAllocated += bytes;
+        return pstd::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+        bytesAllocated -= bytes;
+        pstd::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+    }
+    bool do_is_equal(const memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    size_t bytesAllocated = 0;
+};
+
+// Memory for geometry owned by a _DeferredPrimitive_; it is freed all at once
+struct DeferredPrimitiveMemory : public pstd::pmr::memory_resource {
+    CountingMemoryResource counter;
+    pstd::pmr::monotonic_buffer_resource arena{&counter};
+
+  private:
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        return arena.allocate(bytes, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) override {}
+    bool do_is_equal(const memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Loaded deferred primitives, tracked so that they can be evicted in least
+// recently used order once their memory exceeds --geometry-budget. Primitives
+// record the value of _useEpoch_, which advances with each load, when they
+// are used.
+static std::mutex residentPrimitivesMutex;
+static std::vector<const DeferredPrimitive *> residentPrimitives;
+static size_t residentBytes = 0;
+static std::atomic<uint64_t> useEpoch{0};
+
+// Releases the mesh indices of the triangles and bilinear patches in _prim_,
+// which must no longer be used, so that geometry loaded later can reuse them.
+static void ReleaseMeshIndices(PrimitiveHandle prim) {
+    std::vector<int> triMeshes, blpMeshes;
+    auto addShape = [&](ShapeHandle shape) {
+        if (const Triangle *tri = shape.CastOrNullptr<Triangle>())
+            triMeshes.push_back(tri->MeshIndex());
+        else if (const BilinearPatch *blp = shape.CastOrNullptr<BilinearPatch>())
+            blpMeshes.push_back(blp->MeshIndex());
+    };
+    auto addPrimitive = [&](PrimitiveHandle p) {
+        if (const Triangle *tri = p.CastOrNullptr<Triangle>())
+            triMeshes.push_back(tri->MeshIndex());
+        else if (const SimplePrimitive *sp = p.CastOrNullptr<SimplePrimitive>())
+            addShape(sp->GetShape());
+        else if (const GeometricPrimitive *gp = p.CastOrNullptr<GeometricPrimitive>())
+            addShape(gp->GetShape());
+    };
+    if (const BVHAggregate *bvh = prim.CastOrNullptr<BVHAggregate>())
+        for (PrimitiveHandle p : bvh->Primitives())
+            addPrimitive(p);
+    else
+        addPrimitive(prim);
+
+    for (std::vector<int> *meshes : {&triMeshes, &blpMeshes}) {
+        std::sort(meshes->begin(), meshes->end());
+        meshes->erase(std::unique(meshes->begin(), meshes->end()), meshes->end());
+    }
+    for (int meshIndex : triMeshes) {
+        MeshMaterials::Clear(meshIndex);
+        Triangle::ReleaseMeshIndex(meshIndex);
+    }
+    for (int meshIndex : blpMeshes)
+        BilinearPatch::ReleaseMeshIndex(meshIndex);
+}
+
+// DeferredPrimitive Method Definitions
+template <typename F>
+auto DeferredPrimitive::WithPrimitive(F func) const {
+    bool evictable = Options->geometryBudgetMB > 0;
+    while (true) {
+        // Without a budget, loaded geometry stays loaded
+        if (!evictable && loaded.load(std::memory_order_acquire))
+            return func(primitive);
+
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            if (loaded.load(std::memory_order_relaxed)) {
+                // Record use of primitive, avoiding writes when it's up to date
+                uint64_t epoch = useEpoch.load(std::memory_order_relaxed);
+                if (lastUsed.load(std::memory_order_relaxed) != epoch)
+                    lastUsed.store(epoch, std::memory_order_relaxed);
+                return func(primitive);
+            }
+        }
+        // Other threads that need the primitive wait here until it is loaded
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (!loaded.load(std::memory_order_relaxed))
+            Load();
+    }
+}
+
+pstd::optional<ShapeIntersection> DeferredPrimitive::Intersect(const Ray &r,
+                                                               Float tMax) const {
+    // Only load the geometry once a ray reaches its bounds
+    if (!bounds.IntersectP(r.o, r.d, tMax))
+        return {};
+    return WithPrimitive([&](PrimitiveHandle prim) { return prim.Intersect(r, tMax); });
+}
+
+bool DeferredPrimitive::IntersectP(const Ray &r, Float tMax) const {
+    if (!bounds.IntersectP(r.o, r.d, tMax))
+        return false;
+    return WithPrimitive([&](PrimitiveHandle prim) { return prim.IntersectP(r, tMax); });
+}
+
+void DeferredPrimitive::Load() const {
+    // Load geometry, allocating it all with _memory_
+    TraceScope trace("Load deferred primitive", "Geometry");
+    DeferredPrimitiveMemory *mem = new DeferredPrimitiveMemory;
+    memory.reset(mem);
+    primitive = load(Allocator(mem));
+    memoryBytes = mem->counter.BytesAllocated();
+    // The BVH accounts for its own memory.
+    AddCategoryMemory(MemoryCategory::Geometry, memoryBytes);
+    if (const BVHAggregate *bvh = primitive.CastOrNullptr<BVHAggregate>())
+        memoryBytes += bvh->MemoryBytes();
+    if (Union(primitive.Bounds(), bounds) != bounds)
+        Warning("Deferred geometry extends past its bounds %s; rays may "
+                "miss some of it.",
+                bounds);
+    ++deferredPrimitivesLoaded;
+    lastUsed = ++useEpoch;
+    loaded.store(true, std::memory_order_release);
+    if (Options->geometryBudgetMB == 0)
+        return;
+
+    // Evict least recently used geometry if over budget
+    std::lock_guard<std::mutex> lock(residentPrimitivesMutex);
+    residentPrimitives.push_back(this);
+    residentBytes += memoryBytes;
+    size_t budget = size_t(Options->geometryBudgetMB) << 20;
+    if (residentBytes <= budget)
+        return;
+    std::vector<const DeferredPrimitive *> candidates = residentPrimitives;
+    std::sort(candidates.begin(), candidates.end(),
+              [](const DeferredPrimitive *a, const DeferredPrimitive *b) {
+                  return a->lastUsed.load(std::memory_order_relaxed) <
+                         b->lastUsed.load(std::memory_order_relaxed);
+              });
+    for (const DeferredPrimitive *prim : candidates) {
+        if (residentBytes <= budget)
+            break;
+        // Geometry that rays are being traced against is skipped
+        if (prim == this || !prim->TryEvict())
+            continue;
+        residentBytes -= prim->memoryBytes;
+        residentPrimitives.erase(
+            std::find(residentPrimitives.begin(), residentPrimitives.end(), prim));
+    }
+    if (residentBytes > budget)
+        LOG_VERBOSE("Deferred geometry uses %d bytes, over budget of %d bytes",
+                    residentBytes, budget);
+}
+
+bool DeferredPrimitive::TryEvict() const {
+    std::unique_lock<std::shared_mutex> lock(mutex, std::try_to_lock);
+    if (!lock.owns_lock() || !loaded.load(std::memory_order_relaxed))
+        return false;
+    Unload();
+    return true;
+}
+
+void DeferredPrimitive::Unload() const {
+    // Free BVH memory allocated outside of _memory_ and then _memory_
+    loaded.store(false, std::memory_order_relaxed);
+    ReleaseMeshIndices(primitive);
+    if (BVHAggregate *bvh = primitive.CastOrNullptr<BVHAggregate>()) {
+        bvh->ReleaseMemory();
+        bvh->~BVHAggregate();
+    }
+    primitive = nullptr;
+    DeferredPrimitiveMemory *mem = static_cast<DeferredPrimitiveMemory *>(memory.get());
+    AddCategoryMemory(MemoryCategory::Geometry, -int64_t(mem->counter.BytesAllocated()));
+    memory.reset();
+    ++deferredPrimitivesEvicted;
+}
+
 }  // namespace pbrt
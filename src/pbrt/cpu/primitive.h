@@ -16,23 +16,36 @@
 #include <pbrt/util/taggedptr.h>
 #include <pbrt/util/transform.h>
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
 
 namespace pbrt {
 
 STAT_MEMORY_COUNTER("Memory/Primitives", primitiveMemory);
 
+class OpacityMicromap;
 class SimplePrimitive;
 class GeometricPrimitive;
 class TransformedPrimitive;
 class AnimatedPrimitive;
+class DeferredPrimitive;
 class BVHAggregate;
 class KdTreeAggregate;
+class InstanceBVHAggregate;
+class EmbreeAggregate;
 
 // PrimitiveHandle Definition
+// A _PrimitiveHandle_ may also refer directly to a mesh's _Triangle_, in which
+// case the triangle's material is found from its mesh index using
+// _MeshMaterials_; see _CreateShapePrimitive()_.
 class PrimitiveHandle
     : public TaggedPointer<SimplePrimitive, GeometricPrimitive, TransformedPrimitive,
-                           AnimatedPrimitive, BVHAggregate, KdTreeAggregate> {
+                           AnimatedPrimitive, DeferredPrimitive, BVHAggregate,
+                           KdTreeAggregate, InstanceBVHAggregate, EmbreeAggregate,
+                           Triangle> {
   public:
     // Primitive Interface
     using TaggedPointer::TaggedPointer;
@@ -42,6 +55,66 @@ class PrimitiveHandle
     pstd::optional<ShapeIntersection> Intersect(const Ray &r,
                                                 Float tMax = Infinity) const;
     bool IntersectP(const Ray &r, Float tMax = Infinity) const;
+
+    // Shadow ray test for rays traced to sample lights; aggregates that
+    // support it first test the primitive that occluded the previous one
+    bool IntersectShadowP(const Ray &r, Float tMax = Infinity) const;
+    // Returns true if all of the primitive's surfaces have opaque
+    // materials and none is an interface between media, in which case
+    // shadow rays need only find whether any surface is intersected
+    bool HasOnlyOpaqueSurfaces() const;
+
+    // Aggregates that support it trace ray streams together; other
+    // primitives trace each ray individually
+    void IntersectN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                    pstd::span<pstd::optional<ShapeIntersection>> si) const;
+    void IntersectPN(pstd::span<const Ray> rays, pstd::span<const Float> tMax,
+                     pstd::span<bool> occluded) const;
+};
+
+// Returns a primitive for _shape_. Triangles that don't have an area light
+// or alpha texture and aren't an interface between media are their own
+// primitives, so that the only per-triangle memory is the _Triangle_
+// itself; other shapes get a _SimplePrimitive_ or _GeometricPrimitive_
+// allocated with _alloc_. _alphaMicromap_, if given, is the opacity
+// micromap for _alpha_ over the shape's mesh; see _OpacityMicromap::Create()_.
+PrimitiveHandle CreateShapePrimitive(ShapeHandle shape, MaterialHandle material,
+                                     LightHandle areaLight,
+                                     const MediumInterface &mediumInterface,
+                                     FloatTextureHandle alpha, Allocator alloc,
+                                     const OpacityMicromap *alphaMicromap = nullptr);
+
+// MeshMaterials Definition
+// Records the material of each triangle mesh whose triangles are used
+// directly as primitives, indexed by mesh index. Entries are stored in
+// fixed-size chunks that are never moved, so lookups don't need a lock
+// while meshes are added concurrently, e.g. by _DeferredPrimitive_ loads.
+class MeshMaterials {
+  public:
+    // MeshMaterials Public Methods
+    // Returns false if the mesh already has a different material, which
+    // may happen if a mesh is shared by shapes with different materials.
+    static bool Set(int meshIndex, MaterialHandle material);
+    // Forgets the mesh's material when its index is released for reuse.
+    static void Clear(int meshIndex);
+
+    static MaterialHandle Get(int meshIndex) {
+        const Entry *chunk =
+            chunks[meshIndex >> ChunkBits].load(std::memory_order_acquire);
+        DCHECK(chunk && chunk[meshIndex & (ChunkSize - 1)].set.load());
+        return chunk[meshIndex & (ChunkSize - 1)].material;
+    }
+
+  private:
+    // MeshMaterials Private Members
+    struct Entry {
+        MaterialHandle material;
+        // Set, with release semantics, after _material_ is initialized
+        std::atomic<bool> set{false};
+    };
+    static constexpr int ChunkBits = 15, ChunkSize = 1 << ChunkBits;
+    static std::atomic<Entry *> chunks[(1u << 31) / ChunkSize];
+    static std::mutex mutex;
 };
 
 // GeometricPrimitive Definition
@@ -50,10 +123,14 @@ class GeometricPrimitive {
     // GeometricPrimitive Public Methods
     GeometricPrimitive(ShapeHandle shape, MaterialHandle material, LightHandle areaLight,
                        const MediumInterface &mediumInterface,
-                       FloatTextureHandle alpha = nullptr);
+                       FloatTextureHandle alpha = nullptr,
+                       const OpacityMicromap *alphaMicromap = nullptr);
     Bounds3f Bounds() const;
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
+    ShapeHandle GetShape() const { return shape; }
+    MaterialHandle GetMaterial() const { return material; }
+    const MediumInterface &GetMediumInterface() const { return mediumInterface; }
 
   private:
     // GeometricPrimitive Private Members
@@ -62,6 +139,8 @@ class GeometricPrimitive {
     LightHandle areaLight;
     MediumInterface mediumInterface;
     FloatTextureHandle alpha;
+    // Set for triangles with alpha textures that the micromap can bound
+    const OpacityMicromap *alphaMicromap = nullptr;
 };
 
 // SimplePrimitive Definition
@@ -72,6 +151,8 @@ class SimplePrimitive {
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
     SimplePrimitive(ShapeHandle shape, MaterialHandle material);
+    ShapeHandle GetShape() const { return shape; }
+    MaterialHandle GetMaterial() const { return material; }
 
   private:
     // SimplePrimitive Private Members
@@ -84,7 +165,10 @@ class TransformedPrimitive {
   public:
     // TransformedPrimitive Public Methods
     TransformedPrimitive(PrimitiveHandle primitive, const Transform *renderFromPrimitive)
-        : primitive(primitive), renderFromPrimitive(renderFromPrimitive) {
+        : primitive(primitive),
+          renderFromPrimitive(renderFromPrimitive),
+          primitiveFromRender(renderFromPrimitive->GetInverseMatrix()),
+          isAffine(AffineTransform::IsAffine(renderFromPrimitive->GetInverseMatrix())) {
         primitiveMemory += sizeof(*this);
     }
 
@@ -92,11 +176,29 @@ class TransformedPrimitive {
     bool IntersectP(const Ray &r, Float tMax) const;
 
     Bounds3f Bounds() const { return (*renderFromPrimitive)(primitive.Bounds()); }
+    PrimitiveHandle GetPrimitive() const { return primitive; }
+    // Updates the copy of the inverse transformation after the shared
+    // _renderFromPrimitive_ has been modified
+    void TransformChanged() {
+        primitiveFromRender = AffineTransform(renderFromPrimitive->GetInverseMatrix());
+        isAffine = AffineTransform::IsAffine(renderFromPrimitive->GetInverseMatrix());
+    }
 
   private:
+    // TransformedPrimitive Private Methods
+    Ray primitiveRay(const Ray &r, Float *tMax) const {
+        return isAffine ? primitiveFromRender(r, tMax)
+                        : renderFromPrimitive->ApplyInverse(r, tMax);
+    }
+
     // TransformedPrimitive Private Members
     PrimitiveHandle primitive;
     const Transform *renderFromPrimitive;
+    // Rays are transformed to primitive space with this compact copy of the
+    // inverse transformation, which is stored with the primitive, if it is
+    // affine
+    AffineTransform primitiveFromRender;
+    bool isAffine;
 };
 
 // AnimatedPrimitive Definition
@@ -111,11 +213,60 @@ class AnimatedPrimitive {
                       const AnimatedTransform &renderFromPrimitive);
     pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
     bool IntersectP(const Ray &r, Float tMax) const;
+    PrimitiveHandle GetPrimitive() const { return primitive; }
 
   private:
+    // AnimatedPrimitive Private Methods
+    const Transform &InterpolatedTransform(Float time) const;
+
     // AnimatedPrimitive Private Members
     PrimitiveHandle primitive;
     AnimatedTransform renderFromPrimitive;
+    // Unique identifier for per-thread caches of interpolated transforms
+    uint64_t id;
+};
+
+// DeferredPrimitive Definition
+// Stands in for geometry that is only created, by calling _load_, when a ray
+// first intersects its bounds; loading is thread-safe. Everything that
+// _load_ creates must be allocated with the allocator it is given. With
+// --geometry-budget, the least recently used loaded geometry is freed when
+// the budget is exceeded and is loaded again if it is needed later.
+class DeferredPrimitive {
+  public:
+    // DeferredPrimitive Public Methods
+    DeferredPrimitive(const Bounds3f &bounds, bool onlyOpaqueSurfaces,
+                      std::function<PrimitiveHandle(Allocator)> load)
+        : bounds(bounds), onlyOpaqueSurfaces(onlyOpaqueSurfaces), load(std::move(load)) {
+        primitiveMemory += sizeof(*this);
+    }
+
+    Bounds3f Bounds() const { return bounds; }
+    pstd::optional<ShapeIntersection> Intersect(const Ray &r, Float tMax) const;
+    bool IntersectP(const Ray &r, Float tMax) const;
+    bool HasOnlyOpaqueSurfaces() const { return onlyOpaqueSurfaces; }
+    bool IsLoaded() const { return loaded.load(std::memory_order_acquire); }
+
+  private:
+    // DeferredPrimitive Private Methods
+    template <typename F>
+    auto WithPrimitive(F func) const;
+    void Load() const;
+    bool TryEvict() const;
+    void Unload() const;
+
+    // DeferredPrimitive Private Members
+    Bounds3f bounds;
+    bool onlyOpaqueSurfaces;
+    std::function<PrimitiveHandle(Allocator)> load;
+    // Rays hold _mutex_ shared while they are traced, so that loaded
+    // geometry can only be evicted when it isn't in use
+    mutable std::shared_mutex mutex;
+    mutable std::atomic<bool> loaded{false};
+    mutable std::atomic<uint64_t> lastUsed{0};
+    mutable PrimitiveHandle primitive;
+    mutable std::unique_ptr<pstd::pmr::memory_resource> memory;
+    mutable size_t memoryBytes = 0;
 };
 
 }  // namespace pbrt
@@ -7,6 +7,7 @@
 #include <pbrt/cameras.h>
 #include <pbrt/cpu/aggregates.h>
 #include <pbrt/cpu/integrators.h>
+#include <pbrt/cpu/primitive.h>
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
 #include <pbrt/lights.h>
@@ -17,16 +18,599 @@
 #include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/mesh.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/perfcounters.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/stats.h>
+#include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
+
+#include <atomic>
+#include <initializer_list>
+#include <map>
+#include <type_traits>
+#include <unordered_map>
 
 namespace pbrt {
 
-void CPURender(ParsedScene &parsedScene) {
+// EntityHasher Definition
+// Accumulates a hash of scene entities, so that a CPURenderSession can tell
+// which ones are unchanged since the previous render.
+class EntityHasher {
+  public:
+    // EntityHasher Public Methods
+    void Add(const void *ptr, size_t size) { hash = HashBuffer(ptr, size, hash); }
+
+    template <typename T>
+    void AddValue(const T &v) {
+        static_assert(std::is_trivially_copyable_v<T>, "Can't hash bytes of type");
+        Add(&v, sizeof(T));
+    }
+
+    void AddString(const std::string &str) {
+        AddValue(str.size());
+        Add(str.data(), str.size());
+    }
+
+    void AddTransform(const Transform *t) {
+        if (t)
+            AddValue(t->GetMatrix());
+        else
+            AddValue(nullptr);
+    }
+    void AddTransform(const AnimatedTransform &t) {
+        AddValue(t.startTransform.GetMatrix());
+        AddValue(t.endTransform.GetMatrix());
+        AddValue(t.startTime);
+        AddValue(t.endTime);
+    }
+
+    void AddEntity(const SceneEntity &entity) {
+        // The entity's FileLoc is only used for error messages, so it's
+        // deliberately not included.
+        AddString(entity.name);
+        for (const ParsedParameter *p : entity.parameters.GetParameterVector()) {
+            AddString(p->type);
+            AddString(p->name);
+            AddValue(p->numbers.size());
+            Add(p->numbers.data(), p->numbers.size() * sizeof(double));
+            AddValue(p->strings.size());
+            for (const std::string &str : p->strings)
+                AddString(str);
+            AddValue(p->bools.size());
+            Add(p->bools.data(), p->bools.size());
+        }
+        AddValue(entity.parameters.ColorSpace());
+    }
+
+    uint64_t Get() const { return hash; }
+
+  private:
+    uint64_t hash = 0;
+};
+
+// SceneHashes Definition
+struct SceneHashes {
+    // Hashes of the entities that each group of scene objects is created
+    // from; those for geometry include the materials and media it uses.
+    uint64_t media = 0, materials = 0, geometry = 0;
+    std::vector<uint64_t> shapes, lights;
+    std::map<std::string, uint64_t> instanceDefinitions;
+};
+
+template <typename NeedsCamera>
+static SceneHashes HashScene(const ParsedScene &scene, NeedsCamera needsCamera) {
+    SceneHashes hashes;
+
+    EntityHasher media;
+    for (const auto &m : scene.media) {
+        media.AddString(m.first);
+        media.AddEntity(m.second);
+        media.AddTransform(m.second.renderFromObject);
+    }
+    hashes.media = media.Get();
+
+    EntityHasher materials;
+    for (const auto &textures : {&scene.floatTextures, &scene.spectrumTextures}) {
+        materials.AddValue(textures->size());
+        for (const auto &tex : *textures) {
+            materials.AddString(tex.first);
+            materials.AddString(tex.second.texName);
+            materials.AddEntity(tex.second);
+            materials.AddTransform(tex.second.renderFromObject);
+        }
+    }
+    materials.AddValue(scene.namedMaterials.size());
+    for (const auto &nm : scene.namedMaterials) {
+        materials.AddString(nm.first);
+        materials.AddEntity(nm.second);
+    }
+    for (const auto &mtl : scene.materials)
+        materials.AddEntity(mtl);
+    hashes.materials = materials.Get();
+
+    EntityHasher camera;
+    camera.AddEntity(scene.camera);
+    camera.AddTransform(scene.camera.cameraTransform.RenderFromCamera());
+    camera.AddTransform(&scene.camera.cameraTransform.WorldFromRender());
+    camera.AddString(scene.camera.medium);
+
+    // Lights only use the camera transformation to map from world space to
+    // rendering space, so they needn't be recreated when the camera moves
+    // unless rendering space moves with it.
+    hashes.lights.resize(scene.lights.size());
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        const LightSceneEntity &light = scene.lights[i];
+        EntityHasher h;
+        h.AddValue(hashes.media);
+        h.AddEntity(light);
+        h.AddTransform(light.renderFromObject);
+        h.AddString(light.medium);
+        h.AddTransform(&scene.camera.cameraTransform.WorldFromRender());
+        hashes.lights[i] = h.Get();
+    }
+
+    // Shapes are hashed twice: first, everything that the _ShapeHandle_s
+    // are created from, and then, for the primitives, the material, media,
+    // and area light that they use as well.
+    auto hashShape = [&](const ShapeSceneEntity &sh) {
+        EntityHasher h;
+        h.AddEntity(sh);
+        h.AddTransform(sh.renderFromObject);
+        h.AddTransform(sh.objectFromRender);
+        h.AddValue(sh.reverseOrientation);
+        if (needsCamera(sh))
+            h.AddValue(camera.Get());
+        return h;
+    };
+    auto addPrimitive = [&](EntityHasher &h, int materialIndex,
+                            const std::string &materialName, int lightIndex,
+                            const std::string &insideMedium,
+                            const std::string &outsideMedium) {
+        h.AddValue(materialIndex);
+        h.AddString(materialName);
+        h.AddValue(lightIndex);
+        if (lightIndex != -1)
+            h.AddEntity(scene.areaLights[lightIndex]);
+        h.AddString(insideMedium);
+        h.AddString(outsideMedium);
+    };
+    auto hashPrimitives = [&](const std::vector<ShapeSceneEntity> &shapes,
+                              const std::vector<AnimatedShapeSceneEntity> &animatedShapes,
+                              std::vector<uint64_t> *shapeHashes) {
+        std::vector<uint64_t> primitiveHashes(shapes.size());
+        if (shapeHashes)
+            shapeHashes->resize(shapes.size());
+        ParallelFor(0, shapes.size(), [&](int64_t i) {
+            const ShapeSceneEntity &sh = shapes[i];
+            EntityHasher h = hashShape(sh);
+            if (shapeHashes)
+                (*shapeHashes)[i] = h.Get();
+            addPrimitive(h, sh.materialIndex, sh.materialName, sh.lightIndex,
+                         sh.insideMedium, sh.outsideMedium);
+            primitiveHashes[i] = h.Get();
+        });
+
+        EntityHasher h;
+        h.AddValue(hashes.materials);
+        h.AddValue(hashes.media);
+        h.Add(primitiveHashes.data(), primitiveHashes.size() * sizeof(uint64_t));
+        h.AddValue(animatedShapes.size());
+        for (const AnimatedShapeSceneEntity &sh : animatedShapes) {
+            h.AddEntity(sh);
+            h.AddTransform(sh.renderFromObject);
+            h.AddTransform(sh.identity);
+            h.AddValue(sh.reverseOrientation);
+            addPrimitive(h, sh.materialIndex, sh.materialName, sh.lightIndex,
+                         sh.insideMedium, sh.outsideMedium);
+        }
+        return h;
+    };
+
+    for (const auto &inst : scene.instanceDefinitions)
+        hashes.instanceDefinitions[inst.first] =
+            hashPrimitives(inst.second.shapes, inst.second.animatedShapes, nullptr)
+                .Get();
+
+    EntityHasher geometry =
+        hashPrimitives(scene.shapes, scene.animatedShapes, &hashes.shapes);
+    for (const auto &inst : hashes.instanceDefinitions) {
+        geometry.AddString(inst.first);
+        geometry.AddValue(inst.second);
+    }
+    for (const InstanceSceneEntity &inst : scene.instances) {
+        geometry.AddString(inst.name);
+        geometry.AddTransform(inst.renderFromInstanceAnim);
+        geometry.AddTransform(inst.renderFromInstance);
+    }
+    geometry.AddEntity(scene.accelerator);
+    // Culled geometry depends on the camera
+    if (Options->cullDistance > 0) {
+        geometry.AddValue(Options->cullDistance);
+        geometry.AddValue(camera.Get());
+    }
+    hashes.geometry = geometry.Get();
+
+    return hashes;
+}
+
+// ResidentSceneObjects Definition
+// The objects created for a CPURenderSession's previous render, indexed by
+// the hash of the entities that they were created from. Each is stored
+// along with the scene that it was created from, since objects may refer
+// to their scene's entities and transformations.
+struct ResidentSceneObjects {
+    template <typename T>
+    struct Entry {
+        T object;
+        std::shared_ptr<ParsedScene> scene;
+    };
+    template <typename T>
+    using Map = std::unordered_map<uint64_t, Entry<T>>;
+
+    struct Materials {
+        NamedTextures textures;
+        std::map<std::string, MaterialHandle> namedMaterials;
+        std::vector<MaterialHandle> materials;
+    };
+    struct Geometry {
+        PrimitiveHandle accel;
+        std::vector<LightHandle> areaLights;
+        bool haveScatteringMedia;
+    };
+
+    Map<std::map<std::string, MediumHandle>> media;
+    Map<Materials> materials;
+    Map<pstd::vector<ShapeHandle>> shapes;
+    Map<LightHandle> lights;
+    Map<PrimitiveHandle> instanceDefinitions;
+    Map<Geometry> geometry;
+};
+
+// Returns the previous render's object for the given hash, if there was one,
+// and carries it over to _next_. Must not be called concurrently.
+template <typename T>
+static const T *Reuse(const ResidentSceneObjects *resident,
+                      ResidentSceneObjects::Map<T> ResidentSceneObjects::*member,
+                      ResidentSceneObjects *next, uint64_t hash) {
+    if (!resident)
+        return nullptr;
+    auto iter = (resident->*member).find(hash);
+    if (iter == (resident->*member).end())
+        return nullptr;
+    (next->*member)[hash] = iter->second;
+    return &iter->second.object;
+}
+
+// CameraViewVolume Definition
+// Conservatively bounds the points that the camera's rays can reach: those
+// within _radius_ of a ray that leaves _center_ with a direction in _cone_.
+struct CameraViewVolume {
+    // Returns a lower bound on the distance from _p_ to the volume.
+    Float Distance(Point3f p) const {
+        Vector3f v = p - center;
+        Float d = Length(v);
+        if (d <= radius)
+            return 0;
+        Float theta = AngleBetween(v / d, cone.w) - SafeACos(cone.cosTheta);
+        Float dist = theta <= 0 ? 0 : (theta >= Pi / 2 ? d : d * std::sin(theta));
+        return std::max<Float>(0, dist - radius);
+    }
+
+    Point3f center;
+    Float radius;
+    DirectionCone cone;
+};
+
+// Bounds the camera's view with a grid of rays over the film that includes
+// its edges, for the corners and center of the lens and at the start and
+// end of the shutter interval.
+static pstd::optional<CameraViewVolume> BoundCameraView(CameraHandle camera) {
+    constexpr int gridResolution = 32;
+    Bounds2f sampleBounds = camera.GetFilm().SampleBounds();
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
+    Bounds3f origins;
+    DirectionCone cone;
+    for (Float time : {0.f, 1.f})
+        for (Point2f pLens : {Point2f(0.5f, 0.5f), Point2f(0, 0), Point2f(1, 0),
+                              Point2f(0, 1), Point2f(1, 1)})
+            for (int y = 0; y <= gridResolution; ++y)
+                for (int x = 0; x <= gridResolution; ++x) {
+                    CameraSample cs;
+                    cs.pFilm = sampleBounds.Lerp(
+                        Point2f(Float(x) / gridResolution, Float(y) / gridResolution));
+                    cs.pLens = pLens;
+                    cs.time = time;
+                    pstd::optional<CameraRay> cr = camera.GenerateRay(cs, lambda);
+                    if (!cr)
+                        continue;
+                    origins = Union(origins, cr->ray.o);
+                    cone = Union(cone, DirectionCone(cr->ray.d));
+                }
+    if (cone.empty)
+        return {};
+
+    // Widen the cone by the angle between neighboring rays, to cover the
+    // rays between them that differ from the union's approximation
+    Float spread = Pi / gridResolution;
+    Float theta = SafeACos(cone.cosTheta) + spread;
+    cone.cosTheta = theta >= Pi ? -1 : std::cos(theta);
+
+    CameraViewVolume view;
+    view.cone = cone;
+    origins.BoundingSphere(&view.center, &view.radius);
+    return view;
+}
+
+STAT_COUNTER("Scene/Shapes culled", nCulledShapes);
+STAT_MEMORY_COUNTER("Memory/Culled shapes", culledShapeBytes);
+
+// Ray Tracing Benchmark Definitions
+// Rays from the camera, rays leaving the surfaces that they hit in
+// cosine-distributed directions, and shadow rays between pairs of those
+// surface points.
+enum class BenchRayType { Camera, Surface, Shadow };
+
+static int64_t SumStatsCounters(std::initializer_list<const char *> names) {
+    // Gather the counts from all threads, including this one if it isn't
+    // part of the thread pool
+    ForEachThread(ReportThreadStats);
+    ReportThreadStats();
+    int64_t sum = 0;
+    for (const char *name : names)
+        sum += GetStatsCounter(name);
+    return sum;
+}
+
+static void BenchmarkRays(CameraHandle camera, PrimitiveHandle accel) {
+    if (!accel)
+        ErrorExit("--bench-rays: the scene has no geometry.");
+    std::vector<std::pair<std::string, BenchRayType>> types;
+    for (const std::string &name : SplitString(Options->benchRayTypes, ',')) {
+        if (name == "camera")
+            types.push_back({name, BenchRayType::Camera});
+        else if (name == "surface")
+            types.push_back({name, BenchRayType::Surface});
+        else if (name == "shadow")
+            types.push_back({name, BenchRayType::Shadow});
+        else
+            ErrorExit("%s: unknown --bench-ray-types ray type.", name);
+    }
+
+    // Rays are generated in batches that are then traced, so that only the
+    // time spent in the accelerator is measured.
+    constexpr int batchSize = 65536;
+    Bounds2i pixelBounds = camera.GetFilm().PixelBounds();
+    int64_t nPixels = pixelBounds.Area();
+    int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+    int64_t nBenchRays = Options->benchRayCount;
+    Printf("Ray tracing benchmark, %d rays of each type:\n", nBenchRays);
+    for (const auto &type : types) {
+        int64_t nTraced = 0, nHit = 0, nodesVisited = 0, primitivesTested = 0;
+        double seconds = 0;
+        for (int64_t batchStart = 0; batchStart < nBenchRays; batchStart += batchSize) {
+            int nRays = std::min<int64_t>(batchSize, nBenchRays - batchStart);
+            // Generate camera rays through the image's pixels in scanline
+            // order; a ray with a zero _tMax_ isn't traced.
+            std::vector<Ray> rays(nRays);
+            std::vector<Float> tMax(nRays, 0.f);
+            ParallelFor(0, nRays, [&](int64_t i) {
+                int64_t rayIndex = batchStart + i;
+                RNG rng(Hash(Options->seed, rayIndex));
+                int64_t pixelIndex = rayIndex % nPixels;
+                Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
+                               pixelBounds.pMin.y + pixelIndex / xResolution);
+                CameraSample cs;
+                cs.pFilm = Point2f(pPixel) +
+                           Vector2f(rng.Uniform<Float>(), rng.Uniform<Float>());
+                cs.pLens = Point2f(rng.Uniform<Float>(), rng.Uniform<Float>());
+                cs.time = rng.Uniform<Float>();
+                SampledWavelengths lambda =
+                    SampledWavelengths::SampleUniform(rng.Uniform<Float>());
+                if (pstd::optional<CameraRay> cr = camera.GenerateRay(cs, lambda)) {
+                    rays[i] = cr->ray;
+                    tMax[i] = Infinity;
+                }
+            });
+
+            if (type.second != BenchRayType::Camera) {
+                // Find the camera rays' intersections and replace the rays
+                // with ones leaving them
+                std::vector<pstd::optional<Interaction>> hits(nRays);
+                ParallelFor(0, nRays, [&](int64_t i) {
+                    if (tMax[i] > 0)
+                        if (pstd::optional<ShapeIntersection> si =
+                                accel.Intersect(rays[i], tMax[i]))
+                            hits[i] = si->intr;
+                    tMax[i] = 0;
+                });
+                ParallelFor(0, nRays, [&](int64_t i) {
+                    if (!hits[i])
+                        return;
+                    const Interaction &intr = *hits[i];
+                    RNG rng(Hash(Options->seed, batchStart + i), 1);
+                    if (type.second == BenchRayType::Surface) {
+                        Normal3f n = FaceForward(intr.n, intr.wo);
+                        Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+                        Vector3f wi =
+                            Frame::FromZ(n).FromLocal(SampleCosineHemisphere(u));
+                        rays[i] = intr.SpawnRay(wi);
+                        tMax[i] = Infinity;
+                    } else {
+                        int j = rng.Uniform<uint32_t>(nRays);
+                        if (j != i && hits[j]) {
+                            rays[i] = intr.SpawnRayTo(*hits[j]);
+                            tMax[i] = 1 - ShadowEpsilon;
+                        }
+                    }
+                });
+            }
+
+            // Trace the batch's rays, measuring the time and the work done
+            int64_t nodesStart = SumStatsCounters(
+                {"BVH/Nodes visited", "Kd-Tree/Nodes visited"});
+            int64_t primitivesStart = SumStatsCounters(
+                {"BVH/Primitives tested", "Kd-Tree/Primitives tested"});
+            std::vector<uint8_t> hit(nRays, 0);
+            Timer timer;
+            ParallelFor(0, nRays, [&](int64_t i) {
+                if (tMax[i] == 0)
+                    return;
+                if (type.second == BenchRayType::Shadow)
+                    hit[i] = accel.IntersectP(rays[i], tMax[i]);
+                else
+                    hit[i] = accel.Intersect(rays[i], tMax[i]).has_value();
+            });
+            seconds += timer.ElapsedSeconds();
+            nodesVisited +=
+                SumStatsCounters({"BVH/Nodes visited", "Kd-Tree/Nodes visited"}) -
+                nodesStart;
+            primitivesTested +=
+                SumStatsCounters({"BVH/Primitives tested", "Kd-Tree/Primitives tested"}) -
+                primitivesStart;
+            for (int i = 0; i < nRays; ++i) {
+                nTraced += tMax[i] > 0;
+                nHit += hit[i];
+            }
+        }
+
+        if (nTraced == 0) {
+            Printf("  %-8s no rays were generated\n", type.first);
+            continue;
+        }
+        Printf("  %-8s %9.2f Mrays/s  %7.2f nodes/ray  %7.2f primitives/ray  "
+               "%5.1f%% hit (%d rays)\n",
+               type.first, nTraced / seconds / 1e6, double(nodesVisited) / nTraced,
+               double(primitivesTested) / nTraced, 100. * nHit / nTraced, nTraced);
+    }
+}
+
+static void RenderScene(ParsedScene &parsedScene,
+                        const std::shared_ptr<ParsedScene> &owner,
+                        ResidentSceneObjects *resident, SceneObjectCounts *reused,
+                        SceneObjectCounts *created) {
+    // All of the scene objects are allocated with the default memory
+    // resource, which is thread safe, so that independent entities can be
+    // created concurrently. Most are allocated through the allocator for
+    // their memory category so that their memory use is accounted to it.
     Allocator alloc;
+    Allocator geometryAlloc = CategoryAllocator(MemoryCategory::Geometry);
+    Timer startupTimer;
+    PerfCounterPhase sceneCreationPhase("Scene creation");
+
+    // The parameters of shapes, textures, and materials are freed once the
+    // corresponding objects have been created, though only their large
+    // arrays' memory is returned before the _ParsedScene_'s parameter arena
+    // is released.
+    TrackedMemoryResource *parameterMemory = ParsedParameterMemoryResource();
+    LOG_VERBOSE("Parsed parameter memory before scene creation: %d (peak %d)",
+                parameterMemory->CurrentAllocatedBytes(),
+                parameterMemory->MaxAllocatedBytes());
+
+    // Record how long each startup phase takes; some of them run
+    // concurrently, so their times generally don't sum to the total.
+    std::vector<std::pair<std::string, double>> phaseTimes;
+    std::mutex phaseTimesMutex;
+    auto timePhase = [&](const char *name, auto func) {
+        TraceScope trace(name, "Scene creation");
+        Timer timer;
+        auto result = func();
+        std::lock_guard<std::mutex> lock(phaseTimesMutex);
+        phaseTimes.push_back({name, timer.ElapsedSeconds()});
+        return result;
+    };
+
+    // "plymesh" shapes with "deferred" set are only loaded once a ray reaches
+    // their bounds; area lights need their shapes up front, though.
+    auto isDeferred = [](const ShapeSceneEntity &sh) {
+        return sh.name == "plymesh" && sh.lightIndex == -1 &&
+               sh.parameters.GetOneBool("deferred", false);
+    };
+
+    // Loop subdivision surfaces with "edgelength" are refined according to
+    // their size on the film and so can't be created until the camera is.
+    auto needsCamera = [](const ShapeSceneEntity &sh) {
+        return sh.name == "loopsubdiv" && sh.parameters.GetOneFloat("edgelength", 0.f) > 0;
+    };
+
+    // When rendering as part of a session, find which of the previous
+    // render's objects can be reused; _next_ collects the objects used by
+    // this render.
+    ResidentSceneObjects next;
+    SceneHashes hashes;
+    if (resident)
+        hashes = timePhase("scene diff",
+                           [&]() { return HashScene(parsedScene, needsCamera); });
+    const ResidentSceneObjects::Geometry *residentGeometry =
+        Reuse(resident, &ResidentSceneObjects::geometry, &next, hashes.geometry);
+    const ResidentSceneObjects::Materials *residentMaterials =
+        Reuse(resident, &ResidentSceneObjects::materials, &next, hashes.materials);
+    const std::map<std::string, MediumHandle> *residentMedia =
+        Reuse(resident, &ResidentSceneObjects::media, &next, hashes.media);
+    // Returns the resident shapes for the i'th of the scene's shapes, if any.
+    auto residentShapes = [&](size_t i) -> const pstd::vector<ShapeHandle> * {
+        if (!resident)
+            return nullptr;
+        auto iter = resident->shapes.find(hashes.shapes[i]);
+        return iter != resident->shapes.end() ? &iter->second.object : nullptr;
+    };
+
+    // Start creating shapes, media, and textures, which don't depend on each
+    // other, while the camera and such are created
+    auto CreateShapes = [&](const std::vector<ShapeSceneEntity> &shapes,
+                            bool isSceneShapes) {
+        // Parallelize ShapeHandle::Create calls, which will in turn
+        // parallelize PLY file loading, etc...
+        std::vector<pstd::vector<ShapeHandle>> shapeHandleVectors(shapes.size());
+        ParallelFor(0, shapes.size(), [&](int64_t i) {
+            const auto &sh = shapes[i];
+            if (isDeferred(sh) || (isSceneShapes && needsCamera(sh)))
+                return;
+            if (isSceneShapes && residentShapes(i)) {
+                shapeHandleVectors[i] = *residentShapes(i);
+                return;
+            }
+            EntityStatsScope stats("Shape", sh.name, &sh.loc, geometryAlloc);
+            shapeHandleVectors[i] = ShapeHandle::Create(
+                sh.name, sh.renderFromObject, sh.objectFromRender, sh.reverseOrientation,
+                sh.parameters, &sh.loc, stats.Alloc());
+        });
+        return shapeHandleVectors;
+    };
+    Future<std::vector<pstd::vector<ShapeHandle>>> shapesFuture = RunAsync([&]() {
+        if (residentGeometry)
+            return std::vector<pstd::vector<ShapeHandle>>();
+        return timePhase("shapes",
+                         [&]() { return CreateShapes(parsedScene.shapes, true); });
+    });
+    Future<std::map<std::string, MediumHandle>> mediaFuture = RunAsync([&]() {
+        if (residentMedia)
+            return *residentMedia;
+        return timePhase("media", [&]() {
+            return parsedScene.CreateMedia(CategoryAllocator(MemoryCategory::Media));
+        });
+    });
+    Future<NamedTextures> texturesFuture = RunAsync([&]() {
+        if (residentMaterials)
+            return residentMaterials->textures;
+        return timePhase("textures", [&]() {
+            return parsedScene.CreateTextures(
+                CategoryAllocator(MemoryCategory::Textures), false);
+        });
+    });
 
-    // Create media first (so have them for the camera...)
-    std::map<std::string, MediumHandle> media = parsedScene.CreateMedia(alloc);
+    // Get media now so have them for the camera...
+    std::map<std::string, MediumHandle> media = mediaFuture.Get();
+    if (resident && !residentMedia)
+        next.media[hashes.media] = {media, owner};
 
-    bool haveScatteringMedia = false;
+    std::atomic<bool> haveScatteringMedia{false};
     auto findMedium = [&media, &haveScatteringMedia](const std::string &s,
                                                      const FileLoc *loc) -> MediumHandle {
         if (s.empty())
@@ -57,7 +641,8 @@ void CPURender(ParsedScene &parsedScene) {
                   "does not open.  A black image will result.");
     FilmHandle film =
         FilmHandle::Create(parsedScene.film.name, parsedScene.film.parameters,
-                           exposureTime, filter, &parsedScene.film.loc, alloc);
+                           exposureTime, filter, &parsedScene.film.loc,
+                           CategoryAllocator(MemoryCategory::Film));
 
     // Camera
     MediumHandle cameraMedium =
@@ -72,13 +657,74 @@ void CPURender(ParsedScene &parsedScene) {
         SamplerHandle::Create(parsedScene.sampler.name, parsedScene.sampler.parameters,
                               fullImageResolution, &parsedScene.sampler.loc, alloc);
 
+    // Lights (area lights will be done later, with shapes...)
+    std::vector<LightHandle> lights = timePhase("lights", [&]() {
+        // Create the lights in parallel but keep them in the order in which
+        // they were specified.
+        std::vector<LightHandle> lights(parsedScene.lights.size());
+        ParallelFor(0, parsedScene.lights.size(), [&](int64_t i) {
+            const auto &light = parsedScene.lights[i];
+            MediumHandle outsideMedium = findMedium(light.medium, &light.loc);
+            if (resident) {
+                auto iter = resident->lights.find(hashes.lights[i]);
+                if (iter != resident->lights.end()) {
+                    lights[i] = iter->second.object;
+                    return;
+                }
+            }
+            if (light.renderFromObject.IsAnimated())
+                Warning(&light.loc,
+                        "Animated lights aren't supported. Using the start transform.");
+            EntityStatsScope stats("Light", light.name, &light.loc,
+                                   CategoryAllocator(MemoryCategory::Lights));
+            lights[i] = LightHandle::Create(light.name, light.parameters,
+                                            light.renderFromObject.startTransform,
+                                            parsedScene.camera.cameraTransform,
+                                            outsideMedium, &light.loc, stats.Alloc());
+        });
+        return lights;
+    });
+    if (resident)
+        for (size_t i = 0; i < lights.size(); ++i) {
+            if (!Reuse(resident, &ResidentSceneObjects::lights, &next, hashes.lights[i]))
+                next.lights[hashes.lights[i]] = {lights[i], owner};
+        }
+    std::mutex lightsMutex;
+    lights.reserve(parsedScene.lights.size() + parsedScene.areaLights.size());
+
     // Textures
-    NamedTextures textures = parsedScene.CreateTextures(alloc, false);
+    NamedTextures textures = texturesFuture.Get();
 
     // Materials
     std::map<std::string, MaterialHandle> namedMaterials;
     std::vector<MaterialHandle> materials;
-    parsedScene.CreateMaterials(textures, alloc, &namedMaterials, &materials);
+    if (residentMaterials) {
+        namedMaterials = residentMaterials->namedMaterials;
+        materials = residentMaterials->materials;
+    } else {
+        timePhase("materials", [&]() {
+            parsedScene.CreateMaterials(textures,
+                                        CategoryAllocator(MemoryCategory::Materials),
+                                        &namedMaterials, &materials);
+            return true;
+        });
+        // Textures and materials don't refer to the parameters they were
+        // created from, so their entities' parameters can be freed now.
+        for (auto &tex : parsedScene.floatTextures)
+            tex.second.parameters.FreeParameters();
+        for (auto &tex : parsedScene.spectrumTextures)
+            tex.second.parameters.FreeParameters();
+        for (auto &mtl : parsedScene.materials)
+            mtl.parameters.FreeParameters();
+        for (auto &namedMtl : parsedScene.namedMaterials)
+            namedMtl.second.parameters.FreeParameters();
+        if (resident)
+            next.materials[hashes.materials] = {{textures, namedMaterials, materials},
+                                                owner};
+    }
+    if (GBufferFilm *gbufferFilm = film.CastOrNullptr<GBufferFilm>())
+        gbufferFilm->SetMaterialNames(namedMaterials, materials);
+
     bool haveSubsurface = false;
     for (const auto &mtl : parsedScene.materials)
         if (mtl.name == "subsurface")
@@ -87,22 +733,6 @@ void CPURender(ParsedScene &parsedScene) {
         if (namedMtl.second.name == "subsurface")
             haveSubsurface = true;
 
-    // Lights (area lights will be done later, with shapes...)
-    std::vector<LightHandle> lights;
-    std::mutex lightsMutex;
-    lights.reserve(parsedScene.lights.size() + parsedScene.areaLights.size());
-    for (const auto &light : parsedScene.lights) {
-        MediumHandle outsideMedium = findMedium(light.medium, &light.loc);
-        if (light.renderFromObject.IsAnimated())
-            Warning(&light.loc,
-                    "Animated lights aren't supported. Using the start transform.");
-        LightHandle l = LightHandle::Create(
-            light.name, light.parameters, light.renderFromObject.startTransform,
-            parsedScene.camera.cameraTransform, outsideMedium, &light.loc, alloc);
-        // No need to hold the mutex here
-        lights.push_back(l);
-    }
-
     // Primitives
     auto getAlphaTexture = [&](const ParameterDictionary &parameters,
                                const FileLoc *loc) -> FloatTextureHandle {
@@ -119,28 +749,73 @@ void CPURender(ParsedScene &parsedScene) {
             return nullptr;
     };
 
-    // Non-animated shapes
-    auto CreatePrimitivesForShapes =
-        [&](const std::vector<ShapeSceneEntity> &shapes) -> std::vector<PrimitiveHandle> {
-        // Parallelize ShapeHandle::Create calls, which will in turn
-        // parallelize PLY file loading, etc...
-        pstd::vector<pstd::vector<ShapeHandle>> shapeHandleVectors(shapes.size());
-        ParallelFor(0, shapes.size(), [&](int64_t i) {
-            const auto &sh = shapes[i];
-            shapeHandleVectors[i] =
-                ShapeHandle::Create(sh.name, sh.renderFromObject, sh.objectFromRender,
-                                    sh.reverseOrientation, sh.parameters, &sh.loc, alloc);
+    auto CreateDeferredPrimitive = [&](const ShapeSceneEntity &sh, MaterialHandle mtl,
+                                       const MediumInterface &mi,
+                                       FloatTextureHandle alphaTex) -> PrimitiveHandle {
+        // Find object-space bounds for deferred shape
+        std::string filename =
+            ResolveFilename(sh.parameters.GetOneString("filename", ""));
+        std::vector<Float> b = sh.parameters.GetFloatArray("bounds");
+        pstd::optional<Bounds3f> objectBounds;
+        if (b.size() == 6)
+            objectBounds = Bounds3f(Point3f(b[0], b[1], b[2]), Point3f(b[3], b[4], b[5]));
+        else if (!b.empty())
+            ErrorExit(&sh.loc, "Six values must be provided for \"bounds\".");
+        else
+            objectBounds = TriQuadMesh::ReadPLYBounds(filename);
+        if (!objectBounds)
+            ErrorExit(&sh.loc,
+                      "%s: no bounds found for deferred shape. Provide them with "
+                      "\"bounds\", a \"%s.bounds\" file, or a \"comment bounds\" "
+                      "line in the PLY header.",
+                      filename, filename);
+
+        // Pad render-space bounds to cover rounding error in the mesh's
+        // transformed vertices
+        Bounds3f bounds = (*sh.renderFromObject)(*objectBounds);
+        bounds = Expand(bounds, gamma(3) * MaxComponentValue(Max(Abs(bounds.pMin),
+                                                                 Abs(bounds.pMax))));
+
+        bool onlyOpaque = mtl && !mtl.IsTransparent() && !mi.IsMediumTransition();
+        const ShapeSceneEntity *entity = &sh;
+        // Most of the shape's parameters are only looked up once it is
+        // loaded, so unused ones are reported after its first load.
+        auto reportUnused = std::make_shared<std::once_flag>();
+        return new DeferredPrimitive(bounds, onlyOpaque, [=](Allocator alloc) -> PrimitiveHandle {
+            pstd::vector<ShapeHandle> shapes = ShapeHandle::Create(
+                entity->name, entity->renderFromObject, entity->objectFromRender,
+                entity->reverseOrientation, entity->parameters, &entity->loc, alloc);
+            std::call_once(*reportUnused, [&]() { entity->parameters.ReportUnused(); });
+            const OpacityMicromap *alphaMicromap =
+                alphaTex ? OpacityMicromap::Create(shapes, alphaTex, alloc) : nullptr;
+            std::vector<PrimitiveHandle> prims;
+            for (ShapeHandle s : shapes)
+                prims.push_back(CreateShapePrimitive(s, mtl, nullptr, mi, alphaTex, alloc,
+                                                     alphaMicromap));
+            if (prims.size() == 1)
+                return prims[0];
+            return alloc.new_object<BVHAggregate>(std::move(prims), 4);
         });
+    };
 
+    // Non-animated shapes
+    // The shapes' parameters are freed once their primitives have been
+    // created, except for deferred shapes, which need them later.
+    auto CreatePrimitivesForShapes =
+        [&](std::vector<ShapeSceneEntity> &shapes,
+            std::vector<pstd::vector<ShapeHandle>> shapeHandleVectors,
+            bool isSceneShapes) -> std::vector<PrimitiveHandle> {
         std::vector<PrimitiveHandle> primitives;
         for (size_t i = 0; i < shapes.size(); ++i) {
-            const auto &sh = shapes[i];
+            auto &sh = shapes[i];
             pstd::vector<ShapeHandle> &shapes = shapeHandleVectors[i];
-            if (shapes.empty())
+            bool deferred = isDeferred(sh);
+            if (shapes.empty() && !deferred) {
+                sh.parameters.FreeParameters();
                 continue;
+            }
 
             FloatTextureHandle alphaTex = getAlphaTexture(sh.parameters, &sh.loc);
-            sh.parameters.ReportUnused();  // do now so can grab alpha...
 
             MaterialHandle mtl = nullptr;
             if (!sh.materialName.empty()) {
@@ -156,51 +831,62 @@ void CPURender(ParsedScene &parsedScene) {
             MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                findMedium(sh.outsideMedium, &sh.loc));
 
-            for (auto &s : shapes) {
-                // Possibly create area light for shape
-                LightHandle areaHandle = nullptr;
-                if (sh.lightIndex != -1) {
-                    CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
-                    const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
-
-                    LightHandle area = LightHandle::CreateArea(
-                        areaLightEntity.name, areaLightEntity.parameters,
-                        *sh.renderFromObject, mi, s, &areaLightEntity.loc, Allocator{});
-                    areaHandle = area;
-                    if (area) {
-                        std::lock_guard<std::mutex> lock(lightsMutex);
-                        lights.push_back(area);
-                    }
-                }
-                if (areaHandle == nullptr && !mi.IsMediumTransition() && !alphaTex)
-                    primitives.push_back(new SimplePrimitive(s, mtl));
-                else
-                    primitives.push_back(
-                        new GeometricPrimitive(s, mtl, areaHandle, mi, alphaTex));
+            if (deferred) {
+                primitives.push_back(CreateDeferredPrimitive(sh, mtl, mi, alphaTex));
+                continue;
+            }
+            // Shapes reused from a session's previous render had their
+            // parameters checked when they were created then.
+            if (!(isSceneShapes && residentShapes(i)))
+                sh.parameters.ReportUnused();  // do now so can grab alpha...
+
+            // Possibly create area lights for the shapes
+            pstd::vector<LightHandle> areaLights;
+            if (sh.lightIndex != -1) {
+                CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
+                const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
+
+                areaLights = LightHandle::CreateAreaLights(
+                    areaLightEntity.name, areaLightEntity.parameters,
+                    *sh.renderFromObject, mi, shapes, &areaLightEntity.loc, Allocator{});
+                std::lock_guard<std::mutex> lock(lightsMutex);
+                lights.insert(lights.end(), areaLights.begin(), areaLights.end());
+            }
+
+            const OpacityMicromap *alphaMicromap =
+                alphaTex ? OpacityMicromap::Create(shapes, alphaTex, Allocator())
+                         : nullptr;
+            for (size_t j = 0; j < shapes.size(); ++j) {
+                LightHandle areaHandle = areaLights.empty() ? nullptr : areaLights[j];
+                primitives.push_back(CreateShapePrimitive(shapes[j], mtl, areaHandle, mi,
+                                                          alphaTex, Allocator(),
+                                                          alphaMicromap));
             }
+            sh.parameters.FreeParameters();
         }
         return primitives;
     };
 
-    std::vector<PrimitiveHandle> primitives =
-        CreatePrimitivesForShapes(parsedScene.shapes);
-
     // Animated shapes
     auto CreatePrimitivesForAnimatedShapes =
-        [&](const std::vector<AnimatedShapeSceneEntity> &shapes)
+        [&](std::vector<AnimatedShapeSceneEntity> &shapes)
         -> std::vector<PrimitiveHandle> {
         std::vector<PrimitiveHandle> primitives;
         primitives.reserve(shapes.size());
 
-        for (const auto &sh : shapes) {
-            pstd::vector<ShapeHandle> shapes =
-                ShapeHandle::Create(sh.name, sh.identity, sh.identity,
-                                    sh.reverseOrientation, sh.parameters, &sh.loc, alloc);
-            if (shapes.empty())
+        for (auto &sh : shapes) {
+            EntityStatsScope stats("Shape", sh.name, &sh.loc, geometryAlloc);
+            pstd::vector<ShapeHandle> shapes = ShapeHandle::Create(
+                sh.name, sh.identity, sh.identity, sh.reverseOrientation, sh.parameters,
+                &sh.loc, stats.Alloc());
+            if (shapes.empty()) {
+                sh.parameters.FreeParameters();
                 continue;
+            }
 
             FloatTextureHandle alphaTex = getAlphaTexture(sh.parameters, &sh.loc);
             sh.parameters.ReportUnused();  // do now so can grab alpha...
+            sh.parameters.FreeParameters();
 
             // Create initial shape or shapes for animated shape
 
@@ -218,30 +904,32 @@ void CPURender(ParsedScene &parsedScene) {
             MediumInterface mi(findMedium(sh.insideMedium, &sh.loc),
                                findMedium(sh.outsideMedium, &sh.loc));
 
+            // Possibly create area lights for the shapes
+            pstd::vector<LightHandle> areaLights;
+            if (sh.lightIndex != -1) {
+                CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
+                const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
+
+                // TODO: shouldn't this always be true if we got here?
+                if (sh.renderFromObject.IsAnimated())
+                    ErrorExit(&sh.loc, "Animated area lights are not supported.");
+
+                areaLights = LightHandle::CreateAreaLights(
+                    areaLightEntity.name, areaLightEntity.parameters,
+                    sh.renderFromObject.startTransform, mi, shapes, &sh.loc, Allocator{});
+                std::lock_guard<std::mutex> lock(lightsMutex);
+                lights.insert(lights.end(), areaLights.begin(), areaLights.end());
+            }
+
+            const OpacityMicromap *alphaMicromap =
+                alphaTex ? OpacityMicromap::Create(shapes, alphaTex, Allocator())
+                         : nullptr;
             std::vector<PrimitiveHandle> prims;
-            for (auto &s : shapes) {
-                // Possibly create area light for shape
-                LightHandle areaHandle = nullptr;
-                if (sh.lightIndex != -1) {
-                    CHECK_LT(sh.lightIndex, parsedScene.areaLights.size());
-                    const auto &areaLightEntity = parsedScene.areaLights[sh.lightIndex];
-
-                    // TODO: shouldn't this always be true if we got here?
-                    if (sh.renderFromObject.IsAnimated())
-                        ErrorExit(&sh.loc, "Animated area lights are not supported.");
-
-                    LightHandle area = LightHandle::CreateArea(
-                        areaLightEntity.name, areaLightEntity.parameters,
-                        sh.renderFromObject.startTransform, mi, s, &sh.loc, Allocator{});
-                    areaHandle = area;
-                    if (area)
-                        lights.push_back(area);
-                }
-                if (areaHandle == nullptr && !mi.IsMediumTransition() && !alphaTex)
-                    prims.push_back(new SimplePrimitive(s, mtl));
-                else
-                    prims.push_back(
-                        new GeometricPrimitive(s, mtl, areaHandle, mi, alphaTex));
+            for (size_t j = 0; j < shapes.size(); ++j) {
+                LightHandle areaHandle = areaLights.empty() ? nullptr : areaLights[j];
+                prims.push_back(CreateShapePrimitive(shapes[j], mtl, areaHandle, mi,
+                                                     alphaTex, Allocator(),
+                                                     alphaMicromap));
             }
 
             // TODO: could try to be greedy or even segment them according
@@ -257,73 +945,230 @@ void CPURender(ParsedScene &parsedScene) {
         }
         return primitives;
     };
-    std::vector<PrimitiveHandle> animatedPrimitives =
-        CreatePrimitivesForAnimatedShapes(parsedScene.animatedShapes);
-    primitives.insert(primitives.end(), animatedPrimitives.begin(),
-                      animatedPrimitives.end());
-
-    // Instance definitions
-    std::map<std::string, PrimitiveHandle> instanceDefinitions;
-    std::mutex instanceDefinitionsMutex;
-    std::vector<std::map<std::string, InstanceDefinitionSceneEntity>::iterator>
-        instanceDefinitionIterators;
-    for (auto iter = parsedScene.instanceDefinitions.begin();
-         iter != parsedScene.instanceDefinitions.end(); ++iter)
-        instanceDefinitionIterators.push_back(iter);
-    ParallelFor(0, instanceDefinitionIterators.size(), [&](int64_t i) {
-        const auto &inst = *instanceDefinitionIterators[i];
-
-        std::vector<PrimitiveHandle> instancePrimitives =
-            CreatePrimitivesForShapes(inst.second.shapes);
-        std::vector<PrimitiveHandle> movingInstancePrimitives =
-            CreatePrimitivesForAnimatedShapes(inst.second.animatedShapes);
-        instancePrimitives.insert(instancePrimitives.end(),
-                                  movingInstancePrimitives.begin(),
-                                  movingInstancePrimitives.end());
-
-        if (instancePrimitives.size() > 1) {
-            PrimitiveHandle bvh = new BVHAggregate(std::move(instancePrimitives));
-            instancePrimitives.clear();
-            instancePrimitives.push_back(bvh);
-        }
+    // Geometry and the aggregates built over it. A session reuses them if
+    // no shape, instance, material, or medium has changed, and otherwise
+    // still reuses the unchanged shapes and instance definitions.
+    PrimitiveHandle accel;
+    if (residentGeometry) {
+        accel = residentGeometry->accel;
+        lights.insert(lights.end(), residentGeometry->areaLights.begin(),
+                      residentGeometry->areaLights.end());
+        haveScatteringMedia =
+            haveScatteringMedia || residentGeometry->haveScatteringMedia;
+        shapesFuture.Wait();
+        for (uint64_t hash : hashes.shapes)
+            Reuse(resident, &ResidentSceneObjects::shapes, &next, hash);
+        for (const auto &inst : hashes.instanceDefinitions)
+            Reuse(resident, &ResidentSceneObjects::instanceDefinitions, &next,
+                  inst.second);
+    } else {
+        // Area lights are added to _lights_ as the shapes are created;
+        // record which media the geometry uses separately from the others.
+        size_t nNonAreaLights = lights.size();
+        bool lightsHaveScatteringMedia = haveScatteringMedia;
+        haveScatteringMedia = false;
 
-        std::lock_guard<std::mutex> lock(instanceDefinitionsMutex);
-        if (instancePrimitives.empty())
-            instanceDefinitions[inst.first] = nullptr;
-        else
-            instanceDefinitions[inst.first] = instancePrimitives[0];
-    });
+        std::vector<pstd::vector<ShapeHandle>> shapeHandles = shapesFuture.Get();
+        timePhase("camera-dependent shapes", [&]() {
+            ParallelFor(0, parsedScene.shapes.size(), [&](int64_t i) {
+                const auto &sh = parsedScene.shapes[i];
+                if (!needsCamera(sh))
+                    return;
+                if (residentShapes(i)) {
+                    shapeHandles[i] = *residentShapes(i);
+                    return;
+                }
+                EntityStatsScope stats("Shape", sh.name, &sh.loc, geometryAlloc);
+                shapeHandles[i] = ShapeHandle::Create(
+                    sh.name, sh.renderFromObject, sh.objectFromRender,
+                    sh.reverseOrientation, sh.parameters, &sh.loc, stats.Alloc(), camera);
+            });
+            return 0;
+        });
+        if (resident)
+            for (size_t i = 0; i < shapeHandles.size(); ++i)
+                if (!Reuse(resident, &ResidentSceneObjects::shapes, &next,
+                           hashes.shapes[i]) &&
+                    !shapeHandles[i].empty())
+                    next.shapes[hashes.shapes[i]] = {shapeHandles[i], owner};
 
-    // Instances
-    for (const auto &inst : parsedScene.instances) {
-        auto iter = instanceDefinitions.find(inst.name);
-        if (iter == instanceDefinitions.end())
-            ErrorExit(&inst.loc, "%s: object instance not defined", inst.name);
+        // Optionally drop shapes that are farther than --cull-distance from
+        // everything the camera sees. Area lights and medium boundaries are
+        // always kept, and "deferred" shapes are only loaded if a ray
+        // reaches them anyway.
+        pstd::optional<CameraViewVolume> view;
+        if (Options->cullDistance > 0)
+            view = BoundCameraView(camera);
+        if (view)
+            timePhase("culling", [&]() {
+                ParallelFor(0, parsedScene.shapes.size(), [&](int64_t i) {
+                    const ShapeSceneEntity &sh = parsedScene.shapes[i];
+                    if (sh.lightIndex != -1 || sh.insideMedium != sh.outsideMedium)
+                        return;
+                    pstd::vector<ShapeHandle> &handles = shapeHandles[i];
+                    auto culled = [&](ShapeHandle s) {
+                        Point3f center;
+                        Float radius;
+                        s.Bounds().BoundingSphere(&center, &radius);
+                        return view->Distance(center) > radius + Options->cullDistance;
+                    };
+                    size_t n = 0;
+                    size_t bytes = 0;
+                    for (ShapeHandle s : handles) {
+                        if (culled(s))
+                            bytes += (s.Is<Triangle>() ? 0 : sizeof(SimplePrimitive)) +
+                                     s.DispatchCPU([](auto ptr) { return sizeof(*ptr); });
+                        else
+                            handles[n++] = s;
+                    }
+                    nCulledShapes += handles.size() - n;
+                    culledShapeBytes += bytes;
+                    handles.resize(n);
+                });
+                return 0;
+            });
 
-        if (iter->second == nullptr)
-            // empty instance
-            continue;
+        Timer primitivesTimer;
+        std::vector<PrimitiveHandle> primitives =
+            CreatePrimitivesForShapes(parsedScene.shapes, std::move(shapeHandles), true);
 
-        if (inst.renderFromInstance)
-            primitives.push_back(
-                new TransformedPrimitive(iter->second, inst.renderFromInstance));
-        else
-            primitives.push_back(
-                new AnimatedPrimitive(iter->second, inst.renderFromInstanceAnim));
-    }
+        std::vector<PrimitiveHandle> animatedPrimitives =
+            CreatePrimitivesForAnimatedShapes(parsedScene.animatedShapes);
+        primitives.insert(primitives.end(), animatedPrimitives.begin(),
+                          animatedPrimitives.end());
+
+        // Instance definitions
+        std::map<std::string, PrimitiveHandle> instanceDefinitions;
+        std::mutex instanceDefinitionsMutex;
+        std::vector<std::map<std::string, InstanceDefinitionSceneEntity>::iterator>
+            instanceDefinitionIterators;
+        for (auto iter = parsedScene.instanceDefinitions.begin();
+             iter != parsedScene.instanceDefinitions.end(); ++iter)
+            instanceDefinitionIterators.push_back(iter);
+        ParallelFor(0, instanceDefinitionIterators.size(), [&](int64_t i) {
+            auto &inst = *instanceDefinitionIterators[i];
+            if (resident) {
+                auto iter = resident->instanceDefinitions.find(
+                    hashes.instanceDefinitions[inst.first]);
+                if (iter != resident->instanceDefinitions.end()) {
+                    std::lock_guard<std::mutex> lock(instanceDefinitionsMutex);
+                    instanceDefinitions[inst.first] = iter->second.object;
+                    return;
+                }
+            }
+
+            std::vector<PrimitiveHandle> instancePrimitives = CreatePrimitivesForShapes(
+                inst.second.shapes, CreateShapes(inst.second.shapes, false), false);
+            std::vector<PrimitiveHandle> movingInstancePrimitives =
+                CreatePrimitivesForAnimatedShapes(inst.second.animatedShapes);
+            instancePrimitives.insert(instancePrimitives.end(),
+                                      movingInstancePrimitives.begin(),
+                                      movingInstancePrimitives.end());
+
+            if (instancePrimitives.size() > 1) {
+                PrimitiveHandle bvh = new BVHAggregate(std::move(instancePrimitives));
+                instancePrimitives.clear();
+                instancePrimitives.push_back(bvh);
+            }
+
+            std::lock_guard<std::mutex> lock(instanceDefinitionsMutex);
+            if (instancePrimitives.empty())
+                instanceDefinitions[inst.first] = nullptr;
+            else
+                instanceDefinitions[inst.first] = instancePrimitives[0];
+        });
+        if (resident)
+            for (const auto &inst : hashes.instanceDefinitions)
+                if (!Reuse(resident, &ResidentSceneObjects::instanceDefinitions, &next,
+                           inst.second))
+                    next.instanceDefinitions[inst.second] = {
+                        instanceDefinitions[inst.first], owner};
+
+        // Instances
+        // Static instances share a two-level _InstanceBVHAggregate_; animated
+        // ones are transformed individually
+        std::vector<PrimitiveHandle> prototypes;
+        std::map<std::string, int> prototypeIndices;
+        std::vector<int> instancePrototypes;
+        std::vector<const Transform *> renderFromInstances;
+        for (const auto &inst : parsedScene.instances) {
+            auto iter = instanceDefinitions.find(inst.name);
+            if (iter == instanceDefinitions.end())
+                ErrorExit(&inst.loc, "%s: object instance not defined", inst.name);
+
+            if (iter->second == nullptr)
+                // empty instance
+                continue;
+
+            if (inst.renderFromInstance && inst.renderFromInstance->IsIdentity())
+                // No need to go through the instance BVH for untransformed
+                // instances.
+                primitives.push_back(iter->second);
+            else if (inst.renderFromInstance) {
+                auto protoIter = prototypeIndices.find(inst.name);
+                if (protoIter == prototypeIndices.end()) {
+                    protoIter =
+                        prototypeIndices.insert({inst.name, prototypes.size()}).first;
+                    prototypes.push_back(iter->second);
+                }
+                instancePrototypes.push_back(protoIter->second);
+                renderFromInstances.push_back(inst.renderFromInstance);
+            } else
+                primitives.push_back(
+                    new AnimatedPrimitive(iter->second, inst.renderFromInstanceAnim));
+        }
+        if (!instancePrototypes.empty())
+            primitives.push_back(new InstanceBVHAggregate(
+                std::move(prototypes), instancePrototypes, renderFromInstances));
+
+        phaseTimes.push_back({"primitives", primitivesTimer.ElapsedSeconds()});
 
-    // Accelerator
-    PrimitiveHandle accel = nullptr;
-    if (!primitives.empty())
-        accel = CreateAccelerator(parsedScene.accelerator.name, std::move(primitives),
-                                  parsedScene.accelerator.parameters);
+        // Accelerator
+        accel = timePhase("accelerator", [&]() -> PrimitiveHandle {
+            if (primitives.empty())
+                return nullptr;
+            PerfCounterPhase bvhPhase("BVH build");
+            return CreateAccelerator(parsedScene.accelerator.name, std::move(primitives),
+                                     parsedScene.accelerator.parameters);
+        });
+
+        if (resident)
+            next.geometry[hashes.geometry] = {
+                {accel,
+                 std::vector<LightHandle>(lights.begin() + nNonAreaLights, lights.end()),
+                 haveScatteringMedia},
+                owner};
+        haveScatteringMedia = haveScatteringMedia || lightsHaveScatteringMedia;
+    }
 
     // Integrator
+    AssignLightIndices(lights);
     const RGBColorSpace *integratorColorSpace = parsedScene.film.parameters.ColorSpace();
     std::unique_ptr<Integrator> integrator(Integrator::Create(
         parsedScene.integrator.name, parsedScene.integrator.parameters, camera, sampler,
         accel, lights, integratorColorSpace, &parsedScene.integrator.loc));
 
+    // Objects from the previous render that weren't reused are dropped
+    // from the session now, as are the scenes that only they referred to.
+    if (resident) {
+        auto count = [&](auto member, int SceneObjectCounts::*counter) {
+            reused->*counter = created->*counter = 0;
+            for (const auto &entry : next.*member) {
+                SceneObjectCounts *counts =
+                    (resident->*member).count(entry.first) ? reused : created;
+                ++(counts->*counter);
+            }
+        };
+        count(&ResidentSceneObjects::media, &SceneObjectCounts::media);
+        count(&ResidentSceneObjects::materials, &SceneObjectCounts::materials);
+        count(&ResidentSceneObjects::shapes, &SceneObjectCounts::shapes);
+        count(&ResidentSceneObjects::lights, &SceneObjectCounts::lights);
+        count(&ResidentSceneObjects::instanceDefinitions,
+              &SceneObjectCounts::instanceDefinitions);
+        count(&ResidentSceneObjects::geometry, &SceneObjectCounts::geometry);
+        *resident = std::move(next);
+    }
+
     // Helpful warnings
     if (haveScatteringMedia && parsedScene.integrator.name != "volpath" &&
         parsedScene.integrator.name != "simplevolpath" &&
@@ -347,6 +1192,21 @@ void CPURender(ParsedScene &parsedScene) {
                 "GBufferFilm is not supported by the \"%s\" integrator. The channels "
                 "other than R, G, B will be zero.",
                 parsedScene.integrator.name);
+    if (IntegratorAOVs(film.RequestedAOVs()) != AOVFlags::None &&
+        parsedScene.integrator.name != "path")
+        Warning(&parsedScene.film.loc,
+                "The \"lobes\", \"lightgroups\", and \"materialids\" AOVs are only "
+                "computed by the \"path\" integrator; they will be zero.");
+
+    const std::string &integratorName = parsedScene.integrator.name;
+    bool splattingIntegrator = integratorName == "bdpt" || integratorName == "mlt" ||
+                               integratorName == "sppm" || integratorName == "lightpath";
+    if (Options->adaptiveThreshold > 0 && splattingIntegrator)
+        ErrorExit("--adaptive isn't supported by the \"%s\" integrator.",
+                  parsedScene.integrator.name);
+    if (!Options->distributedDirectory.empty() && splattingIntegrator)
+        ErrorExit("Distributed rendering isn't supported by the \"%s\" integrator.",
+                  parsedScene.integrator.name);
 
     if (haveSubsurface && parsedScene.integrator.name != "volpath")
         Warning("Some objects in the scene have subsurface scattering, which is "
@@ -354,7 +1214,41 @@ void CPURender(ParsedScene &parsedScene) {
                 "to render them correctly.",
                 parsedScene.integrator.name);
 
+    sceneCreationPhase.End();
     LOG_VERBOSE("Memory used after scene creation: %d", GetCurrentRSS());
+    LOG_VERBOSE("Parsed parameter memory after scene creation: %d (peak %d)",
+                parameterMemory->CurrentAllocatedBytes(),
+                parameterMemory->MaxAllocatedBytes());
+    std::string phases;
+    for (const auto &phase : phaseTimes)
+        phases += StringPrintf("%s%s %.1fs", phases.empty() ? "" : ", ", phase.first,
+                               phase.second);
+    LOG_VERBOSE("Scene creation: %.1fs (%s)", startupTimer.ElapsedSeconds(), phases);
+    if (!Options->statsJSONFile.empty()) {
+        for (const auto &phase : phaseTimes)
+            StatsAppendJSON("phases",
+                            StringPrintf("{\"name\": %s, \"seconds\": %.6f}",
+                                         JSONString(phase.first), phase.second));
+        StatsAppendJSON("phases",
+                        StringPrintf("{\"name\": \"scene creation\", \"seconds\": %.6f}",
+                                     startupTimer.ElapsedSeconds()));
+        Point2i resolution = film.FullResolution();
+        StatsSetJSON(
+            "config",
+            StringPrintf("{\"renderer\": \"cpu\", \"threads\": %d, \"spp\": %d, "
+                         "\"resolution\": [%d, %d], \"integrator\": %s, "
+                         "\"accelerator\": %s, \"sampler\": %s, \"film\": %s}",
+                         RunningThreads(), sampler.SamplesPerPixel(), resolution.x,
+                         resolution.y, JSONString(parsedScene.integrator.name),
+                         JSONString(parsedScene.accelerator.name),
+                         JSONString(parsedScene.sampler.name),
+                         JSONString(parsedScene.film.name)));
+    }
+
+    if (Options->benchRays) {
+        BenchmarkRays(camera, accel);
+        return;
+    }
 
     if (Options->pixelMaterial) {
         SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
@@ -397,10 +1291,28 @@ void CPURender(ParsedScene &parsedScene) {
     integrator->Render();
 
     LOG_VERBOSE("Memory used after rendering: %s", GetCurrentRSS());
+}
+
+void CPURender(ParsedScene &parsedScene) {
+    RenderScene(parsedScene, nullptr, nullptr, nullptr, nullptr);
+
+    PtexTextureBase::ReportStats();
+    ImageTextureBase::ClearCache();
+    FreeBufferCaches();
+}
 
+// CPURenderSession Method Definitions
+CPURenderSession::CPURenderSession()
+    : resident(std::make_unique<ResidentSceneObjects>()) {}
+
+CPURenderSession::~CPURenderSession() {
     PtexTextureBase::ReportStats();
     ImageTextureBase::ClearCache();
     FreeBufferCaches();
 }
 
+void CPURenderSession::Render(std::shared_ptr<ParsedScene> scene) {
+    RenderScene(*scene, scene, resident.get(), &reused, &created);
+}
+
 }  // namespace pbrt
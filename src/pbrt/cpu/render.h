@@ -7,12 +7,48 @@
 
 #include <pbrt/pbrt.h>
 
+#include <memory>
+
 namespace pbrt {
 
 class ParsedScene;
+struct ResidentSceneObjects;
 
 void CPURender(ParsedScene &scene);
 
+// SceneObjectCounts Definition
+// The number of resident objects of each kind that a CPURenderSession render
+// used. Materials and media are each kept as a single object for the scene.
+struct SceneObjectCounts {
+    int media = 0, materials = 0, shapes = 0, lights = 0;
+    int instanceDefinitions = 0, geometry = 0;
+};
+
+// CPURenderSession Definition
+// Renders a sequence of versions of a scene, keeping the objects created
+// for each render resident so that the next one only needs to recreate
+// the media, textures and materials, shapes, lights, and aggregates whose
+// scene entities have changed. Objects may refer to the scene they were
+// created from, so the session shares ownership of the scenes it renders.
+class CPURenderSession {
+  public:
+    // CPURenderSession Public Methods
+    CPURenderSession();
+    ~CPURenderSession();
+
+    void Render(std::shared_ptr<ParsedScene> scene);
+
+    // Return the counts of the objects that the most recent render reused
+    // from the one before it and of those that it created.
+    const SceneObjectCounts &Reused() const { return reused; }
+    const SceneObjectCounts &Created() const { return created; }
+
+  private:
+    // CPURenderSession Private Members
+    std::unique_ptr<ResidentSceneObjects> resident;
+    SceneObjectCounts reused, created;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_CPU_RENDER_H
@@ -11,6 +11,7 @@
 #include <pbrt/bsdf.h>
 #include <pbrt/cameras.h>
 #include <pbrt/filters.h>
+#include <pbrt/lights.h>
 #include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/util/bluenoise.h>
@@ -19,15 +20,33 @@
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/float.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 
+#include <flip.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
 namespace pbrt {
 
 void FilmHandle::AddSplat(const Point2f &p, SampledSpectrum v,
@@ -36,11 +55,73 @@ void FilmHandle::AddSplat(const Point2f &p, SampledSpectrum v,
     return Dispatch(splat);
 }
 
+void FilmHandle::FlushSplats() {
+    auto flush = [&](auto ptr) { return ptr->FlushSplats(); };
+    return DispatchCPU(flush);
+}
+
+void FilmHandle::BeginTile(const Bounds2i &tileBounds) {
+    auto begin = [&](auto ptr) { return ptr->BeginTile(tileBounds); };
+    return DispatchCPU(begin);
+}
+
+void FilmHandle::EndTile() {
+    auto end = [&](auto ptr) { return ptr->EndTile(); };
+    return DispatchCPU(end);
+}
+
+bool FilmHandle::IsStreaming() const {
+    auto streaming = [&](auto ptr) { return ptr->IsStreaming(); };
+    return DispatchCPU(streaming);
+}
+
+AOVFlags FilmHandle::RequestedAOVs() const {
+    auto requested = [&](auto ptr) { return ptr->RequestedAOVs(); };
+    return DispatchCPU(requested);
+}
+
+void FilmHandle::AddAOVSample(const Point2i &pFilm, const AOVSample &aov,
+                              const SampledWavelengths &lambda, Float weight) {
+    auto add = [&](auto ptr) { return ptr->AddAOVSample(pFilm, aov, lambda, weight); };
+    return DispatchCPU(add);
+}
+
+std::string FilmHandle::SaveState() const {
+    auto save = [&](auto ptr) { return ptr->SaveState(); };
+    return DispatchCPU(save);
+}
+
+void FilmHandle::RestoreState(const std::string &state) {
+    auto restore = [&](auto ptr) { return ptr->RestoreState(state); };
+    return DispatchCPU(restore);
+}
+
+std::string FilmHandle::SaveState(const Bounds2i &bounds) const {
+    auto save = [&](auto ptr) { return ptr->SaveState(bounds); };
+    return DispatchCPU(save);
+}
+
+void FilmHandle::MergeState(const std::string &state, const Bounds2i &bounds) {
+    auto merge = [&](auto ptr) { return ptr->MergeState(state, bounds); };
+    return DispatchCPU(merge);
+}
+
+void FilmHandle::ResetPixels(const Bounds2i &bounds) {
+    auto reset = [&](auto ptr) { return ptr->ResetPixels(bounds); };
+    return DispatchCPU(reset);
+}
+
 void FilmHandle::WriteImage(ImageMetadata metadata, Float splatScale) {
     auto write = [&](auto ptr) { return ptr->WriteImage(metadata, splatScale); };
     return DispatchCPU(write);
 }
 
+std::function<void()> FilmHandle::PrepareImageWrite(ImageMetadata metadata,
+                                                    Float splatScale) {
+    auto prep = [&](auto ptr) { return ptr->PrepareImageWrite(metadata, splatScale); };
+    return DispatchCPU(prep);
+}
+
 Image FilmHandle::GetImage(ImageMetadata *metadata, Float splatScale) {
     auto get = [&](auto ptr) { return ptr->GetImage(metadata, splatScale); };
     return DispatchCPU(get);
@@ -235,6 +316,14 @@ PixelSensor *PixelSensor::CreateDefault(Allocator alloc) {
     return Create(ParameterDictionary(), RGBColorSpace::sRGB, 1.0, nullptr, alloc);
 }
 
+void PixelSensor::ComputeResponses() {
+    responses.resize(Lambda_max - Lambda_min + 1);
+    Float scale = imagingRatio / NSpectrumSamples;
+    for (int lambda = Lambda_min; lambda <= Lambda_max; ++lambda)
+        responses[lambda - Lambda_min] = {
+            {scale * r_bar(lambda), scale * g_bar(lambda), scale * b_bar(lambda), 0}};
+}
+
 // Swatch reflectances are taken from Danny Pascale's Macbeth chart measurements
 // BabelColor ColorChecker data: Copyright (c) 2004-2012 Danny Pascale
 // (www.babelcolor.com); used by permission.
@@ -459,19 +548,64 @@ SpectrumHandle PixelSensor::swatchReflectances[nSwatchReflectances]{
 
 STAT_MEMORY_COUNTER("Memory/Film pixels", filmPixelMemory);
 
+// RGBFilmStream Definition
+// State for streaming an RGBFilm's finished pixels to a tiled EXR file.
+// Pixels are copied into the EXR tiles that they overlap, each of which is
+// written and freed as soon as all of its pixels are finished.
+struct RGBFilmStream {
+    RGBFilmStream(int tileSize) : tileSize(tileSize) {}
+
+    struct StagedTile {
+        Image image;
+        int pixelsFinished = 0;
+    };
+
+    std::mutex mutex;
+    int tileSize;
+    // Created when the first tile finishes
+    std::unique_ptr<TiledEXRWriter> writer;
+    std::map<int, StagedTile> stagedTiles;
+    int tilesWritten = 0, maxStagedTiles = 0;
+};
+
+// RGBFilmFloatSplats Definition
+struct RGBFilmFloatSplats {
+    struct Pixel {
+        AtomicFloat rgb[3];
+    };
+    std::mutex mutex;
+    // Allocated when the first splat is added
+    std::atomic<BlockedArray2D<Pixel> *> pixels{nullptr};
+};
+
 // RGBFilm Method Definitions
 RGBFilm::RGBFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
-                 Float maxComponentValue, bool writeFP16, Allocator alloc)
+                 Float maxComponentValue, bool writeFP16, bool threadSplatBuffers,
+                 bool tileBuffers, int streamTileSize, bool floatPixels,
+                 Allocator alloc)
     : FilmBase(p),
-      pixels(p.pixelBounds, alloc),
+      pixels(streamTileSize > 0 || floatPixels ? Bounds2i() : p.pixelBounds, alloc),
       colorSpace(colorSpace),
       maxComponentValue(maxComponentValue),
-      writeFP16(writeFP16) {
+      writeFP16(writeFP16),
+      floatPixels(floatPixels && streamTileSize == 0),
+      floatPixelValues(this->floatPixels ? p.pixelBounds : Bounds2i(), alloc),
+      tileBuffers(tileBuffers || streamTileSize > 0),
+      threadSplatBuffers(threadSplatBuffers) {
     filterIntegral = filter.Integral();
     CHECK(!pixelBounds.IsEmpty());
     CHECK(colorSpace != nullptr);
-    filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
+    if (streamTileSize > 0)
+        stream = new RGBFilmStream(streamTileSize);
+    else if (this->floatPixels) {
+        floatSplats = new RGBFilmFloatSplats;
+        filmPixelMemory += pixelBounds.Area() * sizeof(FloatPixel);
+    } else
+        filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
     outputRGBFromSensorRGB = colorSpace->RGBFromXYZ * sensor->XYZFromSensorRGB;
+    // Give the film a unique id for the threads' splat buffer caches
+    static std::atomic<int> nextSplatBuffersId{0};
+    splatBuffersId = nextSplatBuffersId++;
 }
 
 SampledWavelengths RGBFilm::SampleWavelengths(Float u) const {
@@ -481,6 +615,11 @@ SampledWavelengths RGBFilm::SampleWavelengths(Float u) const {
 void RGBFilm::AddSplat(const Point2f &p, SampledSpectrum L,
                        const SampledWavelengths &lambda) {
     CHECK(!L.HasNaNs());
+#ifndef PBRT_IS_GPU_CODE
+    if (stream)
+        ErrorExit("Splats aren't supported with streaming films; use an "
+                  "integrator that doesn't splat or set \"streaming\" to false.");
+#endif
     // Convert sample radiance to _PixelSensor_ RGB
     RGB rgb = sensor->ToSensorRGB(L, lambda);
 
@@ -497,10 +636,32 @@ void RGBFilm::AddSplat(const Point2f &p, SampledSpectrum L,
                          Point2i(Floor(pDiscrete + radius)) + Vector2i(1, 1));
     splatBounds = Intersect(splatBounds, pixelBounds);
 
+#ifndef PBRT_IS_GPU_CODE
+    if (threadSplatBuffers) {
+        // Add splat to the calling thread's buffer
+        ThreadSplats *buffer = ThreadSplatBuffer();
+        for (Point2i pi : splatBounds) {
+            Float wt = filter.Evaluate(Point2f(p - pi - Vector2f(0.5, 0.5)));
+            if (wt != 0) {
+                SplatPixel &splatPixel = threadSplatPixel(buffer, pi);
+                for (int i = 0; i < 3; ++i)
+                    splatPixel.rgb[i] += wt * rgb[i];
+            }
+        }
+        return;
+    }
+#endif
+
     for (Point2i pi : splatBounds) {
         // Evaluate filter at _pi_ and add splat contribution
         Float wt = filter.Evaluate(Point2f(p - pi - Vector2f(0.5, 0.5)));
         if (wt != 0) {
+#ifndef PBRT_IS_GPU_CODE
+            if (floatPixels) {
+                addFloatSplat(pi, wt * rgb);
+                continue;
+            }
+#endif
             Pixel &pixel = pixels[pi];
             for (int i = 0; i < 3; ++i)
                 pixel.splatRGB[i].Add(wt * rgb[i]);
@@ -508,13 +669,429 @@ void RGBFilm::AddSplat(const Point2f &p, SampledSpectrum L,
     }
 }
 
+void RGBFilm::addFloatSplat(const Point2i &p, const RGB &rgb) {
+    // Allocate splat storage the first time a splat is added
+    using SplatPixels = BlockedArray2D<RGBFilmFloatSplats::Pixel>;
+    SplatPixels *splatPixels = floatSplats->pixels.load(std::memory_order_acquire);
+    if (!splatPixels) {
+        std::lock_guard<std::mutex> lock(floatSplats->mutex);
+        splatPixels = floatSplats->pixels.load(std::memory_order_relaxed);
+        if (!splatPixels) {
+            splatPixels = new SplatPixels(pixelBounds);
+            filmPixelMemory += pixelBounds.Area() * sizeof(RGBFilmFloatSplats::Pixel);
+            floatSplats->pixels.store(splatPixels, std::memory_order_release);
+        }
+    }
+
+    RGBFilmFloatSplats::Pixel &pixel = (*splatPixels)[p];
+    for (int c = 0; c < 3; ++c)
+        pixel.rgb[c].Add(rgb[c]);
+}
+
+RGB RGBFilm::floatSplatRGB(const Point2i &p) const {
+    const BlockedArray2D<RGBFilmFloatSplats::Pixel> *splatPixels =
+        floatSplats->pixels.load(std::memory_order_acquire);
+    if (!splatPixels)
+        return RGB(0, 0, 0);
+    const RGBFilmFloatSplats::Pixel &pixel = (*splatPixels)[p];
+    return RGB(pixel.rgb[0], pixel.rgb[1], pixel.rgb[2]);
+}
+
+static std::mutex splatBuffersMutex;
+
+RGBFilm::ThreadSplats *RGBFilm::ThreadSplatBuffer() {
+    // Return the calling thread's cached buffer if it belongs to this film
+    static thread_local int cachedFilmId = -1;
+    static thread_local ThreadSplats *cachedBuffer = nullptr;
+    if (cachedFilmId == splatBuffersId)
+        return cachedBuffer;
+
+    // Find or allocate the calling thread's splat buffer for this film
+    std::lock_guard<std::mutex> lock(splatBuffersMutex);
+    std::thread::id threadId = std::this_thread::get_id();
+    auto iter = std::find_if(splatBuffers.begin(), splatBuffers.end(),
+                             [&](const auto &b) { return b.first == threadId; });
+    if (iter == splatBuffers.end()) {
+        std::unique_ptr<ThreadSplats> buffer = std::make_unique<ThreadSplats>();
+        buffer->tiles.reserve(ThreadSplats::MaxTiles);
+        splatBuffers.push_back({threadId, std::move(buffer)});
+        filmPixelMemory += ThreadSplats::MaxTiles * sizeof(ThreadSplats::Tile);
+        iter = splatBuffers.end() - 1;
+    }
+    cachedFilmId = splatBuffersId;
+    cachedBuffer = iter->second.get();
+    return cachedBuffer;
+}
+
+RGBFilm::SplatPixel &RGBFilm::threadSplatPixel(ThreadSplats *splats, const Point2i &p) {
+    // Find the tile of _splats_ that holds _p_, adding it if necessary
+    constexpr int TileSize = ThreadSplats::TileSize;
+    Point2i pMin(pixelBounds.pMin.x + (p.x - pixelBounds.pMin.x) / TileSize * TileSize,
+                 pixelBounds.pMin.y + (p.y - pixelBounds.pMin.y) / TileSize * TileSize);
+    std::vector<ThreadSplats::Tile> &tiles = splats->tiles;
+    if (splats->lastTile == -1 || tiles[splats->lastTile].pMin != pMin) {
+        auto iter = std::find_if(tiles.begin(), tiles.end(),
+                                 [&](const auto &tile) { return tile.pMin == pMin; });
+        if (iter == tiles.end()) {
+            if (tiles.size() == ThreadSplats::MaxTiles)
+                flushThreadSplats(splats);
+            tiles.push_back(ThreadSplats::Tile{pMin, {}});
+            iter = tiles.end() - 1;
+        }
+        splats->lastTile = iter - tiles.begin();
+    }
+    Point2i pTile(p.x - pMin.x, p.y - pMin.y);
+    return tiles[splats->lastTile].pixels[pTile.y * TileSize + pTile.x];
+}
+
+void RGBFilm::flushThreadSplats(ThreadSplats *splats) {
+    // Add the tiles' splats to the film's pixels, which other threads may be
+    // splatting to, and empty the buffer
+    constexpr int TileSize = ThreadSplats::TileSize;
+    for (const ThreadSplats::Tile &tile : splats->tiles) {
+        Bounds2i tileBounds = Intersect(
+            Bounds2i(tile.pMin, tile.pMin + Vector2i(TileSize, TileSize)), pixelBounds);
+        for (Point2i pi : tileBounds) {
+            const SplatPixel &splatPixel =
+                tile.pixels[(pi.y - tile.pMin.y) * TileSize + pi.x - tile.pMin.x];
+            if (floatPixels) {
+                if (splatPixel.rgb[0] != 0 || splatPixel.rgb[1] != 0 ||
+                    splatPixel.rgb[2] != 0)
+                    addFloatSplat(pi, RGB(splatPixel.rgb[0], splatPixel.rgb[1],
+                                          splatPixel.rgb[2]));
+                continue;
+            }
+            Pixel &pixel = pixels[pi];
+            for (int c = 0; c < 3; ++c)
+                if (splatPixel.rgb[c] != 0)
+                    pixel.splatRGB[c].Add(splatPixel.rgb[c]);
+        }
+    }
+    splats->tiles.clear();
+    splats->lastTile = -1;
+}
+
+void RGBFilm::FlushSplats() {
+    // Add all threads' buffered splats to film pixels
+    ParallelFor(0, splatBuffers.size(),
+                [&](int64_t i) { flushThreadSplats(splatBuffers[i].second.get()); });
+}
+
+// RGBFilm tile buffer for the calling thread; _film_ is only set between
+// BeginTile() and EndTile() calls.
+struct RGBFilmTileBuffer {
+    struct Pixel {
+        double rgbSum[3] = {0., 0., 0.};
+        double weightSum = 0.;
+    };
+    const RGBFilm *film = nullptr;
+    Bounds2i bounds;
+    std::vector<Pixel> pixels;
+};
+
+static thread_local RGBFilmTileBuffer threadTileBuffer;
+
+template <typename F>
+void RGBFilm::streamTile(const Bounds2i &tileBounds, F getPixelRGB) {
+    // Compute final pixel values for the tile
+    std::vector<RGB> rgb(tileBounds.Area());
+    for (size_t i = 0; i < rgb.size(); ++i) {
+        rgb[i] = getPixelRGB(i);
+        if (writeFP16)
+            for (int c = 0; c < 3; ++c)
+                rgb[i][c] = std::min<Float>(rgb[i][c], 65504);
+    }
+
+    std::lock_guard<std::mutex> lock(stream->mutex);
+    if (!stream->writer) {
+        ImageMetadata metadata;
+        metadata.pixelBounds = pixelBounds;
+        metadata.fullResolution = fullResolution;
+        metadata.colorSpace = colorSpace;
+        PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
+        stream->writer = std::make_unique<TiledEXRWriter>(
+            filename, format, std::vector<std::string>{"R", "G", "B"}, stream->tileSize,
+            metadata);
+    }
+    TiledEXRWriter &writer = *stream->writer;
+
+    // Copy pixel values to the EXR tiles that overlap the tile
+    int tileSize = stream->tileSize, width = tileBounds.pMax.x - tileBounds.pMin.x;
+    Point2i t0((tileBounds.pMin.x - pixelBounds.pMin.x) / tileSize,
+               (tileBounds.pMin.y - pixelBounds.pMin.y) / tileSize);
+    Point2i t1((tileBounds.pMax.x - 1 - pixelBounds.pMin.x) / tileSize,
+               (tileBounds.pMax.y - 1 - pixelBounds.pMin.y) / tileSize);
+    for (int ty = t0.y; ty <= t1.y; ++ty)
+        for (int tx = t0.x; tx <= t1.x; ++tx) {
+            // Find or create the staged EXR tile
+            Bounds2i exrTileBounds = writer.TileBounds(Point2i(tx, ty));
+            int tileIndex = ty * writer.NumTiles().x + tx;
+            auto iter = stream->stagedTiles.find(tileIndex);
+            if (iter == stream->stagedTiles.end()) {
+                Image image(writeFP16 ? PixelFormat::Half : PixelFormat::Float,
+                            Point2i(exrTileBounds.Diagonal()), {"R", "G", "B"});
+                iter = stream->stagedTiles
+                           .insert({tileIndex, RGBFilmStream::StagedTile{
+                                                   std::move(image), 0}})
+                           .first;
+                stream->maxStagedTiles =
+                    std::max<int>(stream->maxStagedTiles, stream->stagedTiles.size());
+            }
+            RGBFilmStream::StagedTile &staged = iter->second;
+
+            Bounds2i overlap = Intersect(exrTileBounds, tileBounds);
+            for (Point2i p : overlap) {
+                const RGB &v = rgb[(p.x - tileBounds.pMin.x) +
+                                   (p.y - tileBounds.pMin.y) * width];
+                staged.image.SetChannels(Point2i(p - exrTileBounds.pMin),
+                                         {v[0], v[1], v[2]});
+            }
+            staged.pixelsFinished += overlap.Area();
+
+            // Write the EXR tile once all of its pixels are finished
+            if (staged.pixelsFinished == exrTileBounds.Area()) {
+                writer.WriteTile(Point2i(tx, ty), staged.image);
+                stream->stagedTiles.erase(iter);
+                ++stream->tilesWritten;
+            }
+        }
+}
+
+void RGBFilm::BeginTile(const Bounds2i &tileBounds) {
+    if (!tileBuffers)
+        return;
+    RGBFilmTileBuffer &tile = threadTileBuffer;
+    tile.film = this;
+    tile.bounds = Intersect(tileBounds, pixelBounds);
+    tile.pixels.assign(tile.bounds.Area(), RGBFilmTileBuffer::Pixel());
+}
+
+bool RGBFilm::addTileSample(const Point2i &pFilm, const RGB &rgb, Float weight) {
+    // Samples outside of the current tile go directly to the film
+    RGBFilmTileBuffer &tile = threadTileBuffer;
+    if (tile.film != this || !InsideExclusive(pFilm, tile.bounds)) {
+        if (stream)
+            LOG_FATAL("Streaming film sample at %s is outside of the current tile",
+                      pFilm);
+        return false;
+    }
+
+    int width = tile.bounds.pMax.x - tile.bounds.pMin.x;
+    RGBFilmTileBuffer::Pixel &pixel =
+        tile.pixels[(pFilm.x - tile.bounds.pMin.x) +
+                    (pFilm.y - tile.bounds.pMin.y) * width];
+    for (int c = 0; c < 3; ++c)
+        pixel.rgbSum[c] += weight * rgb[c];
+    pixel.weightSum += weight;
+    return true;
+}
+
+void RGBFilm::EndTile() {
+    RGBFilmTileBuffer &tile = threadTileBuffer;
+    if (tile.film != this)
+        return;
+
+    if (stream) {
+        streamTile(tile.bounds, [&](int index) {
+            const RGBFilmTileBuffer::Pixel &tilePixel = tile.pixels[index];
+            RGB rgb(tilePixel.rgbSum[0], tilePixel.rgbSum[1], tilePixel.rgbSum[2]);
+            if (tilePixel.weightSum != 0)
+                rgb /= tilePixel.weightSum;
+            return outputRGBFromSensorRGB * rgb;
+        });
+        tile.film = nullptr;
+        return;
+    }
+
+    // Add tile's samples to film pixels; tiles don't overlap, so no other
+    // thread is updating these pixels.
+    int index = 0;
+    for (Point2i p : tile.bounds) {
+        const RGBFilmTileBuffer::Pixel &tilePixel = tile.pixels[index++];
+        if (floatPixels) {
+            FloatPixel &pixel = floatPixelValues[p];
+            for (int c = 0; c < 3; ++c)
+                pixel.rgbSum[c] += tilePixel.rgbSum[c];
+            pixel.weightSum += tilePixel.weightSum;
+        } else {
+            Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c)
+                pixel.rgbSum[c] += tilePixel.rgbSum[c];
+            pixel.weightSum += tilePixel.weightSum;
+        }
+    }
+    tile.film = nullptr;
+}
+
+// Film State Helper Functions
+template <typename T>
+static void appendState(std::string *state, const T &value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "film state values must be trivially copyable");
+    state->append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+static T readState(const std::string &state, size_t *offset) {
+    if (*offset + sizeof(T) > state.size())
+        ErrorExit("Render checkpoint film state is truncated.");
+    T value;
+    std::memcpy(&value, state.data() + *offset, sizeof(T));
+    *offset += sizeof(T);
+    return value;
+}
+
+std::string RGBFilm::SaveState(const Bounds2i &bounds) const {
+    if (stream)
+        ErrorExit("%s: render checkpoints aren't supported with streaming films.",
+                  filename);
+    CHECK(Inside(bounds, pixelBounds));
+    std::string state;
+    appendState(&state, int32_t(floatPixels));
+    if (!floatPixels) {
+        state.reserve(state.size() + bounds.Area() * 7 * sizeof(double));
+        for (Point2i p : bounds) {
+            const Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c)
+                appendState(&state, pixel.rgbSum[c]);
+            appendState(&state, pixel.weightSum);
+            for (int c = 0; c < 3; ++c)
+                appendState(&state, double(pixel.splatRGB[c]));
+        }
+        return state;
+    }
+
+    // Save single-precision pixels along with their compensation terms so
+    // that summation continues exactly as it would have
+    const BlockedArray2D<RGBFilmFloatSplats::Pixel> *splatPixels =
+        floatSplats->pixels.load(std::memory_order_acquire);
+    appendState(&state, int32_t(splatPixels != nullptr));
+    for (Point2i p : bounds)
+        appendState(&state, floatPixelValues[p]);
+    if (splatPixels)
+        for (Point2i p : bounds)
+            for (int c = 0; c < 3; ++c)
+                appendState(&state, float((*splatPixels)[p].rgb[c]));
+    return state;
+}
+
+void RGBFilm::RestoreState(const std::string &state) {
+    loadState(state, pixelBounds, false);
+}
+
+void RGBFilm::MergeState(const std::string &state, const Bounds2i &bounds) {
+    loadState(state, bounds, true);
+}
+
+void RGBFilm::ResetPixels(const Bounds2i &bounds) {
+    CHECK(Inside(bounds, pixelBounds));
+    if (floatPixels) {
+        if (floatSplats->pixels.load(std::memory_order_acquire))
+            ErrorExit("%s: pixels can't be reset after splats have been added.",
+                      filename);
+        for (Point2i p : bounds)
+            floatPixelValues[p] = FloatPixel();
+        return;
+    }
+    for (Point2i p : bounds) {
+        Pixel &pixel = pixels[p];
+        for (int c = 0; c < 3; ++c) {
+            pixel.rgbSum[c] = 0;
+            pixel.splatRGB[c] = 0;
+        }
+        pixel.weightSum = 0;
+    }
+}
+
+void RGBFilm::loadState(const std::string &state, const Bounds2i &bounds, bool merge) {
+    if (stream)
+        ErrorExit("%s: render checkpoints aren't supported with streaming films.",
+                  filename);
+    CHECK(Inside(bounds, pixelBounds));
+    size_t offset = 0;
+    if (readState<int32_t>(state, &offset) != int32_t(floatPixels))
+        ErrorExit("%s: render checkpoint was saved with different pixel storage.",
+                  filename);
+    bool hasSplats = floatPixels && readState<int32_t>(state, &offset);
+    size_t pixelStateSize = floatPixels ? sizeof(FloatPixel) : 7 * sizeof(double);
+    if (hasSplats)
+        pixelStateSize += 3 * sizeof(float);
+    if (state.size() != offset + bounds.Area() * pixelStateSize)
+        ErrorExit("%s: render checkpoint doesn't match the film's resolution.",
+                  filename);
+
+    if (!floatPixels) {
+        for (Point2i p : bounds) {
+            Pixel &pixel = pixels[p];
+            for (int c = 0; c < 3; ++c)
+                pixel.rgbSum[c] = (merge ? pixel.rgbSum[c] : 0.) +
+                                  readState<double>(state, &offset);
+            pixel.weightSum =
+                (merge ? pixel.weightSum : 0.) + readState<double>(state, &offset);
+            for (int c = 0; c < 3; ++c)
+                pixel.splatRGB[c] = (merge ? double(pixel.splatRGB[c]) : 0.) +
+                                    readState<double>(state, &offset);
+        }
+        return;
+    }
+
+    for (Point2i p : bounds) {
+        FloatPixel saved = readState<FloatPixel>(state, &offset);
+        FloatPixel &pixel = floatPixelValues[p];
+        // Copy saved values into pixels without any samples so that their
+        // compensation terms are preserved exactly
+        if (!merge || float(pixel.weightSum) == 0)
+            pixel = saved;
+        else {
+            for (int c = 0; c < 3; ++c)
+                pixel.rgbSum[c] += float(saved.rgbSum[c]);
+            pixel.weightSum += float(saved.weightSum);
+        }
+    }
+    if (hasSplats)
+        for (Point2i p : bounds) {
+            RGB rgb;
+            for (int c = 0; c < 3; ++c)
+                rgb[c] = readState<float>(state, &offset);
+            addFloatSplat(p, rgb);
+        }
+}
+
 void RGBFilm::WriteImage(ImageMetadata metadata, Float splatScale) {
-    Image image = GetImage(&metadata, splatScale);
-    LOG_VERBOSE("Writing image %s with bounds %s", filename, pixelBounds);
-    image.Write(filename, metadata);
+    if (stream) {
+        // Finish writing the streamed EXR file
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        if (!stream->writer)
+            return;
+        Point2i nTiles = stream->writer->NumTiles();
+        if (stream->tilesWritten != nTiles.x * nTiles.y)
+            Error("%s: only %d of %d tiles were finished.", filename,
+                  stream->tilesWritten, nTiles.x * nTiles.y);
+        LOG_VERBOSE("Finished streaming image %s with bounds %s; at most %d EXR tiles "
+                    "were resident",
+                    filename, pixelBounds, stream->maxStagedTiles);
+        stream->writer.reset();
+        return;
+    }
+
+    PrepareImageWrite(metadata, splatScale)();
+}
+
+std::function<void()> RGBFilm::PrepareImageWrite(ImageMetadata metadata,
+                                                 Float splatScale) {
+    auto image = std::make_shared<Image>(GetImage(&metadata, splatScale));
+    std::string filename = this->filename;
+    Bounds2i pixelBounds = this->pixelBounds;
+    return [=]() {
+        LOG_VERBOSE("Writing image %s with bounds %s", filename, pixelBounds);
+        image->Write(filename, metadata);
+    };
 }
 
 Image RGBFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
+    if (stream)
+        ErrorExit("%s: the image of a streaming film isn't available.", filename);
+
     // Convert image to RGB and compute final pixel values
     LOG_VERBOSE("Converting image to RGB and computing final weighted pixel values");
     PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
@@ -549,9 +1126,10 @@ Image RGBFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
 }
 
 std::string RGBFilm::ToString() const {
-    return StringPrintf(
-        "[ RGBFilm %s colorSpace: %s maxComponentValue: %f writeFP16: %s ]",
-        BaseToString(), *colorSpace, maxComponentValue, writeFP16);
+    return StringPrintf("[ RGBFilm %s colorSpace: %s maxComponentValue: %f writeFP16: %s "
+                        "floatPixels: %s tileBuffers: %s streaming: %s ]",
+                        BaseToString(), *colorSpace, maxComponentValue, writeFP16,
+                        floatPixels, tileBuffers, stream != nullptr);
 }
 
 RGBFilm *RGBFilm::Create(const ParameterDictionary &parameters, Float exposureTime,
@@ -559,13 +1137,45 @@ RGBFilm *RGBFilm::Create(const ParameterDictionary &parameters, Float exposureTi
                          const FileLoc *loc, Allocator alloc) {
     Float maxComponentValue = parameters.GetOneFloat("maxcomponentvalue", Infinity);
     bool writeFP16 = parameters.GetOneBool("savefp16", true);
+    bool threadSplatBuffers = parameters.GetOneBool("threadsplatbuffers", false);
+    if (threadSplatBuffers && Options->useGPU) {
+        Warning(loc, "\"threadsplatbuffers\" is not supported with the GPU renderer.");
+        threadSplatBuffers = false;
+    }
+    bool tileBuffers = parameters.GetOneBool("tilebuffers", false);
+    if (tileBuffers && Options->useGPU) {
+        Warning(loc, "\"tilebuffers\" is not supported with the GPU renderer.");
+        tileBuffers = false;
+    }
+    bool streaming = parameters.GetOneBool("streaming", false);
+    int streamTileSize = parameters.GetOneInt("streamingtilesize", 64);
+    if (streaming && Options->useGPU) {
+        Warning(loc, "\"streaming\" is not supported with the GPU renderer.");
+        streaming = false;
+    }
+    if (streaming && streamTileSize <= 0)
+        ErrorExit(loc, "%d: \"streamingtilesize\" must be positive.", streamTileSize);
+    std::string storage = parameters.GetOneString("storage", "double");
+    if (storage != "double" && storage != "float")
+        ErrorExit(loc, "%s: unknown film storage. Must be \"double\" or \"float\".",
+                  storage);
+    bool floatPixels = storage == "float";
+    if (floatPixels && Options->useGPU) {
+        Warning(loc, "\"float\" storage is not supported with the GPU renderer.");
+        floatPixels = false;
+    }
 
     PixelSensor *sensor =
         PixelSensor::Create(parameters, colorSpace, exposureTime, loc, alloc);
     FilmBaseParameters filmBaseParameters(parameters, filter, sensor, loc);
+    if (streaming && !HasExtension(filmBaseParameters.filename, "exr"))
+        ErrorExit(loc, "%s: streaming films can only write EXR files.",
+                  filmBaseParameters.filename);
 
     return alloc.new_object<RGBFilm>(filmBaseParameters, colorSpace, maxComponentValue,
-                                     writeFP16, alloc);
+                                     writeFP16, threadSplatBuffers, tileBuffers,
+                                     streaming ? streamTileSize : 0, floatPixels,
+                                     alloc);
 }
 
 // GBufferFilm Method Definitions
@@ -603,17 +1213,116 @@ void GBufferFilm::AddSample(const Point2i &pFilm, SampledSpectrum L,
     p.weightSum += weight;
 }
 
+void GBufferFilm::AddAOVSample(const Point2i &pFilm, const AOVSample &aov,
+                               const SampledWavelengths &lambda, Float weight) {
+    Point2i p(pFilm.x - pixelBounds.pMin.x, pFilm.y - pixelBounds.pMin.y);
+    size_t pixelIndex = size_t(p.y) * pixelBounds.Diagonal().x + p.x;
+    // Add weighted RGB values of the lobe and light group AOVs
+    auto addRGB = [&](double *sum, const SampledSpectrum &L) {
+        if (!L)
+            return;
+        RGB rgb = sensor->ToSensorRGB(L, lambda);
+        for (int c = 0; c < 3; ++c)
+            sum[c] += weight * rgb[c];
+    };
+    double *sums = aovSums.data() + pixelIndex * aovStride;
+    if (aovs & AOVFlags::Lobes)
+        for (int i = 0; i < NumAOVLobes; ++i)
+            addRGB(sums + lobesOffset + 3 * i, aov.lobeL[i]);
+    if (aovs & AOVFlags::LightGroups)
+        for (int i = 0; i < MaxLightGroups; ++i)
+            addRGB(sums + lightGroupsOffset + 3 * i, aov.lightGroupL[i]);
+
+    // Add coverage of the visible material's ID
+    const uint32_t *materialID = nullptr;
+    if ((aovs & AOVFlags::MaterialIDs) && aov.material)
+        materialID = materialIDs.Find(aov.material);
+    if (materialID) {
+        uint32_t id = *materialID;
+        MaterialCoverage *coverage =
+            materialCoverage.data() + pixelIndex * NumMaterialRanks;
+        // Coverage of materials beyond the first _NumMaterialRanks_ that are
+        // seen in a pixel is dropped.
+        for (int i = 0; i < NumMaterialRanks; ++i)
+            if (coverage[i].id == id || coverage[i].id == 0) {
+                coverage[i].id = id;
+                coverage[i].coverage += weight;
+                break;
+            }
+    }
+}
+
+void GBufferFilm::AddCostSample(const Point2i &pFilm, const PixelCostSample &cost) {
+    if (!(aovs & AOVFlags::Cost))
+        return;
+    Point2i p(pFilm.x - pixelBounds.pMin.x, pFilm.y - pixelBounds.pMin.y);
+    size_t pixelIndex = size_t(p.y) * pixelBounds.Diagonal().x + p.x;
+    double *sums = aovSums.data() + pixelIndex * aovStride + costOffset;
+    sums[0] += 1;
+    sums[1] += cost.microseconds;
+    sums[2] += cost.rays;
+    sums[3] += cost.nodesVisited;
+    sums[4] += cost.shadowRays;
+    sums[5] += cost.mediumSteps;
+}
+
+void GBufferFilm::SetMaterialNames(
+    const std::map<std::string, MaterialHandle> &namedMaterials,
+    const std::vector<MaterialHandle> &materials) {
+    auto addMaterial = [&](const std::string &name, MaterialHandle material) {
+        if (!material || materialIDs.HasKey(material))
+            return;
+        // Make sure that the ID's bits are a normal floating-point value,
+        // as is done for cryptomatte IDs
+        uint32_t id = uint32_t(Hash(name));
+        uint32_t exponent = (id >> 23) & 255;
+        if (exponent == 0 || exponent == 255)
+            id ^= 1 << 23;
+        materialIDs.Insert(material, id);
+        materialIDManifest.push_back(StringPrintf("%s:%08x", name, id));
+    };
+    for (const auto &nm : namedMaterials)
+        addMaterial(nm.first, nm.second);
+    for (size_t i = 0; i < materials.size(); ++i)
+        addMaterial(StringPrintf("material %d", i), materials[i]);
+}
+
 GBufferFilm::GBufferFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
-                         Float maxComponentValue, bool writeFP16, Allocator alloc)
+                         Float maxComponentValue, bool writeFP16, AOVFlags aovs,
+                         Allocator alloc)
     : FilmBase(p),
       pixels(pixelBounds, alloc),
       colorSpace(colorSpace),
       maxComponentValue(maxComponentValue),
       writeFP16(writeFP16),
-      filterIntegral(filter.Integral()) {
+      filterIntegral(filter.Integral()),
+      aovs(aovs),
+      aovSums(alloc),
+      materialCoverage(alloc),
+      materialIDs(alloc) {
     CHECK(!pixelBounds.IsEmpty());
     filmPixelMemory += pixelBounds.Area() * sizeof(Pixel);
     outputRGBFromSensorRGB = colorSpace->RGBFromXYZ * sensor->XYZFromSensorRGB;
+
+    // Allocate storage for the requested AOVs
+    if (aovs & AOVFlags::Lobes) {
+        lobesOffset = aovStride;
+        aovStride += 3 * NumAOVLobes;
+    }
+    if (aovs & AOVFlags::LightGroups) {
+        lightGroupsOffset = aovStride;
+        aovStride += 3 * MaxLightGroups;
+    }
+    if (aovs & AOVFlags::Cost) {
+        costOffset = aovStride;
+        aovStride += 6;
+    }
+    aovSums.resize(size_t(pixelBounds.Area()) * aovStride);
+    filmPixelMemory += aovSums.size() * sizeof(double);
+    if (aovs & AOVFlags::MaterialIDs) {
+        materialCoverage.resize(size_t(pixelBounds.Area()) * NumMaterialRanks);
+        filmPixelMemory += materialCoverage.size() * sizeof(MaterialCoverage);
+    }
 }
 
 SampledWavelengths GBufferFilm::SampleWavelengths(Float u) const {
@@ -644,51 +1353,163 @@ void GBufferFilm::AddSplat(const Point2f &p, SampledSpectrum v,
 }
 
 void GBufferFilm::WriteImage(ImageMetadata metadata, Float splatScale) {
-    Image image = GetImage(&metadata, splatScale);
-    LOG_VERBOSE("Writing image %s with bounds %s", filename, pixelBounds);
-    image.Write(filename, metadata);
+    PrepareImageWrite(metadata, splatScale)();
+}
+
+std::function<void()> GBufferFilm::PrepareImageWrite(ImageMetadata metadata,
+                                                     Float splatScale) {
+    // The image is followed by the AOV images, if any
+    auto images = std::make_shared<std::vector<Image>>();
+    images->push_back(GetImage(&metadata, splatScale));
+    std::vector<std::string> partNames = {"rgba"};
+    if (IntegratorAOVs(aovs) != AOVFlags::None) {
+        std::vector<std::string> lightGroups = LightGroupNames();
+        for (Image &image : GetAOVImages(lightGroups))
+            images->push_back(std::move(image));
+        for (const AOVInfo &info : RegisteredAOVs)
+            if (info.partName && (aovs & info.flag))
+                partNames.push_back(info.partName);
+        if (aovs & AOVFlags::LightGroups)
+            metadata.stringVectors["lightGroups"] = lightGroups;
+        if (aovs & AOVFlags::MaterialIDs)
+            metadata.stringVectors["materialIDManifest"] = materialIDManifest;
+    }
+    CHECK_EQ(images->size(), partNames.size());
+
+    std::string filename = this->filename;
+    Bounds2i pixelBounds = this->pixelBounds;
+    return [=]() {
+        LOG_VERBOSE("Writing image %s with bounds %s", filename, pixelBounds);
+        if (images->size() == 1) {
+            (*images)[0].Write(filename, metadata);
+            return;
+        }
+        // Write the image and the AOV images as parts of a multi-part EXR file
+        std::vector<std::pair<std::string, const Image *>> parts;
+        for (size_t i = 0; i < images->size(); ++i)
+            parts.push_back({partNames[i], &(*images)[i]});
+        WriteMultiPartEXR(filename, parts, metadata);
+    };
+}
+
+std::vector<Image> GBufferFilm::GetAOVImages(
+    const std::vector<std::string> &lightGroups) const {
+    std::vector<Image> images;
+    Point2i resolution(pixelBounds.Diagonal());
+    PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
+    // Returns the channel names of an RGB image for each of _names_
+    auto rgbChannels = [](const auto &names) {
+        std::vector<std::string> channels;
+        for (const std::string &name : names)
+            for (const char *c : {".R", ".G", ".B"})
+                channels.push_back(name + c);
+        return channels;
+    };
+    // Writes the normalized output RGB values of _n_ sums starting at
+    // _offset_ in each pixel's AOV sums to _image_
+    auto setRGBImage = [&](Image &image, int offset, int n) {
+        ParallelFor2D(pixelBounds, [&](Point2i p) {
+            Point2i pOffset(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
+            const double *sums =
+                aovSums.data() + (size_t(pOffset.y) * resolution.x + pOffset.x) *
+                                     aovStride + offset;
+            Float weightSum = pixels[p].weightSum;
+            for (int i = 0; i < n; ++i) {
+                RGB rgb(sums[3 * i], sums[3 * i + 1], sums[3 * i + 2]);
+                if (weightSum != 0)
+                    rgb /= weightSum;
+                rgb = outputRGBFromSensorRGB * rgb;
+                for (int c = 0; c < 3; ++c)
+                    image.SetChannel(pOffset, 3 * i + c, rgb[c]);
+            }
+        });
+    };
+
+    if (aovs & AOVFlags::Lobes) {
+        Image &image = images.emplace_back(
+            format, resolution,
+            rgbChannels(std::vector<std::string>{"emission", "diffuse", "glossy",
+                                                 "specular", "transmission"}));
+        setRGBImage(image, lobesOffset, NumAOVLobes);
+    }
+    if (aovs & AOVFlags::LightGroups) {
+        // Only the light groups that lights were assigned to are written
+        std::vector<std::string> channels = rgbChannels(lightGroups);
+        if (channels.empty())
+            channels = {"R", "G", "B"};
+        Image &image = images.emplace_back(format, resolution, channels);
+        setRGBImage(image, lightGroupsOffset, lightGroups.size());
+    }
+    if (aovs & AOVFlags::MaterialIDs) {
+        // IDs are stored as the bits of 32-bit floats, sorted by coverage
+        std::vector<std::string> channels;
+        for (int i = 0; i < NumMaterialRanks; ++i) {
+            channels.push_back(StringPrintf("id%d", i));
+            channels.push_back(StringPrintf("coverage%d", i));
+        }
+        Image &image = images.emplace_back(PixelFormat::Float, resolution, channels);
+        ParallelFor2D(pixelBounds, [&](Point2i p) {
+            Point2i pOffset(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
+            const MaterialCoverage *pixelCoverage =
+                materialCoverage.data() +
+                (size_t(pOffset.y) * resolution.x + pOffset.x) * NumMaterialRanks;
+            MaterialCoverage coverage[NumMaterialRanks];
+            std::copy(pixelCoverage, pixelCoverage + NumMaterialRanks, coverage);
+            std::sort(coverage, coverage + NumMaterialRanks,
+                      [](const MaterialCoverage &a, const MaterialCoverage &b) {
+                          return a.coverage > b.coverage;
+                      });
+            Float weightSum = pixels[p].weightSum;
+            for (int i = 0; i < NumMaterialRanks; ++i) {
+                image.SetChannel(pOffset, 2 * i, BitsToFloat(coverage[i].id));
+                image.SetChannel(pOffset, 2 * i + 1,
+                                 weightSum != 0 ? coverage[i].coverage / weightSum : 0);
+            }
+        });
+    }
+    return images;
 }
 
 Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
     // Convert image to RGB and compute final pixel values
     LOG_VERBOSE("Converting image to RGB and computing final weighted pixel values");
     PixelFormat format = writeFP16 ? PixelFormat::Half : PixelFormat::Float;
-    Image image(format, Point2i(pixelBounds.Diagonal()),
-                {"R",
-                 "G",
-                 "B",
-                 "Albedo.R",
-                 "Albedo.G",
-                 "Albedo.B",
-                 "Px",
-                 "Py",
-                 "Pz",
-                 "dzdx",
-                 "dzdy",
-                 "Nx",
-                 "Ny",
-                 "Nz",
-                 "Nsx",
-                 "Nsy",
-                 "Nsz",
-                 "Variance.R",
-                 "Variance.G",
-                 "Variance.B",
-                 "RelativeVariance.R",
-                 "RelativeVariance.G",
-                 "RelativeVariance.B"});
+    std::vector<std::string> channels = {"R", "G", "B"};
+    bool writeGeometry = aovs & AOVFlags::Geometry;
+    bool writeVariance = aovs & AOVFlags::Variance;
+    if (writeGeometry)
+        channels.insert(channels.end(),
+                        {"Albedo.R", "Albedo.G", "Albedo.B", "Px", "Py", "Pz", "dzdx",
+                         "dzdy", "Nx", "Ny", "Nz", "Nsx", "Nsy", "Nsz"});
+    if (writeVariance)
+        channels.insert(channels.end(),
+                        {"Variance.R", "Variance.G", "Variance.B", "RelativeVariance.R",
+                         "RelativeVariance.G", "RelativeVariance.B"});
+    bool writeCost = aovs & AOVFlags::Cost;
+    if (writeCost)
+        channels.insert(channels.end(), {"Cost.Time", "Cost.Rays", "Cost.Nodes",
+                                         "Cost.ShadowRays", "Cost.MediumSteps"});
+    Image image(format, Point2i(pixelBounds.Diagonal()), channels);
 
     ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
-    ImageChannelDesc pDesc = image.GetChannelDesc({"Px", "Py", "Pz"});
-    ImageChannelDesc dzDesc = image.GetChannelDesc({"dzdx", "dzdy"});
-    ImageChannelDesc nDesc = image.GetChannelDesc({"Nx", "Ny", "Nz"});
-    ImageChannelDesc nsDesc = image.GetChannelDesc({"Nsx", "Nsy", "Nsz"});
-    ImageChannelDesc albedoRgbDesc =
-        image.GetChannelDesc({"Albedo.R", "Albedo.G", "Albedo.B"});
-    ImageChannelDesc varianceDesc =
-        image.GetChannelDesc({"Variance.R", "Variance.G", "Variance.B"});
-    ImageChannelDesc relVarianceDesc = image.GetChannelDesc(
-        {"RelativeVariance.R", "RelativeVariance.G", "RelativeVariance.B"});
+    ImageChannelDesc pDesc, dzDesc, nDesc, nsDesc, albedoRgbDesc;
+    if (writeGeometry) {
+        pDesc = image.GetChannelDesc({"Px", "Py", "Pz"});
+        dzDesc = image.GetChannelDesc({"dzdx", "dzdy"});
+        nDesc = image.GetChannelDesc({"Nx", "Ny", "Nz"});
+        nsDesc = image.GetChannelDesc({"Nsx", "Nsy", "Nsz"});
+        albedoRgbDesc = image.GetChannelDesc({"Albedo.R", "Albedo.G", "Albedo.B"});
+    }
+    ImageChannelDesc varianceDesc, relVarianceDesc;
+    if (writeVariance) {
+        varianceDesc = image.GetChannelDesc({"Variance.R", "Variance.G", "Variance.B"});
+        relVarianceDesc = image.GetChannelDesc(
+            {"RelativeVariance.R", "RelativeVariance.G", "RelativeVariance.B"});
+    }
+    ImageChannelDesc costDesc;
+    if (writeCost)
+        costDesc = image.GetChannelDesc({"Cost.Time", "Cost.Rays", "Cost.Nodes",
+                                         "Cost.ShadowRays", "Cost.MediumSteps"});
 
     std::atomic<int> nClamped{0};
     ParallelFor2D(pixelBounds, [&](Point2i p) {
@@ -726,25 +1547,41 @@ Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
 
         Point2i pOffset(p.x - pixelBounds.pMin.x, p.y - pixelBounds.pMin.y);
         image.SetChannels(pOffset, rgbDesc, {rgb[0], rgb[1], rgb[2]});
-        image.SetChannels(pOffset, albedoRgbDesc,
-                          {albedoRgb[0], albedoRgb[1], albedoRgb[2]});
-
-        Normal3f n =
-            LengthSquared(pixel.nSum) > 0 ? Normalize(pixel.nSum) : Normal3f(0, 0, 0);
-        Normal3f ns =
-            LengthSquared(pixel.nsSum) > 0 ? Normalize(pixel.nsSum) : Normal3f(0, 0, 0);
-        image.SetChannels(pOffset, pDesc, {pt.x, pt.y, pt.z});
-        image.SetChannels(pOffset, dzDesc, {std::abs(dzdx), std::abs(dzdy)});
-        image.SetChannels(pOffset, nDesc, {n.x, n.y, n.z});
-        image.SetChannels(pOffset, nsDesc, {ns.x, ns.y, ns.z});
-        image.SetChannels(
-            pOffset, varianceDesc,
-            {pixel.varianceEstimator[0].Variance(), pixel.varianceEstimator[1].Variance(),
-             pixel.varianceEstimator[2].Variance()});
-        image.SetChannels(pOffset, relVarianceDesc,
-                          {pixel.varianceEstimator[0].RelativeVariance(),
-                           pixel.varianceEstimator[1].RelativeVariance(),
-                           pixel.varianceEstimator[2].RelativeVariance()});
+
+        if (writeGeometry) {
+            image.SetChannels(pOffset, albedoRgbDesc,
+                              {albedoRgb[0], albedoRgb[1], albedoRgb[2]});
+            Normal3f n = LengthSquared(pixel.nSum) > 0 ? Normalize(pixel.nSum)
+                                                       : Normal3f(0, 0, 0);
+            Normal3f ns = LengthSquared(pixel.nsSum) > 0 ? Normalize(pixel.nsSum)
+                                                         : Normal3f(0, 0, 0);
+            image.SetChannels(pOffset, pDesc, {pt.x, pt.y, pt.z});
+            image.SetChannels(pOffset, dzDesc, {std::abs(dzdx), std::abs(dzdy)});
+            image.SetChannels(pOffset, nDesc, {n.x, n.y, n.z});
+            image.SetChannels(pOffset, nsDesc, {ns.x, ns.y, ns.z});
+        }
+        if (writeVariance) {
+            image.SetChannels(pOffset, varianceDesc,
+                              {pixel.varianceEstimator[0].Variance(),
+                               pixel.varianceEstimator[1].Variance(),
+                               pixel.varianceEstimator[2].Variance()});
+            image.SetChannels(pOffset, relVarianceDesc,
+                              {pixel.varianceEstimator[0].RelativeVariance(),
+                               pixel.varianceEstimator[1].RelativeVariance(),
+                               pixel.varianceEstimator[2].RelativeVariance()});
+        }
+        if (writeCost) {
+            // Write the average cost of the pixel's samples; time is in
+            // microseconds.
+            size_t pixelIndex = size_t(pOffset.y) * pixelBounds.Diagonal().x + pOffset.x;
+            const double *sums = aovSums.data() + pixelIndex * aovStride + costOffset;
+            Float cost[5] = {};
+            if (sums[0] > 0)
+                for (int i = 0; i < 5; ++i)
+                    cost[i] = sums[i + 1] / sums[0];
+            image.SetChannels(pOffset, costDesc,
+                              {cost[0], cost[1], cost[2], cost[3], cost[4]});
+        }
     });
 
     if (nClamped.load() > 0)
@@ -757,10 +1594,21 @@ Image GBufferFilm::GetImage(ImageMetadata *metadata, Float splatScale) {
     return image;
 }
 
+std::string GBufferFilm::SaveState() const {
+    ErrorExit("Render checkpoints and distributed rendering aren't supported with "
+              "the \"gbuffer\" film.");
+}
+
+void GBufferFilm::RestoreState(const std::string &state) {
+    ErrorExit("Render checkpoints and distributed rendering aren't supported with "
+              "the \"gbuffer\" film.");
+}
+
 std::string GBufferFilm::ToString() const {
     return StringPrintf("[ GBufferFilm %s colorSpace: %s maxComponentValue: %f "
-                        "writeFP16: %s ]",
-                        BaseToString(), *colorSpace, maxComponentValue, writeFP16);
+                        "writeFP16: %s aovs: %d ]",
+                        BaseToString(), *colorSpace, maxComponentValue, writeFP16,
+                        int(aovs));
 }
 
 GBufferFilm *GBufferFilm::Create(const ParameterDictionary &parameters,
@@ -779,8 +1627,94 @@ GBufferFilm *GBufferFilm::Create(const ParameterDictionary &parameters,
         ErrorExit(loc, "%s: EXR is the only format supported by the GBufferFilm.",
                   filmBaseParameters.filename);
 
+    AOVFlags aovs = AOVFlags::None;
+    std::vector<std::string> aovNames = parameters.GetStringArray("aovs");
+    if (aovNames.empty())
+        aovNames = {"geometry", "variance"};
+    for (const std::string &name : aovNames) {
+        auto iter = std::find_if(std::begin(RegisteredAOVs), std::end(RegisteredAOVs),
+                                 [&](const AOVInfo &info) { return name == info.name; });
+        if (iter == std::end(RegisteredAOVs))
+            ErrorExit(loc, "%s: unknown AOV for \"aovs\".", name);
+        aovs = aovs | iter->flag;
+    }
+
     return alloc.new_object<GBufferFilm>(filmBaseParameters, colorSpace,
-                                         maxComponentValue, writeFP16, alloc);
+                                         maxComponentValue, writeFP16, aovs, alloc);
+}
+
+// ReferenceErrorLog Method Definitions
+std::unique_ptr<ReferenceErrorLog> ReferenceErrorLog::Create(
+    const Bounds2i &pixelBounds) {
+    if (Options->mseReferenceImage.empty())
+        return nullptr;
+
+    ImageAndMetadata im = Image::Read(Options->mseReferenceImage);
+    Bounds2i refPixelBounds = im.metadata.pixelBounds
+                                  ? *im.metadata.pixelBounds
+                                  : Bounds2i(Point2i(0, 0), im.image.Resolution());
+    if (!Inside(pixelBounds, refPixelBounds))
+        ErrorExit("Output image pixel bounds %s aren't inside the MSE "
+                  "image's pixel bounds %s.",
+                  pixelBounds, refPixelBounds);
+
+    // Transform the pixelBounds of the image we're rendering to the
+    // coordinate system with refPixelBounds.pMin at the origin, which in
+    // turn gives us the section of the reference image to crop. (This is
+    // complicated by the fact that Image doesn't support pixel bounds...)
+    Bounds2i cropBounds(Point2i(pixelBounds.pMin - refPixelBounds.pMin),
+                        Point2i(pixelBounds.pMax - refPixelBounds.pMin));
+    auto reference = std::make_unique<Image>(im.image.Crop(cropBounds));
+    CHECK_EQ(reference->Resolution(), Point2i(pixelBounds.Diagonal()));
+
+    FILE *file = fopen(Options->mseReferenceOutput.c_str(), "w");
+    if (!file)
+        ErrorExit("%s: %s", Options->mseReferenceOutput, ErrorString());
+    fprintf(file, "# seconds, spp, MSE, relMSE, FLIP\n");
+    return std::unique_ptr<ReferenceErrorLog>(
+        new ReferenceErrorLog(std::move(reference), file));
+}
+
+ReferenceErrorLog::~ReferenceErrorLog() {
+    fclose(file);
+}
+
+Float ReferenceErrorLog::Add(const Image &image, int spp, double seconds) {
+    // Report the time spent rendering, not including the time spent here
+    double renderSeconds = seconds - errorSeconds;
+    Timer timer;
+    ImageChannelDesc desc = image.AllChannelsDesc();
+    Float mse = image.MSE(desc, *reference).Average();
+    Float relMSE = image.MRSE(desc, *reference).Average();
+
+    // FLIP is only defined for RGB images with values in [0,1]
+    Float flip = std::numeric_limits<Float>::quiet_NaN();
+    ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
+    ImageChannelDesc refRGBDesc = reference->GetChannelDesc({"R", "G", "B"});
+    if (rgbDesc && refRGBDesc) {
+        Point2i res = image.Resolution();
+        std::vector<float> rgb(3 * res.x * res.y), refRGB(3 * res.x * res.y);
+        std::vector<float> error(res.x * res.y);
+        ParallelFor(0, res.y, [&](int64_t y) {
+            for (int x = 0; x < res.x; ++x) {
+                ImageChannelValues v = image.GetChannels({x, int(y)}, rgbDesc);
+                ImageChannelValues r = reference->GetChannels({x, int(y)}, refRGBDesc);
+                for (int c = 0; c < 3; ++c) {
+                    rgb[3 * (y * res.x + x) + c] = Clamp(v[c], 0, 1);
+                    refRGB[3 * (y * res.x + x) + c] = Clamp(r[c], 0, 1);
+                }
+            }
+        });
+        ComputeFLIPError(rgb.data(), refRGB.data(), error.data(), res.x, res.y,
+                         FLIPOptions());
+        flip = std::accumulate(error.begin(), error.end(), 0.) / error.size();
+    }
+
+    fprintf(file, "%.6f, %d, %.9g, %.9g, %.9g\n", renderSeconds, spp, mse, relMSE,
+            flip);
+    errorSeconds += timer.ElapsedSeconds();
+    fflush(file);
+    return mse;
 }
 
 FilmHandle FilmHandle::Create(const std::string &name,
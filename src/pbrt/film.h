@@ -14,9 +14,13 @@
 #include <pbrt/base/bxdf.h>
 #include <pbrt/base/camera.h>
 #include <pbrt/base/film.h>
+#include <pbrt/base/light.h>
+#include <pbrt/base/material.h>
 #include <pbrt/bsdf.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/containers.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/sampling.h>
@@ -25,9 +29,13 @@
 #include <pbrt/util/vecmath.h>
 
 #include <atomic>
+#include <cstdio>
+#include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace pbrt {
@@ -45,7 +53,12 @@ class PixelSensor {
     PixelSensor(SpectrumHandle r, SpectrumHandle g, SpectrumHandle b,
                 const RGBColorSpace *outputColorSpace, Float wbTemp, Float imagingRatio,
                 Allocator alloc)
-        : r_bar(r, alloc), g_bar(g, alloc), b_bar(b, alloc), imagingRatio(imagingRatio) {
+        : r_bar(r, alloc),
+          g_bar(g, alloc),
+          b_bar(b, alloc),
+          imagingRatio(imagingRatio),
+          responses(alloc) {
+        ComputeResponses();
         // Compute XYZ from camera RGB matrix
         // Compute _rgbCamera_ values for training swatches
         DenselySampledSpectrum sensorIllum = Spectra::D(wbTemp, alloc);
@@ -84,7 +97,9 @@ class PixelSensor {
         : r_bar(&Spectra::X(), alloc),
           g_bar(&Spectra::Y(), alloc),
           b_bar(&Spectra::Z(), alloc),
-          imagingRatio(imagingRatio) {
+          imagingRatio(imagingRatio),
+          responses(alloc) {
+        ComputeResponses();
         // Compute white balancing matrix for XYZ _PixelSensor_
         if (wbTemp != 0) {
             auto whiteIlluminant = Spectra::D(wbTemp, alloc);
@@ -96,16 +111,33 @@ class PixelSensor {
 
     PBRT_CPU_GPU
     RGB ToSensorRGB(const SampledSpectrum &L, const SampledWavelengths &lambda) const {
-        return imagingRatio * RGB((r_bar.Sample(lambda) * L).Average(),
-                                  (g_bar.Sample(lambda) * L).Average(),
-                                  (b_bar.Sample(lambda) * L).Average());
+        // Accumulate the responses to the sampled wavelengths all at once
+        Float rgb[4] = {0, 0, 0, 0};
+        for (int i = 0; i < NSpectrumSamples; ++i) {
+            int offset = std::lround(lambda[i]) - Lambda_min;
+            if (offset < 0 || offset >= responses.size())
+                continue;
+            const Response &response = responses[offset];
+            for (int c = 0; c < 4; ++c)
+                rgb[c] += response.rgb[c] * L[i];
+        }
+        return RGB(rgb[0], rgb[1], rgb[2]);
     }
 
     // PixelSensor Public Members
     SquareMatrix<3> XYZFromSensorRGB;
 
   private:
+    // PixelSensor::Response Definition
+    // The response is padded to four values so that a wavelength's
+    // contribution can be accumulated with a single SIMD multiply-add.
+    struct alignas(4 * sizeof(Float)) Response {
+        Float rgb[4];
+    };
+
     // PixelSensor Private Methods
+    void ComputeResponses();
+
     template <typename Triplet>
     static Triplet ProjectReflectance(SpectrumHandle r, SpectrumHandle illum,
                                       SpectrumHandle b1, SpectrumHandle b2,
@@ -114,6 +146,10 @@ class PixelSensor {
     // PixelSensor Private Members
     DenselySampledSpectrum r_bar, g_bar, b_bar;
     Float imagingRatio;
+    // _r_bar_, _g_bar_, and _b_bar_ for each wavelength from _Lambda_min_ to
+    // _Lambda_max_, scaled by the imaging ratio and by the 1 / n factor of the
+    // average over the sampled wavelengths
+    pstd::vector<Response> responses;
     static constexpr int nSwatchReflectances = 24;
     static SpectrumHandle swatchReflectances[nSwatchReflectances];
 };
@@ -158,6 +194,124 @@ class VisibleSurface {
     SampledSpectrum albedo;
 };
 
+// AOVFlags Definition
+// GBufferFilm can write these sets of output channels (arbitrary output
+// variables) in addition to the final RGB values. A render selects them
+// with the film's "aovs" parameter, and integrators only compute the ones
+// that are requested.
+enum class AOVFlags {
+    None = 0,
+    // Position, normals, screen-space depth derivatives, and albedo
+    Geometry = 1 << 0,
+    // Variance and relative variance of the pixel values
+    Variance = 1 << 1,
+    // Radiance by the kind of BSDF lobe scattered from at the first vertex
+    Lobes = 1 << 2,
+    // Radiance by the light group of the light it came from
+    LightGroups = 1 << 3,
+    // Cryptomatte-style IDs and coverage of the visible materials
+    MaterialIDs = 1 << 4,
+    // Time taken and rays traced per camera sample, for finding the parts
+    // of the image that are expensive to render
+    Cost = 1 << 5
+};
+
+PBRT_CPU_GPU inline AOVFlags operator|(AOVFlags a, AOVFlags b) {
+    return AOVFlags((int)a | (int)b);
+}
+
+PBRT_CPU_GPU inline int operator&(AOVFlags a, AOVFlags b) {
+    return ((int)a & (int)b);
+}
+
+// Returns the AOVs in _aovs_ that integrators compute, rather than the
+// film computing them from the _VisibleSurface_.
+PBRT_CPU_GPU inline AOVFlags IntegratorAOVs(AOVFlags aovs) {
+    return AOVFlags(aovs &
+                    (AOVFlags::Lobes | AOVFlags::LightGroups | AOVFlags::MaterialIDs));
+}
+
+// AOV Registry
+// Each AOV's name for the "aovs" film parameter; AOVs whose part name is
+// non-null are written to that part of a multi-part EXR file.
+struct AOVInfo {
+    AOVFlags flag;
+    const char *name;
+    const char *partName;
+};
+
+inline constexpr AOVInfo RegisteredAOVs[] = {
+    {AOVFlags::Geometry, "geometry", nullptr},
+    {AOVFlags::Variance, "variance", nullptr},
+    {AOVFlags::Lobes, "lobes", "lobes"},
+    {AOVFlags::LightGroups, "lightgroups", "lightgroups"},
+    {AOVFlags::MaterialIDs, "materialids", "materialids"},
+    {AOVFlags::Cost, "cost", nullptr}};
+
+// AOVLobe Definition
+// Radiance is attributed to the kind of lobe that the path scattered from
+// at its first vertex; light seen directly is _Emission_.
+enum class AOVLobe { Emission, Diffuse, Glossy, Specular, Transmission };
+static constexpr int NumAOVLobes = 5;
+
+PBRT_CPU_GPU inline AOVLobe GetAOVLobe(BxDFFlags flags) {
+    if (flags & BxDFFlags::Transmission)
+        return AOVLobe::Transmission;
+    if (flags & BxDFFlags::Specular)
+        return AOVLobe::Specular;
+    if (flags & BxDFFlags::Glossy)
+        return AOVLobe::Glossy;
+    return AOVLobe::Diffuse;
+}
+
+// AOVSample Definition
+// Values of the requested AOVs for a camera sample. Radiance values are
+// accumulated by the integrator along with the sample's total radiance.
+struct AOVSample {
+    // AOVSample Public Methods
+    explicit AOVSample(AOVFlags flags) : flags(flags) {
+        for (SampledSpectrum &L : lobeL)
+            L = SampledSpectrum(0.f);
+        for (SampledSpectrum &L : lightGroupL)
+            L = SampledSpectrum(0.f);
+    }
+
+    PBRT_CPU_GPU
+    void ScaleRadiance(const SampledSpectrum &scale) {
+        for (SampledSpectrum &L : lobeL)
+            L *= scale;
+        for (SampledSpectrum &L : lightGroupL)
+            L *= scale;
+    }
+
+    PBRT_CPU_GPU
+    void AddRadiance(const SampledSpectrum &L, AOVLobe lobe, LightHandle light) {
+        if (flags & AOVFlags::Lobes)
+            lobeL[int(lobe)] += L;
+        if (flags & AOVFlags::LightGroups) {
+            int group = light ? light.LightGroup() : -1;
+            if (group >= 0)
+                lightGroupL[group] += L;
+        }
+    }
+
+    // AOVSample Public Members
+    AOVFlags flags;
+    SampledSpectrum lobeL[NumAOVLobes];
+    SampledSpectrum lightGroupL[MaxLightGroups];
+    // Material at the first intersection
+    MaterialHandle material;
+};
+
+// PixelCostSample Definition
+// The work done to compute a camera sample, for the "cost" AOV. The GPU
+// renderer doesn't measure the time taken or the BVH nodes visited and
+// leaves them zero.
+struct PixelCostSample {
+    Float microseconds = 0;
+    int rays = 0, nodesVisited = 0, shadowRays = 0, mediumSteps = 0;
+};
+
 // FilmBaseParameters Definition
 struct FilmBaseParameters {
     FilmBaseParameters(const ParameterDictionary &parameters, FilterHandle filter,
@@ -226,6 +380,9 @@ class FilmBase {
     std::string filename;
 };
 
+struct RGBFilmStream;
+struct RGBFilmFloatSplats;
+
 // RGBFilm Definition
 class RGBFilm : public FilmBase {
   public:
@@ -233,6 +390,13 @@ class RGBFilm : public FilmBase {
     PBRT_CPU_GPU
     bool UsesVisibleSurface() const { return false; }
 
+    // AOVs are only supported by GBufferFilm
+    AOVFlags RequestedAOVs() const { return AOVFlags::None; }
+    void AddAOVSample(const Point2i &pFilm, const AOVSample &aov,
+                      const SampledWavelengths &lambda, Float weight) {}
+    PBRT_CPU_GPU
+    void AddCostSample(const Point2i &pFilm, const PixelCostSample &cost) {}
+
     PBRT_CPU_GPU
     void AddSample(const Point2i &pFilm, SampledSpectrum L,
                    const SampledWavelengths &lambda, const VisibleSurface *,
@@ -247,25 +411,51 @@ class RGBFilm : public FilmBase {
         }
 
         DCHECK(InsideExclusive(pFilm, pixelBounds));
+#ifndef PBRT_IS_GPU_CODE
+        // Add sample to the calling thread's tile buffer if it has one
+        if (tileBuffers && addTileSample(pFilm, rgb, weight))
+            return;
+#endif
+
         // Update pixel values with filtered sample contribution
-        Pixel &pixel = pixels[pFilm];
-        for (int c = 0; c < 3; ++c)
-            pixel.rgbSum[c] += weight * rgb[c];
-        pixel.weightSum += weight;
+        if (floatPixels) {
+            FloatPixel &pixel = floatPixelValues[pFilm];
+            for (int c = 0; c < 3; ++c)
+                pixel.rgbSum[c] += weight * rgb[c];
+            pixel.weightSum += weight;
+        } else {
+            Pixel &pixel = pixels[pFilm];
+            for (int c = 0; c < 3; ++c)
+                pixel.rgbSum[c] += weight * rgb[c];
+            pixel.weightSum += weight;
+        }
     }
 
     PBRT_CPU_GPU
     RGB GetPixelRGB(const Point2i &p, Float splatScale = 1) const {
-        const Pixel &pixel = pixels[p];
-        RGB rgb(pixel.rgbSum[0], pixel.rgbSum[1], pixel.rgbSum[2]);
+        RGB rgb, splatRGB;
+        Float weightSum;
+        if (floatPixels) {
+            const FloatPixel &pixel = floatPixelValues[p];
+            rgb = RGB(Float(pixel.rgbSum[0]), Float(pixel.rgbSum[1]),
+                      Float(pixel.rgbSum[2]));
+            weightSum = Float(pixel.weightSum);
+#ifndef PBRT_IS_GPU_CODE
+            splatRGB = floatSplatRGB(p);
+#endif
+        } else {
+            const Pixel &pixel = pixels[p];
+            rgb = RGB(pixel.rgbSum[0], pixel.rgbSum[1], pixel.rgbSum[2]);
+            weightSum = pixel.weightSum;
+            splatRGB = RGB(pixel.splatRGB[0], pixel.splatRGB[1], pixel.splatRGB[2]);
+        }
         // Normalize _rgb_ with weight sum
-        Float weightSum = pixel.weightSum;
         if (weightSum != 0)
             rgb /= weightSum;
 
         // Add splat value at pixel
         for (int c = 0; c < 3; ++c)
-            rgb[c] += splatScale * pixel.splatRGB[c] / filterIntegral;
+            rgb[c] += splatScale * splatRGB[c] / filterIntegral;
 
         // Convert _rgb_ to output RGB color space
         rgb = outputRGBFromSensorRGB * rgb;
@@ -274,9 +464,15 @@ class RGBFilm : public FilmBase {
     }
 
     RGBFilm() = default;
+    // If _streamTileSize_ is non-zero, the film streams finished pixels to
+    // a tiled EXR file with tiles of that size rather than storing the
+    // entire image.
+    // If _floatPixels_ is true, pixel sums are stored in single precision
+    // with compensated summation, which takes less than half the memory.
     RGBFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
             Float maxComponentValue = Infinity, bool writeFP16 = true,
-            Allocator alloc = {});
+            bool threadSplatBuffers = false, bool tileBuffers = false,
+            int streamTileSize = 0, bool floatPixels = false, Allocator alloc = {});
 
     static RGBFilm *Create(const ParameterDictionary &parameters, Float exposureTime,
                            FilterHandle filter, const RGBColorSpace *colorSpace,
@@ -288,7 +484,38 @@ class RGBFilm : public FilmBase {
     PBRT_CPU_GPU
     void AddSplat(const Point2f &p, SampledSpectrum v, const SampledWavelengths &lambda);
 
+    // Accumulates splats held in per-thread buffers into the film's pixels;
+    // must not be called while other threads may be adding splats. The
+    // integrators call it at the end of each wave of samples.
+    void FlushSplats();
+
+    // With tile buffers enabled, samples the calling thread adds inside
+    // _tileBounds_ are accumulated in a thread-local buffer until
+    // EndTile() adds them to the film's pixels. This avoids threads
+    // writing to the same cache lines at tile borders. A streaming film
+    // instead writes the tile's final values to its output file, so each
+    // tile must be rendered with all of its samples at once.
+    void BeginTile(const Bounds2i &tileBounds);
+    void EndTile();
+
+    bool IsStreaming() const { return stream != nullptr; }
+
+    // Returns the film's accumulated pixel values for a render checkpoint,
+    // which RestoreState() later reloads. Splats must have been flushed
+    // and no tiles may be in progress.
+    std::string SaveState() const { return SaveState(pixelBounds); }
+    void RestoreState(const std::string &state);
+    // Returns the accumulated values of just the pixels in _bounds_;
+    // MergeState() adds such values to the film's.
+    std::string SaveState(const Bounds2i &bounds) const;
+    void MergeState(const std::string &state, const Bounds2i &bounds);
+    // Discards the samples of the pixels in _bounds_; the film must not
+    // have any splats.
+    void ResetPixels(const Bounds2i &bounds);
+
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
+    std::function<void()> PrepareImageWrite(ImageMetadata metadata,
+                                            Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
     std::string ToString() const;
@@ -308,21 +535,76 @@ class RGBFilm : public FilmBase {
         AtomicDouble splatRGB[3];
     };
 
+    // RGBFilm::FloatPixel Definition
+    // Splats are stored separately for these pixels and are only allocated
+    // once one is added, since most integrators don't splat.
+    struct FloatPixel {
+        CompensatedSum<float> rgbSum[3];
+        CompensatedSum<float> weightSum;
+    };
+
+    // RGBFilm::SplatPixel Definition
+    struct SplatPixel {
+        double rgb[3] = {0., 0., 0.};
+    };
+
+    // RGBFilm::ThreadSplats Definition
+    // A thread's buffered splats are held in up to _MaxTiles_ square tiles of
+    // pixels; when another tile is needed, the thread first adds its tiles'
+    // splats to the film's pixels.
+    struct ThreadSplats {
+        static constexpr int TileSize = 16, MaxTiles = 16;
+        struct Tile {
+            Point2i pMin;
+            SplatPixel pixels[TileSize * TileSize];
+        };
+        std::vector<Tile> tiles;
+        int lastTile = -1;
+    };
+
+    // RGBFilm Private Methods
+    ThreadSplats *ThreadSplatBuffer();
+    SplatPixel &threadSplatPixel(ThreadSplats *splats, const Point2i &p);
+    void flushThreadSplats(ThreadSplats *splats);
+    bool addTileSample(const Point2i &pFilm, const RGB &rgb, Float weight);
+    template <typename F>
+    void streamTile(const Bounds2i &tileBounds, F getPixelRGB);
+    void addFloatSplat(const Point2i &p, const RGB &rgb);
+    RGB floatSplatRGB(const Point2i &p) const;
+    void loadState(const std::string &state, const Bounds2i &bounds, bool merge);
+
     // RGBFilm Private Members
     const RGBColorSpace *colorSpace;
     Float maxComponentValue;
     bool writeFP16;
     Float filterIntegral;
     SquareMatrix<3> outputRGBFromSensorRGB;
-    Array2D<Pixel> pixels;
+    // Pixels are stored in blocks so that a tile's pixels span fewer
+    // cache lines and pages than they would in scanline order.
+    BlockedArray2D<Pixel> pixels;
+    // Used instead of _pixels_ for films with single-precision pixels
+    bool floatPixels;
+    BlockedArray2D<FloatPixel> floatPixelValues;
+    RGBFilmFloatSplats *floatSplats = nullptr;
+    bool tileBuffers;
+    // Only allocated for streaming films, which leave _pixels_ empty
+    RGBFilmStream *stream = nullptr;
+    // Per-thread splat buffers; each one is allocated the first time its
+    // thread adds a splat.
+    bool threadSplatBuffers;
+    int splatBuffersId;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<ThreadSplats>>> splatBuffers;
 };
 
 // GBufferFilm Definition
 class GBufferFilm : public FilmBase {
   public:
     // GBufferFilm Public Methods
+    // Channels are written for the AOVs in _aovs_; the ones that have a
+    // part name are written to separate parts of a multi-part EXR file.
     GBufferFilm(FilmBaseParameters p, const RGBColorSpace *colorSpace,
                 Float maxComponentValue = Infinity, bool writeFP16 = true,
+                AOVFlags aovs = AOVFlags::Geometry | AOVFlags::Variance,
                 Allocator alloc = {});
 
     static GBufferFilm *Create(const ParameterDictionary &parameters, Float exposureTime,
@@ -347,7 +629,38 @@ class GBufferFilm : public FilmBase {
     }
 
     PBRT_CPU_GPU
-    bool UsesVisibleSurface() const { return true; }
+    bool UsesVisibleSurface() const {
+        return aovs & (AOVFlags::Geometry | AOVFlags::Variance);
+    }
+
+    AOVFlags RequestedAOVs() const { return aovs; }
+    // Adds the values of the AOVs that are computed by integrators; must be
+    // called with the same arguments as the corresponding AddSample() call.
+    void AddAOVSample(const Point2i &pFilm, const AOVSample &aov,
+                      const SampledWavelengths &lambda, Float weight);
+    PBRT_CPU_GPU
+    void AddCostSample(const Point2i &pFilm, const PixelCostSample &cost);
+    // Material IDs are computed by hashing the materials' names; anonymous
+    // materials are named by their index.
+    void SetMaterialNames(const std::map<std::string, MaterialHandle> &namedMaterials,
+                          const std::vector<MaterialHandle> &materials);
+
+    // GBufferFilm always accumulates splats and samples directly into its
+    // pixels.
+    void FlushSplats() {}
+    void BeginTile(const Bounds2i &tileBounds) {}
+    void EndTile() {}
+    bool IsStreaming() const { return false; }
+
+    // Render checkpoints and film merging aren't supported; these report an
+    // error.
+    std::string SaveState() const;
+    void RestoreState(const std::string &state);
+    std::string SaveState(const Bounds2i &bounds) const { return SaveState(); }
+    void MergeState(const std::string &state, const Bounds2i &bounds) {
+        RestoreState(state);
+    }
+    void ResetPixels(const Bounds2i &bounds) { RestoreState({}); }
 
     PBRT_CPU_GPU
     RGB GetPixelRGB(const Point2i &p, Float splatScale = 1) const {
@@ -369,6 +682,8 @@ class GBufferFilm : public FilmBase {
     }
 
     void WriteImage(ImageMetadata metadata, Float splatScale = 1);
+    std::function<void()> PrepareImageWrite(ImageMetadata metadata,
+                                            Float splatScale = 1);
     Image GetImage(ImageMetadata *metadata, Float splatScale = 1);
 
     std::string ToString() const;
@@ -387,6 +702,20 @@ class GBufferFilm : public FilmBase {
         VarianceEstimator<Float> varianceEstimator[3];
     };
 
+    // GBufferFilm::MaterialCoverage Definition
+    struct MaterialCoverage {
+        uint32_t id = 0;
+        float coverage = 0;
+    };
+
+    // GBufferFilm::MaterialHandleHash Definition
+    struct MaterialHandleHash {
+        size_t operator()(MaterialHandle material) const { return Hash(material.ptr()); }
+    };
+
+    // GBufferFilm Private Methods
+    std::vector<Image> GetAOVImages(const std::vector<std::string> &lightGroups) const;
+
     // GBufferFilm Private Members
     Array2D<Pixel> pixels;
     const RGBColorSpace *colorSpace;
@@ -394,6 +723,44 @@ class GBufferFilm : public FilmBase {
     bool writeFP16;
     Float filterIntegral;
     SquareMatrix<3> outputRGBFromSensorRGB;
+    AOVFlags aovs;
+    // Weighted sums of the lobe and light group AOVs' RGB values, stored
+    // _aovStride_ values per pixel; only the requested AOVs are stored.
+    // The cost AOV stores the number of samples and their summed costs.
+    int aovStride = 0, lobesOffset = 0, lightGroupsOffset = 0, costOffset = 0;
+    pstd::vector<double> aovSums;
+    // Up to _NumMaterialRanks_ material IDs per pixel and their coverage
+    static constexpr int NumMaterialRanks = 4;
+    pstd::vector<MaterialCoverage> materialCoverage;
+    HashMap<MaterialHandle, uint32_t, MaterialHandleHash> materialIDs;
+    std::vector<std::string> materialIDManifest;
+};
+
+// ReferenceErrorLog Definition
+// Records how quickly a render converges to the --mse-reference-image: each
+// call to Add() appends the elapsed rendering time, the number of samples
+// per pixel, and the image's MSE, relative MSE, and mean FLIP error to the
+// --mse-reference-out file.
+class ReferenceErrorLog {
+  public:
+    // ReferenceErrorLog Public Methods
+    // Returns nullptr if no reference image was specified.
+    static std::unique_ptr<ReferenceErrorLog> Create(const Bounds2i &pixelBounds);
+
+    ~ReferenceErrorLog();
+
+    // Logs the error of _image_ and returns its MSE; _seconds_ is the
+    // elapsed time, from which the time spent computing errors is excluded.
+    Float Add(const Image &image, int spp, double seconds);
+
+  private:
+    ReferenceErrorLog(std::unique_ptr<Image> reference, FILE *file)
+        : reference(std::move(reference)), file(file) {}
+
+    // ReferenceErrorLog Private Members
+    std::unique_ptr<Image> reference;
+    FILE *file;
+    double errorSeconds = 0;
 };
 
 PBRT_CPU_GPU
@@ -438,6 +805,13 @@ inline bool FilmHandle::UsesVisibleSurface() const {
     return Dispatch(uses);
 }
 
+PBRT_CPU_GPU
+inline void FilmHandle::AddCostSample(const Point2i &pFilm,
+                                      const PixelCostSample &cost) {
+    auto add = [&](auto ptr) { return ptr->AddCostSample(pFilm, cost); };
+    return Dispatch(add);
+}
+
 PBRT_CPU_GPU
 inline RGB FilmHandle::GetPixelRGB(const Point2i &p, Float splatScale) const {
     auto get = [&](auto ptr) { return ptr->GetPixelRGB(p, splatScale); };
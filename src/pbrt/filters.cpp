@@ -131,10 +131,25 @@ FilterHandle FilterHandle::Create(const std::string &name,
 }
 
 // FilterSampler Method Definitions
+// Computes the guide table for the _n_-bin CDF _cdf_: entry _j_ is the last
+// bin that starts at or before the sample value $j/n$.
+static void computeGuide(const Float *cdf, int n, int *guide) {
+    int o = 0;
+    for (int j = 0; j < n; ++j) {
+        Float u = Float(j) / Float(n);
+        while (o < n - 1 && cdf[o + 1] <= u)
+            ++o;
+        guide[j] = o;
+    }
+}
+
 FilterSampler::FilterSampler(FilterHandle filter, Allocator alloc)
     : domain(Point2f(-filter.Radius()), Point2f(filter.Radius())),
       values(int(32 * filter.Radius().x), int(32 * filter.Radius().y), alloc),
-      distrib(alloc) {
+      conditionalCDF(values.xSize() + 1, values.ySize(), alloc),
+      conditionalGuide(values.xSize(), values.ySize(), alloc),
+      marginalCDF(values.ySize() + 1, alloc),
+      marginalGuide(values.ySize(), alloc) {
     // Tabularize filter function in _values_
     for (int y = 0; y < values.ySize(); ++y)
         for (int x = 0; x < values.xSize(); ++x) {
@@ -143,13 +158,28 @@ FilterSampler::FilterSampler(FilterHandle filter, Allocator alloc)
             values(x, y) = filter.Evaluate(p);
         }
 
-    // Compute sampling distribution for filter
-    distrib = PiecewiseConstant2D(values, domain, alloc);
+    // Compute conditional CDFs and guide tables for the rows of _values_
+    int nx = values.xSize(), ny = values.ySize();
+    std::vector<Float> rowIntegrals(ny);
+    for (int y = 0; y < ny; ++y) {
+        PiecewiseConstant1D row(pstd::span<const Float>(&values(0, y), nx),
+                                domain.pMin.x, domain.pMax.x);
+        std::copy(row.cdf.begin(), row.cdf.end(), &conditionalCDF(0, y));
+        computeGuide(&conditionalCDF(0, y), nx, &conditionalGuide(0, y));
+        rowIntegrals[y] = row.Integral();
+    }
+
+    // Compute marginal CDF and guide table
+    PiecewiseConstant1D marginal(rowIntegrals, domain.pMin.y, domain.pMax.y);
+    std::copy(marginal.cdf.begin(), marginal.cdf.end(), marginalCDF.begin());
+    computeGuide(marginalCDF.data(), ny, marginalGuide.data());
+    integral = marginal.Integral();
 }
 
 std::string FilterSampler::ToString() const {
-    return StringPrintf("[ FilterSampler domain: %s values: %s distrib: %s ]", domain,
-                        values, distrib);
+    return StringPrintf("[ FilterSampler domain: %s values: %s marginalCDF: %s "
+                        "integral: %f ]",
+                        domain, values, marginalCDF, integral);
 }
 
 }  // namespace pbrt
@@ -23,6 +23,12 @@ struct FilterSample {
     Float weight;
 };
 
+// FilterSampler Definition
+// Samples filters by inverting the CDFs of their tabulated values. Each CDF
+// has a guide table that gives the bin of the CDF that each of its equal
+// ranges of sample values starts in, so that sampling is a table lookup
+// followed by, usually, at most a few steps forward rather than a binary
+// search.
 class FilterSampler {
   public:
     // FilterSampler Public Methods
@@ -31,21 +37,45 @@ class FilterSampler {
 
     PBRT_CPU_GPU
     FilterSample Sample(const Point2f &u) const {
-        Point2f p = distrib.Sample(u);
-        Point2f p01 = Point2f(domain.Offset(p));
-        Point2i pi(Clamp(p01.x * values.xSize() + 0.5f, 0, values.xSize() - 1),
-                   Clamp(p01.y * values.ySize() + 0.5f, 0, values.ySize() - 1));
-        return {p, values[pi] < 0 ? -1.f : 1.f};
+        // Sample row of tabulated filter using marginal CDF
+        int nx = values.xSize(), ny = values.ySize();
+        Float dy;
+        int y = SampleCDF(marginalCDF.data(), marginalGuide.data(), ny, u[1], &dy);
+
+        // Sample column of tabulated filter using row's conditional CDF
+        Float dx;
+        int x = SampleCDF(&conditionalCDF(0, y), &conditionalGuide(0, y), nx, u[0], &dx);
+
+        Point2f p = domain.Lerp(Point2f((x + dx) / nx, (y + dy) / ny));
+        return {p, values(x, y) < 0 ? -1.f : 1.f};
     }
 
     PBRT_CPU_GPU
-    Float Integral() const { return distrib.Integral(); }
+    Float Integral() const { return integral; }
 
   private:
+    // FilterSampler Private Methods
+    // Returns the bin of the _n_-bin CDF _cdf_ that _u_ falls in and the
+    // offset of _u_ within it in _du_; the search starts at the bin that
+    // _guide_ gives for _u_'s range of sample values.
+    PBRT_CPU_GPU
+    static int SampleCDF(const Float *cdf, const int *guide, int n, Float u, Float *du) {
+        int o = guide[std::min<int>(u * n, n - 1)];
+        while (o < n - 1 && cdf[o + 1] <= u)
+            ++o;
+        *du = (cdf[o + 1] > cdf[o]) ? (u - cdf[o]) / (cdf[o + 1] - cdf[o]) : 0;
+        return o;
+    }
+
     // FilterSampler Private Members
     Bounds2f domain;
     Array2D<Float> values;
-    PiecewiseConstant2D distrib;
+    // Row _y_ of _conditionalCDF_ holds the CDF of row _y_ of _values_.
+    Array2D<Float> conditionalCDF;
+    Array2D<int> conditionalGuide;
+    pstd::vector<Float> marginalCDF;
+    pstd::vector<int> marginalGuide;
+    Float integral;
 };
 
 // BoxFilter Definition
@@ -98,3 +98,28 @@ TEST(Filter, Integral) {
     for (FilterHandle f : makeFilters(Vector2f(3.4, 2.5)))
         EXPECT_TRUE(approxEqual(f.Integral(), integrateFilter(f))) << f;
 }
+
+TEST(Filter, SampleMatchesPiecewiseConstant) {
+    // The guide tables should give the same samples as a binary search of
+    // the same tabulated distribution.
+    for (Vector2f r : {Vector2f(1, 1), Vector2f(2.5, 1), Vector2f(3.4, 2.5)}) {
+        for (FilterHandle f : std::vector<FilterHandle>{new GaussianFilter(r),
+                                                        new MitchellFilter(r),
+                                                        new LanczosSincFilter(r)}) {
+            Bounds2f domain(Point2f(-r), Point2f(r));
+            Array2D<Float> values(int(32 * r.x), int(32 * r.y));
+            for (int y = 0; y < values.ySize(); ++y)
+                for (int x = 0; x < values.xSize(); ++x)
+                    values(x, y) = f.Evaluate(domain.Lerp(Point2f(
+                        (x + 0.5f) / values.xSize(), (y + 0.5f) / values.ySize())));
+            PiecewiseConstant2D distrib(values, domain);
+
+            EXPECT_FLOAT_EQ(distrib.Integral(), FilterSampler(f).Integral()) << f;
+            for (Point2f u : Stratified2D(32, 32)) {
+                Point2f p = f.Sample(u).p, pd = distrib.Sample(u);
+                EXPECT_NEAR(p.x, pd.x, 1e-4) << f << " u " << u;
+                EXPECT_NEAR(p.y, pd.y, 1e-4) << f << " u " << u;
+            }
+        }
+    }
+}
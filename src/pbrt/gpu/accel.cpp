@@ -8,22 +8,32 @@
 #include <pbrt/gpu/optix.h>
 #include <pbrt/lights.h>
 #include <pbrt/materials.h>
+#include <pbrt/options.h>
 #include <pbrt/parsedscene.h>
+#include <pbrt/shapes.h>
 #include <pbrt/textures.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/loopsubdiv.h>
 #include <pbrt/util/mesh.h>
 #include <pbrt/util/parallel.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/splines.h>
 #include <pbrt/util/stats.h>
 
 #include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <mutex>
 
 #include <optix.h>
 #include <optix_function_table_definition.h>
+#if (OPTIX_VERSION >= 70600)
+#include <optix_micromap.h>
+#endif
 #include <optix_stubs.h>
 
 #ifdef NVTX
@@ -65,6 +75,7 @@ struct __align__(OPTIX_SBT_RECORD_ALIGNMENT) GPUAccel::HitgroupRecord {
         TriangleMeshRecord triRec;
         BilinearMeshRecord bilinearRec;
         QuadricRecord quadricRec;
+        CurveRecord curveRec;
     };
 };
 
@@ -74,58 +85,373 @@ extern const unsigned char PBRT_EMBEDDED_PTX[];
 
 STAT_MEMORY_COUNTER("Memory/Acceleration structures", gpuBVHBytes);
 
-OptixTraversableHandle GPUAccel::buildBVH(
-    const std::vector<OptixBuildInput> &buildInputs) {
-    // Figure out memory requirements.
+STAT_COUNTER("Scene/GPU acceleration structures read from cache", nCachedGASs);
+STAT_COUNTER("Scene/OptiX module compilation time (ms)", optixModuleMS);
+STAT_COUNTER("Scene/OptiX pipeline creation time (ms)", optixPipelineMS);
+
+// Limits on the size of OptiX's disk cache of compiled modules and
+// pipelines; when it exceeds the high water mark, entries are evicted
+// until it is below the low water mark.
+static constexpr size_t OptiXCacheLowWaterBytes = size_t(1) << 30;
+static constexpr size_t OptiXCacheHighWaterBytes = size_t(2) << 30;
+
+// BVHs are built in batches that share temporary and output buffers of at
+// most this many bytes, unless a single BVH needs more.
+static constexpr size_t MaxBVHBatchBytes = size_t(1) << 30;
+
+// The built-in curve intersector must be created with the same flags that
+// the GASs are built with.
+static constexpr unsigned int AccelBuildFlags =
+    OPTIX_BUILD_FLAG_ALLOW_COMPACTION | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE;
+
+static size_t alignAccelBytes(size_t bytes) {
+    return (bytes + OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1) &
+           ~size_t(OPTIX_ACCEL_BUFFER_BYTE_ALIGNMENT - 1);
+}
+
+// GAS Cache Definitions
+// With --bvh-cache, compacted GASs are stored along with the information
+// OptiX needs to relocate them to a new address, so that later runs with
+// the same geometry can copy them to the GPU rather than building them.
+static constexpr int32_t GASCacheVersion = 1;
+
+struct GASCacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint64_t bytes;
+    int32_t version, optixVersion;
+    OptixAccelRelocationInfo relocationInfo;
+};
+
+// A GAS is fully determined by its build inputs' geometry and flags; the
+// buffers they refer to are in managed memory and so can be read here.
+static uint64_t GASCacheKey(const std::vector<OptixBuildInput> &buildInputs) {
+    uint64_t hash = Hash(buildInputs.size(), GASCacheVersion, OPTIX_VERSION);
+    for (const OptixBuildInput &input : buildInputs) {
+        if (input.type == OPTIX_BUILD_INPUT_TYPE_TRIANGLES) {
+            const OptixBuildInputTriangleArray &tri = input.triangleArray;
+            hash = HashBuffer((const void *)tri.vertexBuffers[0],
+                              size_t(tri.numVertices) * tri.vertexStrideInBytes, hash);
+            hash =
+                HashBuffer((const void *)tri.indexBuffer,
+                           size_t(tri.numIndexTriplets) * tri.indexStrideInBytes, hash);
+            hash = Hash(hash, int(input.type), tri.flags[0]);
+#if (OPTIX_VERSION >= 70200)
+        } else if (input.type == OPTIX_BUILD_INPUT_TYPE_CURVES) {
+            const OptixBuildInputCurveArray &curves = input.curveArray;
+            hash = HashBuffer((const void *)curves.vertexBuffers[0],
+                              size_t(curves.numVertices) * curves.vertexStrideInBytes,
+                              hash);
+            hash = HashBuffer((const void *)curves.widthBuffers[0],
+                              size_t(curves.numVertices) * curves.widthStrideInBytes,
+                              hash);
+            hash = HashBuffer((const void *)curves.indexBuffer,
+                              size_t(curves.numPrimitives) * curves.indexStrideInBytes,
+                              hash);
+            hash = Hash(hash, int(input.type), int(curves.curveType), curves.flag);
+#endif
+        } else {
+            CHECK(input.type == OPTIX_BUILD_INPUT_TYPE_CUSTOM_PRIMITIVES);
+            const OptixBuildInputCustomPrimitiveArray &prims = input.customPrimitiveArray;
+            hash = HashBuffer((const void *)prims.aabbBuffers[0],
+                              size_t(prims.numPrimitives) * sizeof(OptixAabb), hash);
+            hash = Hash(hash, int(input.type), prims.flags[0]);
+        }
+    }
+    return hash;
+}
+
+// GASs that refer to opacity micromap arrays aren't cached, since the
+// arrays would have to be cached and relocated along with them.
+static bool UsesOpacityMicromaps(const std::vector<OptixBuildInput> &buildInputs) {
+#if (OPTIX_VERSION >= 70600)
+    for (const OptixBuildInput &input : buildInputs)
+        if (input.type == OPTIX_BUILD_INPUT_TYPE_TRIANGLES &&
+            input.triangleArray.opacityMicromap.opacityMicromapArray)
+            return true;
+#endif
+    return false;
+}
+
+bool GPUAccel::readGASCache(BVHBuild *build) const {
+    const std::string &filename = build->cacheFilename;
+    if (!FileExists(filename))
+        return false;
+    std::string contents = ReadFileContents(filename);
+
+    // Validate cache file header and check that the GAS can be used here
+    GASCacheHeader header;
+    if (contents.size() < sizeof(header)) {
+        Warning("%s: ignoring corrupt GAS cache file.", filename);
+        return false;
+    }
+    std::memcpy(&header, contents.data(), sizeof(header));
+    if (std::memcmp(header.magic, "pbrtgas", 8) != 0 ||
+        header.version != GASCacheVersion || header.optixVersion != OPTIX_VERSION ||
+        header.key != build->cacheKey ||
+        contents.size() != sizeof(header) + header.bytes) {
+        Warning("%s: ignoring stale or corrupt GAS cache file.", filename);
+        return false;
+    }
+    int compatible = 0;
+    OPTIX_CHECK(optixAccelCheckRelocationCompatibility(
+        optixContext, &header.relocationInfo, &compatible));
+    if (!compatible) {
+        LOG_VERBOSE("%s: cached GAS isn't compatible with this GPU", filename);
+        return false;
+    }
+
+    // Copy the GAS to the GPU and relocate it to its new address
+    CUDA_CHECK(cudaMalloc(&build->buffer, header.bytes));
+    build->bufferBytes = header.bytes;
+    CUDA_CHECK(cudaMemcpy(build->buffer, contents.data() + sizeof(header), header.bytes,
+                          cudaMemcpyHostToDevice));
+    OPTIX_CHECK(optixAccelRelocate(optixContext, cudaStream, &header.relocationInfo,
+                                   /* instance handles */ 0, 0,
+                                   CUdeviceptr(build->buffer), header.bytes,
+                                   &build->handle));
+    gpuBVHBytes += header.bytes;
+    ++nCachedGASs;
+    LOG_VERBOSE("Read GAS from cache file %s", filename);
+    return true;
+}
+
+void GPUAccel::writeGASCache(const BVHBuild &build) const {
+    GASCacheHeader header;
+    std::memcpy(header.magic, "pbrtgas", 8);
+    header.key = build.cacheKey;
+    header.bytes = build.bufferBytes;
+    header.version = GASCacheVersion;
+    header.optixVersion = OPTIX_VERSION;
+    OPTIX_CHECK(
+        optixAccelGetRelocationInfo(optixContext, build.handle, &header.relocationInfo));
+
+    std::string contents(sizeof(header) + build.bufferBytes, '\0');
+    std::memcpy(&contents[0], &header, sizeof(header));
+    CUDA_CHECK(cudaMemcpy(&contents[sizeof(header)], build.buffer, build.bufferBytes,
+                          cudaMemcpyDeviceToHost));
+
+    if (!WriteFileAtomic(build.cacheFilename, contents)) {
+        Warning("%s: unable to write GAS cache file.", build.cacheFilename);
+        return;
+    }
+    LOG_VERBOSE("Wrote GAS to cache file %s", build.cacheFilename);
+}
+
+void GPUAccel::buildBVHs(const std::vector<BVHBuild *> &builds) {
     OptixAccelBuildOptions accelOptions = {};
-    accelOptions.buildFlags =
-        (OPTIX_BUILD_FLAG_ALLOW_COMPACTION | OPTIX_BUILD_FLAG_PREFER_FAST_TRACE);
+    accelOptions.buildFlags = AccelBuildFlags;
     accelOptions.motionOptions.numKeys = 1;
     accelOptions.operation = OPTIX_BUILD_OPERATION_BUILD;
 
-    OptixAccelBufferSizes blasBufferSizes;
-    OPTIX_CHECK(optixAccelComputeMemoryUsage(optixContext, &accelOptions,
-                                             buildInputs.data(), buildInputs.size(),
-                                             &blasBufferSizes));
-
-    uint64_t *compactedSizeBufferPtr = alloc.new_object<uint64_t>();
-    OptixAccelEmitDesc emitDesc;
-    emitDesc.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
-    emitDesc.result = (CUdeviceptr)compactedSizeBufferPtr;
+    // Use cached GASs where possible and find the others' memory requirements
+    std::vector<BVHBuild *> pending;
+    std::vector<OptixAccelBufferSizes> bufferSizes;
+    for (BVHBuild *build : builds) {
+        if (!Options->bvhCacheDirectory.empty() &&
+            build->buildInputs[0].type != OPTIX_BUILD_INPUT_TYPE_INSTANCES &&
+            !UsesOpacityMicromaps(build->buildInputs)) {
+            build->cacheKey = GASCacheKey(build->buildInputs);
+            build->cacheFilename =
+                StringPrintf("%s/gas-%016llx.bin", Options->bvhCacheDirectory,
+                             (unsigned long long)build->cacheKey);
+            if (readGASCache(build))
+                continue;
+        }
 
-    // Allocate buffers.
-    void *tempBuffer;
-    CUDA_CHECK(cudaMalloc(&tempBuffer, blasBufferSizes.tempSizeInBytes));
-    void *outputBuffer;
-    CUDA_CHECK(cudaMalloc(&outputBuffer, blasBufferSizes.outputSizeInBytes));
+        OptixAccelBufferSizes sizes;
+        OPTIX_CHECK(optixAccelComputeMemoryUsage(optixContext, &accelOptions,
+                                                 build->buildInputs.data(),
+                                                 build->buildInputs.size(), &sizes));
+        pending.push_back(build);
+        bufferSizes.push_back(sizes);
+    }
 
-    // Build.
-    OptixTraversableHandle traversableHandle{0};
-    OPTIX_CHECK(optixAccelBuild(
-        optixContext, cudaStream, &accelOptions, buildInputs.data(), buildInputs.size(),
-        CUdeviceptr(tempBuffer), blasBufferSizes.tempSizeInBytes,
-        CUdeviceptr(outputBuffer), blasBufferSizes.outputSizeInBytes, &traversableHandle,
-        &emitDesc, 1));
+    for (size_t start = 0, end; start < pending.size(); start = end) {
+        // Choose the BVHs to build in this batch and their buffer offsets
+        std::vector<size_t> tempOffsets, outputOffsets;
+        size_t tempBytes = 0, outputBytes = 0;
+        for (end = start; end < pending.size(); ++end) {
+            size_t buildTempBytes = alignAccelBytes(bufferSizes[end].tempSizeInBytes);
+            size_t buildOutputBytes = alignAccelBytes(bufferSizes[end].outputSizeInBytes);
+            if (end > start &&
+                tempBytes + outputBytes + buildTempBytes + buildOutputBytes >
+                    MaxBVHBatchBytes)
+                break;
+            tempOffsets.push_back(tempBytes);
+            outputOffsets.push_back(outputBytes);
+            tempBytes += buildTempBytes;
+            outputBytes += buildOutputBytes;
+        }
+        size_t nBuilds = end - start;
+
+        // Allocate buffers shared by the batch's builds
+        char *tempBuffer, *outputBuffer;
+        CUDA_CHECK(cudaMalloc(&tempBuffer, tempBytes));
+        CUDA_CHECK(cudaMalloc(&outputBuffer, outputBytes));
+        uint64_t *compactedSizes;
+        CUDA_CHECK(cudaMalloc(&compactedSizes, nBuilds * sizeof(uint64_t)));
+
+        // Build; the compacted sizes of all of the BVHs are then read back
+        // with a single synchronization.
+        for (size_t i = 0; i < nBuilds; ++i) {
+            BVHBuild *build = pending[start + i];
+            const OptixAccelBufferSizes &sizes = bufferSizes[start + i];
+            OptixAccelEmitDesc emitDesc;
+            emitDesc.type = OPTIX_PROPERTY_TYPE_COMPACTED_SIZE;
+            emitDesc.result = CUdeviceptr(compactedSizes + i);
+            OPTIX_CHECK(optixAccelBuild(
+                optixContext, cudaStream, &accelOptions, build->buildInputs.data(),
+                build->buildInputs.size(), CUdeviceptr(tempBuffer + tempOffsets[i]),
+                sizes.tempSizeInBytes, CUdeviceptr(outputBuffer + outputOffsets[i]),
+                sizes.outputSizeInBytes, &build->handle, &emitDesc, 1));
+        }
+        std::vector<uint64_t> hostCompactedSizes(nBuilds);
+        CUDA_CHECK(cudaMemcpyAsync(hostCompactedSizes.data(), compactedSizes,
+                                   nBuilds * sizeof(uint64_t), cudaMemcpyDeviceToHost,
+                                   cudaStream));
+        CUDA_CHECK(cudaStreamSynchronize(cudaStream));
+
+        // Compact
+        for (size_t i = 0; i < nBuilds; ++i) {
+            BVHBuild *build = pending[start + i];
+            build->bufferBytes = hostCompactedSizes[i];
+            CUDA_CHECK(cudaMalloc(&build->buffer, build->bufferBytes));
+            gpuBVHBytes += build->bufferBytes;
+            OPTIX_CHECK(optixAccelCompact(optixContext, cudaStream, build->handle,
+                                          CUdeviceptr(build->buffer), build->bufferBytes,
+                                          &build->handle));
+        }
+        CUDA_CHECK(cudaStreamSynchronize(cudaStream));
 
-    CUDA_CHECK(cudaDeviceSynchronize());
+        CUDA_CHECK(cudaFree(tempBuffer));
+        CUDA_CHECK(cudaFree(outputBuffer));
+        CUDA_CHECK(cudaFree(compactedSizes));
+    }
+    // Wait for any relocations of cached GASs
+    CUDA_CHECK(cudaStreamSynchronize(cudaStream));
 
-    gpuBVHBytes += *compactedSizeBufferPtr;
+    for (BVHBuild *build : pending)
+        if (!build->cacheFilename.empty())
+            writeGASCache(*build);
+}
 
-    // Compact
-    void *asBuffer;
-    CUDA_CHECK(cudaMalloc(&asBuffer, *compactedSizeBufferPtr));
+#if (OPTIX_VERSION >= 70600)
+OptixBuildInputOpacityMicromap GPUAccel::buildOpacityMicromapArray(
+    const OpacityMicromap &omm, BVHBuild *build) {
+    // Convert micromaps to OptiX's 4-state format, using predefined indices
+    // for triangles that are entirely in one state
+    constexpr int DataAlignment = 16;
+    std::vector<uint8_t> data;
+    std::vector<OptixOpacityMicromapDesc> descs;
+    pstd::vector<int32_t> indices(omm.NumTriangles(), alloc);
+    int levelCounts[OpacityMicromap::MaxLevel + 1] = {};
+    for (size_t t = 0; t < omm.NumTriangles(); ++t) {
+        int level = omm.Level(t);
+        if (level == 0) {
+            switch (omm.MicroTriangleState(t, 0)) {
+            case OpacityMicromap::State::Transparent:
+                indices[t] = OPTIX_OPACITY_MICROMAP_PREDEFINED_INDEX_FULLY_TRANSPARENT;
+                break;
+            case OpacityMicromap::State::Opaque:
+                indices[t] = OPTIX_OPACITY_MICROMAP_PREDEFINED_INDEX_FULLY_OPAQUE;
+                break;
+            default:
+                indices[t] =
+                    OPTIX_OPACITY_MICROMAP_PREDEFINED_INDEX_FULLY_UNKNOWN_TRANSPARENT;
+            }
+            continue;
+        }
 
-    OPTIX_CHECK(optixAccelCompact(optixContext, cudaStream, traversableHandle,
-                                  CUdeviceptr(asBuffer), *compactedSizeBufferPtr,
-                                  &traversableHandle));
-    CUDA_CHECK(cudaDeviceSynchronize());
+        OptixOpacityMicromapDesc desc = {};
+        desc.byteOffset = data.size();
+        desc.subdivisionLevel = level;
+        desc.format = OPTIX_OPACITY_MICROMAP_FORMAT_4_STATE;
+        // OptiX orders micro-triangles along a space-filling curve; find
+        // each one's state from its centroid.
+        int nMicroTriangles = 1 << (2 * level);
+        data.resize(data.size() + RoundUp(nMicroTriangles / 4, DataAlignment));
+        for (int i = 0; i < nMicroTriangles; ++i) {
+            float2 b0, b1, b2;
+            optixMicromapIndexToBaseBarycentrics(i, level, b0, b1, b2);
+            Point2f centroid((b0.x + b1.x + b2.x) / 3, (b0.y + b1.y + b2.y) / 3);
+            uint8_t state = uint8_t(omm.Lookup(t, centroid));
+            data[desc.byteOffset + i / 4] |= state << (2 * (i % 4));
+        }
+        indices[t] = descs.size();
+        descs.push_back(desc);
+        ++levelCounts[level];
+    }
+    // Each micromap is used by one triangle, so the usage counts match the
+    // array's histogram, other than for an unused micromap added so that
+    // the array isn't empty.
+    std::vector<OptixOpacityMicromapHistogramEntry> histogram;
+    std::vector<OptixOpacityMicromapUsageCount> usageCounts;
+    for (int level = 1; level <= OpacityMicromap::MaxLevel; ++level)
+        if (levelCounts[level] > 0) {
+            histogram.push_back({(unsigned int)levelCounts[level], (unsigned int)level,
+                                 OPTIX_OPACITY_MICROMAP_FORMAT_4_STATE});
+            usageCounts.push_back({(unsigned int)levelCounts[level],
+                                   (unsigned int)level,
+                                   OPTIX_OPACITY_MICROMAP_FORMAT_4_STATE});
+        }
+    if (descs.empty()) {
+        OptixOpacityMicromapDesc desc = {};
+        desc.format = OPTIX_OPACITY_MICROMAP_FORMAT_4_STATE;
+        descs.push_back(desc);
+        data.resize(DataAlignment);
+        histogram.push_back({1, 0, OPTIX_OPACITY_MICROMAP_FORMAT_4_STATE});
+    }
 
+    // Copy micromap data to the GPU and build the array
+    void *dataBuffer, *descBuffer;
+    CUDA_CHECK(cudaMalloc(&dataBuffer, data.size()));
+    CUDA_CHECK(cudaMemcpy(dataBuffer, data.data(), data.size(), cudaMemcpyHostToDevice));
+    CUDA_CHECK(cudaMalloc(&descBuffer, descs.size() * sizeof(descs[0])));
+    CUDA_CHECK(cudaMemcpy(descBuffer, descs.data(), descs.size() * sizeof(descs[0]),
+                          cudaMemcpyHostToDevice));
+
+    OptixOpacityMicromapArrayBuildInput arrayInput = {};
+    arrayInput.flags = OPTIX_OPACITY_MICROMAP_FLAG_PREFER_FAST_TRACE;
+    arrayInput.inputBuffer = CUdeviceptr(dataBuffer);
+    arrayInput.perMicromapDescBuffer = CUdeviceptr(descBuffer);
+    arrayInput.perMicromapDescStrideInBytes = sizeof(OptixOpacityMicromapDesc);
+    arrayInput.numMicromapHistogramEntries = histogram.size();
+    arrayInput.micromapHistogramEntries = histogram.data();
+
+    OptixMicromapBufferSizes sizes;
+    OPTIX_CHECK(
+        optixOpacityMicromapArrayComputeMemoryUsage(optixContext, &arrayInput, &sizes));
+    void *tempBuffer, *arrayBuffer;
+    CUDA_CHECK(cudaMalloc(&tempBuffer, sizes.tempSizeInBytes));
+    CUDA_CHECK(cudaMalloc(&arrayBuffer, sizes.outputSizeInBytes));
+    OptixMicromapBuffers buffers = {};
+    buffers.output = CUdeviceptr(arrayBuffer);
+    buffers.outputSizeInBytes = sizes.outputSizeInBytes;
+    buffers.temp = CUdeviceptr(tempBuffer);
+    buffers.tempSizeInBytes = sizes.tempSizeInBytes;
+    OPTIX_CHECK(
+        optixOpacityMicromapArrayBuild(optixContext, cudaStream, &arrayInput, &buffers));
+    CUDA_CHECK(cudaStreamSynchronize(cudaStream));
     CUDA_CHECK(cudaFree(tempBuffer));
-    CUDA_CHECK(cudaFree(outputBuffer));
-    alloc.delete_object(compactedSizeBufferPtr);
-
-    return traversableHandle;
+    CUDA_CHECK(cudaFree(dataBuffer));
+    CUDA_CHECK(cudaFree(descBuffer));
+    gpuBVHBytes += sizes.outputSizeInBytes;
+
+    // Return the triangle input's micromap description; the array must
+    // outlive the GAS, while the indices are needed until it's built.
+    build->micromapIndices.push_back(std::move(indices));
+    build->micromapUsageCounts.push_back(std::move(usageCounts));
+    OptixBuildInputOpacityMicromap input = {};
+    input.indexingMode = OPTIX_OPACITY_MICROMAP_ARRAY_INDEXING_MODE_INDEXED;
+    input.opacityMicromapArray = CUdeviceptr(arrayBuffer);
+    input.indexBuffer = CUdeviceptr(build->micromapIndices.back().data());
+    input.indexSizeInBytes = sizeof(int32_t);
+    input.numMicromapUsageCounts = build->micromapUsageCounts.back().size();
+    input.micromapUsageCounts = build->micromapUsageCounts.back().data();
+    return input;
 }
+#endif  // OPTIX_VERSION >= 70600
 
 static MaterialHandle getMaterial(
     const ShapeSceneEntity &shape,
@@ -207,7 +533,7 @@ static MediumInterface *getMediumInterface(
                                              getMedium(shape.outsideMedium));
 }
 
-OptixTraversableHandle GPUAccel::createGASForTriangles(
+std::unique_ptr<GPUAccel::BVHBuild> GPUAccel::createGASForTriangles(
     const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
     const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
     const std::map<std::string, FloatTextureHandle> &floatTextures,
@@ -216,10 +542,6 @@ OptixTraversableHandle GPUAccel::createGASForTriangles(
     const std::map<std::string, MediumHandle> &media,
     const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
     Bounds3f *gasBounds) {
-    std::vector<OptixBuildInput> buildInputs;
-    std::vector<CUdeviceptr> pDeviceDevicePtrs;
-    std::vector<uint32_t> triangleInputFlags;
-
     // Allocate space for potentially all shapes being triangle meshes so
     // that we can write them in order (just potentially sparsely...)
     std::vector<TriangleMesh *> meshes(shapes.size(), nullptr);
@@ -298,11 +620,15 @@ OptixTraversableHandle GPUAccel::createGASForTriangles(
         }
     });
 
-    buildInputs.resize(meshesCreated.load());
+    if (meshesCreated.load() == 0)
+        return nullptr;
+
+    auto build = std::make_unique<BVHBuild>(alloc);
+    build->buildInputs.resize(meshesCreated.load());
     // Important so that these aren't reallocated so we can take pointers to
     // elements...
-    pDeviceDevicePtrs.resize(meshesCreated.load());
-    triangleInputFlags.resize(meshesCreated.load());
+    build->bufferPtrs.resize(meshesCreated.load());
+    build->flags.resize(meshesCreated.load());
 
     int buildIndex = 0;
     for (int shapeIndex = 0; shapeIndex < meshes.size(); ++shapeIndex) {
@@ -322,24 +648,36 @@ OptixTraversableHandle GPUAccel::createGASForTriangles(
         input.triangleArray.vertexFormat = OPTIX_VERTEX_FORMAT_FLOAT3;
         input.triangleArray.vertexStrideInBytes = sizeof(Point3f);
         input.triangleArray.numVertices = mesh->nVertices;
-        pDeviceDevicePtrs[buildIndex] = CUdeviceptr(mesh->p);
-        input.triangleArray.vertexBuffers = &pDeviceDevicePtrs[buildIndex];
+        build->bufferPtrs[buildIndex] = CUdeviceptr(mesh->p);
+        input.triangleArray.vertexBuffers = &build->bufferPtrs[buildIndex];
 
         input.triangleArray.indexFormat = OPTIX_INDICES_FORMAT_UNSIGNED_INT3;
         input.triangleArray.indexStrideInBytes = 3 * sizeof(int);
         input.triangleArray.numIndexTriplets = mesh->nTriangles;
         input.triangleArray.indexBuffer = CUdeviceptr(mesh->vertexIndices);
 
-        triangleInputFlags[buildIndex] =
+        build->flags[buildIndex] =
             getOptixGeometryFlags(true, alphaTextureHandle, materialHandle);
-        input.triangleArray.flags = &triangleInputFlags[buildIndex];
+        input.triangleArray.flags = &build->flags[buildIndex];
+
+#if (OPTIX_VERSION >= 70600)
+        // With an opacity micromap, the any-hit program only runs where the
+        // alpha texture's value at the hit isn't already known
+        if (alphaTextureHandle)
+            if (OpacityMicromap *omm =
+                    OpacityMicromap::Create(mesh, alphaTextureHandle, Allocator())) {
+                input.triangleArray.opacityMicromap =
+                    buildOpacityMicromapArray(*omm, build.get());
+                Allocator().delete_object(omm);
+            }
+#endif
 
         input.triangleArray.numSbtRecords = 1;
         input.triangleArray.sbtIndexOffsetBuffer = CUdeviceptr(nullptr);
         input.triangleArray.sbtIndexOffsetSizeInBytes = 0;
         input.triangleArray.sbtIndexOffsetStrideInBytes = 0;
 
-        buildInputs[buildIndex] = input;
+        build->buildInputs[buildIndex] = input;
 
         HitgroupRecord hgRecord;
         OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
@@ -370,13 +708,10 @@ OptixTraversableHandle GPUAccel::createGASForTriangles(
         ++buildIndex;
     }
 
-    if (buildInputs.empty())
-        return {};
-
-    return buildBVH(buildInputs);
+    return build;
 }
 
-OptixTraversableHandle GPUAccel::createGASForBLPs(
+std::unique_ptr<GPUAccel::BVHBuild> GPUAccel::createGASForBLPs(
     const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
     const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
     const std::map<std::string, FloatTextureHandle> &floatTextures,
@@ -385,10 +720,7 @@ OptixTraversableHandle GPUAccel::createGASForBLPs(
     const std::map<std::string, MediumHandle> &media,
     const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
     Bounds3f *gasBounds) {
-    std::vector<OptixBuildInput> buildInputs;
-    pstd::vector<OptixAabb> shapeAABBs(alloc);
-    std::vector<CUdeviceptr> aabbPtrs;
-    std::vector<uint32_t> flags;
+    auto build = std::make_unique<BVHBuild>(alloc);
 
     for (size_t shapeIndex = 0; shapeIndex < shapes.size(); ++shapeIndex) {
         const auto &shape = shapes[shapeIndex];
@@ -405,7 +737,7 @@ OptixTraversableHandle GPUAccel::createGASForBLPs(
         buildInput.customPrimitiveArray.numSbtRecords = 1;
         buildInput.customPrimitiveArray.numPrimitives = mesh->nVertices;
         // aabbBuffers and flags pointers are set when we're done
-        buildInputs.push_back(buildInput);
+        build->buildInputs.push_back(buildInput);
 
         Bounds3f shapeBounds;
         for (size_t i = 0; i < mesh->nVertices; ++i)
@@ -413,14 +745,15 @@ OptixTraversableHandle GPUAccel::createGASForBLPs(
 
         OptixAabb aabb = {shapeBounds.pMin.x, shapeBounds.pMin.y, shapeBounds.pMin.z,
                           shapeBounds.pMax.x, shapeBounds.pMax.y, shapeBounds.pMax.z};
-        shapeAABBs.push_back(aabb);
+        build->aabbs.push_back(aabb);
 
         *gasBounds = Union(*gasBounds, shapeBounds);
 
         MaterialHandle materialHandle = getMaterial(shape, namedMaterials, materials);
         FloatTextureHandle alphaTextureHandle = getAlphaTexture(shape, floatTextures, alloc);
 
-        flags.push_back(getOptixGeometryFlags(false, alphaTextureHandle, materialHandle));
+        build->flags.push_back(
+            getOptixGeometryFlags(false, alphaTextureHandle, materialHandle));
 
         HitgroupRecord hgRecord;
         OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
@@ -447,22 +780,22 @@ OptixTraversableHandle GPUAccel::createGASForBLPs(
         shadowHGRecords.push_back(hgRecord);
     }
 
-    if (buildInputs.empty())
-        return {};
+    if (build->buildInputs.empty())
+        return nullptr;
 
-    for (size_t i = 0; i < shapeAABBs.size(); ++i)
-        aabbPtrs.push_back(CUdeviceptr(&shapeAABBs[i]));
+    for (size_t i = 0; i < build->aabbs.size(); ++i)
+        build->bufferPtrs.push_back(CUdeviceptr(&build->aabbs[i]));
 
-    CHECK_EQ(buildInputs.size(), flags.size());
-    for (size_t i = 0; i < buildInputs.size(); ++i) {
-        buildInputs[i].customPrimitiveArray.aabbBuffers = &aabbPtrs[i];
-        buildInputs[i].customPrimitiveArray.flags = &flags[i];
+    CHECK_EQ(build->buildInputs.size(), build->flags.size());
+    for (size_t i = 0; i < build->buildInputs.size(); ++i) {
+        build->buildInputs[i].customPrimitiveArray.aabbBuffers = &build->bufferPtrs[i];
+        build->buildInputs[i].customPrimitiveArray.flags = &build->flags[i];
     }
 
-    return buildBVH(buildInputs);
+    return build;
 }
 
-OptixTraversableHandle GPUAccel::createGASForQuadrics(
+std::unique_ptr<GPUAccel::BVHBuild> GPUAccel::createGASForQuadrics(
     const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
     const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
     const std::map<std::string, FloatTextureHandle> &floatTextures,
@@ -471,10 +804,7 @@ OptixTraversableHandle GPUAccel::createGASForQuadrics(
     const std::map<std::string, MediumHandle> &media,
     const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
     Bounds3f *gasBounds) {
-    std::vector<OptixBuildInput> buildInputs;
-    pstd::vector<OptixAabb> shapeAABBs(alloc);
-    std::vector<CUdeviceptr> aabbPtrs;
-    std::vector<unsigned int> flags;
+    auto build = std::make_unique<BVHBuild>(alloc);
 
     for (size_t shapeIndex = 0; shapeIndex < shapes.size(); ++shapeIndex) {
         const auto &shape = shapes[shapeIndex];
@@ -497,19 +827,20 @@ OptixTraversableHandle GPUAccel::createGASForQuadrics(
         buildInput.customPrimitiveArray.numPrimitives = 1;
         // aabbBuffers and flags pointers are set when we're done
 
-        buildInputs.push_back(buildInput);
+        build->buildInputs.push_back(buildInput);
 
         Bounds3f shapeBounds = shapeHandle.Bounds();
         OptixAabb aabb = {shapeBounds.pMin.x, shapeBounds.pMin.y, shapeBounds.pMin.z,
                           shapeBounds.pMax.x, shapeBounds.pMax.y, shapeBounds.pMax.z};
-        shapeAABBs.push_back(aabb);
+        build->aabbs.push_back(aabb);
 
         *gasBounds = Union(*gasBounds, shapeBounds);
 
         // Find alpha texture, if present.
         MaterialHandle materialHandle = getMaterial(shape, namedMaterials, materials);
         FloatTextureHandle alphaTextureHandle = getAlphaTexture(shape, floatTextures, alloc);
-        flags.push_back(getOptixGeometryFlags(false, alphaTextureHandle, materialHandle));
+        build->flags.push_back(
+            getOptixGeometryFlags(false, alphaTextureHandle, materialHandle));
 
         HitgroupRecord hgRecord;
         OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
@@ -536,21 +867,170 @@ OptixTraversableHandle GPUAccel::createGASForQuadrics(
         shadowHGRecords.push_back(hgRecord);
     }
 
-    if (buildInputs.empty())
-        return {};
+    if (build->buildInputs.empty())
+        return nullptr;
 
-    for (size_t i = 0; i < shapeAABBs.size(); ++i)
-        aabbPtrs.push_back(CUdeviceptr(&shapeAABBs[i]));
+    for (size_t i = 0; i < build->aabbs.size(); ++i)
+        build->bufferPtrs.push_back(CUdeviceptr(&build->aabbs[i]));
 
-    CHECK_EQ(buildInputs.size(), flags.size());
-    for (size_t i = 0; i < buildInputs.size(); ++i) {
-        buildInputs[i].customPrimitiveArray.aabbBuffers = &aabbPtrs[i];
-        buildInputs[i].customPrimitiveArray.flags = &flags[i];
+    CHECK_EQ(build->buildInputs.size(), build->flags.size());
+    for (size_t i = 0; i < build->buildInputs.size(); ++i) {
+        build->buildInputs[i].customPrimitiveArray.aabbBuffers = &build->bufferPtrs[i];
+        build->buildInputs[i].customPrimitiveArray.flags = &build->flags[i];
     }
 
-    return buildBVH(buildInputs);
+    return build;
 }
 
+#if (OPTIX_VERSION >= 70200)
+std::unique_ptr<GPUAccel::BVHBuild> GPUAccel::createGASForCurves(
+    const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
+    const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
+    const std::map<std::string, FloatTextureHandle> &floatTextures,
+    const std::map<std::string, MaterialHandle> &namedMaterials,
+    const std::vector<MaterialHandle> &materials,
+    const std::map<std::string, MediumHandle> &media,
+    const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
+    Bounds3f *gasBounds) {
+    auto build = std::make_unique<BVHBuild>(alloc);
+    std::vector<CUdeviceptr> vertexPtrs, radiusPtrs;
+
+    for (size_t shapeIndex = 0; shapeIndex < shapes.size(); ++shapeIndex) {
+        const auto &shape = shapes[shapeIndex];
+        if (shape.name != "curve" && shape.name != "curveset")
+            continue;
+
+        // Each of the Curves returned here covers part of one of the
+        // shape's Bezier segments; each becomes a single OptiX curve
+        // segment so that primitive indices match the area light indices.
+        // Curve sets have a separate _CurveCommon_ for each of their curves.
+        pstd::vector<ShapeHandle> shapeHandles = ShapeHandle::Create(
+            shape.name, shape.renderFromObject, shape.objectFromRender,
+            shape.reverseOrientation, shape.parameters, &shape.loc, alloc);
+        if (shapeHandles.empty())
+            continue;
+
+        CurveType type = shapeHandles[0].Cast<Curve>()->Common()->type;
+        if (type != CurveType::Cylinder)
+            Warning(&shape.loc, "%s curves are rendered as cylinders on the GPU.",
+                    ToString(type));
+
+        // Widths are given in object space; scale them by the transformation's
+        // average scale along the coordinate axes
+        const Transform &renderFromObject = *shape.renderFromObject;
+        Float widthScale = (Length(renderFromObject(Vector3f(1, 0, 0))) +
+                            Length(renderFromObject(Vector3f(0, 1, 0))) +
+                            Length(renderFromObject(Vector3f(0, 0, 1)))) /
+                           3;
+
+        int nSegments = shapeHandles.size();
+        Point3f *cp = alloc.allocate_object<Point3f>(4 * nSegments);
+        Float *radius = alloc.allocate_object<Float>(4 * nSegments);
+        Point2f *uRange = alloc.allocate_object<Point2f>(nSegments);
+        unsigned int *indices = alloc.allocate_object<unsigned int>(nSegments);
+        Bounds3f shapeBounds;
+        for (int i = 0; i < nSegments; ++i) {
+            const Curve *curve = shapeHandles[i].Cast<Curve>();
+            const CurveCommon *common = curve->Common();
+            Float uMin = curve->UMin(), uMax = curve->UMax();
+            pstd::array<Point3f, 4> b =
+                CubicBezierControlPoints(pstd::span<const Point3f>(common->cpObj),
+                                         uMin, uMax);
+            for (int j = 0; j < 4; ++j)
+                b[j] = renderFromObject(b[j]);
+
+            // Convert the segment's Bezier control points to the uniform
+            // cubic B-spline basis, which describes the same curve
+            Point3f *p = cp + 4 * i;
+            p[0] = Point3f(6 * Vector3f(b[0]) - 7 * Vector3f(b[1]) + 2 * Vector3f(b[2]));
+            p[1] = Point3f(2 * Vector3f(b[1]) - Vector3f(b[2]));
+            p[2] = Point3f(2 * Vector3f(b[2]) - Vector3f(b[1]));
+            p[3] = Point3f(2 * Vector3f(b[1]) - 7 * Vector3f(b[2]) + 6 * Vector3f(b[3]));
+
+            // The radius varies linearly along the curve; the B-spline
+            // coefficients that reproduce it are evenly spaced and extend one
+            // segment length beyond each end.
+            Float r0 = widthScale * Lerp(uMin, common->width[0], common->width[1]) / 2;
+            Float r1 = widthScale * Lerp(uMax, common->width[0], common->width[1]) / 2;
+            for (int j = 0; j < 4; ++j)
+                radius[4 * i + j] = std::max<Float>(0, Lerp(j - 1, r0, r1));
+
+            uRange[i] = Point2f(uMin, uMax);
+            indices[i] = 4 * i;
+
+            Float rMax = std::max(r0, r1);
+            for (int j = 0; j < 4; ++j)
+                shapeBounds = Union(shapeBounds, b[j]);
+            shapeBounds = Expand(shapeBounds, rMax);
+        }
+
+        OptixBuildInput buildInput = {};
+        buildInput.type = OPTIX_BUILD_INPUT_TYPE_CURVES;
+        buildInput.curveArray.curveType = OPTIX_PRIMITIVE_TYPE_ROUND_CUBIC_BSPLINE;
+        buildInput.curveArray.numPrimitives = nSegments;
+        buildInput.curveArray.numVertices = 4 * nSegments;
+        buildInput.curveArray.vertexStrideInBytes = sizeof(Point3f);
+        buildInput.curveArray.widthStrideInBytes = sizeof(Float);
+        buildInput.curveArray.indexBuffer = CUdeviceptr(indices);
+        buildInput.curveArray.indexStrideInBytes = sizeof(unsigned int);
+        // vertexBuffers and widthBuffers pointers are set when we're done
+        vertexPtrs.push_back(CUdeviceptr(cp));
+        radiusPtrs.push_back(CUdeviceptr(radius));
+
+        *gasBounds = Union(*gasBounds, shapeBounds);
+
+        MaterialHandle materialHandle = getMaterial(shape, namedMaterials, materials);
+        FloatTextureHandle alphaTextureHandle = getAlphaTexture(shape, floatTextures, alloc);
+        // As with triangles, alpha is tested in the any-hit program
+        buildInput.curveArray.flag =
+            getOptixGeometryFlags(true, alphaTextureHandle, materialHandle);
+        build->buildInputs.push_back(buildInput);
+
+        HitgroupRecord hgRecord;
+        OPTIX_CHECK(optixSbtRecordPackHeader(intersectPG, &hgRecord));
+        hgRecord.curveRec.cp = cp;
+        hgRecord.curveRec.radius = radius;
+        hgRecord.curveRec.uRange = uRange;
+        hgRecord.curveRec.reverseOrientation = shape.reverseOrientation;
+        hgRecord.curveRec.material = materialHandle;
+        hgRecord.curveRec.alphaTexture = alphaTextureHandle;
+        hgRecord.curveRec.areaLights = {};
+        if (shape.lightIndex != -1) {
+            auto iter = shapeIndexToAreaLights.find(shapeIndex);
+            // Note: this will hit if we try to have an instance as an area
+            // light.
+            CHECK(iter != shapeIndexToAreaLights.end());
+            CHECK_EQ(iter->second->size(), nSegments);
+            hgRecord.curveRec.areaLights = pstd::MakeSpan(*iter->second);
+        }
+        hgRecord.curveRec.mediumInterface = getMediumInterface(shape, media, alloc);
+
+        intersectHGRecords.push_back(hgRecord);
+
+        OPTIX_CHECK(optixSbtRecordPackHeader(randomHitPG, &hgRecord));
+        randomHitHGRecords.push_back(hgRecord);
+
+        OPTIX_CHECK(optixSbtRecordPackHeader(shadowPG, &hgRecord));
+        shadowHGRecords.push_back(hgRecord);
+    }
+
+    if (build->buildInputs.empty())
+        return nullptr;
+
+    // Vertex and radius buffer pointers are interleaved in _bufferPtrs_
+    for (size_t i = 0; i < build->buildInputs.size(); ++i) {
+        build->bufferPtrs.push_back(vertexPtrs[i]);
+        build->bufferPtrs.push_back(radiusPtrs[i]);
+    }
+    for (size_t i = 0; i < build->buildInputs.size(); ++i) {
+        build->buildInputs[i].curveArray.vertexBuffers = &build->bufferPtrs[2 * i];
+        build->buildInputs[i].curveArray.widthBuffers = &build->bufferPtrs[2 * i + 1];
+    }
+
+    return build;
+}
+#endif  // OPTIX_VERSION >= 70200
+
 static void logCallback(unsigned int level, const char* tag, const char* message, void* cbdata) {
     if (level <= 2)
         LOG_ERROR("OptiX: %s: %s", tag, message);
@@ -563,6 +1043,7 @@ GPUAccel::GPUAccel(
     const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
     const std::map<std::string, MediumHandle> &media,
     pstd::array<bool, MaterialHandle::NumTags()> *haveBasicEvalMaterial,
+    pstd::array<bool, MaterialHandle::NumTags()> *haveNonConstantBasicEvalMaterial,
     pstd::array<bool, MaterialHandle::NumTags()> *haveUniversalEvalMaterial,
     bool *haveSubsurface)
     : alloc(alloc),
@@ -600,6 +1081,23 @@ GPUAccel::GPUAccel(
     LOG_VERBOSE("Optix version %d.%d.%d successfully initialized", OPTIX_VERSION / 10000,
                 (OPTIX_VERSION % 10000) / 100, OPTIX_VERSION % 100);
 
+    // Enable OptiX's disk cache so that modules compiled from the embedded
+    // PTX are reused by later runs. It can be disabled by setting the
+    // OPTIX_CACHE_MAXSIZE environment variable to zero, in which case
+    // enabling it fails.
+    if (optixDeviceContextSetCacheEnabled(optixContext, 1) == OPTIX_SUCCESS) {
+        if (!Options->bvhCacheDirectory.empty())
+            OPTIX_CHECK(optixDeviceContextSetCacheLocation(
+                optixContext, Options->bvhCacheDirectory.c_str()));
+        OPTIX_CHECK(optixDeviceContextSetCacheDatabaseSizes(
+            optixContext, OptiXCacheLowWaterBytes, OptiXCacheHighWaterBytes));
+        char cacheLocation[1024];
+        OPTIX_CHECK(optixDeviceContextGetCacheLocation(optixContext, cacheLocation,
+                                                       sizeof(cacheLocation)));
+        LOG_VERBOSE("OptiX disk cache location: %s", cacheLocation);
+    } else
+        LOG_VERBOSE("OptiX disk cache is disabled");
+
     // OptiX module
     OptixModuleCompileOptions moduleCompileOptions = {};
     // TODO: REVIEW THIS
@@ -622,6 +1120,14 @@ GPUAccel::GPUAccel(
         (OPTIX_EXCEPTION_FLAG_STACK_OVERFLOW | OPTIX_EXCEPTION_FLAG_TRACE_DEPTH |
          OPTIX_EXCEPTION_FLAG_DEBUG);
     pipelineCompileOptions.pipelineLaunchParamsVariableName = "params";
+#if (OPTIX_VERSION >= 70600)
+    pipelineCompileOptions.allowOpacityMicromaps = 1;
+#endif
+#if (OPTIX_VERSION >= 70200)
+    pipelineCompileOptions.usesPrimitiveTypeFlags =
+        (OPTIX_PRIMITIVE_TYPE_FLAGS_CUSTOM | OPTIX_PRIMITIVE_TYPE_FLAGS_TRIANGLE |
+         OPTIX_PRIMITIVE_TYPE_FLAGS_ROUND_CUBIC_BSPLINE);
+#endif
 
     OptixPipelineLinkOptions pipelineLinkOptions = {};
     pipelineLinkOptions.maxTraceDepth = 2;
@@ -635,6 +1141,7 @@ GPUAccel::GPUAccel(
 
     char log[4096];
     size_t logSize = sizeof(log);
+    Timer moduleTimer;
     OPTIX_CHECK_WITH_LOG(
         optixModuleCreateFromPTX(optixContext, &moduleCompileOptions,
                                  &pipelineCompileOptions, ptxCode.c_str(),
@@ -642,7 +1149,23 @@ GPUAccel::GPUAccel(
         log);
     LOG_VERBOSE("%s", log);
 
+#if (OPTIX_VERSION >= 70200)
+    // Curves are intersected by OptiX's built-in intersection program
+    OptixModule curveISModule;
+    OptixBuiltinISOptions builtinISOptions = {};
+    builtinISOptions.builtinISModuleType = OPTIX_PRIMITIVE_TYPE_ROUND_CUBIC_BSPLINE;
+#if (OPTIX_VERSION >= 70400)
+    builtinISOptions.buildFlags = AccelBuildFlags;
+#endif
+    OPTIX_CHECK(optixBuiltinISModuleGet(optixContext, &moduleCompileOptions,
+                                        &pipelineCompileOptions, &builtinISOptions,
+                                        &curveISModule));
+#endif
+    optixModuleMS += int64_t(1000 * moduleTimer.ElapsedSeconds());
+    LOG_VERBOSE("OptiX module creation took %.3fs", moduleTimer.ElapsedSeconds());
+
     // Optix program groups...
+    Timer pipelineTimer;
     OptixProgramGroupOptions pgOptions = {};
     OptixProgramGroup raygenPGClosest;
     {
@@ -710,6 +1233,23 @@ GPUAccel::GPUAccel(
         LOG_VERBOSE("%s", log);
     }
 
+#if (OPTIX_VERSION >= 70200)
+    OptixProgramGroup hitPGCurve;
+    {
+        OptixProgramGroupDesc desc = {};
+        desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        desc.hitgroup.moduleCH = optixModule;
+        desc.hitgroup.entryFunctionNameCH = "__closesthit__curve";
+        desc.hitgroup.moduleAH = optixModule;
+        desc.hitgroup.entryFunctionNameAH = "__anyhit__curve";
+        desc.hitgroup.moduleIS = curveISModule;
+        OPTIX_CHECK_WITH_LOG(optixProgramGroupCreate(optixContext, &desc, 1, &pgOptions,
+                                                     log, &logSize, &hitPGCurve),
+                             log);
+        LOG_VERBOSE("%s", log);
+    }
+#endif
+
     OptixProgramGroup raygenPGShadow;
     {
         OptixProgramGroupDesc desc = {};
@@ -801,6 +1341,22 @@ GPUAccel::GPUAccel(
         LOG_VERBOSE("%s", log);
     }
 
+#if (OPTIX_VERSION >= 70200)
+    OptixProgramGroup anyhitPGShadowCurve;
+    {
+        OptixProgramGroupDesc desc = {};
+        desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        desc.hitgroup.moduleIS = curveISModule;
+        desc.hitgroup.moduleAH = optixModule;
+        desc.hitgroup.entryFunctionNameAH = "__anyhit__shadowCurve";
+        OPTIX_CHECK_WITH_LOG(
+            optixProgramGroupCreate(optixContext, &desc, 1, &pgOptions, log, &logSize,
+                                    &anyhitPGShadowCurve),
+            log);
+        LOG_VERBOSE("%s", log);
+    }
+#endif
+
     OptixProgramGroup raygenPGRandomHit;
     {
         OptixProgramGroupDesc desc = {};
@@ -856,6 +1412,22 @@ GPUAccel::GPUAccel(
         LOG_VERBOSE("%s", log);
     }
 
+#if (OPTIX_VERSION >= 70200)
+    OptixProgramGroup hitPGRandomHitCurve;
+    {
+        OptixProgramGroupDesc desc = {};
+        desc.kind = OPTIX_PROGRAM_GROUP_KIND_HITGROUP;
+        desc.hitgroup.moduleIS = curveISModule;
+        desc.hitgroup.moduleAH = optixModule;
+        desc.hitgroup.entryFunctionNameAH = "__anyhit__randomHitCurve";
+        OPTIX_CHECK_WITH_LOG(
+            optixProgramGroupCreate(optixContext, &desc, 1, &pgOptions, log, &logSize,
+                                    &hitPGRandomHitCurve),
+            log);
+        LOG_VERBOSE("%s", log);
+    }
+#endif
+
     // Optix pipeline...
     OptixProgramGroup allPGs[] = {raygenPGClosest,
                                   missPGNoOp,
@@ -872,13 +1444,21 @@ GPUAccel::GPUAccel(
                                   raygenPGRandomHit,
                                   hitPGRandomHitTriangle,
                                   hitPGRandomHitBilinearPatch,
-                                  hitPGRandomHitQuadric};
+                                  hitPGRandomHitQuadric,
+#if (OPTIX_VERSION >= 70200)
+                                  hitPGCurve,
+                                  anyhitPGShadowCurve,
+                                  hitPGRandomHitCurve
+#endif
+    };
     OPTIX_CHECK_WITH_LOG(
         optixPipelineCreate(optixContext, &pipelineCompileOptions, &pipelineLinkOptions,
                             allPGs, sizeof(allPGs) / sizeof(allPGs[0]), log, &logSize,
                             &optixPipeline),
         log);
     LOG_VERBOSE("%s", log);
+    optixPipelineMS += int64_t(1000 * pipelineTimer.ElapsedSeconds());
+    LOG_VERBOSE("OptiX pipeline creation took %.3fs", pipelineTimer.ElapsedSeconds());
 
 #if 0
     OPTIX_CHECK(optixPipelineSetStackSize(
@@ -957,9 +1537,14 @@ GPUAccel::GPUAccel(
 
         FloatTextureHandle displace = m.GetDisplacement();
         if (m.CanEvaluateTextures(BasicTextureEvaluator()) &&
-            (!displace || BasicTextureEvaluator().CanEvaluate({displace}, {})))
+            (!displace || BasicTextureEvaluator().CanEvaluate({displace}, {}))) {
             (*haveBasicEvalMaterial)[m.Tag()] = true;
-        else
+            // Record whether the basic evaluator's image lookups are needed;
+            // if not, a kernel specialized for constant textures is used
+            if (!m.CanEvaluateTextures(ConstantTextureEvaluator()) ||
+                (displace && !ConstantTextureEvaluator().CanEvaluate({displace}, {})))
+                (*haveNonConstantBasicEvalMaterial)[m.Tag()] = true;
+        } else
             (*haveUniversalEvalMaterial)[m.Tag()] = true;
     };
     for (MaterialHandle m : materials)
@@ -967,24 +1552,98 @@ GPUAccel::GPUAccel(
     for (const auto &m : namedMaterials)
         updateMaterialNeeds(m.second);
 
-    for (const auto &shape : scene.shapes)
+    for (const auto &shape : scene.shapes) {
+#if (OPTIX_VERSION < 70200)
+        if (shape.name == "curve" || shape.name == "curveset")
+            ErrorExit(&shape.loc, "%s: OptiX 7.2 or later is required for curves "
+                                  "with the GPU renderer",
+                      shape.name);
+#endif
         if (shape.name != "sphere" && shape.name != "cylinder" && shape.name != "disk" &&
             shape.name != "trianglemesh" && shape.name != "plymesh" &&
-            shape.name != "loopsubdiv" && shape.name != "bilinearmesh")
+            shape.name != "loopsubdiv" && shape.name != "bilinearmesh" &&
+            shape.name != "curve" && shape.name != "curveset")
             ErrorExit(&shape.loc, "%s: unknown shape", shape.name);
+    }
 
-    OptixTraversableHandle triangleGASTraversable = createGASForTriangles(
+    std::unique_ptr<BVHBuild> triangleGAS = createGASForTriangles(
         scene.shapes, hitPGTriangle, anyhitPGShadowTriangle, hitPGRandomHitTriangle,
         textures.floatTextures, namedMaterials, materials, media, shapeIndexToAreaLights, &bounds);
     int bilinearSBTOffset = intersectHGRecords.size();
-    OptixTraversableHandle bilinearPatchGASTraversable =
+    std::unique_ptr<BVHBuild> bilinearPatchGAS =
         createGASForBLPs(scene.shapes, hitPGBilinearPatch, anyhitPGShadowBilinearPatch,
                          hitPGRandomHitBilinearPatch, textures.floatTextures, namedMaterials,
                          materials, media, shapeIndexToAreaLights, &bounds);
     int quadricSBTOffset = intersectHGRecords.size();
-    OptixTraversableHandle quadricGASTraversable = createGASForQuadrics(
+    std::unique_ptr<BVHBuild> quadricGAS = createGASForQuadrics(
         scene.shapes, hitPGQuadric, anyhitPGShadowQuadric, hitPGRandomHitQuadric,
         textures.floatTextures, namedMaterials, materials, media, shapeIndexToAreaLights, &bounds);
+    int curveSBTOffset = intersectHGRecords.size();
+    std::unique_ptr<BVHBuild> curveGAS;
+#if (OPTIX_VERSION >= 70200)
+    curveGAS = createGASForCurves(scene.shapes, hitPGCurve, anyhitPGShadowCurve,
+                                  hitPGRandomHitCurve, textures.floatTextures,
+                                  namedMaterials, materials, media,
+                                  shapeIndexToAreaLights, &bounds);
+#endif
+
+    // Create GASs for instance definitions
+    // Each definition's geometry is built once, with one GAS per shape
+    // type; instances then refer to those GASs from the top-level IAS so
+    // that GPU memory use scales with unique geometry.
+    struct InstanceGASs {
+        std::unique_ptr<BVHBuild> triangleGAS, bilinearPatchGAS, quadricGAS, curveGAS;
+        int triangleSBTOffset, bilinearPatchSBTOffset, quadricSBTOffset, curveSBTOffset;
+        Bounds3f bounds;
+    };
+    std::map<std::string, InstanceGASs> instanceMap;
+    for (const auto &def : scene.instanceDefinitions) {
+        if (!def.second.animatedShapes.empty())
+            Warning("Ignoring %d animated shapes in instance \"%s\".",
+                    def.second.animatedShapes.size(), def.first);
+
+        InstanceGASs inst;
+        inst.triangleSBTOffset = intersectHGRecords.size();
+        inst.triangleGAS = createGASForTriangles(
+            def.second.shapes, hitPGTriangle, anyhitPGShadowTriangle,
+            hitPGRandomHitTriangle, textures.floatTextures, namedMaterials, materials,
+            media, {}, &inst.bounds);
+        inst.bilinearPatchSBTOffset = intersectHGRecords.size();
+        inst.bilinearPatchGAS = createGASForBLPs(
+            def.second.shapes, hitPGBilinearPatch, anyhitPGShadowBilinearPatch,
+            hitPGRandomHitBilinearPatch, textures.floatTextures, namedMaterials,
+            materials, media, {}, &inst.bounds);
+        inst.quadricSBTOffset = intersectHGRecords.size();
+        inst.quadricGAS = createGASForQuadrics(
+            def.second.shapes, hitPGQuadric, anyhitPGShadowQuadric,
+            hitPGRandomHitQuadric, textures.floatTextures, namedMaterials, materials,
+            media, {}, &inst.bounds);
+        inst.curveSBTOffset = intersectHGRecords.size();
+#if (OPTIX_VERSION >= 70200)
+        inst.curveGAS = createGASForCurves(
+            def.second.shapes, hitPGCurve, anyhitPGShadowCurve, hitPGRandomHitCurve,
+            textures.floatTextures, namedMaterials, materials, media, {}, &inst.bounds);
+#endif
+        instanceMap[def.first] = std::move(inst);
+    }
+
+    // Build all of the GASs together
+    std::vector<BVHBuild *> gasBuilds;
+    auto addBuild = [&](const std::unique_ptr<BVHBuild> &build) {
+        if (build)
+            gasBuilds.push_back(build.get());
+    };
+    addBuild(triangleGAS);
+    addBuild(bilinearPatchGAS);
+    addBuild(quadricGAS);
+    addBuild(curveGAS);
+    for (const auto &inst : instanceMap) {
+        addBuild(inst.second.triangleGAS);
+        addBuild(inst.second.bilinearPatchGAS);
+        addBuild(inst.second.quadricGAS);
+        addBuild(inst.second.curveGAS);
+    }
+    buildBVHs(gasBuilds);
 
     pstd::vector<OptixInstance> iasInstances(alloc);
 
@@ -994,47 +1653,31 @@ GPUAccel::GPUAccel(
     gasInstance.visibilityMask = 255;
     gasInstance.flags =
         OPTIX_INSTANCE_FLAG_NONE;  // TODO: OPTIX_INSTANCE_FLAG_DISABLE_ANYHIT
-    if (triangleGASTraversable) {
-        gasInstance.traversableHandle = triangleGASTraversable;
+    if (triangleGAS) {
+        gasInstance.traversableHandle = triangleGAS->handle;
         gasInstance.sbtOffset = 0;
         iasInstances.push_back(gasInstance);
     }
-    if (bilinearPatchGASTraversable) {
-        gasInstance.traversableHandle = bilinearPatchGASTraversable;
+    if (bilinearPatchGAS) {
+        gasInstance.traversableHandle = bilinearPatchGAS->handle;
         gasInstance.sbtOffset = bilinearSBTOffset;
         iasInstances.push_back(gasInstance);
     }
-    if (quadricGASTraversable) {
-        gasInstance.traversableHandle = quadricGASTraversable;
+    if (quadricGAS) {
+        gasInstance.traversableHandle = quadricGAS->handle;
         gasInstance.sbtOffset = quadricSBTOffset;
         iasInstances.push_back(gasInstance);
     }
-
-    // Create GASs for instance definitions
-    // TODO: better name here...
-    struct Instance {
-        OptixTraversableHandle handle;
-        Bounds3f bounds;
-        int sbtOffset;
-    };
-    std::map<std::string, Instance> instanceMap;
-    for (const auto &def : scene.instanceDefinitions) {
-        if (!def.second.animatedShapes.empty())
-            Warning("Ignoring %d animated shapes in instance \"%s\".",
-                    def.second.animatedShapes.size(), def.first);
-
-        Instance inst;
-        inst.sbtOffset = intersectHGRecords.size();
-        inst.handle = createGASForTriangles(
-            def.second.shapes, hitPGTriangle, anyhitPGShadowTriangle,
-            hitPGRandomHitTriangle, textures.floatTextures, namedMaterials, materials, media, {},
-            &inst.bounds);
-        instanceMap[def.first] = inst;
+    if (curveGAS) {
+        gasInstance.traversableHandle = curveGAS->handle;
+        gasInstance.sbtOffset = curveSBTOffset;
+        iasInstances.push_back(gasInstance);
     }
 
     // Create OptixInstances for instances
     for (const auto &inst : scene.instances) {
-        if (instanceMap.find(inst.name) == instanceMap.end())
+        auto iter = instanceMap.find(inst.name);
+        if (iter == instanceMap.end())
             ErrorExit(&inst.loc, "%s: object instance not defined.", inst.name);
 
         if (inst.renderFromInstance == nullptr) {
@@ -1043,14 +1686,14 @@ GPUAccel::GPUAccel(
             continue;
         }
 
-        const Instance &in = instanceMap[inst.name];
-        if (!in.handle) {
+        const InstanceGASs &in = iter->second;
+        if (!in.triangleGAS && !in.bilinearPatchGAS && !in.quadricGAS && !in.curveGAS) {
             // Warning(&inst.loc, "Skipping instance of empty instance
             // definition");
             continue;
         }
 
-        bounds = Union(bounds, (*inst.renderFromInstance)(instanceMap[inst.name].bounds));
+        bounds = Union(bounds, (*inst.renderFromInstance)(in.bounds));
 
         OptixInstance optixInstance = {};
         for (int i = 0; i < 3; ++i)
@@ -1058,12 +1701,29 @@ GPUAccel::GPUAccel(
                 optixInstance.transform[4 * i + j] =
                     inst.renderFromInstance->GetMatrix()[i][j];
         optixInstance.visibilityMask = 255;
-        optixInstance.sbtOffset = instanceMap[inst.name].sbtOffset;
         optixInstance.flags =
             OPTIX_INSTANCE_FLAG_NONE;  // TODO:
                                        // OPTIX_INSTANCE_FLAG_DISABLE_ANYHIT
-        optixInstance.traversableHandle = instanceMap[inst.name].handle;
-        iasInstances.push_back(optixInstance);
+        if (in.triangleGAS) {
+            optixInstance.traversableHandle = in.triangleGAS->handle;
+            optixInstance.sbtOffset = in.triangleSBTOffset;
+            iasInstances.push_back(optixInstance);
+        }
+        if (in.bilinearPatchGAS) {
+            optixInstance.traversableHandle = in.bilinearPatchGAS->handle;
+            optixInstance.sbtOffset = in.bilinearPatchSBTOffset;
+            iasInstances.push_back(optixInstance);
+        }
+        if (in.quadricGAS) {
+            optixInstance.traversableHandle = in.quadricGAS->handle;
+            optixInstance.sbtOffset = in.quadricSBTOffset;
+            iasInstances.push_back(optixInstance);
+        }
+        if (in.curveGAS) {
+            optixInstance.traversableHandle = in.curveGAS->handle;
+            optixInstance.sbtOffset = in.curveSBTOffset;
+            iasInstances.push_back(optixInstance);
+        }
     }
 
     // Build the top-level IAS
@@ -1071,9 +1731,11 @@ GPUAccel::GPUAccel(
     buildInput.type = OPTIX_BUILD_INPUT_TYPE_INSTANCES;
     buildInput.instanceArray.instances = CUdeviceptr(iasInstances.data());
     buildInput.instanceArray.numInstances = iasInstances.size();
-    std::vector<OptixBuildInput> buildInputs = {buildInput};
+    BVHBuild iasBuild(alloc);
+    iasBuild.buildInputs = {buildInput};
 
-    rootTraversable = buildBVH({buildInput});
+    buildBVHs({&iasBuild});
+    rootTraversable = iasBuild.handle;
 
     if (!scene.animatedShapes.empty())
         Warning("Ignoring %d animated shapes", scene.animatedShapes.size());
@@ -1100,9 +1762,20 @@ GPUAccel::ParamBufferState &GPUAccel::getParamBuffer(
     const RayIntersectParameters &params) const {
     CHECK(nextParamOffset < paramsPool.size());
 
+    int nTried = 0;
+    while (paramsPool[nextParamOffset].reserved) {
+        if (++nextParamOffset == paramsPool.size())
+            nextParamOffset = 0;
+        if (++nTried == paramsPool.size())
+            LOG_FATAL("All %d ray intersection parameter buffers are in use by "
+                      "CUDA graphs.", paramsPool.size());
+    }
+
     ParamBufferState &pbs = paramsPool[nextParamOffset];
     if (++nextParamOffset == paramsPool.size())
         nextParamOffset = 0;
+    if (GPUStreamIsCapturing())
+        pbs.reserved = true;
     if (!pbs.used)
         pbs.used = true;
     else
@@ -1111,7 +1784,7 @@ GPUAccel::ParamBufferState &GPUAccel::getParamBuffer(
     // Copy to host-side pinned memory
     memcpy(pbs.hostPtr, &params, sizeof(params));
     CUDA_CHECK(cudaMemcpyAsync((void *)pbs.ptr, pbs.hostPtr, sizeof(params),
-                               cudaMemcpyHostToDevice));
+                               cudaMemcpyHostToDevice, GPUStream()));
 
     return pbs;
 }
@@ -1122,10 +1795,13 @@ void GPUAccel::IntersectClosest(
     MaterialEvalQueue *universalEvalMaterialQueue,
     MediumSampleQueue *mediumSampleQueue,
     RayQueue *rayQueue, RayQueue *nextRayQueue) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events =
-        GetProfilerEvents("Tracing closest hit rays");
-
-    cudaEventRecord(events.first);
+    // Kernels being captured into a CUDA graph are profiled with the graph.
+    bool capturing = GPUStreamIsCapturing();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing closest hit rays");
+        cudaEventRecord(events.first, GPUStream());
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
@@ -1147,28 +1823,35 @@ void GPUAccel::IntersectClosest(
         nvtxRangePush("GPUAccel::IntersectClosest");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, GPUStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &intersectSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!pbs.reserved)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent, GPUStream()));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
-        LOG_VERBOSE("Post-sync triangle intersect closest");
+        if (!capturing) {
+            CUDA_CHECK(cudaDeviceSynchronize());
+            LOG_VERBOSE("Post-sync triangle intersect closest");
+        }
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second, GPUStream());
 };
 
 void GPUAccel::IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue,
                                SOA<PixelSampleState> *pixelSampleState) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents("Tracing shadow rays");
-
-    cudaEventRecord(events.first);
+    bool capturing = GPUStreamIsCapturing();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing shadow rays");
+        cudaEventRecord(events.first, GPUStream());
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
@@ -1185,28 +1868,35 @@ void GPUAccel::IntersectShadow(int maxRays, ShadowRayQueue *shadowRayQueue,
         nvtxRangePush("GPUAccel::IntersectShadow");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, GPUStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &shadowSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!pbs.reserved)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent, GPUStream()));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
-        LOG_VERBOSE("Post-sync intersect shadow");
+        if (!capturing) {
+            CUDA_CHECK(cudaDeviceSynchronize());
+            LOG_VERBOSE("Post-sync intersect shadow");
+        }
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second, GPUStream());
 }
 
 void GPUAccel::IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
                                  SOA<PixelSampleState> *pixelSampleState) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents("Tracing shadow Tr rays");
-
-    cudaEventRecord(events.first);
+    bool capturing = GPUStreamIsCapturing();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing shadow Tr rays");
+        cudaEventRecord(events.first, GPUStream());
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
@@ -1223,29 +1913,35 @@ void GPUAccel::IntersectShadowTr(int maxRays, ShadowRayQueue *shadowRayQueue,
         nvtxRangePush("GPUAccel::IntersectShadowTr");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, GPUStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &shadowTrSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!pbs.reserved)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent, GPUStream()));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
-        LOG_VERBOSE("Post-sync intersect shadow Tr");
+        if (!capturing) {
+            CUDA_CHECK(cudaDeviceSynchronize());
+            LOG_VERBOSE("Post-sync intersect shadow Tr");
+        }
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second, GPUStream());
 }
 
 void GPUAccel::IntersectOneRandom(int maxRays,
                                   SubsurfaceScatterQueue *subsurfaceScatterQueue) const {
-    std::pair<cudaEvent_t, cudaEvent_t> events =
-        GetProfilerEvents("Tracing subsurface scattering probe rays");
-
-    cudaEventRecord(events.first);
+    bool capturing = GPUStreamIsCapturing();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing) {
+        events = GetProfilerEvents("Tracing subsurface scattering probe rays");
+        cudaEventRecord(events.first, GPUStream());
+    }
 
     if (rootTraversable) {
         RayIntersectParameters params;
@@ -1261,21 +1957,25 @@ void GPUAccel::IntersectOneRandom(int maxRays,
         nvtxRangePush("GPUAccel::IntersectOneRandom");
 #endif
 
-        OPTIX_CHECK(optixLaunch(optixPipeline, cudaStream, pbs.ptr,
+        OPTIX_CHECK(optixLaunch(optixPipeline, GPUStream(), pbs.ptr,
                                 sizeof(RayIntersectParameters), &randomHitSBT, maxRays, 1,
                                 1));
-        CUDA_CHECK(cudaEventRecord(pbs.finishedEvent));
+        if (!pbs.reserved)
+            CUDA_CHECK(cudaEventRecord(pbs.finishedEvent, GPUStream()));
 
 #ifdef NVTX
         nvtxRangePop();
 #endif
 #ifndef NDEBUG
-        CUDA_CHECK(cudaDeviceSynchronize());
-        LOG_VERBOSE("Post-sync triangle intersect random");
+        if (!capturing) {
+            CUDA_CHECK(cudaDeviceSynchronize());
+            LOG_VERBOSE("Post-sync triangle intersect random");
+        }
 #endif
     }
 
-    cudaEventRecord(events.second);
+    if (!capturing)
+        cudaEventRecord(events.second, GPUStream());
 }
 
 }  // namespace pbrt
@@ -16,6 +16,7 @@
 #include <pbrt/util/soa.h>
 
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
 #include <vector>
@@ -32,6 +33,8 @@ class GPUAccel {
              const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
              const std::map<std::string, MediumHandle> &media,
              pstd::array<bool, MaterialHandle::NumTags()> *haveBasicEvalMaterial,
+             pstd::array<bool, MaterialHandle::NumTags()>
+                 *haveNonConstantBasicEvalMaterial,
              pstd::array<bool, MaterialHandle::NumTags()> *haveUniversalEvalMaterial,
              bool *haveSubsurface);
 
@@ -54,7 +57,41 @@ class GPUAccel {
   private:
     struct HitgroupRecord;
 
-    OptixTraversableHandle createGASForTriangles(
+    // BVHBuild holds the inputs for building a GAS or IAS, along with the
+    // storage that they refer to, until buildBVHs() builds it.
+    struct BVHBuild {
+        BVHBuild(Allocator alloc) : aabbs(alloc) {}
+
+        std::vector<OptixBuildInput> buildInputs;
+        std::vector<CUdeviceptr> bufferPtrs;
+        std::vector<uint32_t> flags;
+        pstd::vector<OptixAabb> aabbs;
+#if (OPTIX_VERSION >= 70600)
+        // Index buffers and usage counts for triangle inputs' opacity
+        // micromap arrays
+        std::vector<pstd::vector<int32_t>> micromapIndices;
+        std::vector<std::vector<OptixOpacityMicromapUsageCount>> micromapUsageCounts;
+#endif
+
+        // Set by buildBVHs()
+        OptixTraversableHandle handle = {};
+        void *buffer = nullptr;
+        size_t bufferBytes = 0;
+        std::string cacheFilename;
+        uint64_t cacheKey = 0;
+    };
+
+    std::unique_ptr<BVHBuild> createGASForTriangles(
+        const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
+        const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
+        const std::map<std::string, FloatTextureHandle> &floatTextures,
+        const std::map<std::string, MaterialHandle> &namedMaterials,
+        const std::vector<MaterialHandle> &materials,
+        const std::map<std::string, MediumHandle> &media,
+        const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
+        Bounds3f *gasBounds);
+
+    std::unique_ptr<BVHBuild> createGASForBLPs(
         const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
         const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
         const std::map<std::string, FloatTextureHandle> &floatTextures,
@@ -64,7 +101,7 @@ class GPUAccel {
         const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
         Bounds3f *gasBounds);
 
-    OptixTraversableHandle createGASForBLPs(
+    std::unique_ptr<BVHBuild> createGASForQuadrics(
         const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
         const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
         const std::map<std::string, FloatTextureHandle> &floatTextures,
@@ -74,7 +111,7 @@ class GPUAccel {
         const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
         Bounds3f *gasBounds);
 
-    OptixTraversableHandle createGASForQuadrics(
+    std::unique_ptr<BVHBuild> createGASForCurves(
         const std::vector<ShapeSceneEntity> &shapes, const OptixProgramGroup &intersectPG,
         const OptixProgramGroup &shadowPG, const OptixProgramGroup &randomHitPG,
         const std::map<std::string, FloatTextureHandle> &floatTextures,
@@ -84,7 +121,13 @@ class GPUAccel {
         const std::map<int, pstd::vector<LightHandle> *> &shapeIndexToAreaLights,
         Bounds3f *gasBounds);
 
-    OptixTraversableHandle buildBVH(const std::vector<OptixBuildInput> &buildInputs);
+#if (OPTIX_VERSION >= 70600)
+    OptixBuildInputOpacityMicromap buildOpacityMicromapArray(const OpacityMicromap &omm,
+                                                             BVHBuild *build);
+#endif
+    void buildBVHs(const std::vector<BVHBuild *> &builds);
+    bool readGASCache(BVHBuild *build) const;
+    void writeGASCache(const BVHBuild &build) const;
 
     Allocator alloc;
     Bounds3f bounds;
@@ -95,6 +138,9 @@ class GPUAccel {
 
     struct ParamBufferState {
         bool used = false;
+        // Buffers used by kernels captured in a CUDA graph are read each
+        // time the graph is launched and so can't be reused.
+        bool reserved = false;
         cudaEvent_t finishedEvent;
         CUdeviceptr ptr = 0;
         void *hostPtr = nullptr;
@@ -16,20 +16,20 @@
 namespace pbrt {
 
 // GPUPathIntegrator Camera Ray Methods
-void GPUPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
+void GPUPathIntegrator::GenerateCameraRays() {
     // Define _generateRays_ lambda function
     auto generateRays = [=](auto sampler) {
         using Sampler = std::remove_reference_t<decltype(*sampler)>;
         if constexpr (!std::is_same_v<Sampler, MLTSampler> &&
                       !std::is_same_v<Sampler, DebugMLTSampler>)
-            GenerateCameraRays<Sampler>(y0, sampleIndex);
+            GenerateCameraRays<Sampler>();
     };
 
     sampler.DispatchCPU(generateRays);
 }
 
 template <typename Sampler>
-void GPUPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
+void GPUPathIntegrator::GenerateCameraRays() {
     RayQueue *rayQueue = CurrentRayQueue(0);
     GPUParallelFor(
         "Generate Camera rays", maxQueueSize, PBRT_GPU_LAMBDA(int pixelIndex) {
@@ -38,7 +38,17 @@ void GPUPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
             Bounds2i pixelBounds = film.PixelBounds();
             int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
             Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
-                           y0 + pixelIndex / xResolution);
+                           passState->y0 + pixelIndex / xResolution);
+            if (int start = passState->activePixelStart; start >= 0) {
+                // Use the pass's next active pixel for adaptive sampling; the
+                // ones past the last active pixel are outside the bounds.
+                if (start + pixelIndex < *activePixelCount) {
+                    int index = activePixels[start + pixelIndex];
+                    pPixel = Point2i(pixelBounds.pMin.x + index % xResolution,
+                                     pixelBounds.pMin.y + index / xResolution);
+                } else
+                    pPixel = Point2i(pixelBounds.pMin.x, pixelBounds.pMax.y);
+            }
             pixelSampleState.pPixel[pixelIndex] = pPixel;
 
             // Test pixel coordinates against pixel bounds
@@ -47,7 +57,7 @@ void GPUPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
 
             // Initialize _Sampler_ for current pixel and sample
             Sampler pixelSampler = *sampler.Cast<Sampler>();
-            pixelSampler.StartPixelSample(pPixel, sampleIndex, 0);
+            pixelSampler.StartPixelSample(pPixel, passState->sampleIndex, 0);
 
             // Sample wavelengths for ray path
             Float lu = pixelSampler.Get1D();
@@ -66,9 +76,14 @@ void GPUPathIntegrator::GenerateCameraRays(int y0, int sampleIndex) {
             pixelSampleState.filterWeight[pixelIndex] = cameraSample.weight;
             if (initializeVisibleSurface)
                 pixelSampleState.visibleSurface[pixelIndex] = VisibleSurface();
+            if (pixelCosts)
+                pixelCosts[pixelIndex] = PixelCostSample();
 
             // Enqueue camera ray for intersection tests
             if (cameraRay) {
+                // The preview integrators ignore participating media
+                if (previewMode != PreviewMode::None)
+                    cameraRay->ray.medium = nullptr;
                 rayQueue->PushCameraRay(cameraRay->ray, lambda, pixelIndex);
                 pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay->weight;
             } else
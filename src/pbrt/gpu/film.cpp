@@ -25,8 +25,16 @@ void GPUPathIntegrator::UpdateFilm() {
 
             PBRT_DBG("Adding Lw %f %f %f %f at pixel (%d, %d)", Lw[0], Lw[1], Lw[2],
                      Lw[3], pPixel.x, pPixel.y);
-            // Provide sample radiance value to film
             SampledWavelengths lambda = pixelSampleState.lambda[pixelIndex];
+            // Record the sample's luminance for adaptive sampling
+            if (pixelVariance) {
+                Bounds2i pixelBounds = film.PixelBounds();
+                int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+                Vector2i p = pPixel - pixelBounds.pMin;
+                pixelVariance[p.y * xResolution + p.x].Add(Lw.y(lambda));
+            }
+
+            // Provide sample radiance value to film
             Float filterWeight = pixelSampleState.filterWeight[pixelIndex];
             if (initializeVisibleSurface) {
                 VisibleSurface visibleSurface =
@@ -34,6 +42,8 @@ void GPUPathIntegrator::UpdateFilm() {
                 film.AddSample(pPixel, Lw, lambda, &visibleSurface, filterWeight);
             } else
                 film.AddSample(pPixel, Lw, lambda, nullptr, filterWeight);
+            if (pixelCosts)
+                film.AddCostSample(pPixel, pixelCosts[pixelIndex]);
         });
 }
 
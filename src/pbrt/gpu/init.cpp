@@ -10,6 +10,8 @@
 #include <pbrt/util/log.h>
 #include <pbrt/util/print.h>
 
+#include <algorithm>
+
 #include <cuda.h>
 
 #ifdef NVTX
@@ -18,6 +20,32 @@
 
 namespace pbrt {
 
+static void InitDevice(int device) {
+    LOG_VERBOSE("Selecting GPU device %d", device);
+#ifdef NVTX
+    nvtxNameCuDevice(device, "PBRT_GPU");
+#endif
+    CUDA_CHECK(cudaSetDevice(device));
+    // Make sure that the device's context has been created.
+    CUDA_CHECK(cudaFree(nullptr));
+
+    int hasUnifiedAddressing;
+    CUDA_CHECK(cudaDeviceGetAttribute(&hasUnifiedAddressing, cudaDevAttrUnifiedAddressing,
+                                      device));
+    if (!hasUnifiedAddressing)
+        LOG_FATAL("The selected GPU device (%d) does not support unified addressing.",
+                  device);
+
+    CUDA_CHECK(cudaDeviceSetLimit(cudaLimitStackSize, 8192));
+    size_t stackSize;
+    CUDA_CHECK(cudaDeviceGetLimit(&stackSize, cudaLimitStackSize));
+    LOG_VERBOSE("Reset stack size to %d", stackSize);
+
+    CUDA_CHECK(cudaDeviceSetLimit(cudaLimitPrintfFifoSize, 32 * 1024 * 1024));
+
+    CUDA_CHECK(cudaDeviceSetCacheConfig(cudaFuncCachePreferL1));
+}
+
 void GPUInit() {
     cudaFree(nullptr);
 
@@ -62,28 +90,13 @@ void GPUInit() {
 #endif
     }
 
-    int device = Options->gpuDevice ? *Options->gpuDevice : 0;
-    LOG_VERBOSE("Selecting GPU device %d", device);
-#ifdef NVTX
-    nvtxNameCuDevice(device, "PBRT_GPU");
-#endif
-    CUDA_CHECK(cudaSetDevice(device));
-
-    int hasUnifiedAddressing;
-    CUDA_CHECK(cudaDeviceGetAttribute(&hasUnifiedAddressing, cudaDevAttrUnifiedAddressing,
-                                      device));
-    if (!hasUnifiedAddressing)
-        LOG_FATAL("The selected GPU device (%d) does not support unified addressing.",
-                  device);
-
-    CUDA_CHECK(cudaDeviceSetLimit(cudaLimitStackSize, 8192));
-    size_t stackSize;
-    CUDA_CHECK(cudaDeviceGetLimit(&stackSize, cudaLimitStackSize));
-    LOG_VERBOSE("Reset stack size to %d", stackSize);
-
-    CUDA_CHECK(cudaDeviceSetLimit(cudaLimitPrintfFifoSize, 32 * 1024 * 1024));
-
-    CUDA_CHECK(cudaDeviceSetCacheConfig(cudaFuncCachePreferL1));
+    if (Options->gpuCount > nDevices)
+        Warning("--gpu-count %d given but only %d GPUs are available.",
+                Options->gpuCount, nDevices);
+    std::vector<int> renderDevices = GPURenderDevices();
+    for (int device : renderDevices)
+        InitDevice(device);
+    CUDA_CHECK(cudaSetDevice(renderDevices[0]));
 }
 
 void GPUThreadInit() {
@@ -94,4 +107,28 @@ void GPUThreadInit() {
     CUDA_CHECK(cudaSetDevice(device));
 }
 
+std::vector<int> GPURenderDevices() {
+    if (Options->gpuCount == 1)
+        return {Options->gpuDevice ? *Options->gpuDevice : 0};
+
+    int nDevices;
+    CUDA_CHECK(cudaGetDeviceCount(&nDevices));
+    int count =
+        Options->gpuCount == 0 ? nDevices : std::min(Options->gpuCount, nDevices);
+    std::vector<int> devices(count);
+    for (int i = 0; i < count; ++i)
+        devices[i] = i;
+    return devices;
+}
+
+void ForEachGPURenderDevice(std::function<void()> func) {
+    int currentDevice;
+    CUDA_CHECK(cudaGetDevice(&currentDevice));
+    for (int device : GPURenderDevices()) {
+        CUDA_CHECK(cudaSetDevice(device));
+        func();
+    }
+    CUDA_CHECK(cudaSetDevice(currentDevice));
+}
+
 }  // namespace pbrt
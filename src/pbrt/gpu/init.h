@@ -5,11 +5,21 @@
 #ifndef PBRT_GPU_INIT_H
 #define PBRT_GPU_INIT_H
 
+#include <functional>
+#include <vector>
+
 namespace pbrt {
 
 void GPUInit();
 void GPUThreadInit();
 
+// Returns the CUDA devices that pbrt renders with; the first one is the
+// current device after GPUInit().
+std::vector<int> GPURenderDevices();
+// Calls _func_ with each of the render devices set as the current device,
+// e.g. to initialize per-device __constant__ variables.
+void ForEachGPURenderDevice(std::function<void()> func);
+
 }  // namespace pbrt
 
 #endif  // PBRT_GPU_INIT_H
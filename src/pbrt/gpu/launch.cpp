@@ -4,9 +4,16 @@
 
 #include <pbrt/gpu/launch.h>
 
+#include <pbrt/options.h>
+#include <pbrt/util/log.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
 
 #include <algorithm>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
 #include <vector>
 
 namespace pbrt {
@@ -51,22 +58,42 @@ struct ProfilerEvent {
     KernelStats *stats = nullptr;
 };
 
-// Store pointers so that reallocs don't mess up held KernelStats pointers
-// in ProfilerEvent..
-static std::vector<KernelStats *> kernelStats;
+// Each GPU has its own events and statistics, since events can only be
+// recorded on the device they were created on.
+struct DeviceProfiler {
+    // Store pointers so that reallocs don't mess up held KernelStats pointers
+    // in ProfilerEvent..
+    std::vector<KernelStats *> kernelStats;
+    std::vector<std::pair<std::string, WorkQueueStats *>> queueStats;
 
-// Ring buffer
-static std::vector<ProfilerEvent> eventPool;
-static size_t eventPoolOffset = 0;
+    // Ring buffer
+    std::vector<ProfilerEvent> eventPool;
+    size_t eventPoolOffset = 0;
+};
+
+static std::mutex profilersMutex;
+static std::map<int, DeviceProfiler> profilers;
+
+static DeviceProfiler &CurrentDeviceProfiler() {
+    int device;
+    CUDA_CHECK(cudaGetDevice(&device));
+    std::lock_guard<std::mutex> lock(profilersMutex);
+    // Elements of a std::map aren't moved when others are added.
+    return profilers[device];
+}
 
 std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description) {
+    DeviceProfiler &profiler = CurrentDeviceProfiler();
+    std::vector<ProfilerEvent> &eventPool = profiler.eventPool;
+    std::vector<KernelStats *> &kernelStats = profiler.kernelStats;
+
     if (eventPool.empty())
         eventPool.resize(1024);  // how many? This is probably more than we need...
 
-    if (eventPoolOffset == eventPool.size())
-        eventPoolOffset = 0;
+    if (profiler.eventPoolOffset == eventPool.size())
+        profiler.eventPoolOffset = 0;
 
-    ProfilerEvent &pe = eventPool[eventPoolOffset++];
+    ProfilerEvent &pe = eventPool[profiler.eventPoolOffset++];
     if (pe.active)
         pe.Sync();
 
@@ -87,25 +114,92 @@ std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description) {
     return {pe.start, pe.stop};
 }
 
-void ReportKernelStats() {
-    CUDA_CHECK(cudaDeviceSynchronize());
+WorkQueueStats *GetWorkQueueStats(const char *description, size_t itemBytes) {
+    if (!Options->gpuQueueStats)
+        return nullptr;
+
+    DeviceProfiler &profiler = CurrentDeviceProfiler();
+    for (const auto &qs : profiler.queueStats)
+        if (qs.first == description)
+            return qs.second;
+
+    // The kernels update the statistics in managed memory; the CPU only
+    // reads them after the GPU is idle.
+    void *ptr;
+    CUDA_CHECK(cudaMallocManaged(&ptr, sizeof(WorkQueueStats)));
+    WorkQueueStats *stats = new (ptr) WorkQueueStats;
+    stats->itemBytes = itemBytes;
+    profiler.queueStats.push_back(std::make_pair(std::string(description), stats));
+    return stats;
+}
+
+void ReportKernelStats(Float renderSeconds) {
+    int currentDevice;
+    CUDA_CHECK(cudaGetDevice(&currentDevice));
 
-    // Drain active profiler events
-    for (size_t i = 0; i < eventPool.size(); ++i)
-        if (eventPool[i].active)
-            eventPool[i].Sync();
+    // Drain active profiler events and sum each kernel's statistics over
+    // all of the devices
+    std::vector<KernelStats> kernelStats;
+    std::vector<std::pair<std::string, WorkQueueStats>> queueStats;
+    std::map<int, float> deviceMS;
+    for (auto &deviceProfiler : profilers) {
+        CUDA_CHECK(cudaSetDevice(deviceProfiler.first));
+        CUDA_CHECK(cudaDeviceSynchronize());
+
+        DeviceProfiler &profiler = deviceProfiler.second;
+        for (size_t i = 0; i < profiler.eventPool.size(); ++i)
+            if (profiler.eventPool[i].active)
+                profiler.eventPool[i].Sync();
+
+        for (const KernelStats *ks : profiler.kernelStats) {
+            deviceMS[deviceProfiler.first] += ks->sumMS;
+            auto iter = std::find_if(
+                kernelStats.begin(), kernelStats.end(),
+                [&](const KernelStats &s) { return s.description == ks->description; });
+            if (iter == kernelStats.end())
+                kernelStats.push_back(*ks);
+            else {
+                iter->minMS = std::min(iter->minMS, ks->minMS);
+                iter->maxMS = std::max(iter->maxMS, ks->maxMS);
+                iter->numLaunches += ks->numLaunches;
+                iter->sumMS += ks->sumMS;
+            }
+        }
+
+        for (const auto &qs : profiler.queueStats) {
+            auto iter = std::find_if(queueStats.begin(), queueStats.end(),
+                                     [&](const auto &s) { return s.first == qs.first; });
+            if (iter == queueStats.end())
+                queueStats.push_back(std::make_pair(qs.first, *qs.second));
+            else {
+                iter->second.launches += qs.second->launches;
+                iter->second.items += qs.second->items;
+                iter->second.threads += qs.second->threads;
+            }
+        }
+    }
+    CUDA_CHECK(cudaSetDevice(currentDevice));
 
     // Compute total milliseconds over all kernels and launches
     float totalMS = 0;
     for (size_t i = 0; i < kernelStats.size(); ++i)
-        totalMS += kernelStats[i]->sumMS;
+        totalMS += kernelStats[i].sumMS;
+
+    for (const KernelStats &ks : kernelStats)
+        StatsAppendJSON("gpuKernels",
+                        StringPrintf("{\"name\": %s, \"launches\": %d, \"sumMS\": %.6f, "
+                                     "\"minMS\": %.6f, \"maxMS\": %.6f}",
+                                     JSONString(ks.description), ks.numLaunches,
+                                     ks.sumMS, ks.minMS, ks.maxMS));
+    if (Options->quiet)
+        return;
 
     printf("GPU Kernel Profile:\n");
     int otherLaunches = 0;
     float otherMS = 0;
     const float otherCutoff = 0.001f * totalMS;
     for (size_t i = 0; i < kernelStats.size(); ++i) {
-        KernelStats *stats = kernelStats[i];
+        KernelStats *stats = &kernelStats[i];
         if (stats->sumMS > otherCutoff)
             Printf("  %-49s %5d launches %9.2f ms / %5.1f%s (avg %6.3f, min "
                    "%6.3f, max %7.3f)\n",
@@ -122,6 +216,44 @@ void ReportKernelStats() {
            otherLaunches, otherMS, 100.f * otherMS / totalMS, "%",
            otherMS / otherLaunches);
     Printf("\nTotal GPU time: %9.2f ms\n", totalMS);
+
+    if (!queueStats.empty()) {
+        // Report the average number of items per launch, the fraction of
+        // the launched threads that had an item to process, and the
+        // bandwidth for reading the items if the kernel was timed
+        // individually rather than as part of a CUDA graph.
+        Printf("\nGPU Work Queue Occupancy:\n");
+        for (const auto &qs : queueStats) {
+            const WorkQueueStats &stats = qs.second;
+            if (stats.launches == 0)
+                continue;
+            double mib = double(stats.items) * stats.itemBytes / (1024. * 1024.);
+            std::string bandwidth = "";
+            auto iter = std::find_if(
+                kernelStats.begin(), kernelStats.end(),
+                [&](const KernelStats &s) { return s.description == qs.first; });
+            if (iter != kernelStats.end() && iter->sumMS > 0)
+                bandwidth =
+                    StringPrintf(", %7.2f GiB/s", mib / iter->sumMS * 1000 / 1024);
+            Printf("  %-49s %10.1f items/launch %5.1f%s active %10.2f MiB%s\n", qs.first,
+                   double(stats.items) / stats.launches,
+                   100. * stats.items / std::max<uint64_t>(1, stats.threads), "%", mib,
+                   bandwidth);
+        }
+    }
+
+    if (deviceMS.size() > 1 && renderSeconds > 0) {
+        // Report how much of the render each GPU spent running kernels;
+        // the scaling efficiency is the fraction of the ideal
+        // _deviceMS.size()_ times speedup that was achieved.
+        float renderMS = 1000 * renderSeconds;
+        for (const auto &dm : deviceMS)
+            Printf("  GPU %-45d %9.2f ms / %5.1f%s busy\n", dm.first, dm.second,
+                   100.f * dm.second / renderMS, "%");
+        Printf("Multi-GPU scaling efficiency: %5.1f%s over %d GPUs\n",
+               100.f * totalMS / (deviceMS.size() * renderMS), "%",
+               int(deviceMS.size()));
+    }
     Printf("\n");
 }
 
@@ -129,4 +261,60 @@ void GPUWait() {
     CUDA_CHECK(cudaDeviceSynchronize());
 }
 
+static thread_local cudaStream_t currentStream = nullptr;
+
+cudaStream_t GPUStream() {
+    return currentStream;
+}
+
+void GPUSetStream(cudaStream_t stream) {
+    currentStream = stream;
+}
+
+bool GPUStreamIsCapturing() {
+    if (!currentStream)
+        return false;
+    cudaStreamCaptureStatus status;
+    CUDA_CHECK(cudaStreamIsCapturing(currentStream, &status));
+    return status == cudaStreamCaptureStatusActive;
+}
+
+GPUGraph::~GPUGraph() {
+    Reset();
+    if (stream)
+        CUDA_CHECK(cudaStreamDestroy(stream));
+}
+
+void GPUGraph::Launch(const char *description, std::function<void()> launchKernels) {
+    // Work on _stream_, which isn't a non-blocking stream, is ordered with
+    // respect to work on the default stream.
+    if (!stream)
+        CUDA_CHECK(cudaStreamCreate(&stream));
+
+    cudaStream_t prevStream = GPUStream();
+    GPUSetStream(stream);
+    if (!graphExec) {
+        // Capture the kernels into a graph
+        CUDA_CHECK(cudaStreamBeginCapture(stream, cudaStreamCaptureModeThreadLocal));
+        launchKernels();
+        cudaGraph_t graph;
+        CUDA_CHECK(cudaStreamEndCapture(stream, &graph));
+        CUDA_CHECK(cudaGraphInstantiate(&graphExec, graph, nullptr, nullptr, 0));
+        CUDA_CHECK(cudaGraphDestroy(graph));
+        LOG_VERBOSE("Captured CUDA graph for %s", description);
+    }
+
+    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents(description);
+    cudaEventRecord(events.first, stream);
+    CUDA_CHECK(cudaGraphLaunch(graphExec, stream));
+    cudaEventRecord(events.second, stream);
+    GPUSetStream(prevStream);
+}
+
+void GPUGraph::Reset() {
+    if (graphExec)
+        CUDA_CHECK(cudaGraphExecDestroy(graphExec));
+    graphExec = nullptr;
+}
+
 }  // namespace pbrt
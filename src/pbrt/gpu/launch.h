@@ -10,7 +10,9 @@
 #include <pbrt/util/check.h>
 #include <pbrt/util/log.h>
 
+#include <functional>
 #include <map>
+#include <mutex>
 #include <typeindex>
 #include <typeinfo>
 #include <utility>
@@ -27,9 +29,34 @@ namespace pbrt {
 
 std::pair<cudaEvent_t, cudaEvent_t> GetProfilerEvents(const char *description);
 
+// WorkQueueStats Definition
+// With --gpu-queue-stats, kernels that process the items in a work queue
+// record how many items there were and how many threads were launched for
+// them; these are reported with the kernel times.
+struct WorkQueueStats {
+    PBRT_CPU_GPU
+    void Record(int nItems, int nThreads) {
+        ++launches;
+        items += nItems;
+        threads += nThreads;
+    }
+
+    uint64_t launches = 0, items = 0, threads = 0;
+    // Bytes that the queue's SOA stores for each item; each one is written
+    // to the queue once and read once.
+    size_t itemBytes = 0;
+};
+
+// Returns the statistics for the queue processed by the kernel with the
+// given description in memory that both the CPU and the current GPU can
+// access, or nullptr if queue statistics aren't being recorded.
+WorkQueueStats *GetWorkQueueStats(const char *description, size_t itemBytes);
+
 template <typename F>
 inline int GetBlockSize(const char *description, F kernel) {
-    // Note: this isn't re-entrant, but that's fine for our purposes...
+    // Kernels are launched from one thread per GPU with multi-GPU rendering.
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
     static std::map<std::type_index, int> kernelBlockSizes;
 
     std::type_index index = std::type_index(typeid(F));
@@ -69,6 +96,31 @@ void GPUDo(const char *description, F func) {
 
 void GPUWait();
 
+// Kernels are launched on the calling thread's current stream, which is the
+// default stream unless another has been set, e.g. to run independent
+// kernels concurrently or to capture kernels into a CUDA graph.
+cudaStream_t GPUStream();
+void GPUSetStream(cudaStream_t stream);
+// Returns true if the current stream's work is being captured into a graph;
+// individual kernels aren't profiled then.
+bool GPUStreamIsCapturing();
+
+// GPUGraph Definition
+// A GPUGraph captures the kernels that a function launches the first time
+// that Launch() is called and replays them as a CUDA graph afterward, which
+// saves most of the per-kernel launch overhead. The function must launch the
+// same kernels with the same parameters each time.
+class GPUGraph {
+  public:
+    ~GPUGraph();
+    void Launch(const char *description, std::function<void()> launchKernels);
+    void Reset();
+
+  private:
+    cudaStream_t stream = nullptr;
+    cudaGraphExec_t graphExec = nullptr;
+};
+
 #ifdef __CUDACC__
 template <typename F>
 void GPUParallelFor(const char *description, int nItems, F func) {
@@ -78,19 +130,27 @@ void GPUParallelFor(const char *description, int nItems, F func) {
     auto kernel = &Kernel<F>;
 
     int blockSize = GetBlockSize(description, kernel);
-    std::pair<cudaEvent_t, cudaEvent_t> events = GetProfilerEvents(description);
+    cudaStream_t stream = GPUStream();
+    bool capturing = GPUStreamIsCapturing();
+    std::pair<cudaEvent_t, cudaEvent_t> events;
+    if (!capturing)
+        events = GetProfilerEvents(description);
 
 #ifdef PBRT_DEBUG_BUILD
     LOG_VERBOSE("Launching %s", description);
 #endif
-    cudaEventRecord(events.first);
+    if (!capturing)
+        cudaEventRecord(events.first, stream);
     int gridSize = (nItems + blockSize - 1) / blockSize;
-    kernel<<<gridSize, blockSize>>>(func, nItems);
-    cudaEventRecord(events.second);
+    kernel<<<gridSize, blockSize, 0, stream>>>(func, nItems);
+    if (!capturing)
+        cudaEventRecord(events.second, stream);
 
 #ifdef PBRT_DEBUG_BUILD
-    CUDA_CHECK(cudaDeviceSynchronize());
-    LOG_VERBOSE("Post-sync %s", description);
+    if (!capturing) {
+        CUDA_CHECK(cudaDeviceSynchronize());
+        LOG_VERBOSE("Post-sync %s", description);
+    }
 #endif
 #ifdef NVTX
     nvtxRangePop();
@@ -98,7 +158,10 @@ void GPUParallelFor(const char *description, int nItems, F func) {
 }
 #endif  // __CUDACC__
 
-void ReportKernelStats();
+// Prints the time spent in each kernel, summed over all of the GPUs that
+// launched kernels. With multiple GPUs, given the wall-clock time that
+// rendering took, it also reports how busy each GPU was.
+void ReportKernelStats(Float renderSeconds = 0);
 
 }  // namespace pbrt
 
@@ -10,6 +10,20 @@
 
 namespace pbrt {
 
+// GPU Medium Sampling Constants
+// Rays are advanced through media over several kernel launches: each launch
+// but the last samples at most _MediumSegmentsPerRound_ majorant segments
+// with nonzero majorants along each ray and re-enqueues the rays that aren't
+// done, so that threads for rays through short or empty stretches of a
+// medium don't wait for the ones that cross many dense cells.
+static constexpr int MediumSampleRounds = 4;
+static constexpr int MediumSegmentsPerRound = 16;
+// Each round's kernel has its own name so that its queue's occupancy is
+// reported separately.
+static const char *MediumSampleRoundNames[MediumSampleRounds] = {
+    "Sample medium interaction", "Sample medium interaction (round 2)",
+    "Sample medium interaction (round 3)", "Sample medium interaction (round 4)"};
+
 // It's not unususal for these values to have very large or very small
 // magnitudes after multiple (null) scattering events, even though in the
 // end ratios like T_hat/uniPathPDF are generally around 1.  To avoid overflow,
@@ -35,10 +49,13 @@ static inline void rescale(SampledSpectrum &T_hat, SampledSpectrum &lightPathPDF
 }
 
 // GPUPathIntegrator Participating Media Methods
-void GPUPathIntegrator::SampleMediumInteraction(int depth) {
+void GPUPathIntegrator::SampleMediumInteraction(int depth, int round,
+                                                MediumSampleQueue *queue,
+                                                MediumSampleQueue *resumeQueue) {
     RayQueue *nextRayQueue = NextRayQueue(depth);
+    int maxSegments = resumeQueue ? MediumSegmentsPerRound : 0;
     ForAllQueued(
-        "Sample medium interaction", mediumSampleQueue, maxQueueSize,
+        MediumSampleRoundNames[round], queue, queueLaunchSize,
         PBRT_GPU_LAMBDA(MediumSampleWorkItem w) {
             Ray ray = w.ray;
             Float tMax = w.tMax;
@@ -54,7 +71,9 @@ void GPUPathIntegrator::SampleMediumInteraction(int depth) {
             SampledSpectrum uniPathPDF = w.uniPathPDF;
             SampledSpectrum lightPathPDF = w.lightPathPDF;
             SampledSpectrum L(0.f);
-            RNG rng(Hash(tMax), Hash(ray.d));
+            // Resumed rays' origins are included so that each round uses
+            // different random numbers for rays that don't hit anything.
+            RNG rng(round == 0 ? Hash(tMax) : Hash(ray.o, tMax), Hash(ray.d));
 
             PBRT_DBG("Lambdas %f %f %f %f\n", lambda[0], lambda[1], lambda[2], lambda[3]);
             PBRT_DBG("Medium sample T_hat %f %f %f %f uniPathPDF %f %f %f %f "
@@ -70,10 +89,17 @@ void GPUPathIntegrator::SampleMediumInteraction(int depth) {
             RaySamples raySamples = pixelSampleState.samples[w.pixelIndex];
             Float uDist = raySamples.media.uDist;
             Float uMode = raySamples.media.uMode;
+            if (round > 0) {
+                uDist = rng.Uniform<Float>();
+                uMode = rng.Uniform<Float>();
+            }
+            Float tResume = Infinity;
 
             SampledSpectrum Tmaj = ray.medium.SampleTmaj(
                 ray, tMax, uDist, rng, lambda, [&](const MediumSample &mediumSample) {
                     rescale(T_hat, uniPathPDF, lightPathPDF);
+                    if (pixelCosts)
+                        ++pixelCosts[w.pixelIndex].mediumSteps;
 
                     const MediumInteraction &intr = mediumSample.intr;
                     const SampledSpectrum &sigma_a = intr.sigma_a;
@@ -139,7 +165,8 @@ void GPUPathIntegrator::SampleMediumInteraction(int depth) {
 
                         return true;
                     }
-                });
+                },
+                maxSegments, &tResume);
             if (!scattered && T_hat) {
                 T_hat *= Tmaj;
                 uniPathPDF *= Tmaj;
@@ -163,7 +190,22 @@ void GPUPathIntegrator::SampleMediumInteraction(int depth) {
 
             // There's no more work to do if there was a scattering event in
             // the medium.
-            if (scattered || !T_hat || depth == maxDepth)
+            if (scattered || !T_hat)
+                return;
+
+            // Re-enqueue the ray to continue sampling where this round stopped
+            if (tResume < Infinity) {
+                MediumSampleWorkItem resumed = w;
+                resumed.ray = Ray(ray(tResume), ray.d, ray.time, ray.medium);
+                resumed.tMax = tMax - tResume;
+                resumed.T_hat = T_hat;
+                resumed.uniPathPDF = uniPathPDF;
+                resumed.lightPathPDF = lightPathPDF;
+                resumeQueue->Push(resumed);
+                return;
+            }
+
+            if (depth == maxDepth)
                 return;
 
             // Otherwise, enqueue bump and medium stuff...
@@ -222,16 +264,31 @@ void GPUPathIntegrator::SampleMediumInteraction(int depth) {
             };
             material.Dispatch(enqueue);
         });
+}
+
+void GPUPathIntegrator::SampleMediumInteraction(int depth) {
+    // Sample medium interactions, alternating between the two medium sample
+    // queues for the rays that are re-enqueued
+    MediumSampleQueue *queues[2] = {mediumSampleQueue, mediumResumeQueue};
+    for (int round = 0; round < MediumSampleRounds; ++round) {
+        MediumSampleQueue *resumeQueue =
+            round + 1 < MediumSampleRounds ? queues[(round + 1) & 1] : nullptr;
+        if (resumeQueue)
+            GPUDo(
+                "Reset medium resume queue",
+                PBRT_GPU_LAMBDA() { resumeQueue->Reset(); });
+        SampleMediumInteraction(depth, round, queues[round & 1], resumeQueue);
+    }
 
     if (depth == maxDepth)
         return;
 
-    RayQueue *currentRayQueue = CurrentRayQueue(depth);
+    RayQueue *nextRayQueue = NextRayQueue(depth);
 
     using PhaseFunction = HGPhaseFunction;
     std::string desc = std::string("Sample direct/indirect - Henyey Greenstein");
     ForAllQueued(
-        desc.c_str(), mediumScatterQueue, maxQueueSize,
+        desc.c_str(), mediumScatterQueue, queueLaunchSize,
         PBRT_GPU_LAMBDA(MediumScatterWorkItem w) {
             RaySamples raySamples = pixelSampleState.samples[w.pixelIndex];
             Float time = 0;  // TODO: FIXME
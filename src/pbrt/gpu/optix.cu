@@ -240,20 +240,9 @@ static __forceinline__ __device__ void ProcessClosestIntersection(
     PBRT_DBG("Closest hit found intersection at t %f\n", optixGetRayTmax());
 }
 
-///////////////////////////////////////////////////////////////////////////
-// Triangles
-
-static __forceinline__ __device__ SurfaceInteraction
-getTriangleIntersection() {
-    const TriangleMeshRecord &rec = *(const TriangleMeshRecord *)optixGetSbtDataPointer();
-
-    float b1 = optixGetTriangleBarycentrics().x;
-    float b2 = optixGetTriangleBarycentrics().y;
-    float b0 = 1 - b1 - b2;
-
-    float3 rd = optixGetWorldRayDirection();
-    Vector3f wo = -Vector3f(rd.x, rd.y, rd.z);
-
+// All geometry is reached through the top-level IAS, either directly or as
+// part of an object instance, so there is always a single transform.
+static __forceinline__ __device__ Transform getWorldFromInstance() {
     assert(optixGetTransformListSize() == 1);
     float worldFromObj[12], objFromWorld[12];
     optixGetObjectToWorldTransformMatrix(worldFromObj);
@@ -269,18 +258,37 @@ getTriangleIntersection() {
                                   objFromWorld[9], objFromWorld[10], objFromWorld[11],
                                   0.f, 0.f, 0.f, 1.f);
 
-    Transform worldFromInstance(worldFromObjM, objFromWorldM);
+    return Transform(worldFromObjM, objFromWorldM);
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Triangles
 
-    Float time = optixGetRayTime();
+static __forceinline__ __device__ SurfaceInteraction getTriangleIntersection(
+    const TriangleMeshRecord &rec, int primIndex, Float b1, Float b2, Float tHit,
+    Vector3f wo, const Transform &worldFromInstance, Float time) {
+    Float b0 = 1 - b1 - b2;
     wo = worldFromInstance.ApplyInverse(wo);
 
-    TriangleIntersection ti{b0, b1, b2, optixGetRayTmax()};
+    TriangleIntersection ti{b0, b1, b2, tHit};
     SurfaceInteraction intr =
-        Triangle::InteractionFromIntersection(rec.mesh, optixGetPrimitiveIndex(),
-                                              ti, time, wo);
+        Triangle::InteractionFromIntersection(rec.mesh, primIndex, ti, time, wo);
     return worldFromInstance(intr);
 }
 
+static __forceinline__ __device__ SurfaceInteraction
+getTriangleIntersection() {
+    const TriangleMeshRecord &rec = *(const TriangleMeshRecord *)optixGetSbtDataPointer();
+
+    float3 rd = optixGetWorldRayDirection();
+    Vector3f wo = -Vector3f(rd.x, rd.y, rd.z);
+
+    return getTriangleIntersection(rec, optixGetPrimitiveIndex(),
+                                   optixGetTriangleBarycentrics().x,
+                                   optixGetTriangleBarycentrics().y, optixGetRayTmax(),
+                                   wo, getWorldFromInstance(), optixGetRayTime());
+}
+
 static __forceinline__ __device__ bool alphaKilled(const TriangleMeshRecord &rec) {
     if (!rec.alphaTexture)
         return false;
@@ -430,7 +438,14 @@ extern "C" __global__ void __raygen__shadow_Tr() {
             break;
         }
 
-        if (ray.medium) {
+        if (const HomogeneousMedium *homogeneous =
+                ray.medium.CastOrNullptr<HomogeneousMedium>()) {
+            // Homogeneous media's transmittance is known in closed form; the
+            // path PDFs are unchanged since nothing is sampled along the segment.
+            Float tEnd =
+                missed ? tMax : (Distance(ray.o, Point3f(ctx.piHit)) / Length(ray.d));
+            T_ray *= homogeneous->Tr(ray, tEnd, lambda);
+        } else if (ray.medium) {
             PBRT_DBG("Ray medium %p. Will sample tmaj...\n", ray.medium.ptr());
 
             Float tEnd =
@@ -522,12 +537,9 @@ extern "C" __global__ void __miss__shadow_Tr() {
 // Quadrics
 
 static __device__ inline SurfaceInteraction getQuadricIntersection(
-    const QuadricIntersection &si) {
-    QuadricRecord &rec = *((QuadricRecord *)optixGetSbtDataPointer());
-
-    float3 rd = optixGetWorldRayDirection();
-    Vector3f wo = -Vector3f(rd.x, rd.y, rd.z);
-    Float time = optixGetRayTime();
+    const QuadricRecord &rec, const QuadricIntersection &si, Vector3f wo,
+    const Transform &worldFromInstance, Float time) {
+    wo = worldFromInstance.ApplyInverse(wo);
 
     SurfaceInteraction intr;
     if (const Sphere *sphere = rec.shape.CastOrNullptr<Sphere>())
@@ -539,7 +551,18 @@ static __device__ inline SurfaceInteraction getQuadricIntersection(
     else
         assert(!"unexpected quadric");
 
-    return intr;
+    return worldFromInstance(intr);
+}
+
+static __device__ inline SurfaceInteraction getQuadricIntersection(
+    const QuadricIntersection &si) {
+    QuadricRecord &rec = *((QuadricRecord *)optixGetSbtDataPointer());
+
+    float3 rd = optixGetWorldRayDirection();
+    Vector3f wo = -Vector3f(rd.x, rd.y, rd.z);
+
+    return getQuadricIntersection(rec, si, wo, getWorldFromInstance(),
+                                  optixGetRayTime());
 }
 
 extern "C" __global__ void __closesthit__quadric() {
@@ -613,6 +636,16 @@ extern "C" __global__ void __intersection__quadric() {
 ///////////////////////////////////////////////////////////////////////////
 // Bilinear patches
 
+static __forceinline__ __device__ SurfaceInteraction getBilinearPatchIntersection(
+    const BilinearMeshRecord &rec, int primIndex, Point2f uv, Vector3f wo,
+    const Transform &worldFromInstance, Float time) {
+    wo = worldFromInstance.ApplyInverse(wo);
+
+    SurfaceInteraction intr =
+        BilinearPatch::InteractionFromIntersection(rec.mesh, primIndex, uv, time, wo);
+    return worldFromInstance(intr);
+}
+
 static __forceinline__ __device__ SurfaceInteraction
 getBilinearPatchIntersection(Point2f uv) {
     BilinearMeshRecord &rec = *((BilinearMeshRecord *)optixGetSbtDataPointer());
@@ -620,8 +653,8 @@ getBilinearPatchIntersection(Point2f uv) {
     float3 rd = optixGetWorldRayDirection();
     Vector3f wo = -Vector3f(rd.x, rd.y, rd.z);
 
-    return BilinearPatch::InteractionFromIntersection(rec.mesh, optixGetPrimitiveIndex(),
-                                                      uv, optixGetRayTime(), wo);
+    return getBilinearPatchIntersection(rec, optixGetPrimitiveIndex(), uv, wo,
+                                        getWorldFromInstance(), optixGetRayTime());
 }
 
 extern "C" __global__ void __closesthit__bilinearPatch() {
@@ -687,14 +720,201 @@ extern "C" __global__ void __intersection__bilinearPatch() {
                             FloatToBits(isect->uv[1]));
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Curves
+
+#if (OPTIX_VERSION >= 70200)
+// The ray is given in the space of the curve's GAS here.
+static __forceinline__ __device__ SurfaceInteraction getCurveIntersection(
+    const CurveRecord &rec, int segment, Float t, Float tHit, Point3f o, Vector3f d,
+    const Transform &worldFromInstance, Float time) {
+    // Evaluate the segment's B-spline and its derivative at the hit
+    const Point3f *cp = rec.cp + 4 * segment;
+    const Float *radius = rec.radius + 4 * segment;
+    Float t2 = t * t, t3 = t2 * t;
+    Float basis[4] = {(1 - t) * (1 - t) * (1 - t) / 6, (3 * t3 - 6 * t2 + 4) / 6,
+                      (-3 * t3 + 3 * t2 + 3 * t + 1) / 6, t3 / 6};
+    Float dBasis[4] = {-(1 - t) * (1 - t) / 2, (3 * t2 - 4 * t) / 2,
+                       (-3 * t2 + 2 * t + 1) / 2, t2 / 2};
+    Vector3f pc, dpdt;
+    Float r = 0;
+    for (int i = 0; i < 4; ++i) {
+        pc += basis[i] * Vector3f(cp[i]);
+        dpdt += dBasis[i] * Vector3f(cp[i]);
+        r += basis[i] * radius[i];
+    }
+
+    // Compute the hit point and the surface's local frame there
+    Point3f pHit = o + tHit * d;
+    Point2f uRange = rec.uRange[segment];
+    Vector3f dpdu = dpdt / (uRange[1] - uRange[0]);
+    if (LengthSquared(dpdu) == 0)
+        dpdu = Vector3f(1, 0, 0);
+    Vector3f toHit = pHit - Point3f(pc);
+    toHit -= Dot(toHit, dpdu) / LengthSquared(dpdu) * dpdu;
+    Vector3f n = Normalize(toHit);
+    Vector3f dpdv = Normalize(Cross(n, dpdu)) * (2 * r);
+
+    // As with the CPU curve intersection code, _v_ measures the hit's
+    // offset from the curve's center as seen along the ray
+    Vector3f side = Cross(dpdu, d);
+    Float v = 0.5f;
+    if (LengthSquared(side) > 0 && r > 0)
+        v = Clamp(0.5f + 0.5f * Dot(toHit, Normalize(side)) / r, 0, 1);
+    Float u = Lerp(t, uRange[0], uRange[1]);
+
+    Vector3f wo = -Normalize(d);
+    Vector3f pError(4 * r, 4 * r, 4 * r);
+    SurfaceInteraction intr(Point3fi(pHit, pError), Point2f(u, v), wo, dpdu, dpdv,
+                            Normal3f(), Normal3f(), time, rec.reverseOrientation);
+    return worldFromInstance(intr);
+}
+
+static __forceinline__ __device__ SurfaceInteraction getCurveIntersection() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    float3 org = optixGetObjectRayOrigin();
+    float3 dir = optixGetObjectRayDirection();
+    return getCurveIntersection(rec, optixGetPrimitiveIndex(), optixGetCurveParameter(),
+                                optixGetRayTmax(), Point3f(org.x, org.y, org.z),
+                                Vector3f(dir.x, dir.y, dir.z), getWorldFromInstance(),
+                                optixGetRayTime());
+}
+
+static __forceinline__ __device__ bool alphaKilled(const CurveRecord &rec) {
+    if (!rec.alphaTexture)
+        return false;
+
+    SurfaceInteraction intr = getCurveIntersection();
+
+    BasicTextureEvaluator eval;
+    Float alpha = eval(rec.alphaTexture, intr);
+    if (alpha >= 1)
+        return false;
+    if (alpha <= 0)
+        return true;
+    else {
+        float3 o = optixGetWorldRayOrigin();
+        float3 d = optixGetWorldRayDirection();
+        Float u = uint32_t(Hash(o, d)) * 0x1p-32f;
+        return u > alpha;
+    }
+}
+
+extern "C" __global__ void __closesthit__curve() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    SurfaceInteraction intr = getCurveIntersection();
+
+    if (rec.mediumInterface && rec.mediumInterface->IsMediumTransition())
+        intr.mediumInterface = rec.mediumInterface;
+    intr.material = rec.material;
+    if (!rec.areaLights.empty())
+        intr.areaLight = rec.areaLights[optixGetPrimitiveIndex()];
+
+    ProcessClosestIntersection(intr);
+}
+
+extern "C" __global__ void __anyhit__curve() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    if (alphaKilled(rec))
+        optixIgnoreIntersection();
+}
+
+extern "C" __global__ void __anyhit__shadowCurve() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    if (rec.material && rec.material.IsTransparent())
+        optixIgnoreIntersection();
+
+    if (alphaKilled(rec))
+        optixIgnoreIntersection();
+}
+#endif  // OPTIX_VERSION >= 70200
+
 ///////////////////////////////////////////////////////////////////////////
 // Random hit (for subsurface scattering)
 
+// RandomHitCandidate records the information about a probe ray hit that is
+// needed to compute its SubsurfaceInteraction. The any-hit programs only
+// do reservoir selection over these; the interaction is computed once for
+// the selected hit after traversal is finished.
+struct RandomHitCandidate {
+    enum Type { TriangleHit, BilinearPatchHit, QuadricHit, CurveHit };
+    Type type;
+    const void *rec;
+    int primIndex;
+    // Barycentrics, (u,v), the quadric's pObj and phi, or the curve parameter
+    float attrib[4];
+    float tHit;
+    float worldFromInstance[12];
+};
+
 struct RandomHitPayload {
-    WeightedReservoirSampler<SubsurfaceInteraction> wrs;
+    WeightedReservoirSampler<RandomHitCandidate> wrs;
     MaterialHandle material;
 };
 
+static __forceinline__ __device__ void addRandomHitCandidate(
+    RandomHitCandidate::Type type, float a0, float a1 = 0, float a2 = 0, float a3 = 0) {
+    RandomHitPayload *p = getPayload<RandomHitPayload>();
+    p->wrs.Add(
+        [&] PBRT_CPU_GPU() {
+            RandomHitCandidate c;
+            c.type = type;
+            c.rec = optixGetSbtDataPointer();
+            c.primIndex = optixGetPrimitiveIndex();
+            c.attrib[0] = a0;
+            c.attrib[1] = a1;
+            c.attrib[2] = a2;
+            c.attrib[3] = a3;
+            c.tHit = optixGetRayTmax();
+            optixGetObjectToWorldTransformMatrix(c.worldFromInstance);
+            return c;
+        },
+        1.f);
+}
+
+static __device__ SubsurfaceInteraction
+getRandomHitInteraction(const RandomHitCandidate &c, const Ray &ray) {
+    const float *m = c.worldFromInstance;
+    Transform worldFromInstance(SquareMatrix<4>(m[0], m[1], m[2], m[3], m[4], m[5], m[6],
+                                                m[7], m[8], m[9], m[10], m[11], 0.f, 0.f,
+                                                0.f, 1.f));
+    Vector3f wo = -ray.d;
+
+    switch (c.type) {
+    case RandomHitCandidate::TriangleHit:
+        return getTriangleIntersection(*(const TriangleMeshRecord *)c.rec, c.primIndex,
+                                       c.attrib[0], c.attrib[1], c.tHit, wo,
+                                       worldFromInstance, ray.time);
+    case RandomHitCandidate::BilinearPatchHit:
+        return getBilinearPatchIntersection(
+            *(const BilinearMeshRecord *)c.rec, c.primIndex,
+            Point2f(c.attrib[0], c.attrib[1]), wo, worldFromInstance, ray.time);
+    case RandomHitCandidate::QuadricHit: {
+        QuadricIntersection qi;
+        qi.pObj = Point3f(c.attrib[0], c.attrib[1], c.attrib[2]);
+        qi.phi = c.attrib[3];
+        return getQuadricIntersection(*(const QuadricRecord *)c.rec, qi, wo,
+                                      worldFromInstance, ray.time);
+    }
+#if (OPTIX_VERSION >= 70200)
+    case RandomHitCandidate::CurveHit: {
+        return getCurveIntersection(*(const CurveRecord *)c.rec, c.primIndex,
+                                    c.attrib[0], c.tHit,
+                                    worldFromInstance.ApplyInverse(ray.o),
+                                    worldFromInstance.ApplyInverse(ray.d),
+                                    worldFromInstance, ray.time);
+    }
+#endif
+    default:
+        assert(!"unexpected random hit type");
+        return {};
+    }
+}
+
 extern "C" __global__ void __raygen__randomHit() {
     // Keep as uint32_t so can pass directly to optixTrace.
     uint32_t index = optixGetLaunchIndex().x;
@@ -715,16 +935,17 @@ extern "C" __global__ void __raygen__randomHit() {
     PBRT_DBG("Randomhit raygen ray.o %f %f %f ray.d %f %f %f tMax %f\n", ray.o.x, ray.o.y,
         ray.o.z, ray.d.x, ray.d.y, ray.d.z, tMax);
 
-    Trace(params.traversable, ray, 0.f /* tMin */, tMax, OPTIX_RAY_FLAG_NONE, ptr0, ptr1);
+    Trace(params.traversable, ray, 0.f /* tMin */, tMax,
+          OPTIX_RAY_FLAG_DISABLE_CLOSESTHIT, ptr0, ptr1);
 
     if (payload.wrs.HasSample() &&
         payload.wrs.WeightSum() > 0) {  // TODO: latter check shouldn't be needed...
-        const SubsurfaceInteraction &si = payload.wrs.GetSample();
+        SubsurfaceInteraction si = getRandomHitInteraction(payload.wrs.GetSample(), ray);
         PBRT_DBG("optix si p %f %f %f n %f %f %f\n", si.p().x, si.p().y, si.p().z, si.n.x,
             si.n.y, si.n.z);
 
         params.subsurfaceScatterQueue->weight[index] = payload.wrs.WeightSum();
-        params.subsurfaceScatterQueue->ssi[index] = payload.wrs.GetSample();
+        params.subsurfaceScatterQueue->ssi[index] = si;
     } else
         params.subsurfaceScatterQueue->weight[index] = 0;
 }
@@ -738,7 +959,9 @@ extern "C" __global__ void __anyhit__randomHitTriangle() {
         rec.material.ptr(), p->material.ptr());
 
     if (rec.material == p->material)
-        p->wrs.Add([&] PBRT_CPU_GPU() { return getTriangleIntersection(); }, 1.f);
+        addRandomHitCandidate(RandomHitCandidate::TriangleHit,
+                              optixGetTriangleBarycentrics().x,
+                              optixGetTriangleBarycentrics().y);
 
     optixIgnoreIntersection();
 }
@@ -752,13 +975,9 @@ extern "C" __global__ void __anyhit__randomHitBilinearPatch() {
         rec.material.ptr(), p->material.ptr());
 
     if (rec.material == p->material)
-        p->wrs.Add(
-            [&] PBRT_CPU_GPU() {
-                Point2f uv(BitsToFloat(optixGetAttribute_0()),
-                           BitsToFloat(optixGetAttribute_1()));
-                return getBilinearPatchIntersection(uv);
-            },
-            1.f);
+        addRandomHitCandidate(RandomHitCandidate::BilinearPatchHit,
+                              BitsToFloat(optixGetAttribute_0()),
+                              BitsToFloat(optixGetAttribute_1()));
 
     optixIgnoreIntersection();
 }
@@ -771,19 +990,28 @@ extern "C" __global__ void __anyhit__randomHitQuadric() {
     PBRT_DBG("Anyhit quadric for random hit: rec.material %p params.materials %p\n",
         rec.material.ptr(), p->material.ptr());
 
-    if (rec.material == p->material) {
-        p->wrs.Add(
-            [&] PBRT_CPU_GPU() {
-                QuadricIntersection qi;
-                qi.pObj = Point3f(BitsToFloat(optixGetAttribute_0()),
-                                  BitsToFloat(optixGetAttribute_1()),
-                                  BitsToFloat(optixGetAttribute_2()));
-                qi.phi = BitsToFloat(optixGetAttribute_3());
-
-                return getQuadricIntersection(qi);
-            },
-            1.f);
-    }
+    if (rec.material == p->material)
+        addRandomHitCandidate(RandomHitCandidate::QuadricHit,
+                              BitsToFloat(optixGetAttribute_0()),
+                              BitsToFloat(optixGetAttribute_1()),
+                              BitsToFloat(optixGetAttribute_2()),
+                              BitsToFloat(optixGetAttribute_3()));
+
+    optixIgnoreIntersection();
+}
+
+#if (OPTIX_VERSION >= 70200)
+extern "C" __global__ void __anyhit__randomHitCurve() {
+    const CurveRecord &rec = *(const CurveRecord *)optixGetSbtDataPointer();
+
+    RandomHitPayload *p = getPayload<RandomHitPayload>();
+
+    PBRT_DBG("Anyhit curve for random hit: rec.material %p params.materials %p\n",
+        rec.material.ptr(), p->material.ptr());
+
+    if (rec.material == p->material)
+        addRandomHitCandidate(RandomHitCandidate::CurveHit, optixGetCurveParameter());
 
     optixIgnoreIntersection();
 }
+#endif  // OPTIX_VERSION >= 70200
@@ -47,6 +47,21 @@ struct QuadricRecord {
     MediumInterface *mediumInterface;
 };
 
+// Curves are intersected with OptiX's built-in round cubic B-spline
+// primitives; each of a shape's segments has four control points and radii
+// in _cp_ and _radius_, and _uRange_ gives its extent in the curve's
+// parameterization.
+struct CurveRecord {
+    const Point3f *cp;
+    const Float *radius;
+    const Point2f *uRange;
+    bool reverseOrientation;
+    MaterialHandle material;
+    FloatTextureHandle alphaTexture;
+    pstd::span<LightHandle> areaLights;
+    MediumInterface *mediumInterface;
+};
+
 struct RayIntersectParameters {
     OptixTraversableHandle traversable;
 
@@ -9,16 +9,20 @@
 #include <pbrt/film.h>
 #include <pbrt/filters.h>
 #include <pbrt/gpu/accel.h>
+#include <pbrt/gpu/init.h>
 #include <pbrt/gpu/launch.h>
 #include <pbrt/gpu/optix.h>
+#include <pbrt/gpu/sppm.h>
 #include <pbrt/lights.h>
 #include <pbrt/lightsamplers.h>
+#include <pbrt/options.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/display.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/log.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/progressreporter.h>
 #include <pbrt/util/pstd.h>
@@ -27,13 +31,18 @@
 #include <pbrt/util/string.h>
 #include <pbrt/util/taggedptr.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <thread>
+#include <vector>
 
 #include <cuda.h>
 #include <cuda_runtime.h>
+#include <cub/cub.cuh>
 
 #ifdef NVTX
 #ifdef PBRT_IS_WINDOWS
@@ -50,7 +59,7 @@ namespace pbrt {
 STAT_MEMORY_COUNTER("Memory/GPU path integrator pixel state", pathIntegratorBytes);
 
 GPUPathIntegrator::GPUPathIntegrator(Allocator alloc, const ParsedScene &scene)
-    : envLights(alloc) {
+    : allLights(alloc), envLights(alloc) {
     // Allocate all of the data structures that represent the scene...
     std::map<std::string, MediumHandle> media = scene.CreateMedia(alloc);
 
@@ -87,6 +96,7 @@ GPUPathIntegrator::GPUPathIntegrator(Allocator alloc, const ParsedScene &scene)
     film = FilmHandle::Create(scene.film.name, scene.film.parameters, exposureTime,
                               filter, &scene.film.loc, alloc);
     initializeVisibleSurface = film.UsesVisibleSurface();
+    filmColorSpace = scene.film.parameters.ColorSpace();
 
     sampler = SamplerHandle::Create(scene.sampler.name, scene.sampler.parameters,
                                     film.FullResolution(), &scene.sampler.loc, alloc);
@@ -96,8 +106,6 @@ GPUPathIntegrator::GPUPathIntegrator(Allocator alloc, const ParsedScene &scene)
                                   cameraMedium, scene.camera.cameraTransform, film,
                                   &scene.camera.loc, alloc);
 
-    pstd::vector<LightHandle> allLights;
-
     for (const auto &light : scene.lights) {
         MediumHandle outsideMedium = findMedium(light.medium, &light.loc);
         if (light.renderFromObject.IsAnimated())
@@ -134,174 +142,365 @@ GPUPathIntegrator::GPUPathIntegrator(Allocator alloc, const ParsedScene &scene)
 
         MediumHandle outsideMedium = findMedium(shape.outsideMedium, &shape.loc);
 
+        if (renderFromLight.IsAnimated())
+            ErrorExit(&shape.loc, "Animated lights are not supported.");
         pstd::vector<LightHandle> *lightsForShape =
-            alloc.new_object<pstd::vector<LightHandle>>(alloc);
-        for (ShapeHandle sh : shapeHandles) {
-            if (renderFromLight.IsAnimated())
-                ErrorExit(&shape.loc, "Animated lights are not supported.");
-            DiffuseAreaLight *area = DiffuseAreaLight::Create(
-                renderFromLight.startTransform, outsideMedium, areaLightEntity.parameters,
-                areaLightEntity.parameters.ColorSpace(), &areaLightEntity.loc, alloc, sh);
-            allLights.push_back(area);
-            lightsForShape->push_back(area);
-        }
+            alloc.new_object<pstd::vector<LightHandle>>(LightHandle::CreateAreaLights(
+                areaLightEntity.name, areaLightEntity.parameters,
+                renderFromLight.startTransform, MediumInterface(outsideMedium),
+                shapeHandles, &areaLightEntity.loc, alloc));
+        allLights.insert(allLights.end(), lightsForShape->begin(), lightsForShape->end());
         shapeIndexToAreaLights[i] = lightsForShape;
     }
 
     haveBasicEvalMaterial.fill(false);
+    haveNonConstantBasicEvalMaterial.fill(false);
     haveUniversalEvalMaterial.fill(false);
     haveSubsurface = false;
     accel = new GPUAccel(scene, alloc, nullptr /* cuda stream */, shapeIndexToAreaLights,
-                         media, &haveBasicEvalMaterial, &haveUniversalEvalMaterial,
-                         &haveSubsurface);
+                         media, &haveBasicEvalMaterial, &haveNonConstantBasicEvalMaterial,
+                         &haveUniversalEvalMaterial, &haveSubsurface);
 
     // Preprocess the light sources
     for (LightHandle light : allLights)
         light.Preprocess(accel->Bounds());
 
+    // Determine the preview mode, if any, from the integrator name
+    const ParameterDictionary &integratorParameters = scene.integrator.parameters;
+    if (scene.integrator.name == "ambientocclusion") {
+        previewMode = PreviewMode::AmbientOcclusion;
+        aoCosSample = integratorParameters.GetOneBool("cossample", true);
+        aoMaxDistance = integratorParameters.GetOneFloat("maxdistance", Infinity);
+    } else if (scene.integrator.name == "preview") {
+        std::string mode = integratorParameters.GetOneString("mode", "albedo");
+        if (mode == "albedo")
+            previewMode = PreviewMode::Albedo;
+        else if (mode == "normal")
+            previewMode = PreviewMode::Normal;
+        else if (mode != "direct")
+            ErrorExit(&scene.integrator.loc,
+                      "%s: unknown \"preview\" integrator mode. Must be \"albedo\", "
+                      "\"normal\", or \"direct\".",
+                      mode);
+    } else if (scene.integrator.name != "path" && scene.integrator.name != "volpath" &&
+               scene.integrator.name != "sppm")
+        Warning(&scene.integrator.loc,
+                "The GPU renderer only supports the \"volpath\", \"sppm\", "
+                "\"ambientocclusion\", and \"preview\" integrators. Using \"volpath\".");
+    // As with the CPU's ambient occlusion integrator, preview images are lit
+    // by the film color space's illuminant, normalized to unit luminance.
+    previewIlluminant = &filmColorSpace->illuminant;
+    previewIllumScale = 1 / SpectrumToPhotometric(previewIlluminant);
+    if (previewMode != PreviewMode::None && haveMedia)
+        Warning(&scene.integrator.loc,
+                "Participating media are ignored by the GPU \"%s\" integrator.",
+                scene.integrator.name);
+
     bool haveLights = !allLights.empty();
     for (const auto &m : media)
         haveLights |= m.second.IsEmissive();
-    if (!haveLights)
+    if (!haveLights && previewMode == PreviewMode::None)
         ErrorExit("No light sources specified");
 
     std::string lightSamplerName =
         scene.integrator.parameters.GetOneString("lightsampler", "bvh");
     if (allLights.size() == 1)
         lightSamplerName = "uniform";
+    AssignLightIndices(allLights);
     lightSampler = LightSamplerHandle::Create(lightSamplerName, allLights, alloc);
 
-    if (scene.integrator.name != "path" && scene.integrator.name != "volpath")
-        Warning(&scene.integrator.loc,
-                "The GPU renderer always uses a \"volpath\" integrator.");
-
     // Integrator parameters
     regularize = scene.integrator.parameters.GetOneBool("regularize", false);
     maxDepth = scene.integrator.parameters.GetOneInt("maxdepth", 5);
+    // The preview integrators' camera rays end at their first intersection;
+    // the "direct" mode is the path integrator limited to direct lighting.
+    if (scene.integrator.name == "preview" || previewMode != PreviewMode::None)
+        maxDepth = 1;
 
     // Warn about unsupported stuff...
     if (Options->forceDiffuse)
         Warning("The GPU rendering path does not support --force-diffuse.");
-    if (Options->writePartialImages)
-        Warning("The GPU rendering path does not support --write-partial-images.");
     if (Options->recordPixelStatistics)
         Warning("The GPU rendering path does not support --pixelstats.");
-    if (!Options->mseReferenceImage.empty())
-        Warning("The GPU rendering path does not support --mse-reference-image.");
-    if (!Options->mseReferenceOutput.empty())
-        Warning("The GPU rendering path does not support --mse-reference-out.");
 
     ///////////////////////////////////////////////////////////////////////////
     // Allocate storage for all of the queues/buffers...
 
     CUDATrackedMemoryResource *mr =
-        dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource());
+        dynamic_cast<CUDATrackedMemoryResource *>(alloc.resource());
     CHECK(mr != nullptr);
     size_t startSize = mr->BytesAllocated();
 
-    // Compute number of scanlines to render per pass
+    // Sorting the material evaluation queues makes texture lookups more
+    // coherent, which only matters for image textures.
+    auto isImageTexture = [](const auto &tex) {
+        return tex.second.texName == "imagemap" || tex.second.texName == "ptex";
+    };
+    bool haveImageTextures =
+        std::any_of(scene.floatTextures.begin(), scene.floatTextures.end(),
+                    isImageTexture) ||
+        std::any_of(scene.spectrumTextures.begin(), scene.spectrumTextures.end(),
+                    isImageTexture);
+    bool sortMaterials = !Options->gpuDisableMaterialSort && haveImageTextures;
+
+    // Compute the number of paths to trace in parallel
     Vector2i resolution = film.PixelBounds().Diagonal();
-    // TODO: make this configurable. Base it on the amount of GPU memory?
-    int maxSamples = 1024 * 1024;
-    scanlinesPerPass = std::max(1, maxSamples / resolution.x);
+    int64_t maxSamples = Options->gpuPaths;
+    if (maxSamples == 0) {
+        // Use half of the GPU memory that will be free once the scene's
+        // data has been copied to the GPU for the queues.
+        // MaterialEvalWorkItem's size doesn't depend on the material type.
+        int nMaterialQueues =
+            std::count(haveBasicEvalMaterial.begin(), haveBasicEvalMaterial.end(), true) +
+            std::count(haveUniversalEvalMaterial.begin(), haveUniversalEvalMaterial.end(),
+                       true);
+        size_t bytesPerPath = sizeof(PixelSampleState) + 2 * sizeof(RayWorkItem) +
+                              sizeof(ShadowRayWorkItem) + sizeof(HitAreaLightWorkItem) +
+                              nMaterialQueues * sizeof(MaterialEvalWorkItem<void>);
+        if (haveSubsurface)
+            bytesPerPath += sizeof(GetBSSRDFAndProbeRayWorkItem) +
+                            sizeof(SubsurfaceScatterWorkItem);
+        if (envLights.size())
+            bytesPerPath += sizeof(EscapedRayWorkItem);
+        if (haveMedia)
+            bytesPerPath +=
+                2 * sizeof(MediumSampleWorkItem) + sizeof(MediumScatterWorkItem);
+        if (sortMaterials)
+            bytesPerPath += 2 * (sizeof(uint64_t) + sizeof(int));
+
+        size_t sceneBytes = mr->BytesAllocated();
+        CUDATrackedMemoryResource *sharedResource =
+            dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource());
+        if (sharedResource && sharedResource != mr)
+            sceneBytes += sharedResource->BytesAllocated();
+        size_t freeBytes, totalBytes;
+        CUDA_CHECK(cudaMemGetInfo(&freeBytes, &totalBytes));
+        size_t availableBytes = freeBytes > sceneBytes ? freeBytes - sceneBytes : 0;
+        maxSamples = availableBytes / 2 / bytesPerPath;
+        LOG_VERBOSE("%d bytes free on the GPU, %d for the scene, %d bytes per path",
+                    freeBytes, sceneBytes, bytesPerPath);
+    }
+    // Render at least one scanline but no more than the whole image per pass
+    if (maxSamples < resolution.x && Options->gpuPaths > 0)
+        Warning("--gpu-paths %d is less than the image width; tracing %d paths at once.",
+                Options->gpuPaths, resolution.x);
+    maxSamples = Clamp(maxSamples, resolution.x, int64_t(resolution.x) * resolution.y);
+
+    // Compute number of scanlines to render per pass
+    scanlinesPerPass = std::max<int>(1, maxSamples / resolution.x);
     int nPasses = (resolution.y + scanlinesPerPass - 1) / scanlinesPerPass;
     scanlinesPerPass = (resolution.y + nPasses - 1) / nPasses;
     maxQueueSize = resolution.x * scanlinesPerPass;
     LOG_VERBOSE("Will render in %d passes %d scanlines per pass\n", nPasses,
                 scanlinesPerPass);
 
-    pixelSampleState = SOA<PixelSampleState>(maxQueueSize, alloc);
+    // Find how many threads the GPU can run at once for sparse depths
+    queueLaunchSize = maxQueueSize;
+    int device, nSMs, threadsPerSM;
+    CUDA_CHECK(cudaGetDevice(&device));
+    CUDA_CHECK(cudaDeviceGetAttribute(&nSMs, cudaDevAttrMultiProcessorCount, device));
+    CUDA_CHECK(cudaDeviceGetAttribute(&threadsPerSM,
+                                      cudaDevAttrMaxThreadsPerMultiProcessor, device));
+    tailLaunchSize = std::min(maxQueueSize, nSMs * threadsPerSM);
+    if (tailLaunchSize == maxQueueSize)
+        tailStartDepth = maxDepth + 1;
+
+    // The queues' items and the pixel sample state are only accessed by
+    // kernels, so they are stored in device memory, which isn't migrated
+    // like managed memory. The queue objects themselves, which are
+    // constructed on the host, stay in managed memory.
+    CUDADeviceMemoryResource *deviceResource = new CUDADeviceMemoryResource;
+    Allocator queueAlloc(deviceResource);
 
-    rayQueues[0] = alloc.new_object<RayQueue>(maxQueueSize, alloc);
-    rayQueues[1] = alloc.new_object<RayQueue>(maxQueueSize, alloc);
+    pixelSampleState = SOA<PixelSampleState>(maxQueueSize, queueAlloc);
 
-    shadowRayQueue = alloc.new_object<ShadowRayQueue>(maxQueueSize, alloc);
+    rayQueues[0] = alloc.new_object<RayQueue>(maxQueueSize, queueAlloc);
+    rayQueues[1] = alloc.new_object<RayQueue>(maxQueueSize, queueAlloc);
+
+    shadowRayQueue = alloc.new_object<ShadowRayQueue>(maxQueueSize, queueAlloc);
 
     if (haveSubsurface) {
         bssrdfEvalQueue =
-            alloc.new_object<GetBSSRDFAndProbeRayQueue>(maxQueueSize, alloc);
+            alloc.new_object<GetBSSRDFAndProbeRayQueue>(maxQueueSize, queueAlloc);
         subsurfaceScatterQueue =
-            alloc.new_object<SubsurfaceScatterQueue>(maxQueueSize, alloc);
+            alloc.new_object<SubsurfaceScatterQueue>(maxQueueSize, queueAlloc);
     }
 
     if (envLights.size())
-        escapedRayQueue = alloc.new_object<EscapedRayQueue>(maxQueueSize, alloc);
-    hitAreaLightQueue = alloc.new_object<HitAreaLightQueue>(maxQueueSize, alloc);
+        escapedRayQueue = alloc.new_object<EscapedRayQueue>(maxQueueSize, queueAlloc);
+    hitAreaLightQueue = alloc.new_object<HitAreaLightQueue>(maxQueueSize, queueAlloc);
 
     basicEvalMaterialQueue = alloc.new_object<MaterialEvalQueue>(
-        maxQueueSize, alloc,
+        maxQueueSize, queueAlloc,
         pstd::MakeConstSpan(&haveBasicEvalMaterial[1], haveBasicEvalMaterial.size() - 1));
     universalEvalMaterialQueue = alloc.new_object<MaterialEvalQueue>(
-        maxQueueSize, alloc,
+        maxQueueSize, queueAlloc,
         pstd::MakeConstSpan(&haveUniversalEvalMaterial[1],
                             haveUniversalEvalMaterial.size() - 1));
 
+    // Each sort is a handful of kernel launches and passes over all of the
+    // queue's entries; with small queues, that costs more than the more
+    // coherent texture lookups save.
+    sortMaterialEvalQueues = sortMaterials && maxQueueSize >= 65536;
+    if (sortMaterialEvalQueues) {
+        LOG_VERBOSE("Sorting material evaluation queues");
+        AllocateMaterialEvalSort(queueAlloc);
+    }
+
     if (haveMedia) {
-        mediumSampleQueue = alloc.new_object<MediumSampleQueue>(maxQueueSize, alloc);
-        mediumScatterQueue = alloc.new_object<MediumScatterQueue>(maxQueueSize, alloc);
+        mediumSampleQueue = alloc.new_object<MediumSampleQueue>(maxQueueSize, queueAlloc);
+        mediumResumeQueue = alloc.new_object<MediumSampleQueue>(maxQueueSize, queueAlloc);
+        mediumScatterQueue =
+            alloc.new_object<MediumScatterQueue>(maxQueueSize, queueAlloc);
+    }
+
+    if (film.RequestedAOVs() & AOVFlags::Cost)
+        pixelCosts = queueAlloc.allocate_object<PixelCostSample>(maxQueueSize);
+
+    if (Options->adaptiveThreshold > 0) {
+        // Allocate pixel statistics and active pixel list for adaptive sampling
+        int nPixels = film.PixelBounds().Area();
+        pixelVariance = queueAlloc.allocate_object<VarianceEstimator<Float>>(nPixels);
+        pixelActive = queueAlloc.allocate_object<bool>(nPixels);
+        activePixels = queueAlloc.allocate_object<int>(nPixels);
+        activePixelCount = alloc.new_object<int>(0);
+        VarianceEstimator<Float> *variance = pixelVariance;
+        GPUParallelFor(
+            "Initialize pixel variance", nPixels,
+            PBRT_GPU_LAMBDA(int pixelIndex) {
+                variance[pixelIndex] = VarianceEstimator<Float>();
+            });
+        CUDA_CHECK(cub::DeviceSelect::Flagged(
+            nullptr, activePixelsTempBytes, cub::CountingInputIterator<int>(0),
+            pixelActive, activePixels, activePixelCount, nPixels));
+        CUDA_CHECK(cudaMalloc(&activePixelsTempStorage, activePixelsTempBytes));
     }
 
     stats = alloc.new_object<Stats>(maxDepth, alloc);
+    passState = alloc.new_object<PassState>();
 
-    size_t endSize = mr->BytesAllocated();
+    size_t endSize = mr->BytesAllocated() + deviceResource->BytesAllocated();
     pathIntegratorBytes += endSize - startSize;
+    stats->pathsPerPass = maxQueueSize;
+    stats->passes = nPasses;
+    stats->queueBytes =
+        endSize - startSize + materialSortTempBytes + activePixelsTempBytes;
 }
 
+// GPUFilmReadback Definition
+// GPUFilmReadback copies snapshots of the film's RGB pixel values to the host
+// for the display server and partial images without stalling rendering: a
+// kernel on the rendering stream computes them in device memory and a
+// separate copy stream copies them to pinned host memory once it finishes.
+// There are two buffers, so that a snapshot can be started while the
+// previous one is still being copied.
+class GPUFilmReadback {
+  public:
+    GPUFilmReadback(FilmHandle film) : film(film) {
+        Vector2i resolution = film.PixelBounds().Diagonal();
+        nPixels = resolution.x * resolution.y;
+        for (Buffer &buffer : buffers) {
+            CUDA_CHECK(cudaMalloc(&buffer.deviceRGB, nPixels * sizeof(RGB)));
+            CUDA_CHECK(cudaMallocHost(&buffer.hostRGB, nPixels * sizeof(RGB)));
+            CUDA_CHECK(
+                cudaEventCreateWithFlags(&buffer.readyEvent, cudaEventDisableTiming));
+            CUDA_CHECK(
+                cudaEventCreateWithFlags(&buffer.copiedEvent, cudaEventDisableTiming));
+        }
+        CUDA_CHECK(cudaStreamCreateWithFlags(&copyStream, cudaStreamNonBlocking));
+    }
+
+    ~GPUFilmReadback() {
+        for (Buffer &buffer : buffers) {
+            CUDA_CHECK(cudaEventSynchronize(buffer.copiedEvent));
+            CUDA_CHECK(cudaFree(buffer.deviceRGB));
+            CUDA_CHECK(cudaFreeHost(buffer.hostRGB));
+            CUDA_CHECK(cudaEventDestroy(buffer.readyEvent));
+            CUDA_CHECK(cudaEventDestroy(buffer.copiedEvent));
+        }
+        CUDA_CHECK(cudaStreamDestroy(copyStream));
+    }
+
+    // Starts a snapshot of the film as it will be once the kernels launched
+    // so far have finished, when each pixel has _spp_ samples.
+    void Snapshot(int spp) {
+        Buffer &buffer = buffers[next];
+        next ^= 1;
+        // Wait for the buffer's previous snapshot if it's still being copied
+        if (buffer.spp > 0)
+            CUDA_CHECK(cudaEventSynchronize(buffer.copiedEvent));
+        buffer.spp = spp;
+
+        FilmHandle film = this->film;
+        Bounds2i pixelBounds = film.PixelBounds();
+        int xResolution = pixelBounds.Diagonal().x;
+        RGB *rgb = buffer.deviceRGB;
+        GPUParallelFor(
+            "Snapshot film", nPixels, PBRT_GPU_LAMBDA(int index) {
+                Point2i pPixel(pixelBounds.pMin.x + index % xResolution,
+                               pixelBounds.pMin.y + index / xResolution);
+                rgb[index] = film.GetPixelRGB(pPixel);
+            });
+
+        CUDA_CHECK(cudaEventRecord(buffer.readyEvent, GPUStream()));
+        CUDA_CHECK(cudaStreamWaitEvent(copyStream, buffer.readyEvent, 0));
+        CUDA_CHECK(cudaMemcpyAsync(buffer.hostRGB, buffer.deviceRGB,
+                                   nPixels * sizeof(RGB), cudaMemcpyDeviceToHost,
+                                   copyStream));
+        CUDA_CHECK(cudaEventRecord(buffer.copiedEvent, copyStream));
+    }
+
+    // Returns the most recent snapshot that has been copied to the host and
+    // wasn't returned before, or nullptr if there's none. With _wait_, waits
+    // for the most recent snapshot's copy to finish. The values remain valid
+    // until the second following call to Snapshot().
+    const RGB *Poll(int *spp, bool wait = false) {
+        // Check the most recently started snapshot first
+        for (int index : {next ^ 1, next}) {
+            Buffer &buffer = buffers[index];
+            if (buffer.spp <= polledSpp)
+                continue;
+            if (wait)
+                CUDA_CHECK(cudaEventSynchronize(buffer.copiedEvent));
+            else if (cudaEventQuery(buffer.copiedEvent) != cudaSuccess)
+                continue;
+            polledSpp = *spp = buffer.spp;
+            return buffer.hostRGB;
+        }
+        return nullptr;
+    }
+
+  private:
+    struct Buffer {
+        RGB *deviceRGB = nullptr, *hostRGB = nullptr;
+        cudaEvent_t readyEvent, copiedEvent;
+        int spp = 0;
+    };
+
+    FilmHandle film;
+    int nPixels;
+    Buffer buffers[2];
+    int next = 0, polledSpp = 0;
+    cudaStream_t copyStream = nullptr;
+};
+
 // GPUPathIntegrator Method Definitions
-void GPUPathIntegrator::Render() {
+int GPUPathIntegrator::Render() {
     Vector2i resolution = film.PixelBounds().Diagonal();
     int spp = sampler.SamplesPerPixel();
-    // Launch thread to copy image for display server, if enabled
-    RGB *displayRGB = nullptr, *displayRGBHost = nullptr;
-    std::atomic<bool> exitCopyThread{false};
-    std::thread copyThread;
+    // Snapshots of the film are copied to the host for the display server
+    // and partial images while rendering continues.
+    std::unique_ptr<GPUFilmReadback> filmReadback;
+    if (!Options->displayServer.empty() || Options->writePartialImages)
+        filmReadback = std::make_unique<GPUFilmReadback>(film);
 
+    RGB *displayRGBHost = nullptr;
     if (!Options->displayServer.empty()) {
-        // Allocate staging memory on the GPU to store the current WIP
-        // image.
-        CUDA_CHECK(cudaMalloc(&displayRGB, resolution.x * resolution.y * sizeof(RGB)));
-        CUDA_CHECK(cudaMemset(displayRGB, 0, resolution.x * resolution.y * sizeof(RGB)));
-
         // Host-side memory for the WIP Image.  We'll just let this leak so
         // that the lambda passed to DisplayDynamic below doesn't access
         // freed memory after Render() returns...
         displayRGBHost = new RGB[resolution.x * resolution.y];
 
-        copyThread = std::thread([&]() {
-#ifdef NVTX
-#ifdef PBRT_IS_WINDOWS
-            nvtxNameOsThread(GetCurrentThreadId(), "DISPLAY_SERVER_COPY_THREAD");
-#else
-            nvtxNameOsThread(syscall(SYS_gettid), "DISPLAY_SERVER_COPY_THREAD");
-#endif
-#endif
-            // Copy back to the CPU using a separate stream so that we can
-            // periodically but asynchronously pick up the latest results
-            // from the GPU.
-            cudaStream_t memcpyStream;
-            CUDA_CHECK(cudaStreamCreate(&memcpyStream));
-#ifdef NVTX
-            nvtxNameCuStream(memcpyStream, "DISPLAY_SERVER_COPY_STREAM");
-#endif
-
-            // Copy back to the host from the GPU buffer, without any
-            // synthronization.
-            while (!exitCopyThread) {
-                CUDA_CHECK(cudaMemcpyAsync(displayRGBHost, displayRGB,
-                                           resolution.x * resolution.y * sizeof(RGB),
-                                           cudaMemcpyDeviceToHost, memcpyStream));
-                std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-                CUDA_CHECK(cudaStreamSynchronize(memcpyStream));
-            }
-
-            // Copy one more time to get the final image before exiting.
-            CUDA_CHECK(cudaMemcpy(displayRGBHost, displayRGB,
-                                  resolution.x * resolution.y * sizeof(RGB),
-                                  cudaMemcpyDeviceToHost));
-            CUDA_CHECK(cudaDeviceSynchronize());
-        });
-
         // Now on the CPU side, give the display system a lambda that
         // copies values from |displayRGBHost| into its buffers used for
         // sending messages to the display program (i.e., tev).
@@ -319,6 +518,43 @@ void GPUPathIntegrator::Render() {
                        });
     }
 
+    // Passes the most recent film snapshot that has reached the host to the
+    // display and, if _writeImage_ is true and the previous partial image
+    // has been written, writes it as a partial image in the background.
+    Timer renderTimer;
+    Future<void> imageWrite;
+    auto useFilmSnapshot = [&](bool wait, bool writeImage) {
+        int snapshotSpp;
+        const RGB *rgb = filmReadback->Poll(&snapshotSpp, wait);
+        if (!rgb)
+            return;
+        if (displayRGBHost)
+            std::memcpy(displayRGBHost, rgb, resolution.x * resolution.y * sizeof(RGB));
+
+        if (!writeImage || !Options->writePartialImages ||
+            (imageWrite.Valid() && !imageWrite.IsReady()))
+            return;
+        auto image = std::make_shared<Image>(
+            Image(PixelFormat::Float, Point2i(resolution), {"R", "G", "B"}));
+        for (int y = 0; y < resolution.y; ++y)
+            for (int x = 0; x < resolution.x; ++x) {
+                RGB v = rgb[x + y * resolution.x];
+                image->SetChannels({x, y}, {v.r, v.g, v.b});
+            }
+        ImageMetadata metadata;
+        camera.InitMetadata(&metadata);
+        metadata.renderTimeSeconds = renderTimer.ElapsedSeconds();
+        metadata.samplesPerPixel = snapshotSpp;
+        metadata.pixelBounds = film.PixelBounds();
+        metadata.fullResolution = film.FullResolution();
+        metadata.colorSpace = filmColorSpace;
+        // Favor speed over size for partial images
+        metadata.compressionLevel = 1;
+        std::string filename = film.GetFilename();
+        LOG_VERBOSE("Writing partial image with spp = %d", snapshotSpp);
+        imageWrite = RunAsync([=]() { image->Write(filename, metadata); });
+    };
+
     int firstSampleIndex = 0, lastSampleIndex = spp;
     // Update sample index range based on debug start, if provided
     if (!Options->debugStart.empty()) {
@@ -330,114 +566,288 @@ void GPUPathIntegrator::Render() {
         lastSampleIndex = firstSampleIndex + values[1];
     }
 
+    // With adaptive sampling, every pixel is sampled until they all have
+    // the minimum number of samples. After that, the pixels that haven't
+    // converged are found periodically, with a readback of their count, and
+    // only they are sampled, still using consecutive sample indices.
+    int nActivePixels = -1;
+    int nextActivePixelsUpdate = Options->adaptiveMinSamples;
+    int activePixelsUpdateInterval = 1;
+
+    // With an MSE reference image, the image's error is logged after 1, 2,
+    // 4, ... samples and then every 16 samples, since each measurement
+    // waits for the GPU and copies the film to the host.
+    std::unique_ptr<ReferenceErrorLog> errorLog =
+        ReferenceErrorLog::Create(film.PixelBounds());
+    int nextErrorLog = 1;
+
     ProgressReporter progress(lastSampleIndex - firstSampleIndex, "Rendering",
                               Options->quiet, true /* GPU */);
-    for (int sampleIndex = firstSampleIndex; sampleIndex < lastSampleIndex;
-         ++sampleIndex) {
+    progress.SetSamplesPerWorkUnit(film.PixelBounds().Area());
+    int sampleIndex;
+    for (sampleIndex = firstSampleIndex; sampleIndex < lastSampleIndex; ++sampleIndex) {
         // Render image for sample _sampleIndex_
-        LOG_VERBOSE("Starting to submit work for sample %d", sampleIndex);
-        Bounds2i pixelBounds = film.PixelBounds();
-        for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
-             y0 += scanlinesPerPass) {
-            // Generate camera rays for current scanline range
-            RayQueue *cameraRayQueue = CurrentRayQueue(0);
-            GPUDo(
-                "Reset ray queue", PBRT_GPU_LAMBDA() {
-                    PBRT_DBG("Starting scanlines at y0 = %d, sample %d / %d\n", y0,
-                             sampleIndex, spp);
-                    cameraRayQueue->Reset();
-                });
-            GenerateCameraRays(y0, sampleIndex);
-            GPUDo(
-                "Update camera ray stats",
-                PBRT_GPU_LAMBDA() { stats->cameraRays += cameraRayQueue->Size(); });
-
-            // Trace rays and estimate radiance up to maximum ray depth
-            for (int depth = 0; true; ++depth) {
-                // Reset queues before tracing rays
-                RayQueue *nextQueue = NextRayQueue(depth);
-                GPUDo(
-                    "Reset queues before tracing rays", PBRT_GPU_LAMBDA() {
-                        nextQueue->Reset();
-                        // Reset queues before tracing next batch of rays
-                        if (mediumSampleQueue)
-                            mediumSampleQueue->Reset();
-                        if (mediumScatterQueue)
-                            mediumScatterQueue->Reset();
-
-                        if (escapedRayQueue)
-                            escapedRayQueue->Reset();
-                        hitAreaLightQueue->Reset();
-
-                        basicEvalMaterialQueue->Reset();
-                        universalEvalMaterialQueue->Reset();
-
-                        if (bssrdfEvalQueue)
-                            bssrdfEvalQueue->Reset();
-                        if (subsurfaceScatterQueue)
-                            subsurfaceScatterQueue->Reset();
-                    });
-
-                // Follow active ray paths and accumulate radiance estimates
-                GenerateRaySamples(depth, sampleIndex);
-                // Find closest intersections along active rays
-                IntersectClosest(CurrentRayQueue(depth), escapedRayQueue,
-                                 hitAreaLightQueue, basicEvalMaterialQueue,
-                                 universalEvalMaterialQueue, mediumSampleQueue,
-                                 NextRayQueue(depth));
-
-                if (depth > 0) {
-                    // As above, with the indexing...
-                    RayQueue *statsQueue = CurrentRayQueue(depth);
-                    GPUDo(
-                        "Update indirect ray stats", PBRT_GPU_LAMBDA() {
-                            stats->indirectRays[depth] += statsQueue->Size();
-                        });
-                }
-                if (haveMedia)
-                    SampleMediumInteraction(depth);
-                if (escapedRayQueue)
-                    HandleEscapedRays(depth);
-                HandleRayFoundEmission(depth);
-                if (depth == maxDepth)
-                    break;
-                EvaluateMaterialsAndBSDFs(depth);
-                // Do immediately so that we have space for shadow rays for subsurface..
-                TraceShadowRays(depth);
-                if (haveSubsurface)
-                    SampleSubsurface(depth);
-            }
+        RenderSample(sampleIndex, nActivePixels);
+        progress.Update();
 
-            UpdateFilm();
-            // Copy updated film pixels to buffer for display
-            if (!Options->displayServer.empty())
-                GPUParallelFor(
-                    "Update Display RGB Buffer", maxQueueSize,
-                    PBRT_GPU_LAMBDA(int pixelIndex) {
-                        Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
-                        if (!InsideExclusive(pPixel, film.PixelBounds()))
-                            return;
-
-                        Point2i p(pPixel - film.PixelBounds().pMin);
-                        displayRGB[p.x + p.y * resolution.x] = film.GetPixelRGB(pPixel);
-                    });
+        if (filmReadback && sampleIndex + 1 < lastSampleIndex) {
+            filmReadback->Snapshot(sampleIndex + 1 - firstSampleIndex);
+            useFilmSnapshot(false, true);
         }
 
-        progress.Update();
+        int samplesTaken = sampleIndex + 1 - firstSampleIndex;
+        if (errorLog &&
+            (samplesTaken == nextErrorLog || sampleIndex + 1 == lastSampleIndex)) {
+            GPUWait();
+            double elapsed = renderTimer.ElapsedSeconds();
+            ImageMetadata metadata;
+            errorLog->Add(film.GetImage(&metadata), samplesTaken, elapsed);
+            nextErrorLog = samplesTaken + std::min(samplesTaken, 16);
+        }
+
+        // Update the active pixels for adaptive sampling; as with the CPU
+        // integrators' waves, the interval between updates doubles, here up
+        // to 16 samples, since each one waits for the GPU.
+        if (pixelVariance && samplesTaken >= nextActivePixelsUpdate &&
+            sampleIndex + 1 < lastSampleIndex) {
+            nActivePixels = UpdateActivePixels();
+            int nPixels = film.PixelBounds().Area();
+            LOG_VERBOSE("Adaptive sampling: %d of %d pixels converged at spp = %d",
+                        nPixels - nActivePixels, nPixels, samplesTaken);
+            nextActivePixelsUpdate = samplesTaken + activePixelsUpdateInterval;
+            activePixelsUpdateInterval = std::min(2 * activePixelsUpdateInterval, 16);
+            if (nActivePixels == 0) {
+                ++sampleIndex;
+                break;
+            }
+        }
+
+        // Stop if another sample's pass isn't expected to fit in the time
+        // limit; waiting for the GPU here gives the time the pass took.
+        if (Options->timeLimit > 0 && sampleIndex + 1 < lastSampleIndex) {
+            GPUWait();
+            double elapsed = renderTimer.ElapsedSeconds();
+            double secondsPerSample = elapsed / (sampleIndex + 1 - firstSampleIndex);
+            if (elapsed + secondsPerSample > Options->timeLimit) {
+                LOG_VERBOSE("Stopping at spp = %d to stay within the time limit",
+                            sampleIndex + 1);
+                ++sampleIndex;
+                break;
+            }
+        }
     }
     progress.Done();
-    GPUWait();
-    // Shut down display server thread, if active
-    // Wait until rendering is all done before we start to shut down the
-    // display stuff..
-    if (!Options->displayServer.empty()) {
-        exitCopyThread = true;
-        copyThread.join();
+    // Show the final image on the display; the caller writes it to disk, so
+    // the last partial image must be finished before then.
+    if (displayRGBHost) {
+        filmReadback->Snapshot(sampleIndex - firstSampleIndex);
+        useFilmSnapshot(true, false);
     }
+    if (imageWrite.Valid())
+        imageWrite.Wait();
 
     // Another synchronization to make sure no kernels are running on the
     // GPU so that we can safely access unified memory from the CPU.
     GPUWait();
+    return sampleIndex - firstSampleIndex;
+}
+
+void GPUPathIntegrator::RenderSample(int sampleIndex, int nActivePixels) {
+    LOG_VERBOSE("Starting to submit work for sample %d", sampleIndex);
+    // The kernels for all of the passes are the same, so they are captured
+    // in a CUDA graph once and then replayed for each pass.
+    bool useGraph = !Options->gpuDisableGraphs;
+
+    auto renderPass = [&]() {
+        if (useGraph)
+            passGraph.Launch("Render pass (CUDA graph)", [&]() { RenderPass(); });
+        else
+            RenderPass();
+    };
+
+    Bounds2i pixelBounds = film.PixelBounds();
+    int nPasses = 0;
+    if (nActivePixels >= 0) {
+        // Render passes over the active pixels for adaptive sampling
+        for (int start = 0; start < nActivePixels; start += maxQueueSize, ++nPasses) {
+            SetPassState(pixelBounds.pMin.y, sampleIndex, start);
+            renderPass();
+        }
+    } else {
+        for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
+             y0 += scanlinesPerPass, ++nPasses) {
+            SetPassState(y0, sampleIndex);
+            renderPass();
+        }
+    }
+
+    if (tailStartDepth < 0)
+        ChooseTailStartDepth(nPasses);
+}
+
+void GPUPathIntegrator::ChooseTailStartDepth(int nPasses) {
+    // Wait for the ray counts, which are only ever read this once while
+    // rendering
+    GPUWait();
+    tailStartDepth = maxDepth + 1;
+    if (previewMode == PreviewMode::None)
+        for (int depth = 1; depth <= maxDepth; ++depth)
+            if (stats->indirectRays[depth] < uint64_t(nPasses) * tailLaunchSize) {
+                tailStartDepth = depth;
+                break;
+            }
+    LOG_VERBOSE("Launching %d threads for queued items from depth %d on",
+                tailLaunchSize, tailStartDepth);
+
+    // The passes' kernels are launched differently from now on, so the
+    // graph has to be captured again.
+    passGraph.Reset();
+}
+
+void GPUPathIntegrator::SetPassState(int y0, int sampleIndex, int activePixelStart) {
+    GPUDo(
+        "Set pass state", PBRT_GPU_LAMBDA() {
+            passState->y0 = y0;
+            passState->sampleIndex = sampleIndex;
+            passState->activePixelStart = activePixelStart;
+        });
+}
+
+int GPUPathIntegrator::UpdateActivePixels() {
+    // Flag the pixels that haven't converged
+    int nPixels = film.PixelBounds().Area();
+    Float threshold = Options->adaptiveThreshold;
+    int minSamples = Options->adaptiveMinSamples;
+    GPUParallelFor(
+        "Find unconverged pixels", nPixels, PBRT_GPU_LAMBDA(int pixelIndex) {
+            // As with the CPU integrators, a pixel has converged once the
+            // standard error of its mean luminance, relative to the clamped
+            // mean, is below the threshold.
+            const VarianceEstimator<Float> &ve = pixelVariance[pixelIndex];
+            bool converged = false;
+            if (ve.Count() >= minSamples) {
+                Float stdError = SafeSqrt(ve.Variance() / ve.Count());
+                converged = stdError / std::max<Float>(ve.Mean(), 1e-2f) <= threshold;
+            }
+            pixelActive[pixelIndex] = !converged;
+        });
+
+    // Compact the indices of the flagged pixels, keeping them in scanline
+    // order so that each pass's pixels are close together
+    CUDA_CHECK(cub::DeviceSelect::Flagged(activePixelsTempStorage,
+                                          activePixelsTempBytes,
+                                          cub::CountingInputIterator<int>(0), pixelActive,
+                                          activePixels, activePixelCount, nPixels,
+                                          GPUStream()));
+    GPUWait();
+    return *activePixelCount;
+}
+
+void GPUPathIntegrator::RenderPass() {
+    if (previewMode != PreviewMode::None) {
+        RenderPreviewPass();
+        return;
+    }
+
+    int spp = sampler.SamplesPerPixel();
+    // Create the stream and events for handling escaped rays concurrently
+    if (escapedRayQueue && !escapedRayStream) {
+        CUDA_CHECK(cudaStreamCreateWithFlags(&escapedRayStream, cudaStreamNonBlocking));
+        CUDA_CHECK(
+            cudaEventCreateWithFlags(&escapedRayForkEvent, cudaEventDisableTiming));
+        CUDA_CHECK(
+            cudaEventCreateWithFlags(&escapedRayJoinEvent, cudaEventDisableTiming));
+    }
+
+    // Generate camera rays for current scanline range
+    RayQueue *cameraRayQueue = CurrentRayQueue(0);
+    GPUDo(
+        "Reset ray queue", PBRT_GPU_LAMBDA() {
+            PBRT_DBG("Starting scanlines at y0 = %d, sample %d / %d\n", passState->y0,
+                     passState->sampleIndex, spp);
+            cameraRayQueue->Reset();
+        });
+    GenerateCameraRays();
+    GPUDo(
+        "Update camera ray stats",
+        PBRT_GPU_LAMBDA() { stats->cameraRays += cameraRayQueue->Size(); });
+
+    // Trace rays and estimate radiance up to maximum ray depth
+    for (int depth = 0; true; ++depth) {
+        queueLaunchSize = (tailStartDepth >= 0 && depth >= tailStartDepth)
+                              ? tailLaunchSize
+                              : maxQueueSize;
+        // Reset queues before tracing rays
+        RayQueue *nextQueue = NextRayQueue(depth);
+        GPUDo(
+            "Reset queues before tracing rays", PBRT_GPU_LAMBDA() {
+                nextQueue->Reset();
+                // Reset queues before tracing next batch of rays
+                if (mediumSampleQueue)
+                    mediumSampleQueue->Reset();
+                if (mediumScatterQueue)
+                    mediumScatterQueue->Reset();
+
+                if (escapedRayQueue)
+                    escapedRayQueue->Reset();
+                hitAreaLightQueue->Reset();
+
+                basicEvalMaterialQueue->Reset();
+                universalEvalMaterialQueue->Reset();
+
+                if (bssrdfEvalQueue)
+                    bssrdfEvalQueue->Reset();
+                if (subsurfaceScatterQueue)
+                    subsurfaceScatterQueue->Reset();
+            });
+
+        // Follow active ray paths and accumulate radiance estimates
+        GenerateRaySamples(depth);
+        // Find closest intersections along active rays
+        IntersectClosest(CurrentRayQueue(depth), escapedRayQueue, hitAreaLightQueue,
+                         basicEvalMaterialQueue, universalEvalMaterialQueue,
+                         mediumSampleQueue, NextRayQueue(depth));
+
+        if (haveMedia)
+            SampleMediumInteraction(depth);
+        // Update ray statistics after rays that escape media have been enqueued
+        RayQueue *statsQueue = CurrentRayQueue(depth);
+        GPUDo(
+            "Update ray stats", PBRT_GPU_LAMBDA() {
+                if (depth > 0)
+                    stats->indirectRays[depth] += statsQueue->Size();
+                if (escapedRayQueue)
+                    stats->escapedRays[depth] += escapedRayQueue->Size();
+            });
+        // Escaped rays and rays that hit surfaces are for different pixels, so
+        // the escaped rays can be handled on another stream while the hits
+        // are processed.
+        cudaStream_t stream = GPUStream();
+        if (escapedRayStream) {
+            CUDA_CHECK(cudaEventRecord(escapedRayForkEvent, stream));
+            CUDA_CHECK(cudaStreamWaitEvent(escapedRayStream, escapedRayForkEvent, 0));
+            GPUSetStream(escapedRayStream);
+            HandleEscapedRays(depth);
+            CUDA_CHECK(cudaEventRecord(escapedRayJoinEvent, escapedRayStream));
+            GPUSetStream(stream);
+        } else if (escapedRayQueue)
+            HandleEscapedRays(depth);
+        HandleRayFoundEmission(depth);
+        if (depth < maxDepth) {
+            EvaluateMaterialsAndBSDFs(depth);
+            // Do immediately so that we have space for shadow rays for subsurface..
+            TraceShadowRays(depth);
+            if (haveSubsurface)
+                SampleSubsurface(depth);
+        }
+        // The escaped ray queue is reset before the next depth's rays are traced
+        if (escapedRayStream)
+            CUDA_CHECK(cudaStreamWaitEvent(stream, escapedRayJoinEvent, 0));
+        if (depth == maxDepth)
+            break;
+    }
+
+    UpdateFilm();
 }
 
 void GPUPathIntegrator::IntersectClosest(RayQueue *rayQueue,
@@ -447,6 +857,12 @@ void GPUPathIntegrator::IntersectClosest(RayQueue *rayQueue,
                                          MaterialEvalQueue *universalEvalMaterialQueue,
                                          MediumSampleQueue *mediumSampleQueue,
                                          RayQueue *nextRayQueue) const {
+    if (pixelCosts)
+        ForAllQueued(
+            "Count rays", rayQueue, queueLaunchSize,
+            PBRT_GPU_LAMBDA(const RayWorkItem w) {
+                ++pixelCosts[w.pixelIndex].rays;
+            });
     accel->IntersectClosest(maxQueueSize, escapedRayQueue, hitAreaLightQueue,
                             basicEvalMaterialQueue, universalEvalMaterialQueue,
                             mediumSampleQueue, rayQueue, nextRayQueue);
@@ -454,7 +870,7 @@ void GPUPathIntegrator::IntersectClosest(RayQueue *rayQueue,
 
 void GPUPathIntegrator::HandleEscapedRays(int depth) {
     ForAllQueued(
-        "Handle escaped rays", escapedRayQueue, maxQueueSize,
+        "Handle escaped rays", escapedRayQueue, queueLaunchSize,
         PBRT_GPU_LAMBDA(const EscapedRayWorkItem w) {
             // Update pixel radiance for escaped ray
             SampledSpectrum L(0.f);
@@ -496,7 +912,7 @@ void GPUPathIntegrator::HandleEscapedRays(int depth) {
 
 void GPUPathIntegrator::HandleRayFoundEmission(int depth) {
     ForAllQueued(
-        "Handle emitters hit by indirect rays", hitAreaLightQueue, maxQueueSize,
+        "Handle emitters hit by indirect rays", hitAreaLightQueue, queueLaunchSize,
         PBRT_GPU_LAMBDA(const HitAreaLightWorkItem w) {
             // Find emitted radiance from surface that ray hit
             SampledSpectrum Le = w.areaLight.L(w.p, w.n, w.uv, w.wo, w.lambda);
@@ -533,6 +949,12 @@ void GPUPathIntegrator::HandleRayFoundEmission(int depth) {
 }
 
 void GPUPathIntegrator::TraceShadowRays(int depth) {
+    if (pixelCosts)
+        ForAllQueued(
+            "Count shadow rays", shadowRayQueue, queueLaunchSize,
+            PBRT_GPU_LAMBDA(const ShadowRayWorkItem w) {
+                ++pixelCosts[w.pixelIndex].shadowRays;
+            });
     if (haveMedia)
         accel->IntersectShadowTr(maxQueueSize, shadowRayQueue, &pixelSampleState);
     else
@@ -545,7 +967,157 @@ void GPUPathIntegrator::TraceShadowRays(int depth) {
         });
 }
 
+// Renders with a replica of the scene and the integrator on each of the
+// given GPUs. Each GPU takes the next sample index to render from a shared
+// counter when it finishes one, so faster GPUs render more of the samples,
+// and the GPUs' films are summed on the host at the end.
+// Records the render's configuration for --stats-json
+static void RecordRenderConfig(const ParsedScene &scene, GPUPathIntegrator *integrator,
+                               int nDevices) {
+    Point2i resolution = integrator->film.FullResolution();
+    StatsSetJSON("config",
+                 StringPrintf("{\"renderer\": \"gpu\", \"gpus\": %d, \"spp\": %d, "
+                              "\"resolution\": [%d, %d], \"integrator\": %s, "
+                              "\"accelerator\": \"optix\", \"sampler\": %s, "
+                              "\"film\": %s}",
+                              nDevices, integrator->sampler.SamplesPerPixel(),
+                              resolution.x, resolution.y,
+                              JSONString(scene.integrator.name),
+                              JSONString(scene.sampler.name),
+                              JSONString(scene.film.name)));
+}
+
+static void GPURenderMultiGPU(ParsedScene &scene, const std::vector<int> &devices) {
+    std::vector<CUDATrackedMemoryResource *> resources;
+    std::vector<GPUPathIntegrator *> integrators;
+    for (int device : devices) {
+        CUDA_CHECK(cudaSetDevice(device));
+        // Each GPU's integrator and scene representation are allocated from
+        // their own memory resource so that they can be moved to its memory.
+        resources.push_back(new CUDATrackedMemoryResource);
+        Allocator alloc(resources.back());
+        integrators.push_back(alloc.new_object<GPUPathIntegrator>(alloc, scene));
+    }
+
+    // Values that all of the integrators use (spectra, color spaces, mesh
+    // vertex buffers, ...) are only read while rendering, so each GPU gets
+    // a copy of them.
+    CUDATrackedMemoryResource *sharedResource =
+        dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource());
+    CHECK(sharedResource != nullptr);
+    sharedResource->ReplicateToGPUs(devices);
+    for (size_t i = 0; i < devices.size(); ++i) {
+        CUDA_CHECK(cudaSetDevice(devices[i]));
+        CUDA_CHECK(cudaMemAdvise(integrators[i], sizeof(GPUPathIntegrator),
+                                 cudaMemAdviseSetReadMostly, /* ignored argument */ 0));
+        CUDA_CHECK(cudaMemAdvise(integrators[i], sizeof(GPUPathIntegrator),
+                                 cudaMemAdviseSetPreferredLocation, devices[i]));
+        resources[i]->PrefetchToGPU();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Render!
+    int spp = integrators[0]->sampler.SamplesPerPixel();
+    ProgressReporter progress(spp, "Rendering", Options->quiet);
+    progress.SetSamplesPerWorkUnit(integrators[0]->film.PixelBounds().Area());
+    std::atomic<int> nextSampleIndex{0};
+    std::vector<int> deviceSamples(devices.size(), 0);
+    Timer timer;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < devices.size(); ++i)
+        threads.push_back(std::thread([&, i]() {
+            CUDA_CHECK(cudaSetDevice(devices[i]));
+            Timer deviceTimer;
+            int sampleIndex;
+            while ((sampleIndex = nextSampleIndex++) < spp) {
+                integrators[i]->RenderSample(sampleIndex);
+                // Wait for the sample's kernels to finish so that the next
+                // sample index goes to whichever GPU is free first.
+                GPUWait();
+                ++deviceSamples[i];
+                progress.Update();
+
+                // Stop if another sample isn't expected to fit in the time limit
+                double elapsed = deviceTimer.ElapsedSeconds();
+                if (Options->timeLimit > 0 &&
+                    elapsed + elapsed / deviceSamples[i] > Options->timeLimit)
+                    break;
+            }
+        }));
+    for (std::thread &thread : threads)
+        thread.join();
+    progress.Done();
+    Float renderSeconds = timer.ElapsedSeconds();
+    LOG_VERBOSE("Total rendering time: %.3f s", renderSeconds);
+
+    // Sum the GPUs' films and statistics into the first GPU's
+    CUDA_CHECK(cudaSetDevice(devices[0]));
+    GPUPathIntegrator *integrator = integrators[0];
+    Bounds2i pixelBounds = integrator->film.PixelBounds();
+    int samplesTaken = 0;
+    for (size_t i = 0; i < devices.size(); ++i) {
+        samplesTaken += deviceSamples[i];
+        if (i == 0)
+            continue;
+        integrator->film.MergeState(integrators[i]->film.SaveState(pixelBounds),
+                                    pixelBounds);
+        integrator->stats->Merge(*integrators[i]->stats);
+    }
+
+    ReportKernelStats(renderSeconds);
+    RecordRenderConfig(scene, integrators[0], devices.size());
+    if (!Options->quiet) {
+        Printf("GPU Statistics:\n");
+        for (size_t i = 0; i < devices.size(); ++i)
+            Printf("    %-42s               %12d\n",
+                   StringPrintf("GPU %d samples per pixel", devices[i]),
+                   deviceSamples[i]);
+        Printf("%s\n", integrator->stats->Print());
+    }
+
+    for (int device : devices) {
+        CUDA_CHECK(cudaSetDevice(device));
+        std::vector<GPULogItem> logs = ReadGPULogs();
+        for (const auto &item : logs)
+            Log(item.level, item.file, item.line, item.message);
+    }
+    CUDA_CHECK(cudaSetDevice(devices[0]));
+
+    ImageMetadata metadata;
+    integrator->camera.InitMetadata(&metadata);
+    metadata.renderTimeSeconds = timer.ElapsedSeconds();
+    metadata.samplesPerPixel = samplesTaken;
+    integrator->film.WriteImage(metadata);
+}
+
 void GPURender(ParsedScene &scene) {
+    // SPPM is implemented by a GPUPathIntegrator subclass
+    bool sppm = scene.integrator.name == "sppm";
+
+    std::vector<int> devices = GPURenderDevices();
+    if (devices.size() > 1 && !Options->benchRays) {
+        bool concurrentManagedAccess = true;
+        for (int device : devices) {
+            int hasConcurrentManagedAccess;
+            CUDA_CHECK(cudaDeviceGetAttribute(&hasConcurrentManagedAccess,
+                                              cudaDevAttrConcurrentManagedAccess,
+                                              device));
+            concurrentManagedAccess &= bool(hasConcurrentManagedAccess);
+        }
+        if (sppm || scene.film.name != "rgb" || !Options->debugStart.empty() ||
+            !Options->displayServer.empty() || Options->adaptiveThreshold > 0 ||
+            !concurrentManagedAccess)
+            Warning("Rendering with a single GPU: multiple GPUs are only supported "
+                    "with the \"rgb\" film, without the \"sppm\" integrator, "
+                    "--debugstart, --display-server, or --adaptive, and on systems "
+                    "with concurrent managed memory access.");
+        else {
+            GPURenderMultiGPU(scene, devices);
+            return;
+        }
+    }
+
+    size_t integratorSize = sppm ? sizeof(GPUSPPMIntegrator) : sizeof(GPUPathIntegrator);
 #ifdef PBRT_IS_WINDOWS
     // NOTE: on Windows, where only basic unified memory is supported, the
     // GPUPathIntegrator itself is *not* allocated using the unified memory
@@ -553,13 +1125,17 @@ void GPURender(ParsedScene &scene) {
     // (e.g. maxDepth) concurrently while the GPU is rendering.  In turn,
     // the lambda capture for GPU kernels has to capture *this by value (see
     // the definition of PBRT_GPU_LAMBDA in gpulaunch.h.).
-    GPUPathIntegrator *integrator = new GPUPathIntegrator(gpuMemoryAllocator, scene);
+    GPUPathIntegrator *integrator =
+        sppm ? new GPUSPPMIntegrator(gpuMemoryAllocator, scene)
+             : new GPUPathIntegrator(gpuMemoryAllocator, scene);
 #else
     // With more capable unified memory, the GPUPathIntegrator can live in
     // unified memory and some cudaMemAdvise calls, to come shortly, let us
     // have fast read-only access to it on the CPU.
+    Allocator alloc = gpuMemoryAllocator;
     GPUPathIntegrator *integrator =
-        gpuMemoryAllocator.new_object<GPUPathIntegrator>(gpuMemoryAllocator, scene);
+        sppm ? alloc.new_object<GPUSPPMIntegrator>(gpuMemoryAllocator, scene)
+             : alloc.new_object<GPUPathIntegrator>(gpuMemoryAllocator, scene);
 #endif
 
     int deviceIndex;
@@ -577,9 +1153,9 @@ void GPURender(ParsedScene &scene) {
         // performance. (This makes it possible to use the values of things
         // like GPUPathIntegrator::haveSubsurface to conditionally launch
         // kernels according to what's in the scene...)
-        CUDA_CHECK(cudaMemAdvise(integrator, sizeof(*integrator),
-                                 cudaMemAdviseSetReadMostly, /* ignored argument */ 0));
-        CUDA_CHECK(cudaMemAdvise(integrator, sizeof(*integrator),
+        CUDA_CHECK(cudaMemAdvise(integrator, integratorSize, cudaMemAdviseSetReadMostly,
+                                 /* ignored argument */ 0));
+        CUDA_CHECK(cudaMemAdvise(integrator, integratorSize,
                                  cudaMemAdviseSetPreferredLocation, deviceIndex));
 
         // Copy all of the scene data structures over to GPU memory.  This
@@ -595,16 +1171,22 @@ void GPURender(ParsedScene &scene) {
         // kernel sufficient?
     }
 
+    if (Options->benchRays) {
+        integrator->BenchmarkRays();
+        return;
+    }
+
     ///////////////////////////////////////////////////////////////////////////
     // Render!
     Timer timer;
-    integrator->Render();
+    int samplesTaken = sppm ? static_cast<GPUSPPMIntegrator *>(integrator)->Render()
+                            : integrator->Render();
 
     LOG_VERBOSE("Total rendering time: %.3f s", timer.ElapsedSeconds());
 
+    ReportKernelStats();
+    RecordRenderConfig(scene, integrator, 1);
     if (!Options->quiet) {
-        ReportKernelStats();
-
         Printf("GPU Statistics:\n");
         Printf("%s\n", integrator->stats->Print());
     }
@@ -613,19 +1195,39 @@ void GPURender(ParsedScene &scene) {
     for (const auto &item : logs)
         Log(item.level, item.file, item.line, item.message);
 
+    // The SPPM integrator writes its image itself
+    if (sppm)
+        return;
+
     ImageMetadata metadata;
-    metadata.samplesPerPixel = integrator->sampler.SamplesPerPixel();
     integrator->camera.InitMetadata(&metadata);
     metadata.renderTimeSeconds = timer.ElapsedSeconds();
-    metadata.samplesPerPixel = integrator->sampler.SamplesPerPixel();
+    metadata.samplesPerPixel = samplesTaken;
     integrator->film.WriteImage(metadata);
 }
 
 GPUPathIntegrator::Stats::Stats(int maxDepth, Allocator alloc)
-    : indirectRays(maxDepth + 1, alloc), shadowRays(maxDepth, alloc) {}
+    : indirectRays(maxDepth + 1, alloc),
+      escapedRays(maxDepth + 1, alloc),
+      shadowRays(maxDepth, alloc) {}
+
+void GPUPathIntegrator::Stats::Merge(const Stats &stats) {
+    cameraRays += stats.cameraRays;
+    for (size_t i = 0; i < indirectRays.size(); ++i)
+        indirectRays[i] += stats.indirectRays[i];
+    for (size_t i = 0; i < escapedRays.size(); ++i)
+        escapedRays[i] += stats.escapedRays[i];
+    for (size_t i = 0; i < shadowRays.size(); ++i)
+        shadowRays[i] += stats.shadowRays[i];
+}
 
 std::string GPUPathIntegrator::Stats::Print() const {
     std::string s;
+    s += StringPrintf("    %-42s               %12d\n", "Paths traced in parallel",
+                      pathsPerPass);
+    s += StringPrintf("    %-42s               %12d\n", "Passes per sample", passes);
+    s += StringPrintf("    %-42s               %12.2f\n", "Queue memory (MiB)",
+                      queueBytes / (1024. * 1024.));
     s += StringPrintf("    %-42s               %12" PRIu64 "\n", "Camera rays",
                       cameraRays);
     for (int i = 1; i < indirectRays.size(); ++i)
@@ -634,6 +1236,19 @@ std::string GPUPathIntegrator::Stats::Print() const {
     for (int i = 0; i < shadowRays.size(); ++i)
         s += StringPrintf("    %-42s               %12" PRIu64 "\n",
                           StringPrintf("Shadow rays, depth %-3d", i), shadowRays[i]);
+    // Paths that weren't continued at a depth ended there, either by
+    // escaping, by Russian roulette, by failing to sample the BSDF, or
+    // by reaching the maximum depth.
+    for (int i = 0; i < indirectRays.size(); ++i) {
+        uint64_t active = (i == 0) ? cameraRays : indirectRays[i];
+        uint64_t next = (i + 1 < indirectRays.size()) ? indirectRays[i + 1] : 0;
+        if (active == 0)
+            break;
+        s += StringPrintf("    %-42s               %12" PRIu64 " (%" PRIu64
+                          " escaped)\n",
+                          StringPrintf("Paths ended, depth %-3d", i),
+                          active > next ? active - next : 0, escapedRays[i]);
+    }
     return s;
 }
 
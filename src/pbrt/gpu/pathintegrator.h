@@ -14,14 +14,18 @@
 #include <pbrt/base/light.h>
 #include <pbrt/base/lightsampler.h>
 #include <pbrt/base/sampler.h>
+#include <pbrt/gpu/launch.h>
 #include <pbrt/gpu/workitems.h>
 #include <pbrt/gpu/workqueue.h>
+#include <pbrt/util/color.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/sampling.h>
 
 namespace pbrt {
 
 class ParsedScene;
 class GPUAccel;
+struct BenchmarkHit;
 
 void GPUInit();
 void GPURender(ParsedScene &scene);
@@ -30,18 +34,39 @@ void GPURender(ParsedScene &scene);
 class GPUPathIntegrator {
   public:
     // GPUPathIntegrator Public Methods
-    void Render();
-
-    void GenerateCameraRays(int y0, int sampleIndex);
+    // Returns the number of samples per pixel taken, which may be fewer
+    // than the sampler's with --time-limit.
+    int Render();
+    // Adds a sample to each pixel using sample index _sampleIndex_ or, if
+    // _nActivePixels_ isn't negative, to the first _nActivePixels_ pixels
+    // of _activePixels_.
+    void RenderSample(int sampleIndex, int nActivePixels = -1);
+
+    // Sets the scanline range or the range of active pixels, if
+    // _activePixelStart_ isn't negative, and the sample index that the
+    // following kernels use.
+    void SetPassState(int y0, int sampleIndex, int activePixelStart = -1);
+    // Launches the kernels that trace the paths for the current pass.
+    void RenderPass();
+
+    // Chooses _tailStartDepth_ given the ray counts of the first sample's
+    // _nPasses_ passes.
+    void ChooseTailStartDepth(int nPasses);
+
+    void GenerateCameraRays();
     template <typename Sampler>
-    void GenerateCameraRays(int y0, int sampleIndex);
+    void GenerateCameraRays();
 
-    void GenerateRaySamples(int depth, int sampleIndex);
+    void GenerateRaySamples(int depth);
     template <typename Sampler>
-    void GenerateRaySamples(int depth, int sampleIndex);
+    void GenerateRaySamples(int depth);
 
     void TraceShadowRays(int depth);
     void SampleMediumInteraction(int depth);
+    // Samples the rays in _queue_ for round _round_ of medium sampling,
+    // pushing the ones that aren't done to _resumeQueue_ if it's non-null.
+    void SampleMediumInteraction(int depth, int round, MediumSampleQueue *queue,
+                                 MediumSampleQueue *resumeQueue);
     void SampleSubsurface(int depth);
 
     void HandleEscapedRays(int depth);
@@ -54,6 +79,11 @@ class GPUPathIntegrator {
     void EvaluateMaterialAndBSDF(TextureEvaluator texEval, MaterialEvalQueue *evalQueue,
                                  int depth);
 
+    void AllocateMaterialEvalSort(Allocator alloc);
+    // Returns the order in which to evaluate the queue's items.
+    template <typename Material>
+    const int *SortMaterialEvalQueue(WorkQueue<MaterialEvalWorkItem<Material>> *queue);
+
     void SampleDirect(int depth);
     template <typename BxDF>
     void SampleDirect(int depth);
@@ -62,8 +92,30 @@ class GPUPathIntegrator {
     template <typename BxDF>
     void SampleIndirect(int depth);
 
+    // The "ambientocclusion" integrator and the "preview" integrator's
+    // albedo and normal modes only trace camera rays and, for ambient
+    // occlusion, one shadow ray per hit; a single kernel per material type
+    // computes each hit's contribution in place of BSDF sampling.
+    void RenderPreviewPass();
+    void EvaluatePreview();
+    template <typename Material>
+    void EvaluatePreview();
+    template <typename Material, typename TextureEvaluator>
+    void EvaluatePreview(TextureEvaluator texEval, MaterialEvalQueue *evalQueue);
+
+    // Rather than rendering, traces camera rays, rays leaving their
+    // intersections, and shadow rays between pairs of the intersections
+    // for --bench-rays and reports how many of each are traced per second.
+    void BenchmarkRays();
+    template <typename Material>
+    void GenerateBenchmarkRays(BenchmarkHit *hits, bool pushSurfaceRays, int pass);
+
     void UpdateFilm();
 
+    // Finds the pixels that haven't converged for adaptive sampling, stores
+    // their indices in _activePixels_, and returns how many there are.
+    int UpdateActivePixels();
+
     GPUPathIntegrator(Allocator alloc, const ParsedScene &scene);
 
     RayQueue *CurrentRayQueue(int depth) { return rayQueues[depth & 1]; }
@@ -81,6 +133,7 @@ class GPUPathIntegrator {
     bool haveSubsurface;
     bool haveMedia;
     pstd::array<bool, MaterialHandle::NumTags()> haveBasicEvalMaterial;
+    pstd::array<bool, MaterialHandle::NumTags()> haveNonConstantBasicEvalMaterial;
     pstd::array<bool, MaterialHandle::NumTags()> haveUniversalEvalMaterial;
 
     GPUAccel *accel = nullptr;
@@ -89,30 +142,86 @@ class GPUPathIntegrator {
         Stats(int maxDepth, Allocator alloc);
 
         std::string Print() const;
+        // Adds the counts of another GPU's integrator.
+        void Merge(const Stats &stats);
+
+        // The working-set configuration chosen for the queues
+        int pathsPerPass = 0, passes = 0;
+        size_t queueBytes = 0;
 
         // Note: not atomics: tid 0 always updates them for everyone...
         uint64_t cameraRays = 0;
-        pstd::vector<uint64_t> indirectRays, shadowRays;
+        pstd::vector<uint64_t> indirectRays, escapedRays, shadowRays;
     };
     Stats *stats;
 
     FilterHandle filter;
     FilmHandle film;
+    const RGBColorSpace *filmColorSpace;
     SamplerHandle sampler;
     CameraHandle camera;
-    pstd::vector<LightHandle> envLights;
+    pstd::vector<LightHandle> allLights, envLights;
     LightSamplerHandle lightSampler;
 
     int maxDepth;
     bool regularize;
 
+    enum class PreviewMode { None, AmbientOcclusion, Albedo, Normal };
+    PreviewMode previewMode = PreviewMode::None;
+    const DenselySampledSpectrum *previewIlluminant;
+    Float previewIllumScale;
+    bool aoCosSample;
+    Float aoMaxDistance;
+
     int scanlinesPerPass, maxQueueSize;
+    // Once fewer paths remain at a depth than the GPU can run threads at
+    // once, the queues' kernels for it and the following depths launch
+    // just _tailLaunchSize_ persistent threads that loop over the queued
+    // items instead of a thread for every item that a queue could hold.
+    // _tailStartDepth_ is chosen using the first sample's ray counts and
+    // is negative until then.
+    int tailStartDepth = -1, tailLaunchSize;
+    // The number of threads that the current depth's queue kernels launch
+    int queueLaunchSize;
+
+    // The current pass's parameters are read from memory rather than
+    // captured by the kernels so that a pass's kernels can be replayed from a
+    // CUDA graph for all of them.
+    struct PassState {
+        int y0, sampleIndex;
+        int activePixelStart;
+    };
+    PassState *passState;
+    GPUGraph passGraph;
+
+    // Escaped rays are handled on a separate stream, concurrently with the
+    // kernels that process ray intersections.
+    cudaStream_t escapedRayStream = nullptr;
+    cudaEvent_t escapedRayForkEvent, escapedRayJoinEvent;
 
     SOA<PixelSampleState> pixelSampleState;
 
+    // With adaptive sampling, each pixel's sample luminance statistics are
+    // kept for the whole render, unlike the pixel sample state, whose
+    // entries are reused for each pass's pixels. Once all pixels have the
+    // minimum number of samples, only the pixels that haven't converged
+    // are sampled; their indices are compacted into _activePixels_.
+    VarianceEstimator<Float> *pixelVariance = nullptr;
+    bool *pixelActive = nullptr;
+    int *activePixels = nullptr, *activePixelCount = nullptr;
+    void *activePixelsTempStorage = nullptr;
+    size_t activePixelsTempBytes = 0;
+
+    // Work done for each pixel sample in the current pass, for the film's
+    // "cost" AOV; null if it wasn't requested.
+    PixelCostSample *pixelCosts = nullptr;
+
     RayQueue *rayQueues[2];
 
     MediumSampleQueue *mediumSampleQueue = nullptr;
+    // Rays that cross many majorant segments are re-enqueued between medium
+    // sampling rounds, alternating between this and _mediumSampleQueue_.
+    MediumSampleQueue *mediumResumeQueue = nullptr;
     MediumScatterQueue *mediumScatterQueue = nullptr;
 
     EscapedRayQueue *escapedRayQueue = nullptr;
@@ -122,6 +231,15 @@ class GPUPathIntegrator {
     MaterialEvalQueue *basicEvalMaterialQueue = nullptr;
     MaterialEvalQueue *universalEvalMaterialQueue = nullptr;
 
+    // The material evaluation queues' items may be sorted by material and
+    // texture coordinates before they are evaluated so that texture lookups
+    // are more coherent.
+    bool sortMaterialEvalQueues = false;
+    uint64_t *materialSortKeys[2] = {nullptr, nullptr};
+    int *materialSortIndices[2] = {nullptr, nullptr};
+    void *materialSortTempStorage = nullptr;
+    size_t materialSortTempBytes = 0;
+
     ShadowRayQueue *shadowRayQueue = nullptr;
 
     GetBSSRDFAndProbeRayQueue *bssrdfEvalQueue = nullptr;
@@ -0,0 +1,167 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/bxdfs.h>
+#include <pbrt/gpu/launch.h>
+#include <pbrt/gpu/pathintegrator.h>
+#include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/spectrum.h>
+#include <pbrt/util/vecmath.h>
+
+#include <type_traits>
+
+namespace pbrt {
+
+// PreviewMaterialCallback Definition
+struct PreviewMaterialCallback {
+    GPUPathIntegrator *integrator;
+    // PreviewMaterialCallback Public Methods
+    template <typename Material>
+    void operator()() {
+        if constexpr (!std::is_same_v<Material, MixMaterial>)
+            integrator->EvaluatePreview<Material>();
+    }
+};
+
+// GPUPathIntegrator Preview Methods
+void GPUPathIntegrator::RenderPreviewPass() {
+    // Reset queues and generate camera rays for current scanline range
+    RayQueue *cameraRayQueue = CurrentRayQueue(0);
+    RayQueue *nextQueue = NextRayQueue(0);
+    GPUDo(
+        "Reset preview queues", PBRT_GPU_LAMBDA() {
+            cameraRayQueue->Reset();
+            nextQueue->Reset();
+            hitAreaLightQueue->Reset();
+            basicEvalMaterialQueue->Reset();
+            universalEvalMaterialQueue->Reset();
+        });
+    GenerateCameraRays();
+    GPUDo(
+        "Update camera ray stats",
+        PBRT_GPU_LAMBDA() { stats->cameraRays += cameraRayQueue->Size(); });
+
+    // Find the camera rays' intersections and compute their contributions;
+    // escaped rays, emission, and rays that pass through surfaces without
+    // materials don't contribute.
+    if (previewMode == PreviewMode::AmbientOcclusion)
+        GenerateRaySamples(0);
+    IntersectClosest(cameraRayQueue, nullptr, hitAreaLightQueue, basicEvalMaterialQueue,
+                     universalEvalMaterialQueue, nullptr, nextQueue);
+    EvaluatePreview();
+    if (previewMode == PreviewMode::AmbientOcclusion)
+        TraceShadowRays(0);
+
+    UpdateFilm();
+}
+
+void GPUPathIntegrator::EvaluatePreview() {
+    MaterialHandle::ForEachType(PreviewMaterialCallback{this});
+}
+
+template <typename Material>
+void GPUPathIntegrator::EvaluatePreview() {
+    int index = MaterialHandle::TypeIndex<Material>();
+    if (haveBasicEvalMaterial[index]) {
+        if (haveNonConstantBasicEvalMaterial[index])
+            EvaluatePreview<Material>(BasicTextureEvaluator(), basicEvalMaterialQueue);
+        else
+            EvaluatePreview<Material>(ConstantTextureEvaluator(), basicEvalMaterialQueue);
+    }
+    if (haveUniversalEvalMaterial[index])
+        EvaluatePreview<Material>(UniversalTextureEvaluator(),
+                                  universalEvalMaterialQueue);
+}
+
+template <typename Material, typename TextureEvaluator>
+void GPUPathIntegrator::EvaluatePreview(TextureEvaluator texEval,
+                                        MaterialEvalQueue *evalQueue) {
+    // Construct _name_ for material/texture evaluator kernel
+    std::string name = StringPrintf("%s Preview (%s tex)", Material::Name(),
+                                    TextureEvaluatorName<TextureEvaluator>());
+
+    ForAllQueued(
+        name.c_str(), evalQueue->Get<MaterialEvalWorkItem<Material>>(), maxQueueSize,
+        PBRT_GPU_LAMBDA(const MaterialEvalWorkItem<Material> w) {
+            SampledWavelengths lambda = w.lambda;
+            SampledSpectrum illum = previewIllumScale * previewIlluminant->Sample(lambda);
+            if (previewMode == PreviewMode::AmbientOcclusion) {
+                // Sample ambient occlusion direction around the geometric normal
+                Normal3f n = FaceForward(w.n, w.wo);
+                RaySamples raySamples = pixelSampleState.samples[w.pixelIndex];
+                Point2f u = raySamples.direct.u;
+                Vector3f wi;
+                Float pdf;
+                if (aoCosSample) {
+                    wi = SampleCosineHemisphere(u);
+                    pdf = CosineHemispherePDF(std::abs(wi.z));
+                } else {
+                    wi = SampleUniformHemisphere(u);
+                    pdf = UniformHemispherePDF();
+                }
+                if (pdf == 0)
+                    return;
+                wi = Frame::FromZ(n).FromLocal(wi);
+
+                // Enqueue shadow ray with its unoccluded contribution; dividing
+                // by $\pi$ makes a fully visible point's value one.
+                SampledSpectrum Ld =
+                    SafeDiv(illum * (Dot(wi, n) / (Pi * pdf)), lambda.PDF());
+                Ray ray = SpawnRay(w.pi, w.n, w.time, wi);
+                shadowRayQueue->Push(ray, aoMaxDistance, lambda, Ld, SampledSpectrum(1.f),
+                                     SampledSpectrum(0.f), w.pixelIndex);
+                return;
+            }
+
+            // Apply bump mapping if material has a displacement texture
+            Normal3f ns = w.ns;
+            Vector3f dpdus = w.dpdus;
+            FloatTextureHandle displacement = w.material->GetDisplacement();
+            const Image *normalMap = w.material->GetNormalMap();
+            if (displacement || normalMap) {
+                BumpEvalContext bctx = w.GetBumpEvalContext();
+                Vector3f dpdvs;
+                Bump(texEval, displacement, normalMap, bctx, &dpdus, &dpdvs);
+                ns = Normal3f(Normalize(Cross(dpdus, dpdvs)));
+                ns = FaceForward(ns, w.n);
+            }
+
+            SampledSpectrum r;
+            if (previewMode == PreviewMode::Normal) {
+                // Map shading normal's components to $[0,1]$ reflectances
+                RGB rgb(Clamp((ns.x + 1) / 2, 0, 1), Clamp((ns.y + 1) / 2, 0, 1),
+                        Clamp((ns.z + 1) / 2, 0, 1));
+                r = RGBAlbedoSpectrum(*filmColorSpace, rgb).Sample(lambda);
+            } else {
+                // Estimate BSDF's albedo
+                MaterialEvalContext ctx = w.GetMaterialEvalContext(ns, dpdus);
+                using BxDF = typename Material::BxDF;
+                BxDF bxdf;
+                BSDF bsdf = w.material->GetBSDF(texEval, ctx, lambda, &bxdf);
+                constexpr int nRhoSamples = 16;
+                SampledSpectrum rho(0.f);
+                for (int i = 0; i < nRhoSamples; ++i) {
+                    Float uc = RadicalInverse(0, i + 1);
+                    Point2f u(RadicalInverse(1, i + 1), RadicalInverse(2, i + 1));
+                    pstd::optional<BSDFSample> bs = bsdf.Sample_f<BxDF>(w.wo, uc, u);
+                    if (bs)
+                        rho += bs->f * AbsDot(bs->wi, ns) / bs->pdf;
+                }
+                r = rho / nRhoSamples;
+            }
+
+            // Record the hit's contribution, lit by the normalized illuminant
+            pixelSampleState.L[w.pixelIndex] = SafeDiv(illum * r, lambda.PDF());
+        });
+}
+
+}  // namespace pbrt
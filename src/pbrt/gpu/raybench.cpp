@@ -0,0 +1,215 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/gpu/accel.h>
+#include <pbrt/gpu/launch.h>
+#include <pbrt/gpu/pathintegrator.h>
+#include <pbrt/interaction.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/sampling.h>
+#include <pbrt/util/string.h>
+#include <pbrt/util/vecmath.h>
+
+#include <algorithm>
+#include <type_traits>
+
+namespace pbrt {
+
+// BenchmarkHit Definition
+struct BenchmarkHit {
+    Point3fi pi;
+    Normal3f n;
+    Float time;
+    bool valid;
+};
+
+// BenchmarkMaterialCallback Definition
+struct BenchmarkMaterialCallback {
+    GPUPathIntegrator *integrator;
+    BenchmarkHit *hits;
+    bool pushSurfaceRays;
+    int pass;
+    // BenchmarkMaterialCallback Public Methods
+    template <typename Material>
+    void operator()() {
+        if constexpr (!std::is_same_v<Material, MixMaterial>)
+            integrator->GenerateBenchmarkRays<Material>(hits, pushSurfaceRays, pass);
+    }
+};
+
+// GPUPathIntegrator Ray Tracing Benchmark Methods
+void GPUPathIntegrator::BenchmarkRays() {
+    bool traceCamera = false, traceSurface = false, traceShadow = false;
+    for (const std::string &name : SplitString(Options->benchRayTypes, ',')) {
+        if (name == "camera")
+            traceCamera = true;
+        else if (name == "surface")
+            traceSurface = true;
+        else if (name == "shadow")
+            traceShadow = true;
+        else
+            ErrorExit("%s: unknown --bench-ray-types ray type.", name);
+    }
+
+    // Only the accelerator's kernels are timed; the GPU is idle before and
+    // after each of them.
+    auto timeKernels = [](auto trace) {
+        GPUWait();
+        Timer timer;
+        trace();
+        GPUWait();
+        return timer.ElapsedSeconds();
+    };
+
+    BenchmarkHit *hits = gpuMemoryAllocator.allocate_object<BenchmarkHit>(maxQueueSize);
+    RayQueue *cameraRayQueue = CurrentRayQueue(0);
+    RayQueue *surfaceRayQueue = NextRayQueue(0);
+    Bounds2i pixelBounds = film.PixelBounds();
+    int passesPerSample =
+        (pixelBounds.pMax.y - pixelBounds.pMin.y + scanlinesPerPass - 1) /
+        scanlinesPerPass;
+    int64_t nBenchRays = Options->benchRayCount;
+    int64_t nCameraRays = 0, nSurfaceRays = 0, nShadowRays = 0;
+    double cameraSeconds = 0, surfaceSeconds = 0, shadowSeconds = 0;
+    // Stop once enough rays of each type have been traced or, if few camera
+    // rays hit anything, after many more camera rays than that.
+    for (int pass = 0; nCameraRays < 16 * nBenchRays; ++pass) {
+        if (nCameraRays >= nBenchRays && (!traceSurface || nSurfaceRays >= nBenchRays) &&
+            (!traceShadow || nShadowRays >= nBenchRays))
+            break;
+        // Generate the camera rays for the next scanlines
+        int sampleIndex = pass / passesPerSample;
+        int y0 = pixelBounds.pMin.y + (pass % passesPerSample) * scanlinesPerPass;
+        SetPassState(y0, sampleIndex);
+        GPUDo(
+            "Reset benchmark queues", PBRT_GPU_LAMBDA() {
+                cameraRayQueue->Reset();
+                surfaceRayQueue->Reset();
+                hitAreaLightQueue->Reset();
+                basicEvalMaterialQueue->Reset();
+                universalEvalMaterialQueue->Reset();
+                shadowRayQueue->Reset();
+            });
+        GenerateCameraRays();
+        GPUWait();
+        nCameraRays += cameraRayQueue->Size();
+
+        cameraSeconds += timeKernels([&]() {
+            IntersectClosest(cameraRayQueue, nullptr, hitAreaLightQueue,
+                             basicEvalMaterialQueue, universalEvalMaterialQueue, nullptr,
+                             surfaceRayQueue);
+        });
+        if (!traceSurface && !traceShadow)
+            continue;
+
+        // Record the intersections and generate surface and shadow rays
+        GPUParallelFor(
+            "Reset benchmark hits", maxQueueSize,
+            PBRT_GPU_LAMBDA(int i) { hits[i].valid = false; });
+        GPUDo(
+            "Reset surface ray queue",
+            PBRT_GPU_LAMBDA() { surfaceRayQueue->Reset(); });
+        MaterialHandle::ForEachType(
+            BenchmarkMaterialCallback{this, hits, traceSurface, pass});
+        if (traceShadow)
+            GPUParallelFor(
+                "Generate benchmark shadow rays", maxQueueSize,
+                PBRT_GPU_LAMBDA(int i) {
+                    // Connect the intersection to a randomly chosen other one
+                    if (!hits[i].valid)
+                        return;
+                    RNG rng(Hash(pass, i), 1);
+                    int j = rng.Uniform<uint32_t>(maxQueueSize);
+                    if (j == i || !hits[j].valid)
+                        return;
+                    const BenchmarkHit &h0 = hits[i], &h1 = hits[j];
+                    Ray ray = SpawnRayTo(h0.pi, h0.n, h0.time, h1.pi, h1.n);
+                    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
+                    shadowRayQueue->Push(ray, 1 - ShadowEpsilon, lambda,
+                                         SampledSpectrum(0.f), SampledSpectrum(1.f),
+                                         SampledSpectrum(0.f), i);
+                });
+        GPUDo(
+            "Reset benchmark material queues", PBRT_GPU_LAMBDA() {
+                cameraRayQueue->Reset();
+                hitAreaLightQueue->Reset();
+                basicEvalMaterialQueue->Reset();
+                universalEvalMaterialQueue->Reset();
+            });
+        GPUWait();
+
+        // Trace the surface and shadow rays
+        if (traceSurface) {
+            nSurfaceRays += surfaceRayQueue->Size();
+            surfaceSeconds += timeKernels([&]() {
+                IntersectClosest(surfaceRayQueue, nullptr, hitAreaLightQueue,
+                                 basicEvalMaterialQueue, universalEvalMaterialQueue,
+                                 nullptr, cameraRayQueue);
+            });
+        }
+        if (traceShadow) {
+            nShadowRays += shadowRayQueue->Size();
+            shadowSeconds += timeKernels([&]() {
+                accel->IntersectShadow(maxQueueSize, shadowRayQueue, &pixelSampleState);
+            });
+        }
+    }
+
+    // Report the rays traced per second; OptiX doesn't expose the number of
+    // BVH nodes visited or primitives tested.
+    Printf("GPU ray tracing benchmark:\n");
+    auto report = [](const char *name, bool traced, int64_t nRays, double seconds) {
+        if (!traced)
+            return;
+        if (nRays == 0)
+            Printf("  %-8s no rays were generated\n", name);
+        else
+            Printf("  %-8s %9.2f Mrays/s  (%d rays)\n", name, nRays / seconds / 1e6,
+                   nRays);
+    };
+    report("camera", traceCamera, nCameraRays, cameraSeconds);
+    report("surface", traceSurface, nSurfaceRays, surfaceSeconds);
+    report("shadow", traceShadow, nShadowRays, shadowSeconds);
+
+    gpuMemoryAllocator.deallocate_object(hits, maxQueueSize);
+}
+
+template <typename Material>
+void GPUPathIntegrator::GenerateBenchmarkRays(BenchmarkHit *hits, bool pushSurfaceRays,
+                                              int pass) {
+    int index = MaterialHandle::TypeIndex<Material>();
+    RayQueue *surfaceRayQueue = NextRayQueue(0);
+    for (MaterialEvalQueue *evalQueue :
+         {basicEvalMaterialQueue, universalEvalMaterialQueue}) {
+        if (!(evalQueue == basicEvalMaterialQueue ? haveBasicEvalMaterial[index]
+                                                  : haveUniversalEvalMaterial[index]))
+            continue;
+        std::string name = StringPrintf("%s Benchmark Rays", Material::Name());
+        ForAllQueued(
+            name.c_str(), evalQueue->Get<MaterialEvalWorkItem<Material>>(),
+            maxQueueSize, PBRT_GPU_LAMBDA(const MaterialEvalWorkItem<Material> w) {
+                hits[w.pixelIndex] = BenchmarkHit{w.pi, w.n, w.time, true};
+                if (!pushSurfaceRays)
+                    return;
+                // Sample a cosine-distributed direction about the normal
+                RNG rng(Hash(pass, w.pixelIndex));
+                Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+                Normal3f n = FaceForward(w.n, w.wo);
+                Vector3f wi = Frame::FromZ(n).FromLocal(SampleCosineHemisphere(u));
+                surfaceRayQueue->PushCameraRay(SpawnRay(w.pi, w.n, w.time, wi), w.lambda,
+                                               w.pixelIndex);
+            });
+    }
+}
+
+}  // namespace pbrt
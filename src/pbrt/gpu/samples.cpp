@@ -12,24 +12,25 @@
 namespace pbrt {
 
 // GPUPathIntegrator Sampler Methods
-void GPUPathIntegrator::GenerateRaySamples(int depth, int sampleIndex) {
+void GPUPathIntegrator::GenerateRaySamples(int depth) {
     auto generateSamples = [=](auto sampler) {
         using Sampler = std::remove_reference_t<decltype(*sampler)>;
         if constexpr (!std::is_same_v<Sampler, MLTSampler> &&
                       !std::is_same_v<Sampler, DebugMLTSampler>)
-            GenerateRaySamples<Sampler>(depth, sampleIndex);
+            GenerateRaySamples<Sampler>(depth);
     };
     sampler.DispatchCPU(generateSamples);
 }
 
 template <typename Sampler>
-void GPUPathIntegrator::GenerateRaySamples(int depth, int sampleIndex) {
+void GPUPathIntegrator::GenerateRaySamples(int depth) {
     // Generate description string _desc_ for ray sample generation
     std::string desc = std::string("Generate ray samples - ") + Sampler::Name();
 
     RayQueue *rayQueue = CurrentRayQueue(depth);
     ForAllQueued(
-        desc.c_str(), rayQueue, maxQueueSize, PBRT_GPU_LAMBDA(const RayWorkItem w) {
+        desc.c_str(), rayQueue, queueLaunchSize,
+        PBRT_GPU_LAMBDA(const RayWorkItem w) {
             // Generate samples for ray segment at current sample index
             // Find first sample dimension
             int dimension = 5 + 7 * depth;
@@ -41,7 +42,7 @@ void GPUPathIntegrator::GenerateRaySamples(int depth, int sampleIndex) {
             // Initialize _Sampler_ for pixel, sample index, and dimension
             Sampler pixelSampler = *sampler.Cast<Sampler>();
             Point2i pPixel = pixelSampleState.pPixel[w.pixelIndex];
-            pixelSampler.StartPixelSample(pPixel, sampleIndex, dimension);
+            pixelSampler.StartPixelSample(pPixel, passState->sampleIndex, dimension);
 
             // Initialize _RaySamples_ structure with sample values
             RaySamples rs;
@@ -0,0 +1,670 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/gpu/sppm.h>
+
+#include <pbrt/cameras.h>
+#include <pbrt/film.h>
+#include <pbrt/gpu/accel.h>
+#include <pbrt/gpu/launch.h>
+#include <pbrt/interaction.h>
+#include <pbrt/lights.h>
+#include <pbrt/lightsamplers.h>
+#include <pbrt/materials.h>
+#include <pbrt/options.h>
+#include <pbrt/samplers.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/check.h>
+#include <pbrt/util/colorspace.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/log.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
+#include <pbrt/util/stats.h>
+
+#include <algorithm>
+#include <new>
+#include <type_traits>
+
+#include <cub/cub.cuh>
+
+namespace pbrt {
+
+STAT_MEMORY_COUNTER("Memory/GPU SPPM pixels and grid", sppmBytes);
+
+// GPU SPPM Constants
+// The grid's cells are twice as wide as the largest search radius, so each
+// visible point overlaps at most two cells along each axis.
+static constexpr int MaxCellsPerVisiblePoint = 8;
+// Photon paths use Halton dimensions 0-5 for light sampling and then four
+// dimensions for each scattering event.
+static constexpr int PhotonLightDimensions = 6;
+static constexpr int PhotonBounceDimensions = 4;
+
+// GPUSPPMIntegrator Method Definitions
+GPUSPPMIntegrator::GPUSPPMIntegrator(Allocator alloc, const ParsedScene &scene)
+    : GPUPathIntegrator(alloc, scene) {
+    if (haveMedia)
+        ErrorExit(&scene.integrator.loc,
+                  "The GPU \"sppm\" integrator does not support participating media.");
+    if (!Options->displayServer.empty())
+        Warning("The GPU \"sppm\" integrator does not support --display-server.");
+    if (Options->adaptiveThreshold > 0)
+        ErrorExit("--adaptive isn't supported by the GPU \"sppm\" integrator.");
+
+    // Initialize SPPM parameters
+    const ParameterDictionary &parameters = scene.integrator.parameters;
+    nPixels = film.PixelBounds().Area();
+    int photonsPerIter = parameters.GetOneInt("photonsperiteration", -1);
+    photonsPerIteration = photonsPerIter > 0 ? photonsPerIter : nPixels;
+    initialSearchRadius = parameters.GetOneFloat("radius", 1.f);
+    int seed = parameters.GetOneInt("seed", 6502);
+    digitPermutations = ComputeRadicalInversePermutations(seed, alloc);
+    shootLightSampler = LightSamplerHandle::Create("power", allLights, alloc);
+    colorSpace = scene.film.parameters.ColorSpace();
+
+    CUDATrackedMemoryResource *mr =
+        dynamic_cast<CUDATrackedMemoryResource *>(gpuMemoryAllocator.resource());
+    CHECK(mr != nullptr);
+    size_t startSize = mr->BytesAllocated();
+
+    // Allocate SPPM pixels
+    pixels = alloc.allocate_object<GPUSPPMPixel>(nPixels);
+    for (int i = 0; i < nPixels; ++i) {
+        alloc.construct(&pixels[i]);
+        pixels[i].radius = initialSearchRadius;
+    }
+
+    // Allocate visible point grid
+    hashSize = NextPrime(nPixels);
+    gridCellSizeBits = alloc.new_object<uint32_t>(0);
+    cellCounts = alloc.allocate_object<int>(hashSize + 1);
+    std::fill(cellCounts, cellCounts + hashSize + 1, 0);
+    cellStart = alloc.allocate_object<int>(hashSize + 1);
+    gridPixels = alloc.allocate_object<int>(MaxCellsPerVisiblePoint * nPixels);
+    CUDA_CHECK(cub::DeviceScan::ExclusiveSum(nullptr, scanTempBytes, cellCounts,
+                                             cellStart, hashSize + 1));
+    CUDA_CHECK(cudaMalloc(&scanTempStorage, scanTempBytes));
+
+    sppmBytes += mr->BytesAllocated() - startSize + scanTempBytes;
+}
+
+int GPUSPPMIntegrator::Render() {
+    int nIterations = sampler.SamplesPerPixel();
+    ProgressReporter progress(2 * nIterations, "Rendering", Options->quiet,
+                              true /* GPU */);
+    Bounds2i pixelBounds = film.PixelBounds();
+    for (int iter = 0; iter < nIterations; ++iter) {
+        // Sample wavelengths for SPPM pass
+        SampledWavelengths passLambda =
+            Options->disableWavelengthJitter
+                ? film.SampleWavelengths(0.5)
+                : film.SampleWavelengths(RadicalInverse(1, iter));
+
+        // Define _resetQueues_ lambda function
+        auto resetQueues = [&](int depth) {
+            RayQueue *nextQueue = NextRayQueue(depth);
+            GPUDo(
+                "Reset queues before tracing rays", PBRT_GPU_LAMBDA() {
+                    nextQueue->Reset();
+                    if (escapedRayQueue)
+                        escapedRayQueue->Reset();
+                    hitAreaLightQueue->Reset();
+                    basicEvalMaterialQueue->Reset();
+                    universalEvalMaterialQueue->Reset();
+                });
+        };
+
+        // Generate SPPM visible points
+        for (int y0 = pixelBounds.pMin.y; y0 < pixelBounds.pMax.y;
+             y0 += scanlinesPerPass) {
+            // Generate camera rays for current scanline range
+            RayQueue *cameraRayQueue = CurrentRayQueue(0);
+            SetPassState(y0, iter);
+            GPUDo(
+                "Reset ray queue", PBRT_GPU_LAMBDA() { cameraRayQueue->Reset(); });
+            GenerateCameraRays(y0, iter, passLambda);
+            GPUDo(
+                "Update camera ray stats",
+                PBRT_GPU_LAMBDA() { stats->cameraRays += cameraRayQueue->Size(); });
+
+            // Follow camera paths until they create visible points
+            for (int depth = 0; true; ++depth) {
+                resetQueues(depth);
+                GenerateRaySamples(depth);
+                IntersectClosest(CurrentRayQueue(depth), escapedRayQueue,
+                                 hitAreaLightQueue, basicEvalMaterialQueue,
+                                 universalEvalMaterialQueue, nullptr,
+                                 NextRayQueue(depth));
+                if (escapedRayQueue)
+                    HandleEscapedRays(depth);
+                HandleRayFoundEmission(depth);
+                if (depth == maxDepth)
+                    break;
+                EvaluateMaterialsAndBSDFs(depth);
+                TraceShadowRays(depth);
+            }
+
+            AccumulateDirectLighting();
+        }
+        progress.Update();
+
+        // Trace photons and accumulate contributions at visible points
+        BuildVisiblePointGrid();
+        for (int photonStart = 0; photonStart < photonsPerIteration;
+             photonStart += maxQueueSize) {
+            int nPhotons = std::min(maxQueueSize, photonsPerIteration - photonStart);
+            RayQueue *photonRayQueue = CurrentRayQueue(0);
+            GPUDo(
+                "Reset photon ray queue", PBRT_GPU_LAMBDA() { photonRayQueue->Reset(); });
+            GeneratePhotons(iter, photonStart, nPhotons, passLambda);
+
+            for (int depth = 0; depth < maxDepth; ++depth) {
+                resetQueues(depth);
+                IntersectClosest(CurrentRayQueue(depth), escapedRayQueue,
+                                 hitAreaLightQueue, basicEvalMaterialQueue,
+                                 universalEvalMaterialQueue, nullptr,
+                                 NextRayQueue(depth));
+                ScatterPhotons(iter, photonStart, depth);
+            }
+        }
+        progress.Update();
+
+        UpdatePixels(passLambda);
+
+        // Periodically write SPPM image to disk
+        if (iter + 1 == nIterations || (iter + 1 <= 64 && IsPowerOf2(iter + 1)) ||
+            ((iter + 1) % 64 == 0))
+            WriteImage(iter + 1, progress.ElapsedSeconds());
+    }
+    progress.Done();
+    GPUWait();
+    return nIterations;
+}
+
+void GPUSPPMIntegrator::GenerateCameraRays(int y0, int iteration,
+                                           SampledWavelengths passLambda) {
+    // Define _generateRays_ lambda function
+    auto generateRays = [=](auto sampler) {
+        using Sampler = std::remove_reference_t<decltype(*sampler)>;
+        if constexpr (!std::is_same_v<Sampler, MLTSampler> &&
+                      !std::is_same_v<Sampler, DebugMLTSampler>)
+            GenerateCameraRays<Sampler>(y0, iteration, passLambda);
+    };
+
+    sampler.DispatchCPU(generateRays);
+}
+
+template <typename Sampler>
+void GPUSPPMIntegrator::GenerateCameraRays(int y0, int iteration,
+                                           SampledWavelengths passLambda) {
+    RayQueue *rayQueue = CurrentRayQueue(0);
+    GPUParallelFor(
+        "Generate SPPM camera rays", maxQueueSize, PBRT_GPU_LAMBDA(int pixelIndex) {
+            // Compute pixel coordinates for _pixelIndex_
+            Bounds2i pixelBounds = film.PixelBounds();
+            int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+            Point2i pPixel(pixelBounds.pMin.x + pixelIndex % xResolution,
+                           y0 + pixelIndex / xResolution);
+            pixelSampleState.pPixel[pixelIndex] = pPixel;
+            if (!InsideExclusive(pPixel, pixelBounds))
+                return;
+
+            // Generate camera ray using the pass's wavelengths
+            Sampler pixelSampler = *sampler.Cast<Sampler>();
+            pixelSampler.StartPixelSample(pPixel, iteration, 0);
+            CameraSample cameraSample = GetCameraSample(pixelSampler, pPixel, filter);
+            pstd::optional<CameraRay> cameraRay =
+                camera.GenerateRay(cameraSample, passLambda);
+
+            // Initialize _PixelSampleState_ and enqueue camera ray
+            pixelSampleState.L[pixelIndex] = SampledSpectrum(0.f);
+            pixelSampleState.lambda[pixelIndex] = passLambda;
+            pixelSampleState.filterWeight[pixelIndex] = cameraSample.weight;
+            if (cameraRay) {
+                rayQueue->PushCameraRay(cameraRay->ray, passLambda, pixelIndex);
+                pixelSampleState.cameraRayWeight[pixelIndex] = cameraRay->weight;
+            } else
+                pixelSampleState.cameraRayWeight[pixelIndex] = SampledSpectrum(0);
+        });
+}
+
+// SPPMEvaluateMaterialCallback Definition
+struct SPPMEvaluateMaterialCallback {
+    int depth;
+    GPUSPPMIntegrator *integrator;
+    // SPPMEvaluateMaterialCallback Public Methods
+    template <typename Material>
+    void operator()() {
+        if constexpr (!std::is_same_v<Material, MixMaterial>)
+            integrator->EvaluateMaterialAndBSDF<Material>(depth);
+    }
+};
+
+void GPUSPPMIntegrator::EvaluateMaterialsAndBSDFs(int depth) {
+    MaterialHandle::ForEachType(SPPMEvaluateMaterialCallback{depth, this});
+}
+
+template <typename Material>
+void GPUSPPMIntegrator::EvaluateMaterialAndBSDF(int depth) {
+    int index = MaterialHandle::TypeIndex<Material>();
+    if (haveBasicEvalMaterial[index]) {
+        if (haveNonConstantBasicEvalMaterial[index])
+            EvaluateMaterialAndBSDF<Material>(BasicTextureEvaluator(),
+                                              basicEvalMaterialQueue, depth);
+        else
+            EvaluateMaterialAndBSDF<Material>(ConstantTextureEvaluator(),
+                                              basicEvalMaterialQueue, depth);
+    }
+    if (haveUniversalEvalMaterial[index])
+        EvaluateMaterialAndBSDF<Material>(UniversalTextureEvaluator(),
+                                          universalEvalMaterialQueue, depth);
+}
+
+template <typename Material, typename TextureEvaluator>
+void GPUSPPMIntegrator::EvaluateMaterialAndBSDF(TextureEvaluator texEval,
+                                                MaterialEvalQueue *evalQueue, int depth) {
+    // Construct _name_ for material/texture evaluator kernel
+    std::string name = StringPrintf(
+        "SPPM %s + BxDF Eval (%s tex)", Material::Name(),
+        TextureEvaluatorName<TextureEvaluator>());
+
+    RayQueue *nextRayQueue = NextRayQueue(depth);
+    ForAllQueued(
+        name.c_str(), evalQueue->Get<MaterialEvalWorkItem<Material>>(), maxQueueSize,
+        PBRT_GPU_LAMBDA(const MaterialEvalWorkItem<Material> w) {
+            // Apply bump mapping if material has a displacement texture
+            Normal3f ns = w.ns;
+            Vector3f dpdus = w.dpdus;
+            FloatTextureHandle displacement = w.material->GetDisplacement();
+            const Image *normalMap = w.material->GetNormalMap();
+            if (displacement || normalMap) {
+                BumpEvalContext bctx = w.GetBumpEvalContext();
+                Vector3f dpdvs;
+                Bump(texEval, displacement, normalMap, bctx, &dpdus, &dpdvs);
+                ns = Normal3f(Normalize(Cross(dpdus, dpdvs)));
+                ns = FaceForward(ns, w.n);
+            }
+
+            // Get BSDF at intersection point
+            SampledWavelengths lambda = w.lambda;
+            MaterialEvalContext ctx = w.GetMaterialEvalContext(ns, dpdus);
+            using BxDF = typename Material::BxDF;
+            BxDF bxdf;
+            BSDF bsdf = w.material->GetBSDF(texEval, ctx, lambda, &bxdf);
+            if (regularize && w.anyNonSpecularBounces)
+                bsdf.Regularize();
+
+            Vector3f wo = w.wo;
+            RaySamples raySamples = pixelSampleState.samples[w.pixelIndex];
+            bool createVisiblePoint =
+                bsdf.IsDiffuse() || (bsdf.IsGlossy() && depth + 1 == maxDepth);
+            if (createVisiblePoint) {
+                // Record visible point and end the camera path
+                Point2i pPixel = pixelSampleState.pPixel[w.pixelIndex];
+                GPUSPPMPixel &pixel = pixels[SPPMPixelIndex(pPixel)];
+                BxDF *vpBxDF = new (pixel.vpBxDF) BxDF(bxdf);
+                pixel.vp.p = Point3f(w.pi);
+                pixel.vp.wo = wo;
+                pixel.vp.bsdf = BSDF(wo, w.n, ns, dpdus, vpBxDF);
+                pixel.vp.beta =
+                    SampledSpectrum(pixelSampleState.cameraRayWeight[w.pixelIndex]) *
+                    w.T_hat / w.uniPathPDF.Average();
+                pixel.vp.secondaryLambdaTerminated = lambda.SecondaryTerminated();
+            } else {
+                // Sample BSDF and enqueue indirect ray at intersection point
+                pstd::optional<BSDFSample> bsdfSample = bsdf.Sample_f<BxDF>(
+                    wo, raySamples.indirect.uc, raySamples.indirect.u);
+                if (bsdfSample) {
+                    // Compute updated path throughput and PDFs
+                    Vector3f wi = bsdfSample->wi;
+                    SampledSpectrum T_hat = w.T_hat * bsdfSample->f * AbsDot(wi, ns);
+                    SampledSpectrum uniPathPDF = w.uniPathPDF,
+                                    lightPathPDF = w.uniPathPDF;
+                    if (bsdfSample->pdfIsProportional) {
+                        Float pdf = bsdf.PDF<BxDF>(wo, wi);
+                        T_hat *= pdf / bsdfSample->pdf;
+                        uniPathPDF *= pdf;
+                    } else
+                        uniPathPDF *= bsdfSample->pdf;
+                    Float etaScale = w.etaScale;
+                    if (bsdfSample->IsTransmission())
+                        etaScale *= Sqr(bsdfSample->eta);
+
+                    // Apply Russian roulette to indirect ray
+                    SampledSpectrum rrBeta = T_hat * etaScale / uniPathPDF.Average();
+                    if (rrBeta.MaxComponentValue() < 1 && depth > 1) {
+                        Float q = std::max<Float>(0, 1 - rrBeta.MaxComponentValue());
+                        if (raySamples.indirect.rr < q)
+                            T_hat = SampledSpectrum(0.f);
+                        uniPathPDF *= 1 - q;
+                        lightPathPDF *= 1 - q;
+                    }
+
+                    if (T_hat) {
+                        // Enqueue indirect ray for next ray depth
+                        Ray ray = SpawnRay(w.pi, w.n, w.time, wi);
+                        bool anyNonSpecularBounces =
+                            !bsdfSample->IsSpecular() || w.anyNonSpecularBounces;
+                        LightSampleContext ctx(w.pi, w.n, ns);
+                        nextRayQueue->PushIndirectRay(
+                            ray, ctx, T_hat, uniPathPDF, lightPathPDF, lambda, etaScale,
+                            bsdfSample->IsSpecular(), anyNonSpecularBounces,
+                            w.pixelIndex);
+                    }
+                }
+            }
+
+            // Sample light and enqueue shadow ray at intersection point
+            if (bsdf.IsNonSpecular()) {
+                // Choose a light source using the _LightSampler_
+                LightSampleContext ctx(w.pi, w.n, ns);
+                if (bsdf.HasReflection() && !bsdf.HasTransmission())
+                    ctx.pi = OffsetRayOrigin(ctx.pi, w.n, wo);
+                else if (bsdf.HasTransmission() && !bsdf.HasReflection())
+                    ctx.pi = OffsetRayOrigin(ctx.pi, w.n, -wo);
+                pstd::optional<SampledLight> sampledLight =
+                    lightSampler.Sample(ctx, raySamples.direct.uc);
+                if (!sampledLight)
+                    return;
+                LightHandle light = sampledLight->light;
+
+                // Sample light source and evaluate BSDF for direct lighting
+                pstd::optional<LightLiSample> ls = light.SampleLi(
+                    ctx, raySamples.direct.u, lambda, LightSamplingMode::WithMIS);
+                if (!ls || !ls->L || ls->pdf == 0)
+                    return;
+                Vector3f wi = ls->wi;
+                SampledSpectrum f = bsdf.f<BxDF>(wo, wi);
+                if (!f)
+                    return;
+
+                // Compute path throughput and path PDFs for light sample
+                // Camera paths end at visible points, so emission found by
+                // BSDF sampling there isn't included and the light sample
+                // isn't weighted by MIS.
+                SampledSpectrum T_hat = w.T_hat * f * AbsDot(wi, ns);
+                Float lightPDF = ls->pdf * sampledLight->pdf;
+                Float bsdfPDF = (IsDeltaLight(light.Type()) || createVisiblePoint)
+                                    ? 0.f
+                                    : bsdf.PDF<BxDF>(wo, wi);
+                SampledSpectrum uniPathPDF = w.uniPathPDF * bsdfPDF;
+                SampledSpectrum lightPathPDF = w.uniPathPDF * lightPDF;
+
+                // Enqueue shadow ray with tentative radiance contribution
+                SampledSpectrum Ld = SafeDiv(T_hat * ls->L, lambda.PDF());
+                Ray ray = SpawnRayTo(w.pi, w.n, w.time, ls->pLight.pi, ls->pLight.n);
+                shadowRayQueue->Push(ray, 1 - ShadowEpsilon, lambda, Ld, uniPathPDF,
+                                     lightPathPDF, w.pixelIndex);
+            }
+        });
+}
+
+void GPUSPPMIntegrator::AccumulateDirectLighting() {
+    GPUParallelFor(
+        "Accumulate SPPM direct lighting", maxQueueSize, PBRT_GPU_LAMBDA(int pixelIndex) {
+            Point2i pPixel = pixelSampleState.pPixel[pixelIndex];
+            if (!InsideExclusive(pPixel, film.PixelBounds()))
+                return;
+            SampledSpectrum L = SampledSpectrum(pixelSampleState.L[pixelIndex]) *
+                                pixelSampleState.cameraRayWeight[pixelIndex];
+            SampledWavelengths lambda = pixelSampleState.lambda[pixelIndex];
+            pixels[SPPMPixelIndex(pPixel)].Ld += film.ToOutputRGB(L, lambda);
+        });
+}
+
+void GPUSPPMIntegrator::BuildVisiblePointGrid() {
+    // Find grid cell size for SPPM visible points
+    GPUDo(
+        "Reset SPPM grid cell size", PBRT_GPU_LAMBDA() { *gridCellSizeBits = 0; });
+    GPUParallelFor(
+        "Find SPPM grid cell size", nPixels, PBRT_GPU_LAMBDA(int pixelIndex) {
+            const GPUSPPMPixel &pixel = pixels[pixelIndex];
+            // Positive floats order the same way as their bit patterns
+            if (pixel.vp.beta)
+                atomicMax(gridCellSizeBits, FloatToBits(2 * pixel.radius));
+        });
+
+    // Sort visible points into grid cells
+    // As with the CPU SPPMIntegrator, visible points are counting sorted by
+    // cell hash. Scattering the pixels decrements _cellCounts_ back to zero,
+    // which leaves it ready for the next iteration.
+    GPUParallelFor(
+        "Count SPPM grid visible points", nPixels, PBRT_GPU_LAMBDA(int pixelIndex) {
+            const GPUSPPMPixel &pixel = pixels[pixelIndex];
+            if (pixel.vp.beta)
+                ForVisiblePointCells(pixel, [&](int h) { atomicAdd(&cellCounts[h], 1); });
+        });
+    CUDA_CHECK(cub::DeviceScan::ExclusiveSum(scanTempStorage, scanTempBytes, cellCounts,
+                                             cellStart, hashSize + 1));
+    GPUParallelFor(
+        "Scatter SPPM grid visible points", nPixels, PBRT_GPU_LAMBDA(int pixelIndex) {
+            const GPUSPPMPixel &pixel = pixels[pixelIndex];
+            if (pixel.vp.beta)
+                ForVisiblePointCells(pixel, [&](int h) {
+                    int offset = cellStart[h] + atomicAdd(&cellCounts[h], -1) - 1;
+                    gridPixels[offset] = pixelIndex;
+                });
+        });
+}
+
+void GPUSPPMIntegrator::GeneratePhotons(int iteration, int photonStart, int nPhotons,
+                                        SampledWavelengths passLambda) {
+    RayQueue *photonRayQueue = CurrentRayQueue(0);
+    GPUParallelFor(
+        "Generate photon rays", nPhotons, PBRT_GPU_LAMBDA(int photonIndex) {
+            uint64_t haltonIndex =
+                uint64_t(iteration) * uint64_t(photonsPerIteration) + photonStart +
+                photonIndex;
+            // Choose light to shoot photon from
+            pstd::optional<SampledLight> sampledLight =
+                shootLightSampler.Sample(PhotonSample(haltonIndex, 0));
+            if (!sampledLight)
+                return;
+            LightHandle light = sampledLight->light;
+            Float lightPDF = sampledLight->pdf;
+
+            // Generate photon ray from light source and initialize _beta_
+            Point2f uLight0(PhotonSample(haltonIndex, 1), PhotonSample(haltonIndex, 2));
+            Point2f uLight1(PhotonSample(haltonIndex, 3), PhotonSample(haltonIndex, 4));
+            Float time = camera.SampleTime(PhotonSample(haltonIndex, 5));
+            SampledWavelengths lambda = passLambda;
+            pstd::optional<LightLeSample> les =
+                light.SampleLe(uLight0, uLight1, lambda, time);
+            if (!les || les->pdfPos == 0 || les->pdfDir == 0 || !les->L)
+                return;
+            SampledSpectrum beta = (les->AbsCosTheta(les->ray.d) * les->L) /
+                                   (lightPDF * les->pdfPos * les->pdfDir);
+            if (!beta)
+                return;
+
+            // Enqueue photon ray; its throughput is carried in _T_hat_
+            photonRayQueue->PushIndirectRay(les->ray, LightSampleContext(), beta,
+                                            SampledSpectrum(1.f), SampledSpectrum(1.f),
+                                            lambda, 1.f, false, false, photonIndex);
+        });
+}
+
+PBRT_GPU
+void GPUSPPMIntegrator::DepositPhoton(Point3f p, Vector3f wi, const SampledSpectrum &beta,
+                                      const SampledWavelengths &lambda) {
+    Float cellSize = BitsToFloat(*gridCellSizeBits);
+    if (cellSize == 0)
+        return;
+    int h = Hash(GridCell(p, cellSize)) % hashSize;
+    // Add photon contribution to visible points in cell _h_
+    for (int i = cellStart[h]; i < cellStart[h + 1]; ++i) {
+        GPUSPPMPixel &pixel = pixels[gridPixels[i]];
+        if (DistanceSquared(pixel.vp.p, p) > Sqr(pixel.radius))
+            continue;
+        // Update _pixel_ $\Phi$ and $m$ for nearby photon
+        SampledSpectrum Phi = beta * pixel.vp.bsdf.f(pixel.vp.wo, wi);
+        SampledWavelengths phiLambda = lambda;
+        if (pixel.vp.secondaryLambdaTerminated)
+            phiLambda.TerminateSecondary();
+        Phi = SafeDiv(Phi, phiLambda.PDF());
+        for (int j = 0; j < NSpectrumSamples; ++j)
+            pixel.Phi[j].Add(Phi[j]);
+        atomicAdd(&pixel.m, 1);
+    }
+}
+
+// ScatterPhotonsCallback Definition
+struct ScatterPhotonsCallback {
+    int iteration, photonStart, depth;
+    GPUSPPMIntegrator *integrator;
+    // ScatterPhotonsCallback Public Methods
+    template <typename Material>
+    void operator()() {
+        if constexpr (!std::is_same_v<Material, MixMaterial>)
+            integrator->ScatterPhotons<Material>(iteration, photonStart, depth);
+    }
+};
+
+void GPUSPPMIntegrator::ScatterPhotons(int iteration, int photonStart, int depth) {
+    MaterialHandle::ForEachType(
+        ScatterPhotonsCallback{iteration, photonStart, depth, this});
+}
+
+template <typename Material>
+void GPUSPPMIntegrator::ScatterPhotons(int iteration, int photonStart, int depth) {
+    int index = MaterialHandle::TypeIndex<Material>();
+    if (haveBasicEvalMaterial[index]) {
+        if (haveNonConstantBasicEvalMaterial[index])
+            ScatterPhotons<Material>(BasicTextureEvaluator(), basicEvalMaterialQueue,
+                                     iteration, photonStart, depth);
+        else
+            ScatterPhotons<Material>(ConstantTextureEvaluator(), basicEvalMaterialQueue,
+                                     iteration, photonStart, depth);
+    }
+    if (haveUniversalEvalMaterial[index])
+        ScatterPhotons<Material>(UniversalTextureEvaluator(), universalEvalMaterialQueue,
+                                 iteration, photonStart, depth);
+}
+
+template <typename Material, typename TextureEvaluator>
+void GPUSPPMIntegrator::ScatterPhotons(TextureEvaluator texEval,
+                                       MaterialEvalQueue *evalQueue, int iteration,
+                                       int photonStart, int depth) {
+    // Construct _name_ for photon scattering kernel
+    std::string name = StringPrintf(
+        "SPPM photon %s + BxDF Eval (%s tex)", Material::Name(),
+        TextureEvaluatorName<TextureEvaluator>());
+
+    RayQueue *nextRayQueue = NextRayQueue(depth);
+    ForAllQueued(
+        name.c_str(), evalQueue->Get<MaterialEvalWorkItem<Material>>(), maxQueueSize,
+        PBRT_GPU_LAMBDA(const MaterialEvalWorkItem<Material> w) {
+            // Add photon contribution to nearby visible points
+            SampledSpectrum beta = w.T_hat;
+            if (depth > 0)
+                DepositPhoton(Point3f(w.pi), w.wo, beta, w.lambda);
+            if (depth + 1 == maxDepth)
+                return;
+
+            // Compute BSDF at photon intersection point
+            Normal3f ns = w.ns;
+            Vector3f dpdus = w.dpdus;
+            FloatTextureHandle displacement = w.material->GetDisplacement();
+            const Image *normalMap = w.material->GetNormalMap();
+            if (displacement || normalMap) {
+                BumpEvalContext bctx = w.GetBumpEvalContext();
+                Vector3f dpdvs;
+                Bump(texEval, displacement, normalMap, bctx, &dpdus, &dpdvs);
+                ns = Normal3f(Normalize(Cross(dpdus, dpdvs)));
+                ns = FaceForward(ns, w.n);
+            }
+            SampledWavelengths lambda = w.lambda;
+            MaterialEvalContext ctx = w.GetMaterialEvalContext(ns, dpdus);
+            using BxDF = typename Material::BxDF;
+            BxDF bxdf;
+            BSDF bsdf = w.material->GetBSDF(texEval, ctx, lambda, &bxdf);
+
+            // Sample BSDF _fr_ and direction _wi_ for reflected photon
+            uint64_t haltonIndex = uint64_t(iteration) * uint64_t(photonsPerIteration) +
+                                   photonStart + w.pixelIndex;
+            int dim = PhotonLightDimensions + PhotonBounceDimensions * depth;
+            Point2f u(PhotonSample(haltonIndex, dim + 1),
+                      PhotonSample(haltonIndex, dim + 2));
+            pstd::optional<BSDFSample> bs = bsdf.Sample_f<BxDF>(
+                w.wo, PhotonSample(haltonIndex, dim), u, TransportMode::Importance);
+            if (!bs)
+                return;
+            SampledSpectrum bnew = beta * bs->f * AbsDot(bs->wi, ns) / bs->pdf;
+
+            // Possibly terminate photon path with Russian roulette
+            Float betaRatio = bnew.MaxComponentValue() / beta.MaxComponentValue();
+            Float q = std::max<Float>(0, 1 - betaRatio);
+            if (PhotonSample(haltonIndex, dim + 3) < q)
+                return;
+            bnew /= 1 - q;
+
+            Ray ray = SpawnRay(w.pi, w.n, w.time, bs->wi);
+            nextRayQueue->PushIndirectRay(ray, LightSampleContext(w.pi, w.n, ns), bnew,
+                                          SampledSpectrum(1.f), SampledSpectrum(1.f),
+                                          lambda, w.etaScale, bs->IsSpecular(), true,
+                                          w.pixelIndex);
+        });
+}
+
+void GPUSPPMIntegrator::UpdatePixels(SampledWavelengths passLambda) {
+    GPUParallelFor(
+        "Update SPPM pixels", nPixels, PBRT_GPU_LAMBDA(int pixelIndex) {
+            GPUSPPMPixel &p = pixels[pixelIndex];
+            if (int m = p.m; m > 0) {
+                // Compute new photon count and search radius given photons
+                Float gamma = (Float)2 / (Float)3;
+                Float nNew = p.n + gamma * m;
+                Float rNew = p.radius * std::sqrt(nNew / (p.n + m));
+
+                // Update $\tau$ for pixel
+                SampledSpectrum Phi;
+                for (int i = 0; i < NSpectrumSamples; ++i)
+                    Phi[i] = p.Phi[i];
+                RGB rgb = film.ToOutputRGB(p.vp.beta * Phi, passLambda);
+                p.tau = (p.tau + rgb) * Sqr(rNew) / Sqr(p.radius);
+
+                // Set remaining pixel values for next photon pass
+                p.n = nNew;
+                p.radius = rNew;
+                p.m = 0;
+                for (int i = 0; i < NSpectrumSamples; ++i)
+                    p.Phi[i] = (Float)0;
+            }
+            // Reset _VisiblePoint_ in pixel
+            p.vp.beta = SampledSpectrum(0.);
+            p.vp.bsdf = BSDF();
+        });
+}
+
+void GPUSPPMIntegrator::WriteImage(int nIterations, Float elapsedSeconds) {
+    // Wait for the GPU so that the pixels can be read on the CPU
+    GPUWait();
+    uint64_t np = (uint64_t)nIterations * (uint64_t)photonsPerIteration;
+    Bounds2i pixelBounds = film.PixelBounds();
+    Image rgbImage(PixelFormat::Float, Point2i(pixelBounds.Diagonal()), {"R", "G", "B"});
+    ParallelFor2D(pixelBounds, [&](Point2i pPixel) {
+        // Compute radiance _L_ for SPPM pixel _pPixel_
+        const GPUSPPMPixel &pixel = pixels[SPPMPixelIndex(pPixel)];
+        RGB L = pixel.Ld / nIterations + pixel.tau / (np * Pi * Sqr(pixel.radius));
+
+        Point2i pImage = Point2i(pPixel - pixelBounds.pMin);
+        rgbImage.SetChannels(pImage, {L.r, L.g, L.b});
+    });
+
+    ImageMetadata metadata;
+    metadata.renderTimeSeconds = elapsedSeconds;
+    metadata.samplesPerPixel = nIterations;
+    metadata.pixelBounds = pixelBounds;
+    metadata.fullResolution = film.FullResolution();
+    metadata.colorSpace = colorSpace;
+    // Favor speed over size for images of intermediate iterations
+    if (nIterations < sampler.SamplesPerPixel())
+        metadata.compressionLevel = 1;
+    camera.InitMetadata(&metadata);
+    rgbImage.Write(film.GetFilename(), metadata);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,156 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_GPU_SPPM_H
+#define PBRT_GPU_SPPM_H
+
+#include <pbrt/pbrt.h>
+
+#include <pbrt/base/bxdf.h>
+#include <pbrt/base/lightsampler.h>
+#include <pbrt/bsdf.h>
+#include <pbrt/bxdfs.h>
+#include <pbrt/gpu/pathintegrator.h>
+#include <pbrt/gpu/workitems.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/containers.h>
+#include <pbrt/util/float.h>
+#include <pbrt/util/hash.h>
+#include <pbrt/util/lowdiscrepancy.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/pstd.h>
+#include <pbrt/util/spectrum.h>
+
+#include <algorithm>
+
+namespace pbrt {
+
+// Returns the size of the largest of the given types
+template <typename... Ts>
+constexpr size_t MaxSizeOf(TypePack<Ts...>) {
+    size_t size = 0;
+    ((size = std::max(size, sizeof(Ts))), ...);
+    return size;
+}
+
+// GPUSPPMPixel Definition
+struct GPUSPPMPixel {
+    // GPUSPPMPixel Public Members
+    Float radius = 0;
+    RGB Ld;
+    struct VisiblePoint {
+        Point3f p;
+        Vector3f wo;
+        BSDF bsdf;
+        SampledSpectrum beta = SampledSpectrum(0.f);
+        bool secondaryLambdaTerminated = false;
+    } vp;
+    // Storage for the visible point's BxDF, which _vp.bsdf_ refers to
+    alignas(16) uint8_t vpBxDF[MaxSizeOf(BxDFHandle::Types())];
+    AtomicFloat Phi[NSpectrumSamples];
+    int m = 0;
+    RGB tau;
+    Float n = 0;
+};
+
+// GPUSPPMIntegrator Definition
+// The GPUSPPMIntegrator reuses the GPUPathIntegrator's scene representation,
+// queues, and kernels for tracing the camera paths that create visible
+// points; photons are traced through the same ray and material queues.
+class GPUSPPMIntegrator : public GPUPathIntegrator {
+  public:
+    // GPUSPPMIntegrator Public Methods
+    GPUSPPMIntegrator(Allocator alloc, const ParsedScene &scene);
+
+    // Returns the number of iterations taken.
+    int Render();
+
+    void GenerateCameraRays(int y0, int iteration, SampledWavelengths passLambda);
+    template <typename Sampler>
+    void GenerateCameraRays(int y0, int iteration, SampledWavelengths passLambda);
+
+    void EvaluateMaterialsAndBSDFs(int depth);
+    template <typename Material>
+    void EvaluateMaterialAndBSDF(int depth);
+    template <typename Material, typename TextureEvaluator>
+    void EvaluateMaterialAndBSDF(TextureEvaluator texEval, MaterialEvalQueue *evalQueue,
+                                 int depth);
+
+    void AccumulateDirectLighting();
+
+    void BuildVisiblePointGrid();
+
+    void GeneratePhotons(int iteration, int photonStart, int nPhotons,
+                         SampledWavelengths passLambda);
+
+    void ScatterPhotons(int iteration, int photonStart, int depth);
+    template <typename Material>
+    void ScatterPhotons(int iteration, int photonStart, int depth);
+    template <typename Material, typename TextureEvaluator>
+    void ScatterPhotons(TextureEvaluator texEval, MaterialEvalQueue *evalQueue,
+                        int iteration, int photonStart, int depth);
+
+    void UpdatePixels(SampledWavelengths passLambda);
+
+    void WriteImage(int nIterations, Float elapsedSeconds);
+
+    PBRT_CPU_GPU
+    int SPPMPixelIndex(Point2i pPixel) const {
+        Bounds2i pixelBounds = film.PixelBounds();
+        int xResolution = pixelBounds.pMax.x - pixelBounds.pMin.x;
+        return (pPixel.y - pixelBounds.pMin.y) * xResolution +
+               (pPixel.x - pixelBounds.pMin.x);
+    }
+
+    PBRT_CPU_GPU
+    Float PhotonSample(uint64_t haltonIndex, int dimension) const {
+        return ScrambledRadicalInverse(dimension, haltonIndex,
+                                       (*digitPermutations)[dimension]);
+    }
+
+    PBRT_CPU_GPU
+    Point3i GridCell(Point3f p, Float cellSize) const {
+        return Point3i(Floor(p / cellSize));
+    }
+
+    // Calls _func_ with the hash of each grid cell that a pixel's visible
+    // point overlaps
+    template <typename F>
+    PBRT_GPU void ForVisiblePointCells(const GPUSPPMPixel &pixel, F func) const {
+        Float cellSize = BitsToFloat(*gridCellSizeBits);
+        Float r = pixel.radius;
+        Point3i pMin = GridCell(pixel.vp.p - Vector3f(r, r, r), cellSize);
+        Point3i pMax = GridCell(pixel.vp.p + Vector3f(r, r, r), cellSize);
+        for (int z = pMin.z; z <= pMax.z; ++z)
+            for (int y = pMin.y; y <= pMax.y; ++y)
+                for (int x = pMin.x; x <= pMax.x; ++x)
+                    func(int(Hash(Point3i(x, y, z)) % hashSize));
+    }
+
+    PBRT_GPU
+    void DepositPhoton(Point3f p, Vector3f wi, const SampledSpectrum &beta,
+                       const SampledWavelengths &lambda);
+
+    // GPUSPPMIntegrator Member Variables
+    int nPixels, photonsPerIteration;
+    Float initialSearchRadius;
+    LightSamplerHandle shootLightSampler;
+    pstd::vector<DigitPermutation> *digitPermutations;
+    const RGBColorSpace *colorSpace;
+
+    GPUSPPMPixel *pixels;
+
+    // Each cell of the visible point grid hashes to an entry in
+    // _cellStart_, which gives the start of the range of _gridPixels_ that
+    // holds the indices of the pixels with visible points that overlap it.
+    int hashSize;
+    uint32_t *gridCellSizeBits;
+    int *cellCounts, *cellStart, *gridPixels;
+    void *scanTempStorage = nullptr;
+    size_t scanTempBytes = 0;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_GPU_SPPM_H
@@ -22,7 +22,7 @@ void GPUPathIntegrator::SampleSubsurface(int depth) {
     RayQueue *nextRayQueue = NextRayQueue(depth);
 
     ForAllQueued(
-        "Get BSSRDF and enqueue probe ray", bssrdfEvalQueue, maxQueueSize,
+        "Get BSSRDF and enqueue probe ray", bssrdfEvalQueue, queueLaunchSize,
         PBRT_GPU_LAMBDA(const GetBSSRDFAndProbeRayWorkItem w) {
             using BSSRDF = typename SubsurfaceMaterial::BSSRDF;
             BSSRDF bssrdf;
@@ -45,7 +45,7 @@ void GPUPathIntegrator::SampleSubsurface(int depth) {
     accel->IntersectOneRandom(maxQueueSize, subsurfaceScatterQueue);
 
     ForAllQueued(
-        "Handle out-scattering after SSS", subsurfaceScatterQueue, maxQueueSize,
+        "Handle out-scattering after SSS", subsurfaceScatterQueue, queueLaunchSize,
         PBRT_GPU_LAMBDA(SubsurfaceScatterWorkItem w) {
             if (w.weight == 0)
                 return;
@@ -15,11 +15,14 @@
 #include <pbrt/textures.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/containers.h>
+#include <pbrt/util/bits.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
 #include <type_traits>
 
+#include <cub/cub.cuh>
+
 namespace pbrt {
 
 PBRT_CPU_GPU
@@ -59,25 +62,84 @@ void GPUPathIntegrator::EvaluateMaterialsAndBSDFs(int depth) {
 
 template <typename Material>
 void GPUPathIntegrator::EvaluateMaterialAndBSDF(int depth) {
-    if (haveBasicEvalMaterial[MaterialHandle::TypeIndex<Material>()])
-        EvaluateMaterialAndBSDF<Material>(BasicTextureEvaluator(), basicEvalMaterialQueue,
-                                          depth);
-    if (haveUniversalEvalMaterial[MaterialHandle::TypeIndex<Material>()])
+    int index = MaterialHandle::TypeIndex<Material>();
+    if (haveBasicEvalMaterial[index]) {
+        if (haveNonConstantBasicEvalMaterial[index])
+            EvaluateMaterialAndBSDF<Material>(BasicTextureEvaluator(),
+                                              basicEvalMaterialQueue, depth);
+        else
+            EvaluateMaterialAndBSDF<Material>(ConstantTextureEvaluator(),
+                                              basicEvalMaterialQueue, depth);
+    }
+    if (haveUniversalEvalMaterial[index])
         EvaluateMaterialAndBSDF<Material>(UniversalTextureEvaluator(),
                                           universalEvalMaterialQueue, depth);
 }
 
+void GPUPathIntegrator::AllocateMaterialEvalSort(Allocator alloc) {
+    for (int i = 0; i < 2; ++i) {
+        materialSortKeys[i] = alloc.allocate_object<uint64_t>(maxQueueSize);
+        materialSortIndices[i] = alloc.allocate_object<int>(maxQueueSize);
+    }
+    cub::DoubleBuffer<uint64_t> keys(materialSortKeys[0], materialSortKeys[1]);
+    cub::DoubleBuffer<int> indices(materialSortIndices[0], materialSortIndices[1]);
+    CUDA_CHECK(cub::DeviceRadixSort::SortPairs(nullptr, materialSortTempBytes, keys,
+                                               indices, maxQueueSize));
+    CUDA_CHECK(cudaMalloc(&materialSortTempStorage, materialSortTempBytes));
+}
+
+template <typename Material>
+const int *GPUPathIntegrator::SortMaterialEvalQueue(
+    WorkQueue<MaterialEvalWorkItem<Material>> *queue) {
+    // Compute sort keys from the material and texture coordinates
+    uint64_t *sortKeys = materialSortKeys[0];
+    int *sortIndices = materialSortIndices[0];
+    GPUParallelFor(
+        "Compute material sort keys", maxQueueSize, PBRT_GPU_LAMBDA(int index) {
+            sortIndices[index] = index;
+            if (index >= queue->Size()) {
+                // Sort unused entries after all of the queue's items
+                sortKeys[index] = ~uint64_t(0);
+                return;
+            }
+            // Items for the same material instance use the same textures;
+            // among them, order by the texture coordinates' Morton code.
+            uint64_t materialBits = uint32_t(uintptr_t(queue->material[index]) >> 4);
+            Point2f uv = queue->uv[index];
+            auto quantize = [](Float x) {
+                return uint32_t(Clamp(x - pstd::floor(x), 0, 1) * 0xffff);
+            };
+            sortKeys[index] =
+                (materialBits << 32) | EncodeMorton2(quantize(uv[0]), quantize(uv[1]));
+        });
+
+    // The sort's buffers and its number of passes are the same for every
+    // queue, so the sorted indices always end up in the same buffer, which
+    // allows capturing the sort in a CUDA graph.
+    cub::DoubleBuffer<uint64_t> keys(materialSortKeys[0], materialSortKeys[1]);
+    cub::DoubleBuffer<int> indices(materialSortIndices[0], materialSortIndices[1]);
+    CUDA_CHECK(cub::DeviceRadixSort::SortPairs(materialSortTempStorage,
+                                               materialSortTempBytes, keys, indices,
+                                               maxQueueSize, 0, 64, GPUStream()));
+    return indices.Current();
+}
+
 template <typename Material, typename TextureEvaluator>
 void GPUPathIntegrator::EvaluateMaterialAndBSDF(TextureEvaluator texEval,
                                                 MaterialEvalQueue *evalQueue, int depth) {
     // Construct _name_ for material/texture evaluator kernel
     std::string name = StringPrintf(
         "%s + BxDF Eval (%s tex)", Material::Name(),
-        std::is_same_v<TextureEvaluator, BasicTextureEvaluator> ? "Basic" : "Universal");
+        TextureEvaluatorName<TextureEvaluator>());
 
     RayQueue *nextRayQueue = NextRayQueue(depth);
+    auto queue = evalQueue->Get<MaterialEvalWorkItem<Material>>();
+    // Sorting all of the queue's entries isn't worthwhile once few paths
+    // remain.
+    bool sort = sortMaterialEvalQueues && queueLaunchSize == maxQueueSize;
+    const int *order = sort ? SortMaterialEvalQueue(queue) : nullptr;
     ForAllQueued(
-        name.c_str(), evalQueue->Get<MaterialEvalWorkItem<Material>>(), maxQueueSize,
+        name.c_str(), queue, order, queueLaunchSize,
         PBRT_GPU_LAMBDA(const MaterialEvalWorkItem<Material> w) {
             // Evaluate material and BSDF for ray intersection
             // Apply bump mapping if material has a displacement texture
@@ -14,11 +14,68 @@
 #include <pbrt/materials.h>
 #include <pbrt/ray.h>
 #include <pbrt/util/containers.h>
+#include <pbrt/util/float.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/soa.h>
+#include <pbrt/util/vecmath.h>
 
 namespace pbrt {
 
+// Compact Work Item Encodings
+// If pbrt is built with PBRT_GPU_COMPACT_QUEUES, the work queues store the
+// fields that are marked with encoding() in workitems.soa using these types.
+// Their constructors are implicit so that the work queues' Push() methods
+// can assign to the fields' arrays directly.
+
+// HalfSampledSpectrum Definition
+// Stores a spectrum's values as half floats relative to the largest of
+// them, so that path throughputs and PDFs, which may be far outside of
+// half's range, can be stored.
+class HalfSampledSpectrum {
+  public:
+    // HalfSampledSpectrum Public Methods
+    HalfSampledSpectrum() = default;
+    PBRT_CPU_GPU
+    HalfSampledSpectrum(const SampledSpectrum &s) {
+        scale = 0;
+        for (int i = 0; i < NSpectrumSamples; ++i)
+            scale = std::max(scale, std::abs(s[i]));
+        Float invScale = scale > 0 ? 1 / scale : 0;
+        for (int i = 0; i < NSpectrumSamples; ++i)
+            v[i] = Half(s[i] * invScale);
+    }
+
+    PBRT_CPU_GPU
+    explicit operator SampledSpectrum() const {
+        SampledSpectrum s;
+        for (int i = 0; i < NSpectrumSamples; ++i)
+            s[i] = scale * float(v[i]);
+        return s;
+    }
+
+  private:
+    // HalfSampledSpectrum Private Members
+    Float scale;
+    Half v[NSpectrumSamples];
+};
+
+// OctahedralNormal3f Definition
+// Stores a unit-length normal in 32 bits.
+class OctahedralNormal3f {
+  public:
+    // OctahedralNormal3f Public Methods
+    OctahedralNormal3f() = default;
+    PBRT_CPU_GPU
+    OctahedralNormal3f(Normal3f n) : v(Vector3f(n)) {}
+
+    PBRT_CPU_GPU
+    explicit operator Normal3f() const { return Normal3f(Vector3f(v)); }
+
+  private:
+    // OctahedralNormal3f Private Members
+    OctahedralVector v;
+};
+
 // RaySamples Definition
 struct RaySamples {
     // RaySamples Public Members
@@ -110,6 +167,8 @@ struct SOA<RaySamples> {
     PBRT_CPU_GPU
     GetSetIndirector operator[](int i) { return GetSetIndirector{this, i}; }
 
+    static constexpr size_t BytesPerItem = 3 * sizeof(Float4) + 2 * sizeof(Float);
+
   private:
     Float4 *__restrict__ direct;
     Float4 *__restrict__ indirect;
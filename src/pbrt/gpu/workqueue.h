@@ -89,12 +89,35 @@ class WorkQueue : public SOA<WorkItem> {
 };
 
 // WorkQueue Inline Functions
+// ForAllQueued() launches _nThreads_ threads to call _func_ for the queue's
+// items. Usually there is a thread for each item that the queue can hold;
+// when fewer are launched, e.g. once few paths remain, each thread loops
+// over every _nThreads_th item so that all of them are still processed.
 template <typename F, typename WorkItem>
-void ForAllQueued(const char *desc, WorkQueue<WorkItem> *q, int maxQueued, F func) {
-    GPUParallelFor(desc, maxQueued, [=] PBRT_GPU(int index) mutable {
-        if (index >= q->Size())
-            return;
-        func((*q)[index]);
+void ForAllQueued(const char *desc, WorkQueue<WorkItem> *q, int nThreads, F func) {
+    WorkQueueStats *stats = GetWorkQueueStats(desc, SOA<WorkItem>::BytesPerItem);
+    GPUParallelFor(desc, nThreads, [=] PBRT_GPU(int thread) mutable {
+        int size = q->Size();
+        if (thread == 0 && stats)
+            stats->Record(size, nThreads);
+        for (int index = thread; index < size; index += nThreads)
+            func((*q)[index]);
+    });
+}
+
+// This variant processes the queue's items in the order given by _order_,
+// whose first entries are a permutation of the indices of the queue's
+// items, or in queue order if _order_ is null.
+template <typename F, typename WorkItem>
+void ForAllQueued(const char *desc, WorkQueue<WorkItem> *q, const int *order,
+                  int nThreads, F func) {
+    WorkQueueStats *stats = GetWorkQueueStats(desc, SOA<WorkItem>::BytesPerItem);
+    GPUParallelFor(desc, nThreads, [=] PBRT_GPU(int thread) mutable {
+        int size = q->Size();
+        if (thread == 0 && stats)
+            stats->Record(size, nThreads);
+        for (int i = thread; i < size; i += nThreads)
+            func((*q)[order ? order[i] : i]);
     });
 }
 
@@ -152,9 +152,23 @@ RayDifferential SurfaceInteraction::SpawnRay(const RayDifferential &rayi,
 BSDF SurfaceInteraction::GetBSDF(const RayDifferential &ray, SampledWavelengths &lambda,
                                  CameraHandle camera, ScratchBuffer &scratchBuffer,
                                  SamplerHandle sampler) {
-    ComputeDifferentials(ray, camera, sampler.SamplesPerPixel());
+    // Compute differentials only if they may be needed: to filter textures
+    // other than constant ones, for bump or normal mapping, or to find the
+    // differentials of specularly scattered rays, which requires that _ray_
+    // have them. Otherwise they are left zero, as most indirect rays hit
+    // surfaces that don't need them.
+    bool computedDifferentials = false;
+    auto computeDifferentials = [&]() {
+        if (!computedDifferentials)
+            ComputeDifferentials(ray, camera, sampler.SamplesPerPixel());
+        computedDifferentials = true;
+    };
+    if (ray.hasDifferentials)
+        computeDifferentials();
+
     // Resolve _MixMaterial_ if necessary
     while (material.Is<MixMaterial>()) {
+        computeDifferentials();
         MixMaterial *mix = material.CastOrNullptr<MixMaterial>();
         material = mix->ChooseMaterial(UniversalTextureEvaluator(), *this);
     }
@@ -166,6 +180,9 @@ BSDF SurfaceInteraction::GetBSDF(const RayDifferential &ray, SampledWavelengths
     // Evaluate bump map and compute shading normal
     FloatTextureHandle displacement = material.GetDisplacement();
     const Image *normalMap = material.GetNormalMap();
+    if (displacement || normalMap ||
+        !material.CanEvaluateTextures(ConstantTextureEvaluator()))
+        computeDifferentials();
     if (displacement || normalMap) {
         Vector3f dpdu, dpdv;
         Bump(UniversalTextureEvaluator(), displacement, normalMap, *this, &dpdu, &dpdv);
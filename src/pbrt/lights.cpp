@@ -9,6 +9,7 @@
 #include <pbrt/lights.h>
 
 #include <pbrt/cameras.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/samplers.h>
 #include <pbrt/shapes.h>
@@ -17,6 +18,7 @@
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/float.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
@@ -25,11 +27,55 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
 namespace pbrt {
 
 STAT_COUNTER("Scene/Lights", numLights);
 STAT_COUNTER("Scene/AreaLights", numAreaLights);
 
+// Light Group Function Definitions
+static std::mutex lightGroupsMutex;
+static std::vector<std::string> lightGroupNames;
+
+int LightGroupIndex(const std::string &name, const FileLoc *loc) {
+    std::lock_guard<std::mutex> lock(lightGroupsMutex);
+    auto iter = std::find(lightGroupNames.begin(), lightGroupNames.end(), name);
+    if (iter != lightGroupNames.end())
+        return iter - lightGroupNames.begin();
+    if (lightGroupNames.size() == MaxLightGroups)
+        ErrorExit(loc, "%s: at most %d light groups are supported.", name,
+                  MaxLightGroups);
+    lightGroupNames.push_back(name);
+    return lightGroupNames.size() - 1;
+}
+
+std::vector<std::string> LightGroupNames() {
+    std::lock_guard<std::mutex> lock(lightGroupsMutex);
+    return lightGroupNames;
+}
+
+// Light Index Function Definitions
+void AssignLightIndices(pstd::span<const LightHandle> lights) {
+    for (size_t i = 0; i < lights.size(); ++i)
+        lights[i].DispatchCPU([&](auto ptr) { ptr->SetIndex(int(i)); });
+}
+
+int LightIndexCount(pstd::span<const LightHandle> lights) {
+    int maxIndex = -1;
+    for (LightHandle light : lights) {
+        if (light.Index() == -1) {
+            AssignLightIndices(lights);
+            return lights.size();
+        }
+        maxIndex = std::max(maxIndex, light.Index());
+    }
+    return maxIndex + 1;
+}
+
 // Light Method Definitions
 std::string ToString(LightType lf) {
     switch (lf) {
@@ -629,6 +675,152 @@ GoniometricLight *GoniometricLight::Create(const Transform &renderFromLight,
                                               std::move(image), alloc);
 }
 
+// Image-Textured Emitter Function Definitions
+// Image emission over a triangle is tabulated at the centers of an $n \times n$
+// grid over the triangle's area sampling domain, with _n_ chosen so that the
+// grid roughly resolves the image texels that the triangle covers. Triangles
+// that cover at least this many grid cells along each dimension are
+// importance sampled according to the tabulated values.
+static constexpr int MinImageDistributionResolution = 3;
+static constexpr int MaxImageDistributionResolution = 64;
+static constexpr Float ImageDistributionFloor = 0.01f;
+
+static int TriangleImageResolution(const Triangle *tri, const Image &image) {
+    pstd::array<Point2f, 3> uv = tri->TextureCoordinates();
+    Vector2f d1 = uv[1] - uv[0], d2 = uv[2] - uv[0];
+    Float uvArea = std::abs(DifferenceOfProducts(d1.x, d2.y, d1.y, d2.x)) / 2;
+    Float texels = uvArea * image.Resolution().x * image.Resolution().y;
+    return Clamp(int(std::ceil(std::sqrt(2 * texels))), 1,
+                 MaxImageDistributionResolution);
+}
+
+// Returns the image lookup point for the center of grid cell $(x,y)$, where
+// $t$ is flipped to match _DiffuseAreaLight::L()_.
+static Point2f TriangleImagePoint(const pstd::array<Point2f, 3> &uv, int n, int x,
+                                  int y) {
+    Point2f u((x + 0.5f) / n, (y + 0.5f) / n);
+    pstd::array<Float, 3> b = SampleUniformTriangle(u);
+    Point2f st = b[0] * uv[0] + b[1] * uv[1] + b[2] * uv[2];
+    return Point2f(st[0], 1 - st[1]);
+}
+
+// Returns the average image channel value over the triangle and, if the
+// triangle covers enough of the image, a distribution for sampling it.
+static Float TabulateTriangleImage(const Triangle *tri, const Image &image,
+                                   Allocator alloc,
+                                   const PiecewiseConstant2D **distribution) {
+    int n = TriangleImageResolution(tri, image);
+    pstd::array<Point2f, 3> uv = tri->TextureCoordinates();
+    std::vector<Float> values(n * n);
+    Float sum = 0;
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            Point2f st = TriangleImagePoint(uv, n, x, y);
+            for (int c = 0; c < 3; ++c)
+                values[y * n + x] += image.BilerpChannel(st, c) / 3;
+            sum += values[y * n + x];
+        }
+
+    Float average = sum / (n * n);
+    *distribution = nullptr;
+    if (n >= MinImageDistributionResolution) {
+        // Ensure that cells whose centers are dark but that still overlap
+        // emitting texels may be sampled
+        for (Float &v : values)
+            v = std::max(v, ImageDistributionFloor * average);
+        *distribution = alloc.new_object<PiecewiseConstant2D>(values, n, n, alloc);
+    }
+    return average;
+}
+
+// Returns the average emitted spectrum over the triangle.
+static SampledSpectrum TriangleImageSpectrum(const Triangle *tri, const Image &image,
+                                             const RGBColorSpace &colorSpace,
+                                             const SampledWavelengths &lambda) {
+    int n = TriangleImageResolution(tri, image);
+    pstd::array<Point2f, 3> uv = tri->TextureCoordinates();
+    SampledSpectrum sum(0.f);
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            Point2f st = TriangleImagePoint(uv, n, x, y);
+            RGB rgb;
+            for (int c = 0; c < 3; ++c)
+                rgb[c] = image.BilerpChannel(st, c);
+            sum += RGBIlluminantSpectrum(colorSpace, ClampZero(rgb)).Sample(lambda);
+        }
+    return sum / (n * n);
+}
+
+// Samples a point on _shape_ by area, importance sampling its area sampling
+// domain with _distribution_ if it isn't null.
+PBRT_CPU_GPU static pstd::optional<ShapeSample> SampleEmitter(
+    ShapeHandle shape, const PiecewiseConstant2D *distribution, Point2f u) {
+    if (!distribution)
+        return shape.Sample(u);
+    Float pdf;
+    Point2f us = distribution->Sample(u, &pdf);
+    pstd::optional<ShapeSample> ss = shape.Sample(us);
+    if (ss)
+        ss->pdf *= pdf;
+    return ss;
+}
+
+PBRT_CPU_GPU static Float EmitterPDF(ShapeHandle shape,
+                                     const PiecewiseConstant2D *distribution,
+                                     const Interaction &intr) {
+    if (!distribution)
+        return shape.PDF(intr);
+    // Find the point in the triangle's area sampling domain that maps to _intr_
+    pstd::array<Point3f, 3> v = shape.Cast<Triangle>()->Vertices();
+    Point3f p = intr.p();
+    Vector3f n = Cross(v[1] - v[0], v[2] - v[0]);
+    Float b0 = Dot(Cross(v[1] - p, v[2] - p), n) / LengthSquared(n);
+    Float b1 = Dot(Cross(v[2] - p, v[0] - p), n) / LengthSquared(n);
+    Point2f u = InvertUniformTriangleSample({b0, b1, 1 - b0 - b1});
+    u = Point2f(Clamp(u[0], 0, OneMinusEpsilon), Clamp(u[1], 0, OneMinusEpsilon));
+
+    return distribution->PDF(u) * shape.PDF(intr);
+}
+
+// Samples a point on _shape_ as seen from _ctx_, returning its PDF with
+// respect to solid angle.
+PBRT_CPU_GPU static pstd::optional<ShapeSample> SampleEmitter(
+    ShapeHandle shape, const PiecewiseConstant2D *distribution,
+    const ShapeSampleContext &ctx, Point2f u) {
+    if (!distribution)
+        return shape.Sample(ctx, u);
+    pstd::optional<ShapeSample> ss = SampleEmitter(shape, distribution, u);
+    if (!ss)
+        return {};
+    ss->intr.time = ctx.time;
+    Vector3f wi = ss->intr.p() - ctx.p();
+    if (LengthSquared(wi) == 0)
+        return {};
+    wi = Normalize(wi);
+
+    // Convert area sample PDF in _ss_ to solid angle measure
+    ss->pdf /= AbsDot(ss->intr.n, -wi) / DistanceSquared(ctx.p(), ss->intr.p());
+    if (IsInf(ss->pdf))
+        return {};
+    return ss;
+}
+
+PBRT_CPU_GPU static Float EmitterPDF(ShapeHandle shape,
+                                     const PiecewiseConstant2D *distribution,
+                                     const ShapeSampleContext &ctx, Vector3f wi) {
+    if (!distribution)
+        return shape.PDF(ctx, wi);
+    // Intersect sample ray with shape geometry
+    pstd::optional<ShapeIntersection> isect = shape.Intersect(ctx.SpawnRay(wi));
+    if (!isect)
+        return 0;
+
+    // Compute PDF in solid angle measure from shape intersection point
+    Float pdf = EmitterPDF(shape, distribution, isect->intr) /
+                (AbsDot(isect->intr.n, -wi) / DistanceSquared(ctx.p(), isect->intr.p()));
+    return IsInf(pdf) ? 0 : pdf;
+}
+
 // DiffuseAreaLight Method Definitions
 DiffuseAreaLight::DiffuseAreaLight(const Transform &renderFromLight,
                                    const MediumInterface &mediumInterface,
@@ -654,6 +846,18 @@ DiffuseAreaLight::DiffuseAreaLight(const Transform &renderFromLight,
         CHECK_EQ(3, desc.size());
         CHECK(desc.IsIdentity());
         CHECK(imageColorSpace != nullptr);
+
+        if (const Triangle *tri = shape.CastOrNullptr<Triangle>())
+            imageAverage = TabulateTriangleImage(tri, image, alloc, &imageDistribution);
+        else {
+            // Compute average _DiffuseAreaLight_ image channel value
+            // Assume no distortion in the mapping, FWIW...
+            for (int y = 0; y < image.Resolution().y; ++y)
+                for (int x = 0; x < image.Resolution().x; ++x)
+                    for (int c = 0; c < 3; ++c)
+                        imageAverage += image.GetChannel({x, y}, c);
+            imageAverage /= 3 * image.Resolution().x * image.Resolution().y;
+        }
     } else {
         CHECK(Le);
     }
@@ -673,7 +877,7 @@ pstd::optional<LightLiSample> DiffuseAreaLight::SampleLi(LightSampleContext ctx,
                                                          LightSamplingMode mode) const {
     // Sample point on shape for _DiffuseAreaLight_
     ShapeSampleContext shapeCtx(ctx.pi, ctx.n, ctx.ns, 0 /* time */);
-    pstd::optional<ShapeSample> ss = shape.Sample(shapeCtx, u);
+    pstd::optional<ShapeSample> ss = SampleEmitter(shape, imageDistribution, shapeCtx, u);
     if (!ss || ss->pdf == 0 || LengthSquared(ss->intr.p() - ctx.p()) == 0)
         return {};
     DCHECK(!IsNaN(ss->pdf));
@@ -690,12 +894,15 @@ pstd::optional<LightLiSample> DiffuseAreaLight::SampleLi(LightSampleContext ctx,
 Float DiffuseAreaLight::PDF_Li(LightSampleContext ctx, Vector3f wi,
                                LightSamplingMode) const {
     ShapeSampleContext shapeCtx(ctx.pi, ctx.n, ctx.ns, 0 /* time */);
-    return shape.PDF(shapeCtx, wi);
+    return EmitterPDF(shape, imageDistribution, shapeCtx, wi);
 }
 
 SampledSpectrum DiffuseAreaLight::Phi(const SampledWavelengths &lambda) const {
     SampledSpectrum phi(0.f);
-    if (image) {
+    if (image && shape.Is<Triangle>())
+        phi = TriangleImageSpectrum(shape.Cast<Triangle>(), image, *imageColorSpace,
+                                    lambda);
+    else if (image) {
         // Compute average light image emission
         for (int y = 0; y < image.Resolution().y; ++y)
             for (int x = 0; x < image.Resolution().x; ++x) {
@@ -714,18 +921,7 @@ SampledSpectrum DiffuseAreaLight::Phi(const SampledWavelengths &lambda) const {
 
 pstd::optional<LightBounds> DiffuseAreaLight::Bounds() const {
     // Compute _phi_ for diffuse area light bounds
-    Float phi = 0;
-    if (image) {
-        // Compute average _DiffuseAreaLight_ image channel value
-        // Assume no distortion in the mapping, FWIW...
-        for (int y = 0; y < image.Resolution().y; ++y)
-            for (int x = 0; x < image.Resolution().x; ++x)
-                for (int c = 0; c < 3; ++c)
-                    phi += image.GetChannel({x, y}, c);
-        phi /= 3 * image.Resolution().x * image.Resolution().y;
-
-    } else
-        phi = Lemit.MaxValue();
+    Float phi = image ? imageAverage : Lemit.MaxValue();
     phi *= scale * (twoSided ? 2 : 1) * area * Pi;
 
     DirectionCone nb = shape.NormalBounds();
@@ -737,7 +933,7 @@ pstd::optional<LightLeSample> DiffuseAreaLight::SampleLe(Point2f u1, Point2f u2,
                                                          SampledWavelengths &lambda,
                                                          Float time) const {
     // Sample a point on the area light's _Shape_
-    pstd::optional<ShapeSample> ss = shape.Sample(u1);
+    pstd::optional<ShapeSample> ss = SampleEmitter(shape, imageDistribution, u1);
     if (!ss)
         return {};
     ss->intr.time = time;
@@ -776,7 +972,7 @@ pstd::optional<LightLeSample> DiffuseAreaLight::SampleLe(Point2f u1, Point2f u2,
 void DiffuseAreaLight::PDF_Le(const Interaction &intr, Vector3f &w, Float *pdfPos,
                               Float *pdfDir) const {
     CHECK_NE(intr.n, Normal3f(0, 0, 0));
-    *pdfPos = shape.PDF(intr);
+    *pdfPos = EmitterPDF(shape, imageDistribution, intr);
     *pdfDir = twoSided ? (.5 * CosineHemispherePDF(AbsDot(intr.n, w)))
                        : CosineHemispherePDF(Dot(intr.n, w));
 }
@@ -788,22 +984,29 @@ std::string DiffuseAreaLight::ToString() const {
                         area, image);
 }
 
-DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
-                                           MediumHandle medium,
-                                           const ParameterDictionary &parameters,
-                                           const RGBColorSpace *colorSpace,
-                                           const FileLoc *loc, Allocator alloc,
-                                           const ShapeHandle shape) {
-    SpectrumHandle L =
-        parameters.GetOneSpectrum("L", nullptr, SpectrumType::Illuminant, alloc);
-    Float scale = parameters.GetOneFloat("scale", 1);
-    bool twoSided = parameters.GetOneBool("twosided", false);
+// Emission parameters shared by _DiffuseAreaLight_ and _DiffuseMeshLight_.
+struct DiffuseEmission {
+    SpectrumHandle L;
+    Float scale;
+    bool twoSided;
+    Image image;
+    const RGBColorSpace *imageColorSpace = nullptr;
+};
+
+// Returns the emission given by a "diffuse" area light's parameters for an
+// emitter with total surface area _area_, which "power" is relative to.
+static DiffuseEmission GetDiffuseEmission(const ParameterDictionary &parameters,
+                                          const RGBColorSpace *colorSpace,
+                                          const FileLoc *loc, Allocator alloc,
+                                          Float area) {
+    DiffuseEmission e{nullptr, 1, false, Image(alloc)};
+    e.L = parameters.GetOneSpectrum("L", nullptr, SpectrumType::Illuminant, alloc);
+    e.scale = parameters.GetOneFloat("scale", 1);
+    e.twoSided = parameters.GetOneBool("twosided", false);
 
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
-    Image image(alloc);
-    const RGBColorSpace *imageColorSpace = nullptr;
     if (!filename.empty()) {
-        if (L != nullptr)
+        if (e.L != nullptr)
             ErrorExit(loc, "Both \"L\" and \"filename\" specified for DiffuseAreaLight.");
         ImageAndMetadata im = Image::Read(filename, alloc);
 
@@ -813,14 +1016,14 @@ DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
                       "%s: Image provided to \"diffuse\" area light must have "
                       "R, G, and B channels.",
                       filename);
-        image = im.image.SelectChannels(channelDesc, alloc);
+        e.image = im.image.SelectChannels(channelDesc, alloc);
 
-        imageColorSpace = im.metadata.GetColorSpace();
-    } else if (L == nullptr)
-        L = &colorSpace->illuminant;
+        e.imageColorSpace = im.metadata.GetColorSpace();
+    } else if (e.L == nullptr)
+        e.L = &colorSpace->illuminant;
 
     // scale so that radiance is equivalent to 1 nit
-    scale /= SpectrumToPhotometric(L ? L : &colorSpace->illuminant);
+    e.scale /= SpectrumToPhotometric(e.L ? e.L : &colorSpace->illuminant);
 
     Float phi_v = parameters.GetOneFloat("power", -1.0f);
     if (phi_v > 0) {
@@ -828,33 +1031,198 @@ DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
         // distribution and texture and is used to normalize the emitted
         // radiance such that the user-defined power will be the actual power
         // emitted by the light.
-        Float k_e;
-        // Get the appropriate luminance vector from the image colour space
-        RGB lum = imageColorSpace->LuminanceVector();
-        // we need to know which channels correspond to R, G and B
-        // we know that the channelDesc is valid as we would have exited in the
-        // block above otherwise
-        ImageChannelDesc channelDesc = image.GetChannelDesc({"R", "G", "B"});
-        if (image) {
+        Float k_e = 1;
+        if (e.image) {
+            // Get the appropriate luminance vector from the image colour space
+            RGB lum = e.imageColorSpace->LuminanceVector();
             k_e = 0;
             // Assume no distortion in the mapping, FWIW...
-            for (int y = 0; y < image.Resolution().y; ++y)
-                for (int x = 0; x < image.Resolution().x; ++x) {
+            for (int y = 0; y < e.image.Resolution().y; ++y)
+                for (int x = 0; x < e.image.Resolution().x; ++x) {
                     for (int c = 0; c < 3; ++c)
-                        k_e += image.GetChannel({x, y}, c) * lum[c];
+                        k_e += e.image.GetChannel({x, y}, c) * lum[c];
                 }
-            k_e /= image.Resolution().x * image.Resolution().y;
+            k_e /= e.image.Resolution().x * e.image.Resolution().y;
         }
 
-        k_e *= (twoSided ? 2 : 1) * shape.Area() * Pi;
+        k_e *= (e.twoSided ? 2 : 1) * area * Pi;
 
         // now multiply up scale to hit the target power
-        scale *= phi_v / k_e;
+        e.scale *= phi_v / k_e;
+    }
+    return e;
+}
+
+DiffuseAreaLight *DiffuseAreaLight::Create(const Transform &renderFromLight,
+                                           MediumHandle medium,
+                                           const ParameterDictionary &parameters,
+                                           const RGBColorSpace *colorSpace,
+                                           const FileLoc *loc, Allocator alloc,
+                                           const ShapeHandle shape) {
+    DiffuseEmission e =
+        GetDiffuseEmission(parameters, colorSpace, loc, alloc, shape.Area());
+    return alloc.new_object<DiffuseAreaLight>(renderFromLight, medium, e.L, e.scale,
+                                              shape, std::move(e.image),
+                                              e.imageColorSpace, e.twoSided, alloc);
+}
+
+// DiffuseMeshLight Method Definitions
+DiffuseMeshLight::DiffuseMeshLight(const MediumInterface &mediumInterface,
+                                   SpectrumHandle Le, Float scale,
+                                   pstd::span<const ShapeHandle> shapes, Image im,
+                                   const RGBColorSpace *imageColorSpace, bool twoSided,
+                                   Allocator alloc)
+    : mediumInterface(mediumInterface),
+      twoSided(twoSided),
+      Lemit(Le, alloc),
+      scale(scale),
+      image(std::move(im)),
+      imageColorSpace(imageColorSpace),
+      triangleLights(alloc) {
+    numLights += shapes.size();
+    numAreaLights += shapes.size();
+
+    if (image) {
+        ImageChannelDesc desc = image.GetChannelDesc({"R", "G", "B"});
+        if (!desc)
+            ErrorExit("Image used for DiffuseMeshLight doesn't have R, G, B "
+                      "channels.");
+        CHECK_EQ(3, desc.size());
+        CHECK(desc.IsIdentity());
+        CHECK(imageColorSpace != nullptr);
+    } else {
+        CHECK(Le);
+    }
+
+    // Create the triangles' lights, computing their power bounds
+    triangleLights.reserve(shapes.size());
+    for (ShapeHandle shape : shapes) {
+        Float area = shape.Area();
+        const PiecewiseConstant2D *imageDistribution = nullptr;
+        Float phi = image ? TabulateTriangleImage(shape.Cast<Triangle>(), image, alloc,
+                                                  &imageDistribution)
+                          : Lemit.MaxValue();
+        phi *= scale * (twoSided ? 2 : 1) * area * Pi;
+        triangleLights.push_back(
+            TriangleLight(this, shape, area, phi, imageDistribution));
     }
+}
+
+std::string DiffuseMeshLight::ToString() const {
+    return StringPrintf("[ DiffuseMeshLight mediumInterface: %s lightGroup: %d "
+                        "Lemit: %s scale: %f twoSided: %s image: %s "
+                        "triangles: %d ]",
+                        mediumInterface, lightGroup, Lemit, scale, twoSided, image,
+                        triangleLights.size());
+}
+
+DiffuseMeshLight *DiffuseMeshLight::Create(MediumHandle medium,
+                                           const ParameterDictionary &parameters,
+                                           const RGBColorSpace *colorSpace,
+                                           const FileLoc *loc, Allocator alloc,
+                                           pstd::span<const ShapeHandle> shapes) {
+    // "power" gives the power emitted by the entire mesh
+    Float area = 0;
+    for (ShapeHandle shape : shapes)
+        area += shape.Area();
+    DiffuseEmission e = GetDiffuseEmission(parameters, colorSpace, loc, alloc, area);
+    return alloc.new_object<DiffuseMeshLight>(medium, e.L, e.scale, shapes,
+                                              std::move(e.image), e.imageColorSpace,
+                                              e.twoSided, alloc);
+}
+
+// TriangleLight Method Definitions
+pstd::optional<LightLiSample> TriangleLight::SampleLi(LightSampleContext ctx, Point2f u,
+                                                      SampledWavelengths lambda,
+                                                      LightSamplingMode mode) const {
+    // Sample point on triangle for _TriangleLight_
+    ShapeSampleContext shapeCtx(ctx.pi, ctx.n, ctx.ns, 0 /* time */);
+    pstd::optional<ShapeSample> ss = SampleEmitter(shape, imageDistribution, shapeCtx, u);
+    if (!ss || ss->pdf == 0 || LengthSquared(ss->intr.p() - ctx.p()) == 0)
+        return {};
+    DCHECK(!IsNaN(ss->pdf));
+    ss->intr.mediumInterface = &meshLight->mediumInterface;
+
+    // Return _LightLiSample_ for sampled point on triangle
+    Vector3f wi = Normalize(ss->intr.p() - ctx.p());
+    SampledSpectrum Le = L(ss->intr.p(), ss->intr.n, ss->intr.uv, -wi, lambda);
+    if (!Le)
+        return {};
+    return LightLiSample(Le, wi, ss->pdf, ss->intr);
+}
 
-    return alloc.new_object<DiffuseAreaLight>(renderFromLight, medium, L, scale, shape,
-                                              std::move(image), imageColorSpace, twoSided,
-                                              alloc);
+Float TriangleLight::PDF_Li(LightSampleContext ctx, Vector3f wi,
+                            LightSamplingMode) const {
+    ShapeSampleContext shapeCtx(ctx.pi, ctx.n, ctx.ns, 0 /* time */);
+    return EmitterPDF(shape, imageDistribution, shapeCtx, wi);
+}
+
+SampledSpectrum TriangleLight::Phi(const SampledWavelengths &lambda) const {
+    const DiffuseMeshLight &m = *meshLight;
+    SampledSpectrum L = m.image ? TriangleImageSpectrum(shape.Cast<Triangle>(), m.image,
+                                                        *m.imageColorSpace, lambda)
+                                : m.Lemit.Sample(lambda);
+    return L * (m.twoSided ? 2 : 1) * m.scale * area * Pi;
+}
+
+pstd::optional<LightBounds> TriangleLight::Bounds() const {
+    DirectionCone nb = shape.NormalBounds();
+    return LightBounds(shape.Bounds(), nb.w, phiBound, nb.cosTheta, std::cos(Pi / 2),
+                       meshLight->twoSided);
+}
+
+pstd::optional<LightLeSample> TriangleLight::SampleLe(Point2f u1, Point2f u2,
+                                                      SampledWavelengths &lambda,
+                                                      Float time) const {
+    // Sample a point on the triangle
+    pstd::optional<ShapeSample> ss = SampleEmitter(shape, imageDistribution, u1);
+    if (!ss)
+        return {};
+    ss->intr.time = time;
+    ss->intr.mediumInterface = &meshLight->mediumInterface;
+
+    // Sample a cosine-weighted outgoing direction _w_ for triangle light
+    Vector3f w;
+    Float pdfDir;
+    if (meshLight->twoSided) {
+        // Choose side of surface and sample cosine-weighted outgoing direction
+        if (u2[0] < 0.5f) {
+            u2[0] = std::min(u2[0] * 2, OneMinusEpsilon);
+            w = SampleCosineHemisphere(u2);
+        } else {
+            u2[0] = std::min((u2[0] - 0.5f) * 2, OneMinusEpsilon);
+            w = SampleCosineHemisphere(u2);
+            w.z *= -1;
+        }
+        pdfDir = 0.5f * CosineHemispherePDF(std::abs(w.z));
+
+    } else {
+        w = SampleCosineHemisphere(u2);
+        pdfDir = CosineHemispherePDF(w.z);
+    }
+    if (pdfDir == 0)
+        return {};
+
+    // Return _LightLeSample_ for ray leaving triangle light
+    const Interaction &intr = ss->intr;
+    Frame nFrame = Frame::FromZ(intr.n);
+    w = nFrame.FromLocal(w);
+    return LightLeSample(L(intr.p(), intr.n, intr.uv, w, lambda), intr.SpawnRay(w), intr,
+                         ss->pdf, pdfDir);
+}
+
+void TriangleLight::PDF_Le(const Interaction &intr, Vector3f &w, Float *pdfPos,
+                           Float *pdfDir) const {
+    CHECK_NE(intr.n, Normal3f(0, 0, 0));
+    *pdfPos = EmitterPDF(shape, imageDistribution, intr);
+    *pdfDir = meshLight->twoSided ? (.5 * CosineHemispherePDF(AbsDot(intr.n, w)))
+                                  : CosineHemispherePDF(Dot(intr.n, w));
+}
+
+std::string TriangleLight::ToString() const {
+    return StringPrintf("[ TriangleLight meshLight: %p shape: %s area: %f phiBound: %f "
+                        "imageDistribution: %p index: %d ]",
+                        meshLight, shape, area, phiBound, imageDistribution, index);
 }
 
 // UniformInfiniteLight Method Definitions
@@ -921,6 +1289,139 @@ std::string UniformInfiniteLight::ToString() const {
     return StringPrintf("[ UniformInfiniteLight %s Lemit: %s ]", BaseToString(), Lemit);
 }
 
+// Light Distribution Cache Definitions
+STAT_COUNTER("Scene/Light distributions loaded from cache", lightCacheHits);
+
+// Increment _LightCacheVersion_ whenever the layout of cached tables changes.
+static constexpr int32_t LightCacheVersion = 1;
+
+struct LightCacheHeader {
+    char magic[8];
+    int32_t version;
+    int32_t floatSize;
+    uint64_t key;
+    uint64_t nFloats;
+};
+
+// Returns a hash of the image's format, resolution, and pixel values.
+static uint64_t LightImageHash(const Image &image) {
+    Point2i res = image.Resolution();
+    size_t rowBytes = size_t(res.x) * image.NChannels() * TexelBytes(image.Format());
+    std::vector<uint64_t> rowHashes(res.y);
+    ParallelFor(0, res.y, [&](int64_t y) {
+        rowHashes[y] = HashBuffer(image.RawPointer({0, int(y)}), rowBytes);
+    });
+    std::string encoding = image.Encoding() ? image.Encoding().ToString() : "";
+    return Hash(HashBuffer(rowHashes.data(), rowHashes.size() * sizeof(uint64_t)),
+                HashBuffer(encoding.data(), encoding.size()), res, image.Format(),
+                image.NChannels());
+}
+
+// Opens a cache file written by _WriteLightCacheTables()_ and returns its
+// tables if it's valid for _key_. They are only valid while _file_ is open.
+static pstd::optional<pstd::span<const Float>> ReadLightCacheTables(
+    const std::string &filename, uint64_t key, std::unique_ptr<MappedFile> *file) {
+    if (!FileExists(filename))
+        return {};
+    std::string error;
+    *file = MappedFile::Open(filename, &error);
+    if (!*file) {
+        Warning("%s", error);
+        return {};
+    }
+
+    // Validate cache file header
+    LightCacheHeader header;
+    size_t size = (*file)->Size(), nFloats = 0;
+    if (size >= sizeof(header)) {
+        std::memcpy(&header, (*file)->Data(), sizeof(header));
+        nFloats = (size - sizeof(header)) / sizeof(Float);
+    }
+    if (size < sizeof(header) || std::memcmp(header.magic, "pbrtlgt", 8) != 0 ||
+        header.version != LightCacheVersion || header.floatSize != sizeof(Float) ||
+        header.key != key || header.nFloats != nFloats) {
+        Warning("%s: ignoring stale or corrupt light cache file.", filename);
+        return {};
+    }
+    return pstd::span<const Float>(
+        reinterpret_cast<const Float *>((*file)->Data() + sizeof(header)), nFloats);
+}
+
+// Writes _nFloats_ values, which are initialized by _writeTables_, to a light
+// cache file for _key_.
+static void WriteLightCacheTables(const std::string &filename, uint64_t key,
+                                  size_t nFloats,
+                                  std::function<void(pstd::span<Float>)> writeTables) {
+    // Initialize cache file contents
+    LightCacheHeader header;
+    std::memcpy(header.magic, "pbrtlgt", 8);
+    header.version = LightCacheVersion;
+    header.floatSize = sizeof(Float);
+    header.key = key;
+    header.nFloats = nFloats;
+    std::string contents(sizeof(header) + nFloats * sizeof(Float), '\0');
+    std::memcpy(&contents[0], &header, sizeof(header));
+    writeTables(
+        pstd::span<Float>(reinterpret_cast<Float *>(&contents[sizeof(header)]), nFloats));
+
+    if (!WriteFileAtomic(filename, contents)) {
+        Warning("%s: unable to write light cache file.", filename);
+        return;
+    }
+    LOG_VERBOSE("Wrote light sampling distributions to cache file %s", filename);
+}
+
+// Initializes the given distributions from a cache file written by
+// _WriteLightCache()_ and returns true if it's valid for _key_.
+static bool ReadLightCache(const std::string &filename, uint64_t key,
+                           const std::vector<PiecewiseConstant2D *> &distributions,
+                           Allocator alloc) {
+    std::unique_ptr<MappedFile> file;
+    pstd::optional<pstd::span<const Float>> cacheTables =
+        ReadLightCacheTables(filename, key, &file);
+    if (!cacheTables)
+        return false;
+
+    // Read distributions' tables, only updating _distributions_ if all are valid
+    pstd::span<const Float> tables = *cacheTables;
+    std::vector<PiecewiseConstant2D> cached;
+    cached.reserve(distributions.size());
+    for (size_t i = 0; i < distributions.size(); ++i) {
+        pstd::optional<PiecewiseConstant2D> d =
+            PiecewiseConstant2D::FromTables(tables, alloc);
+        if (!d) {
+            Warning("%s: ignoring corrupt light cache file.", filename);
+            return false;
+        }
+        tables = tables.subspan(d->TablesSize(), tables.size() - d->TablesSize());
+        cached.push_back(std::move(*d));
+    }
+    if (!tables.empty()) {
+        Warning("%s: ignoring corrupt light cache file.", filename);
+        return false;
+    }
+    for (size_t i = 0; i < distributions.size(); ++i)
+        *distributions[i] = std::move(cached[i]);
+
+    ++lightCacheHits;
+    LOG_VERBOSE("Loaded light sampling distributions from cache file %s", filename);
+    return true;
+}
+
+static void WriteLightCache(
+    const std::string &filename, uint64_t key,
+    const std::vector<const PiecewiseConstant2D *> &distributions) {
+    size_t nFloats = 0;
+    for (const PiecewiseConstant2D *d : distributions)
+        nFloats += d->TablesSize();
+    WriteLightCacheTables(filename, key, nFloats, [&](pstd::span<Float> tables) {
+        for (const PiecewiseConstant2D *d : distributions) {
+            d->WriteTables(tables.subspan(0, d->TablesSize()));
+            tables = tables.subspan(d->TablesSize(), tables.size() - d->TablesSize());
+        }
+    });
+}
+
 // ImageInfiniteLight Method Definitions
 ImageInfiniteLight::ImageInfiniteLight(Transform renderFromLight, Image im,
                                        const RGBColorSpace *imageColorSpace, Float scale,
@@ -943,15 +1444,41 @@ ImageInfiniteLight::ImageInfiniteLight(Transform renderFromLight, Image im,
         ErrorExit("%s: image resolution (%d, %d) is non-square. It's unlikely "
                   "this is an equal area environment map.",
                   filename, image.Resolution().x, image.Resolution().y);
+    // Use cached sampling distributions for the image, if available
+    std::string cacheFilename;
+    uint64_t cacheKey = 0;
+    if (!Options->lightCacheDirectory.empty()) {
+        cacheKey = Hash(LightImageHash(image), LightCacheVersion);
+        cacheFilename =
+            StringPrintf("%s/envmap-%016llx.bin", Options->lightCacheDirectory,
+                         (unsigned long long)cacheKey);
+        if (ReadLightCache(cacheFilename, cacheKey,
+                           {&distribution, &compensatedDistribution}, alloc))
+            return;
+    }
+
     Array2D<Float> d = image.GetSamplingDistribution();
     Bounds2f domain = Bounds2f(Point2f(0, 0), Point2f(1, 1));
     distribution = PiecewiseConstant2D(d, domain, alloc);
 
     // Initialize compensated PDF for image infinite area light
-    Float average = std::accumulate(d.begin(), d.end(), 0.) / d.size();
-    for (Float &v : d)
-        v = std::max<Float>(v - average, std::min<Float>(.001f * average, v));
+    std::vector<double> rowSums(d.ySize());
+    ParallelFor(0, d.ySize(), [&](int64_t y) {
+        for (int x = 0; x < d.xSize(); ++x)
+            rowSums[y] += d(x, y);
+    });
+    Float average = std::accumulate(rowSums.begin(), rowSums.end(), 0.) / d.size();
+    ParallelFor(0, d.ySize(), [&](int64_t y) {
+        for (int x = 0; x < d.xSize(); ++x) {
+            Float &v = d(x, y);
+            v = std::max<Float>(v - average, std::min<Float>(.001f * average, v));
+        }
+    });
     compensatedDistribution = PiecewiseConstant2D(d, domain, alloc);
+
+    if (!cacheFilename.empty())
+        WriteLightCache(cacheFilename, cacheKey,
+                        {&distribution, &compensatedDistribution});
 }
 
 Float ImageInfiniteLight::PDF_Li(LightSampleContext ctx, Vector3f w,
@@ -1021,11 +1548,10 @@ PortalImageInfiniteLight::PortalImageInfiniteLight(
     const RGBColorSpace *imageColorSpace, Float scale, const std::string &filename,
     std::vector<Point3f> p, Allocator alloc)
     : LightBase(LightType::Infinite, renderFromLight, MediumInterface()),
-      image(alloc),
+      portals(alloc),
       imageColorSpace(imageColorSpace),
       scale(scale),
-      filename(filename),
-      distribution(alloc) {
+      filename(filename) {
     ImageChannelDesc channelDesc = equalAreaImage.GetChannelDesc({"R", "G", "B"});
     if (!channelDesc)
         ErrorExit("%s: image used for PortalImageInfiniteLight doesn't have R, "
@@ -1039,43 +1565,105 @@ PortalImageInfiniteLight::PortalImageInfiniteLight(
                   "this is an equal area environment map.",
                   filename, equalAreaImage.Resolution().x, equalAreaImage.Resolution().y);
 
-    if (p.size() != 4)
-        ErrorExit("Expected 4 vertices for infinite light portal but given %d", p.size());
-    for (int i = 0; i < 4; ++i)
-        portal[i] = p[i];
-
-    // PortalImageInfiniteLight constructor conclusion
-    // Compute frame for portal coordinate system
-    Vector3f p01 = Normalize(portal[1] - portal[0]);
-    Vector3f p12 = Normalize(portal[2] - portal[1]);
-    Vector3f p32 = Normalize(portal[2] - portal[3]);
-    Vector3f p03 = Normalize(portal[3] - portal[0]);
-    // Do opposite edges have the same direction?
-    if (std::abs(Dot(p01, p32) - 1) > .001 || std::abs(Dot(p12, p03) - 1) > .001)
-        Error("Infinite light portal isn't a planar quadrilateral");
-    // Sides perpendicular?
-    if (std::abs(Dot(p01, p12)) > .001 || std::abs(Dot(p12, p32)) > .001 ||
-        std::abs(Dot(p32, p03)) > .001 || std::abs(Dot(p03, p01)) > .001)
-        Error("Infinite light portal isn't a planar quadrilateral");
-    portalFrame = Frame::FromXY(p03, p01);
+    if (p.empty() || p.size() % 4 != 0)
+        ErrorExit("Expected 4 vertices for each infinite light portal but given %d",
+                  p.size());
+    uint64_t imageHash =
+        Options->lightCacheDirectory.empty() ? 0 : LightImageHash(equalAreaImage);
+    portals.reserve(p.size() / 4);
+    for (size_t i = 0; i < p.size(); i += 4) {
+        Portal portal;
+        for (int j = 0; j < 4; ++j)
+            portal.p[j] = p[i + j];
+
+        // Compute frame for portal coordinate system
+        Vector3f p01 = Normalize(portal.p[1] - portal.p[0]);
+        Vector3f p12 = Normalize(portal.p[2] - portal.p[1]);
+        Vector3f p32 = Normalize(portal.p[2] - portal.p[3]);
+        Vector3f p03 = Normalize(portal.p[3] - portal.p[0]);
+        // Do opposite edges have the same direction?
+        if (std::abs(Dot(p01, p32) - 1) > .001 || std::abs(Dot(p12, p03) - 1) > .001)
+            Error("Infinite light portal isn't a planar quadrilateral");
+        // Sides perpendicular?
+        if (std::abs(Dot(p01, p12)) > .001 || std::abs(Dot(p12, p32)) > .001 ||
+            std::abs(Dot(p32, p03)) > .001 || std::abs(Dot(p03, p01)) > .001)
+            Error("Infinite light portal isn't a planar quadrilateral");
+        portal.frame = Frame::FromXY(p03, p01);
+
+        // Share the rectified image of an earlier portal with the same
+        // orientation, if there is one
+        portal.image = nullptr;
+        for (const Portal &prev : portals)
+            if (Dot(prev.frame.x, portal.frame.x) > 1 - 1e-5f &&
+                Dot(prev.frame.y, portal.frame.y) > 1 - 1e-5f) {
+                portal.frame = prev.frame;
+                portal.image = prev.image;
+                portal.distribution = prev.distribution;
+                break;
+            }
+        if (!portal.image)
+            RectifyImage(&portal, equalAreaImage, imageHash, alloc);
+        portals.push_back(portal);
+    }
+}
+
+void PortalImageInfiniteLight::RectifyImage(Portal *portal, const Image &equalAreaImage,
+                                            uint64_t imageHash, Allocator alloc) const {
+    Point2i res = equalAreaImage.Resolution();
+    Image *image = alloc.new_object<Image>(PixelFormat::Float, res,
+                                           std::vector<std::string>{"R", "G", "B"},
+                                           equalAreaImage.Encoding(), alloc);
+    portal->image = image;
+    // Use the cached rectified image and distribution, if available
+    // The cached tables are the image's RGB values followed by the
+    // distribution's function values.
+    size_t nPixels = size_t(res.x) * res.y;
+    std::string cacheFilename;
+    uint64_t cacheKey = 0;
+    if (!Options->lightCacheDirectory.empty()) {
+        cacheKey = Hash(imageHash, LightCacheVersion, portal->frame,
+                        renderFromLight.GetMatrix());
+        cacheFilename =
+            StringPrintf("%s/portal-%016llx.bin", Options->lightCacheDirectory,
+                         (unsigned long long)cacheKey);
+        std::unique_ptr<MappedFile> file;
+        pstd::optional<pstd::span<const Float>> tables =
+            ReadLightCacheTables(cacheFilename, cacheKey, &file);
+        if (tables && tables->size() != 4 * nPixels)
+            Warning("%s: ignoring corrupt light cache file.", cacheFilename);
+        else if (tables) {
+            Array2D<Float> d(res.x, res.y);
+            ParallelFor(0, res.y, [&](int64_t y) {
+                for (int x = 0; x < res.x; ++x) {
+                    size_t offset = y * res.x + x;
+                    for (int c = 0; c < 3; ++c)
+                        image->SetChannel({x, int(y)}, c, (*tables)[3 * offset + c]);
+                    d(x, y) = (*tables)[3 * nPixels + offset];
+                }
+            });
+            portal->distribution =
+                alloc.new_object<WindowedPiecewiseConstant2D>(d, alloc);
+            ++lightCacheHits;
+            LOG_VERBOSE("Loaded light sampling distributions from cache file %s",
+                        cacheFilename);
+            return;
+        }
+    }
 
     // Resample environment map into rectified image
-    image = Image(PixelFormat::Float, equalAreaImage.Resolution(), {"R", "G", "B"},
-                  equalAreaImage.Encoding(), alloc);
-    ParallelFor(0, image.Resolution().y, [&](int y) {
-        for (int x = 0; x < image.Resolution().x; ++x) {
+    ParallelFor(0, res.y, [&](int y) {
+        for (int x = 0; x < res.x; ++x) {
             // Resample _equalAreaImage_ to compute rectified image pixel $(x,y)$
             // Find $(u,v)$ coordinates in equal-area image for pixel
-            Point2f uv((x + 0.5f) / image.Resolution().x,
-                       (y + 0.5f) / image.Resolution().y);
-            Vector3f w = RenderFromImage(uv);
+            Point2f uv((x + 0.5f) / res.x, (y + 0.5f) / res.y);
+            Vector3f w = RenderFromImage(portal->frame, uv);
             w = Normalize(renderFromLight.ApplyInverse(w));
             Point2f uvEqui = EqualAreaSphereToSquare(w);
 
             for (int c = 0; c < 3; ++c) {
                 Float v =
                     equalAreaImage.BilerpChannel(uvEqui, c, WrapMode::OctahedralSphere);
-                image.SetChannel({x, y}, c, v);
+                image->SetChannel({x, y}, c, v);
             }
         }
     });
@@ -1083,52 +1671,100 @@ PortalImageInfiniteLight::PortalImageInfiniteLight(
     // Initialize sampling distribution for portal image infinite light
     auto duv_dw = [&](const Point2f &p) {
         Float duv_dw;
-        (void)RenderFromImage(p, &duv_dw);
+        (void)RenderFromImage(portal->frame, p, &duv_dw);
         return duv_dw;
     };
-    Array2D<Float> d = image.GetSamplingDistribution(duv_dw);
-    distribution = WindowedPiecewiseConstant2D(d, alloc);
+    Array2D<Float> d = image->GetSamplingDistribution(duv_dw);
+    if (!cacheFilename.empty())
+        WriteLightCacheTables(cacheFilename, cacheKey, 4 * nPixels,
+                              [&](pstd::span<Float> tables) {
+                                  for (int y = 0; y < res.y; ++y)
+                                      for (int x = 0; x < res.x; ++x) {
+                                          size_t offset = size_t(y) * res.x + x;
+                                          for (int c = 0; c < 3; ++c)
+                                              tables[3 * offset + c] =
+                                                  image->GetChannel({x, y}, c);
+                                          tables[3 * nPixels + offset] = d(x, y);
+                                      }
+                              });
+    portal->distribution = alloc.new_object<WindowedPiecewiseConstant2D>(d, alloc);
 }
 
 SampledSpectrum PortalImageInfiniteLight::Phi(const SampledWavelengths &lambda) const {
     // We're really computing fluence, then converting to power, for what
     // that's worth..
-    SampledSpectrum sumL(0.);
-
-    for (int y = 0; y < image.Resolution().y; ++y) {
-        for (int x = 0; x < image.Resolution().x; ++x) {
-            RGB rgb;
-            for (int c = 0; c < 3; ++c)
-                rgb[c] = image.GetChannel({x, y}, c);
+    SampledSpectrum phi(0.);
+    for (const Portal &portal : portals) {
+        const Image &image = *portal.image;
+        SampledSpectrum sumL(0.);
+        for (int y = 0; y < image.Resolution().y; ++y) {
+            for (int x = 0; x < image.Resolution().x; ++x) {
+                RGB rgb;
+                for (int c = 0; c < 3; ++c)
+                    rgb[c] = image.GetChannel({x, y}, c);
 
-            Point2f st((x + 0.5f) / image.Resolution().x,
-                       (y + 0.5f) / image.Resolution().y);
-            Float duv_dw;
-            (void)RenderFromImage(st, &duv_dw);
+                Point2f st((x + 0.5f) / image.Resolution().x,
+                           (y + 0.5f) / image.Resolution().y);
+                Float duv_dw;
+                (void)RenderFromImage(portal.frame, st, &duv_dw);
 
-            sumL +=
-                RGBIlluminantSpectrum(*imageColorSpace, ClampZero(rgb)).Sample(lambda) /
-                duv_dw;
+                sumL += RGBIlluminantSpectrum(*imageColorSpace, ClampZero(rgb))
+                            .Sample(lambda) /
+                        duv_dw;
+            }
         }
+        phi += Area(portal) * sumL / (image.Resolution().x * image.Resolution().y);
     }
 
-    return scale * Area() * sumL / (image.Resolution().x * image.Resolution().y);
+    return scale * phi;
+}
+
+pstd::optional<LightBounds> PortalImageInfiniteLight::Bounds() const {
+    // Compute _phi_ for the portals from their images' average channel values
+    Float phi = 0;
+    Bounds3f bounds;
+    DirectionCone normals;
+    for (const Portal &portal : portals) {
+        const Image &image = *portal.image;
+        Float sumL = 0;
+        for (int y = 0; y < image.Resolution().y; ++y)
+            for (int x = 0; x < image.Resolution().x; ++x) {
+                Point2f st((x + 0.5f) / image.Resolution().x,
+                           (y + 0.5f) / image.Resolution().y);
+                Float duv_dw;
+                (void)RenderFromImage(portal.frame, st, &duv_dw);
+                sumL += std::max<Float>(0, image.GetChannels({x, y}).Average()) / duv_dw;
+            }
+        phi += Area(portal) * sumL / (image.Resolution().x * image.Resolution().y);
+
+        // Light arrives through the portal in the direction opposite to its
+        // frame's $z$ axis
+        for (Point3f p : portal.p)
+            bounds = Union(bounds, p);
+        normals = Union(normals, DirectionCone(-portal.frame.z));
+    }
+
+    return LightBounds(bounds, normals.w, scale * phi, normals.cosTheta,
+                       std::cos(Pi / 2), false);
 }
 
 SampledSpectrum PortalImageInfiniteLight::Le(const Ray &ray,
                                              const SampledWavelengths &lambda) const {
-    pstd::optional<Point2f> uv = ImageFromRender(Normalize(ray.d));
-    pstd::optional<Bounds2f> b = ImageBounds(ray.o);
-    if (!uv || !b || !Inside(*uv, *b))
-        return SampledSpectrum(0.f);
-    return ImageLookup(*uv, lambda);
+    // Return the environment's radiance if the ray passes through any portal
+    for (const Portal &portal : portals) {
+        pstd::optional<Point2f> uv = ImageFromRender(portal.frame, Normalize(ray.d));
+        pstd::optional<Bounds2f> b = ImageBounds(portal, ray.o);
+        if (uv && b && Inside(*uv, *b))
+            return ImageLookup(portal, *uv, lambda);
+    }
+    return SampledSpectrum(0.f);
 }
 
 SampledSpectrum PortalImageInfiniteLight::ImageLookup(
-    Point2f uv, const SampledWavelengths &lambda) const {
+    const Portal &portal, Point2f uv, const SampledWavelengths &lambda) const {
     RGB rgb;
     for (int c = 0; c < 3; ++c)
-        rgb[c] = image.LookupNearestChannel(uv, c);
+        rgb[c] = portal.image->LookupNearestChannel(uv, c);
     RGBIlluminantSpectrum spec(*imageColorSpace, ClampZero(rgb));
     return scale * spec.Sample(lambda);
 }
@@ -1136,50 +1772,72 @@ SampledSpectrum PortalImageInfiniteLight::ImageLookup(
 pstd::optional<LightLiSample> PortalImageInfiniteLight::SampleLi(
     LightSampleContext ctx, Point2f u, SampledWavelengths lambda,
     LightSamplingMode mode) const {
-    // Sample $(u,v)$ in potentially-visible region of light image
-    pstd::optional<Bounds2f> b = ImageBounds(ctx.p());
-    if (!b)
+    // Choose a portal in proportion to the light arriving through it
+    Float weightSum = 0;
+    for (const Portal &portal : portals)
+        weightSum += PortalWeight(portal, ctx.p());
+    if (weightSum == 0)
         return {};
+    int index = -1;
+    Float weight = 0, up = u[0] * weightSum;
+    for (size_t i = 0; i < portals.size(); ++i) {
+        weight = PortalWeight(portals[i], ctx.p());
+        if (weight == 0)
+            continue;
+        index = i;
+        if (up < weight)
+            break;
+        up -= weight;
+    }
+    u[0] = std::min(up / weight, OneMinusEpsilon);
+    const Portal &portal = portals[index];
+
+    // Sample $(u,v)$ in potentially-visible region of portal's image
+    pstd::optional<Bounds2f> b = ImageBounds(portal, ctx.p());
     Float mapPDF;
-    Point2f uv = distribution.Sample(u, *b, &mapPDF);
+    Point2f uv = portal.distribution->Sample(u, *b, &mapPDF);
     if (mapPDF == 0)
         return {};
 
     // Convert portal image sample point to direction and compute PDF
     Float duv_dw;
-    Vector3f wi = RenderFromImage(uv, &duv_dw);
+    Vector3f wi = RenderFromImage(portal.frame, uv, &duv_dw);
     if (duv_dw == 0)
         return {};
-    Float pdf = mapPDF / duv_dw;
+    // Other portals that _wi_ passes through could have sampled it, too
+    Float pdf = weight * mapPDF / duv_dw;
+    for (size_t i = 0; i < portals.size(); ++i)
+        if (int(i) != index)
+            pdf += WeightedPDF(portals[i], ctx.p(), wi);
+    pdf /= weightSum;
     CHECK(!IsInf(pdf));
 
     // Compute radiance for portal light sample and return _LightLiSample_
-    SampledSpectrum L = ImageLookup(uv, lambda);
+    SampledSpectrum L = ImageLookup(portal, uv, lambda);
     Point3f pl = ctx.p() + 2 * sceneRadius * wi;
     return LightLiSample(L, wi, pdf, Interaction(pl, &mediumInterface));
 }
 
 Float PortalImageInfiniteLight::PDF_Li(LightSampleContext ctx, Vector3f w,
                                        LightSamplingMode mode) const {
-    // Find image $(u,v)$ coordinates corresponding to direction _w_
-    Float duv_dw;
-    pstd::optional<Point2f> uv = ImageFromRender(w, &duv_dw);
-    if (!uv || duv_dw == 0)
-        return 0;
-
-    // Return PDF for sampling $(u,v)$ from reference point
-    pstd::optional<Bounds2f> b = ImageBounds(ctx.p());
-    if (!b)
-        return {};
-    Float pdf = distribution.PDF(*uv, *b);
-    return pdf / duv_dw;
+    // Sum the densities of sampling _w_ through each portal
+    Float weightSum = 0, pdf = 0;
+    for (const Portal &portal : portals) {
+        weightSum += PortalWeight(portal, ctx.p());
+        pdf += WeightedPDF(portal, ctx.p(), w);
+    }
+    return weightSum > 0 ? pdf / weightSum : 0;
 }
 
 pstd::optional<LightLeSample> PortalImageInfiniteLight::SampleLe(
     Point2f u1, Point2f u2, SampledWavelengths &lambda, Float time) const {
+    // Choose a portal uniformly and sample a direction from its image
+    int index = std::min<int>(u1[0] * portals.size(), portals.size() - 1);
+    u1[0] = std::min<Float>(u1[0] * portals.size() - index, OneMinusEpsilon);
+    const Portal &portal = portals[index];
     Float mapPDF;
     Bounds2f b(Point2f(0, 0), Point2f(1, 1));
-    Point2f uv = distribution.Sample(u1, b, &mapPDF);
+    Point2f uv = portal.distribution->Sample(u1, b, &mapPDF);
     if (mapPDF == 0)
         return {};
 
@@ -1187,24 +1845,28 @@ pstd::optional<LightLeSample> PortalImageInfiniteLight::SampleLe(
     // Note: ignore WorldToLight since we already folded it in when we
     // resampled...
     Float duv_dw;
-    Vector3f w = -RenderFromImage(uv, &duv_dw);
+    Vector3f w = -RenderFromImage(portal.frame, uv, &duv_dw);
     if (duv_dw == 0)
         return {};
 
     // Compute PDF for sampled infinite light direction
     Float pdfDir = mapPDF / duv_dw;
+    for (size_t i = 0; i < portals.size(); ++i)
+        if (int(i) != index)
+            pdfDir += DirectionPDF(portals[i], -w);
+    pdfDir /= portals.size();
 
 #if 0
     // Just sample within the portal.
     // This works with the light path integrator, but not BDPT :-(
-    Point3f p = portal[0] + u2[0] * (portal[1] - portal[0]) +
-        u2[1] * (portal[3] - portal[0]);
+    Point3f p = portal.p[0] + u2[0] * (portal.p[1] - portal.p[0]) +
+        u2[1] * (portal.p[3] - portal.p[0]);
     // Compute _PortalImageInfiniteLight_ ray PDFs
     Ray ray(p, w, time);
 
     // Cosine to account for projected area of portal w.r.t. ray direction.
-    Normal3f n = Normal3f(portalFrame.z);
-    Float pdfPos = 1 / (Area() * AbsDot(n, w));
+    Normal3f n = Normal3f(portal.frame.z);
+    Float pdfPos = 1 / (Area(portal) * AbsDot(n, w));
 #else
     // Compute infinite light sample ray
     Frame wFrame = Frame::FromZ(-w);
@@ -1215,7 +1877,7 @@ pstd::optional<LightLeSample> PortalImageInfiniteLight::SampleLe(
     Float pdfPos = 1 / (Pi * Sqr(sceneRadius));
 #endif
 
-    SampledSpectrum L = ImageLookup(uv, lambda);
+    SampledSpectrum L = ImageLookup(portal, uv, lambda);
 
     return LightLeSample(L, ray, pdfPos, pdfDir);
 }
@@ -1224,31 +1886,33 @@ void PortalImageInfiniteLight::PDF_Le(const Ray &ray, Float *pdfPos,
                                       Float *pdfDir) const {
     // TODO: negate here or???
     Vector3f w = -Normalize(ray.d);
-    Float duv_dw;
-    pstd::optional<Point2f> uv = ImageFromRender(w, &duv_dw);
-
-    if (!uv || duv_dw == 0) {
+    Float pdf = 0;
+    for (const Portal &portal : portals)
+        pdf += DirectionPDF(portal, w);
+    if (pdf == 0) {
         *pdfPos = *pdfDir = 0;
         return;
     }
 
-    Bounds2f b(Point2f(0, 0), Point2f(1, 1));
-    Float pdf = distribution.PDF(*uv, b);
-
 #if 0
-    Normal3f n = Normal3f(portalFrame.z);
-    *pdfPos = 1 / (Area() * AbsDot(n, w));
+    Normal3f n = Normal3f(portals[0].frame.z);
+    *pdfPos = 1 / (Area(portals[0]) * AbsDot(n, w));
 #else
     *pdfPos = 1 / (Pi * Sqr(sceneRadius));
 #endif
 
-    *pdfDir = pdf / duv_dw;
+    *pdfDir = pdf / portals.size();
+}
+
+std::string PortalImageInfiniteLight::Portal::ToString() const {
+    return StringPrintf("[ Portal p: %s frame: %s image: %p distribution: %p ]", p, frame,
+                        image, distribution);
 }
 
 std::string PortalImageInfiniteLight::ToString() const {
-    return StringPrintf("[ PortalImageInfiniteLight %s filename:%s scale: %f portal: %s "
-                        " portalFrame: %s ]",
-                        BaseToString(), filename, scale, portal, portalFrame);
+    return StringPrintf(
+        "[ PortalImageInfiniteLight %s filename:%s scale: %f portals: %s ]",
+        BaseToString(), filename, scale, portals);
 }
 
 // SpotLight Method Definitions
@@ -1543,6 +2207,12 @@ LightHandle LightHandle::Create(const std::string &name,
     if (!light)
         ErrorExit(loc, "%s: unable to create light.", name);
 
+    std::string lightGroup = parameters.GetOneString("lightgroup", "");
+    if (!lightGroup.empty()) {
+        int group = LightGroupIndex(lightGroup, loc);
+        light.DispatchCPU([&](auto ptr) { ptr->SetLightGroup(group); });
+    }
+
     parameters.ReportUnused();
     return light;
 }
@@ -1564,8 +2234,45 @@ LightHandle LightHandle::CreateArea(const std::string &name,
     if (!area)
         ErrorExit(loc, "%s: unable to create area light.", name);
 
+    std::string lightGroup = parameters.GetOneString("lightgroup", "");
+    if (!lightGroup.empty()) {
+        int group = LightGroupIndex(lightGroup, loc);
+        area.DispatchCPU([&](auto ptr) { ptr->SetLightGroup(group); });
+    }
+
     parameters.ReportUnused();
     return area;
 }
 
+pstd::vector<LightHandle> LightHandle::CreateAreaLights(
+    const std::string &name, const ParameterDictionary &parameters,
+    const Transform &renderFromLight, const MediumInterface &mediumInterface,
+    pstd::span<const ShapeHandle> shapes, const FileLoc *loc, Allocator alloc) {
+    pstd::vector<LightHandle> lights(alloc);
+    bool isMesh =
+        shapes.size() > 1 && std::all_of(shapes.begin(), shapes.end(),
+                                         [](ShapeHandle s) { return s.Is<Triangle>(); });
+    if (name != "diffuse" || !isMesh) {
+        for (ShapeHandle shape : shapes)
+            lights.push_back(CreateArea(name, parameters, renderFromLight,
+                                        mediumInterface, shape, loc, alloc));
+        return lights;
+    }
+
+    // Create a single _DiffuseMeshLight_ for the mesh's triangles
+    DiffuseMeshLight *meshLight =
+        DiffuseMeshLight::Create(mediumInterface.outside, parameters,
+                                 parameters.ColorSpace(), loc, alloc, shapes);
+    lights.reserve(shapes.size());
+    for (TriangleLight &light : meshLight->TriangleLights())
+        lights.push_back(&light);
+
+    std::string lightGroup = parameters.GetOneString("lightgroup", "");
+    if (!lightGroup.empty())
+        meshLight->SetLightGroup(LightGroupIndex(lightGroup, loc));
+
+    parameters.ReportUnused();
+    return lights;
+}
+
 }  // namespace pbrt
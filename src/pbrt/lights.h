@@ -24,11 +24,29 @@
 #include <pbrt/util/vecmath.h>
 
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace pbrt {
 
 std::string ToString(LightType type);
 
+// Light Group Function Declarations
+// Lights are assigned to groups with their "lightgroup" parameter; groups
+// are numbered in the order in which they are first used.
+int LightGroupIndex(const std::string &name, const FileLoc *loc);
+std::vector<std::string> LightGroupNames();
+
+// Light Index Function Declarations
+// Numbers the given lights consecutively from zero, replacing any indices
+// they had before. This is done for each scene's lights once they have all
+// been created, so that lights that are reused from an earlier scene are
+// renumbered along with the new ones.
+void AssignLightIndices(pstd::span<const LightHandle> lights);
+// Returns one more than the largest index of the given lights, first
+// numbering them with _AssignLightIndices()_ if any of them has no index.
+int LightIndexCount(pstd::span<const LightHandle> lights);
+
 // Light Inline Functions
 PBRT_CPU_GPU inline bool IsDeltaLight(LightType type) {
     return (type == LightType::DeltaPosition || type == LightType::DeltaDirection);
@@ -140,6 +158,14 @@ class LightBase {
     PBRT_CPU_GPU
     LightType Type() const { return type; }
 
+    PBRT_CPU_GPU
+    int LightGroup() const { return lightGroup; }
+    void SetLightGroup(int group) { lightGroup = group; }
+
+    PBRT_CPU_GPU
+    int Index() const { return index; }
+    void SetIndex(int i) { index = i; }
+
     PBRT_CPU_GPU
     SampledSpectrum L(Point3f p, Normal3f n, Point2f uv, Vector3f w,
                       const SampledWavelengths &lambda) const {
@@ -156,6 +182,8 @@ class LightBase {
     LightType type;
     Transform renderFromLight;
     MediumInterface mediumInterface;
+    int lightGroup = -1;
+    int index = -1;
 };
 
 // PointLight Definition
@@ -443,6 +471,142 @@ class DiffuseAreaLight : public LightBase {
     Float scale;
     Image image;
     const RGBColorSpace *imageColorSpace;
+    // Average image channel value over the shape, and, for triangles that
+    // cover enough of the image, the distribution that their area sampling
+    // domain is importance sampled with
+    Float imageAverage = 0;
+    const PiecewiseConstant2D *imageDistribution = nullptr;
+};
+
+// DiffuseMeshLight Definition
+// Diffuse emission from all of the triangles of a mesh. The emission is
+// stored once for the mesh and each triangle's light is a _TriangleLight_
+// that only records its shape, area, power, and image distribution, so that
+// meshes with many emissive triangles don't need a _DiffuseAreaLight_ for
+// each one.
+class DiffuseMeshLight {
+  public:
+    // DiffuseMeshLight Public Methods
+    DiffuseMeshLight(const MediumInterface &mediumInterface, SpectrumHandle Le,
+                     Float scale, pstd::span<const ShapeHandle> shapes, Image image,
+                     const RGBColorSpace *imageColorSpace, bool twoSided,
+                     Allocator alloc);
+
+    static DiffuseMeshLight *Create(MediumHandle medium,
+                                    const ParameterDictionary &parameters,
+                                    const RGBColorSpace *colorSpace, const FileLoc *loc,
+                                    Allocator alloc,
+                                    pstd::span<const ShapeHandle> shapes);
+
+    // The lights for the shapes the mesh light was created with, in order
+    pstd::span<TriangleLight> TriangleLights() {
+        return pstd::span<TriangleLight>(triangleLights.data(), triangleLights.size());
+    }
+
+    void SetLightGroup(int group) { lightGroup = group; }
+
+    PBRT_CPU_GPU
+    SampledSpectrum L(Point3f p, Normal3f n, Point2f uv, Vector3f w,
+                      const SampledWavelengths &lambda) const {
+        if (!twoSided && Dot(n, w) < 0)
+            return SampledSpectrum(0.f);
+        if (image) {
+            // Return _DiffuseMeshLight_ emission using image
+            RGB rgb;
+            Point2f st = uv;
+            st[1] = 1 - st[1];
+            for (int c = 0; c < 3; ++c)
+                rgb[c] = image.BilerpChannel(st, c);
+            return scale *
+                   RGBIlluminantSpectrum(*imageColorSpace, ClampZero(rgb)).Sample(lambda);
+
+        } else
+            return scale * Lemit.Sample(lambda);
+    }
+
+    std::string ToString() const;
+
+  private:
+    friend class TriangleLight;
+    // DiffuseMeshLight Private Members
+    MediumInterface mediumInterface;
+    int lightGroup = -1;
+    bool twoSided;
+    DenselySampledSpectrum Lemit;
+    Float scale;
+    Image image;
+    const RGBColorSpace *imageColorSpace;
+    pstd::vector<TriangleLight> triangleLights;
+};
+
+// TriangleLight Definition
+class TriangleLight {
+  public:
+    // TriangleLight Public Methods
+    TriangleLight(DiffuseMeshLight *meshLight, ShapeHandle shape, Float area,
+                  Float phiBound, const PiecewiseConstant2D *imageDistribution)
+        : meshLight(meshLight),
+          shape(shape),
+          area(area),
+          phiBound(phiBound),
+          imageDistribution(imageDistribution) {}
+
+    PBRT_CPU_GPU
+    LightType Type() const { return LightType::Area; }
+
+    // Light groups are shared by all of a mesh's triangles.
+    PBRT_CPU_GPU
+    int LightGroup() const { return meshLight->lightGroup; }
+    void SetLightGroup(int group) { meshLight->SetLightGroup(group); }
+
+    PBRT_CPU_GPU
+    int Index() const { return index; }
+    void SetIndex(int i) { index = i; }
+
+    void Preprocess(const Bounds3f &sceneBounds) {}
+
+    SampledSpectrum Phi(const SampledWavelengths &lambda) const;
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLeSample> SampleLe(Point2f u1, Point2f u2,
+                                           SampledWavelengths &lambda, Float time) const;
+    PBRT_CPU_GPU
+    void PDF_Le(const Interaction &, Vector3f &w, Float *pdfPos, Float *pdfDir) const;
+
+    PBRT_CPU_GPU
+    void PDF_Le(const Ray &, Float *pdfPos, Float *pdfDir) const {
+        LOG_FATAL("Shouldn't be called for area lights");
+    }
+
+    pstd::optional<LightBounds> Bounds() const;
+
+    std::string ToString() const;
+
+    PBRT_CPU_GPU
+    SampledSpectrum L(Point3f p, Normal3f n, Point2f uv, Vector3f w,
+                      const SampledWavelengths &lambda) const {
+        return meshLight->L(p, n, uv, w, lambda);
+    }
+    PBRT_CPU_GPU
+    SampledSpectrum Le(const Ray &, const SampledWavelengths &) const {
+        return SampledSpectrum(0.f);
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<LightLiSample> SampleLi(LightSampleContext ctx, Point2f u,
+                                           SampledWavelengths lambda,
+                                           LightSamplingMode mode) const;
+
+    PBRT_CPU_GPU
+    Float PDF_Li(LightSampleContext ctx, Vector3f wi, LightSamplingMode) const;
+
+  private:
+    // TriangleLight Private Members
+    DiffuseMeshLight *meshLight;
+    ShapeHandle shape;
+    Float area, phiBound;
+    const PiecewiseConstant2D *imageDistribution;
+    int index = -1;
 };
 
 // UniformInfiniteLight Definition
@@ -579,9 +743,10 @@ class ImageInfiniteLight : public LightBase {
 class PortalImageInfiniteLight : public LightBase {
   public:
     // PortalImageInfiniteLight Public Methods
+    // _portals_ gives the four vertices of each of the light's portals.
     PortalImageInfiniteLight(const Transform &renderFromLight, Image image,
                              const RGBColorSpace *imageColorSpace, Float scale,
-                             const std::string &filename, std::vector<Point3f> portal,
+                             const std::string &filename, std::vector<Point3f> portals,
                              Allocator alloc);
 
     void Preprocess(const Bounds3f &sceneBounds) {
@@ -612,18 +777,37 @@ class PortalImageInfiniteLight : public LightBase {
         LOG_FATAL("Shouldn't be called for non-area lights");
     }
 
-    pstd::optional<LightBounds> Bounds() const { return {}; }
+    // The portals are bounded like one-sided area lights so that light
+    // samplers can account for their positions and orientations.
+    pstd::optional<LightBounds> Bounds() const;
 
     std::string ToString() const;
 
   private:
+    // PortalImageInfiniteLight::Portal Definition
+    struct Portal {
+        std::string ToString() const;
+
+        pstd::array<Point3f, 4> p;
+        Frame frame;
+        // Environment map rectified for _frame_ and its sampling distribution,
+        // which are shared by all portals with the same frame
+        const Image *image;
+        const WindowedPiecewiseConstant2D *distribution;
+    };
+
     // PortalImageInfiniteLight Private Methods
+    void RectifyImage(Portal *portal, const Image &equalAreaImage, uint64_t imageHash,
+                      Allocator alloc) const;
+
     PBRT_CPU_GPU
-    SampledSpectrum ImageLookup(Point2f uv, const SampledWavelengths &lambda) const;
+    SampledSpectrum ImageLookup(const Portal &portal, Point2f uv,
+                                const SampledWavelengths &lambda) const;
 
     PBRT_CPU_GPU
-    pstd::optional<Point2f> ImageFromRender(Vector3f wRender,
-                                            Float *duv_dw = nullptr) const {
+    static pstd::optional<Point2f> ImageFromRender(const Frame &portalFrame,
+                                                   Vector3f wRender,
+                                                   Float *duv_dw = nullptr) {
         Vector3f w = portalFrame.ToLocal(wRender);
         if (w.z <= 0)
             return {};
@@ -639,7 +823,8 @@ class PortalImageInfiniteLight : public LightBase {
     }
 
     PBRT_CPU_GPU
-    Vector3f RenderFromImage(Point2f uv, Float *duv_dw = nullptr) const {
+    static Vector3f RenderFromImage(const Frame &portalFrame, Point2f uv,
+                                    Float *duv_dw = nullptr) {
         Float alpha = -Pi / 2 + uv[0] * Pi, beta = -Pi / 2 + uv[1] * Pi;
         Float x = std::tan(alpha), y = std::tan(beta);
         DCHECK(!IsInf(x) && !IsInf(y));
@@ -653,24 +838,56 @@ class PortalImageInfiniteLight : public LightBase {
     }
 
     PBRT_CPU_GPU
-    pstd::optional<Bounds2f> ImageBounds(const Point3f &p) const {
-        pstd::optional<Point2f> p0 = ImageFromRender(Normalize(portal[0] - p));
-        pstd::optional<Point2f> p1 = ImageFromRender(Normalize(portal[2] - p));
+    static pstd::optional<Bounds2f> ImageBounds(const Portal &portal, const Point3f &p) {
+        pstd::optional<Point2f> p0 =
+            ImageFromRender(portal.frame, Normalize(portal.p[0] - p));
+        pstd::optional<Point2f> p1 =
+            ImageFromRender(portal.frame, Normalize(portal.p[2] - p));
         if (!p0 || !p1)
             return {};
         return Bounds2f(*p0, *p1);
     }
 
     PBRT_CPU_GPU
-    Float Area() const {
-        return Length(portal[1] - portal[0]) * Length(portal[3] - portal[0]);
+    static Float Area(const Portal &portal) {
+        return Length(portal.p[1] - portal.p[0]) * Length(portal.p[3] - portal.p[0]);
+    }
+
+    // Returns the portal's share of the light that arrives at _p_ through
+    // all portals, up to a factor that is the same for all of them.
+    PBRT_CPU_GPU
+    static Float PortalWeight(const Portal &portal, const Point3f &p) {
+        pstd::optional<Bounds2f> b = ImageBounds(portal, p);
+        return b ? portal.distribution->Integral(*b) : 0;
+    }
+
+    // Returns the density of sampling _w_ through _portal_ from _p_ times the
+    // portal's weight.
+    PBRT_CPU_GPU
+    static Float WeightedPDF(const Portal &portal, const Point3f &p, Vector3f w) {
+        Float duv_dw;
+        pstd::optional<Point2f> uv = ImageFromRender(portal.frame, w, &duv_dw);
+        pstd::optional<Bounds2f> b = ImageBounds(portal, p);
+        if (!uv || !b || duv_dw == 0 || !Inside(*uv, *b))
+            return 0;
+        return portal.distribution->PDF(*uv, *b) * portal.distribution->Integral(*b) /
+               duv_dw;
+    }
+
+    // Returns the density of sampling the direction _w_ from the portal's
+    // entire image.
+    PBRT_CPU_GPU
+    static Float DirectionPDF(const Portal &portal, Vector3f w) {
+        Float duv_dw;
+        pstd::optional<Point2f> uv = ImageFromRender(portal.frame, w, &duv_dw);
+        if (!uv || duv_dw == 0)
+            return 0;
+        Bounds2f b(Point2f(0, 0), Point2f(1, 1));
+        return portal.distribution->PDF(*uv, b) / duv_dw;
     }
 
     // PortalImageInfiniteLight Private Members
-    pstd::array<Point3f, 4> portal;
-    Frame portalFrame;
-    Image image;
-    WindowedPiecewiseConstant2D distribution;
+    pstd::vector<Portal> portals;
     const RGBColorSpace *imageColorSpace;
     Float scale;
     Float sceneRadius;
@@ -769,6 +986,16 @@ inline LightType LightHandle::Type() const {
     return Dispatch(t);
 }
 
+inline int LightHandle::LightGroup() const {
+    auto group = [&](auto ptr) { return ptr->LightGroup(); };
+    return Dispatch(group);
+}
+
+inline int LightHandle::Index() const {
+    auto index = [&](auto ptr) { return ptr->Index(); };
+    return Dispatch(index);
+}
+
 }  // namespace pbrt
 
 #endif  // PBRT_LIGHTS_H
@@ -173,6 +173,140 @@ TEST(ProjectionLight, Sampling) {
     }
 }
 
+TEST(PortalImageInfiniteLight, MultiplePortals) {
+    // Two windows in the $z=1$ plane, seen from the origin
+    std::vector<Point3f> portals = {
+        Point3f(-1, -.5, 1), Point3f(-1, .5, 1),  Point3f(-.2, .5, 1),
+        Point3f(-.2, -.5, 1), Point3f(.2, -.5, 1), Point3f(.2, .5, 1),
+        Point3f(1, .5, 1),    Point3f(1, -.5, 1)};
+    PortalImageInfiniteLight light(Transform(), MakeLightImage({256, 256}),
+                                   RGBColorSpace::sRGB, 1 /* scale */, "test", portals,
+                                   Allocator());
+    light.Preprocess(Bounds3f(Point3f(-2, -2, -2), Point3f(2, 2, 2)));
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5);
+    LightSampleContext ctx(Point3fi(Point3f(0, 0, 0)), Normal3f(0, 0, 1),
+                           Normal3f(0, 0, 1));
+
+    // Light samples should pass through a portal and have consistent PDFs,
+    // except for a few that are at the edges of image pixels
+    int nSamples = 256 * 1024, nMismatched = 0;
+    double sampled = 0;
+    for (Point2f u : Hammersley2D(nSamples)) {
+        pstd::optional<LightLiSample> ls =
+            light.SampleLi(ctx, u, lambda, LightSamplingMode::WithMIS);
+        if (!ls)
+            continue;
+        EXPECT_GT(ls->wi.z, 0);
+        Float pdf = light.PDF_Li(ctx, ls->wi, LightSamplingMode::WithMIS);
+        if (std::abs(pdf / ls->pdf - 1) > 1e-3)
+            ++nMismatched;
+        sampled += ls->L[0] / ls->pdf;
+    }
+    sampled /= nSamples;
+    EXPECT_LT(nMismatched, nSamples / 1000);
+
+    // Compare to the radiance through the portals with uniform sampling
+    double uniform = 0;
+    for (Point2f u : Hammersley2D(nSamples)) {
+        Vector3f w = SampleUniformSphere(u);
+        uniform += light.Le(Ray(Point3f(0, 0, 0), w), lambda)[0];
+    }
+    uniform /= nSamples * UniformSpherePDF();
+
+    EXPECT_GT(sampled, 0);
+    EXPECT_NEAR(1, sampled / uniform, .02)
+        << "sampled: " << sampled << ", uniform: " << uniform;
+}
+
+TEST(DiffuseMeshLight, MatchesDiffuseAreaLights) {
+    Transform id;
+    std::vector<int> indices{0, 1, 2, 0, 2, 3};
+    std::vector<Point3f> p{Point3f(0, 0, 0), Point3f(2, 0, 0), Point3f(2, 1, 0),
+                           Point3f(0, 1, 0.5)};
+    TriangleMesh mesh(id, false /* rev orientation */, indices, p, {}, {}, {}, {});
+    pstd::vector<ShapeHandle> tris = Triangle::CreateTriangles(&mesh, Allocator());
+    ASSERT_EQ(2, tris.size());
+
+    ConstantSpectrum Le(2.f);
+    DiffuseMeshLight meshLight(MediumInterface(), &Le, 1.5f, tris, Image(), nullptr,
+                               true /* two sided */, Allocator());
+    pstd::span<TriangleLight> triLights = meshLight.TriangleLights();
+    ASSERT_EQ(2, triLights.size());
+
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5);
+    for (size_t i = 0; i < tris.size(); ++i) {
+        DiffuseAreaLight areaLight(id, MediumInterface(), &Le, 1.5f, tris[i], Image(),
+                                   nullptr, true /* two sided */, Allocator());
+        LightHandle a = &areaLight, t = &triLights[i];
+
+        EXPECT_EQ(LightType::Area, t.Type());
+        EXPECT_FLOAT_EQ(a.Phi(lambda)[0], t.Phi(lambda)[0]);
+        pstd::optional<LightBounds> ab = a.Bounds(), tb = t.Bounds();
+        ASSERT_TRUE(ab.has_value() && tb.has_value());
+        EXPECT_EQ(ab->bounds, tb->bounds);
+        EXPECT_FLOAT_EQ(ab->phi, tb->phi);
+
+        LightSampleContext ctx(Point3fi(Point3f(0.5, 0.5, 1)), Normal3f(0, 0, -1),
+                               Normal3f(0, 0, -1));
+        for (Point2f u : Hammersley2D(64)) {
+            pstd::optional<LightLiSample> as = a.SampleLi(ctx, u, lambda);
+            pstd::optional<LightLiSample> ts = t.SampleLi(ctx, u, lambda);
+            ASSERT_EQ(as.has_value(), ts.has_value());
+            if (!as)
+                continue;
+            EXPECT_EQ(as->wi, ts->wi);
+            EXPECT_FLOAT_EQ(as->pdf, ts->pdf);
+            EXPECT_FLOAT_EQ(as->L[0], ts->L[0]);
+            EXPECT_FLOAT_EQ(a.PDF_Li(ctx, as->wi), t.PDF_Li(ctx, ts->wi));
+        }
+    }
+}
+
+TEST(DiffuseAreaLight, ImageTriangleSampling) {
+    Transform id;
+    TriangleMesh mesh(id, false /* rev orientation */, {0, 1, 2},
+                      {Point3f(0, 0, 0), Point3f(1, 0, 0), Point3f(1, 1, 0)}, {}, {},
+                      {Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)}, {});
+    pstd::vector<ShapeHandle> tris = Triangle::CreateTriangles(&mesh, Allocator());
+    Image image = MakeLightImage({64, 64});
+    DiffuseAreaLight areaLight(id, MediumInterface(), nullptr, 1.f, tris[0], image,
+                               RGBColorSpace::sRGB, true /* two sided */, Allocator());
+    LightHandle light = &areaLight;
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5);
+
+    // The PDFs of sampled points should match the returned ones
+    LightSampleContext ctx(Point3fi(Point3f(0.2, 0.6, 1)), Normal3f(0, 0, -1),
+                           Normal3f(0, 0, -1));
+    int nZero = 0, n = 4096;
+    for (Point2f u : Hammersley2D(n)) {
+        pstd::optional<LightLiSample> ls = light.SampleLi(ctx, u, lambda);
+        if (!ls) {
+            ++nZero;
+            continue;
+        }
+        EXPECT_LT(std::abs(light.PDF_Li(ctx, ls->wi) - ls->pdf), 1e-3 * ls->pdf);
+    }
+    // Most of the image is black, but few samples should be wasted there
+    EXPECT_LT(nZero, n / 20);
+
+    // Estimate the light's power by sampling emitted rays
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        Point2f u1(RadicalInverse(0, i), RadicalInverse(1, i));
+        Point2f u2(RadicalInverse(2, i), RadicalInverse(3, i));
+        pstd::optional<LightLeSample> les = light.SampleLe(u1, u2, lambda, 0);
+        ASSERT_TRUE(les.has_value());
+        Vector3f w = les->ray.d;
+        Float pdfPos, pdfDir;
+        light.PDF_Le(*les->intr, w, &pdfPos, &pdfDir);
+        EXPECT_LT(std::abs(pdfPos - les->pdfPos), 1e-3 * les->pdfPos);
+        if (les->pdfPos > 0)
+            sum += les->L[0] * AbsDot(les->ray.d, les->intr->n) /
+                   (les->pdfPos * les->pdfDir);
+    }
+    EXPECT_LT(std::abs(sum / n - light.Phi(lambda)[0]), 0.02 * light.Phi(lambda)[0]);
+}
+
 TEST(LightBounds, Basics) {
     LightBounds bounds(Bounds3f(Point3f(0, 0, 0), Point3f(.1, .1, .01)),
                        Vector3f(0, 0, 1), 1.f /* phi */, std::cos(0.f) /* theta_o: normal spread */,
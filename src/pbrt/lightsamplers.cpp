@@ -12,9 +12,11 @@
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
 
 #include <atomic>
 #include <cstdint>
@@ -55,6 +57,8 @@ LightSamplerHandle LightSamplerHandle::Create(const std::string &name,
         return alloc.new_object<BVHLightSampler>(lights, alloc);
     else if (name == "exhaustive")
         return alloc.new_object<ExhaustiveLightSampler>(lights, alloc);
+    else if (name == "spatial")
+        return alloc.new_object<SpatialLightSampler>(lights, alloc);
     else {
         Error(R"(Light sample distribution type "%s" unknown. Using "bvh".)",
               name.c_str());
@@ -76,14 +80,9 @@ std::string LightSamplerHandle::ToString() const {
 // PowerLightSampler Method Definitions
 PowerLightSampler::PowerLightSampler(pstd::span<const LightHandle> lights,
                                      Allocator alloc)
-    : lightToIndex(alloc),
-      lights(lights.begin(), lights.end(), alloc),
-      aliasTable(alloc) {
+    : lights(lights.begin(), lights.end(), alloc), lightPDF(alloc), aliasTable(alloc) {
     if (lights.empty())
         return;
-    // Initialize _lightToIndex_ hash table
-    for (size_t i = 0; i < lights.size(); ++i)
-        lightToIndex.Insert(lights[i], i);
 
     // Compute lights' power and initialize alias table
     std::vector<Float> lightPower;
@@ -95,6 +94,11 @@ PowerLightSampler::PowerLightSampler(pstd::span<const LightHandle> lights,
     if (std::accumulate(lightPower.begin(), lightPower.end(), 0.f) == 0.f)
         std::fill(lightPower.begin(), lightPower.end(), 1.f);
     aliasTable = AliasTable(lightPower, alloc);
+
+    // Initialize _lightPDF_ array
+    lightPDF.resize(LightIndexCount(lights));
+    for (size_t i = 0; i < lights.size(); ++i)
+        lightPDF[lights[i].Index()] = aliasTable.PDF(i);
 }
 
 std::string PowerLightSampler::ToString() const {
@@ -107,88 +111,177 @@ std::string PowerLightSampler::ToString() const {
 STAT_MEMORY_COUNTER("Memory/Light BVH", lightBVHBytes);
 STAT_INT_DISTRIBUTION("Integrator/Lights sampled per lookup", nLightsSampled);
 
+// Light BVH Construction Helper Functions
+// As with the geometry BVH, ranges of more than _parallelBuildThreshold_
+// lights compute their bounds and SAH buckets using multiple threads, and
+// subtrees with more than _parallelSubtreeThreshold_ lights are built in
+// parallel.
+static constexpr int parallelBuildThreshold = 64 * 1024;
+static constexpr int parallelSubtreeThreshold = 16 * 1024;
+static constexpr int nLightBVHBuckets = 12;
+
+// Returns the starting index of each of the blocks of lights in
+// _[start, end)_ that are processed in parallel, followed by _end_.
+static std::vector<int> LightBlockStarts(int start, int end) {
+    int64_t n = end - start;
+    int nBlocks = Clamp(n / (parallelBuildThreshold / 4), 1, 8 * RunningThreads());
+    std::vector<int> blockStarts(nBlocks + 1);
+    for (int b = 0; b <= nBlocks; ++b)
+        blockStarts[b] = start + n * b / nBlocks;
+    return blockStarts;
+}
+
+static void ComputeLightBounds(const std::vector<std::pair<int, LightBounds>> &bvhLights,
+                               int start, int end, Bounds3f *bounds,
+                               Bounds3f *centroidBounds) {
+    if (end - start <= parallelBuildThreshold) {
+        for (int i = start; i < end; ++i) {
+            const LightBounds &lb = bvhLights[i].second;
+            *bounds = Union(*bounds, lb.bounds);
+            *centroidBounds = Union(*centroidBounds, lb.Centroid());
+        }
+        return;
+    }
+    // Compute bounds of blocks of lights in parallel and merge them
+    std::vector<int> blockStarts = LightBlockStarts(start, end);
+    int nBlocks = blockStarts.size() - 1;
+    std::vector<Bounds3f> blockBounds(nBlocks), blockCentroidBounds(nBlocks);
+    ParallelFor(0, nBlocks, [&](int64_t b) {
+        ComputeLightBounds(bvhLights, blockStarts[b], blockStarts[b + 1],
+                           &blockBounds[b], &blockCentroidBounds[b]);
+    });
+    for (int b = 0; b < nBlocks; ++b) {
+        *bounds = Union(*bounds, blockBounds[b]);
+        *centroidBounds = Union(*centroidBounds, blockCentroidBounds[b]);
+    }
+}
+
+// Returns the SAH bucket along each axis of a light with the given centroid.
+static int LightBucket(const Bounds3f &centroidBounds, Point3f pc, int dim) {
+    int b = nLightBVHBuckets * centroidBounds.Offset(pc)[dim];
+    if (b == nLightBVHBuckets)
+        b = nLightBVHBuckets - 1;
+    DCHECK_GE(b, 0);
+    DCHECK_LT(b, nLightBVHBuckets);
+    return b;
+}
+
+// Accumulates the _LightBounds_ of the lights in _[start, end)_ into
+// _buckets_, which holds _nLightBVHBuckets_ buckets for each of the three axes.
+static void ComputeLightBuckets(const std::vector<std::pair<int, LightBounds>> &bvhLights,
+                                int start, int end, const Bounds3f &centroidBounds,
+                                LightBounds *buckets) {
+    if (end - start <= parallelBuildThreshold) {
+        for (int i = start; i < end; ++i) {
+            const LightBounds &lb = bvhLights[i].second;
+            Point3f pc = lb.Centroid();
+            for (int dim = 0; dim < 3; ++dim) {
+                if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
+                    continue;
+                int b = dim * nLightBVHBuckets + LightBucket(centroidBounds, pc, dim);
+                buckets[b] = Union(buckets[b], lb);
+            }
+        }
+        return;
+    }
+    // Fill buckets for blocks of lights in parallel and merge them
+    std::vector<int> blockStarts = LightBlockStarts(start, end);
+    int nBlocks = blockStarts.size() - 1;
+    constexpr int nBuckets = 3 * nLightBVHBuckets;
+    std::vector<LightBounds> blockBuckets(nBlocks * nBuckets);
+    ParallelFor(0, nBlocks, [&](int64_t b) {
+        ComputeLightBuckets(bvhLights, blockStarts[b], blockStarts[b + 1],
+                            centroidBounds, &blockBuckets[b * nBuckets]);
+    });
+    for (int b = 0; b < nBlocks; ++b)
+        for (int i = 0; i < nBuckets; ++i)
+            buckets[i] = Union(buckets[i], blockBuckets[b * nBuckets + i]);
+}
+
 // BVHLightSampler Method Definitions
 BVHLightSampler::BVHLightSampler(pstd::span<const LightHandle> lights, Allocator alloc)
     : lights(lights.begin(), lights.end(), alloc),
       infiniteLights(alloc),
       nodes(alloc),
       lightToBitTrail(alloc) {
+    lightToBitTrail.resize(LightIndexCount(lights));
+    std::fill(lightToBitTrail.begin(), lightToBitTrail.end(), NoBitTrail);
+
     // Initialize _infiniteLights_ array and light BVH
+    // Compute lights' bounds in parallel
+    std::vector<pstd::optional<LightBounds>> lightBounds(lights.size());
+    ParallelFor(0, lights.size(),
+                [&](int64_t i) { lightBounds[i] = lights[i].Bounds(); });
+
     std::vector<std::pair<int, LightBounds>> bvhLights;
     for (size_t i = 0; i < lights.size(); ++i) {
         // Partition $i$th light into _infiniteLights_ or _bvhLights_
         LightHandle light = lights[i];
-        pstd::optional<LightBounds> lightBounds = light.Bounds();
-        if (!lightBounds)
+        if (!lightBounds[i])
             infiniteLights.push_back(light);
-        else if (lightBounds->phi > 0) {
-            bvhLights.push_back(std::make_pair(i, *lightBounds));
-            allLightBounds = Union(allLightBounds, lightBounds->bounds);
+        else if (lightBounds[i]->phi > 0) {
+            bvhLights.push_back(std::make_pair(i, *lightBounds[i]));
+            allLightBounds = Union(allLightBounds, lightBounds[i]->bounds);
         }
     }
-    if (!bvhLights.empty())
-        buildBVH(bvhLights, 0, bvhLights.size(), 0, 0, alloc);
+    if (!bvhLights.empty()) {
+        // A binary tree with $n$ leaves has $2n-1$ nodes; allocate them all
+        // up front so that subtrees can be built in parallel.
+        nodes.resize(2 * bvhLights.size() - 1);
+        buildBVH(bvhLights, 0, bvhLights.size(), 0, 0, 0);
+    }
     lightBVHBytes += nodes.size() * sizeof(LightBVHNode);
 }
 
-std::pair<int, LightBounds> BVHLightSampler::buildBVH(
-    std::vector<std::pair<int, LightBounds>> &bvhLights, int start, int end,
-    uint32_t bitTrail, int depth, Allocator alloc) {
+LightBounds BVHLightSampler::buildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights,
+                                      int start, int end, uint32_t bitTrail, int depth,
+                                      int nodeIndex) {
     CHECK_LT(start, end);
     // Initialize leaf node if only a single light remains
     if (end - start == 1) {
-        int nodeIndex = nodes.size();
         CompactLightBounds cb(bvhLights[start].second, allLightBounds);
         int lightIndex = bvhLights[start].first;
-        nodes.push_back(LightBVHNode::MakeLeaf(lightIndex, cb));
-        lightToBitTrail.Insert(lights[lightIndex], bitTrail);
-        return {nodeIndex, bvhLights[start].second};
+        nodes[nodeIndex] = LightBVHNode::MakeLeaf(lightIndex, cb);
+        CHECK_NE(bitTrail, NoBitTrail);
+        lightToBitTrail[lights[lightIndex].Index()] = bitTrail;
+        return bvhLights[start].second;
     }
 
     // Choose split dimension and position using modified SAH
     // Compute bounds and centroid bounds for lights
     Bounds3f bounds, centroidBounds;
-    for (int i = start; i < end; ++i) {
-        const LightBounds &lb = bvhLights[i].second;
-        bounds = Union(bounds, lb.bounds);
-        centroidBounds = Union(centroidBounds, lb.Centroid());
-    }
+    ComputeLightBounds(bvhLights, start, end, &bounds, &centroidBounds);
+
+    // Compute _LightBounds_ for each bucket along each dimension
+    LightBounds bucketLightBounds[3 * nLightBVHBuckets];
+    ComputeLightBuckets(bvhLights, start, end, centroidBounds, bucketLightBounds);
 
     Float minCost = Infinity;
     int minCostSplitBucket = -1, minCostSplitDim = -1;
-    constexpr int nBuckets = 12;
     for (int dim = 0; dim < 3; ++dim) {
         // Compute minimum cost bucket for splitting along dimension _dim_
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim])
             continue;
-        // Compute _LightBounds_ for each bucket
-        LightBounds bucketLightBounds[nBuckets];
-        for (int i = start; i < end; ++i) {
-            Point3f pc = bvhLights[i].second.Centroid();
-            int b = nBuckets * centroidBounds.Offset(pc)[dim];
-            if (b == nBuckets)
-                b = nBuckets - 1;
-            CHECK_GE(b, 0);
-            CHECK_LT(b, nBuckets);
-            bucketLightBounds[b] = Union(bucketLightBounds[b], bvhLights[i].second);
-        }
+        const LightBounds *buckets = &bucketLightBounds[dim * nLightBVHBuckets];
 
         // Compute costs for splitting lights after each bucket
-        Float cost[nBuckets - 1];
-        for (int i = 0; i < nBuckets - 1; ++i) {
-            // Find _LightBounds_ for lights below and above bucket split
-            LightBounds b0, b1;
-            for (int j = 0; j <= i; ++j)
-                b0 = Union(b0, bucketLightBounds[j]);
-            for (int j = i + 1; j < nBuckets; ++j)
-                b1 = Union(b1, bucketLightBounds[j]);
-
-            // Compute final light split cost for bucket
-            cost[i] = EvaluateCost(b0, bounds, dim) + EvaluateCost(b1, bounds, dim);
+        // Find _LightBounds_ for lights above each bucket split
+        LightBounds above[nLightBVHBuckets - 1];
+        above[nLightBVHBuckets - 2] = buckets[nLightBVHBuckets - 1];
+        for (int i = nLightBVHBuckets - 3; i >= 0; --i)
+            above[i] = Union(buckets[i + 1], above[i + 1]);
+
+        // Sweep over splits, accumulating _LightBounds_ below the split
+        Float cost[nLightBVHBuckets - 1];
+        LightBounds below;
+        for (int i = 0; i < nLightBVHBuckets - 1; ++i) {
+            below = Union(below, buckets[i]);
+            cost[i] =
+                EvaluateCost(below, bounds, dim) + EvaluateCost(above[i], bounds, dim);
         }
 
         // Find light split that minimizes SAH metric
-        for (int i = 1; i < nBuckets - 1; ++i) {
+        for (int i = 1; i < nLightBVHBuckets - 1; ++i) {
             if (cost[i] > 0 && cost[i] < minCost) {
                 minCost = cost[i];
                 minCostSplitBucket = i;
@@ -205,13 +298,8 @@ std::pair<int, LightBounds> BVHLightSampler::buildBVH(
         const auto *pmid = std::partition(
             &bvhLights[start], &bvhLights[end - 1] + 1,
             [=](const std::pair<int, LightBounds> &l) {
-                int b = nBuckets *
-                        centroidBounds.Offset(l.second.Centroid())[minCostSplitDim];
-                if (b == nBuckets)
-                    b = nBuckets - 1;
-                CHECK_GE(b, 0);
-                CHECK_LT(b, nBuckets);
-                return b <= minCostSplitBucket;
+                return LightBucket(centroidBounds, l.second.Centroid(),
+                                   minCostSplitDim) <= minCostSplitBucket;
             });
         mid = pmid - &bvhLights[0];
         if (mid == start || mid == end)
@@ -219,21 +307,29 @@ std::pair<int, LightBounds> BVHLightSampler::buildBVH(
         CHECK(mid > start && mid < end);
     }
 
-    // Allocate interior _LightBVHNode_ and recursively initialize children
-    int nodeIndex = nodes.size();
-    nodes.push_back(LightBVHNode());
-    CHECK_LT(depth, 64);
-    std::pair<int, LightBounds> child0 =
-        buildBVH(bvhLights, start, mid, bitTrail, depth + 1, alloc);
-    CHECK_EQ(nodeIndex + 1, child0.first);
-    std::pair<int, LightBounds> child1 =
-        buildBVH(bvhLights, mid, end, bitTrail | (1u << depth), depth + 1, alloc);
-
-    // Initialize interior node and return node index and bounds
-    LightBounds lb = Union(child0.second, child1.second);
+    // Recursively initialize children of interior _LightBVHNode_
+    // The first child's subtree immediately follows this node and has
+    // $2(\roman{mid}-\roman{start})-1$ nodes.
+    CHECK_LT(depth, 32);
+    int childIndex[2] = {nodeIndex + 1, nodeIndex + 2 * (mid - start)};
+    LightBounds childBounds[2];
+    auto buildChild = [&](int i) {
+        childBounds[i] =
+            buildBVH(bvhLights, i == 0 ? start : mid, i == 0 ? mid : end,
+                     bitTrail | (uint32_t(i) << depth), depth + 1, childIndex[i]);
+    };
+    if (end - start > parallelSubtreeThreshold)
+        ParallelFor(0, 2, [&](int64_t i) { buildChild(i); });
+    else {
+        buildChild(0);
+        buildChild(1);
+    }
+
+    // Initialize interior node and return its bounds
+    LightBounds lb = Union(childBounds[0], childBounds[1]);
     CompactLightBounds cb(lb, allLightBounds);
-    nodes[nodeIndex] = LightBVHNode::MakeInterior(child1.first, cb);
-    return {nodeIndex, lb};
+    nodes[nodeIndex] = LightBVHNode::MakeInterior(childIndex[1], cb);
+    return lb;
 }
 
 std::string BVHLightSampler::ToString() const {
@@ -254,9 +350,11 @@ ExhaustiveLightSampler::ExhaustiveLightSampler(pstd::span<const LightHandle> lig
       infiniteLights(alloc),
       lightBounds(alloc),
       lightToBoundedIndex(alloc) {
+    lightToBoundedIndex.resize(LightIndexCount(lights));
+    std::fill(lightToBoundedIndex.begin(), lightToBoundedIndex.end(), -1);
     for (const auto &light : lights) {
         if (pstd::optional<LightBounds> lb = light.Bounds(); lb) {
-            lightToBoundedIndex.Insert(light, boundedLights.size());
+            lightToBoundedIndex[light.Index()] = boundedLights.size();
             lightBounds.push_back(*lb);
             boundedLights.push_back(light);
         } else
@@ -294,7 +392,9 @@ pstd::optional<SampledLight> ExhaustiveLightSampler::Sample(const LightSampleCon
 
 Float ExhaustiveLightSampler::PDF(const LightSampleContext &ctx,
                                   LightHandle light) const {
-    if (!lightToBoundedIndex.HasKey(light))
+    int index = light.Index();
+    if (index < 0 || index >= int(lightToBoundedIndex.size()) ||
+        lightToBoundedIndex[index] == -1)
         return 1.f / (infiniteLights.size() + (!lightBounds.empty() ? 1 : 0));
 
     Float importanceSum = 0;
@@ -315,4 +415,111 @@ std::string ExhaustiveLightSampler::ToString() const {
     return StringPrintf("[ ExhaustiveLightSampler lightBounds: %s]", lightBounds);
 }
 
+///////////////////////////////////////////////////////////////////////////
+// SpatialLightSampler
+
+STAT_MEMORY_COUNTER("Memory/Spatial light sampler", spatialLightSamplerBytes);
+STAT_COUNTER("Integrator/Spatial light sampler samples dropped", nDroppedLightSamples);
+
+// The grid's cells are $1/64$ of the extent of the lights' bounds along their
+// longest axis; they are hashed into a fixed number of entries.
+static constexpr int SpatialGridResolution = 64;
+static constexpr int SpatialHashCells = 64 * 1024;
+// Lights that have contributed nothing to this many samples in a cell give
+// up their slot there so that other lights can use it.
+static constexpr int MinLightSlotSamples = 16;
+
+// SpatialLightSampler::CellAccumulator Definition
+struct SpatialLightSampler::CellAccumulator {
+    struct Slot {
+        // _LightHandle::Index()_ of the slot's light, or -1 if unused
+        std::atomic<int> lightIndex{-1};
+        AtomicFloat contribution;
+        std::atomic<int> count{0};
+    };
+    Slot slots[LightsPerCell];
+};
+
+// SpatialLightSampler Method Definitions
+SpatialLightSampler::SpatialLightSampler(pstd::span<const LightHandle> lights,
+                                         Allocator alloc)
+    : bvhSampler(lights, alloc), lightsByIndex(alloc), cellDistributions(alloc) {
+    lightsByIndex.resize(LightIndexCount(lights));
+    for (LightHandle light : lights)
+        lightsByIndex[light.Index()] = light;
+
+    // Initialize spatial hash grid over the bounds of the lights
+    // There's nothing to learn if there are only infinite lights or if all
+    // lights are at a single point.
+    const Bounds3f &bounds = bvhSampler.Bounds();
+    if (bounds.IsDegenerate() || MaxComponentValue(bounds.Diagonal()) == 0)
+        return;
+    gridOrigin = bounds.pMin;
+    invCellSize = SpatialGridResolution / MaxComponentValue(bounds.Diagonal());
+    cellDistributions.resize(SpatialHashCells);
+    cellAccumulators = alloc.allocate_object<CellAccumulator>(SpatialHashCells);
+    for (int i = 0; i < SpatialHashCells; ++i)
+        alloc.construct(&cellAccumulators[i]);
+    spatialLightSamplerBytes +=
+        SpatialHashCells * (sizeof(CellDistribution) + sizeof(CellAccumulator));
+}
+
+void SpatialLightSampler::Record(Point3f p, LightHandle light, Float contribution) {
+    int cellIndex = CellIndex(p);
+    if (cellIndex == -1 || IsNaN(contribution) || IsInf(contribution))
+        return;
+    int lightIndex = light.Index();
+    DCHECK(lightIndex >= 0 && lightIndex < int(lightsByIndex.size()));
+
+    // Add contribution to the light's slot, claiming an unused one if needed
+    for (CellAccumulator::Slot &slot : cellAccumulators[cellIndex].slots) {
+        int slotLightIndex = slot.lightIndex.load(std::memory_order_relaxed);
+        if (slotLightIndex == -1 &&
+            slot.lightIndex.compare_exchange_strong(slotLightIndex, lightIndex))
+            slotLightIndex = lightIndex;
+        if (slotLightIndex == lightIndex) {
+            slot.contribution.Add(contribution);
+            ++slot.count;
+            return;
+        }
+    }
+    // All of the cell's slots are used by other lights
+    ++nDroppedLightSamples;
+}
+
+void SpatialLightSampler::Update() {
+    ParallelFor(0, cellDistributions.size(), [&](int64_t i) {
+        // Set cell's distribution proportional to its lights' mean contributions
+        CellDistribution &dist = cellDistributions[i];
+        dist.nLights = 0;
+        Float sum = 0;
+        for (CellAccumulator::Slot &slot : cellAccumulators[i].slots) {
+            int lightIndex = slot.lightIndex, count = slot.count;
+            if (lightIndex == -1 || count == 0)
+                continue;
+            Float mean = slot.contribution / count;
+            if (mean == 0) {
+                // Free the slot if its light hasn't contributed in many samples
+                if (count >= MinLightSlotSamples) {
+                    slot.lightIndex = -1;
+                    slot.contribution = 0;
+                    slot.count = 0;
+                }
+                continue;
+            }
+            dist.lights[dist.nLights] = lightsByIndex[lightIndex];
+            dist.pmf[dist.nLights++] = mean;
+            sum += mean;
+        }
+        for (int j = 0; j < dist.nLights; ++j)
+            dist.pmf[j] /= sum;
+    });
+}
+
+std::string SpatialLightSampler::ToString() const {
+    return StringPrintf("[ SpatialLightSampler bvhSampler: %s gridOrigin: %s "
+                        "invCellSize: %f nCells: %d ]",
+                        bvhSampler, gridOrigin, invCellSize, cellDistributions.size());
+}
+
 }  // namespace pbrt
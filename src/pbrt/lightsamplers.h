@@ -83,9 +83,10 @@ class PowerLightSampler {
 
     PBRT_CPU_GPU
     Float PDF(LightHandle light) const {
-        if (!aliasTable.size())
+        int index = light.Index();
+        if (index < 0 || index >= int(lightPDF.size()))
             return 0;
-        return aliasTable.PDF(lightToIndex[light]);
+        return lightPDF[index];
     }
 
     PBRT_CPU_GPU
@@ -103,7 +104,8 @@ class PowerLightSampler {
   private:
     // PowerLightSampler Private Members
     pstd::vector<LightHandle> lights;
-    HashMap<LightHandle, size_t, LightHandleHash> lightToIndex;
+    // Lights' sampling probabilities, indexed by _LightHandle::Index()_
+    pstd::vector<Float> lightPDF;
     AliasTable aliasTable;
 };
 
@@ -331,11 +333,13 @@ class BVHLightSampler {
     PBRT_CPU_GPU
     Float PDF(const LightSampleContext &ctx, LightHandle light) const {
         // Handle infinite _light_ PDF computation
-        if (!lightToBitTrail.HasKey(light))
+        int index = light.Index();
+        if (index < 0 || index >= int(lightToBitTrail.size()) ||
+            lightToBitTrail[index] == NoBitTrail)
             return 1.f / (infiniteLights.size() + (!nodes.empty() ? 1 : 0));
 
         // Initialize local variables for BVH traversal for PDF computation
-        uint32_t bitTrail = lightToBitTrail[light];
+        uint32_t bitTrail = lightToBitTrail[index];
         Point3f p = ctx.p();
         Normal3f n = ctx.ns;
         Float pdf = 1;
@@ -384,13 +388,18 @@ class BVHLightSampler {
         return 1.f / lights.size();
     }
 
+    // Returns the bounds of the lights in the BVH.
+    PBRT_CPU_GPU
+    const Bounds3f &Bounds() const { return allLightBounds; }
+
     std::string ToString() const;
 
   private:
     // BVHLightSampler Private Methods
-    std::pair<int, LightBounds> buildBVH(
-        std::vector<std::pair<int, LightBounds>> &bvhLights, int start, int end,
-        uint32_t bitTrail, int depth, Allocator alloc);
+    // Builds the subtree for _bvhLights[start, end)_ rooted at
+    // _nodes[nodeIndex]_ and returns its bounds.
+    LightBounds buildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights, int start,
+                         int end, uint32_t bitTrail, int depth, int nodeIndex);
 
     Float EvaluateCost(const LightBounds &b, const Bounds3f &bounds, int dim) const {
         // Evaluate direction bounds measure for _LightBounds_
@@ -412,7 +421,10 @@ class BVHLightSampler {
     pstd::vector<LightHandle> infiniteLights;
     Bounds3f allLightBounds;
     pstd::vector<LightBVHNode> nodes;
-    HashMap<LightHandle, uint32_t, LightHandleHash> lightToBitTrail;
+    // Bit trails of the lights in the BVH, indexed by _LightHandle::Index()_;
+    // other lights have _NoBitTrail_.
+    static constexpr uint32_t NoBitTrail = ~uint32_t(0);
+    pstd::vector<uint32_t> lightToBitTrail;
 };
 
 // ExhaustiveLightSampler Definition
@@ -447,7 +459,122 @@ class ExhaustiveLightSampler {
   private:
     pstd::vector<LightHandle> lights, boundedLights, infiniteLights;
     pstd::vector<LightBounds> lightBounds;
-    HashMap<LightHandle, size_t, LightHandleHash> lightToBoundedIndex;
+    // Indices into _boundedLights_, indexed by _LightHandle::Index()_, or -1
+    pstd::vector<int> lightToBoundedIndex;
+};
+
+// SpatialLightSampler Definition
+// Learns how much each light contributes to points in the cells of a
+// spatial hash grid, including the effect of visibility, from the light
+// samples that integrators report with Record(). Lights are sampled from a
+// mix of the learned distribution for the point's cell and a
+// _BVHLightSampler_, which keeps sampling robust and handles cells that
+// haven't learned anything yet. The learned distributions only change in
+// Update(), which must not run concurrently with sampling.
+class SpatialLightSampler {
+  public:
+    // SpatialLightSampler Public Methods
+    SpatialLightSampler(pstd::span<const LightHandle> lights, Allocator alloc);
+
+    PBRT_CPU_GPU
+    pstd::optional<SampledLight> Sample(const LightSampleContext &ctx, Float u) const {
+        const CellDistribution *cell = LookupCell(ctx.p());
+        if (!cell)
+            return bvhSampler.Sample(ctx, u);
+
+        if (u < BVHFraction) {
+            // Sample light using _bvhSampler_
+            u = std::min<Float>(u / BVHFraction, OneMinusEpsilon);
+            pstd::optional<SampledLight> sl = bvhSampler.Sample(ctx, u);
+            if (!sl)
+                return {};
+            return SampledLight{sl->light, BVHFraction * sl->pdf +
+                                               (1 - BVHFraction) * cell->PMF(sl->light)};
+        } else {
+            // Sample light using the cell's learned distribution
+            u = std::min<Float>((u - BVHFraction) / (1 - BVHFraction), OneMinusEpsilon);
+            int slot = 0;
+            while (slot < cell->nLights - 1 && u >= cell->pmf[slot])
+                u -= cell->pmf[slot++];
+            LightHandle light = cell->lights[slot];
+            return SampledLight{light, BVHFraction * bvhSampler.PDF(ctx, light) +
+                                           (1 - BVHFraction) * cell->pmf[slot]};
+        }
+    }
+
+    PBRT_CPU_GPU
+    Float PDF(const LightSampleContext &ctx, LightHandle light) const {
+        const CellDistribution *cell = LookupCell(ctx.p());
+        if (!cell)
+            return bvhSampler.PDF(ctx, light);
+        return BVHFraction * bvhSampler.PDF(ctx, light) +
+               (1 - BVHFraction) * cell->PMF(light);
+    }
+
+    PBRT_CPU_GPU
+    pstd::optional<SampledLight> Sample(Float u) const { return bvhSampler.Sample(u); }
+
+    PBRT_CPU_GPU
+    Float PDF(LightHandle light) const { return bvhSampler.PDF(light); }
+
+    // Records the contribution of a sample of _light_ at the point _p_; it
+    // should be zero if the light was occluded. It may be called
+    // concurrently from multiple threads.
+    void Record(Point3f p, LightHandle light, Float contribution);
+    // Rebuilds the cells' distributions from the contributions recorded so far.
+    void Update();
+
+    std::string ToString() const;
+
+  private:
+    // SpatialLightSampler Private Types
+    static constexpr int LightsPerCell = 8;
+    struct CellDistribution {
+        PBRT_CPU_GPU
+        Float PMF(LightHandle light) const {
+            for (int i = 0; i < nLights; ++i)
+                if (lights[i] == light)
+                    return pmf[i];
+            return 0;
+        }
+
+        LightHandle lights[LightsPerCell];
+        Float pmf[LightsPerCell];
+        int nLights = 0;
+    };
+    struct CellAccumulator;
+
+    // SpatialLightSampler Private Methods
+    PBRT_CPU_GPU
+    int CellIndex(Point3f p) const {
+        if (cellDistributions.empty())
+            return -1;
+        Vector3f v = (p - gridOrigin) * invCellSize;
+        uint64_t h = Hash(int(std::floor(v.x)), int(std::floor(v.y)),
+                          int(std::floor(v.z)));
+        return h % cellDistributions.size();
+    }
+
+    PBRT_CPU_GPU
+    const CellDistribution *LookupCell(Point3f p) const {
+        int index = CellIndex(p);
+        if (index == -1 || cellDistributions[index].nLights == 0)
+            return nullptr;
+        return &cellDistributions[index];
+    }
+
+    // SpatialLightSampler Private Members
+    // Probability of sampling with _bvhSampler_ in cells with learned
+    // distributions
+    static constexpr Float BVHFraction = 0.5f;
+    BVHLightSampler bvhSampler;
+    // Lights, indexed by _LightHandle::Index()_
+    pstd::vector<LightHandle> lightsByIndex;
+    Point3f gridOrigin;
+    Float invCellSize = 0;
+    pstd::vector<CellDistribution> cellDistributions;
+    // Contributions recorded for each cell, which are only accessed on the CPU
+    CellAccumulator *cellAccumulators = nullptr;
 };
 
 inline pstd::optional<SampledLight> LightSamplerHandle::Sample(
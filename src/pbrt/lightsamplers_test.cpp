@@ -14,6 +14,7 @@
 #include <pbrt/util/transform.h>
 #include <pbrt/util/vecmath.h>
 
+#include <algorithm>
 #include <memory>
 #include <tuple>
 #include <unordered_map>
@@ -346,3 +347,112 @@ TEST(PowerLightSampling, PdfMethod) {
         EXPECT_FLOAT_EQ(sampledLight->pdf, distrib.PDF(intr, sampledLight->light));
     }
 }
+
+TEST(LightSampling, LightIndices) {
+    std::vector<LightHandle> lights;
+    std::vector<ShapeHandle> tris;
+    std::tie(lights, tris) = randomLights(10, Allocator());
+    std::vector<LightHandle> others;
+    std::tie(others, tris) = randomLights(4, Allocator());
+
+    // Samplers built over overlapping sets of lights share their indices
+    PowerLightSampler power(lights, Allocator());
+    std::vector<int> indices;
+    for (LightHandle light : lights) {
+        EXPECT_GE(light.Index(), 0);
+        EXPECT_EQ(indices.end(),
+                  std::find(indices.begin(), indices.end(), light.Index()));
+        indices.push_back(light.Index());
+    }
+    BVHLightSampler bvh(lights, Allocator());
+    for (size_t i = 0; i < lights.size(); ++i)
+        EXPECT_EQ(indices[i], lights[i].Index());
+
+    // Lights that a sampler doesn't know about have zero probability
+    Interaction intr(Point3fi(Point3f(0.5, 0.5, 0.5)), Normal3f(0, 0, 0), Point2f(0, 0));
+    Float sum = 0;
+    for (LightHandle light : lights)
+        sum += power.PDF(intr, light);
+    EXPECT_FLOAT_EQ(1, sum);
+    for (LightHandle light : others) {
+        EXPECT_EQ(0, power.PDF(intr, light));
+        EXPECT_EQ(-1, light.Index());
+    }
+
+    // A later scene's lights are numbered from zero, including the ones that
+    // were also in an earlier scene.
+    std::vector<LightHandle> nextScene = {others[0], lights[7], others[1]};
+    AssignLightIndices(nextScene);
+    for (size_t i = 0; i < nextScene.size(); ++i)
+        EXPECT_EQ(int(i), nextScene[i].Index());
+    PowerLightSampler nextPower(nextScene, Allocator());
+    sum = 0;
+    for (LightHandle light : nextScene)
+        sum += nextPower.PDF(intr, light);
+    EXPECT_FLOAT_EQ(1, sum);
+}
+
+// Enough lights that the BVH's bounds, buckets, and subtrees are computed in
+// parallel; the sampler's PDFs should still be consistent with sampling.
+TEST(BVHLightSampling, ManyLights) {
+    RNG rng(17);
+    std::vector<LightHandle> lights;
+    ConstantSpectrum one(1.f);
+    for (int i = 0; i < 100000; ++i) {
+        Vector3f p{Lerp(rng.Uniform<Float>(), -5, 5), Lerp(rng.Uniform<Float>(), -5, 5),
+                   Lerp(rng.Uniform<Float>(), -5, 5)};
+        lights.push_back(new PointLight(Translate(p), MediumInterface(), &one,
+                                        1 + rng.Uniform<Float>(), Allocator()));
+    }
+    BVHLightSampler distrib(lights, Allocator());
+
+    for (int i = 0; i < 1000; ++i) {
+        Point3f p{Lerp(rng.Uniform<Float>(), -6, 6), Lerp(rng.Uniform<Float>(), -6, 6),
+                  Lerp(rng.Uniform<Float>(), -6, 6)};
+        Interaction intr(Point3fi(p), Normal3f(0, 0, 0), Point2f(0, 0));
+        pstd::optional<SampledLight> sampledLight =
+            distrib.Sample(intr, rng.Uniform<Float>());
+        ASSERT_TRUE((bool)sampledLight) << i << " - " << p;
+        EXPECT_FLOAT_EQ(sampledLight->pdf, distrib.PDF(intr, sampledLight->light));
+    }
+}
+
+TEST(SpatialLightSampling, Learning) {
+    ConstantSpectrum one(1.f);
+    std::vector<LightHandle> lights;
+    for (Vector3f p : {Vector3f(-1, 0, 0), Vector3f(1, 0, 0), Vector3f(0, 1, 0)})
+        lights.push_back(
+            new PointLight(Translate(p), MediumInterface(), &one, 1.f, Allocator()));
+    SpatialLightSampler distrib(lights, Allocator());
+
+    // Only the third light reaches the point; learning should make it the
+    // most likely one there while still giving the others nonzero probability.
+    Point3f p(0.5, 0.25, 0.1);
+    Interaction intr(Point3fi(p), Normal3f(0, 0, 0), Point2f(0, 0));
+    Float pdf0 = distrib.PDF(intr, lights[2]);
+    for (int i = 0; i < 100; ++i) {
+        distrib.Record(p, lights[0], 0);
+        distrib.Record(p, lights[1], 0);
+        distrib.Record(p, lights[2], 1);
+    }
+    distrib.Update();
+    EXPECT_GT(distrib.PDF(intr, lights[2]), pdf0);
+    Float sum = 0;
+    for (LightHandle light : lights) {
+        EXPECT_GT(distrib.PDF(intr, light), 0);
+        sum += distrib.PDF(intr, light);
+    }
+    EXPECT_FLOAT_EQ(1, sum);
+
+    RNG rng;
+    int counts[3] = {0, 0, 0};
+    for (int i = 0; i < 1000; ++i) {
+        pstd::optional<SampledLight> sampledLight =
+            distrib.Sample(intr, rng.Uniform<Float>());
+        ASSERT_TRUE((bool)sampledLight);
+        EXPECT_FLOAT_EQ(sampledLight->pdf, distrib.PDF(intr, sampledLight->light));
+        for (int j = 0; j < 3; ++j)
+            counts[j] += sampledLight->light == lights[j];
+    }
+    EXPECT_GT(counts[2], counts[0] + counts[1]);
+}
@@ -21,8 +21,11 @@
 #include <pbrt/util/spectrum.h>
 
 #include <cmath>
+#include <map>
+#include <mutex>
 #include <numeric>
 #include <string>
+#include <utility>
 
 namespace pbrt {
 
@@ -120,9 +123,10 @@ MixMaterial *MixMaterial::Create(MaterialHandle materials[2],
 // HairMaterial Method Definitions
 std::string HairMaterial::ToString() const {
     return StringPrintf("[ HairMaterial sigma_a: %s color: %s eumelanin: %s "
-                        "pheomelanin: %s eta: %s beta_m: %s beta_n: %s alpha: %s ]",
+                        "pheomelanin: %s eta: %s beta_m: %s beta_n: %s alpha: %s "
+                        "table: %s ]",
                         sigma_a, color, eumelanin, pheomelanin, eta, beta_m, beta_n,
-                        alpha);
+                        alpha, table ? table->ToString() : std::string("(nullptr)"));
 }
 
 HairMaterial *HairMaterial::Create(const TextureParameterDictionary &parameters,
@@ -159,6 +163,20 @@ HairMaterial *HairMaterial::Create(const TextureParameterDictionary &parameters,
         if (color)
             Warning(loc, "Ignoring \"color\" parameter since "
                          "\"eumelanin\"/\"pheomelanin\" was provided.");
+
+        // Convert constant concentrations to _sigma_a_ now, rather than at
+        // every intersection
+        auto isConstant = [](FloatTextureHandle tex) {
+            return !tex || tex.Is<FloatConstantTexture>();
+        };
+        if (isConstant(eumelanin) && isConstant(pheomelanin)) {
+            Float ce = eumelanin ? eumelanin.Evaluate(TextureEvalContext()) : 0;
+            Float cp = pheomelanin ? pheomelanin.Evaluate(TextureEvalContext()) : 0;
+            sigma_a = alloc.new_object<SpectrumConstantTexture>(
+                alloc.new_object<RGBUnboundedSpectrum>(HairBxDF::SigmaAFromConcentration(
+                    std::max<Float>(0, ce), std::max<Float>(0, cp))));
+            eumelanin = pheomelanin = nullptr;
+        }
     } else {
         // Default: brown-ish hair.
         sigma_a = alloc.new_object<SpectrumConstantTexture>(
@@ -171,8 +189,27 @@ HairMaterial *HairMaterial::Create(const TextureParameterDictionary &parameters,
     FloatTextureHandle beta_n = parameters.GetFloatTexture("beta_n", 0.3f, alloc);
     FloatTextureHandle alpha = parameters.GetFloatTexture("alpha", 2.f, alloc);
 
+    const HairBxDFTable *table = nullptr;
+    if (parameters.GetOneBool("tabulate", false)) {
+        if (!beta_m.Is<FloatConstantTexture>() || !beta_n.Is<FloatConstantTexture>())
+            Warning(loc, "HairMaterial: \"tabulate\" requires constant \"beta_m\" "
+                         "and \"beta_n\". Ignoring.");
+        else {
+            // Find or create the table for this material's $\beta_m$ and $\beta_n$
+            Float bm = std::max<Float>(1e-2, beta_m.Evaluate(TextureEvalContext()));
+            Float bn = std::max<Float>(1e-2, beta_n.Evaluate(TextureEvalContext()));
+            static std::mutex tablesMutex;
+            static std::map<std::pair<Float, Float>, const HairBxDFTable *> tables;
+            std::lock_guard<std::mutex> lock(tablesMutex);
+            const HairBxDFTable *&t = tables[std::make_pair(bm, bn)];
+            if (!t)
+                t = alloc.new_object<HairBxDFTable>(bm, bn, alloc);
+            table = t;
+        }
+    }
+
     return alloc.new_object<HairMaterial>(sigma_a, color, eumelanin, pheomelanin, eta,
-                                          beta_m, beta_n, alpha);
+                                          beta_m, beta_n, alpha, table);
 }
 
 // DiffuseMaterial Method Definitions
@@ -251,6 +288,40 @@ std::string CoatedDiffuseMaterial::ToString() const {
         remapRoughness);
 }
 
+// Returns a _LayeredBxDFTable_ for the layered BxDFs that _material_ returns,
+// or _nullptr_ if they can't be tabulated.
+template <typename Material>
+static const LayeredBxDFTable *TabulateLayeredBxDF(const Material &material,
+                                                   FloatTextureHandle uRoughness,
+                                                   FloatTextureHandle vRoughness,
+                                                   const FileLoc *loc, Allocator alloc) {
+    ConstantTextureEvaluator texEval;
+    if (!material.CanEvaluateTextures(texEval)) {
+        Warning(loc, "%s: \"tabulate\" requires constant textures. Ignoring.",
+                Material::Name());
+        return nullptr;
+    }
+    if (texEval(uRoughness, TextureEvalContext()) !=
+        texEval(vRoughness, TextureEvalContext())) {
+        Warning(loc, "%s: \"tabulate\" requires isotropic roughness. Ignoring.",
+                Material::Name());
+        return nullptr;
+    }
+
+    return alloc.new_object<LayeredBxDFTable>(
+        [&](Vector3f wo, Vector3f wi, const SampledWavelengths &lambda) {
+            MaterialEvalContext ctx;
+            ctx.wo = wo;
+            ctx.n = ctx.ns = Normal3f(0, 0, 1);
+            ctx.dpdus = Vector3f(1, 0, 0);
+            SampledWavelengths l = lambda;
+            typename Material::BxDF bxdf;
+            material.GetBSDF(ConstantTextureEvaluator(), ctx, l, &bxdf);
+            return bxdf.fLayers(wo, wi, TransportMode::Radiance);
+        },
+        alloc);
+}
+
 CoatedDiffuseMaterial *CoatedDiffuseMaterial::Create(
     const TextureParameterDictionary &parameters, Image *normalMap, const FileLoc *loc,
     Allocator alloc) {
@@ -286,6 +357,18 @@ CoatedDiffuseMaterial *CoatedDiffuseMaterial::Create(
         parameters.GetFloatTextureOrNull("displacement", alloc);
     bool remapRoughness = parameters.GetOneBool("remaproughness", true);
 
+    if (parameters.GetOneBool("tabulate", false)) {
+        if (!config.twoSided)
+            Warning(loc, "CoatedDiffuseMaterial: \"tabulate\" requires "
+                         "\"twosided\". Ignoring.");
+        else
+            config.table = TabulateLayeredBxDF(
+                CoatedDiffuseMaterial(reflectance, uRoughness, vRoughness, thickness,
+                                      albedo, g, eta, nullptr, nullptr, remapRoughness,
+                                      config),
+                uRoughness, vRoughness, loc, alloc);
+    }
+
     return alloc.new_object<CoatedDiffuseMaterial>(
         reflectance, uRoughness, vRoughness, thickness, albedo, g, eta, displacement,
         normalMap, remapRoughness, config);
@@ -366,6 +449,21 @@ CoatedConductorMaterial *CoatedConductorMaterial::Create(
         parameters.GetFloatTextureOrNull("displacement", alloc);
     bool remapRoughness = parameters.GetOneBool("remaproughness", true);
 
+    if (parameters.GetOneBool("tabulate", false)) {
+        CoatedConductorMaterial material(
+            interfaceURoughness, interfaceVRoughness, thickness, interfaceEta, g, albedo,
+            conductorURoughness, conductorVRoughness, conductorEta, k, reflectance,
+            nullptr, nullptr, remapRoughness, config);
+        ConstantTextureEvaluator texEval;
+        if (texEval(conductorURoughness, TextureEvalContext()) !=
+            texEval(conductorVRoughness, TextureEvalContext()))
+            Warning(loc, "CoatedConductorMaterial: \"tabulate\" requires isotropic "
+                         "roughness. Ignoring.");
+        else
+            config.table = TabulateLayeredBxDF(material, interfaceURoughness,
+                                               interfaceVRoughness, loc, alloc);
+    }
+
     return alloc.new_object<CoatedConductorMaterial>(
         interfaceURoughness, interfaceVRoughness, thickness, interfaceEta, g, albedo,
         conductorURoughness, conductorVRoughness, conductorEta, k, reflectance,
@@ -449,9 +547,21 @@ SubsurfaceMaterial *SubsurfaceMaterial::Create(
         parameters.GetFloatTextureOrNull("displacement", alloc);
     bool remapRoughness = parameters.GetOneBool("remaproughness", true);
 
-    return alloc.new_object<SubsurfaceMaterial>(
-        scale, sigma_a, sigma_s, reflectance, mfp, g, eta, uRoughness, vRoughness,
-        displacement, normalMap, remapRoughness, alloc);
+    // Get the BSSRDF profile table, which is shared with materials with the
+    // same profile, _g_, and _eta_
+    std::string profileName = parameters.GetOneString("profile", "beamdiffusion");
+    BSSRDFProfile profile;
+    if (profileName == "beamdiffusion")
+        profile = BSSRDFProfile::BeamDiffusion;
+    else if (profileName == "burley")
+        profile = BSSRDFProfile::Burley;
+    else
+        ErrorExit(loc, "%s: unknown \"profile\" for subsurface material.", profileName);
+    const BSSRDFTable *table = GetBSSRDFTable(profile, g, eta, alloc);
+
+    return alloc.new_object<SubsurfaceMaterial>(scale, sigma_a, sigma_s, reflectance, mfp,
+                                                table, eta, uRoughness, vRoughness,
+                                                displacement, normalMap, remapRoughness);
 }
 
 // DiffuseTransmissionMaterial Method Definitions
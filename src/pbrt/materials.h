@@ -384,7 +384,8 @@ class HairMaterial {
     HairMaterial(SpectrumTextureHandle sigma_a, SpectrumTextureHandle color,
                  FloatTextureHandle eumelanin, FloatTextureHandle pheomelanin,
                  FloatTextureHandle eta, FloatTextureHandle beta_m,
-                 FloatTextureHandle beta_n, FloatTextureHandle alpha)
+                 FloatTextureHandle beta_n, FloatTextureHandle alpha,
+                 const HairBxDFTable *table = nullptr)
         : sigma_a(sigma_a),
           color(color),
           eumelanin(eumelanin),
@@ -392,7 +393,8 @@ class HairMaterial {
           eta(eta),
           beta_m(beta_m),
           beta_n(beta_n),
-          alpha(alpha) {}
+          alpha(alpha),
+          table(table) {}
 
     static const char *Name() { return "HairMaterial"; }
 
@@ -426,7 +428,7 @@ class HairMaterial {
 
         // Offset along width
         Float h = -1 + 2 * ctx.uv[1];
-        *bxdf = HairBxDF(h, e, sig_a, bm, bn, a);
+        *bxdf = HairBxDF(h, e, sig_a, bm, bn, a, table);
         return BSDF(ctx.wo, ctx.n, ctx.ns, ctx.dpdus, bxdf);
     }
 
@@ -452,6 +454,9 @@ class HairMaterial {
     SpectrumTextureHandle sigma_a, color;
     FloatTextureHandle eumelanin, pheomelanin, eta;
     FloatTextureHandle beta_m, beta_n, alpha;
+    // If non-null, $M_p$ and $N_p$ are evaluated and sampled using this
+    // table, which is only used when $\beta_m$ and $\beta_n$ are constant
+    const HairBxDFTable *table;
 };
 
 // DiffuseMaterial Definition
@@ -641,7 +646,7 @@ class CoatedDiffuseMaterial {
 
         *bxdf =
             CoatedDiffuseBxDF(DielectricInterfaceBxDF(e, SampledSpectrum(1.f), distrib),
-                              IdealDiffuseBxDF(r), thick, a, gg, config);
+                              IdealDiffuseBxDF(r), thick, a, gg, config, lambda);
         return BSDF(ctx.wo, ctx.n, ctx.ns, ctx.dpdus, bxdf);
     }
 
@@ -753,7 +758,8 @@ class CoatedConductorMaterial {
 
         *bxdf = CoatedConductorBxDF(
             DielectricInterfaceBxDF(ieta, SampledSpectrum(1.f), interfaceDistrib),
-            ConductorBxDF(conductorDistrib, ce, ck), thick, a, gg, config);
+            ConductorBxDF(conductorDistrib, ce, ck), thick, a, gg, config,
+            lambda);
         return BSDF(ctx.wo, ctx.n, ctx.ns, ctx.dpdus, bxdf);
     }
 
@@ -798,10 +804,10 @@ class SubsurfaceMaterial {
     // SubsurfaceMaterial Public Methods
     SubsurfaceMaterial(Float scale, SpectrumTextureHandle sigma_a,
                        SpectrumTextureHandle sigma_s, SpectrumTextureHandle reflectance,
-                       SpectrumTextureHandle mfp, Float g, Float eta,
+                       SpectrumTextureHandle mfp, const BSSRDFTable *table, Float eta,
                        FloatTextureHandle uRoughness, FloatTextureHandle vRoughness,
                        FloatTextureHandle displacement, Image *normalMap,
-                       bool remapRoughness, Allocator alloc)
+                       bool remapRoughness)
         : displacement(displacement),
           normalMap(normalMap),
           scale(scale),
@@ -813,9 +819,7 @@ class SubsurfaceMaterial {
           vRoughness(vRoughness),
           eta(eta),
           remapRoughness(remapRoughness),
-          table(100, 64, alloc) {
-        ComputeBeamDiffusionBSSRDF(g, eta, &table);
-    }
+          table(table) {}
 
     static const char *Name() { return "SubsurfaceMaterial"; }
 
@@ -857,9 +861,9 @@ class SubsurfaceMaterial {
             DCHECK(reflectance && mfp);
             SampledSpectrum mfree = ClampZero(scale * texEval(mfp, ctx, lambda));
             SampledSpectrum r = Clamp(texEval(reflectance, ctx, lambda), 0, 1);
-            SubsurfaceFromDiffuse(table, r, mfree, &sig_a, &sig_s);
+            SubsurfaceFromDiffuse(*table, r, mfree, &sig_a, &sig_s);
         }
-        *bssrdf = TabulatedBSSRDF(ctx.p, ctx.ns, ctx.wo, eta, sig_a, sig_s, &table);
+        *bssrdf = TabulatedBSSRDF(ctx.p, ctx.ns, ctx.wo, eta, sig_a, sig_s, table);
     }
 
     PBRT_CPU_GPU
@@ -886,7 +890,7 @@ class SubsurfaceMaterial {
     Float scale, eta;
     FloatTextureHandle uRoughness, vRoughness;
     bool remapRoughness;
-    BSSRDFTable table;
+    const BSSRDFTable *table;
 };
 
 // DiffuseTransmissionMaterial Definition
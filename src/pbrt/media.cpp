@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 
 namespace pbrt {
 
@@ -186,6 +187,75 @@ std::string HomogeneousMedium::ToString() const {
 
 STAT_MEMORY_COUNTER("Memory/Volume grids", volumeGridBytes);
 
+STAT_MEMORY_COUNTER("Memory/Majorant grids", majorantGridBytes);
+STAT_PERCENT("Media/Refined majorant grid cells", refinedMajorantCells,
+             totalMajorantCells);
+
+// MajorantGrid Method Definitions
+MajorantGrid::MajorantGrid(Point3i res, int refineRes,
+                           std::function<Float(const Bounds3f &)> maxDensity,
+                           Allocator alloc)
+    : res(res),
+      refineRes(refineRes),
+      voxels(res.x * res.y * res.z, alloc),
+      blockOffsets(size_t(res.x * res.y * res.z), -1, alloc),
+      blockVoxels(alloc) {
+    // Compute maximum densities at the refined resolution
+    Point3i fineRes = refineRes * res;
+    std::vector<Float> fineVoxels(fineRes.x * fineRes.y * fineRes.z);
+    ParallelFor(0, fineVoxels.size(), [&](size_t index) {
+        Float x = index % fineRes.x;
+        Float y = (index / fineRes.x) % fineRes.y;
+        Float z = index / (fineRes.x * fineRes.y);
+        Bounds3f bounds(Point3f(x / fineRes.x, y / fineRes.y, z / fineRes.z),
+                        Point3f((x + 1) / fineRes.x, (y + 1) / fineRes.y,
+                                (z + 1) / fineRes.z));
+        fineVoxels[index] = maxDensity(bounds);
+    });
+
+    // Set coarse majorants and decide which cells to refine
+    int blockSize = refineRes * refineRes * refineRes;
+    auto fineOffset = [&](Point3i p, int i) {
+        Point3i pf(p.x * refineRes + i % refineRes,
+                   p.y * refineRes + (i / refineRes) % refineRes,
+                   p.z * refineRes + i / (refineRes * refineRes));
+        return pf.x + fineRes.x * (pf.y + fineRes.y * pf.z);
+    };
+    std::vector<bool> refine(voxels.size(), false);
+    ParallelFor(0, voxels.size(), [&](size_t index) {
+        Point3i p(index % res.x, (index / res.x) % res.y, index / (res.x * res.y));
+        Float maxValue = 0, sumValue = 0;
+        for (int i = 0; i < blockSize; ++i) {
+            Float v = fineVoxels[fineOffset(p, i)];
+            maxValue = std::max(maxValue, v);
+            sumValue += v;
+        }
+        voxels[index] = maxValue;
+        // The expected number of null collisions in a cell is bounded by
+        // the integral of its majorant, so only refine cells where the
+        // refined majorants at least halve it.
+        refine[index] = blockSize > 1 && sumValue / blockSize < 0.5f * maxValue;
+    });
+    for (size_t index = 0; index < voxels.size(); ++index)
+        if (refine[index]) {
+            Point3i p(index % res.x, (index / res.x) % res.y, index / (res.x * res.y));
+            blockOffsets[index] = blockVoxels.size();
+            for (int i = 0; i < blockSize; ++i)
+                blockVoxels.push_back(fineVoxels[fineOffset(p, i)]);
+            ++refinedMajorantCells;
+        }
+
+    totalMajorantCells += voxels.size();
+    majorantGridBytes += BytesAllocated();
+}
+
+std::string MajorantGrid::ToString() const {
+    return StringPrintf("[ MajorantGrid res: %s refineRes: %d voxels: %s "
+                        "blockOffsets: %s blockVoxels: %s ]",
+                        res, refineRes, voxels, blockOffsets, blockVoxels);
+}
+
+
 // UniformGridMediumProvider Method Definitions
 UniformGridMediumProvider::UniformGridMediumProvider(
     const Bounds3f &bounds, pstd::optional<SampledGrid<Float>> dgrid,
@@ -310,22 +380,110 @@ static nanovdb::GridHandle<Buffer> readGrid(const std::string &filename,
     return grid;
 }
 
+// Returns a copy of _grid_ whose storage comes from _alloc_
+static nanovdb::GridHandle<NanoVDBBuffer> copyGrid(
+    const nanovdb::GridHandle<NanoVDBBuffer> &grid, Allocator alloc) {
+    if (!grid)
+        return {};
+    NanoVDBBuffer buf(grid.size(), alloc);
+    std::memcpy(buf.data(), grid.data(), grid.size());
+    return nanovdb::GridHandle<NanoVDBBuffer>(std::move(buf));
+}
+
+// Box-filters the voxels of _grid_ in the index-space bounds _bbox_ down by
+// _factor_ along each axis
+static SampledGrid<Float> downsampleGrid(const nanovdb::FloatGrid *grid,
+                                         const nanovdb::CoordBBox &bbox, int factor,
+                                         Allocator alloc) {
+    Point3i fullRes(bbox.max()[0] - bbox.min()[0] + 1, bbox.max()[1] - bbox.min()[1] + 1,
+                    bbox.max()[2] - bbox.min()[2] + 1);
+    Point3i res((fullRes.x + factor - 1) / factor, (fullRes.y + factor - 1) / factor,
+                (fullRes.z + factor - 1) / factor);
+    std::vector<Float> values(size_t(res.x) * res.y * res.z);
+    ParallelFor(0, res.z, [&](int64_t z) {
+        auto accessor = grid->getAccessor();
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x) {
+                // Average the full-resolution voxels covered by the LOD voxel
+                Point3i p0(bbox.min()[0] + x * factor, bbox.min()[1] + y * factor,
+                           bbox.min()[2] + int(z) * factor);
+                Point3i p1 = Min(p0 + Vector3i(factor, factor, factor),
+                                 Point3i(bbox.max()[0] + 1, bbox.max()[1] + 1,
+                                         bbox.max()[2] + 1));
+                double sum = 0;
+                for (int nz = p0.z; nz < p1.z; ++nz)
+                    for (int ny = p0.y; ny < p1.y; ++ny)
+                        for (int nx = p0.x; nx < p1.x; ++nx)
+                            sum += accessor.getValue({nx, ny, nz});
+                int nVoxels = (p1.x - p0.x) * (p1.y - p0.y) * (p1.z - p0.z);
+                values[x + res.x * (y + res.y * size_t(z))] = sum / nVoxels;
+            }
+    });
+    return SampledGrid<Float>(values, res.x, res.y, res.z, alloc);
+}
+
 NanoVDBMediumProvider *NanoVDBMediumProvider::Create(
     const ParameterDictionary &parameters, const FileLoc *loc, Allocator alloc) {
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
     if (filename.empty())
         ErrorExit(loc, "Must supply \"filename\" to \"nanovdb\" medium.");
 
+    // Grids that may not fit in the memory budget are first read into host
+    // memory, which isn't used for rendering.
+    Float memoryBudget = parameters.GetOneFloat("memorybudget", 0.f);
+    Allocator readAlloc = memoryBudget > 0 ? Allocator() : alloc;
+
     nanovdb::GridHandle<NanoVDBBuffer> densityGrid;
     nanovdb::BBox<nanovdb::Vec3R> bbox;
-    densityGrid = readGrid<NanoVDBBuffer>(filename, "density", loc, alloc);
+    densityGrid = readGrid<NanoVDBBuffer>(filename, "density", loc, readAlloc);
     if (!densityGrid)
         ErrorExit(loc, "%s: didn't find \"density\" grid.", filename);
 
     bbox = densityGrid.grid<float>()->worldBBox();
 
     nanovdb::GridHandle<NanoVDBBuffer> temperatureGrid;
-    temperatureGrid = readGrid<NanoVDBBuffer>(filename, "temperature", loc, alloc);
+    temperatureGrid = readGrid<NanoVDBBuffer>(filename, "temperature", loc, readAlloc);
+
+    pstd::optional<SampledGrid<Float>> lodDensityGrid, lodTemperatureGrid;
+    int lodFactor = 1;
+    if (memoryBudget > 0) {
+        size_t budgetBytes = memoryBudget * 1024 * 1024;
+        if (densityGrid.size() + temperatureGrid.size() <= budgetBytes) {
+            // Move the grids into memory that can be used for rendering
+            densityGrid = copyGrid(densityGrid, alloc);
+            temperatureGrid = copyGrid(temperatureGrid, alloc);
+        } else {
+            // Find the smallest LOD whose dense grids fit within the budget
+            nanovdb::CoordBBox indexBBox = densityGrid.grid<float>()->indexBBox();
+            int nGrids = temperatureGrid ? 2 : 1, maxExtent = 1;
+            for (int axis = 0; axis < 3; ++axis)
+                maxExtent = std::max(maxExtent,
+                                     indexBBox.max()[axis] - indexBBox.min()[axis] + 1);
+            auto lodBytes = [&](int factor) {
+                size_t voxels = 1;
+                for (int axis = 0; axis < 3; ++axis)
+                    voxels *= (indexBBox.max()[axis] - indexBBox.min()[axis] + factor) /
+                              factor;
+                return nGrids * voxels * sizeof(Float);
+            };
+            lodFactor = 2;
+            while (lodFactor < maxExtent && lodBytes(lodFactor) > budgetBytes)
+                lodFactor *= 2;
+            Warning(loc,
+                    "%s: %d MB of grids exceed \"memorybudget\" %f MB. Downsampling "
+                    "by %d.",
+                    filename, (densityGrid.size() + temperatureGrid.size()) >> 20,
+                    memoryBudget, lodFactor);
+
+            lodDensityGrid =
+                downsampleGrid(densityGrid.grid<float>(), indexBBox, lodFactor, alloc);
+            if (temperatureGrid)
+                lodTemperatureGrid = downsampleGrid(temperatureGrid.grid<float>(),
+                                                    indexBBox, lodFactor, alloc);
+            densityGrid = nanovdb::GridHandle<NanoVDBBuffer>();
+            temperatureGrid = nanovdb::GridHandle<NanoVDBBuffer>();
+        }
+    }
 
     Bounds3f bounds(Point3f(bbox.min()[0], bbox.min()[1], bbox.min()[2]),
                     Point3f(bbox.max()[0], bbox.max()[1], bbox.max()[2]));
@@ -334,9 +492,10 @@ NanoVDBMediumProvider *NanoVDBMediumProvider::Create(
     Float temperatureCutoff = parameters.GetOneFloat("temperaturecutoff", 0.f);
     Float temperatureScale = parameters.GetOneFloat("temperaturescale", 1.f);
 
-    return alloc.new_object<NanoVDBMediumProvider>(bounds, std::move(densityGrid),
-                                                   std::move(temperatureGrid), LeScale,
-                                                   temperatureCutoff, temperatureScale);
+    return alloc.new_object<NanoVDBMediumProvider>(
+        bounds, std::move(densityGrid), std::move(temperatureGrid),
+        std::move(lodDensityGrid), std::move(lodTemperatureGrid), lodFactor, LeScale,
+        temperatureCutoff, temperatureScale);
 }
 
 MediumHandle MediumHandle::Create(const std::string &name,
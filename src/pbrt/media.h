@@ -19,15 +19,16 @@
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/scattering.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 
 #include <nanovdb/NanoVDB.h>
 #include <nanovdb/util/GridHandle.h>
-#include <nanovdb/util/SampleFromVoxels.h>
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <nanovdb/util/CudaDeviceBuffer.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
 
+#include <functional>
 #include <limits>
 #include <memory>
 #include <vector>
@@ -100,8 +101,9 @@ class HomogeneousMedium {
 
     template <typename F>
     PBRT_CPU_GPU SampledSpectrum SampleTmaj(Ray ray, Float tMax, Float u, RNG &rng,
-                                            const SampledWavelengths &lambda,
-                                            F callback) const {
+                                            const SampledWavelengths &lambda, F callback,
+                                            int maxSegments = 0,
+                                            Float *tResume = nullptr) const {
         // Normalize ray direction for homogeneous medium sampling
         tMax *= Length(ray.d);
         if (std::isinf(tMax))
@@ -132,6 +134,17 @@ class HomogeneousMedium {
             return FastExp(-tMax * sigma_maj);
     }
 
+    // Returns the transmittance along _ray_ up to _tMax_ in closed form.
+    // Ratio tracking through a homogeneous medium never sees a null
+    // collision, so it degenerates to an all-or-nothing estimate of this.
+    PBRT_CPU_GPU
+    SampledSpectrum Tr(const Ray &ray, Float tMax,
+                       const SampledWavelengths &lambda) const {
+        SampledSpectrum sigma_t =
+            sigScale * (sigma_a_spec.Sample(lambda) + sigma_s_spec.Sample(lambda));
+        return FastExp(-tMax * Length(ray.d) * sigma_t);
+    }
+
     std::string ToString() const;
 
   private:
@@ -141,6 +154,117 @@ class HomogeneousMedium {
     HGPhaseFunction phase;
 };
 
+// MajorantGrid Definition
+// A two-level grid of maximum densities over $[0,1]^3$. Each coarse cell
+// stores the maximum density inside it and may also point to a block of
+// _refineRes_^3 finer majorants. Blocks are only kept for cells where the
+// density varies enough that the finer majorants substantially reduce the
+// number of null collisions.
+class MajorantGrid {
+  public:
+    // MajorantGrid Public Methods
+    MajorantGrid(Allocator alloc)
+        : voxels(alloc), blockOffsets(alloc), blockVoxels(alloc) {}
+    MajorantGrid(Point3i res, int refineRes,
+                 std::function<Float(const Bounds3f &)> maxDensity, Allocator alloc);
+
+    PBRT_CPU_GPU
+    Point3i Resolution() const { return res; }
+    PBRT_CPU_GPU
+    int RefineResolution() const { return refineRes; }
+
+    PBRT_CPU_GPU
+    Float Lookup(Point3i p) const { return voxels[Offset(p)]; }
+
+    // Returns the refined majorants for the given cell, or _nullptr_ if the
+    // cell isn't refined.
+    PBRT_CPU_GPU
+    const Float *RefinedBlock(Point3i p) const {
+        int offset = blockOffsets[Offset(p)];
+        return offset >= 0 ? &blockVoxels[offset] : nullptr;
+    }
+
+    size_t BytesAllocated() const {
+        return voxels.size() * sizeof(Float) + blockOffsets.size() * sizeof(int) +
+               blockVoxels.size() * sizeof(Float);
+    }
+
+    std::string ToString() const;
+
+  private:
+    // MajorantGrid Private Methods
+    PBRT_CPU_GPU
+    int Offset(Point3i p) const { return p.x + res.x * (p.y + res.y * p.z); }
+
+    // MajorantGrid Private Members
+    Point3i res;
+    int refineRes = 1;
+    pstd::vector<Float> voxels;
+    pstd::vector<int> blockOffsets;
+    pstd::vector<Float> blockVoxels;
+};
+
+// Steps the ray _o_ + _t_ _d_, given in the [0,1]^3 parametric space of a
+// grid with resolution _res_, through the grid's voxels over [_tMin_, _tMax_],
+// calling _callback_ with each voxel and the parametric range the ray spends
+// inside it. Traversal stops early and returns _false_ if _callback_ returns
+// _false_.
+template <typename F>
+PBRT_CPU_GPU inline bool TraverseGrid(Point3f o, Vector3f d, Float tMin, Float tMax,
+                                      Point3i res, F callback) {
+    Point3f gridIntersect = o + tMin * d;
+    Float nextCrossingT[3], deltaT[3];
+    int step[3], voxelLimit[3], voxel[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        // Initialize ray stepping parameters for axis
+        // Compute current voxel for axis and handle negative zero direction
+        voxel[axis] = Clamp(gridIntersect[axis] * res[axis], 0, res[axis] - 1);
+        if (d[axis] == -0.f)
+            d[axis] = 0.f;
+
+        if (d[axis] >= 0) {
+            // Handle ray with positive direction for voxel stepping
+            Float nextVoxelPos = Float(voxel[axis] + 1) / res[axis];
+            nextCrossingT[axis] = tMin + (nextVoxelPos - gridIntersect[axis]) / d[axis];
+            deltaT[axis] = 1 / (d[axis] * res[axis]);
+            step[axis] = 1;
+            voxelLimit[axis] = res[axis];
+
+        } else {
+            // Handle ray with negative direction for voxel stepping
+            Float nextVoxelPos = Float(voxel[axis]) / res[axis];
+            nextCrossingT[axis] = tMin + (nextVoxelPos - gridIntersect[axis]) / d[axis];
+            deltaT[axis] = -1 / (d[axis] * res[axis]);
+            step[axis] = -1;
+            voxelLimit[axis] = -1;
+        }
+    }
+
+    // Walk ray through grid voxels
+    Float t0 = tMin;
+    while (true) {
+        // Find _stepAxis_ for stepping to next voxel and exit point _t1_
+        int bits = ((nextCrossingT[0] < nextCrossingT[1]) << 2) +
+                   ((nextCrossingT[0] < nextCrossingT[2]) << 1) +
+                   ((nextCrossingT[1] < nextCrossingT[2]));
+        const int cmpToAxis[8] = {2, 1, 2, 1, 2, 2, 0, 0};
+        int stepAxis = cmpToAxis[bits];
+        Float t1 = std::min(tMax, nextCrossingT[stepAxis]);
+
+        if (!callback(Point3i(voxel[0], voxel[1], voxel[2]), t0, t1))
+            return false;
+
+        // Advance to next voxel in grid
+        if (nextCrossingT[stepAxis] > tMax)
+            return true;
+        voxel[stepAxis] += step[stepAxis];
+        if (voxel[stepAxis] == voxelLimit[stepAxis])
+            return true;
+        nextCrossingT[stepAxis] += deltaT[stepAxis];
+        t0 = t1;
+    }
+}
+
 // CuboidMedium Definition
 template <typename Provider>
 class CuboidMedium {
@@ -156,29 +280,31 @@ class CuboidMedium {
           sigScale(sigScale),
           phase(g),
           renderFromMedium(renderFromMedium),
-          maxDensityGrid(alloc) {
-        // Initialize _maxDensityGrid_
-        maxDensityGrid = provider->GetMaxDensityGrid(alloc, &gridResolution);
+          majorantGrid(alloc) {
+        // Initialize _majorantGrid_
+        majorantGrid = provider->GetMajorantGrid(alloc);
     }
 
     std::string ToString() const {
         return StringPrintf("[ CuboidMedium provider: %s mediumBounds: %s "
                             "sigma_a_spec: %s sigma_s_spec: %s sigScale: %f phase: %s "
-                            "maxDensityGrid: %s gridResolution: %s ]",
+                            "majorantGrid: %s ]",
                             *provider, mediumBounds, sigma_a_spec, sigma_s_spec, sigScale,
-                            phase, maxDensityGrid, gridResolution);
+                            phase, majorantGrid);
     }
 
     bool IsEmissive() const { return provider->IsEmissive(); }
 
     template <typename F>
     PBRT_CPU_GPU SampledSpectrum SampleTmaj(Ray rRender, Float raytMax, Float u, RNG &rng,
-                                            const SampledWavelengths &lambda,
-                                            F callback) const {
+                                            const SampledWavelengths &lambda, F callback,
+                                            int maxSegments = 0,
+                                            Float *tResume = nullptr) const {
         SampledSpectrum TmajAccum(1.f);
         // Transform ray to grid density's space and compute bounds overlap
         Ray ray = renderFromMedium.ApplyInverse(rRender, &raytMax);
-        raytMax *= Length(ray.d);
+        Float dLength = Length(ray.d);
+        raytMax *= dLength;
         ray.d = Normalize(ray.d);
         Float tMin, tMax;
         if (!mediumBounds.IntersectP(ray.o, ray.d, raytMax, &tMin, &tMax))
@@ -190,105 +316,76 @@ class CuboidMedium {
         SampledSpectrum sigma_s = sigScale * sigma_s_spec.Sample(lambda);
         SampledSpectrum sigma_t = sigma_a + sigma_s;
 
-        // Set up 3D DDA for ray through grid
-        Vector3f diag = mediumBounds.Diagonal();
-        Ray rayGrid(Point3f(mediumBounds.Offset(ray.o)),
-                    Vector3f(ray.d.x / diag.x, ray.d.y / diag.y, ray.d.z / diag.z));
-        Point3f gridIntersect = rayGrid(tMin);
-        Float nextCrossingT[3], deltaT[3];
-        int step[3], voxelLimit[3], voxel[3];
-        for (int axis = 0; axis < 3; ++axis) {
-            // Initialize ray stepping parameters for axis
-            // Compute current voxel for axis and handle negative zero direction
-            voxel[axis] = Clamp(gridIntersect[axis] * gridResolution[axis], 0,
-                                gridResolution[axis] - 1);
-            if (rayGrid.d[axis] == -0.f)
-                rayGrid.d[axis] = 0.f;
-
-            if (rayGrid.d[axis] >= 0) {
-                // Handle ray with positive direction for voxel stepping
-                Float nextVoxelPos = Float(voxel[axis] + 1) / gridResolution[axis];
-                nextCrossingT[axis] =
-                    tMin + (nextVoxelPos - gridIntersect[axis]) / rayGrid.d[axis];
-                deltaT[axis] = 1 / (rayGrid.d[axis] * gridResolution[axis]);
-                step[axis] = 1;
-                voxelLimit[axis] = gridResolution[axis];
-
-            } else {
-                // Handle ray with negative direction for voxel stepping
-                Float nextVoxelPos = Float(voxel[axis]) / gridResolution[axis];
-                nextCrossingT[axis] =
-                    tMin + (nextVoxelPos - gridIntersect[axis]) / rayGrid.d[axis];
-                deltaT[axis] = -1 / (rayGrid.d[axis] * gridResolution[axis]);
-                step[axis] = -1;
-                voxelLimit[axis] = -1;
-            }
-        }
+        // Get provider accessor for the lookups along the ray
+        typename Provider::Accessor accessor = provider->GetAccessor();
 
-        // Walk ray through maximum density grid and sample scattering
-        Float t0 = tMin;
-        while (true) {
-            // Find _stepAxis_ for stepping to next voxel and exit point _t1_
-            int bits = ((nextCrossingT[0] < nextCrossingT[1]) << 2) +
-                       ((nextCrossingT[0] < nextCrossingT[2]) << 1) +
-                       ((nextCrossingT[1] < nextCrossingT[2]));
-            const int cmpToAxis[8] = {2, 1, 2, 1, 2, 2, 0, 0};
-            int stepAxis = cmpToAxis[bits];
-            Float t1 = std::min(tMax, nextCrossingT[stepAxis]);
-
-            // Sample volume scattering in current voxel
-            // Get _maxDensity_ for current voxel and compute _sigma_maj_
-            int offset =
-                voxel[0] + gridResolution.x * (voxel[1] + gridResolution.y * voxel[2]);
-            Float maxDensity = maxDensityGrid[offset];
+        // Define _sampleSegment_ lambda for sampling with a constant majorant
+        // _sampleSegment_ returns _false_ if the callback requests termination
+        // or the segment budget is used up
+        int nSegments = 0;
+        auto sampleSegment = [&](Float maxDensity, Float t0, Float t1) -> bool {
             SampledSpectrum sigma_maj(sigma_t * maxDensity);
-
-            if (sigma_maj[0] == 0)
+            if (sigma_maj[0] == 0) {
                 TmajAccum *= FastExp(-sigma_maj * (t1 - t0));
-            else {
-                while (true) {
-                    // Sample medium in current voxel
-                    // Sample _t_ for scattering event and check validity
-                    Float t = t0 + SampleExponential(u, sigma_maj[0]);
-                    u = rng.Uniform<Float>();
-                    if (t >= t1) {
-                        TmajAccum *= FastExp(-sigma_maj * (t1 - t0));
-                        break;
-                    }
-
-                    if (t < tMax) {
-                        // Compute medium properties at sampled point in grid
-                        SampledSpectrum Tmaj = FastExp(-sigma_maj * (t - t0));
-                        Point3f p = ray(t);
-                        SampledSpectrum d = provider->Density(p, lambda);
-                        SampledSpectrum Le = provider->Le(p, lambda);
-                        SampledSpectrum sigmap_a = sigma_a * d, sigmap_s = sigma_s * d;
-
-                        Tmaj *= TmajAccum;
-                        TmajAccum = SampledSpectrum(1.f);
-
-                        // Report scattering event in grid to callback function
-                        Point3f pRender = renderFromMedium(p);
-                        MediumInteraction intr(pRender, -Normalize(rRender.d),
-                                               rRender.time, sigmap_a, sigmap_s,
-                                               sigma_maj, Le, this, &phase);
-                        if (!callback(MediumSample(intr, Tmaj)))
-                            return TmajAccum;
-                    }
-                    // Update _t0_ after medium interaction
-                    t0 = t;
+                return true;
+            }
+            // Stop before the segment if _maxSegments_ have been sampled
+            if (maxSegments > 0 && nSegments == maxSegments) {
+                *tResume = t0 / dLength;
+                return false;
+            }
+            ++nSegments;
+            while (true) {
+                // Sample _t_ for scattering event and check validity
+                Float t = t0 + SampleExponential(u, sigma_maj[0]);
+                u = rng.Uniform<Float>();
+                if (t >= t1) {
+                    TmajAccum *= FastExp(-sigma_maj * (t1 - t0));
+                    return true;
                 }
+
+                // Compute medium properties at sampled point in grid
+                SampledSpectrum Tmaj = FastExp(-sigma_maj * (t - t0));
+                Point3f p = ray(t);
+                SampledSpectrum d = accessor.Density(p, lambda);
+                SampledSpectrum Le = accessor.Le(p, lambda);
+                SampledSpectrum sigmap_a = sigma_a * d, sigmap_s = sigma_s * d;
+
+                Tmaj *= TmajAccum;
+                TmajAccum = SampledSpectrum(1.f);
+
+                // Report scattering event in grid to callback function
+                Point3f pRender = renderFromMedium(p);
+                MediumInteraction intr(pRender, -Normalize(rRender.d), rRender.time,
+                                       sigmap_a, sigmap_s, sigma_maj, Le, this, &phase);
+                if (!callback(MediumSample(intr, Tmaj)))
+                    return false;
+
+                // Update _t0_ after medium interaction
+                t0 = t;
             }
+        };
 
-            // Advance to next voxel in maximum density grid
-            if (nextCrossingT[stepAxis] > tMax)
-                break;
-            voxel[stepAxis] += step[stepAxis];
-            if (voxel[stepAxis] == voxelLimit[stepAxis])
-                break;
-            nextCrossingT[stepAxis] += deltaT[stepAxis];
-            t0 = t1;
-        }
+        // Walk ray through majorant grid and sample scattering
+        Vector3f diag = mediumBounds.Diagonal();
+        Point3f oGrid(mediumBounds.Offset(ray.o));
+        Vector3f dGrid(ray.d.x / diag.x, ray.d.y / diag.y, ray.d.z / diag.z);
+        Point3i res = majorantGrid.Resolution();
+        auto sampleCell = [&](Point3i voxel, Float t0, Float t1) {
+            const Float *block = majorantGrid.RefinedBlock(voxel);
+            if (!block)
+                return sampleSegment(majorantGrid.Lookup(voxel), t0, t1);
+            // Walk ray through refined majorants for _voxel_
+            int r = majorantGrid.RefineResolution();
+            Point3f oBlock(oGrid.x * res.x - voxel.x, oGrid.y * res.y - voxel.y,
+                           oGrid.z * res.z - voxel.z);
+            Vector3f dBlock(dGrid.x * res.x, dGrid.y * res.y, dGrid.z * res.z);
+            auto sampleRefined = [&](Point3i v, Float tv0, Float tv1) {
+                return sampleSegment(block[v.x + r * (v.y + r * v.z)], tv0, tv1);
+            };
+            return TraverseGrid(oBlock, dBlock, t0, t1, Point3i(r, r, r), sampleRefined);
+        };
+        TraverseGrid(oGrid, dGrid, tMin, tMax, res, sampleCell);
 
         return TmajAccum;
     }
@@ -333,8 +430,7 @@ class CuboidMedium {
     Float sigScale;
     HGPhaseFunction phase;
     Transform renderFromMedium;
-    pstd::vector<Float> maxDensityGrid;
-    Point3i gridResolution;
+    MajorantGrid majorantGrid;
 };
 
 // UniformGridMediumProvider Definition
@@ -357,6 +453,11 @@ class UniformGridMediumProvider {
 
     bool IsEmissive() const { return Le_spec.MaxValue() > 0; }
 
+    // Lookups don't need any per-ray state, so the provider is its own accessor
+    using Accessor = const UniformGridMediumProvider &;
+    PBRT_CPU_GPU
+    Accessor GetAccessor() const { return *this; }
+
     PBRT_CPU_GPU
     SampledSpectrum Le(Point3f p, const SampledWavelengths &lambda) const {
         Point3f pp = Point3f(bounds.Offset(p));
@@ -374,11 +475,15 @@ class UniformGridMediumProvider {
             });
     }
 
-    pstd::vector<Float> GetMaxDensityGrid(Allocator alloc, Point3i *res) const {
-        // Set _gridResolution_ and allocate _maxGrid_
-        *res = Point3i(16, 16, 16);
-        pstd::vector<Float> maxGrid(alloc);
-        maxGrid.resize(res->x * res->y * res->z);
+    MajorantGrid GetMajorantGrid(Allocator alloc) const {
+        // Choose refinement so that refined cells approach the density grid's voxels
+        Point3i res(16, 16, 16);
+        int gridRes = densityGrid ? std::max({densityGrid->xSize(), densityGrid->ySize(),
+                                              densityGrid->zSize()})
+                                  : std::max({rgbDensityGrid->xSize(),
+                                              rgbDensityGrid->ySize(),
+                                              rgbDensityGrid->zSize()});
+        int refineRes = Clamp((gridRes + res.x - 1) / res.x, 1, 8);
 
         // Define _getMaxDensity_ lambda
         auto getMaxDensity = [&](const Bounds3f &bounds) -> Float {
@@ -390,18 +495,7 @@ class UniformGridMediumProvider {
                     [] PBRT_CPU_GPU(RGBUnboundedSpectrum s) { return s.MaxValue(); });
         };
 
-        // Compute maximum density for each _maxGrid_ cell
-        int offset = 0;
-        for (Float z = 0; z < res->z; ++z)
-            for (Float y = 0; y < res->y; ++y)
-                for (Float x = 0; x < res->x; ++x) {
-                    Bounds3f bounds(
-                        Point3f(x / res->x, y / res->y, z / res->z),
-                        Point3f((x + 1) / res->x, (y + 1) / res->y, (z + 1) / res->z));
-                    maxGrid[offset++] = getMaxDensity(bounds);
-                }
-
-        return maxGrid;
+        return MajorantGrid(res, refineRes, getMaxDensity, alloc);
     }
 
   private:
@@ -437,6 +531,10 @@ class CloudMediumProvider {
     PBRT_CPU_GPU
     bool IsEmissive() const { return false; }
 
+    using Accessor = const CloudMediumProvider &;
+    PBRT_CPU_GPU
+    Accessor GetAccessor() const { return *this; }
+
     PBRT_CPU_GPU
     SampledSpectrum Le(Point3f p, const SampledWavelengths &lambda) const {
         return SampledSpectrum(0.f);
@@ -469,9 +567,9 @@ class CloudMediumProvider {
         return SampledSpectrum(Clamp(d, 0, 1));
     }
 
-    pstd::vector<Float> GetMaxDensityGrid(Allocator alloc, Point3i *res) const {
-        *res = Point3i(1, 1, 1);
-        return pstd::vector<Float>(1, 1.f, alloc);
+    MajorantGrid GetMajorantGrid(Allocator alloc) const {
+        return MajorantGrid(Point3i(1, 1, 1), 1, [](const Bounds3f &) { return 1.f; },
+                            alloc);
     }
 
   private:
@@ -554,6 +652,49 @@ class NanoVDBBuffer {
     uint8_t *ptr = nullptr;
 };
 
+// NanoVDBStencilSampler Definition
+// Trilinearly interpolates a NanoVDB float grid through a ReadAccessor,
+// which caches the path to the most recently visited leaf node, and keeps
+// the last 2x2x2 stencil of voxel values so that repeated lookups in the
+// same voxel don't touch the tree at all.
+class NanoVDBStencilSampler {
+  public:
+    PBRT_CPU_GPU
+    NanoVDBStencilSampler(const nanovdb::FloatGrid *grid)
+        : accessor(grid->getAccessor()) {}
+
+    PBRT_CPU_GPU
+    Float operator()(nanovdb::Vec3<float> pIndex) {
+        // Compute voxel coordinates and offsets for _pIndex_
+        nanovdb::Coord ijk(int(std::floor(pIndex[0])), int(std::floor(pIndex[1])),
+                           int(std::floor(pIndex[2])));
+        Float dx = pIndex[0] - ijk[0], dy = pIndex[1] - ijk[1], dz = pIndex[2] - ijk[2];
+
+        // Fetch the voxel values around _ijk_ if they aren't already cached
+        if (!stencilValid || ijk != stencilOrigin) {
+            for (int i = 0; i < 8; ++i)
+                stencil[i] = accessor.getValue(nanovdb::Coord(
+                    ijk[0] + (i & 1), ijk[1] + ((i >> 1) & 1), ijk[2] + (i >> 2)));
+            stencilOrigin = ijk;
+            stencilValid = true;
+        }
+
+        // Return trilinearly interpolated stencil values
+        Float d00 = Lerp(dx, stencil[0], stencil[1]);
+        Float d10 = Lerp(dx, stencil[2], stencil[3]);
+        Float d01 = Lerp(dx, stencil[4], stencil[5]);
+        Float d11 = Lerp(dx, stencil[6], stencil[7]);
+        return Lerp(dz, Lerp(dy, d00, d10), Lerp(dy, d01, d11));
+    }
+
+  private:
+    // NanoVDBStencilSampler Private Members
+    nanovdb::FloatGrid::AccessorType accessor;
+    nanovdb::Coord stencilOrigin;
+    bool stencilValid = false;
+    Float stencil[8];
+};
+
 class NanoVDBMediumProvider {
   public:
     // NanoVDBMediumProvider Public Methods
@@ -562,20 +703,31 @@ class NanoVDBMediumProvider {
 
     std::string ToString() const {
         return StringPrintf("[ NanoVDBMediumProvider bounds: %s LeScale: %f "
-                            "temperatureCutoff: %f temperatureScale: %f (grids elided) ]",
-                            bounds, LeScale, temperatureCutoff, temperatureScale);
+                            "temperatureCutoff: %f temperatureScale: %f lodFactor: %d "
+                            "(grids elided) ]",
+                            bounds, LeScale, temperatureCutoff, temperatureScale,
+                            lodFactor);
     }
 
+    // If _lodFactor_ is greater than one, the medium is represented by the
+    // given downsampled LOD grids rather than by NanoVDB grids.
     NanoVDBMediumProvider(const Bounds3f &bounds, nanovdb::GridHandle<NanoVDBBuffer> dg,
-                          nanovdb::GridHandle<NanoVDBBuffer> tg, Float LeScale,
-                          Float temperatureCutoff, Float temperatureScale)
+                          nanovdb::GridHandle<NanoVDBBuffer> tg,
+                          pstd::optional<SampledGrid<Float>> lodDensity,
+                          pstd::optional<SampledGrid<Float>> lodTemperature,
+                          int lodFactor, Float LeScale, Float temperatureCutoff,
+                          Float temperatureScale)
         : bounds(bounds),
           densityGrid(std::move(dg)),
           temperatureGrid(std::move(tg)),
+          lodDensityGrid(std::move(lodDensity)),
+          lodTemperatureGrid(std::move(lodTemperature)),
+          lodFactor(lodFactor),
           LeScale(LeScale),
           temperatureCutoff(temperatureCutoff),
           temperatureScale(temperatureScale) {
-        densityFloatGrid = densityGrid.grid<float>();
+        if (densityGrid)
+            densityFloatGrid = densityGrid.grid<float>();
         if (temperatureGrid) {
             temperatureFloatGrid = temperatureGrid.grid<float>();
             Float minTemperature, maxTemperature;
@@ -587,48 +739,88 @@ class NanoVDBMediumProvider {
     PBRT_CPU_GPU
     const Bounds3f &Bounds() const { return bounds; }
 
-    bool IsEmissive() const { return temperatureFloatGrid != nullptr && LeScale > 0; }
+    bool IsEmissive() const {
+        return (temperatureFloatGrid != nullptr || lodTemperatureGrid) && LeScale > 0;
+    }
+
+    // NanoVDBMediumProvider::Accessor Definition
+    // An _Accessor_ holds cached NanoVDB tree traversal state for the
+    // spatially coherent lookups made while sampling a single ray.
+    class Accessor {
+      public:
+        PBRT_CPU_GPU
+        Accessor(const NanoVDBMediumProvider *provider) : provider(provider) {
+            if (provider->densityFloatGrid)
+                density = NanoVDBStencilSampler(provider->densityFloatGrid);
+            if (provider->temperatureFloatGrid)
+                temperature = NanoVDBStencilSampler(provider->temperatureFloatGrid);
+        }
+
+        PBRT_CPU_GPU
+        SampledSpectrum Density(const Point3f &p, const SampledWavelengths &lambda) {
+            if (provider->lodDensityGrid) {
+                Point3f pp(provider->bounds.Offset(p));
+                return SampledSpectrum(provider->lodDensityGrid->Lookup(pp));
+            }
+            return SampledSpectrum((*density)(provider->IndexPoint(p)));
+        }
+
+        PBRT_CPU_GPU
+        SampledSpectrum Le(const Point3f &p, const SampledWavelengths &lambda) {
+            Float temp;
+            if (provider->lodTemperatureGrid)
+                temp = provider->lodTemperatureGrid->Lookup(
+                    Point3f(provider->bounds.Offset(p)));
+            else if (temperature)
+                temp = (*temperature)(provider->IndexPoint(p));
+            else
+                return SampledSpectrum(0.f);
+            temp = (temp - provider->temperatureCutoff) * provider->temperatureScale;
+            if (temp <= 100.f)
+                return SampledSpectrum(0.f);
+            return provider->LeScale * BlackbodySpectrum(temp).Sample(lambda);
+        }
+
+      private:
+        const NanoVDBMediumProvider *provider;
+        pstd::optional<NanoVDBStencilSampler> density, temperature;
+    };
+
+    PBRT_CPU_GPU
+    Accessor GetAccessor() const { return Accessor(this); }
 
     PBRT_CPU_GPU
     SampledSpectrum Le(const Point3f &p, const SampledWavelengths &lambda) const {
-        if (!temperatureFloatGrid)
-            return SampledSpectrum(0.f);
-        nanovdb::Vec3<float> pIndex =
-            densityFloatGrid->worldToIndexF(nanovdb::Vec3<float>(p.x, p.y, p.z));
-        using Sampler = nanovdb::SampleFromVoxels<nanovdb::FloatGrid::TreeType, 1, false>;
-        Float temp = Sampler(temperatureFloatGrid->tree())(pIndex);
-        temp = (temp - temperatureCutoff) * temperatureScale;
-        if (temp <= 100.f)
-            return SampledSpectrum(0.f);
-        return LeScale * BlackbodySpectrum(temp).Sample(lambda);
-    }
-
-    pstd::vector<Float> GetMaxDensityGrid(Allocator alloc, Point3i *res) const {
-#if 0
-    // For debugging: single, medium-wide majorant...
-    *res = Point3i(1, 1, 1);
-    Float minDensity, maxDensity;
-    densityFloatGrid->tree().extrema(minDensity, maxDensity);
-    return pstd::vector<Float>(1, maxDensity, alloc);
-#else
-        *res = Point3i(64, 64, 64);
+        return GetAccessor().Le(p, lambda);
+    }
 
-        LOG_VERBOSE("Starting nanovdb grid GetMaxDensityGrid()");
+    MajorantGrid GetMajorantGrid(Allocator alloc) const {
+        if (lodDensityGrid) {
+            // Compute majorants from the LOD density grid
+            Point3i res(16, 16, 16);
+            int gridRes = std::max({lodDensityGrid->xSize(), lodDensityGrid->ySize(),
+                                    lodDensityGrid->zSize()});
+            int refineRes = Clamp((gridRes + res.x - 1) / res.x, 1, 8);
+            return MajorantGrid(
+                res, refineRes,
+                [&](const Bounds3f &b) { return lodDensityGrid->MaxValue(b); }, alloc);
+        }
 
-        pstd::vector<Float> maxGrid(res->x * res->y * res->z, 0.f, alloc);
+        // Match majorant grid levels to NanoVDB's lower internal and leaf nodes
+        auto bbox = densityFloatGrid->indexBBox();
+        constexpr int lowerDim = nanovdb::NanoLower<float>::DIM;
+        constexpr int leafDim = nanovdb::NanoLeaf<float>::DIM;
+        Point3i res;
+        for (int axis = 0; axis < 3; ++axis) {
+            int extent = bbox.max()[axis] - bbox.min()[axis] + 1;
+            res[axis] = Clamp((extent + lowerDim - 1) / lowerDim, 1, 16);
+        }
 
-        ParallelFor(0, maxGrid.size(), [&](size_t index) {
-            // Indices into maxGrid
-            int x = index % res->x;
-            int y = (index / res->x) % res->y;
-            int z = index / (res->x * res->y);
-            CHECK_EQ(index, x + res->x * (y + res->y * z));
+        LOG_VERBOSE("Starting nanovdb grid GetMajorantGrid() res %s", res);
 
-            // World (aka medium) space bounds of this max grid cell
-            Bounds3f wb(bounds.Lerp(Point3f(Float(x) / res->x, Float(y) / res->y,
-                                            Float(z) / res->z)),
-                        bounds.Lerp(Point3f(Float(x + 1) / res->x, Float(y + 1) / res->y,
-                                            Float(z + 1) / res->z)));
+        auto getMaxDensity = [&](const Bounds3f &b) -> Float {
+            // World (aka medium) space bounds of this majorant grid cell
+            Bounds3f wb(bounds.Lerp(b.pMin), bounds.Lerp(b.pMax));
 
             // Compute corresponding NanoVDB index-space bounds in floating-point.
             nanovdb::Vec3R i0 = densityFloatGrid->worldToIndexF(
@@ -638,7 +830,6 @@ class NanoVDBMediumProvider {
 
             // Now find integer index-space bounds, accounting for both
             // filtering and the overall index bounding box.
-            auto bbox = densityFloatGrid->indexBBox();
             Float delta = 1.f;  // Filter slop
             int nx0 = std::max(int(i0[0] - delta), bbox.min()[0]);
             int nx1 = std::min(int(i1[0] + delta), bbox.max()[0]);
@@ -655,33 +846,34 @@ class NanoVDBMediumProvider {
                 for (int ny = ny0; ny <= ny1; ++ny)
                     for (int nx = nx0; nx <= nx1; ++nx)
                         maxValue = std::max(maxValue, accessor.getValue({nx, ny, nz}));
+            return maxValue;
+        };
 
-            // Only write into maxGrid once when we're done to minimize
-            // cache thrashing..
-            maxGrid[index] = maxValue;
-        });
-
-        LOG_VERBOSE("Finished nanovdb grid GetMaxDensityGrid()");
-        return maxGrid;
-#endif
+        MajorantGrid grid(res, lowerDim / leafDim, getMaxDensity, alloc);
+        LOG_VERBOSE("Finished nanovdb grid GetMajorantGrid()");
+        return grid;
     }
 
     PBRT_CPU_GPU
     SampledSpectrum Density(const Point3f &p, const SampledWavelengths &lambda) const {
-        nanovdb::Vec3<float> pIndex =
-            densityFloatGrid->worldToIndexF(nanovdb::Vec3<float>(p.x, p.y, p.z));
-        using Sampler = nanovdb::SampleFromVoxels<nanovdb::FloatGrid::TreeType, 1, false>;
-        Float density = Sampler(densityFloatGrid->tree())(pIndex);
-        return SampledSpectrum(density);
+        return GetAccessor().Density(p, lambda);
     }
 
   private:
+    // NanoVDBMediumProvider Private Methods
+    PBRT_CPU_GPU
+    nanovdb::Vec3<float> IndexPoint(const Point3f &p) const {
+        return densityFloatGrid->worldToIndexF(nanovdb::Vec3<float>(p.x, p.y, p.z));
+    }
+
     // NanoVDBMediumProvider Private Members
     Bounds3f bounds;
     nanovdb::GridHandle<NanoVDBBuffer> densityGrid;
     nanovdb::GridHandle<NanoVDBBuffer> temperatureGrid;
     const nanovdb::FloatGrid *densityFloatGrid = nullptr;
     const nanovdb::FloatGrid *temperatureFloatGrid = nullptr;
+    pstd::optional<SampledGrid<Float>> lodDensityGrid, lodTemperatureGrid;
+    int lodFactor = 1;
     Float LeScale, temperatureCutoff, temperatureScale;
 };
 
@@ -703,10 +895,24 @@ inline Float PhaseFunctionHandle::PDF(Vector3f wo, Vector3f wi) const {
 
 template <typename F>
 SampledSpectrum MediumHandle::SampleTmaj(Ray ray, Float tMax, Float u, RNG &rng,
-                                         const SampledWavelengths &lambda, F func) const {
+                                         const SampledWavelengths &lambda, F func,
+                                         int maxSegments, Float *tResume) const {
+#ifdef PBRT_IS_GPU_CODE
     auto sampletn = [&](auto ptr) {
-        return ptr->SampleTmaj(ray, tMax, u, rng, lambda, func);
+        return ptr->SampleTmaj(ray, tMax, u, rng, lambda, func, maxSegments, tResume);
     };
+#else
+    // Count the steps taken through the medium for the "cost" AOV
+    auto countStep = [&](const MediumSample &ms) {
+        if (countTraversalSteps)
+            ++threadWorkCounters.mediumSteps;
+        return func(ms);
+    };
+    auto sampletn = [&](auto ptr) {
+        return ptr->SampleTmaj(ray, tMax, u, rng, lambda, countStep, maxSegments,
+                               tResume);
+    };
+#endif
     return Dispatch(sampletn);
 }
 
@@ -96,3 +96,74 @@ TEST(HenyeyGreenstein, g) {
         EXPECT_NEAR(g, gEst, .01);
     }
 }
+
+TEST(MajorantGrid, RefineVaryingCells) {
+    // Density is one in the corner [0,1/8]^3 and zero elsewhere.
+    auto maxDensity = [](const Bounds3f &b) -> Float {
+        return (b.pMin.x < 0.125f && b.pMin.y < 0.125f && b.pMin.z < 0.125f) ? 1 : 0;
+    };
+    MajorantGrid grid(Point3i(2, 2, 2), 4, maxDensity, Allocator());
+
+    // Only the cell containing the corner should be refined.
+    const Float *block = grid.RefinedBlock(Point3i(0, 0, 0));
+    ASSERT_TRUE(block != nullptr);
+    EXPECT_EQ(1, grid.Lookup(Point3i(0, 0, 0)));
+    EXPECT_EQ(1, block[0]);
+    EXPECT_EQ(0, block[1]);
+    EXPECT_EQ(0, block[4 * 4 * 4 - 1]);
+
+    EXPECT_TRUE(grid.RefinedBlock(Point3i(1, 0, 0)) == nullptr);
+    EXPECT_EQ(0, grid.Lookup(Point3i(1, 1, 1)));
+}
+
+TEST(MajorantGrid, TraverseCoversRay) {
+    RNG rng;
+    for (int i = 0; i < 100; ++i) {
+        Point3f o(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        Vector3f d =
+            SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()});
+        Float tMin = 0, tMax;
+        ASSERT_TRUE(Bounds3f(Point3f(0, 0, 0), Point3f(1, 1, 1))
+                        .IntersectP(o, d, Infinity, nullptr, &tMax));
+
+        // Voxel ranges should be contiguous and contain the ray's points.
+        Float tPrev = tMin;
+        Point3i res(5, 3, 7);
+        TraverseGrid(o, d, tMin, tMax, res, [&](Point3i v, Float t0, Float t1) {
+            EXPECT_EQ(tPrev, t0);
+            EXPECT_LE(t0, t1);
+            Point3f p = o + (t0 + t1) / 2 * d;
+            for (int axis = 0; axis < 3; ++axis)
+                EXPECT_EQ(v[axis], int(Clamp(p[axis] * res[axis], 0, res[axis] - 1)));
+            tPrev = t1;
+            return true;
+        });
+        EXPECT_NEAR(tMax, tPrev, 1e-4f);
+    }
+}
+
+TEST(HomogeneousMedium, TrMatchesSampleTmaj) {
+    ConstantSpectrum sigma_a(0.25f), sigma_s(0.5f), Le(0.f);
+    HomogeneousMedium medium(&sigma_a, &sigma_s, 2.f, &Le, 0.f, 0.f, Allocator());
+    SampledWavelengths lambda = SampledWavelengths::SampleUniform(0.5f);
+    Ray ray(Point3f(0, 0, 0), Vector3f(0, 2, 0));
+    Float tMax = 0.75f;
+
+    // The closed-form transmittance should match exp(-sigma_t d) and the
+    // probability of _SampleTmaj()_ reaching _tMax_ without an event.
+    SampledSpectrum Tr = medium.Tr(ray, tMax, lambda);
+    EXPECT_NEAR(std::exp(-1.5f * 2 * tMax), Tr[0], 1e-3f);
+
+    RNG rng;
+    int n = 100000, escaped = 0;
+    for (int i = 0; i < n; ++i) {
+        bool scattered = false;
+        medium.SampleTmaj(ray, tMax, rng.Uniform<Float>(), rng, lambda,
+                          [&](const MediumSample &) {
+                              scattered = true;
+                              return false;
+                          });
+        escaped += !scattered;
+    }
+    EXPECT_NEAR(Tr[0], Float(escaped) / n, 0.01f);
+}
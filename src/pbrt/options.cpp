@@ -16,14 +16,43 @@ __constant__ BasicPBRTOptions OptionsGPU;
 
 std::string PBRTOptions::ToString() const {
     return StringPrintf(
-        "[ PBRTOptions nThreads: %d seed: %d quickRender: %s quiet: %s "
-        "recordPixelStatistics: %s upgrade: %s disablePixelJitter: %s "
+        "[ PBRTOptions nThreads: %d numa: %s seed: %d quickRender: %s preview: %s "
+        "quiet: %s "
+        "recordPixelStatistics: %s statsLevel: %s statsCategories: %s perfCounters: %s "
+        "statsJSONFile: %s progressRates: %s progressStream: %s "
+        "upgrade: %s "
+        "disablePixelJitter: %s "
         "disableWavelengthJitter: %s forceDiffuse: %s useGPU: %s "
-        "imageFile: %s mseReferenceImage: %s mseReferenceOutput: %s "
-        "debugStart: %s displayServer: %s cropWindow: %s pixelBounds: %s ]",
-        nThreads, seed, quickRender, quiet, recordPixelStatistics, upgrade,
-        disablePixelJitter, disableWavelengthJitter, forceDiffuse, useGPU, imageFile,
-        mseReferenceImage, mseReferenceOutput, debugStart, displayServer, cropWindow,
+        "gpuCount: %d gpuPaths: %d gpuDisableGraphs: %s gpuDisableMaterialSort: %s "
+        "gpuQueueStats: %s gpuCompressTextures: %s gpuCompactTextures: %s "
+        "imageFile: %s mseReferenceImage: %s "
+        "mseReferenceOutput: %s "
+        "debugStart: %s displayServer: %s traceFile: %s bvhCacheDirectory: %s "
+        "lightCacheDirectory: %s lensCacheDirectory: %s bssrdfCacheDirectory: %s "
+        "sharedCache: %s "
+        "entityStatsCount: %d entityStatsFile: %s "
+        "geometryBudgetMB: %d "
+        "textureBudgetMB: %d ptexCacheMB: %d ptexMaxFiles: %d memoryBudgets: %s "
+        "instanceIdentityTolerance: %f cullDistance: %f rasterPrimary: %s "
+        "checkpointInterval: %f resume: %s "
+        "adaptiveThreshold: %f "
+        "adaptiveMinSamples: %d timeLimit: %f targetError: %f "
+        "distributedDirectory: %s distributedCoordinator: %s "
+        "distributedSampleSplits: %d benchRays: %s benchRayCount: %d "
+        "benchRayTypes: %s cropWindow: %s pixelBounds: %s ]",
+        nThreads, numa, seed, quickRender, preview, quiet, recordPixelStatistics,
+        pbrt::ToString(statsLevel), statsCategories, perfCounters, statsJSONFile,
+        progressRates, progressStream, upgrade, disablePixelJitter,
+        disableWavelengthJitter, forceDiffuse, useGPU, gpuCount, gpuPaths,
+        gpuDisableGraphs, gpuDisableMaterialSort, gpuQueueStats, gpuCompressTextures,
+        gpuCompactTextures, imageFile, mseReferenceImage, mseReferenceOutput, debugStart,
+        displayServer, traceFile, bvhCacheDirectory, lightCacheDirectory,
+        lensCacheDirectory, bssrdfCacheDirectory, sharedCache, entityStatsCount,
+        entityStatsFile, geometryBudgetMB, textureBudgetMB, ptexCacheMB, ptexMaxFiles,
+        memoryBudgets, instanceIdentityTolerance, cullDistance, rasterPrimary,
+        checkpointInterval, resume, adaptiveThreshold, adaptiveMinSamples, timeLimit,
+        targetError, distributedDirectory, distributedCoordinator,
+        distributedSampleSplits, benchRays, benchRayCount, benchRayTypes, cropWindow,
         pixelBounds);
 }
 
@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/vecmath.h>
 
 #include <string>
@@ -30,20 +31,93 @@ struct BasicPBRTOptions {
 // PBRTOptions Definiton
 struct PBRTOptions : BasicPBRTOptions {
     int nThreads = 0;
+    bool numa = false;
     LogLevel logLevel = LogLevel::Error;
     bool writePartialImages = false;
+    // Seconds between render checkpoints; zero disables checkpointing.
+    Float checkpointInterval = 0;
+    bool resume = false;
+    // Relative error at which adaptive sampling stops sampling a pixel, once
+    // it has at least _adaptiveMinSamples_ samples; zero disables it.
+    Float adaptiveThreshold = 0;
+    int adaptiveMinSamples = 16;
+    // Rendering stops after the last wave of samples that is expected to
+    // finish within _timeLimit_ seconds, or once the mean relative error of
+    // the pixels is below _targetError_; zero disables either.
+    Float timeLimit = 0;
+    Float targetError = 0;
+    // Shared directory of a distributed render that this process is the
+    // coordinator of or a worker for, and the number of sample ranges that
+    // the coordinator splits each job's pixels' samples into.
+    std::string distributedDirectory;
+    bool distributedCoordinator = false;
+    int distributedSampleSplits = 1;
     bool recordPixelStatistics = false;
+    // Statistics to record and, if non-empty, the comma-separated categories
+    // of them to report.
+    StatsLevel statsLevel = StatsLevel::Full;
+    std::string statsCategories;
+    bool perfCounters = false;
+    std::string statsJSONFile;
+    bool progressRates = false;
+    std::string progressStream;
     pstd::optional<int> pixelSamples;
     pstd::optional<int> gpuDevice;
+    // Number of GPUs to render with; zero uses all of them.
+    int gpuCount = 1;
+    // Number of paths the GPU traces in parallel, which sets the size of its
+    // queues; zero chooses it based on the GPU's free memory.
+    int gpuPaths = 0;
+    bool gpuDisableGraphs = false;
+    bool gpuDisableMaterialSort = false;
+    // Record and report how full the GPU's work queues are.
+    bool gpuQueueStats = false;
+    bool gpuCompressTextures = false;
+    // Store 32-bit float image textures on the GPU as 8-bit sRGB or half
+    // float texels.
+    bool gpuCompactTextures = false;
     bool quickRender = false;
+    // Show reduced-resolution passes on the display server before rendering
+    // at full resolution.
+    bool preview = false;
     bool upgrade = false;
     std::string imageFile;
     std::string mseReferenceImage, mseReferenceOutput;
     std::string debugStart;
     std::string displayServer;
+    std::string traceFile;
+    std::string bvhCacheDirectory;
+    std::string lightCacheDirectory;
+    std::string lensCacheDirectory;
+    std::string bssrdfCacheDirectory;
+    // Set with --shared-cache, for which the caches are in a directory on
+    // a shared-memory file system that concurrent pbrt processes use;
+    // BVHs are then also used from the cache files that they are written to
+    // so that their nodes' memory is shared with the other processes.
+    bool sharedCache = false;
+    int entityStatsCount = 0;
+    std::string entityStatsFile;
+    int geometryBudgetMB = 0;
+    int textureBudgetMB = 0;
+    // Limits for the Ptex cache, which may be set with scene "Option"s.
+    int ptexCacheMB = 4096;
+    int ptexMaxFiles = 100;
+    std::string memoryBudgets;
+    Float instanceIdentityTolerance = 0;
+    // Shapes that are farther than _cullDistance_ from everything the camera
+    // sees aren't rendered; zero disables culling.
+    Float cullDistance = 0;
+    // Find camera rays' first intersections by rasterizing the scene's
+    // triangles rather than by tracing the rays.
+    bool rasterPrimary = false;
     pstd::optional<Bounds2f> cropWindow;
     pstd::optional<Bounds2i> pixelBounds;
     pstd::optional<Point2i> pixelMaterial;
+    // Rather than rendering, trace _benchRayCount_ rays of each of the
+    // comma-separated _benchRayTypes_ and report the accelerator's speed.
+    bool benchRays = false;
+    int benchRayCount = 1 << 20;
+    std::string benchRayTypes = "camera,surface,shadow";
 
     std::string ToString() const;
 };
@@ -11,6 +11,7 @@
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
@@ -156,20 +157,22 @@ constexpr char ParameterTypeTraits<ParameterType::String>::typeName[];
 
 ParameterDictionary::ParameterDictionary(ParsedParameterVector p,
                                          const RGBColorSpace *colorSpace)
-    : params(std::move(p)), colorSpace(colorSpace) {
+    : params(std::move(p)), nOwned(params.size()), colorSpace(colorSpace) {
     std::reverse(params.begin(), params.end());
     CHECK(colorSpace != nullptr);
     checkParameterTypes();
+    buildIndex();
 }
 
 ParameterDictionary::ParameterDictionary(ParsedParameterVector p0,
                                          const ParsedParameterVector &params1,
                                          const RGBColorSpace *colorSpace)
-    : params(std::move(p0)), colorSpace(colorSpace) {
+    : params(std::move(p0)), nOwned(params.size()), colorSpace(colorSpace) {
     std::reverse(params.begin(), params.end());
     CHECK(colorSpace != nullptr);
     params.insert(params.end(), params1.rbegin(), params1.rend());
     checkParameterTypes();
+    buildIndex();
 }
 
 void ParameterDictionary::checkParameterTypes() {
@@ -188,6 +191,28 @@ void ParameterDictionary::checkParameterTypes() {
             ErrorExit(&p->loc, "%s: unknown parameter type", p->type);
 }
 
+uint64_t ParameterDictionary::hashName(const std::string &name) {
+    return HashBuffer(name.data(), name.size());
+}
+
+void ParameterDictionary::buildIndex() {
+    nameHashes.resize(params.size());
+    for (size_t i = 0; i < params.size(); ++i)
+        nameHashes[i] = hashName(params[i]->name);
+}
+
+int ParameterDictionary::findParameter(const std::string &name, const char *typeName,
+                                       int start) const {
+    // Returns the index of the first parameter at or after _start_ with the
+    // given name and, if _typeName_ is non-null, type; -1 if there is none.
+    uint64_t hash = hashName(name);
+    for (int i = start; i < int(params.size()); ++i)
+        if (nameHashes[i] == hash && params[i]->name == name &&
+            (!typeName || params[i]->type == typeName))
+            return i;
+    return -1;
+}
+
 // ParameterDictionary Method Definitions
 Point3f ParameterDictionary::GetOnePoint3f(const std::string &name,
                                            const Point3f &def) const {
@@ -200,9 +225,8 @@ typename ParameterTypeTraits<PT>::ReturnType ParameterDictionary::lookupSingle(
     typename ParameterTypeTraits<PT>::ReturnType defaultValue) const {
     // Search _params_ for parameter _name_
     using traits = ParameterTypeTraits<PT>;
-    for (const ParsedParameter *p : params) {
-        if (p->name != name || p->type != traits::typeName)
-            continue;
+    if (int index = findParameter(name, traits::typeName); index != -1) {
+        const ParsedParameter *p = params[index];
         // Extract parameter values from _p_
         const auto &values = traits::GetValues(*p);
 
@@ -257,10 +281,9 @@ SpectrumHandle ParameterDictionary::GetOneSpectrum(const std::string &name,
                                                    SpectrumHandle defaultValue,
                                                    SpectrumType spectrumType,
                                                    Allocator alloc) const {
-    for (const ParsedParameter *p : params) {
-        if (p->name != name)
-            continue;
-
+    for (int i = findParameter(name, nullptr); i != -1;
+         i = findParameter(name, nullptr, i + 1)) {
+        const ParsedParameter *p = params[i];
         std::vector<SpectrumHandle> s = extractSpectrumArray(*p, spectrumType, alloc);
         if (!s.empty()) {
             if (s.size() > 1)
@@ -302,9 +325,9 @@ std::vector<ReturnType> ParameterDictionary::lookupArray(const std::string &name
                                                          const char *typeName,
                                                          int nPerItem, G getValues,
                                                          C convert) const {
-    for (const ParsedParameter *p : params)
-        if (p->name == name && p->type == typeName)
-            return returnArray<ReturnType>(getValues(*p), *p, nPerItem, convert);
+    if (int index = findParameter(name, typeName); index != -1)
+        return returnArray<ReturnType>(getValues(*params[index]), *params[index],
+                                       nPerItem, convert);
 
     return {};
 }
@@ -439,10 +462,9 @@ std::vector<SpectrumHandle> ParameterDictionary::extractSpectrumArray(
 
 std::vector<SpectrumHandle> ParameterDictionary::GetSpectrumArray(
     const std::string &name, SpectrumType spectrumType, Allocator alloc) const {
-    for (const ParsedParameter *p : params) {
-        if (p->name != name)
-            continue;
-
+    for (int i = findParameter(name, nullptr); i != -1;
+         i = findParameter(name, nullptr, i + 1)) {
+        const ParsedParameter *p = params[i];
         std::vector<SpectrumHandle> s = extractSpectrumArray(*p, spectrumType, alloc);
         if (!s.empty())
             return s;
@@ -456,10 +478,8 @@ std::vector<std::string> ParameterDictionary::GetStringArray(
 }
 
 std::string ParameterDictionary::GetTexture(const std::string &name) const {
-    for (const ParsedParameter *p : params) {
-        if (p->name != name || p->type != "texture")
-            continue;
-
+    if (int index = findParameter(name, "texture"); index != -1) {
+        const ParsedParameter *p = params[index];
         if (p->strings.empty())
             ErrorExit(&p->loc, "No string values provided for parameter \"%s\".", name);
         if (p->strings.size() > 1)
@@ -473,56 +493,66 @@ std::string ParameterDictionary::GetTexture(const std::string &name) const {
 }
 
 std::vector<RGB> ParameterDictionary::GetRGBArray(const std::string &name) const {
-    for (const ParsedParameter *p : params) {
-        if (p->name == name && p->type == "rgb") {
-            if (p->numbers.size() % 3)
-                ErrorExit(&p->loc, "Number of values given for \"rgb\" parameter %d "
-                                   "\"name\" isn't a multiple of 3.");
+    if (int index = findParameter(name, "rgb"); index != -1) {
+        const ParsedParameter *p = params[index];
+        if (p->numbers.size() % 3)
+            ErrorExit(&p->loc, "Number of values given for \"rgb\" parameter %d "
+                               "\"name\" isn't a multiple of 3.");
 
-            std::vector<RGB> rgb(p->numbers.size() / 3);
-            for (int i = 0; i < p->numbers.size() / 3; ++i)
-                rgb[i] =
-                    RGB(p->numbers[3 * i], p->numbers[3 * i + 1], p->numbers[3 * i + 2]);
+        std::vector<RGB> rgb(p->numbers.size() / 3);
+        for (int i = 0; i < p->numbers.size() / 3; ++i)
+            rgb[i] = RGB(p->numbers[3 * i], p->numbers[3 * i + 1], p->numbers[3 * i + 2]);
 
-            p->lookedUp = true;
-            return rgb;
-        }
+        p->lookedUp = true;
+        return rgb;
     }
     return {};
 }
 
 pstd::optional<RGB> ParameterDictionary::GetOneRGB(const std::string &name) const {
-    for (const ParsedParameter *p : params) {
-        if (p->name == name && p->type == "rgb") {
-            if (p->numbers.size() < 3)
-                ErrorExit(&p->loc, "Insufficient values for \"rgb\" parameter \"%s\".",
-                          p->name);
-            return RGB(p->numbers[0], p->numbers[1], p->numbers[2]);
-        }
+    if (int index = findParameter(name, "rgb"); index != -1) {
+        const ParsedParameter *p = params[index];
+        if (p->numbers.size() < 3)
+            ErrorExit(&p->loc, "Insufficient values for \"rgb\" parameter \"%s\".",
+                      p->name);
+        return RGB(p->numbers[0], p->numbers[1], p->numbers[2]);
     }
     return {};
 }
 
 Float ParameterDictionary::UpgradeBlackbody(const std::string &name) {
     Float scale = 1;
-    for (ParsedParameter *p : params) {
-        if (p->name == name && p->type == "blackbody") {
-            if (p->numbers.size() != 2)
-                ErrorExit(&p->loc,
-                          "Expected two values for legacy \"blackbody\" parameter.");
-            scale *= p->numbers[1];
-            p->numbers.pop_back();
-        }
+    for (int i = findParameter(name, "blackbody"); i != -1;
+         i = findParameter(name, "blackbody", i + 1)) {
+        ParsedParameter *p = params[i];
+        if (p->numbers.size() != 2)
+            ErrorExit(&p->loc, "Expected two values for legacy \"blackbody\" parameter.");
+        scale *= p->numbers[1];
+        p->numbers.pop_back();
     }
     return scale;
 }
 
 void ParameterDictionary::remove(const std::string &name, const char *typeName) {
-    for (auto iter = params.begin(); iter != params.end(); ++iter)
-        if ((*iter)->name == name && (*iter)->type == typeName) {
-            params.erase(iter);
-            return;
+    if (int index = findParameter(name, typeName); index != -1) {
+        if (index < nOwned) {
+            Allocator alloc(params[index]->numbers.get_allocator().resource());
+            alloc.delete_object(params[index]);
+            --nOwned;
         }
+        params.erase(params.begin() + index);
+        nameHashes.erase(nameHashes.begin() + index);
+    }
+}
+
+void ParameterDictionary::FreeParameters() {
+    for (int i = 0; i < nOwned; ++i) {
+        Allocator alloc(params[i]->numbers.get_allocator().resource());
+        alloc.delete_object(params[i]);
+    }
+    params.clear();
+    nameHashes.clear();
+    nOwned = 0;
 }
 
 void ParameterDictionary::RemoveFloat(const std::string &name) {
@@ -573,9 +603,11 @@ void ParameterDictionary::RemoveSpectrum(const std::string &name) {
 
 void ParameterDictionary::RenameParameter(const std::string &before,
                                           const std::string &after) {
-    for (ParsedParameter *p : params)
-        if (p->name == before)
-            p->name = after;
+    for (int i = findParameter(before, nullptr); i != -1;
+         i = findParameter(before, nullptr, i + 1)) {
+        params[i]->name = after;
+        nameHashes[i] = hashName(after);
+    }
 }
 
 void ParameterDictionary::RenameUsedTextures(
@@ -592,24 +624,25 @@ void ParameterDictionary::RenameUsedTextures(
 }
 
 void ParameterDictionary::ReportUnused() const {
-    // type / name
-    InlinedVector<std::pair<const std::string *, const std::string *>, 16> seen;
+    // Indices into _params_ of the used type / name pairs
+    InlinedVector<int, 16> seen;
 
-    for (const ParsedParameter *p : params) {
+    for (int i = 0; i < int(params.size()); ++i) {
+        const ParsedParameter *p = params[i];
         if (p->mayBeUnused)
             continue;
 
-        bool haveSeen =
-            std::find_if(seen.begin(), seen.end(),
-                         [&p](std::pair<const std::string *, const std::string *> p2) {
-                             return *p2.first == p->type && *p2.second == p->name;
-                         }) != seen.end();
+        bool haveSeen = std::find_if(seen.begin(), seen.end(), [&](int j) {
+                            return nameHashes[j] == nameHashes[i] &&
+                                   params[j]->name == p->name &&
+                                   params[j]->type == p->type;
+                        }) != seen.end();
         if (p->lookedUp) {
             // A parameter may be used when creating an initial Material, say,
             // but then an override from a Shape may shadow it such that its
             // name is already in the seen array.
             if (!haveSeen)
-                seen.push_back(std::make_pair(&p->type, &p->name));
+                seen.push_back(i);
         } else if (haveSeen) {
             // It's shadowed by another parameter; that's fine.
         } else
@@ -617,19 +650,24 @@ void ParameterDictionary::ReportUnused() const {
     }
 }
 
-std::string ParameterDictionary::ToParameterDefinition(const ParsedParameter *p,
-                                                       int indentCount) {
-    std::string s = StringPrintf("\"%s %s\" [ ", p->type, p->name);
+// Passes the text of the given parameter's definition to _emit_ a piece at
+// a time, so that the definitions of parameters with many values can be
+// written out without being held in memory in their entirety.
+template <typename F>
+static void emitParameterDefinition(const ParsedParameter *p, int indentCount,
+                                    F emit) {
+    std::string start = StringPrintf("\"%s %s\" [ ", p->type, p->name);
+    emit(start);
     int continuationIndent = indentCount + 10 + p->type.size() + p->name.size();
-    int column = indentCount + 4 + s.size();
+    int column = indentCount + 4 + start.size();
     auto printOne = [&](const std::string &val) {
         if (column > 80) {  //   && i % 3 == 0) {
-            s += "\n";
-            s.append(continuationIndent, ' ');
+            emit("\n");
+            emit(std::string(continuationIndent, ' '));
             column = continuationIndent;
         }
         column += val.size();
-        s += val;
+        emit(val);
     };
 
     for (double v : p->numbers)
@@ -641,8 +679,13 @@ std::string ParameterDictionary::ToParameterDefinition(const ParsedParameter *p,
         printOne('"' + str + "\" ");
     for (bool b : p->bools)
         printOne(b ? "true " : "false ");
-    s += "]";
+    emit("]");
+}
 
+std::string ParameterDictionary::ToParameterDefinition(const ParsedParameter *p,
+                                                       int indentCount) {
+    std::string s;
+    emitParameterDefinition(p, indentCount, [&](const std::string &str) { s += str; });
     return s;
 }
 
@@ -657,10 +700,18 @@ std::string ParameterDictionary::ToParameterList(int indentCount) const {
     return s;
 }
 
+void ParameterDictionary::WriteParameterList(FILE *f, int indentCount) const {
+    for (const ParsedParameter *p : params) {
+        fprintf(f, "%*s", indentCount + 4, "");
+        emitParameterDefinition(p, indentCount,
+                                [&](const std::string &str) { fputs(str.c_str(), f); });
+        fputc('\n', f);
+    }
+}
+
 std::string ParameterDictionary::ToParameterDefinition(const std::string &name) const {
-    for (const ParsedParameter *p : params)
-        if (p->name == name)
-            return ToParameterDefinition(p, 0);
+    if (int index = findParameter(name, nullptr); index != -1)
+        return ToParameterDefinition(params[index], 0);
     return "";
 }
 
@@ -676,9 +727,8 @@ std::string ParameterDictionary::ToString() const {
 }
 
 const FileLoc *ParameterDictionary::loc(const std::string &name) const {
-    for (const ParsedParameter *p : params)
-        if (p->name == name)
-            return &p->loc;
+    if (int index = findParameter(name, nullptr); index != -1)
+        return &params[index]->loc;
     return nullptr;
 }
 
@@ -805,10 +855,9 @@ SpectrumTextureHandle TextureParameterDictionary::GetSpectrumTextureOrNull(
                                               ? textures->albedoSpectrumTextures
                                               : textures->illuminantSpectrumTextures);
 
-    for (const ParsedParameter *p : dict->params) {
-        if (p->name != name)
-            continue;
-
+    for (int i = dict->findParameter(name, nullptr); i != -1;
+         i = dict->findParameter(name, nullptr, i + 1)) {
+        const ParsedParameter *p = dict->params[i];
         if (p->type == "texture") {
             if (p->strings.empty())
                 ErrorExit(&p->loc, "No texture name provided for parameter \"%s\".",
@@ -870,10 +919,9 @@ FloatTextureHandle TextureParameterDictionary::GetFloatTexture(const std::string
 
 FloatTextureHandle TextureParameterDictionary::GetFloatTextureOrNull(
     const std::string &name, Allocator alloc) const {
-    for (const ParsedParameter *p : dict->params) {
-        if (p->name != name)
-            continue;
-
+    for (int i = dict->findParameter(name, nullptr); i != -1;
+         i = dict->findParameter(name, nullptr, i + 1)) {
+        const ParsedParameter *p = dict->params[i];
         if (p->type == "texture") {
             if (p->strings.empty())
                 ErrorExit(&p->loc, "No texture name provided for parameter \"%s\".",
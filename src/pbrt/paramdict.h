@@ -16,6 +16,7 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
+#include <cstdio>
 #include <limits>
 #include <map>
 #include <memory>
@@ -72,6 +73,7 @@ class ParameterDictionary {
     pstd::optional<RGB> GetOneRGB(const std::string &name) const;
     // Unfortunately, this is most easily done here...
     Float UpgradeBlackbody(const std::string &name);
+    // Removed parameters that are owned by the dictionary are freed.
     void RemoveFloat(const std::string &);
     void RemoveInt(const std::string &);
     void RemoveBool(const std::string &);
@@ -90,6 +92,9 @@ class ParameterDictionary {
     const RGBColorSpace *ColorSpace() const { return colorSpace; }
 
     std::string ToParameterList(int indent = 0) const;
+    // Equivalent to writing the result of ToParameterList() to _f_, but
+    // without building up the entire string first.
+    void WriteParameterList(FILE *f, int indent = 0) const;
     std::string ToParameterDefinition(const std::string &) const;
     std::string ToString() const;
 
@@ -127,6 +132,12 @@ class ParameterDictionary {
 
     void ReportUnused() const;
 
+    // Frees the parameters that were passed as the first vector to the
+    // constructor; the ones that were appended from the second vector may
+    // be shared with other dictionaries (as attributes are) and are left
+    // alone. The dictionary is empty afterward.
+    void FreeParameters();
+
   private:
     friend class TextureParameterDictionary;
     // ParameterDictionary Private Methods
@@ -148,12 +159,22 @@ class ParameterDictionary {
                                                      SpectrumType spectrumType,
                                                      Allocator alloc) const;
 
+    int findParameter(const std::string &name, const char *typeName,
+                      int start = 0) const;
+    static uint64_t hashName(const std::string &name);
+    void buildIndex();
+
     void remove(const std::string &name, const char *typeName);
     void checkParameterTypes();
     static std::string ToParameterDefinition(const ParsedParameter *p, int indentCount);
 
     // ParameterDictionary Private Members
     ParsedParameterVector params;
+    // Hashes of the parameter names, parallel to _params_; lookups compare
+    // these before falling back to string comparison.
+    InlinedVector<uint64_t, 8> nameHashes;
+    // The first _nOwned_ parameters are owned by this dictionary.
+    int nOwned = 0;
     const RGBColorSpace *colorSpace = nullptr;
 };
 
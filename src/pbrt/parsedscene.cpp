@@ -18,10 +18,27 @@
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/spectrum.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <mutex>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
@@ -72,6 +89,15 @@ ParsedScene::GraphicsState::GraphicsState() {
         return;                                                    \
     } else /* swallow trailing semicolon */
 
+#define VERIFY_NOT_IMPORTED(func)                                         \
+    if (importing) {                                                      \
+        ErrorExitDeferred(&loc,                                           \
+                          "\"%s\" is not allowed in imported files since " \
+                          "it would affect the importing file.",          \
+                          func);                                          \
+        return;                                                           \
+    } else /* swallow trailing semicolon */
+
 #define FOR_ACTIVE_TRANSFORMS(expr)                         \
     for (int i = 0; i < MaxTransforms; ++i)                 \
         if (graphicsState.activeTransformBits & (1 << i)) { \
@@ -79,39 +105,79 @@ ParsedScene::GraphicsState::GraphicsState() {
         }
 
 STAT_MEMORY_COUNTER("Memory/TransformCache", transformCacheBytes);
+STAT_MEMORY_COUNTER("Memory/TransformCache savings from sharing", transformCacheBytesSaved);
 STAT_PERCENT("Geometry/TransformCache hits", nTransformCacheHits, nTransformCacheLookups);
+STAT_COUNTER("Geometry/Near-identity instance transforms removed",
+             nNearIdentityInstanceTransforms);
 
 // TransformCache Method Definitions
+TransformCache::TransformCache() {
+    pstd::pmr::memory_resource *upstream =
+        Options->useGPU ? gpuMemoryAllocator.resource() : Allocator().resource();
+    for (int i = 0; i < NumShards; ++i)
+        shards[i] = std::make_unique<Shard>(upstream);
+}
+
 const Transform *TransformCache::Lookup(const Transform &t) {
     ++nTransformCacheLookups;
 
-    if (!hashTable.empty()) {
-        size_t offset = t.Hash() % hashTable.bucket_count();
-        for (auto iter = hashTable.begin(offset); iter != hashTable.end(offset); ++iter) {
+    uint64_t hash = t.Hash();
+    // The low bits of the hash select the bucket within the shard's table,
+    // so use the high ones to choose the shard.
+    Shard &shard = *shards[(hash >> 32) % NumShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (!shard.hashTable.empty()) {
+        size_t offset = hash % shard.hashTable.bucket_count();
+        for (auto iter = shard.hashTable.begin(offset);
+             iter != shard.hashTable.end(offset); ++iter) {
             if (**iter == t) {
                 ++nTransformCacheHits;
+                transformCacheBytesSaved += sizeof(Transform);
                 return *iter;
             }
         }
     }
-    Transform *tptr = alloc.new_object<Transform>(t);
+    Transform *tptr = shard.alloc.new_object<Transform>(t);
     transformCacheBytes += sizeof(Transform);
-    hashTable.insert(tptr);
+    shard.hashTable.insert(tptr);
     return tptr;
 }
 
-TransformCache::~TransformCache() {
-    for (const auto &iter : hashTable) {
-        Transform *tptr = iter;
-        alloc.delete_object(tptr);
+const Transform *TransformCache::LookupInstance(const Transform &t) {
+    Float tolerance = Options->instanceIdentityTolerance;
+    if (tolerance > 0 && !t.IsIdentity()) {
+        const SquareMatrix<4> &m = t.GetMatrix();
+        bool nearIdentity = true;
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                if (std::abs(m[i][j] - (i == j ? 1 : 0)) > tolerance)
+                    nearIdentity = false;
+        if (nearIdentity) {
+            ++nNearIdentityInstanceTransforms;
+            return Lookup(Transform());
+        }
     }
+    return Lookup(t);
+}
+
+TransformCache::~TransformCache() {
+    for (const auto &shard : shards)
+        for (Transform *tptr : shard->hashTable)
+            shard->alloc.delete_object(tptr);
 }
 
 STAT_COUNTER("Scene/Object instances created", nObjectInstancesCreated);
 STAT_COUNTER("Scene/Object instances used", nObjectInstancesUsed);
+STAT_COUNTER("Scene/Materials deduplicated", nMaterialsDeduplicated);
+STAT_COUNTER("Scene/Textures deduplicated", nTexturesDeduplicated);
+STAT_COUNTER("Scene/Unreferenced textures not created", nUnreachableTextures);
 
 // ParsedScene Method Definitions
 ParsedScene::ParsedScene() {
+    parameterArenas.push_back(
+        std::make_unique<ArenaMemoryResource>(ParsedParameterMemoryResource()));
+
     // Set scene defaults
     camera.name = "perspective";
     sampler.name = "pmj02bn";
@@ -125,6 +191,10 @@ ParsedScene::ParsedScene() {
     film.parameters = ParameterDictionary({}, RGBColorSpace::sRGB);
 }
 
+Allocator ParsedScene::ParameterAllocator() {
+    return Allocator(parameterArenas.front().get());
+}
+
 void ParsedScene::ReverseOrientation(FileLoc loc) {
     VERIFY_WORLD("ReverseOrientation");
     graphicsState.reverseOrientation = !graphicsState.reverseOrientation;
@@ -138,21 +208,23 @@ void ParsedScene::ColorSpace(const std::string &name, FileLoc loc) {
 }
 
 void ParsedScene::Identity(FileLoc loc) {
-    FOR_ACTIVE_TRANSFORMS(graphicsState.ctm[i] = pbrt::Transform();)
+    TransformSet &ctm = graphicsState.ctm.Mutable();
+    FOR_ACTIVE_TRANSFORMS(ctm[i] = pbrt::Transform();)
 }
 
 void ParsedScene::Translate(Float dx, Float dy, Float dz, FileLoc loc) {
-    FOR_ACTIVE_TRANSFORMS(graphicsState.ctm[i] = graphicsState.ctm[i] *
-                                                 pbrt::Translate(Vector3f(dx, dy, dz));)
+    TransformSet &ctm = graphicsState.ctm.Mutable();
+    FOR_ACTIVE_TRANSFORMS(ctm[i] = ctm[i] * pbrt::Translate(Vector3f(dx, dy, dz));)
 }
 
 void ParsedScene::CoordinateSystem(const std::string &name, FileLoc loc) {
-    namedCoordinateSystems[name] = graphicsState.ctm;
+    VERIFY_NOT_IMPORTED("CoordinateSystem");
+    namedCoordinateSystems[name] = *graphicsState.ctm;
 }
 
 void ParsedScene::CoordSysTransform(const std::string &name, FileLoc loc) {
     if (namedCoordinateSystems.find(name) != namedCoordinateSystems.end())
-        graphicsState.ctm = namedCoordinateSystems[name];
+        graphicsState.ctm.Set(namedCoordinateSystems[name]);
     else
         Warning(&loc, "Couldn't find named coordinate system \"%s\"", name);
 }
@@ -163,8 +235,8 @@ void ParsedScene::Camera(const std::string &name, ParsedParameterVector params,
 
     VERIFY_OPTIONS("Camera");
 
-    TransformSet cameraFromWorld = graphicsState.ctm;
-    TransformSet worldFromCamera = Inverse(graphicsState.ctm);
+    TransformSet cameraFromWorld = *graphicsState.ctm;
+    TransformSet worldFromCamera = Inverse(*graphicsState.ctm);
     namedCoordinateSystems["camera"] = Inverse(cameraFromWorld);
 
     CameraTransform cameraTransform(
@@ -173,7 +245,7 @@ void ParsedScene::Camera(const std::string &name, ParsedParameterVector params,
     renderFromWorld = cameraTransform.RenderFromWorld();
 
     camera = CameraSceneEntity(name, std::move(dict), loc, cameraTransform,
-                               graphicsState.currentOutsideMedium);
+                               *graphicsState.currentOutsideMedium);
 }
 
 void ParsedScene::AttributeBegin(FileLoc loc) {
@@ -205,15 +277,15 @@ void ParsedScene::Attribute(const std::string &target, ParsedParameterVector att
                             FileLoc loc) {
     ParsedParameterVector *currentAttributes = nullptr;
     if (target == "shape") {
-        currentAttributes = &graphicsState.shapeAttributes;
+        currentAttributes = &graphicsState.attributes.Mutable().shape;
     } else if (target == "light") {
-        currentAttributes = &graphicsState.lightAttributes;
+        currentAttributes = &graphicsState.attributes.Mutable().light;
     } else if (target == "material") {
-        currentAttributes = &graphicsState.materialAttributes;
+        currentAttributes = &graphicsState.attributes.Mutable().material;
     } else if (target == "medium") {
-        currentAttributes = &graphicsState.mediumAttributes;
+        currentAttributes = &graphicsState.attributes.Mutable().medium;
     } else if (target == "texture") {
-        currentAttributes = &graphicsState.textureAttributes;
+        currentAttributes = &graphicsState.attributes.Mutable().texture;
     } else {
         ErrorExitDeferred(
             &loc,
@@ -235,40 +307,39 @@ void ParsedScene::Attribute(const std::string &target, ParsedParameterVector att
 void ParsedScene::WorldBegin(FileLoc loc) {
     VERIFY_OPTIONS("WorldBegin");
     currentBlock = BlockState::WorldBlock;
-    for (int i = 0; i < MaxTransforms; ++i)
-        graphicsState.ctm[i] = pbrt::Transform();
+    graphicsState.ctm.Set(TransformSet());
     graphicsState.activeTransformBits = AllTransformsBits;
-    namedCoordinateSystems["world"] = graphicsState.ctm;
+    namedCoordinateSystems["world"] = *graphicsState.ctm;
 }
 
 void ParsedScene::LightSource(const std::string &name, ParsedParameterVector params,
                               FileLoc loc) {
     VERIFY_WORLD("LightSource");
-    ParameterDictionary dict(std::move(params), graphicsState.lightAttributes,
+    ParameterDictionary dict(std::move(params), graphicsState.attributes->light,
                              graphicsState.colorSpace);
     lights.push_back(LightSceneEntity(name, std::move(dict), loc, RenderFromObject(),
-                                      graphicsState.currentOutsideMedium));
+                                      *graphicsState.currentOutsideMedium));
 }
 
 void ParsedScene::Shape(const std::string &name, ParsedParameterVector params,
                         FileLoc loc) {
     VERIFY_WORLD("Shape");
 
-    ParameterDictionary dict(std::move(params), graphicsState.shapeAttributes,
+    ParameterDictionary dict(std::move(params), graphicsState.attributes->shape,
                              graphicsState.colorSpace);
 
     int areaLightIndex = -1;
-    if (!graphicsState.areaLightName.empty()) {
-        areaLights.push_back(SceneEntity(graphicsState.areaLightName,
-                                         graphicsState.areaLightParams,
-                                         graphicsState.areaLightLoc));
+    const GraphicsState::AreaLight &areaLight = *graphicsState.areaLight;
+    if (!areaLight.name.empty()) {
+        areaLights.push_back(
+            SceneEntity(areaLight.name, areaLight.parameters, areaLight.loc));
         areaLightIndex = areaLights.size() - 1;
     }
 
     if (CTMIsAnimated()) {
         std::vector<AnimatedShapeSceneEntity> *as = &animatedShapes;
         if (currentInstance != nullptr) {
-            if (!graphicsState.areaLightName.empty())
+            if (!areaLight.name.empty())
                 Warning(&loc, "Area lights not supported with object instancing");
             as = &currentInstance->animatedShapes;
         }
@@ -279,12 +350,12 @@ void ParsedScene::Shape(const std::string &name, ParsedParameterVector params,
         as->push_back(AnimatedShapeSceneEntity(
             {name, std::move(dict), loc, renderFromShape, identity,
              graphicsState.reverseOrientation, graphicsState.currentMaterialIndex,
-             graphicsState.currentMaterialName, areaLightIndex,
-             graphicsState.currentInsideMedium, graphicsState.currentOutsideMedium}));
+             *graphicsState.currentMaterialName, areaLightIndex,
+             *graphicsState.currentInsideMedium, *graphicsState.currentOutsideMedium}));
     } else {
         std::vector<ShapeSceneEntity> *s = &shapes;
         if (currentInstance != nullptr) {
-            if (!graphicsState.areaLightName.empty())
+            if (!areaLight.name.empty())
                 Warning(&loc, "Area lights not supported with object instancing");
             s = &currentInstance->shapes;
         }
@@ -297,8 +368,8 @@ void ParsedScene::Shape(const std::string &name, ParsedParameterVector params,
         s->push_back(ShapeSceneEntity(
             {name, std::move(dict), loc, renderFromObject, objectFromRender,
              graphicsState.reverseOrientation, graphicsState.currentMaterialIndex,
-             graphicsState.currentMaterialName, areaLightIndex,
-             graphicsState.currentInsideMedium, graphicsState.currentOutsideMedium}));
+             *graphicsState.currentMaterialName, areaLightIndex,
+             *graphicsState.currentInsideMedium, *graphicsState.currentOutsideMedium}));
     }
 }
 
@@ -368,13 +439,129 @@ void ParsedScene::ObjectInstance(const std::string &name, FileLoc loc) {
             InstanceSceneEntity(name, loc, animatedRenderFromInstance, nullptr));
     } else {
         const class Transform *renderFromInstance =
-            transformCache.Lookup(RenderFromObject(0) * worldFromRender);
+            transformCache.LookupInstance(RenderFromObject(0) * worldFromRender);
 
         instances.push_back(
             InstanceSceneEntity(name, loc, AnimatedTransform(), renderFromInstance));
     }
 }
 
+std::unique_ptr<ParsedScene> ParsedScene::CopyForImport(FileLoc loc) const {
+    if (currentBlock != BlockState::WorldBlock)
+        ErrorExit(&loc, "Import is only allowed inside the world block.");
+    if (currentInstance != nullptr)
+        ErrorExit(&loc, "Import is not allowed inside an object definition.");
+
+    auto importScene = std::make_unique<ParsedScene>();
+    importScene->graphicsState = graphicsState;
+    importScene->currentBlock = currentBlock;
+    importScene->namedCoordinateSystems = namedCoordinateSystems;
+    importScene->renderFromWorld = renderFromWorld;
+    // Copy the materials so that the current material index remains valid
+    importScene->materials = materials;
+    importScene->importedMaterialsStart = materials.size();
+    importScene->importing = true;
+    return importScene;
+}
+
+void ParsedScene::MergeImported(ParsedScene *importScene) {
+    while (!importScene->pushedGraphicsStates.empty()) {
+        ErrorExitDeferred(&importScene->pushStack.back().second,
+                          "Missing end to AttributeBegin in imported file");
+        importScene->pushedGraphicsStates.pop_back();
+        importScene->pushStack.pop_back();
+    }
+    errorExit |= importScene->errorExit;
+    for (std::unique_ptr<ArenaMemoryResource> &arena : importScene->parameterArenas)
+        parameterArenas.push_back(std::move(arena));
+    importScene->parameterArenas.clear();
+
+    // Append the imported materials and area lights, and then update shapes'
+    // indices to refer to their new positions.
+    int materialsStart = importScene->importedMaterialsStart;
+    int materialOffset = int(materials.size()) - materialsStart;
+    int areaLightOffset = areaLights.size();
+    materials.insert(materials.end(),
+                     std::make_move_iterator(importScene->materials.begin() +
+                                             materialsStart),
+                     std::make_move_iterator(importScene->materials.end()));
+    areaLights.insert(areaLights.end(),
+                      std::make_move_iterator(importScene->areaLights.begin()),
+                      std::make_move_iterator(importScene->areaLights.end()));
+
+    // Shared transforms are owned by the imported scene's _TransformCache_,
+    // so they are looked up again in this scene's cache.
+    auto mergeShape = [&](auto &s) {
+        if (s.materialIndex >= materialsStart)
+            s.materialIndex += materialOffset;
+        if (s.lightIndex != -1)
+            s.lightIndex += areaLightOffset;
+    };
+    auto mergeShapes = [&](std::vector<ShapeSceneEntity> &from,
+                           std::vector<ShapeSceneEntity> *to) {
+        for (ShapeSceneEntity &s : from) {
+            mergeShape(s);
+            s.renderFromObject = transformCache.Lookup(*s.renderFromObject);
+            s.objectFromRender = transformCache.Lookup(*s.objectFromRender);
+            to->push_back(std::move(s));
+        }
+    };
+    auto mergeAnimatedShapes = [&](std::vector<AnimatedShapeSceneEntity> &from,
+                                   std::vector<AnimatedShapeSceneEntity> *to) {
+        for (AnimatedShapeSceneEntity &s : from) {
+            mergeShape(s);
+            s.identity = transformCache.Lookup(*s.identity);
+            to->push_back(std::move(s));
+        }
+    };
+    mergeShapes(importScene->shapes, &shapes);
+    mergeAnimatedShapes(importScene->animatedShapes, &animatedShapes);
+
+    for (InstanceSceneEntity &inst : importScene->instances) {
+        if (inst.renderFromInstance)
+            inst.renderFromInstance = transformCache.Lookup(*inst.renderFromInstance);
+        instances.push_back(std::move(inst));
+    }
+    for (auto &def : importScene->instanceDefinitions) {
+        if (instanceDefinitions.find(def.first) != instanceDefinitions.end()) {
+            ErrorExitDeferred(&def.second.loc, "%s: trying to redefine an object instance",
+                              def.first);
+            continue;
+        }
+        InstanceDefinitionSceneEntity &merged = instanceDefinitions[def.first];
+        merged = InstanceDefinitionSceneEntity(def.second.name, def.second.loc);
+        mergeShapes(def.second.shapes, &merged.shapes);
+        mergeAnimatedShapes(def.second.animatedShapes, &merged.animatedShapes);
+    }
+
+    lights.insert(lights.end(), std::make_move_iterator(importScene->lights.begin()),
+                  std::make_move_iterator(importScene->lights.end()));
+    for (auto &m : importScene->media) {
+        if (media.find(m.first) != media.end())
+            ErrorExitDeferred(&m.second.loc, "Named medium \"%s\" redefined.", m.first);
+        else
+            media[m.first] = std::move(m.second);
+    }
+
+    // Named definitions are appended in order, skipping redefinitions
+    auto mergeNamed = [&](auto &from, auto *to, const char *message) {
+        std::set<std::string> names;
+        for (const auto &item : *to)
+            names.insert(item.first);
+        for (auto &item : from) {
+            if (!names.insert(item.first).second)
+                ErrorExitDeferred(&item.second.loc, message, item.first);
+            else
+                to->push_back(std::move(item));
+        }
+    };
+    mergeNamed(importScene->floatTextures, &floatTextures, "Redefining texture \"%s\".");
+    mergeNamed(importScene->spectrumTextures, &spectrumTextures,
+               "Redefining texture \"%s\".");
+    mergeNamed(importScene->namedMaterials, &namedMaterials,
+               "%s: named material redefined.");
+}
+
 void ParsedScene::EndOfFiles() {
     if (currentBlock != BlockState::WorldBlock)
         ErrorExitDeferred("End of files before \"WorldBegin\".");
@@ -441,7 +628,9 @@ void ParsedScene::EndOfFiles() {
 }
 
 void ParsedScene::Option(const std::string &name, const std::string &value, FileLoc loc) {
+    VERIFY_NOT_IMPORTED("Option");
     std::string nName = normalizeArg(name);
+    optionStatements.push_back(std::make_pair(name, value));
 
     if (nName == "disablepixeljitter") {
         if (value == "true")
@@ -485,38 +674,48 @@ void ParsedScene::Option(const std::string &name, const std::string &value, File
         else
             ErrorExitDeferred(&loc, "%s: expected \"true\" or \"false\" for option value",
                               value);
+    } else if (nName == "ptexcachemb" || nName == "ptexmaxfiles") {
+        int v = std::atoi(value.c_str());
+        if (v <= 0)
+            ErrorExitDeferred(&loc, "%s: expected positive integer for option value",
+                              value);
+        else if (nName == "ptexcachemb")
+            Options->ptexCacheMB = v;
+        else
+            Options->ptexMaxFiles = v;
     } else
         ErrorExitDeferred(&loc, "%s: unknown option", name);
 }
 
 void ParsedScene::Transform(Float tr[16], FileLoc loc) {
-    FOR_ACTIVE_TRANSFORMS(graphicsState.ctm[i] = Transpose(
+    TransformSet &ctm = graphicsState.ctm.Mutable();
+    FOR_ACTIVE_TRANSFORMS(ctm[i] = Transpose(
                               pbrt::Transform(SquareMatrix<4>(pstd::MakeSpan(tr, 16))));)
 }
 
 void ParsedScene::ConcatTransform(Float tr[16], FileLoc loc) {
+    TransformSet &ctm = graphicsState.ctm.Mutable();
     FOR_ACTIVE_TRANSFORMS(
-        graphicsState.ctm[i] =
-            graphicsState.ctm[i] *
-            Transpose(pbrt::Transform(SquareMatrix<4>(pstd::MakeSpan(tr, 16))));)
+        ctm[i] = ctm[i] *
+                 Transpose(pbrt::Transform(SquareMatrix<4>(pstd::MakeSpan(tr, 16))));)
 }
 
 void ParsedScene::Rotate(Float angle, Float dx, Float dy, Float dz, FileLoc loc) {
-    FOR_ACTIVE_TRANSFORMS(graphicsState.ctm[i] =
-                              graphicsState.ctm[i] *
-                              pbrt::Rotate(angle, Vector3f(dx, dy, dz));)
+    TransformSet &ctm = graphicsState.ctm.Mutable();
+    FOR_ACTIVE_TRANSFORMS(ctm[i] = ctm[i] * pbrt::Rotate(angle, Vector3f(dx, dy, dz));)
 }
 
 void ParsedScene::Scale(Float sx, Float sy, Float sz, FileLoc loc) {
-    FOR_ACTIVE_TRANSFORMS(graphicsState.ctm[i] =
-                              graphicsState.ctm[i] * pbrt::Scale(sx, sy, sz);)
+    TransformSet &ctm = graphicsState.ctm.Mutable();
+    FOR_ACTIVE_TRANSFORMS(ctm[i] = ctm[i] * pbrt::Scale(sx, sy, sz);)
 }
 
 void ParsedScene::LookAt(Float ex, Float ey, Float ez, Float lx, Float ly, Float lz,
                          Float ux, Float uy, Float uz, FileLoc loc) {
     class Transform lookAt =
         pbrt::LookAt(Point3f(ex, ey, ez), Point3f(lx, ly, lz), Vector3f(ux, uy, uz));
-    FOR_ACTIVE_TRANSFORMS(graphicsState.ctm[i] = graphicsState.ctm[i] * lookAt;);
+    TransformSet &ctm = graphicsState.ctm.Mutable();
+    FOR_ACTIVE_TRANSFORMS(ctm[i] = ctm[i] * lookAt;);
 }
 
 void ParsedScene::ActiveTransformAll(FileLoc loc) {
@@ -576,7 +775,7 @@ void ParsedScene::Integrator(const std::string &name, ParsedParameterVector para
 
 void ParsedScene::MakeNamedMedium(const std::string &name, ParsedParameterVector params,
                                   FileLoc loc) {
-    ParameterDictionary dict(std::move(params), graphicsState.mediumAttributes,
+    ParameterDictionary dict(std::move(params), graphicsState.attributes->medium,
                              graphicsState.colorSpace);
 
     if (media.find(name) != media.end()) {
@@ -589,8 +788,8 @@ void ParsedScene::MakeNamedMedium(const std::string &name, ParsedParameterVector
 
 void ParsedScene::MediumInterface(const std::string &insideName,
                                   const std::string &outsideName, FileLoc loc) {
-    graphicsState.currentInsideMedium = insideName;
-    graphicsState.currentOutsideMedium = outsideName;
+    graphicsState.currentInsideMedium.Set(insideName);
+    graphicsState.currentOutsideMedium.Set(outsideName);
 }
 
 void ParsedScene::Texture(const std::string &name, const std::string &type,
@@ -598,7 +797,7 @@ void ParsedScene::Texture(const std::string &name, const std::string &type,
                           FileLoc loc) {
     VERIFY_WORLD("Texture");
 
-    ParameterDictionary dict(std::move(params), graphicsState.textureAttributes,
+    ParameterDictionary dict(std::move(params), graphicsState.attributes->texture,
                              graphicsState.colorSpace);
 
     if (type != "float" && type != "spectrum") {
@@ -623,18 +822,18 @@ void ParsedScene::Texture(const std::string &name, const std::string &type,
 void ParsedScene::Material(const std::string &name, ParsedParameterVector params,
                            FileLoc loc) {
     VERIFY_WORLD("Material");
-    ParameterDictionary dict(std::move(params), graphicsState.materialAttributes,
+    ParameterDictionary dict(std::move(params), graphicsState.attributes->material,
                              graphicsState.colorSpace);
     materials.push_back(SceneEntity(name, std::move(dict), loc));
     graphicsState.currentMaterialIndex = materials.size() - 1;
-    graphicsState.currentMaterialName.clear();
+    graphicsState.currentMaterialName.Set(std::string());
 }
 
 void ParsedScene::MakeNamedMaterial(const std::string &name, ParsedParameterVector params,
                                     FileLoc loc) {
     VERIFY_WORLD("MakeNamedMaterial");
 
-    ParameterDictionary dict(std::move(params), graphicsState.materialAttributes,
+    ParameterDictionary dict(std::move(params), graphicsState.attributes->material,
                              graphicsState.colorSpace);
 
     // Note: O(n). FIXME?
@@ -649,17 +848,98 @@ void ParsedScene::MakeNamedMaterial(const std::string &name, ParsedParameterVect
 
 void ParsedScene::NamedMaterial(const std::string &name, FileLoc loc) {
     VERIFY_WORLD("NamedMaterial");
-    graphicsState.currentMaterialName = name;
+    graphicsState.currentMaterialName.Set(name);
     graphicsState.currentMaterialIndex = -1;
 }
 
 void ParsedScene::AreaLightSource(const std::string &name, ParsedParameterVector params,
                                   FileLoc loc) {
     VERIFY_WORLD("AreaLightSource");
-    graphicsState.areaLightName = name;
-    graphicsState.areaLightParams = ParameterDictionary(
-        std::move(params), graphicsState.lightAttributes, graphicsState.colorSpace);
-    graphicsState.areaLightLoc = loc;
+    graphicsState.areaLight.Set(
+        {name,
+         ParameterDictionary(std::move(params), graphicsState.attributes->light,
+                             graphicsState.colorSpace),
+         loc});
+}
+
+// Returns a string that is equal for two parameter dictionaries exactly
+// when they describe the same object: only the unshadowed parameter of
+// each type and name is included, in sorted order, and references to
+// already-created textures are replaced with the texture they resolve to,
+// so that identical textures declared under different names still match.
+static std::string CanonicalParameterKey(const ParameterDictionary &dict,
+                                         const NamedTextures *textures) {
+    const ParsedParameterVector &params = dict.GetParameterVector();
+    InlinedVector<const ParsedParameter *, 8> used;
+    for (const ParsedParameter *p : params)
+        if (std::find_if(used.begin(), used.end(), [&](const ParsedParameter *u) {
+                return u->name == p->name && u->type == p->type;
+            }) == used.end())
+            used.push_back(p);
+    std::sort(used.begin(), used.end(),
+              [](const ParsedParameter *a, const ParsedParameter *b) {
+                  return std::tie(a->name, a->type) < std::tie(b->name, b->type);
+              });
+
+    std::string key;
+    auto append = [&key](const void *ptr, size_t size) {
+        key.append(reinterpret_cast<const char *>(ptr), size);
+    };
+    auto appendString = [&](const std::string &str) {
+        size_t size = str.size();
+        append(&size, sizeof(size));
+        key += str;
+    };
+
+    const RGBColorSpace *colorSpace = dict.ColorSpace();
+    append(&colorSpace, sizeof(colorSpace));
+    for (const ParsedParameter *p : used) {
+        appendString(p->type);
+        appendString(p->name);
+        size_t n = p->numbers.size();
+        append(&n, sizeof(n));
+        append(p->numbers.data(), n * sizeof(double));
+        n = p->bools.size();
+        append(&n, sizeof(n));
+        for (bool b : p->bools)
+            key += b ? '1' : '0';
+        n = p->strings.size();
+        append(&n, sizeof(n));
+        for (const std::string &str : p->strings) {
+            if (p->type == "texture" && textures) {
+                auto fiter = textures->floatTextures.find(str);
+                auto siter = textures->albedoSpectrumTextures.find(str);
+                if (fiter != textures->floatTextures.end() ||
+                    siter != textures->albedoSpectrumTextures.end()) {
+                    const void *ptrs[2] = {
+                        fiter != textures->floatTextures.end() ? fiter->second.ptr()
+                                                               : nullptr,
+                        siter != textures->albedoSpectrumTextures.end()
+                            ? siter->second.ptr()
+                            : nullptr};
+                    key += 'T';
+                    append(ptrs, sizeof(ptrs));
+                    continue;
+                }
+            }
+            key += 'S';
+            appendString(str);
+        }
+    }
+    return key;
+}
+
+static std::string TextureKey(const TextureSceneEntity &tex,
+                              const NamedTextures *textures) {
+    std::string key = tex.texName;
+    key += '\0';
+    const SquareMatrix<4> &m = tex.renderFromObject.startTransform.GetMatrix();
+    for (int i = 0; i < 4; ++i)
+        for (int j = 0; j < 4; ++j) {
+            Float v = m[i][j];
+            key.append(reinterpret_cast<const char *>(&v), sizeof(v));
+        }
+    return key + CanonicalParameterKey(tex.parameters, textures);
 }
 
 void ParsedScene::CreateMaterials(
@@ -704,6 +984,11 @@ void ParsedScene::CreateMaterials(
     });
     LOG_VERBOSE("Done reading normal maps");
 
+    // Materials with the same type and parameters share a single
+    // MaterialHandle.
+    std::unordered_map<std::string, MaterialHandle> materialCache;
+    int nDeduplicated = 0;
+
     // Named materials
     for (const auto &nm : namedMaterials) {
         const std::string &name = nm.first;
@@ -722,31 +1007,116 @@ void ParsedScene::CreateMaterials(
             continue;
         }
 
+        std::string key =
+            type + '\0' + CanonicalParameterKey(mtl.parameters, &textures);
+        if (auto iter = materialCache.find(key); iter != materialCache.end()) {
+            ++nMaterialsDeduplicated;
+            ++nDeduplicated;
+            (*namedMaterialsOut)[name] = iter->second;
+            continue;
+        }
+
         std::string fn = nm.second.parameters.GetOneString("normalmap", "");
         Image *normalMap = !fn.empty() ? normalMapCache[fn] : nullptr;
 
         TextureParameterDictionary texDict(&mtl.parameters, &textures);
+        EntityStatsScope stats("Material", name, &mtl.loc, alloc);
         MaterialHandle m = MaterialHandle::Create(type, texDict, normalMap,
-                                                  *namedMaterialsOut, &mtl.loc, alloc);
+                                                  *namedMaterialsOut, &mtl.loc,
+                                                  stats.Alloc());
         (*namedMaterialsOut)[name] = m;
+        materialCache[key] = m;
     }
 
     // Regular materials
     materialsOut->reserve(materials.size());
     for (const auto &mtl : materials) {
+        std::string key =
+            mtl.name + '\0' + CanonicalParameterKey(mtl.parameters, &textures);
+        if (auto iter = materialCache.find(key); iter != materialCache.end()) {
+            ++nMaterialsDeduplicated;
+            ++nDeduplicated;
+            materialsOut->push_back(iter->second);
+            continue;
+        }
+
         std::string fn = mtl.parameters.GetOneString("normalmap", "");
         Image *normalMap = !fn.empty() ? normalMapCache[fn] : nullptr;
 
         TextureParameterDictionary texDict(&mtl.parameters, &textures);
+        EntityStatsScope stats("Material", mtl.name, &mtl.loc, alloc);
         MaterialHandle m = MaterialHandle::Create(mtl.name, texDict, normalMap,
-                                                  *namedMaterialsOut, &mtl.loc, alloc);
+                                                  *namedMaterialsOut, &mtl.loc,
+                                                  stats.Alloc());
         materialsOut->push_back(m);
+        materialCache[key] = m;
+    }
+
+    LOG_VERBOSE("Created %d materials; %d duplicates shared an existing material",
+                namedMaterials.size() + materials.size() - nDeduplicated, nDeduplicated);
+}
+
+// Adds the names of the textures that _dict_ refers to to _names_ and
+// returns the number that were not already present.
+static int AddTextureReferences(const ParameterDictionary &dict,
+                                std::set<std::string> *names) {
+    int nAdded = 0;
+    for (const ParsedParameter *p : dict.GetParameterVector())
+        if (p->type == "texture" && !p->strings.empty())
+            nAdded += names->insert(p->strings[0]).second;
+    return nAdded;
+}
+
+// Returns the names of the textures that may be evaluated during rendering:
+// those that materials and shapes refer to and, recursively, the textures
+// that those textures refer to. Float and spectrum textures are in separate
+// namespaces but a texture parameter doesn't say which it refers to, so a
+// name that is reachable is taken to be reachable for both.
+static std::set<std::string> ReachableTextures(const ParsedScene &scene) {
+    std::set<std::string> names;
+    for (const auto &nm : scene.namedMaterials)
+        AddTextureReferences(nm.second.parameters, &names);
+    for (const auto &mtl : scene.materials)
+        AddTextureReferences(mtl.parameters, &names);
+    for (const auto &sh : scene.shapes)
+        AddTextureReferences(sh.parameters, &names);
+    for (const auto &sh : scene.animatedShapes)
+        AddTextureReferences(sh.parameters, &names);
+    for (const auto &def : scene.instanceDefinitions) {
+        for (const auto &sh : def.second.shapes)
+            AddTextureReferences(sh.parameters, &names);
+        for (const auto &sh : def.second.animatedShapes)
+            AddTextureReferences(sh.parameters, &names);
     }
+
+    // Follow references from reachable textures until no more are found
+    int nAdded;
+    do {
+        nAdded = 0;
+        for (const auto *texList : {&scene.floatTextures, &scene.spectrumTextures})
+            for (const auto &tex : *texList)
+                if (names.find(tex.first) != names.end())
+                    nAdded += AddTextureReferences(tex.second.parameters, &names);
+    } while (nAdded > 0);
+    return names;
 }
 
 NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
     NamedTextures textures;
 
+    // Image textures on the CPU aren't read until they are first evaluated,
+    // but GPU textures are uploaded when they are created, so only create
+    // the textures that may be evaluated when rendering on the GPU.
+    std::set<std::string> reachableTextures;
+    if (gpu)
+        reachableTextures = ReachableTextures(*this);
+    auto isUnreachable = [&](const std::string &name) {
+        if (!gpu || reachableTextures.find(name) != reachableTextures.end())
+            return false;
+        ++nUnreachableTextures;
+        return true;
+    };
+
     std::set<std::string> seenFloatTextureFilenames, seenSpectrumTextureFilenames;
     std::vector<size_t> parallelFloatTextures, serialFloatTextures;
     std::vector<size_t> parallelSpectrumTextures, serialSpectrumTextures;
@@ -757,6 +1127,8 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
     int nMissingTextures = 0;
     for (size_t i = 0; i < floatTextures.size(); ++i) {
         const auto &tex = floatTextures[i];
+        if (isUnreachable(tex.first))
+            continue;
 
         if (tex.second.renderFromObject.IsAnimated())
             Warning(&tex.second.loc,
@@ -785,6 +1157,8 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
     }
     for (size_t i = 0; i < spectrumTextures.size(); ++i) {
         const auto &tex = spectrumTextures[i];
+        if (isUnreachable(tex.first))
+            continue;
 
         if (tex.second.renderFromObject.IsAnimated())
             Warning(&tex.second.loc,
@@ -830,8 +1204,10 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
         // Pass nullptr for the textures, since they shouldn't be accessed
         // anyway.
         TextureParameterDictionary texDict(&tex.second.parameters, nullptr);
-        FloatTextureHandle t = FloatTextureHandle::Create(
-            tex.second.texName, renderFromTexture, texDict, &tex.second.loc, alloc, gpu);
+        EntityStatsScope stats("Texture", tex.first, &tex.second.loc, alloc);
+        FloatTextureHandle t =
+            FloatTextureHandle::Create(tex.second.texName, renderFromTexture, texDict,
+                                       &tex.second.loc, stats.Alloc(), gpu);
         std::lock_guard<std::mutex> lock(mutex);
         textures.floatTextures[tex.first] = t;
     });
@@ -842,16 +1218,17 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
         pbrt::Transform renderFromTexture = tex.second.renderFromObject.startTransform;
         // nullptr for the textures, as above.
         TextureParameterDictionary texDict(&tex.second.parameters, nullptr);
+        EntityStatsScope stats("Texture", tex.first, &tex.second.loc, alloc);
         SpectrumTextureHandle albedoTex = SpectrumTextureHandle::Create(
             tex.second.texName, renderFromTexture, texDict, SpectrumType::Albedo,
-            &tex.second.loc, alloc, gpu);
+            &tex.second.loc, stats.Alloc(), gpu);
         // These should be fast since they should hit the texture cache
         SpectrumTextureHandle unboundedTex = SpectrumTextureHandle::Create(
             tex.second.texName, renderFromTexture, texDict, SpectrumType::Unbounded,
-            &tex.second.loc, alloc, gpu);
+            &tex.second.loc, stats.Alloc(), gpu);
         SpectrumTextureHandle illumTex = SpectrumTextureHandle::Create(
             tex.second.texName, renderFromTexture, texDict, SpectrumType::Illuminant,
-            &tex.second.loc, alloc, gpu);
+            &tex.second.loc, stats.Alloc(), gpu);
 
         std::lock_guard<std::mutex> lock(mutex);
         textures.albedoSpectrumTextures[tex.first] = albedoTex;
@@ -859,49 +1236,103 @@ NamedTextures ParsedScene::CreateTextures(Allocator alloc, bool gpu) const {
         textures.illuminantSpectrumTextures[tex.first] = illumTex;
     });
 
+    // Textures with the same type, transformation, and parameters as one
+    // that has already been created share its TextureHandle. The textures
+    // loaded in parallel all have distinct filenames, so only the serial
+    // ones may be duplicates, though they may duplicate a parallel one.
+    std::unordered_map<std::string, FloatTextureHandle> floatTextureCache;
+    // Albedo, unbounded, and illuminant textures, respectively.
+    using SpectrumTextures = std::array<SpectrumTextureHandle, 3>;
+    std::unordered_map<std::string, SpectrumTextures> spectrumTextureCache;
+    for (size_t index : parallelFloatTextures) {
+        const auto &tex = floatTextures[index];
+        floatTextureCache[TextureKey(tex.second, nullptr)] =
+            textures.floatTextures[tex.first];
+    }
+    for (size_t index : parallelSpectrumTextures) {
+        const auto &tex = spectrumTextures[index];
+        spectrumTextureCache[TextureKey(tex.second, nullptr)] = {
+            textures.albedoSpectrumTextures[tex.first],
+            textures.unboundedSpectrumTextures[tex.first],
+            textures.illuminantSpectrumTextures[tex.first]};
+    }
+    int nDeduplicated = 0;
+
     LOG_VERBOSE("Loading serial textures");
     // And do the rest serially
     for (size_t index : serialFloatTextures) {
         const auto &tex = floatTextures[index];
 
+        std::string key = TextureKey(tex.second, &textures);
+        if (auto iter = floatTextureCache.find(key); iter != floatTextureCache.end()) {
+            ++nTexturesDeduplicated;
+            ++nDeduplicated;
+            textures.floatTextures[tex.first] = iter->second;
+            continue;
+        }
+
         pbrt::Transform renderFromTexture = tex.second.renderFromObject.startTransform;
         TextureParameterDictionary texDict(&tex.second.parameters, &textures);
-        FloatTextureHandle t = FloatTextureHandle::Create(
-            tex.second.texName, renderFromTexture, texDict, &tex.second.loc, alloc, gpu);
+        EntityStatsScope stats("Texture", tex.first, &tex.second.loc, alloc);
+        FloatTextureHandle t =
+            FloatTextureHandle::Create(tex.second.texName, renderFromTexture, texDict,
+                                       &tex.second.loc, stats.Alloc(), gpu);
         textures.floatTextures[tex.first] = t;
+        floatTextureCache[key] = t;
     }
     for (size_t index : serialSpectrumTextures) {
         const auto &tex = spectrumTextures[index];
 
+        std::string key = TextureKey(tex.second, &textures);
+        if (auto iter = spectrumTextureCache.find(key);
+            iter != spectrumTextureCache.end()) {
+            ++nTexturesDeduplicated;
+            ++nDeduplicated;
+            textures.albedoSpectrumTextures[tex.first] = iter->second[0];
+            textures.unboundedSpectrumTextures[tex.first] = iter->second[1];
+            textures.illuminantSpectrumTextures[tex.first] = iter->second[2];
+            continue;
+        }
+
         if (tex.second.renderFromObject.IsAnimated())
             Warning(&tex.second.loc, "Animated world to texture transform not supported. "
                                      "Using start transform.");
 
         pbrt::Transform renderFromTexture = tex.second.renderFromObject.startTransform;
         TextureParameterDictionary texDict(&tex.second.parameters, &textures);
+        EntityStatsScope stats("Texture", tex.first, &tex.second.loc, alloc);
         SpectrumTextureHandle albedoTex = SpectrumTextureHandle::Create(
             tex.second.texName, renderFromTexture, texDict, SpectrumType::Albedo,
-            &tex.second.loc, alloc, gpu);
+            &tex.second.loc, stats.Alloc(), gpu);
         SpectrumTextureHandle unboundedTex = SpectrumTextureHandle::Create(
             tex.second.texName, renderFromTexture, texDict, SpectrumType::Unbounded,
-            &tex.second.loc, alloc, gpu);
+            &tex.second.loc, stats.Alloc(), gpu);
         SpectrumTextureHandle illumTex = SpectrumTextureHandle::Create(
             tex.second.texName, renderFromTexture, texDict, SpectrumType::Illuminant,
-            &tex.second.loc, alloc, gpu);
+            &tex.second.loc, stats.Alloc(), gpu);
 
         textures.albedoSpectrumTextures[tex.first] = albedoTex;
         textures.unboundedSpectrumTextures[tex.first] = unboundedTex;
         textures.illuminantSpectrumTextures[tex.first] = illumTex;
+        spectrumTextureCache[key] = {albedoTex, unboundedTex, illumTex};
     }
 
-    LOG_VERBOSE("Done creating textures");
+    LOG_VERBOSE("Done creating textures; %d duplicates shared an existing texture",
+                nDeduplicated);
     return textures;
 }
 
 std::map<std::string, MediumHandle> ParsedScene::CreateMedia(Allocator alloc) const {
-    std::map<std::string, MediumHandle> mediaMap;
+    // Create the media in parallel, since some of them may need to read
+    // large volume files from disk
+    std::vector<std::map<std::string, TransformedSceneEntity>::const_iterator> mediaIters;
+    for (auto iter = media.begin(); iter != media.end(); ++iter)
+        mediaIters.push_back(iter);
 
-    for (const auto &m : media) {
+    std::map<std::string, MediumHandle> mediaMap;
+    std::mutex mutex;
+    ParallelFor(0, mediaIters.size(), [&](int64_t i) {
+        const auto &m = *mediaIters[i];
         std::string type = m.second.parameters.GetOneString("type", "");
         if (type.empty())
             ErrorExit(&m.second.loc, "No parameter string \"type\" found for medium.");
@@ -910,21 +1341,617 @@ std::map<std::string, MediumHandle> ParsedScene::CreateMedia(Allocator alloc) co
             Warning(&m.second.loc,
                     "Animated transformation provided for medium. Only the "
                     "start transform will be used.");
+        EntityStatsScope stats("Medium", m.first, &m.second.loc, alloc);
         MediumHandle medium = MediumHandle::Create(
             type, m.second.parameters, m.second.renderFromObject.startTransform,
-            &m.second.loc, alloc);
+            &m.second.loc, stats.Alloc());
+
+        std::lock_guard<std::mutex> lock(mutex);
         mediaMap[m.first] = medium;
-    }
+    });
 
     return mediaMap;
 }
 
+// Binary Scene File Local Definitions
+static const char binarySceneMagic[8] = {'p', 'b', 'r', 't', 's', 'c', 'n', '\0'};
+static constexpr uint32_t binarySceneVersion = 1;
+static constexpr uint32_t binarySceneByteOrder = 0x01020304;
+
+// BinarySceneHeader Definition
+struct BinarySceneHeader {
+    char magic[8];
+    uint32_t version, byteOrder, floatSize, renderingSpace;
+    // Offsets of the sections that follow the header
+    uint64_t filenamesOffset, parametersOffset, transformsOffset, entitiesOffset;
+};
+
+static std::string ColorSpaceName(const RGBColorSpace *cs) {
+    if (!cs)
+        return "";
+    else if (cs == RGBColorSpace::sRGB)
+        return "srgb";
+    else if (cs == RGBColorSpace::DCI_P3)
+        return "dci-p3";
+    else if (cs == RGBColorSpace::Rec2020)
+        return "rec2020";
+    else if (cs == RGBColorSpace::ACES2065_1)
+        return "aces2065-1";
+    ErrorExit("Unable to store unnamed color space %s in binary scene file.", *cs);
+}
+
+// BinarySceneWriter Definition
+class BinarySceneWriter {
+  public:
+    // BinarySceneWriter Public Methods
+    BinarySceneWriter(const std::string &filename) : filename(filename) {
+        f = fopen(filename.c_str(), "wb");
+        if (!f)
+            ErrorExit("%s: %s", filename, ErrorString());
+    }
+
+    void WriteBytes(const void *ptr, size_t size) {
+        if (size > 0 && fwrite(ptr, 1, size, f) != size)
+            ErrorExit("%s: %s", filename, ErrorString());
+        offset += size;
+    }
+    template <typename T>
+    void WriteValue(const T &v) {
+        static_assert(std::is_trivially_copyable_v<T>, "Can only write POD values");
+        WriteBytes(&v, sizeof(T));
+    }
+    void WriteString(std::string_view s) {
+        WriteValue<uint64_t>(s.size());
+        WriteBytes(s.data(), s.size());
+    }
+    void Align(size_t alignment) {
+        static const char zeros[16] = {};
+        WriteBytes(zeros, (alignment - offset % alignment) % alignment);
+    }
+    void WriteTransform(const Transform &t) {
+        WriteValue(t.GetMatrix());
+        WriteValue(t.GetInverseMatrix());
+    }
+    void WriteAnimatedTransform(const AnimatedTransform &t) {
+        WriteTransform(t.startTransform);
+        WriteValue(t.startTime);
+        WriteTransform(t.endTransform);
+        WriteValue(t.endTime);
+    }
+
+    uint64_t Offset() const { return offset; }
+
+    void Close(const BinarySceneHeader &header) {
+        // Rewrite the header now that the section offsets are known
+        if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, f) != 1 ||
+            fclose(f) != 0)
+            ErrorExit("%s: %s", filename, ErrorString());
+        f = nullptr;
+    }
+
+  private:
+    // BinarySceneWriter Private Members
+    std::string filename;
+    FILE *f = nullptr;
+    uint64_t offset = 0;
+};
+
+// BinarySceneReader Definition
+class BinarySceneReader {
+  public:
+    // BinarySceneReader Public Methods
+    BinarySceneReader(const std::string &filename) : filename(filename) {
+#ifdef PBRT_HAVE_MMAP
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+            ErrorExit("%s: %s", filename, ErrorString());
+        struct stat stat;
+        if (fstat(fd, &stat) != 0)
+            ErrorExit("%s: %s", filename, ErrorString());
+        size = stat.st_size;
+        if (size > 0) {
+            void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr == MAP_FAILED)
+                ErrorExit("%s: %s", filename, ErrorString());
+            data = static_cast<const char *>(ptr);
+        }
+        close(fd);
+#else
+        contents = ReadFileContents(filename);
+        data = contents.data();
+        size = contents.size();
+#endif
+    }
+    ~BinarySceneReader() {
+#ifdef PBRT_HAVE_MMAP
+        if (data)
+            munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    BinarySceneReader(const BinarySceneReader &) = delete;
+    BinarySceneReader &operator=(const BinarySceneReader &) = delete;
+
+    void Seek(uint64_t o) {
+        if (o > size)
+            ErrorExit("%s: truncated binary scene file.", filename);
+        offset = o;
+    }
+    const char *ReadBytes(size_t n) {
+        if (n > size - offset)
+            ErrorExit("%s: truncated binary scene file.", filename);
+        const char *ptr = data + offset;
+        offset += n;
+        return ptr;
+    }
+    template <typename T>
+    T ReadValue() {
+        T v;
+        std::memcpy(&v, ReadBytes(sizeof(T)), sizeof(T));
+        return v;
+    }
+    std::string ReadString() {
+        uint64_t n = ReadValue<uint64_t>();
+        return std::string(ReadBytes(n), n);
+    }
+    void Align(size_t alignment) { ReadBytes((alignment - offset % alignment) % alignment); }
+    Transform ReadTransform() {
+        SquareMatrix<4> m = ReadValue<SquareMatrix<4>>();
+        SquareMatrix<4> mInv = ReadValue<SquareMatrix<4>>();
+        return Transform(m, mInv);
+    }
+    AnimatedTransform ReadAnimatedTransform() {
+        Transform startTransform = ReadTransform();
+        Float startTime = ReadValue<Float>();
+        Transform endTransform = ReadTransform();
+        Float endTime = ReadValue<Float>();
+        return AnimatedTransform(startTransform, startTime, endTransform, endTime);
+    }
+
+    std::string filename;
+
+  private:
+    // BinarySceneReader Private Members
+    const char *data = nullptr;
+    size_t size = 0, offset = 0;
+#ifndef PBRT_HAVE_MMAP
+    std::string contents;
+#endif
+};
+
+// ParsedScene Binary File Method Definitions
+bool ParsedScene::IsBinarySceneFile(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f)
+        return false;
+    char magic[sizeof(binarySceneMagic)];
+    bool isBinary = fread(magic, sizeof(magic), 1, f) == 1 &&
+                    std::memcmp(magic, binarySceneMagic, sizeof(magic)) == 0;
+    fclose(f);
+    return isBinary;
+}
+
+void ParsedScene::WriteBinary(const std::string &filename) const {
+    BinarySceneWriter w(filename);
+    BinarySceneHeader header = {};
+    std::memcpy(header.magic, binarySceneMagic, sizeof(binarySceneMagic));
+    header.version = binarySceneVersion;
+    header.byteOrder = binarySceneByteOrder;
+    header.floatSize = sizeof(Float);
+    header.renderingSpace = uint32_t(Options->renderingSpace);
+    w.WriteValue(header);
+
+    // Entities refer to filenames, parameters, and shared transforms by index
+    // into tables that are written after them.
+    std::vector<std::string_view> filenames;
+    std::unordered_map<std::string_view, uint32_t> filenameIndices;
+    std::vector<const ParsedParameter *> parameters;
+    std::unordered_map<const ParsedParameter *, uint32_t> parameterIndices;
+    std::vector<const class Transform *> transforms;
+    std::unordered_map<const class Transform *, int32_t> transformIndices;
+
+    auto writeLoc = [&](const FileLoc &loc) {
+        auto iter = filenameIndices.find(loc.filename);
+        if (iter == filenameIndices.end()) {
+            iter = filenameIndices.insert({loc.filename, uint32_t(filenames.size())}).first;
+            filenames.push_back(loc.filename);
+        }
+        w.WriteValue(iter->second);
+        w.WriteValue<int32_t>(loc.line);
+        w.WriteValue<int32_t>(loc.column);
+    };
+    auto writeTransformIndex = [&](const class Transform *t) {
+        if (!t) {
+            w.WriteValue<int32_t>(-1);
+            return;
+        }
+        auto iter = transformIndices.find(t);
+        if (iter == transformIndices.end()) {
+            iter = transformIndices.insert({t, int32_t(transforms.size())}).first;
+            transforms.push_back(t);
+        }
+        w.WriteValue(iter->second);
+    };
+    auto writeEntity = [&](const SceneEntity &e) {
+        w.WriteString(e.name);
+        w.WriteString(ColorSpaceName(e.parameters.ColorSpace()));
+        const ParsedParameterVector &params = e.parameters.GetParameterVector();
+        w.WriteValue<uint32_t>(params.size());
+        for (const ParsedParameter *p : params) {
+            auto iter = parameterIndices.find(p);
+            if (iter == parameterIndices.end()) {
+                iter = parameterIndices.insert({p, uint32_t(parameters.size())}).first;
+                parameters.push_back(p);
+            }
+            w.WriteValue(iter->second);
+        }
+        writeLoc(e.loc);
+    };
+    auto writeShape = [&](const ShapeSceneEntity &s) {
+        writeEntity(s);
+        writeTransformIndex(s.renderFromObject);
+        writeTransformIndex(s.objectFromRender);
+        w.WriteValue<uint8_t>(s.reverseOrientation);
+        w.WriteValue<int32_t>(s.materialIndex);
+        w.WriteString(s.materialName);
+        w.WriteValue<int32_t>(s.lightIndex);
+        w.WriteString(s.insideMedium);
+        w.WriteString(s.outsideMedium);
+    };
+    auto writeAnimatedShape = [&](const AnimatedShapeSceneEntity &s) {
+        writeEntity(s);
+        w.WriteAnimatedTransform(s.renderFromObject);
+        writeTransformIndex(s.identity);
+        w.WriteValue<uint8_t>(s.reverseOrientation);
+        w.WriteValue<int32_t>(s.materialIndex);
+        w.WriteString(s.materialName);
+        w.WriteValue<int32_t>(s.lightIndex);
+        w.WriteString(s.insideMedium);
+        w.WriteString(s.outsideMedium);
+    };
+    auto writeTexture = [&](const std::pair<std::string, TextureSceneEntity> &t) {
+        w.WriteString(t.first);
+        writeEntity(t.second);
+        w.WriteAnimatedTransform(t.second.renderFromObject);
+        w.WriteString(t.second.texName);
+    };
+
+    // Write scene entities
+    header.entitiesOffset = w.Offset();
+    w.WriteValue<uint64_t>(optionStatements.size());
+    for (const auto &option : optionStatements) {
+        w.WriteString(option.first);
+        w.WriteString(option.second);
+    }
+
+    for (const SceneEntity *e : {&film, &sampler, &integrator, &filter, &accelerator})
+        writeEntity(*e);
+    writeEntity(camera);
+    w.WriteAnimatedTransform(camera.cameraTransform.RenderFromCamera());
+    w.WriteTransform(camera.cameraTransform.WorldFromRender());
+    w.WriteString(camera.medium);
+
+    w.WriteValue<uint64_t>(namedMaterials.size());
+    for (const auto &nm : namedMaterials) {
+        w.WriteString(nm.first);
+        writeEntity(nm.second);
+    }
+    w.WriteValue<uint64_t>(materials.size());
+    for (const SceneEntity &m : materials)
+        writeEntity(m);
+    w.WriteValue<uint64_t>(media.size());
+    for (const auto &m : media) {
+        w.WriteString(m.first);
+        writeEntity(m.second);
+        w.WriteAnimatedTransform(m.second.renderFromObject);
+    }
+    w.WriteValue<uint64_t>(floatTextures.size());
+    for (const auto &t : floatTextures)
+        writeTexture(t);
+    w.WriteValue<uint64_t>(spectrumTextures.size());
+    for (const auto &t : spectrumTextures)
+        writeTexture(t);
+    w.WriteValue<uint64_t>(lights.size());
+    for (const LightSceneEntity &l : lights) {
+        writeEntity(l);
+        w.WriteAnimatedTransform(l.renderFromObject);
+        w.WriteString(l.medium);
+    }
+    w.WriteValue<uint64_t>(areaLights.size());
+    for (const SceneEntity &l : areaLights)
+        writeEntity(l);
+    w.WriteValue<uint64_t>(shapes.size());
+    for (const ShapeSceneEntity &s : shapes)
+        writeShape(s);
+    w.WriteValue<uint64_t>(animatedShapes.size());
+    for (const AnimatedShapeSceneEntity &s : animatedShapes)
+        writeAnimatedShape(s);
+    w.WriteValue<uint64_t>(instances.size());
+    for (const InstanceSceneEntity &inst : instances) {
+        w.WriteString(inst.name);
+        writeLoc(inst.loc);
+        w.WriteAnimatedTransform(inst.renderFromInstanceAnim);
+        writeTransformIndex(inst.renderFromInstance);
+    }
+    w.WriteValue<uint64_t>(instanceDefinitions.size());
+    for (const auto &def : instanceDefinitions) {
+        w.WriteString(def.first);
+        w.WriteString(def.second.name);
+        writeLoc(def.second.loc);
+        w.WriteValue<uint64_t>(def.second.shapes.size());
+        for (const ShapeSceneEntity &s : def.second.shapes)
+            writeShape(s);
+        w.WriteValue<uint64_t>(def.second.animatedShapes.size());
+        for (const AnimatedShapeSceneEntity &s : def.second.animatedShapes)
+            writeAnimatedShape(s);
+    }
+
+    // Write parameter table; arrays of numbers are stored aligned so that
+    // they can be copied directly out of the memory-mapped file.
+    header.parametersOffset = w.Offset();
+    w.WriteValue<uint64_t>(parameters.size());
+    for (const ParsedParameter *p : parameters) {
+        w.WriteString(p->type);
+        w.WriteString(p->name);
+        writeLoc(p->loc);
+        w.WriteValue<uint8_t>(p->mayBeUnused);
+        w.WriteString(ColorSpaceName(p->colorSpace));
+        w.WriteValue<uint64_t>(p->numbers.size());
+        w.Align(alignof(double));
+        w.WriteBytes(p->numbers.data(), p->numbers.size() * sizeof(double));
+        w.WriteValue<uint64_t>(p->strings.size());
+        for (const std::string &s : p->strings)
+            w.WriteString(s);
+        w.WriteValue<uint64_t>(p->bools.size());
+        w.WriteBytes(p->bools.data(), p->bools.size());
+    }
+
+    // Write transform and filename tables
+    header.transformsOffset = w.Offset();
+    w.WriteValue<uint64_t>(transforms.size());
+    for (const class Transform *t : transforms)
+        w.WriteTransform(*t);
+
+    header.filenamesOffset = w.Offset();
+    w.WriteValue<uint64_t>(filenames.size());
+    for (std::string_view fn : filenames)
+        w.WriteString(fn);
+
+    w.Close(header);
+}
+
+void ParsedScene::ReadBinary(const std::string &filename) {
+    BinarySceneReader r(filename);
+    BinarySceneHeader header = r.ReadValue<BinarySceneHeader>();
+    if (std::memcmp(header.magic, binarySceneMagic, sizeof(binarySceneMagic)) != 0)
+        ErrorExit("%s: not a binary scene file.", filename);
+    if (header.version != binarySceneVersion)
+        ErrorExit("%s: binary scene file version %d is not supported.", filename,
+                  header.version);
+    if (header.byteOrder != binarySceneByteOrder || header.floatSize != sizeof(Float))
+        ErrorExit("%s: binary scene file was written on an incompatible system or with "
+                  "a different floating-point precision.",
+                  filename);
+    if (header.renderingSpace != uint32_t(Options->renderingSpace))
+        Warning("%s: binary scene file was written with a different rendering "
+                "coordinate system; its stored coordinate system will be used.",
+                filename);
+
+    // Read filename table; _FileLoc_s only hold views of their filenames, so
+    // the strings must remain valid for the rest of the run.
+    r.Seek(header.filenamesOffset);
+    std::vector<std::string_view> filenames(r.ReadValue<uint64_t>());
+    for (std::string_view &fn : filenames)
+        fn = *new std::string(r.ReadString());
+    auto readLoc = [&]() {
+        uint32_t index = r.ReadValue<uint32_t>();
+        if (index >= filenames.size())
+            ErrorExit("%s: corrupt binary scene file.", filename);
+        FileLoc loc(filenames[index]);
+        loc.line = r.ReadValue<int32_t>();
+        loc.column = r.ReadValue<int32_t>();
+        return loc;
+    };
+    auto readColorSpace = [&]() -> const RGBColorSpace * {
+        std::string name = r.ReadString();
+        if (name.empty())
+            return nullptr;
+        const RGBColorSpace *cs = RGBColorSpace::GetNamed(name);
+        if (!cs)
+            ErrorExit("%s: %s: unknown color space in binary scene file.", filename,
+                      name);
+        return cs;
+    };
+
+    // Read parameter table
+    r.Seek(header.parametersOffset);
+    Allocator alloc = ParameterAllocator();
+    std::vector<ParsedParameter *> parameters(r.ReadValue<uint64_t>());
+    for (ParsedParameter *&p : parameters) {
+        std::string type = r.ReadString();
+        std::string name = r.ReadString();
+        p = alloc.new_object<ParsedParameter>(alloc, readLoc());
+        p->type = std::move(type);
+        p->name = std::move(name);
+        p->mayBeUnused = r.ReadValue<uint8_t>();
+        p->colorSpace = readColorSpace();
+        size_t nNumbers = r.ReadValue<uint64_t>();
+        r.Align(alignof(double));
+        const char *numbers = r.ReadBytes(nNumbers * sizeof(double));
+        p->numbers.resize(nNumbers);
+        std::memcpy(p->numbers.data(), numbers, nNumbers * sizeof(double));
+        p->strings.resize(r.ReadValue<uint64_t>());
+        for (std::string &s : p->strings)
+            s = r.ReadString();
+        size_t nBools = r.ReadValue<uint64_t>();
+        const char *bools = r.ReadBytes(nBools);
+        p->bools.resize(nBools);
+        std::memcpy(p->bools.data(), bools, nBools);
+    }
+
+    // Read transform table, adding the transforms to the _TransformCache_
+    r.Seek(header.transformsOffset);
+    std::vector<const class Transform *> transforms(r.ReadValue<uint64_t>());
+    for (const class Transform *&t : transforms)
+        t = transformCache.Lookup(r.ReadTransform());
+    auto readTransformIndex = [&]() -> const class Transform * {
+        int32_t index = r.ReadValue<int32_t>();
+        if (index == -1)
+            return nullptr;
+        if (index < 0 || index >= int32_t(transforms.size()))
+            ErrorExit("%s: corrupt binary scene file.", filename);
+        return transforms[index];
+    };
+
+    auto readEntity = [&](SceneEntity *e) {
+        e->name = r.ReadString();
+        const RGBColorSpace *colorSpace = readColorSpace();
+        ParsedParameterVector params;
+        uint32_t nParams = r.ReadValue<uint32_t>();
+        for (uint32_t i = 0; i < nParams; ++i) {
+            uint32_t index = r.ReadValue<uint32_t>();
+            if (index >= parameters.size())
+                ErrorExit("%s: corrupt binary scene file.", filename);
+            params.push_back(parameters[index]);
+        }
+        // _ParameterDictionary_ reverses the parameters it is given; undo
+        // that so that they are in the order that they were written.
+        std::reverse(params.begin(), params.end());
+        // Default-constructed dictionaries don't have a color space.
+        // Parameters may be shared by multiple entities in binary scene
+        // files, so they are passed as the second, unowned, vector.
+        if (colorSpace)
+            e->parameters = ParameterDictionary({}, params, colorSpace);
+        else if (params.empty())
+            e->parameters = ParameterDictionary();
+        else
+            ErrorExit("%s: corrupt binary scene file.", filename);
+        e->loc = readLoc();
+    };
+    auto readShape = [&](ShapeSceneEntity *s) {
+        readEntity(s);
+        s->renderFromObject = readTransformIndex();
+        s->objectFromRender = readTransformIndex();
+        s->reverseOrientation = r.ReadValue<uint8_t>();
+        s->materialIndex = r.ReadValue<int32_t>();
+        s->materialName = r.ReadString();
+        s->lightIndex = r.ReadValue<int32_t>();
+        s->insideMedium = r.ReadString();
+        s->outsideMedium = r.ReadString();
+    };
+    auto readAnimatedShape = [&](AnimatedShapeSceneEntity *s) {
+        readEntity(s);
+        s->renderFromObject = r.ReadAnimatedTransform();
+        s->identity = readTransformIndex();
+        s->reverseOrientation = r.ReadValue<uint8_t>();
+        s->materialIndex = r.ReadValue<int32_t>();
+        s->materialName = r.ReadString();
+        s->lightIndex = r.ReadValue<int32_t>();
+        s->insideMedium = r.ReadString();
+        s->outsideMedium = r.ReadString();
+    };
+    auto readTexture = [&](std::pair<std::string, TextureSceneEntity> *t) {
+        t->first = r.ReadString();
+        readEntity(&t->second);
+        t->second.renderFromObject = r.ReadAnimatedTransform();
+        t->second.texName = r.ReadString();
+    };
+
+    // Read scene entities
+    r.Seek(header.entitiesOffset);
+    uint64_t nOptions = r.ReadValue<uint64_t>();
+    for (uint64_t i = 0; i < nOptions; ++i) {
+        std::string name = r.ReadString();
+        std::string value = r.ReadString();
+        Option(name, value, FileLoc());
+    }
+
+    for (SceneEntity *e : {&film, &sampler, &integrator, &filter, &accelerator})
+        readEntity(e);
+    readEntity(&camera);
+    AnimatedTransform renderFromCamera = r.ReadAnimatedTransform();
+    class Transform worldFromRender = r.ReadTransform();
+    camera.cameraTransform = CameraTransform(renderFromCamera, worldFromRender);
+    camera.medium = r.ReadString();
+    renderFromWorld = Inverse(worldFromRender);
+
+    namedMaterials.resize(r.ReadValue<uint64_t>());
+    for (auto &nm : namedMaterials) {
+        nm.first = r.ReadString();
+        readEntity(&nm.second);
+    }
+    materials.resize(r.ReadValue<uint64_t>());
+    for (SceneEntity &m : materials)
+        readEntity(&m);
+    media.clear();
+    uint64_t nMedia = r.ReadValue<uint64_t>();
+    for (uint64_t i = 0; i < nMedia; ++i) {
+        TransformedSceneEntity &m = media[r.ReadString()];
+        readEntity(&m);
+        m.renderFromObject = r.ReadAnimatedTransform();
+    }
+    floatTextures.resize(r.ReadValue<uint64_t>());
+    for (auto &t : floatTextures)
+        readTexture(&t);
+    spectrumTextures.resize(r.ReadValue<uint64_t>());
+    for (auto &t : spectrumTextures)
+        readTexture(&t);
+    lights.resize(r.ReadValue<uint64_t>());
+    for (LightSceneEntity &l : lights) {
+        readEntity(&l);
+        l.renderFromObject = r.ReadAnimatedTransform();
+        l.medium = r.ReadString();
+    }
+    areaLights.resize(r.ReadValue<uint64_t>());
+    for (SceneEntity &l : areaLights)
+        readEntity(&l);
+    shapes.resize(r.ReadValue<uint64_t>());
+    for (ShapeSceneEntity &s : shapes)
+        readShape(&s);
+    animatedShapes.resize(r.ReadValue<uint64_t>());
+    for (AnimatedShapeSceneEntity &s : animatedShapes)
+        readAnimatedShape(&s);
+    instances.resize(r.ReadValue<uint64_t>());
+    for (InstanceSceneEntity &inst : instances) {
+        inst.name = r.ReadString();
+        inst.loc = readLoc();
+        inst.renderFromInstanceAnim = r.ReadAnimatedTransform();
+        inst.renderFromInstance = readTransformIndex();
+    }
+    instanceDefinitions.clear();
+    uint64_t nDefinitions = r.ReadValue<uint64_t>();
+    for (uint64_t i = 0; i < nDefinitions; ++i) {
+        InstanceDefinitionSceneEntity &def = instanceDefinitions[r.ReadString()];
+        def.name = r.ReadString();
+        def.loc = readLoc();
+        def.shapes.resize(r.ReadValue<uint64_t>());
+        for (ShapeSceneEntity &s : def.shapes)
+            readShape(&s);
+        def.animatedShapes.resize(r.ReadValue<uint64_t>());
+        for (AnimatedShapeSceneEntity &s : def.animatedShapes)
+            readAnimatedShape(&s);
+    }
+
+    // The scene is complete, as if the world block had been parsed
+    currentBlock = BlockState::WorldBlock;
+}
+
 // FormattingScene Method Definitions
 FormattingScene::~FormattingScene() {
     if (errorExit)
         ErrorExit("Fatal errors during scene updating.");
 }
 
+void FormattingScene::printParameters(ParameterDictionary *dict,
+                                      const std::string &extra) {
+    // Write the parameters directly to stdout and then free them, so that
+    // memory use is bounded by the largest single entity in the scene
+    // rather than by the size of the entire scene.
+    fputs(extra.c_str(), stdout);
+    dict->WriteParameterList(stdout, catIndentCount);
+    dict->FreeParameters();
+}
+
 void FormattingScene::Option(const std::string &name, const std::string &value,
                              FileLoc loc) {
     std::string nName = normalizeArg(name);
@@ -1026,7 +2053,7 @@ void FormattingScene::PixelFilter(const std::string &name, ParsedParameterVector
     }
 
     Printf("%sPixelFilter \"%s\"\n", indent(), name);
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 void FormattingScene::Film(const std::string &type, ParsedParameterVector params,
@@ -1052,7 +2079,7 @@ void FormattingScene::Film(const std::string &type, ParsedParameterVector params
         Printf("%sFilm \"rgb\"\n", indent());
     else
         Printf("%sFilm \"%s\"\n", indent(), type);
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 void FormattingScene::Sampler(const std::string &name, ParsedParameterVector params,
@@ -1068,15 +2095,15 @@ void FormattingScene::Sampler(const std::string &name, ParsedParameterVector par
             Printf("%sSampler \"%s\"\n", indent(), name);
     } else
         Printf("%sSampler \"%s\"\n", indent(), name);
-    std::cout << dict.ToParameterList(catIndentCount);
+    printParameters(&dict);
 }
 
 void FormattingScene::Accelerator(const std::string &name, ParsedParameterVector params,
                                   FileLoc loc) {
     ParameterDictionary dict(std::move(params), RGBColorSpace::sRGB);
 
-    Printf("%sAccelerator \"%s\"\n%s", indent(), name,
-           dict.ToParameterList(catIndentCount));
+    Printf("%sAccelerator \"%s\"\n", indent(), name);
+    printParameters(&dict);
 }
 
 void FormattingScene::Integrator(const std::string &name, ParsedParameterVector params,
@@ -1111,7 +2138,7 @@ void FormattingScene::Integrator(const std::string &name, ParsedParameterVector
         extra += indent(1) + "\"integer maxdepth\" [ 1 ]\n";
     } else
         Printf("%sIntegrator \"%s\"\n", indent(), name);
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 void FormattingScene::Camera(const std::string &name, ParsedParameterVector params,
@@ -1126,18 +2153,18 @@ void FormattingScene::Camera(const std::string &name, ParsedParameterVector para
     if (upgrade && name == "realistic")
         dict.RemoveBool("simpleweighting");
 
-    std::cout << dict.ToParameterList(catIndentCount);
+    printParameters(&dict);
 }
 
 void FormattingScene::MakeNamedMedium(const std::string &name,
                                       ParsedParameterVector params, FileLoc loc) {
     ParameterDictionary dict(params, RGBColorSpace::sRGB);
     if (upgrade && name == "heterogeneous")
-        Printf("%sMakeNamedMedium \"%s\"\n%s\n", indent(), "uniformgrid",
-               dict.ToParameterList(catIndentCount));
+        Printf("%sMakeNamedMedium \"%s\"\n", indent(), "uniformgrid");
     else
-        Printf("%sMakeNamedMedium \"%s\"\n%s\n", indent(), name,
-               dict.ToParameterList(catIndentCount));
+        Printf("%sMakeNamedMedium \"%s\"\n", indent(), name);
+    printParameters(&dict);
+    Printf("\n");
 }
 
 void FormattingScene::MediumInterface(const std::string &insideName,
@@ -1298,7 +2325,7 @@ void FormattingScene::Texture(const std::string &name, const std::string &type,
     } else
         Printf("%sTexture \"%s\" \"%s\" \"%s\"\n", indent(), name, type, texname);
 
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 std::string FormattingScene::upgradeMaterialIndex(const std::string &name,
@@ -1514,7 +2541,7 @@ void FormattingScene::Material(const std::string &name, ParsedParameterVector pa
 #endif
 
     Printf("%sMaterial \"%s\"\n", indent(), newName);
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 void FormattingScene::MakeNamedMaterial(const std::string &name,
@@ -1541,10 +2568,14 @@ void FormattingScene::MakeNamedMaterial(const std::string &name,
         dict.RemoveString("type");
         extra = indent(1) + StringPrintf("\"string type\" [ \"%s\" ]\n", matName) + extra;
     }
-    std::cout << extra << dict.ToParameterList(catIndentCount);
-
-    if (upgrade)
+    if (upgrade) {
+        // The dictionary is kept for upgrading materials that refer to
+        // this one, so its parameters can't be freed.
+        fputs(extra.c_str(), stdout);
+        dict.WriteParameterList(stdout, catIndentCount);
         namedMaterialDictionaries[definedNamedMaterials[name]] = std::move(dict);
+    } else
+        printParameters(&dict, extra);
 }
 
 void FormattingScene::NamedMaterial(const std::string &name, FileLoc loc) {
@@ -1629,7 +2660,7 @@ void FormattingScene::LightSource(const std::string &name, ParsedParameterVector
         }
     }
 
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 void FormattingScene::AreaLightSource(const std::string &name,
@@ -1658,7 +2689,7 @@ void FormattingScene::AreaLightSource(const std::string &name,
 
     if (totalScale != 1)
         Printf("%s\"float scale\" [%f]\n", indent(1), totalScale);
-    std::cout << extra << dict.ToParameterList(catIndentCount);
+    printParameters(&dict, extra);
 }
 
 static std::string upgradeTriMeshUVs(const FormattingScene &scene,
@@ -1708,7 +2739,7 @@ void FormattingScene::Shape(const std::string &name, ParsedParameterVector param
         if (vi.size() < 500) {
             // It's a small mesh; don't bother with a PLY file after all.
             Printf("%sShape \"%s\"\n", indent(), name);
-            std::cout << dict.ToParameterList(catIndentCount);
+            printParameters(&dict);
         } else {
             static int count = 1;
             const char *plyPrefix =
@@ -1729,7 +2760,7 @@ void FormattingScene::Shape(const std::string &name, ParsedParameterVector param
             dict.RemoveInt("faceIndices");
 
             Printf("%sShape \"plymesh\" \"string filename\" \"%s\"\n", indent(), fn);
-            std::cout << dict.ToParameterList(catIndentCount);
+            printParameters(&dict);
         }
         return;
     }
@@ -1773,7 +2804,7 @@ void FormattingScene::Shape(const std::string &name, ParsedParameterVector param
         dict.RenameParameter("Kd", "reflectance");
     }
 
-    std::cout << dict.ToParameterList(catIndentCount);
+    printParameters(&dict);
 }
 
 void FormattingScene::ReverseOrientation(FileLoc loc) {
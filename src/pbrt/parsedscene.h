@@ -15,6 +15,8 @@
 #include <pbrt/util/transform.h>
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <unordered_set>
@@ -221,22 +223,36 @@ struct TransformHash {
 };
 
 // TransformCache Definition
+// The cache may be used concurrently from multiple threads; the table is
+// split into shards, each with its own lock and memory arena, so that
+// lookups of different transforms rarely contend. Returned pointers remain
+// valid for the lifetime of the cache.
 class TransformCache {
   public:
     // TransformCache Public Methods
-    TransformCache()
-        : bufferResource(Options->useGPU ? gpuMemoryAllocator.resource()
-                                         : Allocator().resource()),
-          alloc(&bufferResource) {}
+    TransformCache();
     ~TransformCache();
 
     const Transform *Lookup(const Transform &t);
+    // Like Lookup(), but transforms that are within
+    // Options->instanceIdentityTolerance of the identity are replaced by
+    // the identity, which lets instances that use them skip being
+    // transformed at all.
+    const Transform *LookupInstance(const Transform &t);
 
   private:
     // TransformCache Private Members
-    pstd::pmr::monotonic_buffer_resource bufferResource;
-    Allocator alloc;
-    std::unordered_set<Transform *, TransformHash> hashTable;
+    struct alignas(64) Shard {
+        Shard(pstd::pmr::memory_resource *upstream)
+            : bufferResource(16384, upstream), alloc(&bufferResource) {}
+
+        std::mutex mutex;
+        pstd::pmr::monotonic_buffer_resource bufferResource;
+        Allocator alloc;
+        std::unordered_set<Transform *, TransformHash> hashTable;
+    };
+    static constexpr int NumShards = 32;
+    std::unique_ptr<Shard> shards[NumShards];
 };
 
 // MaxTransforms Definition
@@ -272,6 +288,34 @@ struct TransformSet {
     Transform t[MaxTransforms];
 };
 
+// CopyOnWrite Definition
+// Holds a value that may be shared by many copies of the _CopyOnWrite_; a
+// private copy of it is only made when one of them modifies it.
+template <typename T>
+class CopyOnWrite {
+  public:
+    // CopyOnWrite Public Methods
+    CopyOnWrite() : value(std::make_shared<T>()) {}
+
+    const T &operator*() const { return *value; }
+    const T *operator->() const { return value.get(); }
+
+    T &Mutable() {
+        if (value.use_count() > 1)
+            value = std::make_shared<T>(*value);
+        return *value;
+    }
+    void Set(T v) {
+        if (value.use_count() > 1)
+            value = std::make_shared<T>(std::move(v));
+        else
+            *value = std::move(v);
+    }
+
+  private:
+    std::shared_ptr<T> value;
+};
+
 // ParsedScene Definition
 class ParsedScene : public SceneRepresentation {
   public:
@@ -324,6 +368,8 @@ class ParsedScene : public SceneRepresentation {
 
     void EndOfFiles();
 
+    Allocator ParameterAllocator();
+
     std::string ToString() const;
 
     NamedTextures CreateTextures(Allocator alloc, bool gpu) const;
@@ -334,6 +380,17 @@ class ParsedScene : public SceneRepresentation {
 
     std::map<std::string, MediumHandle> CreateMedia(Allocator alloc) const;
 
+    // Files loaded with "Import" are parsed concurrently, each into a copy of
+    // the importing scene's state, and then merged back in statement order.
+    std::unique_ptr<ParsedScene> CopyForImport(FileLoc loc) const;
+    void MergeImported(ParsedScene *importScene);
+
+    // Binary scene files store the scene's entities after parsing, so that
+    // large scenes can be reloaded without tokenizing the text description.
+    static bool IsBinarySceneFile(const std::string &filename);
+    void WriteBinary(const std::string &filename) const;
+    void ReadBinary(const std::string &filename);
+
     // ParsedScene Public Members
     SceneEntity film, sampler, integrator, filter, accelerator;
     CameraSceneEntity camera;
@@ -356,30 +413,36 @@ class ParsedScene : public SceneRepresentation {
         GraphicsState();
 
         // GraphicsState Public Members
-        std::string currentInsideMedium, currentOutsideMedium;
+        // Members that aren't plain values are shared with the graphics
+        // states pushed by AttributeBegin and ObjectBegin until one of them
+        // changes, so that pushing a state doesn't copy them.
+        CopyOnWrite<std::string> currentInsideMedium, currentOutsideMedium;
 
         int currentMaterialIndex = 0;
-        std::string currentMaterialName;
-
-        std::string areaLightName;
-        ParameterDictionary areaLightParams;
-        FileLoc areaLightLoc;
-
-        ParsedParameterVector shapeAttributes;
-        ParsedParameterVector lightAttributes;
-        ParsedParameterVector materialAttributes;
-        ParsedParameterVector mediumAttributes;
-        ParsedParameterVector textureAttributes;
+        CopyOnWrite<std::string> currentMaterialName;
+
+        struct AreaLight {
+            std::string name;
+            ParameterDictionary parameters;
+            FileLoc loc;
+        };
+        CopyOnWrite<AreaLight> areaLight;
+
+        struct Attributes {
+            ParsedParameterVector shape, light, material, medium, texture;
+        };
+        CopyOnWrite<Attributes> attributes;
         bool reverseOrientation = false;
         const RGBColorSpace *colorSpace = RGBColorSpace::sRGB;
-        TransformSet ctm;
+        CopyOnWrite<TransformSet> ctm;
         uint32_t activeTransformBits = AllTransformsBits;
         Float transformStartTime = 0, transformEndTime = 1;
     };
 
     // ParsedScene Private Methods
     class Transform RenderFromObject(int index) const {
-        return pbrt::Transform((renderFromWorld * graphicsState.ctm[index]).GetMatrix());
+        const TransformSet &ctm = *graphicsState.ctm;
+        return pbrt::Transform((renderFromWorld * ctm[index]).GetMatrix());
     }
 
     AnimatedTransform RenderFromObject() const {
@@ -387,7 +450,7 @@ class ParsedScene : public SceneRepresentation {
                 RenderFromObject(1), graphicsState.transformEndTime};
     }
 
-    bool CTMIsAnimated() const { return graphicsState.ctm.IsAnimated(); }
+    bool CTMIsAnimated() const { return graphicsState.ctm->IsAnimated(); }
 
     // ParsedScene Private Members
     GraphicsState graphicsState;
@@ -402,6 +465,15 @@ class ParsedScene : public SceneRepresentation {
     std::vector<GraphicsState> pushedGraphicsStates;
     std::vector<std::pair<char, FileLoc>> pushStack;  // 'a': attribute, 'o': object
     InstanceDefinitionSceneEntity *currentInstance = nullptr;
+    std::vector<std::pair<std::string, std::string>> optionStatements;
+    // Set for scenes created by CopyForImport(); materials before
+    // _importedMaterialsStart_ are the importing scene's.
+    bool importing = false;
+    int importedMaterialsStart = 0;
+    // Parsed parameters are allocated from the first arena and are all
+    // released together when the scene is destroyed; the arenas of imported
+    // scenes are adopted along with their entities.
+    std::vector<std::unique_ptr<ArenaMemoryResource>> parameterArenas;
 };
 
 class FormattingScene : public SceneRepresentation {
@@ -463,6 +535,7 @@ class FormattingScene : public SceneRepresentation {
     }
 
   private:
+    void printParameters(ParameterDictionary *dict, const std::string &extra = "");
     std::string upgradeMaterialIndex(const std::string &name, ParameterDictionary *dict,
                                      FileLoc loc) const;
     std::string upgradeMaterial(std::string *name, ParameterDictionary *dict,
@@ -11,10 +11,12 @@
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
 
 #include <double-conversion/double-conversion.h>
+#include <zlib.h>
 
 #include <cctype>
 #include <cstdio>
@@ -28,10 +30,17 @@
 #elif defined(PBRT_IS_WINDOWS)
 #include <windows.h>  // Windows file mapping API
 #endif
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -115,6 +124,164 @@ static double_conversion::StringToDoubleConverter floatParser(
     double_conversion::StringToDoubleConverter::ALLOW_HEX, 0. /* empty string value */,
     0. /* junk string value */, nullptr /* infinity symbol */, nullptr /* NaN symbol */);
 
+#ifdef PBRT_HAVE_MMAP
+// GzipStream Definition
+// Decompresses a gzip-compressed scene file on a separate thread so that
+// tokenizing can start before decompression finishes. The text is written
+// into a range of address space that is reserved up front and committed as
+// it fills, so that it never moves and the std::string_views returned by
+// the Tokenizer stay valid. The compressed file is read through a small
+// fixed-size buffer rather than being read or mapped in its entirety.
+class GzipStream {
+  public:
+    // GzipStream Public Methods
+    static std::unique_ptr<GzipStream> Open(const std::string &filename,
+                                            std::string *error);
+    ~GzipStream();
+
+    const char *Data() const { return buffer; }
+    // Blocks until more than _n_ bytes have been decompressed or the end of
+    // the stream has been reached and returns the number of bytes available.
+    size_t WaitForMore(size_t n);
+    // Returns a description of the error that ended decompression early, if
+    // there was one, the first time it is called.
+    std::string TakeError();
+
+  private:
+    // GzipStream Private Methods
+    GzipStream(FILE *f, char *buffer, size_t reserved)
+        : file(f), buffer(buffer), reserved(reserved) {}
+    void decompress();
+    void finish(std::string err);
+
+    // GzipStream Private Members
+    static constexpr size_t InputBufferSize = 256 * 1024;
+    static constexpr size_t CommitSize = 4 * 1024 * 1024;
+    FILE *file;
+    char *buffer;
+    size_t reserved, committed = 0;
+    std::thread thread;
+    std::atomic<bool> cancelled{false};
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t available = 0;
+    bool done = false;
+    std::string error;
+};
+
+// GzipStream Method Definitions
+std::unique_ptr<GzipStream> GzipStream::Open(const std::string &filename,
+                                             std::string *error) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        *error = StringPrintf("%s: %s", filename, ErrorString());
+        return nullptr;
+    }
+    // The reservation only consumes address space; pages are committed
+    // as decompressed text is written to them.
+    size_t reserved = sizeof(void *) == 8 ? (size_t(1) << 36) : (size_t(1) << 30);
+    void *ptr = mmap(nullptr, reserved, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        *error = StringPrintf("%s: mmap: %s", filename, ErrorString());
+        fclose(f);
+        return nullptr;
+    }
+
+    std::unique_ptr<GzipStream> stream(new GzipStream(f, (char *)ptr, reserved));
+    stream->thread = std::thread([s = stream.get()]() { s->decompress(); });
+    return stream;
+}
+
+GzipStream::~GzipStream() {
+    cancelled = true;
+    thread.join();
+    munmap(buffer, reserved);
+}
+
+void GzipStream::decompress() {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // Adding 16 to the window size has zlib expect a gzip header.
+    if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+        fclose(file);
+        finish("unable to initialize zlib");
+        return;
+    }
+
+    std::vector<unsigned char> input(InputBufferSize);
+    std::string err;
+    size_t written = 0;
+    int ret = Z_OK;
+    while (!cancelled) {
+        if (zs.avail_in == 0) {
+            zs.next_in = input.data();
+            zs.avail_in = fread(input.data(), 1, input.size(), file);
+            if (zs.avail_in == 0) {
+                if (ferror(file))
+                    err = StringPrintf("error reading compressed scene file: %s",
+                                       ErrorString());
+                else if (ret != Z_STREAM_END)
+                    err = "unexpected end of compressed scene file";
+                break;
+            }
+        }
+        // Concatenated gzip files are valid gzip files.
+        if (ret == Z_STREAM_END)
+            inflateReset(&zs);
+
+        if (written == committed) {
+            if (committed + CommitSize > reserved) {
+                err = "decompressed scene file is too large";
+                break;
+            }
+            if (mprotect(buffer + committed, CommitSize, PROT_READ | PROT_WRITE) != 0) {
+                err = StringPrintf("mprotect: %s", ErrorString());
+                break;
+            }
+            committed += CommitSize;
+        }
+
+        zs.next_out = (unsigned char *)buffer + written;
+        zs.avail_out = committed - written;
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            err = StringPrintf("corrupt compressed scene file: %s",
+                               zs.msg ? zs.msg : "unknown zlib error");
+            break;
+        }
+
+        if (committed - zs.avail_out != written) {
+            written = committed - zs.avail_out;
+            std::lock_guard<std::mutex> lock(mutex);
+            available = written;
+            cv.notify_all();
+        }
+    }
+
+    inflateEnd(&zs);
+    fclose(file);
+    finish(std::move(err));
+}
+
+void GzipStream::finish(std::string err) {
+    std::lock_guard<std::mutex> lock(mutex);
+    error = std::move(err);
+    done = true;
+    cv.notify_all();
+}
+
+size_t GzipStream::WaitForMore(size_t n) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return available > n || done; });
+    return available;
+}
+
+std::string GzipStream::TakeError() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return std::move(error);
+}
+#endif  // PBRT_HAVE_MMAP
+
 std::unique_ptr<Tokenizer> Tokenizer::CreateFromFile(
     const std::string &filename,
     std::function<void(const char *, const FileLoc *)> errorCallback) {
@@ -128,6 +295,50 @@ std::unique_ptr<Tokenizer> Tokenizer::CreateFromFile(
         return std::make_unique<Tokenizer>(std::move(str), std::move(errorCallback));
     }
 
+    if (HasExtension(filename, "zst")) {
+        errorCallback(StringPrintf("%s: zstd-compressed scene files are not supported; "
+                                   "use gzip instead",
+                                   filename)
+                          .c_str(),
+                      nullptr);
+        return nullptr;
+    }
+
+    if (HasExtension(filename, "gz")) {
+#ifdef PBRT_HAVE_MMAP
+        std::string error;
+        std::unique_ptr<GzipStream> stream = GzipStream::Open(filename, &error);
+        if (!stream) {
+            errorCallback(error.c_str(), nullptr);
+            return nullptr;
+        }
+        return std::make_unique<Tokenizer>(std::move(stream), filename,
+                                           std::move(errorCallback));
+#else
+        // Without a way to reserve address space for the decompressed
+        // text, decompress all of it before tokenizing starts.
+        gzFile gz = gzopen(filename.c_str(), "rb");
+        if (!gz) {
+            errorCallback(StringPrintf("%s: %s", filename, ErrorString()).c_str(),
+                          nullptr);
+            return nullptr;
+        }
+        std::string str;
+        char buf[65536];
+        int n;
+        while ((n = gzread(gz, buf, sizeof(buf))) > 0)
+            str.append(buf, n);
+        int err;
+        std::string message = n < 0 ? gzerror(gz, &err) : "";
+        gzclose(gz);
+        if (n < 0) {
+            errorCallback(StringPrintf("%s: %s", filename, message).c_str(), nullptr);
+            return nullptr;
+        }
+        return std::make_unique<Tokenizer>(std::move(str), std::move(errorCallback));
+#endif
+    }
+
 #ifdef PBRT_HAVE_MMAP
     int fd = open(filename.c_str(), O_RDONLY);
     if (fd == -1) {
@@ -228,6 +439,36 @@ Tokenizer::Tokenizer(void *ptr, size_t len, std::string filename,
 }
 #endif
 
+#ifdef PBRT_HAVE_MMAP
+Tokenizer::Tokenizer(std::unique_ptr<GzipStream> s, std::string filename,
+                     std::function<void(const char *, const FileLoc *)> errorCallback)
+    : errorCallback(std::move(errorCallback)), stream(std::move(s)) {
+    // As above, the filename needs to outlive the Tokenizer.
+    loc = FileLoc(*new std::string(filename));
+    pos = end = stream->Data();
+}
+#endif
+
+bool Tokenizer::waitForInput() {
+#ifdef PBRT_HAVE_MMAP
+    if (!stream)
+        return false;
+
+    size_t consumed = end - stream->Data();
+    size_t available = stream->WaitForMore(consumed);
+    if (available == consumed) {
+        if (std::string error = stream->TakeError(); !error.empty())
+            errorCallback(error.c_str(), &loc);
+        return false;
+    }
+    tokenizerMemory += available - consumed;
+    end = stream->Data() + available;
+    return true;
+#else
+    return false;
+#endif
+}
+
 Tokenizer::~Tokenizer() {
 #ifdef PBRT_HAVE_MMAP
     if ((unmapPtr != nullptr) && unmapLength > 0)
@@ -312,28 +553,109 @@ pstd::optional<Token> Tokenizer::Next() {
     }
 }
 
-static double parseNumber(const Token &t) {
+pstd::optional<std::string_view> Tokenizer::ScanNumberArray() {
+    const char *p = pos, *lineStart = nullptr;
+    int nLines = 0;
+    for (;; ++p) {
+        if (p == end && !waitForInput())
+            return {};
+        char ch = *p;
+        if (ch == ']')
+            break;
+        if (ch == '\n') {
+            ++nLines;
+            lineStart = p + 1;
+        } else if (!((ch >= '0' && ch <= '9') || ch == '.' || ch == '-' || ch == '+' ||
+                     ch == 'e' || ch == 'E' || ch == ' ' || ch == '\t' || ch == '\r'))
+            return {};
+    }
+
+    // Update the location as getChar() would have, including the ']'
+    std::string_view numbers(pos, p - pos);
+    if (nLines > 0) {
+        loc.line += nLines;
+        loc.column = p + 1 - lineStart;
+    } else
+        loc.column += p + 1 - pos;
+    pos = p + 1;
+    return numbers;
+}
+
+// Parses decimal numbers with few enough significant digits that they can
+// be computed exactly with a single multiplication or division by an
+// exactly-representable power of ten, which gives a correctly-rounded
+// result (Clinger's fast path). Returns false for anything else.
+template <typename T>
+static bool parseNumberFast(std::string_view str, double *value) {
+    constexpr uint64_t maxMantissa = uint64_t(1) << std::numeric_limits<T>::digits;
+    constexpr int maxExponent = std::is_same_v<T, float> ? 10 : 22;
+    static const T powersOfTen[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+                                    1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+                                    1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+    const char *p = str.data(), *end = str.data() + str.size();
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0, nDigits = 0;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p, ++nDigits)
+        mantissa = mantissa * 10 + (*p - '0');
+    if (p != end && *p == '.')
+        for (++p; p != end && *p >= '0' && *p <= '9'; ++p, ++nDigits, --exponent)
+            mantissa = mantissa * 10 + (*p - '0');
+    if (nDigits == 0 || nDigits > 19)
+        return false;
+
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negativeExponent = false;
+        if (p != end && (*p == '-' || *p == '+'))
+            negativeExponent = *p++ == '-';
+        if (p == end)
+            return false;
+        int e = 0;
+        for (; p != end && *p >= '0' && *p <= '9' && e < 1000; ++p)
+            e = e * 10 + (*p - '0');
+        exponent += negativeExponent ? -e : e;
+    }
+    if (p != end || mantissa > maxMantissa || exponent < -maxExponent ||
+        exponent > maxExponent)
+        return false;
+
+    T v = T(mantissa);
+    v = exponent < 0 ? v / powersOfTen[-exponent] : v * powersOfTen[exponent];
+    *value = negative ? -v : v;
+    return true;
+}
+
+static double parseNumber(std::string_view str, const FileLoc &loc) {
     // Fast path for a single digit
-    if (t.token.size() == 1) {
-        if (!(t.token[0] >= '0' && t.token[0] <= '9'))
-            ErrorExit(&t.loc, "\"%c\": expected a number", t.token[0]);
-        return t.token[0] - '0';
+    if (str.size() == 1) {
+        if (!(str[0] >= '0' && str[0] <= '9'))
+            ErrorExit(&loc, "\"%c\": expected a number", str[0]);
+        return str[0] - '0';
     }
 
+    double val;
+    if (parseNumberFast<Float>(str, &val))
+        return val;
+
     // Copy to a buffer so we can NUL-terminate it, as strto[idf]() expect.
     char buf[64];
     char *bufp = buf;
     std::unique_ptr<char[]> allocBuf;
-    CHECK_RARE(1e-5, t.token.size() + 1 >= sizeof(buf));
-    if (t.token.size() + 1 >= sizeof(buf)) {
+    CHECK_RARE(1e-5, str.size() + 1 >= sizeof(buf));
+    if (str.size() + 1 >= sizeof(buf)) {
         // This should be very unusual, but is necessary in case we get a
         // goofball number with lots of leading zeros, for example.
-        allocBuf = std::make_unique<char[]>(t.token.size() + 1);
+        allocBuf = std::make_unique<char[]>(str.size() + 1);
         bufp = allocBuf.get();
     }
 
-    std::copy(t.token.begin(), t.token.end(), bufp);
-    bufp[t.token.size()] = '\0';
+    std::copy(str.begin(), str.end(), bufp);
+    bufp[str.size()] = '\0';
 
     // Can we just use strtol?
     auto isInteger = [](std::string_view str) {
@@ -344,22 +666,136 @@ static double parseNumber(const Token &t) {
     };
 
     int length = 0;
-    double val;
-    if (isInteger(t.token)) {
+    if (isInteger(str)) {
         char *endptr;
         val = double(strtol(bufp, &endptr, 10));
         length = endptr - bufp;
     } else if (sizeof(Float) == sizeof(float))
-        val = floatParser.StringToFloat(bufp, t.token.size(), &length);
+        val = floatParser.StringToFloat(bufp, str.size(), &length);
     else
-        val = floatParser.StringToDouble(bufp, t.token.size(), &length);
+        val = floatParser.StringToDouble(bufp, str.size(), &length);
 
     if (length == 0)
-        ErrorExit(&t.loc, "%s: expected a number", toString(t.token));
+        ErrorExit(&loc, "%s: expected a number", toString(str));
 
     return val;
 }
 
+static double parseNumber(const Token &t) {
+    return parseNumber(t.token, t.loc);
+}
+
+// Parses the whitespace-separated numbers in _str_, which may hold tens of
+// millions of them for large meshes; large arrays are split into chunks at
+// whitespace and parsed in parallel.
+static void parseNumbers(std::string_view str, const FileLoc &loc,
+                         pstd::vector<double> *numbers) {
+    auto isSpace = [](char ch) {
+        return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r';
+    };
+    auto parseChunk = [&](std::string_view chunk, auto *values) {
+        size_t i = 0;
+        while (true) {
+            while (i < chunk.size() && isSpace(chunk[i]))
+                ++i;
+            if (i == chunk.size())
+                return;
+            size_t start = i;
+            while (i < chunk.size() && !isSpace(chunk[i]))
+                ++i;
+            values->push_back(parseNumber(chunk.substr(start, i - start), loc));
+        }
+    };
+
+    constexpr size_t chunkSize = 1024 * 1024;
+    if (str.size() < 2 * chunkSize) {
+        // Parse into a reused buffer so that _numbers_, which may be
+        // allocated from an arena that doesn't reuse freed memory, is only
+        // allocated once rather than each time it grows.
+        thread_local std::vector<double> values;
+        values.clear();
+        parseChunk(str, &values);
+        size_t offset = numbers->size();
+        numbers->resize(offset + values.size());
+        std::copy(values.begin(), values.end(), numbers->begin() + offset);
+        return;
+    }
+
+    // Find chunk boundaries so that no number is split across two chunks
+    std::vector<size_t> chunkStart(1, 0);
+    for (size_t start = chunkSize; start < str.size(); start += chunkSize) {
+        start = std::max(start, chunkStart.back());
+        while (start < str.size() && !isSpace(str[start]))
+            ++start;
+        chunkStart.push_back(start);
+    }
+    chunkStart.push_back(str.size());
+
+    std::vector<std::vector<double>> chunkValues(chunkStart.size() - 1);
+    ParallelFor(0, chunkValues.size(), [&](int64_t i) {
+        // Assume at least 4 characters per number
+        chunkValues[i].reserve((chunkStart[i + 1] - chunkStart[i]) / 4);
+        parseChunk(str.substr(chunkStart[i], chunkStart[i + 1] - chunkStart[i]),
+                   &chunkValues[i]);
+    });
+
+    size_t offset = numbers->size(), nValues = 0;
+    for (const std::vector<double> &values : chunkValues)
+        nValues += values.size();
+    numbers->resize(offset + nValues);
+    for (const std::vector<double> &values : chunkValues) {
+        std::copy(values.begin(), values.end(), numbers->begin() + offset);
+        offset += values.size();
+    }
+}
+
+// Appends _count_ values stored in _filename_ starting at byte _offset_ to
+// _numbers_; they are little-endian 32-bit integers if _isInteger_ is true
+// and 32-bit floats otherwise.
+static void readBinaryNumbers(const std::string &filename, int64_t offset, int64_t count,
+                              bool isInteger, const FileLoc &loc,
+                              pstd::vector<double> *numbers) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f)
+        ErrorExit(&loc, "%s: %s", filename, ErrorString());
+#ifdef PBRT_IS_WINDOWS
+    if (_fseeki64(f, offset, SEEK_SET) != 0)
+#else
+    if (fseeko(f, offset, SEEK_SET) != 0)
+#endif
+        ErrorExit(&loc, "%s: %s", filename, ErrorString());
+
+    uint32_t one = 1;
+    bool littleEndian = *reinterpret_cast<uint8_t *>(&one) == 1;
+    size_t start = numbers->size();
+    numbers->resize(start + count);
+
+    // Read and convert the values a buffer's worth at a time.
+    std::vector<uint32_t> buf(std::min<int64_t>(count, 1024 * 1024));
+    for (int64_t i = 0; i < count; i += buf.size()) {
+        size_t n = std::min<int64_t>(buf.size(), count - i);
+        if (fread(buf.data(), sizeof(uint32_t), n, f) != n)
+            ErrorExit(&loc, "%s: premature end of file reading %d values at offset %d",
+                      filename, count, offset);
+        for (size_t j = 0; j < n; ++j) {
+            uint32_t bits = buf[j];
+            if (!littleEndian)
+                bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) |
+                       (bits << 24);
+            double v;
+            if (isInteger)
+                v = int32_t(bits);
+            else {
+                float fv;
+                std::memcpy(&fv, &bits, sizeof(float));
+                v = fv;
+            }
+            (*numbers)[start + i + j] = v;
+        }
+    }
+    fclose(f);
+}
+
 inline bool isQuotedString(std::string_view str) {
     return str.size() >= 2 && str[0] == '"' && str.back() == '"';
 }
@@ -377,9 +813,10 @@ static std::string_view dequoteString(const Token &t) {
 constexpr int TokenOptional = 0;
 constexpr int TokenRequired = 1;
 
-template <typename Next, typename Unget>
+template <typename Next, typename Unget, typename ScanNumbers>
 static ParsedParameterVector parseParameters(
-    Next nextToken, Unget ungetToken, Allocator alloc, bool formatting,
+    Next nextToken, Unget ungetToken, ScanNumbers scanNumberArray, Allocator alloc,
+    bool formatting,
     const std::function<void(const Token &token, const char *)> &errorCallback) {
     ParsedParameterVector parameterVector;
 
@@ -499,7 +936,34 @@ static ParsedParameterVector parseParameters(
 
         Token val = *nextToken(TokenRequired);
 
+        if (val.token == "binary") {
+            // The values are stored in a separate file:
+            // binary "filename" <byte offset> <number of values>
+            if (param->type == "bool" || param->type == "string" ||
+                param->type == "texture")
+                errorCallback(val, "binary values must be numeric");
+            std::string filename =
+                ResolveFilename(toString(dequoteString(*nextToken(TokenRequired))));
+            Token offsetToken = *nextToken(TokenRequired);
+            Token countToken = *nextToken(TokenRequired);
+            double offset = parseNumber(offsetToken), count = parseNumber(countToken);
+            if (offset < 0 || offset != int64_t(offset))
+                errorCallback(offsetToken, "expected a non-negative integer offset");
+            if (count < 0 || count != int64_t(count))
+                errorCallback(countToken, "expected a non-negative integer count");
+            readBinaryNumbers(filename, offset, count, param->type == "integer", val.loc,
+                              &param->numbers);
+            parameterVector.push_back(param);
+            continue;
+        }
+
         if (val.token == "[") {
+            // Numeric arrays are parsed directly from the file's text
+            if (pstd::optional<std::string_view> numbers = scanNumberArray()) {
+                parseNumbers(*numbers, val.loc, &param->numbers);
+                parameterVector.push_back(param);
+                continue;
+            }
             while (true) {
                 val = *nextToken(TokenRequired);
                 if (val.token == "]")
@@ -531,18 +995,35 @@ static ParsedParameterVector parseParameters(
     return parameterVector;
 }
 
+TrackedMemoryResource *ParsedParameterMemoryResource() {
+    static TrackedMemoryResource memoryResource;
+    return &memoryResource;
+}
+
+Allocator SceneRepresentation::ParameterAllocator() {
+    return Allocator(ParsedParameterMemoryResource());
+}
+
 static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
     FormattingScene *formattingScene = dynamic_cast<FormattingScene *>(scene);
     bool formatting = formattingScene != nullptr;
 
-    TrackedMemoryResource memoryResource;
-    Allocator alloc(&memoryResource);
+    Allocator alloc = scene->ParameterAllocator();
 
     static bool warnedTransformBeginEndDeprecated = false;
 
+    // Each file in _fileStack_ has a corresponding entry in _fileStats_
+    // that records the time spent parsing it and the memory allocated for
+    // its parameters.
     std::vector<std::unique_ptr<Tokenizer>> fileStack;
+    std::vector<std::unique_ptr<EntityStatsScope>> fileStats;
+    fileStats.push_back(
+        std::make_unique<EntityStatsScope>("File", t->loc.filename, nullptr, alloc));
     fileStack.push_back(std::move(t));
 
+    // Scenes for files loaded with "Import" that are being parsed concurrently
+    std::vector<std::pair<std::unique_ptr<ParsedScene>, Future<void>>> imports;
+
     pstd::optional<Token> ungetToken;
 
     auto parseError = [&](const char *msg, const FileLoc *loc) {
@@ -569,6 +1050,7 @@ static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
         if (!tok) {
             // We've reached EOF in the current file. Anything more to parse?
             fileStack.pop_back();
+            fileStats.pop_back();
             return nextToken(flags);
         } else if (tok->token[0] == '#') {
             // Swallow comments, unless --format or --toply was given, in
@@ -587,6 +1069,12 @@ static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
         ungetToken = t;
     };
 
+    auto scanNumberArray = [&]() -> pstd::optional<std::string_view> {
+        if (ungetToken.has_value() || fileStack.empty())
+            return {};
+        return fileStack.back()->ScanNumberArray();
+    };
+
     // Helper function for pbrt API entrypoints that take a single string
     // parameter and a ParameterVector (e.g. pbrtShape()).
     // using BasicEntrypoint = void (ParsedScene::*)(const std::string &,
@@ -599,7 +1087,8 @@ static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
         std::string_view dequoted = dequoteString(t);
         std::string n = toString(dequoted);
         ParsedParameterVector parameterVector = parseParameters(
-            nextToken, unget, alloc, formatting, [&](const Token &t, const char *msg) {
+            nextToken, unget, scanNumberArray, fileStats.back()->Alloc(), formatting,
+            [&](const Token &t, const char *msg) {
                 std::string token = toString(t.token);
                 std::string str = StringPrintf("%s: %s", token, msg);
                 parseError(str.c_str(), &t.loc);
@@ -696,8 +1185,40 @@ static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
                     filename = ResolveFilename(filename);
                     std::unique_ptr<Tokenizer> tinc =
                         Tokenizer::CreateFromFile(filename, parseError);
-                    if (tinc)
+                    if (tinc) {
+                        fileStats.push_back(std::make_unique<EntityStatsScope>(
+                            "File", filename, &tok->loc, alloc));
                         fileStack.push_back(std::move(tinc));
+                    }
+                }
+            } else if (tok->token == "Import") {
+                Token filenameToken = *nextToken(TokenRequired);
+                std::string filename = toString(dequoteString(filenameToken));
+                if (formatting)
+                    Printf("%sImport \"%s\"\n",
+                           dynamic_cast<FormattingScene *>(scene)->indent(), filename);
+                else {
+                    ParsedScene *parsedScene = dynamic_cast<ParsedScene *>(scene);
+                    CHECK(parsedScene != nullptr);
+                    // Parse the imported file concurrently into a copy of the
+                    // current scene state; it's merged back in once this file
+                    // has been parsed.
+                    std::unique_ptr<ParsedScene> importScene =
+                        parsedScene->CopyForImport(tok->loc);
+                    filename = ResolveFilename(filename);
+                    Future<void> importParsed = RunAsync(
+                        [](ParsedScene *importScene, std::string filename) {
+                            auto importError = [](const char *msg, const FileLoc *loc) {
+                                ErrorExit(loc, "%s", msg);
+                            };
+                            std::unique_ptr<Tokenizer> timport =
+                                Tokenizer::CreateFromFile(filename, importError);
+                            if (timport)
+                                parse(importScene, std::move(timport));
+                        },
+                        importScene.get(), filename);
+                    imports.push_back(
+                        std::make_pair(std::move(importScene), std::move(importParsed)));
                 }
             } else if (tok->token == "Identity")
                 scene->Identity(tok->loc);
@@ -852,7 +1373,7 @@ static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
                 std::string_view dequoted = dequoteString(t);
                 std::string texName = toString(dequoted);
                 ParsedParameterVector params = parseParameters(
-                    nextToken, unget, alloc, formatting,
+                    nextToken, unget, scanNumberArray, fileStats.back()->Alloc(), formatting,
                     [&](const Token &t, const char *msg) {
                         std::string token = toString(t.token);
                         std::string str = StringPrintf("%s: %s", token, msg);
@@ -877,6 +1398,12 @@ static void parse(SceneRepresentation *scene, std::unique_ptr<Tokenizer> t) {
             syntaxError(*tok);
         }
     }
+
+    // Merge imported files in the order that they were imported
+    for (auto &import : imports) {
+        import.second.Wait();
+        dynamic_cast<ParsedScene *>(scene)->MergeImported(import.first.get());
+    }
 }
 
 void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filenames) {
@@ -884,6 +1411,17 @@ void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filena
         ErrorExit(loc, "%s", msg);
     };
 
+    // Load binary scene files directly, without going through the tokenizer
+    if (filenames.size() == 1 && ParsedScene::IsBinarySceneFile(filenames[0])) {
+        ParsedScene *parsedScene = dynamic_cast<ParsedScene *>(scene);
+        if (!parsedScene)
+            ErrorExit("%s: binary scene files can only be rendered.", filenames[0]);
+        SetSearchDirectory(filenames[0]);
+        parsedScene->ReadBinary(filenames[0]);
+        scene->EndOfFiles();
+        return;
+    }
+
     // Process scene description
     if (filenames.empty()) {
         // Parse scene from standard input
@@ -116,6 +116,10 @@ class SceneRepresentation {
 
     virtual void EndOfFiles() = 0;
 
+    // Returns the allocator that the scene's parsed parameters are allocated
+    // with; it is only used by the thread that parses into the scene.
+    virtual Allocator ParameterAllocator();
+
   protected:
     // SceneRepresentation Protected Methods
     template <typename... Args>
@@ -132,10 +136,18 @@ class SceneRepresentation {
     mutable bool errorExit = false;
 };
 
+class TrackedMemoryResource;
+
 // Scene Parsing Declarations
 void ParseFiles(SceneRepresentation *scene, pstd::span<const std::string> filenames);
 void ParseString(SceneRepresentation *scene, std::string str);
 
+// Returns the memory resource that parsed parameters are allocated from,
+// which tracks how much memory they are using.
+TrackedMemoryResource *ParsedParameterMemoryResource();
+
+class GzipStream;
+
 // Token Definition
 struct Token {
     Token() = default;
@@ -154,6 +166,10 @@ class Tokenizer {
 #if defined(PBRT_HAVE_MMAP) || defined(PBRT_IS_WINDOWS)
     Tokenizer(void *ptr, size_t len, std::string filename,
               std::function<void(const char *, const FileLoc *)> errorCallback);
+#endif
+#ifdef PBRT_HAVE_MMAP
+    Tokenizer(std::unique_ptr<GzipStream> stream, std::string filename,
+              std::function<void(const char *, const FileLoc *)> errorCallback);
 #endif
     ~Tokenizer();
 
@@ -166,6 +182,11 @@ class Tokenizer {
 
     pstd::optional<Token> Next();
 
+    // If the input up to the next ']' holds only numbers and whitespace,
+    // returns a view of it and advances past the ']'; otherwise returns an
+    // unset optional without consuming anything.
+    pstd::optional<std::string_view> ScanNumberArray();
+
     // Just for parse().
     // TODO? Have a method to set this?
     FileLoc loc;
@@ -173,7 +194,7 @@ class Tokenizer {
   private:
     // Tokenizer Private Methods
     int getChar() {
-        if (pos == end)
+        if (pos == end && !waitForInput())
             return EOF;
         int ch = *pos++;
         if (ch == '\n') {
@@ -190,6 +211,7 @@ class Tokenizer {
             // the next line again shortly...
             --loc.line;
     }
+    bool waitForInput();
 
     // Tokenizer Private Members
     // This function is called if there is an error during lexing.
@@ -209,6 +231,11 @@ class Tokenizer {
     // simpler.
     std::string contents;
 
+    // Compressed scene files are decompressed on a separate thread while
+    // they are being tokenized; when _pos_ reaches _end_, waitForInput()
+    // waits for the stream to provide more text.
+    std::unique_ptr<GzipStream> stream;
+
     // Pointers to the current position in the file and one past the end of
     // the file.
     const char *pos, *end;
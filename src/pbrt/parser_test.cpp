@@ -4,12 +4,21 @@
 
 #include <gtest/gtest.h>
 
+#include <pbrt/options.h>
+#include <pbrt/parsedscene.h>
 #include <pbrt/parser.h>
 #include <pbrt/pbrt.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 
+#include <zlib.h>
+
 #include <fstream>
 #include <initializer_list>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -144,3 +153,332 @@ Integrator "deep" "float density" [ 2 2.66612 -5e-51]
 
     EXPECT_EQ(0, remove(filename.c_str()));
 }
+
+TEST(Parser, BinarySceneRoundTrip) {
+    ParsedScene scene;
+    ParseString(&scene, R"(
+LookAt 0 1 5  0 0 0  0 1 0
+Camera "perspective" "float fov" 45
+Film "rgb" "string filename" "out.exr" "integer xresolution" 64
+WorldBegin
+LightSource "infinite" "rgb L" [ .5 .6 .7 ]
+Texture "checks" "spectrum" "checkerboard" "float uscale" 4 "rgb tex1" [ 1 0 0 ]
+MakeNamedMaterial "red" "string type" "diffuse" "texture reflectance" "checks"
+NamedMaterial "red"
+AttributeBegin
+  ColorSpace "rec2020"
+  Translate 1 2 3
+  AreaLightSource "diffuse" "rgb L" [ 4 4 4 ]
+  Shape "trianglemesh" "point3 P" [ 0 0 0 1 0 0 1 1 0 ] "integer indices" [ 0 1 2 ]
+AttributeEnd
+ObjectBegin "sphere"
+  Shape "sphere" "float radius" 2
+ObjectEnd
+ActiveTransform EndTime
+Translate 1 0 0
+ActiveTransform All
+ObjectInstance "sphere"
+Material "conductor" "bool remaproughness" false
+Shape "disk"
+)");
+
+    std::string filename = inTestDir("test.pbrtscn");
+    scene.WriteBinary(filename);
+    EXPECT_TRUE(ParsedScene::IsBinarySceneFile(filename));
+
+    ParsedScene loaded;
+    std::vector<std::string> filenames = {filename};
+    ParseFiles(&loaded, filenames);
+    EXPECT_EQ(scene.ToString(), loaded.ToString());
+    ASSERT_EQ(1, loaded.shapes.size());
+    EXPECT_EQ(1, loaded.animatedShapes.size());
+    EXPECT_EQ(RGBColorSpace::Rec2020, loaded.shapes[0].parameters.ColorSpace());
+    EXPECT_EQ(std::vector<int>({0, 1, 2}),
+              loaded.shapes[0].parameters.GetIntArray("indices"));
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(Parser, ImportMatchesInclude) {
+    std::string filename = inTestDir("test_import.pbrt");
+    std::ofstream out(filename);
+    out << R"(
+Translate 0 0 2
+AttributeBegin
+  Material "conductor"
+  AreaLightSource "diffuse" "rgb L" [ 1 1 1 ]
+  Shape "sphere"
+AttributeEnd
+Material "coated"
+Shape "disk"
+MakeNamedMaterial "imported" "string type" "diffuse"
+ObjectBegin "importedObject"
+  Shape "sphere"
+ObjectEnd
+ObjectInstance "importedObject"
+)";
+    out.close();
+    ASSERT_TRUE(out.good());
+
+    std::string header = R"(
+Camera "perspective"
+WorldBegin
+Material "dielectric"
+AttributeBegin
+  AreaLightSource "diffuse" "rgb L" [ 2 2 2 ]
+  Shape "sphere"
+AttributeEnd
+)";
+    // Imported files are merged after the importing file's own entities
+    ParsedScene importScene, includeScene;
+    ParseString(&importScene, header + "Shape \"cylinder\"\nImport \"" + filename + "\"");
+    ParseString(&includeScene, header + "Shape \"cylinder\"\nAttributeBegin\nInclude \"" +
+                                   filename + "\"\nAttributeEnd");
+
+    EXPECT_EQ(includeScene.ToString(), importScene.ToString());
+    ASSERT_EQ(4, importScene.shapes.size());
+    EXPECT_EQ("conductor", importScene.materials[importScene.shapes[2].materialIndex].name);
+    EXPECT_EQ(1, importScene.shapes[2].lightIndex);
+    EXPECT_EQ("coated", importScene.materials[importScene.shapes[3].materialIndex].name);
+    EXPECT_EQ(-1, importScene.shapes[3].lightIndex);
+    EXPECT_EQ(1, importScene.instanceDefinitions.size());
+    EXPECT_EQ(1, importScene.namedMaterials.size());
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(Parser, NumberArrays) {
+    // Enough values that the array is parsed in parallel chunks
+    std::string str = "WorldBegin\nShape \"trianglemesh\" \"float values\" [\n";
+    std::vector<double> expected;
+    for (int i = 0; i < 500000; ++i) {
+        double v = (i % 1001) * 0.25 - 100;
+        str += StringPrintf("%f%s", v, (i % 10) == 9 ? "\n" : " ");
+        expected.push_back(v);
+    }
+    str += "] \"float exps\" [ 1e3 -2.5E-2 +.5 7. ]\n\"float x\" [ 1 # comment\n 2 ]\n";
+    str += "Shape \"disk\"\n";
+
+    ParsedScene scene;
+    ParseString(&scene, str);
+    ASSERT_EQ(2, scene.shapes.size());
+
+    std::map<std::string, const ParsedParameter *> params;
+    for (const ParsedParameter *p : scene.shapes[0].parameters.GetParameterVector())
+        params[p->name] = p;
+    ASSERT_EQ(expected.size(), params["values"]->numbers.size());
+    for (size_t i = 0; i < expected.size(); ++i)
+        EXPECT_EQ(expected[i], params["values"]->numbers[i]);
+    // Numbers are parsed at _Float_ precision
+    EXPECT_EQ(std::vector<double>({1e3, Float(-2.5e-2), .5, 7.}),
+              std::vector<double>(params["exps"]->numbers.begin(),
+                                  params["exps"]->numbers.end()));
+    EXPECT_EQ(2, params["x"]->numbers.size());
+
+    // Locations after the arrays should be the same as if they had been
+    // tokenized.
+    EXPECT_EQ(3 + 500000 / 10, params["exps"]->loc.line);
+    EXPECT_EQ(2, params["exps"]->loc.column);
+    EXPECT_EQ(3 + 500000 / 10 + 3, scene.shapes[1].loc.line);
+}
+
+TEST(Parser, GzipSceneFile) {
+    // Enough text that it is decompressed over multiple chunks, with the
+    // number array spanning chunk boundaries.
+    std::string str = "WorldBegin\nShape \"trianglemesh\" \"float values\" [\n";
+    std::vector<double> expected;
+    for (int i = 0; i < 2000000; ++i) {
+        double v = (i % 1001) * 0.25 - 100;
+        str += StringPrintf("%f%s", v, (i % 10) == 9 ? "\n" : " ");
+        expected.push_back(v);
+    }
+    str += "]\nShape \"disk\" \"string name\" \"end\"\n";
+
+    std::string filename = inTestDir("test.pbrt.gz");
+    gzFile gz = gzopen(filename.c_str(), "wb");
+    ASSERT_TRUE(gz != nullptr);
+    ASSERT_EQ(str.size(), gzwrite(gz, str.data(), str.size()));
+    ASSERT_EQ(Z_OK, gzclose(gz));
+
+    {
+        ParsedScene scene;
+        ParseFiles(&scene, {filename});
+        ASSERT_EQ(2, scene.shapes.size());
+        const ParsedParameter *values = scene.shapes[0].parameters.GetParameterVector()[0];
+        ASSERT_EQ(expected.size(), values->numbers.size());
+        for (size_t i = 0; i < expected.size(); ++i)
+            EXPECT_EQ(expected[i], values->numbers[i]);
+        EXPECT_EQ("end", scene.shapes[1].parameters.GetOneString("name", ""));
+        EXPECT_EQ(3 + 2000000 / 10 + 1, scene.shapes[1].loc.line);
+    }
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(Parser, BinaryParameterValues) {
+    // Four bytes of padding, then 6 floats and 3 integers.
+    std::vector<float> p = {0, 0.5, 1, -2, 3.25, 1e6};
+    std::vector<int32_t> indices = {0, 1, -1};
+    std::string contents(4, '\0');
+    contents.append(reinterpret_cast<const char *>(p.data()), p.size() * sizeof(float));
+    contents.append(reinterpret_cast<const char *>(indices.data()),
+                    indices.size() * sizeof(int32_t));
+    std::string filename = inTestDir("values.bin");
+    ASSERT_TRUE(WriteFile(filename, contents));
+
+    ParsedScene scene;
+    ParseString(&scene, StringPrintf(R"(WorldBegin
+Shape "trianglemesh" "point3 P" binary "%s" 4 6
+    "integer indices" binary "%s" 28 3 "float empty" binary "%s" 0 0
+)",
+                                     filename, filename, filename));
+    ASSERT_EQ(1, scene.shapes.size());
+    const ParameterDictionary &dict = scene.shapes[0].parameters;
+    std::vector<Point3f> pp = dict.GetPoint3fArray("P");
+    ASSERT_EQ(2, pp.size());
+    EXPECT_EQ(Point3f(0, 0.5, 1), pp[0]);
+    EXPECT_EQ(Point3f(-2, 3.25, 1e6), pp[1]);
+    EXPECT_EQ(indices.size(), dict.GetIntArray("indices").size());
+    for (size_t i = 0; i < indices.size(); ++i)
+        EXPECT_EQ(indices[i], dict.GetIntArray("indices")[i]);
+    // A zero-length range parses to a parameter without values, like "[ ]"
+    for (const ParsedParameter *param : dict.GetParameterVector())
+        if (param->name == "empty") {
+            EXPECT_TRUE(param->numbers.empty());
+        }
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(Parser, FreeParameters) {
+    TrackedMemoryResource *memory = ParsedParameterMemoryResource();
+    size_t startBytes = memory->CurrentAllocatedBytes();
+
+    // Large arrays are allocated outside of the scene's parameter arena and so
+    // are returned as soon as they are freed.
+    std::string values;
+    for (int i = 0; i < 2048; ++i)
+        values += std::to_string(i) + " ";
+    {
+        ParsedScene scene;
+        ParseString(&scene, R"(WorldBegin
+Attribute "shape" "float radius" 2
+Shape "trianglemesh" "float values" [ )" + values + R"( ]
+Shape "sphere"
+)");
+        ASSERT_EQ(2, scene.shapes.size());
+        size_t parsedBytes = memory->CurrentAllocatedBytes();
+        EXPECT_GT(parsedBytes, startBytes);
+
+        // Freeing one shape's parameters leaves the shared attribute alone.
+        scene.shapes[0].parameters.FreeParameters();
+        EXPECT_LT(memory->CurrentAllocatedBytes(), parsedBytes);
+        EXPECT_TRUE(scene.shapes[0].parameters.GetFloatArray("values").empty());
+        EXPECT_EQ(2.f, scene.shapes[1].parameters.GetOneFloat("radius", 0.f));
+    }
+
+    // Everything else is released along with the scene.
+    EXPECT_EQ(startBytes, memory->CurrentAllocatedBytes());
+}
+
+TEST(Parser, WriteParameterList) {
+    ParsedScene scene;
+    ParseString(&scene, R"(WorldBegin
+Shape "trianglemesh" "point3 P" [ 0 0 0 1 0 0 1 1 0 0 1 0 2 2 2 3 3 3 4 4 4 5 5 5 ]
+    "integer indices" [ 0 1 2 0 2 3 ] "string name" "quad" "bool flag" true
+)");
+    ASSERT_EQ(1, scene.shapes.size());
+    ParameterDictionary &dict = scene.shapes[0].parameters;
+
+    FILE *f = tmpfile();
+    ASSERT_TRUE(f != nullptr);
+    dict.WriteParameterList(f, 4);
+    std::string written(ftell(f), '\0');
+    rewind(f);
+    ASSERT_EQ(written.size(), fread(&written[0], 1, written.size(), f));
+    fclose(f);
+    EXPECT_EQ(dict.ToParameterList(4), written);
+
+    // Removing a parameter leaves the others alone.
+    dict.RemovePoint3f("P");
+    EXPECT_TRUE(dict.GetPoint3fArray("P").empty());
+    EXPECT_EQ("quad", dict.GetOneString("name", ""));
+}
+
+TEST(Parser, NestedGraphicsState) {
+    ParsedScene scene;
+    ParseString(&scene, R"(WorldBegin
+NamedMaterial "outer"
+MediumInterface "fog" ""
+Attribute "shape" "float radius" 2
+AttributeBegin
+  Translate 1 0 0
+  NamedMaterial "inner"
+  AreaLightSource "diffuse"
+  Attribute "shape" "float radius" 3
+  Shape "sphere"
+  AttributeBegin
+    Shape "sphere"
+  AttributeEnd
+AttributeEnd
+Shape "sphere"
+)");
+    ASSERT_EQ(3, scene.shapes.size());
+
+    // State set before a nested block is inherited by it...
+    for (int i = 0; i < 2; ++i) {
+        EXPECT_EQ("inner", scene.shapes[i].materialName);
+        EXPECT_EQ("fog", scene.shapes[i].insideMedium);
+        EXPECT_NE(-1, scene.shapes[i].lightIndex);
+        EXPECT_EQ(3.f, scene.shapes[i].parameters.GetOneFloat("radius", 0.f));
+        EXPECT_EQ(scene.shapes[0].renderFromObject, scene.shapes[i].renderFromObject);
+    }
+    EXPECT_FALSE(scene.shapes[0].renderFromObject->IsIdentity());
+
+    // ...and changes made inside it are undone at its end.
+    EXPECT_EQ("outer", scene.shapes[2].materialName);
+    EXPECT_EQ("fog", scene.shapes[2].insideMedium);
+    EXPECT_EQ(-1, scene.shapes[2].lightIndex);
+    EXPECT_EQ(2.f, scene.shapes[2].parameters.GetOneFloat("radius", 0.f));
+    EXPECT_TRUE(scene.shapes[2].renderFromObject->IsIdentity());
+}
+
+TEST(Parser, TransformCacheConcurrent) {
+    TransformCache cache;
+    std::vector<const Transform *> first(1000), second(1000);
+    ParallelFor(0, 2000, [&](int64_t i) {
+        const Transform *t = cache.Lookup(Translate(Vector3f(i % 1000, 0, 0)));
+        (i < 1000 ? first : second)[i % 1000] = t;
+    });
+
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(first[i], second[i]);
+        EXPECT_EQ(Translate(Vector3f(i, 0, 0)), *first[i]);
+        if (i > 0)
+            EXPECT_NE(first[i - 1], first[i]);
+    }
+}
+
+TEST(Parser, NearIdentityInstances) {
+    Float origTolerance = Options->instanceIdentityTolerance;
+    Options->instanceIdentityTolerance = 1e-4f;
+
+    ParsedScene scene;
+    ParseString(&scene, R"(WorldBegin
+ObjectBegin "a"
+Shape "sphere"
+ObjectEnd
+ObjectInstance "a"
+Translate 0 0 1e-6
+ObjectInstance "a"
+Translate 0 0 1
+ObjectInstance "a"
+)");
+    ASSERT_EQ(3, scene.instances.size());
+    EXPECT_TRUE(scene.instances[0].renderFromInstance->IsIdentity());
+    EXPECT_EQ(scene.instances[0].renderFromInstance,
+              scene.instances[1].renderFromInstance);
+    EXPECT_FALSE(scene.instances[2].renderFromInstance->IsIdentity());
+
+    Options->instanceIdentityTolerance = origTolerance;
+}
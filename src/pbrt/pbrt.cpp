@@ -14,9 +14,12 @@
 #include <pbrt/util/error.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
+#include <pbrt/util/perfcounters.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/progressreporter.h>
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/trace.h>
 
 #include <stdlib.h>
 
@@ -47,17 +50,29 @@ void InitPBRT(const PBRTOptions &opt) {
         SuppressErrorMessages();
 
     InitLogging(opt.logLevel, Options->useGPU);
+    StatsInit(Options->statsLevel, Options->statsCategories);
+    ProgressInit(Options->progressRates, Options->progressStream);
 
     // General \pbrt Initialization
+    if (!Options->traceFile.empty())
+        TraceInit();
+    if (Options->entityStatsCount > 0 || !Options->entityStatsFile.empty())
+        EntityStatsInit();
+    if (!Options->memoryBudgets.empty())
+        SetMemoryBudgets(Options->memoryBudgets);
+    if (Options->perfCounters)
+        PerfCountersInit();  // Before the worker threads start, so they are counted
     int nThreads = Options->nThreads != 0 ? Options->nThreads : AvailableCores();
-    ParallelInit(nThreads);  // Threads must be launched before the
-                             // profiler is initialized.
+    ParallelInit(nThreads, Options->numa);  // Threads must be launched before the
+                                            // profiler is initialized.
 
     if (Options->useGPU) {
 #ifdef PBRT_BUILD_GPU_RENDERER
         GPUInit();
 
-        CUDA_CHECK(cudaMemcpyToSymbol(OptionsGPU, Options, sizeof(OptionsGPU)));
+        ForEachGPURenderDevice([]() {
+            CUDA_CHECK(cudaMemcpyToSymbol(OptionsGPU, Options, sizeof(OptionsGPU)));
+        });
 
         ColorEncodingHandle::Init(gpuMemoryAllocator);
         Spectra::Init(gpuMemoryAllocator);
@@ -91,17 +106,33 @@ void CleanupPBRT() {
 
     if (Options->recordPixelStatistics)
         StatsWritePixelImages();
+    if (!Options->statsJSONFile.empty()) {
+        StatsSetJSON("memoryCategories", MemoryCategoriesJSON());
+        WriteStatsJSON(Options->statsJSONFile);
+    }
 
     if (!Options->quiet) {
         PrintStats(stdout);
         ClearStats();
+        PrintPerfCounters(stdout);
+        PrintMemoryCategories(stdout);
+        if (Options->entityStatsCount > 0)
+            PrintEntityStats(stdout, Options->entityStatsCount);
     }
+    if (!Options->entityStatsFile.empty())
+        WriteEntityStats(Options->entityStatsFile);
     if (PrintCheckRare(stdout))
         ErrorExit("CHECK_RARE failures");
 
     if (!Options->displayServer.empty())
         DisconnectFromDisplayServer();
 
+    if (!Options->traceFile.empty()) {
+        WriteTrace(Options->traceFile);
+        TraceCleanup();
+    }
+    ProgressCleanup();
+
     // API Cleanup
     ParallelCleanup();
 
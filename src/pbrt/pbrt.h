@@ -72,6 +72,7 @@ auto ArraySizeHelper(const T (&array)[N]) -> char (&)[N];
 namespace pstd {
 
 namespace pmr {
+class memory_resource;
 template <typename T>
 class polymorphic_allocator;
 }
@@ -9,8 +9,11 @@
 #include <pbrt/options.h>
 #include <pbrt/paramdict.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/memory.h>
 #include <pbrt/util/string.h>
 
+#include <map>
+#include <mutex>
 #include <string>
 
 namespace pbrt {
@@ -212,11 +215,26 @@ PMJ02BNSampler::PMJ02BNSampler(int samplesPerPixel, int seed, Allocator alloc)
     // Get sorted pmj02bn samples for pixel samples
     if (samplesPerPixel > nPMJ02bnSamples)
         Error("PMJ02BNSampler only supports up to %d samples per pixel", nPMJ02bnSamples);
-    // Compute _pixelTileSize_ for pmj02bn pixel samples and allocate _pixelSamples_
+    // Compute _pixelTileSize_ for pmj02bn pixel samples
     pixelTileSize =
         1 << (Log4Int(nPMJ02bnSamples) - Log4Int(RoundUpPow4(samplesPerPixel)));
+
+    // Reuse the pixel sample indices of an earlier sampler if possible; they
+    // only depend on the sample count and are allocated with the same
+    // long-lived allocator as pbrt's other global tables, so they remain
+    // valid after the allocator that was passed in is gone.
+    static std::mutex indicesMutex;
+    static std::map<int, const pstd::vector<uint16_t> *> sharedIndices;
+    std::lock_guard<std::mutex> lock(indicesMutex);
+    auto iter = sharedIndices.find(samplesPerPixel);
+    if (iter != sharedIndices.end()) {
+        pixelSampleIndices = iter->second;
+        return;
+    }
+    Allocator indicesAlloc = Options->useGPU ? gpuMemoryAllocator : Allocator{};
     int nPixelSamples = pixelTileSize * pixelTileSize * samplesPerPixel;
-    pixelSamples = alloc.new_object<pstd::vector<Point2f>>(nPixelSamples, alloc);
+    pstd::vector<uint16_t> *indices =
+        indicesAlloc.new_object<pstd::vector<uint16_t>>(nPixelSamples, indicesAlloc);
 
     // Loop over pmj02bn samples and associate them with their pixels
     std::vector<int> nStored(pixelTileSize * pixelTileSize, 0);
@@ -229,8 +247,7 @@ PMJ02BNSampler::PMJ02BNSampler(int samplesPerPixel, int seed, Allocator alloc)
             continue;
         }
         int sampleOffset = pixelOffset * samplesPerPixel + nStored[pixelOffset];
-        CHECK((*pixelSamples)[sampleOffset] == Point2f(0, 0));
-        (*pixelSamples)[sampleOffset] = Point2f(p - Floor(p));
+        (*indices)[sampleOffset] = i;
         ++nStored[pixelOffset];
     }
 
@@ -238,6 +255,7 @@ PMJ02BNSampler::PMJ02BNSampler(int samplesPerPixel, int seed, Allocator alloc)
         CHECK_EQ(nStored[i], samplesPerPixel);
     for (int c : nStored)
         DCHECK_EQ(c, samplesPerPixel);
+    pixelSampleIndices = sharedIndices[samplesPerPixel] = indices;
 }
 
 PMJ02BNSampler *PMJ02BNSampler::Create(const ParameterDictionary &parameters,
@@ -264,9 +282,9 @@ std::vector<SamplerHandle> PMJ02BNSampler::Clone(int n, Allocator alloc) {
 
 std::string PMJ02BNSampler::ToString() const {
     return StringPrintf("[ PMJ02BNSampler pixel: %s sampleIndex: %d dimension: %d "
-                        "samplesPerPixel: %d pixelTileSize: %d pixelSamples: %p ]",
+                        "samplesPerPixel: %d pixelTileSize: %d pixelSampleIndices: %p ]",
                         pixel, sampleIndex, dimension, samplesPerPixel, pixelTileSize,
-                        pixelSamples);
+                        pixelSampleIndices);
 }
 
 std::string RandomSampler::ToString() const {
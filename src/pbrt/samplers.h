@@ -411,7 +411,10 @@ class PMJ02BNSampler {
     Point2f GetPixel2D() {
         int px = pixel.x % pixelTileSize, py = pixel.y % pixelTileSize;
         int offset = (px + py * pixelTileSize) * samplesPerPixel;
-        return (*pixelSamples)[offset + sampleIndex];
+        // Map the pmj02bn sample to the pixel's part of the tile
+        Point2f p = GetPMJ02BNSample(0, (*pixelSampleIndices)[offset + sampleIndex]);
+        p *= pixelTileSize;
+        return Point2f(p - Floor(p));
     }
 
     PBRT_CPU_GPU
@@ -447,7 +450,9 @@ class PMJ02BNSampler {
     // PMJ02BNSampler Private Members
     int samplesPerPixel, seed;
     int pixelTileSize;
-    pstd::vector<Point2f> *pixelSamples;
+    // Indices of the pmj02bn samples in each pixel of the tile, which are
+    // shared by all samplers with the same number of samples per pixel
+    const pstd::vector<uint16_t> *pixelSampleIndices;
     Point2i pixel;
     int sampleIndex, dimension;
 };
@@ -548,6 +553,26 @@ class SobolSampler {
         return u;
     }
 
+    PBRT_CPU_GPU
+    void GetND(pstd::span<Float> u) {
+#ifndef PBRT_FLOAT_AS_DOUBLE
+        if (dimension + u.size() <= NSobolDimensions) {
+            // Compute all of the dimensions' samples with one pass over _sobolIndex_
+            constexpr int BatchSize = 16;
+            uint32_t v[BatchSize];
+            for (size_t start = 0; start < u.size(); start += BatchSize) {
+                size_t n = std::min<size_t>(BatchSize, u.size() - start);
+                SobolSampleBits32(sobolIndex, dimension, pstd::span<uint32_t>(v, n));
+                for (size_t i = 0; i < n; ++i, ++dimension)
+                    u[start + i] = RandomizeSample(dimension, v[i]);
+            }
+            return;
+        }
+#endif
+        for (Float &ui : u)
+            ui = Get1D();
+    }
+
     std::vector<SamplerHandle> Clone(int n, Allocator alloc);
     std::string ToString() const;
 
@@ -571,6 +596,23 @@ class SobolSampler {
             return SobolSample(sobolIndex, dimension, OwenScrambler(hash));
     }
 
+    // Randomizes the Sobol$'$ sample bits _v_ as _SampleDimension()_ does
+    PBRT_CPU_GPU
+    Float RandomizeSample(int dimension, uint32_t v) const {
+        if (dimension >= 2 && randomizeStrategy != RandomizeStrategy::None) {
+            uint32_t hash = MixBits((uint64_t(dimension) << 32) ^ GetOptions().seed);
+            if (randomizeStrategy == RandomizeStrategy::CranleyPatterson)
+                v = CranleyPattersonRotator(hash)(v);
+            else if (randomizeStrategy == RandomizeStrategy::PermuteDigits)
+                v = BinaryPermuteScrambler(hash)(v);
+            else if (randomizeStrategy == RandomizeStrategy::FastOwen)
+                v = FastOwenScrambler(hash)(v);
+            else
+                v = OwenScrambler(hash)(v);
+        }
+        return std::min(v * 0x1p-32f, FloatOneMinusEpsilon);
+    }
+
     // SobolSampler Private Members
     int samplesPerPixel, scale;
     RandomizeStrategy randomizeStrategy;
@@ -805,6 +847,14 @@ inline Point2f SamplerHandle::Get2D() {
     return Dispatch(get);
 }
 
+inline void SamplerHandle::GetND(pstd::span<Float> u) {
+    if (SobolSampler *sobol = CastOrNullptr<SobolSampler>())
+        sobol->GetND(u);
+    else
+        for (Float &ui : u)
+            ui = Get1D();
+}
+
 inline Point2f SamplerHandle::GetPixel2D() {
     auto get = [&](auto ptr) { return ptr->GetPixel2D(); };
     return Dispatch(get);
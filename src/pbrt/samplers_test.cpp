@@ -7,6 +7,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/samplers.h>
+#include <pbrt/util/rng.h>
 
 using namespace pbrt;
 
@@ -161,3 +162,77 @@ TEST(PMJ02BNSampler, ElementaryIntervals) {
         checkElementarySampler("PMJ02BNSampler", new PMJ02BNSampler(1 << logSamples),
                                logSamples);
 }
+
+TEST(Sobol, SampleBits) {
+    RNG rng;
+    for (int dim : {0, 1, 2, 7, 100}) {
+        for (int i = 0; i < 1000; ++i) {
+            int64_t a = rng.Uniform<uint64_t>() & ((1ull << SobolMatrixSize) - 1);
+            if (i < 100)
+                a = i;
+            // Compare to the product with the generator matrix
+            uint32_t v = 0;
+            for (int bit = 0; bit < SobolMatrixSize; ++bit)
+                if (a & (1ull << bit))
+                    v ^= SobolMatrices32[dim * SobolMatrixSize + bit];
+            EXPECT_EQ(v, SobolSampleBits32(a, dim)) << dim << ", " << a;
+
+            uint32_t batch[5];
+            SobolSampleBits32(a, dim, pstd::span<uint32_t>(batch, 5));
+            for (int d = 0; d < 5; ++d)
+                EXPECT_EQ(SobolSampleBits32(a, dim + d), batch[d]);
+        }
+    }
+}
+
+TEST(Sobol, IncrementalSamples) {
+    for (int dim : {0, 1, 3}) {
+        for (int64_t aStart : {int64_t(0), int64_t(37), (int64_t(1) << 32) - 100}) {
+            std::vector<Float> u(1000);
+            SobolSamples(aStart, dim, FastOwenScrambler(dim), pstd::MakeSpan(u));
+            for (size_t i = 0; i < u.size(); ++i)
+                EXPECT_EQ(SobolSample(aStart + i, dim, FastOwenScrambler(dim)), u[i]);
+        }
+    }
+}
+
+TEST(Sampler, GetND) {
+    constexpr int spp = 16;
+    Point2i resolution(100, 101);
+    std::vector<SamplerHandle> samplers;
+    for (RandomizeStrategy r :
+         {RandomizeStrategy::None, RandomizeStrategy::CranleyPatterson,
+          RandomizeStrategy::PermuteDigits, RandomizeStrategy::FastOwen,
+          RandomizeStrategy::Owen}) {
+        samplers.push_back(new SobolSampler(spp, resolution, r));
+        samplers.push_back(new ZSobolSampler(spp, resolution, r));
+    }
+
+    // The batched samples should match successive calls to Get1D(),
+    // including when the sampler's dimensions wrap around.
+    for (SamplerHandle sampler : samplers)
+        for (int startDim : {0, 5, NSobolDimensions - 10}) {
+            sampler.StartPixelSample({3, 7}, 5, startDim);
+            std::vector<Float> u(40);
+            sampler.GetND(pstd::MakeSpan(u));
+            sampler.StartPixelSample({3, 7}, 5, startDim);
+            for (size_t i = 0; i < u.size(); ++i)
+                EXPECT_EQ(sampler.Get1D(), u[i]) << sampler.ToString() << ", " << i;
+        }
+}
+
+TEST(DigitPermutation, Permutes) {
+    // Bases above 256 aren't tabulated but should still be permuted.
+    for (int base : {2, 3, 251, 257, 7919}) {
+        DigitPermutation perm(base, 17, {});
+        for (int digitIndex = 0; digitIndex < 2; ++digitIndex) {
+            std::vector<bool> seen(base, false);
+            for (int digitValue = 0; digitValue < base; ++digitValue) {
+                int p = perm.Permute(digitIndex, digitValue);
+                ASSERT_TRUE(p >= 0 && p < base);
+                EXPECT_FALSE(seen[p]);
+                seen[p] = true;
+            }
+        }
+    }
+}
@@ -4,9 +4,11 @@
 
 #include <pbrt/shapes.h>
 
+#include <pbrt/cameras.h>
 #include <pbrt/interaction.h>
 #include <pbrt/options.h>
 #include <pbrt/paramdict.h>
+#include <pbrt/textures.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
@@ -16,10 +18,14 @@
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/splines.h>
 #include <pbrt/util/stats.h>
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <pbrt/gpu/init.h>
+#endif  // PBRT_BUILD_GPU_RENDERER
 
 #if defined(PBRT_BUILD_GPU_RENDERER)
 #include <cuda.h>
@@ -147,8 +153,10 @@ void Triangle::Init(Allocator alloc) {
     allMeshes = alloc.new_object<pstd::vector<const TriangleMesh *>>(alloc);
 #if defined(PBRT_BUILD_GPU_RENDERER)
     if (Options->useGPU)
-        CUDA_CHECK(
-            cudaMemcpyToSymbol(allTriangleMeshesGPU, &allMeshes, sizeof(allMeshes)));
+        ForEachGPURenderDevice([&]() {
+            CUDA_CHECK(
+                cudaMemcpyToSymbol(allTriangleMeshesGPU, &allMeshes, sizeof(allMeshes)));
+        });
 #endif
 }
 
@@ -260,14 +268,24 @@ pstd::optional<TriangleIntersection> IntersectTriangle(const Ray &ray, Float tMa
 }
 
 // Triangle Method Definitions
+// Indices of released meshes, which are reused before _allMeshes_ grows
+static std::mutex allTriangleMeshesLock;
+static std::vector<int> freeTriangleMeshIndices;
+
 pstd::vector<ShapeHandle> Triangle::CreateTriangles(const TriangleMesh *mesh,
                                                     Allocator alloc) {
-    static std::mutex allMeshesLock;
-    allMeshesLock.lock();
-    CHECK_LT(allMeshes->size(), 1 << 31);
-    int meshIndex = int(allMeshes->size());
-    allMeshes->push_back(mesh);
-    allMeshesLock.unlock();
+    allTriangleMeshesLock.lock();
+    int meshIndex;
+    if (!freeTriangleMeshIndices.empty()) {
+        meshIndex = freeTriangleMeshIndices.back();
+        freeTriangleMeshIndices.pop_back();
+        (*allMeshes)[meshIndex] = mesh;
+    } else {
+        CHECK_LT(allMeshes->size(), 1 << 31);
+        meshIndex = int(allMeshes->size());
+        allMeshes->push_back(mesh);
+    }
+    allTriangleMeshesLock.unlock();
 
     pstd::vector<ShapeHandle> tris(mesh->nTriangles, alloc);
     Triangle *t = alloc.allocate_object<Triangle>(mesh->nTriangles);
@@ -279,6 +297,12 @@ pstd::vector<ShapeHandle> Triangle::CreateTriangles(const TriangleMesh *mesh,
     return tris;
 }
 
+void Triangle::ReleaseMeshIndex(int meshIndex) {
+    std::lock_guard<std::mutex> lock(allTriangleMeshesLock);
+    (*allMeshes)[meshIndex] = nullptr;
+    freeTriangleMeshIndices.push_back(meshIndex);
+}
+
 Bounds3f Triangle::Bounds() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const TriangleMesh *mesh = GetMesh();
@@ -296,8 +320,8 @@ DirectionCone Triangle::NormalBounds() const {
 
     Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
     // Ensure correct orientation of geometric normal for normal bounds
-    if (mesh->n != nullptr) {
-        Normal3f ns(mesh->n[v[0]] + mesh->n[v[1]] + mesh->n[v[2]]);
+    if (mesh->HasNormals()) {
+        Normal3f ns(mesh->Normal(v[0]) + mesh->Normal(v[1]) + mesh->Normal(v[2]));
         n = FaceForward(n, ns);
     } else if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
         n *= -1;
@@ -319,12 +343,10 @@ pstd::optional<ShapeIntersection> Triangle::Intersect(const Ray &ray, Float tMax
     if (!triIsect)
         return {};
 
-    SurfaceInteraction intr =
-        InteractionFromIntersection(mesh, triIndex, *triIsect, ray.time, -ray.d);
 #ifndef PBRT_IS_GPU_CODE
     ++nTriHits;
 #endif
-    return ShapeIntersection{intr, triIsect->t};
+    return IntersectionFromHit(*triIsect, ray);
 }
 
 bool Triangle::IntersectP(const Ray &ray, Float tMax) const {
@@ -425,9 +447,159 @@ TriangleMesh *Triangle::CreateMesh(const Transform *renderFromObject,
         faceIndices = {};
     }
 
+    // Shading attributes can be stored at reduced precision to save memory
+    bool compressAttributes = parameters.GetOneBool("compressattributes", false);
+
     return alloc.new_object<TriangleMesh>(
         *renderFromObject, reverseOrientation, std::move(vi), std::move(P), std::move(S),
-        std::move(N), std::move(uvs), std::move(faceIndices));
+        std::move(N), std::move(uvs), std::move(faceIndices), nullptr, compressAttributes);
+}
+
+STAT_MEMORY_COUNTER("Memory/Opacity micromaps", opacityMicromapBytes);
+STAT_COUNTER("Geometry/Opacity micromaps", nOpacityMicromaps);
+
+// OpacityMicromap Method Definitions
+OpacityMicromap *OpacityMicromap::Create(const TriangleMesh *mesh,
+                                         FloatTextureHandle alpha, Allocator alloc) {
+    // Give up on textures whose values can't be bounded
+    if (!FloatTextureRange(alpha, {Point2f(), Point2f(), Point2f()}))
+        return nullptr;
+
+    // Choose each triangle's level and classify its micro-triangles
+    std::vector<int> levels(mesh->nTriangles);
+    std::vector<std::vector<State>> triStates(mesh->nTriangles);
+    std::atomic<bool> anyKnown{false};
+    ParallelFor(0, mesh->nTriangles, [&](int64_t t) {
+        const int *v = &mesh->vertexIndices[3 * t];
+        pstd::array<Point2f, 3> uv({Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
+        if (mesh->HasUV())
+            for (int i = 0; i < 3; ++i)
+                uv[i] = mesh->UV(v[i]);
+        // Returns the state of the micro-triangle with the given barycentric
+        // $(b_1,b_2)$ vertices.
+        auto classify = [&](Point2f b0, Point2f b1, Point2f b2) {
+            // Grow the micro-triangle slightly so that round-off error in
+            // intersections' barycentrics can't lead to a wrong state
+            Point2f c = (b0 + b1 + b2) / 3;
+            pstd::array<Point2f, 3> muv;
+            Point2f b[3] = {b0, b1, b2};
+            for (int i = 0; i < 3; ++i) {
+                Point2f bi = c + 1.01f * (b[i] - c);
+                muv[i] = (1 - bi[0] - bi[1]) * uv[0] + bi[0] * uv[1] + bi[1] * uv[2];
+            }
+            pstd::optional<Interval> a = FloatTextureRange(alpha, muv);
+            if (a && a->LowerBound() >= 1)
+                return State::Opaque;
+            if (a && a->UpperBound() <= 0)
+                return State::Transparent;
+            return State::Unknown;
+        };
+
+        std::vector<State> prevStates = {classify({0, 0}, {1, 0}, {0, 1})};
+        int prevLevel = 0;
+        Float prevUnknown = prevStates[0] == State::Unknown ? 1 : 0;
+        // Subdivide further while doing so finds the state of more of the
+        // triangle, always going to at least level 3 since coarse
+        // micro-triangles may all straddle the texture's edges.
+        for (int level = 1; level <= MaxLevel && prevUnknown > 0; ++level) {
+            int n = 1 << level, nUnknown = 0;
+            std::vector<State> states(n * n);
+            for (int j = 0; j < n; ++j)
+                for (int i = 0; i < n - j; ++i) {
+                    int index = j * (2 * n - j) + 2 * i;
+                    states[index] = classify(Point2f(i, j) / n, Point2f(i + 1, j) / n,
+                                             Point2f(i, j + 1) / n);
+                    nUnknown += states[index] == State::Unknown;
+                    if (i + j < n - 1) {
+                        states[index + 1] =
+                            classify(Point2f(i + 1, j) / n, Point2f(i, j + 1) / n,
+                                     Point2f(i + 1, j + 1) / n);
+                        nUnknown += states[index + 1] == State::Unknown;
+                    }
+                }
+            Float unknown = Float(nUnknown) / (n * n);
+            if (level > 3 && unknown > 0.75f * prevUnknown)
+                break;
+            prevStates = std::move(states);
+            prevLevel = level;
+            prevUnknown = unknown;
+        }
+
+        // Store triangles with all micro-triangles in the same state at level 0
+        if (std::all_of(prevStates.begin(), prevStates.end(),
+                        [&](State s) { return s == prevStates[0]; })) {
+            prevStates.resize(1);
+            prevLevel = 0;
+        }
+        if (prevUnknown < 1)
+            anyKnown = true;
+        levels[t] = prevLevel;
+        triStates[t] = std::move(prevStates);
+    });
+    if (!anyKnown)
+        return nullptr;
+
+    // Pack triangles' micro-triangle states
+    OpacityMicromap *omm = alloc.new_object<OpacityMicromap>(mesh, alloc);
+    omm->triangles.resize(mesh->nTriangles);
+    size_t nWords = 0;
+    for (int t = 0; t < mesh->nTriangles; ++t) {
+        if (levels[t] == 0)
+            omm->triangles[t] = uint32_t(triStates[t][0]) << LevelBits;
+        else {
+            CHECK_LT(nWords, 1u << (32 - LevelBits));
+            omm->triangles[t] = uint32_t(nWords << LevelBits) | levels[t];
+            nWords += (triStates[t].size() + 15) / 16;
+        }
+    }
+    omm->states.resize(nWords);
+    std::fill(omm->states.begin(), omm->states.end(), 0);
+    for (int t = 0; t < mesh->nTriangles; ++t)
+        if (levels[t] > 0) {
+            uint32_t *words = &omm->states[omm->triangles[t] >> LevelBits];
+            for (size_t i = 0; i < triStates[t].size(); ++i)
+                words[i / 16] |= uint32_t(triStates[t][i]) << (2 * (i % 16));
+        }
+
+    ++nOpacityMicromaps;
+    opacityMicromapBytes += omm->BytesUsed();
+    return omm;
+}
+
+OpacityMicromap *OpacityMicromap::Create(pstd::span<const ShapeHandle> shapes,
+                                         FloatTextureHandle alpha, Allocator alloc) {
+    if (shapes.empty())
+        return nullptr;
+    const Triangle *first = shapes[0].CastOrNullptr<Triangle>();
+    if (!first)
+        return nullptr;
+    for (ShapeHandle shape : shapes) {
+        const Triangle *tri = shape.CastOrNullptr<Triangle>();
+        if (!tri || tri->MeshIndex() != first->MeshIndex())
+            return nullptr;
+    }
+    return Create(first->GetMesh(), alpha, alloc);
+}
+
+OpacityMicromap::State OpacityMicromap::Lookup(int triIndex, Point3f p) const {
+    // Compute barycentric coordinates of _p_ with respect to the triangle
+    const int *v = &mesh->vertexIndices[3 * triIndex];
+    Point3f p0 = mesh->p[v[0]];
+    Vector3f e1 = mesh->p[v[1]] - p0, e2 = mesh->p[v[2]] - p0, d = p - p0;
+    Float d11 = Dot(e1, e1), d12 = Dot(e1, e2), d22 = Dot(e2, e2);
+    Float d1 = Dot(d, e1), d2 = Dot(d, e2);
+    Float det = DifferenceOfProducts(d11, d22, d12, d12);
+    if (det == 0)
+        return State::Unknown;
+    Point2f b(DifferenceOfProducts(d22, d1, d12, d2) / det,
+              DifferenceOfProducts(d11, d2, d12, d1) / det);
+
+    return Lookup(triIndex, b);
+}
+
+std::string OpacityMicromap::ToString() const {
+    return StringPrintf("[ OpacityMicromap mesh: %p triangles: %d states: %d ]", mesh,
+                        triangles.size(), states.size());
 }
 
 STAT_MEMORY_COUNTER("Memory/Curves", curveBytes);
@@ -470,6 +642,8 @@ CurveCommon::CurveCommon(pstd::span<const Point3f> c, Float width0, Float width1
         normalAngle = AngleBetween(n[0], n[1]);
         invSinNormalAngle = 1 / std::sin(normalAngle);
     }
+    if (Vector3f chord = cpObj[3] - cpObj[0]; LengthSquared(chord) > 0)
+        chordFrame = Frame::FromX(Normalize(chord));
     ++nCurves;
 }
 
@@ -509,6 +683,19 @@ pstd::vector<ShapeHandle> CreateCurve(const Transform *renderFromObject,
 }
 
 // Curve Method Definitions
+Curve::Curve(const CurveCommon *common, Float uMin, Float uMax)
+    : common(common), uMin(uMin), uMax(uMax) {
+    // Bound segment's control points in the curve's chord frame
+    pstd::array<Point3f, 4> cp =
+        CubicBezierControlPoints(pstd::MakeConstSpan(common->cpObj), uMin, uMax);
+    for (const Point3f &p : cp)
+        chordBounds = Union(chordBounds,
+                            Point3f(common->chordFrame.ToLocal(p - common->cpObj[0])));
+    Float maxWidth = std::max(Lerp(uMin, common->width[0], common->width[1]),
+                              Lerp(uMax, common->width[0], common->width[1]));
+    chordBounds = Expand(chordBounds, 0.5f * maxWidth);
+}
+
 Bounds3f Curve::Bounds() const {
     pstd::span<const Point3f> cpSpan(common->cpObj);
     Bounds3f objBounds = BoundCubicBezier(cpSpan, uMin, uMax);
@@ -550,6 +737,14 @@ bool Curve::IntersectRay(const Ray &r, Float tMax,
     // Transform _Ray_ to curve's object space
     Ray ray = (*common->objectFromRender)(r);
 
+    // Test ray against segment's bounds in the curve's chord frame
+    Vector3f oChord = common->chordFrame.ToLocal(ray.o - common->cpObj[0]);
+    Vector3f dChord = common->chordFrame.ToLocal(ray.d);
+    // Expand bounds to cover rounding error in transforming the ray
+    Float err = gamma(6) * (2 * Length(oChord) + Length(chordBounds.Diagonal()));
+    if (!Expand(chordBounds, err).IntersectP(Point3f(oChord), dChord, tMax))
+        return false;
+
     // Get object-space control points for curve segment, _cpObj_
     pstd::array<Point3f, 4> cpObj =
         CubicBezierControlPoints(pstd::span<const Point3f>(common->cpObj), uMin, uMax);
@@ -750,6 +945,19 @@ std::string Curve::ToString() const {
     return StringPrintf("[ Curve common: %s uMin: %f uMax: %f ]", *common, uMin, uMax);
 }
 
+static CurveType GetCurveType(const ParameterDictionary &parameters,
+                               const FileLoc *loc) {
+    std::string curveType = parameters.GetOneString("type", "flat");
+    if (curveType == "flat")
+        return CurveType::Flat;
+    else if (curveType == "ribbon")
+        return CurveType::Ribbon;
+    else if (curveType == "cylinder")
+        return CurveType::Cylinder;
+    Error(loc, R"(Unknown curve type "%s".  Using "cylinder".)", curveType);
+    return CurveType::Cylinder;
+}
+
 pstd::vector<ShapeHandle> Curve::Create(const Transform *renderFromObject,
                                         const Transform *objectFromRender,
                                         bool reverseOrientation,
@@ -800,18 +1008,7 @@ pstd::vector<ShapeHandle> Curve::Create(const Transform *renderFromObject,
         nSegments = cp.size() - degree;
     }
 
-    CurveType type;
-    std::string curveType = parameters.GetOneString("type", "flat");
-    if (curveType == "flat")
-        type = CurveType::Flat;
-    else if (curveType == "ribbon")
-        type = CurveType::Ribbon;
-    else if (curveType == "cylinder")
-        type = CurveType::Cylinder;
-    else {
-        Error(loc, R"(Unknown curve type "%s".  Using "cylinder".)", curveType);
-        type = CurveType::Cylinder;
-    }
+    CurveType type = GetCurveType(parameters, loc);
 
     std::vector<Normal3f> n = parameters.GetNormal3fArray("N");
     if (!n.empty()) {
@@ -889,6 +1086,89 @@ pstd::vector<ShapeHandle> Curve::Create(const Transform *renderFromObject,
     return curves;
 }
 
+// Curve set files start with the 8 bytes "PBRTCRV1", followed by the number
+// of curves n as a 32-bit unsigned integer and 4 unused bytes. Then come the
+// curves' cubic Bezier control points, 12n floats, and then the widths at
+// their endpoints, 2n floats. All values are 32-bit and little-endian.
+pstd::vector<ShapeHandle> Curve::CreateSet(const Transform *renderFromObject,
+                                           const Transform *objectFromRender,
+                                           bool reverseOrientation,
+                                           const ParameterDictionary &parameters,
+                                           const FileLoc *loc, Allocator alloc) {
+    CurveType type = GetCurveType(parameters, loc);
+    if (type == CurveType::Ribbon) {
+        Error(loc, "\"ribbon\" curves are not supported by \"curveset\" shapes.");
+        return {};
+    }
+    int splitDepth = parameters.GetOneInt("splitdepth", 3);
+
+    std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+    std::string error;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename, &error);
+    if (!file) {
+        Error(loc, "%s", error);
+        return {};
+    }
+    const uint8_t *data = file->Data();
+    if (file->Size() < 16 || memcmp(data, "PBRTCRV1", 8) != 0) {
+        Error(loc, "%s: not a curve set file.", filename);
+        return {};
+    }
+
+    uint32_t one = 1;
+    bool littleEndian = *reinterpret_cast<uint8_t *>(&one) == 1;
+    auto read32 = [&](size_t offset) {
+        uint32_t bits;
+        memcpy(&bits, data + offset, sizeof(bits));
+        if (!littleEndian)
+            bits = (bits >> 24) | ((bits >> 8) & 0xff00) | ((bits << 8) & 0xff0000) |
+                   (bits << 24);
+        return bits;
+    };
+    auto readFloat = [&](size_t offset) {
+        uint32_t bits = read32(offset);
+        float v;
+        memcpy(&v, &bits, sizeof(float));
+        return Float(v);
+    };
+
+    int64_t nCurves = read32(8);
+    size_t cpOffset = 16, widthOffset = cpOffset + 12 * sizeof(float) * nCurves;
+    if (file->Size() < widthOffset + 2 * sizeof(float) * nCurves) {
+        Error(loc, "%s: premature end of file reading %d curves.", filename, nCurves);
+        return {};
+    }
+
+    // Allocate the _CurveCommon_s and the _Curve_s for all of the curves at
+    // once and initialize them in parallel
+    int nSegments = 1 << splitDepth;
+    CurveCommon *commons = alloc.allocate_object<CurveCommon>(nCurves);
+    Curve *curves = alloc.allocate_object<Curve>(nCurves * nSegments);
+    pstd::vector<ShapeHandle> shapes(nCurves * nSegments, alloc);
+    ParallelFor(0, nCurves, [&](int64_t i) {
+        Point3f cp[4];
+        for (int j = 0; j < 4; ++j)
+            for (int c = 0; c < 3; ++c)
+                cp[j][c] = readFloat(cpOffset + sizeof(float) * (12 * i + 3 * j + c));
+        Float w0 = readFloat(widthOffset + sizeof(float) * 2 * i);
+        Float w1 = readFloat(widthOffset + sizeof(float) * (2 * i + 1));
+        alloc.construct(&commons[i], pstd::MakeConstSpan(cp), w0, w1, type,
+                        pstd::span<const Normal3f>(), renderFromObject,
+                        objectFromRender, reverseOrientation);
+
+        for (int s = 0; s < nSegments; ++s) {
+            Curve *curve = &curves[i * nSegments + s];
+            alloc.construct(curve, &commons[i], s / Float(nSegments),
+                            (s + 1) / Float(nSegments));
+            shapes[i * nSegments + s] = curve;
+        }
+    });
+
+    nSplitCurves += nCurves * nSegments;
+    curveBytes += nCurves * (sizeof(CurveCommon) + nSegments * sizeof(Curve));
+    return shapes;
+}
+
 STAT_PIXEL_RATIO("Intersections/Ray-bilinear patch intersection tests", nBLPHits,
                  nBLPTests);
 
@@ -980,14 +1260,24 @@ BilinearPatchMesh *BilinearPatch::CreateMesh(const Transform *renderFromObject,
         std::move(N), std::move(uv), std::move(faceIndices), imageDist);
 }
 
+// Indices of released meshes, which are reused before _allMeshes_ grows
+static std::mutex allBilinearMeshesLock;
+static std::vector<int> freeBilinearMeshIndices;
+
 pstd::vector<ShapeHandle> BilinearPatch::CreatePatches(const BilinearPatchMesh *mesh,
                                                        Allocator alloc) {
-    static std::mutex allMeshesLock;
-    allMeshesLock.lock();
-    CHECK_LT(allMeshes->size(), 1 << 31);
-    int meshIndex = int(allMeshes->size());
-    allMeshes->push_back(mesh);
-    allMeshesLock.unlock();
+    allBilinearMeshesLock.lock();
+    int meshIndex;
+    if (!freeBilinearMeshIndices.empty()) {
+        meshIndex = freeBilinearMeshIndices.back();
+        freeBilinearMeshIndices.pop_back();
+        (*allMeshes)[meshIndex] = mesh;
+    } else {
+        CHECK_LT(allMeshes->size(), 1 << 31);
+        meshIndex = int(allMeshes->size());
+        allMeshes->push_back(mesh);
+    }
+    allBilinearMeshesLock.unlock();
 
     pstd::vector<ShapeHandle> blps(mesh->nPatches, alloc);
     BilinearPatch *patches = alloc.allocate_object<BilinearPatch>(mesh->nPatches);
@@ -999,6 +1289,12 @@ pstd::vector<ShapeHandle> BilinearPatch::CreatePatches(const BilinearPatchMesh *
     return blps;
 }
 
+void BilinearPatch::ReleaseMeshIndex(int meshIndex) {
+    std::lock_guard<std::mutex> lock(allBilinearMeshesLock);
+    (*allMeshes)[meshIndex] = nullptr;
+    freeBilinearMeshIndices.push_back(meshIndex);
+}
+
 pstd::vector<const BilinearPatchMesh *> *BilinearPatch::allMeshes;
 #if defined(PBRT_BUILD_GPU_RENDERER)
 PBRT_GPU pstd::vector<const BilinearPatchMesh *> *allBilinearMeshesGPU;
@@ -1008,8 +1304,10 @@ void BilinearPatch::Init(Allocator alloc) {
     allMeshes = alloc.new_object<pstd::vector<const BilinearPatchMesh *>>(alloc);
 #if defined(PBRT_BUILD_GPU_RENDERER)
     if (Options->useGPU)
-        CUDA_CHECK(
-            cudaMemcpyToSymbol(allBilinearMeshesGPU, &allMeshes, sizeof(allMeshes)));
+        ForEachGPURenderDevice([&]() {
+            CUDA_CHECK(
+                cudaMemcpyToSymbol(allBilinearMeshesGPU, &allMeshes, sizeof(allMeshes)));
+        });
 #endif
 }
 
@@ -1116,9 +1414,7 @@ pstd::optional<ShapeIntersection> BilinearPatch::Intersect(const Ray &ray,
         IntersectBilinearPatch(ray, tMax, p00, p10, p01, p11);
     if (!blpIsect)
         return {};
-    SurfaceInteraction intr =
-        InteractionFromIntersection(mesh, blpIndex, blpIsect->uv, ray.time, -ray.d);
-    return ShapeIntersection{intr, blpIsect->t};
+    return IntersectionFromHit(*blpIsect, ray);
 }
 
 bool BilinearPatch::IntersectP(const Ray &ray, Float tMax) const {
@@ -1333,7 +1629,8 @@ pstd::vector<ShapeHandle> ShapeHandle::Create(const std::string &name,
                                               const Transform *objectFromRender,
                                               bool reverseOrientation,
                                               const ParameterDictionary &parameters,
-                                              const FileLoc *loc, Allocator alloc) {
+                                              const FileLoc *loc, Allocator alloc,
+                                              CameraHandle camera) {
     pstd::vector<ShapeHandle> shapes(alloc);
     if (name == "sphere") {
         shapes = {Sphere::Create(renderFromObject, objectFromRender, reverseOrientation,
@@ -1358,6 +1655,9 @@ pstd::vector<ShapeHandle> ShapeHandle::Create(const std::string &name,
     else if (name == "curve")
         shapes = Curve::Create(renderFromObject, objectFromRender, reverseOrientation,
                                parameters, loc, alloc);
+    else if (name == "curveset")
+        shapes = Curve::CreateSet(renderFromObject, objectFromRender, reverseOrientation,
+                                  parameters, loc, alloc);
     else if (name == "trianglemesh") {
         TriangleMesh *mesh = Triangle::CreateMesh(renderFromObject, reverseOrientation,
                                                   parameters, loc, alloc);
@@ -1365,18 +1665,25 @@ pstd::vector<ShapeHandle> ShapeHandle::Create(const std::string &name,
     } else if (name == "plymesh") {
         std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
         TriQuadMesh plyMesh = TriQuadMesh::ReadPLY(filename);
+        // Deferred meshes are freed when evicted under a geometry memory
+        // budget, so their buffers are allocated along with them
+        Allocator *bufferAlloc = nullptr;
+        if (Options->geometryBudgetMB > 0 && parameters.GetOneBool("deferred", false))
+            bufferAlloc = &alloc;
 
         if (!plyMesh.triIndices.empty()) {
             TriangleMesh *mesh = alloc.new_object<TriangleMesh>(
                 *renderFromObject, reverseOrientation, plyMesh.triIndices, plyMesh.p,
-                std::vector<Vector3f>(), plyMesh.n, plyMesh.uv, plyMesh.faceIndices);
+                std::vector<Vector3f>(), plyMesh.n, plyMesh.uv, plyMesh.faceIndices,
+                bufferAlloc, parameters.GetOneBool("compressattributes", false));
             shapes = Triangle::CreateTriangles(mesh, alloc);
         }
 
         if (!plyMesh.quadIndices.empty()) {
             BilinearPatchMesh *mesh = alloc.new_object<BilinearPatchMesh>(
                 *renderFromObject, reverseOrientation, plyMesh.quadIndices, plyMesh.p,
-                plyMesh.n, plyMesh.uv, plyMesh.faceIndices, nullptr /* image dist */);
+                plyMesh.n, plyMesh.uv, plyMesh.faceIndices, nullptr /* image dist */,
+                bufferAlloc);
             pstd::vector<ShapeHandle> quadMesh =
                 BilinearPatch::CreatePatches(mesh, alloc);
             shapes.insert(shapes.end(), quadMesh.begin(), quadMesh.end());
@@ -1395,8 +1702,32 @@ pstd::vector<ShapeHandle> ShapeHandle::Create(const std::string &name,
         // don't actually use this for now...
         std::string scheme = parameters.GetOneString("scheme", "loop");
 
+        // With "edgelength" and a camera, only split edges that are longer
+        // than that many pixels on the film, up to "levels" times
+        std::function<bool(Point3f, Point3f)> splitEdge;
+        Float edgeLength = parameters.GetOneFloat("edgelength", 0.f);
+        if (edgeLength > 0 && camera) {
+            Float time = camera.SampleTime(0.5f);
+            Point3f pCamera =
+                camera.GetCameraTransform().RenderFromCamera(Point3f(0, 0, 0), time);
+            splitEdge = [=](Point3f p0, Point3f p1) {
+                // Find the size of a pixel's footprint at the edge's midpoint
+                SurfaceInteraction si;
+                si.pi = Point3fi((p0 + p1) / 2);
+                si.time = time;
+                if (pCamera == si.p())
+                    return true;
+                si.n = Normal3f(Normalize(pCamera - si.p()));
+                camera.ApproximatedPdxy(si, 1);
+                Float pixelSize = std::min(Length(si.dpdx), Length(si.dpdy));
+                return Distance(p0, p1) > edgeLength * pixelSize;
+            };
+        } else if (edgeLength > 0)
+            Warning(loc, "\"edgelength\" is ignored for shapes in object instances; "
+                         "subdividing uniformly.");
+
         TriangleMesh *mesh = LoopSubdivide(renderFromObject, reverseOrientation, nLevels,
-                                           vertexIndices, P, alloc);
+                                           vertexIndices, P, alloc, splitEdge);
 
         shapes = Triangle::CreateTriangles(mesh, alloc);
     } else
@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/base/shape.h>
+#include <pbrt/base/texture.h>
 #include <pbrt/interaction.h>
 #include <pbrt/ray.h>
 #include <pbrt/util/buffercache.h>
@@ -833,12 +834,20 @@ class Triangle {
     // Triangle Public Methods
     static pstd::vector<ShapeHandle> CreateTriangles(const TriangleMesh *mesh,
                                                      Allocator alloc);
+    // Makes a mesh's index available to meshes that are created later; none
+    // of the mesh's triangles may be used afterward.
+    static void ReleaseMeshIndex(int meshIndex);
 
     Triangle() = default;
     Triangle(int meshIndex, int triIndex) : meshIndex(meshIndex), triIndex(triIndex) {}
 
     static void Init(Allocator alloc);
 
+    PBRT_CPU_GPU
+    int MeshIndex() const { return meshIndex; }
+    PBRT_CPU_GPU
+    int TriangleIndex() const { return triIndex; }
+
     PBRT_CPU_GPU
     Bounds3f Bounds() const;
 
@@ -848,6 +857,16 @@ class Triangle {
     PBRT_CPU_GPU
     bool IntersectP(const Ray &ray, Float tMax = Infinity) const;
 
+    // Returns the intersection for a hit with the triangle that was found by
+    // IntersectTriangle() with its vertices
+    PBRT_CPU_GPU
+    ShapeIntersection IntersectionFromHit(const TriangleIntersection &isect,
+                                          const Ray &ray) const {
+        return ShapeIntersection{
+            InteractionFromIntersection(GetMesh(), triIndex, isect, ray.time, -ray.d),
+            isect.t};
+    }
+
     PBRT_CPU_GPU
     Float Area() const {
         // Get triangle vertices in _p0_, _p1_, and _p2_
@@ -861,6 +880,24 @@ class Triangle {
     PBRT_CPU_GPU
     DirectionCone NormalBounds() const;
 
+    PBRT_CPU_GPU
+    pstd::array<Point3f, 3> Vertices() const {
+        const TriangleMesh *mesh = GetMesh();
+        const int *v = &mesh->vertexIndices[3 * triIndex];
+        return pstd::array<Point3f, 3>({mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]]});
+    }
+
+    // Returns the texture coordinates at the triangle's vertices, which are
+    // $(0,0)$, $(1,0)$, and $(1,1)$ if the mesh doesn't provide any.
+    PBRT_CPU_GPU
+    pstd::array<Point2f, 3> TextureCoordinates() const {
+        const TriangleMesh *mesh = GetMesh();
+        const int *v = &mesh->vertexIndices[3 * triIndex];
+        if (!mesh->HasUV())
+            return pstd::array<Point2f, 3>({Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
+        return pstd::array<Point2f, 3>({mesh->UV(v[0]), mesh->UV(v[1]), mesh->UV(v[2])});
+    }
+
     std::string ToString() const;
 
     static TriangleMesh *CreateMesh(const Transform *renderFromObject,
@@ -891,9 +928,9 @@ class Triangle {
         // Compute deltas and matrix determinant for triangle partial derivatives
         // Get triangle texture coordinates in _uv_ array
         pstd::array<Point2f, 3> uv =
-            mesh->uv
+            mesh->HasUV()
                 ? pstd::array<Point2f, 3>(
-                      {mesh->uv[v[0]], mesh->uv[v[1]], mesh->uv[v[2]]})
+                      {mesh->UV(v[0]), mesh->UV(v[1]), mesh->UV(v[2])})
                 : pstd::array<Point2f, 3>({Point2f(0, 0), Point2f(1, 0), Point2f(1, 1)});
 
         Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
@@ -942,22 +979,24 @@ class Triangle {
         if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
             isect.n = isect.shading.n = -isect.n;
 
-        if (mesh->n || mesh->s) {
+        if (mesh->HasNormals() || mesh->HasTangents()) {
             // Initialize _Triangle_ shading geometry
+            pstd::array<Normal3f, 3> n;
+            if (mesh->HasNormals())
+                n = {mesh->Normal(v[0]), mesh->Normal(v[1]), mesh->Normal(v[2])};
             // Compute shading normal _ns_ for triangle
             Normal3f ns;
-            if (mesh->n != nullptr) {
-                ns =
-                    ti.b0 * mesh->n[v[0]] + ti.b1 * mesh->n[v[1]] + ti.b2 * mesh->n[v[2]];
+            if (mesh->HasNormals()) {
+                ns = ti.b0 * n[0] + ti.b1 * n[1] + ti.b2 * n[2];
                 ns = LengthSquared(ns) > 0 ? Normalize(ns) : isect.n;
             } else
                 ns = isect.n;
 
             // Compute shading tangent _ss_ for triangle
             Vector3f ss;
-            if (mesh->s != nullptr) {
-                ss =
-                    ti.b0 * mesh->s[v[0]] + ti.b1 * mesh->s[v[1]] + ti.b2 * mesh->s[v[2]];
+            if (mesh->HasTangents()) {
+                ss = ti.b0 * mesh->Tangent(v[0]) + ti.b1 * mesh->Tangent(v[1]) +
+                     ti.b2 * mesh->Tangent(v[2]);
                 if (LengthSquared(ss) == 0)
                     ss = isect.dpdu;
             } else
@@ -972,12 +1011,12 @@ class Triangle {
 
             // Compute $\dndu$ and $\dndv$ for triangle shading geometry
             Normal3f dndu, dndv;
-            if (mesh->n != nullptr) {
+            if (mesh->HasNormals()) {
                 // Compute deltas for triangle partial derivatives of normal
                 Vector2f duv02 = uv[0] - uv[2];
                 Vector2f duv12 = uv[1] - uv[2];
-                Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-                Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+                Normal3f dn1 = n[0] - n[2];
+                Normal3f dn2 = n[1] - n[2];
 
                 Float determinant =
                     DifferenceOfProducts(duv02[0], duv12[1], duv02[1], duv12[0]);
@@ -989,8 +1028,8 @@ class Triangle {
                     // (rather than giving up) so that ray differentials for
                     // rays reflected from triangles with degenerate
                     // parameterizations are still reasonable.
-                    Vector3f dn = Cross(Vector3f(mesh->n[v[2]] - mesh->n[v[0]]),
-                                        Vector3f(mesh->n[v[1]] - mesh->n[v[0]]));
+                    Vector3f dn =
+                        Cross(Vector3f(n[2] - n[0]), Vector3f(n[1] - n[0]));
 
                     if (LengthSquared(dn) == 0)
                         dndu = dndv = Normal3f(0, 0, 0);
@@ -1027,9 +1066,9 @@ class Triangle {
 
         // Compute surface normal for sampled point on triangle
         Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
-        if (mesh->n != nullptr) {
-            Normal3f ns(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                        (1 - b[0] - b[1]) * mesh->n[v[2]]);
+        if (mesh->HasNormals()) {
+            Normal3f ns(b[0] * mesh->Normal(v[0]) + b[1] * mesh->Normal(v[1]) +
+                        (1 - b[0] - b[1]) * mesh->Normal(v[2]));
             n = FaceForward(n, ns);
         } else if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
             n *= -1;
@@ -1038,7 +1077,11 @@ class Triangle {
         Point3f pAbsSum = Abs(b[0] * p0) + Abs(b[1] * p1) + Abs((1 - b[0] - b[1]) * p2);
         Vector3f pError = Vector3f(gamma(6) * pAbsSum);
 
-        return ShapeSample{Interaction(Point3fi(p, pError), n), 1 / Area()};
+        // Compute $(u,v)$ for sampled point on triangle
+        pstd::array<Point2f, 3> uv = TextureCoordinates();
+        Point2f uvSample = b[0] * uv[0] + b[1] * uv[1] + b[2] * uv[2];
+
+        return ShapeSample{Interaction(Point3fi(p, pError), n, uvSample), 1 / Area()};
     }
 
     PBRT_CPU_GPU
@@ -1099,9 +1142,9 @@ class Triangle {
 
         // Compute surface normal for sampled point on triangle
         Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
-        if (mesh->n != nullptr) {
-            Normal3f ns(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                        (1 - b[0] - b[1]) * mesh->n[v[2]]);
+        if (mesh->HasNormals()) {
+            Normal3f ns(b[0] * mesh->Normal(v[0]) + b[1] * mesh->Normal(v[1]) +
+                        (1 - b[0] - b[1]) * mesh->Normal(v[2]));
             n = FaceForward(n, ns);
         } else if (mesh->reverseOrientation ^ mesh->transformSwapsHandedness)
             n *= -1;
@@ -1110,8 +1153,12 @@ class Triangle {
         Point3f pAbsSum = Abs(b[0] * p0) + Abs(b[1] * p1) + Abs((1 - b[0] - b[1]) * p2);
         Vector3f pError = Vector3f(gamma(6) * pAbsSum);
 
+        // Compute $(u,v)$ for sampled point on triangle
+        pstd::array<Point2f, 3> uv = TextureCoordinates();
+        Point2f uvSample = b[0] * uv[0] + b[1] * uv[1] + b[2] * uv[2];
+
         // Return _ShapeSample_ for uniform solid angle sampled point on triangle
-        return ShapeSample{Interaction(Point3fi(p, pError), n, ctx.time), pdf};
+        return ShapeSample{Interaction(Point3fi(p, pError), n, ctx.time, uvSample), pdf};
     }
 
     PBRT_CPU_GPU
@@ -1159,6 +1206,8 @@ class Triangle {
     }
 
   private:
+    friend class EmbreeAggregate;
+    friend class OpacityMicromap;
     // Triangle Private Methods
     PBRT_CPU_GPU
     const TriangleMesh *GetMesh() const {
@@ -1176,6 +1225,78 @@ class Triangle {
     static constexpr Float MaxSphericalSampleArea = 6.22;
 };
 
+// OpacityMicromap Definition
+// An OpacityMicromap records which parts of a triangle mesh's triangles an
+// alpha texture makes fully opaque or fully transparent, so that the
+// texture need only be evaluated at intersections in the rest. Each
+// triangle is split into $4^\roman{level}$ micro-triangles by uniformly
+// subdividing its edges, with the level chosen per triangle. Micro-triangles
+// are numbered along rows of increasing $b_2$, alternating upright and
+// inverted micro-triangles in each row.
+class OpacityMicromap {
+  public:
+    // OpacityMicromap Public Types
+    // These match the states of OptiX's 4-state opacity micromaps.
+    enum class State : uint8_t { Transparent = 0, Opaque = 1, Unknown = 2 };
+    static constexpr int MaxLevel = 6;
+
+    // OpacityMicromap Public Methods
+    OpacityMicromap(const TriangleMesh *mesh, Allocator alloc)
+        : mesh(mesh), triangles(alloc), states(alloc) {}
+
+    // Returns nullptr if _alpha_'s values can't be bounded or no part of the
+    // mesh is known to be opaque or transparent.
+    static OpacityMicromap *Create(const TriangleMesh *mesh, FloatTextureHandle alpha,
+                                   Allocator alloc);
+    // Returns the micromap for the mesh of the triangles in _shapes_, or
+    // nullptr if they aren't all triangles of one mesh. The micromap is
+    // allocated with _alloc_, like the primitives that use it.
+    static OpacityMicromap *Create(pstd::span<const ShapeHandle> shapes,
+                                   FloatTextureHandle alpha, Allocator alloc);
+
+    size_t NumTriangles() const { return triangles.size(); }
+    int Level(int triIndex) const { return triangles[triIndex] & LevelMask; }
+    State MicroTriangleState(int triIndex, int microIndex) const {
+        uint32_t t = triangles[triIndex];
+        if ((t & LevelMask) == 0)
+            return State(t >> LevelBits);
+        uint32_t word = states[(t >> LevelBits) + microIndex / 16];
+        return State((word >> (2 * (microIndex % 16))) & 3);
+    }
+
+    // Returns the index of the micro-triangle holding the point with
+    // barycentric coordinates $(1-b_1-b_2, b_1, b_2)$.
+    static int MicroTriangleIndex(Point2f b, int level) {
+        int n = 1 << level;
+        Float u = b[0] * n, v = b[1] * n;
+        int i = Clamp(int(u), 0, n - 1), j = Clamp(int(v), 0, n - 1);
+        i = std::min(i, n - 1 - j);
+        bool inverted = (u - i) + (v - j) > 1 && i + j < n - 1;
+        return j * (2 * n - j) + 2 * i + (inverted ? 1 : 0);
+    }
+
+    State Lookup(int triIndex, Point2f b) const {
+        return MicroTriangleState(triIndex, MicroTriangleIndex(b, Level(triIndex)));
+    }
+    // Looks up the state at a point on a triangle, e.g., an intersection.
+    State Lookup(int triIndex, Point3f p) const;
+
+    size_t BytesUsed() const {
+        return sizeof(*this) + triangles.size() * sizeof(triangles[0]) +
+               states.size() * sizeof(states[0]);
+    }
+    std::string ToString() const;
+
+  private:
+    // OpacityMicromap Private Members
+    // Each triangle's entry has its level in the low bits; the rest are its
+    // state for level 0 and otherwise the offset of its first word of
+    // 2-bit micro-triangle states in _states_.
+    static constexpr int LevelBits = 4, LevelMask = (1 << LevelBits) - 1;
+    const TriangleMesh *mesh;
+    pstd::vector<uint32_t> triangles, states;
+};
+
 // CurveType Definition
 enum class CurveType { Flat, Cylinder, Ribbon };
 
@@ -1198,6 +1319,11 @@ struct CurveCommon {
     Float normalAngle, invSinNormalAngle;
     const Transform *renderFromObject, *objectFromRender;
     bool reverseOrientation, transformSwapsHandedness;
+    // Frame aligned with the line between the curve's endpoints; segments'
+    // oriented bounds are expressed in it, relative to _cpObj[0]_. It is
+    // shared by all of the curve's segments and adds 36 bytes per curve
+    // with 32-bit _Float_s.
+    Frame chordFrame;
 };
 
 // Curve Definition
@@ -1209,6 +1335,13 @@ class Curve {
                                             bool reverseOrientation,
                                             const ParameterDictionary &parameters,
                                             const FileLoc *loc, Allocator alloc);
+    // Creates all of the curves stored in the binary curve set file given by
+    // the "filename" parameter, as is written by cyhair2pbrt.
+    static pstd::vector<ShapeHandle> CreateSet(const Transform *renderFromObject,
+                                               const Transform *objectFromRender,
+                                               bool reverseOrientation,
+                                               const ParameterDictionary &parameters,
+                                               const FileLoc *loc, Allocator alloc);
 
     PBRT_CPU_GPU
     Bounds3f Bounds() const;
@@ -1230,12 +1363,18 @@ class Curve {
 
     std::string ToString() const;
 
-    Curve(const CurveCommon *common, Float uMin, Float uMax)
-        : common(common), uMin(uMin), uMax(uMax) {}
+    Curve(const CurveCommon *common, Float uMin, Float uMax);
 
     PBRT_CPU_GPU
     DirectionCone NormalBounds() const { return DirectionCone::EntireSphere(); }
 
+    PBRT_CPU_GPU
+    const CurveCommon *Common() const { return common; }
+    PBRT_CPU_GPU
+    Float UMin() const { return uMin; }
+    PBRT_CPU_GPU
+    Float UMax() const { return uMax; }
+
   private:
     // Curve Private Methods
     bool IntersectRay(const Ray &r, Float tMax,
@@ -1247,6 +1386,13 @@ class Curve {
     // Curve Private Members
     const CurveCommon *common;
     Float uMin, uMax;
+    // Bounds of the segment in _common->chordFrame_, which fit diagonal
+    // curves much more tightly than axis-aligned bounds. Segments share
+    // their curve's control points and widths through _common_, but each
+    // stores its own bounds: with 32-bit _Float_s, 24 bytes, which grows a
+    // _Curve_ from 16 to 40 bytes. "splitdepth" multiplies this cost along
+    // with the number of segments.
+    Bounds3f chordBounds;
 };
 
 // BilinearPatch Declarations
@@ -1344,6 +1490,11 @@ class BilinearPatch {
 
     static pstd::vector<ShapeHandle> CreatePatches(const BilinearPatchMesh *mesh,
                                                    Allocator alloc);
+    // Makes a mesh's index available to meshes that are created later; none
+    // of the mesh's patches may be used afterward.
+    static void ReleaseMeshIndex(int meshIndex);
+
+    int MeshIndex() const { return meshIndex; }
 
     PBRT_CPU_GPU
     Bounds3f Bounds() const;
@@ -1355,6 +1506,16 @@ class BilinearPatch {
     PBRT_CPU_GPU
     bool IntersectP(const Ray &ray, Float tMax = Infinity) const;
 
+    // Returns the intersection for a hit with the patch that was found by
+    // IntersectBilinearPatch() with its vertices
+    PBRT_CPU_GPU
+    ShapeIntersection IntersectionFromHit(const BilinearIntersection &isect,
+                                          const Ray &ray) const {
+        return ShapeIntersection{InteractionFromIntersection(GetMesh(), blpIndex,
+                                                             isect.uv, ray.time, -ray.d),
+                                 isect.t};
+    }
+
     PBRT_CPU_GPU
     pstd::optional<ShapeSample> Sample(const ShapeSampleContext &ctx, Point2f u) const;
 
@@ -1375,6 +1536,14 @@ class BilinearPatch {
     PBRT_CPU_GPU
     Float Area() const { return area; }
 
+    PBRT_CPU_GPU
+    pstd::array<Point3f, 4> Vertices() const {
+        const BilinearPatchMesh *mesh = GetMesh();
+        const int *v = &mesh->vertexIndices[4 * blpIndex];
+        return pstd::array<Point3f, 4>(
+            {mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]], mesh->p[v[3]]});
+    }
+
     PBRT_CPU_GPU
     static SurfaceInteraction InteractionFromIntersection(const BilinearPatchMesh *mesh,
                                                           int patchIndex,
@@ -7,18 +7,37 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/interaction.h>
+#include <pbrt/parsedscene.h>
+#include <pbrt/parser.h>
 #include <pbrt/shapes.h>
+#include <pbrt/textures.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/loopsubdiv.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/memory.h>
+#include <pbrt/util/mesh.h>
 #include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
+#include <pbrt/util/splines.h>
 
+#include <rply/rply.h>
+
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <functional>
+#include <map>
 
 using namespace pbrt;
 
+static std::string inTestDir(const std::string &path) {
+    return path;
+}
+
 static Float pExp(RNG &rng, Float exp = 8.) {
     Float logu = Lerp(rng.Uniform<Float>(), -exp, exp);
     return std::pow(10, logu);
@@ -446,3 +465,406 @@ TEST(Triangle, BadCases) {
 
     EXPECT_FALSE(tris[0].Intersect(ray).has_value());
 }
+
+TEST(Triangle, CompressedAttributes) {
+    RNG rng;
+    Transform identity;
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    std::vector<Normal3f> n;
+    std::vector<Vector3f> s;
+    std::vector<Point2f> uv;
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(Point3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1)));
+            n.push_back(Normal3f(
+                SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()})));
+            s.push_back(SampleUniformSphere({rng.Uniform<Float>(), rng.Uniform<Float>()}));
+            uv.push_back(Point2f(pUnif(rng, 4), pUnif(rng, 4)));
+        }
+    }
+    TriangleMesh mesh(identity, false, indices, p, s, n, uv, {});
+    TriangleMesh compressed(identity, false, indices, p, s, n, uv, {}, nullptr, true);
+    EXPECT_TRUE(compressed.n == nullptr && compressed.s == nullptr &&
+                compressed.uv == nullptr);
+    EXPECT_TRUE(compressed.HasNormals() && compressed.HasTangents() &&
+                compressed.HasUV());
+
+    for (size_t i = 0; i < p.size(); ++i) {
+        EXPECT_GT(Dot(mesh.Normal(i), compressed.Normal(i)), .9999f);
+        EXPECT_GT(Dot(mesh.Tangent(i), compressed.Tangent(i)), .9999f);
+        EXPECT_LT(Distance(mesh.UV(i), compressed.UV(i)), 1e-3f);
+    }
+
+    // Shading geometry at intersections should match closely
+    pstd::vector<ShapeHandle> tris = Triangle::CreateTriangles(&mesh, Allocator());
+    pstd::vector<ShapeHandle> compressedTris =
+        Triangle::CreateTriangles(&compressed, Allocator());
+    for (size_t i = 0; i < tris.size(); ++i) {
+        Point3f pt = tris[i].Sample(Point2f(.3, .4))->intr.p();
+        Ray ray(Point3f(0, 0, 3), pt - Point3f(0, 0, 3));
+        pstd::optional<ShapeIntersection> si = tris[i].Intersect(ray);
+        pstd::optional<ShapeIntersection> sic = compressedTris[i].Intersect(ray);
+        ASSERT_EQ(si.has_value(), sic.has_value());
+        if (!si)
+            continue;
+        EXPECT_EQ(si->tHit, sic->tHit);
+        EXPECT_GT(Dot(si->intr.shading.n, sic->intr.shading.n), .999f);
+        EXPECT_LT(Distance(si->intr.uv, sic->intr.uv), 1e-3f);
+    }
+}
+
+TEST(Triangle, MicroTriangleIndex) {
+    RNG rng;
+    for (int level = 0; level <= 3; ++level) {
+        // Every micro-triangle should be found, and points should be
+        // found to be inside the micro-triangle they're in
+        int n = 1 << level;
+        std::vector<bool> seen(n * n, false);
+        for (int i = 0; i < 10000; ++i) {
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Point2f b = u[0] + u[1] > 1 ? Point2f(1 - u[0], 1 - u[1]) : u;
+            int index = OpacityMicromap::MicroTriangleIndex(b, level);
+            ASSERT_GE(index, 0);
+            ASSERT_LT(index, n * n);
+            seen[index] = true;
+
+            // Find the row and column of the micro-triangle
+            int j = std::min<int>(b[1] * n, n - 1), i0 = std::min<int>(b[0] * n, n - 1);
+            EXPECT_GE(index, j * (2 * n - j));
+            EXPECT_LT(index, (j + 1) * (2 * n - j - 1));
+            EXPECT_LE(std::abs((index - j * (2 * n - j)) / 2 - i0), 1);
+        }
+        for (int i = 0; i < n * n; ++i)
+            EXPECT_TRUE(seen[i]) << "level " << level << " index " << i;
+    }
+}
+
+TEST(Triangle, OpacityMicromap) {
+    // Alpha texture with an opaque disk, a ramp, and transparency outside
+    Image image(PixelFormat::Float, {64, 64}, {"R", "G", "B"});
+    for (int y = 0; y < 64; ++y)
+        for (int x = 0; x < 64; ++x) {
+            Float r = Distance(Point2f(x + .5f, y + .5f), Point2f(32, 32));
+            Float a = Clamp((28 - r) / 8, 0, 1);
+            for (int c = 0; c < 3; ++c)
+                image.SetChannel({x, y}, c, a);
+        }
+    std::string filename = inTestDir("test-alpha.pfm");
+    ASSERT_TRUE(image.Write(filename));
+    FloatImageTexture tex(new UVMapping2D, filename, MIPMapFilterOptions(),
+                          WrapMode::Repeat, 1, false, ColorEncodingHandle::Linear,
+                          Allocator());
+
+    RNG rng;
+    Transform identity;
+    std::vector<int> indices;
+    std::vector<Point3f> p;
+    std::vector<Point2f> uv;
+    for (int i = 0; i < 100; ++i)
+        for (int j = 0; j < 3; ++j) {
+            indices.push_back(p.size());
+            p.push_back(Point3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1)));
+            uv.push_back(Point2f(pUnif(rng, 1), pUnif(rng, 1)));
+        }
+    TriangleMesh mesh(identity, false, indices, p, {}, {}, uv, {});
+    const OpacityMicromap *omm = OpacityMicromap::Create(&mesh, &tex, Allocator());
+    ASSERT_TRUE(omm != nullptr);
+
+    // Micromap states should match the texture's values; filtering texels
+    // that are all one may give a value that is just below one, though.
+    int nKnown = 0, nTests = 0;
+    for (int t = 0; t < mesh.nTriangles; ++t)
+        for (int i = 0; i < 100; ++i) {
+            Point2f u(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Point2f b = u[0] + u[1] > 1 ? Point2f(1 - u[0], 1 - u[1]) : u;
+            const int *v = &indices[3 * t];
+            TextureEvalContext ctx;
+            ctx.uv = (1 - b[0] - b[1]) * uv[v[0]] + b[0] * uv[v[1]] + b[1] * uv[v[2]];
+            Float a = tex.Evaluate(ctx);
+
+            OpacityMicromap::State state = omm->Lookup(t, b);
+            if (state == OpacityMicromap::State::Opaque)
+                EXPECT_GE(a, 1 - 1e-5f);
+            else if (state == OpacityMicromap::State::Transparent)
+                EXPECT_LE(a, 0);
+            nKnown += state != OpacityMicromap::State::Unknown;
+            ++nTests;
+
+            // Lookups at points on the triangle should agree
+            Point3f pt = (1 - b[0] - b[1]) * p[v[0]] + b[0] * p[v[1]] + b[1] * p[v[2]];
+            OpacityMicromap::State pState = omm->Lookup(t, pt);
+            if (pState == OpacityMicromap::State::Opaque)
+                EXPECT_GE(a, 1 - 1e-5f);
+            else if (pState == OpacityMicromap::State::Transparent)
+                EXPECT_LE(a, 0);
+        }
+    // The ramp, which covers about a third of the texture, is never known
+    EXPECT_GT(nKnown, nTests / 3);
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(TriQuadMesh, BinaryPLYMatchesASCII) {
+    // Write the same mesh in each PLY storage mode, with mixed property types
+    // and an extra property that must be skipped
+    int nVertices = 200, nFaces = 300;
+    std::vector<std::string> filenames = {inTestDir("ascii.ply"), inTestDir("little.ply"),
+                                          inTestDir("big.ply")};
+    e_ply_storage_mode modes[] = {PLY_ASCII, PLY_LITTLE_ENDIAN, PLY_BIG_ENDIAN};
+    for (int m = 0; m < 3; ++m) {
+        p_ply ply = ply_create(filenames[m].c_str(), modes[m], nullptr, 0, nullptr);
+        ASSERT_TRUE(ply != nullptr);
+        ply_add_element(ply, "vertex", nVertices);
+        ply_add_scalar_property(ply, "x", PLY_FLOAT);
+        ply_add_scalar_property(ply, "y", PLY_DOUBLE);
+        ply_add_scalar_property(ply, "z", PLY_FLOAT);
+        ply_add_scalar_property(ply, "flags", PLY_UCHAR);
+        ply_add_scalar_property(ply, "nx", PLY_FLOAT);
+        ply_add_scalar_property(ply, "ny", PLY_FLOAT);
+        ply_add_scalar_property(ply, "nz", PLY_FLOAT);
+        ply_add_scalar_property(ply, "s", PLY_FLOAT);
+        ply_add_scalar_property(ply, "t", PLY_FLOAT);
+        ply_add_element(ply, "face", nFaces);
+        ply_add_list_property(ply, "vertex_indices", PLY_UCHAR, PLY_UINT);
+        ply_add_scalar_property(ply, "face_indices", PLY_SHORT);
+        ply_write_header(ply);
+        for (int i = 0; i < nVertices; ++i)
+            for (int c = 0; c < 9; ++c)
+                ply_write(ply, c == 3 ? 7 : (i * .25 + c));
+        for (int i = 0; i < nFaces; ++i) {
+            int n = (i % 7 == 0) ? 4 : 3;
+            ply_write(ply, n);
+            for (int j = 0; j < n; ++j)
+                ply_write(ply, (i * 13 + j * 7) % nVertices);
+            ply_write(ply, i % 100);
+        }
+        ply_close(ply);
+    }
+
+    TriQuadMesh ascii = TriQuadMesh::ReadPLY(filenames[0]);
+    EXPECT_EQ(nVertices, int(ascii.p.size()));
+    EXPECT_EQ(nFaces, int(ascii.faceIndices.size()));
+    for (int m = 1; m < 3; ++m) {
+        TriQuadMesh mesh = TriQuadMesh::ReadPLY(filenames[m]);
+        EXPECT_EQ(ascii.p, mesh.p);
+        EXPECT_EQ(ascii.n, mesh.n);
+        EXPECT_EQ(ascii.uv, mesh.uv);
+        EXPECT_EQ(ascii.faceIndices, mesh.faceIndices);
+        EXPECT_EQ(ascii.triIndices, mesh.triIndices);
+        EXPECT_EQ(ascii.quadIndices, mesh.quadIndices);
+    }
+
+    for (const std::string &fn : filenames)
+        EXPECT_EQ(0, remove(fn.c_str()));
+}
+
+TEST(Curve, RaysThroughCenterHit) {
+    // Rays through points on the curve's centerline must be reported as
+    // hits by one of its segments
+    RNG rng;
+    Transform identity;
+    int nSegments = 8;
+    std::vector<Curve> curves;
+    for (int i = 0; i < 100; ++i) {
+        Point3f cp[4];
+        for (int j = 0; j < 4; ++j)
+            cp[j] = Point3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1));
+        CurveType type = (i & 1) ? CurveType::Cylinder : CurveType::Flat;
+        // Leaks...
+        CurveCommon *common = new CurveCommon(cp, .02f, .01f, type, {}, &identity,
+                                              &identity, false);
+        curves.clear();
+        for (int s = 0; s < nSegments; ++s)
+            curves.push_back(
+                Curve(common, Float(s) / nSegments, Float(s + 1) / nSegments));
+
+        for (int j = 0; j < 100; ++j) {
+            Vector3f dpdu;
+            Point3f p = EvaluateCubicBezier(pstd::MakeConstSpan(cp),
+                                            rng.Uniform<Float>(), &dpdu);
+            Point3f o = p + 10 * SampleUniformSphere({rng.Uniform<Float>(),
+                                                      rng.Uniform<Float>()});
+            Vector3f d = p - o;
+            // Skip rays that nearly follow the curve
+            if (AbsDot(Normalize(d), Normalize(dpdu)) > .9f)
+                continue;
+
+            Ray ray(o, d);
+            bool hit = false;
+            for (const Curve &curve : curves)
+                hit |= curve.IntersectP(ray, 2);
+            EXPECT_TRUE(hit) << i << " " << j;
+
+            // The same ray, backwards, can't hit
+            ray.d = -d;
+            for (const Curve &curve : curves)
+                EXPECT_FALSE(curve.IntersectP(ray, 2));
+        }
+    }
+}
+
+TEST(Curve, CurveSetMatchesCurves) {
+    // Write a curve set file with a few curves and describe the same curves
+    // with individual "curve" shapes
+    int nCurves = 3;
+    std::vector<float> cp, widths;
+    std::string curveShapes;
+    for (int i = 0; i < nCurves; ++i) {
+        std::string p;
+        for (int j = 0; j < 12; ++j) {
+            cp.push_back(0.25f * ((i * 7 + j * 5) % 11) - 1);
+            p += StringPrintf("%f ", cp.back());
+        }
+        widths.push_back(0.125f * (i + 1));
+        widths.push_back(0.0625f * (i + 1));
+        curveShapes += StringPrintf(
+            "Shape \"curve\" \"string type\" \"cylinder\" \"integer splitdepth\" 2 "
+            "\"point3 P\" [ %s ] \"float width0\" %f \"float width1\" %f\n",
+            p, widths[2 * i], widths[2 * i + 1]);
+    }
+    uint32_t header[2] = {uint32_t(nCurves), 0};
+    std::string contents = "PBRTCRV1";
+    contents.append(reinterpret_cast<const char *>(header), sizeof(header));
+    contents.append(reinterpret_cast<const char *>(cp.data()), cp.size() * sizeof(float));
+    contents.append(reinterpret_cast<const char *>(widths.data()),
+                    widths.size() * sizeof(float));
+    std::string filename = inTestDir("test.curves");
+    ASSERT_TRUE(WriteFile(filename, contents));
+
+    ParsedScene scene;
+    ParseString(&scene, "WorldBegin\nShape \"curveset\" \"string type\" \"cylinder\" "
+                        "\"integer splitdepth\" 2 \"string filename\" \"" +
+                            filename + "\"\n" + curveShapes);
+    ASSERT_EQ(1 + nCurves, scene.shapes.size());
+
+    Transform identity;
+    auto create = [&](const ShapeSceneEntity &sh) {
+        return ShapeHandle::Create(sh.name, &identity, &identity, false, sh.parameters,
+                                   &sh.loc, Allocator());
+    };
+    pstd::vector<ShapeHandle> curveSet = create(scene.shapes[0]);
+    ASSERT_EQ(4 * nCurves, curveSet.size());
+    for (int i = 0; i < nCurves; ++i) {
+        pstd::vector<ShapeHandle> curves = create(scene.shapes[1 + i]);
+        ASSERT_EQ(4, curves.size());
+        for (int s = 0; s < 4; ++s) {
+            EXPECT_EQ(curves[s].Bounds(), curveSet[4 * i + s].Bounds());
+            EXPECT_EQ(curves[s].Area(), curveSet[4 * i + s].Area());
+        }
+    }
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+TEST(LoopSubdiv, AdaptiveIsWatertight) {
+    // Octahedron
+    std::vector<Point3f> p = {{1, 0, 0},  {-1, 0, 0}, {0, 1, 0},
+                              {0, -1, 0}, {0, 0, 1},  {0, 0, -1}};
+    std::vector<int> indices = {0, 2, 4, 2, 1, 4, 1, 3, 4, 3, 0, 4,
+                                2, 0, 5, 1, 2, 5, 3, 1, 5, 0, 3, 5};
+    Transform identity;
+
+    TriangleMesh *uniform = LoopSubdivide(&identity, false, 3, indices, p, {});
+    EXPECT_EQ(8 * 64, uniform->nTriangles);
+
+    // Only refine edges with an endpoint with x > 0
+    TriangleMesh *adaptive =
+        LoopSubdivide(&identity, false, 3, indices, p, {},
+                      [](Point3f p0, Point3f p1) { return p0.x > 0 || p1.x > 0; });
+    EXPECT_LT(adaptive->nTriangles, uniform->nTriangles);
+    EXPECT_GT(adaptive->nTriangles, 8 * 4);
+
+    // Each edge should be shared with a consistently oriented neighbor face
+    std::map<std::pair<int, int>, int> edgeCount;
+    for (int i = 0; i < adaptive->nTriangles; ++i)
+        for (int j = 0; j < 3; ++j)
+            ++edgeCount[{adaptive->vertexIndices[3 * i + j],
+                         adaptive->vertexIndices[3 * i + (j + 1) % 3]}];
+    for (const auto &edge : edgeCount) {
+        EXPECT_EQ(1, edge.second);
+        EXPECT_EQ(1, edgeCount.count({edge.first.second, edge.first.first}));
+    }
+}
+
+TEST(LoopSubdiv, UniformMatchesReference) {
+    // Open pyramid with an extra triangle, so that the result exercises the
+    // interior, boundary, regular, and extraordinary vertex rules
+    std::vector<Point3f> p = {{0, 0, 1},  {1, 0, 0},  {0, 1, 0},
+                              {-1, 0, 0}, {0, -1, 0}, {2, 2, 0}};
+    std::vector<int> indices = {0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 1, 1, 5, 2};
+    Transform identity;
+    TriangleMesh *mesh = LoopSubdivide(&identity, false, 1, indices, p, {});
+
+    // Limit positions, normalized normals, and triangles computed by the
+    // SDVertex/SDFace implementation that LoopSubdivide replaced
+    std::vector<Point3f> pRef = {{0, 0, 0.5},
+                      {1, 0.175, 0},
+                      {0.175, 1, 0},
+                      {-0.65, 0, 0},
+                      {0, -0.65, 0},
+                      {1.475, 1.475, 0},
+                      {0.364583, 0.0208333, 0.3125},
+                      {0.645833, 0.645833, 0.125},
+                      {0.0208333, 0.364583, 0.3125},
+                      {-0.425, 0.5, 0},
+                      {-0.333333, 0, 0.302083},
+                      {-0.45, -0.45, 0},
+                      {0, -0.333333, 0.302083},
+                      {0.5, -0.425, 0},
+                      {1.425, 0.95, 0},
+                      {0.95, 1.425, 0}};
+    std::vector<Normal3f> nRef = {{0.01449, 0.01449, -0.99979},
+                                  {-0.35700, 0.24016, -0.90270},
+                                  {0.24016, -0.35700, -0.90270},
+                                  {0.69014, -0.01816, -0.72345},
+                                  {-0.01816, 0.69014, -0.72345},
+                                  {0, 0, -1},
+                                  {-0.44307, 0.10987, -0.88973},
+                                  {-0.15333, -0.15333, -0.97621},
+                                  {0.10987, -0.44307, -0.88973},
+                                  {0.51959, -0.42866, -0.73910},
+                                  {0.59229, -0.01138, -0.80565},
+                                  {0.49161, 0.49161, -0.71877},
+                                  {-0.01138, 0.59229, -0.80565},
+                                  {-0.42866, 0.51959, -0.73910},
+                                  {-0.10573, 0.03863, -0.99364},
+                                  {0.03863, -0.10573, -0.99364}};
+    std::vector<int> indicesRef = {0,  6, 8,  6,  1,  7,  8,  7,  2,  6,  7,  8,
+                                   0,  8, 10, 8,  2,  9,  10, 9,  3,  8,  9,  10,
+                                   0,  10, 12, 10, 3,  11, 12, 11, 4,  10, 11, 12,
+                                   0,  12, 6,  12, 4,  13, 6,  13, 1,  12, 13, 6,
+                                   1,  14, 7,  14, 5,  15, 7,  15, 2,  14, 15, 7};
+    ASSERT_EQ(pRef.size(), mesh->nVertices);
+    ASSERT_EQ(indicesRef.size(), 3 * mesh->nTriangles);
+
+    // Vertices may be numbered differently; match them up by position
+    std::vector<int> refIndex(mesh->nVertices);
+    for (int i = 0; i < mesh->nVertices; ++i) {
+        int closest = 0;
+        for (int j = 1; j < pRef.size(); ++j)
+            if (Distance(mesh->p[i], pRef[j]) < Distance(mesh->p[i], pRef[closest]))
+                closest = j;
+        refIndex[i] = closest;
+        EXPECT_LT(Distance(mesh->p[i], pRef[closest]), 1e-5f) << mesh->p[i];
+        EXPECT_LT(Length(Vector3f(Normalize(mesh->n[i]) - nRef[closest])), 1e-4f)
+            << mesh->n[i] << " vs. " << nRef[closest];
+    }
+
+    // Compare the triangles, each rotated to start at its smallest index
+    auto sortedTriangles = [](std::function<int(int)> index, int nTriangles) {
+        std::vector<std::array<int, 3>> tris;
+        for (int i = 0; i < nTriangles; ++i) {
+            std::array<int, 3> t = {index(3 * i), index(3 * i + 1), index(3 * i + 2)};
+            std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+            tris.push_back(t);
+        }
+        std::sort(tris.begin(), tris.end());
+        return tris;
+    };
+    auto trianglesRef =
+        sortedTriangles([&](int i) { return indicesRef[i]; }, mesh->nTriangles);
+    auto triangles = sortedTriangles(
+        [&](int i) { return refIndex[mesh->vertexIndices[i]]; }, mesh->nTriangles);
+    EXPECT_EQ(trianglesRef, triangles);
+}
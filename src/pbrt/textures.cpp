@@ -5,12 +5,15 @@
 #include <pbrt/textures.h>
 
 #include <pbrt/interaction.h>
+#include <pbrt/options.h>
 #include <pbrt/paramdict.h>
+#include <pbrt/util/bcn.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
 #include <pbrt/util/float.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/splines.h>
 #include <pbrt/util/stats.h>
 
@@ -344,11 +347,11 @@ SampledSpectrum SpectrumImageTexture::Evaluate(TextureEvalContext ctx,
     st[1] = 1 - st[1];
 
     // Lookup filtered RGB value in _MIPMap_
-    RGB rgb = scale * mipmap->Filter<RGB>(st, dstdx, dstdy);
+    RGB rgb = scale * GetMIPMap()->Filter<RGB>(st, dstdx, dstdy);
     rgb = ClampZero(invert ? (RGB(1, 1, 1) - rgb) : rgb);
 
     // Return _SampledSpectrum_ for RGB image texture value
-    if (const RGBColorSpace *cs = mipmap->GetRGBColorSpace(); cs != nullptr) {
+    if (const RGBColorSpace *cs = GetMIPMap()->GetRGBColorSpace(); cs != nullptr) {
         if (spectrumType == SpectrumType::Unbounded)
             return RGBUnboundedSpectrum(*cs, rgb).Sample(lambda);
         else if (spectrumType == SpectrumType::Albedo)
@@ -366,13 +369,13 @@ SampledSpectrum SpectrumImageTexture::Evaluate(TextureEvalContext ctx,
 std::string SpectrumImageTexture::ToString() const {
     return StringPrintf(
         "[ SpectrumImageTexture mapping: %s scale: %f invert: %s mipmap: %s ]", mapping,
-        scale, invert, *mipmap);
+        scale, invert, *lazyMIPMap);
 }
 
 std::string FloatImageTexture::ToString() const {
     return StringPrintf(
         "[ FloatImageTexture mapping: %s scale: %f invert: %s mipmap: %s ]", mapping,
-        scale, invert, *mipmap);
+        scale, invert, *lazyMIPMap);
 }
 
 std::string TexInfo::ToString() const {
@@ -381,8 +384,136 @@ std::string TexInfo::ToString() const {
         filterOptions, wrapMode, encoding);
 }
 
+// SharedTextureImage Definition
+// The decoded image for a file, which is kept until all of the _LazyMIPMap_s
+// that use it have been loaded.
+struct SharedTextureImage {
+    std::mutex mutex;
+    bool decoded = false;
+    ColorEncodingHandle encoding;
+    ImageAndMetadata image;
+    int nPending = 0;
+};
+
+STAT_PERCENT("Texture/Image maps loaded", nImageMapsLoaded, nImageMaps);
+STAT_COUNTER("Texture/Duplicate image decodes avoided", nImageDecodesAvoided);
+
+// Returns the image to create the _MIPMap_ for _texInfo_ from, decoding it
+// only if _shared_ doesn't hold a decoded image that can be used for it.
+static ImageAndMetadata GetTextureImage(SharedTextureImage *shared,
+                                        const TexInfo &texInfo) {
+    std::lock_guard<std::mutex> lock(shared->mutex);
+    bool last = --shared->nPending == 0;
+    if (!shared->decoded) {
+        shared->image = MIPMap::ReadImage(texInfo.filename, texInfo.encoding, {});
+        shared->encoding = texInfo.encoding;
+        shared->decoded = true;
+    } else {
+        // Only PNG files are decoded using the encoding; their 8-bit images
+        // just record it, but 16-bit ones are converted to linear with it.
+        bool isPNG = HasExtension(texInfo.filename, "png");
+        if (isPNG && texInfo.encoding != shared->encoding &&
+            shared->image.image.Format() != PixelFormat::U256) {
+            if (last)
+                shared->image = ImageAndMetadata();
+            return MIPMap::ReadImage(texInfo.filename, texInfo.encoding, {});
+        }
+        ++nImageDecodesAvoided;
+    }
+
+    ImageAndMetadata result = last ? std::move(shared->image) : shared->image;
+    if (last)
+        shared->image = ImageAndMetadata();
+
+    Image &image = result.image;
+    if (HasExtension(texInfo.filename, "png") && texInfo.encoding != shared->encoding) {
+        // Give the 8-bit image the texture's encoding
+        const uint8_t *p = static_cast<const uint8_t *>(image.RawPointer({0, 0}));
+        pstd::vector<uint8_t> p8(p, p + image.BytesUsed());
+        image = Image(std::move(p8), image.Resolution(), image.ChannelNames(),
+                      texInfo.encoding ? texInfo.encoding : ColorEncodingHandle::sRGB);
+    }
+    return result;
+}
+
+// LazyMIPMap Method Definitions
+LazyMIPMap::LazyMIPMap(TexInfo texInfo, SharedTextureImage *sharedImage,
+                       Allocator alloc)
+    : texInfo(std::move(texInfo)), sharedImage(sharedImage), alloc(alloc) {
+    ++nImageMaps;
+}
+
+MIPMap *LazyMIPMap::Load() {
+    std::call_once(loadFlag, [this]() {
+        MIPMap *m;
+        if (sharedImage) {
+            ImageAndMetadata imageAndMetadata = GetTextureImage(sharedImage, texInfo);
+            const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
+            m = alloc.new_object<MIPMap>(std::move(imageAndMetadata.image), colorSpace,
+                                         texInfo.wrapMode, alloc, texInfo.filterOptions);
+        } else
+            m = MIPMap::CreateFromFile(texInfo.filename, texInfo.filterOptions,
+                                       texInfo.wrapMode, texInfo.encoding, alloc);
+        ++nImageMapsLoaded;
+        mipmap.store(m, std::memory_order_release);
+    });
+    return mipmap.load(std::memory_order_acquire);
+}
+
+std::string LazyMIPMap::ToString() const {
+    if (MIPMap *m = mipmap.load(std::memory_order_acquire); m != nullptr)
+        return m->ToString();
+    return StringPrintf("[ LazyMIPMap texInfo: %s (not loaded) ]", texInfo);
+}
+
+// ImageTextureBase Method Definitions
 std::mutex ImageTextureBase::textureCacheMutex;
-std::map<TexInfo, MIPMap *> ImageTextureBase::textureCache;
+std::map<TexInfo, LazyMIPMap *> ImageTextureBase::textureCache;
+std::map<std::string, SharedTextureImage *> ImageTextureBase::imageCache;
+
+ImageTextureBase::ImageTextureBase(TextureMapping2DHandle mapping, std::string filename,
+                                   MIPMapFilterOptions filterOptions, WrapMode wrapMode,
+                                   Float scale, bool invert, ColorEncodingHandle encoding,
+                                   Allocator alloc)
+    : mapping(mapping), scale(scale), invert(invert) {
+    // Get _LazyMIPMap_ from texture cache, adding it if not present
+    TexInfo texInfo(filename, filterOptions, wrapMode, encoding);
+    std::lock_guard<std::mutex> lock(textureCacheMutex);
+    LazyMIPMap *&entry = textureCache[texInfo];
+    if (!entry) {
+        // Share the decoded image with the other textures that use _filename_;
+        // pyramid files aren't decoded, so there is nothing to share for them.
+        SharedTextureImage *sharedImage = nullptr;
+        if (!HasExtension(filename, "mip")) {
+            SharedTextureImage *&image = imageCache[filename];
+            if (!image)
+                image = new SharedTextureImage;
+            sharedImage = image;
+            std::lock_guard<std::mutex> imageLock(sharedImage->mutex);
+            ++sharedImage->nPending;
+        }
+        entry = new LazyMIPMap(texInfo, sharedImage, alloc);
+    }
+    lazyMIPMap = entry;
+}
+
+void ImageTextureBase::ClearCache() {
+    std::lock_guard<std::mutex> lock(textureCacheMutex);
+    int nUnloaded = 0;
+    for (const auto &entry : textureCache) {
+        if (!entry.second->IsLoaded())
+            ++nUnloaded;
+        delete entry.second;
+    }
+    if (nUnloaded > 0)
+        LOG_VERBOSE("%d of %d image textures were never evaluated and so were not loaded",
+                    nUnloaded, textureCache.size());
+    textureCache.clear();
+
+    for (const auto &entry : imageCache)
+        delete entry.second;
+    imageCache.clear();
+}
 
 FloatImageTexture *FloatImageTexture::Create(const Transform &renderFromTexture,
                                              const TextureParameterDictionary &parameters,
@@ -418,6 +549,52 @@ FloatImageTexture *FloatImageTexture::Create(const Transform &renderFromTexture,
                                                scale, invert, encoding, alloc);
 }
 
+// Returns bounds on _scale_ times the values of _mipmap_'s zero-width
+// lookups in the (s,t) triangle that _mapping_ maps _uv_ to, inverted if
+// _invert_ is set.
+static pstd::optional<Interval> MappedImageRange(const MIPMap *mipmap,
+                                                 TextureMapping2DHandle mapping,
+                                                 Float scale, bool invert,
+                                                 const pstd::array<Point2f, 3> &uv) {
+    // Other mappings aren't affine in $(u,v)$ and so the (s,t) triangle's
+    // bounds can't be found from its vertices
+    if (!mapping.Is<UVMapping2D>())
+        return {};
+    Bounds2f st;
+    for (Point2f p : uv) {
+        TextureEvalContext ctx;
+        ctx.uv = p;
+        Vector2f dstdx, dstdy;
+        Point2f stp = mapping.Map(ctx, &dstdx, &dstdy);
+        st = Union(st, Point2f(stp[0], 1 - stp[1]));
+    }
+
+    Interval range = mipmap->FilterRange(st);
+    if (std::isinf(range.LowerBound()) || std::isinf(range.UpperBound()))
+        return {};
+    Interval v(scale * range.LowerBound(), scale * range.UpperBound());
+    if (invert)
+        return Interval(std::max<Float>(0, 1 - v.UpperBound()),
+                        std::max<Float>(0, 1 - v.LowerBound()));
+    return v;
+}
+
+pstd::optional<Interval> FloatImageTexture::EvaluateRange(
+    const pstd::array<Point2f, 3> &uv) const {
+    return MappedImageRange(GetMIPMap(), mapping, scale, invert, uv);
+}
+
+pstd::optional<Interval> FloatTextureRange(FloatTextureHandle tex,
+                                           const pstd::array<Point2f, 3> &uv) {
+    if (const FloatConstantTexture *ct = tex.CastOrNullptr<FloatConstantTexture>())
+        return Interval(ct->Evaluate(TextureEvalContext()));
+    if (const FloatImageTexture *it = tex.CastOrNullptr<FloatImageTexture>())
+        return it->EvaluateRange(uv);
+    if (const GPUFloatImageTexture *gt = tex.CastOrNullptr<GPUFloatImageTexture>())
+        return gt->EvaluateRange(uv);
+    return {};
+}
+
 SpectrumImageTexture *SpectrumImageTexture::Create(
     const Transform &renderFromTexture, const TextureParameterDictionary &parameters,
     SpectrumType spectrumType, const FileLoc *loc, Allocator alloc) {
@@ -529,8 +706,26 @@ SpectrumMixTexture *SpectrumMixTexture::Create(
 
 static Ptex::PtexCache *cache;
 
+// PtexThreadHandles Definition
+// Each thread keeps the texture and filter for each Ptex file that it has
+// looked up rather than getting them from the cache and releasing them for
+// every lookup, which contends for the cache's locks.
+struct PtexThreadHandles {
+    Ptex::PtexTexture *texture = nullptr;
+    Ptex::PtexFilter *filter = nullptr;
+};
+
+static std::once_flag ptexInitFlag;
+static std::mutex ptexFileIndicesMutex;
+static std::map<std::string, int> ptexFileIndices;
+static ThreadLocal<std::vector<PtexThreadHandles>> *ptexThreadHandles;
+
 STAT_COUNTER("Texture/Ptex lookups", nLookups);
+STAT_PERCENT("Texture/Ptex lookups using thread's handles", nHandleReuses,
+             nHandleLookups);
 STAT_COUNTER("Texture/Ptex files accessed", nFilesAccessed);
+STAT_COUNTER("Texture/Ptex file reopens", nFileReopens);
+STAT_COUNTER("Texture/Ptex peak files open", peakFilesOpen);
 STAT_COUNTER("Texture/Ptex block reads", nBlockReads);
 STAT_MEMORY_COUNTER("Memory/Ptex peak memory used", peakMemoryUsed);
 
@@ -543,15 +738,22 @@ struct : public PtexErrorHandler {
 PtexTextureBase::PtexTextureBase(const std::string &filename,
                                  ColorEncodingHandle encoding)
     : filename(filename), encoding(encoding) {
-    if (cache == nullptr) {
-        int maxFiles = 100;
-        size_t maxMem = 1ull << 32;  // 4GB
+    std::call_once(ptexInitFlag, []() {
+        int maxFiles = Options->ptexMaxFiles;
+        size_t maxMem = size_t(Options->ptexCacheMB) << 20;
         bool premultiply = true;
 
         cache = Ptex::PtexCache::create(maxFiles, maxMem, premultiply, nullptr,
                                         &errorHandler);
         // TODO? cache->setSearchPath(...);
-    }
+        ptexThreadHandles = new ThreadLocal<std::vector<PtexThreadHandles>>();
+    });
+
+    // Textures for the same file share thread handles
+    std::unique_lock<std::mutex> lock(ptexFileIndicesMutex);
+    auto iter = ptexFileIndices.insert({filename, int(ptexFileIndices.size())}).first;
+    fileIndex = iter->second;
+    lock.unlock();
 
     // Issue an error if the texture doesn't exist or has an unsupported
     // number of channels.
@@ -575,12 +777,25 @@ void PtexTextureBase::ReportStats() {
     if (!cache)
         return;
 
+    // Release the handles that threads have kept so that the cache can
+    // close their files and free their memory
+    ptexThreadHandles->ForAll([](std::vector<PtexThreadHandles> &handles) {
+        for (PtexThreadHandles &h : handles)
+            if (h.filter) {
+                h.filter->release();
+                h.texture->release();
+                h = PtexThreadHandles();
+            }
+    });
+
     Ptex::PtexCache::Stats stats;
     cache->getStats(stats);
 
     nFilesAccessed += stats.filesAccessed;
+    nFileReopens += stats.fileReopens;
+    peakFilesOpen = std::max<int64_t>(peakFilesOpen, stats.peakFilesOpen);
     nBlockReads += stats.blockReads;
-    peakMemoryUsed = std::max(peakMemoryUsed, int64_t(stats.peakMemUsed));
+    peakMemoryUsed = std::max<int64_t>(peakMemoryUsed, stats.peakMemUsed);
 }
 
 int PtexTextureBase::SampleTexture(TextureEvalContext ctx, float result[3]) const {
@@ -590,19 +805,27 @@ int PtexTextureBase::SampleTexture(TextureEvalContext ctx, float result[3]) cons
     }
 
     ++nLookups;
-    Ptex::String error;
-    Ptex::PtexTexture *texture = cache->get(filename.c_str(), error);
-    CHECK(texture != nullptr);
-    // TODO: make the filter an option?
-    Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
-    Ptex::PtexFilter *filter = Ptex::PtexFilter::getFilter(texture, opts);
-    int nc = texture->numChannels();
+    // Get the thread's texture and filter for the file, creating them if needed
+    std::vector<PtexThreadHandles> &handles = ptexThreadHandles->Get();
+    if (size_t(fileIndex) >= handles.size())
+        handles.resize(fileIndex + 1);
+    PtexThreadHandles &h = handles[fileIndex];
+    ++nHandleLookups;
+    if (h.filter)
+        ++nHandleReuses;
+    else {
+        Ptex::String error;
+        h.texture = cache->get(filename.c_str(), error);
+        CHECK(h.texture != nullptr);
+        // TODO: make the filter an option?
+        Ptex::PtexFilter::Options opts(Ptex::PtexFilter::FilterType::f_bspline);
+        h.filter = Ptex::PtexFilter::getFilter(h.texture, opts);
+    }
+    int nc = h.texture->numChannels();
 
     int firstChan = 0;
-    filter->eval(result, firstChan, nc, ctx.faceIndex, ctx.uv[0], ctx.uv[1], ctx.dudx,
-                 ctx.dvdx, ctx.dudy, ctx.dvdy);
-    filter->release();
-    texture->release();
+    h.filter->eval(result, firstChan, nc, ctx.faceIndex, ctx.uv[0], ctx.uv[1], ctx.dudx,
+                   ctx.dvdx, ctx.dudy, ctx.dvdy);
 
     if (encoding != ColorEncodingHandle::Linear) {
         // It feels a little dirty to convert to 8-bits to run through the
@@ -802,52 +1025,252 @@ WrinkledTexture *WrinkledTexture::Create(const Transform &renderFromTexture,
 
 #if defined(PBRT_BUILD_GPU_RENDERER)
 
+// GPUTextureArray Definition
+// The texels of a GPU image texture are stored in a CUDA array, or in a CUDA
+// mipmapped array if the texture is filtered using its MIP map.
+struct GPUTextureArray {
+    cudaArray_t array = nullptr;
+    cudaMipmappedArray_t mipmap = nullptr;
+    cudaTextureReadMode readMode = cudaReadModeElementType;
+    // Set if the texels are 8-bit sRGB-encoded values, which the texture
+    // hardware converts to linear values when they are read.
+    bool sRGB = false;
+};
+
 struct LuminanceTextureCacheItem {
-    cudaArray_t array;
-    cudaTextureReadMode readMode;
+    GPUTextureArray texArray;
     bool originallySingleChannel;
 };
 struct RGBTextureCacheItem {
-    cudaArray_t array;
-    cudaTextureReadMode readMode;
+    GPUTextureArray texArray;
     const RGBColorSpace *colorSpace;
 };
 
 static std::mutex textureCacheMutex;
+// The caches are indexed by filename, with a suffix for mipmapped arrays.
 static std::map<std::string, LuminanceTextureCacheItem> lumTextureCache;
 static std::map<std::string, RGBTextureCacheItem> rgbTextureCache;
 
 STAT_MEMORY_COUNTER("Memory/ImageTextures", gpuImageTextureBytes);
+STAT_COUNTER("Scene/Block-compressed GPU textures", nBlockCompressedTextures);
+STAT_COUNTER("Scene/MIP mapped GPU textures", nMIPMappedTextures);
+
+// With --gpu-compress-textures, textures are stored block-compressed unless
+// the RMS error of the compressed texels' values exceeds this.
+static constexpr Float MaxBlockCompressionError = 0.02f;
+
+// Returns a CUDA array holding the texels of _image_, which must have either
+// a single channel or three 8-bit channels, compressed with BC4 or BC1,
+// respectively. Returns nullptr if --gpu-compress-textures wasn't given or
+// the image can't be compressed accurately enough.
+static cudaArray_t createBlockCompressedTextureArray(const Image &image,
+                                                     const std::string &filename) {
+    Point2i res = image.Resolution();
+    if (!Options->gpuCompressTextures || res.x % BCBlockTexels != 0 ||
+        res.y % BCBlockTexels != 0)
+        return nullptr;
+#if CUDART_VERSION >= 11050
+    Float rmsError;
+    std::vector<uint8_t> blocks;
+    cudaChannelFormatDesc channelDesc;
+    if (image.NChannels() == 1) {
+        blocks = CompressBC4(image, 0, &rmsError);
+        channelDesc =
+            cudaCreateChannelDesc<cudaChannelFormatKindUnsignedBlockCompressed4>();
+    } else {
+        CHECK(Is8Bit(image.Format()) && image.NChannels() == 3);
+        blocks = CompressBC1(image, &rmsError);
+        // Use the sRGB format for sRGB-encoded texels so that reads return
+        // linear values
+        channelDesc =
+            image.Encoding().Is<sRGBColorEncoding>()
+                ? cudaCreateChannelDesc<
+                      cudaChannelFormatKindUnsignedBlockCompressed1SRGB>()
+                : cudaCreateChannelDesc<cudaChannelFormatKindUnsignedBlockCompressed1>();
+    }
+    if (rmsError > MaxBlockCompressionError) {
+        LOG_VERBOSE("%s: RMS error %f is too high to block compress texture", filename,
+                    rmsError);
+        return nullptr;
+    }
 
-static cudaArray_t createSingleChannelTextureArray(const Image &image) {
-    CHECK_EQ(1, image.NChannels());
     cudaArray_t texArray;
+    CUDA_CHECK(cudaMallocArray(&texArray, &channelDesc, res.x, res.y));
+    // Block-compressed data is copied in rows of blocks
+    int pitch = (res.x / BCBlockTexels) * BCBlockBytes;
+    CUDA_CHECK(cudaMemcpy2DToArray(texArray, /* offset */ 0, 0, blocks.data(), pitch,
+                                   pitch, res.y / BCBlockTexels,
+                                   cudaMemcpyHostToDevice));
+    gpuImageTextureBytes += blocks.size();
+    ++nBlockCompressedTextures;
+    LOG_VERBOSE("%s: block compressed texture with RMS error %f", filename, rmsError);
+    return texArray;
+#else
+    static std::once_flag warned;
+    std::call_once(warned, []() {
+        Warning("--gpu-compress-textures requires CUDA 11.5 or later; ignoring it.");
+    });
+    return nullptr;
+#endif
+}
+
+// GPUTextureFilter Definition
+// GPU image textures support the same filters as the CPU ones: "point" and
+// "bilinear" filter the full-resolution image, while "trilinear" and "ewa"
+// use the texture hardware's MIP map filtering, which is anisotropic for
+// "ewa".
+struct GPUTextureFilter {
+    bool mipmap = false;
+    cudaTextureFilterMode filterMode = cudaFilterModeLinear;
+    int maxAnisotropy = 1;
+};
+
+static GPUTextureFilter getTextureFilter(const TextureParameterDictionary &parameters,
+                                         const FileLoc *loc) {
+    std::string filter = parameters.GetOneString("filter", "bilinear");
+    pstd::optional<FilterFunction> ff = ParseFilter(filter);
+    if (!ff) {
+        Error(loc, "%s: filter function unknown", filter);
+        ff = FilterFunction::Bilinear;
+    }
+
+    GPUTextureFilter textureFilter;
+    switch (*ff) {
+    case FilterFunction::Point:
+        textureFilter.filterMode = cudaFilterModePoint;
+        break;
+    case FilterFunction::Bilinear:
+        break;
+    case FilterFunction::Trilinear:
+        textureFilter.mipmap = true;
+        break;
+    case FilterFunction::EWA:
+        textureFilter.mipmap = true;
+        // The texture hardware supports a maximum anisotropy of 16.
+        textureFilter.maxAnisotropy =
+            Clamp(int(parameters.GetOneFloat("maxanisotropy", 8.f)), 1, 16);
+        break;
+    }
+    return textureFilter;
+}
+
+// With --gpu-compact-textures, 32-bit float images are stored using less
+// memory: RGB images with all values in [0,1] as 8-bit sRGB-encoded texels
+// and the rest as half floats.
+static Image compactTextureImage(Image image) {
+    if (!Options->gpuCompactTextures || image.Format() != PixelFormat::Float)
+        return image;
+
+    auto inUnitRange = [&]() {
+        for (int y = 0; y < image.Resolution().y; ++y)
+            for (int x = 0; x < image.Resolution().x; ++x)
+                for (int c = 0; c < image.NChannels(); ++c)
+                    if (Float v = image.GetChannel({x, y}, c); v < 0 || v > 1)
+                        return false;
+        return true;
+    };
+    if (image.NChannels() == 3 && inUnitRange())
+        return image.ConvertToFormat(PixelFormat::U256, ColorEncodingHandle::sRGB);
+    return image.ConvertToFormat(PixelFormat::Half);
+}
+
+static cudaChannelFormatDesc textureChannelDesc(PixelFormat format, int nChannels) {
+    int bits = Is8Bit(format) ? 8 : (Is16Bit(format) ? 16 : 32);
+    cudaChannelFormatKind kind =
+        Is8Bit(format) ? cudaChannelFormatKindUnsigned : cudaChannelFormatKindFloat;
+    if (nChannels == 1)
+        return cudaCreateChannelDesc(bits, 0, 0, 0, kind);
+    return cudaCreateChannelDesc(bits, bits, bits, bits, kind);
+}
+
+// Copies the texels of _image_, which must have one or three channels, to
+// _array_. Three-channel images are stored with a fourth channel set to one,
+// since CUDA arrays don't support three channels.
+static void copyToTextureArray(const Image &image, cudaArray_t array) {
+    Point2i res = image.Resolution();
+    auto copy = [&](auto *texels, auto one) {
+        using T = std::remove_const_t<std::remove_pointer_t<decltype(texels)>>;
+        std::vector<T> rgba;
+        if (image.NChannels() == 3) {
+            rgba.resize(4 * size_t(res.x) * res.y);
+            for (size_t i = 0; i < size_t(res.x) * res.y; ++i) {
+                for (int c = 0; c < 3; ++c)
+                    rgba[4 * i + c] = texels[3 * i + c];
+                rgba[4 * i + 3] = one;
+            }
+            texels = rgba.data();
+        }
+
+        int pitch = res.x * (image.NChannels() == 3 ? 4 : 1) * sizeof(T);
+        gpuImageTextureBytes += pitch * res.y;
+        CUDA_CHECK(cudaMemcpy2DToArray(array, /* offset */ 0, 0, texels, pitch, pitch,
+                                       res.y, cudaMemcpyHostToDevice));
+    };
 
-    cudaChannelFormatDesc channelDesc;
-    int pitch;
     switch (image.Format()) {
     case PixelFormat::U256:
-        channelDesc = cudaCreateChannelDesc(8, 0, 0, 0, cudaChannelFormatKindUnsigned);
-        pitch = image.Resolution().x * sizeof(uint8_t);
+        copy((const uint8_t *)image.RawPointer({0, 0}), uint8_t(255));
         break;
     case PixelFormat::Half:
-        channelDesc = cudaCreateChannelDesc(16, 0, 0, 0, cudaChannelFormatKindFloat);
-        pitch = image.Resolution().x * sizeof(Half);
+        copy((const Half *)image.RawPointer({0, 0}), Half(1.f));
         break;
     case PixelFormat::Float:
-        channelDesc = cudaCreateChannelDesc(32, 0, 0, 0, cudaChannelFormatKindFloat);
-        pitch = image.Resolution().x * sizeof(float);
+        copy((const float *)image.RawPointer({0, 0}), 1.f);
         break;
+    default:
+        LOG_FATAL("Unexpected PixelFormat");
     }
-    gpuImageTextureBytes += pitch * image.Resolution().y;
+}
 
-    CUDA_CHECK(cudaMallocArray(&texArray, &channelDesc, image.Resolution().x,
-                               image.Resolution().y));
+// Returns a GPUTextureArray holding the texels of _image_, which must have
+// one or three channels, along with its MIP map if _mipmap_ is true.
+static GPUTextureArray createTextureArray(Image image, const std::string &filename,
+                                          bool mipmap, WrapMode2D wrapMode) {
+    GPUTextureArray texArray;
+    // The texture array's format determines whether sRGB texels are decoded,
+    // so the sRGB read flag isn't set for block-compressed textures. They
+    // aren't MIP mapped, since the coarser levels' resolutions generally
+    // aren't multiples of the block size.
+    if (!mipmap && (image.NChannels() == 1 || Is8Bit(image.Format()))) {
+        texArray.array = createBlockCompressedTextureArray(image, filename);
+        if (texArray.array) {
+            texArray.readMode = cudaReadModeNormalizedFloat;
+            return texArray;
+        }
+    }
 
-    CUDA_CHECK(cudaMemcpy2DToArray(texArray, /* offset */ 0, 0, image.RawPointer({0, 0}),
-                                   pitch, pitch, image.Resolution().y,
-                                   cudaMemcpyHostToDevice));
+    // The texture hardware can only decode 8-bit texels with linear or sRGB
+    // encodings; others are converted to linear half floats.
+    image = compactTextureImage(std::move(image));
+    ColorEncodingHandle encoding = image.Encoding();
+    if (Is8Bit(image.Format()) && !encoding.Is<sRGBColorEncoding>() &&
+        !encoding.Is<LinearColorEncoding>())
+        image = image.ConvertToFormat(PixelFormat::Half);
+    texArray.readMode = Is8Bit(image.Format()) ? cudaReadModeNormalizedFloat
+                                               : cudaReadModeElementType;
+    texArray.sRGB = Is8Bit(image.Format()) && encoding.Is<sRGBColorEncoding>();
+
+    cudaChannelFormatDesc channelDesc =
+        textureChannelDesc(image.Format(), image.NChannels());
+    if (!mipmap) {
+        CUDA_CHECK(cudaMallocArray(&texArray.array, &channelDesc, image.Resolution().x,
+                                   image.Resolution().y));
+        copyToTextureArray(image, texArray.array);
+        return texArray;
+    }
 
+    // Allocate the mipmapped array and copy each level of the pyramid to it
+    pstd::vector<Image> pyramid = Image::GeneratePyramid(std::move(image), wrapMode);
+    Point2i res = pyramid[0].Resolution();
+    CUDA_CHECK(cudaMallocMipmappedArray(&texArray.mipmap, &channelDesc,
+                                        make_cudaExtent(res.x, res.y, 0),
+                                        pyramid.size()));
+    for (size_t level = 0; level < pyramid.size(); ++level) {
+        cudaArray_t levelArray;
+        CUDA_CHECK(cudaGetMipmappedArrayLevel(&levelArray, texArray.mipmap, level));
+        copyToTextureArray(pyramid[level], levelArray);
+    }
+    ++nMIPMappedTextures;
     return texArray;
 }
 
@@ -862,191 +1285,106 @@ static cudaTextureAddressMode convertAddressMode(const std::string &mode) {
         ErrorExit("%s: texture wrap mode not supported", mode);
 }
 
+static cudaTextureObject_t createTextureObject(const GPUTextureArray &texArray,
+                                               const std::string &wrap,
+                                               const GPUTextureFilter &filter) {
+    cudaResourceDesc resDesc = {};
+    if (texArray.mipmap) {
+        resDesc.resType = cudaResourceTypeMipmappedArray;
+        resDesc.res.mipmap.mipmap = texArray.mipmap;
+    } else {
+        resDesc.resType = cudaResourceTypeArray;
+        resDesc.res.array.array = texArray.array;
+    }
+
+    cudaTextureDesc texDesc = {};
+    texDesc.addressMode[0] = convertAddressMode(wrap);
+    texDesc.addressMode[1] = convertAddressMode(wrap);
+    texDesc.filterMode = filter.filterMode;
+    texDesc.readMode = texArray.readMode;
+    texDesc.normalizedCoords = 1;
+    texDesc.maxAnisotropy = filter.maxAnisotropy;
+    texDesc.maxMipmapLevelClamp = 99;
+    texDesc.minMipmapLevelClamp = 0;
+    texDesc.mipmapFilterMode = cudaFilterModeLinear;
+    texDesc.borderColor[0] = texDesc.borderColor[1] = texDesc.borderColor[2] =
+        texDesc.borderColor[3] = 0.f;
+    texDesc.sRGB = texArray.sRGB;
+
+    cudaTextureObject_t texObj;
+    CUDA_CHECK(cudaCreateTextureObject(&texObj, &resDesc, &texDesc, nullptr));
+    return texObj;
+}
+
+// Returns the wrap mode used to generate a texture's MIP map.
+static WrapMode2D textureWrapMode(const std::string &wrap) {
+    pstd::optional<WrapMode> wrapMode = ParseWrapMode(wrap.c_str());
+    if (!wrapMode)
+        ErrorExit("%s: wrap mode unknown", wrap);
+    return *wrapMode;
+}
+
 GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
     const Transform &renderFromTexture, const TextureParameterDictionary &parameters,
     SpectrumType spectrumType, const FileLoc *loc, Allocator alloc) {
-    /*
-      Float maxAniso = parameters.GetOneFloat("maxanisotropy", 8.f);
-      std::string filter = parameters.GetOneString("filter", "bilinear");
-      const char *defaultEncoding = HasExtension(filename, "png") ? "sRGB" :
-      "linear"; std::string encodingString = parameters.GetOneString("encoding",
-      defaultEncoding); const ColorEncoding *encoding =
-      ColorEncodingHandle::Get(encodingString, alloc);
-    */
-
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+    std::string wrap = parameters.GetOneString("wrap", "repeat");
+    GPUTextureFilter filter = getTextureFilter(parameters, loc);
+    std::string cacheKey = filter.mipmap ? filename + " (MIP map)" : filename;
 
     // These have to be initialized one way or another in the below
-    cudaArray_t texArray;
-    cudaTextureReadMode readMode;
+    GPUTextureArray texArray;
     const RGBColorSpace *colorSpace = nullptr;
     bool isSingleChannel = false;
 
     textureCacheMutex.lock();
-    auto rgbIter = rgbTextureCache.find(filename);
+    auto rgbIter = rgbTextureCache.find(cacheKey);
     if (rgbIter != rgbTextureCache.end()) {
-        LOG_VERBOSE("Found %s in RGB tex array cache!", filename);
-        texArray = rgbIter->second.array;
-        readMode = rgbIter->second.readMode;
+        LOG_VERBOSE("Found %s in RGB tex array cache!", cacheKey);
+        texArray = rgbIter->second.texArray;
         colorSpace = rgbIter->second.colorSpace;
         textureCacheMutex.unlock();
     } else {
-        auto lumIter = lumTextureCache.find(filename);
+        auto lumIter = lumTextureCache.find(cacheKey);
         // We don't want to take it if it was originally an RGB texture and
         // GPUFloatImageTexture converted it to single channel
         if (lumIter != lumTextureCache.end() && lumIter->second.originallySingleChannel) {
-            LOG_VERBOSE("Found %s in luminance tex array cache!", filename);
-            texArray = lumIter->second.array;
-            readMode = lumIter->second.readMode;
+            LOG_VERBOSE("Found %s in luminance tex array cache!", cacheKey);
+            texArray = lumIter->second.texArray;
             colorSpace = RGBColorSpace::sRGB;
             textureCacheMutex.unlock();
             isSingleChannel = true;
         } else {
             textureCacheMutex.unlock();
 
-            {
-                ImageAndMetadata immeta = Image::Read(filename);
-                Image &image = immeta.image;
-
-                readMode = image.Format() == PixelFormat::U256
-                               ? cudaReadModeNormalizedFloat
-                               : cudaReadModeElementType;
-                colorSpace = immeta.metadata.GetColorSpace();
-
-                ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
-                if (rgbDesc) {
-                    image = image.SelectChannels(rgbDesc);
-
-                    switch (image.Format()) {
-                    case PixelFormat::U256: {
-                        std::vector<uint8_t> rgba(4 * image.Resolution().x *
-                                                  image.Resolution().y);
-                        size_t offset = 0;
-                        for (int y = 0; y < image.Resolution().y; ++y)
-                            for (int x = 0; x < image.Resolution().x; ++x) {
-                                for (int c = 0; c < 3; ++c)
-                                    rgba[offset++] =
-                                        ((uint8_t *)image.RawPointer({x, y}))[c];
-                                rgba[offset++] = 255;
-                            }
-
-                        cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
-                            8, 8, 8, 8, cudaChannelFormatKindUnsigned);
-
-                        CUDA_CHECK(cudaMallocArray(&texArray, &channelDesc,
-                                                   image.Resolution().x,
-                                                   image.Resolution().y));
-
-                        int pitch = image.Resolution().x * 4 * sizeof(uint8_t);
-                        gpuImageTextureBytes += pitch * image.Resolution().y;
-
-                        CUDA_CHECK(cudaMemcpy2DToArray(texArray,
-                                                       /* offset */ 0, 0, rgba.data(),
-                                                       pitch, pitch, image.Resolution().y,
-                                                       cudaMemcpyHostToDevice));
-                        break;
-                    }
-                    case PixelFormat::Half: {
-                        std::vector<Half> rgba(4 * image.Resolution().x *
-                                               image.Resolution().y);
-
-                        size_t offset = 0;
-                        for (int y = 0; y < image.Resolution().y; ++y)
-                            for (int x = 0; x < image.Resolution().x; ++x) {
-                                for (int c = 0; c < 3; ++c)
-                                    rgba[offset++] = Half(image.GetChannel({x, y}, c));
-                                rgba[offset++] = Half(1.f);
-                            }
-
-                        cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
-                            16, 16, 16, 16, cudaChannelFormatKindFloat);
-
-                        CUDA_CHECK(cudaMallocArray(&texArray, &channelDesc,
-                                                   image.Resolution().x,
-                                                   image.Resolution().y));
-
-                        int pitch = image.Resolution().x * 4 * sizeof(Half);
-                        gpuImageTextureBytes += pitch * image.Resolution().y;
-
-                        CUDA_CHECK(cudaMemcpy2DToArray(texArray,
-                                                       /* offset */ 0, 0, rgba.data(),
-                                                       pitch, pitch, image.Resolution().y,
-                                                       cudaMemcpyHostToDevice));
-                        break;
-                    }
-                    case PixelFormat::Float: {
-                        std::vector<float> rgba(4 * image.Resolution().x *
-                                                image.Resolution().y);
-
-                        size_t offset = 0;
-                        for (int y = 0; y < image.Resolution().y; ++y)
-                            for (int x = 0; x < image.Resolution().x; ++x) {
-                                for (int c = 0; c < 3; ++c)
-                                    rgba[offset++] = image.GetChannel({x, y}, c);
-                                rgba[offset++] = 1.f;
-                            }
-
-                        cudaChannelFormatDesc channelDesc = cudaCreateChannelDesc(
-                            32, 32, 32, 32, cudaChannelFormatKindFloat);
-
-                        CUDA_CHECK(cudaMallocArray(&texArray, &channelDesc,
-                                                   image.Resolution().x,
-                                                   image.Resolution().y));
-
-                        int pitch = image.Resolution().x * 4 * sizeof(float);
-                        gpuImageTextureBytes += pitch * image.Resolution().y;
-
-                        CUDA_CHECK(cudaMemcpy2DToArray(texArray,
-                                                       /* offset */ 0, 0, rgba.data(),
-                                                       pitch, pitch, image.Resolution().y,
-                                                       cudaMemcpyHostToDevice));
-                        break;
-                    }
-                    default:
-                        LOG_FATAL("Unexpected PixelFormat");
-                    }
-
-                    textureCacheMutex.lock();
-                    rgbTextureCache[filename] =
-                        RGBTextureCacheItem{texArray, readMode, colorSpace};
-                    textureCacheMutex.unlock();
-                } else if (image.NChannels() == 1) {
-                    texArray = createSingleChannelTextureArray(image);
-
-                    textureCacheMutex.lock();
-                    lumTextureCache[filename] =
-                        LuminanceTextureCacheItem{texArray, readMode, true};
-                    textureCacheMutex.unlock();
-                    isSingleChannel = true;
-                } else {
-                    Warning(loc, "%s: unable to decypher image format", filename);
-                    return nullptr;
-                }
-            }  // profile scope
+            ImageAndMetadata immeta = Image::Read(filename);
+            Image &image = immeta.image;
+            colorSpace = immeta.metadata.GetColorSpace();
+
+            ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
+            if (rgbDesc) {
+                texArray = createTextureArray(image.SelectChannels(rgbDesc), filename,
+                                              filter.mipmap, textureWrapMode(wrap));
+
+                textureCacheMutex.lock();
+                rgbTextureCache[cacheKey] = RGBTextureCacheItem{texArray, colorSpace};
+                textureCacheMutex.unlock();
+            } else if (image.NChannels() == 1) {
+                texArray = createTextureArray(std::move(image), filename, filter.mipmap,
+                                              textureWrapMode(wrap));
+
+                textureCacheMutex.lock();
+                lumTextureCache[cacheKey] = LuminanceTextureCacheItem{texArray, true};
+                textureCacheMutex.unlock();
+                isSingleChannel = true;
+            } else {
+                Warning(loc, "%s: unable to decypher image format", filename);
+                return nullptr;
+            }
         }
     }
 
-    cudaResourceDesc resDesc = {};
-    resDesc.resType = cudaResourceTypeArray;
-    resDesc.res.array.array = texArray;
-
-    std::string wrap = parameters.GetOneString("wrap", "repeat");
-    cudaTextureDesc texDesc = {};
-    texDesc.addressMode[0] = convertAddressMode(wrap);
-    texDesc.addressMode[1] = convertAddressMode(wrap);
-    texDesc.filterMode = cudaFilterModeLinear;
-    texDesc.readMode = readMode;
-    texDesc.normalizedCoords = 1;
-    texDesc.maxAnisotropy = 1;
-    texDesc.maxMipmapLevelClamp = 99;
-    texDesc.minMipmapLevelClamp = 0;
-    texDesc.mipmapFilterMode = cudaFilterModePoint;
-    texDesc.borderColor[0] = texDesc.borderColor[1] = texDesc.borderColor[2] =
-        texDesc.borderColor[3] = 0.f;
-    texDesc.sRGB = 1;
-
-    cudaTextureObject_t texObj;
-    CUDA_CHECK(cudaCreateTextureObject(&texObj, &resDesc, &texDesc, nullptr));
+    cudaTextureObject_t texObj = createTextureObject(texArray, wrap, filter);
 
     TextureMapping2DHandle mapping =
         TextureMapping2DHandle::Create(parameters, renderFromTexture, loc, alloc);
@@ -1054,101 +1392,80 @@ GPUSpectrumImageTexture *GPUSpectrumImageTexture::Create(
     Float scale = parameters.GetOneFloat("scale", 1.f);
     bool invert = parameters.GetOneBool("invert", false);
 
-    return alloc.new_object<GPUSpectrumImageTexture>(
-        mapping, texObj, scale, invert, isSingleChannel, colorSpace, spectrumType);
+    return alloc.new_object<GPUSpectrumImageTexture>(mapping, texObj, filter.mipmap,
+                                                     scale, invert, isSingleChannel,
+                                                     colorSpace, spectrumType);
+}
+
+// Reads the image for a _GPUFloatImageTexture_, reducing it to the single
+// channel that the texture's values come from.
+static Image readLuminanceImage(const std::string &filename, const FileLoc *loc,
+                                bool *convertedImage) {
+    ImageAndMetadata immeta = Image::Read(filename);
+    Image &image = immeta.image;
+    *convertedImage = false;
+    if (image.NChannels() != 1) {
+        ImageChannelDesc rgbaDesc = image.GetChannelDesc({"R", "G", "B", "A"});
+        ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
+        auto allOnes = [&]() {
+            for (int y = 0; y < image.Resolution().y; ++y)
+                for (int x = 0; x < image.Resolution().x; ++x)
+                    if (image.GetChannels({x, y}, rgbaDesc)[3] != 1)
+                        return false;
+            return true;
+        };
+        if (rgbaDesc && !allOnes()) {
+            ImageChannelDesc alphaDesc = image.GetChannelDesc({"A"});
+            image = image.SelectChannels(alphaDesc);
+            *convertedImage = true;
+        } else if (rgbDesc) {
+            // Convert to one channel
+            Image avgImage(image.Format(), image.Resolution(), {"Y"}, image.Encoding());
+
+            for (int y = 0; y < image.Resolution().y; ++y)
+                for (int x = 0; x < image.Resolution().x; ++x)
+                    avgImage.SetChannel({x, y}, 0,
+                                        image.GetChannels({x, y}, rgbDesc).Average());
+
+            image = std::move(avgImage);
+            *convertedImage = true;
+        } else
+            ErrorExit(loc, "%s: %d channel image, without RGB channels.", filename,
+                      image.NChannels());
+    }
+    return std::move(image);
 }
 
 GPUFloatImageTexture *GPUFloatImageTexture::Create(
     const Transform &renderFromTexture, const TextureParameterDictionary &parameters,
     const FileLoc *loc, Allocator alloc) {
-    /*
-      Float maxAniso = parameters.GetOneFloat("maxanisotropy", 8.f);
-      std::string filter = parameters.GetOneString("filter", "bilinear");
-      const char *defaultEncoding = HasExtension(filename, "png") ? "sRGB" :
-      "linear"; std::string encodingString = parameters.GetOneString("encoding",
-      defaultEncoding); const ColorEncoding *encoding =
-      ColorEncodingHandle::Get(encodingString, alloc);
-    */
     std::string filename = ResolveFilename(parameters.GetOneString("filename", ""));
+    std::string wrap = parameters.GetOneString("wrap", "repeat");
+    GPUTextureFilter filter = getTextureFilter(parameters, loc);
+    std::string cacheKey = filter.mipmap ? filename + " (MIP map)" : filename;
 
-    cudaArray_t texArray;
-    cudaTextureReadMode readMode;
+    GPUTextureArray texArray;
 
     textureCacheMutex.lock();
-    auto iter = lumTextureCache.find(filename);
+    auto iter = lumTextureCache.find(cacheKey);
     if (iter != lumTextureCache.end()) {
-        LOG_VERBOSE("Found %s in luminance tex array cache!", filename);
-        texArray = iter->second.array;
-        readMode = iter->second.readMode;
+        LOG_VERBOSE("Found %s in luminance tex array cache!", cacheKey);
+        texArray = iter->second.texArray;
         textureCacheMutex.unlock();
     } else {
         textureCacheMutex.unlock();
 
-        ImageAndMetadata immeta = Image::Read(filename);
-        Image &image = immeta.image;
         bool convertedImage = false;
-        if (image.NChannels() != 1) {
-            ImageChannelDesc rgbaDesc = image.GetChannelDesc({"R", "G", "B", "A"});
-            ImageChannelDesc rgbDesc = image.GetChannelDesc({"R", "G", "B"});
-            auto allOnes = [&]() {
-                for (int y = 0; y < image.Resolution().y; ++y)
-                    for (int x = 0; x < image.Resolution().x; ++x)
-                        if (image.GetChannels({x, y}, rgbaDesc)[3] != 1)
-                            return false;
-                return true;
-            };
-            if (rgbaDesc && !allOnes()) {
-                ImageChannelDesc alphaDesc = image.GetChannelDesc({"A"});
-                image = image.SelectChannels(alphaDesc);
-                convertedImage = true;
-            } else if (rgbDesc) {
-                // Convert to one channel
-                Image avgImage(image.Format(), image.Resolution(), {"Y"},
-                               image.Encoding());
-
-                for (int y = 0; y < image.Resolution().y; ++y)
-                    for (int x = 0; x < image.Resolution().x; ++x)
-                        avgImage.SetChannel({x, y}, 0,
-                                            image.GetChannels({x, y}, rgbDesc).Average());
-
-                image = std::move(avgImage);
-                convertedImage = true;
-            } else
-                ErrorExit(loc, "%s: %d channel image, without RGB channels.", filename,
-                          image.NChannels());
-        }
-
-        texArray = createSingleChannelTextureArray(image);
-        readMode = (image.Format() == PixelFormat::U256) ? cudaReadModeNormalizedFloat
-                                                         : cudaReadModeElementType;
+        Image image = readLuminanceImage(filename, loc, &convertedImage);
+        texArray = createTextureArray(std::move(image), filename, filter.mipmap,
+                                      textureWrapMode(wrap));
 
         textureCacheMutex.lock();
-        lumTextureCache[filename] =
-            LuminanceTextureCacheItem{texArray, readMode, !convertedImage};
+        lumTextureCache[cacheKey] = LuminanceTextureCacheItem{texArray, !convertedImage};
         textureCacheMutex.unlock();
     }
 
-    cudaResourceDesc resDesc = {};
-    resDesc.resType = cudaResourceTypeArray;
-    resDesc.res.array.array = texArray;
-
-    std::string wrap = parameters.GetOneString("wrap", "repeat");
-    cudaTextureDesc texDesc = {};
-    texDesc.addressMode[0] = convertAddressMode(wrap);
-    texDesc.addressMode[1] = convertAddressMode(wrap);
-    texDesc.filterMode = cudaFilterModeLinear;
-    texDesc.readMode = readMode;
-    texDesc.normalizedCoords = 1;
-    texDesc.maxAnisotropy = 1;
-    texDesc.maxMipmapLevelClamp = 99;
-    texDesc.minMipmapLevelClamp = 0;
-    texDesc.mipmapFilterMode = cudaFilterModePoint;
-    texDesc.borderColor[0] = texDesc.borderColor[1] = texDesc.borderColor[2] =
-        texDesc.borderColor[3] = 0.f;
-    texDesc.sRGB = 1;
-
-    cudaTextureObject_t texObj;
-    CUDA_CHECK(cudaCreateTextureObject(&texObj, &resDesc, &texDesc, nullptr));
+    cudaTextureObject_t texObj = createTextureObject(texArray, wrap, filter);
 
     TextureMapping2DHandle mapping =
         TextureMapping2DHandle::Create(parameters, renderFromTexture, loc, alloc);
@@ -1156,7 +1473,31 @@ GPUFloatImageTexture *GPUFloatImageTexture::Create(
     Float scale = parameters.GetOneFloat("scale", 1.f);
     bool invert = parameters.GetOneBool("invert", false);
 
-    return alloc.new_object<GPUFloatImageTexture>(mapping, texObj, scale, invert);
+    WrapMode wrapMode = ParseWrapMode(wrap.c_str()).value_or(WrapMode::Repeat);
+    return alloc.new_object<GPUFloatImageTexture>(mapping, texObj, filter.mipmap, scale,
+                                                  invert, filename, wrapMode);
+}
+
+pstd::optional<Interval> GPUFloatImageTexture::EvaluateRange(
+    const pstd::array<Point2f, 3> &uv) const {
+    // CPU-side MIP maps of images read for bounding GPU textures' values
+    static std::mutex mipmapsMutex;
+    static std::map<std::pair<std::string, WrapMode>, MIPMap *> mipmaps;
+
+    MIPMap *mipmap;
+    {
+        std::lock_guard<std::mutex> lock(mipmapsMutex);
+        MIPMap *&entry = mipmaps[std::make_pair(filename, wrapMode)];
+        if (!entry) {
+            bool converted;
+            MIPMapFilterOptions options;
+            options.filter = FilterFunction::Bilinear;
+            entry = new MIPMap(readLuminanceImage(filename, nullptr, &converted),
+                               RGBColorSpace::sRGB, wrapMode, Allocator(), options);
+        }
+        mipmap = entry;
+    }
+    return MappedImageRange(mipmap, mapping, scale, invert, uv);
 }
 
 #endif  // PBRT_BUILD_GPU_RENDERER
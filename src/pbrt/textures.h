@@ -18,10 +18,12 @@
 #include <pbrt/util/transform.h>
 #include <pbrt/util/vecmath.h>
 
+#include <atomic>
 #include <initializer_list>
 #include <map>
 #include <mutex>
 #include <string>
+#include <type_traits>
 
 namespace pbrt {
 
@@ -61,6 +63,13 @@ struct TextureEvalContext {
     int faceIndex = 0;
 };
 
+// FloatTextureRange() returns bounds on the values of _tex_ at zero-width
+// lookups with $(u,v)$ inside the given triangle, as are made when alpha
+// textures are evaluated at ray intersections. An unset optional is
+// returned for textures whose values can't be bounded.
+pstd::optional<Interval> FloatTextureRange(FloatTextureHandle tex,
+                                           const pstd::array<Point2f, 3> &uv);
+
 // UVMapping2D Definition
 class UVMapping2D {
   public:
@@ -520,49 +529,64 @@ struct TexInfo {
     ColorEncodingHandle encoding;
 };
 
+struct SharedTextureImage;
+
+// LazyMIPMap Definition
+// Reads an image texture's file and creates its _MIPMap_ the first time the
+// texture is evaluated, so that images that are never sampled aren't loaded.
+// The decoded image is shared with the other _LazyMIPMap_s for the same file.
+class LazyMIPMap {
+  public:
+    // LazyMIPMap Public Methods
+    LazyMIPMap(TexInfo texInfo, SharedTextureImage *sharedImage, Allocator alloc);
+
+    MIPMap *Get() {
+        if (MIPMap *m = mipmap.load(std::memory_order_acquire); m != nullptr)
+            return m;
+        return Load();
+    }
+    bool IsLoaded() const { return mipmap.load(std::memory_order_acquire) != nullptr; }
+
+    std::string ToString() const;
+
+  private:
+    MIPMap *Load();
+
+    // LazyMIPMap Private Members
+    TexInfo texInfo;
+    SharedTextureImage *sharedImage;
+    Allocator alloc;
+    std::once_flag loadFlag;
+    std::atomic<MIPMap *> mipmap{nullptr};
+};
+
 // ImageTextureBase Definition
 class ImageTextureBase {
   public:
     // ImageTextureBase Public Methods
     ImageTextureBase(TextureMapping2DHandle mapping, std::string filename,
                      MIPMapFilterOptions filterOptions, WrapMode wrapMode, Float scale,
-                     bool invert, ColorEncodingHandle encoding, Allocator alloc)
-        : mapping(mapping), scale(scale), invert(invert) {
-        // Get _MIPMap_ from texture cache if present
-        TexInfo texInfo(filename, filterOptions, wrapMode, encoding);
-        std::unique_lock<std::mutex> lock(textureCacheMutex);
-        if (auto iter = textureCache.find(texInfo); iter != textureCache.end()) {
-            mipmap = iter->second;
-            return;
-        }
-        lock.unlock();
-
-        // Create _MIPMap_ for _filename_ and add to texture cache
-        mipmap =
-            MIPMap::CreateFromFile(filename, filterOptions, wrapMode, encoding, alloc);
-        lock.lock();
-        // This is actually ok, but if it hits, it means we've wastefully
-        // loaded this texture. (Note that in that case, should just return
-        // the one that's already in there and not replace it.)
-        CHECK(textureCache.find(texInfo) == textureCache.end());
-        textureCache[texInfo] = mipmap;
-    }
+                     bool invert, ColorEncodingHandle encoding, Allocator alloc);
 
-    static void ClearCache() { textureCache.clear(); }
+    static void ClearCache();
 
     void MultiplyScale(Float s) { scale *= s; }
 
   protected:
+    // ImageTextureBase Protected Methods
+    MIPMap *GetMIPMap() const { return lazyMIPMap->Get(); }
+
     // ImageTextureBase Protected Members
     TextureMapping2DHandle mapping;
     Float scale;
     bool invert;
-    MIPMap *mipmap;
+    LazyMIPMap *lazyMIPMap;
 
   private:
     // ImageTextureBase Private Members
     static std::mutex textureCacheMutex;
-    static std::map<TexInfo, MIPMap *> textureCache;
+    static std::map<TexInfo, LazyMIPMap *> textureCache;
+    static std::map<std::string, SharedTextureImage *> imageCache;
 };
 
 // FloatImageTexture Definition
@@ -584,10 +608,11 @@ class FloatImageTexture : public ImageTextureBase {
         // Texture coordinates are (0,0) in the lower left corner, but
         // image coordinates are (0,0) in the upper left.
         st[1] = 1 - st[1];
-        Float v = scale * mipmap->Filter<Float>(st, dstdx, dstdy);
+        Float v = scale * GetMIPMap()->Filter<Float>(st, dstdx, dstdy);
         return invert ? std::max<Float>(0, 1 - v) : v;
 #endif
     }
+    pstd::optional<Interval> EvaluateRange(const pstd::array<Point2f, 3> &uv) const;
 
     static FloatImageTexture *Create(const Transform &renderFromTexture,
                                      const TextureParameterDictionary &parameters,
@@ -624,13 +649,28 @@ class SpectrumImageTexture : public ImageTextureBase {
 };
 
 #if defined(PBRT_BUILD_GPU_RENDERER) && defined(__NVCC__)
+// Looks up a GPU image texture at _st_. Mipmapped textures are filtered by
+// the texture hardware using the screen-space derivatives of _st_.
+template <typename T>
+PBRT_GPU inline T GPUTextureLookup(cudaTextureObject_t texObj, bool mipmapped,
+                                   Point2f st, Vector2f dstdx, Vector2f dstdy) {
+    // flip y coord since image has (0,0) at upper left, texture at lower
+    // left
+    if (mipmapped)
+        return tex2DGrad<T>(texObj, st[0], 1 - st[1], make_float2(dstdx[0], -dstdx[1]),
+                            make_float2(dstdy[0], -dstdy[1]));
+    return tex2D<T>(texObj, st[0], 1 - st[1]);
+}
+
 class GPUSpectrumImageTexture {
   public:
     GPUSpectrumImageTexture(TextureMapping2DHandle mapping, cudaTextureObject_t texObj,
-                            Float scale, bool invert, bool isSingleChannel,
-                            const RGBColorSpace *colorSpace, SpectrumType spectrumType)
+                            bool mipmapped, Float scale, bool invert,
+                            bool isSingleChannel, const RGBColorSpace *colorSpace,
+                            SpectrumType spectrumType)
         : mapping(mapping),
           texObj(texObj),
+          mipmapped(mipmapped),
           scale(scale),
           invert(invert),
           isSingleChannel(isSingleChannel),
@@ -643,16 +683,15 @@ class GPUSpectrumImageTexture {
         LOG_FATAL("GPUSpectrumImageTexture::Evaluate called from CPU");
         return SampledSpectrum(0);
 #else
-        // flip y coord since image has (0,0) at upper left, texture at lower
-        // left
         Vector2f dstdx, dstdy;
         Point2f st = mapping.Map(ctx, &dstdx, &dstdy);
         RGB rgb;
         if (isSingleChannel) {
-            float tex = scale * tex2D<float>(texObj, st[0], 1 - st[1]);
+            float tex =
+                scale * GPUTextureLookup<float>(texObj, mipmapped, st, dstdx, dstdy);
             rgb = RGB(tex, tex, tex);
         } else {
-            float4 tex = tex2D<float4>(texObj, st[0], 1 - st[1]);
+            float4 tex = GPUTextureLookup<float4>(texObj, mipmapped, st, dstdx, dstdy);
             rgb = scale * RGB(tex.x, tex.y, tex.z);
         }
         if (invert)
@@ -678,6 +717,7 @@ class GPUSpectrumImageTexture {
 
     TextureMapping2DHandle mapping;
     cudaTextureObject_t texObj;
+    bool mipmapped;
     Float scale;
     bool invert, isSingleChannel;
     const RGBColorSpace *colorSpace;
@@ -687,8 +727,15 @@ class GPUSpectrumImageTexture {
 class GPUFloatImageTexture {
   public:
     GPUFloatImageTexture(TextureMapping2DHandle mapping, cudaTextureObject_t texObj,
-                         Float scale, bool invert)
-        : mapping(mapping), texObj(texObj), scale(scale), invert(invert) {}
+                         bool mipmapped, Float scale, bool invert,
+                         std::string filename, WrapMode wrapMode)
+        : mapping(mapping),
+          texObj(texObj),
+          mipmapped(mipmapped),
+          scale(scale),
+          invert(invert),
+          filename(std::move(filename)),
+          wrapMode(wrapMode) {}
 
     PBRT_CPU_GPU
     Float Evaluate(TextureEvalContext ctx) const {
@@ -698,9 +745,7 @@ class GPUFloatImageTexture {
 #else
         Vector2f dstdx, dstdy;
         Point2f st = mapping.Map(ctx, &dstdx, &dstdy);
-        // flip y coord since image has (0,0) at upper left, texture at lower
-        // left
-        Float v = scale * tex2D<float>(texObj, st[0], 1 - st[1]);
+        Float v = scale * GPUTextureLookup<float>(texObj, mipmapped, st, dstdx, dstdy);
         return invert ? std::max<Float>(0, 1 - v) : v;
 #endif
     }
@@ -709,14 +754,21 @@ class GPUFloatImageTexture {
                                         const TextureParameterDictionary &parameters,
                                         const FileLoc *loc, Allocator alloc);
 
+    // Bounds the texture's values using a CPU-side copy of its image, which
+    // is only read if this is called.
+    pstd::optional<Interval> EvaluateRange(const pstd::array<Point2f, 3> &uv) const;
+
     std::string ToString() const { return "GPUFloatImageTexture"; }
 
     void MultiplyScale(Float s) { scale *= s; }
 
     TextureMapping2DHandle mapping;
     cudaTextureObject_t texObj;
+    bool mipmapped;
     Float scale;
     bool invert;
+    std::string filename;
+    WrapMode wrapMode;
 };
 
 #else  // PBRT_BUILD_GPU_RENDERER && __NVCC__
@@ -753,6 +805,10 @@ class GPUFloatImageTexture {
         return nullptr;
     }
 
+    pstd::optional<Interval> EvaluateRange(const pstd::array<Point2f, 3> &uv) const {
+        return {};
+    }
+
     std::string ToString() const { return "GPUFloatImageTexture"; }
 };
 
@@ -851,6 +907,9 @@ class PtexTextureBase {
   public:
     PtexTextureBase(const std::string &filename, ColorEncodingHandle encoding);
 
+    // Reports the Ptex cache's statistics and releases the textures and
+    // filters that threads have kept; it must be called when no lookups are
+    // in progress.
     static void ReportStats();
 
   protected:
@@ -859,6 +918,8 @@ class PtexTextureBase {
 
   private:
     bool valid;
+    // Index of the texture's file in each thread's Ptex handles
+    int fileIndex;
     std::string filename;
     ColorEncodingHandle encoding;
 };
@@ -1068,6 +1129,54 @@ class BasicTextureEvaluator {
     }
 };
 
+// ConstantTextureEvaluator Definition
+// Materials that only use constant textures can be evaluated with the
+// ConstantTextureEvaluator; their kernels then have no image lookups and
+// don't need the texture coordinates or their differentials.
+class ConstantTextureEvaluator {
+  public:
+    // ConstantTextureEvaluator Public Methods
+    PBRT_CPU_GPU
+    bool CanEvaluate(std::initializer_list<FloatTextureHandle> ftex,
+                     std::initializer_list<SpectrumTextureHandle> stex) const {
+        for (auto f : ftex)
+            if (f && !f.Is<FloatConstantTexture>())
+                return false;
+        for (auto s : stex)
+            if (s && !s.Is<SpectrumConstantTexture>())
+                return false;
+        return true;
+    }
+
+    PBRT_CPU_GPU
+    Float operator()(FloatTextureHandle tex, TextureEvalContext ctx) {
+        if (FloatConstantTexture *fcTex = tex.CastOrNullptr<FloatConstantTexture>())
+            return fcTex->Evaluate(ctx);
+        else
+            return 0.f;
+    }
+
+    PBRT_CPU_GPU
+    SampledSpectrum operator()(SpectrumTextureHandle tex, TextureEvalContext ctx,
+                               SampledWavelengths lambda) {
+        if (SpectrumConstantTexture *sc = tex.CastOrNullptr<SpectrumConstantTexture>())
+            return sc->Evaluate(ctx, lambda);
+        else
+            return SampledSpectrum(0.f);
+    }
+};
+
+// Returns a short name for a texture evaluator, for use in kernel names
+template <typename TextureEvaluator>
+inline const char *TextureEvaluatorName() {
+    if constexpr (std::is_same_v<TextureEvaluator, ConstantTextureEvaluator>)
+        return "Constant";
+    else if constexpr (std::is_same_v<TextureEvaluator, BasicTextureEvaluator>)
+        return "Basic";
+    else
+        return "Universal";
+}
+
 }  // namespace pbrt
 
 #endif  // PBRT_TEXTURES_H
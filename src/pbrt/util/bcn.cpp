@@ -0,0 +1,277 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/bcn.h>
+
+#include <pbrt/util/check.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace pbrt {
+
+// Block Compression Helper Functions
+static uint16_t PackRGB565(const Float rgb[3]) {
+    int r = Clamp(int(std::round(rgb[0] * 31 / 255)), 0, 31);
+    int g = Clamp(int(std::round(rgb[1] * 63 / 255)), 0, 63);
+    int b = Clamp(int(std::round(rgb[2] * 31 / 255)), 0, 31);
+    return (r << 11) | (g << 5) | b;
+}
+
+static void UnpackRGB565(uint16_t c, int rgb[3]) {
+    int r = c >> 11, g = (c >> 5) & 0x3f, b = c & 0x1f;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Returns the BC1 palette for the given endpoints.
+static void BC1Palette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+    UnpackRGB565(c0, palette[0]);
+    UnpackRGB565(c1, palette[1]);
+    for (int c = 0; c < 3; ++c) {
+        if (c0 > c1) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        } else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+}
+
+// Chooses the nearest palette entry for each texel, stores the block, and
+// returns its sum of squared errors.
+static int EncodeBC1Indices(const uint8_t rgb[16][3], uint16_t c0, uint16_t c1,
+                            uint8_t block[BCBlockBytes], int indices[16]) {
+    int palette[4][3];
+    BC1Palette(c0, c1, palette);
+    uint32_t bits = 0;
+    int sse = 0;
+    for (int i = 0; i < 16; ++i) {
+        int best = 0, bestError = std::numeric_limits<int>::max();
+        for (int j = 0; j < (c0 > c1 ? 4 : 3); ++j) {
+            int error = Sqr(rgb[i][0] - palette[j][0]) + Sqr(rgb[i][1] - palette[j][1]) +
+                        Sqr(rgb[i][2] - palette[j][2]);
+            if (error < bestError) {
+                best = j;
+                bestError = error;
+            }
+        }
+        indices[i] = best;
+        bits |= uint32_t(best) << (2 * i);
+        sse += bestError;
+    }
+    block[0] = c0 & 0xff;
+    block[1] = c0 >> 8;
+    block[2] = c1 & 0xff;
+    block[3] = c1 >> 8;
+    for (int i = 0; i < 4; ++i)
+        block[4 + i] = (bits >> (8 * i)) & 0xff;
+    return sse;
+}
+
+// Encodes a block of texels and returns its sum of squared errors.
+static int CompressBC1Block(const uint8_t rgb[16][3], uint8_t block[BCBlockBytes]) {
+    // Find the principal axis of the texels' colors using power iteration
+    Float mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            mean[c] += rgb[i][c] / Float(16);
+    Float cov[3][3] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int a = 0; a < 3; ++a)
+            for (int b = 0; b < 3; ++b)
+                cov[a][b] += (rgb[i][a] - mean[a]) * (rgb[i][b] - mean[b]);
+    Float axis[3] = {1, 1, 1};
+    for (int iter = 0; iter < 8; ++iter) {
+        Float next[3];
+        for (int a = 0; a < 3; ++a)
+            next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2];
+        Float length = std::sqrt(Sqr(next[0]) + Sqr(next[1]) + Sqr(next[2]));
+        if (length == 0)
+            break;
+        for (int a = 0; a < 3; ++a)
+            axis[a] = next[a] / length;
+    }
+
+    // Choose endpoints at the extent of the texels along the axis
+    Float tMin = Infinity, tMax = -Infinity;
+    for (int i = 0; i < 16; ++i) {
+        Float t = 0;
+        for (int c = 0; c < 3; ++c)
+            t += (rgb[i][c] - mean[c]) * axis[c];
+        tMin = std::min(tMin, t);
+        tMax = std::max(tMax, t);
+    }
+    Float e0[3], e1[3];
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = mean[c] + tMax * axis[c];
+        e1[c] = mean[c] + tMin * axis[c];
+    }
+    uint16_t c0 = PackRGB565(e0), c1 = PackRGB565(e1);
+    if (c0 < c1)
+        pstd::swap(c0, c1);
+    int indices[16];
+    int sse = EncodeBC1Indices(rgb, c0, c1, block, indices);
+    if (c0 == c1 || sse == 0)
+        return sse;
+
+    // Refit the endpoints to the chosen indices with least squares and keep
+    // the result if it is better
+    const Float paletteWeights[4] = {1, 0, Float(2) / 3, Float(1) / 3};
+    Float aa = 0, ab = 0, bb = 0, ax[3] = {}, bx[3] = {};
+    for (int i = 0; i < 16; ++i) {
+        Float a = paletteWeights[indices[i]], b = 1 - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < 3; ++c) {
+            ax[c] += a * rgb[i][c];
+            bx[c] += b * rgb[i][c];
+        }
+    }
+    Float det = aa * bb - ab * ab;
+    if (det == 0)
+        return sse;
+    for (int c = 0; c < 3; ++c) {
+        e0[c] = (ax[c] * bb - bx[c] * ab) / det;
+        e1[c] = (bx[c] * aa - ax[c] * ab) / det;
+    }
+    uint16_t r0 = PackRGB565(e0), r1 = PackRGB565(e1);
+    if (r0 < r1)
+        pstd::swap(r0, r1);
+    if (r0 == r1)
+        return sse;
+    uint8_t refit[BCBlockBytes];
+    int refitSSE = EncodeBC1Indices(rgb, r0, r1, refit, indices);
+    if (refitSSE < sse) {
+        std::memcpy(block, refit, BCBlockBytes);
+        sse = refitSSE;
+    }
+    return sse;
+}
+
+// Returns the value of palette entry _i_ for BC4 endpoints _r0_ and _r1_.
+static Float BC4PaletteValue(int r0, int r1, int i) {
+    if (i < 2)
+        return (i == 0 ? r0 : r1) / Float(255);
+    if (r0 > r1)
+        return ((8 - i) * r0 + (i - 1) * r1) / Float(7 * 255);
+    if (i < 6)
+        return ((6 - i) * r0 + (i - 1) * r1) / Float(5 * 255);
+    return i == 6 ? 0 : 1;
+}
+
+// Encodes a block of values and returns its sum of squared errors.
+static Float CompressBC4Block(const Float values[16], uint8_t block[BCBlockBytes]) {
+    Float vMin = 1, vMax = 0;
+    for (int i = 0; i < 16; ++i) {
+        vMin = std::min(vMin, Clamp(values[i], 0, 1));
+        vMax = std::max(vMax, Clamp(values[i], 0, 1));
+    }
+    int r0 = std::round(vMax * 255), r1 = std::round(vMin * 255);
+
+    uint64_t bits = 0;
+    Float sse = 0;
+    for (int i = 0; i < 16; ++i) {
+        int best = 0;
+        Float bestError = Infinity;
+        for (int j = 0; j < (r0 > r1 ? 8 : 1); ++j) {
+            Float error = Sqr(values[i] - BC4PaletteValue(r0, r1, j));
+            if (error < bestError) {
+                best = j;
+                bestError = error;
+            }
+        }
+        bits |= uint64_t(best) << (3 * i);
+        sse += bestError;
+    }
+    block[0] = r0;
+    block[1] = r1;
+    for (int i = 0; i < 6; ++i)
+        block[2 + i] = (bits >> (8 * i)) & 0xff;
+    return sse;
+}
+
+// Block Compression Function Definitions
+std::vector<uint8_t> CompressBC1(const Image &image, Float *rmsError) {
+    CHECK(Is8Bit(image.Format()) && image.NChannels() >= 3);
+    Point2i res = image.Resolution();
+    CHECK(res.x % BCBlockTexels == 0 && res.y % BCBlockTexels == 0);
+    Point2i nBlocks = res / BCBlockTexels;
+    std::vector<uint8_t> blocks(size_t(nBlocks.x) * nBlocks.y * BCBlockBytes);
+    std::vector<double> rowSSE(nBlocks.y, 0.);
+
+    ParallelFor(0, nBlocks.y, [&](int64_t by) {
+        for (int bx = 0; bx < nBlocks.x; ++bx) {
+            uint8_t rgb[16][3];
+            for (int i = 0; i < 16; ++i) {
+                Point2i p(bx * BCBlockTexels + i % 4, by * BCBlockTexels + i / 4);
+                std::memcpy(rgb[i], image.RawPointer(p), 3);
+            }
+            uint8_t *block = &blocks[(by * nBlocks.x + bx) * BCBlockBytes];
+            rowSSE[by] += CompressBC1Block(rgb, block) / Sqr(255.);
+        }
+    });
+
+    double sse = 0;
+    for (double s : rowSSE)
+        sse += s;
+    *rmsError = std::sqrt(sse / (3. * res.x * res.y));
+    return blocks;
+}
+
+std::vector<uint8_t> CompressBC4(const Image &image, int channel, Float *rmsError) {
+    CHECK(channel >= 0 && channel < image.NChannels());
+    Point2i res = image.Resolution();
+    CHECK(res.x % BCBlockTexels == 0 && res.y % BCBlockTexels == 0);
+    Point2i nBlocks = res / BCBlockTexels;
+    std::vector<uint8_t> blocks(size_t(nBlocks.x) * nBlocks.y * BCBlockBytes);
+    std::vector<double> rowSSE(nBlocks.y, 0.);
+
+    ParallelFor(0, nBlocks.y, [&](int64_t by) {
+        for (int bx = 0; bx < nBlocks.x; ++bx) {
+            Float values[16];
+            for (int i = 0; i < 16; ++i) {
+                Point2i p(bx * BCBlockTexels + i % 4, by * BCBlockTexels + i / 4);
+                values[i] = image.GetChannel(p, channel);
+            }
+            uint8_t *block = &blocks[(by * nBlocks.x + bx) * BCBlockBytes];
+            rowSSE[by] += CompressBC4Block(values, block);
+        }
+    });
+
+    double sse = 0;
+    for (double s : rowSSE)
+        sse += s;
+    *rmsError = std::sqrt(sse / (double(res.x) * res.y));
+    return blocks;
+}
+
+void DecompressBC1Block(const uint8_t block[BCBlockBytes], uint8_t rgb[16][3]) {
+    uint16_t c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+    int palette[4][3];
+    BC1Palette(c0, c1, palette);
+    uint32_t bits = block[4] | (block[5] << 8) | (block[6] << 16) |
+                    (uint32_t(block[7]) << 24);
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 3; ++c)
+            rgb[i][c] = palette[(bits >> (2 * i)) & 3][c];
+}
+
+void DecompressBC4Block(const uint8_t block[BCBlockBytes], Float values[16]) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; ++i)
+        bits |= uint64_t(block[2 + i]) << (8 * i);
+    for (int i = 0; i < 16; ++i)
+        values[i] = BC4PaletteValue(block[0], block[1], (bits >> (3 * i)) & 7);
+}
+
+}  // namespace pbrt
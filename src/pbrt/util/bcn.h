@@ -0,0 +1,36 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_BCN_H
+#define PBRT_UTIL_BCN_H
+
+#include <pbrt/pbrt.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace pbrt {
+
+// Block Compression Declarations
+// BC1 and BC4 store each 4x4 block of texels in 8 bytes; blocks are stored
+// in scanline order. BC1 encodes three 8-bit channels, which it leaves in
+// whatever color encoding they have, and BC4 encodes one channel with
+// values in [0,1].
+static constexpr int BCBlockTexels = 4, BCBlockBytes = 8;
+
+// The CompressBC*() functions require images whose resolution is a multiple
+// of _BCBlockTexels_ and return the root mean square error of the compressed
+// texels' channel values, in [0,1] units, in _*rmsError_.
+
+// Compresses the first three channels of an 8-bit image.
+std::vector<uint8_t> CompressBC1(const Image &image, Float *rmsError);
+// Compresses the given channel of an image.
+std::vector<uint8_t> CompressBC4(const Image &image, int channel, Float *rmsError);
+
+void DecompressBC1Block(const uint8_t block[BCBlockBytes], uint8_t rgb[16][3]);
+void DecompressBC4Block(const uint8_t block[BCBlockBytes], Float values[16]);
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_BCN_H
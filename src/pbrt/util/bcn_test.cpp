@@ -0,0 +1,105 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/bcn.h>
+#include <pbrt/util/color.h>
+#include <pbrt/util/image.h>
+#include <pbrt/util/rng.h>
+
+#include <cmath>
+
+using namespace pbrt;
+
+static Image GradientImage(Point2i res, int nc, PixelFormat format) {
+    Image image(format, res, nc == 1 ? std::vector<std::string>{"Y"}
+                                     : std::vector<std::string>{"R", "G", "B"},
+                ColorEncodingHandle::Linear);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < nc; ++c)
+                image.SetChannel({x, y}, c,
+                                 0.5f + 0.45f * std::sin((c + 1) * x / 17.f + y / 23.f));
+    return image;
+}
+
+TEST(BCn, BC1MatchesDecoded) {
+    Point2i res(64, 32);
+    Image image = GradientImage(res, 3, PixelFormat::U256);
+    Float rmsError;
+    std::vector<uint8_t> blocks = CompressBC1(image, &rmsError);
+    ASSERT_EQ(blocks.size(), res.x * res.y / 2);
+    EXPECT_LT(rmsError, 0.02f);
+
+    // The reported error should match the decoded blocks' error
+    double sse = 0;
+    for (int by = 0; by < res.y / 4; ++by)
+        for (int bx = 0; bx < res.x / 4; ++bx) {
+            uint8_t rgb[16][3];
+            DecompressBC1Block(&blocks[(by * res.x / 4 + bx) * BCBlockBytes], rgb);
+            for (int i = 0; i < 16; ++i)
+                for (int c = 0; c < 3; ++c) {
+                    Point2i p(4 * bx + i % 4, 4 * by + i / 4);
+                    int v = static_cast<const uint8_t *>(image.RawPointer(p))[c];
+                    sse += Sqr((v - rgb[i][c]) / 255.);
+                }
+        }
+    EXPECT_NEAR(rmsError, std::sqrt(sse / (3 * res.x * res.y)), 1e-5);
+}
+
+TEST(BCn, BC1Constant) {
+    // Colors that are exactly representable in RGB565 are compressed exactly.
+    Point2i res(8, 8);
+    Image image(PixelFormat::U256, res, {"R", "G", "B"}, ColorEncodingHandle::Linear);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            image.SetChannels({x, y}, {1.f, 0.f, 1.f});
+    Float rmsError;
+    std::vector<uint8_t> blocks = CompressBC1(image, &rmsError);
+    EXPECT_EQ(0, rmsError);
+    uint8_t rgb[16][3];
+    DecompressBC1Block(blocks.data(), rgb);
+    for (int i = 0; i < 16; ++i) {
+        EXPECT_EQ(255, rgb[i][0]);
+        EXPECT_EQ(0, rgb[i][1]);
+        EXPECT_EQ(255, rgb[i][2]);
+    }
+}
+
+TEST(BCn, BC4) {
+    Point2i res(32, 16);
+    for (PixelFormat format : {PixelFormat::U256, PixelFormat::Float}) {
+        Image image = GradientImage(res, 1, format);
+        Float rmsError;
+        std::vector<uint8_t> blocks = CompressBC4(image, 0, &rmsError);
+        ASSERT_EQ(blocks.size(), res.x * res.y / 2);
+        EXPECT_LT(rmsError, 0.005f);
+
+        for (int by = 0; by < res.y / 4; ++by)
+            for (int bx = 0; bx < res.x / 4; ++bx) {
+                Float values[16];
+                DecompressBC4Block(&blocks[(by * res.x / 4 + bx) * BCBlockBytes], values);
+                for (int i = 0; i < 16; ++i) {
+                    Point2i p(4 * bx + i % 4, 4 * by + i / 4);
+                    EXPECT_NEAR(image.GetChannel(p, 0), values[i], 0.02f);
+                }
+            }
+    }
+}
+
+TEST(BCn, BC4OutOfRange) {
+    // Values outside [0,1] can't be represented, which should be reflected
+    // in the error.
+    Point2i res(8, 8);
+    Image image(PixelFormat::Float, res, {"Y"});
+    RNG rng;
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            image.SetChannel({x, y}, 0, 4 * rng.Uniform<Float>());
+    Float rmsError;
+    CompressBC4(image, 0, &rmsError);
+    EXPECT_GT(rmsError, 0.5f);
+}
@@ -14,6 +14,8 @@ BufferCache<Point2f> *point2BufferCache;
 BufferCache<Point3f> *point3BufferCache;
 BufferCache<Vector3f> *vector3BufferCache;
 BufferCache<Normal3f> *normal3BufferCache;
+BufferCache<OctahedralVector> *octahedralVectorBufferCache;
+BufferCache<uint32_t> *uint32BufferCache;
 
 void InitBufferCaches(Allocator alloc) {
     CHECK(intBufferCache == nullptr);
@@ -22,14 +24,50 @@ void InitBufferCaches(Allocator alloc) {
     point3BufferCache = alloc.new_object<BufferCache<Point3f>>(alloc);
     vector3BufferCache = alloc.new_object<BufferCache<Vector3f>>(alloc);
     normal3BufferCache = alloc.new_object<BufferCache<Normal3f>>(alloc);
+    octahedralVectorBufferCache = alloc.new_object<BufferCache<OctahedralVector>>(alloc);
+    uint32BufferCache = alloc.new_object<BufferCache<uint32_t>>(alloc);
 }
 
+// Per-type BufferCache statistics
+static StatRegisterer intBufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<int>::ReportStats(accum, "Geometry/Buffer cache hits (int)",
+                                  "Memory/Redundant int buffers");
+});
+static StatRegisterer point2BufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<Point2f>::ReportStats(accum, "Geometry/Buffer cache hits (Point2f)",
+                                      "Memory/Redundant Point2f buffers");
+});
+static StatRegisterer point3BufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<Point3f>::ReportStats(accum, "Geometry/Buffer cache hits (Point3f)",
+                                      "Memory/Redundant Point3f buffers");
+});
+static StatRegisterer vector3BufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<Vector3f>::ReportStats(accum, "Geometry/Buffer cache hits (Vector3f)",
+                                       "Memory/Redundant Vector3f buffers");
+});
+static StatRegisterer normal3BufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<Normal3f>::ReportStats(accum, "Geometry/Buffer cache hits (Normal3f)",
+                                       "Memory/Redundant Normal3f buffers");
+});
+static StatRegisterer octahedralVectorBufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<OctahedralVector>::ReportStats(
+        accum, "Geometry/Buffer cache hits (OctahedralVector)",
+        "Memory/Redundant OctahedralVector buffers");
+});
+static StatRegisterer uint32BufferCacheStats([](StatsAccumulator &accum) {
+    BufferCache<uint32_t>::ReportStats(accum, "Geometry/Buffer cache hits (uint32_t)",
+                                       "Memory/Redundant uint32_t buffers");
+});
+
 STAT_MEMORY_COUNTER("Memory/Mesh indices", meshIndexBytes);
 STAT_MEMORY_COUNTER("Memory/Mesh vertex positions", meshPositionBytes);
 STAT_MEMORY_COUNTER("Memory/Mesh normals", meshNormalBytes);
 STAT_MEMORY_COUNTER("Memory/Mesh uvs", meshUVBytes);
 STAT_MEMORY_COUNTER("Memory/Mesh tangents", meshTangentBytes);
 STAT_MEMORY_COUNTER("Memory/Mesh face indices", meshFaceIndexBytes);
+STAT_MEMORY_COUNTER("Memory/Mesh compressed normals and tangents",
+                    meshCompressedVectorBytes);
+STAT_MEMORY_COUNTER("Memory/Mesh compressed uvs", meshCompressedUVBytes);
 
 void FreeBufferCaches() {
     LOG_VERBOSE("int buffer bytes: %d", intBufferCache->BytesUsed());
@@ -51,6 +89,14 @@ void FreeBufferCaches() {
     LOG_VERBOSE("s bytes: %d", vector3BufferCache->BytesUsed());
     meshTangentBytes += vector3BufferCache->BytesUsed();
     vector3BufferCache->Clear();
+
+    LOG_VERBOSE("compressed n and s bytes: %d", octahedralVectorBufferCache->BytesUsed());
+    meshCompressedVectorBytes += octahedralVectorBufferCache->BytesUsed();
+    octahedralVectorBufferCache->Clear();
+
+    LOG_VERBOSE("compressed uv bytes: %d", uint32BufferCache->BytesUsed());
+    meshCompressedUVBytes += uint32BufferCache->BytesUsed();
+    uint32BufferCache->Clear();
 }
 
 }  // namespace pbrt
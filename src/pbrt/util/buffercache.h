@@ -9,21 +9,21 @@
 
 #include <pbrt/util/check.h>
 #include <pbrt/util/hash.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/stats.h>
 #include <pbrt/util/vecmath.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <mutex>
 #include <string>
-#include <unordered_set>
+#include <vector>
 
 namespace pbrt {
 
-STAT_MEMORY_COUNTER("Memory/Redundant vertex and index buffers", redundantBufferBytes);
-STAT_PERCENT("Geometry/Buffer cache hits", nBufferCacheHits, nBufferCacheLookups);
-
 // BufferCache Definition
 template <typename T>
 class BufferCache {
@@ -32,60 +32,101 @@ class BufferCache {
     BufferCache(Allocator alloc) : alloc(alloc) {}
 
     const T *LookupOrAdd(const std::vector<T> &buf) {
-        ++nBufferCacheLookups;
-        std::lock_guard<std::mutex> lock(mutex);
+        ++nLookups;
+        // Hash _buf_ contents and find the shard bucket that may hold them
+        size_t size = buf.size();
+        uint64_t hash = HashBuffer(buf.data(), size * sizeof(T));
+        Shard &shard = shards[hash % NumShards];
+        std::atomic<Entry *> &bucket = shard.buckets[(hash / NumShards) % NumBuckets];
+
         // Return pointer to data if _buf_ contents is already in the cache
-        Buffer lookupBuffer(buf.data(), buf.size());
-        if (auto iter = cache.find(lookupBuffer); iter != cache.end()) {
-            DCHECK(std::memcmp(buf.data(), iter->ptr, buf.size() * sizeof(T)) == 0);
-            ++nBufferCacheHits;
-            redundantBufferBytes += buf.capacity() * sizeof(T);
-            return iter->ptr;
+        if (const T *ptr = Find(bucket.load(std::memory_order_acquire), buf, hash)) {
+            ++nHits;
+            redundantBytes += buf.capacity() * sizeof(T);
+            return ptr;
         }
 
-        // Add _buf_ contents to cache and return pointer to cached copy
-        T *ptr = alloc.allocate_object<T>(buf.size());
+        // Make copy of _buf_ contents without holding the shard's lock, since
+        // _ParallelFirstTouch()_ may run other threads' work here
+        T *ptr = alloc.allocate_object<T>(size);
+        ParallelFirstTouch(ptr, size * sizeof(T));
         std::copy(buf.begin(), buf.end(), ptr);
-        bytesUsed += buf.size() * sizeof(T);
-        cache.insert(Buffer(ptr, buf.size()));
+
+        // Add copy to the bucket and return pointer to it unless another
+        // thread added the same contents in the meantime
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Entry *head = bucket.load(std::memory_order_relaxed);
+        if (const T *existing = Find(head, buf, hash)) {
+            alloc.deallocate_object(ptr, size);
+            ++nHits;
+            redundantBytes += buf.capacity() * sizeof(T);
+            return existing;
+        }
+        bucket.store(alloc.new_object<Entry>(ptr, size, hash, head),
+                     std::memory_order_release);
+        bytesUsed += size * sizeof(T);
         return ptr;
     }
 
+    // _Clear()_ must not be called concurrently with _LookupOrAdd()_.
     void Clear() {
-        std::lock_guard<std::mutex> lock(mutex);
-        for (auto iter : cache)
-            alloc.deallocate_object(const_cast<T *>(iter.ptr), iter.size);
-        cache.clear();
+        for (Shard &shard : shards)
+            for (std::atomic<Entry *> &bucket : shard.buckets) {
+                Entry *entry = bucket.exchange(nullptr);
+                while (entry) {
+                    Entry *next = entry->next;
+                    alloc.deallocate_object(const_cast<T *>(entry->ptr), entry->size);
+                    alloc.delete_object(entry);
+                    entry = next;
+                }
+            }
         bytesUsed = 0;
     }
 
     size_t BytesUsed() const { return bytesUsed; }
 
-  private:
-    // BufferCache::Buffer Definition
-    struct Buffer {
-        // BufferCache::Buffer Public Methods
-        Buffer() = default;
-        Buffer(const T *ptr, size_t size) : ptr(ptr), size(size) {}
-
-        bool operator==(const Buffer &b) const {
-            return size == b.size && std::memcmp(ptr, b.ptr, size * sizeof(T)) == 0;
-        }
+    static void ReportStats(StatsAccumulator &accum, const char *hitsTitle,
+                            const char *redundantTitle) {
+        accum.ReportPercentage(hitsTitle, nHits, nLookups);
+        accum.ReportMemoryCounter(redundantTitle, redundantBytes);
+        nHits = nLookups = redundantBytes = 0;
+    }
 
-        const T *ptr = nullptr;
-        size_t size = 0;
+  private:
+    // BufferCache::Entry Definition
+    struct Entry {
+        Entry(const T *ptr, size_t size, uint64_t hash, Entry *next)
+            : ptr(ptr), size(size), hash(hash), next(next) {}
+
+        const T *ptr;
+        size_t size;
+        uint64_t hash;
+        Entry *next;
     };
 
-    // BufferCache::BufferHasher Definition
-    struct BufferHasher {
-        size_t operator()(const Buffer &b) const { return HashBuffer(b.ptr, b.size); }
+    // BufferCache::Shard Definition
+    static constexpr int NumShards = 64, NumBuckets = 256;
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::atomic<Entry *> buckets[NumBuckets] = {};
     };
 
+    // BufferCache Private Methods
+    static const T *Find(const Entry *entry, const std::vector<T> &buf, uint64_t hash) {
+        // Entries are never modified after they are published, so the bucket
+        // lists can be traversed without holding the shard's lock
+        for (; entry; entry = entry->next)
+            if (entry->hash == hash && entry->size == buf.size() &&
+                std::memcmp(buf.data(), entry->ptr, buf.size() * sizeof(T)) == 0)
+                return entry->ptr;
+        return nullptr;
+    }
+
     // BufferCache Private Members
     Allocator alloc;
-    std::mutex mutex;
-    std::unordered_set<Buffer, BufferHasher> cache;
-    size_t bytesUsed = 0;
+    Shard shards[NumShards];
+    std::atomic<size_t> bytesUsed{0};
+    static inline thread_local int64_t nLookups, nHits, redundantBytes;
 };
 
 // BufferCache Global Declarations
@@ -94,6 +135,8 @@ extern BufferCache<Point2f> *point2BufferCache;
 extern BufferCache<Point3f> *point3BufferCache;
 extern BufferCache<Vector3f> *vector3BufferCache;
 extern BufferCache<Normal3f> *normal3BufferCache;
+extern BufferCache<OctahedralVector> *octahedralVectorBufferCache;
+extern BufferCache<uint32_t> *uint32BufferCache;
 
 void InitBufferCaches(Allocator alloc);
 void FreeBufferCaches();
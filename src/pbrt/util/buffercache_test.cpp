@@ -6,7 +6,9 @@
 
 #include <pbrt/pbrt.h>
 #include <pbrt/util/buffercache.h>
+#include <pbrt/util/parallel.h>
 
+#include <atomic>
 #include <vector>
 
 using namespace pbrt;
@@ -38,3 +40,26 @@ TEST(BufferCache, Basics) {
 
     EXPECT_EQ(9 * sizeof(int), intBufferCache->BytesUsed());
 }
+
+TEST(BufferCache, Parallel) {
+    FreeBufferCaches();
+
+    // Look up 16 distinct buffers many times from multiple threads
+    std::vector<std::vector<int>> bufs(16);
+    for (int i = 0; i < bufs.size(); ++i)
+        for (int j = 0; j <= i; ++j)
+            bufs[i].push_back(i * 100 + j);
+
+    std::vector<std::atomic<const int *>> ptrs(bufs.size());
+    ParallelFor(0, 1024, [&](int64_t i) {
+        const std::vector<int> &buf = bufs[i % bufs.size()];
+        const int *ptr = intBufferCache->LookupOrAdd(buf);
+        const int *expected = nullptr;
+        if (!ptrs[i % bufs.size()].compare_exchange_strong(expected, ptr))
+            EXPECT_EQ(expected, ptr);
+        for (size_t j = 0; j < buf.size(); ++j)
+            EXPECT_EQ(buf[j], ptr[j]);
+    });
+
+    EXPECT_EQ(136 * sizeof(int), intBufferCache->BytesUsed());
+}
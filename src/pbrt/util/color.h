@@ -18,6 +18,12 @@
 #include <memory>
 #include <string>
 
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && !defined(PBRT_IS_GPU_CODE) && \
+    (defined(__SSE2__) || defined(_M_X64))
+#define PBRT_RGB_SIGMOID_SSE
+#include <immintrin.h>
+#endif
+
 // A special present from windgi.h on Windows...
 #ifdef RGB
 #undef RGB
@@ -346,6 +352,23 @@ class RGBSigmoidPolynomial {
         return s(v);
     }
 
+    // Evaluates the sigmoid polynomial at all of the given wavelengths,
+    // processing four of them at a time with SIMD instructions where
+    // available.
+    template <int N>
+    PBRT_CPU_GPU pstd::array<Float, N> Evaluate(
+        const pstd::array<Float, N> &lambda) const {
+        pstd::array<Float, N> result;
+        int i = 0;
+#ifdef PBRT_RGB_SIGMOID_SSE
+        for (; i + 4 <= N; i += 4)
+            _mm_storeu_ps(&result[i], Evaluate4(_mm_loadu_ps(&lambda[i])));
+#endif
+        for (; i < N; ++i)
+            result[i] = (*this)(lambda[i]);
+        return result;
+    }
+
     PBRT_CPU_GPU
     Float MaxValue() const {
         if (c0 < 0) {
@@ -361,6 +384,28 @@ class RGBSigmoidPolynomial {
     PBRT_CPU_GPU
     static Float s(Float x) { return .5f + x / (2 * std::sqrt(1 + x * x)); };
 
+#ifdef PBRT_RGB_SIGMOID_SSE
+    __m128 Evaluate4(__m128 lambda) const {
+        // Evaluate the polynomial using Horner's rule
+#ifdef __FMA__
+        __m128 v = _mm_fmadd_ps(
+            lambda, _mm_fmadd_ps(lambda, _mm_set1_ps(c0), _mm_set1_ps(c1)),
+            _mm_set1_ps(c2));
+#else
+        __m128 v = _mm_add_ps(
+            _mm_mul_ps(lambda, _mm_add_ps(_mm_mul_ps(lambda, _mm_set1_ps(c0)),
+                                          _mm_set1_ps(c1))),
+            _mm_set1_ps(c2));
+#endif
+        // Clamp _v_ so that infinite values give 0 or 1 without a branch; the
+        // sigmoid already rounds to those beyond this range
+        v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1e8f)), _mm_set1_ps(1e8f));
+        __m128 d = _mm_mul_ps(_mm_set1_ps(2),
+                              _mm_sqrt_ps(_mm_add_ps(_mm_set1_ps(1), _mm_mul_ps(v, v))));
+        return _mm_add_ps(_mm_set1_ps(.5f), _mm_div_ps(v, d));
+    }
+#endif
+
     // RGBSigmoidPolynomial Private Members
     Float c0, c1, c2;
 };
@@ -464,6 +509,8 @@ class GammaColorEncoding {
     PBRT_CPU_GPU
     void FromLinear(pstd::span<const Float> vin, pstd::span<uint8_t> vout) const;
 
+    Float Gamma() const { return gamma; }
+
     std::string ToString() const;
 
   private:
@@ -5,6 +5,9 @@
 #include <pbrt/util/colorspace.h>
 
 #include <pbrt/options.h>
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <pbrt/gpu/init.h>
+#endif  // PBRT_BUILD_GPU_RENDERER
 
 namespace pbrt {
 
@@ -95,17 +98,18 @@ void RGBColorSpace::Init(Allocator alloc) {
         Point2f(.7347, .2653), Point2f(0., 1.), Point2f(.0001, -.077),
         GetNamedSpectrum("illum-acesD60"), RGBToSpectrumTable::ACES2065_1, alloc);
 #ifdef PBRT_BUILD_GPU_RENDERER
-    if (Options->useGPU) {
-        CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_sRGB, &RGBColorSpace::sRGB,
-                                      sizeof(RGBColorSpace_sRGB)));
-        CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_DCI_P3, &RGBColorSpace::DCI_P3,
-                                      sizeof(RGBColorSpace_DCI_P3)));
-        CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_Rec2020, &RGBColorSpace::Rec2020,
-                                      sizeof(RGBColorSpace_Rec2020)));
-        CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_ACES2065_1,
-                                      &RGBColorSpace::ACES2065_1,
-                                      sizeof(RGBColorSpace_ACES2065_1)));
-    }
+    if (Options->useGPU)
+        ForEachGPURenderDevice([&]() {
+            CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_sRGB, &RGBColorSpace::sRGB,
+                                          sizeof(RGBColorSpace_sRGB)));
+            CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_DCI_P3, &RGBColorSpace::DCI_P3,
+                                          sizeof(RGBColorSpace_DCI_P3)));
+            CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_Rec2020, &RGBColorSpace::Rec2020,
+                                          sizeof(RGBColorSpace_Rec2020)));
+            CUDA_CHECK(cudaMemcpyToSymbol(RGBColorSpace_ACES2065_1,
+                                          &RGBColorSpace::ACES2065_1,
+                                          sizeof(RGBColorSpace_ACES2065_1)));
+        });
 #endif
 }
 
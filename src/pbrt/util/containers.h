@@ -7,12 +7,14 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/bits.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iterator>
 #include <memory>
@@ -20,6 +22,11 @@
 #include <tuple>
 #include <type_traits>
 
+#if !defined(PBRT_IS_GPU_CODE) && (defined(__SSE2__) || defined(_M_X64))
+#define PBRT_HASHMAP_SSE2
+#include <immintrin.h>
+#endif
+
 namespace pbrt {
 
 // TypePack Definition
@@ -160,6 +167,10 @@ void ForEachType(F func, TypePack<T, Ts...>) {
 template <typename F>
 void ForEachType(F func, TypePack<>) {}
 
+// Declared in util/parallel.h, which is not included here so that users of
+// the containers don't depend on the thread pool.
+void ParallelFirstTouch(void *ptr, size_t size);
+
 // Array2D Definition
 template <typename T>
 class Array2D {
@@ -177,6 +188,7 @@ class Array2D {
         : extent(extent), allocator(allocator) {
         int n = extent.Area();
         values = allocator.allocate_object<T>(n);
+        ParallelFirstTouch(values, n * sizeof(T));
         for (int i = 0; i < n; ++i)
             allocator.construct(values + i);
     }
@@ -309,6 +321,86 @@ class Array2D {
     T *values;
 };
 
+// BlockedArray2D Definition
+// Stores a 2D array as square blocks of 2^LogBlockSize x 2^LogBlockSize
+// values, each contiguous in memory, so that accesses to nearby values in
+// both dimensions touch fewer cache lines and pages than with Array2D's
+// scanline layout. The array is padded to a whole number of blocks.
+template <typename T, int LogBlockSize = 2>
+class BlockedArray2D {
+  public:
+    // BlockedArray2D Type Definitions
+    using value_type = T;
+    using allocator_type = pstd::pmr::polymorphic_allocator<std::byte>;
+
+    // BlockedArray2D Public Methods
+    BlockedArray2D(allocator_type allocator = {})
+        : BlockedArray2D({{0, 0}, {0, 0}}, allocator) {}
+
+    BlockedArray2D(const Bounds2i &extent, allocator_type allocator = {})
+        : extent(extent), allocator(allocator) {
+        xBlocks = roundUp(xSize()) >> LogBlockSize;
+        int n = paddedSize();
+        values = allocator.allocate_object<T>(n);
+        ParallelFirstTouch(values, n * sizeof(T));
+        for (int i = 0; i < n; ++i)
+            allocator.construct(values + i);
+    }
+
+    ~BlockedArray2D() {
+        int n = paddedSize();
+        for (int i = 0; i < n; ++i)
+            allocator.destroy(values + i);
+        allocator.deallocate_object(values, n);
+    }
+
+    BlockedArray2D(const BlockedArray2D &) = delete;
+    BlockedArray2D &operator=(const BlockedArray2D &) = delete;
+
+    PBRT_CPU_GPU
+    T &operator[](Point2i p) { return values[offset(p)]; }
+    PBRT_CPU_GPU
+    const T &operator[](Point2i p) const { return values[offset(p)]; }
+    PBRT_CPU_GPU T &operator()(int x, int y) { return (*this)[{x, y}]; }
+    PBRT_CPU_GPU
+    const T &operator()(int x, int y) const { return (*this)[{x, y}]; }
+
+    PBRT_CPU_GPU
+    int size() const { return extent.Area(); }
+    PBRT_CPU_GPU
+    int xSize() const { return extent.pMax.x - extent.pMin.x; }
+    PBRT_CPU_GPU
+    int ySize() const { return extent.pMax.y - extent.pMin.y; }
+
+    std::string ToString() const {
+        return StringPrintf("[ BlockedArray2D extent: %s blockSize: %d ]", extent,
+                            BlockSize);
+    }
+
+  private:
+    // BlockedArray2D Private Methods
+    PBRT_CPU_GPU
+    static int roundUp(int x) { return (x + BlockSize - 1) & ~(BlockSize - 1); }
+    PBRT_CPU_GPU
+    int paddedSize() const { return roundUp(xSize()) * roundUp(ySize()); }
+
+    PBRT_CPU_GPU
+    int offset(Point2i p) const {
+        DCHECK(InsideExclusive(p, extent));
+        int x = p.x - extent.pMin.x, y = p.y - extent.pMin.y;
+        int block = (y >> LogBlockSize) * xBlocks + (x >> LogBlockSize);
+        return (block << (2 * LogBlockSize)) + ((y & (BlockSize - 1)) << LogBlockSize) +
+               (x & (BlockSize - 1));
+    }
+
+    // BlockedArray2D Private Members
+    static constexpr int BlockSize = 1 << LogBlockSize;
+    Bounds2i extent;
+    Allocator allocator;
+    int xBlocks;
+    T *values;
+};
+
 template <typename T, int N, class Allocator = pstd::pmr::polymorphic_allocator<T>>
 class InlinedVector {
   public:
@@ -638,6 +730,11 @@ class InlinedVector {
 };
 
 // HashMap Definition
+// An open-addressing hash table organized like a Swiss table: slots are
+// grouped _GroupSize_ at a time, and a separate array of control bytes
+// stores seven bits of the hash of each occupied slot's key. A probe
+// compares a group's control bytes to the key's with a few SIMD
+// instructions and only reads the slots whose bytes match.
 template <typename Key, typename Value, typename Hash,
           typename Allocator =
               pstd::pmr::polymorphic_allocator<pstd::optional<std::pair<Key, Value>>>>
@@ -693,35 +790,45 @@ class HashMap {
     PBRT_CPU_GPU
     size_t capacity() const { return table.size(); }
     void Clear() {
-        table.clear();
+        table = pstd::vector<TableEntry>(GroupSize, table.get_allocator());
+        control = pstd::vector<int8_t>(GroupSize, Empty, table.get_allocator());
         nStored = 0;
     }
 
-    HashMap(Allocator alloc) : table(8, alloc) {}
+    HashMap(Allocator alloc)
+        : table(GroupSize, alloc), control(GroupSize, Empty, alloc) {}
 
     HashMap(const HashMap &) = delete;
     HashMap &operator=(const HashMap &) = delete;
 
     void Insert(const Key &key, const Value &value) {
-        size_t offset = FindOffset(key);
-        if (table[offset].has_value() == false) {
-            // Grow hash table if it is too full
-            if (3 * ++nStored > capacity()) {
-                Grow();
-                offset = FindOffset(key);
-            }
+        uint64_t hash = HashKey(key);
+        if (const TableEntry *entry = FindEntry(key, hash)) {
+            const_cast<TableEntry *>(entry)->value().second = value;
+            return;
         }
-        table[offset] = std::make_pair(key, value);
+        // Grow hash table if it is too full
+        if (8 * (nStored + 1) > 7 * capacity())
+            Grow();
+        InsertNew(std::make_pair(key, value), hash);
+        ++nStored;
     }
 
+    // Returns a pointer to _key_'s value or _nullptr_ if it isn't present.
     PBRT_CPU_GPU
-    bool HasKey(const Key &key) const { return table[FindOffset(key)].has_value(); }
+    const Value *Find(const Key &key) const {
+        const TableEntry *entry = FindEntry(key, HashKey(key));
+        return entry ? &entry->value().second : nullptr;
+    }
+
+    PBRT_CPU_GPU
+    bool HasKey(const Key &key) const { return Find(key) != nullptr; }
 
     PBRT_CPU_GPU
     const Value &operator[](const Key &key) const {
-        size_t offset = FindOffset(key);
-        CHECK(table[offset].has_value());
-        return table[offset]->second;
+        const Value *value = Find(key);
+        CHECK(value != nullptr);
+        return *value;
     }
 
     PBRT_CPU_GPU
@@ -739,44 +846,226 @@ class HashMap {
   private:
     // HashMap Private Methods
     PBRT_CPU_GPU
-    size_t FindOffset(const Key &key) const {
-        size_t baseOffset = Hash()(key) & (capacity() - 1);
-        for (int nProbes = 0;; ++nProbes) {
-            // Find offset for _key_ using quadratic probing
-            size_t offset =
-                (baseOffset + nProbes / 2 + nProbes * nProbes / 2) & (capacity() - 1);
-            if (table[offset].has_value() == false || key == table[offset]->first)
-                return offset;
+    static uint64_t HashKey(const Key &key) { return MixBits(Hash()(key)); }
+    // The low seven bits of the hash are stored in the control bytes and the
+    // rest choose the first group to probe.
+    PBRT_CPU_GPU
+    static int8_t ControlByte(uint64_t hash) { return int8_t(hash & 0x7f); }
+
+    // Returns a bit mask of the slots in _group_ whose control bytes are _c_.
+    PBRT_CPU_GPU
+    uint32_t MatchGroup(size_t group, int8_t c) const {
+        const int8_t *groupControl = control.data() + group * GroupSize;
+#ifdef PBRT_HASHMAP_SSE2
+        __m128i bytes = _mm_loadu_si128((const __m128i *)groupControl);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < GroupSize; ++i)
+            if (groupControl[i] == c)
+                mask |= 1u << i;
+        return mask;
+#endif
+    }
+
+    PBRT_CPU_GPU
+    static int LowestSetBit(uint32_t mask) {
+#ifdef PBRT_IS_GPU_CODE
+        return __ffs(mask) - 1;
+#elif defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return index;
+#else
+        return __builtin_ctz(mask);
+#endif
+    }
+
+    PBRT_CPU_GPU
+    const TableEntry *FindEntry(const Key &key, uint64_t hash) const {
+        // Probe groups using triangular numbers, which visits all of them
+        size_t groupMask = capacity() / GroupSize - 1;
+        size_t group = (hash >> 7) & groupMask;
+        for (size_t nProbes = 1;; ++nProbes) {
+            for (uint32_t mask = MatchGroup(group, ControlByte(hash)); mask;
+                 mask &= mask - 1) {
+                size_t offset = group * GroupSize + LowestSetBit(mask);
+                if (table[offset]->first == key)
+                    return &table[offset];
+            }
+            // Entries are never removed, so the key isn't present if the
+            // group has an empty slot
+            if (MatchGroup(group, Empty))
+                return nullptr;
+            group = (group + nProbes) & groupMask;
         }
     }
 
-    void Grow() {
-        size_t currentCapacity = capacity();
-        pstd::vector<TableEntry> newTable(std::max<size_t>(64, 2 * currentCapacity),
-                                          table.get_allocator());
-        size_t newCapacity = newTable.size();
-        for (size_t i = 0; i < currentCapacity; ++i) {
-            // Insert _table[i]_ into _newTable_ if it is set
-            if (!table[i].has_value())
-                continue;
-            size_t baseOffset = Hash()(table[i]->first) & (newCapacity - 1);
-            for (int nProbes = 0;; ++nProbes) {
-                size_t offset = (baseOffset + nProbes / 2 + nProbes * nProbes / 2) &
-                                (newCapacity - 1);
-                if (!newTable[offset]) {
-                    newTable[offset] = std::move(*table[i]);
-                    break;
-                }
+    void InsertNew(std::pair<Key, Value> &&entry, uint64_t hash) {
+        size_t groupMask = capacity() / GroupSize - 1;
+        size_t group = (hash >> 7) & groupMask;
+        for (size_t nProbes = 1;; ++nProbes) {
+            if (uint32_t mask = MatchGroup(group, Empty); mask) {
+                size_t offset = group * GroupSize + LowestSetBit(mask);
+                control[offset] = ControlByte(hash);
+                table[offset] = std::move(entry);
+                return;
             }
+            group = (group + nProbes) & groupMask;
         }
-        table = std::move(newTable);
+    }
+
+    void Grow() {
+        pstd::vector<TableEntry> oldTable = std::move(table);
+        size_t newCapacity = std::max<size_t>(64, 2 * oldTable.size());
+        table = pstd::vector<TableEntry>(newCapacity, oldTable.get_allocator());
+        control = pstd::vector<int8_t>(newCapacity, Empty, oldTable.get_allocator());
+        for (TableEntry &entry : oldTable)
+            if (entry.has_value()) {
+                uint64_t hash = HashKey(entry->first);
+                InsertNew(std::move(*entry), hash);
+            }
     }
 
     // HashMap Private Members
+    static constexpr int GroupSize = 16;
+    static constexpr int8_t Empty = -128;
     pstd::vector<TableEntry> table;
+    pstd::vector<int8_t> control;
     size_t nStored = 0;
 };
 
+// ConcurrentHashMap Definition
+// A fixed-capacity hash table that allows concurrent insertions and
+// lookups from multiple threads, on the CPU or the GPU. Entries can't be
+// removed or changed once they have been inserted.
+template <typename Key, typename Value, typename Hash>
+class ConcurrentHashMap {
+  public:
+    // ConcurrentHashMap Public Methods
+    ConcurrentHashMap(size_t capacity, Allocator alloc)
+        : capacity(RoundUpPow2(std::max<int64_t>(capacity, 1))), alloc(alloc) {
+        slots = alloc.allocate_object<Slot>(this->capacity);
+        for (size_t i = 0; i < this->capacity; ++i)
+            alloc.construct(&slots[i]);
+    }
+    ~ConcurrentHashMap() {
+        for (size_t i = 0; i < capacity; ++i)
+            slots[i].~Slot();
+        alloc.deallocate_object(slots, capacity);
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+    ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
+
+    // Inserts _key_ with _value_ and returns true unless _key_ is already
+    // present, in which case its value is left unchanged. The table must
+    // not become full.
+    PBRT_CPU_GPU
+    bool Insert(const Key &key, const Value &value) {
+        for (size_t offset = MixBits(Hash()(key)) & (capacity - 1), nProbes = 0;;) {
+            Slot &slot = slots[offset];
+            uint32_t state = slot.Load();
+            if (state == Empty && slot.CompareExchange(Empty, Busy)) {
+                // Fill in the slot that this thread has claimed
+                slot.key = key;
+                slot.value = value;
+                slot.Publish();
+                return true;
+            }
+            if (state == Full) {
+                if (slot.key == key)
+                    return false;
+                offset = (offset + 1) & (capacity - 1);
+                CHECK_LT(++nProbes, capacity);
+            }
+            // Otherwise another thread is filling in the slot; look at it
+            // again on the next iteration. Not waiting for it in a nested
+            // loop lets a GPU thread that is filling in the slot make
+            // progress even if it is in the same warp as this one.
+        }
+    }
+
+    // Returns a pointer to _key_'s value or _nullptr_ if it isn't present.
+    PBRT_CPU_GPU
+    const Value *Find(const Key &key) const {
+        for (size_t offset = MixBits(Hash()(key)) & (capacity - 1), nProbes = 0;
+             nProbes < capacity;) {
+            const Slot &slot = slots[offset];
+            uint32_t state = slot.Load();
+            if (state == Empty)
+                return nullptr;
+            if (state == Full) {
+                if (slot.key == key)
+                    return &slot.value;
+                offset = (offset + 1) & (capacity - 1);
+                ++nProbes;
+            }
+            // As in Insert(), a slot that is being filled in is checked again.
+        }
+        return nullptr;
+    }
+
+    PBRT_CPU_GPU
+    bool HasKey(const Key &key) const { return Find(key) != nullptr; }
+
+  private:
+    // ConcurrentHashMap Private Members
+    static constexpr uint32_t Empty = 0, Busy = 1, Full = 2;
+    struct Slot {
+        PBRT_CPU_GPU
+        uint32_t Load() const {
+#ifdef PBRT_IS_GPU_CODE
+            uint32_t s = *(volatile const uint32_t *)&state;
+            __threadfence();
+            return s;
+#else
+            return AtomicState().load(std::memory_order_acquire);
+#endif
+        }
+        PBRT_CPU_GPU
+        bool CompareExchange(uint32_t expected, uint32_t desired) {
+#ifdef PBRT_IS_GPU_CODE
+            return atomicCAS(&state, expected, desired) == expected;
+#else
+            return AtomicState().compare_exchange_strong(expected, desired,
+                                                         std::memory_order_acq_rel);
+#endif
+        }
+        PBRT_CPU_GPU
+        void Publish() {
+#ifdef PBRT_IS_GPU_CODE
+            __threadfence();
+            *(volatile uint32_t *)&state = Full;
+#else
+            AtomicState().store(Full, std::memory_order_release);
+#endif
+        }
+
+#ifndef PBRT_IS_GPU_CODE
+        // Host code accesses _state_ as a std::atomic, which has the same
+        // size and representation as the uint32_t that device code uses.
+        std::atomic<uint32_t> &AtomicState() const {
+            static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+                              alignof(std::atomic<uint32_t>) == alignof(uint32_t),
+                          "std::atomic<uint32_t> must match uint32_t's layout");
+            return *reinterpret_cast<std::atomic<uint32_t> *>(
+                const_cast<uint32_t *>(&state));
+        }
+#endif
+
+        // The state is a plain uint32_t on both the host and the device, so
+        // that the table has the same layout on each.
+        uint32_t state = Empty;
+        Key key;
+        Value value;
+    };
+
+    size_t capacity;
+    Allocator alloc;
+    Slot *slots;
+};
+
 // SampledGrid Definition
 template <typename T>
 class SampledGrid {
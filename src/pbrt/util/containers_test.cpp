@@ -8,8 +8,10 @@
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/rng.h>
 
+#include <atomic>
 #include <set>
 #include <string>
+#include <thread>
 
 using namespace pbrt;
 
@@ -44,6 +46,30 @@ TEST(Array2D, Bounds) {
         EXPECT_EQ(Point2f(p.y, p.x), a[p]);
 }
 
+TEST(BlockedArray2D, Bounds) {
+    // The extent isn't a multiple of the block size in either dimension
+    Bounds2i b(Point2i(-5, 3), Point2i(10, 10));
+    BlockedArray2D<Point2f, 2> a(b);
+
+    EXPECT_EQ(b.pMax.x - b.pMin.x, a.xSize());
+    EXPECT_EQ(b.pMax.y - b.pMin.y, a.ySize());
+    EXPECT_EQ(b.Area(), a.size());
+
+    std::set<const Point2f *> addresses;
+    for (Point2i p : b) {
+        a[p] = Point2f(p.y, p.x);
+        addresses.insert(&a[p]);
+    }
+    EXPECT_EQ(b.Area(), addresses.size());
+
+    for (Point2i p : b)
+        EXPECT_EQ(Point2f(p.y, p.x), a(p.x, p.y));
+
+    // Values in the same block are contiguous
+    EXPECT_EQ(&a(-5, 3) + 1, &a(-4, 3));
+    EXPECT_EQ(&a(-5, 3) + 4, &a(-5, 4));
+}
+
 TEST(HashMap, Basics) {
     Allocator alloc;
     HashMap<int, std::string, std::hash<int>> map(alloc);
@@ -108,6 +134,71 @@ TEST(HashMap, Randoms) {
     EXPECT_EQ(0, values.size());
 }
 
+TEST(ConcurrentHashMap, Threads) {
+    Allocator alloc;
+    ConcurrentHashMap<int, int, std::hash<int>> map(20000, alloc);
+
+    // Each key is inserted by two threads; only one of them should succeed.
+    std::atomic<int> nInserted{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+        threads.push_back(std::thread([&, t]() {
+            for (int i = 0; i < 5000; ++i) {
+                int key = (t / 2) * 5000 + i;
+                if (map.Insert(key, -key))
+                    ++nInserted;
+                const int *value = map.Find(key);
+                ASSERT_TRUE(value != nullptr);
+                EXPECT_EQ(-key, *value);
+            }
+        }));
+    for (std::thread &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(10000, nInserted);
+    for (int key = 0; key < 10000; ++key)
+        EXPECT_EQ(-key, *map.Find(key));
+    EXPECT_FALSE(map.HasKey(10000));
+    EXPECT_FALSE(map.HasKey(-1));
+}
+
+TEST(ConcurrentHashMap, FindDuringInsert) {
+    ConcurrentHashMap<int, int, std::hash<int>> map(65536, Allocator());
+    const int nKeys = 40000;
+
+    // Two threads insert the keys while two others look them up; a lookup
+    // must find either nothing or the complete value.
+    std::atomic<bool> inserting{true};
+    std::atomic<int> nFound{0};
+    std::vector<std::thread> writers, readers;
+    for (int t = 0; t < 2; ++t)
+        writers.push_back(std::thread([&, t]() {
+            for (int key = t; key < nKeys; key += 2)
+                EXPECT_TRUE(map.Insert(key, -key));
+        }));
+    for (int t = 0; t < 2; ++t)
+        readers.push_back(std::thread([&, t]() {
+            while (inserting)
+                for (int key = t; key < nKeys; key += 97)
+                    if (const int *value = map.Find(key)) {
+                        EXPECT_EQ(-key, *value);
+                        ++nFound;
+                    }
+        }));
+    for (std::thread &thread : writers)
+        thread.join();
+    inserting = false;
+    for (std::thread &thread : readers)
+        thread.join();
+
+    EXPECT_GT(nFound, 0);
+    for (int key = 0; key < nKeys; ++key) {
+        const int *value = map.Find(key);
+        ASSERT_TRUE(value != nullptr);
+        EXPECT_EQ(-key, *value);
+    }
+}
+
 TEST(TypePack, Index) {
     using Pack = TypePack<int, float, double>;
 
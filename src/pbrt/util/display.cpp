@@ -12,6 +12,9 @@
 
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
 
@@ -213,14 +216,55 @@ void Serialize(uint8_t **ptr, T value) {
 
 constexpr int tileSize = 128;
 
+// Dynamic items are updated at most this often and are limited to this
+// fraction of wall-clock time, so that fetching pixel values and sending
+// them over a slow link don't compete much with rendering.
+constexpr int minUpdateMilliseconds = 250;
+constexpr double maxUpdateTimeFraction = 0.05;
+
 }  // namespace
 
+// DisplayDirtyTiles Definition
+// Records which display tiles of a dynamic item have changed since they
+// were last sent; tiles start out dirty.
+struct DisplayDirtyTiles {
+    DisplayDirtyTiles(Point2i resolution)
+        : nTilesX((resolution.x + tileSize - 1) / tileSize),
+          nTiles(nTilesX * ((resolution.y + tileSize - 1) / tileSize)),
+          dirty(new std::atomic<bool>[nTiles]) {
+        MarkAll();
+    }
+
+    void MarkAll() {
+        for (int i = 0; i < nTiles; ++i)
+            dirty[i] = true;
+    }
+
+    void Mark(Bounds2i b) {
+        if (b.IsEmpty())
+            return;
+        for (int y = b.pMin.y / tileSize; y <= (b.pMax.y - 1) / tileSize; ++y)
+            for (int x = b.pMin.x / tileSize; x <= (b.pMax.x - 1) / tileSize; ++x)
+                if (x < nTilesX && y * nTilesX + x < nTiles)
+                    dirty[y * nTilesX + x] = true;
+    }
+
+    int nTilesX, nTiles;
+    std::unique_ptr<std::atomic<bool>[]> dirty;
+};
+
+// Dirty tile trackers of dynamic items, indexed by the title they were
+// created with
+static std::mutex dirtyTilesMutex;
+static std::map<std::string, std::shared_ptr<DisplayDirtyTiles>> dirtyTilesByTitle;
+
 class DisplayItem {
   public:
     DisplayItem(
         const std::string &title, Point2i resolution,
         std::vector<std::string> channelNames,
-        std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues);
+        std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues,
+        std::shared_ptr<DisplayDirtyTiles> dirtyTiles = nullptr);
 
     bool Display(IPCChannel &channel);
 
@@ -232,6 +276,8 @@ class DisplayItem {
     Point2i resolution;
     std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues;
     std::vector<std::string> channelNames;
+    // Only the tiles marked here are fetched and sent, if non-null
+    std::shared_ptr<DisplayDirtyTiles> dirtyTiles;
 
     struct ImageChannelBuffer {
         ImageChannelBuffer(const std::string &channelName, int nTiles,
@@ -243,6 +289,8 @@ class DisplayItem {
         std::vector<uint8_t> buffer;
         int tileBoundsOffset = 0, channelValuesOffset = 0;
         std::vector<uint64_t> tileHashes;
+        // Hash of a zero tile, which is what a newly-opened image holds
+        uint64_t zeroHash;
 
         int setCount, tileIndex;
     };
@@ -252,8 +300,12 @@ class DisplayItem {
 DisplayItem::DisplayItem(
     const std::string &baseTitle, Point2i resolution,
     std::vector<std::string> channelNames,
-    std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues)
-    : resolution(resolution), getTileValues(getTileValues), channelNames(channelNames) {
+    std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues,
+    std::shared_ptr<DisplayDirtyTiles> dirtyTiles)
+    : resolution(resolution),
+      getTileValues(getTileValues),
+      channelNames(channelNames),
+      dirtyTiles(std::move(dirtyTiles)) {
 #ifdef PBRT_IS_WINDOWS
     title = StringPrintf("%s (%d)", baseTitle, GetCurrentThreadId());
 #else
@@ -292,8 +344,8 @@ DisplayItem::ImageChannelBuffer::ImageChannelBuffer(const std::string &channelNa
     // for a fully-zero tile (which corresponds to the initial state on the
     // viewer side.)
     memset(buffer.data() + channelValuesOffset, 0, tileSize * tileSize * sizeof(float));
-    uint64_t zeroHash = HashBuffer(buffer.data() + channelValuesOffset,
-                                   tileSize * tileSize * sizeof(float));
+    zeroHash = HashBuffer(buffer.data() + channelValuesOffset,
+                          tileSize * tileSize * sizeof(float));
     tileHashes.assign(nTiles, zeroHash);
 }
 
@@ -334,6 +386,12 @@ bool DisplayItem::Display(IPCChannel &ipcChannel) {
             // maybe next time
             return false;
         openedImage = true;
+        // The viewer starts with a zero image, so everything must be resent
+        for (ImageChannelBuffer &channelBuffer : channelBuffers)
+            std::fill(channelBuffer.tileHashes.begin(), channelBuffer.tileHashes.end(),
+                      channelBuffer.zeroHash);
+        if (dirtyTiles)
+            dirtyTiles->MarkAll();
     }
 
     std::vector<pstd::span<Float>> displayValues(channelBuffers.size());
@@ -346,6 +404,10 @@ bool DisplayItem::Display(IPCChannel &ipcChannel) {
     int tileIndex = 0;
     for (int y = 0; y < resolution.y; y += tileSize)
         for (int x = 0; x < resolution.x; x += tileSize, ++tileIndex) {
+            // Skip tiles that haven't changed since they were last sent
+            if (dirtyTiles && !dirtyTiles->dirty[tileIndex].exchange(false))
+                continue;
+
             int height = std::min(y + tileSize, resolution.y) - y;
             int width = std::min(x + tileSize, resolution.x) - x;
 
@@ -361,6 +423,8 @@ bool DisplayItem::Display(IPCChannel &ipcChannel) {
                 if (!channelBuffers[c].SendIfChanged(ipcChannel, tileIndex)) {
                     // Welp. Stop for now...
                     openedImage = false;
+                    if (dirtyTiles)
+                        dirtyTiles->dirty[tileIndex] = true;
                     return false;
                 }
         }
@@ -390,6 +454,8 @@ bool DisplayItem::SendOpenImage(IPCChannel &ipcChannel) {
 }
 
 static std::atomic<bool> exitThread{false};
+static std::mutex exitMutex;
+static std::condition_variable exitCondition;
 static std::mutex mutex;
 static std::thread updateThread;
 static std::vector<DisplayItem> dynamicItems;
@@ -397,12 +463,26 @@ static std::vector<DisplayItem> dynamicItems;
 static IPCChannel *channel;
 
 static void updateDynamicItems() {
-    while (!exitThread) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    std::chrono::duration<double> wait = std::chrono::milliseconds(minUpdateMilliseconds);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> exitLock(exitMutex);
+            if (exitCondition.wait_for(exitLock, wait, [] { return bool(exitThread); }))
+                break;
+        }
 
-        std::lock_guard<std::mutex> lock(mutex);
-        for (auto &item : dynamicItems)
-            item.Display(*channel);
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &item : dynamicItems)
+                item.Display(*channel);
+        }
+        // Wait long enough that updates take at most _maxUpdateTimeFraction_
+        // of the time
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        wait = std::max<std::chrono::duration<double>>(
+            std::chrono::milliseconds(minUpdateMilliseconds),
+            elapsed * (1 / maxUpdateTimeFraction - 1));
     }
 
     // One last time to get the last bits
@@ -411,6 +491,10 @@ static void updateDynamicItems() {
         item.Display(*channel);
 
     dynamicItems.clear();
+    {
+        std::lock_guard<std::mutex> dirtyLock(dirtyTilesMutex);
+        dirtyTilesByTitle.clear();
+    }
     delete channel;
     channel = nullptr;
 }
@@ -424,7 +508,11 @@ void ConnectToDisplayServer(const std::string &host) {
 
 void DisconnectFromDisplayServer() {
     if (updateThread.get_id() != std::thread::id()) {
-        exitThread = true;
+        {
+            std::lock_guard<std::mutex> exitLock(exitMutex);
+            exitThread = true;
+        }
+        exitCondition.notify_all();
         updateThread.join();
         updateThread = std::thread();
         exitThread = false;
@@ -487,9 +575,32 @@ void DisplayStatic(
 void DisplayDynamic(
     const std::string &title, const Point2i &resolution,
     std::vector<std::string> channelNames,
-    std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues) {
+    std::function<void(Bounds2i b, pstd::span<pstd::span<Float>>)> getTileValues,
+    bool trackDirtyTiles) {
+    std::shared_ptr<DisplayDirtyTiles> dirtyTiles;
+    if (trackDirtyTiles) {
+        dirtyTiles = std::make_shared<DisplayDirtyTiles>(resolution);
+        std::lock_guard<std::mutex> dirtyLock(dirtyTilesMutex);
+        dirtyTilesByTitle[title] = dirtyTiles;
+    }
+
     std::lock_guard<std::mutex> lock(mutex);
-    dynamicItems.push_back(DisplayItem(title, resolution, channelNames, getTileValues));
+    dynamicItems.push_back(
+        DisplayItem(title, resolution, channelNames, getTileValues, dirtyTiles));
+}
+
+void MarkDisplayDynamicDirty(const std::string &title, Bounds2i bounds) {
+    // Hold _dirtyTilesMutex_ only while finding the item's tracker so that
+    // rendering threads never wait for updates being sent
+    std::shared_ptr<DisplayDirtyTiles> dirtyTiles;
+    {
+        std::lock_guard<std::mutex> dirtyLock(dirtyTilesMutex);
+        auto iter = dirtyTilesByTitle.find(title);
+        if (iter == dirtyTilesByTitle.end())
+            return;
+        dirtyTiles = iter->second;
+    }
+    dirtyTiles->Mark(bounds);
 }
 
 }  // namespace pbrt
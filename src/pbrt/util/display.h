@@ -28,10 +28,18 @@ void DisplayStatic(
     std::vector<std::string> channelNames,
     std::function<void(Bounds2i, pstd::span<pstd::span<Float>>)> getTileValues);
 
+// If _trackDirtyTiles_ is true, the item's values are only fetched and sent
+// again for the regions passed to MarkDisplayDynamicDirty() since the last
+// update; otherwise all of them are checked for changes at each update.
 void DisplayDynamic(
     const std::string &title, const Point2i &resolution,
     std::vector<std::string> channelNames,
-    std::function<void(Bounds2i, pstd::span<pstd::span<Float>>)> getTileValues);
+    std::function<void(Bounds2i, pstd::span<pstd::span<Float>>)> getTileValues,
+    bool trackDirtyTiles = false);
+
+// Marks the pixels in _bounds_ of the dynamic item with the given title as
+// changed; it may be called concurrently from any thread.
+void MarkDisplayDynamicDirty(const std::string &title, Bounds2i bounds);
 
 void DisplayStatic(const std::string &title, const Image &image,
                    pstd::optional<ImageChannelDesc> channelDesc = {});
@@ -6,6 +6,7 @@
 
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/print.h>
 #include <pbrt/util/string.h>
 
 #include <filesystem/path.h>
@@ -16,11 +17,18 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <random>
 #ifndef PBRT_IS_WINDOWS
 #include <dirent.h>
 #include <sys/dir.h>
 #include <sys/types.h>
 #endif
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
@@ -110,6 +118,58 @@ std::string ReadFileContents(const std::string &filename) {
                        (std::istreambuf_iterator<char>()));
 }
 
+// MappedFile Method Definitions
+std::unique_ptr<MappedFile> MappedFile::Open(const std::string &filename,
+                                             std::string *error) {
+    std::unique_ptr<MappedFile> file(new MappedFile);
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        *error = StringPrintf("%s: %s", filename, ErrorString());
+        return nullptr;
+    }
+    struct stat stat;
+    if (fstat(fd, &stat) != 0) {
+        *error = StringPrintf("%s: %s", filename, ErrorString());
+        close(fd);
+        return nullptr;
+    }
+    file->size = stat.st_size;
+    // mmap() doesn't allow empty mappings
+    if (file->size > 0) {
+        void *ptr = mmap(nullptr, file->size, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+        if (ptr == MAP_FAILED) {
+            *error = StringPrintf("%s: %s", filename, ErrorString());
+            close(fd);
+            return nullptr;
+        }
+        // Files are generally consumed front to back
+        madvise(ptr, file->size, MADV_SEQUENTIAL);
+        file->data = (const uint8_t *)ptr;
+        file->mapped = true;
+    }
+    close(fd);
+#else
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs) {
+        *error = StringPrintf("%s: %s", filename, ErrorString());
+        return nullptr;
+    }
+    file->contents = std::string((std::istreambuf_iterator<char>(ifs)),
+                                 (std::istreambuf_iterator<char>()));
+    file->data = (const uint8_t *)file->contents.data();
+    file->size = file->contents.size();
+#endif
+    return file;
+}
+
+MappedFile::~MappedFile() {
+#ifdef PBRT_HAVE_MMAP
+    if (mapped)
+        munmap((void *)data, size);
+#endif
+}
+
 std::vector<float> ReadFloatFile(const std::string &filename) {
     FILE *f = fopen(filename.c_str(), "r");
     if (f == nullptr) {
@@ -177,4 +237,27 @@ bool WriteFile(const std::string &filename, const std::string &contents) {
     return true;
 }
 
+bool WriteFileAtomic(const std::string &filename, const std::string &contents) {
+    return WriteFileAtomic(filename, [&](FILE *f) {
+        return fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+    });
+}
+
+bool WriteFileAtomic(const std::string &filename,
+                     const std::function<bool(FILE *)> &write) {
+    // Concurrent writers of the same file each use their own temporary file
+    std::string tempFilename =
+        filename + StringPrintf(".%08x.tmp", (unsigned int)std::random_device()());
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    if (!f)
+        return false;
+    bool success = write(f);
+    if (fclose(f) != 0 || !success ||
+        std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+    return true;
+}
+
 }  // namespace pbrt
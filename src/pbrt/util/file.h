@@ -9,14 +9,55 @@
 
 #include <pbrt/util/pstd.h>
 
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace pbrt {
 
+// MappedFile Definition
+// Provides read-only access to the contents of a file. The file is mapped
+// into memory where the system supports it, which avoids copying it into a
+// separate buffer, and is read into memory otherwise.
+class MappedFile {
+  public:
+    // MappedFile Public Methods
+    // Returns nullptr and sets *error if the file can't be opened.
+    static std::unique_ptr<MappedFile> Open(const std::string &filename,
+                                            std::string *error);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const uint8_t *Data() const { return data; }
+    size_t Size() const { return size; }
+
+  private:
+    MappedFile() = default;
+
+    // MappedFile Private Members
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    bool mapped = false;
+    std::string contents;
+};
+
 // File and Filename Function Declarations
 std::string ReadFileContents(const std::string &filename);
 bool WriteFile(const std::string &filename, const std::string &contents);
+// Writes the file to a uniquely named temporary file and renames it to
+// _filename_, so that other threads and processes never see a partially
+// written file and an interrupted write leaves the previous file intact.
+// Returns false, leaving no temporary file, if it can't be written.
+bool WriteFileAtomic(const std::string &filename, const std::string &contents);
+// Writes the file's contents by calling _write_, which returns false on
+// failure, for files that are too large to assemble in memory first.
+bool WriteFileAtomic(const std::string &filename,
+                     const std::function<bool(FILE *)> &write);
 
 std::vector<float> ReadFloatFile(const std::string &filename);
 
@@ -38,6 +38,26 @@ TEST(File, ReadWriteFile) {
     EXPECT_EQ(0, remove(fn.c_str()));
 }
 
+#ifndef PBRT_IS_WINDOWS
+TEST(File, WriteFileAtomic) {
+    std::string fn = inTestDir("atomic.bin");
+    std::string str = "atomic\0contents";
+    EXPECT_TRUE(WriteFileAtomic(fn, str));
+    EXPECT_EQ(str, ReadFileContents(fn));
+
+    // Replacing the file leaves no temporary files behind
+    EXPECT_TRUE(WriteFileAtomic(fn, [](FILE *f) { return fputs("replaced", f) >= 0; }));
+    EXPECT_EQ("replaced", ReadFileContents(fn));
+    EXPECT_EQ(1, MatchingFilenames(fn).size());
+
+    // A failed write leaves the previous file intact
+    EXPECT_FALSE(WriteFileAtomic(fn, [](FILE *f) { return false; }));
+    EXPECT_EQ("replaced", ReadFileContents(fn));
+    EXPECT_EQ(1, MatchingFilenames(fn).size());
+    EXPECT_EQ(0, remove(fn.c_str()));
+}
+#endif  // !PBRT_IS_WINDOWS
+
 TEST(File, Success) {
     std::string fn = inTestDir("floatfile_good.txt");
     EXPECT_TRUE(WriteFile(fn, R"(1
@@ -78,3 +98,27 @@ l5l
 
     remove(fn.c_str());
 }
+
+TEST(File, MappedFile) {
+    std::string fn = inTestDir("mapped.bin");
+    std::string str = "mapped\0contents";
+    str.append(1000, 'x');
+    EXPECT_TRUE(WriteFile(fn, str));
+
+    std::string error;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(fn, &error);
+    ASSERT_TRUE(file != nullptr) << error;
+    ASSERT_EQ(str.size(), file->Size());
+    EXPECT_EQ(str, std::string((const char *)file->Data(), file->Size()));
+    file.reset();
+    EXPECT_EQ(0, remove(fn.c_str()));
+
+    EXPECT_TRUE(WriteFile(fn, ""));
+    file = MappedFile::Open(fn, &error);
+    ASSERT_TRUE(file != nullptr) << error;
+    EXPECT_EQ(0, file->Size());
+    EXPECT_EQ(0, remove(fn.c_str()));
+
+    EXPECT_TRUE(MappedFile::Open("NO_SUCH_FILE_64622", &error) == nullptr);
+    EXPECT_FALSE(error.empty());
+}
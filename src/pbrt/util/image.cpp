@@ -4,6 +4,7 @@
 
 #include <pbrt/util/image.h>
 
+#include <pbrt/util/bits.h>
 #include <pbrt/util/bluenoise.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
@@ -25,11 +26,20 @@
 #include <ImfInputFile.h>
 #include <ImfIntAttribute.h>
 #include <ImfMatrixAttribute.h>
+#include <ImfMultiPartOutputFile.h>
 #include <ImfOutputFile.h>
+#include <ImfOutputPart.h>
+#include <ImfPartType.h>
 #include <ImfStringVectorAttribute.h>
+#include <ImfThreading.h>
+#include <ImfTiledOutputFile.h>
 #endif
+#include <zlib.h>
 
+#include <atomic>
 #include <cmath>
+#include <complex>
+#include <mutex>
 #include <numeric>
 
 // use lodepng and get 16-bit.
@@ -80,9 +90,11 @@ std::string ImageChannelDesc::ToString() const {
 std::string ImageMetadata::ToString() const {
     return StringPrintf("[ ImageMetadata renderTimeSeconds: %s cameraFromWorld: %s "
                         "NDCFromWorld: %s pixelBounds: %s fullResolution: %s "
-                        "samplesPerPixel: %s MSE: %s colorSpace: %s ]",
+                        "samplesPerPixel: %s MSE: %s colorSpace: %s "
+                        "compressionLevel: %s ]",
                         renderTimeSeconds, cameraFromWorld, NDCFromWorld, pixelBounds,
-                        fullResolution, samplesPerPixel, MSE, colorSpace);
+                        fullResolution, samplesPerPixel, MSE, colorSpace,
+                        compressionLevel);
 }
 
 const RGBColorSpace *ImageMetadata::GetColorSpace() const {
@@ -192,22 +204,118 @@ pstd::vector<Image> Image::GeneratePyramid(Image image, WrapMode2D wrapMode,
     return pyramid;
 }
 
-Image Image::GaussianFilter(const ImageChannelDesc &desc, int halfWidth,
-                            Float sigma) const {
-    // Compute filter weights
-    std::vector<Float> wts(2 * halfWidth + 1, Float(0));
-    for (int d = 0; d < 2 * halfWidth + 1; ++d)
-        wts[d] = Gaussian(d - halfWidth, 0, sigma);
+// FFTPlan Definition
+// Precomputed tables for power-of-two sized complex FFTs.
+class FFTPlan {
+  public:
+    FFTPlan(int n) : n(n), twiddles(n / 2), bitReverse(n) {
+        CHECK(IsPowerOf2(n));
+        for (int i = 0; i < n / 2; ++i)
+            twiddles[i] = std::polar(1.0, -2 * 3.14159265358979323846 * i / n);
+        int logn = Log2Int(n);
+        for (int i = 0; i < n; ++i)
+            bitReverse[i] = logn == 0 ? 0 : ReverseBits32(i) >> (32 - logn);
+    }
 
-    // Normalize weights
-    Float wtSum = std::accumulate(wts.begin(), wts.end(), Float(0));
-    for (Float &w : wts)
-        w /= wtSum;
+    // Computes the discrete Fourier transform of _v_ in place, or its
+    // inverse, without the 1/n scale, if _inverse_ is true.
+    void Transform(std::complex<double> *v, bool inverse) const {
+        for (int i = 0; i < n; ++i)
+            if (i < bitReverse[i])
+                std::swap(v[i], v[bitReverse[i]]);
+        for (int size = 2; size <= n; size *= 2) {
+            int half = size / 2, stride = n / size;
+            for (int start = 0; start < n; start += size)
+                for (int j = 0; j < half; ++j) {
+                    std::complex<double> w = twiddles[j * stride];
+                    if (inverse)
+                        w = std::conj(w);
+                    std::complex<double> t = w * v[start + j + half];
+                    v[start + j + half] = v[start + j] - t;
+                    v[start + j] += t;
+                }
+        }
+    }
 
-    // Separable blur; first blur in x into blurx, selecting out the
-    // desired channels along the way.
-    Image blurx(PixelFormat::Float, resolution, ChannelNames(desc));
+  private:
+    int n;
+    std::vector<std::complex<double>> twiddles;
+    std::vector<int> bitReverse;
+};
+
+// Kernels with at least this many taps are applied using FFTs.
+static constexpr int MinFFTKernelSize = 49;
+
+// Sets _out(i, line, c)_ to the sum over _k_ of _kernel[k]_ times
+// _in(i + k - halfWidth, line, c)_ for each of _nLines_ lines of _n_
+// values, where _in()_ clamps its first argument to [0, n). Lines are
+// processed in parallel, with pairs of channels packed into the real and
+// imaginary parts of a single complex FFT.
+template <typename In, typename Out>
+static void ConvolveLinesFFT(int n, int nLines, int nc, pstd::span<const Float> kernel,
+                             In in, Out out) {
+    int halfWidth = kernel.size() / 2;
+    int fftSize = RoundUpPow2(n + 2 * halfWidth);
+    FFTPlan plan(fftSize);
+
+    // Compute the transform of the kernel, arranged so that the circular
+    // convolution computes the sum above
+    std::vector<std::complex<double>> kernelFFT(fftSize, 0.);
+    for (size_t k = 0; k < kernel.size(); ++k)
+        kernelFFT[(fftSize - int(k)) % fftSize] = kernel[k];
+    plan.Transform(kernelFFT.data(), false);
+    for (std::complex<double> &v : kernelFFT)
+        v /= fftSize;
+
+    ParallelFor(0, nLines * ((nc + 1) / 2), [&](int64_t i0, int64_t i1) {
+        std::vector<std::complex<double>> v(fftSize);
+        for (int64_t i = i0; i < i1; ++i) {
+            int line = i / ((nc + 1) / 2), c = 2 * (i % ((nc + 1) / 2));
+            bool pair = c + 1 < nc;
+            for (int j = 0; j < fftSize; ++j) {
+                if (j >= n + 2 * halfWidth) {
+                    v[j] = 0;
+                    continue;
+                }
+                int x = Clamp(j - halfWidth, 0, n - 1);
+                v[j] = {in(x, line, c), pair ? in(x, line, c + 1) : 0};
+            }
+            plan.Transform(v.data(), false);
+            for (int j = 0; j < fftSize; ++j)
+                v[j] *= kernelFFT[j];
+            plan.Transform(v.data(), true);
+            for (int x = 0; x < n; ++x) {
+                out(x, line, c, v[x].real());
+                if (pair)
+                    out(x, line, c + 1, v[x].imag());
+            }
+        }
+    });
+}
+
+Image Image::Convolve(const ImageChannelDesc &desc,
+                      pstd::span<const Float> kernel) const {
+    CHECK_EQ(1, kernel.size() % 2);
+    int halfWidth = kernel.size() / 2;
     int nc = desc.size();
+
+    // Separable convolution; first convolve in x into blurx, selecting out
+    // the desired channels along the way, and then in y from blurx, which
+    // has just the channels we want already.
+    Image blurx(PixelFormat::Float, resolution, ChannelNames(desc));
+    Image blury(PixelFormat::Float, resolution, ChannelNames(desc));
+    if (kernel.size() >= MinFFTKernelSize) {
+        ConvolveLinesFFT(
+            resolution.x, resolution.y, nc, kernel,
+            [&](int x, int y, int c) { return GetChannel({x, y}, desc.offset[c]); },
+            [&](int x, int y, int c, Float v) { blurx.SetChannel({x, y}, c, v); });
+        ConvolveLinesFFT(
+            resolution.y, resolution.x, nc, kernel,
+            [&](int y, int x, int c) { return blurx.GetChannel({x, y}, c); },
+            [&](int y, int x, int c, Float v) { blury.SetChannel({x, y}, c, v); });
+        return blury;
+    }
+
     ParallelFor(0, resolution.y, [&](int64_t y0, int64_t y1) {
         for (int y = y0; y < y1; ++y) {
             for (int x = 0; x < resolution.x; ++x) {
@@ -215,16 +323,13 @@ Image Image::GaussianFilter(const ImageChannelDesc &desc, int halfWidth,
                 for (int r = -halfWidth; r <= halfWidth; ++r) {
                     ImageChannelValues cv = GetChannels({x + r, y}, desc);
                     for (int c = 0; c < nc; ++c)
-                        result[c] += wts[r + halfWidth] * cv[c];
+                        result[c] += kernel[r + halfWidth] * cv[c];
                 }
                 blurx.SetChannels({x, y}, result);
             }
         }
     });
 
-    // Now blur in y from blur x to the result; blurx has just the
-    // channels we want already.
-    Image blury(PixelFormat::Float, resolution, ChannelNames(desc));
     ParallelFor(0, resolution.y, [&](int64_t y0, int64_t y1) {
         for (int y = y0; y < y1; ++y) {
             for (int x = 0; x < resolution.x; ++x) {
@@ -232,7 +337,7 @@ Image Image::GaussianFilter(const ImageChannelDesc &desc, int halfWidth,
                 for (int r = -halfWidth; r <= halfWidth; ++r) {
                     ImageChannelValues cv = blurx.GetChannels({x, y + r});
                     for (int c = 0; c < nc; ++c)
-                        result[c] += wts[r + halfWidth] * cv[c];
+                        result[c] += kernel[r + halfWidth] * cv[c];
                 }
                 blury.SetChannels({x, y}, result);
             }
@@ -241,6 +346,21 @@ Image Image::GaussianFilter(const ImageChannelDesc &desc, int halfWidth,
     return blury;
 }
 
+Image Image::GaussianFilter(const ImageChannelDesc &desc, int halfWidth,
+                            Float sigma) const {
+    // Compute filter weights
+    std::vector<Float> wts(2 * halfWidth + 1, Float(0));
+    for (int d = 0; d < 2 * halfWidth + 1; ++d)
+        wts[d] = Gaussian(d - halfWidth, 0, sigma);
+
+    // Normalize weights
+    Float wtSum = std::accumulate(wts.begin(), wts.end(), Float(0));
+    for (Float &w : wts)
+        w /= wtSum;
+
+    return Convolve(desc, wts);
+}
+
 std::vector<ResampleWeight> Image::ResampleWeights(int oldRes, int newRes) {
     CHECK_GE(newRes, oldRes);
     std::vector<ResampleWeight> wt(newRes);
@@ -267,6 +387,7 @@ Image Image::FloatResizeUp(Point2i newRes, WrapMode2D wrapMode) const {
     CHECK_GE(newRes.x, resolution.x);
     CHECK_GE(newRes.y, resolution.y);
     Image resampledImage(PixelFormat::Float, newRes, channelNames);
+    int nc = NChannels();
     // Compute $x$ and $y$ resampling weights for image resizing
     std::vector<ResampleWeight> xWeights, yWeights;
     xWeights = ResampleWeights(resolution[0], newRes[0]);
@@ -279,7 +400,7 @@ Image Image::FloatResizeUp(Point2i newRes, WrapMode2D wrapMode) const {
                                   yWeights[outExtent.pMin.y].firstPixel),
                           Point2i(xWeights[outExtent.pMax.x - 1].firstPixel + 4,
                                   yWeights[outExtent.pMax.y - 1].firstPixel + 4));
-        std::vector<float> inBuf(NChannels() * inExtent.Area());
+        std::vector<float> inBuf(nc * inExtent.Area());
         CopyRectOut(inExtent, pstd::span<float>(inBuf), wrapMode);
 
         // Resize image in the $x$ dimension
@@ -288,7 +409,7 @@ Image Image::FloatResizeUp(Point2i newRes, WrapMode2D wrapMode) const {
         int nyOut = outExtent.pMax.y - outExtent.pMin.y;
         int nxIn = inExtent.pMax.x - inExtent.pMin.x;
         int nyIn = inExtent.pMax.y - inExtent.pMin.y;
-        std::vector<float> xBuf(NChannels() * nyIn * nxOut);
+        std::vector<float> xBuf(nc * nyIn * nxOut);
 
         int xBufOffset = 0;
         for (int yOut = inExtent.pMin.y; yOut < inExtent.pMax.y; ++yOut) {
@@ -302,41 +423,38 @@ Image Image::FloatResizeUp(Point2i newRes, WrapMode2D wrapMode) const {
                 DCHECK_GE(xIn, 0);
                 DCHECK_LT(xIn + 3, nxIn);
                 int yIn = yOut - inExtent.pMin.y;
-                int inOffset = NChannels() * (xIn + yIn * nxIn);
+                int inOffset = nc * (xIn + yIn * nxIn);
                 DCHECK_GE(inOffset, 0);
-                DCHECK_LT(inOffset + 3 * NChannels(), inBuf.size());
+                DCHECK_LT(inOffset + 3 * nc, inBuf.size());
 
-                for (int c = 0; c < NChannels(); ++c, ++xBufOffset, ++inOffset)
+                for (int c = 0; c < nc; ++c, ++xBufOffset, ++inOffset)
                     xBuf[xBufOffset] = rsw.weight[0] * inBuf[inOffset] +
-                                       rsw.weight[1] * inBuf[inOffset + NChannels()] +
-                                       rsw.weight[2] * inBuf[inOffset + 2 * NChannels()] +
-                                       rsw.weight[3] * inBuf[inOffset + 3 * NChannels()];
+                                       rsw.weight[1] * inBuf[inOffset + nc] +
+                                       rsw.weight[2] * inBuf[inOffset + 2 * nc] +
+                                       rsw.weight[3] * inBuf[inOffset + 3 * nc];
             }
         }
 
         // Resize image in the $y$ dimension
-        std::vector<float> outBuf(NChannels() * nxOut * nyOut);
-        for (int x = 0; x < nxOut; ++x) {
-            for (int y = 0; y < nyOut; ++y) {
-                int yOut = y + outExtent[0][1];
-                DCHECK(yOut >= 0 && yOut < yWeights.size());
-                const ResampleWeight &rsw = yWeights[yOut];
-
-                DCHECK_GE(rsw.firstPixel - inExtent[0][1], 0);
-                int xBufOffset =
-                    NChannels() * (x + nxOut * (rsw.firstPixel - inExtent[0][1]));
-                DCHECK_GE(xBufOffset, 0);
-                int step = NChannels() * nxOut;
-                DCHECK_LT(xBufOffset + 3 * step, xBuf.size());
-
-                int outOffset = NChannels() * (x + y * nxOut);
-                for (int c = 0; c < NChannels(); ++c, ++outOffset, ++xBufOffset)
-                    outBuf[outOffset] =
-                        std::max<Float>(0, (rsw.weight[0] * xBuf[xBufOffset] +
-                                            rsw.weight[1] * xBuf[xBufOffset + step] +
-                                            rsw.weight[2] * xBuf[xBufOffset + 2 * step] +
-                                            rsw.weight[3] * xBuf[xBufOffset + 3 * step]));
-            }
+        // Each output scanline is a weighted sum of four of _xBuf_'s
+        // scanlines, so work along scanlines to access memory contiguously.
+        std::vector<float> outBuf(nc * nxOut * nyOut);
+        int step = nc * nxOut;
+        for (int y = 0; y < nyOut; ++y) {
+            int yOut = y + outExtent[0][1];
+            DCHECK(yOut >= 0 && yOut < yWeights.size());
+            const ResampleWeight &rsw = yWeights[yOut];
+
+            DCHECK_GE(rsw.firstPixel - inExtent[0][1], 0);
+            int xBufOffset = step * (rsw.firstPixel - inExtent[0][1]);
+            DCHECK_LT(xBufOffset + 4 * step, xBuf.size() + 1);
+            const float *in = &xBuf[xBufOffset];
+            float *out = &outBuf[y * step];
+            for (int i = 0; i < step; ++i)
+                out[i] = std::max<Float>(0, (rsw.weight[0] * in[i] +
+                                             rsw.weight[1] * in[i + step] +
+                                             rsw.weight[2] * in[i + 2 * step] +
+                                             rsw.weight[3] * in[i + 3 * step]));
         }
 
         // Copy resampled image pixels out into _resampledImage_
@@ -457,10 +575,25 @@ Image Image::ConvertToFormat(PixelFormat newFormat, ColorEncodingHandle encoding
         return *this;
 
     Image newImage(newFormat, resolution, channelNames, encoding);
-    for (int y = 0; y < resolution.y; ++y)
-        for (int x = 0; x < resolution.x; ++x)
-            for (int c = 0; c < NChannels(); ++c)
-                newImage.SetChannel({x, y}, c, GetChannel({x, y}, c));
+    // Convert scanlines in parallel through a buffer of _float_ values, so
+    // that each format's conversion runs over whole scanlines
+    ParallelFor(0, resolution.y, [&](int64_t y0, int64_t y1) {
+        std::vector<float> buf(NChannels() * resolution.x);
+        for (int y = y0; y < y1; ++y) {
+            Bounds2i extent({0, y}, {resolution.x, y + 1});
+            CopyRectOut(extent, pstd::span<float>(buf));
+            // As SetChannel() does, replace NaNs with zero
+            int nNaN = 0;
+            for (float &v : buf)
+                if (IsNaN(v)) {
+                    v = 0;
+                    ++nNaN;
+                }
+            if (nNaN > 0)
+                LOG_ERROR("%d NaN values in scanline %d", nNaN, y);
+            newImage.CopyRectIn(extent, buf);
+        }
+    });
     return newImage;
 }
 
@@ -861,8 +994,9 @@ ImageAndMetadata Image::Read(const std::string &name, Allocator alloc,
             case 2: {
                 Image image(std::move(pixels), {x, y}, {"Y", "A"},
                             ColorEncodingHandle::sRGB);
-                return ImageAndMetadata{image.SelectChannels(image.GetChannelDesc({"Y"})),
-                                        ImageMetadata()};
+                return ImageAndMetadata{
+                    image.SelectChannels(image.GetChannelDesc({"Y"}), alloc),
+                    ImageMetadata()};
             }
             case 3:
                 return ImageAndMetadata{Image(std::move(pixels), {x, y}, {"R", "G", "B"},
@@ -872,7 +1006,7 @@ ImageAndMetadata Image::Read(const std::string &name, Allocator alloc,
                 Image image(std::move(pixels), {x, y}, {"R", "G", "B", "A"},
                             ColorEncodingHandle::sRGB);
                 return ImageAndMetadata{
-                    image.SelectChannels(image.GetChannelDesc({"R", "G", "B"})),
+                    image.SelectChannels(image.GetChannelDesc({"R", "G", "B"}), alloc),
                     ImageMetadata()};
             }
             default:
@@ -939,6 +1073,13 @@ bool Image::Write(std::string name, const ImageMetadata &metadata) const {
 ///////////////////////////////////////////////////////////////////////////
 // OpenEXR
 
+// Sizes OpenEXR's global thread pool, which it uses to compress and
+// decompress blocks of scanlines or tiles in parallel, to match pbrt's.
+static void initEXRThreads() {
+    static std::once_flag flag;
+    std::call_once(flag, []() { Imf::setGlobalThreadCount(RunningThreads()); });
+}
+
 static Imf::FrameBuffer imageToFrameBuffer(const Image &image,
                                            const ImageChannelDesc &desc,
                                            const Imath::Box2i &dataWindow) {
@@ -972,6 +1113,7 @@ static Imf::FrameBuffer imageToFrameBuffer(const Image &image,
 }
 
 static ImageAndMetadata ReadEXR(const std::string &name, Allocator alloc) {
+    initEXRThreads();
     try {
         Imf::InputFile file(name.c_str());
         Imath::Box2i dw = file.header().dataWindow();
@@ -1086,77 +1228,86 @@ static ImageAndMetadata ReadEXR(const std::string &name, Allocator alloc) {
     return {};
 }
 
+// Returns an EXR header for an image with the given resolution and metadata;
+// the caller adds the channels.
+static Imf::Header exrHeader(Point2i resolution, const ImageMetadata &metadata) {
+    Imath::Box2i displayWindow, dataWindow;
+    if (metadata.fullResolution)
+        // Agan, -1 offsets to handle inclusive indexing in OpenEXR...
+        displayWindow = {Imath::V2i(0, 0), Imath::V2i(metadata.fullResolution->x - 1,
+                                                      metadata.fullResolution->y - 1)};
+    else
+        displayWindow = {Imath::V2i(0, 0),
+                         Imath::V2i(resolution.x - 1, resolution.y - 1)};
+
+    if (metadata.pixelBounds)
+        dataWindow = {
+            Imath::V2i(metadata.pixelBounds->pMin.x, metadata.pixelBounds->pMin.y),
+            Imath::V2i(metadata.pixelBounds->pMax.x - 1,
+                       metadata.pixelBounds->pMax.y - 1)};
+    else
+        dataWindow = {Imath::V2i(0, 0),
+                      Imath::V2i(resolution.x - 1, resolution.y - 1)};
+
+    Imf::Header header(displayWindow, dataWindow);
+    if (metadata.compressionLevel && *metadata.compressionLevel == 0)
+        header.compression() = Imf::NO_COMPRESSION;
+
+    if (metadata.renderTimeSeconds)
+        header.insert("renderTimeSeconds",
+                      Imf::FloatAttribute(*metadata.renderTimeSeconds));
+    if (metadata.cameraFromWorld) {
+        float m[4][4];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = (*metadata.cameraFromWorld)[i][j];
+        header.insert("worldToCamera", Imf::M44fAttribute(m));
+    }
+    if (metadata.NDCFromWorld) {
+        float m[4][4];
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = (*metadata.NDCFromWorld)[i][j];
+        header.insert("worldToNDC", Imf::M44fAttribute(m));
+    }
+    if (metadata.samplesPerPixel)
+        header.insert("samplesPerPixel", Imf::IntAttribute(*metadata.samplesPerPixel));
+    if (metadata.MSE)
+        header.insert("MSE", Imf::FloatAttribute(*metadata.MSE));
+    for (const auto &iter : metadata.stringVectors)
+        header.insert(iter.first, Imf::StringVectorAttribute(iter.second));
+
+    // The OpenEXR spec says that the default is sRGB if no
+    // chromaticities are provided.  It should be innocuous to write
+    // the sRGB primaries anyway, but for completely indecipherable
+    // reasons, OSX's Preview.app decides to gamma correct the pixels
+    // in EXR files if it finds primaries.  So, we don't write them in
+    // that case in the interests of nicer looking images on the
+    // screen.
+    if (*metadata.GetColorSpace() != *RGBColorSpace::sRGB) {
+        const RGBColorSpace &cs = *metadata.GetColorSpace();
+        Imf::Chromaticities chromaticities(
+            Imath::V2f(cs.r.x, cs.r.y), Imath::V2f(cs.g.x, cs.g.y),
+            Imath::V2f(cs.b.x, cs.b.y), Imath::V2f(cs.w.x, cs.w.y));
+        header.insert("chromaticities", Imf::ChromaticitiesAttribute(chromaticities));
+    }
+
+    return header;
+}
+
 bool Image::WriteEXR(const std::string &name, const ImageMetadata &metadata) const {
     if (Is8Bit(format))
         return ConvertToFormat(PixelFormat::Half).WriteEXR(name, metadata);
     CHECK(Is16Bit(format) || Is32Bit(format));
 
+    initEXRThreads();
     try {
-        Imath::Box2i displayWindow, dataWindow;
-        if (metadata.fullResolution)
-            // Agan, -1 offsets to handle inclusive indexing in OpenEXR...
-            displayWindow = {Imath::V2i(0, 0),
-                             Imath::V2i(metadata.fullResolution->x - 1,
-                                        metadata.fullResolution->y - 1)};
-        else
-            displayWindow = {Imath::V2i(0, 0),
-                             Imath::V2i(resolution.x - 1, resolution.y - 1)};
-
-        if (metadata.pixelBounds)
-            dataWindow = {
-                Imath::V2i(metadata.pixelBounds->pMin.x, metadata.pixelBounds->pMin.y),
-                Imath::V2i(metadata.pixelBounds->pMax.x - 1,
-                           metadata.pixelBounds->pMax.y - 1)};
-        else
-            dataWindow = {Imath::V2i(0, 0),
-                          Imath::V2i(resolution.x - 1, resolution.y - 1)};
-
-        Imf::FrameBuffer fb = imageToFrameBuffer(*this, AllChannelsDesc(), dataWindow);
-
-        Imf::Header header(displayWindow, dataWindow);
+        Imf::Header header = exrHeader(resolution, metadata);
+        Imf::FrameBuffer fb =
+            imageToFrameBuffer(*this, AllChannelsDesc(), header.dataWindow());
         for (auto iter = fb.begin(); iter != fb.end(); ++iter)
             header.channels().insert(iter.name(), iter.slice().type);
 
-        if (metadata.renderTimeSeconds)
-            header.insert("renderTimeSeconds",
-                          Imf::FloatAttribute(*metadata.renderTimeSeconds));
-        if (metadata.cameraFromWorld) {
-            float m[4][4];
-            for (int i = 0; i < 4; ++i)
-                for (int j = 0; j < 4; ++j)
-                    m[i][j] = (*metadata.cameraFromWorld)[i][j];
-            header.insert("worldToCamera", Imf::M44fAttribute(m));
-        }
-        if (metadata.NDCFromWorld) {
-            float m[4][4];
-            for (int i = 0; i < 4; ++i)
-                for (int j = 0; j < 4; ++j)
-                    m[i][j] = (*metadata.NDCFromWorld)[i][j];
-            header.insert("worldToNDC", Imf::M44fAttribute(m));
-        }
-        if (metadata.samplesPerPixel)
-            header.insert("samplesPerPixel",
-                          Imf::IntAttribute(*metadata.samplesPerPixel));
-        if (metadata.MSE)
-            header.insert("MSE", Imf::FloatAttribute(*metadata.MSE));
-        for (const auto &iter : metadata.stringVectors)
-            header.insert(iter.first, Imf::StringVectorAttribute(iter.second));
-
-        // The OpenEXR spec says that the default is sRGB if no
-        // chromaticities are provided.  It should be innocuous to write
-        // the sRGB primaries anyway, but for completely indecipherable
-        // reasons, OSX's Preview.app decides to gamma correct the pixels
-        // in EXR files if it finds primaries.  So, we don't write them in
-        // that case in the interests of nicer looking images on the
-        // screen.
-        if (*metadata.GetColorSpace() != *RGBColorSpace::sRGB) {
-            const RGBColorSpace &cs = *metadata.GetColorSpace();
-            Imf::Chromaticities chromaticities(
-                Imath::V2f(cs.r.x, cs.r.y), Imath::V2f(cs.g.x, cs.g.y),
-                Imath::V2f(cs.b.x, cs.b.y), Imath::V2f(cs.w.x, cs.w.y));
-            header.insert("chromaticities", Imf::ChromaticitiesAttribute(chromaticities));
-        }
-
         Imf::OutputFile file(name.c_str(), header);
         file.setFrameBuffer(fb);
         file.writePixels(resolution.y);
@@ -1168,12 +1319,118 @@ bool Image::WriteEXR(const std::string &name, const ImageMetadata &metadata) con
     return true;
 }
 
+bool WriteMultiPartEXR(const std::string &filename,
+                       const std::vector<std::pair<std::string, const Image *>> &parts,
+                       const ImageMetadata &metadata) {
+    initEXRThreads();
+    try {
+        // Initialize headers and frame buffers for the parts
+        std::vector<Imf::Header> headers;
+        std::vector<Imf::FrameBuffer> frameBuffers;
+        std::vector<Image> converted(parts.size());
+        for (size_t i = 0; i < parts.size(); ++i) {
+            const Image *image = parts[i].second;
+            CHECK_EQ(image->Resolution(), parts[0].second->Resolution());
+            if (Is8Bit(image->Format())) {
+                converted[i] = image->ConvertToFormat(PixelFormat::Half);
+                image = &converted[i];
+            }
+            Imf::Header header = exrHeader(image->Resolution(), metadata);
+            header.setName(parts[i].first);
+            header.setType(Imf::SCANLINEIMAGE);
+            Imf::FrameBuffer fb =
+                imageToFrameBuffer(*image, image->AllChannelsDesc(), header.dataWindow());
+            for (auto iter = fb.begin(); iter != fb.end(); ++iter)
+                header.channels().insert(iter.name(), iter.slice().type);
+            headers.push_back(header);
+            frameBuffers.push_back(fb);
+        }
+
+        // Write the parts' pixels
+        Imf::MultiPartOutputFile file(filename.c_str(), headers.data(), headers.size());
+        for (size_t i = 0; i < parts.size(); ++i) {
+            Imf::OutputPart part(file, i);
+            part.setFrameBuffer(frameBuffers[i]);
+            part.writePixels(parts[i].second->Resolution().y);
+        }
+    } catch (const std::exception &exc) {
+        Error("%s: error writing EXR: %s", filename, exc.what());
+        return false;
+    }
+    return true;
+}
+
+// TiledEXRWriter Method Definitions
+struct TiledEXRWriter::EXRFile {
+    EXRFile(const std::string &filename, const Imf::Header &header)
+        : file(filename.c_str(), header) {}
+    Imf::TiledOutputFile file;
+};
+
+TiledEXRWriter::TiledEXRWriter(const std::string &filename, PixelFormat format,
+                               std::vector<std::string> channelNames, int tileSize,
+                               const ImageMetadata &metadata)
+    : filename(filename), format(format), channelNames(std::move(channelNames)),
+      tileSize(tileSize) {
+    CHECK(metadata.pixelBounds.has_value());
+    CHECK(format == PixelFormat::Half || format == PixelFormat::Float);
+    CHECK_GT(tileSize, 0);
+    pixelBounds = *metadata.pixelBounds;
+
+    initEXRThreads();
+    try {
+        Imf::Header header = exrHeader(Point2i(pixelBounds.Diagonal()), metadata);
+        for (const std::string &name : this->channelNames)
+            header.channels().insert(
+                name, Imf::Channel(format == PixelFormat::Half ? Imf::HALF : Imf::FLOAT));
+        header.setTileDescription(
+            Imf::TileDescription(tileSize, tileSize, Imf::ONE_LEVEL));
+        // Tiles may be written in any order; with the default INCREASING_Y
+        // line order, OpenEXR would hold out-of-order tiles in memory.
+        header.lineOrder() = Imf::RANDOM_Y;
+        file = std::make_unique<EXRFile>(filename, header);
+    } catch (const std::exception &exc) {
+        ErrorExit("%s: error creating EXR: %s", filename, exc.what());
+    }
+}
+
+TiledEXRWriter::~TiledEXRWriter() = default;
+
+Point2i TiledEXRWriter::NumTiles() const {
+    Vector2i d = pixelBounds.Diagonal();
+    return Point2i((d.x + tileSize - 1) / tileSize, (d.y + tileSize - 1) / tileSize);
+}
+
+Bounds2i TiledEXRWriter::TileBounds(Point2i tile) const {
+    Point2i pMin = pixelBounds.pMin + Vector2i(tile.x * tileSize, tile.y * tileSize);
+    return Intersect(Bounds2i(pMin, pMin + Vector2i(tileSize, tileSize)), pixelBounds);
+}
+
+void TiledEXRWriter::WriteTile(Point2i tile, const Image &image) {
+    Bounds2i bounds = TileBounds(tile);
+    CHECK_EQ(image.Resolution(), Point2i(bounds.Diagonal()));
+    CHECK(image.Format() == format);
+
+    try {
+        Imath::Box2i tileWindow(Imath::V2i(bounds.pMin.x, bounds.pMin.y),
+                                Imath::V2i(bounds.pMax.x - 1, bounds.pMax.y - 1));
+        file->file.setFrameBuffer(
+            imageToFrameBuffer(image, image.AllChannelsDesc(), tileWindow));
+        file->file.writeTile(tile.x, tile.y);
+    } catch (const std::exception &exc) {
+        ErrorExit("%s: error writing EXR tile: %s", filename, exc.what());
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // PNG Function Definitions
 
 static ImageAndMetadata ReadPNG(const std::string &name, Allocator alloc,
                                 ColorEncodingHandle encoding) {
-    std::string contents = ReadFileContents(name);
+    std::string fileError;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(name, &fileError);
+    if (!file)
+        ErrorExit("%s", fileError);
 
     if (encoding == nullptr)
         encoding = ColorEncodingHandle::sRGB;
@@ -1181,101 +1438,73 @@ static ImageAndMetadata ReadPNG(const std::string &name, Allocator alloc,
     unsigned width, height;
     LodePNGState state;
     lodepng_state_init(&state);
-    unsigned int error = lodepng_inspect(
-        &width, &height, &state, (const unsigned char *)contents.data(), contents.size());
+    unsigned int error =
+        lodepng_inspect(&width, &height, &state, file->Data(), file->Size());
     if (error != 0)
         ErrorExit("%s: %s", name, lodepng_error_text(error));
 
+    // Converts decoded 16-bit big-endian values to the image's channels,
+    // with the rows processed in parallel.
+    auto convert16 = [&](const std::vector<unsigned char> &buf, Image &image) {
+        int nc = image.NChannels();
+        CHECK_EQ(buf.size(), size_t(2) * nc * width * height);
+        ParallelFor(0, height, [&](int64_t y) {
+            const unsigned char *p = &buf[size_t(2) * nc * width * y];
+            for (unsigned int x = 0; x < width; ++x)
+                for (int c = 0; c < nc; ++c, p += 2) {
+                    Float v = (((int)p[0] << 8) + (int)p[1]) / 65535.f;
+                    image.SetChannel(Point2i(x, y), c, encoding.ToFloatLinear(v));
+                }
+        });
+    };
+
     Image image(alloc);
     switch (state.info_png.color.colortype) {
     case LCT_GREY:
     case LCT_GREY_ALPHA: {
         std::vector<unsigned char> buf;
         int bpp = state.info_png.color.bitdepth == 16 ? 16 : 8;
-        error =
-            lodepng::decode(buf, width, height, (const unsigned char *)contents.data(),
-                            contents.size(), LCT_GREY, bpp);
+        error = lodepng::decode(buf, width, height, file->Data(), file->Size(), LCT_GREY,
+                                bpp);
         if (error != 0)
             ErrorExit("%s: %s", name, lodepng_error_text(error));
 
         if (state.info_png.color.bitdepth == 16) {
-            image = Image(PixelFormat::Half, Point2i(width, height), {"Y"});
-            auto bufIter = buf.begin();
-            for (unsigned int y = 0; y < height; ++y)
-                for (unsigned int x = 0; x < width; ++x, bufIter += 2) {
-                    // Convert from little endian.
-                    Float v = (((int)bufIter[0] << 8) + (int)bufIter[1]) / 65535.f;
-                    v = encoding.ToFloatLinear(v);
-                    image.SetChannel(Point2i(x, y), 0, v);
-                }
-            CHECK(bufIter == buf.end());
+            image = Image(PixelFormat::Half, Point2i(width, height), {"Y"}, nullptr,
+                          alloc);
+            convert16(buf, image);
         } else {
-            image = Image(PixelFormat::U256, Point2i(width, height), {"Y"}, encoding);
+            image = Image(PixelFormat::U256, Point2i(width, height), {"Y"}, encoding,
+                          alloc);
             std::copy(buf.begin(), buf.end(), (uint8_t *)image.RawPointer({0, 0}));
         }
-        return ImageAndMetadata{image, ImageMetadata()};
+        return ImageAndMetadata{std::move(image), ImageMetadata()};
     }
     default: {
         std::vector<unsigned char> buf;
         int bpp = state.info_png.color.bitdepth == 16 ? 16 : 8;
         bool hasAlpha = (state.info_png.color.colortype == LCT_RGBA);
         // Force RGB if it's palletted or whatever.
-        error =
-            lodepng::decode(buf, width, height, (const unsigned char *)contents.data(),
-                            contents.size(), hasAlpha ? LCT_RGBA : LCT_RGB, bpp);
+        error = lodepng::decode(buf, width, height, file->Data(), file->Size(),
+                                hasAlpha ? LCT_RGBA : LCT_RGB, bpp);
         if (error != 0)
             ErrorExit("%s: %s", name, lodepng_error_text(error));
 
         ImageMetadata metadata;
         metadata.colorSpace = RGBColorSpace::sRGB;
+        std::vector<std::string> channels = {"R", "G", "B"};
+        if (hasAlpha)
+            channels.push_back("A");
         if (state.info_png.color.bitdepth == 16) {
-            if (hasAlpha) {
-                image = Image(PixelFormat::Half, Point2i(width, height),
-                              {"R", "G", "B", "A"});
-                auto bufIter = buf.begin();
-                for (unsigned int y = 0; y < height; ++y)
-                    for (unsigned int x = 0; x < width; ++x, bufIter += 8) {
-                        CHECK(bufIter < buf.end());
-                        // Convert from little endian.
-                        Float rgba[4] = {
-                            (((int)bufIter[0] << 8) + (int)bufIter[1]) / 65535.f,
-                            (((int)bufIter[2] << 8) + (int)bufIter[3]) / 65535.f,
-                            (((int)bufIter[4] << 8) + (int)bufIter[5]) / 65535.f,
-                            (((int)bufIter[6] << 8) + (int)bufIter[7]) / 65535.f};
-                        for (int c = 0; c < 4; ++c) {
-                            rgba[c] = encoding.ToFloatLinear(rgba[c]);
-                            image.SetChannel(Point2i(x, y), c, rgba[c]);
-                        }
-                    }
-                CHECK(bufIter == buf.end());
-            } else {
-                image = Image(PixelFormat::Half, Point2i(width, height), {"R", "G", "B"});
-                auto bufIter = buf.begin();
-                for (unsigned int y = 0; y < height; ++y)
-                    for (unsigned int x = 0; x < width; ++x, bufIter += 6) {
-                        CHECK(bufIter < buf.end());
-                        // Convert from little endian.
-                        Float rgb[3] = {
-                            (((int)bufIter[0] << 8) + (int)bufIter[1]) / 65535.f,
-                            (((int)bufIter[2] << 8) + (int)bufIter[3]) / 65535.f,
-                            (((int)bufIter[4] << 8) + (int)bufIter[5]) / 65535.f};
-                        for (int c = 0; c < 3; ++c) {
-                            rgb[c] = encoding.ToFloatLinear(rgb[c]);
-                            image.SetChannel(Point2i(x, y), c, rgb[c]);
-                        }
-                    }
-                CHECK(bufIter == buf.end());
-            }
-        } else if (hasAlpha) {
-            image = Image(PixelFormat::U256, Point2i(width, height), {"R", "G", "B", "A"},
-                          encoding);
-            std::copy(buf.begin(), buf.end(), (uint8_t *)image.RawPointer({0, 0}));
+            image = Image(PixelFormat::Half, Point2i(width, height), channels, nullptr,
+                          alloc);
+            convert16(buf, image);
         } else {
-            image = Image(PixelFormat::U256, Point2i(width, height), {"R", "G", "B"},
-                          encoding);
+            image = Image(PixelFormat::U256, Point2i(width, height), channels, encoding,
+                          alloc);
             std::copy(buf.begin(), buf.end(), (uint8_t *)image.RawPointer({0, 0}));
         }
-        return ImageAndMetadata{image, metadata};
+        return ImageAndMetadata{std::move(image), metadata};
     }
     }
 }
@@ -1287,9 +1516,30 @@ Image Image::SelectChannels(const ImageChannelDesc &desc, Allocator alloc) const
         descChannelNames.push_back(channelNames[desc.offset[i]]);
 
     Image image(format, resolution, descChannelNames, encoding, alloc);
-    for (int y = 0; y < resolution.y; ++y)
-        for (int x = 0; x < resolution.x; ++x)
-            image.SetChannels({x, y}, GetChannels({x, y}, desc));
+    // Copy the selected channels' encoded values, without converting them
+    auto copyChannels = [&](const auto &from, auto &to) {
+        int nc = NChannels(), ncOut = desc.size();
+        ParallelFor(0, resolution.y, [&](int64_t y) {
+            size_t offset = PixelOffset({0, int(y)});
+            size_t outOffset = image.PixelOffset({0, int(y)});
+            for (int x = 0; x < resolution.x; ++x, offset += nc, outOffset += ncOut)
+                for (int c = 0; c < ncOut; ++c)
+                    to[outOffset + c] = from[offset + desc.offset[c]];
+        });
+    };
+    switch (format) {
+    case PixelFormat::U256:
+        copyChannels(p8, image.p8);
+        break;
+    case PixelFormat::Half:
+        copyChannels(p16, image.p16);
+        break;
+    case PixelFormat::Float:
+        copyChannels(p32, image.p32);
+        break;
+    default:
+        LOG_FATAL("Unhandled PixelFormat");
+    }
     return image;
 }
 
@@ -1298,9 +1548,33 @@ Image Image::Crop(const Bounds2i &bounds, Allocator alloc) const {
     CHECK(bounds.pMin.x >= 0 && bounds.pMin.y >= 0);
     Image image(format, Point2i(bounds.pMax - bounds.pMin), channelNames, encoding,
                 alloc);
-    for (Point2i p : bounds)
-        for (int c = 0; c < NChannels(); ++c)
-            image.SetChannel(Point2i(p - bounds.pMin), c, GetChannel(p, c));
+    // Copy encoded values of the scanlines' pixels inside the image; the
+    // rest are found by clamping, as GetChannel() does.
+    auto copyPixels = [&](const auto &from, auto &to) {
+        int nc = NChannels();
+        ParallelFor(bounds.pMin.y, bounds.pMax.y, [&](int64_t y) {
+            int yIn = std::min<int>(y, resolution.y - 1);
+            size_t outOffset = image.PixelOffset({0, int(y - bounds.pMin.y)});
+            for (int x = bounds.pMin.x; x < bounds.pMax.x; ++x) {
+                size_t offset = PixelOffset({std::min(x, resolution.x - 1), yIn});
+                for (int c = 0; c < nc; ++c)
+                    to[outOffset++] = from[offset + c];
+            }
+        });
+    };
+    switch (format) {
+    case PixelFormat::U256:
+        copyPixels(p8, image.p8);
+        break;
+    case PixelFormat::Half:
+        copyPixels(p16, image.p16);
+        break;
+    case PixelFormat::Float:
+        copyPixels(p32, image.p32);
+        break;
+    default:
+        LOG_FATAL("Unhandled PixelFormat");
+    }
     return image;
 }
 
@@ -1311,57 +1585,178 @@ std::string Image::ToString() const {
                         encoding ? encoding.ToString().c_str() : "(nullptr)");
 }
 
+// Returns the PNG filter type for each scanline of the 8-bit image
+// _pixels_, choosing them in parallel with lodepng's default heuristic of
+// minimizing the sum of the absolute values of the filtered bytes.
+static std::vector<unsigned char> choosePNGFilters(const uint8_t *pixels,
+                                                   Point2i resolution, int nc) {
+    size_t stride = size_t(nc) * resolution.x;
+    std::vector<unsigned char> filters(resolution.y);
+    ParallelFor(0, resolution.y, [&](int64_t y) {
+        const uint8_t *row = pixels + y * stride;
+        const uint8_t *prev = (y > 0) ? row - stride : nullptr;
+        // Returns the cost of filtering the scanline with _predict_
+        auto cost = [&](bool signedCost, auto predict) {
+            uint64_t sum = 0;
+            for (size_t i = 0; i < stride; ++i) {
+                int a = (i >= nc) ? row[i - nc] : 0, b = prev ? prev[i] : 0;
+                int c = (prev && i >= nc) ? prev[i - nc] : 0;
+                uint8_t f = row[i] - predict(a, b, c);
+                sum += (signedCost && f >= 128) ? 256 - f : f;
+            }
+            return sum;
+        };
+        uint64_t sums[5] = {
+            cost(false, [](int a, int b, int c) { return 0; }),
+            cost(true, [](int a, int b, int c) { return a; }),
+            cost(true, [](int a, int b, int c) { return b; }),
+            cost(true, [](int a, int b, int c) { return (a + b) / 2; }),
+            cost(true, [](int a, int b, int c) {
+                int p = a + b - c;
+                int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+            })};
+        filters[y] = std::min_element(sums, sums + 5) - sums;
+    });
+    return filters;
+}
+
+// Compresses _in_ into a zlib stream for lodepng, deflating blocks of it in
+// parallel. Each block is primed with the end of the preceding one, so that
+// matches can refer back into it, and all but the last end with a sync
+// flush so that the blocks' outputs are byte-aligned and can be joined.
+static unsigned parallelZlibCompress(unsigned char **out, size_t *outSize,
+                                     const unsigned char *in, size_t inSize,
+                                     const LodePNGCompressSettings *settings) {
+    int level = *static_cast<const int *>(settings->custom_context);
+    constexpr size_t blockSize = 256 * 1024, windowSize = 32768;
+    size_t nBlocks = std::max<size_t>(1, (inSize + blockSize - 1) / blockSize);
+    std::vector<std::vector<unsigned char>> blocks(nBlocks);
+    std::vector<uLong> blockAdlers(nBlocks);
+    std::atomic<bool> failed{false};
+    ParallelFor(0, nBlocks, [&](int64_t i) {
+        size_t start = i * blockSize, size = std::min(blockSize, inSize - start);
+        z_stream stream = {};
+        if (deflateInit2(&stream, level, Z_DEFLATED, -15 /* raw deflate */, 8,
+                         Z_DEFAULT_STRATEGY) != Z_OK) {
+            failed = true;
+            return;
+        }
+        if (i > 0) {
+            size_t dictSize = std::min(windowSize, start);
+            deflateSetDictionary(&stream, in + start - dictSize, dictSize);
+        }
+        // Leave room for the sync flush's empty stored block
+        blocks[i].resize(deflateBound(&stream, size) + 16);
+        stream.next_in = const_cast<Bytef *>(in + start);
+        stream.avail_in = size;
+        stream.next_out = blocks[i].data();
+        stream.avail_out = blocks[i].size();
+        bool last = (i == nBlocks - 1);
+        int err = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+        if ((last && err != Z_STREAM_END) || (!last && err != Z_OK) ||
+            stream.avail_in > 0)
+            failed = true;
+        blocks[i].resize(stream.total_out);
+        deflateEnd(&stream);
+        blockAdlers[i] = adler32(adler32(0, nullptr, 0), in + start, size);
+    });
+    // zlib only fails for valid levels if it runs out of memory, so report
+    // lodepng's allocation failure error
+    if (failed)
+        return 83;
+
+    // Assemble zlib stream from header, compressed blocks, and checksum
+    size_t size = 6;
+    for (const std::vector<unsigned char> &block : blocks)
+        size += block.size();
+    unsigned char *data = static_cast<unsigned char *>(malloc(size));
+    if (!data)
+        return 83;
+    // The header's check bits make it a multiple of 31; its level field
+    // is informational.
+    int levelField = 2;
+    if (level >= 0)
+        levelField = (level < 2) ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3));
+    data[0] = 0x78;
+    data[1] = levelField << 6;
+    data[1] += 31 - (data[0] * 256 + data[1]) % 31;
+    size_t offset = 2;
+    uLong adler = blockAdlers[0];
+    for (size_t i = 0; i < nBlocks; ++i) {
+        std::copy(blocks[i].begin(), blocks[i].end(), data + offset);
+        offset += blocks[i].size();
+        if (i > 0) {
+            size_t blockStart = i * blockSize;
+            adler = adler32_combine(adler, blockAdlers[i],
+                                    std::min(blockSize, inSize - blockStart));
+        }
+    }
+    for (int i = 0; i < 4; ++i)
+        data[offset + i] = (adler >> (24 - 8 * i)) & 0xff;
+
+    *out = data;
+    *outSize = size;
+    return 0;
+}
+
 bool Image::WritePNG(const std::string &name, const ImageMetadata &metadata) const {
-    unsigned int error = 0;
-    int nOutOfGamut = 0;
-
-    if (format == PixelFormat::U256) {
-        if (NChannels() == 1)
-            error = lodepng_encode_file(name.c_str(), p8.data(), resolution.x,
-                                        resolution.y, LCT_GREY, 8 /* bitdepth */);
-        else if (NChannels() == 3)
-            // TODO: it would be nice to store the color encoding used in the
-            // PNG metadata...
-            error = lodepng_encode24_file(name.c_str(), p8.data(), resolution.x,
-                                          resolution.y);
-        else
-            LOG_FATAL("Unhandled channel count in WritePNG(): %d", NChannels());
-    } else if (NChannels() == 3) {
-        // It may not actually be RGB, but that's what PNG's going to
-        // assume..
-        std::unique_ptr<uint8_t[]> rgb8 =
-            std::make_unique<uint8_t[]>(3 * resolution.x * resolution.y);
-        for (int y = 0; y < resolution.y; ++y)
+    int nc = NChannels();
+    if (nc != 1 && nc != 3) {
+        Error("%s: unable to write PNG with %d channels.", name, nc);
+        return false;
+    }
+
+    // Encode non-8-bit pixel values as 8-bit sRGB in parallel
+    const uint8_t *pixels = p8.data();
+    std::vector<uint8_t> pixels8;
+    std::atomic<int> nOutOfGamut{0};
+    if (format != PixelFormat::U256) {
+        // For 3 channels, it may not actually be RGB, but that's what PNG's
+        // going to assume..
+        pixels8.resize(nc * resolution.x * resolution.y);
+        ParallelFor(0, resolution.y, [&](int64_t y) {
+            int n = 0;
             for (int x = 0; x < resolution.x; ++x)
-                for (int c = 0; c < 3; ++c) {
-                    Float dither = -.5f + BlueNoise(c, {x, y});
-                    Float v = GetChannel({x, y}, c);
+                for (int c = 0; c < nc; ++c) {
+                    Float dither = -.5f + BlueNoise(c, {x, int(y)});
+                    Float v = GetChannel({x, int(y)}, c);
                     if (v < 0 || v > 1)
-                        ++nOutOfGamut;
-                    rgb8[3 * (y * resolution.x + x) + c] = LinearToSRGB8(v, dither);
+                        ++n;
+                    pixels8[nc * (y * resolution.x + x) + c] = LinearToSRGB8(v, dither);
                 }
-
-        error =
-            lodepng_encode24_file(name.c_str(), rgb8.get(), resolution.x, resolution.y);
-    } else if (NChannels() == 1) {
-        std::unique_ptr<uint8_t[]> y8 =
-            std::make_unique<uint8_t[]>(resolution.x * resolution.y);
-        for (int y = 0; y < resolution.y; ++y)
-            for (int x = 0; x < resolution.x; ++x) {
-                Float dither = -.5f + BlueNoise(0, {x, y});
-                Float v = GetChannel({x, y}, 0);
-                if (v < 0 || v > 1)
-                    ++nOutOfGamut;
-                y8[y * resolution.x + x] = LinearToSRGB8(v, dither);
-            }
-
-        error = lodepng_encode_file(name.c_str(), y8.get(), resolution.x, resolution.y,
-                                    LCT_GREY, 8 /* bitdepth */);
+            nOutOfGamut += n;
+        });
+        pixels = pixels8.data();
     }
-
     if (nOutOfGamut > 0)
         Warning("%s: %d out of gamut pixel channels clamped to [0,1].", name,
-                nOutOfGamut);
+                int(nOutOfGamut));
+
+    // Encode PNG, filtering scanlines and compressing in parallel
+    // TODO: it would be nice to store the color encoding used in the PNG
+    // metadata...
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = (nc == 1) ? LCT_GREY : LCT_RGB;
+    state.info_raw.bitdepth = 8;
+    lodepng_color_mode_copy(&state.info_png.color, &state.info_raw);
+    state.encoder.auto_convert = 0;
+    std::vector<unsigned char> filters = choosePNGFilters(pixels, resolution, nc);
+    state.encoder.filter_strategy = LFS_PREDEFINED;
+    state.encoder.predefined_filters = filters.data();
+    int level = metadata.compressionLevel.value_or(Z_DEFAULT_COMPRESSION);
+    state.encoder.zlibsettings.custom_zlib = parallelZlibCompress;
+    state.encoder.zlibsettings.custom_context = &level;
+
+    unsigned char *png = nullptr;
+    size_t pngSize = 0;
+    unsigned error =
+        lodepng_encode(&png, &pngSize, pixels, resolution.x, resolution.y, &state);
+    if (error == 0)
+        error = lodepng_save_file(png, pngSize, name.c_str());
+    free(png);
+    lodepng_state_cleanup(&state);
 
     if (error != 0) {
         Error("Error writing PNG \"%s\": %s", name, lodepng_error_text(error));
@@ -1407,23 +1802,23 @@ static inline int isWhitespace(char c) {
     return static_cast<int>(c == ' ' || c == '\n' || c == '\t');
 }
 
-// Reads a "word" from the fp and puts it into buffer and adds a null
-// terminator.  i.e. it keeps reading until whitespace is reached.  Returns
-// the number of characters read *not* including the whitespace, and
-// returns -1 on an error.
-static int readWord(FILE *fp, char *buffer, int bufferLength) {
-    int n;
-    int c;
-
+// Reads a "word" from the file contents starting at *pos and puts it into
+// buffer and adds a null terminator.  i.e. it keeps reading until whitespace
+// is reached, which is consumed.  Returns the number of characters read
+// *not* including the whitespace, and returns -1 on an error.
+static int readWord(const uint8_t **pos, const uint8_t *end, char *buffer,
+                    int bufferLength) {
     if (bufferLength < 1)
         return -1;
 
-    n = 0;
-    c = fgetc(fp);
-    while (c != EOF && (isWhitespace(c) == 0) && n < bufferLength) {
-        buffer[n] = c;
-        ++n;
-        c = fgetc(fp);
+    int n = 0;
+    while (*pos < end) {
+        char c = *(*pos)++;
+        if (isWhitespace(c) != 0)
+            break;
+        if (n == bufferLength)
+            return -1;
+        buffer[n++] = c;
     }
 
     if (n < bufferLength) {
@@ -1435,20 +1830,19 @@ static int readWord(FILE *fp, char *buffer, int bufferLength) {
 }
 
 static ImageAndMetadata ReadPFM(const std::string &filename, Allocator alloc) {
-    pstd::vector<float> rgb32(alloc);
     char buffer[BUFFER_SIZE];
-    unsigned int nFloats;
     int nChannels, width, height;
     float scale;
-    bool fileLittleEndian;
     ImageMetadata metadata;
 
-    FILE *fp = fopen(filename.c_str(), "rb");
-    if (fp == nullptr)
-        ErrorExit("%s: unable to open PFM file", filename);
+    std::string error;
+    std::unique_ptr<MappedFile> file = MappedFile::Open(filename, &error);
+    if (!file)
+        ErrorExit("%s", error);
+    const uint8_t *pos = file->Data(), *end = pos + file->Size();
 
     // read either "Pf" or "PF"
-    if (readWord(fp, buffer, BUFFER_SIZE) == -1)
+    if (readWord(&pos, end, buffer, BUFFER_SIZE) == -1)
         ErrorExit("%s: unable to read PFM file", filename);
 
     if (strcmp(buffer, "Pf") == 0)
@@ -1461,47 +1855,49 @@ static ImageAndMetadata ReadPFM(const std::string &filename, Allocator alloc) {
 
     // read the rest of the header
     // read width
-    if (readWord(fp, buffer, BUFFER_SIZE) == -1)
-        goto fail;
+    if (readWord(&pos, end, buffer, BUFFER_SIZE) == -1)
+        ErrorExit("%s: premature end of file in PFM file", filename);
     if (!Atoi(buffer, &width))
         ErrorExit("%s: unable to decode width \"%s\"", filename, buffer);
 
     // read height
-    if (readWord(fp, buffer, BUFFER_SIZE) == -1)
-        goto fail;
+    if (readWord(&pos, end, buffer, BUFFER_SIZE) == -1)
+        ErrorExit("%s: premature end of file in PFM file", filename);
     if (!Atoi(buffer, &height))
         ErrorExit("%s: unable to decode height \"%s\"", filename, buffer);
 
     // read scale
-    if (readWord(fp, buffer, BUFFER_SIZE) == -1)
-        goto fail;
+    if (readWord(&pos, end, buffer, BUFFER_SIZE) == -1)
+        ErrorExit("%s: premature end of file in PFM file", filename);
     if (!Atof(buffer, &scale))
         ErrorExit("%s: unable to decode scale \"%s\"", filename, buffer);
 
-    // read the data
-    nFloats = nChannels * width * height;
-    rgb32.resize(nFloats);
-    for (int y = height - 1; y >= 0; --y)
-        if (fread(&rgb32[nChannels * y * width], sizeof(float), nChannels * width, fp) !=
-            nChannels * width)
-            goto fail;
-
-    // apply endian conversian and scale if appropriate
-    fileLittleEndian = (scale < 0.f);
-    if (hostLittleEndian ^ fileLittleEndian) {
-        uint8_t bytes[4];
-        for (unsigned int i = 0; i < nFloats; ++i) {
-            memcpy(bytes, &rgb32[i], 4);
-            pstd::swap(bytes[0], bytes[3]);
-            pstd::swap(bytes[1], bytes[2]);
-            memcpy(&rgb32[i], bytes, 4);
+    size_t rowFloats = size_t(nChannels) * width;
+    if (width < 0 || height < 0 || size_t(end - pos) < rowFloats * height * sizeof(float))
+        ErrorExit("%s: premature end of file in PFM file", filename);
+
+    // Copy the rows, which are stored bottom to top, directly into the
+    // image's buffer, applying endian conversion and scale if appropriate
+    pstd::vector<float> rgb32(rowFloats * height, alloc);
+    bool fileLittleEndian = (scale < 0.f);
+    ParallelFor(0, height, [&](int64_t y) {
+        float *row = &rgb32[rowFloats * y];
+        memcpy(row, pos + (height - 1 - y) * rowFloats * sizeof(float),
+               rowFloats * sizeof(float));
+        if (hostLittleEndian ^ fileLittleEndian) {
+            uint8_t bytes[4];
+            for (size_t i = 0; i < rowFloats; ++i) {
+                memcpy(bytes, &row[i], 4);
+                pstd::swap(bytes[0], bytes[3]);
+                pstd::swap(bytes[1], bytes[2]);
+                memcpy(&row[i], bytes, 4);
+            }
         }
-    }
-    if (std::abs(scale) != 1.f)
-        for (unsigned int i = 0; i < nFloats; ++i)
-            rgb32[i] *= std::abs(scale);
+        if (std::abs(scale) != 1.f)
+            for (size_t i = 0; i < rowFloats; ++i)
+                row[i] *= std::abs(scale);
+    });
 
-    fclose(fp);
     LOG_VERBOSE("Read PFM image %s (%d x %d)", filename, width, height);
     metadata.colorSpace = RGBColorSpace::sRGB;
     if (nChannels == 1)
@@ -1510,11 +1906,6 @@ static ImageAndMetadata ReadPFM(const std::string &filename, Allocator alloc) {
     else
         return ImageAndMetadata{Image(std::move(rgb32), {width, height}, {"R", "G", "B"}),
                                 metadata};
-
-fail:
-    if (fp != nullptr)
-        fclose(fp);
-    ErrorExit("%s: premature end of file in PFM file", filename);
 }
 
 static ImageAndMetadata ReadHDR(const std::string &filename, Allocator alloc) {
@@ -1531,7 +1922,7 @@ static ImageAndMetadata ReadHDR(const std::string &filename, Allocator alloc) {
         return ImageAndMetadata{Image(std::move(pixels), {x, y}, {"Y"}), ImageMetadata()};
     case 2: {
         Image image(std::move(pixels), {x, y}, {"Y", "A"});
-        return ImageAndMetadata{image.SelectChannels(image.GetChannelDesc({"Y"})),
+        return ImageAndMetadata{image.SelectChannels(image.GetChannelDesc({"Y"}), alloc),
                                 ImageMetadata()};
     }
     case 3:
@@ -1540,7 +1931,8 @@ static ImageAndMetadata ReadHDR(const std::string &filename, Allocator alloc) {
     case 4: {
         Image image(std::move(pixels), {x, y}, {"R", "G", "B", "A"});
         return ImageAndMetadata{
-            image.SelectChannels(image.GetChannelDesc({"R", "G", "B"})), ImageMetadata()};
+            image.SelectChannels(image.GetChannelDesc({"R", "G", "B"}), alloc),
+            ImageMetadata()};
     }
     default:
         ErrorExit("%s: %d channel image unsupported.", filename, n);
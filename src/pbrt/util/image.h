@@ -19,6 +19,9 @@
 #include <cstdint>
 #include <cstring>
 #include <map>
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 namespace pbrt {
@@ -159,6 +162,9 @@ struct ImageMetadata {
     pstd::optional<float> MSE;
     pstd::optional<const RGBColorSpace *> colorSpace;
     std::map<std::string, std::vector<std::string>> stringVectors;
+    // zlib compression level, from 0 to 9, for writing PNG images; zero
+    // also writes EXR images uncompressed. It isn't stored in the file.
+    pstd::optional<int> compressionLevel;
 };
 
 struct ImageAndMetadata;
@@ -323,6 +329,10 @@ class Image {
     ImageChannelValues MRSE(const ImageChannelDesc &desc, const Image &ref,
                             Image *mrseImage = nullptr) const;
 
+    // Convolves the _desc_ channels in x and then in y with _kernel_, which
+    // has an odd number of taps and is centered; large kernels are applied
+    // using FFTs.
+    Image Convolve(const ImageChannelDesc &desc, pstd::span<const Float> kernel) const;
     Image GaussianFilter(const ImageChannelDesc &desc, int halfWidth, Float sigma) const;
 
     template <typename F>
@@ -466,6 +476,44 @@ struct ImageAndMetadata {
     ImageMetadata metadata;
 };
 
+// Writes each image to a separate part of a multi-part EXR file with the
+// given part name; all of the parts' headers store _metadata_. The images
+// must all have the same resolution.
+bool WriteMultiPartEXR(const std::string &filename,
+                       const std::vector<std::pair<std::string, const Image *>> &parts,
+                       const ImageMetadata &metadata);
+
+// TiledEXRWriter Definition
+// Writes an EXR file one tile at a time, in any order, so that the entire
+// image never needs to be in memory. Tiles are numbered starting from the
+// image's pixel bounds' minimum, which _metadata_ must provide. The file is
+// complete once the writer is destroyed.
+class TiledEXRWriter {
+  public:
+    // TiledEXRWriter Public Methods
+    TiledEXRWriter(const std::string &filename, PixelFormat format,
+                   std::vector<std::string> channelNames, int tileSize,
+                   const ImageMetadata &metadata);
+    ~TiledEXRWriter();
+
+    Point2i NumTiles() const;
+    Bounds2i TileBounds(Point2i tile) const;
+
+    // _image_ must have the format and channels given to the constructor
+    // and the resolution of the tile's bounds.
+    void WriteTile(Point2i tile, const Image &image);
+
+  private:
+    // TiledEXRWriter Private Members
+    struct EXRFile;
+    std::unique_ptr<EXRFile> file;
+    std::string filename;
+    PixelFormat format;
+    std::vector<std::string> channelNames;
+    int tileSize;
+    Bounds2i pixelBounds;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_IMAGE_H
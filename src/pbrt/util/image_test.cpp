@@ -6,6 +6,7 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/options.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/file.h>
@@ -21,6 +22,10 @@
 
 using namespace pbrt;
 
+static std::string inTestDir(const std::string &path) {
+    return path;
+}
+
 // TODO:
 // for png i/o: test mono and rgb; make sure mono is smaller
 // pixel bounds stuff... (including i/o paths...)
@@ -457,6 +462,45 @@ TEST(Image, ExrMetadata) {
     EXPECT_EQ(0, remove(filename.c_str()));
 }
 
+TEST(Image, TiledEXRWriter) {
+    // Neither dimension of the image is a multiple of the tile size
+    Bounds2i pixelBounds(Point2i(5, 2), Point2i(42, 25));
+    Point2i res(pixelBounds.Diagonal());
+    pstd::vector<float> rgbPixels = GetFloatPixels(res, 3);
+    Image image(rgbPixels, res, {"R", "G", "B"});
+
+    std::string filename = inTestDir("tiled.exr");
+    ImageMetadata metadata;
+    metadata.pixelBounds = pixelBounds;
+    metadata.fullResolution = Point2i(50, 30);
+    {
+        TiledEXRWriter writer(filename, PixelFormat::Float, {"R", "G", "B"}, 8,
+                              metadata);
+        Point2i nTiles = writer.NumTiles();
+        EXPECT_EQ(Point2i(5, 3), nTiles);
+
+        // Write the tiles in reverse order
+        for (int ty = nTiles.y - 1; ty >= 0; --ty)
+            for (int tx = nTiles.x - 1; tx >= 0; --tx) {
+                Bounds2i b = writer.TileBounds(Point2i(tx, ty));
+                Image tile = image.Crop(Bounds2i(Point2i(b.pMin - pixelBounds.pMin),
+                                                 Point2i(b.pMax - pixelBounds.pMin)));
+                writer.WriteTile(Point2i(tx, ty), tile);
+            }
+    }
+
+    ImageAndMetadata read = Image::Read(filename);
+    EXPECT_EQ(res, read.image.Resolution());
+    EXPECT_EQ(pixelBounds, *read.metadata.pixelBounds);
+    EXPECT_EQ(Point2i(50, 30), *read.metadata.fullResolution);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_EQ(image.GetChannel({x, y}, c), read.image.GetChannel({x, y}, c));
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
 TEST(Image, PngRgbIO) {
     Point2i res(11, 50);
     pstd::vector<float> rgbPixels = GetFloatPixels(res, 3);
@@ -615,12 +659,113 @@ TEST(Image, Select) {
         }
 }
 
-///////////////////////////////////////////////////////////////////////////
+TEST(Image, ConvertAndCrop) {
+    Point2i res(37, 21);
+    pstd::vector<float> pix = GetFloatPixels(res, 3);
+    Image image(pix, res, {"R", "G", "B"});
 
-static std::string inTestDir(const std::string &path) {
-    return path;
+    for (auto format : {PixelFormat::U256, PixelFormat::Half, PixelFormat::Float}) {
+        // Converted values should match converting each value in turn
+        Image converted = image.ConvertToFormat(format, ColorEncodingHandle::sRGB);
+        Image expected(format, res, {"R", "G", "B"}, ColorEncodingHandle::sRGB);
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x)
+                for (int c = 0; c < 3; ++c)
+                    expected.SetChannel({x, y}, c, image.GetChannel({x, y}, c));
+        for (int y = 0; y < res.y; ++y)
+            for (int x = 0; x < res.x; ++x)
+                for (int c = 0; c < 3; ++c)
+                    EXPECT_EQ(expected.GetChannel({x, y}, c),
+                              converted.GetChannel({x, y}, c));
+
+        // Cropped values, including ones past the edge of the image, should
+        // match the original image's
+        Bounds2i bounds(Point2i(5, 3), Point2i(40, 25));
+        Image cropped = converted.Crop(bounds);
+        EXPECT_EQ(Point2i(35, 22), cropped.Resolution());
+        for (Point2i p : bounds)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_EQ(converted.GetChannel(p, c),
+                          cropped.GetChannel(Point2i(p - bounds.pMin), c));
+    }
+}
+
+TEST(MIPMap, TiledMatchesResident) {
+    // The 1MB budget is smaller than the pyramid, so tiles are evicted and
+    // reloaded as the lookups proceed.
+    Point2i res(512, 256);
+    pstd::vector<float> pix = GetFloatPixels(res, 3);
+    Image floatImage(pix, res, {"R", "G", "B"});
+    int origBudget = Options->textureBudgetMB;
+
+    for (PixelFormat format :
+         {PixelFormat::Float, PixelFormat::Half, PixelFormat::U256}) {
+        Image image = floatImage.ConvertToFormat(format, ColorEncodingHandle::sRGB);
+        for (WrapMode wrapMode : {WrapMode::Repeat, WrapMode::Clamp, WrapMode::Black})
+            for (FilterFunction filter :
+                 {FilterFunction::Point, FilterFunction::Bilinear,
+                  FilterFunction::Trilinear, FilterFunction::EWA}) {
+                MIPMapFilterOptions options;
+                options.filter = filter;
+                Options->textureBudgetMB = 0;
+                MIPMap resident(image, RGBColorSpace::sRGB, wrapMode, {}, options);
+                Options->textureBudgetMB = 1;
+                MIPMap tiled(image, RGBColorSpace::sRGB, wrapMode, {}, options);
+
+                ASSERT_EQ(resident.Levels(), tiled.Levels());
+                RNG rng;
+                for (int i = 0; i < 1000; ++i) {
+                    Point2f st(-0.5f + 2 * rng.Uniform<Float>(),
+                               -0.5f + 2 * rng.Uniform<Float>());
+                    Float width = std::pow(2.f, -10 * rng.Uniform<Float>());
+                    Vector2f dst0(width * rng.Uniform<Float>(),
+                                  width * rng.Uniform<Float>());
+                    Vector2f dst1(-dst0.y / 2, dst0.x / 2);
+                    EXPECT_EQ(resident.Filter<RGB>(st, dst0, dst1),
+                              tiled.Filter<RGB>(st, dst0, dst1));
+                    EXPECT_EQ(resident.Filter<Float>(st, dst0, dst1),
+                              tiled.Filter<Float>(st, dst0, dst1));
+                }
+            }
+    }
+
+    Options->textureBudgetMB = origBudget;
 }
 
+TEST(MIPMap, PyramidFileRoundTrip) {
+    Point2i res(200, 130);
+    pstd::vector<float> pix = GetFloatPixels(res, 3);
+    Image image(pix, res, {"R", "G", "B"});
+    MIPMap mipmap(image, RGBColorSpace::sRGB, WrapMode::Clamp, {}, {});
+    std::string filename = inTestDir("pyramid.mip");
+    ASSERT_TRUE(mipmap.Write(filename));
+
+    // Check lookups both with the pyramid read into memory and with its tiles
+    // used through the texture tile cache.
+    int origBudget = Options->textureBudgetMB;
+    for (int budget : {0, 1}) {
+        Options->textureBudgetMB = budget;
+        MIPMap *read = MIPMap::CreateFromFile(filename, {}, WrapMode::Clamp, nullptr, {});
+        ASSERT_EQ(mipmap.Levels(), read->Levels());
+        for (int level = 0; level < mipmap.Levels(); ++level)
+            EXPECT_EQ(mipmap.LevelResolution(level), read->LevelResolution(level));
+
+        RNG rng;
+        for (int i = 0; i < 1000; ++i) {
+            Point2f st(rng.Uniform<Float>(), rng.Uniform<Float>());
+            Float width = std::pow(2.f, -8 * rng.Uniform<Float>());
+            Vector2f dst0(width, 0), dst1(0, width);
+            EXPECT_EQ(mipmap.Filter<RGB>(st, dst0, dst1),
+                      read->Filter<RGB>(st, dst0, dst1));
+        }
+    }
+    Options->textureBudgetMB = origBudget;
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
+
+///////////////////////////////////////////////////////////////////////////
+
 static void TestRoundTrip(const char *fn) {
     Point2i res(16, 29);
     Image image(PixelFormat::Float, res, {"R", "G", "B"});
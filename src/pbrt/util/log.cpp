@@ -7,6 +7,9 @@
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/parallel.h>
+#ifdef PBRT_BUILD_GPU_RENDERER
+#include <pbrt/gpu/init.h>
+#endif  // PBRT_BUILD_GPU_RENDERER
 
 #include <stdio.h>
 #include <ctime>
@@ -66,8 +69,10 @@ void InitLogging(LogLevel level, bool useGPU) {
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     if (useGPU)
-        CUDA_CHECK(cudaMemcpyToSymbol(LOGGING_LogLevelGPU, &LOGGING_LogLevel,
-                                      sizeof(LOGGING_LogLevel)));
+        ForEachGPURenderDevice([]() {
+            CUDA_CHECK(cudaMemcpyToSymbol(LOGGING_LogLevelGPU, &LOGGING_LogLevel,
+                                          sizeof(LOGGING_LogLevel)));
+        });
 #endif
 }
 
@@ -6,118 +6,72 @@
 
 #include <pbrt/util/containers.h>
 #include <pbrt/util/error.h>
-#include <pbrt/util/memory.h>
 #include <pbrt/util/mesh.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/pstd.h>
+#include <pbrt/util/stats.h>
 #include <pbrt/util/transform.h>
 #include <pbrt/util/vecmath.h>
 
-#include <map>
-#include <set>
+#include <algorithm>
+#include <utility>
 
 namespace pbrt {
 
-struct SDFace;
-struct SDVertex;
+STAT_COUNTER("Geometry/Loop subdivision edges split", nEdgesSplit);
 
 // LoopSubdiv Macros
 #define NEXT(i) (((i) + 1) % 3)
 #define PREV(i) (((i) + 2) % 3)
 
 // LoopSubdiv Local Structures
-struct SDVertex {
-    // SDVertex Constructor
-    SDVertex(const Point3f &p = Point3f(0, 0, 0)) : p(p) {}
-
-    // SDVertex Methods
-    int valence();
-    void oneRing(Point3f *p);
-    Point3f p;
-    SDFace *startFace = nullptr;
-    SDVertex *child = nullptr;
-    bool regular = false, boundary = false;
-};
-
-struct SDFace {
-    // SDFace Constructor
-    SDFace() {
-        for (int i = 0; i < 3; ++i) {
-            v[i] = nullptr;
-            f[i] = nullptr;
-        }
-        for (int i = 0; i < 4; ++i)
-            children[i] = nullptr;
+// Triangle mesh stored in flat arrays along with the neighbor of each face
+// across each of its edges; edge _k_ of a face goes from its _k_th vertex
+// to its _NEXT(k)_th vertex.
+struct LoopMesh {
+    // LoopMesh Public Methods
+    LoopMesh(std::vector<int> indices, std::vector<Point3f> p)
+        : indices(std::move(indices)), p(std::move(p)) {
+        ComputeAdjacency();
     }
 
-    // SDFace Methods
-    int vnum(SDVertex *vert) const {
+    size_t NumFaces() const { return indices.size() / 3; }
+
+    int VertexNum(int face, int v) const {
         for (int i = 0; i < 3; ++i)
-            if (v[i] == vert)
+            if (indices[3 * face + i] == v)
                 return i;
-        LOG_FATAL("Basic logic error in SDFace::vnum()");
+        LOG_FATAL("Basic logic error in LoopMesh::VertexNum()");
         return -1;
     }
-    SDFace *nextFace(SDVertex *vert) { return f[vnum(vert)]; }
-    SDFace *prevFace(SDVertex *vert) { return f[PREV(vnum(vert))]; }
-    SDVertex *nextVert(SDVertex *vert) { return v[NEXT(vnum(vert))]; }
-    SDVertex *prevVert(SDVertex *vert) { return v[PREV(vnum(vert))]; }
-    SDVertex *otherVert(SDVertex *v0, SDVertex *v1) {
-        for (int i = 0; i < 3; ++i)
-            if (v[i] != v0 && v[i] != v1)
-                return v[i];
-        LOG_FATAL("Basic logic error in SDVertex::otherVert()");
-        return nullptr;
+    int NextFace(int face, int v) const {
+        return neighbors[3 * face + VertexNum(face, v)];
     }
-    SDVertex *v[3];
-    SDFace *f[3];
-    SDFace *children[4];
-};
-
-struct SDEdge {
-    // SDEdge Constructor
-    SDEdge(SDVertex *v0 = nullptr, SDVertex *v1 = nullptr) {
-        v[0] = std::min(v0, v1);
-        v[1] = std::max(v0, v1);
-        f[0] = f[1] = nullptr;
-        f0edgeNum = -1;
+    int PrevFace(int face, int v) const {
+        return neighbors[3 * face + PREV(VertexNum(face, v))];
     }
-
-    // SDEdge Comparison Function
-    bool operator<(const SDEdge &e2) const {
-        if (v[0] == e2.v[0])
-            return v[1] < e2.v[1];
-        return v[0] < e2.v[0];
+    int NextVertex(int face, int v) const {
+        return indices[3 * face + NEXT(VertexNum(face, v))];
+    }
+    int PrevVertex(int face, int v) const {
+        return indices[3 * face + PREV(VertexNum(face, v))];
     }
-    SDVertex *v[2];
-    SDFace *f[2];
-    int f0edgeNum;
-};
 
-// LoopSubdiv Local Declarations
-static Point3f weightOneRing(SDVertex *vert, Float beta);
-static Point3f weightBoundary(SDVertex *vert, Float beta);
+    int Valence(int v, bool *boundary) const;
+    void OneRing(int v, bool boundary, Point3f *pRing) const;
+    Point3f WeightOneRing(int v, int valence, Float beta) const;
+    Point3f WeightBoundary(int v, int valence, Float beta) const;
 
-// LoopSubdiv Inline Functions
-inline int SDVertex::valence() {
-    SDFace *f = startFace;
-    if (!boundary) {
-        // Compute valence of interior vertex
-        int nf = 1;
-        while ((f = f->nextFace(this)) != startFace)
-            ++nf;
-        return nf;
-    } else {
-        // Compute valence of boundary vertex
-        int nf = 1;
-        while ((f = f->nextFace(this)) != nullptr)
-            ++nf;
-        f = startFace;
-        while ((f = f->prevFace(this)) != nullptr)
-            ++nf;
-        return nf + 1;
-    }
-}
+    // LoopMesh Public Members
+    std::vector<int> indices, neighbors, vertexFace;
+    std::vector<Point3f> p;
+
+  private:
+    // LoopMesh Private Methods
+    void ComputeAdjacency();
+};
 
+// LoopSubdiv Inline Functions
 inline Float beta(int valence) {
     if (valence == 3)
         return 3.f / 16.f;
@@ -129,211 +83,297 @@ inline Float loopGamma(int valence) {
     return 1.f / (valence + 3.f / (8.f * beta(valence)));
 }
 
-// LoopSubdiv Function Definitions
-TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrientation,
-                            int nLevels, pstd::span<const int> vertexIndices,
-                            pstd::span<const Point3f> p, Allocator alloc) {
-    std::vector<SDVertex *> vertices;
-    std::vector<SDFace *> faces;
-    // Allocate _LoopSubdiv_ vertices and faces
-    std::unique_ptr<SDVertex[]> verts = std::make_unique<SDVertex[]>(p.size());
-    for (int i = 0; i < p.size(); ++i) {
-        verts[i] = SDVertex(p[i]);
-        vertices.push_back(&verts[i]);
-    }
-    size_t nFaces = vertexIndices.size() / 3;
-    std::unique_ptr<SDFace[]> fs = std::make_unique<SDFace[]>(nFaces);
-    for (int i = 0; i < nFaces; ++i)
-        faces.push_back(&fs[i]);
-
-    // Set face to vertex pointers
-    const int *vp = vertexIndices.data();
-    for (size_t i = 0; i < nFaces; ++i, vp += 3) {
-        SDFace *f = faces[i];
-        for (int j = 0; j < 3; ++j) {
-            SDVertex *v = vertices[vp[j]];
-            f->v[j] = v;
-            v->startFace = f;
+// LoopMesh Method Definitions
+void LoopMesh::ComputeAdjacency() {
+    // Sort face edges so that the two sides of each edge are adjacent
+    size_t nFaces = NumFaces();
+    std::vector<std::pair<uint64_t, int>> edges(3 * nFaces);
+    ParallelFor(0, nFaces, [&](int64_t face) {
+        for (int k = 0; k < 3; ++k) {
+            uint64_t v0 = indices[3 * face + k], v1 = indices[3 * face + NEXT(k)];
+            edges[3 * face + k] = {(std::min(v0, v1) << 32) | std::max(v0, v1),
+                                   int(3 * face + k)};
         }
-    }
-
-    // Set neighbor pointers in _faces_
-    std::set<SDEdge> edges;
-    for (int i = 0; i < nFaces; ++i) {
-        SDFace *f = faces[i];
-        for (int edgeNum = 0; edgeNum < 3; ++edgeNum) {
-            // Update neighbor pointer for _edgeNum_
-            int v0 = edgeNum, v1 = NEXT(edgeNum);
-            SDEdge e(f->v[v0], f->v[v1]);
-            if (edges.find(e) == edges.end()) {
-                // Handle new edge
-                e.f[0] = f;
-                e.f0edgeNum = edgeNum;
-                edges.insert(e);
-            } else {
-                // Handle previously seen edge
-                e = *edges.find(e);
-                e.f[0]->f[e.f0edgeNum] = f;
-                f->f[edgeNum] = e.f[0];
-                edges.erase(e);
+    });
+    std::sort(edges.begin(), edges.end());
+
+    // Set neighbors of edges shared by two consistently oriented faces
+    neighbors.assign(3 * nFaces, -1);
+    for (size_t i = 0; i < edges.size();) {
+        size_t end = i + 1;
+        while (end < edges.size() && edges[end].first == edges[i].first)
+            ++end;
+        if (end - i == 2) {
+            int e0 = edges[i].second, e1 = edges[i + 1].second;
+            int f0 = e0 / 3, f1 = e1 / 3;
+            if (indices[e0] == indices[3 * f1 + NEXT(e1 % 3)] && f0 != f1) {
+                neighbors[e0] = f1;
+                neighbors[e1] = f0;
             }
         }
+        i = end;
     }
 
-    // Finish vertex initialization
-    for (size_t i = 0; i < p.size(); ++i) {
-        SDVertex *v = vertices[i];
-        SDFace *f = v->startFace;
+    vertexFace.assign(p.size(), -1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        vertexFace[indices[i]] = i / 3;
+}
+
+int LoopMesh::Valence(int v, bool *boundary) const {
+    int startFace = vertexFace[v], f = startFace;
+    // Count faces around _v_, stopping if there's a boundary
+    int nf = 1;
+    while ((f = NextFace(f, v)) != startFace && f != -1)
+        ++nf;
+    *boundary = (f == -1);
+    if (!*boundary)
+        return nf;
+
+    // Count remaining faces around boundary vertex
+    f = startFace;
+    while ((f = PrevFace(f, v)) != -1)
+        ++nf;
+    return nf + 1;
+}
+
+void LoopMesh::OneRing(int v, bool boundary, Point3f *pRing) const {
+    int startFace = vertexFace[v];
+    if (!boundary) {
+        // Get one-ring vertices for interior vertex
+        int face = startFace;
         do {
-            f = f->nextFace(v);
-        } while ((f != nullptr) && f != v->startFace);
-        v->boundary = (f == nullptr);
-        if (!v->boundary && v->valence() == 6)
-            v->regular = true;
-        else if (v->boundary && v->valence() == 4)
-            v->regular = true;
-        else
-            v->regular = false;
+            *pRing++ = p[NextVertex(face, v)];
+            face = NextFace(face, v);
+        } while (face != startFace);
+    } else {
+        // Get one-ring vertices for boundary vertex
+        int face = startFace, f2;
+        while ((f2 = NextFace(face, v)) != -1)
+            face = f2;
+        *pRing++ = p[NextVertex(face, v)];
+        do {
+            *pRing++ = p[PrevVertex(face, v)];
+            face = PrevFace(face, v);
+        } while (face != -1);
     }
+}
 
-    // Refine _LoopSubdiv_ into triangles
-    std::vector<SDFace *> f = faces;
-    std::vector<SDVertex *> v = vertices;
-    pstd::pmr::monotonic_buffer_resource resource;
-    Allocator vertexFaceAllocator(&resource);
+Point3f LoopMesh::WeightOneRing(int v, int valence, Float beta) const {
+    InlinedVector<Point3f, 16> pRing(valence);
+    OneRing(v, false, pRing.data());
+    Point3f pw = (1 - valence * beta) * p[v];
+    for (int i = 0; i < valence; ++i)
+        pw += beta * pRing[i];
+    return pw;
+}
 
-    for (int i = 0; i < nLevels; ++i) {
-        // Update _f_ and _v_ for next level of subdivision
-        std::vector<SDFace *> newFaces;
-        std::vector<SDVertex *> newVertices;
-
-        // Allocate next level of children in mesh tree
-        for (SDVertex *vertex : v) {
-            vertex->child = vertexFaceAllocator.new_object<SDVertex>();
-            vertex->child->regular = vertex->regular;
-            vertex->child->boundary = vertex->boundary;
-            newVertices.push_back(vertex->child);
-        }
-        for (SDFace *face : f) {
-            for (int k = 0; k < 4; ++k) {
-                face->children[k] = vertexFaceAllocator.new_object<SDFace>();
-                newFaces.push_back(face->children[k]);
-            }
-        }
+Point3f LoopMesh::WeightBoundary(int v, int valence, Float beta) const {
+    InlinedVector<Point3f, 16> pRing(valence);
+    OneRing(v, true, pRing.data());
+    Point3f pw = (1 - 2 * beta) * p[v];
+    pw += beta * pRing[0];
+    pw += beta * pRing[valence - 1];
+    return pw;
+}
 
-        // Update vertex positions and create new edge vertices
-
-        // Update vertex positions for even vertices
-        for (SDVertex *vertex : v) {
-            if (!vertex->boundary) {
-                // Apply one-ring rule for even vertex
-                if (vertex->regular)
-                    vertex->child->p = weightOneRing(vertex, 1.f / 16.f);
-                else
-                    vertex->child->p = weightOneRing(vertex, beta(vertex->valence()));
-            } else {
-                // Apply boundary rule for even vertex
-                vertex->child->p = weightBoundary(vertex, 1.f / 8.f);
-            }
+// LoopSubdiv Local Functions
+// Returns the mesh after one level of subdivision of the edges for which
+// _splitEdge_ returns true, or all of them if it's empty. Triangles with
+// only some of their edges split are divided into two or three triangles.
+static pstd::optional<LoopMesh> Subdivide(
+    const LoopMesh &mesh, const Transform &renderFromObject,
+    const std::function<bool(Point3f, Point3f)> &splitEdge) {
+    size_t nFaces = mesh.NumFaces(), nVertices = mesh.p.size();
+    // Assign each edge to one of its faces and decide which edges to split
+    std::vector<int> edgeVertex(3 * nFaces, -1);
+    ParallelFor(0, nFaces, [&](int64_t face) {
+        for (int k = 0; k < 3; ++k) {
+            int neighbor = mesh.neighbors[3 * face + k];
+            if (neighbor != -1 && neighbor < face)
+                continue;
+            Point3f p0 = mesh.p[mesh.indices[3 * face + k]];
+            Point3f p1 = mesh.p[mesh.indices[3 * face + NEXT(k)]];
+            if (!splitEdge || splitEdge(renderFromObject(p0), renderFromObject(p1)))
+                edgeVertex[3 * face + k] = 0;
         }
-
-        // Compute new odd edge vertices
-        std::map<SDEdge, SDVertex *> edgeVerts;
-        for (SDFace *face : f) {
-            for (int k = 0; k < 3; ++k) {
-                // Compute odd vertex on _k_th edge
-                SDEdge edge(face->v[k], face->v[NEXT(k)]);
-                SDVertex *vert = edgeVerts[edge];
-                if (vert == nullptr) {
-                    // Create and initialize new odd vertex
-                    vert = vertexFaceAllocator.new_object<SDVertex>();
-                    newVertices.push_back(vert);
-                    vert->regular = true;
-                    vert->boundary = (face->f[k] == nullptr);
-                    vert->startFace = face->children[3];
-
-                    // Apply edge rules to compute new vertex position
-                    if (vert->boundary) {
-                        vert->p = 0.5f * edge.v[0]->p;
-                        vert->p += 0.5f * edge.v[1]->p;
-                    } else {
-                        vert->p = 3.f / 8.f * edge.v[0]->p;
-                        vert->p += 3.f / 8.f * edge.v[1]->p;
-                        vert->p += 1.f / 8.f * face->otherVert(edge.v[0], edge.v[1])->p;
-                        vert->p +=
-                            1.f / 8.f * face->f[k]->otherVert(edge.v[0], edge.v[1])->p;
-                    }
-                    edgeVerts[edge] = vert;
-                }
-            }
+    });
+
+    // Number the new odd vertices after the even ones
+    int nNewVertices = nVertices;
+    for (int &ev : edgeVertex)
+        if (ev == 0)
+            ev = nNewVertices++;
+    if (nNewVertices == nVertices)
+        return {};
+    nEdgesSplit += nNewVertices - nVertices;
+
+    // Set odd vertices of edges that are assigned to neighbor faces
+    ParallelFor(0, nFaces, [&](int64_t face) {
+        for (int k = 0; k < 3; ++k) {
+            int neighbor = mesh.neighbors[3 * face + k];
+            if (neighbor == -1 || neighbor > face)
+                continue;
+            // The neighbor's side of the edge starts at its second vertex
+            int v1 = mesh.indices[3 * face + NEXT(k)];
+            edgeVertex[3 * face + k] =
+                edgeVertex[3 * neighbor + mesh.VertexNum(neighbor, v1)];
         }
-
-        // Update new mesh topology
-
-        // Update even vertex face pointers
-        for (SDVertex *vertex : v) {
-            int vertNum = vertex->startFace->vnum(vertex);
-            vertex->child->startFace = vertex->startFace->children[vertNum];
+    });
+
+    std::vector<Point3f> newP(nNewVertices);
+    // Update vertex positions for even vertices
+    ParallelFor(0, nVertices, [&](int64_t v) {
+        int startFace = mesh.vertexFace[v];
+        newP[v] = mesh.p[v];
+        if (startFace == -1)
+            return;
+        bool boundary;
+        int valence = mesh.Valence(v, &boundary);
+        if (splitEdge) {
+            // Leave vertices where no edges were split in place
+            bool anySplit = false;
+            auto checkFace = [&](int face) {
+                int vnum = mesh.VertexNum(face, v);
+                anySplit |= edgeVertex[3 * face + vnum] != -1 ||
+                            edgeVertex[3 * face + PREV(vnum)] != -1;
+            };
+            int face = startFace;
+            do {
+                checkFace(face);
+                face = mesh.NextFace(face, v);
+            } while (face != startFace && face != -1);
+            face = startFace;
+            while (boundary && (face = mesh.PrevFace(face, v)) != -1)
+                checkFace(face);
+            if (!anySplit)
+                return;
         }
-
-        // Update face neighbor pointers
-        for (SDFace *face : f) {
-            for (int j = 0; j < 3; ++j) {
-                // Update children _f_ pointers for siblings
-                face->children[3]->f[j] = face->children[NEXT(j)];
-                face->children[j]->f[NEXT(j)] = face->children[3];
-
-                // Update children _f_ pointers for neighbor children
-                SDFace *f2 = face->f[j];
-                face->children[j]->f[j] =
-                    f2 != nullptr ? f2->children[f2->vnum(face->v[j])] : nullptr;
-                f2 = face->f[PREV(j)];
-                face->children[j]->f[PREV(j)] =
-                    f2 != nullptr ? f2->children[f2->vnum(face->v[j])] : nullptr;
+        if (!boundary)
+            // Apply one-ring rule for even vertex
+            newP[v] = mesh.WeightOneRing(v, valence, beta(valence));
+        else
+            // Apply boundary rule for even vertex
+            newP[v] = mesh.WeightBoundary(v, valence, 1.f / 8.f);
+    });
+
+    // Compute new odd edge vertices
+    ParallelFor(0, nFaces, [&](int64_t face) {
+        for (int k = 0; k < 3; ++k) {
+            int neighbor = mesh.neighbors[3 * face + k];
+            int vert = edgeVertex[3 * face + k];
+            if (vert == -1 || (neighbor != -1 && neighbor < face))
+                continue;
+            // Apply edge rules to compute new vertex position
+            Point3f p0 = mesh.p[mesh.indices[3 * face + k]];
+            Point3f p1 = mesh.p[mesh.indices[3 * face + NEXT(k)]];
+            if (neighbor == -1)
+                newP[vert] = 0.5f * p0 + 0.5f * p1;
+            else {
+                Point3f p2 = mesh.p[mesh.indices[3 * face + PREV(k)]];
+                Point3f p3 = mesh.p[mesh.NextVertex(neighbor, mesh.indices[3 * face + k])];
+                newP[vert] = 3.f / 8.f * p0;
+                newP[vert] += 3.f / 8.f * p1;
+                newP[vert] += 1.f / 8.f * p2;
+                newP[vert] += 1.f / 8.f * p3;
             }
         }
+    });
+
+    // Find where each face's children start in the new index buffer
+    std::vector<int> childOffset(nFaces + 1, 0);
+    for (size_t face = 0; face < nFaces; ++face) {
+        int nSplit = 0;
+        for (int k = 0; k < 3; ++k)
+            nSplit += edgeVertex[3 * face + k] != -1;
+        childOffset[face + 1] = childOffset[face] + nSplit + 1;
+    }
 
-        // Update face vertex pointers
-        for (SDFace *face : f) {
-            for (int j = 0; j < 3; ++j) {
-                // Update child vertex pointer to new even vertex
-                face->children[j]->v[j] = face->v[j]->child;
-
-                // Update child vertex pointer to new odd vertex
-                SDVertex *vert = edgeVerts[SDEdge(face->v[j], face->v[NEXT(j)])];
-                face->children[j]->v[NEXT(j)] = vert;
-                face->children[NEXT(j)]->v[j] = vert;
-                face->children[3]->v[j] = vert;
-            }
+    // Create child faces
+    std::vector<int> newIndices(3 * childOffset[nFaces]);
+    ParallelFor(0, nFaces, [&](int64_t face) {
+        const int *v = &mesh.indices[3 * face];
+        const int *ev = &edgeVertex[3 * face];
+        int *child = &newIndices[3 * childOffset[face]];
+        auto addChild = [&child](int v0, int v1, int v2) {
+            *child++ = v0;
+            *child++ = v1;
+            *child++ = v2;
+        };
+        int nSplit = (ev[0] != -1) + (ev[1] != -1) + (ev[2] != -1);
+        if (nSplit == 0)
+            addChild(v[0], v[1], v[2]);
+        else if (nSplit == 3) {
+            for (int j = 0; j < 3; ++j)
+                addChild(v[j], ev[j], ev[PREV(j)]);
+            addChild(ev[0], ev[1], ev[2]);
+        } else if (nSplit == 1) {
+            // Bisect the triangle through the split edge's odd vertex
+            int k = ev[0] != -1 ? 0 : (ev[1] != -1 ? 1 : 2);
+            addChild(v[k], ev[k], v[PREV(k)]);
+            addChild(ev[k], v[NEXT(k)], v[PREV(k)]);
+        } else {
+            // Split the triangle into a triangle and a quadrilateral
+            int k = ev[0] == -1 ? 0 : (ev[1] == -1 ? 1 : 2);
+            int m1 = ev[NEXT(k)], m2 = ev[PREV(k)];
+            addChild(m1, v[PREV(k)], m2);
+            addChild(v[k], v[NEXT(k)], m1);
+            addChild(v[k], m1, m2);
         }
+    });
 
-        // Prepare for next level of subdivision
-        f = newFaces;
-        v = newVertices;
+    return LoopMesh(std::move(newIndices), std::move(newP));
+}
+
+// LoopSubdiv Function Definitions
+TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrientation,
+                            int nLevels, pstd::span<const int> vertexIndices,
+                            pstd::span<const Point3f> p, Allocator alloc,
+                            std::function<bool(Point3f, Point3f)> splitEdge) {
+    for (int index : vertexIndices)
+        if (index < 0 || index >= p.size())
+            ErrorExit("Vertex index %d is out of range for LoopSubdiv shape with %d "
+                      "vertices.",
+                      index, p.size());
+    LoopMesh mesh(std::vector<int>(vertexIndices.begin(), vertexIndices.end()),
+                  std::vector<Point3f>(p.begin(), p.end()));
+
+    // Refine _LoopMesh_ into triangles
+    for (int i = 0; i < nLevels; ++i) {
+        pstd::optional<LoopMesh> refined =
+            Subdivide(mesh, *renderFromObject, splitEdge);
+        if (!refined)
+            break;
+        mesh = std::move(*refined);
     }
 
     // Push vertices to limit surface
-    std::vector<Point3f> pLimit(v.size());
-    for (size_t i = 0; i < v.size(); ++i) {
-        if (v[i]->boundary)
-            pLimit[i] = weightBoundary(v[i], 1.f / 5.f);
+    size_t nVertices = mesh.p.size();
+    std::vector<Point3f> pLimit(nVertices);
+    ParallelFor(0, nVertices, [&](int64_t v) {
+        pLimit[v] = mesh.p[v];
+        if (mesh.vertexFace[v] == -1)
+            return;
+        bool boundary;
+        int valence = mesh.Valence(v, &boundary);
+        if (boundary)
+            pLimit[v] = mesh.WeightBoundary(v, valence, 1.f / 5.f);
         else
-            pLimit[i] = weightOneRing(v[i], loopGamma(v[i]->valence()));
-    }
-    for (size_t i = 0; i < v.size(); ++i)
-        v[i]->p = pLimit[i];
+            pLimit[v] = mesh.WeightOneRing(v, valence, loopGamma(valence));
+    });
+    mesh.p = pLimit;
 
     // Compute vertex tangents on limit surface
-    std::vector<Normal3f> Ns;
-    Ns.reserve(v.size());
-    std::vector<Point3f> pRing(16, Point3f());
-    for (SDVertex *vertex : v) {
+    std::vector<Normal3f> Ns(nVertices);
+    ParallelFor(0, nVertices, [&](int64_t v) {
+        if (mesh.vertexFace[v] == -1)
+            return;
+        bool boundary;
+        int valence = mesh.Valence(v, &boundary);
+        InlinedVector<Point3f, 16> pRing(valence);
+        mesh.OneRing(v, boundary, pRing.data());
+        Point3f pv = mesh.p[v];
         Vector3f S(0, 0, 0), T(0, 0, 0);
-        int valence = vertex->valence();
-        if (valence > (int)pRing.size())
-            pRing.resize(valence);
-        vertex->oneRing(&pRing[0]);
-        if (!vertex->boundary) {
+        if (!boundary) {
             // Compute tangents of interior face
             for (int j = 0; j < valence; ++j) {
                 S += std::cos(2 * Pi * j / valence) * Vector3f(pRing[j]);
@@ -343,12 +383,12 @@ TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrien
             // Compute tangents of boundary face
             S = pRing[valence - 1] - pRing[0];
             if (valence == 2)
-                T = Vector3f(pRing[0] + pRing[1] - 2 * vertex->p);
+                T = Vector3f(pRing[0] + pRing[1] - 2 * pv);
             else if (valence == 3)
-                T = pRing[1] - vertex->p;
+                T = pRing[1] - pv;
             else if (valence == 4)  // regular
                 T = Vector3f(-1 * pRing[0] + 2 * pRing[1] + 2 * pRing[2] + -1 * pRing[3] +
-                             -2 * vertex->p);
+                             -2 * pv);
             else {
                 Float theta = Pi / float(valence - 1);
                 T = Vector3f(std::sin(theta) * (pRing[0] + pRing[valence - 1]));
@@ -359,73 +399,14 @@ TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrien
                 T = -T;
             }
         }
-        Ns.push_back(Normal3f(Cross(S, T)));
-    }
+        Ns[v] = Normal3f(Cross(S, T));
+    });
 
     // Create triangle mesh from subdivision mesh
-    {
-        size_t ntris = f.size();
-        std::vector<int> verts(3 * ntris);
-        int *vp = verts.data();
-        size_t totVerts = v.size();
-        std::map<SDVertex *, int> usedVerts;
-        for (size_t i = 0; i < totVerts; ++i)
-            usedVerts[v[i]] = i;
-        for (size_t i = 0; i < ntris; ++i) {
-            for (int j = 0; j < 3; ++j) {
-                *vp = usedVerts[f[i]->v[j]];
-                ++vp;
-            }
-        }
-        return alloc.new_object<TriangleMesh>(*renderFromObject, reverseOrientation,
-                                              verts, pLimit, std::vector<Vector3f>(), Ns,
-                                              std::vector<Point2f>(), std::vector<int>());
-    }
-}
-
-static Point3f weightOneRing(SDVertex *vert, Float beta) {
-    // Put _vert_ one-ring in _pRing_
-    int valence = vert->valence();
-    InlinedVector<Point3f, 16> pRing(valence);
-
-    vert->oneRing(pRing.data());
-    Point3f p = (1 - valence * beta) * vert->p;
-    for (int i = 0; i < valence; ++i)
-        p += beta * pRing[i];
-    return p;
-}
-
-void SDVertex::oneRing(Point3f *p) {
-    if (!boundary) {
-        // Get one-ring vertices for interior vertex
-        SDFace *face = startFace;
-        do {
-            *p++ = face->nextVert(this)->p;
-            face = face->nextFace(this);
-        } while (face != startFace);
-    } else {
-        // Get one-ring vertices for boundary vertex
-        SDFace *face = startFace, *f2;
-        while ((f2 = face->nextFace(this)) != nullptr)
-            face = f2;
-        *p++ = face->nextVert(this)->p;
-        do {
-            *p++ = face->prevVert(this)->p;
-            face = face->prevFace(this);
-        } while (face != nullptr);
-    }
-}
-
-static Point3f weightBoundary(SDVertex *vert, Float beta) {
-    // Put _vert_ one-ring in _pRing_
-    int valence = vert->valence();
-    InlinedVector<Point3f, 16> pRing(valence);
-
-    vert->oneRing(pRing.data());
-    Point3f p = (1 - 2 * beta) * vert->p;
-    p += beta * pRing[0];
-    p += beta * pRing[valence - 1];
-    return p;
+    return alloc.new_object<TriangleMesh>(*renderFromObject, reverseOrientation,
+                                          std::move(mesh.indices), std::move(pLimit),
+                                          std::vector<Vector3f>(), std::move(Ns),
+                                          std::vector<Point2f>(), std::vector<int>());
 }
 
 }  // namespace pbrt
@@ -9,12 +9,17 @@
 
 #include <pbrt/util/pstd.h>
 
+#include <functional>
+
 namespace pbrt {
 
 // LoopSubdiv Declarations
+// If _splitEdge_ is provided, only edges for which it returns true for
+// their render-space endpoints are split at each of the _nLevels_ levels.
 TriangleMesh *LoopSubdivide(const Transform *renderFromObject, bool reverseOrientation,
                             int nLevels, pstd::span<const int> vertexIndices,
-                            pstd::span<const Point3f> p, Allocator alloc);
+                            pstd::span<const Point3f> p, Allocator alloc,
+                            std::function<bool(Point3f, Point3f)> splitEdge = {});
 
 }  // namespace pbrt
 
@@ -19,7 +19,7 @@ std::string DigitPermutation::ToString() const {
     for (int digitIndex = 0; digitIndex < nDigits; ++digitIndex) {
         s += StringPrintf("[%d] ( ", digitIndex);
         for (int digitValue = 0; digitValue < base; ++digitValue) {
-            s += StringPrintf("%d", permutations[digitIndex * base + digitValue]);
+            s += StringPrintf("%d", Permute(digitIndex, digitValue));
             if (digitValue != base - 1)
                 s += ", ";
         }
@@ -26,7 +26,7 @@ class DigitPermutation {
   public:
     // DigitPermutation Public Methods
     DigitPermutation() = default;
-    DigitPermutation(int base, uint32_t seed, Allocator alloc) : base(base) {
+    DigitPermutation(int base, uint32_t seed, Allocator alloc) : base(base), seed(seed) {
         CHECK_LT(base, 65536);  // uint16_t
         // Compute number of digits needed for _base_
         nDigits = 0;
@@ -36,30 +36,43 @@ class DigitPermutation {
             invBaseN *= invBase;
         }
 
+        // Tabulate the permutations of small bases; larger bases have few
+        // digits, and their permutations are computed as needed
+        if (base > MaxTabulatedBase)
+            return;
         permutations = alloc.allocate_object<uint16_t>(nDigits * base);
-        for (int digitIndex = 0; digitIndex < nDigits; ++digitIndex) {
-            // Compute random permutation for _digitIndex_
-            uint32_t digitSeed = MixBits(((base << 8) + digitIndex) ^ seed);
+        for (int digitIndex = 0; digitIndex < nDigits; ++digitIndex)
             for (int digitValue = 0; digitValue < base; ++digitValue) {
                 int index = digitIndex * base + digitValue;
-                permutations[index] = PermutationElement(digitValue, base, digitSeed);
+                permutations[index] = ComputePermutation(digitIndex, digitValue);
             }
-        }
     }
 
     PBRT_CPU_GPU
     int Permute(int digitIndex, int digitValue) const {
         DCHECK_LT(digitIndex, nDigits);
         DCHECK_LT(digitValue, base);
+        if (!permutations)
+            return ComputePermutation(digitIndex, digitValue);
         return permutations[digitIndex * base + digitValue];
     }
 
     std::string ToString() const;
 
   private:
+    // DigitPermutation Private Methods
+    PBRT_CPU_GPU
+    int ComputePermutation(int digitIndex, int digitValue) const {
+        // Compute random permutation for _digitIndex_
+        uint32_t digitSeed = MixBits(((base << 8) + digitIndex) ^ seed);
+        return PermutationElement(digitValue, base, digitSeed);
+    }
+
     // DigitPermutation Private Members
+    static constexpr int MaxTabulatedBase = 256;
     int base, nDigits;
-    uint16_t *permutations;
+    uint32_t seed;
+    uint16_t *permutations = nullptr;
 };
 
 // Low Discrepancy Declarations
@@ -175,6 +188,33 @@ PBRT_CPU_GPU inline uint32_t OwenScrambleBinaryFull(uint32_t v, uint32_t hash) {
     return v;
 }
 
+// Returns the unrandomized 32-bit Sobol$'$ sample for index _a_. The first
+// two dimensions' generator matrices are the identity and the binary Pascal
+// matrix, which are applied without walking over _a_'s bits.
+PBRT_CPU_GPU inline uint32_t SobolSampleBits32(int64_t a, int dimension) {
+    DCHECK_LT(dimension, NSobolDimensions);
+    DCHECK(a >= 0 && a < (1ull << SobolMatrixSize));
+    if (dimension == 0)
+        return ReverseBits32(uint32_t(a));
+    if (dimension == 1) {
+        // Bit $i$ of the product is the XOR of the bits $j$ of _a_ with $j \supseteq
+        // i$; the matrix's columns repeat with a period of 32.
+        uint32_t v = uint32_t(a) ^ uint32_t(uint64_t(a) >> 32);
+        v ^= (v >> 1) & 0x55555555;
+        v ^= (v >> 2) & 0x33333333;
+        v ^= (v >> 4) & 0x0f0f0f0f;
+        v ^= (v >> 8) & 0x00ff00ff;
+        v ^= v >> 16;
+        return ReverseBits32(v);
+    }
+
+    uint32_t v = 0;
+    for (int i = dimension * SobolMatrixSize; a != 0; a >>= 1, i++)
+        if (a & 1)
+            v ^= SobolMatrices32[i];
+    return v;
+}
+
 template <typename R>
 PBRT_CPU_GPU inline Float SobolSample(int64_t index, int dimension, R randomizer) {
 #ifdef PBRT_FLOAT_AS_DOUBLE
@@ -186,18 +226,63 @@ PBRT_CPU_GPU inline Float SobolSample(int64_t index, int dimension, R randomizer
 
 template <typename R>
 PBRT_CPU_GPU inline float SobolSampleFloat(int64_t a, int dimension, R randomizer) {
-    DCHECK_LT(dimension, NSobolDimensions);
-    DCHECK(a >= 0 && a < (1ull << SobolMatrixSize));
     // Compute initial Sobol sample _v_ using generator matrices
-    uint32_t v = 0;
-    for (int i = dimension * SobolMatrixSize; a != 0; a >>= 1, i++)
-        if (a & 1)
-            v ^= SobolMatrices32[i];
+    uint32_t v = SobolSampleBits32(a, dimension);
 
     v = randomizer(v);
     return std::min(v * 0x1p-32f, FloatOneMinusEpsilon);
 }
 
+// Computes the unrandomized 32-bit Sobol$'$ samples for index _a_ in the
+// dimensions starting at _firstDimension_, going over _a_'s bits once.
+PBRT_CPU_GPU inline void SobolSampleBits32(int64_t a, int firstDimension,
+                                           pstd::span<uint32_t> v) {
+    DCHECK_LE(firstDimension + v.size(), NSobolDimensions);
+    DCHECK(a >= 0 && a < (1ull << SobolMatrixSize));
+    for (uint32_t &vi : v)
+        vi = 0;
+    const uint32_t *C = &SobolMatrices32[firstDimension * SobolMatrixSize];
+    for (int bit = 0; a != 0; a >>= 1, ++bit)
+        if (a & 1)
+            for (size_t d = 0; d < v.size(); ++d)
+                v[d] ^= C[d * SobolMatrixSize + bit];
+}
+
+// Computes the Sobol$'$ samples in _dimension_ for the indices starting at
+// _aStart_. Incrementing an index flips its bits up to and including its
+// lowest zero bit, so each sample after the first is found from the previous
+// one with a single XOR.
+template <typename R>
+PBRT_CPU_GPU inline void SobolSamples(int64_t aStart, int dimension, R randomizer,
+                                      pstd::span<Float> u) {
+#ifdef PBRT_FLOAT_AS_DOUBLE
+    for (size_t i = 0; i < u.size(); ++i)
+        u[i] = SobolSampleDouble(aStart + i, dimension, randomizer);
+#else
+    if (u.empty())
+        return;
+    DCHECK(aStart >= 0 && aStart + u.size() <= (1ull << SobolMatrixSize));
+    // Compute XORs of the generator matrix's first columns
+    const uint32_t *C = &SobolMatrices32[dimension * SobolMatrixSize];
+    uint32_t flip[SobolMatrixSize];
+    flip[0] = C[0];
+    for (int i = 1; i < SobolMatrixSize; ++i)
+        flip[i] = flip[i - 1] ^ C[i];
+
+    uint32_t v = SobolSampleBits32(aStart, dimension);
+    for (size_t i = 0;;) {
+        u[i] = std::min(randomizer(v) * 0x1p-32f, FloatOneMinusEpsilon);
+        if (++i == u.size())
+            break;
+        // Find the lowest set bit of the new index and update _v_
+        uint64_t a = aStart + i, lowBit = a & (~a + 1);
+        int k = (lowBit >> 32) ? 32 + Log2Int(uint32_t(lowBit >> 32))
+                               : Log2Int(uint32_t(lowBit));
+        v ^= flip[k];
+    }
+#endif
+}
+
 // CranleyPattersonRotator Definition
 struct CranleyPattersonRotator {
     PBRT_CPU_GPU
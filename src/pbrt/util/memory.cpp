@@ -5,8 +5,11 @@
 #include <pbrt/util/memory.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/string.h>
 
+#include <algorithm>
 #include <cstdlib>
 #ifdef PBRT_HAVE_MALLOC_H
 #include <malloc.h>  // for both memalign and _aligned_malloc
@@ -18,6 +21,9 @@
 #pragma comment(lib, "psapi.lib")
 // clang-format on
 #endif  // PBRT_IS_WINDOWS
+#if defined(PBRT_IS_LINUX) || defined(PBRT_IS_OSX)
+#include <sys/resource.h>
+#endif
 #ifdef PBRT_IS_LINUX
 #include <unistd.h>
 #include <cstdio>
@@ -113,6 +119,46 @@ void CUDATrackedMemoryResource::PrefetchToGPU() const {
     LOG_VERBOSE("Done prefetching: %d bytes total", bytes);
 }
 
+void CUDATrackedMemoryResource::ReplicateToGPUs(pstd::span<const int> devices) const {
+    int currentDevice;
+    CUDA_CHECK(cudaGetDevice(&currentDevice));
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    LOG_VERBOSE("Replicating %d allocations to %d GPUs", allocations.size(),
+                devices.size());
+    for (auto iter : allocations)
+        CUDA_CHECK(cudaMemAdvise(iter.first, iter.second, cudaMemAdviseSetReadMostly,
+                                 /* ignored argument */ 0));
+    for (int device : devices) {
+        CUDA_CHECK(cudaSetDevice(device));
+        for (auto iter : allocations)
+            CUDA_CHECK(
+                cudaMemPrefetchAsync(iter.first, iter.second, device, 0 /* stream */));
+        CUDA_CHECK(cudaDeviceSynchronize());
+    }
+    CUDA_CHECK(cudaSetDevice(currentDevice));
+}
+
+void *CUDADeviceMemoryResource::do_allocate(size_t size, size_t alignment) {
+    if (size == 0)
+        return nullptr;
+
+    void *ptr;
+    CUDA_CHECK(cudaMalloc(&ptr, size));
+    CHECK_EQ(0, intptr_t(ptr) % alignment);
+    bytesAllocated += size;
+    return ptr;
+}
+
+void CUDADeviceMemoryResource::do_deallocate(void *p, size_t bytes, size_t alignment) {
+    if (!p)
+        return;
+
+    CUDA_CHECK(cudaFree(p));
+    bytesAllocated -= bytes;
+}
+
 static CUDATrackedMemoryResource cudaTrackedMemoryResource;
 Allocator gpuMemoryAllocator(&cudaTrackedMemoryResource);
 
@@ -171,4 +217,134 @@ size_t GetCurrentRSS() {
 #endif
 }
 
+size_t GetPeakRSS() {
+#ifdef PBRT_IS_WINDOWS
+    PROCESS_MEMORY_COUNTERS info;
+    GetProcessMemoryInfo(GetCurrentProcess(), &info, sizeof(info));
+    return (size_t)info.PeakWorkingSetSize;
+#elif defined(PBRT_IS_LINUX) || defined(PBRT_IS_OSX)
+    struct rusage rusage;
+    if (getrusage(RUSAGE_SELF, &rusage) != 0)
+        return 0;
+#ifdef PBRT_IS_OSX
+    // ru_maxrss is in bytes on OSX...
+    return (size_t)rusage.ru_maxrss;
+#else
+    // ...and in kilobytes on Linux.
+    return (size_t)rusage.ru_maxrss * 1024;
+#endif
+#else
+    return 0;
+#endif
+}
+
+// CategoryMemoryResource Definition
+class CategoryMemoryResource : public pstd::pmr::memory_resource {
+  public:
+    void *do_allocate(size_t size, size_t alignment) {
+        Add(size);
+        return pstd::pmr::new_delete_resource()->allocate(size, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) {
+        pstd::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+        Add(-int64_t(bytes));
+    }
+
+    bool do_is_equal(const memory_resource &other) const noexcept {
+        return this == &other;
+    }
+
+    void Add(int64_t bytes);
+
+    std::atomic<int64_t> currentBytes{0}, maxBytes{0};
+    int64_t budget = 0;
+};
+
+// Memory Category Local Variables
+static CategoryMemoryResource categoryResources[NumMemoryCategories];
+static const char *categoryNames[NumMemoryCategories] = {
+    "geometry", "bvh", "textures", "materials", "lights", "media", "film", "integrator"};
+
+static std::string printMB(int64_t bytes) {
+    return StringPrintf("%.2f MB", bytes / (1024. * 1024.));
+}
+
+void CategoryMemoryResource::Add(int64_t bytes) {
+    int64_t current = currentBytes.fetch_add(bytes) + bytes;
+    int64_t prevMax = maxBytes.load(std::memory_order_relaxed);
+    while (prevMax < current && !maxBytes.compare_exchange_weak(prevMax, current))
+        ;
+    if (budget > 0 && current > budget) {
+        PrintMemoryCategories(stderr);
+        ErrorExit("Memory budget of %s for %s exceeded (%s in use).", printMB(budget),
+                  categoryNames[this - categoryResources], printMB(current));
+    }
+}
+
+// Memory Category Function Definitions
+Allocator CategoryAllocator(MemoryCategory category) {
+    return Allocator(&categoryResources[int(category)]);
+}
+
+void AddCategoryMemory(MemoryCategory category, int64_t bytes) {
+    categoryResources[int(category)].Add(bytes);
+}
+
+int64_t CategoryCurrentBytes(MemoryCategory category) {
+    return categoryResources[int(category)].currentBytes.load();
+}
+
+int64_t CategoryMaxBytes(MemoryCategory category) {
+    return categoryResources[int(category)].maxBytes.load();
+}
+
+void SetMemoryBudgets(const std::string &budgets) {
+    for (const std::string &budget : SplitString(budgets, ',')) {
+        std::vector<std::string> nameSize = SplitString(budget, '=');
+        int mb;
+        if (nameSize.size() != 2 || !Atoi(nameSize[1], &mb) || mb <= 0)
+            ErrorExit("%s: expected a memory budget of the form <category>=<MB>.",
+                      budget);
+        auto iter = std::find(std::begin(categoryNames), std::end(categoryNames),
+                              nameSize[0]);
+        if (iter == std::end(categoryNames))
+            ErrorExit("%s: unknown memory category. Expected one of \"geometry\", "
+                      "\"bvh\", \"textures\", \"materials\", \"lights\", "
+                      "\"media\", \"film\", or \"integrator\".",
+                      nameSize[0]);
+        categoryResources[iter - std::begin(categoryNames)].budget =
+            int64_t(mb) * 1024 * 1024;
+    }
+}
+
+void PrintMemoryCategories(FILE *dest) {
+    // Only report the categories that have been used or have a budget.
+    bool printedHeader = false;
+    for (int i = 0; i < NumMemoryCategories; ++i) {
+        const CategoryMemoryResource &r = categoryResources[i];
+        if (r.maxBytes == 0 && r.budget == 0)
+            continue;
+        if (!printedHeader) {
+            fprintf(dest, "Memory by category:%27s%15s%15s\n", "Current", "Peak",
+                    "Budget");
+            printedHeader = true;
+        }
+        std::string budget = r.budget > 0 ? printMB(r.budget) : "-";
+        fprintf(dest, "    %-16s%26s%15s%15s\n", categoryNames[i],
+                printMB(r.currentBytes).c_str(), printMB(r.maxBytes).c_str(),
+                budget.c_str());
+    }
+}
+
+std::string MemoryCategoriesJSON() {
+    std::string json = "{";
+    for (int i = 0; i < NumMemoryCategories; ++i) {
+        const CategoryMemoryResource &r = categoryResources[i];
+        json += StringPrintf("%s\"%s\": {\"current\": %d, \"peak\": %d, \"budget\": %d}",
+                             i > 0 ? ", " : "", categoryNames[i], int64_t(r.currentBytes),
+                             int64_t(r.maxBytes), int64_t(r.budget));
+    }
+    return json + "}";
+}
+
 }  // namespace pbrt
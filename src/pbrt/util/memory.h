@@ -13,9 +13,13 @@
 
 #include <atomic>
 #include <cstddef>
+#include <cstdio>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <type_traits>
+#include <utility>
+#include <vector>
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <unordered_map>
 #endif
@@ -23,6 +27,9 @@
 namespace pbrt {
 
 size_t GetCurrentRSS();
+// Returns the largest resident set size the process has had, in bytes, or
+// zero if it can't be determined.
+size_t GetPeakRSS();
 
 #ifdef PBRT_BUILD_GPU_RENDERER
 
@@ -45,6 +52,9 @@ class CUDATrackedMemoryResource : public CUDAMemoryResource {
     }
 
     void PrefetchToGPU() const;
+    // Marks all of the allocations as read-mostly and prefetches them to
+    // each of the given devices, which then each have a read-only copy.
+    void ReplicateToGPUs(pstd::span<const int> devices) const;
     size_t BytesAllocated() const { return bytesAllocated; }
 
   private:
@@ -66,6 +76,25 @@ class CUDATrackedMemoryResource : public CUDAMemoryResource {
     std::unordered_map<void *, size_t> allocations;
 };
 
+// CUDADeviceMemoryResource allocates GPU device memory. Unlike the managed
+// memory that the other CUDA memory resources return, it can't be accessed
+// by the host, but it is never migrated, so it's used for data like the
+// work queues that only kernels read and write.
+class CUDADeviceMemoryResource : public pstd::pmr::memory_resource {
+  public:
+    void *do_allocate(size_t size, size_t alignment);
+    void do_deallocate(void *p, size_t bytes, size_t alignment);
+
+    bool do_is_equal(const memory_resource &other) const noexcept {
+        return this == &other;
+    }
+
+    size_t BytesAllocated() const { return bytesAllocated; }
+
+  private:
+    std::atomic<size_t> bytesAllocated{0};
+};
+
 #endif
 
 extern Allocator gpuMemoryAllocator;
@@ -102,6 +131,70 @@ class TrackedMemoryResource : public pstd::pmr::memory_resource {
     std::atomic<uint64_t> allocatedBytes{0}, maxAllocatedBytes{0};
 };
 
+// ArenaMemoryResource Definition
+// Allocates small objects from large blocks that are only freed all at once,
+// when the resource is destroyed; individual deallocations of them are
+// no-ops. Allocations of at least _largeSize_ bytes are passed through to the
+// upstream resource so that they can still be freed individually. Only
+// deallocation is thread safe.
+class ArenaMemoryResource : public pstd::pmr::memory_resource {
+  public:
+    ArenaMemoryResource(pstd::pmr::memory_resource *upstream, size_t largeSize = 4096)
+        : upstream(upstream), largeSize(largeSize), arena(upstream) {}
+
+    void *do_allocate(size_t size, size_t alignment) {
+        if (size >= largeSize)
+            return upstream->allocate(size, alignment);
+        return arena.allocate(size, alignment);
+    }
+    void do_deallocate(void *p, size_t bytes, size_t alignment) {
+        if (bytes >= largeSize)
+            upstream->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource &other) const noexcept {
+        return this == &other;
+    }
+
+  private:
+    pstd::pmr::memory_resource *upstream;
+    size_t largeSize;
+    pstd::pmr::monotonic_buffer_resource arena;
+};
+
+// MemoryCategory Definition
+// Memory used for scene objects and rendering is accounted to one of these
+// categories, each of which may be given a budget; exceeding it is a fatal
+// error, reported along with the current use of all categories.
+enum class MemoryCategory {
+    Geometry,
+    BVH,
+    Textures,
+    Materials,
+    Lights,
+    Media,
+    Film,
+    Integrator
+};
+constexpr int NumMemoryCategories = 8;
+
+// Memory Category Function Declarations
+// Returns an allocator whose allocations are accounted to the given
+// category.
+Allocator CategoryAllocator(MemoryCategory category);
+// Accounts memory that isn't allocated through a category's allocator;
+// _bytes_ may be negative when such memory is freed.
+void AddCategoryMemory(MemoryCategory category, int64_t bytes);
+int64_t CategoryCurrentBytes(MemoryCategory category);
+int64_t CategoryMaxBytes(MemoryCategory category);
+// Sets budgets from a string of the form "geometry=4096,textures=512",
+// with sizes in MB.
+void SetMemoryBudgets(const std::string &budgets);
+void PrintMemoryCategories(FILE *dest);
+// Returns a JSON object with each category's current and peak use and
+// budget, in bytes.
+std::string MemoryCategoriesJSON();
+
 template <typename T>
 struct AllocationTraits {
     using SingleObject = T *;
@@ -130,12 +223,17 @@ class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
         ptr = b.ptr;
         allocatedBytes = b.allocatedBytes;
         offset = b.offset;
+        fullBuffers = std::move(b.fullBuffers);
 
         b.ptr = nullptr;
         b.allocatedBytes = b.offset = 0;
+        b.fullBuffers.clear();
     }
 
-    ~ScratchBuffer() { Allocator().deallocate_bytes(ptr, allocatedBytes, align); }
+    ~ScratchBuffer() {
+        Reset();
+        Allocator().deallocate_bytes(ptr, allocatedBytes, align);
+    }
 
     ScratchBuffer &operator=(const ScratchBuffer &) = delete;
 
@@ -143,6 +241,7 @@ class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
         std::swap(b.ptr, ptr);
         std::swap(b.allocatedBytes, allocatedBytes);
         std::swap(b.offset, offset);
+        std::swap(b.fullBuffers, fullBuffers);
         return *this;
     }
 
@@ -150,7 +249,12 @@ class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
     void *Alloc(size_t size, size_t align) {
         if ((offset % align) != 0)
             offset += align - (offset % align);
+#ifdef PBRT_IS_GPU_CODE
         CHECK_LE(offset + size, allocatedBytes);
+#else
+        if (offset + size > size_t(allocatedBytes))
+            Grow(size);
+#endif
         void *p = ptr + offset;
         offset += size;
         return p;
@@ -173,13 +277,31 @@ class alignas(PBRT_L1_CACHE_LINE_SIZE) ScratchBuffer {
     }
 
     PBRT_CPU_GPU
-    void Reset() { offset = 0; }
+    void Reset() {
+#ifndef PBRT_IS_GPU_CODE
+        for (const std::pair<uint8_t *, int> &buf : fullBuffers)
+            Allocator().deallocate_bytes(buf.first, buf.second, align);
+        fullBuffers.clear();
+#endif
+        offset = 0;
+    }
 
   private:
+    // ScratchBuffer Private Methods
+    // Allocations that don't fit go in a new, larger buffer; the full one is
+    // kept until _Reset()_, since the memory allocated from it is still in use.
+    void Grow(size_t minSize) {
+        fullBuffers.push_back(std::make_pair(ptr, allocatedBytes));
+        allocatedBytes = std::max<size_t>(2 * minSize, 2 * size_t(allocatedBytes));
+        ptr = (uint8_t *)Allocator().allocate_bytes(allocatedBytes, align);
+        offset = 0;
+    }
+
     // ScratchBuffer Private Members
     static constexpr int align = PBRT_L1_CACHE_LINE_SIZE;
     uint8_t *ptr = nullptr;
     int allocatedBytes = 0, offset = 0;
+    std::vector<std::pair<uint8_t *, int>> fullBuffers;
 };
 
 }  // namespace pbrt
@@ -7,35 +7,75 @@
 #include <pbrt/util/buffercache.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/log.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/string.h>
 #include <pbrt/util/transform.h>
 
 #include <rply/rply.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
 namespace pbrt {
 
 STAT_RATIO("Geometry/Triangles per mesh", nTris, nTriMeshes);
 STAT_MEMORY_COUNTER("Memory/Triangles", triangleBytes);
 
+// Mesh Local Definitions
+// Meshes that may be freed allocate their buffers with _bufferAlloc_ rather
+// than sharing them through the buffer caches
+template <typename T>
+static const T *StoreBuffer(BufferCache<T> *cache, const std::vector<T> &buf,
+                            Allocator *bufferAlloc) {
+    if (!bufferAlloc)
+        return cache->LookupOrAdd(buf);
+    T *ptr = bufferAlloc->allocate_object<T>(buf.size());
+    std::copy(buf.begin(), buf.end(), ptr);
+    return ptr;
+}
+
+// Returns octahedral encodings of the directions of _v_; zero-length
+// vectors, which have no direction, are stored as $+z$
+template <typename V>
+static std::vector<OctahedralVector> CompressVectors(const std::vector<V> &v) {
+    std::vector<OctahedralVector> oct(v.size());
+    for (size_t i = 0; i < v.size(); ++i)
+        oct[i] = LengthSquared(v[i]) > 0 ? OctahedralVector(Vector3f(v[i]))
+                                         : OctahedralVector(Vector3f(0, 0, 1));
+    return oct;
+}
+
 // TriangleMesh Method Definitions
 TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrientation,
                            std::vector<int> indices, std::vector<Point3f> p,
                            std::vector<Vector3f> s, std::vector<Normal3f> n,
-                           std::vector<Point2f> uv, std::vector<int> faceIndices)
+                           std::vector<Point2f> uv, std::vector<int> faceIndices,
+                           Allocator *bufferAlloc, bool compressAttributes)
     : nTriangles(indices.size() / 3), nVertices(p.size()) {
     CHECK_EQ((indices.size() % 3), 0);
     ++nTriMeshes;
     nTris += nTriangles;
     triangleBytes += sizeof(*this);
     // Initialize mesh _vertexIndices_
-    vertexIndices = intBufferCache->LookupOrAdd(indices);
+    vertexIndices = StoreBuffer(intBufferCache, indices, bufferAlloc);
 
     // Transform mesh vertices to render space and initialize mesh _p_
-    for (Point3f &pt : p)
-        pt = renderFromObject(pt);
-    this->p = point3BufferCache->LookupOrAdd(p);
+    renderFromObject.ApplyInPlace(pstd::span<Point3f>(p));
+    this->p = StoreBuffer(point3BufferCache, p, bufferAlloc);
 
     // Remainder of _TriangleMesh_ constructor
     this->reverseOrientation = reverseOrientation;
@@ -43,27 +83,45 @@ TriangleMesh::TriangleMesh(const Transform &renderFromObject, bool reverseOrient
 
     if (!uv.empty()) {
         CHECK_EQ(nVertices, uv.size());
-        this->uv = point2BufferCache->LookupOrAdd(uv);
+        if (compressAttributes) {
+            // Quantize $(u,v)$ to 16 bits per component within their bounds
+            for (Point2f st : uv)
+                uvBounds = Union(uvBounds, st);
+            std::vector<uint32_t> uvq(nVertices);
+            for (int i = 0; i < nVertices; ++i) {
+                Vector2f o = uvBounds.Offset(uv[i]);
+                uvq[i] = (uint32_t(std::lround(Clamp(o.x, 0, 1) * 65535)) << 16) |
+                         uint32_t(std::lround(Clamp(o.y, 0, 1) * 65535));
+            }
+            this->uvCompressed = StoreBuffer(uint32BufferCache, uvq, bufferAlloc);
+        } else
+            this->uv = StoreBuffer(point2BufferCache, uv, bufferAlloc);
     }
     if (!n.empty()) {
         CHECK_EQ(nVertices, n.size());
-        for (Normal3f &nn : n) {
-            nn = renderFromObject(nn);
-            if (reverseOrientation)
+        renderFromObject.ApplyInPlace(pstd::span<Normal3f>(n));
+        if (reverseOrientation)
+            for (Normal3f &nn : n)
                 nn = -nn;
-        }
-        this->n = normal3BufferCache->LookupOrAdd(n);
+        if (compressAttributes)
+            this->nCompressed = StoreBuffer(octahedralVectorBufferCache,
+                                            CompressVectors(n), bufferAlloc);
+        else
+            this->n = StoreBuffer(normal3BufferCache, n, bufferAlloc);
     }
     if (!s.empty()) {
         CHECK_EQ(nVertices, s.size());
-        for (Vector3f &ss : s)
-            ss = renderFromObject(ss);
-        this->s = vector3BufferCache->LookupOrAdd(s);
+        renderFromObject.ApplyInPlace(pstd::span<Vector3f>(s));
+        if (compressAttributes)
+            this->sCompressed = StoreBuffer(octahedralVectorBufferCache,
+                                            CompressVectors(s), bufferAlloc);
+        else
+            this->s = StoreBuffer(vector3BufferCache, s, bufferAlloc);
     }
 
     if (!faceIndices.empty()) {
         CHECK_EQ(nTriangles, faceIndices.size());
-        this->faceIndices = intBufferCache->LookupOrAdd(faceIndices);
+        this->faceIndices = StoreBuffer(intBufferCache, faceIndices, bufferAlloc);
     }
 
     // Make sure that we don't have too much stuff to be using integers to
@@ -80,7 +138,8 @@ std::string TriangleMesh::ToString() const {
     return StringPrintf(
         "[ TriangleMesh reverseOrientation: %s transformSwapsHandedness: %s "
         "nTriangles: %d nVertices: %d vertexIndices: %s p: %s n: %s "
-        "s: %s uv: %s faceIndices: %s ]",
+        "s: %s uv: %s nCompressed: %s sCompressed: %s uvCompressed: %s uvBounds: %s "
+        "faceIndices: %s ]",
         reverseOrientation, transformSwapsHandedness, nTriangles, nVertices,
         vertexIndices ? StringPrintf("%s", pstd::MakeSpan(vertexIndices, 3 * nTriangles))
                       : np,
@@ -88,6 +147,10 @@ std::string TriangleMesh::ToString() const {
         n ? StringPrintf("%s", pstd::MakeSpan(n, nVertices)) : nullptr,
         s ? StringPrintf("%s", pstd::MakeSpan(s, nVertices)) : nullptr,
         uv ? StringPrintf("%s", pstd::MakeSpan(uv, nVertices)) : nullptr,
+        nCompressed ? StringPrintf("%s", pstd::MakeSpan(nCompressed, nVertices)) : np,
+        sCompressed ? StringPrintf("%s", pstd::MakeSpan(sCompressed, nVertices)) : np,
+        uvCompressed ? StringPrintf("%s", pstd::MakeSpan(uvCompressed, nVertices)) : np,
+        uvBounds,
         faceIndices ? StringPrintf("%s", pstd::MakeSpan(faceIndices, nTriangles))
                     : nullptr);
 }
@@ -106,16 +169,16 @@ bool TriangleMesh::WritePLY(const std::string &filename) const {
     ply_add_scalar_property(plyFile, "x", PLY_FLOAT);
     ply_add_scalar_property(plyFile, "y", PLY_FLOAT);
     ply_add_scalar_property(plyFile, "z", PLY_FLOAT);
-    if (n != nullptr) {
+    if (HasNormals()) {
         ply_add_scalar_property(plyFile, "nx", PLY_FLOAT);
         ply_add_scalar_property(plyFile, "ny", PLY_FLOAT);
         ply_add_scalar_property(plyFile, "nz", PLY_FLOAT);
     }
-    if (uv != nullptr) {
+    if (HasUV()) {
         ply_add_scalar_property(plyFile, "u", PLY_FLOAT);
         ply_add_scalar_property(plyFile, "v", PLY_FLOAT);
     }
-    if (s != nullptr)
+    if (HasTangents())
         Warning(R"(%s: PLY mesh will be missing tangent vectors "S".)", filename);
 
     ply_add_element(plyFile, "face", nTriangles);
@@ -129,14 +192,16 @@ bool TriangleMesh::WritePLY(const std::string &filename) const {
         ply_write(plyFile, p[i].x);
         ply_write(plyFile, p[i].y);
         ply_write(plyFile, p[i].z);
-        if (n != nullptr) {
-            ply_write(plyFile, n[i].x);
-            ply_write(plyFile, n[i].y);
-            ply_write(plyFile, n[i].z);
+        if (HasNormals()) {
+            Normal3f ni = Normal(i);
+            ply_write(plyFile, ni.x);
+            ply_write(plyFile, ni.y);
+            ply_write(plyFile, ni.z);
         }
-        if (uv != nullptr) {
-            ply_write(plyFile, uv[i].x);
-            ply_write(plyFile, uv[i].y);
+        if (HasUV()) {
+            Point2f uvi = UV(i);
+            ply_write(plyFile, uvi.x);
+            ply_write(plyFile, uvi.y);
         }
     }
 
@@ -160,7 +225,8 @@ BilinearPatchMesh::BilinearPatchMesh(const Transform &renderFromObject,
                                      bool reverseOrientation, std::vector<int> indices,
                                      std::vector<Point3f> P, std::vector<Normal3f> N,
                                      std::vector<Point2f> UV, std::vector<int> fIndices,
-                                     PiecewiseConstant2D *imageDist)
+                                     PiecewiseConstant2D *imageDist,
+                                     Allocator *bufferAlloc)
     : reverseOrientation(reverseOrientation),
       transformSwapsHandedness(renderFromObject.SwapsHandedness()),
       nPatches(indices.size() / 4),
@@ -175,33 +241,31 @@ BilinearPatchMesh::BilinearPatchMesh(const Transform &renderFromObject,
     CHECK_LE(P.size(), std::numeric_limits<int>::max());
     CHECK_LE(indices.size(), std::numeric_limits<int>::max());
 
-    vertexIndices = intBufferCache->LookupOrAdd(indices);
+    vertexIndices = StoreBuffer(intBufferCache, indices, bufferAlloc);
 
     blpBytes += sizeof(*this);
 
     // Transform mesh vertices to world space
-    for (Point3f &p : P)
-        p = renderFromObject(p);
-    p = point3BufferCache->LookupOrAdd(P);
+    renderFromObject.ApplyInPlace(pstd::span<Point3f>(P));
+    p = StoreBuffer(point3BufferCache, P, bufferAlloc);
 
     // Copy _UV_ and _N_ vertex data, if present
     if (!UV.empty()) {
         CHECK_EQ(nVertices, UV.size());
-        uv = point2BufferCache->LookupOrAdd(UV);
+        uv = StoreBuffer(point2BufferCache, UV, bufferAlloc);
     }
     if (!N.empty()) {
         CHECK_EQ(nVertices, N.size());
-        for (Normal3f &n : N) {
-            n = renderFromObject(n);
-            if (reverseOrientation)
+        renderFromObject.ApplyInPlace(pstd::span<Normal3f>(N));
+        if (reverseOrientation)
+            for (Normal3f &n : N)
                 n = -n;
-        }
-        n = normal3BufferCache->LookupOrAdd(N);
+        n = StoreBuffer(normal3BufferCache, N, bufferAlloc);
     }
 
     if (!fIndices.empty()) {
         CHECK_EQ(nPatches, fIndices.size());
-        faceIndices = intBufferCache->LookupOrAdd(fIndices);
+        faceIndices = StoreBuffer(intBufferCache, fIndices, bufferAlloc);
     }
 }
 
@@ -296,7 +360,448 @@ int rply_faceindex_callback(p_ply_argument argument) {
     return 1;
 }
 
+// Binary PLY Local Definitions
+// Property types, in the order of rply's _e_ply_type_ (without aliases)
+enum class PLYType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+static pstd::optional<PLYType> ParsePLYType(const std::string &name) {
+    static const char *const names[][2] = {
+        {"int8", "char"},   {"uint8", "uchar"},   {"int16", "short"},
+        {"uint16", "ushort"}, {"int32", "int"},   {"uint32", "uint"},
+        {"float32", "float"}, {"float64", "double"}};
+    for (int i = 0; i < 8; ++i)
+        if (name == names[i][0] || name == names[i][1])
+            return PLYType(i);
+    return {};
+}
+
+static int PLYTypeSize(PLYType type) {
+    static const int sizes[] = {1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[int(type)];
+}
+
+template <typename T>
+static T ReadPLYBytes(const char *ptr, bool swap) {
+    char bytes[sizeof(T)];
+    std::memcpy(bytes, ptr, sizeof(T));
+    if (swap)
+        std::reverse(bytes, bytes + sizeof(T));
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+static double ReadPLYValue(const char *ptr, PLYType type, bool swap) {
+    switch (type) {
+    case PLYType::Int8:
+        return ReadPLYBytes<int8_t>(ptr, swap);
+    case PLYType::UInt8:
+        return ReadPLYBytes<uint8_t>(ptr, swap);
+    case PLYType::Int16:
+        return ReadPLYBytes<int16_t>(ptr, swap);
+    case PLYType::UInt16:
+        return ReadPLYBytes<uint16_t>(ptr, swap);
+    case PLYType::Int32:
+        return ReadPLYBytes<int32_t>(ptr, swap);
+    case PLYType::UInt32:
+        return ReadPLYBytes<uint32_t>(ptr, swap);
+    case PLYType::Float32:
+        return ReadPLYBytes<float>(ptr, swap);
+    default:
+        return ReadPLYBytes<double>(ptr, swap);
+    }
+}
+
+struct PLYProperty {
+    std::string name;
+    PLYType type;
+    bool isList = false;
+    PLYType countType;
+};
+
+struct PLYScalarField {
+    int offset;
+    PLYType type;
+};
+
+struct PLYElement {
+    // Returns the size of each record if it has no list properties and zero
+    // otherwise
+    size_t FixedRecordSize() const {
+        size_t size = 0;
+        for (const PLYProperty &prop : properties) {
+            if (prop.isList)
+                return 0;
+            size += PLYTypeSize(prop.type);
+        }
+        return size;
+    }
+
+    // Returns the location of a scalar property within fixed-size records
+    pstd::optional<PLYScalarField> FindScalar(const char *propName) const {
+        int offset = 0;
+        for (const PLYProperty &prop : properties) {
+            if (prop.name == propName && !prop.isList)
+                return PLYScalarField{offset, prop.type};
+            offset += PLYTypeSize(prop.type);
+        }
+        return {};
+    }
+
+    // Returns the size of the variable-size record starting at _ptr_; the
+    // result extends past _end_ if the record is truncated
+    size_t RecordSize(const char *ptr, const char *end, bool swap) const {
+        size_t size = 0;
+        for (const PLYProperty &prop : properties)
+            if (prop.isList) {
+                if (PLYTypeSize(prop.countType) > end - (ptr + size))
+                    return end - ptr + 1;
+                size_t count = ReadPLYValue(ptr + size, prop.countType, swap);
+                size += PLYTypeSize(prop.countType) + count * PLYTypeSize(prop.type);
+            } else
+                size += PLYTypeSize(prop.type);
+        return size;
+    }
+
+    std::string name;
+    size_t count;
+    std::vector<PLYProperty> properties;
+};
+
+// PLYFileContents Definition
+// Holds the contents of a file, memory mapped if possible
+class PLYFileContents {
+  public:
+    PLYFileContents(const std::string &filename) {
+#ifdef PBRT_HAVE_MMAP
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+            return;
+        struct stat stat;
+        if (fstat(fd, &stat) == 0 && stat.st_size > 0) {
+            void *ptr = mmap(nullptr, stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+                data = static_cast<const char *>(ptr);
+                size = stat.st_size;
+            }
+        }
+        close(fd);
+#else
+        if (FileExists(filename)) {
+            contents = ReadFileContents(filename);
+            data = contents.data();
+            size = contents.size();
+        }
+#endif
+    }
+    ~PLYFileContents() {
+#ifdef PBRT_HAVE_MMAP
+        if (data)
+            munmap(const_cast<char *>(data), size);
+#endif
+    }
+
+    PLYFileContents(const PLYFileContents &) = delete;
+    PLYFileContents &operator=(const PLYFileContents &) = delete;
+
+    const char *data = nullptr;
+    size_t size = 0;
+
+  private:
+#ifndef PBRT_HAVE_MMAP
+    std::string contents;
+#endif
+};
+
+// Reads binary PLY files by decoding the file's vertex and face records
+// directly, in parallel. Returns an unset optional for files that it doesn't
+// handle (ASCII files, for example) so that rply can read them instead.
+static pstd::optional<TriQuadMesh> ReadBinaryPLY(const std::string &filename) {
+    PLYFileContents file(filename);
+    if (!file.data || file.size < 4 || std::memcmp(file.data, "ply", 3) != 0)
+        return {};
+
+    // Parse the PLY header
+    const char *endHeader = "end_header";
+    const char *headerEnd =
+        std::search(file.data, file.data + file.size, endHeader, endHeader + 10);
+    const char *dataStart =
+        std::find(headerEnd, static_cast<const char *>(file.data + file.size), '\n');
+    if (dataStart == file.data + file.size)
+        return {};
+    ++dataStart;
+    bool binary = false, swap = false;
+    std::vector<PLYElement> elements;
+    for (const std::string &line :
+         SplitString(std::string_view(file.data, headerEnd - file.data), '\n')) {
+        std::vector<std::string> tokens = SplitStringsFromWhitespace(line);
+        tokens.erase(std::remove(tokens.begin(), tokens.end(), ""), tokens.end());
+        if (tokens.empty() || tokens[0] == "ply" || tokens[0] == "comment" ||
+            tokens[0] == "obj_info")
+            continue;
+        if (tokens[0] == "format" && tokens.size() == 3) {
+            uint16_t one = 1;
+            bool littleEndianHost = *reinterpret_cast<uint8_t *>(&one) == 1;
+            if (tokens[1] == "binary_little_endian")
+                swap = !littleEndianHost;
+            else if (tokens[1] == "binary_big_endian")
+                swap = littleEndianHost;
+            else
+                return {};
+            binary = true;
+        } else if (tokens[0] == "element" && tokens.size() == 3) {
+            elements.push_back(PLYElement());
+            elements.back().name = tokens[1];
+            int count;
+            if (!Atoi(tokens[2], &count) || count < 0)
+                return {};
+            elements.back().count = count;
+        } else if (tokens[0] == "property" && !elements.empty()) {
+            PLYProperty prop;
+            pstd::optional<PLYType> type, countType;
+            if (tokens.size() == 3) {
+                type = ParsePLYType(tokens[1]);
+                prop.name = tokens[2];
+            } else if (tokens.size() == 5 && tokens[1] == "list") {
+                prop.isList = true;
+                countType = ParsePLYType(tokens[2]);
+                type = ParsePLYType(tokens[3]);
+                prop.name = tokens[4];
+                if (!countType)
+                    return {};
+                prop.countType = *countType;
+            }
+            if (!type)
+                return {};
+            prop.type = *type;
+            elements.back().properties.push_back(prop);
+        } else
+            return {};
+    }
+
+    if (!binary)
+        return {};
+
+    // Find the vertex and face elements and the start of their data
+    const PLYElement *vertexElement = nullptr, *faceElement = nullptr;
+    const char *vertexData = nullptr, *faceData = nullptr;
+    const char *ptr = dataStart, *fileEnd = file.data + file.size;
+    for (const PLYElement &element : elements) {
+        if (element.name == "vertex") {
+            vertexElement = &element;
+            vertexData = ptr;
+        } else if (element.name == "face") {
+            faceElement = &element;
+            faceData = ptr;
+        }
+        if (vertexElement && faceElement)
+            break;
+        // Skip past the element's records
+        if (size_t recordSize = element.FixedRecordSize(); recordSize > 0)
+            ptr += std::min<size_t>(element.count * recordSize, fileEnd - ptr);
+        else
+            for (size_t i = 0; i < element.count && ptr <= fileEnd; ++i)
+                ptr += element.RecordSize(ptr, fileEnd, swap);
+        if (ptr > fileEnd)
+            ErrorExit("%s: unable to read the contents of PLY file", filename);
+    }
+    if (!vertexElement || !faceElement || vertexElement->count == 0 ||
+        faceElement->count == 0)
+        ErrorExit("%s: PLY file is invalid! No face/vertex elements found!", filename);
+    size_t vertexRecordSize = vertexElement->FixedRecordSize();
+    if (vertexRecordSize == 0)
+        return {};
+    if (vertexElement->count * vertexRecordSize > size_t(fileEnd - vertexData))
+        ErrorExit("%s: unable to read the contents of PLY file", filename);
+
+    // Find the face properties
+    const PLYProperty *indicesProperty = nullptr, *faceIndexProperty = nullptr;
+    for (const PLYProperty &prop : faceElement->properties) {
+        if (prop.name == "vertex_indices" && prop.isList)
+            indicesProperty = &prop;
+        else if (prop.name == "face_indices" && !prop.isList)
+            faceIndexProperty = &prop;
+    }
+    if (!indicesProperty)
+        ErrorExit("%s: vertex indices not found in PLY file", filename);
+    // Scalar properties before the vertex indices are at a fixed offset so
+    // that the faces' vertex counts can be found quickly
+    int indicesOffset = 0;
+    for (const PLYProperty &prop : faceElement->properties) {
+        if (&prop == indicesProperty)
+            break;
+        if (prop.isList)
+            return {};
+        indicesOffset += PLYTypeSize(prop.type);
+    }
+
+    // Decode vertex records in parallel
+    auto findScalars = [&](std::initializer_list<const char *> names) {
+        std::vector<PLYScalarField> fields;
+        for (const char *name : names)
+            if (pstd::optional<PLYScalarField> field = vertexElement->FindScalar(name))
+                fields.push_back(*field);
+        return fields;
+    };
+    std::vector<PLYScalarField> pFields = findScalars({"x", "y", "z"});
+    if (pFields.size() != 3)
+        ErrorExit("%s: Vertex coordinate property not found!", filename);
+    std::vector<PLYScalarField> nFields = findScalars({"nx", "ny", "nz"});
+    std::vector<PLYScalarField> uvFields;
+    for (auto names : {std::make_pair("u", "v"), std::make_pair("s", "t"),
+                       std::make_pair("texture_u", "texture_v"),
+                       std::make_pair("texture_s", "texture_t")})
+        if (uvFields = findScalars({names.first, names.second}); uvFields.size() == 2)
+            break;
+
+    TriQuadMesh mesh;
+    size_t nVertices = vertexElement->count;
+    mesh.p.resize(nVertices);
+    if (nFields.size() == 3)
+        mesh.n.resize(nVertices);
+    if (uvFields.size() == 2)
+        mesh.uv.resize(nVertices);
+    constexpr size_t chunkSize = 64 * 1024;
+    ParallelFor(0, (nVertices + chunkSize - 1) / chunkSize, [&](int64_t chunk) {
+        size_t end = std::min(nVertices, (chunk + 1) * chunkSize);
+        for (size_t i = chunk * chunkSize; i < end; ++i) {
+            const char *record = vertexData + i * vertexRecordSize;
+            for (int c = 0; c < 3; ++c)
+                mesh.p[i][c] =
+                    ReadPLYValue(record + pFields[c].offset, pFields[c].type, swap);
+            if (!mesh.n.empty())
+                for (int c = 0; c < 3; ++c)
+                    mesh.n[i][c] =
+                        ReadPLYValue(record + nFields[c].offset, nFields[c].type, swap);
+            if (!mesh.uv.empty())
+                for (int c = 0; c < 2; ++c)
+                    mesh.uv[i][c] =
+                        ReadPLYValue(record + uvFields[c].offset, uvFields[c].type, swap);
+        }
+    });
+
+    // Find the start of each chunk of face records and its number of triangles
+    // and quads
+    struct FaceChunk {
+        const char *data;
+        size_t triOffset, quadOffset;
+    };
+    size_t nFaces = faceElement->count;
+    std::vector<FaceChunk> faceChunks;
+    size_t nTris = 0, nQuads = 0, nIgnored = 0;
+    ptr = faceData;
+    for (size_t i = 0; i < nFaces; ++i) {
+        if (i % chunkSize == 0)
+            faceChunks.push_back(FaceChunk{ptr, nTris, nQuads});
+        size_t recordSize = faceElement->RecordSize(ptr, fileEnd, swap);
+        if (recordSize > size_t(fileEnd - ptr))
+            ErrorExit("%s: unable to read the contents of PLY file", filename);
+        size_t count =
+            ReadPLYValue(ptr + indicesOffset, indicesProperty->countType, swap);
+        if (count == 3)
+            ++nTris;
+        else if (count == 4)
+            ++nQuads;
+        else
+            ++nIgnored;
+        ptr += recordSize;
+    }
+    if (nIgnored > 0)
+        Warning("%s: Ignoring %d faces with other than 3 or 4 vertices (only triangles "
+                "and quads are supported!)",
+                filename, nIgnored);
+
+    // Decode face records in parallel
+    mesh.triIndices.resize(3 * nTris);
+    mesh.quadIndices.resize(4 * nQuads);
+    if (faceIndexProperty)
+        mesh.faceIndices.resize(nFaces);
+    std::atomic<bool> indexOutOfBounds{false};
+    std::atomic<int> badIndex{0};
+    ParallelFor(0, faceChunks.size(), [&](int64_t chunk) {
+        const char *record = faceChunks[chunk].data;
+        int *tri = mesh.triIndices.data() + 3 * faceChunks[chunk].triOffset;
+        int *quad = mesh.quadIndices.data() + 4 * faceChunks[chunk].quadOffset;
+        size_t end = std::min(nFaces, (chunk + 1) * chunkSize);
+        for (size_t i = chunk * chunkSize; i < end; ++i) {
+            for (const PLYProperty &prop : faceElement->properties) {
+                if (&prop == indicesProperty) {
+                    size_t count = ReadPLYValue(record, prop.countType, swap);
+                    record += PLYTypeSize(prop.countType);
+                    int face[4];
+                    for (size_t j = 0; j < count; ++j, record += PLYTypeSize(prop.type))
+                        if (j < 4) {
+                            face[j] = ReadPLYValue(record, prop.type, swap);
+                            if (face[j] < 0 || face[j] >= int(nVertices)) {
+                                badIndex = face[j];
+                                indexOutOfBounds = true;
+                            }
+                        }
+                    if (count == 3)
+                        for (int j = 0; j < 3; ++j)
+                            *tri++ = face[j];
+                    else if (count == 4) {
+                        // Note: modify order since we're specifying it as a blp...
+                        *quad++ = face[0];
+                        *quad++ = face[1];
+                        *quad++ = face[3];
+                        *quad++ = face[2];
+                    }
+                } else if (prop.isList) {
+                    size_t count = ReadPLYValue(record, prop.countType, swap);
+                    record += PLYTypeSize(prop.countType) + count * PLYTypeSize(prop.type);
+                } else {
+                    if (&prop == faceIndexProperty)
+                        mesh.faceIndices[i] = ReadPLYValue(record, prop.type, swap);
+                    record += PLYTypeSize(prop.type);
+                }
+            }
+        }
+    });
+    if (indexOutOfBounds)
+        ErrorExit("plymesh: Vertex index %i is out of bounds! "
+                  "Valid range is [0..%i)",
+                  int(badIndex), int(nVertices));
+
+    return mesh;
+}
+
+pstd::optional<Bounds3f> TriQuadMesh::ReadPLYBounds(const std::string &filename) {
+    // Use bounds from sidecar file, if present
+    std::string sidecarFilename = filename + ".bounds";
+    if (FileExists(sidecarFilename)) {
+        std::vector<float> v = ReadFloatFile(sidecarFilename);
+        if (v.size() != 6)
+            ErrorExit("%s: expected six values for bounds but found %d.",
+                      sidecarFilename, v.size());
+        return Bounds3f(Point3f(v[0], v[1], v[2]), Point3f(v[3], v[4], v[5]));
+    }
+
+    // Look for bounds in a comment in the PLY header
+    p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
+    if (ply == nullptr)
+        ErrorExit("Couldn't open PLY file \"%s\"", filename);
+    if (ply_read_header(ply) == 0)
+        ErrorExit("Unable to read the header of PLY file \"%s\"", filename);
+    pstd::optional<Bounds3f> bounds;
+    const char *comment = nullptr;
+    while ((comment = ply_get_next_comment(ply, comment)) != nullptr) {
+        float v[6];
+        if (sscanf(comment, "bounds %f %f %f %f %f %f", &v[0], &v[1], &v[2], &v[3],
+                   &v[4], &v[5]) == 6) {
+            bounds = Bounds3f(Point3f(v[0], v[1], v[2]), Point3f(v[3], v[4], v[5]));
+            break;
+        }
+    }
+    ply_close(ply);
+    return bounds;
+}
+
 TriQuadMesh TriQuadMesh::ReadPLY(const std::string &filename) {
+    // Decode binary files natively and leave the rest to rply
+    if (pstd::optional<TriQuadMesh> mesh = ReadBinaryPLY(filename))
+        return std::move(*mesh);
+
     TriQuadMesh mesh;
 
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
@@ -22,7 +22,8 @@ class TriangleMesh {
     TriangleMesh(const Transform &renderFromObject, bool reverseOrientation,
                  std::vector<int> vertexIndices, std::vector<Point3f> p,
                  std::vector<Vector3f> S, std::vector<Normal3f> N,
-                 std::vector<Point2f> uv, std::vector<int> faceIndices);
+                 std::vector<Point2f> uv, std::vector<int> faceIndices,
+                 Allocator *bufferAlloc = nullptr, bool compressAttributes = false);
 
     std::string ToString() const;
 
@@ -30,6 +31,33 @@ class TriangleMesh {
 
     static void Init(Allocator alloc);
 
+    // Shading attributes are stored either at full precision or, with
+    // _compressAttributes_, as octahedral-encoded normals and tangents and
+    // $(u,v)$ quantized to 16 bits relative to _uvBounds_; these methods
+    // return them in either case.
+    PBRT_CPU_GPU
+    bool HasNormals() const { return n || nCompressed; }
+    PBRT_CPU_GPU
+    bool HasTangents() const { return s || sCompressed; }
+    PBRT_CPU_GPU
+    bool HasUV() const { return uv || uvCompressed; }
+
+    PBRT_CPU_GPU
+    Normal3f Normal(int vertex) const {
+        return n ? n[vertex] : Normal3f(Vector3f(nCompressed[vertex]));
+    }
+    PBRT_CPU_GPU
+    Vector3f Tangent(int vertex) const {
+        return s ? s[vertex] : Vector3f(sCompressed[vertex]);
+    }
+    PBRT_CPU_GPU
+    Point2f UV(int vertex) const {
+        if (uv)
+            return uv[vertex];
+        uint32_t q = uvCompressed[vertex];
+        return uvBounds.Lerp(Point2f((q >> 16) / 65535.f, (q & 0xffff) / 65535.f));
+    }
+
     // TriangleMesh Public Members
     int nTriangles, nVertices;
     const int *vertexIndices = nullptr;
@@ -37,6 +65,9 @@ class TriangleMesh {
     const Normal3f *n = nullptr;
     const Vector3f *s = nullptr;
     const Point2f *uv = nullptr;
+    const OctahedralVector *nCompressed = nullptr, *sCompressed = nullptr;
+    const uint32_t *uvCompressed = nullptr;
+    Bounds2f uvBounds;
     const int *faceIndices = nullptr;
     bool reverseOrientation, transformSwapsHandedness;
 };
@@ -48,7 +79,8 @@ class BilinearPatchMesh {
     BilinearPatchMesh(const Transform &renderFromObject, bool reverseOrientation,
                       std::vector<int> vertexIndices, std::vector<Point3f> p,
                       std::vector<Normal3f> N, std::vector<Point2f> uv,
-                      std::vector<int> faceIndices, PiecewiseConstant2D *imageDist);
+                      std::vector<int> faceIndices, PiecewiseConstant2D *imageDist,
+                      Allocator *bufferAlloc = nullptr);
 
     std::string ToString() const;
 
@@ -67,6 +99,10 @@ class BilinearPatchMesh {
 
 struct TriQuadMesh {
     static TriQuadMesh ReadPLY(const std::string &filename);
+    // Returns the object-space bounds of a PLY file's vertices without
+    // reading them, from a "<filename>.bounds" sidecar file holding six
+    // values or from a "comment bounds x0 y0 z0 x1 y1 z1" header line
+    static pstd::optional<Bounds3f> ReadPLYBounds(const std::string &filename);
 
     void ConvertToOnlyTriangles();
     std::string ToString() const;
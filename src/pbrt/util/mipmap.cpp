@@ -4,18 +4,43 @@
 
 #include <pbrt/util/mipmap.h>
 
+#include <pbrt/options.h>
 #include <pbrt/util/check.h>
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/file.h>
+#include <pbrt/util/hash.h>
 #include <pbrt/util/log.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/memory.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/stats.h>
+#include <pbrt/util/string.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#ifdef PBRT_HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+#ifndef PBRT_IS_WINDOWS
+#include <unistd.h>
+#endif
+
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && (defined(__SSE2__) || defined(_M_X64))
+#define PBRT_MIPMAP_SSE
+#include <immintrin.h>
+#endif
 
 namespace pbrt {
 
@@ -189,33 +214,332 @@ static PBRT_CONST Float MIPFilterLUT[MIPFilterLUTSize] = {
 
 };
 
+///////////////////////////////////////////////////////////////////////////
+// Texture Tile Cache
+
+STAT_COUNTER("Texture/Tiles loaded", textureTilesLoaded);
+STAT_COUNTER("Texture/Tiles evicted", textureTilesEvicted);
+
+static constexpr int TextureTileSize = 64;
+
+// TiledTextureLevel Definition
+struct TiledTextureLevel {
+    Point2i nTiles;
+    PixelFormat format;
+    ColorEncodingHandle encoding;
+    std::vector<std::string> channelNames;
+    size_t tileBytes;
+    // Offset of the level's first tile in the cache's temporary file or, if
+    // _mapped_ is set, in that memory-mapped pyramid file.
+    int64_t offset;
+    const char *mapped = nullptr;
+};
+
+// Texture Tile Functions
+// Tiles are stored at full size, padded with zeros, in scanline order so
+// that their offsets can be computed.
+static TiledTextureLevel TextureTileLevel(const Image &image, int64_t offset) {
+    Point2i res = image.Resolution();
+    size_t texelBytes = TexelBytes(image.Format()) * image.NChannels();
+    return TiledTextureLevel{Point2i((res.x + TextureTileSize - 1) / TextureTileSize,
+                                     (res.y + TextureTileSize - 1) / TextureTileSize),
+                             image.Format(),
+                             image.Encoding(),
+                             image.ChannelNames(),
+                             Sqr(TextureTileSize) * texelBytes,
+                             offset};
+}
+
+static bool WriteTextureTiles(const Image &image, FILE *f) {
+    TiledTextureLevel tl = TextureTileLevel(image, 0);
+    Point2i res = image.Resolution();
+    size_t texelBytes = tl.tileBytes / Sqr(TextureTileSize);
+    std::vector<uint8_t> tileData(tl.tileBytes);
+    for (int ty = 0; ty < tl.nTiles.y; ++ty)
+        for (int tx = 0; tx < tl.nTiles.x; ++tx) {
+            std::fill(tileData.begin(), tileData.end(), 0);
+            Point2i p0(tx * TextureTileSize, ty * TextureTileSize);
+            int width = std::min(TextureTileSize, res.x - p0.x);
+            for (int y = 0; y < std::min(TextureTileSize, res.y - p0.y); ++y)
+                std::memcpy(&tileData[y * TextureTileSize * texelBytes],
+                            image.RawPointer({p0.x, p0.y + y}), width * texelBytes);
+            if (fwrite(tileData.data(), 1, tl.tileBytes, f) != tl.tileBytes)
+                return false;
+        }
+    return true;
+}
+
+// CachedTextureTile Definition
+struct CachedTextureTile {
+    uint64_t key;
+    Image image;
+    // Set when the tile is used and cleared as the eviction clock hand
+    // passes it.
+    std::atomic<bool> referenced{true};
+};
+
+// TextureTileCache Definition
+// With --texture-budget, MIPMap pyramids are split into square tiles that are
+// written to a temporary file when each MIPMap is created and then read back
+// when they are first used. Once the resident tiles' memory exceeds the
+// budget, tiles are evicted in approximately least recently used order using
+// the clock algorithm. Each thread also keeps a small direct-mapped cache of
+// the tiles it has used so that lookups that hit in it take no lock; an
+// evicted tile stays alive until the threads' caches no longer refer to it.
+class TextureTileCache {
+  public:
+    // TextureTileCache Public Methods
+    TextureTileCache() {
+        file = std::tmpfile();
+        if (!file)
+            ErrorExit("Unable to create temporary file for texture tiles: %s",
+                      ErrorString());
+    }
+
+    int AddPyramid(const pstd::vector<Image> &pyramid);
+    int AddMappedPyramid(std::vector<TiledTextureLevel> levels);
+    const Image &Tile(int texture, int level, Point2i tile);
+
+  private:
+    // TextureTileCache Private Methods
+    static uint64_t Key(int texture, int level, Point2i tile) {
+        return (uint64_t(texture) << 40) | (uint64_t(level) << 34) |
+               (uint64_t(tile.y) << 17) | uint64_t(tile.x);
+    }
+    // _AddLevels()_ must be called with _mutex_ held.
+    int AddLevels(std::vector<TiledTextureLevel> levels);
+    std::shared_ptr<CachedTextureTile> Lookup(uint64_t key, int texture, int level,
+                                              Point2i tile);
+    void ReadBytes(int64_t offset, void *ptr, size_t size);
+
+    // _mutex_ protects all of the following, including writes to _file_.
+    std::mutex mutex;
+    FILE *file;
+    int64_t fileSize = 0;
+    std::vector<std::vector<TiledTextureLevel>> textures;
+    std::unordered_map<uint64_t, std::shared_ptr<CachedTextureTile>> resident;
+    std::vector<std::shared_ptr<CachedTextureTile>> clock;
+    size_t clockHand = 0;
+    size_t residentBytes = 0;
+};
+
+// ThreadTextureTiles Definition
+struct ThreadTextureTiles {
+    static constexpr int Size = 32;
+    uint64_t keys[Size];
+    std::shared_ptr<CachedTextureTile> tiles[Size];
+
+    ThreadTextureTiles() { std::fill(keys, keys + Size, ~uint64_t(0)); }
+};
+
+static thread_local ThreadTextureTiles threadTextureTiles;
+
+// TextureTileCache Method Definitions
+int TextureTileCache::AddPyramid(const pstd::vector<Image> &pyramid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<TiledTextureLevel> levels;
+    for (const Image &image : pyramid) {
+        levels.push_back(TextureTileLevel(image, fileSize));
+        if (!WriteTextureTiles(image, file))
+            ErrorExit("Error writing texture tiles: %s", ErrorString());
+        fileSize += int64_t(levels.back().nTiles.x) * levels.back().nTiles.y *
+                    levels.back().tileBytes;
+    }
+    // Flush so that tiles can be read directly from the file descriptor
+    if (fflush(file) != 0)
+        ErrorExit("Error writing texture tiles: %s", ErrorString());
+    return AddLevels(std::move(levels));
+}
+
+int TextureTileCache::AddMappedPyramid(std::vector<TiledTextureLevel> levels) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return AddLevels(std::move(levels));
+}
+
+int TextureTileCache::AddLevels(std::vector<TiledTextureLevel> levels) {
+    if (textures.size() == (1 << 23))
+        ErrorExit("Too many textures for the texture tile cache.");
+    for (const TiledTextureLevel &tl : levels)
+        if (tl.nTiles.x > (1 << 17) || tl.nTiles.y > (1 << 17))
+            ErrorExit("Image too large for the texture tile cache.");
+    textures.push_back(std::move(levels));
+    return int(textures.size()) - 1;
+}
+
+void TextureTileCache::ReadBytes(int64_t offset, void *ptr, size_t size) {
+#ifdef PBRT_IS_WINDOWS
+    std::lock_guard<std::mutex> lock(mutex);
+    if (_fseeki64(file, offset, SEEK_SET) != 0 || fread(ptr, 1, size, file) != size)
+        ErrorExit("Error reading texture tiles: %s", ErrorString());
+#else
+    // _pread()_ doesn't use the file position, so reads can be concurrent.
+    if (pread(fileno(file), ptr, size, offset) != ssize_t(size))
+        ErrorExit("Error reading texture tiles: %s", ErrorString());
+#endif
+}
+
+std::shared_ptr<CachedTextureTile> TextureTileCache::Lookup(uint64_t key,
+                                                            int texture, int level,
+                                                            Point2i tile) {
+    TiledTextureLevel tl;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto iter = resident.find(key); iter != resident.end()) {
+            iter->second->referenced.store(true, std::memory_order_relaxed);
+            return iter->second;
+        }
+        tl = textures[texture][level];
+    }
+
+    // Read the tile without holding the lock
+    std::shared_ptr<CachedTextureTile> cached = std::make_shared<CachedTextureTile>();
+    cached->key = key;
+    cached->image = Image(tl.format, {TextureTileSize, TextureTileSize},
+                          tl.channelNames, tl.encoding);
+    int64_t tileOffset =
+        tl.offset + (int64_t(tile.y) * tl.nTiles.x + tile.x) * tl.tileBytes;
+    if (tl.mapped)
+        std::memcpy(cached->image.RawPointer({0, 0}), tl.mapped + tileOffset,
+                    tl.tileBytes);
+    else
+        ReadBytes(tileOffset, cached->image.RawPointer({0, 0}), tl.tileBytes);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    // Use the tile that another thread loaded in the meantime, if any
+    if (auto iter = resident.find(key); iter != resident.end())
+        return iter->second;
+    resident[key] = cached;
+    clock.push_back(cached);
+    residentBytes += tl.tileBytes;
+    AddCategoryMemory(MemoryCategory::Textures, tl.tileBytes);
+    ++textureTilesLoaded;
+
+    // Evict tiles that haven't been used since the clock hand last passed
+    size_t budget = size_t(Options->textureBudgetMB) << 20;
+    while (residentBytes > budget && clock.size() > 1) {
+        if (clockHand >= clock.size())
+            clockHand = 0;
+        std::shared_ptr<CachedTextureTile> &t = clock[clockHand];
+        if (t == cached || t->referenced.load(std::memory_order_relaxed)) {
+            t->referenced.store(false, std::memory_order_relaxed);
+            ++clockHand;
+            continue;
+        }
+        size_t bytes = t->image.BytesUsed();
+        residentBytes -= bytes;
+        AddCategoryMemory(MemoryCategory::Textures, -int64_t(bytes));
+        resident.erase(t->key);
+        t = std::move(clock.back());
+        clock.pop_back();
+        ++textureTilesEvicted;
+    }
+    cached->referenced.store(true, std::memory_order_relaxed);
+    return cached;
+}
+
+const Image &TextureTileCache::Tile(int texture, int level, Point2i tile) {
+    uint64_t key = Key(texture, level, tile);
+    ThreadTextureTiles &threadTiles = threadTextureTiles;
+    int slot = MixBits(key) & (ThreadTextureTiles::Size - 1);
+    if (threadTiles.keys[slot] == key) {
+        // Record use of the tile, avoiding writes when it's up to date
+        CachedTextureTile *cached = threadTiles.tiles[slot].get();
+        if (!cached->referenced.load(std::memory_order_relaxed))
+            cached->referenced.store(true, std::memory_order_relaxed);
+        return cached->image;
+    }
+    threadTiles.tiles[slot] = Lookup(key, texture, level, tile);
+    threadTiles.keys[slot] = key;
+    return threadTiles.tiles[slot]->image;
+}
+
+static TextureTileCache *GetTextureTileCache() {
+    static TextureTileCache *cache = new TextureTileCache;
+    return cache;
+}
+
 // MIPMap Method Definitions
+MIPMap::MIPMap(const RGBColorSpace *colorSpace, WrapMode wrapMode, Allocator alloc,
+               const MIPMapFilterOptions &options)
+    : pyramid(alloc),
+      levelResolutions(alloc),
+      colorSpace(colorSpace),
+      wrapMode(wrapMode),
+      options(options) {
+    CHECK(colorSpace != nullptr);
+}
+
 MIPMap::MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
                Allocator alloc, const MIPMapFilterOptions &options)
-    : colorSpace(colorSpace), wrapMode(wrapMode), options(options) {
-    CHECK(colorSpace != nullptr);
-    pyramid = Image::GeneratePyramid(std::move(image), wrapMode, alloc);
-    std::for_each(pyramid.begin(), pyramid.end(),
-                  [](const Image &im) { imageMapBytes += im.BytesUsed(); });
+    : MIPMap(colorSpace, wrapMode, alloc, options) {
+    InitPyramid(Image::GeneratePyramid(std::move(image), wrapMode, alloc), alloc);
+}
+
+void MIPMap::InitPyramid(pstd::vector<Image> levels, Allocator alloc) {
+    pyramid = std::move(levels);
+    for (const Image &im : pyramid)
+        levelResolutions.push_back(im.Resolution());
+    nChannels = pyramid[0].NChannels();
+
+    if (Options->textureBudgetMB > 0) {
+        // Page the pyramid's texels through the texture tile cache
+        tiledTexture = GetTextureTileCache()->AddPyramid(pyramid);
+        pyramid = pstd::vector<Image>(alloc);
+    } else
+        std::for_each(pyramid.begin(), pyramid.end(),
+                      [](const Image &im) { imageMapBytes += im.BytesUsed(); });
+}
+
+const Image *MIPMap::TexelImage(int level, Point2i *st) const {
+    CHECK(level >= 0 && level < levelResolutions.size());
+    if (!RemapPixelCoords(st, levelResolutions[level], wrapMode))
+        return nullptr;
+    if (tiledTexture < 0)
+        return &pyramid[level];
+
+    // Find the tile holding _st_ and the texel's coordinates in it
+    Point2i tile(st->x / TextureTileSize, st->y / TextureTileSize);
+    *st = Point2i(st->x % TextureTileSize, st->y % TextureTileSize);
+    return &GetTextureTileCache()->Tile(tiledTexture, level, tile);
+}
+
+Float MIPMap::BilerpChannel(int level, Point2f st, int c) const {
+    // Compute discrete texel coordinates and offsets for _st_
+    Point2i res = LevelResolution(level);
+    Float x = st[0] * res.x - 0.5f, y = st[1] * res.y - 0.5f;
+    int xi = std::floor(x), yi = std::floor(y);
+    Float dx = x - xi, dy = y - yi;
+
+    // Load texel channel values and return bilinearly interpolated value
+    auto texel = [&](Point2i p) {
+        const Image *image = TexelImage(level, &p);
+        return image ? image->GetChannel(p, c) : Float(0);
+    };
+    pstd::array<Float, 4> v = {texel({xi, yi}), texel({xi + 1, yi}),
+                               texel({xi, yi + 1}), texel({xi + 1, yi + 1})};
+    return ((1 - dx) * (1 - dy) * v[0] + dx * (1 - dy) * v[1] + (1 - dx) * dy * v[2] +
+            dx * dy * v[3]);
 }
 
 template <>
 Float MIPMap::Texel(int level, Point2i st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    return pyramid[level].GetChannel(st, 0, wrapMode);
+    const Image *image = TexelImage(level, &st);
+    return image ? image->GetChannel(st, 0) : 0;
 }
 
 template <>
 RGB MIPMap::Texel(int level, Point2i st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    if (pyramid[level].NChannels() == 3 || pyramid[level].NChannels() == 4) {
+    const Image *image = TexelImage(level, &st);
+    if (!image)
+        return RGB(0, 0, 0);
+    if (nChannels == 3 || nChannels == 4) {
         RGB rgb;
         for (int c = 0; c < 3; ++c)
-            rgb[c] = pyramid[level].GetChannel(st, c, wrapMode);
+            rgb[c] = image->GetChannel(st, c);
         return rgb;
     } else {
-        CHECK_EQ(1, pyramid[level].NChannels());
-        Float v = pyramid[level].GetChannel(st, 0, wrapMode);
+        CHECK_EQ(1, nChannels);
+        Float v = image->GetChannel(st, 0);
         return RGB(v, v, v);
     }
 }
@@ -277,21 +601,148 @@ T MIPMap::Filter(Point2f st, Vector2f dst0, Vector2f dst1) const {
             (lod - ilod) * EWA<T>(ilod + 1, st, dst0, dst1));
 }
 
+Interval MIPMap::FilterRange(Bounds2f st) const {
+    // Find the finest-level texels that zero-width lookups in _st_ may use;
+    // all of the filters then reduce to a bilinear or point lookup there.
+    Point2i res = LevelResolution(0);
+    Bounds2f texels(Point2f(st.pMin.x * res.x - 0.5f, st.pMin.y * res.y - 0.5f),
+                    Point2f(st.pMax.x * res.x + 0.5f, st.pMax.y * res.y + 0.5f));
+    // Don't bother with regions that cover many texels
+    if (texels.Area() > 65536 || std::abs(texels.pMin.x) > 1e9f ||
+        std::abs(texels.pMin.y) > 1e9f || std::abs(texels.pMax.x) > 1e9f ||
+        std::abs(texels.pMax.y) > 1e9f)
+        return Interval(-Infinity, Infinity);
+    int x0 = std::floor(texels.pMin.x), x1 = std::floor(texels.pMax.x);
+    int y0 = std::floor(texels.pMin.y), y1 = std::floor(texels.pMax.y);
+
+    Float vMin = Infinity, vMax = -Infinity;
+    for (int y = y0; y <= y1; ++y)
+        for (int x = x0; x <= x1; ++x) {
+            // Compute the value that _Filter()_ interpolates for texel $(x,y)$
+            Point2i p(x, y);
+            const Image *image = TexelImage(0, &p);
+            Float v = 0;
+            if (image) {
+                if (options.filter == FilterFunction::Point || nChannels == 1)
+                    v = image->GetChannel(p, 0);
+                else if (nChannels == 3)
+                    v = (image->GetChannel(p, 0) + image->GetChannel(p, 1) +
+                         image->GetChannel(p, 2)) /
+                        3;
+                else
+                    v = image->GetChannel(p, 3);
+            }
+            vMin = std::min(vMin, v);
+            vMax = std::max(vMax, v);
+        }
+    return Interval(vMin, vMax);
+}
+
 template <>
 RGB MIPMap::Bilerp(int level, Point2f st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    if (pyramid[level].NChannels() == 3 || pyramid[level].NChannels() == 4) {
+    if (nChannels == 3 || nChannels == 4) {
         RGB rgb;
         for (int c = 0; c < 3; ++c)
-            rgb[c] = pyramid[level].BilerpChannel(st, c, wrapMode);
+            rgb[c] = BilerpChannel(level, st, c);
         return rgb;
     } else {
-        CHECK_EQ(1, pyramid[level].NChannels());
-        Float v = pyramid[level].BilerpChannel(st, 0, wrapMode);
+        CHECK_EQ(1, nChannels);
+        Float v = BilerpChannel(level, st, 0);
         return RGB(v, v, v);
     }
 }
 
+// MIPMap EWA Helper Functions
+// EWA lookups filter runs of up to _EWARunLength_ texels along a row at once.
+static constexpr int EWARunLength = 64;
+
+// Computes the filter weights of the _n_ texels along row _t_ starting at
+// _s_ for the ellipse centered at _st_ with coefficients _A_, _B_, and _C_.
+// Texels outside the ellipse are given zero weight. A texel's weight doesn't
+// depend on the run it is a part of.
+static void EWAWeights(Float A, Float B, Float C, Point2f st, int s, int t, int n,
+                       Float *weights) {
+    Float tt = t - st[1];
+    Float Btt = B * tt, Ctt2 = C * tt * tt;
+#ifdef PBRT_MIPMAP_SSE
+    // Find four texels' lookup table indices at a time; the table's last
+    // entry is zero, so it is used for texels outside the ellipse
+    __m128 vA = _mm_set1_ps(A), vBtt = _mm_set1_ps(Btt), vCtt2 = _mm_set1_ps(Ctt2);
+    __m128 s0 = _mm_set1_ps(st[0]), one = _mm_set1_ps(1);
+    __m128 lutScale = _mm_set1_ps(MIPFilterLUTSize);
+    __m128i lutLast = _mm_set1_epi32(MIPFilterLUTSize - 1);
+    for (int i = 0; i < n; i += 4) {
+        __m128i is = _mm_add_epi32(_mm_set1_epi32(s + i), _mm_setr_epi32(0, 1, 2, 3));
+        __m128 ss = _mm_sub_ps(_mm_cvtepi32_ps(is), s0);
+        __m128 r2 =
+            _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(vA, ss), vBtt), ss), vCtt2);
+        r2 = _mm_max_ps(r2, _mm_setzero_ps());
+        __m128i outside = _mm_castps_si128(_mm_cmpge_ps(r2, one));
+        __m128i index = _mm_cvttps_epi32(_mm_mul_ps(_mm_min_ps(r2, one), lutScale));
+        index = _mm_or_si128(_mm_andnot_si128(outside, index),
+                             _mm_and_si128(outside, lutLast));
+        alignas(16) int32_t indices[4];
+        _mm_store_si128((__m128i *)indices, index);
+        for (int j = 0; j < 4 && i + j < n; ++j)
+            weights[i + j] = MIPFilterLUT[indices[j]];
+    }
+#else
+    for (int i = 0; i < n; ++i) {
+        Float ss = (s + i) - st[0];
+        Float r2 = std::max<Float>((A * ss + Btt) * ss + Ctt2, 0);
+        weights[i] = r2 < 1 ? MIPFilterLUT[int(r2 * MIPFilterLUTSize)] : 0;
+    }
+#endif
+}
+
+// Returns the _T_ value of a texel with _nc_ channels starting at _v_, as
+// MIPMap::Texel() does.
+template <typename T>
+static T EWATexel(const Float *v, int nc);
+
+template <>
+Float EWATexel(const Float *v, int nc) {
+    return v[0];
+}
+
+template <>
+RGB EWATexel(const Float *v, int nc) {
+    return nc >= 3 ? RGB(v[0], v[1], v[2]) : RGB(v[0], v[0], v[0]);
+}
+
+// Adds the weighted values of the _n_ texels of _image_ starting at _p_,
+// which must all be inside the image, to _sum_. The run's texels are
+// converted to linear values together, according to the image's format.
+template <typename T>
+static void AccumulateEWATexels(const Image &image, Point2i p, int n,
+                                const Float *weights, T *sum, Float *sumWts) {
+    int nc = image.NChannels(), nValues = n * nc;
+    Float values[EWARunLength * 4];
+    const void *texels = image.RawPointer(p);
+    switch (image.Format()) {
+    case PixelFormat::U256:
+        image.Encoding().ToLinear({static_cast<const uint8_t *>(texels), size_t(nValues)},
+                                  {values, size_t(nValues)});
+        break;
+    case PixelFormat::Half:
+        for (int i = 0; i < nValues; ++i)
+            values[i] = Float(static_cast<const Half *>(texels)[i]);
+        break;
+    case PixelFormat::Float:
+        std::copy(static_cast<const float *>(texels),
+                  static_cast<const float *>(texels) + nValues, values);
+        break;
+    default:
+        LOG_FATAL("Unhandled PixelFormat");
+    }
+
+    for (int i = 0; i < n; ++i)
+        if (weights[i] > 0) {
+            *sum += weights[i] * EWATexel<T>(&values[i * nc], nc);
+            *sumWts += weights[i];
+        }
+}
+
 template <typename T>
 T MIPMap::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     if (level >= Levels())
@@ -327,25 +778,260 @@ T MIPMap::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     T sum{};
     Float sumWts = 0;
     for (int it = t0; it <= t1; ++it) {
-        Float tt = it - st[1];
-        for (int is = s0; is <= s1; ++is) {
-            Float ss = is - st[0];
-            // Compute squared radius and filter texel if it is inside the ellipse
-            Float r2 = A * ss * ss + B * ss * tt + C * tt * tt;
-            if (r2 < 1) {
-                int index = std::min<int>(r2 * MIPFilterLUTSize, MIPFilterLUTSize - 1);
-                Float weight = MIPFilterLUT[index];
-                sum += weight * Texel<T>(level, {is, it});
-                sumWts += weight;
+        int n;
+        for (int is = s0; is <= s1; is += n) {
+            // Find the next run of texels and compute their filter weights
+            // Runs are split at the level's edges and at tile boundaries so
+            // that each one either needs wrapping or is inside one image.
+            n = std::min(s1 - is + 1, EWARunLength);
+            bool interior = it >= 0 && it < levelRes.y && is >= 0 && is < levelRes.x;
+            if (it >= 0 && it < levelRes.y && is < 0)
+                n = std::min(n, -is);
+            if (interior) {
+                n = std::min(n, levelRes.x - is);
+                if (tiledTexture >= 0)
+                    n = std::min(n, TextureTileSize - is % TextureTileSize);
             }
+            Float weights[EWARunLength];
+            EWAWeights(A, B, C, st, is, it, n, weights);
+
+            if (interior && nChannels <= 4) {
+                // Accumulate weighted texels read directly from their image
+                Point2i p(is, it);
+                const Image *image = TexelImage(level, &p);
+                AccumulateEWATexels(*image, p, n, weights, &sum, &sumWts);
+            } else
+                for (int i = 0; i < n; ++i)
+                    if (weights[i] > 0) {
+                        sum += weights[i] * Texel<T>(level, {is + i, it});
+                        sumWts += weights[i];
+                    }
         }
     }
     return sum / sumWts;
 }
 
+///////////////////////////////////////////////////////////////////////////
+// MIP Pyramid Files
+
+// Pyramid files start with a _MIPFileHeader_, which is followed by each
+// level's texels, stored as tiles in the texture tile cache's layout so that
+// the file can be memory mapped and its tiles used directly.
+static constexpr int MIPFileVersion = 1;
+static constexpr int MIPFileMaxLevels = 32;
+
+struct MIPFileLevel {
+    int32_t resolution[2];
+    int64_t offset;
+};
+
+struct MIPFileHeader {
+    char magic[8];
+    int32_t version, tileSize, format, nChannels, nLevels, wrapMode;
+    // Chromaticities of the color space's primaries and white point
+    float primaries[8];
+    char encoding[32];
+    // Comma-separated
+    char channelNames[64];
+    MIPFileLevel levels[MIPFileMaxLevels];
+};
+
+static std::string EncodingName(ColorEncodingHandle encoding) {
+    if (encoding.Is<sRGBColorEncoding>())
+        return "sRGB";
+    else if (encoding.Is<GammaColorEncoding>())
+        return StringPrintf("gamma %f", encoding.Cast<GammaColorEncoding>()->Gamma());
+    else
+        return "linear";
+}
+
+bool MIPMap::Write(const std::string &filename) const {
+    if (tiledTexture >= 0) {
+        Error("%s: MIPMaps in the texture tile cache can't be written.", filename);
+        return false;
+    }
+
+    // Initialize pyramid file header
+    MIPFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "pbrtmip", 8);
+    header.version = MIPFileVersion;
+    header.tileSize = TextureTileSize;
+    header.format = int32_t(pyramid[0].Format());
+    header.nChannels = nChannels;
+    header.nLevels = Levels();
+    header.wrapMode = int32_t(wrapMode);
+    Point2f primaries[4] = {colorSpace->r, colorSpace->g, colorSpace->b, colorSpace->w};
+    for (int i = 0; i < 4; ++i) {
+        header.primaries[2 * i] = primaries[i].x;
+        header.primaries[2 * i + 1] = primaries[i].y;
+    }
+    std::string encoding =
+        Is8Bit(pyramid[0].Format()) ? EncodingName(pyramid[0].Encoding()) : "linear";
+    std::string channelNames;
+    for (const std::string &name : pyramid[0].ChannelNames())
+        channelNames += (channelNames.empty() ? "" : ",") + name;
+    if (Levels() > MIPFileMaxLevels || encoding.size() >= sizeof(header.encoding) ||
+        channelNames.size() >= sizeof(header.channelNames)) {
+        Error("%s: unable to store MIPMap in pyramid file.", filename);
+        return false;
+    }
+    std::strcpy(header.encoding, encoding.c_str());
+    std::strcpy(header.channelNames, channelNames.c_str());
+    int64_t offset = sizeof(header);
+    for (int level = 0; level < Levels(); ++level) {
+        TiledTextureLevel tl = TextureTileLevel(pyramid[level], offset);
+        header.levels[level] = {{levelResolutions[level].x, levelResolutions[level].y},
+                                offset};
+        offset += int64_t(tl.nTiles.x) * tl.nTiles.y * tl.tileBytes;
+    }
+
+    bool written = WriteFileAtomic(filename, [&](FILE *f) {
+        bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+        for (int level = 0; level < Levels() && success; ++level)
+            success = WriteTextureTiles(pyramid[level], f);
+        return success;
+    });
+    if (!written) {
+        Error("%s: unable to write MIP pyramid file: %s", filename, ErrorString());
+        return false;
+    }
+    return true;
+}
+
+MIPMap *MIPMap::ReadPyramidFile(const std::string &filename,
+                                const MIPMapFilterOptions &options, WrapMode wrapMode,
+                                Allocator alloc) {
+    // Map pyramid file into memory, or read it if memory mapping is unavailable
+    const char *data = nullptr;
+    size_t size = 0;
+#ifdef PBRT_HAVE_MMAP
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1)
+        ErrorExit("%s: %s", filename, ErrorString());
+    struct stat stat;
+    if (fstat(fd, &stat) == 0 && stat.st_size > 0) {
+        size = stat.st_size;
+        void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED)
+            data = static_cast<const char *>(ptr);
+    }
+    close(fd);
+    if (!data)
+        ErrorExit("%s: unable to map MIP pyramid file: %s", filename, ErrorString());
+#else
+    std::string contents = ReadFileContents(filename);
+    data = contents.data();
+    size = contents.size();
+#endif
+
+    // Validate pyramid file header
+    MIPFileHeader header;
+    if (size < sizeof(header))
+        ErrorExit("%s: not a MIP pyramid file.", filename);
+    std::memcpy(&header, data, sizeof(header));
+    header.encoding[sizeof(header.encoding) - 1] = '\0';
+    header.channelNames[sizeof(header.channelNames) - 1] = '\0';
+    std::vector<std::string> channelNames = SplitString(header.channelNames, ',');
+    if (std::memcmp(header.magic, "pbrtmip", 8) != 0 ||
+        header.version != MIPFileVersion || header.tileSize != TextureTileSize ||
+        header.nLevels < 1 || header.nLevels > MIPFileMaxLevels ||
+        header.nChannels != channelNames.size() ||
+        (header.format != int32_t(PixelFormat::U256) &&
+         header.format != int32_t(PixelFormat::Half) &&
+         header.format != int32_t(PixelFormat::Float)))
+        ErrorExit("%s: not a valid MIP pyramid file.", filename);
+    PixelFormat format = PixelFormat(header.format);
+    ColorEncodingHandle encoding =
+        Is8Bit(format) ? ColorEncodingHandle::Get(header.encoding, alloc) : nullptr;
+    std::vector<TiledTextureLevel> levels;
+    for (int level = 0; level < header.nLevels; ++level) {
+        const MIPFileLevel &fl = header.levels[level];
+        Point2i res(fl.resolution[0], fl.resolution[1]);
+        if (res.x < 1 || res.y < 1)
+            ErrorExit("%s: not a valid MIP pyramid file.", filename);
+        Image image(format, {1, 1}, channelNames, encoding);
+        TiledTextureLevel tl = TextureTileLevel(image, fl.offset);
+        tl.nTiles = Point2i((res.x + TextureTileSize - 1) / TextureTileSize,
+                            (res.y + TextureTileSize - 1) / TextureTileSize);
+        tl.mapped = data;
+        if (fl.offset < sizeof(header) ||
+            fl.offset + int64_t(tl.nTiles.x) * tl.nTiles.y * tl.tileBytes > size)
+            ErrorExit("%s: MIP pyramid file is truncated.", filename);
+        levels.push_back(std::move(tl));
+    }
+
+    const RGBColorSpace *colorSpace = RGBColorSpace::Lookup(
+        Point2f(header.primaries[0], header.primaries[1]),
+        Point2f(header.primaries[2], header.primaries[3]),
+        Point2f(header.primaries[4], header.primaries[5]),
+        Point2f(header.primaries[6], header.primaries[7]));
+    if (!colorSpace) {
+        Warning("%s: unknown color space in MIP pyramid file. Using sRGB.", filename);
+        colorSpace = RGBColorSpace::sRGB;
+    }
+    if (WrapMode(header.wrapMode) != wrapMode)
+        Warning("%s: MIP pyramid was built with \"%s\" wrap mode, not \"%s\".",
+                filename, WrapMode(header.wrapMode), wrapMode);
+
+    MIPMap *mipmap = alloc.allocate_object<MIPMap>();
+    new (mipmap) MIPMap(colorSpace, wrapMode, alloc, options);
+#ifdef PBRT_HAVE_MMAP
+    if (Options->textureBudgetMB > 0) {
+        // Use tiles from the mapped file, which remains mapped, as needed
+        for (int level = 0; level < header.nLevels; ++level)
+            mipmap->levelResolutions.push_back(
+                Point2i(header.levels[level].resolution[0],
+                        header.levels[level].resolution[1]));
+        mipmap->nChannels = header.nChannels;
+        mipmap->tiledTexture = GetTextureTileCache()->AddMappedPyramid(std::move(levels));
+        return mipmap;
+    }
+#endif
+
+    // Copy the levels' texels out of their tiles
+    pstd::vector<Image> pyramid(alloc);
+    for (int level = 0; level < header.nLevels; ++level) {
+        const TiledTextureLevel &tl = levels[level];
+        const MIPFileLevel &fl = header.levels[level];
+        Point2i res(fl.resolution[0], fl.resolution[1]);
+        Image image(format, res, channelNames, encoding, alloc);
+        size_t texelBytes = tl.tileBytes / Sqr(TextureTileSize);
+        ParallelFor(0, tl.nTiles.y, [&](int64_t ty) {
+            for (int tx = 0; tx < tl.nTiles.x; ++tx) {
+                const char *tile =
+                    data + tl.offset + (ty * tl.nTiles.x + tx) * tl.tileBytes;
+                Point2i p0(tx * TextureTileSize, ty * TextureTileSize);
+                int width = std::min(TextureTileSize, res.x - p0.x);
+                for (int y = 0; y < std::min<int>(TextureTileSize, res.y - p0.y); ++y)
+                    std::memcpy(image.RawPointer({p0.x, p0.y + y}),
+                                tile + y * TextureTileSize * texelBytes,
+                                width * texelBytes);
+            }
+        });
+        pyramid.push_back(std::move(image));
+    }
+#ifdef PBRT_HAVE_MMAP
+    munmap(const_cast<char *>(data), size);
+#endif
+    mipmap->InitPyramid(std::move(pyramid), alloc);
+    return mipmap;
+}
+
 MIPMap *MIPMap::CreateFromFile(const std::string &filename,
                                const MIPMapFilterOptions &options, WrapMode wrapMode,
                                ColorEncodingHandle encoding, Allocator alloc) {
+    if (HasExtension(filename, "mip"))
+        return ReadPyramidFile(filename, options, wrapMode, alloc);
+
+    ImageAndMetadata imageAndMetadata = ReadImage(filename, encoding, alloc);
+    const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
+    return alloc.new_object<MIPMap>(std::move(imageAndMetadata.image), colorSpace,
+                                    wrapMode, alloc, options);
+}
+
+ImageAndMetadata MIPMap::ReadImage(const std::string &filename,
+                                   ColorEncodingHandle encoding, Allocator alloc) {
     ImageAndMetadata imageAndMetadata = Image::Read(filename, alloc, encoding);
 
     Image &image = imageAndMetadata.image;
@@ -372,9 +1058,7 @@ MIPMap *MIPMap::CreateFromFile(const std::string &filename,
         }
     }
 
-    const RGBColorSpace *colorSpace = imageAndMetadata.metadata.GetColorSpace();
-    return alloc.new_object<MIPMap>(std::move(image), colorSpace, wrapMode, alloc,
-                                    options);
+    return imageAndMetadata;
 }
 
 template <typename T>
@@ -389,24 +1073,26 @@ T MIPMap::Bilerp(int level, Point2f st) const {
 
 template <>
 Float MIPMap::Bilerp(int level, Point2f st) const {
-    CHECK(level >= 0 && level < pyramid.size());
-    switch (pyramid[level].NChannels()) {
+    switch (nChannels) {
     case 1:
-        return pyramid[level].BilerpChannel(st, 0, wrapMode);
+        return BilerpChannel(level, st, 0);
     case 3:
-        return pyramid[level].Bilerp(st, wrapMode).Average();
+        return (BilerpChannel(level, st, 0) + BilerpChannel(level, st, 1) +
+                BilerpChannel(level, st, 2)) /
+               3;
     case 4:
         // Return alpha
-        return pyramid[level].BilerpChannel(st, 3, wrapMode);
+        return BilerpChannel(level, st, 3);
     default:
-        LOG_FATAL("Unexpected number of image channels: %d", pyramid[level].NChannels());
+        LOG_FATAL("Unexpected number of image channels: %d", nChannels);
     }
 }
 
 std::string MIPMap::ToString() const {
-    return StringPrintf("[ MIPMap pyramid: %s colorSpace: %s wrapMode: %s "
-                        "options: %s ]",
-                        pyramid, colorSpace->ToString(), wrapMode, options);
+    return StringPrintf("[ MIPMap pyramid: %s tiledTexture: %d levelResolutions: %s "
+                        "colorSpace: %s wrapMode: %s options: %s ]",
+                        pyramid, tiledTexture, levelResolutions, colorSpace->ToString(),
+                        wrapMode, options);
 }
 
 // Explicit template instantiation..
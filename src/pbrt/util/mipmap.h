@@ -8,6 +8,7 @@
 #include <pbrt/pbrt.h>
 
 #include <pbrt/util/image.h>
+#include <pbrt/util/math.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/vecmath.h>
 
@@ -51,33 +52,60 @@ class MIPMap {
     // MIPMap Public Methods
     MIPMap(Image image, const RGBColorSpace *colorSpace, WrapMode wrapMode,
            Allocator alloc, const MIPMapFilterOptions &options);
+    // Files with a ".mip" extension are read as pyramids written by Write().
     static MIPMap *CreateFromFile(const std::string &filename,
                                   const MIPMapFilterOptions &options, WrapMode wrapMode,
                                   ColorEncodingHandle encoding, Allocator alloc);
+    // Reads an image file (but not a ".mip" file) and returns the image with
+    // the channels that CreateFromFile() would use, ready to be passed to the
+    // MIPMap constructor.
+    static ImageAndMetadata ReadImage(const std::string &filename,
+                                      ColorEncodingHandle encoding, Allocator alloc);
+
+    // Writes the pyramid to a file that CreateFromFile() memory maps, so that
+    // the image needn't be decoded and its pyramid built again.
+    bool Write(const std::string &filename) const;
 
     template <typename T>
     T Filter(Point2f st, Vector2f dstdx, Vector2f dstdy) const;
+    // Returns bounds on the values Filter<Float>() returns with zero-width
+    // filter footprints at $(s,t)$ points inside _st_.
+    Interval FilterRange(Bounds2f st) const;
 
     std::string ToString() const;
 
     Point2i LevelResolution(int level) const {
-        CHECK(level >= 0 && level < pyramid.size());
-        return pyramid[level].Resolution();
+        CHECK(level >= 0 && level < levelResolutions.size());
+        return levelResolutions[level];
     }
-    int Levels() const { return int(pyramid.size()); }
+    int Levels() const { return int(levelResolutions.size()); }
     const RGBColorSpace *GetRGBColorSpace() const { return colorSpace; }
 
   private:
     // MIPMap Private Methods
+    MIPMap(const RGBColorSpace *colorSpace, WrapMode wrapMode, Allocator alloc,
+           const MIPMapFilterOptions &options);
+    void InitPyramid(pstd::vector<Image> levels, Allocator alloc);
+    static MIPMap *ReadPyramidFile(const std::string &filename,
+                                   const MIPMapFilterOptions &options, WrapMode wrapMode,
+                                   Allocator alloc);
+
     template <typename T>
     T Texel(int level, Point2i st) const;
     template <typename T>
     T Bilerp(int level, Point2f st) const;
     template <typename T>
     T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
+    const Image *TexelImage(int level, Point2i *st) const;
+    Float BilerpChannel(int level, Point2f st, int c) const;
 
     // MIPMap Private Members
+    // With --texture-budget, _pyramid_ is empty and texels are read from
+    // tiles of texture _tiledTexture_ in the texture tile cache.
     pstd::vector<Image> pyramid;
+    int tiledTexture = -1;
+    pstd::vector<Point2i> levelResolutions;
+    int nChannels;
     const RGBColorSpace *colorSpace;
     WrapMode wrapMode;
     MIPMapFilterOptions options;
@@ -4,11 +4,17 @@
 
 #include <pbrt/util/noise.h>
 
+#include <pbrt/util/check.h>
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
 #include <cmath>
 
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && (defined(__SSE2__) || defined(_M_X64))
+#define PBRT_NOISE_SSE
+#include <immintrin.h>
+#endif
+
 namespace pbrt {
 
 PBRT_CPU_GPU
@@ -106,6 +112,131 @@ inline Float NoiseWeight(Float t) {
     return 6 * Pow<5>(t) - 15 * Pow<4>(t) + 10 * Pow<3>(t);
 }
 
+#ifdef PBRT_NOISE_SSE
+// SSE Noise Function Definitions
+// These compute the same values as the scalar functions above, for four
+// points at a time.
+static inline __m128 Select4(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128 Grad4(__m128i h, __m128 dx, __m128 dy, __m128 dz) {
+    h = _mm_and_si128(h, _mm_set1_epi32(15));
+    __m128i is12or13 = _mm_or_si128(_mm_cmpeq_epi32(h, _mm_set1_epi32(12)),
+                                     _mm_cmpeq_epi32(h, _mm_set1_epi32(13)));
+    __m128 uMask = _mm_castsi128_ps(
+        _mm_or_si128(_mm_cmplt_epi32(h, _mm_set1_epi32(8)), is12or13));
+    __m128 vMask = _mm_castsi128_ps(
+        _mm_or_si128(_mm_cmplt_epi32(h, _mm_set1_epi32(4)), is12or13));
+    // Negate _u_ and _v_ by flipping their sign bits according to _h_
+    __m128 uSign =
+        _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    __m128 vSign =
+        _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    __m128 u = _mm_xor_ps(Select4(uMask, dx, dy), uSign);
+    __m128 v = _mm_xor_ps(Select4(vMask, dy, dz), vSign);
+    return _mm_add_ps(u, v);
+}
+
+static inline __m128 NoiseWeight4(__m128 t) {
+    __m128 t2 = _mm_mul_ps(t, t), t3 = _mm_mul_ps(t2, t);
+    __m128 t4 = _mm_mul_ps(t2, t2), t5 = _mm_mul_ps(t4, t);
+    return _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_set1_ps(6), t5),
+                                 _mm_mul_ps(_mm_set1_ps(15), t4)),
+                      _mm_mul_ps(_mm_set1_ps(10), t3));
+}
+
+static inline __m128 Lerp4(__m128 t, __m128 a, __m128 b) {
+    return _mm_add_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1), t), a), _mm_mul_ps(t, b));
+}
+
+static inline __m128 Floor4(__m128 v) {
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, v), _mm_set1_ps(1)));
+}
+
+static __m128 Noise4(__m128 x, __m128 y, __m128 z) {
+    // Compute noise cell coordinates and offsets
+    __m128 fx = Floor4(x), fy = Floor4(y), fz = Floor4(z);
+    __m128 dx = _mm_sub_ps(x, fx), dy = _mm_sub_ps(y, fy), dz = _mm_sub_ps(z, fz);
+    __m128i permMask = _mm_set1_epi32(NoisePermSize - 1);
+    alignas(16) int ix[4], iy[4], iz[4];
+    _mm_store_si128((__m128i *)ix, _mm_and_si128(_mm_cvttps_epi32(fx), permMask));
+    _mm_store_si128((__m128i *)iy, _mm_and_si128(_mm_cvttps_epi32(fy), permMask));
+    _mm_store_si128((__m128i *)iz, _mm_and_si128(_mm_cvttps_epi32(fz), permMask));
+
+    // Look up the hashes of the cells' corners, sharing the outer lookups
+    // among corners
+    alignas(16) int h[8][4];
+    for (int i = 0; i < 4; ++i) {
+        int a = NoisePerm[ix[i]] + iy[i], b = NoisePerm[ix[i] + 1] + iy[i];
+        int aa = NoisePerm[a] + iz[i], ab = NoisePerm[a + 1] + iz[i];
+        int ba = NoisePerm[b] + iz[i], bb = NoisePerm[b + 1] + iz[i];
+        h[0][i] = NoisePerm[aa];
+        h[1][i] = NoisePerm[ba];
+        h[2][i] = NoisePerm[ab];
+        h[3][i] = NoisePerm[bb];
+        h[4][i] = NoisePerm[aa + 1];
+        h[5][i] = NoisePerm[ba + 1];
+        h[6][i] = NoisePerm[ab + 1];
+        h[7][i] = NoisePerm[bb + 1];
+    }
+
+    // Compute gradient weights
+    __m128 one = _mm_set1_ps(1);
+    __m128 dx1 = _mm_sub_ps(dx, one), dy1 = _mm_sub_ps(dy, one),
+           dz1 = _mm_sub_ps(dz, one);
+    auto hash = [&](int c) { return _mm_load_si128((const __m128i *)h[c]); };
+    __m128 w000 = Grad4(hash(0), dx, dy, dz);
+    __m128 w100 = Grad4(hash(1), dx1, dy, dz);
+    __m128 w010 = Grad4(hash(2), dx, dy1, dz);
+    __m128 w110 = Grad4(hash(3), dx1, dy1, dz);
+    __m128 w001 = Grad4(hash(4), dx, dy, dz1);
+    __m128 w101 = Grad4(hash(5), dx1, dy, dz1);
+    __m128 w011 = Grad4(hash(6), dx, dy1, dz1);
+    __m128 w111 = Grad4(hash(7), dx1, dy1, dz1);
+
+    // Compute trilinear interpolation of weights
+    __m128 wx = NoiseWeight4(dx), wy = NoiseWeight4(dy), wz = NoiseWeight4(dz);
+    __m128 x00 = Lerp4(wx, w000, w100);
+    __m128 x10 = Lerp4(wx, w010, w110);
+    __m128 x01 = Lerp4(wx, w001, w101);
+    __m128 x11 = Lerp4(wx, w011, w111);
+    __m128 y0 = Lerp4(wy, x00, x10);
+    __m128 y1 = Lerp4(wy, x01, x11);
+    return Lerp4(wz, y0, y1);
+}
+
+// Computes the noise values of four successive octaves of FBm() or
+// Turbulence() at _p_, starting with the octave at frequency _lambda_.
+static void OctaveNoise4(Point3f p, Float lambda, Float noise[4]) {
+    alignas(16) Float l[4];
+    for (int j = 0; j < 4; ++j) {
+        l[j] = lambda;
+        lambda *= 1.99f;
+    }
+    __m128 vl = _mm_load_ps(l);
+    __m128 x = _mm_mul_ps(vl, _mm_set1_ps(p.x)), y = _mm_mul_ps(vl, _mm_set1_ps(p.y));
+    __m128 z = _mm_mul_ps(vl, _mm_set1_ps(p.z));
+    _mm_storeu_ps(noise, Noise4(x, y, z));
+}
+#endif  // PBRT_NOISE_SSE
+
+void Noise(pstd::span<const Point3f> p, pstd::span<Float> result) {
+    CHECK_EQ(p.size(), result.size());
+    size_t i = 0;
+#ifdef PBRT_NOISE_SSE
+    for (; i + 4 <= p.size(); i += 4) {
+        __m128 x = _mm_setr_ps(p[i].x, p[i + 1].x, p[i + 2].x, p[i + 3].x);
+        __m128 y = _mm_setr_ps(p[i].y, p[i + 1].y, p[i + 2].y, p[i + 3].y);
+        __m128 z = _mm_setr_ps(p[i].z, p[i + 1].z, p[i + 2].z, p[i + 3].z);
+        _mm_storeu_ps(&result[i], Noise4(x, y, z));
+    }
+#endif
+    for (; i < p.size(); ++i)
+        result[i] = Noise(p[i]);
+}
+
 Float FBm(Point3f p, Vector3f dpdx, Vector3f dpdy, Float omega, int maxOctaves) {
     // Compute number of octaves for antialiased FBm
     Float len2 = std::max(LengthSquared(dpdx), LengthSquared(dpdy));
@@ -114,13 +245,30 @@ Float FBm(Point3f p, Vector3f dpdx, Vector3f dpdy, Float omega, int maxOctaves)
 
     // Compute sum of octaves of noise for FBm
     Float sum = 0, lambda = 1, o = 1;
+    Float nPartial = n - nInt;
+#if defined(PBRT_NOISE_SSE) && !defined(PBRT_IS_GPU_CODE)
+    // Compute four octaves' noise at a time, including the partial octave
+    for (int i0 = 0; i0 <= nInt; i0 += 4) {
+        Float noise[4];
+        OctaveNoise4(p, lambda, noise);
+        for (int i = i0; i < std::min(i0 + 4, nInt + 1); ++i) {
+            if (i == nInt) {
+                sum += o * SmoothStep(nPartial, .3f, .7f) * noise[i - i0];
+                break;
+            }
+            sum += o * noise[i - i0];
+            lambda *= 1.99f;
+            o *= omega;
+        }
+    }
+#else
     for (int i = 0; i < nInt; ++i) {
         sum += o * Noise(lambda * p);
         lambda *= 1.99f;
         o *= omega;
     }
-    Float nPartial = n - nInt;
     sum += o * SmoothStep(nPartial, .3f, .7f) * Noise(lambda * p);
+#endif
 
     return sum;
 }
@@ -133,6 +281,24 @@ Float Turbulence(Point3f p, Vector3f dpdx, Vector3f dpdy, Float omega, int maxOc
 
     // Compute sum of octaves of noise for turbulence
     Float sum = 0, lambda = 1, o = 1;
+    Float nPartial = n - nInt;
+#if defined(PBRT_NOISE_SSE) && !defined(PBRT_IS_GPU_CODE)
+    // Compute four octaves' noise at a time, including the partial octave
+    for (int i0 = 0; i0 <= nInt; i0 += 4) {
+        Float noise[4];
+        OctaveNoise4(p, lambda, noise);
+        for (int i = i0; i < std::min(i0 + 4, nInt + 1); ++i) {
+            if (i == nInt) {
+                sum += o * Lerp(SmoothStep(nPartial, .3f, .7f), 0.2,
+                                std::abs(noise[i - i0]));
+                break;
+            }
+            sum += o * std::abs(noise[i - i0]);
+            lambda *= 1.99f;
+            o *= omega;
+        }
+    }
+#else
     for (int i = 0; i < nInt; ++i) {
         sum += o * std::abs(Noise(lambda * p));
         lambda *= 1.99f;
@@ -140,8 +306,8 @@ Float Turbulence(Point3f p, Vector3f dpdx, Vector3f dpdy, Float omega, int maxOc
     }
 
     // Account for contributions of clamped octaves in turbulence
-    Float nPartial = n - nInt;
     sum += o * Lerp(SmoothStep(nPartial, .3f, .7f), 0.2, std::abs(Noise(lambda * p)));
+#endif
     for (int i = nInt; i < maxOctaves; ++i) {
         sum += o * 0.2f;
         o *= omega;
@@ -0,0 +1,47 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/noise.h>
+#include <pbrt/util/rng.h>
+#include <pbrt/util/vecmath.h>
+
+#include <vector>
+
+using namespace pbrt;
+
+TEST(Noise, BatchMatchesScalar) {
+    RNG rng;
+    // Use a count that isn't a multiple of the batch size.
+    std::vector<Point3f> p(1003);
+    for (Point3f &pt : p)
+        pt = Point3f(Lerp(rng.Uniform<Float>(), -100, 100),
+                     Lerp(rng.Uniform<Float>(), -100, 100),
+                     Lerp(rng.Uniform<Float>(), -10, 10));
+    std::vector<Float> result(p.size());
+    Noise(p, pstd::MakeSpan(result));
+    for (size_t i = 0; i < p.size(); ++i)
+        EXPECT_EQ(Noise(p[i]), result[i]) << p[i];
+}
+
+TEST(Noise, FBmOctaves) {
+    // With a tiny filter width, FBm() should use all of the octaves and
+    // match a direct sum over them; the partial octave has zero weight.
+    RNG rng;
+    for (int i = 0; i < 100; ++i) {
+        Point3f p(Lerp(rng.Uniform<Float>(), -10, 10), Lerp(rng.Uniform<Float>(), -10, 10),
+                  Lerp(rng.Uniform<Float>(), -10, 10));
+        Vector3f d(1e-6f, 0, 0);
+        int maxOctaves = 1 + i % 9;
+        Float sum = 0, lambda = 1, o = 1;
+        for (int j = 0; j < maxOctaves; ++j) {
+            sum += o * Noise(lambda * p);
+            lambda *= 1.99f;
+            o *= .5f;
+        }
+        EXPECT_EQ(sum, FBm(p, d, d, .5f, maxOctaves));
+    }
+}
@@ -5,15 +5,26 @@
 #include <pbrt/util/parallel.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/perfcounters.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/string.h>
+#include <pbrt/util/trace.h>
 #ifdef PBRT_BUILD_GPU_RENDERER
 #include <pbrt/gpu/init.h>
 #endif  // PBRT_BUILD_GPU_RENDERER
 
 #include <iterator>
 #include <list>
+#include <memory>
 #include <thread>
 #include <vector>
+#ifdef PBRT_IS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
 
 namespace pbrt {
 
@@ -40,30 +51,127 @@ bool Barrier::Block() {
     return --numToExit == 0;
 }
 
+// ChunkDeque Definition
+// A ChunkDeque holds a contiguous range of chunk indices [begin, end) for
+// a parallel job. Both ends are packed into a single 64-bit word, so that
+// the owning thread, which takes chunks from the front, and other threads,
+// which steal half of the remaining chunks from the back, only need a
+// compare-and-swap to update it.
+class alignas(64) ChunkDeque {
+  public:
+    // ChunkDeque Public Methods
+    void Reset(int64_t begin, int64_t end) { range = Pack(begin, end); }
+
+    bool PopFront(int64_t *chunk) {
+        uint64_t r = range.load(std::memory_order_relaxed);
+        while (true) {
+            uint32_t begin = Begin(r), end = End(r);
+            if (begin >= end)
+                return false;
+            if (range.compare_exchange_weak(r, Pack(begin + 1, end))) {
+                *chunk = begin;
+                return true;
+            }
+        }
+    }
+
+    bool StealBack(int64_t *stolenBegin, int64_t *stolenEnd) {
+        uint64_t r = range.load(std::memory_order_relaxed);
+        while (true) {
+            uint32_t begin = Begin(r), end = End(r);
+            if (begin >= end)
+                return false;
+            uint32_t mid = begin + (end - begin) / 2;
+            if (range.compare_exchange_weak(r, Pack(begin, mid))) {
+                *stolenBegin = mid;
+                *stolenEnd = end;
+                return true;
+            }
+        }
+    }
+
+    // Removes all chunks from the deque and returns how many there were.
+    int64_t Clear() {
+        uint64_t r = range.exchange(Pack(0, 0));
+        return std::max<int64_t>(0, int64_t(End(r)) - int64_t(Begin(r)));
+    }
+
+    // Installs the given range if the deque is currently empty; returns
+    // false if some other thread has refilled it in the meantime.
+    bool Refill(int64_t begin, int64_t end) {
+        uint64_t r = range.load(std::memory_order_relaxed);
+        if (Begin(r) < End(r))
+            return false;
+        return range.compare_exchange_strong(r, Pack(begin, end));
+    }
+
+    std::string ToString() const {
+        uint64_t r = range.load(std::memory_order_relaxed);
+        return StringPrintf("[ ChunkDeque begin: %d end: %d ]", Begin(r), End(r));
+    }
+
+  private:
+    // ChunkDeque Private Methods
+    static uint64_t Pack(int64_t begin, int64_t end) {
+        DCHECK(begin >= 0 && begin <= end && end <= 0xffffffff);
+        return (uint64_t(begin) << 32) | uint64_t(end);
+    }
+    static uint32_t Begin(uint64_t r) { return uint32_t(r >> 32); }
+    static uint32_t End(uint64_t r) { return uint32_t(r & 0xffffffff); }
+
+    // ChunkDeque Private Members
+    std::atomic<uint64_t> range{0};
+};
+
 // ParallelJob Definition
 class ParallelJob {
   public:
     // ParallelJob Public Methods
+    ParallelJob(int64_t nChunks, int nDeques, const CancellationToken *cancel = nullptr);
     virtual ~ParallelJob() { DCHECK(removed); }
 
-    virtual bool HaveWork() const = 0;
-    virtual void RunStep(std::unique_lock<std::mutex> *lock) = 0;
+    bool HaveWork() const { return chunksRemaining.load(std::memory_order_relaxed) > 0; }
+    void RunSteps();
 
     bool Finished() const { return !HaveWork() && activeWorkers == 0; }
 
     virtual std::string ToString() const = 0;
 
   protected:
+    // ParallelJob Protected Methods
+    virtual void RunChunk(int64_t chunk) = 0;
+    // Name used for the job's chunks in trace files
+    virtual const char *TraceName() const = 0;
+
+    bool Cancelled() const { return cancel && cancel->IsCancelled(); }
+
     std::string BaseToString() const {
-        return StringPrintf("activeWorkers: %d removed: %s", activeWorkers, removed);
+        std::string s =
+            StringPrintf("activeWorkers: %d removed: %s chunksRemaining: %d deques: [ ",
+                         activeWorkers, removed, chunksRemaining.load());
+        for (int i = 0; i < nDeques; ++i)
+            s += deques[i].ToString() + " ";
+        return s + "]";
     }
 
   private:
+    // ParallelJob Private Methods
+    void RunTracedChunk(int64_t chunk) {
+        TraceScope trace(TraceName(), "ParallelJob", chunk);
+        RunChunk(chunk);
+    }
+
     // ParallelJob Private Members
     friend class ThreadPool;
+    friend void EnqueueAsyncWork(std::function<void(void)> work);
+    std::unique_ptr<ChunkDeque[]> deques;
+    int nDeques;
+    std::atomic<int64_t> chunksRemaining;
+    const CancellationToken *cancel;
     int activeWorkers = 0;
     ParallelJob *prev = nullptr, *next = nullptr;
     bool removed = false;
+    bool deleteWhenFinished = false;
 };
 
 // ThreadPool Definition
@@ -80,6 +188,7 @@ class ThreadPool {
     void RemoveFromJobList(ParallelJob *job);
 
     void WorkOrWait(std::unique_lock<std::mutex> *lock);
+    bool WorkOrReturn();
 
     void ForEachThread(std::function<void(void)> func);
 
@@ -88,6 +197,9 @@ class ThreadPool {
   private:
     // ThreadPool Private Methods
     void workerFunc(int tIndex);
+    void LockJobList(std::unique_lock<std::mutex> *lock);
+    ParallelJob *FindJobWithWork() const;
+    void RunJob(ParallelJob *job, std::unique_lock<std::mutex> *lock);
 
     // ThreadPool Private Members
     std::vector<std::thread> threads;
@@ -101,6 +213,151 @@ thread_local int ThreadIndex;
 
 static std::unique_ptr<ThreadPool> threadPool;
 static bool maxThreadIndexCalled = false;
+static std::vector<int> threadCPUs;
+
+// Thread Affinity Function Definitions
+#ifdef PBRT_IS_LINUX
+// Parses CPU and node lists in the sysfs format, e.g. "0-15,32-47".
+static std::vector<int> ParseSysfsList(const std::string &str) {
+    std::vector<int> values;
+    for (std::string_view range : SplitString(str, ',')) {
+        std::vector<int> ends = SplitStringToInts(range, '-');
+        if (ends.size() == 1)
+            values.push_back(ends[0]);
+        else if (ends.size() == 2)
+            for (int i = ends[0]; i <= ends[1]; ++i)
+                values.push_back(i);
+    }
+    return values;
+}
+#endif  // PBRT_IS_LINUX
+
+// Returns the CPUs that threads should be pinned to, indexed by
+// _ThreadIndex_. Successive threads alternate between NUMA nodes so that
+// memory bandwidth is used evenly even if fewer threads than cores are
+// running.
+static std::vector<int> ThreadAffinityCPUs() {
+#ifdef PBRT_IS_LINUX
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        Warning("Unable to get CPU affinity mask: %s", ErrorString());
+        return {};
+    }
+
+    // Find the CPUs in each NUMA node that this process may run on
+    std::vector<std::vector<int>> nodeCPUs;
+    std::vector<int> nodes;
+    if (FileExists("/sys/devices/system/node/online"))
+        nodes = ParseSysfsList(ReadFileContents("/sys/devices/system/node/online"));
+    for (int node : nodes) {
+        std::string filename =
+            StringPrintf("/sys/devices/system/node/node%d/cpulist", node);
+        if (!FileExists(filename))
+            continue;
+        std::vector<int> cpus;
+        for (int cpu : ParseSysfsList(ReadFileContents(filename)))
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        if (!cpus.empty())
+            nodeCPUs.push_back(cpus);
+    }
+    if (nodeCPUs.empty()) {
+        // No NUMA topology available; treat all CPUs as a single node
+        nodeCPUs.push_back({});
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed))
+                nodeCPUs.back().push_back(cpu);
+    }
+    LOG_VERBOSE("Found %d NUMA nodes for thread affinity", nodeCPUs.size());
+
+    // Interleave CPUs from the nodes
+    std::vector<int> cpus;
+    for (size_t i = 0;; ++i) {
+        bool added = false;
+        for (const std::vector<int> &node : nodeCPUs)
+            if (i < node.size()) {
+                cpus.push_back(node[i]);
+                added = true;
+            }
+        if (!added)
+            break;
+    }
+    return cpus;
+#else
+    Warning("Thread affinity is not supported on this system.");
+    return {};
+#endif  // PBRT_IS_LINUX
+}
+
+static void SetThreadAffinity(int tIndex) {
+    if (threadCPUs.empty())
+        return;
+#ifdef PBRT_IS_LINUX
+    int cpu = threadCPUs[tIndex % threadCPUs.size()];
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpu, &cpuSet);
+    if (int err = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+        err != 0)
+        Warning("Unable to pin thread %d to CPU %d: %s", tIndex, cpu, ErrorString(err));
+    else
+        LOG_VERBOSE("Pinned thread %d to CPU %d", tIndex, cpu);
+#endif  // PBRT_IS_LINUX
+}
+
+// ParallelJob Method Definitions
+ParallelJob::ParallelJob(int64_t nChunks, int nDeques, const CancellationToken *cancel)
+    : deques(new ChunkDeque[nDeques]),
+      nDeques(nDeques),
+      chunksRemaining(nChunks),
+      cancel(cancel) {
+    CHECK_LE(nChunks, 0xffffffff);
+    // Give each thread a contiguous range of chunks to start with
+    for (int i = 0; i < nDeques; ++i)
+        deques[i].Reset(nChunks * i / nDeques, nChunks * (i + 1) / nDeques);
+}
+
+void ParallelJob::RunSteps() {
+    int ownIndex = ThreadIndex % nDeques;
+    ChunkDeque &own = deques[ownIndex];
+    while (HaveWork()) {
+        // Discard all chunks that haven't been started if the job was cancelled
+        if (Cancelled()) {
+            for (int i = 0; i < nDeques; ++i)
+                chunksRemaining.fetch_sub(deques[i].Clear(), std::memory_order_relaxed);
+            return;
+        }
+
+        // Run the next chunk from this thread's deque, if available
+        int64_t chunk;
+        if (own.PopFront(&chunk)) {
+            chunksRemaining.fetch_sub(1, std::memory_order_relaxed);
+            RunTracedChunk(chunk);
+            continue;
+        }
+
+        // Steal half of the remaining chunks from another thread's deque
+        int64_t begin, end;
+        int victim = 1;
+        while (victim < nDeques &&
+               !deques[(ownIndex + victim) % nDeques].StealBack(&begin, &end))
+            ++victim;
+        if (victim == nDeques)
+            // Any chunks that remain have already been taken by other threads
+            return;
+
+        if (end - begin > 1 && own.Refill(begin + 1, end)) {
+            chunksRemaining.fetch_sub(1, std::memory_order_relaxed);
+            RunTracedChunk(begin);
+        } else {
+            // Run all stolen chunks here if they couldn't be made stealable
+            chunksRemaining.fetch_sub(end - begin, std::memory_order_relaxed);
+            for (int64_t c = begin; c < end && !Cancelled(); ++c)
+                RunTracedChunk(c);
+        }
+    }
+}
 
 // ThreadPool Method Definitions
 ThreadPool::ThreadPool(int nThreads) {
@@ -112,6 +369,8 @@ ThreadPool::ThreadPool(int nThreads) {
 void ThreadPool::workerFunc(int tIndex) {
     LOG_VERBOSE("Started execution in worker thread %d", tIndex);
     ThreadIndex = tIndex;
+    SetThreadAffinity(tIndex);
+    PerfCountersThreadInit();
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     GPUThreadInit();
@@ -124,8 +383,18 @@ void ThreadPool::workerFunc(int tIndex) {
     LOG_VERBOSE("Exiting worker thread %d", tIndex);
 }
 
+void ThreadPool::LockJobList(std::unique_lock<std::mutex> *lock) {
+    // Record how long the thread is blocked if the lock isn't available
+    if (TracingEnabled() && !lock->try_lock()) {
+        TraceScope trace("Lock job list", "ThreadPool");
+        lock->lock();
+    } else if (!lock->owns_lock())
+        lock->lock();
+}
+
 std::unique_lock<std::mutex> ThreadPool::AddToJobList(ParallelJob *job) {
-    std::unique_lock<std::mutex> lock(mutex);
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    LockJobList(&lock);
     // Add _job_ to head of _jobList_
     if (jobList != nullptr)
         jobList->prev = job;
@@ -136,25 +405,54 @@ std::unique_lock<std::mutex> ThreadPool::AddToJobList(ParallelJob *job) {
     return lock;
 }
 
-void ThreadPool::WorkOrWait(std::unique_lock<std::mutex> *lock) {
-    DCHECK(lock->owns_lock());
-
+ParallelJob *ThreadPool::FindJobWithWork() const {
     ParallelJob *job = jobList;
     while ((job != nullptr) && !job->HaveWork())
         job = job->next;
-    if (job != nullptr) {
-        // Execute work for _job_
-        job->activeWorkers++;
-        job->RunStep(lock);
-        DCHECK(!lock->owns_lock());
-        lock->lock();
-        job->activeWorkers--;
-        if (job->Finished())
-            jobListCondition.notify_all();
+    return job;
+}
 
-    } else
+void ThreadPool::RunJob(ParallelJob *job, std::unique_lock<std::mutex> *lock) {
+    DCHECK(lock->owns_lock());
+    // Execute work for _job_ without holding the job list lock
+    job->activeWorkers++;
+    lock->unlock();
+    job->RunSteps();
+    LockJobList(lock);
+    job->activeWorkers--;
+
+    // Remove job from list if all work has been started
+    if (!job->HaveWork() && !job->removed)
+        RemoveFromJobList(job);
+
+    if (job->Finished()) {
+        jobListCondition.notify_all();
+        // Jobs started with _EnqueueAsyncWork()_ are owned by the pool
+        if (job->deleteWhenFinished)
+            delete job;
+    }
+}
+
+void ThreadPool::WorkOrWait(std::unique_lock<std::mutex> *lock) {
+    DCHECK(lock->owns_lock());
+
+    if (ParallelJob *job = FindJobWithWork(); job != nullptr)
+        RunJob(job, lock);
+    else {
         // Wait for new work to arrive or the job to finish
+        TraceScope trace("Wait", "ThreadPool");
         jobListCondition.wait(*lock);
+    }
+}
+
+bool ThreadPool::WorkOrReturn() {
+    std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+    LockJobList(&lock);
+    ParallelJob *job = FindJobWithWork();
+    if (job == nullptr)
+        return false;
+    RunJob(job, &lock);
+    return true;
 }
 
 void ThreadPool::RemoveFromJobList(ParallelJob *job) {
@@ -217,105 +515,127 @@ std::string ThreadPool::ToString() const {
 class ParallelForLoop1D : public ParallelJob {
   public:
     // ParallelForLoop1D Public Methods
-    ParallelForLoop1D(int64_t startIndex, int64_t endIndex, int chunkSize,
-                      std::function<void(int64_t, int64_t)> func)
-        : func(std::move(func)),
-          nextIndex(startIndex),
+    ParallelForLoop1D(int64_t startIndex, int64_t endIndex, int64_t chunkSize,
+                      std::function<void(int64_t, int64_t)> func,
+                      const CancellationToken *cancel = nullptr)
+        : ParallelJob((endIndex - startIndex + chunkSize - 1) / chunkSize,
+                      RunningThreads(), cancel),
+          func(std::move(func)),
+          startIndex(startIndex),
           endIndex(endIndex),
           chunkSize(chunkSize) {}
 
-    bool HaveWork() const { return nextIndex < endIndex; }
-
-    void RunStep(std::unique_lock<std::mutex> *lock);
-
     std::string ToString() const {
-        return StringPrintf("[ ParallelForLoop1D nextIndex: %d endIndex: %d "
-                            "chunkSize: %d ]",
-                            nextIndex, endIndex, chunkSize);
+        return StringPrintf("[ ParallelForLoop1D startIndex: %d endIndex: %d "
+                            "chunkSize: %d %s ]",
+                            startIndex, endIndex, chunkSize, BaseToString());
     }
 
+  protected:
+    void RunChunk(int64_t chunk);
+    const char *TraceName() const { return "ParallelFor"; }
+
   private:
     // ParallelForLoop1D Private Members
     std::function<void(int64_t, int64_t)> func;
-    int64_t nextIndex, endIndex;
-    int chunkSize;
+    int64_t startIndex, endIndex;
+    int64_t chunkSize;
 };
 
 class ParallelForLoop2D : public ParallelJob {
   public:
     ParallelForLoop2D(const Bounds2i &extent, int chunkSize,
                       std::function<void(Bounds2i)> func)
-        : func(std::move(func)),
+        : ParallelJob(int64_t(nChunks(extent.Diagonal().x, chunkSize)) *
+                          nChunks(extent.Diagonal().y, chunkSize),
+                      RunningThreads()),
+          func(std::move(func)),
           extent(extent),
-          nextStart(extent.pMin),
+          xChunks(nChunks(extent.Diagonal().x, chunkSize)),
           chunkSize(chunkSize) {}
 
-    bool HaveWork() const { return nextStart.y < extent.pMax.y; }
-    void RunStep(std::unique_lock<std::mutex> *lock);
-
     std::string ToString() const {
-        return StringPrintf("[ ParallelForLoop2D extent: %s nextStart: %s "
-                            "chunkSize: %d ]",
-                            extent, nextStart, chunkSize);
+        return StringPrintf("[ ParallelForLoop2D extent: %s xChunks: %d "
+                            "chunkSize: %d %s ]",
+                            extent, xChunks, chunkSize, BaseToString());
     }
 
+  protected:
+    void RunChunk(int64_t chunk);
+    const char *TraceName() const { return "ParallelFor2D"; }
+
   private:
+    static int nChunks(int extent, int chunkSize) {
+        return (extent + chunkSize - 1) / chunkSize;
+    }
+
     std::function<void(Bounds2i)> func;
     const Bounds2i extent;
-    Point2i nextStart;
+    int xChunks;
     int chunkSize;
 };
 
+// AsyncJob Definition
+class AsyncJob : public ParallelJob {
+  public:
+    // AsyncJob Public Methods
+    AsyncJob(std::function<void(void)> work) : ParallelJob(1, 1), work(std::move(work)) {}
+
+    std::string ToString() const {
+        return StringPrintf("[ AsyncJob %s ]", BaseToString());
+    }
+
+  protected:
+    void RunChunk(int64_t chunk) { work(); }
+    const char *TraceName() const { return "RunAsync"; }
+
+  private:
+    std::function<void(void)> work;
+};
+
 // ParallelForLoop1D Method Definitions
-void ParallelForLoop1D::RunStep(std::unique_lock<std::mutex> *lock) {
-    // Determine the range of loop iterations to run in this step
-    int64_t indexStart = nextIndex;
+void ParallelForLoop1D::RunChunk(int64_t chunk) {
+    // Determine the range of loop iterations to run for _chunk_
+    int64_t indexStart = startIndex + chunk * chunkSize;
     int64_t indexEnd = std::min(indexStart + chunkSize, endIndex);
-    nextIndex = indexEnd;
-
-    // Remove job from list if all work has been started
-    if (!HaveWork())
-        threadPool->RemoveFromJobList(this);
 
-    // Release lock and execute loop iterations in _[indexStart, indexEnd)_
-    lock->unlock();
+    // Execute loop iterations in _[indexStart, indexEnd)_
     func(indexStart, indexEnd);
 }
 
-void ParallelForLoop2D::RunStep(std::unique_lock<std::mutex> *lock) {
-    // Compute extent for this step
-    Point2i end = nextStart + Vector2i(chunkSize, chunkSize);
-    Bounds2i b = Intersect(Bounds2i(nextStart, end), extent);
+void ParallelForLoop2D::RunChunk(int64_t chunk) {
+    // Compute extent for _chunk_
+    Point2i start = extent.pMin + Vector2i(int(chunk % xChunks) * chunkSize,
+                                           int(chunk / xChunks) * chunkSize);
+    Bounds2i b = Intersect(Bounds2i(start, start + Vector2i(chunkSize, chunkSize)),
+                           extent);
     CHECK(!b.IsEmpty());
 
-    // Advance to be ready for the next extent.
-    nextStart.x += chunkSize;
-    if (nextStart.x >= extent.pMax.x) {
-        nextStart.x = extent.pMin.x;
-        nextStart.y += chunkSize;
-    }
-
-    if (!HaveWork())
-        threadPool->RemoveFromJobList(this);
-
-    lock->unlock();
-
     // Run the loop iteration
     func(b);
 }
 
 // Parallel Function Defintions
 void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t)> func) {
-    CHECK(threadPool);
-    // Compute chunk size and possibly run entire loop on current thread
+    // Compute chunk size so that there are about 8 chunks per thread
     int64_t chunkSize = std::max<int64_t>(1, (end - start) / (8 * RunningThreads()));
-    if (end - start < chunkSize) {
-        func(start, end);
+    ParallelFor(start, end, chunkSize, std::move(func));
+}
+
+void ParallelFor(int64_t start, int64_t end, int64_t grainSize,
+                 std::function<void(int64_t, int64_t)> func,
+                 const CancellationToken *cancel) {
+    CHECK(threadPool);
+    CHECK_GT(grainSize, 0);
+    // Possibly run entire loop on current thread
+    if (end - start <= grainSize) {
+        if (!cancel || !cancel->IsCancelled())
+            func(start, end);
         return;
     }
 
     // Create and enqueue _ParallelForLoop1D_ for this loop
-    ParallelForLoop1D loop(start, end, chunkSize, std::move(func));
+    ParallelForLoop1D loop(start, end, grainSize, std::move(func), cancel);
     std::unique_lock<std::mutex> lock = threadPool->AddToJobList(&loop);
 
     // Help out with parallel loop iterations in the current thread
@@ -323,6 +643,20 @@ void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t
         threadPool->WorkOrWait(&lock);
 }
 
+void EnqueueAsyncWork(std::function<void(void)> work) {
+    if (!threadPool) {
+        work();
+        return;
+    }
+    AsyncJob *job = new AsyncJob(std::move(work));
+    job->deleteWhenFinished = true;
+    threadPool->AddToJobList(job);
+}
+
+bool DoParallelWork() {
+    return threadPool && threadPool->WorkOrReturn();
+}
+
 int MaxThreadIndex() {
     maxThreadIndexCalled = true;
     return threadPool ? (1 + threadPool->size()) : 1;
@@ -363,7 +697,7 @@ int RunningThreads() {
     return threadPool ? (1 + threadPool->size()) : 1;
 }
 
-void ParallelInit(int nThreads) {
+void ParallelInit(int nThreads, bool pinThreads) {
     // This is risky: if the caller has allocated per-thread data
     // structures before calling ParallelInit(), then we may end up having
     // them accessed with a higher ThreadIndex than the caller expects.
@@ -372,14 +706,45 @@ void ParallelInit(int nThreads) {
     CHECK(!threadPool);
     if (nThreads <= 0)
         nThreads = AvailableCores();
+    if (pinThreads) {
+        threadCPUs = ThreadAffinityCPUs();
+        SetThreadAffinity(0);
+    }
     threadPool = std::make_unique<ThreadPool>(nThreads);
 }
 
 void ParallelCleanup() {
     threadPool.reset();
+    threadCPUs.clear();
     maxThreadIndexCalled = false;
 }
 
+bool ThreadsArePinned() {
+    return !threadCPUs.empty();
+}
+
+void ParallelFirstTouch(void *ptr, size_t size) {
+    // Only bother if the threads will stay on the NUMA node where they
+    // touched the memory and there is enough memory to be worth it
+    if (!threadPool || !ThreadsArePinned() || size < 1024 * 1024)
+        return;
+
+#ifdef PBRT_IS_LINUX
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+#else
+    size_t pageSize = 4096;
+#endif
+    // Write to the first byte of each page of _ptr_ from the thread pool
+    uintptr_t start = reinterpret_cast<uintptr_t>(ptr);
+    uintptr_t firstPage = (start + pageSize - 1) / pageSize * pageSize;
+    int64_t nPages = (start + size - firstPage + pageSize - 1) / pageSize;
+    if (firstPage != start)
+        *static_cast<volatile char *>(ptr) = 0;
+    ParallelFor(0, nPages, [&](int64_t page) {
+        *reinterpret_cast<volatile char *>(firstPage + page * pageSize) = 0;
+    });
+}
+
 void ForEachThread(std::function<void(void)> func) {
     if (threadPool)
         threadPool->ForEachThread(std::move(func));
@@ -7,16 +7,24 @@
 
 #include <pbrt/pbrt.h>
 
+#include <pbrt/util/check.h>
 #include <pbrt/util/float.h>
+#include <pbrt/util/pstd.h>
 #include <pbrt/util/vecmath.h>
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstdint>
 #include <functional>
+#include <future>
 #include <initializer_list>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace pbrt {
 
@@ -158,7 +166,31 @@ class Barrier {
     int numToBlock, numToExit;
 };
 
+// CancellationToken Definition
+// A CancellationToken can be passed to _ParallelFor()_ so that another
+// thread can stop a loop early; chunks of the loop that have not started
+// running when _Cancel()_ is called are skipped.
+class CancellationToken {
+  public:
+    // CancellationToken Public Methods
+    CancellationToken() = default;
+    CancellationToken(const CancellationToken &) = delete;
+    CancellationToken &operator=(const CancellationToken &) = delete;
+
+    void Cancel() { cancelled.store(true, std::memory_order_relaxed); }
+    bool IsCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+    void Reset() { cancelled.store(false, std::memory_order_relaxed); }
+
+  private:
+    std::atomic<bool> cancelled{false};
+};
+
 void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t, int64_t)> func);
+// Runs _func_ over ranges of at most _grainSize_ iterations, stopping early
+// if _cancel_ is non-null and is cancelled.
+void ParallelFor(int64_t start, int64_t end, int64_t grainSize,
+                 std::function<void(int64_t, int64_t)> func,
+                 const CancellationToken *cancel = nullptr);
 void ParallelFor2D(const Bounds2i &extent, std::function<void(Bounds2i)> func);
 
 // Parallel Inline Functions
@@ -169,6 +201,18 @@ inline void ParallelFor(int64_t start, int64_t end, std::function<void(int64_t)>
     });
 }
 
+inline void ParallelFor(int64_t start, int64_t end, int64_t grainSize,
+                        std::function<void(int64_t)> func,
+                        const CancellationToken *cancel = nullptr) {
+    ParallelFor(
+        start, end, grainSize,
+        [&func](int64_t start, int64_t end) {
+            for (int64_t i = start; i < end; ++i)
+                func(i);
+        },
+        cancel);
+}
+
 inline void ParallelFor2D(const Bounds2i &extent, std::function<void(Point2i)> func) {
     ParallelFor2D(extent, [&func](Bounds2i b) {
         for (Point2i p : b)
@@ -178,17 +222,121 @@ inline void ParallelFor2D(const Bounds2i &extent, std::function<void(Point2i)> f
 
 void ForEachThread(std::function<void(void)> func);
 
+// Asynchronous Task Declarations
+void EnqueueAsyncWork(std::function<void(void)> work);
+// Runs some available parallel work on the calling thread if there is any;
+// returns false if there was none.
+bool DoParallelWork();
+
+// Future Definition
+template <typename T>
+class Future {
+  public:
+    // Future Public Methods
+    Future() = default;
+    explicit Future(std::future<T> &&f) : fut(std::move(f)) {}
+
+    bool Valid() const { return fut.valid(); }
+    bool IsReady() const {
+        return fut.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+
+    // Rather than blocking, the waiting thread runs other queued parallel
+    // work until the result is available.
+    void Wait() {
+        while (!IsReady())
+            if (!DoParallelWork()) {
+                // All remaining work is running on other threads
+                fut.wait();
+                return;
+            }
+    }
+
+    T Get() {
+        Wait();
+        return fut.get();
+    }
+
+  private:
+    std::future<T> fut;
+};
+
+// Asynchronous Task Inline Functions
+template <typename F, typename... Args>
+inline auto RunAsync(F func, Args &&...args) {
+    using R = std::invoke_result_t<F, Args...>;
+    auto task = std::make_shared<std::packaged_task<R(void)>>(
+        std::bind(std::move(func), std::forward<Args>(args)...));
+    Future<R> future(task->get_future());
+    EnqueueAsyncWork([task]() { (*task)(); });
+    return future;
+}
+
 // ThreadIndex Declaration
 extern thread_local int ThreadIndex;
 
 // ParallelFunction Declarations
-void ParallelInit(int nThreads = -1);
+void ParallelInit(int nThreads = -1, bool pinThreads = false);
 void ParallelCleanup();
 
+bool ThreadsArePinned();
+// Writes to each page of the uninitialized memory starting at _ptr_ using
+// all of the threads, so that if threads are pinned, the operating system's
+// first-touch policy will spread its pages across the NUMA nodes.
+void ParallelFirstTouch(void *ptr, size_t size);
+
 int AvailableCores();
 int RunningThreads();
 int MaxThreadIndex();
 
+// ThreadLocal Definition
+// ThreadLocal holds a separate value of type _T_ for each thread, indexed
+// by _ThreadIndex_. Each value is created by the provided function the
+// first time its thread calls _Get()_ and is padded to a separate cache
+// line to avoid false sharing.
+template <typename T>
+class ThreadLocal {
+  public:
+    // ThreadLocal Public Methods
+    ThreadLocal() : ThreadLocal([]() { return T(); }) {}
+    ThreadLocal(std::function<T(void)> create)
+        : create(std::move(create)), slots(MaxThreadIndex()) {}
+
+    T &Get() {
+        DCHECK_LT(ThreadIndex, (int)slots.size());
+        pstd::optional<T> &value = slots[ThreadIndex].value;
+        if (!value.has_value())
+            value = create();
+        return *value;
+    }
+
+    // _ForAll()_ and _Reduce()_ must not be called concurrently with _Get()_.
+    template <typename F>
+    void ForAll(F &&func) {
+        for (Slot &slot : slots)
+            if (slot.value.has_value())
+                func(*slot.value);
+    }
+
+    template <typename R, typename F>
+    R Reduce(R initial, F &&combine) const {
+        for (const Slot &slot : slots)
+            if (slot.value.has_value())
+                initial = combine(std::move(initial), *slot.value);
+        return initial;
+    }
+
+  private:
+    // ThreadLocal::Slot Definition
+    struct alignas(64) Slot {
+        pstd::optional<T> value;
+    };
+
+    // ThreadLocal Private Members
+    std::function<T(void)> create;
+    std::vector<Slot> slots;
+};
+
 }  // namespace pbrt
 
 #endif  // PBRT_UTIL_PARALLEL_H
@@ -6,6 +6,7 @@
 #include <pbrt/pbrt.h>
 #include <pbrt/util/parallel.h>
 #include <atomic>
+#include <vector>
 
 using namespace pbrt;
 
@@ -44,3 +45,102 @@ TEST(Parallel, ForEachThread) {
     ForEachThread([&count] { --count; });
     EXPECT_EQ(0, count);
 }
+
+TEST(Parallel, Nested) {
+    // Each iteration should run exactly once, even when loops are nested
+    // and chunks are stolen between threads.
+    std::vector<std::atomic<int>> counts(100 * 123);
+    ParallelFor(0, 100, [&](int64_t i) {
+        ParallelFor(0, 123, [&](int64_t j) { ++counts[i * 123 + j]; });
+    });
+    for (const auto &c : counts)
+        EXPECT_EQ(1, c);
+
+    std::vector<std::atomic<int>> pixelCounts(317 * 129);
+    ParallelFor2D(Bounds2i{{0, 0}, {317, 129}},
+                  [&](Point2i p) { ++pixelCounts[p.y * 317 + p.x]; });
+    for (const auto &c : pixelCounts)
+        EXPECT_EQ(1, c);
+}
+
+TEST(Parallel, RunAsync) {
+    std::vector<Future<int>> futures;
+    for (int i = 0; i < 100; ++i)
+        futures.push_back(RunAsync([](int v) { return v * v; }, i));
+
+    // Tasks may themselves run parallel loops and wait on other tasks.
+    std::atomic<int> counter{0};
+    Future<int> nested = RunAsync([&]() {
+        Future<int> inner = RunAsync([&]() {
+            ParallelFor(0, 1000, [&](int64_t) { ++counter; });
+            return 7;
+        });
+        return inner.Get() + 1;
+    });
+
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(i * i, futures[i].Get());
+    EXPECT_EQ(8, nested.Get());
+    EXPECT_EQ(1000, counter);
+
+    Future<void> done = RunAsync([&]() { counter = 0; });
+    done.Wait();
+    EXPECT_TRUE(done.IsReady());
+    EXPECT_EQ(0, counter);
+}
+
+TEST(Parallel, GrainSize) {
+    for (int64_t grainSize : {1, 7, 64, 5000}) {
+        std::vector<std::atomic<int>> counts(3000);
+        ParallelFor(0, counts.size(), grainSize, [&](int64_t start, int64_t end) {
+            EXPECT_LE(end - start, grainSize);
+            for (int64_t i = start; i < end; ++i)
+                ++counts[i];
+        });
+        for (const std::atomic<int> &c : counts)
+            EXPECT_EQ(1, c.load());
+    }
+}
+
+TEST(Parallel, Cancel) {
+    CancellationToken cancel;
+    cancel.Cancel();
+    std::atomic<int> counter{0};
+    ParallelFor(0, 1000, 1, [&](int64_t) { ++counter; }, &cancel);
+    EXPECT_EQ(0, counter);
+
+    // Cancel the loop from inside one of its iterations; chunks that were
+    // already running may finish, but most should be skipped.
+    cancel.Reset();
+    ParallelFor(
+        0, 100000, 1,
+        [&](int64_t i) {
+            if (++counter == 100)
+                cancel.Cancel();
+        },
+        &cancel);
+    EXPECT_GE(counter, 100);
+    EXPECT_LT(counter, 100000);
+}
+
+TEST(Parallel, ThreadLocal) {
+    std::atomic<int> nCreated{0};
+    ThreadLocal<int64_t> sums([&]() {
+        ++nCreated;
+        return int64_t(0);
+    });
+    ParallelFor(0, 100000, [&](int64_t i) { sums.Get() += i; });
+
+    EXPECT_GE(nCreated, 1);
+    EXPECT_LE(nCreated, RunningThreads());
+    EXPECT_EQ(int64_t(100000) * 99999 / 2,
+              sums.Reduce(int64_t(0), [](int64_t a, int64_t b) { return a + b; }));
+
+    int nValues = 0;
+    sums.ForAll([&](int64_t &v) {
+        ++nValues;
+        v = 0;
+    });
+    EXPECT_EQ(nCreated, nValues);
+    EXPECT_EQ(0, sums.Reduce(int64_t(0), [](int64_t a, int64_t b) { return a + b; }));
+}
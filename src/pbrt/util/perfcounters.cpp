@@ -0,0 +1,214 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/perfcounters.h>
+
+#include <pbrt/util/error.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+#include <pbrt/util/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#ifdef PBRT_IS_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace pbrt {
+
+// ThreadPerfCounters Definition
+// The first of a thread's counters leads the group, so that they are all
+// scheduled together and can be read at once.
+struct ThreadPerfCounters {
+    int threadIndex;
+    int fds[NumPerfCounters];
+};
+
+// PerfCounterPhaseStats Definition
+struct PerfCounterPhaseStats {
+    const char *name;
+    int64_t count;
+    int64_t nanoseconds;
+    PerfCounterValues values;
+};
+
+// Performance Counter Local Variables
+static std::atomic<bool> perfCountersEnabled{false};
+static std::atomic<bool> perfCountersWarned{false};
+// Threads' counters are only ever added, so a phase's starting values can be
+// matched to them by index.
+static std::mutex perfCountersMutex;
+static std::vector<ThreadPerfCounters> threadPerfCounters;
+static std::vector<PerfCounterPhaseStats> phaseStats;
+
+// Performance Counter Utility Functions
+#ifdef PBRT_IS_LINUX
+static bool OpenThreadPerfCounters(ThreadPerfCounters *tc) {
+    const uint64_t configs[NumPerfCounters] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < NumPerfCounters; ++i) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // Count the calling thread on whichever CPU it runs
+        int groupFd = (i == 0) ? -1 : tc->fds[0];
+        tc->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+        if (tc->fds[i] == -1) {
+            int err = errno;
+            for (int j = 0; j < i; ++j)
+                close(tc->fds[j]);
+            if (!perfCountersWarned.exchange(true))
+                Warning("Unable to open hardware performance counters: %s. "
+                        "(Check /proc/sys/kernel/perf_event_paranoid.)",
+                        strerror(err));
+            return false;
+        }
+    }
+    return true;
+}
+
+static PerfCounterValues ReadThreadPerfCounters(const ThreadPerfCounters &tc) {
+    // Read the group's values and scale them to account for the time the
+    // kernel had them multiplexed out
+    uint64_t data[3 + NumPerfCounters];
+    PerfCounterValues v;
+    if (read(tc.fds[0], data, sizeof(data)) != sizeof(data) || data[0] != NumPerfCounters)
+        return v;
+    uint64_t timeEnabled = data[1], timeRunning = data[2];
+    if (timeRunning == 0)
+        return v;
+    double scale = double(timeEnabled) / double(timeRunning);
+    for (int i = 0; i < NumPerfCounters; ++i)
+        v.counts[i] = int64_t(data[3 + i] * scale);
+    return v;
+}
+#endif  // PBRT_IS_LINUX
+
+static void ReadAllPerfCounters(std::vector<PerfCounterValues> *values) {
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    values->resize(threadPerfCounters.size());
+#ifdef PBRT_IS_LINUX
+    for (size_t i = 0; i < threadPerfCounters.size(); ++i)
+        (*values)[i] = ReadThreadPerfCounters(threadPerfCounters[i]);
+#endif
+}
+
+// Performance Counter Function Definitions
+void PerfCountersInit() {
+#ifdef PBRT_IS_LINUX
+    ThreadPerfCounters tc;
+    tc.threadIndex = ThreadIndex;
+    if (!OpenThreadPerfCounters(&tc))
+        return;
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    threadPerfCounters.push_back(tc);
+    perfCountersEnabled = true;
+#else
+    Warning("Hardware performance counters are only supported on Linux.");
+#endif
+}
+
+void PerfCountersThreadInit() {
+#ifdef PBRT_IS_LINUX
+    if (!PerfCountersEnabled())
+        return;
+    ThreadPerfCounters tc;
+    tc.threadIndex = ThreadIndex;
+    if (!OpenThreadPerfCounters(&tc))
+        return;
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    threadPerfCounters.push_back(tc);
+#endif
+}
+
+bool PerfCountersEnabled() {
+    return perfCountersEnabled.load(std::memory_order_relaxed);
+}
+
+void PrintPerfCounters(FILE *dest) {
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    if (phaseStats.empty())
+        return;
+    fprintf(dest, "Hardware performance counters (summed over threads; phases may "
+                  "nest):\n");
+    fprintf(dest, "  %-16s %6s %10s %10s %7s %15s %15s\n", "Phase", "Count", "Time",
+            "Cycles", "IPC", "LLC miss/kinst", "Br. miss/kinst");
+    for (const PerfCounterPhaseStats &p : phaseStats) {
+        double cycles = p.values[PerfCounter::Cycles];
+        double kinst = p.values[PerfCounter::Instructions] / 1000.;
+        double ipc = cycles > 0 ? 1000 * kinst / cycles : 0;
+        auto perKinst = [&](PerfCounter c) {
+            return kinst > 0 ? p.values[c] / kinst : 0;
+        };
+        fprintf(dest, "  %-16s %6" PRId64 " %9.3fs %10.3g %7.2f %15.3f %15.3f\n", p.name,
+                p.count, p.nanoseconds / 1e9, cycles, ipc,
+                perKinst(PerfCounter::LLCMisses), perKinst(PerfCounter::BranchMisses));
+    }
+}
+
+// PerfCounterPhase Method Definitions
+PerfCounterPhase::PerfCounterPhase(const char *name) : name(name) {
+    if (!PerfCountersEnabled())
+        return;
+    ReadAllPerfCounters(&startValues);
+    startTime = TraceTimestamp();
+}
+
+void PerfCounterPhase::End() {
+    if (startTime < 0)
+        return;
+    std::vector<PerfCounterValues> endValues;
+    ReadAllPerfCounters(&endValues);
+    int64_t endTime = TraceTimestamp();
+
+    // Compute each thread's counts over the phase and add them to the totals
+    PerfCounterValues total;
+    for (size_t i = 0; i < endValues.size(); ++i) {
+        PerfCounterValues delta =
+            i < startValues.size() ? endValues[i] - startValues[i] : endValues[i];
+        total += delta;
+        if (delta[PerfCounter::Cycles] == 0)
+            continue;
+        int threadIndex;
+        {
+            std::lock_guard<std::mutex> lock(perfCountersMutex);
+            threadIndex = threadPerfCounters[i].threadIndex;
+        }
+        TraceAnnotatedEvent(name, "PerfCounters", threadIndex, startTime, endTime,
+                            {{"cycles", delta[PerfCounter::Cycles]},
+                             {"instructions", delta[PerfCounter::Instructions]},
+                             {"llcMisses", delta[PerfCounter::LLCMisses]},
+                             {"branchMisses", delta[PerfCounter::BranchMisses]}});
+    }
+
+    std::lock_guard<std::mutex> lock(perfCountersMutex);
+    auto iter = std::find_if(phaseStats.begin(), phaseStats.end(),
+                             [&](const PerfCounterPhaseStats &p) {
+                                 return strcmp(p.name, name) == 0;
+                             });
+    if (iter == phaseStats.end())
+        iter = phaseStats.insert(phaseStats.end(),
+                                 PerfCounterPhaseStats{name, 0, 0, PerfCounterValues()});
+    ++iter->count;
+    iter->nanoseconds += endTime - startTime;
+    iter->values += total;
+    startTime = -1;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,83 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_PERFCOUNTERS_H
+#define PBRT_UTIL_PERFCOUNTERS_H
+
+#include <pbrt/pbrt.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace pbrt {
+
+// Hardware performance counters are read with Linux's perf_event interface
+// for each of pbrt's threads. The counts over each render phase (parsing,
+// scene creation, BVH construction, rendering waves, and image writes) are
+// summed over the threads and reported with the statistics; each thread's
+// counts are also added to the Chrome trace, if one is being recorded.
+
+// PerfCounter Definition
+enum class PerfCounter { Cycles, Instructions, LLCMisses, BranchMisses };
+static constexpr int NumPerfCounters = 4;
+
+// PerfCounterValues Definition
+struct PerfCounterValues {
+    PerfCounterValues &operator+=(const PerfCounterValues &v) {
+        for (int i = 0; i < NumPerfCounters; ++i)
+            counts[i] += v.counts[i];
+        return *this;
+    }
+    PerfCounterValues operator-(const PerfCounterValues &v) const {
+        PerfCounterValues d;
+        for (int i = 0; i < NumPerfCounters; ++i)
+            d.counts[i] = counts[i] - v.counts[i];
+        return d;
+    }
+    int64_t operator[](PerfCounter c) const { return counts[int(c)]; }
+
+    int64_t counts[NumPerfCounters] = {};
+};
+
+// Performance Counter Function Declarations
+// PerfCountersInit() opens the calling thread's counters; other threads'
+// are opened by PerfCountersThreadInit(), which does nothing if counters
+// weren't enabled. If the counters can't be opened (e.g., because
+// /proc/sys/kernel/perf_event_paranoid doesn't allow it), a warning is
+// issued and they are disabled.
+void PerfCountersInit();
+void PerfCountersThreadInit();
+bool PerfCountersEnabled();
+void PrintPerfCounters(FILE *dest);
+
+// PerfCounterPhase Definition
+// Records the counts of all threads' counters from construction until
+// End() is called or the phase is destroyed. Phases may nest, in which case
+// the inner ones' counts are also included in the outer ones'.
+class PerfCounterPhase {
+  public:
+    // PerfCounterPhase Public Methods
+    // _name_ must be a string literal or otherwise outlive the program's
+    // statistics.
+    explicit PerfCounterPhase(const char *name);
+    ~PerfCounterPhase() { End(); }
+
+    PerfCounterPhase(const PerfCounterPhase &) = delete;
+    PerfCounterPhase &operator=(const PerfCounterPhase &) = delete;
+
+    void End();
+
+  private:
+    // PerfCounterPhase Private Members
+    const char *name;
+    int64_t startTime = -1;
+    // Counts of each thread's counters at the start of the phase; threads
+    // that start during it start from zero.
+    std::vector<PerfCounterValues> startValues;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_PERFCOUNTERS_H
@@ -5,12 +5,17 @@
 #include <pbrt/util/progressreporter.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/math.h>
 #include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
+#include <pbrt/util/stats.h>
 
 #include <cerrno>
+#include <cmath>
 #include <cstdio>
 #include <memory>
+#include <mutex>
 
 #ifdef PBRT_IS_WINDOWS
 #include <windows.h>
@@ -30,6 +35,40 @@ namespace pbrt {
 
 static int TerminalWidth();
 
+// Progress Reporting Local Variables
+static bool progressShowRates = false;
+static FILE *progressStream = nullptr;
+static std::mutex progressStreamMutex;
+
+// Progress Reporting Function Definitions
+void ProgressInit(bool showRates, const std::string &streamFilename) {
+    progressShowRates = showRates;
+    if (streamFilename == "-")
+        progressStream = stdout;
+    else if (!streamFilename.empty()) {
+        progressStream = fopen(streamFilename.c_str(), "w");
+        if (!progressStream)
+            ErrorExit("%s: %s", streamFilename, ErrorString());
+    }
+}
+
+void ProgressCleanup() {
+    std::lock_guard<std::mutex> lock(progressStreamMutex);
+    if (progressStream && progressStream != stdout)
+        fclose(progressStream);
+    progressStream = nullptr;
+}
+
+static std::string FormatRate(double rate) {
+    if (rate >= 1e9)
+        return StringPrintf("%.2fG", rate / 1e9);
+    if (rate >= 1e6)
+        return StringPrintf("%.2fM", rate / 1e6);
+    if (rate >= 1e3)
+        return StringPrintf("%.2fk", rate / 1e3);
+    return StringPrintf("%.1f", rate);
+}
+
 std::string Timer::ToString() const {
     return StringPrintf(
         "[ Timer start(ns): %d ]",
@@ -43,6 +82,8 @@ ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title,
     : totalWork(std::max<int64_t>(1, totalWork)), title(title), quiet(quiet) {
     workDone = 0;
     exitThread = false;
+    showBar = !quiet && progressStream != stdout;
+    this->quiet = quiet && !progressStream;
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     if (gpu) {
@@ -58,7 +99,7 @@ ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title,
 #endif
 
     // Launch thread to periodically update progress bar
-    if (!quiet)
+    if (!this->quiet)
         launchThread();
 }
 
@@ -87,7 +128,7 @@ ProgressReporter::~ProgressReporter() {
 }
 
 void ProgressReporter::printBar() {
-    int barLength = TerminalWidth() - 28;
+    int barLength = TerminalWidth() - 28 - (progressShowRates ? 32 : 0);
     int totalPlusses = std::max<int>(2, barLength - title.size());
     int plussesPrinted = 0;
 
@@ -102,8 +143,10 @@ void ProgressReporter::printBar() {
     *s++ = ']';
     *s++ = ' ';
     *s++ = '\0';
-    fputs(buf.get(), stdout);
-    fflush(stdout);
+    if (showBar) {
+        fputs(buf.get(), stdout);
+        fflush(stdout);
+    }
 
 #ifdef PBRT_BUILD_GPU_RENDERER
     std::chrono::milliseconds sleepDuration(gpuEvents.size() ? 50 : 250);
@@ -111,6 +154,14 @@ void ProgressReporter::printBar() {
     std::chrono::milliseconds sleepDuration(250);
 #endif
 
+    // The time remaining is estimated from exponentially smoothed rates of
+    // work and rays traced rather than the average rate so far, so that it
+    // follows changes in the cost of work (e.g., from one wave of samples to
+    // the next); the smoothing time constant is 10 seconds.
+    constexpr double rateTimeConstant = 10;
+    double lastElapsed = 0, workRate = -1, rayRate = 0;
+    int64_t lastWorkDone = 0, lastRaysTraced = 0;
+
     int iterCount = 0;
     bool reallyExit = false;  // make sure we do one more go-round to get the final report
     while (!reallyExit) {
@@ -147,24 +198,74 @@ void ProgressReporter::printBar() {
         }
 #endif
 
-        Float percentDone = Float(workDone) / Float(totalWork);
-        int plussesNeeded = std::round(totalPlusses * percentDone);
-        while (plussesPrinted < plussesNeeded) {
-            *curSpace++ = '+';
-            ++plussesPrinted;
+        // Update the smoothed rates, starting once some work has been done
+        int64_t done = workDone, rays = raysTraced;
+        double elapsed = ElapsedSeconds(), dt = elapsed - lastElapsed;
+        if (done > 0 && dt > 0) {
+            double workInstRate = (done - lastWorkDone) / dt;
+            double rayInstRate = (rays - lastRaysTraced) / dt;
+            if (workRate < 0) {
+                workRate = done / elapsed;
+                rayRate = rays / elapsed;
+            } else {
+                double alpha = 1 - std::exp(-dt / rateTimeConstant);
+                workRate = Lerp(alpha, workRate, workInstRate);
+                rayRate = Lerp(alpha, rayRate, rayInstRate);
+            }
+            lastElapsed = elapsed;
+            lastWorkDone = done;
+            lastRaysTraced = rays;
         }
-        fputs(buf.get(), stdout);
+        double remaining =
+            workRate > 0 ? std::max<double>(0, (totalWork - done) / workRate) : -1;
 
-        // Update elapsed time and estimated time to completion
-        Float elapsed = ElapsedSeconds();
-        Float estRemaining = elapsed / percentDone - elapsed;
-        if (percentDone == 1.f)
-            printf(" (%.1fs)       ", elapsed);
-        else if (!std::isinf(estRemaining))
-            printf(" (%.1fs|%.1fs)  ", elapsed, std::max<Float>(0, estRemaining));
-        else
-            printf(" (%.1fs|?s)  ", elapsed);
-        fflush(stdout);
+        if (showBar) {
+            Float percentDone = Float(done) / Float(totalWork);
+            int plussesNeeded = std::round(totalPlusses * percentDone);
+            while (plussesPrinted < plussesNeeded) {
+                *curSpace++ = '+';
+                ++plussesPrinted;
+            }
+            fputs(buf.get(), stdout);
+
+            // Update elapsed time and estimated time to completion
+            if (percentDone == 1.f)
+                printf(" (%.1fs)       ", elapsed);
+            else if (remaining >= 0)
+                printf(" (%.1fs|%.1fs)  ", elapsed, remaining);
+            else
+                printf(" (%.1fs|?s)  ", elapsed);
+            if (progressShowRates && workRate > 0) {
+                if (samplesPerWorkUnit > 0)
+                    printf("%s samples/s ",
+                           FormatRate(workRate * samplesPerWorkUnit).c_str());
+                else
+                    printf("%s/s ", FormatRate(workRate).c_str());
+                if (rayRate > 0)
+                    printf("%.2f Mrays/s ", rayRate / 1e6);
+            }
+            fflush(stdout);
+        }
+
+        if (progressStream) {
+            std::string line = StringPrintf(
+                "{\"title\": %s, \"work\": %d, \"totalWork\": %d, \"elapsed\": %.3f, "
+                "\"remaining\": %s, \"workPerSecond\": %.6g",
+                JSONString(title), done, totalWork, elapsed,
+                remaining >= 0 ? StringPrintf("%.3f", remaining) : std::string("null"),
+                std::max<double>(0, workRate));
+            if (samplesPerWorkUnit > 0)
+                line += StringPrintf(", \"samplesPerSecond\": %.6g",
+                                     std::max<double>(0, workRate) * samplesPerWorkUnit);
+            if (rays > 0)
+                line += StringPrintf(", \"raysPerSecond\": %.6g", rayRate);
+            line += StringPrintf(", \"finished\": %s}\n", reallyExit ? "true" : "false");
+            std::lock_guard<std::mutex> lock(progressStreamMutex);
+            if (progressStream) {
+                fputs(line.c_str(), progressStream);
+                fflush(progressStream);
+            }
+        }
     }
 }
 
@@ -189,9 +290,17 @@ void ProgressReporter::Done() {
             exitThread = true;
             if (updateThread.joinable())
                 updateThread.join();
-            printf("\n");
+            if (showBar)
+                printf("\n");
         }
     }
+
+    // Record the total work and time once, though the destructor calls
+    // Done() again
+    if (!title.empty() && !statsRecorded.exchange(true))
+        StatsAppendJSON("progress",
+                        StringPrintf("{\"title\": %s, \"work\": %d, \"seconds\": %.6f}",
+                                     JSONString(title), totalWork, ElapsedSeconds()));
 }
 
 std::string ProgressReporter::ToString() const {
@@ -39,6 +39,15 @@ class Timer {
     clock::time_point start;
 };
 
+// Progress Reporting Function Declarations
+// If _showRates_ is true, progress bars also show the rate at which work is
+// being done. If _streamFilename_ isn't empty, a line with a JSON object
+// describing each progress bar's state is written to that file (which may be
+// a named pipe, or "-" for standard output, which disables the bars) at
+// each update, so that other programs can follow renders' progress.
+void ProgressInit(bool showRates, const std::string &streamFilename);
+void ProgressCleanup();
+
 // ProgressReporter Definition
 class ProgressReporter {
   public:
@@ -49,9 +58,15 @@ class ProgressReporter {
 
     ~ProgressReporter();
 
-    void Update(int64_t num = 1);
+    // _rays_ gives the number of rays traced for the work, if known.
+    void Update(int64_t num = 1, int64_t rays = 0);
     void Done();
+    // Sets the number of pixel samples each unit of work represents so that
+    // their rate can be reported.
+    void SetSamplesPerWorkUnit(double n) { samplesPerWorkUnit = n; }
     double ElapsedSeconds() const;
+    // Returns true if progress is neither shown nor streamed.
+    bool Quiet() const { return quiet; }
 
     std::string ToString() const;
 
@@ -63,10 +78,14 @@ class ProgressReporter {
     // ProgressReporter Private Members
     int64_t totalWork;
     std::string title;
-    bool quiet;
+    // Progress is tracked if it is shown or streamed; it may be streamed
+    // without being shown.
+    bool quiet, showBar = false;
     Timer timer;
-    std::atomic<int64_t> workDone;
+    double samplesPerWorkUnit = 0;
+    std::atomic<int64_t> workDone, raysTraced{0};
     std::atomic<bool> exitThread;
+    std::atomic<bool> statsRecorded{false};
     std::thread updateThread;
 
 #ifdef PBRT_BUILD_GPU_RENDERER
@@ -80,7 +99,7 @@ inline double ProgressReporter::ElapsedSeconds() const {
     return timer.ElapsedSeconds();
 }
 
-inline void ProgressReporter::Update(int64_t num) {
+inline void ProgressReporter::Update(int64_t num, int64_t rays) {
 #ifdef PBRT_BUILD_GPU_RENDERER
     if (gpuEvents.size() > 0) {
         if (gpuEventsLaunchedOffset + num <= gpuEvents.size()) {
@@ -96,6 +115,8 @@ inline void ProgressReporter::Update(int64_t num) {
     if (num == 0 || quiet)
         return;
     workDone += num;
+    if (rays > 0)
+        raysTraced += rays;
 }
 
 }  // namespace pbrt
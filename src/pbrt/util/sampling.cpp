@@ -12,6 +12,7 @@
 #include <pbrt/util/float.h>
 #include <pbrt/util/lowdiscrepancy.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 #include <pbrt/util/pstd.h>
 #include <pbrt/util/scattering.h>
@@ -555,6 +556,103 @@ void PiecewiseConstant1D::TestCompareDistributions(const PiecewiseConstant1D &da
     }
 }
 
+// PiecewiseConstant2D Method Definitions
+PiecewiseConstant2D::PiecewiseConstant2D(pstd::span<const Float> func, int nu, int nv,
+                                         Bounds2f domain, Allocator alloc)
+    : domain(domain), pConditionalV(alloc), pMarginal(alloc) {
+    CHECK_EQ(func.size(), (size_t)nu * (size_t)nv);
+    allocateConditionals(nu, nv, alloc);
+    ParallelFor(0, nv, [&](int64_t v) {
+        // Compute conditional sampling distribution for $\tilde{v}$
+        PiecewiseConstant1D &conditional = pConditionalV[v];
+        pstd::span<const Float> f = func.subspan(v * nu, nu);
+        std::copy(f.begin(), f.end(), conditional.func.begin());
+        conditional.computeCDF();
+    });
+
+    // Compute marginal sampling distribution $p[\tilde{v}]$
+    std::vector<Float> marginalFunc;
+    marginalFunc.reserve(nv);
+    for (int v = 0; v < nv; ++v)
+        marginalFunc.push_back(pConditionalV[v].Integral());
+    pMarginal = PiecewiseConstant1D(marginalFunc, domain.pMin[1], domain.pMax[1], alloc);
+}
+
+void PiecewiseConstant2D::allocateConditionals(int nu, int nv, Allocator alloc) {
+    // Allocate conditional distributions' arrays up front so that they can
+    // be initialized in parallel; _alloc_ may not be thread-safe.
+    pConditionalV.reserve(nv);
+    for (int v = 0; v < nv; ++v)
+        pConditionalV.push_back(
+            PiecewiseConstant1D(nu, domain.pMin[0], domain.pMax[0], alloc));
+}
+
+// The tables start with the resolution and domain, which are followed by the
+// marginal and then the conditional distributions, each stored as its
+// integral followed by its function and CDF values.
+static constexpr int PiecewiseConstant2DHeaderSize = 6;
+
+size_t PiecewiseConstant2D::TablesSize(int nu, int nv) {
+    return PiecewiseConstant2DHeaderSize + (2 * size_t(nv) + 2) +
+           size_t(nv) * (2 * size_t(nu) + 2);
+}
+
+void PiecewiseConstant2D::WriteTables(pstd::span<Float> tables) const {
+    Point2i res = Resolution();
+    CHECK_EQ(tables.size(), TablesSize(res.x, res.y));
+    Float header[PiecewiseConstant2DHeaderSize] = {Float(res.x),  Float(res.y),
+                                                   domain.pMin.x, domain.pMin.y,
+                                                   domain.pMax.x, domain.pMax.y};
+    std::copy(header, header + PiecewiseConstant2DHeaderSize, tables.begin());
+
+    auto write = [](const PiecewiseConstant1D &d, Float *out) {
+        *out++ = d.funcInt;
+        out = std::copy(d.func.begin(), d.func.end(), out);
+        std::copy(d.cdf.begin(), d.cdf.end(), out);
+    };
+    size_t offset = PiecewiseConstant2DHeaderSize;
+    write(pMarginal, &tables[offset]);
+    offset += 2 * size_t(res.y) + 2;
+    size_t conditionalSize = 2 * size_t(res.x) + 2;
+    ParallelFor(0, res.y, [&](int64_t v) {
+        write(pConditionalV[v], &tables[offset + v * conditionalSize]);
+    });
+}
+
+pstd::optional<PiecewiseConstant2D> PiecewiseConstant2D::FromTables(
+    pstd::span<const Float> tables, Allocator alloc) {
+    // Validate resolution and domain
+    if (tables.size() < PiecewiseConstant2DHeaderSize)
+        return {};
+    auto validSize = [](Float n) { return n >= 1 && n <= (1 << 24) && n == int(n); };
+    if (!validSize(tables[0]) || !validSize(tables[1]))
+        return {};
+    int nu = tables[0], nv = tables[1];
+    Point2f pMin(tables[2], tables[3]), pMax(tables[4], tables[5]);
+    if (tables.size() < TablesSize(nu, nv) || !(pMin.x < pMax.x) || !(pMin.y < pMax.y))
+        return {};
+
+    // Initialize distributions from _tables_
+    PiecewiseConstant2D d(alloc);
+    d.domain = Bounds2f(pMin, pMax);
+    auto read = [](PiecewiseConstant1D *dist, const Float *in) {
+        dist->funcInt = *in++;
+        std::copy(in, in + dist->func.size(), dist->func.begin());
+        in += dist->func.size();
+        std::copy(in, in + dist->cdf.size(), dist->cdf.begin());
+    };
+    size_t offset = PiecewiseConstant2DHeaderSize;
+    d.pMarginal = PiecewiseConstant1D(nv, pMin.y, pMax.y, alloc);
+    read(&d.pMarginal, &tables[offset]);
+    offset += 2 * size_t(nv) + 2;
+    size_t conditionalSize = 2 * size_t(nu) + 2;
+    d.allocateConditionals(nu, nv, alloc);
+    ParallelFor(0, nv, [&](int64_t v) {
+        read(&d.pConditionalV[v], &tables[offset + v * conditionalSize]);
+    });
+    return d;
+}
+
 void PiecewiseConstant2D::TestCompareDistributions(const PiecewiseConstant2D &da,
                                                    const PiecewiseConstant2D &db,
                                                    Float eps) {
@@ -660,6 +758,26 @@ std::string AliasTable::ToString() const {
     return s + "] ]";
 }
 
+// SummedAreaTable Method Definitions
+SummedAreaTable::SummedAreaTable(const Array2D<Float> &values, Allocator alloc)
+    : sum(values.xSize(), values.ySize(), alloc) {
+    // Compute sums along each scanline in parallel
+    ParallelFor(0, sum.ySize(), [&](int64_t y) {
+        double s = 0;
+        for (int x = 0; x < sum.xSize(); ++x) {
+            s += values(x, y);
+            sum(x, y) = s;
+        }
+    });
+
+    // Accumulate scanline sums down the columns, in parallel over column ranges
+    ParallelFor(0, sum.xSize(), 1024, [&](int64_t x0, int64_t x1) {
+        for (int y = 1; y < sum.ySize(); ++y)
+            for (int64_t x = x0; x < x1; ++x)
+                sum(x, y) += sum(x, y - 1);
+    });
+}
+
 std::string SummedAreaTable::ToString() const {
     return StringPrintf("[ SummedAreaTable sum: %s ]", sum);
 }
@@ -673,26 +673,7 @@ class PiecewiseConstant1D {
                         Allocator alloc = {})
         : func(f.begin(), f.end(), alloc), cdf(f.size() + 1, alloc), min(min), max(max) {
         CHECK_GT(max, min);
-        // Take absolute value of _func_
-        for (Float &f : func)
-            f = std::abs(f);
-
-        // Compute integral of step function at $x_i$
-        cdf[0] = 0;
-        size_t n = f.size();
-        for (size_t i = 1; i < n + 1; ++i) {
-            CHECK_GE(func[i - 1], 0);
-            cdf[i] = cdf[i - 1] + func[i - 1] * (max - min) / n;
-        }
-
-        // Transform step function integral into CDF
-        funcInt = cdf[n];
-        if (funcInt == 0)
-            for (size_t i = 1; i < n + 1; ++i)
-                cdf[i] = Float(i) / Float(n);
-        else
-            for (size_t i = 1; i < n + 1; ++i)
-                cdf[i] /= funcInt;
+        computeCDF();
     }
 
     PBRT_CPU_GPU
@@ -739,6 +720,35 @@ class PiecewiseConstant1D {
     pstd::vector<Float> func, cdf;
     Float min, max;
     Float funcInt = 0;
+
+  private:
+    friend class PiecewiseConstant2D;
+    // PiecewiseConstant1D Private Methods
+    PiecewiseConstant1D(size_t n, Float min, Float max, Allocator alloc)
+        : func(n, alloc), cdf(n + 1, alloc), min(min), max(max) {}
+
+    void computeCDF() {
+        // Take absolute value of _func_
+        for (Float &f : func)
+            f = std::abs(f);
+
+        // Compute integral of step function at $x_i$
+        cdf[0] = 0;
+        size_t n = func.size();
+        for (size_t i = 1; i < n + 1; ++i) {
+            CHECK_GE(func[i - 1], 0);
+            cdf[i] = cdf[i - 1] + func[i - 1] * (max - min) / n;
+        }
+
+        // Transform step function integral into CDF
+        funcInt = cdf[n];
+        if (funcInt == 0)
+            for (size_t i = 1; i < n + 1; ++i)
+                cdf[i] = Float(i) / Float(n);
+        else
+            for (size_t i = 1; i < n + 1; ++i)
+                cdf[i] /= funcInt;
+    }
 };
 
 // PiecewiseConstant2D Definition
@@ -782,23 +792,16 @@ class PiecewiseConstant2D {
                                          const PiecewiseConstant2D &db, Float eps = 1e-5);
 
     PiecewiseConstant2D(pstd::span<const Float> func, int nu, int nv, Bounds2f domain,
-                        Allocator alloc = {})
-        : domain(domain), pConditionalV(alloc), pMarginal(alloc) {
-        CHECK_EQ(func.size(), (size_t)nu * (size_t)nv);
-        pConditionalV.reserve(nv);
-        for (int v = 0; v < nv; ++v)
-            // Compute conditional sampling distribution for $\tilde{v}$
-            pConditionalV.emplace_back(func.subspan(v * nu, nu), domain.pMin[0],
-                                       domain.pMax[0], alloc);
-
-        // Compute marginal sampling distribution $p[\tilde{v}]$
-        std::vector<Float> marginalFunc;
-        marginalFunc.reserve(nv);
-        for (int v = 0; v < nv; ++v)
-            marginalFunc.push_back(pConditionalV[v].Integral());
-        pMarginal =
-            PiecewiseConstant1D(marginalFunc, domain.pMin[1], domain.pMax[1], alloc);
-    }
+                        Allocator alloc = {});
+
+    // The distribution's tables can be stored in a flat array of _Float_s,
+    // e.g. to cache them on disk, and later restored with _FromTables()_.
+    static size_t TablesSize(int nu, int nv);
+    size_t TablesSize() const { return TablesSize(Resolution().x, Resolution().y); }
+    void WriteTables(pstd::span<Float> tables) const;
+    // Returns an unset optional if _tables_ doesn't start with valid tables.
+    static pstd::optional<PiecewiseConstant2D> FromTables(pstd::span<const Float> tables,
+                                                          Allocator alloc = {});
 
     PBRT_CPU_GPU
     Float Integral() const { return pMarginal.Integral(); }
@@ -839,6 +842,9 @@ class PiecewiseConstant2D {
     }
 
   private:
+    // PiecewiseConstant2D Private Methods
+    void allocateConditionals(int nu, int nv, Allocator alloc);
+
     // PiecewiseConstant2D Private Members
     Bounds2f domain;
     pstd::vector<PiecewiseConstant1D> pConditionalV;
@@ -876,21 +882,7 @@ class SummedAreaTable {
   public:
     // SummedAreaTable Public Methods
     SummedAreaTable(Allocator alloc) : sum(alloc) {}
-    SummedAreaTable(const Array2D<Float> &values, Allocator alloc = {})
-        : sum(values.xSize(), values.ySize(), alloc) {
-        sum(0, 0) = values(0, 0);
-        // Compute sums along first scanline and column
-        for (int x = 1; x < sum.xSize(); ++x)
-            sum(x, 0) = values(x, 0) + sum(x - 1, 0);
-        for (int y = 1; y < sum.ySize(); ++y)
-            sum(0, y) = values(0, y) + sum(0, y - 1);
-
-        // Compute sums for the remainder of the entries
-        for (int y = 1; y < sum.ySize(); ++y)
-            for (int x = 1; x < sum.xSize(); ++x)
-                sum(x, y) =
-                    (values(x, y) + sum(x - 1, y) + sum(x, y - 1) - sum(x - 1, y - 1));
-    }
+    SummedAreaTable(const Array2D<Float> &values, Allocator alloc = {});
 
     PBRT_CPU_GPU
     Float Integral(const Bounds2f &extent) const {
@@ -997,6 +989,9 @@ class WindowedPiecewiseConstant2D {
         return Eval(p) / sat.Integral(b);
     }
 
+    PBRT_CPU_GPU
+    Float Integral(const Bounds2f &b) const { return sat.Integral(b); }
+
   private:
     // WindowedPiecewiseConstant2D Private Methods
     template <typename CDF>
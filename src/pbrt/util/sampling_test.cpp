@@ -440,6 +440,42 @@ TEST(PiecewiseConstant2D, Integral) {
     EXPECT_EQ(8, dist4.Integral());
 }
 
+TEST(PiecewiseConstant2D, Tables) {
+    int nx = 37, ny = 21;
+    std::vector<Float> values;
+    RNG rng;
+    for (int i = 0; i < nx * ny; ++i)
+        values.push_back(rng.Uniform<Float>() < .1f ? 0 : rng.Uniform<Float>());
+    Bounds2f domain(Point2f(-1, -0.5), Point2f(3, 1.5));
+    PiecewiseConstant2D dist(values, nx, ny, domain);
+
+    // Distributions restored from tables should be identical
+    std::vector<Float> tables(dist.TablesSize() + 1, Float(-1));
+    dist.WriteTables(pstd::span<Float>(tables.data(), dist.TablesSize()));
+    pstd::optional<PiecewiseConstant2D> restored = PiecewiseConstant2D::FromTables(tables);
+    ASSERT_TRUE(restored.has_value());
+    EXPECT_EQ(dist.TablesSize(), restored->TablesSize());
+    EXPECT_EQ(dist.Domain(), restored->Domain());
+    EXPECT_EQ(dist.Integral(), restored->Integral());
+    for (Point2f u : Uniform2D(1000)) {
+        Float pdf, restoredPDF;
+        Point2f p = dist.Sample(u, &pdf);
+        EXPECT_EQ(p, restored->Sample(u, &restoredPDF));
+        EXPECT_EQ(pdf, restoredPDF);
+        EXPECT_EQ(dist.PDF(p), restored->PDF(p));
+    }
+
+    // Truncated or malformed tables should be rejected
+    EXPECT_FALSE(PiecewiseConstant2D::FromTables(
+                     pstd::span<const Float>(tables.data(), dist.TablesSize() - 1))
+                     .has_value());
+    tables[0] = 0.5f;
+    EXPECT_FALSE(PiecewiseConstant2D::FromTables(tables).has_value());
+    tables[0] = nx;
+    std::swap(tables[2], tables[4]);
+    EXPECT_FALSE(PiecewiseConstant2D::FromTables(tables).has_value());
+}
+
 TEST(Sampling, SphericalTriangle) {
     int count = 1024 * 1024;
     pstd::array<Point3f, 3> v = {Point3f(4, 1, 1), Point3f(-10, 3, 3),
@@ -1276,7 +1312,8 @@ TEST(SummedArea, Rect) {
 }
 
 TEST(SummedArea, Randoms) {
-    std::array<int, 2> dims[] = {{1, 6}, {6, 1}, {12, 19}, {16, 16}, {100, 300}, {49, 2}};
+    std::array<int, 2> dims[] = {{1, 6},   {6, 1},    {12, 19}, {16, 16},
+                                 {49, 2},  {100, 300}, {3000, 5}};
     RNG rng;
     for (const auto d : dims) {
         Array2D<Float> v(d[0], d[1]);
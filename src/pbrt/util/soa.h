@@ -19,6 +19,8 @@
 #include <pbrt/util/spectrum.h>
 #include <pbrt/util/vecmath.h>
 
+#include <cstring>
+
 namespace pbrt {
 
 struct alignas(16) Float4 {
@@ -45,6 +47,28 @@ inline void Store4(Float4 *p, Float4 v) {
 #endif
 }
 
+// LoadPacked() and StorePacked() move a whole value of a type that soac
+// generates with the "packed" layout through 16-byte words.
+template <typename T>
+PBRT_CPU_GPU inline T LoadPacked(const Float4 *p) {
+    constexpr int nWords = (sizeof(T) + 15) / 16;
+    Float4 words[nWords];
+    for (int i = 0; i < nWords; ++i)
+        words[i] = Load4(p + i);
+    T v;
+    std::memcpy(&v, words, sizeof(T));
+    return v;
+}
+
+template <typename T>
+PBRT_CPU_GPU inline void StorePacked(Float4 *p, const T &v) {
+    constexpr int nWords = (sizeof(T) + 15) / 16;
+    Float4 words[nWords];
+    std::memcpy(words, &v, sizeof(T));
+    for (int i = 0; i < nWords; ++i)
+        Store4(p + i, words[i]);
+}
+
 template <>
 class SOA<SampledSpectrum> {
   public:
@@ -94,6 +118,8 @@ class SOA<SampledSpectrum> {
     PBRT_CPU_GPU
     void Store(int i, const SampledSpectrum &s) { (*this)[i] = s; }
 
+    static constexpr size_t BytesPerItem = (NSpectrumSamples + 3) / 4 * sizeof(Float4);
+
   private:
     // number of float4s needed per SampledSpectrum
     static constexpr int n4 = (NSpectrumSamples + 3) / 4;
@@ -156,6 +182,9 @@ class SOA<SampledWavelengths> {
     PBRT_CPU_GPU
     void Store(int i, const SampledWavelengths &wl) { (*this)[i] = wl; }
 
+    static constexpr size_t BytesPerItem =
+        2 * ((NSpectrumSamples + 3) / 4) * sizeof(Float4);
+
   private:
     static constexpr int n4 = (NSpectrumSamples + 3) / 4;
 
@@ -25,12 +25,37 @@
 #include <string>
 #include <vector>
 
+// The number of wavelength samples can be set at build time; it must be a
+// multiple of four.
+#ifndef PBRT_NSPECTRUM_SAMPLES
+#define PBRT_NSPECTRUM_SAMPLES 4
+#endif
+
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && !defined(PBRT_IS_GPU_CODE)
+#if defined(__AVX__) && PBRT_NSPECTRUM_SAMPLES % 8 == 0
+#define PBRT_SPECTRUM_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#define PBRT_SPECTRUM_SSE
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define PBRT_SPECTRUM_NEON
+#include <arm_neon.h>
+#endif
+#endif
+#if defined(PBRT_SPECTRUM_AVX) || defined(PBRT_SPECTRUM_SSE) || \
+    defined(PBRT_SPECTRUM_NEON)
+#define PBRT_SPECTRUM_SIMD
+#endif
+
 namespace pbrt {
 
 // Spectrum Constants
 constexpr Float Lambda_min = 360, Lambda_max = 830;
 
-static constexpr int NSpectrumSamples = 4;
+static constexpr int NSpectrumSamples = PBRT_NSPECTRUM_SAMPLES;
+static_assert(NSpectrumSamples > 0 && NSpectrumSamples % 4 == 0,
+              "NSpectrumSamples must be a multiple of 4");
 
 static constexpr Float CIE_Y_integral = 106.856895;
 
@@ -85,6 +110,109 @@ Float SpectrumToPhotometric(SpectrumHandle s);
 Float SpectrumToPhotometric(SpectrumHandle s);
 XYZ SpectrumToXYZ(SpectrumHandle s);
 
+#ifdef PBRT_SPECTRUM_SIMD
+namespace detail {
+
+// SpectrumVec Definition
+// SpectrumVec holds as many of a SampledSpectrum's values as fit in a SIMD
+// register. Its operations give the same results as the corresponding
+// scalar code, including for NaNs and signed zeros.
+struct SpectrumVec {
+#if defined(PBRT_SPECTRUM_AVX)
+    static constexpr int Width = 8;
+    __m256 v;
+
+    static SpectrumVec Load(const Float *p) { return {_mm256_loadu_ps(p)}; }
+    static SpectrumVec Splat(Float f) { return {_mm256_set1_ps(f)}; }
+    void Store(Float *p) const { _mm256_storeu_ps(p, v); }
+
+    SpectrumVec operator+(SpectrumVec b) const { return {_mm256_add_ps(v, b.v)}; }
+    SpectrumVec operator-(SpectrumVec b) const { return {_mm256_sub_ps(v, b.v)}; }
+    SpectrumVec operator*(SpectrumVec b) const { return {_mm256_mul_ps(v, b.v)}; }
+    SpectrumVec operator/(SpectrumVec b) const { return {_mm256_div_ps(v, b.v)}; }
+    SpectrumVec operator-() const { return {_mm256_xor_ps(v, _mm256_set1_ps(-0.f))}; }
+    // Returns _a_ where _a_ > _b_ and _b_ otherwise.
+    friend SpectrumVec Max(SpectrumVec a, SpectrumVec b) {
+        return {_mm256_max_ps(a.v, b.v)};
+    }
+    // Returns _a_ where _a_ < _b_ and _b_ otherwise.
+    friend SpectrumVec Min(SpectrumVec a, SpectrumVec b) {
+        return {_mm256_min_ps(a.v, b.v)};
+    }
+    friend SpectrumVec Sqrt(SpectrumVec a) { return {_mm256_sqrt_ps(a.v)}; }
+    // Returns _a_ / _b_ where _b_ is nonzero and zero otherwise.
+    friend SpectrumVec SafeDiv(SpectrumVec a, SpectrumVec b) {
+        __m256 nonZero = _mm256_cmp_ps(b.v, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+        return {_mm256_and_ps(nonZero, _mm256_div_ps(a.v, b.v))};
+    }
+    bool AnyNonZero() const {
+        return _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NEQ_UQ));
+    }
+#elif defined(PBRT_SPECTRUM_SSE)
+    static constexpr int Width = 4;
+    __m128 v;
+
+    static SpectrumVec Load(const Float *p) { return {_mm_loadu_ps(p)}; }
+    static SpectrumVec Splat(Float f) { return {_mm_set1_ps(f)}; }
+    void Store(Float *p) const { _mm_storeu_ps(p, v); }
+
+    SpectrumVec operator+(SpectrumVec b) const { return {_mm_add_ps(v, b.v)}; }
+    SpectrumVec operator-(SpectrumVec b) const { return {_mm_sub_ps(v, b.v)}; }
+    SpectrumVec operator*(SpectrumVec b) const { return {_mm_mul_ps(v, b.v)}; }
+    SpectrumVec operator/(SpectrumVec b) const { return {_mm_div_ps(v, b.v)}; }
+    SpectrumVec operator-() const { return {_mm_xor_ps(v, _mm_set1_ps(-0.f))}; }
+    friend SpectrumVec Max(SpectrumVec a, SpectrumVec b) {
+        return {_mm_max_ps(a.v, b.v)};
+    }
+    friend SpectrumVec Min(SpectrumVec a, SpectrumVec b) {
+        return {_mm_min_ps(a.v, b.v)};
+    }
+    friend SpectrumVec Sqrt(SpectrumVec a) { return {_mm_sqrt_ps(a.v)}; }
+    friend SpectrumVec SafeDiv(SpectrumVec a, SpectrumVec b) {
+        __m128 nonZero = _mm_cmpneq_ps(b.v, _mm_setzero_ps());
+        return {_mm_and_ps(nonZero, _mm_div_ps(a.v, b.v))};
+    }
+    bool AnyNonZero() const {
+        return _mm_movemask_ps(_mm_cmpneq_ps(v, _mm_setzero_ps()));
+    }
+#else  // PBRT_SPECTRUM_NEON
+    static constexpr int Width = 4;
+    float32x4_t v;
+
+    static SpectrumVec Load(const Float *p) { return {vld1q_f32(p)}; }
+    static SpectrumVec Splat(Float f) { return {vdupq_n_f32(f)}; }
+    void Store(Float *p) const { vst1q_f32(p, v); }
+
+    SpectrumVec operator+(SpectrumVec b) const { return {vaddq_f32(v, b.v)}; }
+    SpectrumVec operator-(SpectrumVec b) const { return {vsubq_f32(v, b.v)}; }
+    SpectrumVec operator*(SpectrumVec b) const { return {vmulq_f32(v, b.v)}; }
+    SpectrumVec operator/(SpectrumVec b) const { return {vdivq_f32(v, b.v)}; }
+    SpectrumVec operator-() const { return {vnegq_f32(v)}; }
+    // NEON's min and max propagate NaNs, so select explicitly to match the
+    // x86 semantics.
+    friend SpectrumVec Max(SpectrumVec a, SpectrumVec b) {
+        return {vbslq_f32(vcgtq_f32(a.v, b.v), a.v, b.v)};
+    }
+    friend SpectrumVec Min(SpectrumVec a, SpectrumVec b) {
+        return {vbslq_f32(vcltq_f32(a.v, b.v), a.v, b.v)};
+    }
+    friend SpectrumVec Sqrt(SpectrumVec a) { return {vsqrtq_f32(a.v)}; }
+    friend SpectrumVec SafeDiv(SpectrumVec a, SpectrumVec b) {
+        uint32x4_t zero = vceqq_f32(b.v, vdupq_n_f32(0));
+        return {vbslq_f32(zero, vdupq_n_f32(0), vdivq_f32(a.v, b.v))};
+    }
+    bool AnyNonZero() const {
+        return vmaxvq_u32(vmvnq_u32(vceqq_f32(v, vdupq_n_f32(0)))) != 0;
+    }
+#endif
+};
+
+static_assert(PBRT_NSPECTRUM_SAMPLES % SpectrumVec::Width == 0,
+              "Unexpected SIMD width for SampledSpectrum");
+
+}  // namespace detail
+#endif  // PBRT_SPECTRUM_SIMD
+
 // SampledSpectrum Definition
 class SampledSpectrum {
   public:
@@ -97,9 +225,13 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum &operator-=(const SampledSpectrum &s) {
+#ifdef PBRT_SPECTRUM_SIMD
+        return *this = Map([](auto a, auto b) { return a - b; }, *this, s);
+#else
         for (int i = 0; i < NSpectrumSamples; ++i)
             values[i] -= s.values[i];
         return *this;
+#endif
     }
     PBRT_CPU_GPU
     SampledSpectrum operator-(const SampledSpectrum &s) const {
@@ -109,17 +241,25 @@ class SampledSpectrum {
     PBRT_CPU_GPU
     friend SampledSpectrum operator-(Float a, const SampledSpectrum &s) {
         DCHECK(!IsNaN(a));
+#ifdef PBRT_SPECTRUM_SIMD
+        return Map([a](auto v) { return decltype(v)::Splat(a) - v; }, s);
+#else
         SampledSpectrum ret;
         for (int i = 0; i < NSpectrumSamples; ++i)
             ret.values[i] = a - s.values[i];
         return ret;
+#endif
     }
 
     PBRT_CPU_GPU
     SampledSpectrum &operator*=(const SampledSpectrum &s) {
+#ifdef PBRT_SPECTRUM_SIMD
+        return *this = Map([](auto a, auto b) { return a * b; }, *this, s);
+#else
         for (int i = 0; i < NSpectrumSamples; ++i)
             values[i] *= s.values[i];
         return *this;
+#endif
     }
     PBRT_CPU_GPU
     SampledSpectrum operator*(const SampledSpectrum &s) const {
@@ -128,29 +268,34 @@ class SampledSpectrum {
     }
     PBRT_CPU_GPU
     SampledSpectrum operator*(Float a) const {
-        DCHECK(!IsNaN(a));
         SampledSpectrum ret = *this;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            ret.values[i] *= a;
-        return ret;
+        return ret *= a;
     }
     PBRT_CPU_GPU
     SampledSpectrum &operator*=(Float a) {
         DCHECK(!IsNaN(a));
+#ifdef PBRT_SPECTRUM_SIMD
+        return *this = Map([a](auto v) { return v * decltype(v)::Splat(a); }, *this);
+#else
         for (int i = 0; i < NSpectrumSamples; ++i)
             values[i] *= a;
         return *this;
+#endif
     }
     PBRT_CPU_GPU
     friend SampledSpectrum operator*(Float a, const SampledSpectrum &s) { return s * a; }
 
     PBRT_CPU_GPU
     SampledSpectrum &operator/=(const SampledSpectrum &s) {
-        for (int i = 0; i < NSpectrumSamples; ++i) {
+        for (int i = 0; i < NSpectrumSamples; ++i)
             DCHECK_NE(0, s.values[i]);
+#ifdef PBRT_SPECTRUM_SIMD
+        return *this = Map([](auto a, auto b) { return a / b; }, *this, s);
+#else
+        for (int i = 0; i < NSpectrumSamples; ++i)
             values[i] /= s.values[i];
-        }
         return *this;
+#endif
     }
     PBRT_CPU_GPU
     SampledSpectrum operator/(const SampledSpectrum &s) const {
@@ -161,9 +306,13 @@ class SampledSpectrum {
     SampledSpectrum &operator/=(Float a) {
         DCHECK_NE(a, 0);
         DCHECK(!IsNaN(a));
+#ifdef PBRT_SPECTRUM_SIMD
+        return *this = Map([a](auto v) { return v / decltype(v)::Splat(a); }, *this);
+#else
         for (int i = 0; i < NSpectrumSamples; ++i)
             values[i] /= a;
         return *this;
+#endif
     }
     PBRT_CPU_GPU
     SampledSpectrum operator/(Float a) const {
@@ -173,10 +322,14 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum operator-() const {
+#ifdef PBRT_SPECTRUM_SIMD
+        return Map([](auto v) { return -v; }, *this);
+#else
         SampledSpectrum ret;
         for (int i = 0; i < NSpectrumSamples; ++i)
             ret.values[i] = -values[i];
         return ret;
+#endif
     }
     PBRT_CPU_GPU
     bool operator==(const SampledSpectrum &s) const { return values == s.values; }
@@ -223,17 +376,27 @@ class SampledSpectrum {
 
     PBRT_CPU_GPU
     explicit operator bool() const {
+#ifdef PBRT_SPECTRUM_SIMD
+        for (int i = 0; i < NSpectrumSamples; i += detail::SpectrumVec::Width)
+            if (detail::SpectrumVec::Load(&values[i]).AnyNonZero())
+                return true;
+#else
         for (int i = 0; i < NSpectrumSamples; ++i)
             if (values[i] != 0)
                 return true;
+#endif
         return false;
     }
 
     PBRT_CPU_GPU
     SampledSpectrum &operator+=(const SampledSpectrum &s) {
+#ifdef PBRT_SPECTRUM_SIMD
+        return *this = Map([](auto a, auto b) { return a + b; }, *this, s);
+#else
         for (int i = 0; i < NSpectrumSamples; ++i)
             values[i] += s.values[i];
         return *this;
+#endif
     }
 
     PBRT_CPU_GPU
@@ -258,6 +421,27 @@ class SampledSpectrum {
         return sum / NSpectrumSamples;
     }
 
+#ifdef PBRT_SPECTRUM_SIMD
+    // Returns the spectrum given by applying _f_ to the values of _s_, a
+    // _detail::SpectrumVec_ at a time.
+    template <typename F>
+    static SampledSpectrum Map(F f, const SampledSpectrum &s) {
+        SampledSpectrum r;
+        using Vec = detail::SpectrumVec;
+        for (int i = 0; i < NSpectrumSamples; i += Vec::Width)
+            f(Vec::Load(&s.values[i])).Store(&r.values[i]);
+        return r;
+    }
+    template <typename F>
+    static SampledSpectrum Map(F f, const SampledSpectrum &a, const SampledSpectrum &b) {
+        SampledSpectrum r;
+        using Vec = detail::SpectrumVec;
+        for (int i = 0; i < NSpectrumSamples; i += Vec::Width)
+            f(Vec::Load(&a.values[i]), Vec::Load(&b.values[i])).Store(&r.values[i]);
+        return r;
+    }
+#endif
+
   private:
     friend class SOA<SampledSpectrum>;
     pstd::array<Float, NSpectrumSamples> values;
@@ -469,6 +653,11 @@ class PiecewiseLinearSpectrum {
   private:
     // PiecewiseLinearSpectrum Private Members
     pstd::vector<Float> lambdas, values;
+    // The wavelength range is divided into uniformly spaced buckets that
+    // record the first interval that overlaps each one, so that lookups
+    // don't need to binary search _lambdas_.
+    pstd::vector<int> bucketInterval;
+    Float invBucketWidth = 0;
 };
 
 class BlackbodySpectrum {
@@ -505,6 +694,15 @@ class BlackbodySpectrum {
     Float normalizationFactor;
 };
 
+// Evaluates _rsp_ at all of the wavelengths in _lambda_ at once.
+PBRT_CPU_GPU inline SampledSpectrum SampleSigmoidPolynomial(
+    const RGBSigmoidPolynomial &rsp, const SampledWavelengths &lambda) {
+    pstd::array<Float, NSpectrumSamples> l;
+    for (int i = 0; i < NSpectrumSamples; ++i)
+        l[i] = lambda[i];
+    return SampledSpectrum(rsp.Evaluate(l));
+}
+
 class RGBAlbedoSpectrum {
   public:
     // RGBAlbedoSpectrum Public Methods
@@ -518,10 +716,7 @@ class RGBAlbedoSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum Sample(const SampledWavelengths &lambda) const {
-        SampledSpectrum s;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            s[i] = rsp(lambda[i]);
-        return s;
+        return SampleSigmoidPolynomial(rsp, lambda);
     }
 
     std::string ToString() const;
@@ -547,10 +742,7 @@ class RGBUnboundedSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum Sample(const SampledWavelengths &lambda) const {
-        SampledSpectrum s;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            s[i] = scale * rsp(lambda[i]);
-        return s;
+        return scale * SampleSigmoidPolynomial(rsp, lambda);
     }
 
     std::string ToString() const;
@@ -580,10 +772,7 @@ class RGBIlluminantSpectrum {
 
     PBRT_CPU_GPU
     SampledSpectrum Sample(const SampledWavelengths &lambda) const {
-        SampledSpectrum s;
-        for (int i = 0; i < NSpectrumSamples; ++i)
-            s[i] = scale * rsp(lambda[i]);
-        return s * illuminant->Sample(lambda);
+        return scale * SampleSigmoidPolynomial(rsp, lambda) * illuminant->Sample(lambda);
     }
 
     std::string ToString() const;
@@ -597,35 +786,58 @@ class RGBIlluminantSpectrum {
 
 // SampledSpectrum Inline Functions
 PBRT_CPU_GPU inline SampledSpectrum SafeDiv(SampledSpectrum a, SampledSpectrum b) {
+#ifdef PBRT_SPECTRUM_SIMD
+    return SampledSpectrum::Map([](auto a, auto b) { return SafeDiv(a, b); }, a, b);
+#else
     SampledSpectrum r;
     for (int i = 0; i < NSpectrumSamples; ++i)
         r[i] = (b[i] != 0) ? a[i] / b[i] : 0.;
     return r;
+#endif
 }
 
 template <typename U, typename V>
 PBRT_CPU_GPU inline SampledSpectrum Clamp(const SampledSpectrum &s, U low, V high) {
+#ifdef PBRT_SPECTRUM_SIMD
+    // The operand order matches Clamp()'s handling of NaNs
+    SampledSpectrum ret = SampledSpectrum::Map(
+        [low, high](auto v) {
+            using Vec = decltype(v);
+            return Min(Vec::Splat(high), Max(Vec::Splat(low), v));
+        },
+        s);
+#else
     SampledSpectrum ret;
     for (int i = 0; i < NSpectrumSamples; ++i)
         ret[i] = pbrt::Clamp(s[i], low, high);
+#endif
     DCHECK(!ret.HasNaNs());
     return ret;
 }
 
 PBRT_CPU_GPU
 inline SampledSpectrum ClampZero(const SampledSpectrum &s) {
+#ifdef PBRT_SPECTRUM_SIMD
+    SampledSpectrum ret = SampledSpectrum::Map(
+        [](auto v) { return Max(v, decltype(v)::Splat(0)); }, s);
+#else
     SampledSpectrum ret;
     for (int i = 0; i < NSpectrumSamples; ++i)
         ret[i] = std::max<Float>(0, s[i]);
+#endif
     DCHECK(!ret.HasNaNs());
     return ret;
 }
 
 PBRT_CPU_GPU
 inline SampledSpectrum Sqrt(const SampledSpectrum &s) {
+#ifdef PBRT_SPECTRUM_SIMD
+    SampledSpectrum ret = SampledSpectrum::Map([](auto v) { return Sqrt(v); }, s);
+#else
     SampledSpectrum ret;
     for (int i = 0; i < NSpectrumSamples; ++i)
         ret[i] = std::sqrt(s[i]);
+#endif
     DCHECK(!ret.HasNaNs());
     return ret;
 }
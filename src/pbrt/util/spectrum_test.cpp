@@ -8,11 +8,13 @@
 
 #include <pbrt/util/color.h>
 #include <pbrt/util/colorspace.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/rng.h>
 #include <pbrt/util/sampling.h>
 #include <pbrt/util/spectrum.h>
 
 #include <array>
+#include <vector>
 
 using namespace pbrt;
 
@@ -120,6 +122,72 @@ TEST(Spectrum, MaxValue) {
     }
 }
 
+TEST(SampledSpectrum, Operators) {
+    // Check the SampledSpectrum operators, which may be implemented with
+    // SIMD instructions, against per-sample computation.
+    RNG rng;
+    const Float special[] = {0, -0.f, 1, -1, 1e30f};
+    for (int iter = 0; iter < 100; ++iter) {
+        SampledSpectrum a, b;
+        for (int i = 0; i < NSpectrumSamples; ++i) {
+            a[i] = Lerp(rng.Uniform<Float>(), -10, 10);
+            b[i] = Lerp(rng.Uniform<Float>(), -10, 10);
+            if (rng.Uniform<Float>() < .2f)
+                a[i] = special[rng.Uniform<uint32_t>(PBRT_ARRAYSIZE(special))];
+            if (rng.Uniform<Float>() < .2f)
+                b[i] = special[rng.Uniform<uint32_t>(PBRT_ARRAYSIZE(special))];
+        }
+        Float f = Lerp(rng.Uniform<Float>(), .1f, 10);
+
+        SampledSpectrum sum = a + b, diff = a - b, prod = a * b, scaled = f * a;
+        SampledSpectrum quot = a / f, neg = -a, fdiff = f - a;
+        SampledSpectrum safeDiv = SafeDiv(a, b), clamp = Clamp(a, -1, 2);
+        SampledSpectrum clampZero = ClampZero(a), sqrt = Sqrt(ClampZero(b));
+        for (int i = 0; i < NSpectrumSamples; ++i) {
+            EXPECT_EQ(a[i] + b[i], sum[i]);
+            EXPECT_EQ(a[i] - b[i], diff[i]);
+            EXPECT_EQ(a[i] * b[i], prod[i]);
+            EXPECT_EQ(f * a[i], scaled[i]);
+            EXPECT_EQ(a[i] / f, quot[i]);
+            EXPECT_EQ(std::signbit(a[i]), !std::signbit(neg[i]));
+            EXPECT_EQ(f - a[i], fdiff[i]);
+            EXPECT_EQ(b[i] != 0 ? a[i] / b[i] : 0, safeDiv[i]);
+            EXPECT_EQ(Clamp(a[i], -1, 2), clamp[i]);
+            EXPECT_EQ(std::max<Float>(0, a[i]), clampZero[i]);
+            EXPECT_EQ(std::sqrt(std::max<Float>(0, b[i])), sqrt[i]);
+        }
+
+        bool nonZero = false;
+        for (int i = 0; i < NSpectrumSamples; ++i)
+            nonZero |= (a[i] != 0);
+        EXPECT_EQ(nonZero, bool(a));
+    }
+    EXPECT_FALSE(bool(SampledSpectrum(0.f)));
+    EXPECT_FALSE(bool(SampledSpectrum(-0.f)));
+}
+
+TEST(Spectrum, RGBSample) {
+    // Sample() evaluates all of the wavelengths at once; it should match
+    // evaluating them one at a time, up to differences in the use of FMA.
+    RNG rng;
+    for (int i = 0; i < 100; ++i) {
+        RGB rgb(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+        // Also check uniform RGBs, including those that give infinite
+        // polynomial coefficients.
+        if (i < 3)
+            rgb = RGB(i / 2.f, i / 2.f, i / 2.f);
+        RGBAlbedoSpectrum sr(*RGBColorSpace::sRGB, rgb);
+        RGBUnboundedSpectrum su(*RGBColorSpace::sRGB, 10 * rgb);
+        SampledWavelengths lambda =
+            SampledWavelengths::SampleUniform(rng.Uniform<Float>());
+        SampledSpectrum s = sr.Sample(lambda), u = su.Sample(lambda);
+        for (int j = 0; j < NSpectrumSamples; ++j) {
+            EXPECT_NEAR(sr(lambda[j]), s[j], 1e-4f) << rgb << " @ " << lambda[j];
+            EXPECT_NEAR(su(lambda[j]), u[j], 1e-3f) << rgb << " @ " << lambda[j];
+        }
+    }
+}
+
 TEST(Spectrum, SamplingPdfY) {
     // Make sure we can integrate the y matching curve correctly
     Float ysum = 0;
@@ -162,3 +230,50 @@ TEST(Spectrum, SamplingPdfXYZ) {
     EXPECT_LT(std::abs((impInt - unifInt) / unifInt), 1e-3)
         << impInt << " vs. " << unifInt;
 }
+
+TEST(Spectrum, NamedSpectra) {
+    EXPECT_FALSE((bool)GetNamedSpectrum("not-a-spectrum"));
+
+    // Named spectra are created on first use, concurrently here, and then
+    // returned again on subsequent lookups.
+    std::vector<SpectrumHandle> spectra(64);
+    ParallelFor(0, spectra.size(),
+                [&](int64_t i) { spectra[i] = GetNamedSpectrum("metal-Au-eta"); });
+    for (SpectrumHandle s : spectra)
+        EXPECT_EQ(spectra[0], s);
+
+    // Illuminants are normalized to have luminance of 1.
+    SpectrumHandle d65 = GetNamedSpectrum("stdillum-D65");
+    EXPECT_LT(std::abs(InnerProduct(d65, &Spectra::Y()) - 1), 1e-4);
+
+    EXPECT_EQ("metal-Au-eta", FindMatchingNamedSpectrum(spectra[0]));
+}
+
+TEST(Spectrum, PiecewiseLinear) {
+    // Irregularly spaced wavelengths, including some closer together than
+    // the bucket width and a large gap.
+    RNG rng;
+    std::vector<Float> lambdas, values;
+    for (Float lambda = 360; lambda < 830; lambda += rng.Uniform<Float>() < .2f
+                                                         ? rng.Uniform<Float>() / 4
+                                                         : 10 * rng.Uniform<Float>()) {
+        lambdas.push_back(lambda);
+        values.push_back(rng.Uniform<Float>());
+    }
+    lambdas.back() += 200;
+    PiecewiseLinearSpectrum spec(lambdas, values);
+
+    for (int i = 0; i < 10000; ++i) {
+        Float lambda = Lerp(rng.Uniform<Float>(), 300, 1100);
+        if (i < lambdas.size())
+            lambda = lambdas[i];
+        Float expected = 0;
+        for (size_t j = 0; j + 1 < lambdas.size(); ++j)
+            if (lambda >= lambdas[j] && lambda <= lambdas[j + 1]) {
+                Float t = (lambda - lambdas[j]) / (lambdas[j + 1] - lambdas[j]);
+                expected = Lerp(t, values[j], values[j + 1]);
+                break;
+            }
+        EXPECT_FLOAT_EQ(expected, spec(lambda)) << lambda;
+    }
+}
@@ -5,6 +5,8 @@
 #include <pbrt/util/stats.h>
 
 #include <pbrt/util/check.h>
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
 #include <pbrt/util/image.h>
 #include <pbrt/util/memory.h>
 #include <pbrt/util/parallel.h>
@@ -13,6 +15,7 @@
 #include <pbrt/util/vecmath.h>
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cinttypes>
 #include <csignal>
@@ -20,6 +23,7 @@
 #include <map>
 #include <mutex>
 #include <string>
+#include <vector>
 
 namespace pbrt {
 
@@ -39,22 +43,99 @@ static thread_local ThreadStatsState threadStatsState;
 
 static std::vector<StatRegisterer::PixelAccumFunc> *pixelStatFuncs;
 
+// Per-pixel statistics are accumulated in _statsAccumulator_; the others
+// are accumulated separately for each thread.
 static StatsAccumulator statsAccumulator;
 
+// ThreadStatsList Definition
+// Threads' accumulators are kept in a lock-free list; they are never freed,
+// so that their statistics outlive their threads.
+struct ThreadStatsList {
+    StatsAccumulator accum;
+    ThreadStatsList *next = nullptr;
+};
+
+static std::atomic<ThreadStatsList *> threadStatsLists{nullptr};
+static thread_local ThreadStatsList *threadStatsList;
+
+StatsLevel statsLevel = StatsLevel::Full;
+static std::vector<std::string> statsCategories;
+
 static Bounds2i imageBounds;
 std::string pixelStatsBaseName;
 
+thread_local WorkCounters threadWorkCounters;
+bool countRays = false, countTraversalSteps = false;
+
 // Statistics Function Definitions
+StatsLevel StatsLevelFromString(const std::string &s) {
+    if (s == "off")
+        return StatsLevel::Off;
+    else if (s == "cheap")
+        return StatsLevel::Cheap;
+    else if (s == "full")
+        return StatsLevel::Full;
+    ErrorExit("%s: unknown statistics level. Expected \"off\", \"cheap\", or \"full\".",
+              s);
+}
+
+std::string ToString(StatsLevel level) {
+    switch (level) {
+    case StatsLevel::Off:
+        return "off";
+    case StatsLevel::Cheap:
+        return "cheap";
+    default:
+        return "full";
+    }
+}
+
+void StatsInit(StatsLevel level, const std::string &categories) {
+    // Statistics that weren't compiled in can't be recorded
+    statsLevel = StatsLevel(std::min<int>(int(level), PBRT_STATS_LEVEL));
+    statsCategories.clear();
+    if (!categories.empty())
+        statsCategories = SplitString(categories, ',');
+}
+
+// Returns whether the statistics in _category_ are reported.
+static bool StatsCategoryEnabled(const std::string &category) {
+    return statsCategories.empty() ||
+           std::find(statsCategories.begin(), statsCategories.end(), category) !=
+               statsCategories.end();
+}
+
 void ReportThreadStats() {
-    static std::mutex mutex;
-    std::lock_guard<std::mutex> lock(mutex);
-    StatRegisterer::CallCallbacks(statsAccumulator);
+    if (!threadStatsList) {
+        // Add the thread's accumulator to the list of them
+        ThreadStatsList *list = new ThreadStatsList;
+        list->next = threadStatsLists.load(std::memory_order_relaxed);
+        while (!threadStatsLists.compare_exchange_weak(list->next, list,
+                                                       std::memory_order_release,
+                                                       std::memory_order_relaxed))
+            ;
+        threadStatsList = list;
+    }
+    StatRegisterer::CallCallbacks(threadStatsList->accum);
+
     if (pixelStatsEnabled) {
+        // Per-pixel statistics are large enough that they are merged as they
+        // are reported, rather than being kept separately for each thread.
+        static std::mutex mutex;
+        std::lock_guard<std::mutex> lock(mutex);
         statsAccumulator.AccumulatePixelStats(threadStatsState.accum);
         threadStatsState.accum = PixelStatsAccumulator();
     }
 }
 
+// Adds the statistics that all threads have reported to _accum_; they must
+// not be reporting them concurrently.
+static void MergeThreadStats(StatsAccumulator *accum) {
+    for (ThreadStatsList *list = threadStatsLists.load(std::memory_order_acquire); list;
+         list = list->next)
+        accum->Merge(list->accum);
+}
+
 void StatsReportPixelStart(const Point2i &p) {
     if (!pixelStatsEnabled)
         return;
@@ -81,6 +162,10 @@ void StatsReportPixelEnd(const Point2i &p) {
 }
 
 void StatsEnablePixelStats(const Bounds2i &b, const std::string &baseName) {
+    if (statsLevel != StatsLevel::Full) {
+        Warning("Per-pixel statistics are only recorded with \"full\" statistics.");
+        return;
+    }
     pixelStatsEnabled = true;
     imageBounds = b;
     pixelStatsBaseName = baseName;
@@ -208,10 +293,48 @@ void StatsAccumulator::ReportCounter(const char *name, int64_t val) {
     stats->counters[name] += val;
 }
 
+int64_t StatsAccumulator::GetCounter(const std::string &name) const {
+    auto iter = stats->counters.find(name);
+    return iter == stats->counters.end() ? 0 : iter->second;
+}
+
 StatsAccumulator::StatsAccumulator() {
     stats = new Stats;
 }
 
+StatsAccumulator::~StatsAccumulator() {
+    delete stats;
+}
+
+void StatsAccumulator::Merge(const StatsAccumulator &accum) {
+    const Stats &s = *accum.stats;
+    for (const auto &c : s.counters)
+        stats->counters[c.first] += c.second;
+    for (const auto &c : s.memoryCounters)
+        stats->memoryCounters[c.first] += c.second;
+    auto mergeDistribution = [](auto &distrib, const auto &d) {
+        distrib.sum += d.sum;
+        distrib.count += d.count;
+        distrib.min = std::min(distrib.min, d.min);
+        distrib.max = std::max(distrib.max, d.max);
+    };
+    for (const auto &d : s.intDistributions)
+        mergeDistribution(stats->intDistributions[d.first], d.second);
+    for (const auto &d : s.floatDistributions)
+        mergeDistribution(stats->floatDistributions[d.first], d.second);
+    for (const auto &p : s.percentages) {
+        stats->percentages[p.first].first += p.second.first;
+        stats->percentages[p.first].second += p.second.second;
+    }
+    for (const auto &r : s.ratios) {
+        stats->ratios[r.first].first += r.second.first;
+        stats->ratios[r.first].second += r.second.second;
+    }
+    for (const auto &rc : s.rareChecks)
+        ReportRareCheck(rc.first.c_str(), rc.second.maxFrequency, rc.second.numTrue,
+                        rc.second.total);
+}
+
 void StatsAccumulator::ReportMemoryCounter(const char *name, int64_t val) {
     stats->memoryCounters[name] += val;
 }
@@ -322,15 +445,44 @@ void StatsAccumulator::AccumulatePixelStats(const PixelStatsAccumulator &accum)
 }
 
 void PrintStats(FILE *dest) {
-    statsAccumulator.Print(dest);
+    if (statsLevel == StatsLevel::Off)
+        return;
+    StatsAccumulator accum;
+    MergeThreadStats(&accum);
+    accum.Print(dest);
 }
 
 bool PrintCheckRare(FILE *dest) {
-    return statsAccumulator.PrintCheckRare(dest);
+    StatsAccumulator accum;
+    MergeThreadStats(&accum);
+    return accum.PrintCheckRare(dest);
 }
 
 void ClearStats() {
-    statsAccumulator.Clear();
+    for (ThreadStatsList *list = threadStatsLists.load(std::memory_order_acquire); list;
+         list = list->next)
+        list->accum.Clear();
+}
+
+int64_t GetStatsCounter(const std::string &name) {
+    int64_t count = 0;
+    for (ThreadStatsList *list = threadStatsLists.load(std::memory_order_acquire); list;
+         list = list->next)
+        count += list->accum.GetCounter(name);
+    return count;
+}
+
+static std::string printBytes(int64_t bytes) {
+    float kb = (double)bytes / 1024.;
+    if (std::abs(kb) < 1024.)
+        return StringPrintf("%9.2f kB", kb);
+
+    float mib = kb / 1024.;
+    if (std::abs(mib) < 1024.)
+        return StringPrintf("%9.2f MiB", mib);
+
+    float gib = mib / 1024.;
+    return StringPrintf("%9.2f GiB", gib);
 }
 
 static void getCategoryAndTitle(const std::string &str, std::string *category,
@@ -345,6 +497,19 @@ static void getCategoryAndTitle(const std::string &str, std::string *category,
     }
 }
 
+std::string JSONString(const std::string &str) {
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if ((unsigned char)c < 0x20)
+            result += StringPrintf("\\u%04x", int(c));
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
 void StatsAccumulator::Print(FILE *dest) {
     fprintf(dest, "Statistics:\n");
     std::map<std::string, std::vector<std::string>> toPrint;
@@ -359,18 +524,6 @@ void StatsAccumulator::Print(FILE *dest) {
     }
 
     size_t totalMemoryReported = 0;
-    auto printBytes = [](size_t bytes) -> std::string {
-        float kb = (double)bytes / 1024.;
-        if (std::abs(kb) < 1024.)
-            return StringPrintf("%9.2f kB", kb);
-
-        float mib = kb / 1024.;
-        if (std::abs(mib) < 1024.)
-            return StringPrintf("%9.2f MiB", mib);
-
-        float gib = mib / 1024.;
-        return StringPrintf("%9.2f GiB", gib);
-    };
 
     for (auto &counter : stats->memoryCounters) {
         if (counter.second == 0)
@@ -434,13 +587,61 @@ void StatsAccumulator::Print(FILE *dest) {
     }
 
     for (auto &categories : toPrint) {
+        if (!StatsCategoryEnabled(categories.first))
+            continue;
         fprintf(dest, "  %s\n", categories.first.c_str());
         for (auto &item : categories.second)
             fprintf(dest, "    %s\n", item.c_str());
     }
 }
 
+std::string StatsAccumulator::ToJSON() const {
+    // Each kind of statistic is an object keyed by the statistics' full
+    // "category/title" names; unlike Print(), zero-valued ones are included
+    // so that the set of keys doesn't vary from render to render.
+    auto enabled = [](const std::string &name) {
+        std::string category, title;
+        getCategoryAndTitle(name, &category, &title);
+        return StatsCategoryEnabled(category);
+    };
+    auto object = [&](const auto &map, auto format) {
+        std::string json = "{";
+        for (const auto &item : map) {
+            if (!enabled(item.first))
+                continue;
+            json += StringPrintf("%s\n    %s: %s", json.size() > 1 ? "," : "",
+                                 JSONString(item.first), format(item.second));
+        }
+        return json + (json.size() > 1 ? "\n  }" : "}");
+    };
+    auto integer = [](int64_t v) { return StringPrintf("%d", v); };
+    auto distribution = [](const auto &d) {
+        if (d.count == 0)
+            return std::string("{\"count\": 0}");
+        return StringPrintf("{\"count\": %d, \"sum\": %.9g, \"min\": %.9g, "
+                            "\"max\": %.9g, \"avg\": %.9g}",
+                            d.count, double(d.sum), double(d.min), double(d.max),
+                            double(d.sum) / d.count);
+    };
+    auto fraction = [](const std::pair<int64_t, int64_t> &f) {
+        return StringPrintf("{\"numerator\": %d, \"denominator\": %d}", f.first,
+                            f.second);
+    };
+
+    return StringPrintf("  \"counters\": %s,\n  \"memory\": %s,\n"
+                        "  \"intDistributions\": %s,\n  \"floatDistributions\": %s,\n"
+                        "  \"percentages\": %s,\n  \"ratios\": %s",
+                        object(stats->counters, integer),
+                        object(stats->memoryCounters, integer),
+                        object(stats->intDistributions, distribution),
+                        object(stats->floatDistributions, distribution),
+                        object(stats->percentages, fraction),
+                        object(stats->ratios, fraction));
+}
+
 void StatsWritePixelImages() {
+    if (!pixelStatsEnabled)
+        return;
     statsAccumulator.WritePixelImages();
 }
 
@@ -449,6 +650,10 @@ void StatsAccumulator::WritePixelImages() const {
     CHECK(stats->pixelTime.Write(pixelStatsBaseName + "-time.exr"));
 
     for (size_t i = 0; i < stats->pixelCounterImages.size(); ++i) {
+        std::string category, title;
+        getCategoryAndTitle(stats->pixelCounterNames[i], &category, &title);
+        if (!StatsCategoryEnabled(category))
+            continue;
         std::string n = pixelStatsBaseName + "-" + stats->pixelCounterNames[i] + ".exr";
         for (size_t j = 0; j < n.size(); ++j)
             if (n[j] == '/')
@@ -466,6 +671,10 @@ void StatsAccumulator::WritePixelImages() const {
     }
 
     for (size_t i = 0; i < stats->pixelRatioImages.size(); ++i) {
+        std::string category, title;
+        getCategoryAndTitle(stats->pixelRatioNames[i], &category, &title);
+        if (!StatsCategoryEnabled(category))
+            continue;
         std::string n = pixelStatsBaseName + "-" + stats->pixelRatioNames[i] + ".exr";
         for (size_t j = 0; j < n.size(); ++j)
             if (n[j] == '/')
@@ -510,4 +719,145 @@ void StatsAccumulator::Clear() {
     stats->ratios.clear();
 }
 
+// EntityStatsRecord Definition
+struct EntityStatsRecord {
+    const char *kind;
+    std::string name, loc;
+    double seconds;
+    int64_t bytes;
+};
+
+// Entity Statistics Local Variables
+static std::atomic<bool> entityStatsEnabled{false};
+static std::mutex entityStatsMutex;
+static std::vector<EntityStatsRecord> entityStats;
+
+// Entity Statistics Function Definitions
+void EntityStatsInit() {
+    entityStatsEnabled = true;
+}
+
+bool EntityStatsEnabled() {
+    return entityStatsEnabled.load(std::memory_order_relaxed);
+}
+
+EntityStatsScope::EntityStatsScope(const char *kind, std::string_view name,
+                                   const FileLoc *loc, Allocator alloc)
+    : kind(kind), resource(alloc.resource()) {
+    if (!EntityStatsEnabled())
+        return;
+    this->name = std::string(name);
+    if (loc)
+        this->loc = loc->ToString();
+    startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count();
+    // Objects allocated for the entity are freed through _memory_, which
+    // may happen at any time later on, so it is never deleted.
+    memory = new TrackedMemoryResource(resource);
+    resource = memory;
+}
+
+Allocator EntityStatsScope::Alloc() const {
+    return Allocator(resource);
+}
+
+EntityStatsScope::~EntityStatsScope() {
+    if (startTime < 0)
+        return;
+    int64_t endTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+    std::lock_guard<std::mutex> lock(entityStatsMutex);
+    entityStats.push_back(EntityStatsRecord{kind, std::move(name), std::move(loc),
+                                            (endTime - startTime) / 1e9,
+                                            int64_t(memory->CurrentAllocatedBytes())});
+}
+
+void PrintEntityStats(FILE *dest, int count) {
+    std::lock_guard<std::mutex> lock(entityStatsMutex);
+    if (entityStats.empty())
+        return;
+
+    auto printTop = [&](const char *title, auto compare) {
+        std::vector<const EntityStatsRecord *> sorted;
+        for (const EntityStatsRecord &r : entityStats)
+            sorted.push_back(&r);
+        size_t n = std::min<size_t>(count, sorted.size());
+        std::partial_sort(sorted.begin(), sorted.begin() + n, sorted.end(), compare);
+
+        fprintf(dest, "  %s\n", title);
+        for (size_t i = 0; i < n; ++i) {
+            const EntityStatsRecord &r = *sorted[i];
+            fprintf(dest, "    %10.3fs %s  %s \"%s\" %s\n", r.seconds,
+                    printBytes(r.bytes).c_str(), r.kind, r.name.c_str(), r.loc.c_str());
+        }
+    };
+    fprintf(dest, "Scene entities:\n");
+    printTop("Slowest to create",
+             [](const EntityStatsRecord *a, const EntityStatsRecord *b) {
+                 return a->seconds > b->seconds;
+             });
+    printTop("Most memory allocated",
+             [](const EntityStatsRecord *a, const EntityStatsRecord *b) {
+                 return a->bytes > b->bytes;
+             });
+}
+
+// Machine-Readable Statistics Local Variables
+static std::mutex statsJSONMutex;
+static std::map<std::string, std::string> statsJSONValues;
+static std::map<std::string, std::vector<std::string>> statsJSONArrays;
+
+// Machine-Readable Statistics Function Definitions
+void StatsSetJSON(const std::string &key, std::string json) {
+    std::lock_guard<std::mutex> lock(statsJSONMutex);
+    statsJSONValues[key] = std::move(json);
+}
+
+void StatsAppendJSON(const std::string &key, std::string json) {
+    std::lock_guard<std::mutex> lock(statsJSONMutex);
+    statsJSONArrays[key].push_back(std::move(json));
+}
+
+void WriteStatsJSON(const std::string &filename) {
+    // The schema version is incremented whenever existing keys' meanings
+    // change; new keys may be added without changing it.
+    StatsAccumulator accum;
+    MergeThreadStats(&accum);
+    std::string json =
+        StringPrintf("{\n  \"schemaVersion\": 1,\n  \"statsLevel\": \"%s\",\n%s",
+                     ToString(statsLevel), accum.ToJSON());
+
+    std::lock_guard<std::mutex> lock(statsJSONMutex);
+    for (const auto &value : statsJSONValues)
+        json += StringPrintf(",\n  %s: %s", JSONString(value.first), value.second);
+    for (const auto &array : statsJSONArrays) {
+        json += StringPrintf(",\n  %s: [", JSONString(array.first));
+        for (size_t i = 0; i < array.second.size(); ++i)
+            json += StringPrintf("%s\n    %s", i > 0 ? "," : "", array.second[i]);
+        json += "\n  ]";
+    }
+    json += "\n}\n";
+
+    if (!WriteFile(filename, json))
+        Error("%s: unable to write statistics file.", filename);
+}
+
+void WriteEntityStats(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(entityStatsMutex);
+    std::string json = "[\n";
+    for (size_t i = 0; i < entityStats.size(); ++i) {
+        const EntityStatsRecord &r = entityStats[i];
+        json += StringPrintf("  {\"kind\": \"%s\", \"name\": %s, \"loc\": %s, "
+                             "\"seconds\": %.6f, \"bytes\": %d}%s\n",
+                             r.kind, JSONString(r.name), JSONString(r.loc), r.seconds,
+                             r.bytes, i + 1 < entityStats.size() ? "," : "");
+    }
+    json += "]\n";
+
+    if (!WriteFile(filename, json))
+        Error("%s: unable to write entity statistics file.", filename);
+}
+
 }  // namespace pbrt
@@ -10,9 +10,27 @@
 #include <cstdio>
 #include <limits>
 #include <string>
+#include <string_view>
+
+// Statistics are compiled in up to PBRT_STATS_LEVEL: 0 for none of them,
+// 1 for the cheap ones (counters, percentages, and ratios), and 2 for all
+// of them, adding distributions and per-pixel statistics.
+#ifndef PBRT_STATS_LEVEL
+#define PBRT_STATS_LEVEL 2
+#endif
 
 namespace pbrt {
 
+// StatsLevel Definition
+// The statistics that are recorded at run time, up to the ones that are
+// compiled in.
+enum class StatsLevel { Off, Cheap, Full };
+
+StatsLevel StatsLevelFromString(const std::string &s);
+std::string ToString(StatsLevel level);
+
+extern StatsLevel statsLevel;
+
 class StatsAccumulator;
 class PixelStatsAccumulator;
 // StatRegisterer Definition
@@ -28,6 +46,10 @@ class StatRegisterer {
     static void CallPixelCallbacks(const Point2i &p, PixelStatsAccumulator &accum);
 };
 
+// Sets the run-time statistics level and, if _categories_ isn't empty, the
+// comma-separated categories of statistics (e.g., "BVH,Integrator") that
+// are reported.
+void StatsInit(StatsLevel level, const std::string &categories);
 void StatsEnablePixelStats(const Bounds2i &b, const std::string &baseName);
 void StatsReportPixelStart(const Point2i &p);
 void StatsReportPixelEnd(const Point2i &p);
@@ -36,13 +58,68 @@ void PrintStats(FILE *dest);
 void StatsWritePixelImages();
 bool PrintCheckRare(FILE *dest);
 void ClearStats();
+// Adds the calling thread's statistics to its own accumulator without
+// locking; they are merged when they are printed.
 void ReportThreadStats();
+// Returns the accumulated value of the named STAT_COUNTER; threads' values
+// are only included once they have called ReportThreadStats().
+int64_t GetStatsCounter(const std::string &name);
+
+// WriteStatsJSON() writes the statistics in a machine-readable form along
+// with top-level values that other parts of pbrt set or append to (e.g.,
+// the render configuration and the time taken by each startup phase);
+// _json_ must be a JSON value.
+void StatsSetJSON(const std::string &key, std::string json);
+void StatsAppendJSON(const std::string &key, std::string json);
+void WriteStatsJSON(const std::string &filename);
+// Returns _str_ quoted and escaped as a JSON string.
+std::string JSONString(const std::string &str);
+
+// Entity statistics record how long each scene entity (shape, texture,
+// material, included file, ...) took to create and how much memory was
+// allocated for it, so that the most expensive ones can be reported.
+void EntityStatsInit();
+bool EntityStatsEnabled();
+void PrintEntityStats(FILE *dest, int count);
+void WriteEntityStats(const std::string &filename);
+
+class TrackedMemoryResource;
+
+// EntityStatsScope Definition
+// Records the time from construction to destruction for an entity, along
+// with the memory allocated through Alloc() in the meantime that has not
+// been freed. If entity statistics are disabled, Alloc() returns the given
+// allocator and nothing is recorded.
+class EntityStatsScope {
+  public:
+    // EntityStatsScope Public Methods
+    EntityStatsScope(const char *kind, std::string_view name, const FileLoc *loc,
+                     Allocator alloc);
+    ~EntityStatsScope();
+
+    EntityStatsScope(const EntityStatsScope &) = delete;
+    EntityStatsScope &operator=(const EntityStatsScope &) = delete;
+
+    Allocator Alloc() const;
+
+  private:
+    // EntityStatsScope Private Members
+    const char *kind;
+    std::string name, loc;
+    int64_t startTime = -1;
+    TrackedMemoryResource *memory = nullptr;
+    pstd::pmr::memory_resource *resource;
+};
 
 // StatsAccumulator Definition
 class StatsAccumulator {
   public:
     // StatsAccumulator Public Methods
     StatsAccumulator();
+    ~StatsAccumulator();
+
+    StatsAccumulator(const StatsAccumulator &) = delete;
+    StatsAccumulator &operator=(const StatsAccumulator &) = delete;
 
     void ReportCounter(const char *name, int64_t val);
     void ReportMemoryCounter(const char *name, int64_t val);
@@ -56,13 +133,17 @@ class StatsAccumulator {
     void ReportFloatDistribution(const char *name, double sum, int64_t count, double min,
                                  double max);
 
+    void Merge(const StatsAccumulator &accum);
     void AccumulatePixelStats(const PixelStatsAccumulator &accum);
     void WritePixelImages() const;
 
     void Print(FILE *file);
+    std::string ToJSON() const;
     bool PrintCheckRare(FILE *dest);
     void Clear();
 
+    int64_t GetCounter(const std::string &name) const;
+
   private:
     // StatsAccumulator Private Data
     struct Stats;
@@ -85,7 +166,39 @@ class PixelStatsAccumulator {
     PixelStats *stats = nullptr;
 };
 
+// WorkCounters Definition
+// Running per-thread counts of the work done by the CPU renderer, from whose
+// differences the work done for each camera sample is found for the "cost"
+// AOV. They are never reset.
+struct WorkCounters {
+    int64_t rays, nodesVisited, shadowRays, mediumSteps;
+};
+
+extern thread_local WorkCounters threadWorkCounters;
+// The work counters are only updated when these are set. Ray counts are
+// also used for the progress reporter's ray rates, while the counts of BVH
+// nodes visited and medium steps are only used for the "cost" AOV.
+extern bool countRays, countTraversalSteps;
+
+// StatNullCounter Definition
+// The variables of statistics that aren't compiled in have this type, so
+// that the code that updates them compiles to nothing.
+struct StatNullCounter {
+    template <typename T>
+    StatNullCounter &operator=(T) {
+        return *this;
+    }
+    template <typename T>
+    StatNullCounter &operator+=(T) {
+        return *this;
+    }
+    StatNullCounter &operator++() { return *this; }
+    StatNullCounter operator++(int) { return *this; }
+    operator int64_t() const { return 0; }
+};
+
 // Statistics Macros
+#if PBRT_STATS_LEVEL >= 1
 #define STAT_COUNTER(title, var)                                       \
     static thread_local int64_t var;                                   \
     static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) { \
@@ -93,6 +206,39 @@ class PixelStatsAccumulator {
         var = 0;                                                       \
     });
 
+#define STAT_MEMORY_COUNTER(title, var)                                \
+    static thread_local int64_t var;                                   \
+    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) { \
+        accum.ReportMemoryCounter(title, var);                         \
+        var = 0;                                                       \
+    });
+
+#define STAT_PERCENT(title, numVar, denomVar)                             \
+    static thread_local int64_t numVar, denomVar;                         \
+    static StatRegisterer STATS_REG##numVar([](StatsAccumulator &accum) { \
+        accum.ReportPercentage(title, numVar, denomVar);                  \
+        numVar = 0;                                                       \
+        denomVar = 0;                                                     \
+    });
+
+#define STAT_RATIO(title, numVar, denomVar)                               \
+    static thread_local int64_t numVar, denomVar;                         \
+    static StatRegisterer STATS_REG##numVar([](StatsAccumulator &accum) { \
+        accum.ReportRatio(title, numVar, denomVar);                       \
+        numVar = 0;                                                       \
+        denomVar = 0;                                                     \
+    });
+
+#else
+#define STAT_COUNTER(title, var) [[maybe_unused]] static StatNullCounter var;
+#define STAT_MEMORY_COUNTER(title, var) [[maybe_unused]] static StatNullCounter var;
+#define STAT_PERCENT(title, numVar, denomVar) \
+    [[maybe_unused]] static StatNullCounter numVar, denomVar;
+#define STAT_RATIO(title, numVar, denomVar) \
+    [[maybe_unused]] static StatNullCounter numVar, denomVar;
+#endif  // PBRT_STATS_LEVEL >= 1
+
+#if PBRT_STATS_LEVEL >= 2
 #define STAT_PIXEL_COUNTER(title, var)                                         \
     static thread_local int64_t var, var##Sum;                                 \
     static StatRegisterer STATS_REG##var(                                      \
@@ -108,12 +254,24 @@ class PixelStatsAccumulator {
             var = 0;                                                           \
         });
 
-#define STAT_MEMORY_COUNTER(title, var)                                \
-    static thread_local int64_t var;                                   \
-    static StatRegisterer STATS_REG##var([](StatsAccumulator &accum) { \
-        accum.ReportMemoryCounter(title, var);                         \
-        var = 0;                                                       \
-    });
+#define STAT_PIXEL_RATIO(title, numVar, denomVar)                                     \
+    static thread_local int64_t numVar, numVar##Sum, denomVar, denomVar##Sum;         \
+    static StatRegisterer STATS_REG##numVar##denomVar(                                \
+        [](StatsAccumulator &accum) {                                                 \
+            /* report sum, since if disabled, it all just goes into var... */         \
+            accum.ReportRatio(title, numVar + numVar##Sum, denomVar + denomVar##Sum); \
+            numVar = 0;                                                               \
+            numVar##Sum = 0;                                                          \
+            denomVar = 0;                                                             \
+            denomVar##Sum = 0;                                                        \
+        },                                                                            \
+        [](const Point2i &p, int counterIndex, PixelStatsAccumulator &accum) {        \
+            accum.ReportRatio(p, counterIndex, title, numVar, denomVar);              \
+            numVar##Sum += numVar;                                                    \
+            denomVar##Sum += denomVar;                                                \
+            numVar = 0;                                                               \
+            denomVar = 0;                                                             \
+        });
 
 #define STAT_INT_DISTRIBUTION(title, var)                                             \
     static thread_local int64_t var##sum;                                             \
@@ -143,48 +301,28 @@ class PixelStatsAccumulator {
         var##max = StatCounter<double>(std::numeric_limits<double>::lowest());          \
     });
 
-#define STAT_PERCENT(title, numVar, denomVar)                             \
-    static thread_local int64_t numVar, denomVar;                         \
-    static StatRegisterer STATS_REG##numVar([](StatsAccumulator &accum) { \
-        accum.ReportPercentage(title, numVar, denomVar);                  \
-        numVar = 0;                                                       \
-        denomVar = 0;                                                     \
-    });
-
-#define STAT_RATIO(title, numVar, denomVar)                               \
-    static thread_local int64_t numVar, denomVar;                         \
-    static StatRegisterer STATS_REG##numVar([](StatsAccumulator &accum) { \
-        accum.ReportRatio(title, numVar, denomVar);                       \
-        numVar = 0;                                                       \
-        denomVar = 0;                                                     \
-    });
-
-#define STAT_PIXEL_RATIO(title, numVar, denomVar)                                     \
-    static thread_local int64_t numVar, numVar##Sum, denomVar, denomVar##Sum;         \
-    static StatRegisterer STATS_REG##numVar##denomVar(                                \
-        [](StatsAccumulator &accum) {                                                 \
-            /* report sum, since if disabled, it all just goes into var... */         \
-            accum.ReportRatio(title, numVar + numVar##Sum, denomVar + denomVar##Sum); \
-            numVar = 0;                                                               \
-            numVar##Sum = 0;                                                          \
-            denomVar = 0;                                                             \
-            denomVar##Sum = 0;                                                        \
-        },                                                                            \
-        [](const Point2i &p, int counterIndex, PixelStatsAccumulator &accum) {        \
-            accum.ReportRatio(p, counterIndex, title, numVar, denomVar);              \
-            numVar##Sum += numVar;                                                    \
-            denomVar##Sum += denomVar;                                                \
-            numVar = 0;                                                               \
-            denomVar = 0;                                                             \
-        });
+#define ReportValue(var, value)                               \
+    do {                                                      \
+        if (statsLevel == StatsLevel::Full) {                 \
+            var##sum += value;                                \
+            var##count += 1;                                  \
+            var##min = (value < var##min) ? value : var##min; \
+            var##max = (value > var##max) ? value : var##max; \
+        }                                                     \
+    } while (0)
 
-#define ReportValue(var, value)                           \
-    do {                                                  \
-        var##sum += value;                                \
-        var##count += 1;                                  \
-        var##min = (value < var##min) ? value : var##min; \
-        var##max = (value > var##max) ? value : var##max; \
+#else
+// Per-pixel statistics are recorded as regular ones, if those are
+// compiled in, and distributions aren't recorded at all.
+#define STAT_PIXEL_COUNTER(title, var) STAT_COUNTER(title, var)
+#define STAT_PIXEL_RATIO(title, numVar, denomVar) STAT_RATIO(title, numVar, denomVar)
+#define STAT_INT_DISTRIBUTION(title, var)
+#define STAT_FLOAT_DISTRIBUTION(title, var)
+#define ReportValue(var, value) \
+    do {                        \
+        (void)(value);          \
     } while (0)
+#endif  // PBRT_STATS_LEVEL >= 2
 
 }  // namespace pbrt
 
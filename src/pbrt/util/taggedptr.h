@@ -17,97 +17,72 @@
 namespace pbrt {
 
 // TaggedPointer Helper Templates
-template <int n>
-struct DispatchSplit {
-    template <typename F, typename Tp, typename... Ts>
-    PBRT_CPU_GPU inline auto operator()(F func, Tp tp, int tag, TypePack<Ts...> types) {
-        // Recursively consider half of the candidate types depending on _tag_
-        constexpr int mid = n / 2;
-        if (tag - 1 < mid)
-            return DispatchSplit<mid>()(
-                func, tp, tag, typename TakeFirstN<mid, TypePack<Ts...>>::type());
-        else
-            return DispatchSplit<n - mid>()(
-                func, tp, tag - mid, typename RemoveFirstN<mid, TypePack<Ts...>>::type());
-    }
-};
-
-template <>
-struct DispatchSplit<1> {
-    template <typename F, typename Tp, typename... Ts>
-    PBRT_CPU_GPU inline auto operator()(F func, Tp tp, int tag, TypePack<Ts...> types) {
-        DCHECK_EQ(1, tag);
-        static_assert(sizeof...(Ts) == 1);
-        using T = typename GetFirst<TypePack<Ts...>>::type;
-        return func(tp.template Cast<T>());
-    }
-};
-
-// FIXME: can we at least DispatchCRef this from the caller and dispatch based on
-// whether F's return type is a const reference?
-//
-// https://stackoverflow.com/a/41538114 :-p
-
-template <int n>
-struct DispatchSplitCRef;
-
-template <>
-struct DispatchSplitCRef<1> {
-    template <typename F, typename Tp, typename... Ts>
-    PBRT_CPU_GPU inline auto operator()(F func, Tp tp, int tag, TypePack<Ts...> types)
-        -> auto && {
-        DCHECK_EQ(1, tag);
-        static_assert(sizeof...(Ts) == 1);
-        using T = typename GetFirst<TypePack<Ts...>>::type;
-        return func(tp.template Cast<T>());
-    }
-};
-
-template <int n>
-struct DispatchSplitCRef {
-    template <typename F, typename Tp, typename... Ts>
-    PBRT_CPU_GPU inline auto operator()(F func, Tp tp, int tag, TypePack<Ts...> types)
-        -> auto && {
-        constexpr int mid = n / 2;
-
-        if (tag - 1 < mid)  // 0-based indexing here to be more traditional
-            return DispatchSplitCRef<mid>()(
-                func, tp, tag, typename TakeFirstN<mid, TypePack<Ts...>>::type());
-        else
-            return DispatchSplitCRef<n - mid>()(
-                func, tp, tag - mid, typename RemoveFirstN<mid, TypePack<Ts...>>::type());
-    }
-};
-
-template <int n>
-struct DispatchSplitCPU;
-
-template <>
-struct DispatchSplitCPU<1> {
-    template <typename F, typename Tp, typename... Ts>
-    inline auto operator()(F func, Tp tp, int tag, TypePack<Ts...> types) {
-        DCHECK_EQ(1, tag);
-        static_assert(sizeof...(Ts) == 1);
-
-        using T = typename GetFirst<TypePack<Ts...>>::type;
-        return func(tp.template Cast<T>());
+// Returns the _i_th type of _Ts_, clamped to the last one so that the unused
+// cases of the fixed-size switches below still name a valid type.
+template <int i, typename... Ts>
+using DispatchType = typename GetFirst<typename RemoveFirstN<
+    std::min<int>(i, sizeof...(Ts) - 1), TypePack<Ts...>>::type>::type;
+
+// Dispatch is done with a flat switch over (up to) eight types at a time, which
+// compilers turn into a jump table; larger type lists are handled by
+// continuing with the next eight types in the _default_ case.
+template <typename R, int base, typename F, typename Tp, typename... Ts>
+PBRT_CPU_GPU inline R DispatchSwitch(F &func, Tp tp, int tag, TypePack<Ts...> types) {
+    constexpr int n = sizeof...(Ts);
+    switch (tag - base) {
+    case 1:
+        return func(tp.template Cast<DispatchType<0, Ts...>>());
+    case 2:
+        return func(tp.template Cast<DispatchType<1, Ts...>>());
+    case 3:
+        return func(tp.template Cast<DispatchType<2, Ts...>>());
+    case 4:
+        return func(tp.template Cast<DispatchType<3, Ts...>>());
+    case 5:
+        return func(tp.template Cast<DispatchType<4, Ts...>>());
+    case 6:
+        return func(tp.template Cast<DispatchType<5, Ts...>>());
+    case 7:
+        return func(tp.template Cast<DispatchType<6, Ts...>>());
+    default:
+        if constexpr (n > 8) {
+            if (tag - base > 8)
+                return DispatchSwitch<R, base + 8>(
+                    func, tp, tag, typename RemoveFirstN<8, TypePack<Ts...>>::type());
+        }
+        DCHECK_EQ(tag - base, std::min(n, 8));
+        return func(tp.template Cast<DispatchType<7, Ts...>>());
     }
-};
-
-template <int n>
-struct DispatchSplitCPU {
-    template <typename F, typename Tp, typename... Ts>
-    inline auto operator()(F func, Tp tp, int tag, TypePack<Ts...> types) {
-        constexpr int mid = n / 2;
-
-        if (tag - 1 < mid)  // 0-based indexing here to be more traditional
-            return DispatchSplitCPU<mid>()(
-                func, tp, tag, typename TakeFirstN<mid, TypePack<Ts...>>::type());
-        else
-            return DispatchSplitCPU<n - mid>()(
-                func, tp, tag - mid, typename RemoveFirstN<mid, TypePack<Ts...>>::type());
+}
+
+template <typename R, int base, typename F, typename Tp, typename... Ts>
+inline R DispatchSwitchCPU(F &func, Tp tp, int tag, TypePack<Ts...> types) {
+    constexpr int n = sizeof...(Ts);
+    switch (tag - base) {
+    case 1:
+        return func(tp.template Cast<DispatchType<0, Ts...>>());
+    case 2:
+        return func(tp.template Cast<DispatchType<1, Ts...>>());
+    case 3:
+        return func(tp.template Cast<DispatchType<2, Ts...>>());
+    case 4:
+        return func(tp.template Cast<DispatchType<3, Ts...>>());
+    case 5:
+        return func(tp.template Cast<DispatchType<4, Ts...>>());
+    case 6:
+        return func(tp.template Cast<DispatchType<5, Ts...>>());
+    case 7:
+        return func(tp.template Cast<DispatchType<6, Ts...>>());
+    default:
+        if constexpr (n > 8) {
+            if (tag - base > 8)
+                return DispatchSwitchCPU<R, base + 8>(
+                    func, tp, tag, typename RemoveFirstN<8, TypePack<Ts...>>::type());
+        }
+        DCHECK_EQ(tag - base, std::min(n, 8));
+        return func(tp.template Cast<DispatchType<7, Ts...>>());
     }
-};
+}
 
 // TaggedPointer Definition
 template <typename... Ts>
@@ -210,42 +185,67 @@ class TaggedPointer {
     template <typename F>
     PBRT_CPU_GPU inline auto Dispatch(F func) {
         DCHECK(ptr() != nullptr);
-        return DispatchSplit<MaxTag()>()(func, *this, Tag(), Types());
+        using R = std::decay_t<DispatchResult<F>>;
+        return DispatchSwitch<R, 0>(func, *this, Tag(), Types());
     }
 
     template <typename F>
     PBRT_CPU_GPU inline auto Dispatch(F func) const {
         DCHECK(ptr() != nullptr);
-        constexpr int n = MaxTag();
-        return DispatchSplit<n>()(func, *this, Tag(), Types());
+        using R = std::decay_t<DispatchResult<F>>;
+        return DispatchSwitch<R, 0>(func, *this, Tag(), Types());
     }
 
     template <typename F>
     PBRT_CPU_GPU inline auto DispatchCRef(F func) -> auto && {
         DCHECK(ptr() != nullptr);
-        constexpr int n = MaxTag();
-        return DispatchSplitCRef<n>()(func, *this, Tag(), Types());
+        return DispatchSwitch<DispatchResult<F>, 0>(func, *this, Tag(), Types());
     }
 
     template <typename F>
     PBRT_CPU_GPU inline auto DispatchCRef(F func) const -> auto && {
         DCHECK(ptr() != nullptr);
-        constexpr int n = MaxTag();
-        return DispatchSplitCRef<n>()(func, *this, Tag(), Types());
+        return DispatchSwitch<DispatchResult<F>, 0>(func, *this, Tag(), Types());
     }
 
     template <typename F>
     inline auto DispatchCPU(F func) {
         DCHECK(ptr() != nullptr);
-        constexpr int n = MaxTag();
-        return DispatchSplitCPU<n>()(func, *this, Tag(), Types());
+        using R = std::decay_t<DispatchResult<F>>;
+        return DispatchSwitchCPU<R, 0>(func, *this, Tag(), Types());
     }
 
     template <typename F>
     inline auto DispatchCPU(F func) const {
         DCHECK(ptr() != nullptr);
-        constexpr int n = MaxTag();
-        return DispatchSplitCPU<n>()(func, *this, Tag(), Types());
+        using R = std::decay_t<DispatchResult<F>>;
+        return DispatchSwitchCPU<R, 0>(func, *this, Tag(), Types());
+    }
+
+    // Hot call sites that know (e.g., from the scene description) that only
+    // the types _Us_ are likely to be present can use DispatchLikely() to test
+    // for them directly; the call to _func_ can then be inlined without going
+    // through the full switch, which is only used as a fallback.
+    template <typename U, typename... Us, typename F>
+    PBRT_CPU_GPU inline auto DispatchLikely(F func) {
+        DCHECK(ptr() != nullptr);
+        if (Is<U>())
+            return func(Cast<U>());
+        if constexpr (sizeof...(Us) > 0)
+            return DispatchLikely<Us...>(func);
+        else
+            return Dispatch(func);
+    }
+
+    template <typename U, typename... Us, typename F>
+    PBRT_CPU_GPU inline auto DispatchLikely(F func) const {
+        DCHECK(ptr() != nullptr);
+        if (Is<U>())
+            return func(TaggedPointer(*this).template Cast<U>());
+        if constexpr (sizeof...(Us) > 0)
+            return DispatchLikely<Us...>(func);
+        else
+            return Dispatch(func);
     }
 
     template <typename F>
@@ -254,6 +254,11 @@ class TaggedPointer {
     }
 
   private:
+    // Type returned by calling _func_ with a pointer to the first type
+    template <typename F>
+    using DispatchResult = decltype(std::declval<F &>()(
+        std::declval<TaggedPointer &>().template Cast<typename GetFirst<Types>::type>()));
+
     static_assert(sizeof(uintptr_t) == 8, "Expected uintptr_t to be 64 bits");
     // TaggedPointer Private Members
     static constexpr int tagShift = 48;
@@ -232,3 +232,36 @@ TEST(TaggedPointer, Dispatch) {
     ASSERT_EQ(14, it14.cfunc());
     EXPECT_EQ(14, h14.cfunc());
 }
+
+TEST(TaggedPointer, DispatchSwitch) {
+    // Exercise type lists on either side of the eight-way switch boundary.
+    using Handle8 = TaggedPointer<IntType<0>, IntType<1>, IntType<2>, IntType<3>,
+                                  IntType<4>, IntType<5>, IntType<6>, IntType<7>>;
+    using Handle9 = TaggedPointer<IntType<0>, IntType<1>, IntType<2>, IntType<3>,
+                                  IntType<4>, IntType<5>, IntType<6>, IntType<7>,
+                                  IntType<8>>;
+    using Handle2 = TaggedPointer<IntType<0>, IntType<1>>;
+    auto f = [](auto ptr) { return ptr->func(); };
+
+    IntType<1> it1;
+    IntType<7> it7;
+    IntType<8> it8;
+    EXPECT_EQ(1, Handle2(&it1).Dispatch(f));
+    EXPECT_EQ(1, Handle8(&it1).Dispatch(f));
+    EXPECT_EQ(7, Handle8(&it7).Dispatch(f));
+    EXPECT_EQ(7, Handle9(&it7).Dispatch(f));
+    EXPECT_EQ(8, Handle9(&it8).Dispatch(f));
+    EXPECT_EQ(8, Handle(&it8).Dispatch(f));
+}
+
+TEST(TaggedPointer, DispatchLikely) {
+    auto f = [](auto ptr) { return ptr->cfunc(); };
+
+    IntType<3> it3;
+    IntType<12> it12;
+    const Handle h3(&it3), h12(&it12);
+    EXPECT_EQ(3, h3.DispatchLikely<IntType<3>>(f));
+    EXPECT_EQ(3, h3.DispatchLikely<IntType<12>>(f));
+    EXPECT_EQ(12, (h12.DispatchLikely<IntType<3>, IntType<12>>(f)));
+    EXPECT_EQ(12, (h12.DispatchLikely<IntType<0>, IntType<1>>(f)));
+}
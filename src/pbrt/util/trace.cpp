@@ -0,0 +1,166 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <pbrt/util/trace.h>
+
+#include <pbrt/util/error.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/print.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pbrt {
+
+// TraceRecord Definition
+struct TraceRecord {
+    const char *name, *category;
+    int64_t startTime, endTime;
+    int64_t arg;
+};
+
+// AnnotatedTraceRecord Definition
+struct AnnotatedTraceRecord {
+    const char *name, *category;
+    int threadIndex;
+    int64_t startTime, endTime;
+    std::vector<std::pair<const char *, int64_t>> args;
+};
+
+// ThreadTraceBuffer Definition
+struct ThreadTraceBuffer {
+    static constexpr int Capacity = 1 << 16;
+
+    ThreadTraceBuffer(int threadIndex) : threadIndex(threadIndex), records(Capacity) {}
+
+    int threadIndex;
+    std::vector<TraceRecord> records;
+    // Updated with release semantics after each record is written so that
+    // _WriteTrace()_ can run while other threads are still recording.
+    std::atomic<int64_t> nRecords{0};
+};
+
+// Tracing Local Variables
+std::atomic<bool> tracingEnabled{false};
+static std::chrono::steady_clock::time_point traceStartTime;
+static std::mutex traceBuffersMutex;
+static std::vector<std::unique_ptr<ThreadTraceBuffer>> traceBuffers;
+static std::vector<AnnotatedTraceRecord> annotatedRecords;
+// Incremented by _TraceInit()_ so that threads don't use buffers from
+// an earlier trace.
+static std::atomic<int> traceGeneration{0};
+static thread_local ThreadTraceBuffer *threadTraceBuffer;
+static thread_local int threadTraceGeneration = -1;
+
+// Tracing Function Definitions
+void TraceInit() {
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    traceBuffers.clear();
+    annotatedRecords.clear();
+    ++traceGeneration;
+    traceStartTime = std::chrono::steady_clock::now();
+    tracingEnabled = true;
+}
+
+void TraceCleanup() {
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    tracingEnabled = false;
+    traceBuffers.clear();
+    annotatedRecords.clear();
+}
+
+int64_t TraceTimestamp() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - traceStartTime)
+        .count();
+}
+
+void TraceEvent(const char *name, const char *category, int64_t startTime,
+                int64_t endTime, int64_t arg) {
+    if (!TracingEnabled())
+        return;
+    // Allocate a trace buffer for the calling thread if needed
+    if (threadTraceGeneration != traceGeneration) {
+        std::lock_guard<std::mutex> lock(traceBuffersMutex);
+        traceBuffers.push_back(std::make_unique<ThreadTraceBuffer>(ThreadIndex));
+        threadTraceBuffer = traceBuffers.back().get();
+        threadTraceGeneration = traceGeneration;
+    }
+
+    // Add the event to the buffer, overwriting the oldest one if it is full
+    ThreadTraceBuffer *buffer = threadTraceBuffer;
+    int64_t index = buffer->nRecords.load(std::memory_order_relaxed);
+    buffer->records[index % ThreadTraceBuffer::Capacity] =
+        TraceRecord{name, category, startTime, endTime, arg};
+    buffer->nRecords.store(index + 1, std::memory_order_release);
+}
+
+void TraceAnnotatedEvent(const char *name, const char *category, int threadIndex,
+                         int64_t startTime, int64_t endTime,
+                         std::vector<std::pair<const char *, int64_t>> args) {
+    if (!TracingEnabled())
+        return;
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    annotatedRecords.push_back(
+        {name, category, threadIndex, startTime, endTime, std::move(args)});
+}
+
+void WriteTrace(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(traceBuffersMutex);
+    std::string json = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    auto addEvent = [&](const std::string &event) {
+        if (!first)
+            json += ",\n";
+        json += event;
+        first = false;
+    };
+
+    int64_t nDropped = 0;
+    for (const auto &buffer : traceBuffers) {
+        // Name the thread and add its events in the order they were recorded
+        addEvent(StringPrintf("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, "
+                              "\"tid\": %d, \"args\": {\"name\": \"Thread %d\"}}",
+                              buffer->threadIndex, buffer->threadIndex));
+        // Skip the oldest record of a full buffer, which may be overwritten next
+        int64_t nRecords = buffer->nRecords.load(std::memory_order_acquire);
+        int64_t start = std::max<int64_t>(0, nRecords - ThreadTraceBuffer::Capacity + 1);
+        nDropped += start;
+        for (int64_t i = start; i < nRecords; ++i) {
+            const TraceRecord &r = buffer->records[i % ThreadTraceBuffer::Capacity];
+            std::string event = StringPrintf(
+                "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, "
+                "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                r.name, r.category, buffer->threadIndex, r.startTime / 1000.,
+                (r.endTime - r.startTime) / 1000.);
+            if (r.arg >= 0)
+                event += StringPrintf(", \"args\": {\"index\": %d}", r.arg);
+            addEvent(event + "}");
+        }
+    }
+    for (const AnnotatedTraceRecord &r : annotatedRecords) {
+        std::string event = StringPrintf(
+            "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, "
+            "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+            r.name, r.category, r.threadIndex, r.startTime / 1000.,
+            (r.endTime - r.startTime) / 1000.);
+        for (size_t i = 0; i < r.args.size(); ++i)
+            event += StringPrintf("%s\"%s\": %d", i > 0 ? ", " : "", r.args[i].first,
+                                  r.args[i].second);
+        addEvent(event + "}}");
+    }
+    json += "\n]}\n";
+
+    if (nDropped > 0)
+        Warning("%d trace events were dropped from full per-thread buffers.", nDropped);
+    if (!WriteFile(filename, json))
+        Error("%s: unable to write trace file.", filename);
+}
+
+}  // namespace pbrt
@@ -0,0 +1,73 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#ifndef PBRT_UTIL_TRACE_H
+#define PBRT_UTIL_TRACE_H
+
+#include <pbrt/pbrt.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace pbrt {
+
+// Timeline tracing records when each thread starts and finishes units of
+// work into a fixed-size per-thread ring buffer, so that the most recent
+// events can be written out in the Chrome trace event format and viewed
+// with chrome://tracing or Perfetto.
+
+// Tracing Function Declarations
+void TraceInit();
+void TraceCleanup();
+void WriteTrace(const std::string &filename);
+
+// Tracing Global Variables
+extern std::atomic<bool> tracingEnabled;
+
+// Tracing Inline Functions
+inline bool TracingEnabled() {
+    return tracingEnabled.load(std::memory_order_relaxed);
+}
+
+int64_t TraceTimestamp();
+// _name_ and _category_ must be string literals or otherwise outlive the
+// trace, since only the pointers are stored.
+void TraceEvent(const char *name, const char *category, int64_t startTime,
+                int64_t endTime, int64_t arg = -1);
+// Records a rare event on behalf of the given thread with named integer
+// arguments; unlike _TraceEvent()_ events, these are never dropped.
+void TraceAnnotatedEvent(const char *name, const char *category, int threadIndex,
+                         int64_t startTime, int64_t endTime,
+                         std::vector<std::pair<const char *, int64_t>> args);
+
+// TraceScope Definition
+class TraceScope {
+  public:
+    // TraceScope Public Methods
+    TraceScope(const char *name, const char *category, int64_t arg = -1)
+        : name(name), category(category), arg(arg) {
+        if (TracingEnabled())
+            startTime = TraceTimestamp();
+    }
+    ~TraceScope() {
+        if (startTime >= 0)
+            TraceEvent(name, category, startTime, TraceTimestamp(), arg);
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+  private:
+    // TraceScope Private Members
+    const char *name, *category;
+    int64_t arg;
+    int64_t startTime = -1;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_UTIL_TRACE_H
@@ -0,0 +1,46 @@
+// pbrt is Copyright(c) 1998-2020 Matt Pharr, Wenzel Jakob, and Greg Humphreys.
+// The pbrt source code is licensed under the Apache License, Version 2.0.
+// SPDX: Apache-2.0
+
+#include <gtest/gtest.h>
+
+#include <pbrt/pbrt.h>
+#include <pbrt/util/file.h>
+#include <pbrt/util/parallel.h>
+#include <pbrt/util/trace.h>
+
+#include <cstdio>
+#include <string>
+
+using namespace pbrt;
+
+static std::string inTestDir(const std::string &path) {
+    return path;
+}
+
+TEST(Trace, Disabled) {
+    EXPECT_FALSE(TracingEnabled());
+    { TraceScope trace("Test", "Test"); }
+    EXPECT_FALSE(TracingEnabled());
+}
+
+TEST(Trace, WriteChromeTrace) {
+    TraceInit();
+    EXPECT_TRUE(TracingEnabled());
+    {
+        TraceScope trace("Outer scope", "Test", 7);
+        ParallelFor(0, 1000, [](int64_t) {});
+    }
+    std::string fn = inTestDir("trace_test.json");
+    WriteTrace(fn);
+    TraceCleanup();
+    EXPECT_FALSE(TracingEnabled());
+
+    std::string contents = ReadFileContents(fn);
+    EXPECT_EQ(0, contents.find("{\"displayTimeUnit\": \"ms\", \"traceEvents\": ["));
+    EXPECT_NE(std::string::npos, contents.find("\"name\": \"Outer scope\""));
+    EXPECT_NE(std::string::npos, contents.find("\"args\": {\"index\": 7}"));
+    EXPECT_NE(std::string::npos, contents.find("\"name\": \"ParallelFor\""));
+    EXPECT_NE(std::string::npos, contents.find("\"ph\": \"M\""));
+    EXPECT_EQ(0, remove(fn.c_str()));
+}
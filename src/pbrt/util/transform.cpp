@@ -8,6 +8,7 @@
 #include <pbrt/util/check.h>
 #include <pbrt/util/error.h>
 #include <pbrt/util/math.h>
+#include <pbrt/util/parallel.h>
 #include <pbrt/util/print.h>
 
 #include <algorithm>
@@ -133,6 +134,18 @@ SquareMatrix<4> persp(1, 0,           0,              0,
     return Scale(invTanAng, invTanAng, 1) * Transform(persp);
 }
 
+// Transform Local Functions
+// Calls _func_ for ranges of the given number of items, in parallel if there
+// are enough of them
+template <typename F>
+static void ForEachRange(size_t n, F func) {
+    constexpr int64_t grainSize = 16384;
+    if (int64_t(n) <= grainSize)
+        func(0, n);
+    else
+        ParallelFor(0, n, grainSize, func);
+}
+
 // Transform Method Definitions
 Bounds3f Transform::operator()(const Bounds3f &b) const {
     Bounds3f bt;
@@ -229,6 +242,38 @@ void Transform::Decompose(Vector3f *T, SquareMatrix<4> *R, SquareMatrix<4> *S) c
     *S = *Inverse(*R) * M;
 }
 
+void Transform::ApplyInPlace(pstd::span<Point3f> p) const {
+    if (!AffineTransform::IsAffine(m)) {
+        for (Point3f &pt : p)
+            pt = (*this)(pt);
+        return;
+    }
+    // Apply the affine transformation with straight-line code that the
+    // compiler can vectorize
+    AffineTransform t(m);
+    ForEachRange(p.size(), [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i)
+            p[i] = t(p[i]);
+    });
+}
+
+void Transform::ApplyInPlace(pstd::span<Vector3f> v) const {
+    AffineTransform t(m);
+    ForEachRange(v.size(), [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i)
+            v[i] = t(v[i]);
+    });
+}
+
+void Transform::ApplyInPlace(pstd::span<Normal3f> n) const {
+    // Normals are transformed by the transpose of the inverse matrix
+    AffineTransform t(Transpose(mInv));
+    ForEachRange(n.size(), [&](int64_t start, int64_t end) {
+        for (int64_t i = start; i < end; ++i)
+            n[i] = Normal3f(t(Vector3f(n[i])));
+    });
+}
+
 SurfaceInteraction Transform::operator()(const SurfaceInteraction &si) const {
     SurfaceInteraction ret;
     const Transform &t = *this;
@@ -1079,8 +1124,36 @@ Transform AnimatedTransform::Interpolate(Float time) const {
     // Interpolate scale at _dt_
     SquareMatrix<4> scale = (1 - dt) * S[0] + dt * S[1];
 
-    // Return interpolated matrix as product of interpolated components
-    return Translate(trans) * Transform(rotate) * Transform(scale);
+    // Find inverse of upper 3x3 block of interpolated scale
+    SquareMatrix<3> scale3(scale[0][0], scale[0][1], scale[0][2], scale[1][0],
+                           scale[1][1], scale[1][2], scale[2][0], scale[2][1],
+                           scale[2][2]);
+    pstd::optional<SquareMatrix<3>> scale3Inv = Inverse(scale3);
+    Float w = scale[3][3];
+    if (!scale3Inv || w == 0 || scale[0][3] != 0 || scale[1][3] != 0 ||
+        scale[2][3] != 0 || scale[3][0] != 0 || scale[3][1] != 0 || scale[3][2] != 0)
+        // Return interpolated matrix as product of interpolated components
+        return Translate(trans) * Transform(rotate) * Transform(scale);
+
+    // Compute interpolated matrix and its inverse directly from components;
+    // the rotation's inverse is its transpose and the scale's comes from its
+    // 3x3 block, which is much less work than inverting their product.
+    SquareMatrix<4> rotation = Transform(rotate).GetMatrix();
+    SquareMatrix<4> m = rotation * scale;
+    SquareMatrix<4> mInv;
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            mInv[i][j] = 0;
+            for (int k = 0; k < 3; ++k)
+                mInv[i][j] += (*scale3Inv)[i][k] * rotation[j][k];
+        }
+        m[i][3] = trans[i] * w;
+    }
+    for (int i = 0; i < 3; ++i)
+        mInv[i][3] = -(mInv[i][0] * trans.x + mInv[i][1] * trans.y +
+                       mInv[i][2] * trans.z);
+    mInv[3][3] = 1 / w;
+    return Transform(m, mInv);
 }
 
 Bounds3f AnimatedTransform::MotionBounds(const Bounds3f &b) const {
@@ -121,6 +121,12 @@ class Transform {
 
     void Decompose(Vector3f *T, SquareMatrix<4> *R, SquareMatrix<4> *S) const;
 
+    // Transform all of the given points, vectors, or normals in place; long
+    // spans are split into chunks that are transformed in parallel.
+    void ApplyInPlace(pstd::span<Point3f> p) const;
+    void ApplyInPlace(pstd::span<Vector3f> v) const;
+    void ApplyInPlace(pstd::span<Normal3f> n) const;
+
     PBRT_CPU_GPU
     Interaction operator()(const Interaction &in) const;
     PBRT_CPU_GPU
@@ -444,6 +450,65 @@ inline RayDifferential Transform::ApplyInverse(const RayDifferential &r,
     return ret;
 }
 
+// AffineTransform Definition
+// Holds the top three rows of an affine transformation's matrix, which is
+// all that is needed to apply it; it is used where many points or rays are
+// transformed, or where many transformations are stored.
+class AffineTransform {
+  public:
+    // AffineTransform Public Methods
+    AffineTransform() = default;
+    PBRT_CPU_GPU
+    explicit AffineTransform(const SquareMatrix<4> &mat) {
+        for (int i = 0; i < 3; ++i)
+            for (int j = 0; j < 4; ++j)
+                m[i][j] = mat[i][j];
+    }
+
+    PBRT_CPU_GPU
+    static bool IsAffine(const SquareMatrix<4> &mat) {
+        return mat[3][0] == 0 && mat[3][1] == 0 && mat[3][2] == 0 && mat[3][3] == 1;
+    }
+
+    PBRT_CPU_GPU
+    Point3f operator()(Point3f p) const {
+        return Point3f(m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                       m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                       m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]);
+    }
+    PBRT_CPU_GPU
+    Vector3f operator()(Vector3f v) const {
+        return Vector3f(m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+                        m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+                        m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z);
+    }
+
+    // Transforms the ray, offsetting its origin past the error bounds of the
+    // transformed origin as _Transform_ does
+    PBRT_CPU_GPU
+    Ray operator()(const Ray &r, Float *tMax) const {
+        Point3f o;
+        Vector3f d, oError;
+        for (int i = 0; i < 3; ++i) {
+            o[i] = (m[i][0] * r.o.x + m[i][1] * r.o.y) + (m[i][2] * r.o.z + m[i][3]);
+            d[i] = m[i][0] * r.d.x + m[i][1] * r.d.y + m[i][2] * r.d.z;
+            oError[i] =
+                gamma(3) * (std::abs(m[i][0] * r.o.x) + std::abs(m[i][1] * r.o.y) +
+                            std::abs(m[i][2] * r.o.z) + std::abs(m[i][3]));
+        }
+        if (Float lengthSquared = LengthSquared(d); lengthSquared > 0) {
+            Float dt = Dot(Abs(d), oError) / lengthSquared;
+            o += d * dt;
+            if (tMax)
+                *tMax -= dt;
+        }
+        return Ray(o, d, r.time, r.medium);
+    }
+
+    // AffineTransform Public Members
+    Float m[3][4];
+};
+
 // AnimatedTransform Definition
 class AnimatedTransform {
   public:
@@ -526,7 +591,7 @@ class AnimatedTransform {
     Vector3f T[2];
     Quaternion R[2];
     SquareMatrix<4> S[2];
-    bool hasRotation;
+    bool hasRotation = false;
     struct DerivativeTerm {
         PBRT_CPU_GPU
         DerivativeTerm() {}
@@ -71,6 +71,53 @@ TEST(AnimatedTransform, Randoms) {
     }
 }
 
+TEST(AnimatedTransform, InterpolatedInverse) {
+    RNG rng;
+    for (int i = 0; i < 200; ++i) {
+        AnimatedTransform at(RandomTransform(rng), 0., RandomTransform(rng), 1.);
+        for (int j = 0; j < 10; ++j) {
+            // The interpolated transform's inverse should match the one
+            // found by inverting its matrix.
+            Transform tr = at.Interpolate(rng.Uniform<Float>());
+            pstd::optional<SquareMatrix<4>> mInv = Inverse(tr.GetMatrix());
+            ASSERT_TRUE(mInv.has_value());
+            for (int r = 0; r < 4; ++r)
+                for (int c = 0; c < 4; ++c)
+                    EXPECT_NEAR((*mInv)[r][c], tr.GetInverseMatrix()[r][c],
+                                1e-3 * std::max<Float>(1, std::abs((*mInv)[r][c])));
+        }
+    }
+}
+
+TEST(Transform, ApplyInPlace) {
+    RNG rng;
+    for (int i = 0; i < 20; ++i) {
+        Transform t = RandomTransform(rng);
+        std::vector<Point3f> p(100);
+        std::vector<Vector3f> v(100);
+        std::vector<Normal3f> n(100);
+        for (int j = 0; j < 100; ++j) {
+            Vector3f r(rng.Uniform<Float>(), rng.Uniform<Float>(), rng.Uniform<Float>());
+            p[j] = Point3f(r);
+            v[j] = 2 * r;
+            n[j] = Normal3f(3 * r);
+        }
+        std::vector<Point3f> pt = p;
+        std::vector<Vector3f> vt = v;
+        std::vector<Normal3f> nt = n;
+        t.ApplyInPlace(pstd::span<Point3f>(pt));
+        t.ApplyInPlace(pstd::span<Vector3f>(vt));
+        t.ApplyInPlace(pstd::span<Normal3f>(nt));
+        // Allow for the compiler evaluating the two differently
+        auto tolerance = [](auto v) { return 1e-5f * std::max<Float>(1, Length(v)); };
+        for (int j = 0; j < 100; ++j) {
+            EXPECT_LE(Length(t(p[j]) - pt[j]), tolerance(Vector3f(pt[j])));
+            EXPECT_LE(Length(t(v[j]) - vt[j]), tolerance(vt[j]));
+            EXPECT_LE(Length(t(n[j]) - nt[j]), tolerance(nt[j]));
+        }
+    }
+}
+
 TEST(RotateFromTo, Simple) {
     {
     // Same directions...